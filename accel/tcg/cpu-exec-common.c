@@ -52,6 +52,10 @@ uint32_t curr_cflags(CPUState *cpu)
         cflags |= CF_NO_GOTO_TB | 1;
     } else if (qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
         cflags |= CF_NO_GOTO_TB;
+#ifdef XBOX
+    } else if (qatomic_read(&tb_chain_disabled)) {
+        cflags |= CF_NO_GOTO_TB;
+#endif
     }
 
     return cflags;
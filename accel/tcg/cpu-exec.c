@@ -40,6 +40,10 @@
 #include "exec/replay-core.h"
 #include "system/tcg.h"
 #include "exec/helper-proto-common.h"
+#ifdef XBOX
+#include "accel/tcg/probe.h"
+#include "exec/tlb-flags.h"
+#endif
 #include "tcg-accel-ops.h"
 #include "tb-jmp-cache.h"
 #include "tb-hash.h"
@@ -1069,6 +1073,57 @@ int cpu_exec(CPUState *cpu)
     return ret;
 }
 
+#ifdef XBOX
+/*
+ * Translate a block ahead of its first execution. The guest code is only
+ * read once both ends of it are known to be mapped, so this never raises a
+ * guest exception; blocks whose code no longer hashes to @ihash are skipped.
+ */
+bool tb_prewarm(CPUState *cpu, TCGTBCPUState s, uint32_t size, uint64_t ihash)
+{
+    CPUArchState *env = cpu_env(cpu);
+    int mmu_idx = cpu_mmu_index(cpu, true);
+    int exception_index = cpu->exception_index;
+    bool done = false;
+    void *host;
+
+    if (probe_access_flags(env, s.pc, 1, MMU_INST_FETCH, mmu_idx, true,
+                           &host, 0) & (TLB_INVALID_MASK | TLB_MMIO)) {
+        return false;
+    }
+    if (probe_access_flags(env, s.pc + size - 1, 1, MMU_INST_FETCH, mmu_idx,
+                           true, &host, 0) & (TLB_INVALID_MASK | TLB_MMIO)) {
+        return false;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    if (tb_htable_lookup(cpu, s)) {
+        return true;
+    }
+    if (tb_code_hash_func(env, s.pc, size) != ihash) {
+        return false;
+    }
+
+    current_cpu = cpu;
+    cpu_exec_start(cpu);
+    if (sigsetjmp(cpu->jmp_env, 0) == 0) {
+        mmap_lock();
+        tb_gen_code(cpu, s);
+        mmap_unlock();
+        done = true;
+    } else {
+        /* Only a code buffer flush can get here; let the exec loop do it */
+        cpu_exec_longjmp_cleanup(cpu);
+        if (cpu->exception_index != EXCP_INTERRUPT) {
+            cpu->exception_index = exception_index;
+        }
+    }
+    cpu_exec_end(cpu);
+
+    return done;
+}
+#endif
+
 bool tcg_exec_realizefn(CPUState *cpu, Error **errp)
 {
     static bool tcg_target_initialized;
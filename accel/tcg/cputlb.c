@@ -938,6 +938,64 @@ void tlb_reset_dirty(CPUState *cpu, uintptr_t start, uintptr_t length)
     qemu_spin_unlock(&cpu->neg.tlb.c.lock);
 }
 
+#ifdef XBOX
+/* Called with tlb_c.lock held */
+static bool tlb_flush_host_range_locked(CPUTLBEntry *ent,
+                                        uintptr_t start, uintptr_t length)
+{
+    vaddr page;
+
+    if (!(ent->addr_read & TLB_INVALID_MASK)) {
+        page = ent->addr_read;
+    } else if (!(ent->addr_write & TLB_INVALID_MASK)) {
+        page = ent->addr_write;
+    } else if (!(ent->addr_code & TLB_INVALID_MASK)) {
+        page = ent->addr_code;
+    } else {
+        return false;
+    }
+
+    uintptr_t host = (page & TARGET_PAGE_MASK) + ent->addend;
+    if (host - start < length) {
+        memset(ent, -1, sizeof(*ent));
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Flush the entries of every mmu_idx that map host memory in
+ * [start, start + length), whatever guest pages alias it. Lets changes to
+ * memory access callbacks take effect without a full flush. Must be called
+ * from the vCPU itself or with all vCPUs stopped.
+ */
+void tlb_flush_host_range(CPUState *cpu, uintptr_t start, uintptr_t length)
+{
+    int mmu_idx;
+
+    qemu_spin_lock(&cpu->neg.tlb.c.lock);
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+        CPUTLBDescFast *fast = cpu_tlb_fast(cpu, mmu_idx);
+        unsigned int n = tlb_n_entries(fast);
+        unsigned int i;
+
+        for (i = 0; i < n; i++) {
+            if (tlb_flush_host_range_locked(&fast->table[i], start, length)) {
+                tlb_n_used_entries_dec(cpu, mmu_idx);
+            }
+        }
+
+        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+            if (tlb_flush_host_range_locked(&desc->vtable[i], start, length)) {
+                tlb_n_used_entries_dec(cpu, mmu_idx);
+            }
+        }
+    }
+    qemu_spin_unlock(&cpu->neg.tlb.c.lock);
+}
+#endif
+
 /* Called with tlb_c.lock held */
 static inline void tlb_set_dirty1_locked(CPUTLBEntry *tlb_entry,
                                          vaddr addr)
@@ -1998,6 +2056,13 @@ static uint64_t do_ld_mmio_beN(CPUState *cpu, CPUTLBEntryFull *full,
     section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
     mr = section->mr;
 
+#ifdef XBOX
+    /* Regions that do their own locking are dispatched without the BQL */
+    if (mr->lockless_io) {
+        return int_ld_mmio_beN(cpu, full, ret_be, addr, size, mmu_idx,
+                               type, ra, mr, mr_offset);
+    }
+#endif
     BQL_LOCK_GUARD();
     return int_ld_mmio_beN(cpu, full, ret_be, addr, size, mmu_idx,
                            type, ra, mr, mr_offset);
@@ -2539,6 +2604,12 @@ static uint64_t do_st_mmio_leN(CPUState *cpu, CPUTLBEntryFull *full,
     section = io_prepare(&mr_offset, cpu, full->xlat_section, attrs, addr, ra);
     mr = section->mr;
 
+#ifdef XBOX
+    if (mr->lockless_io) {
+        return int_st_mmio_leN(cpu, full, val_le, addr, size, mmu_idx,
+                               ra, mr, mr_offset);
+    }
+#endif
     BQL_LOCK_GUARD();
     return int_st_mmio_leN(cpu, full, val_le, addr, size, mmu_idx,
                            ra, mr, mr_offset);
@@ -18,6 +18,10 @@ extern int64_t max_delay;
 extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
+#ifdef XBOX
+extern unsigned max_insns_per_tb;
+extern bool tb_chain_disabled;
+#endif
 
 extern bool icount_align_option;
 
@@ -51,6 +55,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s);
 void page_init(void);
 void tb_htable_init(void);
 TranslationBlock *inv_tb_htable_lookup(CPUState *cpu, TCGTBCPUState s);
+#ifdef XBOX
+bool tb_prewarm(CPUState *cpu, TCGTBCPUState s, uint32_t size, uint64_t ihash);
+#endif
 void tb_reset_jump(TranslationBlock *tb, int n);
 TranslationBlock *tb_link_page(TranslationBlock *tb);
 void cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
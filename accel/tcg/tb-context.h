@@ -22,6 +22,9 @@
 
 #include "qemu/thread.h"
 #include "qemu/qht.h"
+#ifdef XBOX
+#include "qemu/stats64.h"
+#endif
 
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
@@ -36,6 +39,10 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+#ifdef XBOX
+    Stat64 gen_count;
+    Stat64 gen_time_ns;
+#endif
 };
 
 extern TBContext tb_ctx;
@@ -0,0 +1,370 @@
+/*
+ * Persistent translation block cache for the Xbox
+ *
+ * Host code can't be reused across runs: it embeds the addresses of
+ * helpers, of the code buffer and of other TBs, all of which move every
+ * time xemu starts. What does carry over is which blocks the kernel and
+ * the running title execute. Those are recorded here, keyed by their
+ * translation flags and the hash of their guest code, and translated
+ * again on the next run while the vCPU is halted, so that most of them
+ * exist by the time the guest first jumps to them.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/main-loop.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "hw/core/cpu.h"
+#include "system/cpus.h"
+#include "system/reset.h"
+#include "system/system.h"
+#include "exec/translation-block.h"
+#include "internal-common.h"
+#include "tb-persist.h"
+#include "ui/xemu-settings.h"
+#include "xemu-xbe.h"
+
+#define TB_PERSIST_MAGIC        0x43425458 /* "XTBC" */
+#define TB_PERSIST_VERSION      1
+#define TB_PERSIST_MAX_ENTRIES  (1 << 20)
+#define TB_PERSIST_MAX_RANGES   32
+#define TB_PERSIST_BATCH        32
+#define TB_PERSIST_REFRESH_MS   1000
+#define TB_PERSIST_SAVE_MS      (5 * 60 * 1000)
+
+#define XBOX_KERNEL_BASE        0x80010000
+
+typedef struct TBPersistHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t count;
+} TBPersistHeader;
+
+typedef struct TBPersistEntry {
+    uint64_t ihash;
+    uint32_t pc;
+    uint32_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    uint32_t size;
+    uint32_t reserved;
+} TBPersistEntry;
+
+QEMU_BUILD_BUG_ON(sizeof(TBPersistEntry) != 32);
+
+typedef struct TBPersistRange {
+    vaddr start;
+    vaddr end;
+} TBPersistRange;
+
+static struct {
+    bool enabled;
+    char *path;
+    Notifier exit_notifier;
+
+    /* Every block seen this run or loaded from the file */
+    QemuMutex lock;
+    GHashTable *entries;
+    bool dirty;
+
+    /* Set by a system reset, consumed by the vCPU thread */
+    bool reset;
+
+    /* vCPU thread only */
+    GArray *pending;
+    guint cursor;
+    bool scanned;
+    TBPersistRange ranges[TB_PERSIST_MAX_RANGES];
+    int num_ranges;
+    int64_t next_refresh_ms;
+    int64_t next_save_ms;
+} tbp;
+
+static guint tb_persist_entry_hash(gconstpointer p)
+{
+    const TBPersistEntry *e = p;
+    return e->pc ^ (e->flags * 0x9e3779b1u) ^ e->ihash ^ (e->ihash >> 32);
+}
+
+static gboolean tb_persist_entry_equal(gconstpointer a, gconstpointer b)
+{
+    const TBPersistEntry *x = a, *y = b;
+    return x->pc == y->pc && x->cs_base == y->cs_base &&
+           x->flags == y->flags && x->cflags == y->cflags &&
+           x->ihash == y->ihash && x->size == y->size;
+}
+
+static void tb_persist_load(void)
+{
+    g_autofree char *buf = NULL;
+    gsize len;
+    const TBPersistHeader *hdr;
+    const TBPersistEntry *e;
+
+    if (!g_file_get_contents(tbp.path, &buf, &len, NULL)) {
+        return;
+    }
+
+    hdr = (const TBPersistHeader *)buf;
+    if (len < sizeof(*hdr) || hdr->magic != TB_PERSIST_MAGIC ||
+        hdr->version != TB_PERSIST_VERSION ||
+        hdr->entry_size != sizeof(TBPersistEntry) ||
+        hdr->count > TB_PERSIST_MAX_ENTRIES ||
+        len < sizeof(*hdr) + (gsize)hdr->count * sizeof(TBPersistEntry)) {
+        return;
+    }
+
+    e = (const TBPersistEntry *)(hdr + 1);
+    for (uint32_t i = 0; i < hdr->count; i++, e++) {
+        if (e->size == 0 || e->size >= 4096 ||
+            g_hash_table_contains(tbp.entries, e)) {
+            continue;
+        }
+        g_hash_table_add(tbp.entries, g_memdup2(e, sizeof(*e)));
+        g_array_append_val(tbp.pending, *e);
+    }
+}
+
+static void tb_persist_save(void)
+{
+    GHashTableIter iter;
+    gpointer key;
+    TBPersistHeader *hdr;
+    TBPersistEntry *e;
+    gsize len;
+
+    qemu_mutex_lock(&tbp.lock);
+    if (!tbp.dirty) {
+        qemu_mutex_unlock(&tbp.lock);
+        return;
+    }
+    len = sizeof(*hdr) +
+          g_hash_table_size(tbp.entries) * sizeof(TBPersistEntry);
+    hdr = g_malloc(len);
+    hdr->magic = TB_PERSIST_MAGIC;
+    hdr->version = TB_PERSIST_VERSION;
+    hdr->entry_size = sizeof(TBPersistEntry);
+    hdr->count = g_hash_table_size(tbp.entries);
+    e = (TBPersistEntry *)(hdr + 1);
+    g_hash_table_iter_init(&iter, tbp.entries);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        *e++ = *(TBPersistEntry *)key;
+    }
+    tbp.dirty = false;
+    qemu_mutex_unlock(&tbp.lock);
+
+    if (!g_file_set_contents(tbp.path, (const char *)hdr, len, NULL)) {
+        fprintf(stderr, "tb-persist: failed to write %s\n", tbp.path);
+    }
+    g_free(hdr);
+}
+
+static void tb_persist_exit(Notifier *n, void *data)
+{
+    tb_persist_save();
+}
+
+static void tb_persist_reset(void *opaque)
+{
+    tb_persist_save();
+    qatomic_set(&tbp.reset, true);
+}
+
+void tb_persist_init(void)
+{
+    static bool initialized;
+
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    if (!g_config.perf.tb_cache) {
+        return;
+    }
+
+    tbp.path = g_build_filename(xemu_settings_get_base_path(),
+                                "tb-cache.bin", NULL);
+    qemu_mutex_init(&tbp.lock);
+    tbp.entries = g_hash_table_new_full(tb_persist_entry_hash,
+                                        tb_persist_entry_equal, g_free, NULL);
+    tbp.pending = g_array_new(false, false, sizeof(TBPersistEntry));
+    tb_persist_load();
+
+    tbp.exit_notifier.notify = tb_persist_exit;
+    qemu_add_exit_notifier(&tbp.exit_notifier);
+    qemu_register_reset(tb_persist_reset, NULL);
+
+    qatomic_set(&tbp.enabled, true);
+}
+
+static bool tb_persist_in_ranges(vaddr pc, uint32_t size)
+{
+    for (int i = 0; i < tbp.num_ranges; i++) {
+        if (pc >= tbp.ranges[i].start && pc + size <= tbp.ranges[i].end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void tb_persist_add_range(TBPersistRange *ranges, int *n,
+                                 vaddr start, vaddr size)
+{
+    if (*n < TB_PERSIST_MAX_RANGES && size) {
+        ranges[(*n)++] = (TBPersistRange){ start, start + size };
+    }
+}
+
+/* Find the kernel image and the executable sections of the running XBE */
+static void tb_persist_refresh_ranges(CPUState *cpu)
+{
+    TBPersistRange ranges[TB_PERSIST_MAX_RANGES];
+    int n = 0;
+    uint8_t mz[64], pe[88];
+    struct xbe *xbe;
+
+    if (!cpu_memory_rw_debug(cpu, XBOX_KERNEL_BASE, mz, sizeof(mz), false) &&
+        lduw_le_p(mz) == 0x5a4d) {
+        uint32_t lfanew = ldl_le_p(mz + 0x3c);
+        if (lfanew < 0x1000 &&
+            !cpu_memory_rw_debug(cpu, XBOX_KERNEL_BASE + lfanew, pe,
+                                 sizeof(pe), false) &&
+            ldl_le_p(pe) == 0x4550) {
+            /* OptionalHeader.SizeOfImage */
+            tb_persist_add_range(ranges, &n, XBOX_KERNEL_BASE,
+                                 ldl_le_p(pe + 24 + 56));
+        }
+    }
+
+    xbe = xemu_get_xbe_info();
+    if (xbe) {
+        uint32_t base = ldl_le_p(&xbe->header->m_base);
+        uint32_t num = ldl_le_p(&xbe->header->m_sections);
+        uint32_t off = ldl_le_p(&xbe->header->m_section_headers_addr) - base;
+
+        if (off < xbe->headers_len &&
+            num <= (xbe->headers_len - off) /
+                   sizeof(struct xbe_section_header)) {
+            const struct xbe_section_header *sec =
+                (const void *)(xbe->headers + off);
+            for (uint32_t i = 0; i < num; i++, sec++) {
+                uint32_t flags = ldl_le_p(&sec->m_flags);
+                if ((flags & XBE_SECTION_EXECUTABLE) &&
+                    !(flags & XBE_SECTION_WRITABLE)) {
+                    tb_persist_add_range(ranges, &n,
+                                         ldl_le_p(&sec->m_virtual_addr),
+                                         ldl_le_p(&sec->m_virtual_size));
+                }
+            }
+        }
+    }
+
+    if (n != tbp.num_ranges ||
+        memcmp(ranges, tbp.ranges, n * sizeof(ranges[0]))) {
+        memcpy(tbp.ranges, ranges, n * sizeof(ranges[0]));
+        tbp.num_ranges = n;
+        tbp.cursor = 0;
+        tbp.scanned = false;
+    }
+}
+
+void tb_persist_record(CPUState *cpu, TCGTBCPUState s, TranslationBlock *tb)
+{
+    TBPersistEntry e;
+
+    if (!qatomic_read(&tbp.enabled) || s.cflags != curr_cflags(cpu) ||
+        tb->size == 0 || tb->size >= 4096 ||
+        !tb_persist_in_ranges(s.pc, tb->size)) {
+        return;
+    }
+
+    e = (TBPersistEntry){
+        .ihash = tb->ihash,
+        .pc = s.pc,
+        .cs_base = s.cs_base,
+        .flags = s.flags,
+        .cflags = s.cflags,
+        .size = tb->size,
+    };
+
+    qemu_mutex_lock(&tbp.lock);
+    if (g_hash_table_size(tbp.entries) < TB_PERSIST_MAX_ENTRIES &&
+        !g_hash_table_contains(tbp.entries, &e)) {
+        g_hash_table_add(tbp.entries, g_memdup2(&e, sizeof(e)));
+        tbp.dirty = true;
+    }
+    qemu_mutex_unlock(&tbp.lock);
+}
+
+void tb_persist_idle(CPUState *cpu)
+{
+    int64_t now;
+    uint32_t cflags;
+
+    if (!qatomic_read(&tbp.enabled)) {
+        return;
+    }
+
+    if (qatomic_xchg(&tbp.reset, false)) {
+        tbp.num_ranges = 0;
+        tbp.next_refresh_ms = 0;
+    }
+
+    now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (now >= tbp.next_refresh_ms) {
+        tbp.next_refresh_ms = now + TB_PERSIST_REFRESH_MS;
+        tb_persist_refresh_ranges(cpu);
+    }
+    if (now >= tbp.next_save_ms) {
+        /* Apps on mobile hosts are often killed without a clean exit */
+        tbp.next_save_ms = now + TB_PERSIST_SAVE_MS;
+        bql_unlock();
+        tb_persist_save();
+        bql_lock();
+    }
+
+    if (tbp.scanned || tbp.num_ranges == 0) {
+        return;
+    }
+
+    cflags = curr_cflags(cpu);
+    while (cpu_thread_is_idle(cpu)) {
+        bool done;
+
+        bql_unlock();
+        for (int i = 0; i < TB_PERSIST_BATCH &&
+                        tbp.cursor < tbp.pending->len; i++) {
+            TBPersistEntry *e = &g_array_index(tbp.pending, TBPersistEntry,
+                                               tbp.cursor);
+            TCGTBCPUState s = {
+                .pc = e->pc,
+                .flags = e->flags,
+                .cflags = e->cflags,
+                .cs_base = e->cs_base,
+            };
+
+            /* Not mapped yet, or the code changed: retry after a refresh */
+            if (e->cflags == cflags &&
+                (!tb_persist_in_ranges(e->pc, e->size) ||
+                 !tb_prewarm(cpu, s, e->size, e->ihash))) {
+                tbp.cursor++;
+                continue;
+            }
+            g_array_remove_index_fast(tbp.pending, tbp.cursor);
+        }
+        done = tbp.cursor >= tbp.pending->len;
+        bql_lock();
+
+        if (done) {
+            tbp.cursor = 0;
+            tbp.scanned = true;
+            break;
+        }
+    }
+}
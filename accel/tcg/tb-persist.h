@@ -0,0 +1,24 @@
+/*
+ * Persistent translation block cache for the Xbox
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef ACCEL_TCG_TB_PERSIST_H
+#define ACCEL_TCG_TB_PERSIST_H
+
+#include "accel/tcg/tb-cpu-state.h"
+
+/* Load the cache file if perf.tb_cache is set. Called with the BQL held. */
+void tb_persist_init(void);
+
+/* Remember a block translated from the kernel or XBE code sections */
+void tb_persist_record(CPUState *cpu, TCGTBCPUState s, TranslationBlock *tb);
+
+/*
+ * Translate cached blocks while @cpu has nothing to run. Called from the
+ * vCPU thread with the BQL held; drops it around each batch.
+ */
+void tb_persist_idle(CPUState *cpu);
+
+#endif
@@ -34,6 +34,17 @@
 #include "tcg/startup.h"
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-mttcg.h"
+#ifdef XBOX
+#include "qemu/timer.h"
+#include "system/cpus.h"
+#include "accel/tcg/runtime-stats.h"
+#include "ui/xemu-thread-topology.h"
+#include "ui/xemu-trace.h"
+#include "tb-persist.h"
+#ifdef __ANDROID__
+#include "ui/xemu-android-perf.h"
+#endif
+#endif
 
 typedef struct MttcgForceRcuNotifier {
     Notifier notifier;
@@ -83,14 +94,39 @@ static void *mttcg_cpu_thread_fn(void *arg)
     current_cpu = cpu;
     cpu_thread_signal_created(cpu);
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
+#ifdef XBOX
+    xemu_trace_set_thread_name("vCPU");
+    xemu_thread_topology_register(XEMU_THREAD_LATENCY, "vCPU");
+    tb_persist_init();
+#ifdef __ANDROID__
+    xemu_android_perf_thread_started(XEMU_PERF_THREAD_VCPU);
+#endif
+#endif
 
     do {
+#ifdef XBOX
+        int64_t halt_start = cpu->halted ? get_clock() : 0;
+        if (cpu_thread_is_idle(cpu)) {
+            tb_persist_idle(cpu);
+        }
+#endif
         qemu_process_cpu_events(cpu);
+#ifdef XBOX
+        if (halt_start) {
+            tcg_runtime_stats_add_idle(get_clock() - halt_start, false);
+        }
+#endif
 
         if (cpu_can_run(cpu)) {
             int r;
             bql_unlock();
+#ifdef XBOX
+            xemu_trace_begin("vCPU exec", NULL);
+#endif
             r = tcg_cpu_exec(cpu);
+#ifdef XBOX
+            xemu_trace_end();
+#endif
             bql_lock();
             switch (r) {
             case EXCP_DEBUG:
@@ -36,6 +36,11 @@
 #include "tcg-accel-ops.h"
 #include "tcg-accel-ops-rr.h"
 #include "tcg-accel-ops-icount.h"
+#ifdef XBOX
+#include "qemu/timer.h"
+#include "accel/tcg/runtime-stats.h"
+#include "tb-persist.h"
+#endif
 
 /* Kick all RR vCPUs */
 void rr_kick_vcpu_thread(CPUState *unused)
@@ -195,6 +200,9 @@ static void *rr_cpu_thread_fn(void *arg)
     cpu->neg.can_do_io = true;
     cpu_thread_signal_created(cpu);
     qemu_guest_random_seed_thread_part2(cpu->random_seed);
+#ifdef XBOX
+    tb_persist_init();
+#endif
 
     /* wait for initial kick-off after machine start */
     while (cpu_is_stopped(first_cpu)) {
@@ -232,7 +240,18 @@ static void *rr_cpu_thread_fn(void *arg)
             qemu_notify_event();
         }
 
+#ifdef XBOX
+        int64_t halt_start = first_cpu->halted ? get_clock() : 0;
+        if (all_cpu_threads_idle()) {
+            tb_persist_idle(first_cpu);
+        }
+#endif
         rr_wait_io_event();
+#ifdef XBOX
+        if (halt_start) {
+            tcg_runtime_stats_add_idle(get_clock() - halt_start, false);
+        }
+#endif
         rr_deal_with_unplugged_cpus();
 
         bql_unlock();
@@ -83,6 +83,10 @@ static void tcg_accel_instance_init(Object *obj)
 }
 
 bool one_insn_per_tb;
+#ifdef XBOX
+unsigned max_insns_per_tb;
+bool tb_chain_disabled;
+#endif
 
 #ifndef CONFIG_USER_ONLY
 static void tcg_vm_change_state(void *opaque, bool running, RunState state)
@@ -242,6 +246,44 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+#ifdef XBOX
+static void tcg_get_tb_max_insns(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    uint32_t value = max_insns_per_tb;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tb_max_insns(Object *obj, Visitor *v,
+                                 const char *name, void *opaque,
+                                 Error **errp)
+{
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > CF_COUNT_MASK + 1) {
+        error_setg(errp, "tb-max-insns must be at most %d", CF_COUNT_MASK + 1);
+        return;
+    }
+
+    max_insns_per_tb = value;
+}
+
+static bool tcg_get_chain(Object *obj, Error **errp)
+{
+    return !qatomic_read(&tb_chain_disabled);
+}
+
+static void tcg_set_chain(Object *obj, bool value, Error **errp)
+{
+    qatomic_set(&tb_chain_disabled, !value);
+}
+#endif
+
 static int tcg_gdbstub_supported_sstep_flags(AccelState *as)
 {
     /*
@@ -288,6 +330,19 @@ static void tcg_accel_class_init(ObjectClass *oc, const void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+#ifdef XBOX
+    object_class_property_add(oc, "tb-max-insns", "int",
+        tcg_get_tb_max_insns, tcg_set_tb_max_insns,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tb-max-insns",
+        "Maximum guest insns per translation block (0 for default)");
+
+    object_class_property_add_bool(oc, "chain",
+                                   tcg_get_chain, tcg_set_chain);
+    object_class_property_set_description(oc, "chain",
+        "Link translation blocks with direct jumps");
+#endif
 }
 
 static const TypeInfo tcg_accel_type = {
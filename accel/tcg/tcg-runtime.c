@@ -26,6 +26,7 @@
 #include "exec/cpu-common.h"
 #include "exec/helper-proto-common.h"
 #include "accel/tcg/getpc.h"
+#include "fpu/softfloat.h"
 
 #define HELPER_H  "accel/tcg/tcg-runtime.h"
 #include "exec/helper-info.c.inc"
@@ -148,3 +149,70 @@ void HELPER(exit_atomic)(CPUArchState *env)
 {
     cpu_loop_exit_atomic(env_cpu(env), GETPC());
 }
+
+/* Float helpers */
+
+static float_status ext80_status(void)
+{
+    float_status status = {
+        .float_rounding_mode = float_round_nearest_even,
+        .default_nan_pattern = 0b11000000,
+    };
+    return status;
+}
+
+uint32_t HELPER(ld80f_f32)(void *src)
+{
+    float_status status = ext80_status();
+    return floatx80_to_float32(*(floatx80 *)src, &status);
+}
+
+uint64_t HELPER(ld80f_f64)(void *src)
+{
+    float_status status = ext80_status();
+    return floatx80_to_float64(*(floatx80 *)src, &status);
+}
+
+void HELPER(st80f_f32)(void *dst, uint32_t arg)
+{
+    float_status status = ext80_status();
+    floatx80 v = float32_to_floatx80(arg, &status);
+    ((floatx80 *)dst)->low = v.low;
+    ((floatx80 *)dst)->high = v.high;
+}
+
+void HELPER(st80f_f64)(void *dst, uint64_t arg)
+{
+    float_status status = ext80_status();
+    floatx80 v = float64_to_floatx80(arg, &status);
+    ((floatx80 *)dst)->low = v.low;
+    ((floatx80 *)dst)->high = v.high;
+}
+
+uint32_t HELPER(sin_f32)(uint32_t arg)
+{
+    union { uint32_t i; float f; } u = { .i = arg };
+    u.f = sinf(u.f);
+    return u.i;
+}
+
+uint64_t HELPER(sin_f64)(uint64_t arg)
+{
+    union { uint64_t i; double f; } u = { .i = arg };
+    u.f = sin(u.f);
+    return u.i;
+}
+
+uint32_t HELPER(cos_f32)(uint32_t arg)
+{
+    union { uint32_t i; float f; } u = { .i = arg };
+    u.f = cosf(u.f);
+    return u.i;
+}
+
+uint64_t HELPER(cos_f64)(uint64_t arg)
+{
+    union { uint64_t i; double f; } u = { .i = arg };
+    u.f = cos(u.f);
+    return u.i;
+}
@@ -335,3 +335,13 @@ DEF_HELPER_FLAGS_4(gvec_leus32, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
 DEF_HELPER_FLAGS_4(gvec_leus64, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
 
 DEF_HELPER_FLAGS_5(gvec_bitsel, TCG_CALL_NO_RWG, void, ptr, ptr, ptr, ptr, i32)
+
+/* Float ops that hosts without an x87 unit expand to calls */
+DEF_HELPER_FLAGS_1(ld80f_f32, TCG_CALL_NO_RWG, i32, ptr)
+DEF_HELPER_FLAGS_1(ld80f_f64, TCG_CALL_NO_RWG, i64, ptr)
+DEF_HELPER_FLAGS_2(st80f_f32, TCG_CALL_NO_RWG, void, ptr, i32)
+DEF_HELPER_FLAGS_2(st80f_f64, TCG_CALL_NO_RWG, void, ptr, i64)
+DEF_HELPER_FLAGS_1(sin_f32, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(sin_f64, TCG_CALL_NO_RWG_SE, i64, i64)
+DEF_HELPER_FLAGS_1(cos_f32, TCG_CALL_NO_RWG_SE, i32, i32)
+DEF_HELPER_FLAGS_1(cos_f64, TCG_CALL_NO_RWG_SE, i64, i64)
@@ -16,6 +16,10 @@
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#ifdef XBOX
+#include "system/tcg.h"
+#include "accel/tcg/runtime-stats.h"
+#endif
 #include <math.h>
 
 static void dump_drift_info(GString *buf)
@@ -217,3 +221,34 @@ void tcg_dump_stats(GString *buf)
 {
     tcg_get_stats(current_accel(), buf);
 }
+
+#ifdef XBOX
+static Stat64 idle_ns;
+static Stat64 idle_parks;
+
+void tcg_runtime_stats_add_idle(int64_t ns, bool parked)
+{
+    stat64_add(&idle_ns, ns);
+    if (parked) {
+        stat64_inc(&idle_parks);
+    }
+}
+
+void tcg_get_runtime_stats(TCGRuntimeStats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    stats->code_size = tcg_code_size();
+    stats->code_capacity = tcg_code_capacity();
+    stats->nb_tbs = tcg_nb_tbs();
+    stats->flush_count = qatomic_read(&tb_ctx.tb_flush_count);
+    stats->invalidate_count = qatomic_read(&tb_ctx.tb_phys_invalidate_count);
+    stats->gen_count = stat64_get(&tb_ctx.gen_count);
+    stats->gen_time_ns = stat64_get(&tb_ctx.gen_time_ns);
+    stats->idle_ns = stat64_get(&idle_ns);
+    stats->idle_parks = stat64_get(&idle_parks);
+}
+#endif
@@ -38,6 +38,12 @@
 #include "internal-common.h"
 #include "tcg/perf.h"
 #include "tcg/insn-start-words.h"
+#ifdef XBOX
+#include "qemu/timer.h"
+#endif
+#if defined(XBOX) && !defined(CONFIG_USER_ONLY)
+#include "tb-persist.h"
+#endif
 
 #if defined(CONFIG_VTUNE_JITPROFILING)
 #include <jitprofiling.h>
@@ -285,6 +291,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
     }
 
     max_insns = s.cflags & CF_COUNT_MASK;
+#ifdef XBOX
+    if (max_insns == 0) {
+        max_insns = max_insns_per_tb;
+    }
+#endif
     if (max_insns == 0) {
         max_insns = TCG_MAX_INSNS;
     }
@@ -347,7 +358,13 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
  restart_translate:
     trace_translate_block(tb, s.pc, tb->tc.ptr);
 
+#ifdef XBOX
+    ti = get_clock();
+#endif
     gen_code_size = setjmp_gen_code(env, tb, s.pc, host_pc, &max_insns, &ti);
+#ifdef XBOX
+    stat64_add(&tb_ctx.gen_time_ns, get_clock() - ti);
+#endif
     if (unlikely(gen_code_size < 0)) {
         switch (gen_code_size) {
         case -1:
@@ -421,6 +438,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu, TCGTBCPUState s)
         goto buffer_overflow;
     }
     tb->tc.size = gen_code_size;
+#ifdef XBOX
+    stat64_inc(&tb_ctx.gen_count);
+#endif
 
     /*
      * For CF_PCREL, attribute all executions of the generated code
@@ -582,6 +602,10 @@ recycle_tb:
     }
 #endif
 
+#if defined(XBOX) && !defined(CONFIG_USER_ONLY)
+    tb_persist_record(cpu, s, tb);
+#endif
+
     return tb;
 }
 
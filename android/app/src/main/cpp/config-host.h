@@ -28,6 +28,8 @@
 
 #define CONFIG_IOVEC 1
 
+#define CONFIG_ZSTD 1
+
 #define CONFIG_FDATASYNC 1
 #define CONFIG_CLOCK_GETTIME 1
 #define CONFIG_GETTIMEOFDAY 1
@@ -16,10 +16,14 @@
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <sstream>
 #include <string>
 #include <vector>
 #include <sys/stat.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "xemu-settings.h"
 
@@ -55,6 +59,19 @@ static void LogErrorFmt(const char* fmt, const char* detail) {
   __android_log_print(ANDROID_LOG_ERROR, kLogTag, fmt, detail);
 }
 
+// Startup timeline, in milliseconds since the first mark
+static void StartupMark(const char* stage) {
+  static int64_t start_ns = -1;
+  struct timespec ts {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  const int64_t now_ns = static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+  if (start_ns < 0) {
+    start_ns = now_ns;
+  }
+  __android_log_print(ANDROID_LOG_INFO, kLogTag, "Startup +%lld ms: %s",
+                      static_cast<long long>((now_ns - start_ns) / 1000000), stage);
+}
+
 static bool EnsureDirExists(const std::string& path) {
   if (path.empty()) return false;
   if (mkdir(path.c_str(), 0755) == 0) return true;
@@ -67,11 +84,6 @@ static bool FileExists(const std::string& path) {
   return stat(path.c_str(), &st) == 0;
 }
 
-static bool IsTcgTuningEnabled() {
-  const char* value = SDL_getenv("XEMU_ANDROID_TCG_TUNING");
-  return !(value && value[0] == '0');
-}
-
 static void LoadGameControllerMappingsFromAssets() {
   constexpr const char* kDbAssetName = "gamecontrollerdb.txt";
 
@@ -149,35 +161,14 @@ static void LoadGameControllerMappingsFromAssets() {
   LogInfoInt("Controller mappings loaded from assets: %d", added);
 }
 
-static const char* GetTcgThreadFromEnv() {
-  const char* value = SDL_getenv("XEMU_ANDROID_TCG_THREAD");
-  if (value && strcmp(value, "single") == 0) {
-    return "single";
-  }
-  return "multi";
-}
-
-static int GetTcgTbSizeFromEnv() {
-  constexpr int kDefaultTbSize = 128;
-  constexpr int kMinTbSize = 32;
-  constexpr int kMaxTbSize = 512;
-
-  const char* value = SDL_getenv("XEMU_ANDROID_TCG_TB_SIZE");
-  if (!value || value[0] == '\0') {
-    return kDefaultTbSize;
-  }
-
-  char* end = nullptr;
-  long parsed = strtol(value, &end, 10);
-  if (end == value || (end && *end != '\0')) {
-    return kDefaultTbSize;
-  }
-  if (parsed < kMinTbSize) {
-    parsed = kMinTbSize;
-  } else if (parsed > kMaxTbSize) {
-    parsed = kMaxTbSize;
-  }
-  return static_cast<int>(parsed);
+// Parsing the controller DB takes a noticeable slice of startup and nothing
+// before the first frame needs it. SDL refreshes any controller that is
+// already open once its mapping shows up.
+static int SDLCALL ControllerMappingsThreadMain(void* data) {
+  (void)data;
+  LoadGameControllerMappingsFromAssets();
+  StartupMark("controller mappings loaded");
+  return 0;
 }
 
 static std::string ToLowerAscii(std::string value) {
@@ -562,6 +553,207 @@ cleanup:
   return success;
 }
 
+// Opens a content:// URI and takes ownership of its file descriptor.
+static int OpenUriFd(JNIEnv* env, jobject activity, const std::string& uriString, const char* mode) {
+  if (!env || !activity || uriString.empty()) return -1;
+
+  int fd = -1;
+  jclass activityClass = nullptr;
+  jobject resolver = nullptr;
+  jclass uriClass = nullptr;
+  jobject uri = nullptr;
+  jclass resolverClass = nullptr;
+  jobject pfd = nullptr;
+  jclass pfdClass = nullptr;
+
+  activityClass = env->GetObjectClass(activity);
+  if (!activityClass) {
+    goto cleanup;
+  }
+
+  {
+    jmethodID getContentResolver = env->GetMethodID(activityClass, "getContentResolver",
+                                                    "()Landroid/content/ContentResolver;");
+    if (!getContentResolver) {
+      goto cleanup;
+    }
+    resolver = env->CallObjectMethod(activity, getContentResolver);
+    if (HasException(env, "getContentResolver") || !resolver) {
+      goto cleanup;
+    }
+  }
+
+  uriClass = env->FindClass("android/net/Uri");
+  if (!uriClass) {
+    goto cleanup;
+  }
+  {
+    jmethodID parse = env->GetStaticMethodID(uriClass, "parse", "(Ljava/lang/String;)Landroid/net/Uri;");
+    if (!parse) {
+      goto cleanup;
+    }
+    jstring juri = env->NewStringUTF(uriString.c_str());
+    if (!juri) {
+      goto cleanup;
+    }
+    uri = env->CallStaticObjectMethod(uriClass, parse, juri);
+    env->DeleteLocalRef(juri);
+    if (HasException(env, "Uri.parse") || !uri) {
+      goto cleanup;
+    }
+  }
+
+  resolverClass = env->GetObjectClass(resolver);
+  if (!resolverClass) {
+    goto cleanup;
+  }
+  {
+    jmethodID openFileDescriptor = env->GetMethodID(
+        resolverClass, "openFileDescriptor",
+        "(Landroid/net/Uri;Ljava/lang/String;)Landroid/os/ParcelFileDescriptor;");
+    if (!openFileDescriptor) {
+      goto cleanup;
+    }
+    jstring jmode = env->NewStringUTF(mode);
+    if (!jmode) {
+      goto cleanup;
+    }
+    pfd = env->CallObjectMethod(resolver, openFileDescriptor, uri, jmode);
+    env->DeleteLocalRef(jmode);
+    if (HasException(env, "openFileDescriptor") || !pfd) {
+      goto cleanup;
+    }
+  }
+
+  pfdClass = env->GetObjectClass(pfd);
+  if (!pfdClass) {
+    goto cleanup;
+  }
+  {
+    jmethodID detachFd = env->GetMethodID(pfdClass, "detachFd", "()I");
+    if (!detachFd) {
+      goto cleanup;
+    }
+    fd = env->CallIntMethod(pfd, detachFd);
+    if (HasException(env, "ParcelFileDescriptor.detachFd")) {
+      fd = -1;
+    }
+  }
+
+cleanup:
+  if (pfdClass) env->DeleteLocalRef(pfdClass);
+  if (pfd) env->DeleteLocalRef(pfd);
+  if (resolverClass) env->DeleteLocalRef(resolverClass);
+  if (uri) env->DeleteLocalRef(uri);
+  if (uriClass) env->DeleteLocalRef(uriClass);
+  if (resolver) env->DeleteLocalRef(resolver);
+  if (activityClass) env->DeleteLocalRef(activityClass);
+  return fd;
+}
+
+static std::string ReadSmallFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in.is_open()) return {};
+  std::ostringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static bool CopyFdToPath(int fd, const std::string& path) {
+  const std::string tmp_path = path + ".tmp";
+  int out = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    LogErrorFmt("Failed to create %s", tmp_path.c_str());
+    return false;
+  }
+
+  std::vector<char> buffer(1024 * 1024);
+  bool success = lseek(fd, 0, SEEK_SET) == 0 || errno == ESPIPE;
+  while (success) {
+    ssize_t n = read(fd, buffer.data(), buffer.size());
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      success = n == 0;
+      break;
+    }
+    for (ssize_t done = 0; done < n;) {
+      ssize_t w = write(out, buffer.data() + done, static_cast<size_t>(n - done));
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) {
+        success = false;
+        break;
+      }
+      done += w;
+    }
+  }
+  if (close(out) != 0) {
+    success = false;
+  }
+
+  // Rename into place so an interrupted copy never looks complete
+  if (success && rename(tmp_path.c_str(), path.c_str()) != 0) {
+    success = false;
+  }
+  if (!success) {
+    unlink(tmp_path.c_str());
+  }
+  return success;
+}
+
+// Copies a URI into app storage, skipping the copy when the source has the
+// same size and modification time as last time. The stamp lives next to the
+// copy so deleting one invalidates the other.
+static bool SyncUriToPath(JNIEnv* env, jobject activity, const std::string& uriString, const std::string& path) {
+  int fd = OpenUriFd(env, activity, uriString, "r");
+  if (fd < 0) {
+    // Some providers only hand out streams
+    return CopyUriToPath(env, activity, uriString, path);
+  }
+
+  const std::string stamp_path = path + ".stamp";
+  std::string stamp;
+  struct stat src {};
+  if (fstat(fd, &src) == 0 && S_ISREG(src.st_mode)) {
+    stamp = uriString + "\n" + std::to_string(static_cast<long long>(src.st_size)) + "\n" +
+            std::to_string(static_cast<long long>(src.st_mtim.tv_sec)) + "." +
+            std::to_string(static_cast<long long>(src.st_mtim.tv_nsec)) + "\n";
+    struct stat dst {};
+    if (stat(path.c_str(), &dst) == 0 && dst.st_size == src.st_size &&
+        ReadSmallFile(stamp_path) == stamp) {
+      close(fd);
+      LogInfoFmt("%s unchanged, skipping copy", path.c_str());
+      return true;
+    }
+  }
+
+  unlink(stamp_path.c_str());
+  bool success = CopyFdToPath(fd, path);
+  close(fd);
+  if (success && !stamp.empty()) {
+    std::ofstream out(stamp_path, std::ios::binary | std::ios::trunc);
+    out << stamp;
+  }
+  return success;
+}
+
+// Large images are handed to the core in place as "saf-fd:<fd>" and read by
+// the saf-fd block driver, rather than copied into app storage. Any provider
+// that gives us a seekable descriptor works. The descriptor stays open for
+// the life of the process.
+static std::string OpenUriInPlace(JNIEnv* env, jobject activity, const std::string& uriString, bool writable) {
+  int fd = OpenUriFd(env, activity, uriString, writable ? "rw" : "r");
+  if (fd < 0) {
+    return {};
+  }
+
+  struct stat st {};
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    close(fd);
+    return {};
+  }
+  return "saf-fd:" + std::to_string(fd);
+}
+
 struct EmulatorSettings {
   int surface_scale    = 1;         // 1, 2, or 3
   std::string tcg_thread = "multi"; // "single" or "multi"
@@ -618,9 +810,10 @@ static bool WriteConfigToml(const std::string& config_path,
   toml::table* android = EnsureTable(tbl, "android");
   toml::table* sys = EnsureTable(tbl, "sys");
   toml::table* perf = EnsureTable(tbl, "perf");
+  toml::table* perf_tcg = EnsureTable(*perf, "tcg");
   toml::table* files = EnsureTable(*sys, "files");
   if (!general || !display || !display_quality || !display_window || !audio ||
-      !audio_vp || !android || !sys || !perf || !files) {
+      !audio_vp || !android || !sys || !perf || !perf_tcg || !files) {
     LogErrorFmt("Failed to build config tables at %s", config_path.c_str());
     return false;
   }
@@ -644,8 +837,18 @@ static bool WriteConfigToml(const std::string& config_path,
   audio->insert_or_assign("hrtf", settings.hrtf);
   perf->insert_or_assign("cache_shaders", settings.cache_shaders);
   perf->insert_or_assign("hard_fpu", settings.hard_fpu);
-  android->insert_or_assign("tcg_thread",
+  perf_tcg->insert_or_assign("thread",
     (settings.tcg_thread == "single") ? "single" : "multi");
+  // Move the old android.tcg_* keys over to perf.tcg. 128 was written for
+  // everyone as the default, so leave that to the host-memory based size.
+  if (auto tb_size = (*android)["tcg_tb_size"].value<int64_t>()) {
+    if (*tb_size != 128 && !perf_tcg->contains("tb_size_mb")) {
+      perf_tcg->insert_or_assign("tb_size_mb", *tb_size);
+    }
+  }
+  android->erase("tcg_thread");
+  android->erase("tcg_tuning");
+  android->erase("tcg_tb_size");
   if (!audio_vp->contains("num_workers")) {
     audio_vp->insert_or_assign("num_workers", 0);
   }
@@ -655,12 +858,6 @@ static bool WriteConfigToml(const std::string& config_path,
   if (!android->contains("force_cpu_blit")) {
     android->insert_or_assign("force_cpu_blit", false);
   }
-  if (!android->contains("tcg_tuning")) {
-    android->insert_or_assign("tcg_tuning", true);
-  }
-  if (!android->contains("tcg_tb_size")) {
-    android->insert_or_assign("tcg_tb_size", 128);
-  }
   if (!android->contains("audio_driver")) {
     android->insert_or_assign("audio_driver", "aaudio");
   }
@@ -671,12 +868,19 @@ static bool WriteConfigToml(const std::string& config_path,
   files->insert_or_assign("hdd_path", hdd);
   files->insert_or_assign("dvd_path", dvd);
 
+  std::ostringstream serialized;
+  serialized << tbl;
+  const std::string content = serialized.str();
+  if (ReadSmallFile(config_path) == content) {
+    return true;
+  }
+
   std::ofstream out(config_path, std::ios::binary | std::ios::trunc);
   if (!out.is_open()) {
     LogErrorFmt("Failed to write config at %s", config_path.c_str());
     return false;
   }
-  out << tbl;
+  out << content;
   out.close();
   return true;
 }
@@ -733,7 +937,7 @@ static SetupFiles SyncSetupFiles() {
   }
   if (out.mcpx.empty() && !mcpxUri.empty()) {
     out.mcpx = base + "/mcpx.bin";
-    if (CopyUriToPath(env, activity, mcpxUri, out.mcpx)) {
+    if (SyncUriToPath(env, activity, mcpxUri, out.mcpx)) {
       LogInfo("MCPX ROM synced to app storage");
     } else {
       LogError("Failed to sync MCPX ROM");
@@ -744,7 +948,7 @@ static SetupFiles SyncSetupFiles() {
   }
   if (out.flash.empty() && !flashUri.empty()) {
     out.flash = base + "/flash.bin";
-    if (CopyUriToPath(env, activity, flashUri, out.flash)) {
+    if (SyncUriToPath(env, activity, flashUri, out.flash)) {
       LogInfo("Flash ROM synced to app storage");
     } else {
       LogError("Failed to sync flash ROM");
@@ -753,9 +957,15 @@ static SetupFiles SyncSetupFiles() {
   if (!hddPath.empty() && FileExists(hddPath)) {
     out.hdd = hddPath;
   }
+  if (out.hdd.empty() && !hddUri.empty()) {
+    out.hdd = OpenUriInPlace(env, activity, hddUri, true);
+    if (!out.hdd.empty()) {
+      LogInfoFmt("HDD image opened in place at %s", out.hdd.c_str());
+    }
+  }
   if (out.hdd.empty() && !hddUri.empty()) {
     out.hdd = base + "/hdd.img";
-    if (CopyUriToPath(env, activity, hddUri, out.hdd)) {
+    if (SyncUriToPath(env, activity, hddUri, out.hdd)) {
       LogInfo("HDD image synced to app storage");
     } else {
       LogError("Failed to sync HDD image");
@@ -765,9 +975,15 @@ static SetupFiles SyncSetupFiles() {
   if (!dvdPath.empty() && FileExists(dvdPath)) {
     out.dvd = dvdPath;
   }
+  if (out.dvd.empty() && !dvdUri.empty()) {
+    out.dvd = OpenUriInPlace(env, activity, dvdUri, false);
+    if (!out.dvd.empty()) {
+      LogInfoFmt("DVD image opened in place at %s", out.dvd.c_str());
+    }
+  }
   if (out.dvd.empty() && !dvdUri.empty()) {
     out.dvd = base + "/dvd.iso";
-    if (CopyUriToPath(env, activity, dvdUri, out.dvd)) {
+    if (SyncUriToPath(env, activity, dvdUri, out.dvd)) {
       LogInfo("DVD image synced to app storage");
     } else {
       LogError("Failed to sync DVD image");
@@ -806,6 +1022,27 @@ extern "C" void xemu_android_display_preinit(void);
 extern "C" void xemu_android_display_wait_ready(void);
 extern "C" void xemu_android_display_loop(void);
 extern "C" void xemu_android_set_inline_aio_crash_flag_path(const char* path);
+extern "C" void nv2a_release_caches(bool all);
+
+// ComponentCallbacks2 trim levels
+enum {
+  TRIM_MEMORY_RUNNING_LOW = 10,
+  TRIM_MEMORY_RUNNING_CRITICAL = 15,
+  TRIM_MEMORY_UI_HIDDEN = 20,
+  TRIM_MEMORY_BACKGROUND = 40,
+};
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_izzy2lost_x1box_MainActivity_nativeTrimMemory(JNIEnv*, jclass, jint level) {
+  // Hiding the UI alone isn't memory pressure, so leave the caches be
+  if (level == TRIM_MEMORY_RUNNING_CRITICAL || level >= TRIM_MEMORY_BACKGROUND) {
+    LogInfoInt("Memory pressure (level %d), releasing renderer caches", level);
+    nv2a_release_caches(true);
+  } else if (level == TRIM_MEMORY_RUNNING_LOW) {
+    LogInfoInt("Memory pressure (level %d), trimming renderer caches", level);
+    nv2a_release_caches(false);
+  }
+}
 
 struct QemuLaunchContext {
   int argc;
@@ -827,6 +1064,7 @@ extern "C" int xemu_android_main(int argc, char** argv) {
   }
   LogInfo("xemu_android_main: qemu_init");
   qemu_init(argc, argv);
+  StartupMark("qemu_init done");
   LogInfo("xemu_android_main: qemu_main");
   int rc = qemu_main();
   LogErrorInt("xemu_android_main: qemu_main returned %d", rc);
@@ -837,6 +1075,7 @@ extern "C" int SDL_main(int argc, char* argv[]) {
   (void)argc;
   (void)argv;
 
+  StartupMark("SDL_main");
   LogInfo("SDL_main: start");
   std::string audio_driver_hint = ResolveAndroidAudioDriverHint();
   SDL_SetHintWithPriority(SDL_HINT_AUDIODRIVER, audio_driver_hint.c_str(),
@@ -850,9 +1089,17 @@ extern "C" int SDL_main(int argc, char* argv[]) {
     return 1;
   }
   SDL_GameControllerEventState(SDL_ENABLE);
-  LoadGameControllerMappingsFromAssets();
+  StartupMark("SDL initialized");
+  SDL_Thread* mappings_thread =
+      SDL_CreateThread(ControllerMappingsThreadMain, "controller_db", nullptr);
+  if (mappings_thread) {
+    SDL_DetachThread(mappings_thread);
+  } else {
+    LoadGameControllerMappingsFromAssets();
+  }
 
   SetupFiles setup = SyncSetupFiles();
+  StartupMark("setup files synced");
 
   xemu_android_set_inline_aio_crash_flag_path(setup.inline_aio_flag_path.empty()
                                                    ? nullptr
@@ -882,6 +1129,7 @@ extern "C" int SDL_main(int argc, char* argv[]) {
       return 1;
     }
     LogInfo("SDL_main: config loaded");
+    StartupMark("config loaded");
     LogInfoInt("Config show_welcome=%d", g_config.general.show_welcome ? 1 : 0);
     LogInfoFmt("Config bootrom=%s", g_config.sys.files.bootrom_path ? g_config.sys.files.bootrom_path : "(null)");
     LogInfoFmt("Config flashrom=%s", g_config.sys.files.flashrom_path ? g_config.sys.files.flashrom_path : "(null)");
@@ -929,18 +1177,8 @@ extern "C" int SDL_main(int argc, char* argv[]) {
 
     std::vector<std::string> arg_storage;
     arg_storage.emplace_back("xemu");
-    if (IsTcgTuningEnabled()) {
-      const char* tcg_thread = GetTcgThreadFromEnv();
-      int tcg_tb_size = GetTcgTbSizeFromEnv();
-      char accel_opts[64];
-      snprintf(accel_opts, sizeof(accel_opts), "tcg,thread=%s,tb-size=%d",
-               tcg_thread, tcg_tb_size);
-      arg_storage.emplace_back("-accel");
-      arg_storage.emplace_back(accel_opts);
-      LogInfoFmt("SDL_main: using accel %s", accel_opts);
-    } else {
-      LogInfo("SDL_main: TCG tuning disabled");
-    }
+    LogInfoInt("Config final tcg.thread=%d", (int)g_config.perf.tcg.thread);
+    LogInfoInt("Config final tcg.tb_size_mb=%d", g_config.perf.tcg.tb_size_mb);
 
     std::vector<char*> xemu_argv;
     xemu_argv.reserve(arg_storage.size() + 1);
@@ -961,9 +1199,11 @@ extern "C" int SDL_main(int argc, char* argv[]) {
       return 1;
     }
     LogInfo("SDL_main: qemu thread started");
+    StartupMark("qemu thread started");
     (void)qemu_thread;
     xemu_android_display_wait_ready();
     LogInfo("SDL_main: display ready, entering render loop");
+    StartupMark("display ready");
     xemu_android_display_loop();
     return 0;
   }
@@ -0,0 +1,174 @@
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "xemu-android-audio.h"
+
+#include <aaudio/AAudio.h>
+#include <android/log.h>
+
+#define SAMPLE_RATE 48000
+#define CHANNELS 2
+#define BYTES_PER_FRAME (CHANNELS * sizeof(int16_t))
+
+/* Bursts of headroom in the device buffer, grown on underrun */
+#define MIN_BUFFER_BURSTS 2
+#define MAX_BUFFER_BURSTS 8
+
+static struct {
+    QemuMutex lock;
+    AAudioStream *stream;
+    XemuAndroidAudioCallback cb;
+    void *opaque;
+    int32_t burst_frames;
+    int32_t last_xruns;
+} g_audio;
+
+static void open_stream_locked(void);
+
+static aaudio_data_callback_result_t data_callback(AAudioStream *stream,
+                                                   void *user_data,
+                                                   void *audio_data,
+                                                   int32_t num_frames)
+{
+    g_audio.cb(g_audio.opaque, audio_data, num_frames * BYTES_PER_FRAME);
+
+    /*
+     * Start at the lowest latency the device allows and back off a burst at
+     * a time if it can't keep up.
+     */
+    int32_t xruns = AAudioStream_getXRunCount(stream);
+    if (xruns > g_audio.last_xruns) {
+        g_audio.last_xruns = xruns;
+        int32_t size = AAudioStream_getBufferSizeInFrames(stream);
+        if (size < MAX_BUFFER_BURSTS * g_audio.burst_frames) {
+            AAudioStream_setBufferSizeInFrames(stream,
+                                               size + g_audio.burst_frames);
+        }
+    }
+
+    return AAUDIO_CALLBACK_RESULT_CONTINUE;
+}
+
+/*
+ * The stream can't be reopened from its own callback, so a route change
+ * (e.g. headphones unplugged) is handled on a short-lived thread.
+ */
+static void *restart_thread(void *arg)
+{
+    qemu_mutex_lock(&g_audio.lock);
+    if (g_audio.stream) {
+        AAudioStream_requestStop(g_audio.stream);
+        AAudioStream_close(g_audio.stream);
+        g_audio.stream = NULL;
+    }
+    open_stream_locked();
+    qemu_mutex_unlock(&g_audio.lock);
+    return NULL;
+}
+
+static void error_callback(AAudioStream *stream, void *user_data,
+                           aaudio_result_t error)
+{
+    __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                        "AAudio stream error: %s",
+                        AAudio_convertResultToText(error));
+    if (error == AAUDIO_ERROR_DISCONNECTED) {
+        QemuThread thread;
+        qemu_thread_create(&thread, "xemu-aaudio", restart_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+}
+
+static void open_stream_locked(void)
+{
+    AAudioStreamBuilder *builder;
+    aaudio_result_t result = AAudio_createStreamBuilder(&builder);
+    if (result != AAUDIO_OK) {
+        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                            "AAudio_createStreamBuilder failed: %s",
+                            AAudio_convertResultToText(result));
+        return;
+    }
+
+    /*
+     * Exclusive sharing together with the low latency performance mode is
+     * what lets AAudio map the device buffer directly (MMAP). Devices that
+     * can't do that quietly give us a shared stream instead.
+     */
+    AAudioStreamBuilder_setDirection(builder, AAUDIO_DIRECTION_OUTPUT);
+    AAudioStreamBuilder_setSharingMode(builder, AAUDIO_SHARING_MODE_EXCLUSIVE);
+    AAudioStreamBuilder_setPerformanceMode(builder,
+                                           AAUDIO_PERFORMANCE_MODE_LOW_LATENCY);
+    AAudioStreamBuilder_setFormat(builder, AAUDIO_FORMAT_PCM_I16);
+    AAudioStreamBuilder_setChannelCount(builder, CHANNELS);
+    AAudioStreamBuilder_setSampleRate(builder, SAMPLE_RATE);
+    AAudioStreamBuilder_setDataCallback(builder, data_callback, NULL);
+    AAudioStreamBuilder_setErrorCallback(builder, error_callback, NULL);
+
+    AAudioStream *stream = NULL;
+    result = AAudioStreamBuilder_openStream(builder, &stream);
+    AAudioStreamBuilder_delete(builder);
+    if (result != AAUDIO_OK) {
+        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                            "AAudioStreamBuilder_openStream failed: %s",
+                            AAudio_convertResultToText(result));
+        return;
+    }
+
+    // The APU only produces 48 kHz stereo, so don't accept anything else
+    if (AAudioStream_getSampleRate(stream) != SAMPLE_RATE ||
+        AAudioStream_getChannelCount(stream) != CHANNELS ||
+        AAudioStream_getFormat(stream) != AAUDIO_FORMAT_PCM_I16) {
+        __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                            "AAudio stream format mismatch (%d Hz, %d ch)",
+                            AAudioStream_getSampleRate(stream),
+                            AAudioStream_getChannelCount(stream));
+        AAudioStream_close(stream);
+        return;
+    }
+
+    g_audio.burst_frames = AAudioStream_getFramesPerBurst(stream);
+    g_audio.last_xruns = 0;
+    AAudioStream_setBufferSizeInFrames(stream,
+                                       MIN_BUFFER_BURSTS *
+                                           g_audio.burst_frames);
+
+    result = AAudioStream_requestStart(stream);
+    if (result != AAUDIO_OK) {
+        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                            "AAudioStream_requestStart failed: %s",
+                            AAudio_convertResultToText(result));
+        AAudioStream_close(stream);
+        return;
+    }
+
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "AAudio stream started: %s, %s, burst=%d, buffer=%d",
+                        AAudioStream_getSharingMode(stream) ==
+                                AAUDIO_SHARING_MODE_EXCLUSIVE ?
+                            "exclusive" : "shared",
+                        AAudioStream_getPerformanceMode(stream) ==
+                                AAUDIO_PERFORMANCE_MODE_LOW_LATENCY ?
+                            "low latency" : "normal",
+                        g_audio.burst_frames,
+                        AAudioStream_getBufferSizeInFrames(stream));
+    g_audio.stream = stream;
+}
+
+bool xemu_android_audio_open(XemuAndroidAudioCallback cb, void *opaque,
+                             int *buffer_bytes)
+{
+    qemu_mutex_init(&g_audio.lock);
+    g_audio.cb = cb;
+    g_audio.opaque = opaque;
+
+    qemu_mutex_lock(&g_audio.lock);
+    open_stream_locked();
+    bool opened = g_audio.stream != NULL;
+    if (opened) {
+        *buffer_bytes = AAudioStream_getBufferSizeInFrames(g_audio.stream) *
+                        BYTES_PER_FRAME;
+    }
+    qemu_mutex_unlock(&g_audio.lock);
+
+    return opened;
+}
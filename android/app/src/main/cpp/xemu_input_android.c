@@ -0,0 +1,175 @@
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "xemu-android-input.h"
+
+#include <SDL.h>
+#include <android/log.h>
+#include <jni.h>
+
+/*
+ * The on-screen controller queues its events in a direct ByteBuffer shared
+ * with InputEventRing.kt, so a touch frame costs one JNI call however many
+ * buttons and sticks it moved. The header holds the read index, which only
+ * we write; the write index is handed over by nativeCommit. Keep the layout
+ * in sync with the Kotlin side.
+ */
+#define RING_HEADER_SIZE 64
+#define RING_CAPACITY 256
+
+enum {
+    EVENT_BUTTON = 0,
+    EVENT_AXIS = 1,
+};
+
+typedef struct InputEvent {
+    int64_t time_ns; // CLOCK_MONOTONIC, same clock as System.nanoTime()
+    uint8_t type;
+    uint8_t index;   // SDL_GameControllerButton or SDL_GameControllerAxis
+    uint16_t reserved;
+    float value;     // 0..1 for buttons and triggers, -1..1 for sticks
+} InputEvent;
+
+QEMU_BUILD_BUG_ON(sizeof(InputEvent) != 16);
+
+#define NUM_BUTTONS (SDL_CONTROLLER_BUTTON_DPAD_RIGHT + 1)
+
+static struct {
+    jobject buffer;
+    uint32_t *tail;
+    InputEvent *events;
+    uint32_t head;
+    SDL_Joystick *joystick;
+} g_input;
+
+static Sint16 axis_value(const InputEvent *ev)
+{
+    float v = MAX(-1.0f, MIN(ev->value, 1.0f));
+
+    // Virtual triggers rest at the bottom of the axis range
+    if (ev->index == SDL_CONTROLLER_AXIS_TRIGGERLEFT ||
+        ev->index == SDL_CONTROLLER_AXIS_TRIGGERRIGHT) {
+        return (Sint16)(MAX(v, 0.0f) * 65535.0f - 32768.0f);
+    }
+    return (Sint16)(v * 32767.0f);
+}
+
+/* Must be called with the joysticks locked */
+static void drain_events(void)
+{
+    InputEvent *events = qatomic_load_acquire(&g_input.events);
+    SDL_Joystick *joystick = g_input.joystick;
+    if (!events || !joystick) {
+        return;
+    }
+
+    uint32_t head = qatomic_load_acquire(&g_input.head);
+    uint32_t tail = qatomic_read(g_input.tail);
+    uint32_t changed = 0;
+
+    for (; tail != head; tail++) {
+        const InputEvent *ev = &events[tail % RING_CAPACITY];
+        bool is_trigger = ev->type == EVENT_AXIS &&
+                          (ev->index == SDL_CONTROLLER_AXIS_TRIGGERLEFT ||
+                           ev->index == SDL_CONTROLLER_AXIS_TRIGGERRIGHT);
+
+        /*
+         * A tap can be shorter than the time between two updates. Only
+         * let each button change once per update so the guest still sees
+         * the press; the release goes out with the next one.
+         */
+        if (ev->type == EVENT_BUTTON || is_trigger) {
+            uint32_t bit = 1u << (ev->type == EVENT_BUTTON ?
+                                      ev->index % NUM_BUTTONS :
+                                      NUM_BUTTONS + ev->index);
+            if (changed & bit) {
+                break;
+            }
+            changed |= bit;
+        }
+
+        if (ev->type == EVENT_BUTTON) {
+            SDL_JoystickSetVirtualButton(joystick, ev->index,
+                                         ev->value > 0.5f ? SDL_PRESSED :
+                                                            SDL_RELEASED);
+        } else if (ev->type == EVENT_AXIS) {
+            SDL_JoystickSetVirtualAxis(joystick, ev->index, axis_value(ev));
+        }
+    }
+
+    qatomic_store_release(g_input.tail, tail);
+}
+
+static void SDLCALL virtual_update(void *userdata)
+{
+    drain_events();
+}
+
+void xemu_android_input_init(void)
+{
+    SDL_VirtualJoystickDesc desc = {
+        .version = SDL_VIRTUAL_JOYSTICK_DESC_VERSION,
+        .type = SDL_JOYSTICK_TYPE_GAMECONTROLLER,
+        .naxes = SDL_CONTROLLER_AXIS_MAX,
+        .nbuttons = NUM_BUTTONS,
+        .vendor_id = 0x045e,
+        .product_id = 0x028e,
+        .name = "On-Screen Controller",
+        .Update = virtual_update,
+    };
+
+    int index = SDL_JoystickAttachVirtualEx(&desc);
+    if (index < 0) {
+        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                            "Failed to attach on-screen controller: %s",
+                            SDL_GetError());
+        return;
+    }
+
+    // Keep it open so SDL updates it whether or not a port is bound to it
+    SDL_LockJoysticks();
+    g_input.joystick = SDL_JoystickOpen(index);
+    SDL_UnlockJoysticks();
+    if (!g_input.joystick) {
+        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                            "Failed to open on-screen controller: %s",
+                            SDL_GetError());
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_izzy2lost_x1box_InputEventRing_nativeAttach(JNIEnv *env, jclass cls,
+                                                     jobject buffer)
+{
+    uint8_t *base = (*env)->GetDirectBufferAddress(env, buffer);
+    jlong size = (*env)->GetDirectBufferCapacity(env, buffer);
+
+    if (!base ||
+        size < RING_HEADER_SIZE + RING_CAPACITY * (jlong)sizeof(InputEvent)) {
+        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                            "Invalid input event ring");
+        return;
+    }
+    if (qatomic_read(&g_input.events)) {
+        return;
+    }
+
+    g_input.buffer = (*env)->NewGlobalRef(env, buffer);
+    g_input.tail = (uint32_t *)base;
+    qatomic_store_release(&g_input.events,
+                          (InputEvent *)(base + RING_HEADER_SIZE));
+}
+
+JNIEXPORT void JNICALL
+Java_com_izzy2lost_x1box_InputEventRing_nativeCommit(JNIEnv *env, jclass cls,
+                                                     jint head)
+{
+    qatomic_store_release(&g_input.head, (uint32_t)head);
+
+    // Drain here if the input thread has fallen far behind
+    if (g_input.tail && qatomic_read(&g_input.joystick) &&
+        (uint32_t)head - qatomic_read(g_input.tail) > RING_CAPACITY * 3 / 4) {
+        SDL_LockJoysticks();
+        drain_events();
+        SDL_UnlockJoysticks();
+    }
+}
@@ -0,0 +1,244 @@
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "hw/xbox/nv2a/nv2a.h"
+#include "xemu-android-perf.h"
+#include "xemu-settings.h"
+
+#include <android/log.h>
+#include <dlfcn.h>
+#include <math.h>
+#include <pthread.h>
+
+/*
+ * The performance hint (API 33) and thermal (API 30/31) entry points are
+ * newer than our minimum SDK, so resolve them at runtime and quietly do
+ * without on older devices.
+ */
+
+typedef struct APerformanceHintManager APerformanceHintManager;
+typedef struct APerformanceHintSession APerformanceHintSession;
+typedef struct AThermalManager AThermalManager;
+
+typedef void (*AThermalStatusCallback)(void *data, int status);
+
+enum {
+    THERMAL_STATUS_NONE = 0,
+    THERMAL_STATUS_LIGHT = 1,
+    THERMAL_STATUS_MODERATE = 2,
+};
+
+#define FRAME_TARGET_NS 16666666
+#define THERMAL_POLL_INTERVAL_NS 2000000000LL
+#define THERMAL_FORECAST_SECONDS 10
+#define MAX_HINT_THREADS 8
+
+static struct {
+    APerformanceHintManager *(*get_manager)(void);
+    APerformanceHintSession *(*create_session)(APerformanceHintManager *,
+                                               const int32_t *, size_t,
+                                               int64_t);
+    void (*close_session)(APerformanceHintSession *);
+    int (*report_actual)(APerformanceHintSession *, int64_t);
+    int (*set_threads)(APerformanceHintSession *, const pid_t *, size_t);
+
+    AThermalManager *(*acquire_thermal)(void);
+    int (*get_thermal_status)(AThermalManager *);
+    int (*register_thermal_listener)(AThermalManager *,
+                                     AThermalStatusCallback, void *);
+    float (*get_thermal_headroom)(AThermalManager *, int);
+} api;
+
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+
+static struct {
+    QemuMutex lock;
+    APerformanceHintManager *hint_manager;
+    APerformanceHintSession *session;
+    int32_t tids[MAX_HINT_THREADS];
+    size_t num_tids;
+
+    AThermalManager *thermal;
+    int thermal_status;
+    int64_t last_poll;
+
+    /* 0: full quality, 1: HRTF off, 2: HRTF off and native resolution */
+    int quality_step;
+    bool saved_hrtf;
+    unsigned int saved_scale;
+} g_perf;
+
+static void *load_symbol(void *lib, const char *name)
+{
+    return lib ? dlsym(lib, name) : NULL;
+}
+
+static void thermal_status_changed(void *data, int status)
+{
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "Thermal status changed to %d", status);
+    qatomic_set(&g_perf.thermal_status, status);
+}
+
+static void perf_init(void)
+{
+    qemu_mutex_init(&g_perf.lock);
+
+    void *lib = dlopen("libandroid.so", RTLD_NOW | RTLD_LOCAL);
+
+    api.get_manager = load_symbol(lib, "APerformanceHint_getManager");
+    api.create_session = load_symbol(lib, "APerformanceHint_createSession");
+    api.close_session = load_symbol(lib, "APerformanceHint_closeSession");
+    api.report_actual =
+        load_symbol(lib, "APerformanceHint_reportActualWorkDuration");
+    api.set_threads = load_symbol(lib, "APerformanceHint_setThreads");
+    if (api.get_manager && api.create_session && api.close_session &&
+        api.report_actual) {
+        g_perf.hint_manager = api.get_manager();
+    }
+
+    api.acquire_thermal = load_symbol(lib, "AThermal_acquireManager");
+    api.get_thermal_status =
+        load_symbol(lib, "AThermal_getCurrentThermalStatus");
+    api.register_thermal_listener =
+        load_symbol(lib, "AThermal_registerThermalStatusListener");
+    api.get_thermal_headroom = load_symbol(lib, "AThermal_getThermalHeadroom");
+    if (api.acquire_thermal) {
+        g_perf.thermal = api.acquire_thermal();
+    }
+    if (g_perf.thermal) {
+        if (api.get_thermal_status) {
+            g_perf.thermal_status = api.get_thermal_status(g_perf.thermal);
+        }
+        if (api.register_thermal_listener) {
+            api.register_thermal_listener(g_perf.thermal,
+                                          thermal_status_changed, NULL);
+        }
+    }
+
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "Performance hints %s, thermal status %s",
+                        g_perf.hint_manager ? "available" : "unavailable",
+                        g_perf.thermal ? "available" : "unavailable");
+}
+
+/* Must be called with g_perf.lock held */
+static void add_hint_thread(int32_t tid)
+{
+    if (!g_perf.hint_manager || g_perf.num_tids >= MAX_HINT_THREADS) {
+        return;
+    }
+    g_perf.tids[g_perf.num_tids++] = tid;
+
+    if (g_perf.session && api.set_threads &&
+        api.set_threads(g_perf.session, g_perf.tids, g_perf.num_tids) == 0) {
+        return;
+    }
+
+    // Sessions can't grow before API 34, so start over with the full set
+    if (g_perf.session) {
+        api.close_session(g_perf.session);
+    }
+    g_perf.session = api.create_session(g_perf.hint_manager, g_perf.tids,
+                                        g_perf.num_tids, FRAME_TARGET_NS);
+    if (!g_perf.session) {
+        __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                            "Failed to create performance hint session");
+    }
+}
+
+void xemu_android_perf_thread_started(XemuPerfThread kind)
+{
+    pthread_once(&perf_once, perf_init);
+
+    if (kind == XEMU_PERF_THREAD_VCPU || kind == XEMU_PERF_THREAD_PFIFO) {
+        qemu_mutex_lock(&g_perf.lock);
+        add_hint_thread(qemu_get_thread_id());
+        qemu_mutex_unlock(&g_perf.lock);
+    }
+}
+
+void xemu_android_perf_report_frame(int64_t duration_ns)
+{
+    // Skip the gap left by pauses, loading screens and the like
+    if (duration_ns <= 0 || duration_ns > 10 * FRAME_TARGET_NS) {
+        return;
+    }
+
+    qemu_mutex_lock(&g_perf.lock);
+    if (g_perf.session) {
+        api.report_actual(g_perf.session, duration_ns);
+    }
+    qemu_mutex_unlock(&g_perf.lock);
+}
+
+static void set_quality_step(int step)
+{
+    if (step > g_perf.quality_step) {
+        if (g_perf.quality_step < 1) {
+            g_perf.saved_hrtf = g_config.audio.hrtf;
+            g_config.audio.hrtf = false;
+        }
+        if (step >= 2) {
+            g_perf.saved_scale = nv2a_get_surface_scale_factor();
+            if (g_perf.saved_scale > 1) {
+                nv2a_set_surface_scale_factor(1);
+            }
+        }
+    } else {
+        // Leave alone anything the user changed while we were throttled
+        if (g_perf.quality_step >= 2 && g_perf.saved_scale > 1 &&
+            nv2a_get_surface_scale_factor() == 1) {
+            nv2a_set_surface_scale_factor(g_perf.saved_scale);
+        }
+        if (!g_config.audio.hrtf) {
+            g_config.audio.hrtf = g_perf.saved_hrtf;
+        }
+    }
+
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "Thermal quality step %d -> %d",
+                        g_perf.quality_step, step);
+    g_perf.quality_step = step;
+}
+
+void xemu_android_perf_poll(void)
+{
+    if (!g_perf.thermal) {
+        return;
+    }
+
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (now - g_perf.last_poll < THERMAL_POLL_INTERVAL_NS) {
+        return;
+    }
+    g_perf.last_poll = now;
+
+    int status = qatomic_read(&g_perf.thermal_status);
+    float headroom = api.get_thermal_headroom ?
+        api.get_thermal_headroom(g_perf.thermal, THERMAL_FORECAST_SECONDS) :
+        NAN;
+    bool have_headroom = !isnan(headroom);
+
+    /*
+     * Headroom is a forecast where 1.0 is the point the platform starts
+     * throttling. Step down ahead of that, and only step back up once the
+     * device has clearly cooled so we don't flap between modes.
+     */
+    int step = 0;
+    if (status >= THERMAL_STATUS_MODERATE ||
+        (have_headroom && headroom >= 0.95f)) {
+        step = 2;
+    } else if (status >= THERMAL_STATUS_LIGHT ||
+               (have_headroom && headroom >= 0.85f)) {
+        step = 1;
+    }
+
+    if (step > g_perf.quality_step) {
+        set_quality_step(step);
+    } else if (g_perf.quality_step > 0 && status == THERMAL_STATUS_NONE &&
+               (!have_headroom || headroom < 0.75f)) {
+        set_quality_step(0);
+    }
+}
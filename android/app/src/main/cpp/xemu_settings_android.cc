@@ -1,4 +1,5 @@
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 
 #include <SDL_filesystem.h>
 #include <SDL_gamecontroller.h>
@@ -41,6 +42,7 @@ static void xemu_settings_apply_defaults(void)
     g_config.input.auto_bind = true;
     g_config.input.allow_vibration = true;
     g_config.input.background_input_capture = false;
+    g_config.input.runahead_frames = 0;
     g_config.input.keyboard_controller_scancode_map.a = 4;
     g_config.input.keyboard_controller_scancode_map.b = 5;
     g_config.input.keyboard_controller_scancode_map.x = 27;
@@ -77,6 +79,8 @@ static void xemu_settings_apply_defaults(void)
     g_config.display.window.last_width = 640;
     g_config.display.window.last_height = 480;
     g_config.display.window.vsync = false;
+    g_config.display.window.low_latency = true;
+    g_config.display.vulkan.native_present = true;
     g_config.display.ui.show_menubar = true;
     g_config.display.ui.show_notifications = true;
     g_config.display.ui.hide_cursor = true;
@@ -96,12 +100,32 @@ static void xemu_settings_apply_defaults(void)
     g_config.net.backend = CONFIG_NET_BACKEND_NAT;
     g_config.net.udp.bind_addr = xemu_strdup_or_null("0.0.0.0:9368");
     g_config.net.udp.remote_addr = xemu_strdup_or_null("1.2.3.4:9368");
+    g_config.net.relay.bind_addr = xemu_strdup_or_null("0.0.0.0:9368");
+    g_config.net.relay.peers = xemu_strdup_or_null("");
+    g_config.net.relay.hub = false;
+    g_config.net.relay.aggregate_us = 0;
+    g_config.net.intr_coalesce.usecs = 0;
+    g_config.net.intr_coalesce.frames = 0;
 
     g_config.sys.mem_limit = CONFIG_SYS_MEM_LIMIT_64;
     g_config.sys.avpack = CONFIG_SYS_AVPACK_HDTV;
 
     g_config.perf.hard_fpu = true;
+    g_config.perf.tb_cache = false;
+    g_config.perf.tcg.thread = CONFIG_PERF_TCG_THREAD_AUTO;
+    g_config.perf.tcg.tb_size_mb = 0;
+    g_config.perf.tcg.max_insns = 0;
+    g_config.perf.tcg.chain = true;
+    g_config.perf.park_idle_loops = true;
     g_config.perf.cache_shaders = true;
+    g_config.perf.disc_cache_mb = 64;
+    g_config.perf.hdd_cache_overlay = CONFIG_PERF_HDD_CACHE_OVERLAY_OFF;
+    g_config.perf.hdd_cache_overlay_mb = 512;
+    g_config.perf.hdd_trim = true;
+    g_config.perf.usb_idle_coalesce = 8;
+    g_config.perf.thread_topology = true;
+    g_config.perf.low_memory = CONFIG_PERF_LOW_MEMORY_AUTO;
+    g_config.perf.huge_pages = CONFIG_PERF_HUGE_PAGES_TRANSPARENT;
 }
 
 // Optimized parsers - avoid string allocations
@@ -140,6 +164,10 @@ static bool parse_filtering(const std::string &value, CONFIG_DISPLAY_FILTERING *
         *out = CONFIG_DISPLAY_FILTERING_NEAREST;
         return true;
     }
+    if (value.size() == 3 && (value == "fsr" || value == "Fsr" || value == "FSR")) {
+        *out = CONFIG_DISPLAY_FILTERING_FSR;
+        return true;
+    }
     return false;
 }
 
@@ -203,6 +231,21 @@ const char *xemu_settings_get_default_eeprom_path(void)
     return eeprom_path;
 }
 
+bool xemu_settings_low_memory_mode(void)
+{
+    switch (g_config.perf.low_memory) {
+    case CONFIG_PERF_LOW_MEMORY_ON:
+        return true;
+    case CONFIG_PERF_LOW_MEMORY_OFF:
+        return false;
+    default: {
+        // A "6 GB" phone reports a little less than 6 GiB to the kernel
+        size_t phys_mem = qemu_get_host_physmem();
+        return phys_mem && phys_mem <= 6 * GiB;
+    }
+    }
+}
+
 bool xemu_settings_load(void)
 {
     const int kMaxAudioVpWorkers = 16;
@@ -210,9 +253,6 @@ bool xemu_settings_load(void)
     xemu_settings_apply_defaults();
     error_msg.clear();
     setenv("XEMU_ANDROID_FORCE_CPU_BLIT", "0", 1);
-    setenv("XEMU_ANDROID_TCG_TUNING", "1", 1);
-    setenv("XEMU_ANDROID_TCG_THREAD", "multi", 1);
-    setenv("XEMU_ANDROID_TCG_TB_SIZE", "128", 1);
 
     const char *path = xemu_settings_get_path();
     if (!path || *path == '\0') {
@@ -231,9 +271,11 @@ bool xemu_settings_load(void)
         auto display = tbl["display"];
         auto display_quality = display["quality"];
         auto display_window = display["window"];
+        auto display_vulkan = display["vulkan"];
         auto audio = tbl["audio"];
         auto audio_vp = audio["vp"];
         auto perf = tbl["perf"];
+        auto perf_tcg = perf["tcg"];
         auto android_cfg = tbl["android"];
         auto sys = tbl["sys"];
         auto sys_files = sys["files"];
@@ -271,14 +313,104 @@ bool xemu_settings_load(void)
         if (auto vsync = display_window["vsync"].value<bool>()) {
             g_config.display.window.vsync = *vsync;
         }
+        if (auto low_latency = display_window["low_latency"].value<bool>()) {
+            g_config.display.window.low_latency = *low_latency;
+        }
+        if (auto native_present = display_vulkan["native_present"].value<bool>()) {
+            g_config.display.vulkan.native_present = *native_present;
+        }
 
         // Performance settings
         if (auto hard_fpu = perf["hard_fpu"].value<bool>()) {
             g_config.perf.hard_fpu = *hard_fpu;
         }
+        if (auto tb_cache = perf["tb_cache"].value<bool>()) {
+            g_config.perf.tb_cache = *tb_cache;
+        }
         if (auto cache_shaders = perf["cache_shaders"].value<bool>()) {
             g_config.perf.cache_shaders = *cache_shaders;
         }
+        if (auto thread = perf_tcg["thread"].value<std::string>()) {
+            if (*thread == "auto") {
+                g_config.perf.tcg.thread = CONFIG_PERF_TCG_THREAD_AUTO;
+            } else if (*thread == "single") {
+                g_config.perf.tcg.thread = CONFIG_PERF_TCG_THREAD_SINGLE;
+            } else if (*thread == "multi") {
+                g_config.perf.tcg.thread = CONFIG_PERF_TCG_THREAD_MULTI;
+            } else {
+                __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                                    "Ignoring perf.tcg.thread=%s (expected auto|single|multi)",
+                                    thread->c_str());
+            }
+        }
+        if (auto tb_size_mb = perf_tcg["tb_size_mb"].value<int64_t>()) {
+            g_config.perf.tcg.tb_size_mb = *tb_size_mb < 0 ? 0 : (int)*tb_size_mb;
+        }
+        if (auto max_insns = perf_tcg["max_insns"].value<int64_t>()) {
+            g_config.perf.tcg.max_insns = *max_insns < 0 ? 0 : (int)*max_insns;
+        }
+        if (auto chain = perf_tcg["chain"].value<bool>()) {
+            g_config.perf.tcg.chain = *chain;
+        }
+        if (auto park_idle_loops = perf["park_idle_loops"].value<bool>()) {
+            g_config.perf.park_idle_loops = *park_idle_loops;
+        }
+        if (auto disc_cache_mb = perf["disc_cache_mb"].value<int64_t>()) {
+            g_config.perf.disc_cache_mb = *disc_cache_mb < 0 ? 0 : (int)*disc_cache_mb;
+        }
+        if (auto hdd_cache_overlay = perf["hdd_cache_overlay"].value<std::string>()) {
+            if (*hdd_cache_overlay == "off") {
+                g_config.perf.hdd_cache_overlay = CONFIG_PERF_HDD_CACHE_OVERLAY_OFF;
+            } else if (*hdd_cache_overlay == "discard") {
+                g_config.perf.hdd_cache_overlay = CONFIG_PERF_HDD_CACHE_OVERLAY_DISCARD;
+            } else if (*hdd_cache_overlay == "writeback") {
+                g_config.perf.hdd_cache_overlay = CONFIG_PERF_HDD_CACHE_OVERLAY_WRITEBACK;
+            } else {
+                __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                                    "Ignoring perf.hdd_cache_overlay=%s (expected off|discard|writeback)",
+                                    hdd_cache_overlay->c_str());
+            }
+        }
+        if (auto hdd_cache_overlay_mb = perf["hdd_cache_overlay_mb"].value<int64_t>()) {
+            g_config.perf.hdd_cache_overlay_mb =
+                *hdd_cache_overlay_mb < 0 ? 0 : (int)*hdd_cache_overlay_mb;
+        }
+        if (auto hdd_trim = perf["hdd_trim"].value<bool>()) {
+            g_config.perf.hdd_trim = *hdd_trim;
+        }
+        if (auto usb_idle_coalesce = perf["usb_idle_coalesce"].value<int64_t>()) {
+            g_config.perf.usb_idle_coalesce =
+                *usb_idle_coalesce < 0 ? 0 : (int)*usb_idle_coalesce;
+        }
+        if (auto thread_topology = perf["thread_topology"].value<bool>()) {
+            g_config.perf.thread_topology = *thread_topology;
+        }
+        if (auto low_memory = perf["low_memory"].value<std::string>()) {
+            if (*low_memory == "auto") {
+                g_config.perf.low_memory = CONFIG_PERF_LOW_MEMORY_AUTO;
+            } else if (*low_memory == "on") {
+                g_config.perf.low_memory = CONFIG_PERF_LOW_MEMORY_ON;
+            } else if (*low_memory == "off") {
+                g_config.perf.low_memory = CONFIG_PERF_LOW_MEMORY_OFF;
+            } else {
+                __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                                    "Ignoring perf.low_memory=%s (expected auto|on|off)",
+                                    low_memory->c_str());
+            }
+        }
+        if (auto huge_pages = perf["huge_pages"].value<std::string>()) {
+            if (*huge_pages == "transparent") {
+                g_config.perf.huge_pages = CONFIG_PERF_HUGE_PAGES_TRANSPARENT;
+            } else if (*huge_pages == "explicit") {
+                g_config.perf.huge_pages = CONFIG_PERF_HUGE_PAGES_EXPLICIT;
+            } else if (*huge_pages == "off") {
+                g_config.perf.huge_pages = CONFIG_PERF_HUGE_PAGES_OFF;
+            } else {
+                __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                                    "Ignoring perf.huge_pages=%s (expected transparent|explicit|off)",
+                                    huge_pages->c_str());
+            }
+        }
 
         // Audio settings
         if (auto vp_workers = audio_vp["num_workers"].value<int64_t>()) {
@@ -315,29 +447,6 @@ bool xemu_settings_load(void)
                 setenv("XEMU_ANDROID_EGL_OFFSCREEN", "0", 1);
             }
         }
-        if (auto tcg_tuning = android_cfg["tcg_tuning"].value<bool>()) {
-            setenv("XEMU_ANDROID_TCG_TUNING", *tcg_tuning ? "1" : "0", 1);
-        }
-        if (auto tcg_thread = android_cfg["tcg_thread"].value<std::string>()) {
-            if (*tcg_thread == "single" || *tcg_thread == "multi") {
-                setenv("XEMU_ANDROID_TCG_THREAD", tcg_thread->c_str(), 1);
-            } else {
-                __android_log_print(ANDROID_LOG_WARN, "xemu-android",
-                                    "Ignoring android.tcg_thread=%s (expected single|multi)",
-                                    tcg_thread->c_str());
-            }
-        }
-        if (auto tcg_tb_size = android_cfg["tcg_tb_size"].value<int64_t>()) {
-            int tb_size = (int)*tcg_tb_size;
-            if (tb_size < 32) {
-                tb_size = 32;
-            } else if (tb_size > 512) {
-                tb_size = 512;
-            }
-            char tb_size_str[16];
-            snprintf(tb_size_str, sizeof(tb_size_str), "%d", tb_size);
-            setenv("XEMU_ANDROID_TCG_TB_SIZE", tb_size_str, 1);
-        }
         if (auto inline_aio = android_cfg["inline_aio"].value<bool>()) {
             setenv("XEMU_ANDROID_INLINE_AIO", *inline_aio ? "1" : "0", 1);
         }
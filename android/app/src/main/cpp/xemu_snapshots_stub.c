@@ -45,11 +45,35 @@ void xemu_snapshots_delete(const char *vm_name, Error **err)
     }
 }
 
+bool xemu_snapshots_quicksave_exists(void)
+{
+    return false;
+}
+
+void xemu_snapshots_quicksave(Error **err)
+{
+    if (err) {
+        *err = NULL;
+    }
+}
+
+void xemu_snapshots_quickload(Error **err)
+{
+    if (err) {
+        *err = NULL;
+    }
+}
+
 void xemu_snapshots_save_extra_data(QEMUFile *f)
 {
     (void)f;
 }
 
+GBytes *xemu_snapshots_finish_extra_data(void)
+{
+    return NULL;
+}
+
 bool xemu_snapshots_offset_extra_data(QEMUFile *f)
 {
     (void)f;
@@ -81,3 +105,21 @@ void *xemu_snapshots_create_framebuffer_thumbnail_png(size_t *size)
     }
     return NULL;
 }
+
+bool xemu_snapshots_request_thumbnail(void)
+{
+    return false;
+}
+
+void xemu_snapshots_poll_thumbnail(void)
+{
+}
+
+void *xemu_snapshots_wait_thumbnail(size_t *size, int timeout_ms)
+{
+    (void)timeout_ms;
+    if (size) {
+        *size = 0;
+    }
+    return NULL;
+}
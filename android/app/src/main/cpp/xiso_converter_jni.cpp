@@ -1,23 +1,68 @@
 #include <jni.h>
 
 #include <array>
+#include <cstdint>
 #include <string>
 
-extern "C" int xiso_convert_iso_to_xiso(const char *input_path,
-                                          const char *output_path,
-                                          char *err_buf,
-                                          size_t err_buf_len);
+using XisoProgressFn = int (*)(void *user_data, uint64_t done, uint64_t total);
+
+extern "C" int xiso_convert_image(const char *input_path,
+                                  const char *output_path,
+                                  int compress,
+                                  XisoProgressFn progress,
+                                  void *user_data,
+                                  char *err_buf,
+                                  size_t err_buf_len);
+
+namespace {
+
+struct ProgressListener {
+  JNIEnv *env;
+  jobject listener;
+  jmethodID on_progress;
+};
+
+// Runs on the converting thread, which is the thread that called in
+int report_progress(void *user_data, uint64_t done, uint64_t total) {
+  auto *progress = static_cast<ProgressListener *>(user_data);
+  jboolean keep_going = progress->env->CallBooleanMethod(
+      progress->listener,
+      progress->on_progress,
+      static_cast<jlong>(done),
+      static_cast<jlong>(total));
+  if (progress->env->ExceptionCheck()) {
+    progress->env->ExceptionClear();
+    return 0;
+  }
+  return keep_going ? 1 : 0;
+}
+
+}  // namespace
 
 extern "C" JNIEXPORT jstring JNICALL
-Java_com_izzy2lost_x1box_XisoConverterNative_nativeConvertIsoToXiso(
+Java_com_izzy2lost_x1box_XisoConverterNative_nativeConvert(
     JNIEnv *env,
     jclass,
     jstring input_path,
-    jstring output_path) {
+    jstring output_path,
+    jboolean compress,
+    jobject listener) {
   if (input_path == nullptr || output_path == nullptr) {
     return env->NewStringUTF("Input/output path is missing");
   }
 
+  ProgressListener progress{env, listener, nullptr};
+  if (listener != nullptr) {
+    jclass listener_class = env->GetObjectClass(listener);
+    progress.on_progress =
+        env->GetMethodID(listener_class, "onProgress", "(JJ)Z");
+    env->DeleteLocalRef(listener_class);
+    if (progress.on_progress == nullptr) {
+      env->ExceptionClear();
+      return env->NewStringUTF("Invalid progress listener");
+    }
+  }
+
   const char *input_chars = env->GetStringUTFChars(input_path, nullptr);
   if (input_chars == nullptr) {
     return env->NewStringUTF("Failed to read input path");
@@ -29,9 +74,12 @@ Java_com_izzy2lost_x1box_XisoConverterNative_nativeConvertIsoToXiso(
   }
 
   std::array<char, 4096> error_buffer{};
-  int rc = xiso_convert_iso_to_xiso(
+  int rc = xiso_convert_image(
       input_chars,
       output_chars,
+      compress ? 1 : 0,
+      listener != nullptr ? report_progress : nullptr,
+      &progress,
       error_buffer.data(),
       error_buffer.size());
 
@@ -46,4 +94,4 @@ Java_com_izzy2lost_x1box_XisoConverterNative_nativeConvertIsoToXiso(
                         ? error_buffer.data()
                         : "ISO conversion failed";
   return env->NewStringUTF(msg);
-}
\ No newline at end of file
+}
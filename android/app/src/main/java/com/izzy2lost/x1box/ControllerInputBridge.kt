@@ -1,18 +1,29 @@
 package com.izzy2lost.x1box
 
-import android.view.KeyEvent
-import org.libsdl.app.SDLControllerManager
-
 /**
- * Bridge between on-screen controller and SDL input system
+ * Bridge between on-screen controller and SDL input system. Events are
+ * queued in [InputEventRing] and handed to native code once per touch event.
  */
 class ControllerInputBridge : OnScreenController.ControllerListener {
 
   companion object {
-    // Virtual device ID for on-screen controller
-    const val VIRTUAL_DEVICE_ID = -2
+    // SDL_GameControllerButton
+    const val BUTTON_A = 0
+    const val BUTTON_B = 1
+    const val BUTTON_X = 2
+    const val BUTTON_Y = 3
+    const val BUTTON_BACK = 4
+    const val BUTTON_START = 6
+    const val BUTTON_LEFT_STICK = 7
+    const val BUTTON_RIGHT_STICK = 8
+    const val BUTTON_LEFT_SHOULDER = 9
+    const val BUTTON_RIGHT_SHOULDER = 10
+    const val BUTTON_DPAD_UP = 11
+    const val BUTTON_DPAD_DOWN = 12
+    const val BUTTON_DPAD_LEFT = 13
+    const val BUTTON_DPAD_RIGHT = 14
 
-    // Axis indices for SDL
+    // SDL_GameControllerAxis
     const val AXIS_LEFT_X = 0
     const val AXIS_LEFT_Y = 1
     const val AXIS_RIGHT_X = 2
@@ -21,99 +32,81 @@ class ControllerInputBridge : OnScreenController.ControllerListener {
     const val AXIS_RIGHT_TRIGGER = 5
   }
 
+  init {
+    InputEventRing.attach()
+  }
+
   override fun onButtonPressed(button: OnScreenController.Button) {
-    try {
-      when (button) {
-        OnScreenController.Button.LEFT_TRIGGER ->
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_LEFT_TRIGGER, 1.0f)
-        OnScreenController.Button.RIGHT_TRIGGER ->
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_RIGHT_TRIGGER, 1.0f)
-        else -> {
-          val keyCode = getKeyCodeForButton(button)
-          SDLControllerManager.onNativePadDown(VIRTUAL_DEVICE_ID, keyCode)
-        }
-      }
-    } catch (e: Exception) {
-      android.util.Log.e("ControllerBridge", "Error on button press: ${e.message}")
-    }
+    setButton(button, true)
   }
 
   override fun onButtonReleased(button: OnScreenController.Button) {
-    try {
-      when (button) {
-        OnScreenController.Button.LEFT_TRIGGER ->
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_LEFT_TRIGGER, 0.0f)
-        OnScreenController.Button.RIGHT_TRIGGER ->
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_RIGHT_TRIGGER, 0.0f)
-        else -> {
-          val keyCode = getKeyCodeForButton(button)
-          SDLControllerManager.onNativePadUp(VIRTUAL_DEVICE_ID, keyCode)
-        }
-      }
-    } catch (e: Exception) {
-      android.util.Log.e("ControllerBridge", "Error on button release: ${e.message}")
-    }
+    setButton(button, false)
   }
 
   override fun onStickMoved(stick: OnScreenController.Stick, x: Float, y: Float) {
-    try {
-      when (stick) {
-        OnScreenController.Stick.LEFT -> {
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_LEFT_X, x)
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_LEFT_Y, y)
-        }
-        OnScreenController.Stick.RIGHT -> {
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_RIGHT_X, x)
-          SDLControllerManager.onNativeJoy(VIRTUAL_DEVICE_ID, AXIS_RIGHT_Y, y)
-        }
+    when (stick) {
+      OnScreenController.Stick.LEFT -> {
+        InputEventRing.push(InputEventRing.TYPE_AXIS, AXIS_LEFT_X, x)
+        InputEventRing.push(InputEventRing.TYPE_AXIS, AXIS_LEFT_Y, y)
+      }
+      OnScreenController.Stick.RIGHT -> {
+        InputEventRing.push(InputEventRing.TYPE_AXIS, AXIS_RIGHT_X, x)
+        InputEventRing.push(InputEventRing.TYPE_AXIS, AXIS_RIGHT_Y, y)
       }
-    } catch (e: Exception) {
-      android.util.Log.e("ControllerBridge", "Error on stick move: ${e.message}")
     }
   }
 
   override fun onStickPressed(stick: OnScreenController.Stick) {
-    try {
-      val keyCode = when (stick) {
-        OnScreenController.Stick.LEFT -> KeyEvent.KEYCODE_BUTTON_THUMBL
-        OnScreenController.Stick.RIGHT -> KeyEvent.KEYCODE_BUTTON_THUMBR
-      }
-      SDLControllerManager.onNativePadDown(VIRTUAL_DEVICE_ID, keyCode)
-    } catch (e: Exception) {
-      android.util.Log.e("ControllerBridge", "Error on stick press: ${e.message}")
-    }
+    InputEventRing.push(InputEventRing.TYPE_BUTTON, getStickButton(stick), 1.0f)
   }
 
   override fun onStickReleased(stick: OnScreenController.Stick) {
-    try {
-      val keyCode = when (stick) {
-        OnScreenController.Stick.LEFT -> KeyEvent.KEYCODE_BUTTON_THUMBL
-        OnScreenController.Stick.RIGHT -> KeyEvent.KEYCODE_BUTTON_THUMBR
-      }
-      SDLControllerManager.onNativePadUp(VIRTUAL_DEVICE_ID, keyCode)
-    } catch (e: Exception) {
-      android.util.Log.e("ControllerBridge", "Error on stick release: ${e.message}")
+    InputEventRing.push(InputEventRing.TYPE_BUTTON, getStickButton(stick), 0.0f)
+  }
+
+  override fun onTouchEventHandled() {
+    InputEventRing.commit()
+  }
+
+  private fun setButton(button: OnScreenController.Button, pressed: Boolean) {
+    val value = if (pressed) 1.0f else 0.0f
+    when (button) {
+      OnScreenController.Button.LEFT_TRIGGER ->
+        InputEventRing.push(InputEventRing.TYPE_AXIS, AXIS_LEFT_TRIGGER, value)
+      OnScreenController.Button.RIGHT_TRIGGER ->
+        InputEventRing.push(InputEventRing.TYPE_AXIS, AXIS_RIGHT_TRIGGER, value)
+      else ->
+        InputEventRing.push(InputEventRing.TYPE_BUTTON, getSdlButton(button), value)
+    }
+  }
+
+  private fun getStickButton(stick: OnScreenController.Stick): Int {
+    return when (stick) {
+      OnScreenController.Stick.LEFT -> BUTTON_LEFT_STICK
+      OnScreenController.Stick.RIGHT -> BUTTON_RIGHT_STICK
     }
   }
 
-  private fun getKeyCodeForButton(button: OnScreenController.Button): Int {
+  private fun getSdlButton(button: OnScreenController.Button): Int {
     return when (button) {
-      OnScreenController.Button.A -> KeyEvent.KEYCODE_BUTTON_A
-      OnScreenController.Button.B -> KeyEvent.KEYCODE_BUTTON_B
-      OnScreenController.Button.X -> KeyEvent.KEYCODE_BUTTON_X
-      OnScreenController.Button.Y -> KeyEvent.KEYCODE_BUTTON_Y
-      OnScreenController.Button.DPAD_UP -> KeyEvent.KEYCODE_DPAD_UP
-      OnScreenController.Button.DPAD_DOWN -> KeyEvent.KEYCODE_DPAD_DOWN
-      OnScreenController.Button.DPAD_LEFT -> KeyEvent.KEYCODE_DPAD_LEFT
-      OnScreenController.Button.DPAD_RIGHT -> KeyEvent.KEYCODE_DPAD_RIGHT
-      OnScreenController.Button.LEFT_TRIGGER -> KeyEvent.KEYCODE_BUTTON_L2
-      OnScreenController.Button.RIGHT_TRIGGER -> KeyEvent.KEYCODE_BUTTON_R2
-      OnScreenController.Button.START -> KeyEvent.KEYCODE_BUTTON_START
-      OnScreenController.Button.BACK -> KeyEvent.KEYCODE_BUTTON_SELECT
-      OnScreenController.Button.LEFT_STICK_BUTTON -> KeyEvent.KEYCODE_BUTTON_THUMBL
-      OnScreenController.Button.RIGHT_STICK_BUTTON -> KeyEvent.KEYCODE_BUTTON_THUMBR
-      OnScreenController.Button.WHITE -> KeyEvent.KEYCODE_BUTTON_L1
-      OnScreenController.Button.BLACK -> KeyEvent.KEYCODE_BUTTON_R1
+      OnScreenController.Button.A -> BUTTON_A
+      OnScreenController.Button.B -> BUTTON_B
+      OnScreenController.Button.X -> BUTTON_X
+      OnScreenController.Button.Y -> BUTTON_Y
+      OnScreenController.Button.DPAD_UP -> BUTTON_DPAD_UP
+      OnScreenController.Button.DPAD_DOWN -> BUTTON_DPAD_DOWN
+      OnScreenController.Button.DPAD_LEFT -> BUTTON_DPAD_LEFT
+      OnScreenController.Button.DPAD_RIGHT -> BUTTON_DPAD_RIGHT
+      OnScreenController.Button.START -> BUTTON_START
+      OnScreenController.Button.BACK -> BUTTON_BACK
+      OnScreenController.Button.LEFT_STICK_BUTTON -> BUTTON_LEFT_STICK
+      OnScreenController.Button.RIGHT_STICK_BUTTON -> BUTTON_RIGHT_STICK
+      OnScreenController.Button.WHITE -> BUTTON_LEFT_SHOULDER
+      OnScreenController.Button.BLACK -> BUTTON_RIGHT_SHOULDER
+      // Triggers are axes and handled by setButton
+      OnScreenController.Button.LEFT_TRIGGER,
+      OnScreenController.Button.RIGHT_TRIGGER -> -1
     }
   }
 }
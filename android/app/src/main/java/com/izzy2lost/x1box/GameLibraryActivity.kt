@@ -29,6 +29,8 @@ import java.io.File
 import java.io.FileInputStream
 import java.io.FileOutputStream
 import java.io.IOException
+import java.io.InputStream
+import java.io.OutputStream
 import java.net.URLEncoder
 import java.util.ArrayDeque
 import java.util.Locale
@@ -37,6 +39,7 @@ import java.util.concurrent.ConcurrentHashMap
 class GameLibraryActivity : AppCompatActivity() {
   companion object {
     const val EXTRA_RESTART_LAST_GAME = "com.izzy2lost.x1box.extra.RESTART_LAST_GAME"
+    private const val COPY_BUFFER_SIZE = 4 * 1024 * 1024
   }
 
   private data class GameEntry(
@@ -54,7 +57,7 @@ class GameLibraryActivity : AppCompatActivity() {
   )
 
   private val prefs by lazy { getSharedPreferences("x1box_prefs", MODE_PRIVATE) }
-  private val gameExts = setOf("iso", "xiso", "cso", "cci")
+  private val gameExts = setOf("iso", "xiso", "zxiso", "cso", "cci")
   private val titleStopWords = setOf("the", "a", "an", "and", "of", "for", "in", "on", "to")
   private val coverRepoBaseUrl = "https://raw.githubusercontent.com/izzy2lost/X1_Covers/main/"
   private val boxArtCache = ConcurrentHashMap<String, String>()
@@ -83,6 +86,7 @@ class GameLibraryActivity : AppCompatActivity() {
   private var useCoverGrid = false
   private var boxArtLookupEnabled = true
   @Volatile private var isConvertingIso = false
+  @Volatile private var isConversionCancelled = false
 
   private val pickGamesFolder =
     registerForActivityResult(ActivityResultContracts.OpenDocumentTree()) { uri ->
@@ -136,7 +140,12 @@ class GameLibraryActivity : AppCompatActivity() {
       startActivity(Intent(this, SettingsActivity::class.java))
     }
     btnConvertIso.setOnClickListener {
-      showIsoConversionPicker()
+      if (isConvertingIso) {
+        isConversionCancelled = true
+        btnConvertIso.isEnabled = false
+      } else {
+        showIsoConversionPicker()
+      }
     }
     btnAbout.setOnClickListener {
       showAboutDialog()
@@ -276,9 +285,13 @@ class GameLibraryActivity : AppCompatActivity() {
   }
 
   private fun updateConvertButtonState(games: List<GameEntry> = currentGames) {
+    // While converting, the button cancels
+    btnConvertIso.setText(
+      if (isConvertingIso) R.string.library_convert_cancel else R.string.library_convert_iso
+    )
     btnConvertIso.isEnabled = XisoConverterNative.isAvailable() &&
-      !isConvertingIso &&
-      games.any { game -> isConvertibleIso(game) }
+      (isConvertingIso && !isConversionCancelled ||
+        !isConvertingIso && games.any { game -> isConvertibleIso(game) })
   }
 
   private fun renderList(games: List<GameEntry>) {
@@ -685,16 +698,21 @@ class GameLibraryActivity : AppCompatActivity() {
     }
 
     isConvertingIso = true
+    isConversionCancelled = false
     updateConvertButtonState()
     setLoading(true, getString(R.string.library_converting_game, game.title))
 
     Thread {
       val error = convertIsoToXisoInFolder(game, outputName, overwrite)
       runOnUiThread {
+        val cancelled = isConversionCancelled
         isConvertingIso = false
+        isConversionCancelled = false
         setLoading(false, getString(R.string.library_loading_games))
         updateConvertButtonState()
-        if (error == null) {
+        if (cancelled) {
+          Toast.makeText(this, getString(R.string.library_convert_cancelled), Toast.LENGTH_SHORT).show()
+        } else if (error == null) {
           Toast.makeText(
             this,
             getString(R.string.library_convert_success, outputName),
@@ -742,17 +760,41 @@ class GameLibraryActivity : AppCompatActivity() {
       return getString(R.string.library_convert_create_output_failed)
     }
 
+    // Progress is posted whenever the shown percentage changes
+    var shownStage = 0
+    var shownPercent = -1
+    val reportProgress = { stage: Int, done: Long, total: Long ->
+      val percent = if (total > 0) (done * 100 / total).toInt().coerceIn(0, 100) else 0
+      if (stage != shownStage || percent != shownPercent) {
+        shownStage = stage
+        shownPercent = percent
+        runOnUiThread {
+          if (isConvertingIso) {
+            loadingText.text = getString(stage, game.title, percent)
+          }
+        }
+      }
+      !isConversionCancelled
+    }
+
     val token = System.currentTimeMillis()
     val inputTemp = File(stageDir, "input-$token.iso")
-    val outputTemp = File(stageDir, "output-$token.xiso.iso")
+    val outputTemp = File(stageDir, "output-$token.zxiso")
     var success = false
     try {
-      if (!copyUriToFile(game.uri, inputTemp)) {
+      val copiedIn = copyUriToFile(game.uri, inputTemp, game.sizeBytes) { done, total ->
+        reportProgress(R.string.library_convert_progress_copy_input, done, total)
+      }
+      if (!copiedIn) {
         return getString(R.string.library_convert_copy_input_failed)
       }
 
-      val nativeError =
-        XisoConverterNative.convertIsoToXiso(inputTemp.absolutePath, outputTemp.absolutePath)
+      val nativeError = XisoConverterNative.convertIsoToZxiso(
+        inputTemp.absolutePath,
+        outputTemp.absolutePath
+      ) { done, total ->
+        reportProgress(R.string.library_convert_progress_convert, done, total)
+      }
       if (!nativeError.isNullOrBlank()) {
         return nativeError
       }
@@ -761,7 +803,10 @@ class GameLibraryActivity : AppCompatActivity() {
         return "Converted image was empty"
       }
 
-      if (!copyFileToUri(outputTemp, outputDoc.uri)) {
+      val copiedOut = copyFileToUri(outputTemp, outputDoc.uri) { done, total ->
+        reportProgress(R.string.library_convert_progress_copy_output, done, total)
+      }
+      if (!copiedOut) {
         return getString(R.string.library_convert_copy_output_failed)
       }
       success = true
@@ -794,34 +839,63 @@ class GameLibraryActivity : AppCompatActivity() {
     return dir
   }
 
-  private fun copyUriToFile(uri: Uri, target: File): Boolean {
+  private fun copyUriToFile(
+    uri: Uri,
+    target: File,
+    size: Long,
+    onProgress: (Long, Long) -> Boolean
+  ): Boolean {
     return try {
       val input = contentResolver.openInputStream(uri) ?: return false
       input.use { stream ->
         FileOutputStream(target).use { output ->
-          stream.copyTo(output)
+          copyWithProgress(stream, output, size, onProgress)
         }
       }
-      true
     } catch (_: IOException) {
       false
     }
   }
 
-  private fun copyFileToUri(source: File, targetUri: Uri): Boolean {
+  private fun copyFileToUri(
+    source: File,
+    targetUri: Uri,
+    onProgress: (Long, Long) -> Boolean
+  ): Boolean {
     return try {
       val output = contentResolver.openOutputStream(targetUri, "w") ?: return false
       FileInputStream(source).use { input ->
         output.use { stream ->
-          input.copyTo(stream)
+          copyWithProgress(input, stream, source.length(), onProgress)
         }
       }
-      true
     } catch (_: IOException) {
       false
     }
   }
 
+  /** Returns false if [onProgress] cancelled the copy */
+  private fun copyWithProgress(
+    input: InputStream,
+    output: OutputStream,
+    total: Long,
+    onProgress: (Long, Long) -> Boolean
+  ): Boolean {
+    val buffer = ByteArray(COPY_BUFFER_SIZE)
+    var done = 0L
+    while (true) {
+      val read = input.read(buffer)
+      if (read < 0) {
+        return true
+      }
+      output.write(buffer, 0, read)
+      done += read
+      if (!onProgress(done, total)) {
+        return false
+      }
+    }
+  }
+
   private fun isConvertibleIso(game: GameEntry): Boolean {
     val lower = game.relativePath.lowercase(Locale.ROOT)
     return lower.endsWith(".iso") && !lower.endsWith(".xiso.iso")
@@ -830,7 +904,7 @@ class GameLibraryActivity : AppCompatActivity() {
   private fun buildXisoFileName(sourceName: String): String {
     val lower = sourceName.lowercase(Locale.ROOT)
     val stem = if (lower.endsWith(".iso")) sourceName.dropLast(4) else sourceName
-    return "$stem.xiso.iso"
+    return "$stem.zxiso"
   }
 
   private fun launchGame(game: GameEntry) {
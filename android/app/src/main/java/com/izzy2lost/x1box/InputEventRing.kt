@@ -0,0 +1,67 @@
+package com.izzy2lost.x1box
+
+import java.nio.ByteBuffer
+import java.nio.ByteOrder
+
+/**
+ * Shared-memory ring of timestamped controller events. The UI thread pushes
+ * events and commits them once per touch event; native code drains the ring
+ * each time SDL updates the on-screen controller. The layout must match
+ * xemu_input_android.c.
+ */
+object InputEventRing {
+  const val TYPE_BUTTON = 0
+  const val TYPE_AXIS = 1
+
+  private const val HEADER_SIZE = 64
+  private const val EVENT_SIZE = 16
+  private const val CAPACITY = 256
+
+  private val buffer: ByteBuffer = ByteBuffer
+    .allocateDirect(HEADER_SIZE + EVENT_SIZE * CAPACITY)
+    .order(ByteOrder.nativeOrder())
+  private var head = 0
+  private var committed = 0
+  private var attached = false
+
+  fun attach() {
+    if (!attached) {
+      nativeAttach(buffer)
+      attached = true
+    }
+  }
+
+  fun push(type: Int, index: Int, value: Float) {
+    if (!attached) return
+
+    // The read index lives in the header and is only written by native code
+    if (head - buffer.getInt(0) >= CAPACITY) {
+      commit()
+      if (head - buffer.getInt(0) >= CAPACITY) {
+        android.util.Log.w("InputEventRing", "Event ring full, dropping event")
+        return
+      }
+    }
+
+    val offset = HEADER_SIZE + (head and (CAPACITY - 1)) * EVENT_SIZE
+    buffer.putLong(offset, System.nanoTime())
+    buffer.put(offset + 8, type.toByte())
+    buffer.put(offset + 9, index.toByte())
+    buffer.putFloat(offset + 12, value)
+    head++
+  }
+
+  /** Hands everything pushed since the last commit to native code. */
+  fun commit() {
+    if (head != committed) {
+      committed = head
+      nativeCommit(head)
+    }
+  }
+
+  @JvmStatic
+  private external fun nativeAttach(buffer: ByteBuffer)
+
+  @JvmStatic
+  private external fun nativeCommit(head: Int)
+}
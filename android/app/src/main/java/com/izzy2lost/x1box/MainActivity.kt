@@ -111,39 +111,6 @@ class MainActivity : SDLActivity(), InputManager.InputDeviceListener {
     updateControllerVisibility()
   }
 
-  override fun onResume() {
-    super.onResume()
-    
-    // Register virtual controller after SDL is initialized
-    // Use a delay to ensure SDL is fully ready
-    mLayout?.postDelayed({
-      registerVirtualController()
-    }, 1000)
-  }
-
-  private fun registerVirtualController() {
-    try {
-      // Register the virtual on-screen controller as a joystick device
-      // Device ID: -2, Name: "On-Screen Controller"
-      org.libsdl.app.SDLControllerManager.nativeAddJoystick(
-        -2, // device_id
-        "On-Screen Controller", // name
-        "Virtual touchscreen controller", // desc
-        0x045e, // vendor_id (Microsoft)
-        0x028e, // product_id (Xbox 360 Controller)
-        false, // is_accelerometer
-        0xFFFF, // button_mask (all buttons)
-        6, // naxes (left X/Y, right X/Y, left trigger, right trigger)
-        0x3F, // axis_mask (6 axes)
-        0, // nhats
-        0  // nballs
-      )
-      android.util.Log.d("MainActivity", "Virtual controller registered successfully")
-    } catch (e: Exception) {
-      android.util.Log.e("MainActivity", "Failed to register virtual controller: ${e.message}")
-    }
-  }
-
   private fun setupControllerDetection() {
     inputManager = getSystemService(Context.INPUT_SERVICE) as InputManager
     inputManager?.registerInputDeviceListener(this, null)
@@ -195,6 +162,12 @@ class MainActivity : SDLActivity(), InputManager.InputDeviceListener {
     checkForPhysicalControllers()
   }
 
+  override fun onTrimMemory(level: Int) {
+    super.onTrimMemory(level)
+    // Let the renderer drop cached textures, surfaces and pipelines
+    nativeTrimMemory(level)
+  }
+
   override fun onInputDeviceChanged(deviceId: Int) {
     // Recheck all devices in case configuration changed
     checkForPhysicalControllers()
@@ -204,13 +177,6 @@ class MainActivity : SDLActivity(), InputManager.InputDeviceListener {
     inGameMenuDialog?.dismiss()
     inGameMenuDialog = null
 
-    // Unregister virtual controller
-    try {
-      org.libsdl.app.SDLControllerManager.nativeRemoveJoystick(-2)
-    } catch (e: Exception) {
-      android.util.Log.e("MainActivity", "Failed to unregister virtual controller: ${e.message}")
-    }
-    
     inputManager?.unregisterInputDeviceListener(this)
     super.onDestroy()
   }
@@ -331,4 +297,9 @@ class MainActivity : SDLActivity(), InputManager.InputDeviceListener {
     "SDL2",
     "xemu",
   )
+
+  companion object {
+    @JvmStatic
+    private external fun nativeTrimMemory(level: Int)
+  }
 }
@@ -58,6 +58,8 @@ class OnScreenController @JvmOverloads constructor(
     fun onStickMoved(stick: Stick, x: Float, y: Float)
     fun onStickPressed(stick: Stick)
     fun onStickReleased(stick: Stick)
+    /** Called once all events from a touch event have been delivered. */
+    fun onTouchEventHandled() {}
   }
 
   init {
@@ -315,6 +317,7 @@ class OnScreenController @JvmOverloads constructor(
       }
     }
 
+    controllerListener?.onTouchEventHandled()
     invalidate()
     return true
   }
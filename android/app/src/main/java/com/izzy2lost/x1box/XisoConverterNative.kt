@@ -1,6 +1,11 @@
 package com.izzy2lost.x1box
 
 object XisoConverterNative {
+  /** Called on the converting thread with bytes done and total. Return false to cancel. */
+  fun interface ProgressListener {
+    fun onProgress(done: Long, total: Long): Boolean
+  }
+
   private val isLibraryLoaded: Boolean = try {
     System.loadLibrary("xiso_converter")
     true
@@ -9,13 +14,35 @@ object XisoConverterNative {
   }
 
   @JvmStatic
-  private external fun nativeConvertIsoToXiso(inputPath: String, outputPath: String): String?
+  private external fun nativeConvert(
+    inputPath: String,
+    outputPath: String,
+    compress: Boolean,
+    listener: ProgressListener?
+  ): String?
+
+  fun convertIsoToXiso(
+    inputPath: String,
+    outputPath: String,
+    listener: ProgressListener? = null
+  ): String? = convert(inputPath, outputPath, false, listener)
+
+  fun convertIsoToZxiso(
+    inputPath: String,
+    outputPath: String,
+    listener: ProgressListener? = null
+  ): String? = convert(inputPath, outputPath, true, listener)
 
-  fun convertIsoToXiso(inputPath: String, outputPath: String): String? {
+  private fun convert(
+    inputPath: String,
+    outputPath: String,
+    compress: Boolean,
+    listener: ProgressListener?
+  ): String? {
     if (!isLibraryLoaded) {
       return "ISO converter native library is unavailable"
     }
-    return nativeConvertIsoToXiso(inputPath, outputPath)
+    return nativeConvert(inputPath, outputPath, compress, listener)
   }
 
   fun isAvailable(): Boolean = isLibraryLoaded
@@ -1,11 +1,17 @@
-use std::ffi::{c_char, CStr};
+use std::ffi::{c_char, c_int, c_uint, c_void, CStr};
 use std::fs::File;
-use std::io::{BufReader, BufWriter, Write};
+use std::io::{self, Read, Seek, SeekFrom, Write};
+use std::os::unix::fs::FileExt;
 use std::path::{Path, PathBuf};
+use std::sync::mpsc::{sync_channel, SyncSender};
+use std::sync::{Arc, Mutex};
+use std::thread::JoinHandle;
 
 use anyhow::{anyhow, bail, Context};
 use xdvdfs::blockdev::OffsetWrapper;
-use xdvdfs::write::fs::{StdIOCopier, XDVDFSFilesystem};
+use xdvdfs::write::fs::{
+    dir_tree, FileType, RWCopier, XDVDFSFilesystem, XDVDFSFilesystemError,
+};
 use xdvdfs::write::img::{create_xdvdfs_image, NoOpProgressVisitor};
 
 fn canonical_or_absolute(path: &Path) -> std::io::Result<PathBuf> {
@@ -21,7 +27,430 @@ fn canonical_or_absolute(path: &Path) -> std::io::Result<PathBuf> {
     }
 }
 
-fn convert_iso_to_xiso(input: &Path, output: &Path) -> anyhow::Result<()> {
+// Image data moves in large sector-aligned blocks. Writes go to a thread
+// that keeps a few blocks queued, so reading the next block overlaps them.
+const IO_BLOCK_SIZE: usize = 4 * 1024 * 1024;
+const WRITE_QUEUE_DEPTH: usize = 3;
+const PROGRESS_STEP: u64 = 16 * 1024 * 1024;
+const SECTOR_SIZE: u64 = 2048;
+
+/// Called with the work done and the total, in bytes. Returning 0 cancels.
+pub type XisoProgressFn =
+    Option<unsafe extern "C" fn(user_data: *mut c_void, done: u64, total: u64) -> c_int>;
+
+struct Progress {
+    callback: XisoProgressFn,
+    user_data: *mut c_void,
+    total: u64,
+    base: u64,
+    reported: u64,
+    cancelled: bool,
+}
+
+// SAFETY: the callback and its data are only used from the converting
+// thread, the writer thread never touches them.
+unsafe impl Send for Progress {}
+unsafe impl Sync for Progress {}
+
+impl Progress {
+    fn new(callback: XisoProgressFn, user_data: *mut c_void) -> Self {
+        Self {
+            callback,
+            user_data,
+            total: 0,
+            base: 0,
+            reported: 0,
+            cancelled: false,
+        }
+    }
+
+    /// Report `done` bytes into the current pass, which started at `base`
+    fn update(&mut self, done: u64, force: bool) -> io::Result<()> {
+        let done = (self.base + done).min(self.total);
+        if self.cancelled {
+            return Err(io::Error::other("Conversion cancelled"));
+        }
+        if !force && done < self.reported + PROGRESS_STEP {
+            return Ok(());
+        }
+        self.reported = done;
+
+        let Some(callback) = self.callback else {
+            return Ok(());
+        };
+        // SAFETY: caller contract of the exported conversion functions.
+        if unsafe { callback(self.user_data, done, self.total) } == 0 {
+            self.cancelled = true;
+            return Err(io::Error::other("Conversion cancelled"));
+        }
+        Ok(())
+    }
+}
+
+/// Output file written through a queue of large blocks on a second thread.
+/// Seeks only start a new block, so writes land with positional I/O.
+struct WriteBehind<'a> {
+    queue: Option<SyncSender<(u64, Vec<u8>)>>,
+    worker: Option<JoinHandle<io::Result<()>>>,
+    free: Arc<Mutex<Vec<Vec<u8>>>>,
+    block: Vec<u8>,
+    block_offset: u64,
+    len: u64,
+    queued: u64,
+    progress: Option<&'a mut Progress>,
+}
+
+impl<'a> WriteBehind<'a> {
+    fn new(file: File, progress: Option<&'a mut Progress>) -> Self {
+        let (queue, blocks) = sync_channel::<(u64, Vec<u8>)>(WRITE_QUEUE_DEPTH);
+        let free = Arc::new(Mutex::new(Vec::new()));
+        let worker_free = free.clone();
+        let worker = std::thread::spawn(move || -> io::Result<()> {
+            for (offset, mut block) in blocks {
+                file.write_all_at(&block, offset)?;
+                block.clear();
+                worker_free.lock().unwrap().push(block);
+            }
+            Ok(())
+        });
+
+        Self {
+            queue: Some(queue),
+            worker: Some(worker),
+            free,
+            block: Vec::with_capacity(IO_BLOCK_SIZE),
+            block_offset: 0,
+            len: 0,
+            queued: 0,
+            progress,
+        }
+    }
+
+    fn pos(&self) -> u64 {
+        self.block_offset + self.block.len() as u64
+    }
+
+    fn worker_error(&mut self) -> io::Error {
+        self.queue = None;
+        match self.worker.take().map(|w| w.join()) {
+            Some(Ok(Err(e))) => e,
+            _ => io::Error::other("Image writer stopped"),
+        }
+    }
+
+    fn submit(&mut self) -> io::Result<()> {
+        if self.block.is_empty() {
+            return Ok(());
+        }
+
+        let next = self
+            .free
+            .lock()
+            .unwrap()
+            .pop()
+            .unwrap_or_else(|| Vec::with_capacity(IO_BLOCK_SIZE));
+        let block = std::mem::replace(&mut self.block, next);
+        let len = block.len() as u64;
+        let offset = self.block_offset;
+        self.block_offset += len;
+
+        let sent = match &self.queue {
+            Some(queue) => queue.send((offset, block)).is_ok(),
+            None => false,
+        };
+        if !sent {
+            return Err(self.worker_error());
+        }
+
+        self.queued += len;
+        if let Some(progress) = self.progress.as_deref_mut() {
+            progress.update(self.queued, false)?;
+        }
+        Ok(())
+    }
+
+    /// Copy `size` bytes from the current position of `src` to `offset`,
+    /// reading straight into the queued blocks.
+    fn copy_from(&mut self, src: &mut File, offset: u64, size: u64) -> io::Result<u64> {
+        self.seek(SeekFrom::Start(offset))?;
+
+        let mut remaining = size;
+        while remaining > 0 {
+            let start = self.block.len();
+            let n = (IO_BLOCK_SIZE - start).min(remaining as usize);
+            self.block.resize(start + n, 0);
+            src.read_exact(&mut self.block[start..])?;
+            remaining -= n as u64;
+
+            self.len = self.len.max(self.pos());
+            if self.block.len() == IO_BLOCK_SIZE {
+                self.submit()?;
+            }
+        }
+        Ok(size)
+    }
+
+    /// Write out everything queued and wait for it
+    fn finish(mut self) -> io::Result<()> {
+        self.submit()?;
+        self.queue = None;
+        match self.worker.take().map(|w| w.join()) {
+            Some(Ok(result)) => result,
+            _ => Err(io::Error::other("Image writer panicked")),
+        }
+    }
+}
+
+impl Write for WriteBehind<'_> {
+    fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+        let n = (IO_BLOCK_SIZE - self.block.len()).min(buf.len());
+        self.block.extend_from_slice(&buf[..n]);
+        self.len = self.len.max(self.pos());
+        if self.block.len() == IO_BLOCK_SIZE {
+            self.submit()?;
+        }
+        Ok(n)
+    }
+
+    fn flush(&mut self) -> io::Result<()> {
+        self.submit()
+    }
+}
+
+impl Seek for WriteBehind<'_> {
+    fn seek(&mut self, pos: SeekFrom) -> io::Result<u64> {
+        let target = match pos {
+            SeekFrom::Start(p) => Some(p),
+            SeekFrom::End(d) => self.len.checked_add_signed(d),
+            SeekFrom::Current(d) => self.pos().checked_add_signed(d),
+        }
+        .ok_or_else(|| io::Error::new(io::ErrorKind::InvalidInput, "Invalid seek"))?;
+
+        if target != self.pos() {
+            self.submit()?;
+            self.block_offset = target;
+        }
+        Ok(target)
+    }
+}
+
+impl Drop for WriteBehind<'_> {
+    fn drop(&mut self) {
+        self.queue = None;
+        if let Some(worker) = self.worker.take() {
+            let _ = worker.join();
+        }
+    }
+}
+
+/// Copies file data from the source image into the queued output blocks
+#[derive(Default)]
+struct ImageCopier;
+
+impl<'a> RWCopier<OffsetWrapper<File>, WriteBehind<'a>> for ImageCopier {
+    fn copy(
+        &mut self,
+        offset_in: u64,
+        offset_out: u64,
+        size: u64,
+        src: &mut OffsetWrapper<File>,
+        dest: &mut WriteBehind<'a>,
+    ) -> Result<u64, XDVDFSFilesystemError<io::Error, io::Error>> {
+        src.seek(SeekFrom::Start(offset_in))
+            .map_err(XDVDFSFilesystemError::BlockDevReadErr)?;
+        dest.copy_from(src.get_mut(), offset_out, size)
+            .map_err(XDVDFSFilesystemError::BlockDevWriteErr)
+    }
+}
+
+type SourceFilesystem<'a> = XDVDFSFilesystem<OffsetWrapper<File>, WriteBehind<'a>, ImageCopier>;
+
+/// Bytes of file data the rebuilt image will hold, for progress
+fn image_data_size(fs: &mut SourceFilesystem<'_>) -> anyhow::Result<u64> {
+    let tree = dir_tree(fs, &mut |_| {}).context("Failed to read XDVDFS directory tree")?;
+    Ok(tree
+        .iter()
+        .flat_map(|dir| dir.listing.iter())
+        .filter(|(entry, _)| matches!(entry.file_type, FileType::File))
+        .map(|(entry, _)| entry.len.next_multiple_of(SECTOR_SIZE))
+        .sum::<u64>()
+        .max(1))
+}
+
+// zstd comes from the native build, the final library links it.
+extern "C" {
+    fn ZSTD_compressBound(src_size: usize) -> usize;
+    fn ZSTD_compress(
+        dst: *mut c_void,
+        dst_capacity: usize,
+        src: *const c_void,
+        src_size: usize,
+        compression_level: c_int,
+    ) -> usize;
+    fn ZSTD_isError(code: usize) -> c_uint;
+}
+
+// Compressed image layout, read by block/zxiso.c:
+// "ZXIS", u32 version, u32 chunk size, u32 codec, u64 image size,
+// u64 reserved, u64 offsets[chunks + 1], then the chunk data.
+const ZXISO_MAGIC: &[u8; 4] = b"ZXIS";
+const ZXISO_VERSION: u32 = 1;
+const ZXISO_CODEC_ZSTD: u32 = 1;
+const ZXISO_HEADER_SIZE: u64 = 32;
+const ZXISO_CHUNK_SIZE: usize = 64 * 1024;
+const ZXISO_LEVEL: c_int = 9;
+
+#[derive(Clone, Copy, PartialEq, Eq)]
+pub enum XisoFormat {
+    Plain,
+    Compressed,
+}
+
+fn compress_chunk(chunk: &[u8]) -> anyhow::Result<Vec<u8>> {
+    // Padding is dropped, and chunks that do not shrink are stored as is
+    if chunk.iter().all(|&b| b == 0) {
+        return Ok(Vec::new());
+    }
+
+    // SAFETY: buffers are valid for the lengths passed.
+    unsafe {
+        let mut out = vec![0u8; ZSTD_compressBound(chunk.len())];
+        let n = ZSTD_compress(
+            out.as_mut_ptr() as *mut c_void,
+            out.len(),
+            chunk.as_ptr() as *const c_void,
+            chunk.len(),
+            ZXISO_LEVEL,
+        );
+        if ZSTD_isError(n) != 0 {
+            bail!("zstd compression failed");
+        }
+        if n >= chunk.len() {
+            return Ok(chunk.to_vec());
+        }
+        out.truncate(n);
+        Ok(out)
+    }
+}
+
+fn compress_batch(batch: &[u8], threads: usize) -> anyhow::Result<Vec<Vec<u8>>> {
+    let pieces: Vec<&[u8]> = batch.chunks(ZXISO_CHUNK_SIZE).collect();
+    let per_thread = pieces.len().div_ceil(threads);
+    std::thread::scope(|scope| {
+        let handles: Vec<_> = pieces
+            .chunks(per_thread)
+            .map(|group| {
+                scope.spawn(move || {
+                    group
+                        .iter()
+                        .map(|chunk| compress_chunk(chunk))
+                        .collect::<anyhow::Result<Vec<_>>>()
+                })
+            })
+            .collect();
+        let mut out = Vec::with_capacity(pieces.len());
+        for h in handles {
+            out.extend(h.join().map_err(|_| anyhow!("Compression thread panicked"))??);
+        }
+        Ok(out)
+    })
+}
+
+fn compress_xiso(input: &Path, output: &Path, progress: &mut Progress) -> anyhow::Result<()> {
+    let mut source = File::open(input)
+        .with_context(|| format!("Failed to open XISO image: {}", input.display()))?;
+    let size = source.metadata()?.len();
+    let chunks = size.div_ceil(ZXISO_CHUNK_SIZE as u64) as usize;
+
+    let output_file = File::options()
+        .write(true)
+        .truncate(true)
+        .create(true)
+        .open(output)
+        .with_context(|| format!("Failed to open output file: {}", output.display()))?;
+    let mut writer = WriteBehind::new(output_file, None);
+
+    let index_size = (chunks as u64 + 1) * 8;
+    let mut offsets = Vec::with_capacity(chunks + 1);
+    let mut pos = ZXISO_HEADER_SIZE + index_size;
+    writer.seek(SeekFrom::Start(pos))?;
+
+    // Chunks are compressed in parallel a batch at a time, while the next
+    // batch is read
+    let threads = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let batch_size = threads * 4 * ZXISO_CHUNK_SIZE;
+
+    std::thread::scope(|scope| -> anyhow::Result<()> {
+        let (batches, ready) = sync_channel::<io::Result<Vec<u8>>>(1);
+        scope.spawn(move || {
+            let mut remaining = size;
+            while remaining > 0 {
+                let len = remaining.min(batch_size as u64) as usize;
+                let mut batch = vec![0u8; len];
+                let result = source.read_exact(&mut batch).map(|_| batch);
+                let failed = result.is_err();
+                if batches.send(result).is_err() || failed {
+                    return;
+                }
+                remaining -= len as u64;
+            }
+        });
+
+        let mut read = 0u64;
+        for batch in ready {
+            let batch = batch.context("Failed to read XISO image")?;
+            read += batch.len() as u64;
+
+            for data in compress_batch(&batch, threads)? {
+                offsets.push(pos);
+                writer.write_all(&data).context("Failed to write compressed image")?;
+                pos += data.len() as u64;
+            }
+
+            // This pass covers the same data as the first one
+            let done = read.saturating_mul(progress.total - progress.base) / size.max(1);
+            progress.update(done, false)?;
+        }
+        Ok(())
+    })?;
+    offsets.push(pos);
+
+    writer.seek(SeekFrom::Start(0))?;
+    writer.write_all(ZXISO_MAGIC)?;
+    writer.write_all(&ZXISO_VERSION.to_le_bytes())?;
+    writer.write_all(&(ZXISO_CHUNK_SIZE as u32).to_le_bytes())?;
+    writer.write_all(&ZXISO_CODEC_ZSTD.to_le_bytes())?;
+    writer.write_all(&size.to_le_bytes())?;
+    writer.write_all(&0u64.to_le_bytes())?;
+    for offset in offsets {
+        writer.write_all(&offset.to_le_bytes())?;
+    }
+    writer
+        .finish()
+        .context("Failed to write compressed image")?;
+
+    Ok(())
+}
+
+fn write_xiso<'a>(
+    mut fs: SourceFilesystem<'a>,
+    output_file: File,
+    progress: &'a mut Progress,
+) -> anyhow::Result<()> {
+    let mut output_writer = WriteBehind::new(output_file, Some(progress));
+    create_xdvdfs_image(&mut fs, &mut output_writer, NoOpProgressVisitor)
+        .context("Failed while creating XISO image")?;
+    output_writer
+        .finish()
+        .context("Failed to write output image")
+}
+
+fn convert_iso_to_xiso(
+    input: &Path,
+    output: &Path,
+    format: XisoFormat,
+    progress: &mut Progress,
+) -> anyhow::Result<()> {
     let input_meta = std::fs::metadata(input)
         .with_context(|| format!("Failed to read input metadata: {}", input.display()))?;
     if !input_meta.is_file() {
@@ -46,29 +475,59 @@ fn convert_iso_to_xiso(input: &Path, output: &Path) -> anyhow::Result<()> {
         }
     }
 
+    // Only the XDVDFS tree is walked and copied, the filler between files
+    // on a pressed disc image is never read
     let source_file = File::open(input)
         .with_context(|| format!("Failed to open input file: {}", input.display()))?;
-    let source = BufReader::new(source_file);
-    let source = OffsetWrapper::new(source)
+    let source = OffsetWrapper::new(source_file)
         .with_context(|| format!("Input is not a valid Xbox ISO/XISO image: {}", input.display()))?;
 
-    let mut fs = XDVDFSFilesystem::<_, _, StdIOCopier<_, _>>::new(source)
+    let mut fs = SourceFilesystem::new(source)
         .ok_or_else(|| anyhow!("Failed to mount XDVDFS source image"))?;
 
+    let data_size = image_data_size(&mut fs)?;
+    progress.total = match format {
+        XisoFormat::Plain => data_size,
+        XisoFormat::Compressed => data_size * 2,
+    };
+    progress.update(0, true)?;
+
+    // The compressed image is made from a plain XISO written next to it
+    let xiso_path = match format {
+        XisoFormat::Plain => output.to_path_buf(),
+        XisoFormat::Compressed => {
+            let mut name = output.as_os_str().to_owned();
+            name.push(".tmp");
+            PathBuf::from(name)
+        }
+    };
+
     let output_file = File::options()
         .write(true)
         .truncate(true)
         .create(true)
-        .open(output)
-        .with_context(|| format!("Failed to open output file: {}", output.display()))?;
-    let mut output_writer = BufWriter::with_capacity(1024 * 1024, output_file);
+        .open(&xiso_path)
+        .with_context(|| format!("Failed to open output file: {}", xiso_path.display()))?;
 
-    create_xdvdfs_image(&mut fs, &mut output_writer, NoOpProgressVisitor)
-        .context("Failed while creating XISO image")?;
-    output_writer
-        .flush()
-        .context("Failed to flush output image writer")?;
+    let result = write_xiso(fs, output_file, progress).and_then(|()| {
+        if format == XisoFormat::Compressed {
+            progress.base = data_size;
+            compress_xiso(&xiso_path, output, progress)?;
+        }
+        Ok(())
+    });
 
+    if format == XisoFormat::Compressed {
+        let _ = std::fs::remove_file(&xiso_path);
+    }
+    if progress.cancelled {
+        let _ = std::fs::remove_file(output);
+        bail!("Conversion cancelled");
+    }
+    result?;
+
+    progress.base = 0;
+    progress.update(progress.total, true)?;
     Ok(())
 }
 
@@ -99,18 +558,31 @@ fn c_path_to_owned(ptr: *const c_char, arg_name: &str) -> anyhow::Result<String>
     Ok(s.to_owned())
 }
 
+/// Convert `input_path` into a rebuilt XISO, or a compressed ZXISO when
+/// `compress` is set. Returns 0 on success, 3 if `progress` cancelled it,
+/// and otherwise leaves a message in `err_buf`.
 #[no_mangle]
-pub extern "C" fn xiso_convert_iso_to_xiso(
+pub extern "C" fn xiso_convert_image(
     input_path: *const c_char,
     output_path: *const c_char,
+    compress: c_int,
+    progress: XisoProgressFn,
+    user_data: *mut c_void,
     err_buf: *mut c_char,
     err_buf_len: usize,
 ) -> i32 {
-    let outcome = std::panic::catch_unwind(|| {
+    let format = if compress != 0 {
+        XisoFormat::Compressed
+    } else {
+        XisoFormat::Plain
+    };
+    let mut progress = Progress::new(progress, user_data);
+
+    let outcome = std::panic::catch_unwind(std::panic::AssertUnwindSafe(|| {
         let input = c_path_to_owned(input_path, "input_path")?;
         let output = c_path_to_owned(output_path, "output_path")?;
-        convert_iso_to_xiso(Path::new(&input), Path::new(&output))
-    });
+        convert_iso_to_xiso(Path::new(&input), Path::new(&output), format, &mut progress)
+    }));
 
     match outcome {
         Ok(Ok(())) => {
@@ -119,7 +591,11 @@ pub extern "C" fn xiso_convert_iso_to_xiso(
         }
         Ok(Err(e)) => {
             write_err_buf(err_buf, err_buf_len, &e.to_string());
-            1
+            if progress.cancelled {
+                3
+            } else {
+                1
+            }
         }
         Err(_) => {
             write_err_buf(err_buf, err_buf_len, "ISO conversion panicked");
@@ -0,0 +1,308 @@
+/*
+ * Block protocol driver for inherited file descriptors
+ *
+ * On Android, images picked through the Storage Access Framework are only
+ * reachable as file descriptors handed out by a content provider, and there
+ * is often no path the image could be reopened from. This driver does
+ * positioned I/O on such a descriptor directly, so images don't have to be
+ * copied into app storage first. Filenames take the form "saf-fd:<fd>".
+ * The descriptor is duplicated on open, so the caller may keep or close its
+ * own copy.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/thread-pool.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qobject/qdict.h"
+
+#define SAF_FD_PREFIX "saf-fd:"
+#define SAF_FD_OPT_FD "fd"
+
+typedef struct BDRVSafFdState {
+    int fd;
+    bool writable;
+} BDRVSafFdState;
+
+typedef struct SafFdRequest {
+    int fd;
+    int64_t offset;
+    QEMUIOVector *qiov;
+    bool write;
+} SafFdRequest;
+
+static QemuOptsList saf_fd_opts = {
+    .name = "saf-fd",
+    .head = QTAILQ_HEAD_INITIALIZER(saf_fd_opts.head),
+    .desc = {
+        {
+            .name = SAF_FD_OPT_FD,
+            .type = QEMU_OPT_NUMBER,
+            .help = "File descriptor to read and write",
+        },
+        { /* end of list */ }
+    },
+};
+
+static void saf_fd_parse_filename(const char *filename, QDict *options,
+                                  Error **errp)
+{
+    const char *fd_str;
+    int fd;
+
+    if (!strstart(filename, SAF_FD_PREFIX, &fd_str) ||
+        qemu_strtoi(fd_str, NULL, 10, &fd) || fd < 0) {
+        error_setg(errp, "Filename must be of the form '" SAF_FD_PREFIX
+                   "<fd>'");
+        return;
+    }
+
+    qdict_put_int(options, SAF_FD_OPT_FD, fd);
+}
+
+static int saf_fd_open(BlockDriverState *bs, QDict *options, int flags,
+                       Error **errp)
+{
+    BDRVSafFdState *s = bs->opaque;
+    QemuOpts *opts;
+    struct stat st;
+    int fd, mode;
+
+    opts = qemu_opts_create(&saf_fd_opts, NULL, 0, &error_abort);
+    qemu_opts_absorb_qdict(opts, options, &error_abort);
+    fd = qemu_opt_get_number(opts, SAF_FD_OPT_FD, -1);
+    qemu_opts_del(opts);
+
+    if (fd < 0) {
+        error_setg(errp, "No file descriptor given");
+        return -EINVAL;
+    }
+
+    mode = fcntl(fd, F_GETFL);
+    if (mode < 0) {
+        error_setg_errno(errp, errno, "Invalid file descriptor %d", fd);
+        return -errno;
+    }
+    s->writable = (mode & O_ACCMODE) != O_RDONLY;
+    if ((flags & BDRV_O_RDWR) && !s->writable) {
+        error_setg(errp, "File descriptor %d was opened read-only", fd);
+        return -EACCES;
+    }
+
+    /* Pipes and sockets can't do positioned I/O */
+    if (fstat(fd, &st) < 0 || !(S_ISREG(st.st_mode) || S_ISBLK(st.st_mode))) {
+        error_setg(errp, "File descriptor %d is not seekable", fd);
+        return -EINVAL;
+    }
+
+    s->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (s->fd < 0) {
+        error_setg_errno(errp, errno, "Could not duplicate file descriptor");
+        return -errno;
+    }
+
+    return 0;
+}
+
+static void saf_fd_close(BlockDriverState *bs)
+{
+    BDRVSafFdState *s = bs->opaque;
+
+    if (s->fd >= 0) {
+        qemu_close(s->fd);
+        s->fd = -1;
+    }
+}
+
+static int saf_fd_reopen_prepare(BDRVReopenState *state,
+                                 BlockReopenQueue *queue, Error **errp)
+{
+    BDRVSafFdState *s = state->bs->opaque;
+
+    if ((state->flags & BDRV_O_RDWR) && !s->writable) {
+        error_setg(errp, "File descriptor was opened read-only");
+        return -EACCES;
+    }
+    return 0;
+}
+
+static void saf_fd_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    bs->bl.request_alignment = 1;
+}
+
+static int saf_fd_rw_worker(void *opaque)
+{
+    SafFdRequest *req = opaque;
+    size_t done = 0;
+
+    while (done < req->qiov->size) {
+        struct iovec iov[IOV_MAX];
+        unsigned int niov = iov_copy(iov, ARRAY_SIZE(iov), req->qiov->iov,
+                                     req->qiov->niov, done,
+                                     req->qiov->size - done);
+        ssize_t len = req->write ?
+            pwritev(req->fd, iov, niov, req->offset + done) :
+            preadv(req->fd, iov, niov, req->offset + done);
+
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (len == 0) {
+            if (req->write) {
+                return -EIO;
+            }
+            /* Reads past the end of the image return zeroes */
+            qemu_iovec_memset(req->qiov, done, 0, req->qiov->size - done);
+            break;
+        }
+        done += len;
+    }
+    return 0;
+}
+
+/*
+ * Same escape hatch as file-posix: some Android devices crash switching
+ * coroutines through the thread pool, so I/O can be forced inline.
+ */
+static int coroutine_fn saf_fd_submit(ThreadPoolFunc *func, void *arg)
+{
+#ifdef __ANDROID__
+    static int inline_aio = -1;
+    if (inline_aio < 0) {
+        const char *value = getenv("XEMU_ANDROID_INLINE_AIO");
+        inline_aio = (value && value[0] != '0') ? 1 : 0;
+    }
+    if (inline_aio) {
+        return func(arg);
+    }
+#endif
+    return thread_pool_submit_co(func, arg);
+}
+
+static int coroutine_fn saf_fd_co_preadv(BlockDriverState *bs, int64_t offset,
+                                         int64_t bytes, QEMUIOVector *qiov,
+                                         BdrvRequestFlags flags)
+{
+    BDRVSafFdState *s = bs->opaque;
+    SafFdRequest req = {
+        .fd = s->fd,
+        .offset = offset,
+        .qiov = qiov,
+        .write = false,
+    };
+
+    assert(qiov->size == bytes);
+    return saf_fd_submit(saf_fd_rw_worker, &req);
+}
+
+static int coroutine_fn saf_fd_co_pwritev(BlockDriverState *bs, int64_t offset,
+                                          int64_t bytes, QEMUIOVector *qiov,
+                                          BdrvRequestFlags flags)
+{
+    BDRVSafFdState *s = bs->opaque;
+    SafFdRequest req = {
+        .fd = s->fd,
+        .offset = offset,
+        .qiov = qiov,
+        .write = true,
+    };
+
+    assert(qiov->size == bytes);
+    return saf_fd_submit(saf_fd_rw_worker, &req);
+}
+
+static int saf_fd_flush_worker(void *opaque)
+{
+    int fd = *(int *)opaque;
+    return qemu_fdatasync(fd) < 0 ? -errno : 0;
+}
+
+static int coroutine_fn saf_fd_co_flush(BlockDriverState *bs)
+{
+    BDRVSafFdState *s = bs->opaque;
+
+    if (!s->writable) {
+        return 0;
+    }
+    return saf_fd_submit(saf_fd_flush_worker, &s->fd);
+}
+
+static int64_t coroutine_fn saf_fd_co_getlength(BlockDriverState *bs)
+{
+    BDRVSafFdState *s = bs->opaque;
+    off_t len = lseek(s->fd, 0, SEEK_END);
+
+    return len < 0 ? -errno : len;
+}
+
+static int coroutine_fn saf_fd_co_truncate(BlockDriverState *bs,
+                                           int64_t offset, bool exact,
+                                           PreallocMode prealloc,
+                                           BdrvRequestFlags flags,
+                                           Error **errp)
+{
+    BDRVSafFdState *s = bs->opaque;
+    int64_t cur = saf_fd_co_getlength(bs);
+
+    if (prealloc != PREALLOC_MODE_OFF) {
+        error_setg(errp, "Unsupported preallocation mode '%s'",
+                   PreallocMode_str(prealloc));
+        return -ENOTSUP;
+    }
+    if (cur < 0) {
+        error_setg_errno(errp, -cur, "Could not determine image size");
+        return cur;
+    }
+    /* Only shrink a user's image when an exact size is asked for */
+    if (!exact && offset <= cur) {
+        return 0;
+    }
+    if (ftruncate(s->fd, offset) < 0) {
+        error_setg_errno(errp, errno, "Could not resize image");
+        return -errno;
+    }
+    return 0;
+}
+
+static const char *const saf_fd_strong_runtime_opts[] = {
+    SAF_FD_OPT_FD,
+
+    NULL
+};
+
+static BlockDriver bdrv_saf_fd = {
+    .format_name            = "saf-fd",
+    .protocol_name          = "saf-fd",
+    .instance_size          = sizeof(BDRVSafFdState),
+
+    .bdrv_parse_filename    = saf_fd_parse_filename,
+    .bdrv_open              = saf_fd_open,
+    .bdrv_close             = saf_fd_close,
+    .bdrv_reopen_prepare    = saf_fd_reopen_prepare,
+    .bdrv_refresh_limits    = saf_fd_refresh_limits,
+
+    .bdrv_co_preadv         = saf_fd_co_preadv,
+    .bdrv_co_pwritev        = saf_fd_co_pwritev,
+    .bdrv_co_flush_to_disk  = saf_fd_co_flush,
+    .bdrv_co_getlength      = saf_fd_co_getlength,
+    .bdrv_co_truncate       = saf_fd_co_truncate,
+
+    .strong_runtime_opts    = saf_fd_strong_runtime_opts,
+};
+
+static void bdrv_saf_fd_init(void)
+{
+    bdrv_register(&bdrv_saf_fd);
+}
+
+block_init(bdrv_saf_fd_init);
@@ -0,0 +1,497 @@
+/*
+ * Read cache filter for Xbox disc images
+ *
+ * Disc images are often kept on slow storage (SD cards, network shares)
+ * while the DVD drive issues small synchronous reads. This filter keeps an
+ * LRU cache of large chunks of the image in RAM. The XDVDFS directory is
+ * parsed when the image is opened, and once the guest reads from a file the
+ * rest of its extent is prefetched sequentially, a window at a time, so
+ * streaming titles are served from memory.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/xdvd-cache.h"
+#include "qemu/bitmap.h"
+#include "qemu/coroutine.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/stats64.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "trace.h"
+
+#define XDVD_CACHE_OPT_SIZE "cache-size"
+
+#define XDVD_CHUNK_SIZE (256 * KiB)
+#define XDVD_PREFETCH_WINDOW (8 * MiB)
+
+#define XDVD_SECTOR_SIZE 2048
+#define XDVD_VOLUME_SECTOR 32
+#define XDVD_MAGIC "MICROSOFT*XBOX*MEDIA"
+#define XDVD_MAGIC_LEN 20
+#define XDVD_ATTR_DIRECTORY 0x10
+#define XDVD_MAX_DIR_SIZE (16 * MiB)
+#define XDVD_MAX_ENTRIES (1 << 20)
+
+/* Game partition offsets of plain XISO and full XGD1/2/3 images */
+static const int64_t xdvd_partition_offsets[] = {
+    0, 0x18300000, 0xfd90000, 0x2080000,
+};
+
+typedef struct XdvdExtent {
+    int64_t start;
+    int64_t end;
+} XdvdExtent;
+
+typedef struct XdvdChunk {
+    int64_t index;
+    uint8_t *data;
+    int64_t len;
+    bool loading;
+    CoQueue waiters;
+    QTAILQ_ENTRY(XdvdChunk) lru;
+} XdvdChunk;
+
+typedef struct BDRVXdvdCacheState {
+    int64_t length;
+
+    GHashTable *chunks;
+    QTAILQ_HEAD(, XdvdChunk) lru;
+    unsigned int nchunks;
+    unsigned int max_chunks;
+
+    /* File extents of the game partition, sorted by start */
+    XdvdExtent *extents;
+    unsigned int nextents;
+
+    /* Sequential prefetch of the extent being read */
+    bool prefetching;
+    int64_t prefetch_pos;
+    int64_t prefetch_end;
+} BDRVXdvdCacheState;
+
+static uint64_t xdvd_cache_default_size = 64 * MiB;
+
+static Stat64 xdvd_cache_hits;
+static Stat64 xdvd_cache_misses;
+static Stat64 xdvd_cache_prefetched;
+static Stat64 xdvd_cache_stall_ns;
+
+void xdvd_cache_set_default_size(uint64_t size)
+{
+    xdvd_cache_default_size = size;
+}
+
+void xdvd_cache_get_stats(XdvdCacheStats *stats)
+{
+    stats->hits = stat64_get(&xdvd_cache_hits);
+    stats->misses = stat64_get(&xdvd_cache_misses);
+    stats->prefetched_bytes = stat64_get(&xdvd_cache_prefetched);
+    stats->stall_ns = stat64_get(&xdvd_cache_stall_ns);
+}
+
+static QemuOptsList xdvd_cache_opts = {
+    .name = "xdvd-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(xdvd_cache_opts.head),
+    .desc = {
+        {
+            .name = XDVD_CACHE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the read cache in bytes",
+        },
+        { /* end of list */ }
+    },
+};
+
+static int xdvd_extent_cmp(const void *a, const void *b)
+{
+    const XdvdExtent *ea = a, *eb = b;
+    return ea->start < eb->start ? -1 : ea->start > eb->start;
+}
+
+/*
+ * Collect the file extents of the XDVDFS volume in the partition at
+ * @partition. Directory tables are binary trees of entries addressed by
+ * their offset in dwords from the start of the table.
+ */
+static bool GRAPH_RDLOCK xdvd_parse_volume(BlockDriverState *bs,
+                                           int64_t partition, GArray *extents)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    uint8_t volume[XDVD_SECTOR_SIZE];
+    int64_t volume_offset = partition + XDVD_VOLUME_SECTOR * XDVD_SECTOR_SIZE;
+    GArray *dirs = g_array_new(false, false, sizeof(XdvdExtent));
+    unsigned int entries = 0;
+    bool ok = false;
+
+    if (volume_offset + XDVD_SECTOR_SIZE > s->length ||
+        bdrv_pread(bs->file, volume_offset, sizeof(volume), volume, 0) < 0 ||
+        memcmp(volume, XDVD_MAGIC, XDVD_MAGIC_LEN) ||
+        memcmp(volume + 0x7ec, XDVD_MAGIC, XDVD_MAGIC_LEN)) {
+        goto out;
+    }
+
+    XdvdExtent root = {
+        .start = partition + (int64_t)ldl_le_p(volume + 20) * XDVD_SECTOR_SIZE,
+    };
+    root.end = root.start + ldl_le_p(volume + 24);
+    g_array_append_val(dirs, root);
+
+    while (dirs->len && entries < XDVD_MAX_ENTRIES) {
+        XdvdExtent dir = g_array_index(dirs, XdvdExtent, dirs->len - 1);
+        g_array_set_size(dirs, dirs->len - 1);
+
+        int64_t size = dir.end - dir.start;
+        if (size <= 0 || size > XDVD_MAX_DIR_SIZE || dir.end > s->length) {
+            continue;
+        }
+
+        g_autofree uint8_t *table = g_malloc(size);
+        if (bdrv_pread(bs->file, dir.start, size, table, 0) < 0) {
+            goto out;
+        }
+
+        g_autofree unsigned long *visited = bitmap_new(size / 4 + 1);
+        GArray *pending = g_array_new(false, false, sizeof(uint32_t));
+        uint32_t offset = 0;
+        g_array_append_val(pending, offset);
+
+        while (pending->len && entries < XDVD_MAX_ENTRIES) {
+            offset = g_array_index(pending, uint32_t, pending->len - 1);
+            g_array_set_size(pending, pending->len - 1);
+            entries++;
+
+            if (offset + 14 > size || test_and_set_bit(offset / 4, visited)) {
+                continue;
+            }
+            const uint8_t *e = table + offset;
+            uint16_t left = lduw_le_p(e);
+            uint16_t right = lduw_le_p(e + 2);
+            if (left == 0xffff) {
+                /* Sector padding */
+                continue;
+            }
+
+            XdvdExtent ext = {
+                .start = partition +
+                         (int64_t)ldl_le_p(e + 4) * XDVD_SECTOR_SIZE,
+            };
+            ext.end = ext.start + ldl_le_p(e + 8);
+            if (e[12] & XDVD_ATTR_DIRECTORY) {
+                g_array_append_val(dirs, ext);
+            } else if (ext.end > ext.start) {
+                g_array_append_val(extents, ext);
+            }
+
+            if (left) {
+                uint32_t child = left * 4;
+                g_array_append_val(pending, child);
+            }
+            if (right) {
+                uint32_t child = right * 4;
+                g_array_append_val(pending, child);
+            }
+        }
+        g_array_free(pending, true);
+    }
+    ok = true;
+
+out:
+    g_array_free(dirs, true);
+    return ok;
+}
+
+static void GRAPH_RDLOCK xdvd_parse_filesystem(BlockDriverState *bs)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    GArray *extents = g_array_new(false, false, sizeof(XdvdExtent));
+
+    for (int i = 0; i < ARRAY_SIZE(xdvd_partition_offsets); i++) {
+        if (xdvd_parse_volume(bs, xdvd_partition_offsets[i], extents)) {
+            break;
+        }
+        g_array_set_size(extents, 0);
+    }
+
+    g_array_sort(extents, xdvd_extent_cmp);
+    s->nextents = extents->len;
+    s->extents = (XdvdExtent *)g_array_free(extents, false);
+}
+
+static XdvdExtent *xdvd_find_extent(BDRVXdvdCacheState *s, int64_t offset)
+{
+    unsigned int lo = 0, hi = s->nextents;
+
+    while (lo < hi) {
+        unsigned int mid = lo + (hi - lo) / 2;
+        if (s->extents[mid].end <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < s->nextents && s->extents[lo].start <= offset) {
+        return &s->extents[lo];
+    }
+    return NULL;
+}
+
+static void xdvd_chunk_free(gpointer p)
+{
+    XdvdChunk *c = p;
+    qemu_vfree(c->data);
+    g_free(c);
+}
+
+static void xdvd_cache_remove(BDRVXdvdCacheState *s, XdvdChunk *c)
+{
+    QTAILQ_REMOVE(&s->lru, c, lru);
+    s->nchunks--;
+    g_hash_table_remove(s->chunks, &c->index);
+}
+
+/* Insert a chunk marked as loading, evicting the least recently used one */
+static XdvdChunk *xdvd_cache_insert(BlockDriverState *bs, int64_t index)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    XdvdChunk *c;
+
+    if (s->nchunks >= s->max_chunks) {
+        QTAILQ_FOREACH_REVERSE(c, &s->lru, lru) {
+            if (!c->loading) {
+                xdvd_cache_remove(s, c);
+                break;
+            }
+        }
+    }
+
+    c = g_new0(XdvdChunk, 1);
+    c->index = index;
+    c->len = MIN(XDVD_CHUNK_SIZE, s->length - index * XDVD_CHUNK_SIZE);
+    c->data = qemu_blockalign(bs, c->len);
+    c->loading = true;
+    qemu_co_queue_init(&c->waiters);
+
+    QTAILQ_INSERT_HEAD(&s->lru, c, lru);
+    s->nchunks++;
+    g_hash_table_insert(s->chunks, &c->index, c);
+    return c;
+}
+
+/*
+ * Look up the chunk at @index, reading it from the image on a miss. Returns
+ * NULL on error. For prefetches, a chunk that is cached or being loaded is
+ * left alone and NULL is returned as well.
+ */
+static XdvdChunk * coroutine_fn GRAPH_RDLOCK
+xdvd_cache_get(BlockDriverState *bs, int64_t index, bool prefetch, int *ret)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    int64_t start = get_clock();
+    XdvdChunk *c;
+
+    *ret = 0;
+
+    while ((c = g_hash_table_lookup(s->chunks, &index))) {
+        if (prefetch) {
+            return NULL;
+        }
+        if (!c->loading) {
+            QTAILQ_REMOVE(&s->lru, c, lru);
+            QTAILQ_INSERT_HEAD(&s->lru, c, lru);
+            stat64_add(&xdvd_cache_hits, 1);
+            stat64_add(&xdvd_cache_stall_ns, get_clock() - start);
+            return c;
+        }
+        /* Loaded by another request, which may be a prefetch */
+        qemu_co_queue_wait(&c->waiters, NULL);
+    }
+
+    c = xdvd_cache_insert(bs, index);
+    *ret = bdrv_co_pread(bs->file, index * XDVD_CHUNK_SIZE, c->len, c->data,
+                         0);
+    c->loading = false;
+    qemu_co_queue_restart_all(&c->waiters);
+
+    if (*ret < 0) {
+        xdvd_cache_remove(s, c);
+        return NULL;
+    }
+
+    if (prefetch) {
+        stat64_add(&xdvd_cache_prefetched, c->len);
+        return NULL;
+    }
+    stat64_add(&xdvd_cache_misses, 1);
+    stat64_add(&xdvd_cache_stall_ns, get_clock() - start);
+    return c;
+}
+
+static void coroutine_fn xdvd_prefetch_entry(void *opaque)
+{
+    BlockDriverState *bs = opaque;
+    BDRVXdvdCacheState *s = bs->opaque;
+    int ret;
+
+    GRAPH_RDLOCK_GUARD();
+
+    while (s->prefetch_pos < s->prefetch_end) {
+        int64_t index = s->prefetch_pos / XDVD_CHUNK_SIZE;
+        s->prefetch_pos = (index + 1) * XDVD_CHUNK_SIZE;
+        xdvd_cache_get(bs, index, true, &ret);
+        if (ret < 0) {
+            break;
+        }
+    }
+
+    trace_xdvd_cache_prefetch_done(bs, s->prefetch_pos);
+    s->prefetching = false;
+    bdrv_dec_in_flight(bs);
+}
+
+/* Keep the prefetch window ahead of a guest read ending at @end */
+static void xdvd_prefetch(BlockDriverState *bs, int64_t offset, int64_t end)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    XdvdExtent *ext = xdvd_find_extent(s, offset);
+
+    if (!ext) {
+        return;
+    }
+
+    int64_t target = MIN(MIN(ext->end, end + XDVD_PREFETCH_WINDOW), s->length);
+    if (s->prefetch_pos < offset || s->prefetch_pos > target) {
+        /* The guest moved on to another file, or past the prefetch */
+        s->prefetch_pos = end;
+        s->prefetch_end = target;
+    } else {
+        s->prefetch_end = MAX(s->prefetch_end, target);
+    }
+    if (s->prefetch_pos >= s->prefetch_end || s->prefetching) {
+        return;
+    }
+
+    trace_xdvd_cache_prefetch(bs, s->prefetch_pos, s->prefetch_end);
+    s->prefetching = true;
+    bdrv_inc_in_flight(bs);
+    aio_co_schedule(bdrv_get_aio_context(bs),
+                    qemu_coroutine_create(xdvd_prefetch_entry, bs));
+}
+
+static int xdvd_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                           Error **errp)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    QemuOpts *opts;
+    uint64_t cache_size;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&xdvd_cache_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    cache_size = qemu_opt_get_size(opts, XDVD_CACHE_OPT_SIZE,
+                                   xdvd_cache_default_size);
+    qemu_opts_del(opts);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    s->length = bdrv_getlength(bs->file->bs);
+    if (s->length < 0) {
+        error_setg_errno(errp, -s->length, "Could not get the image size");
+        return s->length;
+    }
+
+    s->max_chunks = MAX(cache_size / XDVD_CHUNK_SIZE, 1);
+    s->chunks = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                      xdvd_chunk_free);
+    QTAILQ_INIT(&s->lru);
+
+    xdvd_parse_filesystem(bs);
+    trace_xdvd_cache_open(bs, s->length, cache_size, s->nextents);
+    return 0;
+}
+
+static void xdvd_cache_close(BlockDriverState *bs)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    XdvdCacheStats stats;
+
+    xdvd_cache_get_stats(&stats);
+    trace_xdvd_cache_close(bs, stats.hits, stats.misses,
+                           stats.prefetched_bytes, stats.stall_ns / SCALE_MS);
+
+    g_hash_table_destroy(s->chunks);
+    g_free(s->extents);
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+xdvd_cache_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+xdvd_cache_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                     QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    BDRVXdvdCacheState *s = bs->opaque;
+    size_t qiov_offset = 0;
+    int64_t end = offset + bytes;
+    int ret;
+
+    if (end > s->length) {
+        return bdrv_co_preadv(bs->file, offset, bytes, qiov, flags);
+    }
+
+    xdvd_prefetch(bs, offset, end);
+
+    while (offset < end) {
+        int64_t index = offset / XDVD_CHUNK_SIZE;
+        int64_t chunk_offset = offset - index * XDVD_CHUNK_SIZE;
+        int64_t n = MIN(end - offset, XDVD_CHUNK_SIZE - chunk_offset);
+        XdvdChunk *c = xdvd_cache_get(bs, index, false, &ret);
+
+        if (!c) {
+            return ret;
+        }
+        qemu_iovec_from_buf(qiov, qiov_offset, c->data + chunk_offset, n);
+        qiov_offset += n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+static BlockDriver bdrv_xdvd_cache = {
+    .format_name                        =   "xdvd-cache",
+    .instance_size                      =   sizeof(BDRVXdvdCacheState),
+
+    .bdrv_open                          =   xdvd_cache_open,
+    .bdrv_close                         =   xdvd_cache_close,
+
+    .bdrv_child_perm                    =   bdrv_default_perms,
+
+    .bdrv_co_getlength                  =   xdvd_cache_co_getlength,
+    .bdrv_co_preadv                     =   xdvd_cache_co_preadv,
+
+    .is_filter                          =   true,
+};
+
+static void bdrv_xdvd_cache_init(void)
+{
+    bdrv_register(&bdrv_xdvd_cache);
+}
+
+block_init(bdrv_xdvd_cache_init);
@@ -0,0 +1,392 @@
+/*
+ * Volatile cache partitions for Xbox hard disk images
+ *
+ * The X, Y and Z partitions of the Xbox hard disk are scratch space titles
+ * fill with data copied from the disc, and they are rewritten constantly.
+ * This filter keeps writes to them in RAM, in chunks filled from the image
+ * on first write, so they neither wear the host storage nor stall the guest
+ * on slow images. The overlay is discarded when the image is closed, or
+ * written back with the writeback option. Once the overlay is full, writes
+ * to chunks not in it go to the image as usual.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/snapshot.h"
+#include "qemu/coroutine.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "qapi/error.h"
+#include "trace.h"
+
+#define XHDD_VOLATILE_OPT_SIZE "cache-size"
+#define XHDD_VOLATILE_OPT_WRITEBACK "writeback"
+
+#define XHDD_CHUNK_SIZE (64 * KiB)
+
+/* The cache partitions follow each other, right after the config area */
+#define XHDD_CACHE_PARTITIONS_START 0x80000LL
+#define XHDD_CACHE_PARTITION_SIZE 0x2ee00000LL
+#define XHDD_CACHE_PARTITIONS_END \
+    (XHDD_CACHE_PARTITIONS_START + 3 * XHDD_CACHE_PARTITION_SIZE)
+
+typedef struct XhddChunk {
+    int64_t index;
+    uint8_t *data;
+} XhddChunk;
+
+typedef struct BDRVXhddVolatileState {
+    /* Range of the image kept in the overlay, in whole chunks */
+    int64_t start;
+    int64_t end;
+    bool writeback;
+
+    GHashTable *chunks;
+    unsigned int max_chunks;
+    CoMutex fill_lock;
+} BDRVXhddVolatileState;
+
+static QemuOptsList xhdd_volatile_opts = {
+    .name = "xhdd-volatile",
+    .head = QTAILQ_HEAD_INITIALIZER(xhdd_volatile_opts.head),
+    .desc = {
+        {
+            .name = XHDD_VOLATILE_OPT_SIZE,
+            .type = QEMU_OPT_SIZE,
+            .help = "Size of the overlay in bytes",
+        },
+        {
+            .name = XHDD_VOLATILE_OPT_WRITEBACK,
+            .type = QEMU_OPT_BOOL,
+            .help = "Write the overlay back to the image when closing",
+        },
+        { /* end of list */ }
+    },
+};
+
+static void xhdd_chunk_free(gpointer p)
+{
+    XhddChunk *c = p;
+    qemu_vfree(c->data);
+    g_free(c);
+}
+
+static int xhdd_chunk_cmp(gconstpointer a, gconstpointer b)
+{
+    const XhddChunk *ca = *(XhddChunk * const *)a;
+    const XhddChunk *cb = *(XhddChunk * const *)b;
+    return ca->index < cb->index ? -1 : ca->index > cb->index;
+}
+
+/*
+ * Length of the run starting at @offset, up to @end, that is served the same
+ * way: a piece of the overlay chunk returned in @chunk, or NULL for a run of
+ * the image.
+ */
+static int64_t xhdd_volatile_run(BDRVXhddVolatileState *s, int64_t offset,
+                                 int64_t end, XhddChunk **chunk)
+{
+    *chunk = NULL;
+
+    if (offset < s->start) {
+        return MIN(end, s->start) - offset;
+    }
+    if (offset >= s->end) {
+        return end - offset;
+    }
+
+    end = MIN(end, s->end);
+    int64_t index = offset / XHDD_CHUNK_SIZE;
+    int64_t next = (index + 1) * XHDD_CHUNK_SIZE;
+    *chunk = g_hash_table_lookup(s->chunks, &index);
+    if (*chunk) {
+        return MIN(end, next) - offset;
+    }
+
+    while (next < end) {
+        index = next / XHDD_CHUNK_SIZE;
+        if (g_hash_table_contains(s->chunks, &index)) {
+            break;
+        }
+        next += XHDD_CHUNK_SIZE;
+    }
+    return MIN(end, next) - offset;
+}
+
+/*
+ * Add the chunk at @index to the overlay, reading it from the image unless it
+ * is about to be overwritten in full. Returns NULL if the overlay is full or
+ * on error, with @ret set.
+ */
+static XhddChunk * coroutine_fn GRAPH_RDLOCK
+xhdd_volatile_add_chunk(BlockDriverState *bs, int64_t index, bool fill,
+                        int *ret)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+    XhddChunk *c;
+
+    *ret = 0;
+
+    qemu_co_mutex_lock(&s->fill_lock);
+
+    /* Another request may have added it while this one was waiting */
+    c = g_hash_table_lookup(s->chunks, &index);
+    if (!c && g_hash_table_size(s->chunks) < s->max_chunks) {
+        uint8_t *data = qemu_blockalign(bs, XHDD_CHUNK_SIZE);
+        if (fill) {
+            *ret = bdrv_co_pread(bs->file, index * XHDD_CHUNK_SIZE,
+                                 XHDD_CHUNK_SIZE, data, 0);
+        }
+        if (*ret < 0) {
+            qemu_vfree(data);
+        } else {
+            c = g_new(XhddChunk, 1);
+            c->index = index;
+            c->data = data;
+            g_hash_table_insert(s->chunks, &c->index, c);
+        }
+    }
+
+    qemu_co_mutex_unlock(&s->fill_lock);
+    return c;
+}
+
+/* Write the overlay to the image in disk order and empty it */
+static int GRAPH_RDLOCK xhdd_volatile_write_back(BlockDriverState *bs)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+    GPtrArray *chunks = g_ptr_array_new();
+    GHashTableIter iter;
+    gpointer value;
+    int ret = 0;
+
+    g_hash_table_iter_init(&iter, s->chunks);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_ptr_array_add(chunks, value);
+    }
+    g_ptr_array_sort(chunks, xhdd_chunk_cmp);
+    for (int i = 0; i < chunks->len; i++) {
+        XhddChunk *c = g_ptr_array_index(chunks, i);
+        ret = bdrv_pwrite(bs->file, c->index * XHDD_CHUNK_SIZE,
+                          XHDD_CHUNK_SIZE, c->data, 0);
+        if (ret < 0) {
+            break;
+        }
+    }
+    trace_xhdd_volatile_write_back(bs, chunks->len, ret);
+    g_ptr_array_free(chunks, true);
+
+    if (ret < 0) {
+        return ret;
+    }
+    g_hash_table_remove_all(s->chunks);
+    return 0;
+}
+
+static int xhdd_volatile_open(BlockDriverState *bs, QDict *options, int flags,
+                              Error **errp)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+    QemuOpts *opts;
+    uint64_t cache_size;
+    int64_t length;
+    int ret;
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&xhdd_volatile_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    cache_size = qemu_opt_get_size(opts, XHDD_VOLATILE_OPT_SIZE, 512 * MiB);
+    s->writeback = qemu_opt_get_bool(opts, XHDD_VOLATILE_OPT_WRITEBACK, false);
+    qemu_opts_del(opts);
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    length = bdrv_getlength(bs->file->bs);
+    if (length < 0) {
+        error_setg_errno(errp, -length, "Could not get the image size");
+        return length;
+    }
+
+    s->start = XHDD_CACHE_PARTITIONS_START;
+    s->end = MIN(XHDD_CACHE_PARTITIONS_END,
+                 QEMU_ALIGN_DOWN(length, XHDD_CHUNK_SIZE));
+    s->end = MAX(s->start, s->end);
+    s->max_chunks = cache_size / XHDD_CHUNK_SIZE;
+    s->chunks = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                      xhdd_chunk_free);
+    qemu_co_mutex_init(&s->fill_lock);
+
+    trace_xhdd_volatile_open(bs, s->start, s->end, cache_size, s->writeback);
+    return 0;
+}
+
+static void GRAPH_UNLOCKED xhdd_volatile_close(BlockDriverState *bs)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+
+    GLOBAL_STATE_CODE();
+
+    if (s->writeback) {
+        GRAPH_RDLOCK_GUARD_MAINLOOP();
+        int ret = xhdd_volatile_write_back(bs);
+        if (ret < 0) {
+            error_report("Failed to write back the hard disk cache "
+                         "partitions: %s", strerror(-ret));
+        }
+    }
+
+    g_hash_table_destroy(s->chunks);
+}
+
+static int64_t coroutine_fn GRAPH_RDLOCK
+xhdd_volatile_co_getlength(BlockDriverState *bs)
+{
+    return bdrv_co_getlength(bs->file->bs);
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+xhdd_volatile_co_preadv_part(BlockDriverState *bs, int64_t offset,
+                             int64_t bytes, QEMUIOVector *qiov,
+                             size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int ret;
+
+    while (offset < end) {
+        XhddChunk *c;
+        int64_t n = xhdd_volatile_run(s, offset, end, &c);
+
+        if (c) {
+            qemu_iovec_from_buf(qiov, qiov_offset,
+                                c->data + offset % XHDD_CHUNK_SIZE, n);
+        } else {
+            ret = bdrv_co_preadv_part(bs->file, offset, n, qiov, qiov_offset,
+                                      flags);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        qiov_offset += n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+xhdd_volatile_co_pwritev_part(BlockDriverState *bs, int64_t offset,
+                              int64_t bytes, QEMUIOVector *qiov,
+                              size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+    int64_t end = offset + bytes;
+    int ret;
+
+    while (offset < end) {
+        XhddChunk *c = NULL;
+        int64_t n;
+
+        if (offset < s->start || offset >= s->end) {
+            n = xhdd_volatile_run(s, offset, end, &c);
+        } else {
+            int64_t index = offset / XHDD_CHUNK_SIZE;
+            n = MIN(end, (index + 1) * XHDD_CHUNK_SIZE) - offset;
+            c = g_hash_table_lookup(s->chunks, &index);
+            if (!c) {
+                c = xhdd_volatile_add_chunk(bs, index, n < XHDD_CHUNK_SIZE,
+                                            &ret);
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+        }
+
+        if (c) {
+            qemu_iovec_to_buf(qiov, qiov_offset,
+                              c->data + offset % XHDD_CHUNK_SIZE, n);
+        } else {
+            ret = bdrv_co_pwritev_part(bs->file, offset, n, qiov, qiov_offset,
+                                       flags);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+        qiov_offset += n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+/*
+ * Chunks covered in full are dropped, the guest view of them is undefined
+ * after a discard. The image underneath is discarded too, partial chunks keep
+ * what they hold.
+ */
+static int coroutine_fn GRAPH_RDLOCK
+xhdd_volatile_co_pdiscard(BlockDriverState *bs, int64_t offset, int64_t bytes)
+{
+    BDRVXhddVolatileState *s = bs->opaque;
+    int64_t first = DIV_ROUND_UP(MAX(offset, s->start), XHDD_CHUNK_SIZE);
+    int64_t last = MIN(offset + bytes, s->end) / XHDD_CHUNK_SIZE;
+
+    for (int64_t index = first; index < last; index++) {
+        g_hash_table_remove(s->chunks, &index);
+    }
+
+    return bdrv_co_pdiscard(bs->file, offset, bytes);
+}
+
+/*
+ * A snapshot of the image has to hold what the guest wrote to the cache
+ * partitions so far, so the overlay is written back first. Loading one goes
+ * through the fallback, which reopens this node with an empty overlay.
+ */
+static int GRAPH_RDLOCK
+xhdd_volatile_snapshot_create(BlockDriverState *bs, QEMUSnapshotInfo *sn_info)
+{
+    int ret = xhdd_volatile_write_back(bs);
+    if (ret < 0) {
+        return ret;
+    }
+    return bdrv_snapshot_create(bs->file->bs, sn_info);
+}
+
+static BlockDriver bdrv_xhdd_volatile = {
+    .format_name                        =   "xhdd-volatile",
+    .instance_size                      =   sizeof(BDRVXhddVolatileState),
+
+    .bdrv_open                          =   xhdd_volatile_open,
+    .bdrv_close                         =   xhdd_volatile_close,
+
+    .bdrv_child_perm                    =   bdrv_default_perms,
+
+    .bdrv_co_getlength                  =   xhdd_volatile_co_getlength,
+    .bdrv_co_preadv_part                =   xhdd_volatile_co_preadv_part,
+    .bdrv_co_pwritev_part               =   xhdd_volatile_co_pwritev_part,
+    .bdrv_co_pdiscard                   =   xhdd_volatile_co_pdiscard,
+
+    .bdrv_snapshot_create               =   xhdd_volatile_snapshot_create,
+
+    .is_filter                          =   true,
+};
+
+static void bdrv_xhdd_volatile_init(void)
+{
+    bdrv_register(&bdrv_xhdd_volatile);
+}
+
+block_init(bdrv_xhdd_volatile_init);
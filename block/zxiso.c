@@ -0,0 +1,405 @@
+/*
+ * Block driver for compressed Xbox disc images (zxiso)
+ *
+ * The image is split into fixed size chunks, each compressed on its own
+ * with zstd, so any chunk can be read without the ones before it.
+ *
+ * Layout, little endian:
+ *   0   magic "ZXIS"
+ *   4   u32 version
+ *   8   u32 chunk size, a power of two
+ *   12  u32 codec, ZXISO_CODEC_ZSTD
+ *   16  u64 uncompressed image size
+ *   24  u64 reserved
+ *   32  u64 offsets[chunk count + 1]
+ *
+ * Chunk i is stored at [offsets[i], offsets[i + 1]) of the file. A chunk
+ * stored with no data reads as zeros (the padding of the image), one
+ * stored at its full size is not compressed. Compressed chunks are always
+ * smaller than that, the writer stores chunks that do not shrink as is.
+ *
+ * Sequential reads decompress the chunks ahead of the guest in parallel on
+ * the thread pool, so they are ready when the guest reaches them.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/block-io.h"
+#include "block/block_int.h"
+#include "block/thread-pool.h"
+#include "qemu/bswap.h"
+#include "qemu/coroutine.h"
+#include "qemu/host-utils.h"
+#include "qemu/module.h"
+#include "qemu/units.h"
+#include "trace.h"
+
+#include <zstd.h>
+
+#define ZXISO_MAGIC "ZXIS"
+#define ZXISO_VERSION 1
+#define ZXISO_CODEC_ZSTD 1
+#define ZXISO_HEADER_SIZE 32
+#define ZXISO_MIN_CHUNK_SIZE (2 * KiB)
+#define ZXISO_MAX_CHUNK_SIZE (1 * MiB)
+
+/* Decompressed chunks kept, and chunks decompressed ahead of the guest */
+#define ZXISO_CACHE_CHUNKS 64
+#define ZXISO_READAHEAD_CHUNKS 8
+
+typedef struct ZxisoChunk {
+    int64_t index;
+    uint8_t *data;
+    bool loading;
+    CoQueue waiters;
+    QTAILQ_ENTRY(ZxisoChunk) lru;
+} ZxisoChunk;
+
+typedef struct BDRVZxisoState {
+    uint32_t chunk_size;
+    uint64_t disk_size;
+    uint64_t nchunks;
+    uint64_t *offsets;
+
+    GHashTable *chunks;
+    QTAILQ_HEAD(, ZxisoChunk) lru;
+    unsigned int nchunks_cached;
+
+    /* End of the previous read, to detect sequential access */
+    int64_t last_end;
+} BDRVZxisoState;
+
+typedef struct ZxisoDecompressJob {
+    const void *src;
+    size_t src_len;
+    void *dst;
+    size_t dst_len;
+} ZxisoDecompressJob;
+
+typedef struct ZxisoLoadCo {
+    BlockDriverState *bs;
+    ZxisoChunk *chunk;
+} ZxisoLoadCo;
+
+static int zxiso_probe(const uint8_t *buf, int buf_size, const char *filename)
+{
+    if (buf_size >= ZXISO_HEADER_SIZE && !memcmp(buf, ZXISO_MAGIC, 4) &&
+        ldl_le_p(buf + 4) == ZXISO_VERSION) {
+        return 100;
+    }
+    return 0;
+}
+
+static int zxiso_open(BlockDriverState *bs, QDict *options, int flags,
+                      Error **errp)
+{
+    BDRVZxisoState *s = bs->opaque;
+    uint8_t header[ZXISO_HEADER_SIZE];
+    int64_t file_size;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    bdrv_graph_rdlock_main_loop();
+    ret = bdrv_apply_auto_read_only(bs, NULL, errp);
+    bdrv_graph_rdunlock_main_loop();
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = bdrv_open_file_child(NULL, options, "file", bs, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    ret = bdrv_pread(bs->file, 0, sizeof(header), header, 0);
+    if (ret < 0) {
+        return ret;
+    }
+    if (memcmp(header, ZXISO_MAGIC, 4) ||
+        ldl_le_p(header + 4) != ZXISO_VERSION) {
+        error_setg(errp, "Not a zxiso image");
+        return -EINVAL;
+    }
+    if (ldl_le_p(header + 12) != ZXISO_CODEC_ZSTD) {
+        error_setg(errp, "Unsupported zxiso codec %" PRIu32,
+                   ldl_le_p(header + 12));
+        return -ENOTSUP;
+    }
+
+    s->chunk_size = ldl_le_p(header + 8);
+    if (!is_power_of_2(s->chunk_size) ||
+        s->chunk_size < ZXISO_MIN_CHUNK_SIZE ||
+        s->chunk_size > ZXISO_MAX_CHUNK_SIZE) {
+        error_setg(errp, "Invalid zxiso chunk size %" PRIu32, s->chunk_size);
+        return -EINVAL;
+    }
+
+    s->disk_size = ldq_le_p(header + 16);
+    s->nchunks = DIV_ROUND_UP(s->disk_size, s->chunk_size);
+    if (s->nchunks > 64 * MiB) {
+        error_setg(errp, "zxiso image is too large");
+        return -EINVAL;
+    }
+
+    file_size = bdrv_getlength(bs->file->bs);
+    if (file_size < 0) {
+        return file_size;
+    }
+
+    size_t offsets_size = (s->nchunks + 1) * sizeof(uint64_t);
+    g_autofree uint64_t *offsets = g_try_malloc(offsets_size);
+    if (!offsets) {
+        error_setg(errp, "Could not allocate the zxiso index");
+        return -ENOMEM;
+    }
+    ret = bdrv_pread(bs->file, ZXISO_HEADER_SIZE, offsets_size, offsets, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    for (uint64_t i = 0; i <= s->nchunks; i++) {
+        offsets[i] = le64_to_cpu(offsets[i]);
+        if (i == 0 ? offsets[i] < ZXISO_HEADER_SIZE + offsets_size :
+                     (offsets[i] < offsets[i - 1] ||
+                      offsets[i] - offsets[i - 1] > s->chunk_size)) {
+            error_setg(errp, "zxiso index entry %" PRIu64 " is invalid", i);
+            return -EINVAL;
+        }
+    }
+    if (offsets[s->nchunks] > file_size) {
+        error_setg(errp, "zxiso image is truncated");
+        return -EINVAL;
+    }
+
+    s->offsets = g_steal_pointer(&offsets);
+    s->chunks = g_hash_table_new(g_int64_hash, g_int64_equal);
+    QTAILQ_INIT(&s->lru);
+    bs->total_sectors = DIV_ROUND_UP(s->disk_size, BDRV_SECTOR_SIZE);
+
+    trace_zxiso_open(bs, s->disk_size, s->chunk_size, s->nchunks);
+    return 0;
+}
+
+static void zxiso_refresh_limits(BlockDriverState *bs, Error **errp)
+{
+    bs->bl.request_alignment = BDRV_SECTOR_SIZE;
+}
+
+static void zxiso_chunk_free(ZxisoChunk *c)
+{
+    qemu_vfree(c->data);
+    g_free(c);
+}
+
+static void zxiso_close(BlockDriverState *bs)
+{
+    BDRVZxisoState *s = bs->opaque;
+    ZxisoChunk *c, *next;
+
+    QTAILQ_FOREACH_SAFE(c, &s->lru, lru, next) {
+        zxiso_chunk_free(c);
+    }
+    g_hash_table_destroy(s->chunks);
+    g_free(s->offsets);
+}
+
+static size_t zxiso_chunk_len(BDRVZxisoState *s, int64_t index)
+{
+    return MIN(s->chunk_size, s->disk_size - index * s->chunk_size);
+}
+
+static void zxiso_cache_remove(BDRVZxisoState *s, ZxisoChunk *c)
+{
+    QTAILQ_REMOVE(&s->lru, c, lru);
+    g_hash_table_remove(s->chunks, &c->index);
+    s->nchunks_cached--;
+    zxiso_chunk_free(c);
+}
+
+/* Add a chunk marked as loading, evicting the least recently used one */
+static ZxisoChunk *zxiso_cache_insert(BlockDriverState *bs, int64_t index)
+{
+    BDRVZxisoState *s = bs->opaque;
+    ZxisoChunk *c;
+
+    if (s->nchunks_cached >= ZXISO_CACHE_CHUNKS) {
+        QTAILQ_FOREACH_REVERSE(c, &s->lru, lru) {
+            if (!c->loading) {
+                zxiso_cache_remove(s, c);
+                break;
+            }
+        }
+    }
+
+    c = g_new0(ZxisoChunk, 1);
+    c->index = index;
+    c->data = qemu_blockalign(bs, s->chunk_size);
+    c->loading = true;
+    qemu_co_queue_init(&c->waiters);
+    QTAILQ_INSERT_HEAD(&s->lru, c, lru);
+    g_hash_table_insert(s->chunks, &c->index, c);
+    s->nchunks_cached++;
+    return c;
+}
+
+static int zxiso_decompress(void *opaque)
+{
+    ZxisoDecompressJob *job = opaque;
+    size_t n = ZSTD_decompress(job->dst, job->dst_len, job->src, job->src_len);
+
+    return ZSTD_isError(n) || n != job->dst_len ? -EIO : 0;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+zxiso_load(BlockDriverState *bs, ZxisoChunk *c)
+{
+    BDRVZxisoState *s = bs->opaque;
+    uint64_t start = s->offsets[c->index];
+    size_t stored = s->offsets[c->index + 1] - start;
+    size_t len = zxiso_chunk_len(s, c->index);
+    int ret;
+
+    if (!stored) {
+        memset(c->data, 0, len);
+        ret = 0;
+    } else if (stored == len) {
+        ret = bdrv_co_pread(bs->file, start, len, c->data, 0);
+    } else {
+        g_autofree uint8_t *buf = g_try_malloc(stored);
+        if (!buf) {
+            ret = -ENOMEM;
+        } else {
+            ret = bdrv_co_pread(bs->file, start, stored, buf, 0);
+        }
+        if (ret >= 0) {
+            ZxisoDecompressJob job = {
+                .src = buf, .src_len = stored, .dst = c->data, .dst_len = len,
+            };
+            ret = thread_pool_submit_co(zxiso_decompress, &job);
+        }
+    }
+
+    c->loading = false;
+    qemu_co_queue_restart_all(&c->waiters);
+    if (ret < 0) {
+        trace_zxiso_load_error(bs, c->index, ret);
+        zxiso_cache_remove(s, c);
+    }
+    return ret;
+}
+
+static void coroutine_fn zxiso_load_entry(void *opaque)
+{
+    ZxisoLoadCo *lc = opaque;
+    BlockDriverState *bs = lc->bs;
+
+    GRAPH_RDLOCK_GUARD();
+    zxiso_load(bs, lc->chunk);
+    bdrv_dec_in_flight(bs);
+    g_free(lc);
+}
+
+/* Start loading the chunks in [first, last] that are not cached */
+static void coroutine_fn zxiso_prefetch(BlockDriverState *bs, int64_t first,
+                                        int64_t last)
+{
+    BDRVZxisoState *s = bs->opaque;
+
+    for (int64_t i = first; i <= last && i < s->nchunks; i++) {
+        if (g_hash_table_contains(s->chunks, &i)) {
+            continue;
+        }
+        ZxisoLoadCo *lc = g_new(ZxisoLoadCo, 1);
+        lc->bs = bs;
+        lc->chunk = zxiso_cache_insert(bs, i);
+        bdrv_inc_in_flight(bs);
+        aio_co_schedule(bdrv_get_aio_context(bs),
+                        qemu_coroutine_create(zxiso_load_entry, lc));
+    }
+}
+
+static ZxisoChunk * coroutine_fn GRAPH_RDLOCK
+zxiso_get_chunk(BlockDriverState *bs, int64_t index, int *ret)
+{
+    BDRVZxisoState *s = bs->opaque;
+    ZxisoChunk *c;
+
+    *ret = 0;
+    while ((c = g_hash_table_lookup(s->chunks, &index))) {
+        if (!c->loading) {
+            QTAILQ_REMOVE(&s->lru, c, lru);
+            QTAILQ_INSERT_HEAD(&s->lru, c, lru);
+            return c;
+        }
+        qemu_co_queue_wait(&c->waiters, NULL);
+    }
+
+    c = zxiso_cache_insert(bs, index);
+    *ret = zxiso_load(bs, c);
+    return *ret < 0 ? NULL : c;
+}
+
+static int coroutine_fn GRAPH_RDLOCK
+zxiso_co_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
+                QEMUIOVector *qiov, BdrvRequestFlags flags)
+{
+    BDRVZxisoState *s = bs->opaque;
+    int64_t end = MIN(offset + bytes, s->disk_size);
+    int64_t first = offset / s->chunk_size;
+    int64_t last = (end - 1) / s->chunk_size;
+    size_t qiov_offset = 0;
+    int ret;
+
+    if (offset >= s->disk_size) {
+        qemu_iovec_memset(qiov, 0, 0, bytes);
+        return 0;
+    }
+
+    /* Decompress the whole request, and the chunks ahead of a stream */
+    zxiso_prefetch(bs, first, offset == s->last_end ?
+                              last + ZXISO_READAHEAD_CHUNKS : last);
+    s->last_end = end;
+
+    while (offset < end) {
+        int64_t index = offset / s->chunk_size;
+        int64_t chunk_offset = offset - index * s->chunk_size;
+        int64_t n = MIN(end - offset, s->chunk_size - chunk_offset);
+        ZxisoChunk *c = zxiso_get_chunk(bs, index, &ret);
+
+        if (!c) {
+            return ret;
+        }
+        qemu_iovec_from_buf(qiov, qiov_offset, c->data + chunk_offset, n);
+        qiov_offset += n;
+        offset += n;
+    }
+
+    if (qiov_offset < bytes) {
+        qemu_iovec_memset(qiov, qiov_offset, 0, bytes - qiov_offset);
+    }
+    return 0;
+}
+
+static BlockDriver bdrv_zxiso = {
+    .format_name            = "zxiso",
+    .instance_size          = sizeof(BDRVZxisoState),
+    .bdrv_probe             = zxiso_probe,
+    .bdrv_open              = zxiso_open,
+    .bdrv_close             = zxiso_close,
+    .bdrv_child_perm        = bdrv_default_perms,
+    .bdrv_refresh_limits    = zxiso_refresh_limits,
+    .bdrv_co_preadv         = zxiso_co_preadv,
+    .is_format              = true,
+};
+
+static void bdrv_zxiso_init(void)
+{
+    bdrv_register(&bdrv_zxiso);
+}
+
+block_init(bdrv_zxiso_init);
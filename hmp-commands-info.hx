@@ -256,6 +256,19 @@ SRST
     Show dynamic compiler info.
 ERST
 
+    {
+        .name       = "xemu-memory",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show memory held by emulator allocations",
+    },
+
+SRST
+  ``info xemu-memory``
+    Show the live and peak memory held by renderer, audio and CPU emulator
+    allocations.
+ERST
+
     {
         .name       = "sync-profile",
         .args_type  = "mean:-m,no_coalesce:-n,max:i?",
@@ -325,6 +325,8 @@ static void cpu_common_initfn(Object *obj)
     QTAILQ_INIT(&cpu->breakpoints);
     QTAILQ_INIT(&cpu->watchpoints);
     QTAILQ_INIT(&cpu->mem_access_callbacks);
+    qemu_mutex_init(&cpu->mem_access_callback_queue_lock);
+    QSIMPLEQ_INIT(&cpu->mem_access_callback_queue);
 
     cpu_exec_initfn(cpu);
 
@@ -360,6 +362,8 @@ static void cpu_common_finalize(Object *obj)
     qemu_cond_destroy(cpu->halt_cond);
     g_free(cpu->halt_cond);
     g_free(cpu->thread);
+    g_free(cpu->mem_access_watched_pages);
+    qemu_mutex_destroy(&cpu->mem_access_callback_queue_lock);
 }
 
 static int64_t cpu_common_get_arch_id(CPUState *cpu)
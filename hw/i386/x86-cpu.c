@@ -31,12 +31,51 @@
 #include "hw/irq.h"
 #include "system/kvm.h"
 
+#ifdef XBOX
+#include "ui/xemu-settings.h"
+
+#define XBOX_CPU_CLOCK_HZ 733333333
+
+/*
+ * The TSC counts core clocks, so like on an upgraded console it speeds up with
+ * perf.cpu_clock_percent while the PIT, ACPI PM timer and PTIMER keep counting
+ * real time. A rate change rebases the count so it stays monotonic. Only the
+ * vCPU thread reads the TSC.
+ */
+static struct {
+    int percent;
+    int64_t base_ns;
+    uint64_t base_tsc;
+} tsc_state = { .percent = 100 };
+
+static uint64_t tsc_since_base(int64_t now)
+{
+    uint64_t ticks = muldiv64(now - tsc_state.base_ns, XBOX_CPU_CLOCK_HZ,
+                              NANOSECONDS_PER_SECOND);
+    return tsc_state.base_tsc + muldiv64(ticks, tsc_state.percent, 100);
+}
+#endif
+
 /* TSC handling */
 uint64_t cpu_get_tsc(CPUX86State *env)
 {
 #ifdef XBOX
-    return muldiv64(qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL), 733333333,
-                    NANOSECONDS_PER_SECOND);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int percent = MIN(MAX(qatomic_read(&g_config.perf.cpu_clock_percent), 50),
+                      400);
+
+    // Loading a snapshot moves the virtual clock back
+    if (now < tsc_state.base_ns) {
+        tsc_state.base_ns = 0;
+        tsc_state.base_tsc = 0;
+    }
+    if (percent != tsc_state.percent) {
+        tsc_state.base_tsc = tsc_since_base(now);
+        tsc_state.base_ns = now;
+        tsc_state.percent = percent;
+    }
+
+    return tsc_since_base(now);
 #else
     return cpus_get_elapsed_ticks();
 #endif
@@ -27,6 +27,7 @@
 #include "qemu/cutils.h"
 #include "hw/scsi/scsi.h"
 #include "system/block-backend.h"
+#include "system/dma.h"
 #include "scsi/constants.h"
 #include "ide-internal.h"
 #include "trace.h"
@@ -419,6 +420,64 @@ eot:
     ide_set_inactive(s, false);
 }
 
+#ifdef XBOX
+/*
+ * Reads of 2048 byte sectors go from the block layer straight into the guest
+ * buffers of the PRD table, in one request for the whole transfer, instead of
+ * in rounds of IDE_DMA_BUF_SECTORS bounced through io_buffer.
+ */
+static void ide_atapi_cmd_read_dma_sg_cb(void *opaque, int ret)
+{
+    IDEState *s = opaque;
+    int32_t prep_size;
+
+    if (s->io_buffer_size > 0 || s->packet_transfer_size <= 0) {
+        if (s->io_buffer_size > 0) {
+            ide_dma_buf_commit(s, ret < 0 ? 0 : s->sg.size);
+        }
+        if (ret < 0 &&
+            ide_handle_rw_error(s, -ret, ide_dma_cmd_to_retry(s->dma_cmd))) {
+            if (s->bus->error_status) {
+                s->bus->dma->aiocb = NULL;
+                return;
+            }
+            goto eot;
+        }
+        s->lba += s->packet_transfer_size >> ATAPI_SECTOR_BITS;
+        s->packet_transfer_size = 0;
+        s->status = READY_STAT | SEEK_STAT;
+        s->nsector = (s->nsector & ~7) | ATAPI_INT_REASON_IO | ATAPI_INT_REASON_CD;
+        ide_bus_set_irq(s->bus);
+        goto eot;
+    }
+
+    s->io_buffer_index = 0;
+    prep_size = s->bus->dma->ops->prepare_buf(s->bus->dma,
+                                              s->packet_transfer_size);
+    if (prep_size < s->packet_transfer_size) {
+        /* The PRDs are too short, stop without raising the interrupt */
+        ide_dma_buf_commit(s, 0);
+        s->io_buffer_size = 0;
+        goto eot;
+    }
+
+    trace_ide_atapi_cmd_read_dma_cb_aio(s, s->lba, prep_size >> 11);
+    s->bus->dma->aiocb = dma_blk_read(s->blk, &s->sg,
+                                      (int64_t)s->lba << ATAPI_SECTOR_BITS,
+                                      BDRV_SECTOR_SIZE,
+                                      ide_atapi_cmd_read_dma_sg_cb, s);
+    return;
+
+eot:
+    if (ret < 0) {
+        block_acct_failed(blk_get_stats(s->blk), &s->acct);
+    } else {
+        block_acct_done(blk_get_stats(s->blk), &s->acct);
+    }
+    ide_set_inactive(s, false);
+}
+#endif
+
 /* start a CD-ROM read command with DMA */
 /* XXX: test if DMA is available */
 static void ide_atapi_cmd_read_dma(IDEState *s, int lba, int nb_sectors,
@@ -436,6 +495,12 @@ static void ide_atapi_cmd_read_dma(IDEState *s, int lba, int nb_sectors,
 
     /* XXX: check if BUSY_STAT should be set */
     s->status = READY_STAT | SEEK_STAT | DRQ_STAT | BUSY_STAT;
+#ifdef XBOX
+    if (sector_size == ATAPI_SECTOR_SIZE && s->bus->dma->ops->prepare_buf) {
+        ide_start_dma(s, ide_atapi_cmd_read_dma_sg_cb);
+        return;
+    }
+#endif
     ide_start_dma(s, ide_atapi_cmd_read_dma_cb);
 }
 
@@ -113,6 +113,8 @@ static const Property ohci_pci_properties[] = {
     DEFINE_PROP_STRING("masterbus", OHCIPCIState, masterbus),
     DEFINE_PROP_UINT32("num-ports", OHCIPCIState, num_ports, 3),
     DEFINE_PROP_UINT32("firstport", OHCIPCIState, firstport, 0),
+    DEFINE_PROP_UINT32("idle-coalesce-frames", OHCIPCIState,
+                       state.idle_coalesce, 0),
 };
 
 static const VMStateDescription vmstate_ohci = {
@@ -353,6 +353,7 @@ static void ohci_soft_reset(OHCIState *ohci)
     ohci->per_cur = 0;
     ohci->done = 0;
     ohci->done_count = 7;
+    ohci->idle_frames = 0;
     /*
      * FSMPS is marked TBD in OCHI 1.0, what gives ffs?
      * I took the value linux sets ...
@@ -1010,6 +1011,9 @@ static int ohci_service_td(OHCIState *ohci, struct ohci_ed *ed)
     } else {
         ret = ohci->usb_packet.status;
     }
+    if (ret != USB_RET_NAK) {
+        ohci->frame_busy = true;
+    }
 
     if (ret >= 0) {
         if (dir == OHCI_TD_DIR_IN) {
@@ -1162,6 +1166,7 @@ static int ohci_service_ed_list(OHCIState *ohci, uint32_t head)
                 }
             } else {
                 /* Handle isochronous endpoints */
+                ohci->frame_busy = true;
                 if (ohci_service_iso_td(ohci, &ed)) {
                     break;
                 }
@@ -1177,10 +1182,38 @@ static int ohci_service_ed_list(OHCIState *ohci, uint32_t head)
     return active;
 }
 
-/* set a timer for EOF */
+/*
+ * Frames in a row without transfers before the frame timer coalesces: one
+ * turn of the interrupt tree, so that every periodic endpoint has NAKed.
+ */
+#define OHCI_IDLE_FRAMES 32
+
+static bool ohci_is_idle(OHCIState *ohci)
+{
+    return ohci->idle_coalesce > 1 && ohci->idle_frames >= OHCI_IDLE_FRAMES;
+}
+
+/*
+ * set a timer for EOF. While the bus is idle the timer only expires every
+ * idle_coalesce frames, which then run back to back: devices with new data
+ * wake the bus up with usb_wakeup(), as do register writes of the guest.
+ */
 static void ohci_eof_timer(OHCIState *ohci)
 {
-    timer_mod(ohci->eof_timer, ohci->sof_time + usb_frame_time);
+    int64_t frames = ohci_is_idle(ohci) ? ohci->idle_coalesce : 1;
+
+    timer_mod(ohci->eof_timer, ohci->sof_time + frames * usb_frame_time);
+}
+
+/* Leave idle coalescing, the next frame is due on time again */
+static void ohci_idle_exit(OHCIState *ohci)
+{
+    bool idle = ohci_is_idle(ohci);
+
+    ohci->idle_frames = 0;
+    if (idle && timer_pending(ohci->eof_timer)) {
+        ohci_eof_timer(ohci);
+    }
 }
 /* Set a timer for EOF and generate a SOF event */
 static void ohci_sof(OHCIState *ohci)
@@ -1268,6 +1301,20 @@ static void ohci_frame_boundary(void *opaque)
     if (ohci->done_count != 7 && ohci->done_count != 0) {
         ohci->done_count--;
     }
+
+    /*
+     * The bus is idle once nothing but NAKs went over it for a while, with
+     * nothing left for the done queue and no SOF interrupt wanted.
+     */
+    if (ohci->frame_busy || ohci->async_td || ohci->done_count != 7 ||
+        (ohci->status & (OHCI_STATUS_CLF | OHCI_STATUS_BLF)) ||
+        (ohci->intr & OHCI_INTR_SF)) {
+        ohci->idle_frames = 0;
+    } else if (ohci->idle_frames < OHCI_IDLE_FRAMES) {
+        ohci->idle_frames++;
+    }
+    ohci->frame_busy = false;
+
     /* Do SOF stuff here */
     ohci_sof(ohci);
 
@@ -1277,6 +1324,18 @@ static void ohci_frame_boundary(void *opaque)
     }
 }
 
+/* Run the frames that are due, see ohci_eof_timer */
+static void ohci_frame_timer(void *opaque)
+{
+    OHCIState *ohci = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    do {
+        ohci_frame_boundary(ohci);
+    } while (ohci_is_idle(ohci) && timer_pending(ohci->eof_timer) &&
+             ohci->sof_time + usb_frame_time <= now);
+}
+
 /*
  * Start sending SOF tokens across the USB bus, lists are processed in
  * next frame
@@ -1289,6 +1348,7 @@ static int ohci_bus_start(OHCIState *ohci)
      * not ready to receive it and can meet some race conditions
      */
     ohci->sof_time = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    ohci->idle_frames = 0;
     ohci_eof_timer(ohci);
 
     return 1;
@@ -1582,10 +1642,16 @@ static uint64_t ohci_mem_read(void *opaque,
 
         case 14: /* HcFmRemaining */
             retval = ohci_get_frame_remaining(ohci);
+            if (ohci_is_idle(ohci)) {
+                ohci_idle_exit(ohci);
+            }
             break;
 
         case 15: /* HcFmNumber */
             retval = ohci->frame_number;
+            if (ohci_is_idle(ohci)) {
+                ohci_idle_exit(ohci);
+            }
             break;
 
         case 16: /* HcPeriodicStart */
@@ -1651,6 +1717,9 @@ static void ohci_mem_write(void *opaque,
         return;
     }
 
+    /* The guest may have changed the lists, or wants interrupts */
+    ohci_idle_exit(ohci);
+
     if (addr >= 0x54 && addr < 0x54 + ohci->num_ports * 4) {
         /* HcRhPortStatus */
         trace_usb_ohci_mem_port_write(size, "HcRhPortStatus",
@@ -1882,7 +1951,16 @@ static USBPortOps ohci_port_ops = {
     .complete = ohci_async_complete_packet,
 };
 
+static void ohci_wakeup_endpoint(USBBus *bus, USBEndpoint *ep,
+                                 unsigned int stream)
+{
+    OHCIState *ohci = container_of(bus, OHCIState, bus);
+
+    ohci_idle_exit(ohci);
+}
+
 static USBBusOps ohci_bus_ops = {
+    .wakeup_endpoint = ohci_wakeup_endpoint,
 };
 
 void usb_ohci_init(OHCIState *ohci, DeviceState *dev, uint32_t num_ports,
@@ -1950,7 +2028,7 @@ void usb_ohci_init(OHCIState *ohci, DeviceState *dev, uint32_t num_ports,
     ohci->async_td = 0;
 
     ohci->eof_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
-                                   ohci_frame_boundary, ohci);
+                                   ohci_frame_timer, ohci);
 }
 
 /*
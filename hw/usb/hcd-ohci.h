@@ -47,6 +47,11 @@ struct OHCIState {
     QEMUTimer *eof_timer;
     int64_t sof_time;
 
+    /* Frames batched per timer expiry once the bus has gone quiet, 0 = off */
+    uint32_t idle_coalesce;
+    uint32_t idle_frames;
+    bool frame_busy;
+
     /* OHCI state */
     /* Control partition */
     uint32_t ctl, status;
@@ -188,6 +188,66 @@ type_init(chihiro_register_types)
 #define COMMUNICATION_SECTORS    0x10000
 #define SECTOR_SIZE              512
 
+/* Back a window of the interface with an image file. The page-aligned part
+ * of the image is mapped privately from the file, so untouched pages come
+ * straight from the page cache and are shared between instances; writes from
+ * the guest are copy-on-write. The remainder of the window (including any
+ * sub-page tail of the image) is ordinary RAM. A NULL @filename leaves the
+ * whole window as zeroed RAM.
+ */
+static void chihiro_map_image(MemoryRegion *window, const char *name,
+                              const char *filename)
+{
+    uint64_t window_size = memory_region_size(window);
+    uint64_t mapped_size = 0;
+    int rc, fd;
+
+    int64_t image_size = 0;
+    if (filename) {
+        image_size = get_image_size(filename);
+        assert(image_size >= 0 && image_size < window_size);
+    }
+
+#ifdef CONFIG_POSIX
+    mapped_size = QEMU_ALIGN_DOWN(image_size, qemu_real_host_page_size());
+    if (mapped_size) {
+        MemoryRegion *file = g_malloc(sizeof(*file));
+        char *file_name = g_strdup_printf("%s.file", name);
+        Error *err = NULL;
+
+        if (memory_region_init_ram_from_file(file, NULL, file_name,
+                                             mapped_size, 0, RAM_READONLY_FD,
+                                             filename, 0, &err)) {
+            memory_region_add_subregion(window, 0, file);
+        } else {
+            warn_report_err(err);
+            g_free(file);
+            mapped_size = 0;
+        }
+        g_free(file_name);
+    }
+#endif
+
+    MemoryRegion *ram = g_malloc(sizeof(*ram));
+    char *ram_name = g_strdup_printf("%s.ram", name);
+    memory_region_init_ram(ram, NULL, ram_name, window_size - mapped_size,
+                           &error_fatal);
+    memory_region_add_subregion(window, mapped_size, ram);
+    g_free(ram_name);
+
+    if (image_size == mapped_size) {
+        return;
+    }
+
+    fd = open(filename, O_RDONLY | O_BINARY);
+    assert(fd != -1);
+    rc = lseek(fd, mapped_size, SEEK_SET);
+    assert(rc == mapped_size);
+    rc = read(fd, memory_region_get_ram_ptr(ram), image_size - mapped_size);
+    assert(rc == image_size - mapped_size);
+    close(fd);
+}
+
 static void chihiro_ide_interface_init(const char *rom_file,
                                        const char *filesystem_file)
 {
@@ -202,56 +262,38 @@ static void chihiro_ide_interface_init(const char *rom_file,
     memory_region_init(interface, NULL, "chihiro.interface",
                        (uint64_t)0x10000000 * SECTOR_SIZE);
 
-    rom = g_malloc(sizeof(*rom));
-    memory_region_init_ram(rom, NULL, "chihiro.interface.rom",
-                           ROM_SECTORS * SECTOR_SIZE, &error_fatal);
-    memory_region_add_subregion(interface,
-                                (uint64_t)ROM_START * SECTOR_SIZE, rom);
-
-
-    /* limited by the size of the board ram, which we emulate as 128M for now */
-    filesystem = g_malloc(sizeof(*filesystem));
-    memory_region_init_ram(filesystem, NULL, "chihiro.interface.filesystem",
-                           128 * 1024 * 1024, &error_fatal);
-    memory_region_add_subregion(interface,
-                                (uint64_t)FILESYSTEM_START * SECTOR_SIZE,
-                                filesystem);
-
-
     AddressSpace *interface_space;
     interface_space = g_malloc(sizeof(*interface_space));
     address_space_init(interface_space, interface, "chihiro-interface");
 
-    /* read files */
-    int rc, fd = -1;
+    rom = g_malloc(sizeof(*rom));
+    memory_region_init(rom, NULL, "chihiro.interface.rom",
+                       ROM_SECTORS * SECTOR_SIZE);
 
     if (!rom_file || (*rom_file == '\x00')) {
         rom_file = "fpr21042_m29w160et.bin";
     }
     char *rom_filename = qemu_find_file(QEMU_FILE_TYPE_BIOS, rom_file);
-    if (rom_filename) {
-        int rom_size = get_image_size(rom_filename);
-        assert(rom_size < memory_region_size(rom));
-
-        fd = open(rom_filename, O_RDONLY | O_BINARY);
-        assert(fd != -1);
-        rc = read(fd, memory_region_get_ram_ptr(rom), rom_size);
-        assert(rc == rom_size);
-        close(fd);
-    }
+    chihiro_map_image(rom, "chihiro.interface.rom", rom_filename);
+    g_free(rom_filename);
+    memory_region_add_subregion(interface,
+                                (uint64_t)ROM_START * SECTOR_SIZE, rom);
+
+    /* limited by the size of the board ram, which we emulate as 128M for now */
+    filesystem = g_malloc(sizeof(*filesystem));
+    memory_region_init(filesystem, NULL, "chihiro.interface.filesystem",
+                       128 * 1024 * 1024);
 
     if (filesystem_file && (*filesystem_file != '\x00')) {
         assert(access(filesystem_file, R_OK) == 0);
-
-        int filesystem_size = get_image_size(filesystem_file);
-        assert(filesystem_size < memory_region_size(filesystem));
-
-        fd = open(filesystem_file, O_RDONLY | O_BINARY);
-        assert(fd != -1);
-        rc = read(fd, memory_region_get_ram_ptr(rom), filesystem_size);
-        assert(rc == filesystem_size);
-        close(fd);
+    } else {
+        filesystem_file = NULL;
     }
+    chihiro_map_image(filesystem, "chihiro.interface.filesystem",
+                      filesystem_file);
+    memory_region_add_subregion(interface,
+                                (uint64_t)FILESYSTEM_START * SECTOR_SIZE,
+                                filesystem);
 
 #if 0 // FIXME
     /* create the device */
@@ -20,6 +20,10 @@
  */
 
 #include "apu_int.h"
+#ifdef __ANDROID__
+#include "ui/xemu-android-audio.h"
+#include "ui/xemu-android-perf.h"
+#endif
 
 MCPXAPUState *g_state; // Used via debug handlers
 
@@ -71,25 +75,29 @@ static void mcpx_apu_write(void *opaque, hwaddr addr, uint64_t val,
     trace_mcpx_apu_reg_write(addr, size, val);
 
     switch (addr) {
-    case NV_PAPU_ISTS:
+    case NV_PAPU_ISTS: {
         /* the bits of the interrupts to clear are written */
+        BQL_LOCK_GUARD();
         qatomic_and(&d->regs[NV_PAPU_ISTS], ~val);
         update_irq(d);
         qemu_cond_broadcast(&d->cond);
         break;
+    }
     case NV_PAPU_FECTL:
     case NV_PAPU_SECTL:
         qatomic_set(&d->regs[addr], val);
         qemu_cond_broadcast(&d->cond);
         break;
-    case NV_PAPU_FEMEMDATA:
+    case NV_PAPU_FEMEMDATA: {
         /* 'magic write'
          * This value is expected to be written to FEMEMADDR on completion of
          * something to do with notifies. Just do it now :/ */
+        BQL_LOCK_GUARD();
         stl_le_phys(&address_space_memory, d->regs[NV_PAPU_FEMEMADDR], val);
         // fprintf(stderr, "MAGIC WRITE\n");
         qatomic_set(&d->regs[addr], val);
         break;
+    }
     default:
         if (addr < 0x20000) {
             qatomic_set(&d->regs[addr], val);
@@ -105,11 +113,100 @@ static const MemoryRegionOps mcpx_apu_mmio_ops = {
 
 static int monitor_num_used_bytes(MCPXAPUState *d)
 {
-    int queued_bytes;
-    qemu_spin_lock(&d->monitor.fifo_lock);
-    queued_bytes = (int)fifo8_num_used(&d->monitor.fifo);
-    qemu_spin_unlock(&d->monitor.fifo_lock);
-    return queued_bytes;
+    return (int)monitor_ring_num_used(&d->monitor.ring);
+}
+
+#define MONITOR_BYTES_PER_MS          (48 * 2 * sizeof(int16_t))
+#define MONITOR_MAX_LATENCY_MS        250
+#define MONITOR_ADAPT_WINDOW_FRAMES   188 /* ~1s of EP frames */
+#define MONITOR_SHRINK_AFTER_WINDOWS  10
+#define MONITOR_SHRINK_AFTER_WINDOWS_MAX 320
+
+static void monitor_set_target_latency(MCPXAPUState *d, int target_bytes)
+{
+    int frame_bytes = sizeof(d->monitor.frame_buf);
+    int max_high = MAX(d->monitor.fifo_capacity_bytes - frame_bytes,
+                       frame_bytes);
+
+    target_bytes = MAX(d->monitor.target_min_bytes,
+                       MIN(target_bytes, d->monitor.target_max_bytes));
+    d->monitor.target_bytes = target_bytes;
+    d->monitor.queued_bytes_high =
+        MIN(target_bytes + 2 * d->monitor.drain_bytes, max_high);
+    d->monitor.queued_bytes_low =
+        MIN(target_bytes, d->monitor.queued_bytes_high);
+}
+
+/*
+ * Once per window, grow the queue target if the audio device ran dry and
+ * slowly give latency back after a run of windows where the device always
+ * found more than a frame to spare. Underruns only count while the APU
+ * thread had time to spare; when emulation itself is behind, more buffering
+ * would not help. Each underrun doubles the wait before the next attempt to
+ * shrink, so the target settles instead of probing into dropouts.
+ */
+static void monitor_adapt_latency(MCPXAPUState *d)
+{
+    int frame_bytes = sizeof(d->monitor.frame_buf);
+
+    if (++d->monitor.window_frames < MONITOR_ADAPT_WINDOW_FRAMES) {
+        return;
+    }
+
+    int underruns = qatomic_xchg(&d->monitor.underruns, 0);
+    int min_slack = qatomic_xchg(&d->monitor.window_min_slack, INT_MAX);
+    if (underruns && d->monitor.window_sleep_us > 0) {
+        monitor_set_target_latency(d, d->monitor.target_bytes +
+                                   MAX(frame_bytes,
+                                       d->monitor.drain_bytes / 2));
+        d->monitor.quiet_windows = 0;
+        d->monitor.shrink_after_windows =
+            MIN(2 * d->monitor.shrink_after_windows,
+                MONITOR_SHRINK_AFTER_WINDOWS_MAX);
+    } else if (!underruns &&
+               ++d->monitor.quiet_windows >=
+                   d->monitor.shrink_after_windows &&
+               min_slack > frame_bytes) {
+        monitor_set_target_latency(d, d->monitor.target_bytes - frame_bytes);
+        d->monitor.quiet_windows = 0;
+    }
+
+    d->monitor.window_frames = 0;
+    d->monitor.window_sleep_us = 0;
+}
+
+/*
+ * Turbo mode ignores the audio device and only paces to the configured speed
+ * multiplier, if any. Deadlines accumulate so the average rate holds even
+ * though waits have millisecond resolution.
+ */
+static void throttle_turbo(MCPXAPUState *d)
+{
+    float speed = g_config.audio.turbo.speed;
+    if (speed <= 0) {
+        d->next_frame_time_us = 0;
+        return;
+    }
+
+    int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    int64_t frame_us = EP_FRAME_US / speed;
+
+    if (d->next_frame_time_us == 0 ||
+        start_us - d->next_frame_time_us > 8 * EP_FRAME_US) {
+        d->next_frame_time_us = start_us;
+    }
+    while (!qatomic_read(&d->exiting)) {
+        int64_t remaining_ms =
+            (d->next_frame_time_us - qemu_clock_get_us(QEMU_CLOCK_REALTIME)) /
+            1000;
+        if (remaining_ms <= 0) {
+            break;
+        }
+        qemu_cond_timedwait(&d->cond, &d->lock, MIN(remaining_ms, INT_MAX));
+    }
+    d->next_frame_time_us += frame_us;
+
+    d->sleep_acc_us += qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
 }
 
 static void throttle(MCPXAPUState *d)
@@ -118,12 +215,18 @@ static void throttle(MCPXAPUState *d)
         return;
     }
 
+    if (g_config.audio.turbo.enable) {
+        throttle_turbo(d);
+        return;
+    }
+
     if (d->monitor.fifo_capacity_bytes <= 0) {
         return;
     }
 
     int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int queued_bytes = monitor_num_used_bytes(d);
+    monitor_adapt_latency(d);
 
     while (!qatomic_read(&d->exiting) &&
            queued_bytes >= d->monitor.queued_bytes_high) {
@@ -161,7 +264,9 @@ static void throttle(MCPXAPUState *d)
         d->next_frame_time_us = start_us;
     }
 
-    d->sleep_acc_us += qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    int64_t slept_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    d->sleep_acc_us += slept_us;
+    d->monitor.window_sleep_us += slept_us;
 }
 
 static void se_frame(MCPXAPUState *d)
@@ -170,6 +275,7 @@ static void se_frame(MCPXAPUState *d)
     mcpx_debug_begin_frame();
     g_dbg.gp_realtime = d->gp.realtime;
     g_dbg.ep_realtime = d->ep.realtime;
+    g_dbg.gp_hle = d->gp.hle;
 
     /* A rudimentary calculation to determine approximately how taxed the APU
      * thread is, by measuring how much time we spend waiting for FIFO to drain
@@ -180,6 +286,7 @@ static void se_frame(MCPXAPUState *d)
     int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
     if (now - d->frame_count_time_ms >= 1000) {
         g_dbg.frames_processed = d->frame_count;
+        g_dbg.fe_lock_contended = qatomic_xchg(&d->fe_lock_contended, 0);
         float t = 1.0f - ((double)d->sleep_acc_us /
                           (double)((now - d->frame_count_time_ms) * 1000));
         g_dbg.utilization = t;
@@ -197,6 +304,8 @@ static void se_frame(MCPXAPUState *d)
     mcpx_apu_dsp_frame(d, mixbins);
 
     if ((d->ep_frame_div + 1) % 8 == 0) {
+        mcpx_apu_ep_wait(d);
+
 #if 0
         FILE *fd = fopen("ep.pcm", "a+");
         assert(fd != NULL);
@@ -213,12 +322,13 @@ static void se_frame(MCPXAPUState *d)
         }
 
         if (d->monitor.fifo_capacity_bytes > 0) {
-            qemu_spin_lock(&d->monitor.fifo_lock);
-            int num_bytes_free = (int)fifo8_num_free(&d->monitor.fifo);
-            assert(num_bytes_free >= sizeof(d->monitor.frame_buf));
-            fifo8_push_all(&d->monitor.fifo, (uint8_t *)d->monitor.frame_buf,
-                           sizeof(d->monitor.frame_buf));
-            qemu_spin_unlock(&d->monitor.fifo_lock);
+            /* In turbo mode the device can't keep up, drop what won't fit */
+            if (!g_config.audio.turbo.enable ||
+                monitor_ring_num_free(&d->monitor.ring) >=
+                    sizeof(d->monitor.frame_buf)) {
+                monitor_ring_push(&d->monitor.ring, d->monitor.frame_buf,
+                                  sizeof(d->monitor.frame_buf));
+            }
         }
         memset(d->monitor.frame_buf, 0, sizeof(d->monitor.frame_buf));
     }
@@ -264,73 +374,107 @@ static int getenv_int_clamped(const char *name, int min_value, int max_value,
     return (int)parsed;
 }
 
-static void monitor_sink_cb(void *opaque, uint8_t *stream, int free_b)
+/*
+ * Stretch the samples that did arrive over the whole device buffer. A brief
+ * drop in pitch is far less noticeable than a gap of silence.
+ */
+static void monitor_stretch(uint8_t *stream, int avail_b, int len_b)
 {
-    MCPXAPUState *s = MCPX_APU_DEVICE(opaque);
+    int16_t (*buf)[2] = (int16_t (*)[2])stream;
+    int in_frames = avail_b / sizeof(buf[0]);
+    int out_frames = len_b / sizeof(buf[0]);
 
+    if (in_frames < 2) {
+        memset(stream + avail_b, 0, len_b - avail_b);
+        return;
+    }
+
+    /*
+     * Walk backwards so every source frame is read before it is overwritten,
+     * which holds since the source position never passes the output one.
+     */
+    float step = (float)(in_frames - 1) / (out_frames - 1);
+    for (int i = out_frames - 1; i >= 0; i--) {
+        float pos = i * step;
+        int idx = MIN((int)pos, in_frames - 2);
+        float frac = pos - idx;
+        for (int ch = 0; ch < 2; ch++) {
+            buf[i][ch] = buf[idx][ch] +
+                         (int)((buf[idx + 1][ch] - buf[idx][ch]) * frac);
+        }
+    }
+    memset(stream + out_frames * sizeof(buf[0]), 0,
+           len_b - out_frames * sizeof(buf[0]));
+}
+
+/*
+ * Fill the device buffer from the ring. When the device lets us, give the
+ * APU thread a few short chances to catch up before settling for less.
+ */
+static void monitor_sink_fill(MCPXAPUState *s, uint8_t *stream, int free_b,
+                              bool can_wait)
+{
     if (!runstate_is_running()) {
         memset(stream, 0, free_b);
         return;
     }
 
-    int avail = 0;
-    for (int i = 0; i < 10; i++) {
-        qemu_spin_lock(&s->monitor.fifo_lock);
-        avail = fifo8_num_used(&s->monitor.fifo);
-        qemu_spin_unlock(&s->monitor.fifo_lock);
-        if (avail >= free_b) {
-            break;
-        }
+    int avail = monitor_ring_num_used(&s->monitor.ring);
+    for (int i = 0; can_wait && i < 10 && avail < free_b; i++) {
         sleep_ns(500000);
         qemu_cond_broadcast(&s->cond);
         if (!runstate_is_running()) {
             memset(stream, 0, free_b);
             return;
         }
+        avail = monitor_ring_num_used(&s->monitor.ring);
     }
 
-    int copied = 0;
-    int to_copy = MIN(free_b, avail);
-    while (copied < to_copy) {
-        uint32_t chunk_len = 0;
-        qemu_spin_lock(&s->monitor.fifo_lock);
-        chunk_len = fifo8_pop_buf(&s->monitor.fifo, stream + copied,
-                                  to_copy - copied);
-        qemu_spin_unlock(&s->monitor.fifo_lock);
-        if (!chunk_len) {
-            break;
-        }
-        copied += chunk_len;
+    if (avail - free_b < qatomic_read(&s->monitor.window_min_slack)) {
+        qatomic_set(&s->monitor.window_min_slack, avail - free_b);
     }
 
+    int copied = monitor_ring_pop(&s->monitor.ring, stream, free_b);
+
     if (copied < free_b) {
-        memset(stream + copied, 0, free_b - copied);
+        qatomic_inc(&s->monitor.underruns);
+        if (copied >= free_b / 2) {
+            monitor_stretch(stream, copied, free_b);
+        } else {
+            memset(stream + copied, 0, free_b - copied);
+        }
     }
 
+    /* Every pull from the device paces the APU thread in throttle() */
     qemu_cond_broadcast(&s->cond);
 }
 
-static void monitor_init(MCPXAPUState *d)
+static void monitor_sink_cb(void *opaque, uint8_t *stream, int free_b)
 {
-    qemu_spin_init(&d->monitor.fifo_lock);
-    d->monitor.fifo_capacity_bytes = 0;
-    d->monitor.device_buffer_bytes = 0;
-    d->monitor.queued_bytes_low = 0;
-    d->monitor.queued_bytes_high = 0;
+    monitor_sink_fill(MCPX_APU_DEVICE(opaque), stream, free_b, true);
+}
 
-    int fifo_frames = 3;
-    int audio_samples = 512;
 #ifdef __ANDROID__
-    fifo_frames = 16;
-    audio_samples = 2048;
-    fifo_frames = getenv_int_clamped("XEMU_ANDROID_AUDIO_FIFO_FRAMES", 3, 32,
-                                     fifo_frames);
-    audio_samples = getenv_int_clamped("XEMU_ANDROID_AUDIO_SAMPLES", 256, 4096,
-                                       audio_samples);
+/* AAudio calls in on a real-time thread which must never sleep */
+static void monitor_sink_realtime_cb(void *opaque, uint8_t *stream,
+                                     int free_b)
+{
+    monitor_sink_fill(MCPX_APU_DEVICE(opaque), stream, free_b, false);
+}
+
+static bool monitor_use_aaudio(void)
+{
+    const char *driver = getenv("XEMU_ANDROID_AUDIO_DRIVER");
+    return !driver || driver[0] == '\0' ||
+           !g_ascii_strcasecmp(driver, "auto") ||
+           !g_ascii_strcasecmp(driver, "default") ||
+           !g_ascii_strcasecmp(driver, "aaudio");
+}
 #endif
-    int fifo_capacity_bytes = fifo_frames * sizeof(d->monitor.frame_buf);
-    fifo8_create(&d->monitor.fifo, fifo_capacity_bytes);
 
+/* Returns the device buffer size in bytes, or 0 on failure */
+static int monitor_open_sdl(MCPXAPUState *d, int audio_samples)
+{
     struct SDL_AudioSpec sdl_audio_spec = {
         .freq = 48000,
         .format = AUDIO_S16LSB,
@@ -343,7 +487,7 @@ static void monitor_init(MCPXAPUState *d)
     if (SDL_Init(SDL_INIT_AUDIO) < 0)  {
         fprintf(stderr, "WARNING: Failed to initialize SDL audio subsystem: %s\n",
                 SDL_GetError());
-        return;
+        return 0;
     }
 
     SDL_AudioDeviceID sdl_audio_dev;
@@ -353,7 +497,7 @@ static void monitor_init(MCPXAPUState *d)
     if (sdl_audio_dev == 0) {
         fprintf(stderr, "WARNING: SDL_OpenAudioDevice failed: %s\n",
                 SDL_GetError());
-        return;
+        return 0;
     }
 
     int bytes_per_sample = SDL_AUDIO_BITSIZE(obtained_audio_spec.format) / 8;
@@ -371,15 +515,75 @@ static void monitor_init(MCPXAPUState *d)
                               bytes_per_sample;
     }
 
+    SDL_PauseAudioDevice(sdl_audio_dev, 0);
+    return device_buffer_bytes;
+}
+
+static void monitor_init(MCPXAPUState *d)
+{
+    d->monitor.fifo_capacity_bytes = 0;
+    d->monitor.device_buffer_bytes = 0;
+    d->monitor.queued_bytes_low = 0;
+    d->monitor.queued_bytes_high = 0;
+
+    int fifo_frames = 3;
+    int audio_samples = 512;
+#ifdef __ANDROID__
+    fifo_frames = 16;
+    audio_samples = 2048;
+    fifo_frames = getenv_int_clamped("XEMU_ANDROID_AUDIO_FIFO_FRAMES", 3, 32,
+                                     fifo_frames);
+    audio_samples = getenv_int_clamped("XEMU_ANDROID_AUDIO_SAMPLES", 256, 4096,
+                                       audio_samples);
+#endif
+    /* Leave room for the latency controller to grow the queue */
+    monitor_ring_init(&d->monitor.ring,
+                      MAX(fifo_frames * sizeof(d->monitor.frame_buf),
+                          MONITOR_MAX_LATENCY_MS * MONITOR_BYTES_PER_MS +
+                              3 * audio_samples * 2 * sizeof(int16_t)));
+    int fifo_capacity_bytes = d->monitor.ring.size;
+
+    /* The device callback starts updating these as soon as it is opened */
+    d->monitor.underruns = 0;
+    d->monitor.window_min_slack = INT_MAX;
+
+    int device_buffer_bytes = 0;
+#ifdef __ANDROID__
+    if (!monitor_use_aaudio() ||
+        !xemu_android_audio_open(monitor_sink_realtime_cb, d,
+                                 &device_buffer_bytes)) {
+        device_buffer_bytes = monitor_open_sdl(d, audio_samples);
+    }
+#else
+    device_buffer_bytes = monitor_open_sdl(d, audio_samples);
+#endif
+    if (device_buffer_bytes <= 0) {
+        return;
+    }
+
     int frame_bytes = sizeof(d->monitor.frame_buf);
     int drain_bytes = MAX(device_buffer_bytes, frame_bytes);
-    int max_high = MAX(fifo_capacity_bytes - frame_bytes, frame_bytes);
     d->monitor.fifo_capacity_bytes = fifo_capacity_bytes;
     d->monitor.device_buffer_bytes = device_buffer_bytes;
-    d->monitor.queued_bytes_high = MIN(3 * drain_bytes, max_high);
-    d->monitor.queued_bytes_low = MIN(drain_bytes, d->monitor.queued_bytes_high);
-
-    SDL_PauseAudioDevice(sdl_audio_dev, 0);
+    d->monitor.drain_bytes = drain_bytes;
+    d->monitor.window_frames = 0;
+    d->monitor.window_sleep_us = 0;
+    d->monitor.quiet_windows = 0;
+    d->monitor.shrink_after_windows = MONITOR_SHRINK_AFTER_WINDOWS;
+
+    /*
+     * Start from one device buffer, or from the configured latency which then
+     * also serves as the floor.
+     */
+    int target_bytes = drain_bytes;
+    if (g_config.audio.target_latency_ms > 0) {
+        target_bytes = g_config.audio.target_latency_ms * MONITOR_BYTES_PER_MS;
+    }
+    d->monitor.target_min_bytes =
+        g_config.audio.target_latency_ms > 0 ? target_bytes : frame_bytes;
+    d->monitor.target_max_bytes =
+        MAX(MONITOR_MAX_LATENCY_MS * MONITOR_BYTES_PER_MS, target_bytes);
+    monitor_set_target_latency(d, target_bytes);
 }
 
 static void mcpx_apu_realize(PCIDevice *dev, Error **errp)
@@ -395,6 +599,12 @@ static void mcpx_apu_realize(PCIDevice *dev, Error **errp)
                           "mcpx-apu-vp", 0x10000);
     memory_region_add_subregion(&d->mmio, 0x20000, &d->vp.mmio);
 
+    /* Registers are accessed atomically and VP methods take fe_lock, so the
+     * vCPU doesn't have to contend with the APU thread for the BQL. Only
+     * interrupt updates still need it. */
+    memory_region_enable_lockless_io(&d->mmio);
+    memory_region_enable_lockless_io(&d->vp.mmio);
+
     memory_region_init_io(&d->gp.mmio, OBJECT(dev), &gp_ops, d,
                           "mcpx-apu-gp", 0x10000);
     memory_region_add_subregion(&d->mmio, 0x30000, &d->gp.mmio);
@@ -412,6 +622,7 @@ static void mcpx_apu_exitfn(PCIDevice *dev)
     d->exiting = true;
     qemu_cond_broadcast(&d->cond);
     qemu_thread_join(&d->apu_thread);
+    mcpx_apu_dsp_finalize(d);
     mcpx_apu_vp_finalize(d);
 }
 
@@ -423,10 +634,9 @@ static void mcpx_apu_reset(MCPXAPUState *d)
     mcpx_apu_vp_reset(d);
 
     // FIXME: Reset DSP state
-    memset(d->gp.dsp->core.pram_opcache, 0,
-           sizeof(d->gp.dsp->core.pram_opcache));
-    memset(d->ep.dsp->core.pram_opcache, 0,
-           sizeof(d->ep.dsp->core.pram_opcache));
+    mcpx_apu_ep_wait(d);
+    dsp56k_invalidate_opcache(&d->gp.dsp->core);
+    dsp56k_invalidate_opcache(&d->ep.dsp->core);
     d->set_irq = false;
     d->next_frame_time_us = 0;
     qemu_cond_signal(&d->cond);
@@ -442,6 +652,7 @@ static void mcpx_apu_vm_state_change(void *opaque, bool running, RunState state)
 
     if (state == RUN_STATE_SAVE_VM) {
         qemu_mutex_lock(&d->lock);
+        mcpx_apu_ep_wait(d);
     }
 }
 
@@ -464,6 +675,11 @@ static int mcpx_apu_pre_load(void *opaque)
 static int mcpx_apu_post_load(void *opaque, int version_id)
 {
     MCPXAPUState *d = opaque;
+
+    /* pram was replaced underneath the decoded instruction caches */
+    dsp56k_invalidate_opcache(&d->gp.dsp->core);
+    dsp56k_invalidate_opcache(&d->ep.dsp->core);
+
     qemu_cond_signal(&d->cond);
     qemu_mutex_unlock(&d->lock);
     return 0;
@@ -629,6 +845,11 @@ type_init(mcpx_apu_register);
 static void *mcpx_apu_frame_thread(void *arg)
 {
     MCPXAPUState *d = MCPX_APU_DEVICE(arg);
+    xemu_trace_set_thread_name("mcpx.apu_thread");
+    xemu_thread_topology_register(XEMU_THREAD_REALTIME, "mcpx.apu_thread");
+#ifdef __ANDROID__
+    xemu_android_perf_thread_started(XEMU_PERF_THREAD_APU);
+#endif
     qemu_mutex_lock(&d->lock);
     while (!qatomic_read(&d->exiting)) {
         int xcntmode = GET_MASK(qatomic_read(&d->regs[NV_PAPU_SECTL]),
@@ -659,7 +880,9 @@ static void *mcpx_apu_frame_thread(void *arg)
             continue;
         }
         throttle(d);
+        xemu_trace_begin("apu frame", NULL);
         se_frame((void *)d);
+        xemu_trace_end();
     }
     qemu_mutex_unlock(&d->lock);
     return NULL;
@@ -674,6 +897,7 @@ void mcpx_apu_init(PCIBus *bus, int devfn, MemoryRegion *ram)
 
     d->ram = ram;
     d->ram_ptr = memory_region_get_ram_ptr(d->ram);
+    d->ram_size = memory_region_size(d->ram);
 
     mcpx_apu_dsp_init(d);
 
@@ -682,6 +906,7 @@ void mcpx_apu_init(PCIBus *bus, int devfn, MemoryRegion *ram)
 
     qemu_mutex_init(&d->lock);
     qemu_cond_init(&d->cond);
+    qemu_mutex_init(&d->fe_lock);
     qemu_add_vm_change_state_handler(mcpx_apu_vm_state_change, d);
 
     mcpx_apu_vp_init(d);
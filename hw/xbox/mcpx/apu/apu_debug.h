@@ -37,6 +37,7 @@ struct McpxApuDebugVoice
 {
     bool active;
     bool paused;
+    bool culled;
     bool stereo;
     uint8_t bin[8];
     uint16_t vol[8];
@@ -68,6 +69,8 @@ struct McpxApuDebugVp
 struct McpxApuDebugDsp
 {
     int cycles;
+    uint64_t program_hash;
+    const char *hle_program; /* NULL if interpreted */
 };
 
 struct McpxApuDebug
@@ -75,8 +78,10 @@ struct McpxApuDebug
     struct McpxApuDebugVp vp;
     struct McpxApuDebugDsp gp, ep;
     int frames_processed;
+    int fe_lock_contended;
     float utilization;
     bool gp_realtime, ep_realtime;
+    bool gp_hle;
 };
 
 #ifdef __cplusplus
@@ -92,6 +97,7 @@ void mcpx_apu_debug_toggle_mute(uint16_t v);
 bool mcpx_apu_debug_is_muted(uint16_t v);
 void mcpx_apu_debug_set_gp_realtime_enabled(bool enable);
 void mcpx_apu_debug_set_ep_realtime_enabled(bool enable);
+void mcpx_apu_debug_set_gp_hle_enabled(bool enable);
 
 #ifdef __cplusplus
 }
@@ -33,14 +33,17 @@
 #include "qemu/main-loop.h"
 #include "qemu/thread.h"
 #include "system/runstate.h"
-#include "qemu/fifo8.h"
+#include "ui/xemu-mem-stats.h"
 #include "ui/xemu-settings.h"
+#include "ui/xemu-thread-topology.h"
+#include "ui/xemu-trace.h"
 
 #include "trace.h"
 #include "apu.h"
 #include "apu_regs.h"
 #include "apu_debug.h"
 #include "fpconv.h"
+#include "monitor_ring.h"
 #include "vp/vp.h"
 #include "dsp/gp_ep.h"
 
@@ -82,14 +85,18 @@ typedef struct MCPXAPUState {
     QemuThread apu_thread;
     QemuMutex lock;
     QemuCond cond;
+    QemuMutex fe_lock; // Serializes VP method writes, which skip the BQL
+    int fe_lock_contended;
 
     MemoryRegion *ram;
     uint8_t *ram_ptr;
+    hwaddr ram_size;
     MemoryRegion mmio;
 
     MCPXAPUVPState vp;
     MCPXAPUGPState gp;
     MCPXAPUEPState ep;
+    XemuMemAccount *dsp_mem_account;
 
     uint32_t regs[0x20000];
 
@@ -102,11 +109,18 @@ typedef struct MCPXAPUState {
     struct {
         McpxApuDebugMonitorPoint point;
         int16_t frame_buf[256][2]; // 1 EP frame (0x400 bytes), 8 buffered
-        QemuSpin fifo_lock;
-        Fifo8 fifo;
+        MonitorRing ring;
         int fifo_capacity_bytes;
         int device_buffer_bytes;
         int queued_bytes_low, queued_bytes_high;
+        int drain_bytes;
+        int target_bytes, target_min_bytes, target_max_bytes;
+        int underruns;
+        int window_frames;
+        int window_min_slack;
+        int64_t window_sleep_us;
+        int quiet_windows;
+        int shrink_after_windows;
     } monitor;
 } MCPXAPUState;
 
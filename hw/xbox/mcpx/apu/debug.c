@@ -53,6 +53,11 @@ void mcpx_apu_debug_set_ep_realtime_enabled(bool run)
     g_state->ep.realtime = run;
 }
 
+void mcpx_apu_debug_set_gp_hle_enabled(bool enable)
+{
+    g_state->gp.hle = enable;
+}
+
 McpxApuDebugMonitorPoint mcpx_apu_debug_get_monitor(void)
 {
     return g_state->monitor.point;
@@ -71,6 +71,7 @@ void dsp_reset(DSPState* dsp)
 
 void dsp_destroy(DSPState* dsp)
 {
+    dsp56k_invalidate_opcache(&dsp->core);
     free(dsp);
 }
 
@@ -154,12 +155,22 @@ void dsp_run(DSPState* dsp, int cycles)
 
     while (dsp->save_cycles > 0)
     {
-        dsp56k_execute_instruction(&dsp->core);
-        dsp->save_cycles -= dsp->core.instr_cycle;
-        dsp->core.cycle_count++;
-
         if (dsp->dma.control & DMA_CONTROL_RUNNING) {
+            /* Step while DMA is running to keep its timing */
+            dsp56k_execute_instruction(&dsp->core);
+            dsp->save_cycles -= dsp->core.instr_cycle;
+            dsp->core.cycle_count++;
             dma_timer++;
+        } else {
+            /* Blocks end on peripheral writes, so DMA starts are seen here */
+            int block_cycles = 0;
+            int executed = dsp56k_execute_block(&dsp->core, dsp->save_cycles,
+                                                &block_cycles);
+            dsp->save_cycles -= block_cycles;
+            dsp->core.cycle_count += executed;
+            if (dsp->dma.control & DMA_CONTROL_RUNNING) {
+                dma_timer++;
+            }
         }
 
         if (dma_timer > 2) {
@@ -189,7 +200,7 @@ void dsp_bootstrap(DSPState* dsp)
             dsp->core.pram[i] &= 0x00ffffff;
         }
     }
-    memset(dsp->core.pram_opcache, 0, sizeof(dsp->core.pram_opcache));
+    dsp56k_invalidate_opcache(&dsp->core);
 }
 
 void dsp_start_frame(DSPState* dsp)
@@ -345,6 +345,42 @@ static const OpcodeEntry nonparallel_opcodes[] = {
 static bool matches_initialised;
 static uint32_t nonparallel_matches[ARRAY_SIZE(nonparallel_opcodes)][2];
 
+/*
+ * Opcodes that can match each value of bits 19..12, in table order.
+ * Bucket b holds opcode_buckets[opcode_bucket_start[b]..start[b+1]).
+ */
+QEMU_BUILD_BUG_ON(ARRAY_SIZE(nonparallel_opcodes) > 256);
+static uint16_t opcode_bucket_start[257];
+static uint8_t *opcode_buckets;
+
+static bool opcode_in_bucket(int i, uint32_t bucket)
+{
+    uint32_t mask = nonparallel_matches[i][0] & 0xff000;
+    return ((bucket << 12) & mask) == (nonparallel_matches[i][1] & mask);
+}
+
+static void init_opcode_buckets(void)
+{
+    int n = 0;
+    for (uint32_t b = 0; b < 256; b++) {
+        opcode_bucket_start[b] = n;
+        for (int i = 0; i < ARRAY_SIZE(nonparallel_opcodes); i++) {
+            n += opcode_in_bucket(i, b);
+        }
+    }
+    opcode_bucket_start[256] = n;
+
+    opcode_buckets = g_new(uint8_t, n);
+    n = 0;
+    for (uint32_t b = 0; b < 256; b++) {
+        for (int i = 0; i < ARRAY_SIZE(nonparallel_opcodes); i++) {
+            if (opcode_in_bucket(i, b)) {
+                opcode_buckets[n++] = i;
+            }
+        }
+    }
+}
+
 /**********************************
  *  Emulator kernel
  **********************************/
@@ -371,6 +407,8 @@ void dsp56k_reset_cpu(dsp_core_t* dsp)
             nonparallel_matches[i][0] = mask;
             nonparallel_matches[i][1] = match;
         }
+
+        init_opcode_buckets();
     }
 
     /* Memory */
@@ -412,8 +450,13 @@ void dsp56k_reset_cpu(dsp_core_t* dsp)
     dsp->disasm_prev_inst_pc = 0xFFFFFFFF;
 }
 
-static const OpcodeEntry *lookup_opcode_slow(uint32_t op) {
-    for (int i = 0; i < ARRAY_SIZE(nonparallel_opcodes); i++) {
+static const OpcodeEntry *lookup_opcode(uint32_t op) {
+    /* Non-parallel opcodes only use bits 19..0 */
+    const uint8_t *bucket = &opcode_buckets[opcode_bucket_start[(op >> 12) & 0xff]];
+    const uint8_t *end = &opcode_buckets[opcode_bucket_start[((op >> 12) & 0xff) + 1]];
+
+    for (; bucket < end; bucket++) {
+        int i = *bucket;
         if ((op & nonparallel_matches[i][0]) == nonparallel_matches[i][1]) {
             if (nonparallel_opcodes[i].match_func
                 && !nonparallel_opcodes[i].match_func(op)) continue;
@@ -426,25 +469,6 @@ static const OpcodeEntry *lookup_opcode_slow(uint32_t op) {
     return NULL;
 }
 
-static const OpcodeEntry *lookup_opcode(uint32_t op) {
-    static struct opcache_entry {
-        uint32_t op;
-        const OpcodeEntry *entry;
-    } opcache[256];
-
-    uint8_t tag =
-        ((op >> 24) & 0xff) ^
-        ((op >> 16) & 0xff) ^
-        ((op >>  8) & 0xff) ^
-        ((op >>  0) & 0xff);
-    if (opcache[tag].op != op || opcache[tag].entry == NULL) {
-        opcache[tag].op = op;
-        opcache[tag].entry = lookup_opcode_slow(op);
-    }
-
-    return opcache[tag].entry;
-}
-
 static uint16_t disasm_instruction(dsp_core_t* dsp, dsp_trace_disasm_t mode)
 {
     dsp->disasm_mode = mode;
@@ -594,6 +618,49 @@ static const char* disasm_get_instruction_text(dsp_core_t* dsp)
     return dsp->disasm_str_instr2;
 }
 
+static void emu_unimplemented(dsp_core_t* dsp)
+{
+    DPRINTF("%x - %s\n", dsp->cur_inst, lookup_opcode(dsp->cur_inst)->name);
+    emu_undefined(dsp);
+}
+
+static const dsp_predecoded_t *predecode(dsp_core_t* dsp, uint32_t pc)
+{
+    dsp_predecoded_t *d = &dsp->pram_opcache[pc];
+    if (d->emu_func) {
+        return d;
+    }
+
+    d->inst = read_memory_p(dsp, pc);
+    if (d->inst >= 0x100000) {
+        /* Do parallel move read */
+        d->emu_func = opcodes_parmove[(d->inst>>20) & BITMASK(4)];
+    } else {
+        const OpcodeEntry *op = lookup_opcode(d->inst);
+        d->emu_func = op->emu_func ? op->emu_func : emu_unimplemented;
+    }
+    return d;
+}
+
+static inline void execute_decoded(dsp_core_t* dsp, uint32_t inst, emu_func_t emu_func)
+{
+    dsp->cur_inst = inst;
+
+    /* Initialize instruction size and cycle counter */
+    dsp->cur_inst_len = 1;
+    dsp->instr_cycle = 2;
+
+    emu_func(dsp);
+
+    /* Process the PC */
+    dsp_postexecute_update_pc(dsp);
+
+    /* Process Interrupts */
+    dsp_postexecute_interrupts(dsp);
+
+    dsp->num_inst += dsp->instr_cycle;
+}
+
 void dsp56k_execute_instruction(dsp_core_t* dsp)
 {
     trace_dsp56k_execute_instruction(dsp->is_gp, dsp->pc);
@@ -602,7 +669,8 @@ void dsp56k_execute_instruction(dsp_core_t* dsp)
     dsp->disasm_memory_ptr = 0;
 
     /* Decode and execute current instruction */
-    dsp->cur_inst = read_memory_p(dsp, dsp->pc);
+    const dsp_predecoded_t *d = predecode(dsp, dsp->pc);
+    dsp->cur_inst = d->inst;
 
     /* Initialize instruction size and cycle counter */
     dsp->cur_inst_len = 1;
@@ -625,22 +693,7 @@ void dsp56k_execute_instruction(dsp_core_t* dsp)
         }
     }
 
-    if (dsp->cur_inst < 0x100000) {
-        const OpcodeEntry *op = dsp->pram_opcache[dsp->pc];
-        if (op == NULL) {
-            op = lookup_opcode(dsp->cur_inst);
-            dsp->pram_opcache[dsp->pc] = op;
-        }
-        if (op->emu_func) {
-            op->emu_func(dsp);
-        } else {
-            DPRINTF("%x - %s\n", dsp->cur_inst, op->name);
-            emu_undefined(dsp);
-        }
-    } else {
-        /* Do parallel move read */
-        opcodes_parmove[(dsp->cur_inst>>20) & BITMASK(4)](dsp);
-    }
+    d->emu_func(dsp);
 
     /* Disasm current instruction ? (trace mode only) */
     if (tracing && disasm_return) {
@@ -682,6 +735,115 @@ void dsp56k_execute_instruction(dsp_core_t* dsp)
 #endif
 }
 
+/**********************************
+ *  Translated blocks
+ **********************************/
+
+/*
+ * Blocks are recorded the first time execution reaches their start address:
+ * each executed instruction is appended together with its handler until
+ * control flow goes backwards (loops, REP, interrupts), a peripheral is
+ * written, or the block is full. Replaying a block only needs to check that
+ * the PC matches the next recorded instruction, so branches taken differently
+ * simply leave the block early. Any P write to an address that is part of a
+ * block flushes all blocks.
+ */
+
+static int record_block(dsp_core_t* dsp, int budget, int *cycles)
+{
+    uint32_t start = dsp->pc;
+    uint32_t gen = dsp->block_gen;
+    dsp_block_t *block = g_new(dsp_block_t, 1);
+    block->num_insns = 0;
+
+    while (*cycles < budget) {
+        uint32_t pc = dsp->pc;
+        const dsp_predecoded_t *d = predecode(dsp, pc);
+
+        dsp_block_insn_t *insn = &block->insns[block->num_insns++];
+        insn->emu_func = d->emu_func;
+        insn->inst = d->inst;
+        insn->pc = pc;
+
+        execute_decoded(dsp, insn->inst, insn->emu_func);
+        *cycles += dsp->instr_cycle;
+
+        if (dsp->pc <= pc || block->num_insns == DSP_BLOCK_MAX_INSNS ||
+            dsp->block_exit || dsp->is_idle) {
+            break;
+        }
+    }
+
+    int executed = block->num_insns;
+    if (dsp->block_gen == gen) {
+        for (int i = 0; i < block->num_insns; i++) {
+            dsp->pram_in_block[block->insns[i].pc] = 1;
+        }
+        dsp->pram_blocks[start] = block;
+        qatomic_set(&dsp->block_bytes, dsp->block_bytes + sizeof(*block));
+    } else {
+        /* Code was modified while recording */
+        g_free(block);
+    }
+
+    return executed;
+}
+
+int dsp56k_execute_block(dsp_core_t* dsp, int budget, int *cycles)
+{
+    if (TRACE_DSP_DISASM ||
+        trace_event_get_state(TRACE_DSP56K_EXECUTE_INSTRUCTION_DISASM)) {
+        dsp56k_execute_instruction(dsp);
+        *cycles += dsp->instr_cycle;
+        return 1;
+    }
+
+    dsp->block_exit = false;
+
+    const dsp_block_t *block = dsp->pram_blocks[dsp->pc];
+    if (block == NULL) {
+        return record_block(dsp, budget, cycles);
+    }
+
+    int executed = 0;
+    for (int i = 0; i < block->num_insns; i++) {
+        const dsp_block_insn_t *insn = &block->insns[i];
+        if (dsp->pc != insn->pc) {
+            break;
+        }
+
+        execute_decoded(dsp, insn->inst, insn->emu_func);
+        *cycles += dsp->instr_cycle;
+        executed++;
+
+        /* The block may have been freed by a P write */
+        if (dsp->block_exit || dsp->is_idle || *cycles >= budget) {
+            break;
+        }
+    }
+
+    return executed;
+}
+
+static void flush_blocks(dsp_core_t* dsp)
+{
+    for (int i = 0; i < DSP_PRAM_SIZE; i++) {
+        g_free(dsp->pram_blocks[i]);
+        dsp->pram_blocks[i] = NULL;
+    }
+    qatomic_set(&dsp->block_bytes, 0);
+    memset(dsp->pram_in_block, 0, sizeof(dsp->pram_in_block));
+    dsp->block_gen++;
+    dsp->block_exit = true;
+}
+
+void dsp56k_invalidate_opcache(dsp_core_t* dsp)
+{
+    memset(dsp->pram_opcache, 0, sizeof(dsp->pram_opcache));
+    flush_blocks(dsp);
+    dsp->pram_gen++;
+}
+
 /**********************************
  *  Update the PC
 **********************************/
@@ -967,6 +1129,37 @@ void dsp56k_write_memory(dsp_core_t* dsp, int space, uint32_t address, uint32_t
         write_memory_raw(dsp, space, address, value);
 }
 
+/*
+ * Returns a host pointer to count words of X or Y memory starting at address,
+ * or NULL if the range is not plain data RAM (peripherals, P memory, or a
+ * range straddling two backing arrays). Words stored through the pointer
+ * must already be masked to 24 bits.
+ */
+uint32_t *dsp56k_memory_ptr(dsp_core_t* dsp, int space, uint32_t address, uint32_t count)
+{
+    uint32_t end = address + count;
+
+    if (TRACE_DSP_DISASM_MEM) {
+        return NULL;
+    }
+
+    if (space == DSP_SPACE_X) {
+        if (address >= DSP_MIXBUFFER_BASE && end <= DSP_MIXBUFFER_BASE+DSP_MIXBUFFER_SIZE) {
+            return &dsp->mixbuffer[address-DSP_MIXBUFFER_BASE];
+        } else if (address >= 0xc00 && end <= 0xc00+DSP_MIXBUFFER_SIZE) {
+            return &dsp->mixbuffer[address-0xc00];
+        } else if (end <= 0xc00) {
+            return &dsp->xram[address];
+        }
+    } else if (space == DSP_SPACE_Y) {
+        if (end <= DSP_YRAM_SIZE) {
+            return &dsp->yram[address];
+        }
+    }
+
+    return NULL;
+}
+
 static void write_memory_raw(dsp_core_t* dsp, int space, uint32_t address, uint32_t value)
 {
     assert((value & 0xFF000000) == 0);
@@ -976,6 +1169,7 @@ static void write_memory_raw(dsp_core_t* dsp, int space, uint32_t address, uint3
         if (address >= DSP_PERIPH_BASE) {
             assert(dsp->write_peripheral);
             dsp->write_peripheral(dsp, address, value);
+            dsp->block_exit = true;
             return;
         } else if (address >= DSP_MIXBUFFER_BASE && address < DSP_MIXBUFFER_BASE+DSP_MIXBUFFER_SIZE) {
             dsp->mixbuffer[address-DSP_MIXBUFFER_BASE] = value;
@@ -991,7 +1185,11 @@ static void write_memory_raw(dsp_core_t* dsp, int space, uint32_t address, uint3
     } else if (space == DSP_SPACE_P) {
         assert(address < DSP_PRAM_SIZE);
         stl_le_p(&dsp->pram[address], value);
-        dsp->pram_opcache[address] = NULL;
+        dsp->pram_gen++;
+        dsp->pram_opcache[address].emu_func = NULL;
+        if (dsp->pram_in_block[address]) {
+            flush_blocks(dsp);
+        }
     } else {
         assert(false);
     }
@@ -1172,21 +1370,57 @@ static void dsp_compute_ssh_ssl(dsp_core_t* dsp)
 /* source,dest[1] is 47:24 */
 /* source,dest[2] is 23:00 */
 
+/*
+ * The arithmetic is done on the accumulator as a single native integer,
+ * held in the low 56 bits of a uint64_t. Carries and borrows out of the
+ * accumulator end up in bit 56.
+ */
+#define DSP_ACC_BITS 56
+#define DSP_ACC_MASK ((UINT64_C(1) << DSP_ACC_BITS) - 1)
+
+static inline uint64_t dsp_acc_get(const uint32_t *acc)
+{
+    return ((uint64_t)acc[0] << 48) | ((uint64_t)acc[1] << 24) | acc[2];
+}
+
+static inline void dsp_acc_set(uint32_t *acc, uint64_t v)
+{
+    acc[0] = (v >> 48) & BITMASK(8);
+    acc[1] = (v >> 24) & BITMASK(24);
+    acc[2] = v & BITMASK(24);
+}
+
+static inline uint16_t dsp_acc_add(uint64_t *d, uint64_t s)
+{
+    uint64_t r = *d + s;
+    uint16_t carry = (r >> DSP_ACC_BITS) & 1;
+    uint16_t overflow = (((s ^ r) & (*d ^ r)) >> (DSP_ACC_BITS - 1)) & 1;
+
+    *d = r & DSP_ACC_MASK;
+    return (overflow<<DSP_SR_L)|(overflow<<DSP_SR_V)|(carry<<DSP_SR_C);
+}
+
+static inline uint16_t dsp_acc_sub(uint64_t *d, uint64_t s)
+{
+    uint64_t r = *d - s;
+    uint16_t carry = (r >> DSP_ACC_BITS) & 1;
+    uint16_t overflow = (((s ^ *d) & (r ^ *d)) >> (DSP_ACC_BITS - 1)) & 1;
+
+    *d = r & DSP_ACC_MASK;
+    return (overflow<<DSP_SR_L)|(overflow<<DSP_SR_V)|(carry<<DSP_SR_C);
+}
+
 static uint16_t dsp_abs56(uint32_t *dest)
 {
-    uint32_t zerodest[3];
+    uint64_t d = dsp_acc_get(dest);
     uint16_t newsr;
 
     /* D=|D| */
 
-    if (dest[0] & (1<<7)) {
-        zerodest[0] = zerodest[1] = zerodest[2] = 0;
-
-        newsr = dsp_sub56(dest, zerodest);
-
-        dest[0] = zerodest[0];
-        dest[1] = zerodest[1];
-        dest[2] = zerodest[2];
+    if (d & (UINT64_C(1) << (DSP_ACC_BITS - 1))) {
+        uint64_t r = 0;
+        newsr = dsp_acc_sub(&r, d);
+        dsp_acc_set(dest, r);
     } else {
         newsr = 0;
     }
@@ -1198,14 +1432,12 @@ static uint16_t dsp_asl56(uint32_t *dest, int n)
 {
     /* Shift left dest n bits: D<<=n */
 
-    uint64_t dest_v = dest[2] | ((uint64_t)dest[1] << 24) | ((uint64_t)dest[0] << 48);
+    uint64_t dest_v = dsp_acc_get(dest);
 
     uint32_t carry = (dest_v >> (56-n)) & 1;
 
     uint64_t dest_s = dest_v << n;
-    dest[2] = dest_s & BITMASK(24);
-    dest[1] = (dest_s >> 24) & BITMASK(24);
-    dest[0] = (dest_s >> 48) & BITMASK(8);
+    dsp_acc_set(dest, dest_s);
 
     uint32_t overflow = (dest_v >> (56-n)) != 0;
     uint32_t v = ((dest_v >> 55) & 1) != ((dest_s >> 55) & 1);
@@ -1217,173 +1449,72 @@ static uint16_t dsp_asr56(uint32_t *dest, int n)
 {
     /* Shift right dest n bits: D>>=n */
 
-    uint64_t dest_v = dest[2] | ((uint64_t)dest[1] << 24) | ((uint64_t)dest[0] << 48);
+    uint64_t dest_v = dsp_acc_get(dest);
 
     uint16_t carry = (dest_v >> (n-1)) & 1;
 
-    dest_v >>= n;
-    dest[2] = dest_v & BITMASK(24);
-    dest[1] = (dest_v >> 24) & BITMASK(24);
-    dest[0] = (dest_v >> 48) & BITMASK(8);
+    dsp_acc_set(dest, dest_v >> n);
 
     return (carry<<DSP_SR_C);
 }
 
 static uint16_t dsp_add56(uint32_t *source, uint32_t *dest)
 {
-    uint16_t overflow, carry, flg_s, flg_d, flg_r;
-
-    flg_s = (source[0]>>7) & 1;
-    flg_d = (dest[0]>>7) & 1;
-
     /* Add source to dest: D = D+S */
-    dest[2] += source[2];
-    dest[1] += source[1]+((dest[2]>>24) & 1);
-    dest[0] += source[0]+((dest[1]>>24) & 1);
-
-    carry = (dest[0]>>8) & 1;
-
-    dest[2] &= BITMASK(24);
-    dest[1] &= BITMASK(24);
-    dest[0] &= BITMASK(8);
-
-    flg_r = (dest[0]>>7) & 1;
-
-    /*set overflow*/
-    overflow = (flg_s ^ flg_r) & (flg_d ^ flg_r);
-
-    return (overflow<<DSP_SR_L)|(overflow<<DSP_SR_V)|(carry<<DSP_SR_C);
+    uint64_t d = dsp_acc_get(dest);
+    uint16_t newsr = dsp_acc_add(&d, dsp_acc_get(source));
+    dsp_acc_set(dest, d);
+    return newsr;
 }
 
 static uint16_t dsp_sub56(uint32_t *source, uint32_t *dest)
 {
-    uint16_t overflow, carry, flg_s, flg_d, flg_r, dest_save;
-
-    dest_save = dest[0];
-
     /* Subtract source from dest: D = D-S */
-    dest[2] -= source[2];
-    dest[1] -= source[1]+((dest[2]>>24) & 1);
-    dest[0] -= source[0]+((dest[1]>>24) & 1);
-
-    carry = (dest[0]>>8) & 1;
-
-    dest[2] &= BITMASK(24);
-    dest[1] &= BITMASK(24);
-    dest[0] &= BITMASK(8);
-
-    flg_s = (source[0]>>7) & 1;
-    flg_d = (dest_save>>7) & 1;
-    flg_r = (dest[0]>>7) & 1;
-
-    /* set overflow */
-    overflow = (flg_s ^ flg_d) & (flg_r ^ flg_d);
-
-    return (overflow<<DSP_SR_L)|(overflow<<DSP_SR_V)|(carry<<DSP_SR_C);
+    uint64_t d = dsp_acc_get(dest);
+    uint16_t newsr = dsp_acc_sub(&d, dsp_acc_get(source));
+    dsp_acc_set(dest, d);
+    return newsr;
 }
 
 static void dsp_mul56(uint32_t source1, uint32_t source2, uint32_t *dest, uint8_t signe)
 {
-    uint32_t part[4], zerodest[3], value;
-
-    /* Multiply: D = S1*S2 */
-    if (source1 & (1<<23)) {
-        signe ^= 1;
-        source1 = (1<<24) - source1;
-    }
-    if (source2 & (1<<23)) {
-        signe ^= 1;
-        source2 = (1<<24) - source2;
-    }
-
-    /* bits 0-11 * bits 0-11 */
-    part[0]=(source1 & BITMASK(12))*(source2 & BITMASK(12));
-    /* bits 12-23 * bits 0-11 */
-    part[1]=((source1>>12) & BITMASK(12))*(source2 & BITMASK(12));
-    /* bits 0-11 * bits 12-23 */
-    part[2]=(source1 & BITMASK(12))*((source2>>12)  & BITMASK(12));
-    /* bits 12-23 * bits 12-23 */
-    part[3]=((source1>>12) & BITMASK(12))*((source2>>12) & BITMASK(12));
-
-    /* Calc dest 2 */
-    dest[2] = part[0];
-    dest[2] += (part[1] & BITMASK(12)) << 12;
-    dest[2] += (part[2] & BITMASK(12)) << 12;
-
-    /* Calc dest 1 */
-    dest[1] = (part[1]>>12) & BITMASK(12);
-    dest[1] += (part[2]>>12) & BITMASK(12);
-    dest[1] += part[3];
-
-    /* Calc dest 0 */
-    dest[0] = 0;
-
-    /* Add carries */
-    value = (dest[2]>>24) & BITMASK(8);
-    if (value) {
-        dest[1] += value;
-        dest[2] &= BITMASK(24);
-    }
-    value = (dest[1]>>24) & BITMASK(8);
-    if (value) {
-        dest[0] += value;
-        dest[1] &= BITMASK(24);
-    }
-
-    /* Get rid of extra sign bit */
-    dsp_asl56(dest, 1);
-
+    /*
+     * Multiply: D = S1*S2, with the product shifted left to get rid of the
+     * extra sign bit. It is at most 48 bits, so it fits a native multiply.
+     */
+    int64_t product = (int64_t)(int32_t)dsp_signextend(24, source1) *
+                      (int32_t)dsp_signextend(24, source2);
     if (signe) {
-        zerodest[0] = zerodest[1] = zerodest[2] = 0;
-
-        dsp_sub56(dest, zerodest);
-
-        dest[0] = zerodest[0];
-        dest[1] = zerodest[1];
-        dest[2] = zerodest[2];
+        product = -product;
     }
+
+    dsp_acc_set(dest, (uint64_t)product << 1);
 }
 
 static void dsp_rnd56(dsp_core_t* dsp, uint32_t *dest)
 {
-    uint32_t rnd_const[3];
+    uint64_t d = dsp_acc_get(dest);
+    int bit;
 
-    rnd_const[0] = 0;
-
-    /* Scaling mode S0 */
+    /* Round at bit 24, or at bit 25 or 23 in the scaling modes S0 and S1 */
     if (dsp->registers[DSP_REG_SR] & (1<<DSP_SR_S0)) {
-        rnd_const[1] = 1;
-        rnd_const[2] = 0;
-        dsp_add56(rnd_const, dest);
-
-        if ((dest[2]==0) && ((dest[1] & 1) == 0)) {
-            dest[1] &= (0xffffff - 0x3);
-        }
-        dest[1] &= 0xfffffe;
-        dest[2]=0;
-    }
-    /* Scaling mode S1 */
-    else if (dsp->registers[DSP_REG_SR] & (1<<DSP_SR_S1)) {
-        rnd_const[1] = 0;
-        rnd_const[2] = (1<<22);
-        dsp_add56(rnd_const, dest);
-
-        if ((dest[2] & 0x7fffff) == 0){
-            dest[2] = 0;
-        }
-        dest[2] &= 0x800000;
+        bit = 25;
+    } else if (dsp->registers[DSP_REG_SR] & (1<<DSP_SR_S1)) {
+        bit = 23;
+    } else {
+        bit = 24;
     }
-    /* No Scaling */
-    else {
-        rnd_const[1] = 0;
-        rnd_const[2] = (1<<23);
-        dsp_add56(rnd_const, dest);
-
-        if (dest[2] == 0) {
-            dest[1] &= 0xfffffe;
-        }
-        dest[2]=0;
+
+    uint64_t below = (UINT64_C(1) << bit) - 1;
+    dsp_acc_add(&d, UINT64_C(1) << (bit - 1));
+
+    /* Convergent rounding: round to even when exactly half way */
+    if ((d & below) == 0) {
+        d &= ~(UINT64_C(1) << bit);
     }
+    d &= ~below;
+
+    dsp_acc_set(dest, d);
 }
 
 static uint32_t dsp_signextend(int bits, uint32_t v) {
@@ -45,6 +45,26 @@ typedef struct dsp_interrupt_s {
 
 typedef struct dsp_core_s dsp_core_t;
 
+/* Predecoded P memory word */
+typedef struct dsp_predecoded_s {
+    void (*emu_func)(dsp_core_t* dsp);  /* NULL until decoded */
+    uint32_t inst;
+} dsp_predecoded_t;
+
+/* Translated block: a straight-line trace of predecoded instructions */
+#define DSP_BLOCK_MAX_INSNS 32
+
+typedef struct dsp_block_insn_s {
+    void (*emu_func)(dsp_core_t* dsp);
+    uint32_t inst;
+    uint32_t pc;
+} dsp_block_insn_t;
+
+typedef struct dsp_block_s {
+    uint32_t num_insns;
+    dsp_block_insn_t insns[DSP_BLOCK_MAX_INSNS];
+} dsp_block_t;
+
 struct dsp_core_s {
     bool is_gp;
     bool is_idle;
@@ -63,7 +83,15 @@ struct dsp_core_s {
     uint32_t xram[DSP_XRAM_SIZE];
     uint32_t yram[DSP_YRAM_SIZE];
     uint32_t pram[DSP_PRAM_SIZE];
-    const void *pram_opcache[DSP_PRAM_SIZE];
+    uint32_t pram_gen;      /* bumped whenever pram may have changed */
+    dsp_predecoded_t pram_opcache[DSP_PRAM_SIZE];
+
+    /* Translated blocks, indexed by start address */
+    dsp_block_t *pram_blocks[DSP_PRAM_SIZE];
+    uint8_t pram_in_block[DSP_PRAM_SIZE]; /* address is part of a block */
+    uint32_t block_gen;     /* bumped whenever blocks are flushed */
+    size_t block_bytes;     /* memory held by pram_blocks */
+    bool block_exit;        /* leave the current block after this instruction */
 
     uint32_t mixbuffer[DSP_MIXBUFFER_SIZE];
 
@@ -138,9 +166,12 @@ struct dsp_core_s {
 /* Functions */
 void dsp56k_reset_cpu(dsp_core_t* dsp);		/* Set dsp_core to use */
 void dsp56k_execute_instruction(dsp_core_t* dsp);	/* Execute 1 instruction */
+int dsp56k_execute_block(dsp_core_t* dsp, int budget, int *cycles); /* Execute 1 block */
+void dsp56k_invalidate_opcache(dsp_core_t* dsp);	/* Drop decoded pram */
 
 uint32_t dsp56k_read_memory(dsp_core_t* dsp, int space, uint32_t address);
 void dsp56k_write_memory(dsp_core_t* dsp, int space, uint32_t address, uint32_t value);
+uint32_t *dsp56k_memory_ptr(dsp_core_t* dsp, int space, uint32_t address, uint32_t count);
 
 /* Interrupt relative functions */
 void dsp56k_add_interrupt(dsp_core_t* dsp, uint16_t inter);
@@ -24,6 +24,14 @@
 #include "dsp_dma_regs.h"
 #include "dsp_state.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define DSP_DMA_ACCEL_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DSP_DMA_ACCEL_NEON
+#endif
+
 #ifdef DEBUG
 
 const char *buffer_names[] = {
@@ -64,6 +72,78 @@ const char *space_names[] = {
 
 #endif
 
+/*
+ * Conversions between DSP words and the packed buffer formats, one block at a
+ * time. The scalar loops also finish off the elements past the last full
+ * vector.
+ */
+
+/* 16 bit: keep the top 16 bits of each 24-bit word */
+static void dma_pack16(uint16_t *dst, const uint32_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+#if defined(DSP_DMA_ACCEL_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 4));
+        /* Sign extend bits 8..23 so the saturating pack is exact */
+        a = _mm_srai_epi32(_mm_slli_epi32(a, 8), 16);
+        b = _mm_srai_epi32(_mm_slli_epi32(b, 8), 16);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+#elif defined(DSP_DMA_ACCEL_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1_u16(dst + i, vshrn_n_u32(vld1q_u32(src + i), 8));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = src[i] >> 8;
+    }
+}
+
+static void dma_unpack16(uint32_t *dst, const uint16_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+#if defined(DSP_DMA_ACCEL_SSE2)
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_slli_epi32(_mm_unpacklo_epi16(v, zero), 8));
+        _mm_storeu_si128((__m128i *)(dst + i + 4),
+                         _mm_slli_epi32(_mm_unpackhi_epi16(v, zero), 8));
+    }
+#elif defined(DSP_DMA_ACCEL_NEON)
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, vshll_n_u16(vld1_u16(src + i), 8));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = (uint32_t)src[i] << 8;
+    }
+}
+
+/* 24 bit: drop whatever the guest left above the word */
+static void dma_unpack24(uint32_t *dst, const uint32_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+#if defined(DSP_DMA_ACCEL_SSE2)
+    __m128i mask = _mm_set1_epi32(0x00ffffff);
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_and_si128(v, mask));
+    }
+#elif defined(DSP_DMA_ACCEL_NEON)
+    uint32x4_t mask = vdupq_n_u32(0x00ffffff);
+    for (; i + 4 <= n; i += 4) {
+        vst1q_u32(dst + i, vandq_u32(vld1q_u32(src + i), mask));
+    }
+#endif
+    for (; i < n; i++) {
+        dst[i] = src[i] & 0x00ffffff;
+    }
+}
+
 static void scratch_circular_copy(
     DSPDMAState *s,
     uint32_t     scratch_base,
@@ -202,12 +282,16 @@ static void dsp_dma_run(DSPDMAState *s)
 
         size_t transfer_size = count * item_size;
 
+        /* Plain X/Y RAM is converted a whole block at a time */
+        uint32_t *mem_ptr = dsp56k_memory_ptr(s->core, mem_space, mem_address,
+            dsp_interleave ? block_count * channel_count : count);
+
         // FIXME: Remove this intermediate buffer
         static uint8_t *scratch_buf = NULL;
         static ssize_t scratch_buf_size = -1;
         if (count * item_size > scratch_buf_size) {
             scratch_buf_size = count * item_size;
-            scratch_buf = malloc(scratch_buf_size);
+            scratch_buf = realloc(scratch_buf, scratch_buf_size);
         }
 
         if (direction) {
@@ -219,8 +303,9 @@ static void dsp_dma_run(DSPDMAState *s)
                 // Interleave samples
                 for (int i = 0; i < block_count; i++) {
                     for (int ch = 0; ch < channel_count; ch++) {
-                        uint32_t v = dsp56k_read_memory(s->core,
-                            mem_space, mem_address+ch*block_count+i);
+                        uint32_t v = mem_ptr ? mem_ptr[ch*block_count+i] :
+                            dsp56k_read_memory(s->core,
+                                mem_space, mem_address+ch*block_count+i);
                         switch(item_size) {
                         case 2:
                             *(uint16_t*)(scratch_buf + i*2*channel_count + ch*2) = v >> 8;
@@ -234,6 +319,12 @@ static void dsp_dma_run(DSPDMAState *s)
                         }
                     }
                 }
+            } else if (mem_ptr) {
+                if (item_size == 2) {
+                    dma_pack16((uint16_t *)scratch_buf, mem_ptr, count);
+                } else {
+                    memcpy(scratch_buf, mem_ptr, transfer_size);
+                }
             } else {
                 for (int i = 0; i < count; i++) {
                     uint32_t v = dsp56k_read_memory(s->core, mem_space, mem_address+i);
@@ -283,22 +374,30 @@ static void dsp_dma_run(DSPDMAState *s)
                 assert(false);
             }
 
-            for (int i = 0; i < count; i++) {
-                uint32_t v;
-                switch(item_size) {
-                case 2:
-                    v = *(uint16_t*)(scratch_buf + i*2) << 8;
-                    break;
-                case 4:
-                    v = (*(uint32_t*)(scratch_buf + i*4)) & item_mask;
-                    break;
-                default:
-                    v = 0;
-                    assert(false);
-                    break;
+            if (mem_ptr) {
+                if (item_size == 2) {
+                    dma_unpack16(mem_ptr, (uint16_t *)scratch_buf, count);
+                } else {
+                    dma_unpack24(mem_ptr, (uint32_t *)scratch_buf, count);
                 }
+            } else {
+                for (int i = 0; i < count; i++) {
+                    uint32_t v;
+                    switch(item_size) {
+                    case 2:
+                        v = *(uint16_t*)(scratch_buf + i*2) << 8;
+                        break;
+                    case 4:
+                        v = (*(uint32_t*)(scratch_buf + i*4)) & item_mask;
+                        break;
+                    default:
+                        v = 0;
+                        assert(false);
+                        break;
+                    }
 
-                dsp56k_write_memory(s->core, mem_space, mem_address+i, v);
+                    dsp56k_write_memory(s->core, mem_space, mem_address+i, v);
+                }
             }
         }
 
@@ -0,0 +1,66 @@
+/*
+ * MCPX DSP program HLE
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "dsp_state.h"
+#include "dsp_hle.h"
+#include "trace.h"
+
+/*
+ * Programs run natively instead of being interpreted, by hash of the whole of
+ * P memory once it is loaded. Titles load the stock XDK effect images with
+ * the bootstrap and DMA, so a given image hashes the same across titles that
+ * use it. The audio debugger shows the hash of the running program.
+ *
+ * A replacement must read and write the same X/Y memory the program does, as
+ * the host driver and the EP see it. Until a program is added here it is
+ * interpreted.
+ */
+static const DSPHLEProgram dsp_hle_programs[] = {
+    { NULL },
+};
+
+/* Identify the loaded program if P memory changed since the last frame */
+void dsp_hle_identify(DSPState *dsp)
+{
+    if (dsp->pram_gen == dsp->core.pram_gen) {
+        return;
+    }
+    dsp->pram_gen = dsp->core.pram_gen;
+    dsp->pram_hash = fast_hash((void *)dsp->core.pram,
+                               sizeof(dsp->core.pram));
+    dsp->hle_program = NULL;
+
+    for (const DSPHLEProgram *p = dsp_hle_programs; p->name; p++) {
+        if (p->pram_hash == dsp->pram_hash) {
+            dsp->hle_program = p;
+            break;
+        }
+    }
+
+    trace_dsp_hle_identify(dsp->pram_hash,
+                           dsp->hle_program ? dsp->hle_program->name : "");
+}
+
+bool dsp_hle_run_frame(DSPState *dsp)
+{
+    return dsp->hle_program && dsp->hle_program->run_frame(dsp);
+}
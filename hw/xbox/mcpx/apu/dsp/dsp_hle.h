@@ -0,0 +1,44 @@
+/*
+ * MCPX DSP program HLE
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef DSP_HLE_H
+#define DSP_HLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct DSPState DSPState;
+
+/*
+ * Native implementation of a known DSP program. run_frame does the work of
+ * one frame of the program on DSP memory, including the DMA it would start,
+ * and returns false to have the frame interpreted instead, e.g. for a
+ * configuration it does not handle.
+ */
+typedef struct DSPHLEProgram {
+    const char *name;
+    uint64_t pram_hash;
+    bool (*run_frame)(DSPState *dsp);
+} DSPHLEProgram;
+
+void dsp_hle_identify(DSPState *dsp);
+bool dsp_hle_run_frame(DSPState *dsp);
+
+#endif /* DSP_HLE_H */
@@ -27,6 +27,7 @@
 
 #include "dsp_cpu.h"
 #include "dsp_dma.h"
+#include "dsp_hle.h"
 
 struct DSPState {
     dsp_core_t core;
@@ -36,6 +37,11 @@ struct DSPState {
     uint32_t interrupts;
 
     bool is_gp;
+
+    /* Program in P memory as of core.pram_gen, see dsp_hle.c */
+    uint32_t pram_gen;
+    uint64_t pram_hash;
+    const DSPHLEProgram *hle_program;
 };
 
 #endif /* DSP_STATE_H */
@@ -20,6 +20,7 @@
  */
 
 #include "hw/xbox/mcpx/apu/apu_int.h"
+#include "hw/xbox/mcpx/apu/vp/mix.h"
 
 static const int16_t ep_silence[256][2] = { 0 };
 
@@ -44,29 +45,45 @@ void mcpx_apu_update_dsp_preference(MCPXAPUState *d)
     last_known_preference = g_config.audio.use_dsp;
 }
 
+static uint32_t sge_read_address(MCPXAPUState *d, hwaddr sge_base,
+                                 unsigned int page_entry)
+{
+    hwaddr entry = sge_base + page_entry * 8;
+
+    /* SGE tables live in guest RAM; skip the dispatch when they do */
+    if (entry + 4 <= d->ram_size) {
+        return ldl_le_p(&d->ram_ptr[entry]);
+    }
+    return ldl_le_phys(&address_space_memory, entry);
+}
+
 static void scatter_gather_rw(MCPXAPUState *d, hwaddr sge_base,
                               unsigned int max_sge, uint8_t *ptr, uint32_t addr,
                               size_t len, bool dir)
 {
     unsigned int page_entry = addr / TARGET_PAGE_SIZE;
     unsigned int offset_in_page = addr % TARGET_PAGE_SIZE;
-    unsigned int bytes_to_copy = TARGET_PAGE_SIZE - offset_in_page;
 
     while (len > 0) {
         assert(page_entry <= max_sge);
 
-        uint32_t prd_address = ldl_le_phys(&address_space_memory,
-                                           sge_base + page_entry * 8 + 0);
-        // uint32_t prd_control = ldl_le_phys(&address_space_memory,
-        //                                     sge_base + page_entry * 8 + 4);
-
-        hwaddr paddr = prd_address + offset_in_page;
-
-        if (bytes_to_copy > len) {
-            bytes_to_copy = len;
+        hwaddr paddr = sge_read_address(d, sge_base, page_entry) +
+                       offset_in_page;
+        size_t bytes_to_copy = MIN(TARGET_PAGE_SIZE - offset_in_page, len);
+
+        /*
+         * Fold following entries that continue the same physical run into
+         * this copy, so a buffer that is contiguous in guest memory moves
+         * with a single memcpy whatever its page count.
+         */
+        while (bytes_to_copy < len && page_entry + 1 <= max_sge &&
+               sge_read_address(d, sge_base, page_entry + 1) ==
+                   paddr + bytes_to_copy) {
+            page_entry += 1;
+            bytes_to_copy += MIN(TARGET_PAGE_SIZE, len - bytes_to_copy);
         }
 
-        assert(paddr + bytes_to_copy < memory_region_size(d->ram));
+        assert(paddr + bytes_to_copy < d->ram_size);
 
         if (dir) {
             memcpy(&d->ram_ptr[paddr], ptr, bytes_to_copy);
@@ -80,7 +97,6 @@ static void scatter_gather_rw(MCPXAPUState *d, hwaddr sge_base,
 
         /* After the first iteration, we are page aligned */
         page_entry += 1;
-        bytes_to_copy = TARGET_PAGE_SIZE;
         offset_in_page = 0;
     }
 }
@@ -399,6 +415,9 @@ static void ep_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
 
     DPRINTF("mcpx apu EP: [0x%" HWADDR_PRIx "] = 0x%lx\n", addr, val);
 
+    /* Don't modify the EP under a frame running on the EP thread */
+    mcpx_apu_ep_wait(d);
+
     switch (addr) {
     case NV_PAPU_EPXMEM ... NV_PAPU_EPXMEM + 0xC00 * 4 - 1: {
         uint32_t xaddr = (addr - NV_PAPU_EPXMEM) / 4;
@@ -436,16 +455,35 @@ const MemoryRegionOps ep_ops = {
     .write = ep_write,
 };
 
+static void ep_run_frame(MCPXAPUState *d)
+{
+    dsp_start_frame(d->ep.dsp);
+    d->ep.dsp->core.is_idle = false;
+    d->ep.dsp->core.cycle_count = 0;
+    xemu_trace_begin("dsp run", "ep");
+    do {
+        dsp_run(d->ep.dsp, 1000);
+    } while (!d->ep.dsp->core.is_idle && d->ep.realtime);
+    xemu_trace_end();
+    g_dbg.ep.cycles = d->ep.dsp->core.cycle_count;
+}
+
 void mcpx_apu_dsp_frame(MCPXAPUState *d, float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME])
 {
-    /* Write VP results to the GP DSP MIXBUF */
-    for (int mixbin = 0; mixbin < NUM_MIXBINS; mixbin++) {
-        uint32_t base = GP_DSP_MIXBUF_BASE + mixbin * NUM_SAMPLES_PER_FRAME;
-        for (int sample = 0; sample < NUM_SAMPLES_PER_FRAME; sample++) {
-            dsp_write_memory(d->gp.dsp, 'X', base + sample,
-                             float_to_24b(mixbins[mixbin][sample]));
-        }
-    }
+    /*
+     * Write VP results to the GP DSP MIXBUF. The mixbins are laid out exactly
+     * as the MIXBUF expects, so convert the whole frame in one pass straight
+     * into the backing store rather than going through dsp_write_memory.
+     */
+    QEMU_BUILD_BUG_ON(NUM_MIXBINS * NUM_SAMPLES_PER_FRAME >
+                      ARRAY_SIZE(d->gp.dsp->core.mixbuffer));
+    vp_mix_to_int24(d->gp.dsp->core.mixbuffer, &mixbins[0][0],
+                    NUM_MIXBINS * NUM_SAMPLES_PER_FRAME);
+
+    xemu_mem_account_set(d->dsp_mem_account,
+                         2 * sizeof(DSPState) +
+                             qatomic_read(&d->gp.dsp->core.block_bytes) +
+                             qatomic_read(&d->ep.dsp->core.block_bytes));
 
     bool ep_enabled = (d->ep.regs[NV_PAPU_EPRST] & NV_PAPU_GPRST_GPRST) &&
                       (d->ep.regs[NV_PAPU_EPRST] & NV_PAPU_GPRST_GPDSPRST);
@@ -456,20 +494,27 @@ void mcpx_apu_dsp_frame(MCPXAPUState *d, float mixbins[NUM_MIXBINS][NUM_SAMPLES_
         dsp_start_frame(d->gp.dsp);
         d->gp.dsp->core.is_idle = false;
         d->gp.dsp->core.cycle_count = 0;
-        do {
-            dsp_run(d->gp.dsp, 1000);
-        } while (!d->gp.dsp->core.is_idle && d->gp.realtime);
+        dsp_hle_identify(d->gp.dsp);
+        bool hle = d->gp.hle && dsp_hle_run_frame(d->gp.dsp);
+        if (!hle) {
+            xemu_trace_begin("dsp run", "gp");
+            do {
+                dsp_run(d->gp.dsp, 1000);
+            } while (!d->gp.dsp->core.is_idle && d->gp.realtime);
+            xemu_trace_end();
+        }
         g_dbg.gp.cycles = d->gp.dsp->core.cycle_count;
+        g_dbg.gp.program_hash = d->gp.dsp->pram_hash;
+        g_dbg.gp.hle_program = hle ? d->gp.dsp->hle_program->name : NULL;
 
         if ((d->monitor.point == MCPX_APU_DEBUG_MON_GP) ||
             (d->monitor.point == MCPX_APU_DEBUG_MON_GP_OR_EP && !ep_enabled)) {
             int off = (d->ep_frame_div % 8) * NUM_SAMPLES_PER_FRAME;
+            const uint32_t *l = d->gp.dsp->core.mixbuffer;
+            const uint32_t *r = l + NUM_SAMPLES_PER_FRAME;
             for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-                uint32_t l = dsp_read_memory(d->gp.dsp, 'X', 0x1400 + i);
-                d->monitor.frame_buf[off + i][0] = l >> 8;
-                uint32_t r =
-                    dsp_read_memory(d->gp.dsp, 'X', 0x1400 + 1 * 0x20 + i);
-                d->monitor.frame_buf[off + i][1] = r >> 8;
+                d->monitor.frame_buf[off + i][0] = l[i] >> 8;
+                d->monitor.frame_buf[off + i][1] = r[i] >> 8;
             }
         }
     }
@@ -478,26 +523,71 @@ void mcpx_apu_dsp_frame(MCPXAPUState *d, float mixbins[NUM_MIXBINS][NUM_SAMPLES_
     if ((d->ep.regs[NV_PAPU_EPRST] & NV_PAPU_GPRST_GPRST) &&
         (d->ep.regs[NV_PAPU_EPRST] & NV_PAPU_GPRST_GPDSPRST)) {
         if (d->ep_frame_div % 8 == 0) {
-            dsp_start_frame(d->ep.dsp);
-            d->ep.dsp->core.is_idle = false;
-            d->ep.dsp->core.cycle_count = 0;
-            do {
-                dsp_run(d->ep.dsp, 1000);
-            } while (!d->ep.dsp->core.is_idle && d->ep.realtime);
-            g_dbg.ep.cycles = d->ep.dsp->core.cycle_count;
+            /*
+             * EP output is not consumed until the last GP frame of this EP
+             * frame, so the EP can run alongside the next 7 GP frames.
+             */
+            mcpx_apu_ep_wait(d);
+            if (g_config.audio.ep_thread) {
+                qemu_mutex_lock(&d->ep.lock);
+                d->ep.frame_pending = true;
+                qemu_cond_broadcast(&d->ep.cond);
+                qemu_mutex_unlock(&d->ep.lock);
+            } else {
+                ep_run_frame(d);
+            }
         }
     }
 }
 
+void mcpx_apu_ep_wait(MCPXAPUState *d)
+{
+    qemu_mutex_lock(&d->ep.lock);
+    while (d->ep.frame_pending) {
+        qemu_cond_wait(&d->ep.cond, &d->ep.lock);
+    }
+    qemu_mutex_unlock(&d->ep.lock);
+}
+
+static void *ep_thread(void *arg)
+{
+    MCPXAPUState *d = arg;
+
+    xemu_trace_set_thread_name("mcpx.ep_thread");
+    xemu_thread_topology_register(XEMU_THREAD_REALTIME, "mcpx.ep_thread");
+    rcu_register_thread();
+
+    qemu_mutex_lock(&d->ep.lock);
+    while (true) {
+        while (!d->ep.frame_pending && !d->ep.should_exit) {
+            qemu_cond_wait(&d->ep.cond, &d->ep.lock);
+        }
+        if (d->ep.should_exit) {
+            break;
+        }
+
+        qemu_mutex_unlock(&d->ep.lock);
+        ep_run_frame(d);
+        qemu_mutex_lock(&d->ep.lock);
+
+        d->ep.frame_pending = false;
+        qemu_cond_broadcast(&d->ep.cond);
+    }
+    qemu_mutex_unlock(&d->ep.lock);
+
+    rcu_unregister_thread();
+    return NULL;
+}
+
 void mcpx_apu_dsp_init(MCPXAPUState *d)
 {
     d->gp.dsp = dsp_init(d, gp_scratch_rw, gp_fifo_rw);
     for (int i = 0; i < DSP_PRAM_SIZE; i++) {
         d->gp.dsp->core.pram[i] = 0xCACACACA;
     }
-    memset(d->gp.dsp->core.pram_opcache, 0,
-           sizeof(d->gp.dsp->core.pram_opcache));
+    dsp56k_invalidate_opcache(&d->gp.dsp->core);
     d->gp.dsp->is_gp = true;
+    d->gp.hle = true;
     d->gp.dsp->core.is_gp = true;
     d->gp.dsp->core.is_idle = false;
     d->gp.dsp->core.cycle_count = 0;
@@ -506,8 +596,7 @@ void mcpx_apu_dsp_init(MCPXAPUState *d)
     for (int i = 0; i < DSP_PRAM_SIZE; i++) {
         d->ep.dsp->core.pram[i] = 0xCACACACA;
     }
-    memset(d->ep.dsp->core.pram_opcache, 0,
-           sizeof(d->ep.dsp->core.pram_opcache));
+    dsp56k_invalidate_opcache(&d->ep.dsp->core);
     for (int i = 0; i < DSP_XRAM_SIZE; i++) {
         d->ep.dsp->core.xram[i] = 0xCACACACA;
     }
@@ -519,8 +608,27 @@ void mcpx_apu_dsp_init(MCPXAPUState *d)
     d->ep.dsp->core.is_idle = false;
     d->ep.dsp->core.cycle_count = 0;
 
+    d->dsp_mem_account = xemu_mem_account("apu", "dsp working set");
+    xemu_mem_account_set(d->dsp_mem_account, 2 * sizeof(DSPState));
+
+    qemu_mutex_init(&d->ep.lock);
+    qemu_cond_init(&d->ep.cond);
+    d->ep.frame_pending = false;
+    d->ep.should_exit = false;
+    qemu_thread_create(&d->ep.thread, "mcpx.ep_thread", ep_thread, d,
+                       QEMU_THREAD_JOINABLE);
+
     /* Until DSP is more performant, a switch to decide whether or not we should
      * use the full audio pipeline or not.
      */
     mcpx_apu_update_dsp_preference(d);
 }
+
+void mcpx_apu_dsp_finalize(MCPXAPUState *d)
+{
+    qemu_mutex_lock(&d->ep.lock);
+    d->ep.should_exit = true;
+    qemu_cond_broadcast(&d->ep.cond);
+    qemu_mutex_unlock(&d->ep.lock);
+    qemu_thread_join(&d->ep.thread);
+}
@@ -35,6 +35,7 @@ typedef struct MCPXAPUState MCPXAPUState;
 
 typedef struct MCPXAPUGPState {
     bool realtime;
+    bool hle; /* Run known programs natively, see dsp_hle.c */
     MemoryRegion mmio;
     DSPState *dsp;
     uint32_t regs[0x10000];
@@ -45,12 +46,21 @@ typedef struct MCPXAPUEPState {
     MemoryRegion mmio;
     DSPState *dsp;
     uint32_t regs[0x10000];
+
+    /* Worker that runs EP frames alongside the GP */
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    bool frame_pending;
+    bool should_exit;
 } MCPXAPUEPState;
 
 extern const MemoryRegionOps gp_ops;
 extern const MemoryRegionOps ep_ops;
 
 void mcpx_apu_dsp_init(MCPXAPUState *d);
+void mcpx_apu_dsp_finalize(MCPXAPUState *d);
+void mcpx_apu_ep_wait(MCPXAPUState *d);
 void mcpx_apu_update_dsp_preference(MCPXAPUState *d);
 void mcpx_apu_dsp_frame(MCPXAPUState *d, float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME]);
 
@@ -0,0 +1,88 @@
+/*
+ * MCPX APU monitor output ring
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef HW_XBOX_MCPX_APU_MONITOR_RING_H
+#define HW_XBOX_MCPX_APU_MONITOR_RING_H
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+
+/*
+ * Single-producer, single-consumer byte ring between the APU thread and the
+ * audio device callback. Head and tail count bytes ever written and read and
+ * each is only stored by its own side, so neither side ever waits on the
+ * other.
+ */
+typedef struct MonitorRing {
+    uint8_t *data;
+    uint32_t size; /* Power of two */
+    uint32_t head QEMU_ALIGNED(64);
+    uint32_t tail QEMU_ALIGNED(64);
+} MonitorRing;
+
+static inline void monitor_ring_init(MonitorRing *r, uint32_t min_size)
+{
+    r->size = pow2ceil(min_size);
+    r->data = g_malloc0(r->size);
+    r->head = 0;
+    r->tail = 0;
+}
+
+static inline uint32_t monitor_ring_num_used(MonitorRing *r)
+{
+    return qatomic_load_acquire(&r->head) - qatomic_load_acquire(&r->tail);
+}
+
+static inline uint32_t monitor_ring_num_free(MonitorRing *r)
+{
+    return r->size - monitor_ring_num_used(r);
+}
+
+/* Producer side only */
+static inline void monitor_ring_push(MonitorRing *r, const void *buf,
+                                     uint32_t len)
+{
+    uint32_t head = r->head;
+    uint32_t tail = qatomic_load_acquire(&r->tail);
+    assert(r->size - (head - tail) >= len);
+
+    uint32_t off = head & (r->size - 1);
+    uint32_t first = MIN(len, r->size - off);
+    memcpy(r->data + off, buf, first);
+    memcpy(r->data, (const uint8_t *)buf + first, len - first);
+
+    qatomic_store_release(&r->head, head + len);
+}
+
+/* Consumer side only, returns the number of bytes popped */
+static inline uint32_t monitor_ring_pop(MonitorRing *r, void *buf,
+                                        uint32_t len)
+{
+    uint32_t tail = r->tail;
+    uint32_t head = qatomic_load_acquire(&r->head);
+    len = MIN(len, head - tail);
+
+    uint32_t off = tail & (r->size - 1);
+    uint32_t first = MIN(len, r->size - off);
+    memcpy(buf, r->data + off, first);
+    memcpy((uint8_t *)buf + first, r->data, len - first);
+
+    qatomic_store_release(&r->tail, tail + len);
+    return len;
+}
+
+#endif
@@ -0,0 +1,100 @@
+/*
+ * MCPX Voice Processor decoded ADPCM block cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "adpcm.h"
+#include "adpcm_cache.h"
+
+/*
+ * Entries are matched on the full block contents as well as the address, so
+ * a guest rewriting a buffer can never hit a stale decode; the old entry
+ * simply ages out.
+ */
+
+static void adpcm_cache_entry_init(Lru *lru, LruNode *node, const void *key)
+{
+    AdpcmCacheNode *anode = container_of(node, AdpcmCacheNode, node);
+    memcpy(&anode->key, key, sizeof(anode->key));
+    adpcm_decode_block(anode->decoded, anode->key.block, anode->key.block_size,
+                       anode->key.channels);
+}
+
+static bool adpcm_cache_entry_compare(Lru *lru, LruNode *node, const void *key)
+{
+    AdpcmCacheNode *anode = container_of(node, AdpcmCacheNode, node);
+    return memcmp(&anode->key, key, sizeof(anode->key));
+}
+
+void adpcm_cache_init(AdpcmCache *cache)
+{
+    for (int i = 0; i < ADPCM_CACHE_NUM_SHARDS; i++) {
+        AdpcmCacheShard *shard = &cache->shards[i];
+        qemu_spin_init(&shard->lock);
+        lru_init(&shard->lru);
+        shard->nodes = g_malloc_n(ADPCM_CACHE_SHARD_SIZE,
+                                  sizeof(AdpcmCacheNode));
+        for (int j = 0; j < ADPCM_CACHE_SHARD_SIZE; j++) {
+            lru_add_free(&shard->lru, &shard->nodes[j].node);
+        }
+        shard->lru.init_node = adpcm_cache_entry_init;
+        shard->lru.compare_nodes = adpcm_cache_entry_compare;
+    }
+}
+
+void adpcm_cache_finalize(AdpcmCache *cache)
+{
+    for (int i = 0; i < ADPCM_CACHE_NUM_SHARDS; i++) {
+        AdpcmCacheShard *shard = &cache->shards[i];
+        lru_flush(&shard->lru);
+        lru_destroy(&shard->lru);
+        g_free(shard->nodes);
+        shard->nodes = NULL;
+    }
+}
+
+void adpcm_cache_flush(AdpcmCache *cache)
+{
+    for (int i = 0; i < ADPCM_CACHE_NUM_SHARDS; i++) {
+        AdpcmCacheShard *shard = &cache->shards[i];
+        qemu_spin_lock(&shard->lock);
+        lru_flush(&shard->lru);
+        qemu_spin_unlock(&shard->lock);
+    }
+}
+
+void adpcm_cache_decode(AdpcmCache *cache, hwaddr addr, const uint8_t *block,
+                        size_t block_size, int channels, int16_t *out)
+{
+    assert(block_size <= ADPCM_CACHE_MAX_BLOCK_SIZE);
+
+    AdpcmCacheKey key;
+    memset(&key, 0, sizeof(key));
+    key.addr = addr;
+    key.block_size = block_size;
+    key.channels = channels;
+    memcpy(key.block, block, block_size);
+
+    uint64_t hash = fast_hash((const uint8_t *)&key, sizeof(key));
+    AdpcmCacheShard *shard = &cache->shards[hash >> 60];
+
+    qemu_spin_lock(&shard->lock);
+    LruNode *node = lru_lookup(&shard->lru, hash, &key);
+    AdpcmCacheNode *anode = container_of(node, AdpcmCacheNode, node);
+    memcpy(out, anode->decoded, sizeof(anode->decoded));
+    qemu_spin_unlock(&shard->lock);
+}
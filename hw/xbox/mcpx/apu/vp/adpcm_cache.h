@@ -0,0 +1,69 @@
+/*
+ * MCPX Voice Processor decoded ADPCM block cache
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_MCPX_APU_VP_ADPCM_CACHE_H
+#define HW_XBOX_MCPX_APU_VP_ADPCM_CACHE_H
+
+#include "qemu/osdep.h"
+#include "qemu/lru.h"
+#include "qemu/thread.h"
+#include "exec/hwaddr.h"
+
+#define ADPCM_CACHE_MAX_BLOCK_SIZE  (36 * 2)
+#define ADPCM_CACHE_MAX_SAMPLES     (65 * 2)
+#define ADPCM_CACHE_NUM_SHARDS      16 /* Top 4 bits of the key hash */
+#define ADPCM_CACHE_SHARD_SIZE      256
+
+typedef struct AdpcmCacheKey {
+    hwaddr addr;
+    uint32_t block_size;
+    uint32_t channels;
+    uint8_t block[ADPCM_CACHE_MAX_BLOCK_SIZE];
+} AdpcmCacheKey;
+
+typedef struct AdpcmCacheNode {
+    LruNode node;
+    AdpcmCacheKey key;
+    int16_t decoded[ADPCM_CACHE_MAX_SAMPLES];
+} AdpcmCacheNode;
+
+/*
+ * Voice workers decode concurrently, so the cache is split into
+ * independently locked shards selected by the key hash.
+ */
+typedef struct AdpcmCacheShard {
+    QemuSpin lock;
+    Lru lru;
+    AdpcmCacheNode *nodes;
+} AdpcmCacheShard;
+
+typedef struct AdpcmCache {
+    AdpcmCacheShard shards[ADPCM_CACHE_NUM_SHARDS];
+} AdpcmCache;
+
+void adpcm_cache_init(AdpcmCache *cache);
+void adpcm_cache_finalize(AdpcmCache *cache);
+void adpcm_cache_flush(AdpcmCache *cache);
+
+/*
+ * Decode the ADPCM block read from guest address addr into out, reusing an
+ * earlier decode of the same bytes from the same address if there is one.
+ */
+void adpcm_cache_decode(AdpcmCache *cache, hwaddr addr, const uint8_t *block,
+                        size_t block_size, int channels, int16_t *out);
+
+#endif
@@ -25,6 +25,7 @@
 #include <math.h>
 
 #include "hw/xbox/mcpx/apu/apu_regs.h"
+#include "hw/xbox/mcpx/apu/vp/mix.h"
 
 #define HRTF_SAMPLES_PER_FRAME  NUM_SAMPLES_PER_FRAME
 #define HRTF_NUM_TAPS           31
@@ -35,7 +36,9 @@
 typedef struct {
     int buf_pos;
     struct {
-        float buf[HRTF_BUFLEN];
+        /* History is mirrored at +HRTF_BUFLEN so every tap window is linear */
+        float buf[2 * HRTF_BUFLEN];
+        /* Coefficients are stored in reverse tap order */
         float hrir_coeff_cur[HRTF_NUM_TAPS];
         float hrir_coeff_tar[HRTF_NUM_TAPS];
     } ch[2];
@@ -64,7 +67,9 @@ hrtf_filter_set_target_params(HrtfFilter *f, float hrir_coeff[2][HRTF_NUM_TAPS],
 
     for (int ch = 0; ch < 2; ch++) {
         float *coeff = f->ch[ch].hrir_coeff_tar;
-        memcpy(coeff, hrir_coeff[ch], sizeof(f->ch[ch].hrir_coeff_tar));
+        for (int k = 0; k < HRTF_NUM_TAPS; k++) {
+            coeff[k] = hrir_coeff[ch][HRTF_NUM_TAPS - 1 - k];
+        }
 
         // Normalize coefficients for unity filter gain
         float s = 0.0f;
@@ -89,11 +94,8 @@ static inline float hrtf_filter_smooth_param(float cur, float tar)
 static inline void hrtf_filter_step_parameters(HrtfFilter *f)
 {
     for (int ch = 0; ch < 2; ch++) {
-        float *coeff_cur = f->ch[ch].hrir_coeff_cur;
-        float *coeff_tar = f->ch[ch].hrir_coeff_tar;
-        for (int k = 0; k < HRTF_NUM_TAPS; k++) {
-            coeff_cur[k] = hrtf_filter_smooth_param(coeff_cur[k], coeff_tar[k]);
-        }
+        vp_mix_smooth(f->ch[ch].hrir_coeff_cur, f->ch[ch].hrir_coeff_tar,
+                      HRTF_PARAM_SMOOTH_ALPHA, HRTF_NUM_TAPS);
     }
     f->itd_cur = hrtf_filter_smooth_param(f->itd_cur, f->itd_tar);
 }
@@ -111,6 +113,7 @@ static inline void hrtf_filter_process(HrtfFilter *f,
 
             // Push new sample
             buf[f->buf_pos] = in[n][ch];
+            buf[f->buf_pos + HRTF_BUFLEN] = in[n][ch];
 
             // Interaural time difference (channel delay)
             float d = f->itd_cur * (ch == 0 ? +1.0f : -1.0f);
@@ -120,18 +123,15 @@ static inline void hrtf_filter_process(HrtfFilter *f,
             int di = d;
             float dfrac = d - di;
 
-            // HRIR Convolution
-            float acc = 0.0f;
-            for (int k = 0; k < HRTF_NUM_TAPS; k++) {
-                int idx1 = (f->buf_pos - di - k + HRTF_BUFLEN) % HRTF_BUFLEN;
-                float s = buf[idx1];
-
-                // Linear interpolation for fractional part
-                if (dfrac > 0.0f) {
-                    int idx2 = (idx1 - 1 + HRTF_BUFLEN) % HRTF_BUFLEN;
-                    s = s * (1 - dfrac) + buf[idx2] * dfrac;
-                }
-                acc += coeff[k] * s;
+            // HRIR Convolution, oldest tap first
+            const float *win =
+                &buf[f->buf_pos + HRTF_BUFLEN - di - (HRTF_NUM_TAPS - 1)];
+            float acc = vp_mix_dot(coeff, win, HRTF_NUM_TAPS);
+
+            // Linear interpolation for fractional part
+            if (dfrac > 0.0f) {
+                float prev = vp_mix_dot(coeff, win - 1, HRTF_NUM_TAPS);
+                acc = acc * (1 - dfrac) + prev * dfrac;
             }
 
             out[n][ch] = acc;
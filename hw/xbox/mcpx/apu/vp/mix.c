@@ -0,0 +1,343 @@
+/*
+ * MCPX Voice Processor mixing kernels
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VP_MIX_ACCEL_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VP_MIX_ACCEL_NEON
+#endif
+
+#ifdef VP_MIX_DISABLE_ACCEL
+#undef VP_MIX_ACCEL_X86
+#undef VP_MIX_ACCEL_NEON
+#endif
+
+/*
+ * Portable implementations. These are also the tails of the vector
+ * versions, so every path agrees on the elements past the last full vector.
+ */
+
+static void mix_accumulate_scalar(float *dst, const float *src, float gain,
+                                  int n)
+{
+    for (int i = 0; i < n; i++) {
+        dst[i] += gain * src[i];
+    }
+}
+
+static float mix_dot_scalar(const float *a, const float *b, int n)
+{
+    float acc = 0.0f;
+    for (int i = 0; i < n; i++) {
+        acc += a[i] * b[i];
+    }
+    return acc;
+}
+
+static void mix_smooth_scalar(float *cur, const float *tar, float alpha, int n)
+{
+    for (int i = 0; i < n; i++) {
+        cur[i] += alpha * (tar[i] - cur[i]);
+    }
+}
+
+static void mix_deinterleave_scalar(float *left, float *right,
+                                    const float (*in)[2], int n)
+{
+    for (int i = 0; i < n; i++) {
+        left[i] = in[i][0];
+        right[i] = in[i][1];
+    }
+}
+
+#define INT24_SCALE 8388608.0f
+#define INT24_MAX_F 8388607.0f
+#define INT24_MIN_F -8388608.0f
+
+static void mix_to_int24_scalar(uint32_t *dst, const float *src, int n)
+{
+    for (int i = 0; i < n; i++) {
+        float scaled = src[i] * INT24_SCALE;
+        int32_t int24;
+        if (scaled >= INT24_MAX_F) {
+            int24 = 0x7fffff;
+        } else if (scaled <= INT24_MIN_F) {
+            int24 = -1 - 0x7fffff;
+        } else {
+            int24 = lrintf(scaled);
+        }
+        dst[i] = int24 & 0xffffff;
+    }
+}
+
+#ifdef VP_MIX_ACCEL_X86
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX __attribute__((target("avx")))
+
+static inline TARGET_SSE2 float hsum_sse2(__m128 v)
+{
+    __m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    sums = _mm_add_ss(sums, shuf);
+    return _mm_cvtss_f32(sums);
+}
+
+static TARGET_SSE2 void mix_accumulate_sse2(float *dst, const float *src,
+                                            float gain, int n)
+{
+    __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 d = _mm_loadu_ps(dst + i);
+        d = _mm_add_ps(d, _mm_mul_ps(g, _mm_loadu_ps(src + i)));
+        _mm_storeu_ps(dst + i, d);
+    }
+    mix_accumulate_scalar(dst + i, src + i, gain, n - i);
+}
+
+static TARGET_SSE2 float mix_dot_sse2(const float *a, const float *b, int n)
+{
+    __m128 acc = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = _mm_add_ps(acc,
+                         _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    return hsum_sse2(acc) + mix_dot_scalar(a + i, b + i, n - i);
+}
+
+static TARGET_SSE2 void mix_smooth_sse2(float *cur, const float *tar,
+                                        float alpha, int n)
+{
+    __m128 a = _mm_set1_ps(alpha);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 c = _mm_loadu_ps(cur + i);
+        __m128 t = _mm_loadu_ps(tar + i);
+        c = _mm_add_ps(c, _mm_mul_ps(a, _mm_sub_ps(t, c)));
+        _mm_storeu_ps(cur + i, c);
+    }
+    mix_smooth_scalar(cur + i, tar + i, alpha, n - i);
+}
+
+static TARGET_SSE2 void mix_deinterleave_sse2(float *left, float *right,
+                                              const float (*in)[2], int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(in[i]);
+        __m128 b = _mm_loadu_ps(in[i + 2]);
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    mix_deinterleave_scalar(left + i, right + i, in + i, n - i);
+}
+
+static TARGET_SSE2 void mix_to_int24_sse2(uint32_t *dst, const float *src,
+                                          int n)
+{
+    __m128 scale = _mm_set1_ps(INT24_SCALE);
+    __m128 lo = _mm_set1_ps(INT24_MIN_F);
+    __m128 hi = _mm_set1_ps(INT24_MAX_F);
+    __m128i mask = _mm_set1_epi32(0xffffff);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+        v = _mm_min_ps(_mm_max_ps(v, lo), hi);
+        __m128i r = _mm_and_si128(_mm_cvtps_epi32(v), mask);
+        _mm_storeu_si128((__m128i *)(dst + i), r);
+    }
+    mix_to_int24_scalar(dst + i, src + i, n - i);
+}
+
+static TARGET_AVX void mix_accumulate_avx(float *dst, const float *src,
+                                          float gain, int n)
+{
+    __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_loadu_ps(dst + i);
+        d = _mm256_add_ps(d, _mm256_mul_ps(g, _mm256_loadu_ps(src + i)));
+        _mm256_storeu_ps(dst + i, d);
+    }
+    mix_accumulate_scalar(dst + i, src + i, gain, n - i);
+}
+
+static TARGET_AVX float mix_dot_avx(const float *a, const float *b, int n)
+{
+    __m256 acc = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(a + i),
+                                               _mm256_loadu_ps(b + i)));
+    }
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                            _mm256_extractf128_ps(acc, 1));
+    return hsum_sse2(sum) + mix_dot_scalar(a + i, b + i, n - i);
+}
+
+static TARGET_AVX void mix_smooth_avx(float *cur, const float *tar,
+                                      float alpha, int n)
+{
+    __m256 a = _mm256_set1_ps(alpha);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 c = _mm256_loadu_ps(cur + i);
+        __m256 t = _mm256_loadu_ps(tar + i);
+        c = _mm256_add_ps(c, _mm256_mul_ps(a, _mm256_sub_ps(t, c)));
+        _mm256_storeu_ps(cur + i, c);
+    }
+    mix_smooth_scalar(cur + i, tar + i, alpha, n - i);
+}
+
+#endif
+
+#ifdef VP_MIX_ACCEL_NEON
+
+static void mix_accumulate_neon(float *dst, const float *src, float gain,
+                                int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        vst1q_f32(dst + i,
+                  vmlaq_n_f32(vld1q_f32(dst + i), vld1q_f32(src + i), gain));
+    }
+    mix_accumulate_scalar(dst + i, src + i, gain, n - i);
+}
+
+static float mix_dot_neon(const float *a, const float *b, int n)
+{
+    float32x4_t acc = vdupq_n_f32(0.0f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(a + i), vld1q_f32(b + i));
+    }
+    return vaddvq_f32(acc) + mix_dot_scalar(a + i, b + i, n - i);
+}
+
+static void mix_smooth_neon(float *cur, const float *tar, float alpha, int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t c = vld1q_f32(cur + i);
+        float32x4_t t = vld1q_f32(tar + i);
+        vst1q_f32(cur + i, vmlaq_n_f32(c, vsubq_f32(t, c), alpha));
+    }
+    mix_smooth_scalar(cur + i, tar + i, alpha, n - i);
+}
+
+static void mix_to_int24_neon(uint32_t *dst, const float *src, int n)
+{
+    float32x4_t lo = vdupq_n_f32(INT24_MIN_F);
+    float32x4_t hi = vdupq_n_f32(INT24_MAX_F);
+    uint32x4_t mask = vdupq_n_u32(0xffffff);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t v = vmulq_n_f32(vld1q_f32(src + i), INT24_SCALE);
+        v = vminq_f32(vmaxq_f32(v, lo), hi);
+        uint32x4_t r = vreinterpretq_u32_s32(vcvtnq_s32_f32(v));
+        vst1q_u32(dst + i, vandq_u32(r, mask));
+    }
+    mix_to_int24_scalar(dst + i, src + i, n - i);
+}
+
+static void mix_deinterleave_neon(float *left, float *right,
+                                  const float (*in)[2], int n)
+{
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float32x4x2_t v = vld2q_f32(in[i]);
+        vst1q_f32(left + i, v.val[0]);
+        vst1q_f32(right + i, v.val[1]);
+    }
+    mix_deinterleave_scalar(left + i, right + i, in + i, n - i);
+}
+
+#endif
+
+static void (*mix_accumulate)(float *, const float *, float, int) =
+    mix_accumulate_scalar;
+static float (*mix_dot)(const float *, const float *, int) = mix_dot_scalar;
+static void (*mix_smooth)(float *, const float *, float, int) =
+    mix_smooth_scalar;
+static void (*mix_deinterleave)(float *, float *, const float (*)[2], int) =
+    mix_deinterleave_scalar;
+static void (*mix_to_int24)(uint32_t *, const float *, int) =
+    mix_to_int24_scalar;
+
+static void __attribute__((constructor)) init_mix_accel(void)
+{
+#ifdef VP_MIX_ACCEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        mix_accumulate = mix_accumulate_sse2;
+        mix_dot = mix_dot_sse2;
+        mix_smooth = mix_smooth_sse2;
+        mix_deinterleave = mix_deinterleave_sse2;
+        mix_to_int24 = mix_to_int24_sse2;
+    }
+    if (__builtin_cpu_supports("avx")) {
+        mix_accumulate = mix_accumulate_avx;
+        mix_dot = mix_dot_avx;
+        mix_smooth = mix_smooth_avx;
+    }
+#endif
+#ifdef VP_MIX_ACCEL_NEON
+    /* Advanced SIMD is mandatory on AArch64 */
+    mix_accumulate = mix_accumulate_neon;
+    mix_dot = mix_dot_neon;
+    mix_smooth = mix_smooth_neon;
+    mix_deinterleave = mix_deinterleave_neon;
+    mix_to_int24 = mix_to_int24_neon;
+#endif
+}
+
+void vp_mix_accumulate(float *dst, const float *src, float gain, int n)
+{
+    mix_accumulate(dst, src, gain, n);
+}
+
+float vp_mix_dot(const float *a, const float *b, int n)
+{
+    return mix_dot(a, b, n);
+}
+
+void vp_mix_smooth(float *cur, const float *tar, float alpha, int n)
+{
+    mix_smooth(cur, tar, alpha, n);
+}
+
+void vp_mix_deinterleave(float *left, float *right, const float (*in)[2],
+                         int n)
+{
+    mix_deinterleave(left, right, in, n);
+}
+
+void vp_mix_to_int24(uint32_t *dst, const float *src, int n)
+{
+    mix_to_int24(dst, src, n);
+}
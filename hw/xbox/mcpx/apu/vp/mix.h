@@ -0,0 +1,42 @@
+/*
+ * MCPX Voice Processor mixing kernels
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_MCPX_APU_VP_MIX_H
+#define HW_XBOX_MCPX_APU_VP_MIX_H
+
+#include <stdint.h>
+
+/* dst[i] += gain * src[i] */
+void vp_mix_accumulate(float *dst, const float *src, float gain, int n);
+
+/* Returns the sum of a[i] * b[i] */
+float vp_mix_dot(const float *a, const float *b, int n);
+
+/* cur[i] += alpha * (tar[i] - cur[i]) */
+void vp_mix_smooth(float *cur, const float *tar, float alpha, int n);
+
+/* Split interleaved stereo frames into one buffer per channel */
+void vp_mix_deinterleave(float *left, float *right, const float (*in)[2],
+                         int n);
+
+/*
+ * Convert to DSP56300 24-bit fixed point, saturating and rounding to nearest
+ * even the same way as float_to_24b()
+ */
+void vp_mix_to_int24(uint32_t *dst, const float *src, int n);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * MCPX Voice Processor polyphase resampler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "mix.h"
+#include "resample.h"
+
+#define UNITY_STEP (1ULL << 32)
+
+/*
+ * Windowed sinc, one row of taps per fractional position. The cutoff is
+ * fixed just below the input Nyquist frequency, so pitching up aliases a
+ * little more than the libsamplerate path does.
+ */
+static float resample_coeff[VP_RESAMPLE_PHASES][VP_RESAMPLE_TAPS];
+
+static void __attribute__((constructor)) init_resample_coeff(void)
+{
+    const double cutoff = 0.9;
+
+    for (int p = 0; p < VP_RESAMPLE_PHASES; p++) {
+        double frac = (double)p / VP_RESAMPLE_PHASES;
+        double sum = 0.0;
+        for (int k = 0; k < VP_RESAMPLE_TAPS; k++) {
+            double x = k - (VP_RESAMPLE_TAPS / 2 - 1) - frac;
+            double s = x == 0.0 ? 1.0 : sin(M_PI * cutoff * x) /
+                                            (M_PI * cutoff * x);
+            double t = (x + VP_RESAMPLE_TAPS / 2.0) / VP_RESAMPLE_TAPS;
+            double w =
+                0.42 - 0.5 * cos(2 * M_PI * t) + 0.08 * cos(4 * M_PI * t);
+            resample_coeff[p][k] = s * w;
+            sum += s * w;
+        }
+
+        // Normalize for unity gain at DC
+        for (int k = 0; k < VP_RESAMPLE_TAPS; k++) {
+            resample_coeff[p][k] /= sum;
+        }
+    }
+}
+
+void vp_resampler_reset(VpResampler *r)
+{
+    memset(r, 0, sizeof(*r));
+
+    /* Leading silence so the first output lands on the first input frame */
+    r->len = VP_RESAMPLE_TAPS / 2 - 1;
+}
+
+int vp_resampler_space(const VpResampler *r)
+{
+    return VP_RESAMPLE_BUFLEN - r->len;
+}
+
+void vp_resampler_push(VpResampler *r, const float (*in)[2], int n)
+{
+    assert(n <= vp_resampler_space(r));
+    vp_mix_deinterleave(&r->buf[0][r->len], &r->buf[1][r->len], in, n);
+    r->len += n;
+}
+
+int vp_resampler_read(VpResampler *r, float (*out)[2], int n, float rate,
+                      int channels)
+{
+    assert(rate <= VP_RESAMPLE_MAX_RATE);
+    uint64_t step = (uint64_t)((double)rate * UNITY_STEP);
+
+    int count = 0;
+    for (; count < n; count++) {
+        int ipos = r->pos >> 32;
+        if (ipos + VP_RESAMPLE_TAPS > r->len) {
+            break;
+        }
+
+        if (step == UNITY_STEP && !(uint32_t)r->pos) {
+            // Straight copy at the native rate
+            out[count][0] = r->buf[0][ipos + VP_RESAMPLE_TAPS / 2 - 1];
+            out[count][1] = r->buf[1][ipos + VP_RESAMPLE_TAPS / 2 - 1];
+        } else {
+            const float *coeff = resample_coeff[(uint32_t)r->pos >> 24];
+            out[count][0] =
+                vp_mix_dot(coeff, &r->buf[0][ipos], VP_RESAMPLE_TAPS);
+            out[count][1] =
+                channels == 1 ?
+                    out[count][0] :
+                    vp_mix_dot(coeff, &r->buf[1][ipos], VP_RESAMPLE_TAPS);
+        }
+
+        r->pos += step;
+    }
+
+    // Drop input no later output will read
+    int consumed = r->pos >> 32;
+    if (consumed > r->len) {
+        consumed = r->len;
+    }
+    if (consumed) {
+        r->len -= consumed;
+        memmove(r->buf[0], &r->buf[0][consumed], r->len * sizeof(float));
+        memmove(r->buf[1], &r->buf[1][consumed], r->len * sizeof(float));
+        r->pos -= (uint64_t)consumed << 32;
+    }
+
+    return count;
+}
@@ -0,0 +1,56 @@
+/*
+ * MCPX Voice Processor polyphase resampler
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_MCPX_APU_VP_RESAMPLE_H
+#define HW_XBOX_MCPX_APU_VP_RESAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define VP_RESAMPLE_TAPS      8
+#define VP_RESAMPLE_PHASES    256
+#define VP_RESAMPLE_MAX_RATE  4.0f
+#define VP_RESAMPLE_CHUNK     32
+#define VP_RESAMPLE_BUFLEN \
+    (VP_RESAMPLE_TAPS + (int)VP_RESAMPLE_MAX_RATE * VP_RESAMPLE_CHUNK + \
+     VP_RESAMPLE_CHUNK)
+
+typedef struct VpResampler {
+    /* Planar input, starting with the history the next output still needs */
+    float buf[2][VP_RESAMPLE_BUFLEN];
+    int len;
+    /* Read position in buf, 32.32 fixed point, of the first tap */
+    uint64_t pos;
+} VpResampler;
+
+void vp_resampler_reset(VpResampler *r);
+
+/* Room left for new input frames */
+int vp_resampler_space(const VpResampler *r);
+
+void vp_resampler_push(VpResampler *r, const float (*in)[2], int n);
+
+/*
+ * Produce up to n output frames, advancing by rate input frames per output,
+ * and return how many could be made from the buffered input. Rate must not
+ * exceed VP_RESAMPLE_MAX_RATE. With channels == 1 only the left channel is
+ * filtered and copied to the right.
+ */
+int vp_resampler_read(VpResampler *r, float (*out)[2], int n, float rate,
+                      int channels);
+
+#endif
@@ -20,7 +20,10 @@
  */
 
 #include "hw/xbox/mcpx/apu/apu_int.h"
-#include "adpcm.h"
+#include "qemu/processor.h"
+#include "adpcm_cache.h"
+#include "mix.h"
+#include "resample.h"
 
 static const struct {
     hwaddr top, current, next;
@@ -30,6 +33,51 @@ static const struct {
     { NV_PAPU_TVLMP, NV_PAPU_CVLMP, NV_PAPU_NVLMP }, // MP
 };
 
+/*
+ * Voice descriptors, SGE and SSL tables and sample data live in guest RAM,
+ * where they are accessed through the host pointer rather than a dispatch
+ * through the address space for every field. Anything else, like MMIO,
+ * takes the slow path.
+ */
+static inline bool in_ram(MCPXAPUState *d, hwaddr addr, hwaddr len)
+{
+    return likely(addr < d->ram_size && len <= d->ram_size - addr);
+}
+
+static uint8_t ram_ldub(MCPXAPUState *d, hwaddr addr)
+{
+    if (in_ram(d, addr, 1)) {
+        return ldub_p(d->ram_ptr + addr);
+    }
+    return ldub_phys(&address_space_memory, addr);
+}
+
+static uint16_t ram_lduw(MCPXAPUState *d, hwaddr addr)
+{
+    if (in_ram(d, addr, 2)) {
+        return lduw_le_p(d->ram_ptr + addr);
+    }
+    return lduw_le_phys(&address_space_memory, addr);
+}
+
+static uint32_t ram_ldl(MCPXAPUState *d, hwaddr addr)
+{
+    if (in_ram(d, addr, 4)) {
+        return ldl_le_p(d->ram_ptr + addr);
+    }
+    return ldl_le_phys(&address_space_memory, addr);
+}
+
+static void ram_stl(MCPXAPUState *d, hwaddr addr, uint32_t val)
+{
+    if (in_ram(d, addr, 4)) {
+        stl_le_p(d->ram_ptr + addr, val);
+        memory_region_set_dirty(d->ram, addr, 4);
+        return;
+    }
+    stl_le_phys(&address_space_memory, addr, val);
+}
+
 static void set_notify_status(MCPXAPUState *d, uint32_t v, int notifier,
                               int status)
 {
@@ -59,6 +107,9 @@ static void voice_reset_filters(MCPXAPUState *d, uint16_t v)
     if (d->vp.filters[v].resampler) {
         src_reset(d->vp.filters[v].resampler);
     }
+    vp_resampler_reset(&d->vp.filters[v].polyphase);
+    d->vp.filters[v].culled = false;
+    d->vp.filters[v].cull_frac = 0.0f;
 }
 
 static bool voice_should_mute(uint16_t v)
@@ -101,8 +152,7 @@ static uint32_t voice_get_mask(MCPXAPUState *d, uint16_t voice_handle,
                                hwaddr offset, uint32_t mask)
 {
     hwaddr voice = d->regs[NV_PAPU_VPVADDR] + voice_handle * NV_PAVS_SIZE;
-    return (ldl_le_phys(&address_space_memory, voice + offset) & mask) >>
-           ctz32(mask);
+    return (ram_ldl(d, voice + offset) & mask) >> ctz32(mask);
 }
 
 static void voice_set_mask(MCPXAPUState *d, uint16_t voice_handle,
@@ -110,9 +160,8 @@ static void voice_set_mask(MCPXAPUState *d, uint16_t voice_handle,
 {
     hwaddr voice = d->regs[NV_PAPU_VPVADDR]
                     + voice_handle * NV_PAVS_SIZE;
-    uint32_t v = ldl_le_phys(&address_space_memory, voice + offset) & ~mask;
-    stl_le_phys(&address_space_memory, voice + offset,
-                v | ((val << ctz32(mask)) & mask));
+    uint32_t v = ram_ldl(d, voice + offset) & ~mask;
+    ram_stl(d, voice + offset, v | ((val << ctz32(mask)) & mask));
 }
 
 static void voice_off(MCPXAPUState *d, uint16_t v)
@@ -642,7 +691,12 @@ static void vp_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     case NV1BA0_PIO_SET_SUBMIX_HEADROOM ...
          NV1BA0_PIO_SET_SUBMIX_HEADROOM+4*(NUM_MIXBINS-1):
         /* TODO: these should instead be queueing up fe commands */
+        if (qemu_mutex_trylock(&d->fe_lock)) {
+            qatomic_inc(&d->fe_lock_contended);
+            qemu_mutex_lock(&d->fe_lock);
+        }
         fe_method(d, addr, val);
+        qemu_mutex_unlock(&d->fe_lock);
         break;
 
     case NV1BA0_PIO_GET_VOICE_POSITION:
@@ -661,12 +715,12 @@ const MemoryRegionOps vp_ops = {
     .write = vp_write,
 };
 
-static hwaddr get_data_ptr(hwaddr sge_base, unsigned int max_sge, uint32_t addr)
+static hwaddr get_data_ptr(MCPXAPUState *d, hwaddr sge_base,
+                           unsigned int max_sge, uint32_t addr)
 {
     unsigned int entry = addr / TARGET_PAGE_SIZE;
     assert(entry <= max_sge);
-    uint32_t prd_address =
-        ldl_le_phys(&address_space_memory, sge_base + entry * 4 * 2);
+    uint32_t prd_address = ram_ldl(d, sge_base + entry * 4 * 2);
     // uint32_t prd_control =
     //     ldl_le_phys(&address_space_memory, sge_base + entry * 4 * 2 + 4);
     DPRINTF("Addr: 0x%08X, control: 0x%08X\n", prd_address, prd_control);
@@ -831,6 +885,10 @@ static float voice_step_envelope(MCPXAPUState *d, uint16_t v, uint32_t reg_0,
     }
 }
 
+/*
+ * Fetch up to num_samples_requested source frames. With samples NULL no data
+ * is read, but the position, loop and notifier state advance just the same.
+ */
 static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
                        int num_samples_requested)
 {
@@ -952,8 +1010,8 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
         }
 
         hwaddr addr = d->regs[NV_PAPU_VPSSLADDR] + page * 8;
-        segment_offset = ldl_le_phys(&address_space_memory, addr);
-        segment_length = ldl_le_phys(&address_space_memory, addr + 4);
+        segment_offset = ram_ldl(d, addr);
+        segment_length = ram_ldl(d, addr + 4);
         assert(segment_offset != 0);
         assert(segment_length != 0);
         seg_len = (segment_length >> 0) & 0xffff;
@@ -1004,34 +1062,45 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
 
     block_size *= samples_per_block;
 
-    // FIXME: Restructure this loop
     int sample_count = 0;
-    for (; (sample_count < num_samples_requested) && (cbo <= ebo);
+    if (samples == NULL && cbo <= ebo) {
+        /* Culled voice, only the position moves */
+        sample_count = MIN(num_samples_requested, (int)(ebo - cbo + 1));
+        cbo += sample_count;
+    }
+
+    // FIXME: Restructure this loop
+    for (; samples && (sample_count < num_samples_requested) && (cbo <= ebo);
          sample_count++, cbo++) {
         if (adpcm) {
             unsigned int block_index = cbo / ADPCM_SAMPLES_PER_BLOCK;
             unsigned int block_position = cbo % ADPCM_SAMPLES_PER_BLOCK;
             if (adpcm_block_index != block_index) {
                 uint32_t linear_addr = block_index * block_size;
+                hwaddr block_addr;
                 if (stream) {
                     hwaddr addr = segment_offset + linear_addr;
                     int max_seg_byte = (seg_len >> 6) * block_size;
                     assert(linear_addr + block_size <= max_seg_byte);
                     memcpy(adpcm_block, &d->ram_ptr[addr],
                            block_size); // FIXME: Use idiomatic DMA function
+                    block_addr = addr;
                 } else {
                     linear_addr += ba;
+                    block_addr = get_data_ptr(d, d->regs[NV_PAPU_VPSGEADDR],
+                                              0xFFFFFFFF, linear_addr);
                     for (unsigned int word_index = 0;
                          word_index < (9 * samples_per_block); word_index++) {
-                        hwaddr addr = get_data_ptr(d->regs[NV_PAPU_VPSGEADDR],
-                                                   0xFFFFFFFF, linear_addr);
-                        adpcm_block[word_index] =
-                            ldl_le_phys(&address_space_memory, addr);
+                        hwaddr addr =
+                            get_data_ptr(d, d->regs[NV_PAPU_VPSGEADDR],
+                                         0xFFFFFFFF, linear_addr);
+                        adpcm_block[word_index] = ram_ldl(d, addr);
                         linear_addr += 4;
                     }
                 }
-                adpcm_decode_block(adpcm_decoded, (uint8_t *)adpcm_block,
-                                   block_size, channels);
+                adpcm_cache_decode(&d->vp.adpcm_cache, block_addr,
+                                   (uint8_t *)adpcm_block, block_size,
+                                   channels, adpcm_decoded);
                 adpcm_block_index = block_index;
             }
 
@@ -1049,7 +1118,7 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
                 addr = segment_offset + cbo * block_size;
             } else {
                 uint32_t linear_addr = ba + cbo * block_size;
-                addr = get_data_ptr(d->regs[NV_PAPU_VPSGEADDR], 0xFFFFFFFF,
+                addr = get_data_ptr(d, d->regs[NV_PAPU_VPSGEADDR], 0xFFFFFFFF,
                                     linear_addr);
             }
 
@@ -1058,19 +1127,19 @@ static int voice_get_samples(MCPXAPUState *d, uint32_t v, float samples[][2],
                 float fval;
                 switch (sample_size) {
                 case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_U8:
-                    ival = ldub_phys(&address_space_memory, addr);
+                    ival = ram_ldub(d, addr);
                     fval = uint8_to_float(ival & 0xff);
                     break;
                 case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S16:
-                    ival = lduw_le_phys(&address_space_memory, addr);
+                    ival = ram_lduw(d, addr);
                     fval = int16_to_float(ival & 0xffff);
                     break;
                 case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S24:
-                    ival = ldl_le_phys(&address_space_memory, addr);
+                    ival = ram_ldl(d, addr);
                     fval = int24_to_float(ival);
                     break;
                 case NV_PAVS_VOICE_CFG_FMT_SAMPLE_SIZE_S32:
-                    ival = ldl_le_phys(&address_space_memory, addr);
+                    ival = ram_ldl(d, addr);
                     fval = int32_to_float(ival);
                     break;
                 default:
@@ -1151,12 +1220,78 @@ static long voice_resample_callback(void *cb_data, float **data)
     return sample_count;
 }
 
+static int voice_resample_polyphase(MCPXAPUState *d, uint16_t v,
+                                    float samples[][2], int requested_num,
+                                    float step)
+{
+    MCPXAPUVoiceFilter *filter = &d->vp.filters[v];
+    bool stereo = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
+                                 NV_PAVS_VOICE_CFG_FMT_STEREO);
+
+    int count = 0;
+    for (;;) {
+        count += vp_resampler_read(&filter->polyphase, &samples[count],
+                                   requested_num - count, step,
+                                   stereo ? 2 : 1);
+        if (count == requested_num) {
+            break;
+        }
+
+        float in[VP_RESAMPLE_CHUNK][2];
+        int sample_count = 0;
+        while (sample_count < VP_RESAMPLE_CHUNK) {
+            int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                                        NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+            if (!active) {
+                break;
+            }
+            int got = voice_get_samples(d, v, &in[sample_count],
+                                        VP_RESAMPLE_CHUNK - sample_count);
+            if (got < 0) {
+                break;
+            }
+            sample_count += got;
+        }
+
+        /* Pad with silence if the voice stopped, same as the SRC path */
+        memset(&in[sample_count], 0,
+               (VP_RESAMPLE_CHUNK - sample_count) * sizeof(in[0]));
+        vp_resampler_push(&filter->polyphase, (const float (*)[2])in,
+                          VP_RESAMPLE_CHUNK);
+    }
+
+    return count;
+}
+
 static int voice_resample(MCPXAPUState *d, uint16_t v, float samples[][2],
                           int requested_num, float rate)
 {
     assert(v < MCPX_HW_MAX_VOICES);
     MCPXAPUVoiceFilter *filter = &d->vp.filters[v];
 
+    /*
+     * The built-in resampler handles the usual pitch range. Very high
+     * pitches and the high quality setting go through libsamplerate.
+     *
+     * Rate is output over input frames, as libsamplerate takes it, while
+     * the built-in resampler steps by input frames per output frame.
+     */
+    float step = 1.0f / rate;
+    bool use_polyphase =
+        g_config.audio.vp.resampler == CONFIG_AUDIO_VP_RESAMPLER_POLYPHASE &&
+        step <= VP_RESAMPLE_MAX_RATE;
+    if (use_polyphase != filter->use_polyphase) {
+        if (use_polyphase) {
+            vp_resampler_reset(&filter->polyphase);
+        } else if (filter->resampler) {
+            src_reset(filter->resampler);
+        }
+        filter->use_polyphase = use_polyphase;
+    }
+    if (use_polyphase) {
+        return voice_resample_polyphase(d, v, samples, requested_num, step);
+    }
+
     if (filter->resampler == NULL) {
         filter->voice = v;
         int err;
@@ -1190,6 +1325,33 @@ static int voice_resample(MCPXAPUState *d, uint16_t v, float samples[][2],
     return count;
 }
 
+/*
+ * Advance an inaudible voice by the source frames it would have consumed this
+ * frame, carrying the fractional remainder over to the next.
+ */
+static void voice_skip_samples(MCPXAPUState *d, uint16_t v, float rate)
+{
+    assert(v < MCPX_HW_MAX_VOICES);
+    MCPXAPUVoiceFilter *filter = &d->vp.filters[v];
+
+    float pos = filter->cull_frac + NUM_SAMPLES_PER_FRAME / rate;
+    int num = (int)pos;
+    filter->cull_frac = pos - num;
+
+    for (int sample_count = 0; sample_count < num;) {
+        int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                                    NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+        if (!active) {
+            break;
+        }
+        int count = voice_get_samples(d, v, NULL, num - sample_count);
+        if (count < 0) {
+            break;
+        }
+        sample_count += count;
+    }
+}
+
 static int peek_ahead_multipass_bin(MCPXAPUState *d, uint16_t v,
                                     uint16_t *dst_voice)
 {
@@ -1282,8 +1444,47 @@ static void get_multipass_samples(MCPXAPUState *d,
     dump_multipass_unused_debug_info(d, v);
 }
 
+static float voice_bin_gain(MCPXAPUState *d, uint16_t v, const int bin[8],
+                            const uint16_t vol[8], int b)
+{
+    float hr;
+    if ((v < MCPX_HW_MAX_3D_VOICES) && (b < 4)) {
+        // FIXME: Not sure if submix/voice headroom factor in for HRTF
+        hr = 1 << d->vp.hrtf_headroom;
+    } else {
+        hr = 1 << d->vp.submix_headroom[bin[b]];
+    }
+    return attenuate(vol[b]) / hr;
+}
+
+/*
+ * Voices mixed in below this gain in every bin stay under the LSB of 16-bit
+ * output, so they are culled: not fetched, resampled or filtered.
+ */
+#define VOICE_CULL_GAIN (1.0f / 65536.0f)
+
+static bool voice_is_inaudible(MCPXAPUState *d, uint16_t v, const int bin[8],
+                               const uint16_t vol[8], float ea_value)
+{
+    if (voice_should_mute(v)) {
+        return true;
+    }
+    for (int b = 0; b < 8; b++) {
+        if (ea_value * voice_bin_gain(d, v, bin, vol, b) >= VOICE_CULL_GAIN) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Mixes into the worker's mixbins, while multipass bins are read from (and
+ * cleared in) mp_mixbins, where the contributions of all workers have been
+ * gathered by then.
+ */
 static void voice_process(MCPXAPUState *d,
                           float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
+                          float mp_mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME],
                           float sample_buf[NUM_SAMPLES_PER_FRAME][2],
                           uint16_t v, int voice_list)
 {
@@ -1325,37 +1526,6 @@ static void voice_process(MCPXAPUState *d,
     assert(ea_value >= 0.0f);
     assert(ea_value <= 1.0f);
 
-    float samples[NUM_SAMPLES_PER_FRAME][2] = { 0 };
-
-    bool multipass = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
-                                    NV_PAVS_VOICE_CFG_FMT_MULTIPASS);
-    dbg->multipass = multipass;
-
-    if (multipass) {
-        get_multipass_samples(d, mixbins, v, samples);
-    } else {
-        for (int sample_count = 0; sample_count < NUM_SAMPLES_PER_FRAME;) {
-            int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                        NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
-            if (!active) {
-                return;
-            }
-            int count =
-                voice_resample(d, v, &samples[sample_count],
-                               NUM_SAMPLES_PER_FRAME - sample_count, rate);
-            if (count < 0) {
-                break;
-            }
-            sample_count += count;
-        }
-    }
-
-    int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
-                                NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
-    if (!active) {
-        return;
-    }
-
     int bin[8];
     bin[0] = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_VBIN,
                             NV_PAVS_VOICE_CFG_VBIN_V0BIN);
@@ -1416,6 +1586,50 @@ static void voice_process(MCPXAPUState *d,
         dbg->vol[i] = vol[i];
     }
 
+    bool multipass = voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
+                                    NV_PAVS_VOICE_CFG_FMT_MULTIPASS);
+    dbg->multipass = multipass;
+
+    /* Multipass voices are cheap and still have to clear their bin */
+    bool culled = !multipass && voice_is_inaudible(d, v, bin, vol, ea_value);
+    dbg->culled = culled;
+    if (culled) {
+        d->vp.filters[v].culled = true;
+        voice_skip_samples(d, v, rate);
+        return;
+    }
+    if (d->vp.filters[v].culled) {
+        /* Resampler and filter history are stale after skipping ahead */
+        voice_reset_filters(d, v);
+    }
+
+    float samples[NUM_SAMPLES_PER_FRAME][2] = { 0 };
+
+    if (multipass) {
+        get_multipass_samples(d, mp_mixbins, v, samples);
+    } else {
+        for (int sample_count = 0; sample_count < NUM_SAMPLES_PER_FRAME;) {
+            int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                                        NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+            if (!active) {
+                return;
+            }
+            int count =
+                voice_resample(d, v, &samples[sample_count],
+                               NUM_SAMPLES_PER_FRAME - sample_count, rate);
+            if (count < 0) {
+                break;
+            }
+            sample_count += count;
+        }
+    }
+
+    int active = voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                                NV_PAVS_VOICE_PAR_STATE_ACTIVE_VOICE);
+    if (!active) {
+        return;
+    }
+
     if (voice_should_mute(v)) {
         return;
     }
@@ -1463,19 +1677,13 @@ static void voice_process(MCPXAPUState *d,
 
     // FIXME: ParaEQ
 
+    float planar[2][NUM_SAMPLES_PER_FRAME];
+    vp_mix_deinterleave(planar[0], planar[1], samples, NUM_SAMPLES_PER_FRAME);
+
     for (int b = 0; b < 8; b++) {
-        float g = ea_value;
-        float hr;
-        if ((v < MCPX_HW_MAX_3D_VOICES) && (b < 4)) {
-            // FIXME: Not sure if submix/voice headroom factor in for HRTF
-            hr = 1 << d->vp.hrtf_headroom;
-        } else {
-            hr = 1 << d->vp.submix_headroom[bin[b]];
-        }
-        g *= attenuate(vol[b])/hr;
-        for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-            mixbins[bin[b]][i] += g*samples[i][b % channels];
-        }
+        float g = ea_value * voice_bin_gain(d, v, bin, vol, b);
+        vp_mix_accumulate(mixbins[bin[b]], planar[b % channels], g,
+                          NUM_SAMPLES_PER_FRAME);
     }
 
     if (d->monitor.point == MCPX_APU_DEBUG_MON_VP) {
@@ -1512,10 +1720,8 @@ static void voice_process(MCPXAPUState *d,
             g = fmax(g, attenuate(vol[b]) / hr);
         }
         g *= ea_value;
-        for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-            sample_buf[i][0] += g*samples[i][0];
-            sample_buf[i][1] += g*samples[i][1];
-        }
+        vp_mix_accumulate(&sample_buf[0][0], &samples[0][0], g,
+                          2 * NUM_SAMPLES_PER_FRAME);
     }
 }
 
@@ -1579,63 +1785,170 @@ static void get_voice_bin_src_dst(MCPXAPUState *d, int v,
     }
 }
 
+/*
+ * Workers spin this many times waiting for the next frame (or for the other
+ * workers to finish) before parking, which covers the gap between
+ * back-to-back frames without a futex round trip.
+ */
+#define VOICE_WORK_SPIN_ITERATIONS 4096
+
+/* Batches handed out per worker, leaving slack for stealing */
+#define VOICE_WORK_BATCHES_PER_WORKER 4
+
+/* Rough relative cost of a voice, used to balance workers */
+static int voice_work_estimate_cost(MCPXAPUState *d, int v)
+{
+    if (voice_get_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
+                       NV_PAVS_VOICE_PAR_STATE_PAUSED)) {
+        return 1;
+    }
+
+    if (voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
+                       NV_PAVS_VOICE_CFG_FMT_MULTIPASS)) {
+        /* Only mixes the multipass bin back in, no decoding or resampling */
+        return 2;
+    }
+
+    if (d->vp.filters[v].culled) {
+        /* Likely inaudible again, only stepping the envelope and position */
+        return 2;
+    }
+
+    /* Decode and resample */
+    int cost = 8;
+    if (voice_get_mask(d, v, NV_PAVS_VOICE_CFG_FMT,
+                       NV_PAVS_VOICE_CFG_FMT_STEREO)) {
+        cost += 4;
+    }
+
+    /* Negative pitch consumes more than one source sample per output */
+    int16_t p = voice_get_mask(d, v, NV_PAVS_VOICE_TAR_PITCH_LINK,
+                               NV_PAVS_VOICE_TAR_PITCH_LINK_PITCH);
+    if (p < 0) {
+        cost += MIN(-p / 4096 + 1, 4) * 4;
+    }
+
+    if (v < MCPX_HW_MAX_3D_VOICES && g_config.audio.hrtf &&
+        voice_get_mask(d, v, NV_PAVS_VOICE_CFG_HRTF_TARGET,
+                       NV_PAVS_VOICE_CFG_HRTF_TARGET_HANDLE) !=
+            HRTF_NULL_HANDLE) {
+        cost += 6;
+    }
+
+    return cost;
+}
+
+static bool voice_worker_claim(VoiceWorker *w, bool steal,
+                               VoiceWorkBatch *batch)
+{
+    uint32_t range = qatomic_read(&w->range);
+
+    for (;;) {
+        uint32_t head = range & 0xffff;
+        uint32_t tail = range >> 16;
+        if (head >= tail) {
+            return false;
+        }
+
+        uint32_t idx = steal ? tail - 1 : head;
+        uint32_t claimed = steal ? (head | (tail - 1) << 16)
+                                 : ((head + 1) | tail << 16);
+        uint32_t prev = qatomic_cmpxchg(&w->range, range, claimed);
+        if (prev == range) {
+            *batch = w->batches[idx];
+            return true;
+        }
+        range = prev;
+    }
+}
+
+static bool voice_worker_next_batch(VoiceWorkDispatch *vwd, VoiceWorker *self,
+                                    VoiceWorkBatch *batch)
+{
+    if (voice_worker_claim(self, false, batch)) {
+        return true;
+    }
+
+    for (int i = 1; i < vwd->num_workers; i++) {
+        VoiceWorker *victim = &vwd->workers[(self->id + i) % vwd->num_workers];
+        if (voice_worker_claim(victim, true, batch)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static uint32_t voice_worker_wait_for_frame(VoiceWorkDispatch *vwd,
+                                            VoiceWorker *self, uint32_t seen)
+{
+    uint32_t gen;
+
+    for (int i = 0; i < VOICE_WORK_SPIN_ITERATIONS; i++) {
+        gen = qatomic_load_acquire(&vwd->frame_gen);
+        if (gen != seen) {
+            return gen;
+        }
+        cpu_relax();
+    }
+
+    for (;;) {
+        qemu_event_reset(&self->wake);
+        gen = qatomic_load_acquire(&vwd->frame_gen);
+        if (gen != seen) {
+            return gen;
+        }
+        qemu_event_wait(&self->wake);
+    }
+}
+
 static void *voice_worker_thread(void *arg)
 {
-    MCPXAPUState *d = arg;
+    VoiceWorker *self = arg;
+    MCPXAPUState *d = self->d;
     VoiceWorkDispatch *vwd = &d->vp.voice_work_dispatch;
+    uint32_t seen = 0;
+
+    xemu_trace_set_thread_name("mcpx.voice_worker");
+    xemu_thread_topology_register(XEMU_THREAD_REALTIME, "mcpx.voice_worker");
 
     rcu_register_thread();
-    qemu_mutex_lock(&vwd->lock);
 
-    int worker_id = ctz64(vwd->workers_pending);
-    VoiceWorker *self = &d->vp.voice_work_dispatch.workers[worker_id];
-    self->queue_len = 0;
+    for (;;) {
+        seen = voice_worker_wait_for_frame(vwd, self, seen);
+        if (qatomic_read(&vwd->workers_should_exit)) {
+            break;
+        }
 
-    do {
         int64_t start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
-        g_dbg.vp.workers[worker_id].num_voices = self->queue_len;
-
-        if (self->queue_len) {
-            qemu_mutex_unlock(&vwd->lock);
-
-            // Process queued voices
-            memset(self->mixbins, 0, sizeof(self->mixbins));
-            if (d->monitor.point == MCPX_APU_DEBUG_MON_VP) {
-                memset(self->sample_buf, 0, sizeof(self->sample_buf));
-            }
-            for (int i = 0; i < self->queue_len; i++) {
-                voice_process(d, self->mixbins, self->sample_buf,
-                              self->queue[i].voice, self->queue[i].list);
-            }
-
-            qemu_mutex_lock(&vwd->lock);
 
-            // Add voice contributions
-            for (int b = 0; b < NUM_MIXBINS; b++) {
-                for (int s = 0; s < NUM_SAMPLES_PER_FRAME; s++) {
-                    vwd->mixbins[b][s] += self->mixbins[b][s];
+        // Process queued voices, then steal from other workers
+        VoiceWorkBatch batch;
+        xemu_trace_begin("voice work", NULL);
+        while (voice_worker_next_batch(vwd, self, &batch)) {
+            if (!self->num_voices) {
+                memset(self->mixbins, 0, sizeof(self->mixbins));
+                if (d->monitor.point == MCPX_APU_DEBUG_MON_VP) {
+                    memset(self->sample_buf, 0, sizeof(self->sample_buf));
                 }
             }
-            if (d->monitor.point == MCPX_APU_DEBUG_MON_VP) {
-                for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
-                    d->vp.sample_buf[i][0] += self->sample_buf[i][0];
-                    d->vp.sample_buf[i][1] += self->sample_buf[i][1];
-                }
+            for (int i = batch.start; i < batch.start + batch.len; i++) {
+                voice_process(d, self->mixbins, vwd->mixbins,
+                              self->sample_buf, vwd->queue[i].voice,
+                              vwd->queue[i].list);
             }
-
-            self->queue_len = 0;
-        }
-
-        vwd->workers_pending &= ~(1 << worker_id);
-        if (!vwd->workers_pending) {
-            qemu_cond_signal(&vwd->work_finished);
+            self->num_voices += batch.len;
         }
+        xemu_trace_end();
 
         int64_t end_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
-        g_dbg.vp.workers[worker_id].time_us = end_time - start_time;
+        g_dbg.vp.workers[self->id].num_voices = self->num_voices;
+        g_dbg.vp.workers[self->id].time_us += end_time - start_time;
 
-        qemu_cond_wait(&vwd->work_pending, &vwd->lock);
-    } while (!vwd->workers_should_exit);
+        if (qatomic_fetch_dec(&vwd->workers_busy) == 1) {
+            qemu_event_set(&vwd->work_finished);
+        }
+    }
 
     rcu_unregister_thread();
     return NULL;
@@ -1674,52 +1987,159 @@ static void voice_work_release_voice_locks(MCPXAPUState *d)
     }
 }
 
+static void voice_work_assign_batch(VoiceWorkDispatch *vwd, int start, int len,
+                                    int cost)
+{
+    // Give the batch to the least loaded worker
+    VoiceWorker *worker = &vwd->workers[0];
+    for (int i = 1; i < vwd->num_workers; i++) {
+        if (vwd->workers[i].cost < worker->cost) {
+            worker = &vwd->workers[i];
+        }
+    }
+
+    uint32_t tail = worker->range >> 16;
+    worker->batches[tail] = (VoiceWorkBatch){ .start = start, .len = len };
+    worker->range = (tail + 1) << 16;
+    worker->cost += cost;
+}
+
+/*
+ * Split the queue into waves by bin dependencies. A voice reading a multipass
+ * bin must see everything mixed into it before it in the voice lists, and
+ * anything mixed in after it was read must not be. Voices only ever add to
+ * other bins, so the rest go into the first wave.
+ */
 static void voice_work_schedule(MCPXAPUState *d)
 {
     VoiceWorkDispatch *vwd = &d->vp.voice_work_dispatch;
-    int next_worker_to_schedule = 0;
-    bool group = false;
-    uint32_t dirty = 0;
+    int last_write[NUM_MIXBINS], last_read[NUM_MIXBINS];
+    int wave[MCPX_HW_MAX_VOICES];
+    uint32_t src_bins[MCPX_HW_MAX_VOICES];
+
+    for (int b = 0; b < NUM_MIXBINS; b++) {
+        last_write[b] = -1;
+        last_read[b] = -1;
+    }
+
+    vwd->num_waves = 0;
+    for (int i = 0; i < vwd->queue_len; i++) {
+        uint32_t src, dst;
+        get_voice_bin_src_dst(d, vwd->queue[i].voice, &src, &dst, NULL);
+
+        int w = 0;
+        for (uint32_t m = src; m; m &= m - 1) {
+            int b = ctz32(m);
+            w = MAX(w, MAX(last_write[b], last_read[b]) + 1);
+        }
+        for (uint32_t m = dst; m; m &= m - 1) {
+            w = MAX(w, last_read[ctz32(m)] + 1);
+        }
+        for (uint32_t m = src; m; m &= m - 1) {
+            last_read[ctz32(m)] = w;
+        }
+        for (uint32_t m = dst; m; m &= m - 1) {
+            int b = ctz32(m);
+            last_write[b] = MAX(last_write[b], w);
+        }
 
+        wave[i] = w;
+        src_bins[i] = src;
+        vwd->queue[i].cost = voice_work_estimate_cost(d, vwd->queue[i].voice);
+        vwd->num_waves = MAX(vwd->num_waves, w + 1);
+    }
+
+    // Sort the queue by wave, keeping list order within each
+    for (int w = 0; w < vwd->num_waves; w++) {
+        vwd->waves[w] = (VoiceWorkWave){ 0 };
+    }
     for (int i = 0; i < vwd->queue_len; i++) {
-        uint32_t src, dst, clr;
-        get_voice_bin_src_dst(d, vwd->queue[i].voice, &src, &dst, &clr);
+        vwd->waves[wave[i]].len++;
+        vwd->waves[wave[i]].src_bins |= src_bins[i];
+    }
+    int fill[MCPX_HW_MAX_VOICES];
+    for (int w = 0, start = 0; w < vwd->num_waves; w++) {
+        vwd->waves[w].start = start;
+        fill[w] = start;
+        start += vwd->waves[w].len;
+    }
+    if (vwd->num_waves > 1) {
+        VoiceWorkItem queue[MCPX_HW_MAX_VOICES];
+        memcpy(queue, vwd->queue, vwd->queue_len * sizeof(queue[0]));
+        for (int i = 0; i < vwd->queue_len; i++) {
+            vwd->queue[fill[wave[i]]++] = queue[i];
+        }
+    }
+}
+
+static void voice_work_schedule_wave(VoiceWorkDispatch *vwd, int w)
+{
+    const VoiceWorkWave *wave = &vwd->waves[w];
+    int total_cost = 0;
 
-        // TODO: To simplify submix scheduling, we make a few assumptions based
-        // on Xbox software observations. However, the configurability of
-        // multipass sources suggests the hardware may not be so strict. We'll
-        // defer making this more robust for now.
-        //
-        // We currently assume that:
-        //
-        // - MP bin is constant
-        assert(!src || (src == MULTIPASS_BIN_MASK));
-        //
-        // - MP voice always clears MP bin
-        assert(!src || (clr == MULTIPASS_BIN_MASK));
-        //
-        // - MP source voices are ordered consecutively in voice lists
-        assert(src || (dst & MULTIPASS_BIN_MASK) ||
-               !(dirty & MULTIPASS_BIN_MASK));
+    for (int i = wave->start; i < wave->start + wave->len; i++) {
+        total_cost += vwd->queue[i].cost;
+    }
 
-        if ((dst & MULTIPASS_BIN_MASK) & ~dirty) {
-            group = true;
+    for (int i = 0; i < vwd->num_workers; i++) {
+        vwd->workers[i].range = 0;
+        vwd->workers[i].cost = 0;
+    }
+
+    int target =
+        MAX(1, total_cost / (vwd->num_workers * VOICE_WORK_BATCHES_PER_WORKER));
+    int start = wave->start, batch_cost = 0;
+    for (int i = wave->start; i < wave->start + wave->len; i++) {
+        batch_cost += vwd->queue[i].cost;
+        if (batch_cost >= target || i == wave->start + wave->len - 1) {
+            voice_work_assign_batch(vwd, start, i + 1 - start, batch_cost);
+            start = i + 1;
+            batch_cost = 0;
         }
+    }
+}
 
-        // Assign voice to worker
-        VoiceWorker *worker = &vwd->workers[next_worker_to_schedule];
-        worker->queue[worker->queue_len++] = vwd->queue[i];
-        vwd->workers_pending |= 1 << next_worker_to_schedule;
+/* Sum the workers' contributions to bins the next wave reads */
+static void voice_work_gather_bins(VoiceWorkDispatch *vwd, uint32_t bins)
+{
+    for (int i = 0; i < vwd->num_workers; i++) {
+        VoiceWorker *worker = &vwd->workers[i];
+        if (!worker->num_voices) {
+            continue;
+        }
+        for (uint32_t m = bins; m; m &= m - 1) {
+            int b = ctz32(m);
+            vp_mix_accumulate(vwd->mixbins[b], worker->mixbins[b], 1.0f,
+                              NUM_SAMPLES_PER_FRAME);
+            memset(worker->mixbins[b], 0, sizeof(worker->mixbins[b]));
+        }
+    }
+}
 
-        dirty = (dirty & ~clr) | dst;
-        if (clr & MULTIPASS_BIN_MASK) {
-            group = false;
+static void voice_work_wait(VoiceWorkDispatch *vwd)
+{
+    for (int i = 0; i < VOICE_WORK_SPIN_ITERATIONS; i++) {
+        if (!qatomic_load_acquire(&vwd->workers_busy)) {
+            return;
         }
+        cpu_relax();
+    }
 
-        if (!group) {
-            next_worker_to_schedule =
-                (next_worker_to_schedule + 1) % vwd->num_workers;
+    for (;;) {
+        qemu_event_reset(&vwd->work_finished);
+        if (!qatomic_load_acquire(&vwd->workers_busy)) {
+            return;
         }
+        qemu_event_wait(&vwd->work_finished);
+    }
+}
+
+static void voice_work_kick(VoiceWorkDispatch *vwd)
+{
+    qatomic_set(&vwd->workers_busy, vwd->num_workers);
+    qatomic_store_release(&vwd->frame_gen, vwd->frame_gen + 1);
+    for (int i = 0; i < vwd->num_workers; i++) {
+        qemu_event_set(&vwd->workers[i].wake);
     }
 }
 
@@ -1731,31 +2151,42 @@ voice_work_dispatch(MCPXAPUState *d,
 
     int64_t start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
 
-    qemu_mutex_lock(&vwd->lock);
-
     if (vwd->queue_len) {
-        memset(vwd->mixbins, 0, sizeof(vwd->mixbins));
-
-        // Signal workers and wait for completion
         voice_work_schedule(d);
-        qemu_cond_broadcast(&vwd->work_pending);
-        qemu_cond_wait(&vwd->work_finished, &vwd->lock);
-        assert(!vwd->workers_pending);
+        vwd->mixbins = mixbins;
+        for (int i = 0; i < vwd->num_workers; i++) {
+            vwd->workers[i].num_voices = 0;
+            g_dbg.vp.workers[i].time_us = 0;
+        }
+
+        // Signal workers and wait for completion, one wave at a time
+        for (int w = 0; w < vwd->num_waves; w++) {
+            voice_work_gather_bins(vwd, vwd->waves[w].src_bins);
+            voice_work_schedule_wave(vwd, w);
+            voice_work_kick(vwd);
+            voice_work_wait(vwd);
+        }
         voice_work_release_voice_locks(d);
         vwd->queue_len = 0;
 
         // Add voice contributions
-        for (int b = 0; b < NUM_MIXBINS; b++) {
-            for (int s = 0; s < NUM_SAMPLES_PER_FRAME; s++) {
-                mixbins[b][s] += vwd->mixbins[b][s];
+        for (int i = 0; i < vwd->num_workers; i++) {
+            VoiceWorker *worker = &vwd->workers[i];
+            if (!worker->num_voices) {
+                continue;
+            }
+            vp_mix_accumulate(&mixbins[0][0], &worker->mixbins[0][0], 1.0f,
+                              NUM_MIXBINS * NUM_SAMPLES_PER_FRAME);
+            if (d->monitor.point == MCPX_APU_DEBUG_MON_VP) {
+                vp_mix_accumulate(&d->vp.sample_buf[0][0],
+                                  &worker->sample_buf[0][0], 1.0f,
+                                  2 * NUM_SAMPLES_PER_FRAME);
             }
         }
     }
 
     int64_t end_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     g_dbg.vp.total_worker_time_us = end_time - start_time;
-
-    qemu_mutex_unlock(&vwd->lock);
 }
 
 static int mcpx_apu_default_vp_worker_count(void)
@@ -1803,36 +2234,34 @@ static void voice_work_init(MCPXAPUState *d)
     vwd->num_workers = MAX(1, MIN(num_workers, MAX_VOICE_WORKERS));
     vwd->workers = g_malloc0_n(vwd->num_workers, sizeof(VoiceWorker));
     vwd->workers_should_exit = false;
-    vwd->workers_pending = 0;
+    vwd->frame_gen = 0;
+    vwd->workers_busy = 0;
     vwd->queue_len = 0;
 
     g_dbg.vp.num_workers = vwd->num_workers;
 
-    qemu_mutex_init(&vwd->lock);
-    qemu_mutex_lock(&vwd->lock);
-    qemu_cond_init(&vwd->work_pending);
-    qemu_cond_init(&vwd->work_finished);
+    qemu_event_init(&vwd->work_finished, false);
     for (int i = 0; i < vwd->num_workers; i++) {
-        vwd->workers_pending |= 1 << i;
-        qemu_thread_create(&vwd->workers[i].thread, "mcpx.voice_worker",
-                           voice_worker_thread, d, QEMU_THREAD_JOINABLE);
+        VoiceWorker *worker = &vwd->workers[i];
+        worker->d = d;
+        worker->id = i;
+        qemu_event_init(&worker->wake, false);
+        qemu_thread_create(&worker->thread, "mcpx.voice_worker",
+                           voice_worker_thread, worker, QEMU_THREAD_JOINABLE);
     }
-    qemu_cond_wait(&vwd->work_finished, &vwd->lock);
-    assert(!vwd->workers_pending);
-    qemu_mutex_unlock(&vwd->lock);
 }
 
 static void voice_work_finalize(MCPXAPUState *d)
 {
     VoiceWorkDispatch *vwd = &d->vp.voice_work_dispatch;
 
-    qemu_mutex_lock(&vwd->lock);
-    vwd->workers_should_exit = true;
-    qemu_cond_broadcast(&vwd->work_pending);
-    qemu_mutex_unlock(&vwd->lock);
+    qatomic_set(&vwd->workers_should_exit, true);
+    voice_work_kick(vwd);
     for (int i = 0; i < vwd->num_workers; i++) {
         qemu_thread_join(&vwd->workers[i].thread);
+        qemu_event_destroy(&vwd->workers[i].wake);
     }
+    qemu_event_destroy(&vwd->work_finished);
     g_free(vwd->workers);
     vwd->workers = NULL;
 }
@@ -1894,12 +2323,22 @@ void mcpx_apu_vp_init(MCPXAPUState *d)
         qemu_spin_init(&d->vp.voice_spinlocks[i]);
     }
 
+    adpcm_cache_init(&d->vp.adpcm_cache);
     voice_work_init(d);
+
+    xemu_mem_account_set(
+        xemu_mem_account("apu", "vp working set"),
+        sizeof(d->vp) +
+            d->vp.voice_work_dispatch.num_workers * sizeof(VoiceWorker) +
+            ADPCM_CACHE_NUM_SHARDS * ADPCM_CACHE_SHARD_SIZE *
+                sizeof(AdpcmCacheNode));
 }
 
 void mcpx_apu_vp_finalize(MCPXAPUState *d)
 {
     voice_work_finalize(d);
+    adpcm_cache_finalize(&d->vp.adpcm_cache);
+    xemu_mem_account_set(xemu_mem_account("apu", "vp working set"), 0);
 }
 
 void mcpx_apu_vp_reset(MCPXAPUState *d)
@@ -1913,4 +2352,5 @@ void mcpx_apu_vp_reset(MCPXAPUState *d)
     for (int v = 0; v < ARRAY_SIZE(d->vp.filters); v++) {
         hrtf_filter_init(&d->vp.filters[v].hrtf);
     }
+    adpcm_cache_flush(&d->vp.adpcm_cache);
 }
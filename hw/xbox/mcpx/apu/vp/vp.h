@@ -30,6 +30,8 @@
 #include "hw/xbox/mcpx/apu/apu_regs.h"
 #include "svf.h"
 #include "hrtf.h"
+#include "resample.h"
+#include "adpcm_cache.h"
 
 typedef struct MCPXAPUState MCPXAPUState;
 
@@ -44,40 +46,75 @@ typedef struct MCPXAPUVoiceFilter {
     uint16_t voice;
     float resample_buf[NUM_SAMPLES_PER_FRAME * 2];
     SRC_STATE *resampler;
+    VpResampler polyphase;
+    bool use_polyphase;
     sv_filter svf[2];
     HrtfFilter hrtf;
+    /* Inaudible voice, only its position is being advanced */
+    bool culled;
+    float cull_frac;
 } MCPXAPUVoiceFilter;
 
 typedef struct VoiceWorkItem {
     int voice;
     int list;
+    int cost;
 } VoiceWorkItem;
 
+/*
+ * Queue entries that can be processed in parallel once earlier waves are
+ * done, and the multipass bins they read
+ */
+typedef struct VoiceWorkWave {
+    uint16_t start;
+    uint16_t len;
+    uint32_t src_bins;
+} VoiceWorkWave;
+
+/* A run of consecutive queue entries claimed by one worker */
+typedef struct VoiceWorkBatch {
+    uint16_t start;
+    uint16_t len;
+} VoiceWorkBatch;
+
 typedef struct VoiceWorker {
     QemuThread thread;
+    QemuEvent wake;
+    MCPXAPUState *d;
+    int id;
     float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
     float sample_buf[NUM_SAMPLES_PER_FRAME][2];
-    VoiceWorkItem queue[MCPX_HW_MAX_VOICES];
-    int queue_len;
+    VoiceWorkBatch batches[MCPX_HW_MAX_VOICES];
+    /*
+     * Unclaimed batches, head in the low half and tail in the high half.
+     * The owner takes from the head and thieves from the tail, both by
+     * compare-and-swap.
+     */
+    uint32_t range;
+    int cost;
+    int num_voices;
 } VoiceWorker;
 
 typedef struct VoiceWorkDispatch {
-    QemuMutex lock;
     int num_workers;
     VoiceWorker *workers;
     bool workers_should_exit;
-    QemuCond work_pending;
-    uint64_t workers_pending;
-    QemuCond work_finished;
-    float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
+    uint32_t frame_gen;
+    int workers_busy;
+    QemuEvent work_finished;
     VoiceWorkItem queue[MCPX_HW_MAX_VOICES];
     int queue_len;
+    VoiceWorkWave waves[MCPX_HW_MAX_VOICES];
+    int num_waves;
+    /* Final mix, holding the multipass bins gathered from all workers */
+    float (*mixbins)[NUM_SAMPLES_PER_FRAME];
 } VoiceWorkDispatch;
 
 typedef struct {
     MemoryRegion mmio;
     VoiceWorkDispatch voice_work_dispatch;
     MCPXAPUVoiceFilter filters[MCPX_HW_MAX_VOICES];
+    AdpcmCache adpcm_cache;
 
     // FIXME: Where are these stored?
     int ssl_base_page;
@@ -36,6 +36,7 @@
 #define MMIO_SIZE 0x400
 #define PHY_ADDR 1
 #define AUTONEG_DURATION_MS 250
+#define NVNET_TX_MAX_FRAGS 32
 
 #define GET_MASK(v, mask) (((v) & (mask)) >> ctz32(mask))
 
@@ -72,6 +73,13 @@ typedef struct NvNetState {
 
     QEMUTimer *autoneg_timer;
 
+    /* Interrupt moderation, off when both limits are zero */
+    uint32_t intr_coalesce_us;
+    uint32_t intr_coalesce_frames;
+    uint32_t coalesced_status;
+    uint32_t coalesced_frames;
+    QEMUTimer *coalesce_timer;
+
     /* Deprecated */
     uint8_t tx_ring_index;
     uint8_t rx_ring_index;
@@ -249,6 +257,52 @@ static void set_intr_status(NvNetState *s, uint32_t status)
     update_irq(s);
 }
 
+static void flush_coalesced_intr(NvNetState *s)
+{
+    timer_del(s->coalesce_timer);
+
+    if (s->coalesced_status) {
+        trace_nvnet_intr_coalesce_flush(s->coalesced_status,
+                                        s->coalesced_frames);
+        set_intr_status(s, s->coalesced_status);
+        s->coalesced_status = 0;
+        s->coalesced_frames = 0;
+    }
+}
+
+static void coalesce_timer_cb(void *opaque)
+{
+    flush_coalesced_intr(opaque);
+}
+
+/*
+ * Raise the interrupt for a completed RX or TX frame. With moderation on, the
+ * status bits are held back until the frame limit is reached or the timer
+ * expires, so the guest services a batch of descriptors per interrupt.
+ */
+static void set_frame_intr_status(NvNetState *s, uint32_t status)
+{
+    if (!s->intr_coalesce_us && !s->intr_coalesce_frames) {
+        set_intr_status(s, status);
+        return;
+    }
+
+    s->coalesced_status |= status;
+    s->coalesced_frames++;
+
+    if (s->intr_coalesce_frames &&
+        s->coalesced_frames >= s->intr_coalesce_frames) {
+        flush_coalesced_intr(s);
+    } else if (!timer_pending(s->coalesce_timer)) {
+        /* Count-only moderation still needs a bound on latency */
+        int64_t delay = s->intr_coalesce_us ?
+                            (int64_t)s->intr_coalesce_us * SCALE_US :
+                            SCALE_MS;
+        timer_mod(s->coalesce_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + delay);
+    }
+}
+
 static void set_mii_intr_status(NvNetState *s, uint32_t status)
 {
     or_reg(s, NVNET_MII_STATUS, status);
@@ -256,12 +310,12 @@ static void set_mii_intr_status(NvNetState *s, uint32_t status)
     // FIXME: MII status mask?
 }
 
-static void send_packet(NvNetState *s, const uint8_t *buf, size_t size)
+static void send_packet(NvNetState *s, const struct iovec *iov, int iovcnt)
 {
     NetClientState *nc = qemu_get_queue(s->nic);
 
-    trace_nvnet_packet_tx(size);
-    qemu_send_packet(nc, buf, size);
+    trace_nvnet_packet_tx(iov_size(iov, iovcnt));
+    qemu_sendv_packet(nc, iov, iovcnt);
 }
 
 static uint16_t get_tx_ring_size(NvNetState *s)
@@ -395,8 +449,8 @@ static bool nvnet_can_receive(NetClientState *nc)
     return can_rx;
 }
 
-static ssize_t dma_packet_to_guest(NvNetState *s, const uint8_t *buf,
-                                   size_t size)
+static ssize_t dma_packet_to_guest(NvNetState *s, const struct iovec *iov,
+                                   int iovcnt, size_t size)
 {
     PCIDevice *d = PCI_DEVICE(s);
     NetClientState *nc = qemu_get_queue(s->nic);
@@ -421,16 +475,35 @@ static ssize_t dma_packet_to_guest(NvNetState *s, const uint8_t *buf,
         assert((desc.length + 1) >= size); // FIXME
 
         trace_nvnet_rx_dma(desc.buffer_addr, size);
-        pci_dma_write(d, desc.buffer_addr, buf, size);
+
+        /* Copy straight into the guest buffer when it maps contiguously */
+        dma_addr_t len = size;
+        void *buf = pci_dma_map(d, desc.buffer_addr, &len,
+                                DMA_DIRECTION_FROM_DEVICE);
+        if (buf && len == size) {
+            iov_to_buf(iov, iovcnt, 0, buf, size);
+            pci_dma_unmap(d, buf, len, DMA_DIRECTION_FROM_DEVICE, size);
+        } else {
+            if (buf) {
+                pci_dma_unmap(d, buf, len, DMA_DIRECTION_FROM_DEVICE, 0);
+            }
+            iov_to_buf(iov, iovcnt, 0, s->rx_dma_buf, size);
+            pci_dma_write(d, desc.buffer_addr, s->rx_dma_buf, size);
+        }
 
         desc.length = size;
         desc.flags = NV_RX_BIT4 | NV_RX_DESCRIPTORVALID;
         store_ring_desc(s, cur_desc_addr, desc);
 
-        set_intr_status(s, NVNET_IRQ_STATUS_RX);
+        set_frame_intr_status(s, NVNET_IRQ_STATUS_RX);
 
         advance_next_rx_ring_desc_addr(s);
 
+        /* Let the guest refill the ring rather than wait out the timer */
+        if (!rx_buf_available(s)) {
+            flush_coalesced_intr(s);
+        }
+
         rval = size;
     } else {
         NVNET_DPRINTF("Could not find free buffer!\n");
@@ -491,9 +564,88 @@ static void advance_next_tx_ring_desc_addr(NvNetState *s)
     set_reg(s, NVNET_TX_RING_NEXT_DESC_PHYS_ADDR, next_desc_addr);
 }
 
-static void dma_packet_from_guest(NvNetState *s)
+/*
+ * Fragments of the frame being transmitted. Descriptors that map to guest
+ * RAM are sent in place. The rest are copied to tx_dma_buf, which also holds
+ * the start of a frame whose descriptors were not all valid at the last kick.
+ */
+typedef struct NvNetTxFrame {
+    struct iovec iov[NVNET_TX_MAX_FRAGS];
+    bool mapped[NVNET_TX_MAX_FRAGS];
+    int iovcnt;
+    size_t size;
+} NvNetTxFrame;
+
+static void tx_frame_add_copy(NvNetState *s, NvNetTxFrame *f,
+                              dma_addr_t addr, uint16_t length)
 {
     PCIDevice *d = PCI_DEVICE(s);
+    uint8_t *dst = &s->tx_dma_buf[s->tx_dma_buf_offset];
+
+    assert((s->tx_dma_buf_offset + length) <= sizeof(s->tx_dma_buf));
+    pci_dma_read(d, addr, dst, length);
+    s->tx_dma_buf_offset += length;
+    f->size += length;
+
+    /* Extend the previous fragment if it ends where this copy starts */
+    if (f->iovcnt && !f->mapped[f->iovcnt - 1] &&
+        (uint8_t *)f->iov[f->iovcnt - 1].iov_base +
+                f->iov[f->iovcnt - 1].iov_len == dst) {
+        f->iov[f->iovcnt - 1].iov_len += length;
+        return;
+    }
+
+    assert(f->iovcnt < NVNET_TX_MAX_FRAGS);
+    f->iov[f->iovcnt].iov_base = dst;
+    f->iov[f->iovcnt].iov_len = length;
+    f->mapped[f->iovcnt] = false;
+    f->iovcnt++;
+}
+
+static void tx_frame_add(NvNetState *s, NvNetTxFrame *f, dma_addr_t addr,
+                         uint16_t length)
+{
+    PCIDevice *d = PCI_DEVICE(s);
+
+    /* Keep the last slot free for copies once the fragment list fills up */
+    if (f->iovcnt < NVNET_TX_MAX_FRAGS - 1) {
+        dma_addr_t len = length;
+        void *buf = pci_dma_map(d, addr, &len, DMA_DIRECTION_TO_DEVICE);
+        if (buf && len == length) {
+            assert((f->size + length) <= sizeof(s->tx_dma_buf));
+            f->iov[f->iovcnt].iov_base = buf;
+            f->iov[f->iovcnt].iov_len = length;
+            f->mapped[f->iovcnt] = true;
+            f->iovcnt++;
+            f->size += length;
+            return;
+        }
+        if (buf) {
+            pci_dma_unmap(d, buf, len, DMA_DIRECTION_TO_DEVICE, 0);
+        }
+    }
+
+    tx_frame_add_copy(s, f, addr, length);
+}
+
+static void tx_frame_release(NvNetState *s, NvNetTxFrame *f)
+{
+    PCIDevice *d = PCI_DEVICE(s);
+
+    for (int i = 0; i < f->iovcnt; i++) {
+        if (f->mapped[i]) {
+            pci_dma_unmap(d, f->iov[i].iov_base, f->iov[i].iov_len,
+                          DMA_DIRECTION_TO_DEVICE, 0);
+        }
+    }
+    f->iovcnt = 0;
+    f->size = 0;
+    s->tx_dma_buf_offset = 0;
+}
+
+static void dma_packet_from_guest(NvNetState *s)
+{
+    NvNetTxFrame frame = { 0 };
     bool packet_sent = false;
 
     if (!can_transmit(s)) {
@@ -504,6 +656,13 @@ static void dma_packet_from_guest(NvNetState *s)
 
     uint32_t base_desc_addr = get_reg(s, NVNET_TX_RING_PHYS_ADDR);
 
+    if (s->tx_dma_buf_offset) {
+        frame.iov[0].iov_base = s->tx_dma_buf;
+        frame.iov[0].iov_len = s->tx_dma_buf_offset;
+        frame.iovcnt = 1;
+        frame.size = s->tx_dma_buf_offset;
+    }
+
     for (int i = 0; i < get_tx_ring_size(s); i++) {
         uint32_t cur_desc_addr = update_current_tx_ring_desc_addr(s);
         struct RingDesc desc = load_ring_desc(s, cur_desc_addr);
@@ -519,20 +678,14 @@ static void dma_packet_from_guest(NvNetState *s)
             break;
         }
 
-        assert((s->tx_dma_buf_offset + length) <= sizeof(s->tx_dma_buf));
-
         trace_nvnet_tx_dma(desc.buffer_addr, length);
-        pci_dma_read(d, desc.buffer_addr, &s->tx_dma_buf[s->tx_dma_buf_offset],
-                     length);
-        s->tx_dma_buf_offset += length;
+        tx_frame_add(s, &frame, desc.buffer_addr, length);
 
+        /*
+         * The guest is stopped in this MMIO write until we return, so the
+         * descriptor can be handed back before its buffer is sent.
+         */
         bool is_last_packet = desc.flags & NV_TX_LASTPACKET;
-        if (is_last_packet) {
-            send_packet(s, s->tx_dma_buf, s->tx_dma_buf_offset);
-            s->tx_dma_buf_offset = 0;
-            packet_sent = true;
-        }
-
         desc.flags &= ~(NV_TX_VALID | NV_TX_RETRYERROR | NV_TX_DEFERRED |
                         NV_TX_CARRIERLOST | NV_TX_LATECOLLISION |
                         NV_TX_UNDERFLOW | NV_TX_ERROR);
@@ -541,15 +694,28 @@ static void dma_packet_from_guest(NvNetState *s)
         advance_next_tx_ring_desc_addr(s);
 
         if (is_last_packet) {
-            // FIXME
-            break;
+            send_packet(s, frame.iov, frame.iovcnt);
+            tx_frame_release(s, &frame);
+            packet_sent = true;
         }
     }
 
+    /*
+     * Mappings can't be held across kicks, so copy the start of a frame
+     * still waiting for descriptors into tx_dma_buf.
+     */
+    if (frame.iovcnt) {
+        uint8_t tmp[TX_ALLOC_BUFSIZE];
+        size_t size = iov_to_buf(frame.iov, frame.iovcnt, 0, tmp, frame.size);
+        tx_frame_release(s, &frame);
+        memcpy(s->tx_dma_buf, tmp, size);
+        s->tx_dma_buf_offset = size;
+    }
+
     set_dma_idle(s, true);
 
     if (packet_sent) {
-        set_intr_status(s, NVNET_IRQ_STATUS_TX);
+        set_frame_intr_status(s, NVNET_IRQ_STATUS_TX);
     }
 }
 
@@ -620,14 +786,16 @@ static ssize_t nvnet_receive_iov(NetClientState *nc, const struct iovec *iov,
         return size;
     }
 
-    iov_to_buf(iov, iovcnt, 0, s->rx_dma_buf, size);
+    /* The filter only looks at the destination address */
+    uint8_t hdr[6];
+    iov_to_buf(iov, iovcnt, 0, hdr, sizeof(hdr));
 
-    if (!receive_filter(s, s->rx_dma_buf, size)) {
+    if (!receive_filter(s, hdr, size)) {
         trace_nvnet_rx_filter_dropped();
         return size;
     }
 
-    return dma_packet_to_guest(s, s->rx_dma_buf, size);
+    return dma_packet_to_guest(s, iov, iovcnt, size);
 }
 
 static ssize_t nvnet_receive(NetClientState *nc, const uint8_t *buf,
@@ -921,6 +1089,8 @@ static void nvnet_realize(PCIDevice *pci_dev, Error **errp)
                           &dev->mem_reentrancy_guard, s);
 
     s->autoneg_timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, autoneg_timer, s);
+    s->coalesce_timer =
+        timer_new_ns(QEMU_CLOCK_VIRTUAL, coalesce_timer_cb, s);
 }
 
 static void nvnet_uninit(PCIDevice *dev)
@@ -928,6 +1098,7 @@ static void nvnet_uninit(PCIDevice *dev)
     NvNetState *s = NVNET(dev);
     qemu_del_nic(s->nic);
     timer_free(s->autoneg_timer);
+    timer_free(s->coalesce_timer);
 }
 
 // clang-format off
@@ -976,6 +1147,9 @@ static void nvnet_reset(void *opaque)
     s->tx_dma_buf_offset = 0;
 
     timer_del(s->autoneg_timer);
+    timer_del(s->coalesce_timer);
+    s->coalesced_status = 0;
+    s->coalesced_frames = 0;
 
     if (qemu_get_queue(s->nic)->link_down) {
         update_regs_on_link_down(s);
@@ -992,6 +1166,14 @@ static void nvnet_reset_hold(Object *obj, ResetType type)
     nvnet_reset(s);
 }
 
+static int nvnet_pre_save(void *opaque)
+{
+    /* Held back interrupts are not part of the snapshot, raise them now */
+    flush_coalesced_intr(NVNET(opaque));
+
+    return 0;
+}
+
 static int nvnet_post_load(void *opaque, int version_id)
 {
     NvNetState *s = NVNET(opaque);
@@ -1033,6 +1215,7 @@ static const VMStateDescription vmstate_nvnet = {
     .name = "nvnet",
     .version_id = 2,
     .minimum_version_id = 1,
+    .pre_save = nvnet_pre_save,
     .post_load = nvnet_post_load,
     // clang-format off
     .fields = (VMStateField[]){
@@ -1050,6 +1233,9 @@ static const VMStateDescription vmstate_nvnet = {
 
 static const Property nvnet_properties[] = {
     DEFINE_NIC_PROPERTIES(NvNetState, conf),
+    DEFINE_PROP_UINT32("intr-coalesce-us", NvNetState, intr_coalesce_us, 0),
+    DEFINE_PROP_UINT32("intr-coalesce-frames", NvNetState,
+                       intr_coalesce_frames, 0),
 };
 
 static void nvnet_class_init(ObjectClass *klass, const void *data)
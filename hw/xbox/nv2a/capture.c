@@ -0,0 +1,457 @@
+/*
+ * QEMU Geforce NV2A pushbuffer capture and replay
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "ui/xemu-settings.h"
+#include "nv2a_int.h"
+
+/*
+ * A capture records the methods seen by PGRAPH over a number of frames,
+ * starting at a flip, so the same work can be replayed later without the
+ * guest for profiling or bisecting renderer changes.
+ *
+ * Capture file layout:
+ *   CaptureHeader      header
+ *   uint8_t[]          nv2a device state, as saved in snapshots
+ *   uint8_t[]          RAMIN contents
+ *   uint8_t[]          guest RAM contents
+ *   CaptureRecord[]    records, each followed by its payload
+ *
+ * Guest RAM changes made by the CPU are recorded as MEMORY records at the
+ * start of each pusher run, for the pages PGRAPH tracks as dirty.
+ */
+static const char capture_magic[8] = "NV2ACAP1";
+
+// Words recorded past the ones a method consumed, for method lookahead
+#define CAPTURE_LOOKAHEAD_WORDS 16
+
+enum {
+    CAPTURE_RECORD_METHOD,
+    CAPTURE_RECORD_MEMORY,
+    CAPTURE_RECORD_FRAME,
+};
+
+typedef struct CaptureHeader {
+    char magic[8];
+    uint64_t state_size;
+    uint64_t ramin_size;
+    uint64_t ram_size;
+} CaptureHeader;
+
+typedef struct CaptureRecord {
+    uint32_t type;
+    uint32_t size; // Payload size, in bytes
+} CaptureRecord;
+
+typedef struct CaptureMethod {
+    uint32_t subchannel;
+    uint32_t method;
+    uint32_t parameter;
+    uint32_t inc;
+    uint32_t num_words_available;
+    uint32_t num_words_processed;
+    uint32_t num_words; // Words following this record
+} CaptureMethod;
+
+typedef struct CaptureMemory {
+    uint64_t addr;
+    uint64_t size; // Bytes following this record
+} CaptureMemory;
+
+bool g_nv2a_capture_active;
+
+static struct {
+    int frames_requested; // Set by the UI thread
+    bool armed;
+    FILE *file;
+    char *path;
+    int frames_left;
+    uint8_t *shadow_ram;
+} g_capture;
+
+static struct {
+    GMappedFile *file;
+    const uint8_t *pos;
+    const uint8_t *end;
+    bool pending;
+    int frames;
+    int64_t start_time;
+} g_replay;
+
+void nv2a_capture_frames(int num_frames)
+{
+    if (num_frames <= 0) {
+        return;
+    }
+
+    qatomic_set(&g_capture.frames_requested, num_frames);
+    qatomic_set(&g_nv2a_capture_active, true);
+}
+
+static void capture_write(const void *data, size_t size)
+{
+    if (g_capture.file && fwrite(data, 1, size, g_capture.file) != size) {
+        fprintf(stderr, "nv2a: Failed to write capture to %s\n",
+                g_capture.path);
+        fclose(g_capture.file);
+        g_capture.file = NULL;
+    }
+}
+
+static void capture_write_record(uint32_t type, const void *data,
+                                 size_t size, const void *payload,
+                                 size_t payload_size)
+{
+    CaptureRecord record = {
+        .type = type,
+        .size = size + payload_size,
+    };
+    capture_write(&record, sizeof(record));
+    capture_write(data, size);
+    if (payload_size) {
+        capture_write(payload, payload_size);
+    }
+}
+
+static void capture_finish(void)
+{
+    if (g_capture.file) {
+        fclose(g_capture.file);
+        g_capture.file = NULL;
+        fprintf(stderr, "nv2a: Wrote capture to %s\n", g_capture.path);
+    }
+
+    g_free(g_capture.path);
+    g_capture.path = NULL;
+    g_free(g_capture.shadow_ram);
+    g_capture.shadow_ram = NULL;
+    g_capture.armed = false;
+
+    if (!qatomic_read(&g_capture.frames_requested)) {
+        qatomic_set(&g_nv2a_capture_active, false);
+    }
+}
+
+static char *get_capture_path(void)
+{
+    g_autofree char *dir =
+        g_strdup_printf("%scaptures", xemu_settings_get_base_path());
+    qemu_mkdir(dir);
+
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    g_autofree char *name = g_date_time_format(now, "%Y%m%d-%H%M%S.nv2acap");
+    return g_build_filename(dir, name, NULL);
+}
+
+static void capture_begin(NV2AState *d)
+{
+    GByteArray *state = nv2a_save_device_state(d, &error_warn);
+    if (!state) {
+        capture_finish();
+        return;
+    }
+
+    size_t ramin_size = memory_region_size(&d->ramin);
+    size_t ram_size = memory_region_size(d->vram);
+
+    g_capture.path = get_capture_path();
+    g_capture.file = fopen(g_capture.path, "wb");
+    if (!g_capture.file) {
+        fprintf(stderr, "nv2a: Failed to open %s for capture\n",
+                g_capture.path);
+        g_byte_array_unref(state);
+        capture_finish();
+        return;
+    }
+
+    CaptureHeader header = {
+        .state_size = state->len,
+        .ramin_size = ramin_size,
+        .ram_size = ram_size,
+    };
+    memcpy(header.magic, capture_magic, sizeof(header.magic));
+    capture_write(&header, sizeof(header));
+    capture_write(state->data, state->len);
+    capture_write(d->ramin_ptr, ramin_size);
+    capture_write(d->vram_ptr, ram_size);
+    g_byte_array_unref(state);
+
+    g_capture.shadow_ram = g_memdup2(d->vram_ptr, ram_size);
+    g_capture.armed = false;
+}
+
+static void capture_memory(NV2AState *d)
+{
+    size_t ram_size = memory_region_size(d->vram);
+    size_t page_size = qemu_target_page_size();
+
+    for (size_t addr = 0; addr < ram_size && g_capture.file;
+         addr += page_size) {
+        if (!pgraph_vram_get_dirty(d, addr, page_size, DIRTY_MEMORY_NV2A) &&
+            !pgraph_vram_get_dirty(d, addr, page_size,
+                                   DIRTY_MEMORY_NV2A_TEX)) {
+            continue;
+        }
+
+        uint8_t *shadow = g_capture.shadow_ram + addr;
+        if (!memcmp(shadow, d->vram_ptr + addr, page_size)) {
+            continue;
+        }
+
+        memcpy(shadow, d->vram_ptr + addr, page_size);
+        CaptureMemory memory = {
+            .addr = addr,
+            .size = page_size,
+        };
+        capture_write_record(CAPTURE_RECORD_MEMORY, &memory, sizeof(memory),
+                             shadow, page_size);
+    }
+}
+
+/*
+ * Called with the FIFO lock held at the start of each pusher run. Surfaces
+ * were downloaded by the renderer's pending work since the capture was
+ * armed, so guest RAM is up to date when the initial state is written.
+ */
+void nv2a_capture_pusher_start(NV2AState *d)
+{
+    if (g_capture.armed) {
+        qemu_mutex_lock(&d->pgraph.lock);
+        capture_begin(d);
+        qemu_mutex_unlock(&d->pgraph.lock);
+    } else if (g_capture.file) {
+        capture_memory(d);
+    }
+}
+
+/*
+ * Called with the PGRAPH lock held after each method. A capture is armed at
+ * a flip so that it starts on a frame boundary.
+ */
+void nv2a_capture_method(NV2AState *d, unsigned int subchannel,
+                         unsigned int method, uint32_t parameter,
+                         const uint32_t *parameters,
+                         size_t num_words_available,
+                         size_t max_lookahead_words, bool inc,
+                         size_t num_words_processed)
+{
+    if (g_capture.file) {
+        size_t num_words = MIN(max_lookahead_words,
+                               MAX(num_words_processed, num_words_available) +
+                                   CAPTURE_LOOKAHEAD_WORDS);
+        CaptureMethod record = {
+            .subchannel = subchannel,
+            .method = method,
+            .parameter = parameter,
+            .inc = inc,
+            .num_words_available = num_words_available,
+            .num_words_processed = num_words_processed,
+            .num_words = num_words,
+        };
+        capture_write_record(CAPTURE_RECORD_METHOD, &record, sizeof(record),
+                             parameters, num_words * sizeof(uint32_t));
+    }
+
+    if (!d->pgraph.waiting_for_flip) {
+        return;
+    }
+
+    if (g_capture.file) {
+        capture_write_record(CAPTURE_RECORD_FRAME, NULL, 0, NULL, 0);
+        if (--g_capture.frames_left == 0) {
+            capture_finish();
+        }
+    } else if (!g_capture.armed) {
+        int frames = qatomic_xchg(&g_capture.frames_requested, 0);
+        if (frames) {
+            g_capture.frames_left = frames;
+            g_capture.armed = true;
+            d->pgraph.renderer->ops.pre_savevm_trigger(d);
+        }
+    }
+
+    if (!g_capture.file && !g_capture.armed &&
+        !qatomic_read(&g_capture.frames_requested)) {
+        qatomic_set(&g_nv2a_capture_active, false);
+    }
+}
+
+/*
+ * Restore the captured state. Called from the main thread with the BQL held,
+ * before the machine starts running.
+ */
+void nv2a_replay_start(const char *path)
+{
+    NV2AState *d = g_nv2a;
+    g_autoptr(GError) err = NULL;
+
+    g_replay.file = g_mapped_file_new(path, FALSE, &err);
+    if (!g_replay.file) {
+        error_report("nv2a: Failed to open capture %s: %s", path,
+                     err->message);
+        exit(1);
+    }
+
+    const uint8_t *data =
+        (const uint8_t *)g_mapped_file_get_contents(g_replay.file);
+    size_t size = g_mapped_file_get_length(g_replay.file);
+    CaptureHeader header;
+
+    if (size < sizeof(header) ||
+        memcmp(data, capture_magic, sizeof(capture_magic))) {
+        error_report("nv2a: %s is not a capture file", path);
+        exit(1);
+    }
+    memcpy(&header, data, sizeof(header));
+
+    const uint8_t *state = data + sizeof(header);
+    const uint8_t *ramin = state + header.state_size;
+    const uint8_t *ram = ramin + header.ramin_size;
+    if (header.ramin_size != memory_region_size(&d->ramin) ||
+        header.ram_size != memory_region_size(d->vram) ||
+        ram + header.ram_size > data + size) {
+        error_report("nv2a: Capture %s does not match this machine", path);
+        exit(1);
+    }
+
+    // Memory first, so the flush done after loading uploads from it
+    memcpy(d->ramin_ptr, ramin, header.ramin_size);
+    memcpy(d->vram_ptr, ram, header.ram_size);
+    memory_region_set_dirty(d->vram, 0, header.ram_size);
+
+    if (!nv2a_load_device_state(d, state, header.state_size, &error_fatal)) {
+        exit(1);
+    }
+
+    g_replay.pos = ram + header.ram_size;
+    g_replay.end = data + size;
+    g_replay.frames = 0;
+    g_replay.start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    qatomic_set(&g_replay.pending, true);
+    pfifo_kick(d);
+}
+
+bool nv2a_replay_pending(void)
+{
+    return qatomic_read(&g_replay.pending);
+}
+
+static void replay_finish(void)
+{
+    int64_t elapsed = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                      g_replay.start_time;
+
+    fprintf(stderr, "nv2a: Replayed %d frames in %.3f s (%.3f ms/frame)\n",
+            g_replay.frames, elapsed / 1e9,
+            g_replay.frames ? elapsed / 1e6 / g_replay.frames : 0.0);
+    pgraph_report_stats(g_nv2a);
+
+    g_mapped_file_unref(g_replay.file);
+    g_replay.file = NULL;
+    qatomic_set(&g_replay.pending, false);
+    qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_UI);
+}
+
+static void replay_method(NV2AState *d, const CaptureMethod *record,
+                          uint32_t *words)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    size_t num_processed =
+        pgraph_method(d, record->subchannel, record->method,
+                      record->parameter, words, record->num_words_available,
+                      record->num_words, record->inc);
+    if (num_processed != record->num_words_processed) {
+        fprintf(stderr, "nv2a: Replay diverged at method 0x%x\n",
+                record->method);
+    }
+
+    // Nothing else completes what the guest would have waited for
+    if (pg->waiting_for_flip) {
+        pgraph_increment_read_3d(pg);
+        pg->waiting_for_flip = false;
+    }
+    pg->waiting_for_nop = false;
+    pg->waiting_for_context_switch = false;
+    pg->pending_interrupts = 0;
+}
+
+/*
+ * Called from the FIFO thread in place of the pusher. Runs the records up to
+ * the next frame, then returns so pending renderer work can be processed.
+ */
+void nv2a_replay_run(NV2AState *d)
+{
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_mutex_lock(&d->pgraph.lock);
+
+    bool frame_done = false;
+    while (!frame_done && g_replay.pos + sizeof(CaptureRecord) <= g_replay.end) {
+        CaptureRecord record;
+        memcpy(&record, g_replay.pos, sizeof(record));
+        const uint8_t *payload = g_replay.pos + sizeof(record);
+        if (payload + record.size > g_replay.end) {
+            break;
+        }
+        g_replay.pos = payload + record.size;
+
+        switch (record.type) {
+        case CAPTURE_RECORD_METHOD: {
+            CaptureMethod method;
+            memcpy(&method, payload, sizeof(method));
+            g_autofree uint32_t *words =
+                g_memdup2(payload + sizeof(method),
+                          method.num_words * sizeof(uint32_t));
+            replay_method(d, &method, words);
+            break;
+        }
+        case CAPTURE_RECORD_MEMORY: {
+            CaptureMemory memory;
+            memcpy(&memory, payload, sizeof(memory));
+            if (memory.addr + memory.size > memory_region_size(d->vram)) {
+                break;
+            }
+            memcpy(d->vram_ptr + memory.addr, payload + sizeof(memory),
+                   memory.size);
+            memory_region_set_dirty(d->vram, memory.addr, memory.size);
+            pgraph_vram_set_dirty(d, memory.addr, memory.size,
+                                  DIRTY_MEMORY_NV2A);
+            pgraph_vram_set_dirty(d, memory.addr, memory.size,
+                                  DIRTY_MEMORY_NV2A_TEX);
+            break;
+        }
+        case CAPTURE_RECORD_FRAME:
+            g_replay.frames += 1;
+            frame_done = true;
+            break;
+        default:
+            break;
+        }
+    }
+
+    qemu_mutex_unlock(&d->pgraph.lock);
+    qemu_mutex_lock(&d->pfifo.lock);
+
+    if (frame_done) {
+        d->pfifo.fifo_kick = true;
+    } else {
+        replay_finish();
+    }
+}
@@ -81,34 +81,103 @@
     _X(NV2A_PROF_CLEAR) \
     _X(NV2A_PROF_QUEUE_SUBMIT) \
     _X(NV2A_PROF_QUEUE_SUBMIT_AUX) \
+    _X(NV2A_PROF_QUEUE_SUBMIT_TRANSFER) \
+    _X(NV2A_PROF_QUEUE_SUBMIT_PRESENT) \
+    _X(NV2A_PROF_FRAME_NOWAIT) \
+    _X(NV2A_PROF_FRAME_SLOT_WAIT) \
+    _X(NV2A_PROF_MEMORY_BUDGET_TRIM) \
     _X(NV2A_PROF_PIPELINE_NOTDIRTY) \
+    _X(NV2A_PROF_PIPELINE_CACHE_HIT) \
+    _X(NV2A_PROF_PIPELINE_CACHE_MISS) \
     _X(NV2A_PROF_PIPELINE_GEN) \
+    _X(NV2A_PROF_PIPELINE_ASYNC_GEN) \
+    _X(NV2A_PROF_PIPELINE_FAST_LINK) \
+    _X(NV2A_PROF_PIPELINE_PENDING) \
+    _X(NV2A_PROF_PIPELINE_FALLBACK) \
     _X(NV2A_PROF_PIPELINE_BIND) \
     _X(NV2A_PROF_PIPELINE_RENDERPASSES) \
+    _X(NV2A_PROF_RENDERPASS_END_FINISH) \
+    _X(NV2A_PROF_RENDERPASS_END_SURFACE_CHANGE) \
+    _X(NV2A_PROF_RENDERPASS_END_FRAMEBUFFER_CHANGE) \
+    _X(NV2A_PROF_RENDERPASS_END_QUERY) \
+    _X(NV2A_PROF_RENDERPASS_END_TRANSFER) \
+    _X(NV2A_PROF_RENDERPASS_CLEAR_LOAD) \
+    _X(NV2A_PROF_RENDERPASS_DEPTH_DISCARD) \
+    _X(NV2A_PROF_RENDERPASS_RECORDED_PARALLEL) \
+    _X(NV2A_PROF_RENDERPASS_RECORD_WAIT) \
+    _X(NV2A_PROF_FIFO_BATCHED_METHOD) \
+    _X(NV2A_PROF_FIFO_LOCK_CONTENDED) \
     _X(NV2A_PROF_BEGIN_ENDS) \
     _X(NV2A_PROF_DRAW_ARRAYS) \
+    _X(NV2A_PROF_DRAW_ARRAYS_KEPT) \
     _X(NV2A_PROF_INLINE_BUFFERS) \
     _X(NV2A_PROF_INLINE_ARRAYS) \
     _X(NV2A_PROF_INLINE_ELEMENTS) \
+    _X(NV2A_PROF_INLINE_ELEMENTS_16BIT) \
+    _X(NV2A_PROF_INLINE_CACHE_HIT) \
+    _X(NV2A_PROF_INLINE_CACHE_MISS) \
+    _X(NV2A_PROF_PRIM_REWRITE_CACHE_HIT) \
+    _X(NV2A_PROF_PRIM_REWRITE_CACHE_MISS) \
+    _X(NV2A_PROF_DRAW_BATCH_MERGE) \
+    _X(NV2A_PROF_DRAW_BATCH_MULTI) \
+    _X(NV2A_PROF_DRAW_STATE_BIND_SKIPPED) \
+    _X(NV2A_PROF_DRAW_FRAMESKIP) \
     _X(NV2A_PROF_QUERY) \
+    _X(NV2A_PROF_SHADER_CACHE_HIT) \
+    _X(NV2A_PROF_SHADER_CACHE_MISS) \
     _X(NV2A_PROF_SHADER_GEN) \
+    _X(NV2A_PROF_SHADER_ASYNC_GEN) \
+    _X(NV2A_PROF_SHADER_PENDING) \
+    _X(NV2A_PROF_SHADER_MODULE_GEN) \
     _X(NV2A_PROF_SHADER_BIND) \
     _X(NV2A_PROF_SHADER_BIND_NOTDIRTY) \
     _X(NV2A_PROF_SHADER_UBO_DIRTY) \
     _X(NV2A_PROF_SHADER_UBO_NOTDIRTY) \
+    _X(NV2A_PROF_SHADER_UBO_BLOCK_REUSED) \
+    _X(NV2A_PROF_SHADER_UNIFORM_SKIPPED) \
+    _X(NV2A_PROF_DESCRIPTOR_SET_WRITE) \
+    _X(NV2A_PROF_DESCRIPTOR_SET_CACHE_HIT) \
     _X(NV2A_PROF_ATTR_BIND) \
+    _X(NV2A_PROF_TEX_CACHE_HIT) \
+    _X(NV2A_PROF_TEX_CACHE_MISS) \
     _X(NV2A_PROF_TEX_UPLOAD) \
+    _X(NV2A_PROF_TEX_UPLOAD_PARTIAL) \
+    _X(NV2A_PROF_TEX_UPLOAD_COMPUTE) \
+    _X(NV2A_PROF_TEX_UPLOAD_DISK_CACHE) \
+    _X(NV2A_PROF_TEX_UPLOAD_TRANSFER_QUEUE) \
+    _X(NV2A_PROF_TEX_UPLOAD_STREAMED) \
+    _X(NV2A_PROF_TEX_UPLOAD_REPLACEMENT) \
+    _X(NV2A_PROF_TEX_HASH_PAGES) \
+    _X(NV2A_PROF_TEX_HASH_US_UNDER_64K) \
+    _X(NV2A_PROF_TEX_HASH_US_UNDER_1M) \
+    _X(NV2A_PROF_TEX_HASH_US_OVER_1M) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_1) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_2) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_3) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4) \
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4_NOTDIRTY) \
+    _X(NV2A_PROF_GEOM_BUFFER_VERSION) \
+    _X(NV2A_PROF_STREAM_RING_WRAP) \
+    _X(NV2A_PROF_STREAM_BYTES) \
+    _X(NV2A_PROF_STREAM_FENCE_WAIT) \
+    _X(NV2A_PROF_SCRATCH_BUFFER_KB) \
+    _X(NV2A_PROF_SCRATCH_BUFFER_GROW) \
+    _X(NV2A_PROF_SCRATCH_BUFFER_SHRINK) \
     _X(NV2A_PROF_SURF_SWIZZLE) \
     _X(NV2A_PROF_SURF_CREATE) \
     _X(NV2A_PROF_SURF_DOWNLOAD) \
+    _X(NV2A_PROF_SURF_DOWNLOAD_DEFERRED) \
+    _X(NV2A_PROF_SURF_DOWNLOAD_ELIDED) \
     _X(NV2A_PROF_SURF_UPLOAD) \
+    _X(NV2A_PROF_SURF_RESCALE) \
+    _X(NV2A_PROF_SURF_DEFRAG_MOVE) \
+    _X(NV2A_PROF_SURF_TRANSIENT) \
+    _X(NV2A_PROF_SURF_TRANSIENT_MISS) \
     _X(NV2A_PROF_SURF_TO_TEX) \
     _X(NV2A_PROF_SURF_TO_TEX_FALLBACK) \
+    _X(NV2A_PROF_SURF_TO_TEX_MIPMAPS) \
+    _X(NV2A_PROF_SURF_TO_TEX_ALIAS) \
+    _X(NV2A_PROF_SURF_BLIT) \
     _X(NV2A_PROF_QUEUE_SUBMIT_1) \
     _X(NV2A_PROF_QUEUE_SUBMIT_2) \
     _X(NV2A_PROF_QUEUE_SUBMIT_3) \
@@ -122,8 +191,44 @@ enum NV2A_PROF_COUNTERS_ENUM {
     NV2A_PROF__COUNT
 };
 
+// GPU time, measured with timestamp queries. Compute dispatches may be part
+// of a surface download, so they are not included in the total.
+#define NV2A_PROF_GPU_TIMERS_XMAC \
+    _X(NV2A_PROF_GPU_RENDER_PASS) \
+    _X(NV2A_PROF_GPU_SURFACE_DOWNLOAD) \
+    _X(NV2A_PROF_GPU_DISPLAY) \
+    _X(NV2A_PROF_GPU_COMPUTE) \
+
+enum NV2A_PROF_GPU_TIMERS_ENUM {
+    #define _X(x) x,
+    NV2A_PROF_GPU_TIMERS_XMAC
+    #undef _X
+    NV2A_PROF_GPU__COUNT
+};
+
 #define NV2A_PROF_NUM_FRAMES 300
 
+// Method offsets tracked for method costs, covering 0-0x1ffc
+#define NV2A_PROF_NUM_METHODS 2048
+
+// Graphics classes tracked for method costs; further classes are ignored
+#define NV2A_PROF_NUM_METHOD_CLASSES 8
+
+typedef struct NV2AMethodCost {
+    uint64_t calls;
+    uint64_t words;
+    uint64_t sampled_calls; // Calls that were timed
+    uint64_t ns;            // Of the sampled calls
+} NV2AMethodCost;
+
+typedef struct NV2AMethodCostEntry {
+    uint32_t graphics_class;
+    unsigned int method;
+    uint64_t calls;
+    uint64_t words;
+    uint64_t ns; // Estimated for all calls
+} NV2AMethodCostEntry;
+
 typedef struct NV2AStats {
     int64_t last_flip_time;
     unsigned int frame_count;
@@ -131,8 +236,21 @@ typedef struct NV2AStats {
     struct {
         int mspf;
         int counters[NV2A_PROF__COUNT];
+        float gpu_ms[NV2A_PROF_GPU__COUNT];
+        float gpu_total_ms;
     } frame_working, frame_history[NV2A_PROF_NUM_FRAMES];
     unsigned int frame_ptr;
+    // Counted since startup and folded in at each flip, so readers on other
+    // threads only need atomic reads
+    uint64_t counter_totals[NV2A_PROF__COUNT];
+    uint64_t total_frames;
+    bool gpu_timers_enabled; // Set while the results are being shown
+    bool method_costs_enabled;
+    unsigned int method_cost_sample_interval; // Time one in this many calls
+    unsigned int method_cost_sample_count;
+    uint32_t method_cost_classes[NV2A_PROF_NUM_METHOD_CLASSES];
+    NV2AMethodCost method_costs[NV2A_PROF_NUM_METHOD_CLASSES]
+                               [NV2A_PROF_NUM_METHODS];
 } NV2AStats;
 
 #ifdef __cplusplus
@@ -143,14 +261,37 @@ extern NV2AStats g_nv2a_stats;
 
 const char *nv2a_profile_get_counter_name(unsigned int cnt);
 int nv2a_profile_get_counter_value(unsigned int cnt);
+uint64_t nv2a_profile_get_counter_total(unsigned int cnt);
+const char *nv2a_profile_get_gpu_timer_name(unsigned int timer);
+float nv2a_profile_get_gpu_time(unsigned int timer);
+float nv2a_profile_get_gpu_total_time(void);
+void nv2a_profile_add_gpu_time(unsigned int frame,
+                               enum NV2A_PROF_GPU_TIMERS_ENUM timer,
+                               float ms);
 void nv2a_profile_increment(void);
 void nv2a_profile_flip_stall(void);
+int64_t nv2a_profile_method_start(void);
+void nv2a_profile_method_cost(uint32_t graphics_class, unsigned int method,
+                              size_t num_words, int64_t start);
+size_t nv2a_profile_get_method_costs(NV2AMethodCostEntry *entries,
+                                     size_t max_entries, uint64_t *total_ns);
+void nv2a_profile_reset_method_costs(void);
+bool nv2a_profile_save_method_costs(const char *path);
+void nv2a_profile_report_method_costs(void);
+const char *pgraph_get_method_name(uint32_t graphics_class,
+                                   unsigned int method);
 
 static inline void nv2a_profile_inc_counter(enum NV2A_PROF_COUNTERS_ENUM cnt)
 {
     g_nv2a_stats.frame_working.counters[cnt] += 1;
 }
 
+static inline void nv2a_profile_add_counter(enum NV2A_PROF_COUNTERS_ENUM cnt,
+                                            int value)
+{
+    g_nv2a_stats.frame_working.counters[cnt] += value;
+}
+
 #ifdef CONFIG_RENDERDOC
 void nv2a_dbg_renderdoc_init(void);
 void *nv2a_dbg_renderdoc_get_api(void);
@@ -21,6 +21,11 @@
 
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "qemu/main-loop.h"
+#include "io/channel-buffer.h"
+#include "migration/qemu-file.h"
+#include "ui/xemu-settings.h"
+
+#define NV2A_VBLANK_INTERVAL (NANOSECONDS_PER_SECOND / 60)
 
 void nv2a_update_irq(NV2AState *d)
 {
@@ -193,16 +198,139 @@ int nv2a_get_screen_off(void)
     return g_nv2a->vga.sr[VGA_SEQ_CLOCK_MODE] & VGA_SR01_SCREEN_OFF;
 }
 
+static void nv2a_download_dirty_surfaces(NV2AState *d);
+
+static void nv2a_raise_vblank(NV2AState *d)
+{
+    d->pcrtc.pending_interrupts |= NV_PCRTC_INTR_0_VBLANK;
+    d->pcrtc.raster = 0;
+
+    nv2a_update_irq(d);
+}
+
 static void nv2a_vga_gfx_update(void *opaque)
 {
     VGACommonState *vga = opaque;
+    NV2AState *d = container_of(vga, NV2AState, vga);
+
+    // Rendered surfaces only reach VRAM when downloaded, so write them back
+    // before a screendump reads the framebuffer through the VGA path
+    if (qemu_console_dump_pending(vga->con)) {
+        nv2a_download_dirty_surfaces(d);
+    }
+
     vga->hw_ops->gfx_update(vga);
 
-    NV2AState *d = container_of(vga, NV2AState, vga);
-    d->pcrtc.pending_interrupts |= NV_PCRTC_INTR_0_VBLANK;
-    d->pcrtc.raster = 0;
+    // With the frame queue the vblank timer raises vblank instead, so the
+    // guest's flips don't wait on the host presenting
+    if (!g_config.display.frame_queue.enabled) {
+        nv2a_raise_vblank(d);
+    }
+}
 
-    nv2a_update_irq(d);
+static void nv2a_frame_queue_reset(NV2AState *d)
+{
+    qemu_mutex_lock(&d->pcrtc.frame_queue.lock);
+    d->pcrtc.frame_queue.head = 0;
+    d->pcrtc.frame_queue.count = 0;
+    d->pcrtc.frame_queue.display_start = d->pcrtc.start;
+    qemu_mutex_unlock(&d->pcrtc.frame_queue.lock);
+}
+
+/*
+ * Queue the scanout address latched at a vblank for presentation. If
+ * presentation has fallen behind, the oldest frame is dropped rather than
+ * holding up the guest.
+ */
+static void nv2a_frame_queue_push(NV2AState *d, hwaddr start)
+{
+    unsigned int depth = MIN(MAX(g_config.display.frame_queue.depth, 1),
+                             NV2A_FRAME_QUEUE_MAX_DEPTH);
+
+    qemu_mutex_lock(&d->pcrtc.frame_queue.lock);
+
+    unsigned int count = d->pcrtc.frame_queue.count;
+    hwaddr last = count ? d->pcrtc.frame_queue.starts[
+                              (d->pcrtc.frame_queue.head + count - 1) %
+                              NV2A_FRAME_QUEUE_MAX_DEPTH] :
+                          d->pcrtc.frame_queue.display_start;
+
+    // Only flips need queueing, a repeated frame would just add latency
+    if (start != last) {
+        while (d->pcrtc.frame_queue.count >= depth) {
+            d->pcrtc.frame_queue.head =
+                (d->pcrtc.frame_queue.head + 1) % NV2A_FRAME_QUEUE_MAX_DEPTH;
+            d->pcrtc.frame_queue.count--;
+        }
+        d->pcrtc.frame_queue.starts[(d->pcrtc.frame_queue.head +
+                                     d->pcrtc.frame_queue.count) %
+                                    NV2A_FRAME_QUEUE_MAX_DEPTH] = start;
+        d->pcrtc.frame_queue.count++;
+    }
+
+    qemu_mutex_unlock(&d->pcrtc.frame_queue.lock);
+}
+
+/*
+ * Move on to the next queued frame, if any. Called by the presenter once
+ * per host refresh, without the BQL.
+ */
+void nv2a_frame_queue_advance(NV2AState *d)
+{
+    qemu_mutex_lock(&d->pcrtc.frame_queue.lock);
+    if (d->pcrtc.frame_queue.count) {
+        d->pcrtc.frame_queue.display_start =
+            d->pcrtc.frame_queue.starts[d->pcrtc.frame_queue.head];
+        d->pcrtc.frame_queue.head =
+            (d->pcrtc.frame_queue.head + 1) % NV2A_FRAME_QUEUE_MAX_DEPTH;
+        d->pcrtc.frame_queue.count--;
+    }
+    qemu_mutex_unlock(&d->pcrtc.frame_queue.lock);
+}
+
+/*
+ * Get the scanout address of the frame to present.
+ */
+hwaddr nv2a_get_display_start(NV2AState *d)
+{
+    if (!g_config.display.frame_queue.enabled) {
+        return d->pcrtc.start;
+    }
+
+    qemu_mutex_lock(&d->pcrtc.frame_queue.lock);
+    hwaddr start = d->pcrtc.frame_queue.display_start;
+    qemu_mutex_unlock(&d->pcrtc.frame_queue.lock);
+
+    return start;
+}
+
+/*
+ * Emulated 60 Hz vblank, used when frames are queued. Flips complete here
+ * and the frame is handed off to the presenter.
+ */
+static void nv2a_vblank(void *opaque)
+{
+    NV2AState *d = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+
+    if (g_config.display.frame_queue.enabled) {
+        nv2a_frame_queue_push(d, d->pcrtc.start);
+        nv2a_raise_vblank(d);
+    } else {
+        nv2a_frame_queue_reset(d);
+    }
+
+    d->pcrtc.next_vblank =
+        MAX(d->pcrtc.next_vblank + NV2A_VBLANK_INTERVAL, now);
+    timer_mod(d->vblank_timer, d->pcrtc.next_vblank);
+}
+
+static void nv2a_restart_vblank(NV2AState *d)
+{
+    nv2a_frame_queue_reset(d);
+    d->pcrtc.next_vblank =
+        qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + NV2A_VBLANK_INTERVAL;
+    timer_mod(d->vblank_timer, d->pcrtc.next_vblank);
 }
 
 static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
@@ -230,6 +358,7 @@ static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
 
     memory_region_set_log(d->vram, true, DIRTY_MEMORY_NV2A);
     memory_region_set_log(d->vram, true, DIRTY_MEMORY_NV2A_TEX);
+    memory_region_set_log(&d->ramin, true, DIRTY_MEMORY_NV2A);
     memory_region_set_dirty(d->vram, 0, memory_region_size(d->vram));
 
     pgraph_init(d);
@@ -279,6 +408,16 @@ static void nv2a_unlock_fifo(NV2AState *d)
     qemu_mutex_unlock(&d->pfifo.lock);
 }
 
+static void nv2a_download_dirty_surfaces(NV2AState *d)
+{
+    nv2a_lock_fifo(d);
+    pgraph_pre_savevm_trigger(d);
+    nv2a_unlock_fifo(d);
+    bql_unlock();
+    pgraph_pre_savevm_wait(d);
+    bql_lock();
+}
+
 static void nv2a_reset(NV2AState *d)
 {
     nv2a_lock_fifo(d);
@@ -298,7 +437,9 @@ static void nv2a_reset(NV2AState *d)
     }
 
     memset(d->pfifo.regs, 0, sizeof(d->pfifo.regs));
+    pfifo_ramht_cache_flush(d);
     memset(d->pgraph.regs_, 0, sizeof(d->pgraph.regs_));
+    d->pgraph.ctx_switch_subchannel = -1;
     memset(d->pvideo.regs, 0, sizeof(d->pvideo.regs));
 
     d->pcrtc.start = 0;
@@ -328,6 +469,8 @@ static void nv2a_reset(NV2AState *d)
         d->puserdac.palette[i*3+2] = i;
     }
 
+    nv2a_restart_vblank(d);
+
     nv2a_unlock_fifo(d);
 }
 
@@ -353,9 +496,17 @@ static void nv2a_realize(PCIDevice *dev, Error **errp)
                                     &d->block_mmio[i]);
     }
 
+    // The pusher's put pointer and the timer are polled constantly, and
+    // both synchronize on their own, see user.c and ptimer.c
+    memory_region_enable_lockless_io(&d->block_mmio[NV_USER]);
+    memory_region_enable_lockless_io(&d->block_mmio[NV_PTIMER]);
+
     qemu_mutex_init(&d->pfifo.lock);
     qemu_cond_init(&d->pfifo.fifo_cond);
     qemu_cond_init(&d->pfifo.fifo_idle_cond);
+
+    qemu_mutex_init(&d->pcrtc.frame_queue.lock);
+    d->vblank_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nv2a_vblank, d);
 }
 
 static void nv2a_exitfn(PCIDevice *dev)
@@ -365,6 +516,8 @@ static void nv2a_exitfn(PCIDevice *dev)
 
     d->exiting = true;
 
+    timer_free(d->vblank_timer);
+
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
     qemu_thread_join(&d->pfifo.thread);
 
@@ -427,7 +580,17 @@ static int nv2a_pre_load(void *opaque)
 static int nv2a_post_load(void *opaque, int version_id)
 {
     NV2AState *d = opaque;
+    d->pgraph.ctx_switch_subchannel = -1;
+    pfifo_ramht_cache_flush(d);
+    pgraph_mark_vsh_constants_dirty(&d->pgraph, 0,
+                                    NV2A_VERTEXSHADER_CONSTANTS);
+
+    // Have the renderer pick up restored RAM as it is used, rather than
+    // uploading all of it before the first draw
+    memory_region_set_dirty(d->vram, 0, memory_region_size(d->vram));
+    qatomic_set(&d->pgraph.flush_discard, true);
     qatomic_set(&d->pgraph.flush_pending, true);
+    nv2a_restart_vblank(d);
     nv2a_unlock_fifo(d);
     return 0;
 }
@@ -568,6 +731,46 @@ static const VMStateDescription vmstate_nv2a = {
     },
 };
 
+/*
+ * Serialize the device state the same way snapshots do, for pushbuffer
+ * captures.
+ */
+GByteArray *nv2a_save_device_state(NV2AState *d, Error **errp)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(64 * KiB);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    GByteArray *data = NULL;
+
+    if (!vmstate_save_state(f, &vmstate_nv2a, d, NULL, errp)) {
+        if (qemu_fflush(f)) {
+            error_setg(errp, "Failed to serialize nv2a state");
+        } else {
+            data = g_byte_array_new();
+            g_byte_array_append(data, bioc->data, bioc->usage);
+        }
+    }
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return data;
+}
+
+bool nv2a_load_device_state(NV2AState *d, const uint8_t *data, size_t size,
+                            Error **errp)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(size);
+    memcpy(bioc->data, data, size);
+    bioc->usage = size;
+
+    QEMUFile *f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    int ret = vmstate_load_state(f, &vmstate_nv2a, d, vmstate_nv2a.version_id,
+                                 errp);
+
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ret == 0;
+}
+
 static void nv2a_class_init(ObjectClass *klass, const void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -21,8 +21,30 @@
 #ifndef HW_NV2A_H
 #define HW_NV2A_H
 
+typedef struct NV2AVkPresentContext NV2AVkPresentContext;
+
+typedef struct NV2APresentRequest {
+    void *window; // SDL_Window created with SDL_WINDOW_VULKAN
+    int width, height; // Drawable size, in pixels
+    bool show_framebuffer;
+    void (*overlay)(const NV2AVkPresentContext *ctx);
+} NV2APresentRequest;
+
+typedef struct NV2AMemoryStats {
+    uint64_t device_bytes; // All device memory held by the renderer
+    uint64_t texture_bytes;
+    uint64_t surface_bytes;
+    unsigned int textures;
+    unsigned int surfaces;
+    unsigned int pipelines;
+    unsigned int shader_modules;
+} NV2AMemoryStats;
+
 void nv2a_init(PCIBus *bus, int devfn, MemoryRegion *ram);
 void nv2a_context_init(void);
+#ifndef __ANDROID__
+void nv2a_context_init_headless(void);
+#endif
 #ifdef __ANDROID__
 void nv2a_android_early_context_init(void);
 bool nv2a_android_copy_readback(uint8_t **buffer, size_t *buffer_size,
@@ -30,9 +52,15 @@ bool nv2a_android_copy_readback(uint8_t **buffer, size_t *buffer_size,
 #endif
 int nv2a_get_framebuffer_surface(void);
 void nv2a_release_framebuffer_surface(void);
+bool nv2a_present_frame(const NV2APresentRequest *req);
+void nv2a_present_surface_lost(void);
 void nv2a_set_surface_scale_factor(unsigned int scale);
 unsigned int nv2a_get_surface_scale_factor(void);
+void nv2a_release_caches(bool all);
+bool nv2a_get_memory_stats(NV2AMemoryStats *stats);
 const uint8_t *nv2a_get_dac_palette(void);
 int nv2a_get_screen_off(void);
+void nv2a_capture_frames(int num_frames);
+void nv2a_replay_start(const char *path);
 
 #endif
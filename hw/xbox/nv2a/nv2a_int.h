@@ -44,6 +44,8 @@
 #include "hw/display/vga_regs.h"
 #include "hw/pci/pci.h"
 #include "cpu.h"
+#include "ui/xemu-thread-topology.h"
+#include "ui/xemu-trace.h"
 
 #include "trace.h"
 
@@ -60,6 +62,20 @@ enum FIFOEngine {
     ENGINE_DVD = 2,
 };
 
+typedef struct RAMHTEntry {
+    uint32_t handle;
+    hwaddr instance;
+    enum FIFOEngine engine;
+    unsigned int channel_id : 5;
+    bool valid;
+} RAMHTEntry;
+
+/* Direct-mapped handle lookups per channel, see ramht_lookup */
+#define RAMHT_CACHE_SIZE 16
+
+/* Completed frames waiting to be presented, see nv2a_vblank */
+#define NV2A_FRAME_QUEUE_MAX_DEPTH 8
+
 typedef struct DMAObject {
     unsigned int dma_class;
     unsigned int dma_target;
@@ -103,6 +119,11 @@ typedef struct NV2AState {
         QemuCond fifo_idle_cond;
         bool fifo_kick;
         bool halt;
+        uint32_t vram_dirty_put; // DMA_PUT when VRAM dirty bits were synced
+        struct {
+            uint32_t ramht; // NV_PFIFO_RAMHT the entries were read with
+            RAMHTEntry entries[NV2A_NUM_CHANNELS][RAMHT_CACHE_SIZE];
+        } ramht_cache;
     } pfifo;
 
     struct {
@@ -128,6 +149,14 @@ typedef struct NV2AState {
         uint32_t enabled_interrupts;
         hwaddr start;
         uint32_t raster;
+        int64_t next_vblank;
+        struct {
+            QemuMutex lock;
+            hwaddr starts[NV2A_FRAME_QUEUE_MAX_DEPTH];
+            unsigned int head;
+            unsigned int count;
+            hwaddr display_start; // Scanout address being presented
+        } frame_queue;
     } pcrtc;
 
     struct {
@@ -161,6 +190,8 @@ typedef struct NV2ABlockInfo {
 extern const NV2ABlockInfo blocktable[NV_NUM_BLOCKS];
 
 void nv2a_update_irq(NV2AState *d);
+void nv2a_frame_queue_advance(NV2AState *d);
+hwaddr nv2a_get_display_start(NV2AState *d);
 
 static inline
 void nv2a_reg_log_read(int block, hwaddr addr, unsigned int size, uint64_t val)
@@ -208,6 +239,9 @@ DEFINE_PROTO(prmdio)
 DEFINE_PROTO(user)
 #undef DEFINE_PROTO
 
+void pfifo_ramht_cache_flush(NV2AState *d);
+void pfifo_ramht_cache_sync(NV2AState *d);
+
 DMAObject nv_dma_load(NV2AState *d, hwaddr dma_obj_address);
 void *nv_dma_map(NV2AState *d, hwaddr dma_obj_address, hwaddr *len);
 
@@ -220,4 +254,19 @@ void *nv_dma_map(NV2AState *d, hwaddr dma_obj_address, hwaddr *len);
 hwaddr nv_clip_gpu_tile_blit(NV2AState *d, hwaddr blit_base_address,
                              hwaddr len);
 
+GByteArray *nv2a_save_device_state(NV2AState *d, Error **errp);
+bool nv2a_load_device_state(NV2AState *d, const uint8_t *data, size_t size,
+                            Error **errp);
+
+extern bool g_nv2a_capture_active;
+void nv2a_capture_pusher_start(NV2AState *d);
+void nv2a_capture_method(NV2AState *d, unsigned int subchannel,
+                         unsigned int method, uint32_t parameter,
+                         const uint32_t *parameters,
+                         size_t num_words_available,
+                         size_t max_lookahead_words, bool inc,
+                         size_t num_words_processed);
+bool nv2a_replay_pending(void);
+void nv2a_replay_run(NV2AState *d);
+
 #endif
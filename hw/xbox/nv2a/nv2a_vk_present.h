@@ -0,0 +1,48 @@
+/*
+ * QEMU Geforce NV2A implementation
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_NV2A_VK_PRESENT_H
+#define HW_NV2A_VK_PRESENT_H
+
+#include <vulkan/vulkan.h>
+
+/*
+ * Passed to the overlay of a present request, on the renderer thread, while
+ * the requesting thread is blocked. The overlay records its draws into
+ * command_buffer, inside render_pass, after the frame has been drawn to the
+ * swapchain image.
+ *
+ * When the renderer is finalized, the overlay is called once more with
+ * command_buffer set to VK_NULL_HANDLE and the device idle, and must release
+ * every object it created on the device.
+ */
+struct NV2AVkPresentContext {
+    VkInstance instance;
+    VkPhysicalDevice physical_device;
+    VkDevice device;
+    uint32_t queue_family;
+    VkQueue queue;
+    VkDescriptorPool descriptor_pool; // Reserved for the overlay
+    VkRenderPass render_pass;
+    uint32_t min_image_count;
+    uint32_t image_count;
+    VkCommandBuffer command_buffer;
+};
+
+#endif
@@ -20,14 +20,9 @@
  */
 
 #include "nv2a_int.h"
-
-typedef struct RAMHTEntry {
-    uint32_t handle;
-    hwaddr instance;
-    enum FIFOEngine engine;
-    unsigned int channel_id : 5;
-    bool valid;
-} RAMHTEntry;
+#ifdef __ANDROID__
+#include "ui/xemu-android-perf.h"
+#endif
 
 static void pfifo_run_pusher(NV2AState *d);
 static uint32_t ramht_hash(NV2AState *d, uint32_t handle);
@@ -146,6 +141,51 @@ static bool pfifo_puller_should_stall(NV2AState *d)
            !can_fifo_access(d);
 }
 
+static bool is_object_method(uint32_t method)
+{
+    /* TODO: Check this range is correct for the nv2a */
+    return method >= 0x180 && method < 0x200;
+}
+
+/*
+ * Hand all data words of one method header to PGRAPH without returning to
+ * the pusher between handlers. Object methods need a RAMHT lookup under the
+ * FIFO lock, so the run stops at those and when PGRAPH asks to stall.
+ */
+static ssize_t pfifo_run_method_words(NV2AState *d, unsigned int subchannel,
+                                      uint32_t method, uint32_t parameter,
+                                      uint32_t *parameters,
+                                      size_t num_words_available,
+                                      size_t max_lookahead_words, bool inc)
+{
+    uint32_t first_method = method;
+    size_t num_proc = 0;
+
+    xemu_trace_begin("pfifo method run", NULL);
+    while (true) {
+        num_proc += pgraph_method(d, subchannel, method, parameter,
+                                  parameters + num_proc,
+                                  num_words_available - num_proc,
+                                  max_lookahead_words - num_proc, inc);
+        if (num_proc >= num_words_available) {
+            break;
+        }
+
+        if (inc) {
+            method = (first_method + 4 * num_proc) & 0x1ffc;
+        }
+        if (is_object_method(method) || pgraph_method_should_stall(d)) {
+            break;
+        }
+
+        parameter = ldl_le_p(parameters + num_proc);
+        nv2a_profile_inc_counter(NV2A_PROF_FIFO_BATCHED_METHOD);
+    }
+    xemu_trace_end();
+
+    return num_proc;
+}
+
 static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
                                 uint32_t parameter, uint32_t *parameters,
                                 size_t num_words_available,
@@ -204,9 +244,8 @@ static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
     } else if (method >= 0x100) {
         // method passed to engine
 
-        /* methods that take objects.
-         * TODO: Check this range is correct for the nv2a */
-        if (method >= 0x180 && method < 0x200) {
+        /* methods that take objects */
+        if (is_object_method(method)) {
             //bql_lock();
             RAMHTEntry entry = ramht_lookup(d, parameter);
             assert(entry.valid);
@@ -224,9 +263,9 @@ static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
         qemu_mutex_lock(&d->pgraph.lock);
 
         if (can_fifo_access(d)) {
-            num_proc =
-                pgraph_method(d, subchannel, method, parameter, parameters,
-                              num_words_available, max_lookahead_words, inc);
+            num_proc = pfifo_run_method_words(d, subchannel, method, parameter,
+                                              parameters, num_words_available,
+                                              max_lookahead_words, inc);
         }
 
         qemu_mutex_unlock(&d->pgraph.lock);
@@ -260,6 +299,10 @@ static void pfifo_run_pusher(NV2AState *d)
     uint32_t *dma_dcount = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT];
     uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
 
+    if (unlikely(qatomic_read(&g_nv2a_capture_active))) {
+        nv2a_capture_pusher_start(d);
+    }
+
     if (!GET_MASK(*push0, NV_PFIFO_CACHE1_PUSH0_ACCESS) ||
         !GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS) ||
         GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_STATUS)) {
@@ -295,6 +338,16 @@ static void pfifo_run_pusher(NV2AState *d)
         uint32_t dma_get_v = *dma_get;
         uint32_t dma_put_v = *dma_put;
         if (dma_get_v == dma_put_v) break;
+
+        /*
+         * The FIFO lock is dropped while methods run, so the guest may have
+         * queued more work. It wrote whatever that work reads before moving
+         * DMA_PUT, pick those writes up before getting to it.
+         */
+        if (dma_put_v != d->pfifo.vram_dirty_put) {
+            d->pfifo.vram_dirty_put = dma_put_v;
+            pgraph_vram_dirty_sync(d);
+        }
         if (dma_get_v >= dma_len) {
             assert(false);
             SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
@@ -453,6 +506,11 @@ void *pfifo_thread(void *arg)
 {
     NV2AState *d = (NV2AState *)arg;
 
+    xemu_trace_set_thread_name("nv2a.pfifo_thread");
+    xemu_thread_topology_register(XEMU_THREAD_LATENCY, "nv2a.pfifo_thread");
+#ifdef __ANDROID__
+    xemu_android_perf_thread_started(XEMU_PERF_THREAD_PFIFO);
+#endif
     pgraph_init_thread(d);
 
     rcu_register_thread();
@@ -461,14 +519,31 @@ void *pfifo_thread(void *arg)
     while (true) {
         d->pfifo.fifo_kick = false;
 
+        /*
+         * Renderers answer VRAM dirty queries from a copy of the dirty
+         * bitmaps taken here, once per batch rather than once per query.
+         */
+        d->pfifo.vram_dirty_put = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT];
+        pgraph_vram_dirty_sync(d);
+
         pgraph_process_pending(d);
 
-        if (!d->pfifo.halt) {
+        if (nv2a_replay_pending()) {
+            nv2a_replay_run(d);
+        } else if (!d->pfifo.halt) {
             pfifo_run_pusher(d);
         }
 
         pgraph_process_pending_reports(d);
 
+        /*
+         * Surfaces created and destroyed along the way only queued their CPU
+         * access callbacks, apply them together in one exclusive section.
+         */
+        if (tcg_enabled()) {
+            mem_access_callback_commit(qemu_get_cpu(0));
+        }
+
         if (!d->pfifo.fifo_kick) {
             qemu_cond_broadcast(&d->pfifo.fifo_idle_cond);
 
@@ -509,17 +584,51 @@ static uint32_t ramht_hash(NV2AState *d, uint32_t handle)
 }
 
 
-static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
+static hwaddr ramht_get_size(NV2AState *d)
 {
-    hwaddr ramht_size =
-        1 << (GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT], NV_PFIFO_RAMHT_SIZE)+12);
+    return 1 << (GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT],
+                          NV_PFIFO_RAMHT_SIZE) + 12);
+}
+
+static hwaddr ramht_get_address(NV2AState *d)
+{
+    return GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT],
+                    NV_PFIFO_RAMHT_BASE_ADDRESS) << 12;
+}
+
+void pfifo_ramht_cache_flush(NV2AState *d)
+{
+    memset(&d->pfifo.ramht_cache, 0, sizeof(d->pfifo.ramht_cache));
+}
+
+/*
+ * RAMIN is plain RAM, so guest updates to the hash table are only seen
+ * through the dirty log. The driver has to write an entry before it can
+ * submit methods that use it, so checking as DMA_PUT moves forward is
+ * enough to never return a stale entry.
+ */
+void pfifo_ramht_cache_sync(NV2AState *d)
+{
+    hwaddr address = ramht_get_address(d);
+    hwaddr size = ramht_get_size(d);
+
+    if (address + size > memory_region_size(&d->ramin)) {
+        return;
+    }
+    if (memory_region_test_and_clear_dirty(&d->ramin, address, size,
+                                           DIRTY_MEMORY_NV2A)) {
+        pfifo_ramht_cache_flush(d);
+    }
+}
+
+static RAMHTEntry ramht_read(NV2AState *d, uint32_t handle)
+{
+    hwaddr ramht_size = ramht_get_size(d);
 
     uint32_t hash = ramht_hash(d, handle);
     assert(hash * 8 < ramht_size);
 
-    hwaddr ramht_address =
-        GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT],
-                 NV_PFIFO_RAMHT_BASE_ADDRESS) << 12;
+    hwaddr ramht_address = ramht_get_address(d);
 
     assert(ramht_address + hash * 8 < memory_region_size(&d->ramin));
 
@@ -536,3 +645,28 @@ static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
         .valid = entry_context & NV_RAMHT_STATUS,
     };
 }
+
+static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
+{
+    if (d->pfifo.ramht_cache.ramht != d->pfifo.regs[NV_PFIFO_RAMHT]) {
+        pfifo_ramht_cache_flush(d);
+        d->pfifo.ramht_cache.ramht = d->pfifo.regs[NV_PFIFO_RAMHT];
+    }
+
+    unsigned int channel_id = GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1],
+                                       NV_PFIFO_CACHE1_PUSH1_CHID);
+    unsigned int slot = (handle ^ (handle >> 16)) % RAMHT_CACHE_SIZE;
+    RAMHTEntry *cached = &d->pfifo.ramht_cache.entries[channel_id][slot];
+    if (cached->valid && cached->handle == handle) {
+        return *cached;
+    }
+
+    RAMHTEntry entry = ramht_read(d, handle);
+
+    /* Only keep entries that actually belong to the handle */
+    if (entry.valid && entry.handle == handle) {
+        *cached = entry;
+    }
+
+    return entry;
+}
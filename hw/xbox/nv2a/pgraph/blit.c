@@ -0,0 +1,574 @@
+/*
+ * QEMU Geforce NV2A 2D blit routines
+ *
+ * Copyright (c) 2012 espes
+ * Copyright (c) 2018-2024 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "blit.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLIT_ACCEL_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define BLIT_ACCEL_NEON
+#endif
+
+#ifdef BLIT_DISABLE_ACCEL
+#undef BLIT_ACCEL_X86
+#undef BLIT_ACCEL_NEON
+#endif
+
+/* Beta of 1.0 (0x7f800000) shifted down to the multiplier range */
+#define MAX_BETA_MULT 0x7f80
+
+typedef void (*BlendAndRowFunc)(const uint8_t *s, uint8_t *d,
+                                size_t width_pixels, uint32_t beta_mult);
+typedef void (*PatchAlphaRowFunc)(uint8_t *d, size_t width_pixels,
+                                  uint8_t alpha);
+typedef void (*ScaleRowFunc)(const uint8_t *s, uint8_t *d,
+                             size_t width_pixels, size_t bytes_per_pixel,
+                             unsigned int factor);
+
+static void blend_and_row(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                          uint32_t beta_mult)
+{
+    uint32_t inv_beta_mult = MAX_BETA_MULT - beta_mult;
+
+    for (size_t x = 0; x < width_pixels; x++) {
+        for (unsigned int ch = 0; ch < 3; ch++) {
+            uint32_t a = s[x * 4 + ch] * beta_mult;
+            uint32_t b = d[x * 4 + ch] * inv_beta_mult;
+            d[x * 4 + ch] = (a + b) / MAX_BETA_MULT;
+        }
+    }
+}
+
+static void patch_alpha_row(uint8_t *d, size_t width_pixels, uint8_t alpha)
+{
+    for (size_t x = 0; x < width_pixels; x++) {
+        d[x * 4 + 3] = alpha;
+    }
+}
+
+static void expand_row(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                       size_t bytes_per_pixel, unsigned int factor)
+{
+    if (bytes_per_pixel == 4) {
+        for (size_t x = 0; x < width_pixels; x++) {
+            uint32_t v;
+            memcpy(&v, s + x * 4, 4);
+            for (unsigned int i = 0; i < factor; i++) {
+                memcpy(d, &v, 4);
+                d += 4;
+            }
+        }
+    } else if (bytes_per_pixel == 2) {
+        for (size_t x = 0; x < width_pixels; x++) {
+            uint16_t v;
+            memcpy(&v, s + x * 2, 2);
+            for (unsigned int i = 0; i < factor; i++) {
+                memcpy(d, &v, 2);
+                d += 2;
+            }
+        }
+    } else {
+        for (size_t x = 0; x < width_pixels; x++) {
+            for (unsigned int i = 0; i < factor; i++) {
+                memcpy(d, s + x * bytes_per_pixel, bytes_per_pixel);
+                d += bytes_per_pixel;
+            }
+        }
+    }
+}
+
+static void shrink_row(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                       size_t bytes_per_pixel, unsigned int factor)
+{
+    if (bytes_per_pixel == 4) {
+        for (size_t x = 0; x < width_pixels; x++) {
+            memcpy(d + x * 4, s + x * 4 * factor, 4);
+        }
+    } else if (bytes_per_pixel == 2) {
+        for (size_t x = 0; x < width_pixels; x++) {
+            memcpy(d + x * 2, s + x * 2 * factor, 2);
+        }
+    } else {
+        for (size_t x = 0; x < width_pixels; x++) {
+            memcpy(d + x * bytes_per_pixel, s + x * bytes_per_pixel * factor,
+                   bytes_per_pixel);
+        }
+    }
+}
+
+/*
+ * The vector paths replace the division by MAX_BETA_MULT (255 * 128) with a
+ * shift and a fixed-point reciprocal of 255: for the largest possible sum
+ * 255 * MAX_BETA_MULT, n >> 7 is at most 65025, and below 65535
+ * n / 255 == (n + 1 + (n >> 8)) >> 8 exactly. Results are bit-identical to
+ * the scalar path.
+ */
+
+#ifdef BLIT_ACCEL_X86
+__attribute__((target("sse2")))
+static inline __m128i blend_and_channels_sse2(__m128i sd, __m128i weights)
+{
+    /* s * beta_mult + d * inv_beta_mult, per channel, in 32-bit lanes */
+    __m128i n = _mm_srli_epi32(_mm_madd_epi16(sd, weights), 7);
+    n = _mm_add_epi32(n, _mm_add_epi32(_mm_srli_epi32(n, 8),
+                                       _mm_set1_epi32(1)));
+    return _mm_srli_epi32(n, 8);
+}
+
+__attribute__((target("sse2")))
+static void blend_and_row_sse2(const uint8_t *s, uint8_t *d,
+                               size_t width_pixels, uint32_t beta_mult)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const short bm = beta_mult, inv = MAX_BETA_MULT - beta_mult;
+    /* Alpha is weighted 0:1 so it passes through unchanged */
+    const __m128i weights =
+        _mm_setr_epi16(bm, inv, bm, inv, bm, inv, 0, MAX_BETA_MULT);
+
+    size_t x = 0;
+    for (; x + 4 <= width_pixels; x += 4) {
+        __m128i sv = _mm_loadu_si128((const __m128i *)(s + x * 4));
+        __m128i dv = _mm_loadu_si128((const __m128i *)(d + x * 4));
+        __m128i s_lo = _mm_unpacklo_epi8(sv, zero);
+        __m128i s_hi = _mm_unpackhi_epi8(sv, zero);
+        __m128i d_lo = _mm_unpacklo_epi8(dv, zero);
+        __m128i d_hi = _mm_unpackhi_epi8(dv, zero);
+
+        __m128i p0 = blend_and_channels_sse2(_mm_unpacklo_epi16(s_lo, d_lo),
+                                             weights);
+        __m128i p1 = blend_and_channels_sse2(_mm_unpackhi_epi16(s_lo, d_lo),
+                                             weights);
+        __m128i p2 = blend_and_channels_sse2(_mm_unpacklo_epi16(s_hi, d_hi),
+                                             weights);
+        __m128i p3 = blend_and_channels_sse2(_mm_unpackhi_epi16(s_hi, d_hi),
+                                             weights);
+
+        __m128i out = _mm_packus_epi16(_mm_packs_epi32(p0, p1),
+                                       _mm_packs_epi32(p2, p3));
+        _mm_storeu_si128((__m128i *)(d + x * 4), out);
+    }
+
+    blend_and_row(s + x * 4, d + x * 4, width_pixels - x, beta_mult);
+}
+
+__attribute__((target("sse2")))
+static void patch_alpha_row_sse2(uint8_t *d, size_t width_pixels,
+                                 uint8_t alpha)
+{
+    const __m128i mask = _mm_set1_epi32(0xff000000);
+    const __m128i value = _mm_set1_epi32((uint32_t)alpha << 24);
+
+    size_t x = 0;
+    for (; x + 4 <= width_pixels; x += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(d + x * 4));
+        v = _mm_or_si128(_mm_andnot_si128(mask, v), value);
+        _mm_storeu_si128((__m128i *)(d + x * 4), v);
+    }
+
+    patch_alpha_row(d + x * 4, width_pixels - x, alpha);
+}
+
+__attribute__((target("sse2")))
+static void expand_row_sse2(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                            size_t bytes_per_pixel, unsigned int factor)
+{
+    size_t x = 0;
+
+    if (bytes_per_pixel == 4 && factor >= 2 && factor <= 4) {
+        for (; x + 4 <= width_pixels; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + x * 4));
+            __m128i *out = (__m128i *)(d + x * 4 * factor);
+            switch (factor) {
+            case 2:
+                _mm_storeu_si128(out, _mm_unpacklo_epi32(v, v));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(v, v));
+                break;
+            case 3:
+                _mm_storeu_si128(out,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 0, 0)));
+                _mm_storeu_si128(out + 1,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 1, 1)));
+                _mm_storeu_si128(out + 2,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 2)));
+                break;
+            case 4:
+                _mm_storeu_si128(out,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 0, 0, 0)));
+                _mm_storeu_si128(out + 1,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 1, 1, 1)));
+                _mm_storeu_si128(out + 2,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 2, 2, 2)));
+                _mm_storeu_si128(out + 3,
+                                 _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 3, 3, 3)));
+                break;
+            }
+        }
+    } else if (bytes_per_pixel == 2 && (factor == 2 || factor == 4)) {
+        for (; x + 8 <= width_pixels; x += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + x * 2));
+            __m128i *out = (__m128i *)(d + x * 2 * factor);
+            __m128i lo = _mm_unpacklo_epi16(v, v);
+            __m128i hi = _mm_unpackhi_epi16(v, v);
+            if (factor == 2) {
+                _mm_storeu_si128(out, lo);
+                _mm_storeu_si128(out + 1, hi);
+            } else {
+                _mm_storeu_si128(out, _mm_unpacklo_epi32(lo, lo));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(lo, lo));
+                _mm_storeu_si128(out + 2, _mm_unpacklo_epi32(hi, hi));
+                _mm_storeu_si128(out + 3, _mm_unpackhi_epi32(hi, hi));
+            }
+        }
+    }
+
+    expand_row(s + x * bytes_per_pixel, d + x * bytes_per_pixel * factor,
+               width_pixels - x, bytes_per_pixel, factor);
+}
+
+__attribute__((target("sse2")))
+static void shrink_row_sse2(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                            size_t bytes_per_pixel, unsigned int factor)
+{
+    size_t x = 0;
+
+    if (bytes_per_pixel == 4 && factor >= 2 && factor <= 4) {
+        for (; x + 4 <= width_pixels; x += 4) {
+            const __m128i *in = (const __m128i *)(s + x * 4 * factor);
+            __m128i a = _mm_loadu_si128(in);
+            __m128i b = _mm_loadu_si128(in + 1);
+            __m128i out;
+            switch (factor) {
+            case 2:
+                out = _mm_castps_si128(
+                    _mm_shuffle_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b),
+                                   _MM_SHUFFLE(2, 0, 2, 0)));
+                break;
+            case 3: {
+                /* Pixels 0, 3 from a, then 6 and 9 gathered from b and c */
+                __m128i c = _mm_loadu_si128(in + 2);
+                __m128 t = _mm_shuffle_ps(_mm_castsi128_ps(b),
+                                          _mm_castsi128_ps(c),
+                                          _MM_SHUFFLE(1, 1, 2, 2));
+                out = _mm_castps_si128(_mm_shuffle_ps(
+                    _mm_castsi128_ps(a), t, _MM_SHUFFLE(2, 0, 3, 0)));
+                break;
+            }
+            default: {
+                __m128i c = _mm_loadu_si128(in + 2);
+                __m128i e = _mm_loadu_si128(in + 3);
+                out = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a, b),
+                                         _mm_unpacklo_epi32(c, e));
+                break;
+            }
+            }
+            _mm_storeu_si128((__m128i *)(d + x * 4), out);
+        }
+    } else if (bytes_per_pixel == 2 && factor == 2) {
+        for (; x + 8 <= width_pixels; x += 8) {
+            const __m128i *in = (const __m128i *)(s + x * 4);
+            /* Sign extending the even pixels lets them pack back exactly */
+            __m128i a = _mm_srai_epi32(
+                _mm_slli_epi32(_mm_loadu_si128(in), 16), 16);
+            __m128i b = _mm_srai_epi32(
+                _mm_slli_epi32(_mm_loadu_si128(in + 1), 16), 16);
+            _mm_storeu_si128((__m128i *)(d + x * 2), _mm_packs_epi32(a, b));
+        }
+    }
+
+    shrink_row(s + x * bytes_per_pixel * factor, d + x * bytes_per_pixel,
+               width_pixels - x, bytes_per_pixel, factor);
+}
+#endif
+
+#ifdef BLIT_ACCEL_NEON
+static void blend_and_row_neon(const uint8_t *s, uint8_t *d,
+                               size_t width_pixels, uint32_t beta_mult)
+{
+    const uint16_t bm = beta_mult, inv = MAX_BETA_MULT - beta_mult;
+    const uint16x8_t one = vdupq_n_u16(1);
+
+    size_t x = 0;
+    for (; x + 8 <= width_pixels; x += 8) {
+        uint8x8x4_t sv = vld4_u8(s + x * 4);
+        uint8x8x4_t dv = vld4_u8(d + x * 4);
+
+        for (int ch = 0; ch < 3; ch++) {
+            uint16x8_t s16 = vmovl_u8(sv.val[ch]);
+            uint16x8_t d16 = vmovl_u8(dv.val[ch]);
+            uint32x4_t lo = vmull_n_u16(vget_low_u16(s16), bm);
+            uint32x4_t hi = vmull_n_u16(vget_high_u16(s16), bm);
+            lo = vmlal_n_u16(lo, vget_low_u16(d16), inv);
+            hi = vmlal_n_u16(hi, vget_high_u16(d16), inv);
+
+            uint16x8_t n = vcombine_u16(vshrn_n_u32(lo, 7),
+                                        vshrn_n_u32(hi, 7));
+            n = vaddq_u16(n, vaddq_u16(vshrq_n_u16(n, 8), one));
+            dv.val[ch] = vshrn_n_u16(n, 8);
+        }
+
+        vst4_u8(d + x * 4, dv);
+    }
+
+    blend_and_row(s + x * 4, d + x * 4, width_pixels - x, beta_mult);
+}
+
+static void patch_alpha_row_neon(uint8_t *d, size_t width_pixels,
+                                 uint8_t alpha)
+{
+    const uint32x4_t mask = vdupq_n_u32(0xff000000);
+    const uint32x4_t value = vdupq_n_u32((uint32_t)alpha << 24);
+
+    size_t x = 0;
+    for (; x + 4 <= width_pixels; x += 4) {
+        uint32x4_t v = vld1q_u32((const uint32_t *)(d + x * 4));
+        vst1q_u32((uint32_t *)(d + x * 4), vbslq_u32(mask, value, v));
+    }
+
+    patch_alpha_row(d + x * 4, width_pixels - x, alpha);
+}
+
+/* The interleaving loads and stores repeat or drop pixels in one step */
+static void expand_row_neon(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                            size_t bytes_per_pixel, unsigned int factor)
+{
+    size_t x = 0;
+
+    if (bytes_per_pixel == 4 && factor >= 2 && factor <= 4) {
+        for (; x + 4 <= width_pixels; x += 4) {
+            uint32x4_t v = vld1q_u32((const uint32_t *)(s + x * 4));
+            uint32_t *out = (uint32_t *)(d + x * 4 * factor);
+            switch (factor) {
+            case 2:
+                vst2q_u32(out, (uint32x4x2_t){ { v, v } });
+                break;
+            case 3:
+                vst3q_u32(out, (uint32x4x3_t){ { v, v, v } });
+                break;
+            case 4:
+                vst4q_u32(out, (uint32x4x4_t){ { v, v, v, v } });
+                break;
+            }
+        }
+    } else if (bytes_per_pixel == 2 && factor >= 2 && factor <= 4) {
+        for (; x + 8 <= width_pixels; x += 8) {
+            uint16x8_t v = vld1q_u16((const uint16_t *)(s + x * 2));
+            uint16_t *out = (uint16_t *)(d + x * 2 * factor);
+            switch (factor) {
+            case 2:
+                vst2q_u16(out, (uint16x8x2_t){ { v, v } });
+                break;
+            case 3:
+                vst3q_u16(out, (uint16x8x3_t){ { v, v, v } });
+                break;
+            case 4:
+                vst4q_u16(out, (uint16x8x4_t){ { v, v, v, v } });
+                break;
+            }
+        }
+    }
+
+    expand_row(s + x * bytes_per_pixel, d + x * bytes_per_pixel * factor,
+               width_pixels - x, bytes_per_pixel, factor);
+}
+
+static void shrink_row_neon(const uint8_t *s, uint8_t *d, size_t width_pixels,
+                            size_t bytes_per_pixel, unsigned int factor)
+{
+    size_t x = 0;
+
+    if (bytes_per_pixel == 4 && factor >= 2 && factor <= 4) {
+        for (; x + 4 <= width_pixels; x += 4) {
+            const uint32_t *in = (const uint32_t *)(s + x * 4 * factor);
+            uint32x4_t v;
+            switch (factor) {
+            case 2:
+                v = vld2q_u32(in).val[0];
+                break;
+            case 3:
+                v = vld3q_u32(in).val[0];
+                break;
+            default:
+                v = vld4q_u32(in).val[0];
+                break;
+            }
+            vst1q_u32((uint32_t *)(d + x * 4), v);
+        }
+    } else if (bytes_per_pixel == 2 && factor >= 2 && factor <= 4) {
+        for (; x + 8 <= width_pixels; x += 8) {
+            const uint16_t *in = (const uint16_t *)(s + x * 2 * factor);
+            uint16x8_t v;
+            switch (factor) {
+            case 2:
+                v = vld2q_u16(in).val[0];
+                break;
+            case 3:
+                v = vld3q_u16(in).val[0];
+                break;
+            default:
+                v = vld4q_u16(in).val[0];
+                break;
+            }
+            vst1q_u16((uint16_t *)(d + x * 2), v);
+        }
+    }
+
+    shrink_row(s + x * bytes_per_pixel * factor, d + x * bytes_per_pixel,
+               width_pixels - x, bytes_per_pixel, factor);
+}
+#endif
+
+static BlendAndRowFunc blend_and_row_accel = blend_and_row;
+static PatchAlphaRowFunc patch_alpha_row_accel = patch_alpha_row;
+static ScaleRowFunc expand_row_accel = expand_row;
+static ScaleRowFunc shrink_row_accel = shrink_row;
+
+static void __attribute__((constructor)) init_blit_accel(void)
+{
+#ifdef BLIT_ACCEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        blend_and_row_accel = blend_and_row_sse2;
+        patch_alpha_row_accel = patch_alpha_row_sse2;
+        expand_row_accel = expand_row_sse2;
+        shrink_row_accel = shrink_row_sse2;
+    }
+#endif
+#ifdef BLIT_ACCEL_NEON
+    /* Advanced SIMD is mandatory on AArch64 */
+    blend_and_row_accel = blend_and_row_neon;
+    patch_alpha_row_accel = patch_alpha_row_neon;
+    expand_row_accel = expand_row_neon;
+    shrink_row_accel = shrink_row_neon;
+#endif
+}
+
+void blit_copy(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_bytes,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch)
+{
+    /*
+     * Packed rows are moved in one go, unless that would change the result
+     * of copying overlapping rows one after another.
+     */
+    size_t size = width_bytes * height;
+    if (source_pitch == width_bytes && dest_pitch == width_bytes &&
+        (source + size <= dest || dest + size <= source)) {
+        memcpy(dest, source, size);
+        return;
+    }
+
+    for (size_t y = 0; y < height; y++) {
+        memmove(dest, source, width_bytes);
+        source += source_pitch;
+        dest += dest_pitch;
+    }
+}
+
+void blit_blend_and(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch,
+    uint32_t beta)
+{
+    uint32_t beta_mult = beta >> 16;
+    size_t width_bytes = width_pixels * 4;
+
+    for (size_t y = 0; y < height; y++) {
+        /*
+         * Rows that partially overlap must be blended a pixel at a time in
+         * order, as the scalar loop would see its own earlier writes.
+         */
+        bool overlaps = source != dest && source < dest + width_bytes &&
+                        dest < source + width_bytes;
+        if (overlaps) {
+            blend_and_row(source, dest, width_pixels, beta_mult);
+        } else {
+            blend_and_row_accel(source, dest, width_pixels, beta_mult);
+        }
+        source += source_pitch;
+        dest += dest_pitch;
+    }
+}
+
+void blit_patch_alpha(
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t dest_pitch,
+    uint8_t alpha)
+{
+    for (size_t y = 0; y < height; y++) {
+        patch_alpha_row_accel(dest, width_pixels, alpha);
+        dest += dest_pitch;
+    }
+}
+
+void blit_expand(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch,
+    size_t bytes_per_pixel,
+    unsigned int factor)
+{
+    size_t row_bytes = width_pixels * bytes_per_pixel * factor;
+
+    for (size_t y = 0; y < height; y++) {
+        expand_row_accel(source, dest, width_pixels, bytes_per_pixel, factor);
+        /* The other rows of the block repeat the first */
+        for (unsigned int i = 1; i < factor; i++) {
+            memcpy(dest + i * dest_pitch, dest, row_bytes);
+        }
+        source += source_pitch;
+        dest += dest_pitch * factor;
+    }
+}
+
+void blit_shrink(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch,
+    size_t bytes_per_pixel,
+    unsigned int factor)
+{
+    for (size_t y = 0; y < height; y++) {
+        shrink_row_accel(source, dest, width_pixels, bytes_per_pixel, factor);
+        source += source_pitch * factor;
+        dest += dest_pitch;
+    }
+}
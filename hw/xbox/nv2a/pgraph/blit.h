@@ -0,0 +1,88 @@
+/*
+ * QEMU Geforce NV2A 2D blit routines
+ *
+ * Copyright (c) 2012 espes
+ * Copyright (c) 2018-2024 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_BLIT_H
+#define HW_XBOX_NV2A_PGRAPH_BLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* NV09F_SET_OPERATION_SRCCOPY: copy rows, source and dest may overlap */
+void blit_copy(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_bytes,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch);
+
+/*
+ * NV09F_SET_OPERATION_BLEND_AND: blend the color channels of 32-bit source
+ * pixels over dest by the 1.31 fixed-point beta. Dest alpha is kept.
+ */
+void blit_blend_and(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch,
+    uint32_t beta);
+
+/* Overwrite the alpha channel of 32-bit pixels */
+void blit_patch_alpha(
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t dest_pitch,
+    uint8_t alpha);
+
+/*
+ * Scale an image up by an integer factor, repeating each source pixel into a
+ * factor x factor block of dest. dest_pitch is the pitch of one scaled row.
+ * Source and dest must not overlap.
+ */
+void blit_expand(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch,
+    size_t bytes_per_pixel,
+    unsigned int factor);
+
+/*
+ * Scale an image down by an integer factor, keeping the top-left pixel of
+ * each factor x factor block of source. width_pixels and height are those of
+ * dest, source_pitch is the pitch of one scaled row. Source and dest must not
+ * overlap.
+ */
+void blit_shrink(
+    const uint8_t *source,
+    uint8_t *dest,
+    size_t width_pixels,
+    size_t height,
+    size_t source_pitch,
+    size_t dest_pitch,
+    size_t bytes_per_pixel,
+    unsigned int factor);
+
+#endif
@@ -20,6 +20,7 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/blit.h"
 #include "renderer.h"
 
 static void perform_blit(int operation, uint8_t *source, uint8_t *dest,
@@ -28,47 +29,16 @@ static void perform_blit(int operation, uint8_t *source, uint8_t *dest,
                          BetaState *beta)
 {
     if (operation == NV09F_SET_OPERATION_SRCCOPY) {
-        for (unsigned int y = 0; y < height; y++) {
-            memmove(dest, source, width_bytes);
-            source += source_pitch;
-            dest += dest_pitch;
-        }
+        blit_copy(source, dest, width_bytes, height, source_pitch, dest_pitch);
     } else if (operation == NV09F_SET_OPERATION_BLEND_AND) {
-        uint32_t max_beta_mult = 0x7f80;
-        uint32_t beta_mult = beta->beta >> 16;
-        uint32_t inv_beta_mult = max_beta_mult - beta_mult;
-
-        for (unsigned int y = 0; y < height; y++) {
-            uint8_t *s = source;
-            uint8_t *d = dest;
-            for (unsigned int x = 0; x < width; x++) {
-                for (unsigned int ch = 0; ch < 3; ch++) {
-                    uint32_t a = s[x * 4 + ch] * beta_mult;
-                    uint32_t b = d[x * 4 + ch] * inv_beta_mult;
-                    d[x * 4 + ch] = (a + b) / max_beta_mult;
-                }
-            }
-            source += source_pitch;
-            dest += dest_pitch;
-        }
+        blit_blend_and(source, dest, width, height, source_pitch, dest_pitch,
+                       beta->beta);
     } else {
         fprintf(stderr, "Unknown blit operation: 0x%x\n", operation);
         assert(false && "Unknown blit operation");
     }
 }
 
-static void patch_alpha(uint8_t *dest, size_t width_pixels, size_t height,
-                        size_t dest_pitch, uint8_t alpha_val)
-{
-    for (unsigned int y = 0; y < height; y++) {
-        uint8_t *d = dest;
-        for (unsigned int x = 0; x < width_pixels; x++) {
-            d[x * 4 + 3] = alpha_val;
-        }
-        dest += dest_pitch;
-    }
-}
-
 void pgraph_gl_image_blit(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -204,20 +174,20 @@ void pgraph_gl_image_blit(NV2AState *d)
 
     if (needs_alpha_patching) {
         if (adjusted_height > 0) {
-            patch_alpha(dest_row, row_pixels, adjusted_height,
-                        context_surfaces->dest_pitch, alpha_override);
+            blit_patch_alpha(dest_row, row_pixels, adjusted_height,
+                             context_surfaces->dest_pitch, alpha_override);
         }
 
         if (leftover_bytes > 0) {
             uint8_t *dest =
                 dest_row + adjusted_height * context_surfaces->dest_pitch;
-            patch_alpha(dest, leftover_bytes / 4, 1, 0, alpha_override);
+            blit_patch_alpha(dest, leftover_bytes / 4, 1, 0, alpha_override);
         }
     }
 
     dest_addr += dest_offset;
     memory_region_set_client_dirty(d->vram, dest_addr, clipped_dest_size,
                                    DIRTY_MEMORY_VGA);
-    memory_region_set_client_dirty(d->vram, dest_addr, clipped_dest_size,
-                                   DIRTY_MEMORY_NV2A_TEX);
+    pgraph_vram_set_dirty(d, dest_addr, clipped_dest_size,
+                          DIRTY_MEMORY_NV2A_TEX);
 }
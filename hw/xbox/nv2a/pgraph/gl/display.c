@@ -254,6 +254,28 @@ void pgraph_gl_init_display(NV2AState *d)
         "uniform bool clip_enable;\n"
         "uniform vec4 clip_rect;\n"
         "layout(location = 0) out vec4 out_Color;\n"
+        // Each pvideo texel holds a pair of pixels as Y0, Cb, Y1, Cr
+        "vec3 pvideo_fetch(ivec2 p)\n"
+        "{\n"
+        "    ivec2 size = textureSize(pvideo_tex, 0) * ivec2(2, 1);\n"
+        "    p = clamp(p, ivec2(0), size - 1);\n"
+        "    vec4 texel = texelFetch(pvideo_tex, ivec2(p.x / 2, p.y), 0);\n"
+        "    vec3 ycbcr = vec3((p.x & 1) != 0 ? texel.b : texel.r, texel.ga)\n"
+        "                 - vec3(16.0, 128.0, 128.0) / 255.0;\n"
+        "    const mat3 bt601 = mat3(1.1640625, 1.1640625, 1.1640625,\n"
+        "                            0.0, -0.390625, 2.015625,\n"
+        "                            1.59765625, -0.8125, 0.0);\n"
+        "    return clamp(bt601 * ycbcr, 0.0, 1.0);\n"
+        "}\n"
+        "vec3 pvideo_sample(vec2 pos)\n"
+        "{\n"
+        "    pos -= 0.5;\n"
+        "    ivec2 p = ivec2(floor(pos));\n"
+        "    vec2 f = fract(pos);\n"
+        "    return mix(mix(pvideo_fetch(p), pvideo_fetch(p + ivec2(1, 0)), f.x),\n"
+        "               mix(pvideo_fetch(p + ivec2(0, 1)), pvideo_fetch(p + ivec2(1, 1)), f.x),\n"
+        "               f.y);\n"
+        "}\n"
         "void main()\n"
         "{\n"
         "    vec2 uv = gl_FragCoord.xy/display_size;\n"
@@ -275,9 +297,9 @@ void pgraph_gl_init_display(NV2AState *d)
         "                           greaterThan(screenCoord, output_region.zw));\n"
         "        if (!any(clip) && (!pvideo_color_key_enable || out_Color.rgb == pvideo_color_key)) {\n"
         "            vec2 out_xy = (screenCoord - pvideo_pos.xy) * pvideo_scale.z;\n"
-        "            vec2 in_st = (pvideo_in_pos + out_xy * pvideo_scale.xy) / vec2(textureSize(pvideo_tex, 0));\n"
-        "            in_st.y *= -1.0;\n"
-        "            out_Color.rgba = texture(pvideo_tex, in_st);\n"
+        "            vec2 in_xy = pvideo_in_pos + out_xy * pvideo_scale.xy;\n"
+        "            in_xy.y = float(textureSize(pvideo_tex, 0).y) - in_xy.y;\n"
+        "            out_Color.rgba = vec4(pvideo_sample(in_xy), 1.0);\n"
         "        }\n"
         "    }\n"
         "}\n";
@@ -339,23 +361,31 @@ void pgraph_gl_finalize_display(PGRAPHState *pg)
     glo_set_current(g_nv2a_context_render);
 }
 
-static uint8_t *convert_texture_data__CR8YB8CB8YA8(const uint8_t *data,
-                                                   unsigned int width,
-                                                   unsigned int height,
-                                                   unsigned int pitch)
+/*
+ * Upload packed CR8YB8CB8YA8 data as is, one RGBA texel per pair of pixels.
+ * It is converted to RGB by the display shader.
+ */
+static void upload_pvideo_texture(const uint8_t *data, unsigned int width,
+                                  unsigned int height, unsigned int pitch)
 {
-    uint8_t *converted_data = (uint8_t *)g_malloc(width * height * 4);
-    int x, y;
-    for (y = 0; y < height; y++) {
-        const uint8_t *line = &data[y * pitch];
-        const uint32_t row_offset = y * width;
-        for (x = 0; x < width; x++) {
-            uint8_t *pixel = &converted_data[(row_offset + x) * 4];
-            convert_yuy2_to_rgb(line, x, &pixel[0], &pixel[1], &pixel[2]);
-            pixel[3] = 255;
-        }
+    unsigned int tex_width = (width + 1) / 2;
+
+    if (pitch % 4 == 0) {
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, height, 0, GL_RGBA,
+                     GL_UNSIGNED_BYTE, data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        return;
+    }
+
+    size_t row_size = tex_width * 4;
+    uint8_t *packed = g_malloc0(row_size * height);
+    for (int y = 0; y < height; y++) {
+        memcpy(packed + y * row_size, data + y * pitch, MIN(row_size, pitch));
     }
-    return converted_data;
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, tex_width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, packed);
+    g_free(packed);
 }
 
 static float pvideo_calculate_scale(unsigned int din_dout,
@@ -466,12 +496,10 @@ static void render_display_pvideo_overlay(NV2AState *d)
     glBindTexture(GL_TEXTURE_2D, r->disp_rndr.pvideo_tex);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    uint8_t *tex_rgba = convert_texture_data__CR8YB8CB8YA8(
-        d->vram_ptr + base + offset, in_width, in_height, in_pitch);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, in_width, in_height, 0, GL_RGBA,
-                 GL_UNSIGNED_BYTE, tex_rgba);
-    g_free(tex_rgba);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    upload_pvideo_texture(d->vram_ptr + base + offset, in_width, in_height,
+                          in_pitch);
     glUniform1i(r->disp_rndr.pvideo_tex_loc, 1);
     glUniform2f(r->disp_rndr.pvideo_in_pos_loc, in_s / 16.f, in_t / 8.f);
     glUniform4f(r->disp_rndr.pvideo_pos_loc,
@@ -653,6 +681,17 @@ static void gl_fence(void)
     glDeleteSync(fence);
 }
 
+static void render_display_timed(NV2AState *d, SurfaceBinding *surface)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+    GpuTimerQueries *q = &r->gpu_timer.display;
+
+    pgraph_gl_gpu_timer_resolve(r, q);
+    int timer_pair = pgraph_gl_gpu_timer_begin(r, q, NV2A_PROF_GPU_DISPLAY);
+    render_display(d, surface);
+    pgraph_gl_gpu_timer_end(r, q, timer_pair);
+}
+
 void pgraph_gl_sync(NV2AState *d)
 {
     VGADisplayParams vga_display_params;
@@ -667,7 +706,7 @@ void pgraph_gl_sync(NV2AState *d)
     }
 
     SurfaceBinding *surface =
-        pgraph_gl_surface_get_within(d, d->pcrtc.start + vga_display_params.line_offset);
+        pgraph_gl_surface_get_within(d, nv2a_get_display_start(d) + vga_display_params.line_offset);
     if (surface == NULL || !surface->color || !surface->width || !surface->height) {
         qemu_event_set(&d->pgraph.sync_complete);
         return;
@@ -697,13 +736,13 @@ void pgraph_gl_sync(NV2AState *d)
     /* Render framebuffer */
 #ifdef __ANDROID__
     glo_set_current(g_nv2a_context_render);
-    render_display(d, surface);
+    render_display_timed(d, surface);
     gl_fence();
     GL_ASSERT_NO_ERROR("pgraph_gl_sync: render fence");
 #else
     /* Render framebuffer in display context */
     glo_set_current(g_nv2a_context_display);
-    render_display(d, surface);
+    render_display_timed(d, surface);
     gl_fence();
     GL_ASSERT_NO_ERROR("pgraph_gl_sync: render fence");
 
@@ -734,7 +773,7 @@ int pgraph_gl_get_framebuffer_surface(NV2AState *d)
     }
 
     SurfaceBinding *surface = pgraph_gl_surface_get_within(
-        d, d->pcrtc.start + vga_display_params.line_offset);
+        d, nv2a_get_display_start(d) + vga_display_params.line_offset);
     if (surface == NULL || !surface->color) {
         qemu_mutex_unlock(&d->pfifo.lock);
         return 0;
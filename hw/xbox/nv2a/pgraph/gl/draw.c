@@ -370,7 +370,10 @@ void pgraph_gl_draw_end(NV2AState *d)
         return;
     }
 
+    int timer_pair = pgraph_gl_gpu_timer_begin(r, &r->gpu_timer.render,
+                                               NV2A_PROF_GPU_RENDER_PASS);
     pgraph_gl_flush_draw(d);
+    pgraph_gl_gpu_timer_end(r, &r->gpu_timer.render, timer_pair);
 
     /* End of visibility testing */
     if (pg->zpass_pixel_count_enable) {
@@ -392,6 +395,50 @@ void pgraph_gl_draw_end(NV2AState *d)
     NV2A_GL_DGROUP_END();
 }
 
+static void draw_streamed_indices(PGRAPHGLState *r, const uint32_t *indices,
+                                  unsigned int count)
+{
+    StreamAlloc alloc =
+        pgraph_gl_stream_upload(r, indices, count * sizeof(uint32_t),
+                                sizeof(uint32_t));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, alloc.buffer);
+    glDrawElements(r->shader_binding->gl_primitive_mode, count,
+                   GL_UNSIGNED_INT, (void *)alloc.offset);
+}
+
+/*
+ * Drop the draw if its program is still linking in the background. Called
+ * once vertex attributes are bound, so the inline attribute values they
+ * carry over to later draws are still updated.
+ */
+static bool skip_draw_if_shader_pending(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    if (r->shader_binding->initialized) {
+        return false;
+    }
+
+    NV2A_GL_DPRINTF(false, "Skipping draw, shader pending");
+    nv2a_profile_inc_counter(NV2A_PROF_SHADER_PENDING);
+
+    if (!pg->inline_buffer_length) {
+        return true;
+    }
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        VertexAttribute *attr = &pg->vertex_attributes[i];
+        if (attr->inline_buffer_populated) {
+            attr->inline_buffer_populated = false;
+            memcpy(attr->inline_value,
+                   attr->inline_buffer + (pg->inline_buffer_length - 1) * 4,
+                   sizeof(attr->inline_value));
+        }
+    }
+
+    return true;
+}
+
 void pgraph_gl_flush_draw(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -418,7 +465,6 @@ void pgraph_gl_flush_draw(NV2AState *d)
     if (pg->draw_arrays_length) {
         NV2A_GL_DPRINTF(false, "Draw Arrays");
         nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS);
-        assert(pg->inline_elements_length == 0);
         assert(pg->inline_buffer_length == 0);
         assert(pg->inline_array_length == 0);
 
@@ -426,24 +472,30 @@ void pgraph_gl_flush_draw(NV2AState *d)
                                       pg->draw_arrays_max_count - 1,
                                       false, 0,
                                       pg->draw_arrays_max_count - 1);
+        if (skip_draw_if_shader_pending(pg)) {
+            return;
+        }
 
         PrimRewrite prim_rw = pgraph_prim_rewrite_ranges(
             &r->prim_rewrite_buf, assembly, pg->draw_arrays_start,
             pg->draw_arrays_count, pg->draw_arrays_length);
 
         if (prim_rw.num_indices > 0) {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->gl_prim_rewrite_buffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         prim_rw.num_indices * sizeof(uint32_t),
-                         prim_rw.indices, GL_STREAM_DRAW);
-            glDrawElements(r->shader_binding->gl_primitive_mode,
-                           prim_rw.num_indices, GL_UNSIGNED_INT, (void *)0);
+            draw_streamed_indices(r, prim_rw.indices, prim_rw.num_indices);
         } else {
             glMultiDrawArrays(r->shader_binding->gl_primitive_mode,
                               pg->draw_arrays_start, pg->draw_arrays_count,
                               pg->draw_arrays_length);
         }
-    } else if (pg->inline_elements_length) {
+
+        // Elements following the ranges in the batch are drawn after them,
+        // see pgraph_expand_draw_arrays
+        if (!pg->inline_elements_length) {
+            return;
+        }
+    }
+
+    if (pg->inline_elements_length) {
         NV2A_GL_DPRINTF(false, "Inline Elements");
         nv2a_profile_inc_counter(NV2A_PROF_INLINE_ELEMENTS);
         assert(pg->inline_buffer_length == 0);
@@ -469,14 +521,12 @@ void pgraph_gl_flush_draw(NV2AState *d)
         pgraph_gl_bind_vertex_attributes(
                 d, min_element, max_element, false, 0,
                 draw_indices[draw_index_count - 1]);
+        if (skip_draw_if_shader_pending(pg)) {
+            return;
+        }
 
         if (prim_rw.num_indices > 0) {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->gl_prim_rewrite_buffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         draw_index_count * sizeof(uint32_t), draw_indices,
-                         GL_STREAM_DRAW);
-            glDrawElements(r->shader_binding->gl_primitive_mode,
-                           draw_index_count, GL_UNSIGNED_INT, (void *)0);
+            draw_streamed_indices(r, draw_indices, draw_index_count);
         } else {
             VertexKey k;
             memset(&k, 0, sizeof(VertexKey));
@@ -512,16 +562,21 @@ void pgraph_gl_flush_draw(NV2AState *d)
             pg->compressed_attrs = 0;
             pgraph_gl_bind_shaders(pg);
         }
+        if (skip_draw_if_shader_pending(pg)) {
+            return;
+        }
 
         for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
             VertexAttribute *attr = &pg->vertex_attributes[i];
             if (attr->inline_buffer_populated) {
                 nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_3);
-                glBindBuffer(GL_ARRAY_BUFFER, r->gl_inline_buffer[i]);
-                glBufferData(GL_ARRAY_BUFFER,
-                             pg->inline_buffer_length * sizeof(float) * 4,
-                             attr->inline_buffer, GL_STREAM_DRAW);
-                glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, 0, 0);
+                StreamAlloc alloc = pgraph_gl_stream_upload(
+                    r, attr->inline_buffer,
+                    pg->inline_buffer_length * sizeof(float) * 4,
+                    sizeof(float));
+                glBindBuffer(GL_ARRAY_BUFFER, alloc.buffer);
+                glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, 0,
+                                      (void *)alloc.offset);
                 glEnableVertexAttribArray(i);
                 attr->inline_buffer_populated = false;
                 memcpy(attr->inline_value,
@@ -537,12 +592,7 @@ void pgraph_gl_flush_draw(NV2AState *d)
             &r->prim_rewrite_buf, assembly, 0, pg->inline_buffer_length);
 
         if (prim_rw.num_indices > 0) {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->gl_prim_rewrite_buffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         prim_rw.num_indices * sizeof(uint32_t),
-                         prim_rw.indices, GL_STREAM_DRAW);
-            glDrawElements(r->shader_binding->gl_primitive_mode,
-                           prim_rw.num_indices, GL_UNSIGNED_INT, (void *)0);
+            draw_streamed_indices(r, prim_rw.indices, prim_rw.num_indices);
         } else {
             glDrawArrays(r->shader_binding->gl_primitive_mode,
                          0, pg->inline_buffer_length);
@@ -552,17 +602,15 @@ void pgraph_gl_flush_draw(NV2AState *d)
         nv2a_profile_inc_counter(NV2A_PROF_INLINE_ARRAYS);
 
         unsigned int index_count = pgraph_gl_bind_inline_array(d);
+        if (skip_draw_if_shader_pending(pg)) {
+            return;
+        }
 
         PrimRewrite prim_rw = pgraph_prim_rewrite_sequential(
             &r->prim_rewrite_buf, assembly, 0, index_count);
 
         if (prim_rw.num_indices > 0) {
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, r->gl_prim_rewrite_buffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         prim_rw.num_indices * sizeof(uint32_t),
-                         prim_rw.indices, GL_STREAM_DRAW);
-            glDrawElements(r->shader_binding->gl_primitive_mode,
-                           prim_rw.num_indices, GL_UNSIGNED_INT, (void *)0);
+            draw_streamed_indices(r, prim_rw.indices, prim_rw.num_indices);
         } else {
             glDrawArrays(r->shader_binding->gl_primitive_mode,
                          0, index_count);
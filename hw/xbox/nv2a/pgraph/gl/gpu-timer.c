@@ -0,0 +1,118 @@
+/*
+ * Geforce NV2A PGRAPH OpenGL Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "renderer.h"
+
+/*
+ * Pairs of GL_TIMESTAMP queries are kept in a ring per context, and read
+ * back in order once available. Query objects aren't shared between
+ * contexts, so each ring is only used from the context it was created in;
+ * the names are created on first use.
+ */
+
+void pgraph_gl_init_gpu_timer(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+#ifdef __ANDROID__
+    r->gpu_timer.supported = false;
+#else
+    r->gpu_timer.supported = epoxy_gl_version() >= 33 ||
+                             glo_check_extension("GL_ARB_timer_query");
+#endif
+}
+
+static void delete_queries(GpuTimerQueries *q)
+{
+    if (q->queries[0]) {
+        glDeleteQueries(GPU_TIMER_MAX_QUERIES, q->queries);
+        q->queries[0] = 0;
+    }
+}
+
+void pgraph_gl_finalize_gpu_timer(PGRAPHState *pg)
+{
+    PGRAPHGLState *r = pg->gl_renderer_state;
+
+    // Called with the render context current
+    delete_queries(&r->gpu_timer.render);
+}
+
+int pgraph_gl_gpu_timer_begin(PGRAPHGLState *r, GpuTimerQueries *q,
+                              enum NV2A_PROF_GPU_TIMERS_ENUM timer)
+{
+    if (!r->gpu_timer.supported ||
+        !qatomic_read(&g_nv2a_stats.gpu_timers_enabled)) {
+        return -1;
+    }
+
+    unsigned int num_pairs = GPU_TIMER_MAX_QUERIES / 2;
+    unsigned int next = (q->head + 1) % num_pairs;
+    if (next == q->tail) {
+        return -1;
+    }
+
+    if (!q->queries[0]) {
+        glGenQueries(GPU_TIMER_MAX_QUERIES, q->queries);
+    }
+
+    int pair = q->head;
+    q->timers[pair] = timer;
+    q->frames[pair] = g_nv2a_stats.frame_count;
+    q->ended[pair] = false;
+    q->head = next;
+    glQueryCounter(q->queries[pair * 2], GL_TIMESTAMP);
+
+    return pair;
+}
+
+void pgraph_gl_gpu_timer_end(PGRAPHGLState *r, GpuTimerQueries *q, int pair)
+{
+    if (pair < 0) {
+        return;
+    }
+
+    glQueryCounter(q->queries[pair * 2 + 1], GL_TIMESTAMP);
+    q->ended[pair] = true;
+}
+
+/*
+ * Read back completed queries, oldest first, without waiting.
+ */
+void pgraph_gl_gpu_timer_resolve(PGRAPHGLState *r, GpuTimerQueries *q)
+{
+    unsigned int num_pairs = GPU_TIMER_MAX_QUERIES / 2;
+
+    while (q->tail != q->head && q->ended[q->tail]) {
+        GLuint *queries = &q->queries[q->tail * 2];
+        GLint available = 0;
+        glGetQueryObjectiv(queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            break;
+        }
+
+        GLuint64 start, end;
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &end);
+        nv2a_profile_add_gpu_time(q->frames[q->tail], q->timers[q->tail],
+                                  (end - start) / 1e6f);
+
+        q->tail = (q->tail + 1) % num_pairs;
+    }
+}
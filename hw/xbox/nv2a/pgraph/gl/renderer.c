@@ -131,6 +131,7 @@ static void pgraph_gl_init(NV2AState *d, Error **errp)
 
     pgraph_gl_init_surfaces(pg);
     pgraph_gl_init_reports(d);
+    pgraph_gl_init_gpu_timer(pg);
     pgraph_gl_init_textures(d);
     pgraph_gl_init_buffers(d);
     pgraph_gl_init_shaders(pg);
@@ -154,6 +155,7 @@ static void pgraph_gl_finalize(NV2AState *d)
     pgraph_gl_finalize_surfaces(pg);
     pgraph_gl_finalize_shaders(pg);
     pgraph_gl_finalize_textures(pg);
+    pgraph_gl_finalize_gpu_timer(pg);
     pgraph_gl_finalize_reports(pg);
     pgraph_gl_finalize_buffers(pg);
     pgraph_gl_finalize_display(pg);
@@ -167,16 +169,25 @@ static void pgraph_gl_finalize(NV2AState *d)
 static void pgraph_gl_flip_stall(NV2AState *d)
 {
     NV2A_GL_DFRAME_TERMINATOR();
+    pgraph_gl_record_surface_readbacks(d);
     glFinish();
+    pgraph_gl_gpu_timer_resolve(d->pgraph.gl_renderer_state,
+                                &d->pgraph.gl_renderer_state->gpu_timer.render);
 }
 
 static void pgraph_gl_flush(NV2AState *d)
 {
-    pgraph_gl_surface_flush(d);
+    bool discard = qatomic_read(&d->pgraph.flush_discard);
+
+    pgraph_gl_surface_flush(d, discard);
     pgraph_gl_mark_textures_possibly_dirty(d, 0, memory_region_size(d->vram));
-    pgraph_gl_update_entire_memory_buffer(d);
+    if (!discard) {
+        /* Otherwise RAM is dirty, draws upload the ranges they use */
+        pgraph_gl_update_entire_memory_buffer(d);
+    }
     /* FIXME: Flush more? */
 
+    qatomic_set(&d->pgraph.flush_discard, false);
     qatomic_set(&d->pgraph.flush_pending, false);
     qemu_event_set(&d->pgraph.flush_complete);
 }
@@ -26,6 +26,7 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/lru.h"
+#include "qemu/interval-tree.h"
 
 #include "hw/hw.h"
 #include "hw/xbox/nv2a/pgraph/prim_rewrite.h"
@@ -35,12 +36,14 @@
 #include "hw/xbox/nv2a/pgraph/surface.h"
 #include "hw/xbox/nv2a/pgraph/texture.h"
 #include "hw/xbox/nv2a/pgraph/glsl/shaders.h"
+#include "ui/xemu-mem-stats.h"
 
 #include "gloffscreen.h"
 #include "constants.h"
 
 typedef struct SurfaceBinding {
     QTAILQ_ENTRY(SurfaceBinding) entry;
+    IntervalTreeNode itree; // Indexed by VRAM range while in surfaces
     MemAccessCallback *access_cb;
 
     hwaddr vram_addr;
@@ -63,8 +66,16 @@ typedef struct SurfaceBinding {
     bool download_pending;
     bool upload_pending;
 
+    // Copy of the surface made at the end of a frame for the CPU to read
+    bool readback_requested;
+    bool readback_valid;
+    int readback_draw_time;
+    GLuint readback_buffer;
+    GLsync readback_fence;
+
     GLuint gl_buffer;
     SurfaceFormatInfo fmt;
+    size_t mem_size; // Estimated size of gl_buffer
 } SurfaceBinding;
 
 typedef struct TextureBinding {
@@ -74,7 +85,7 @@ typedef struct TextureBinding {
     unsigned int scale;
     unsigned int min_filter;
     unsigned int mag_filter;
-    uint32_t lod_bias;
+    float lod_bias;
     unsigned int addru;
     unsigned int addrv;
     unsigned int addrp;
@@ -82,6 +93,8 @@ typedef struct TextureBinding {
     bool border_color_set;
     GLenum gl_target;
     GLuint gl_texture;
+    size_t mem_size; // Estimated from the guest texture size
+    XemuMemAccount *mem_account;
 } TextureBinding;
 
 typedef struct ShaderModuleCacheKey {
@@ -117,7 +130,7 @@ typedef struct ShaderBinding {
     size_t program_size;
     GLenum program_format;
     ShaderState state;
-    QemuThread *save_thread;
+    bool linking; // Linking in the background, see parallel_shader_compile
 
     GLuint gl_program;
     GLenum gl_primitive_mode;
@@ -126,6 +139,17 @@ typedef struct ShaderBinding {
         PshUniformLocs psh;
         VshUniformLocs vsh;
     } uniform_locs;
+
+    // Program uniforms hold the constants as of vsh_constants_gen
+    bool vsh_constants_valid;
+    uint64_t vsh_constants_gen;
+
+    // Values last uploaded to the program, allocated on first use
+    struct {
+        VshUniformValues vsh;
+        PshUniformValues psh;
+    } *uniform_values;
+    bool uniform_values_valid;
 } ShaderBinding;
 
 typedef struct VertexKey {
@@ -160,6 +184,8 @@ typedef struct TextureLruNode {
     bool possibly_dirty;
 } TextureLruNode;
 
+typedef struct ShaderWriteJob ShaderWriteJob;
+
 typedef struct QueryReport {
     QSIMPLEQ_ENTRY(QueryReport) entry;
     bool clear;
@@ -168,6 +194,40 @@ typedef struct QueryReport {
     GLuint *queries;
 } QueryReport;
 
+#define GPU_TIMER_MAX_QUERIES 1024
+
+typedef struct GpuTimerQueries {
+    GLuint queries[GPU_TIMER_MAX_QUERIES];
+    uint8_t timers[GPU_TIMER_MAX_QUERIES / 2];
+    unsigned int frames[GPU_TIMER_MAX_QUERIES / 2];
+    bool ended[GPU_TIMER_MAX_QUERIES / 2];
+    unsigned int head, tail; // Query pairs, ring buffer
+} GpuTimerQueries;
+
+// Ring for index and inline vertex data, fenced in segments for reuse
+#define STREAM_BUFFER_SIZE (32 * MiB)
+#define STREAM_BUFFER_NUM_SEGMENTS 4
+#define STREAM_BUFFER_SEGMENT_SIZE \
+    (STREAM_BUFFER_SIZE / STREAM_BUFFER_NUM_SEGMENTS)
+
+// Buffers for uploads larger than a segment, orphaned on each use
+#define STREAM_BUFFER_NUM_OVERSIZE (NV2A_VERTEXSHADER_ATTRIBUTES * 2)
+
+typedef struct StreamBuffer {
+    GLenum target;
+    GLuint buffer;
+    uint8_t *mapped; // Persistently mapped, NULL without buffer storage
+    size_t offset;
+    GLsync fences[STREAM_BUFFER_NUM_SEGMENTS];
+    GLuint oversize_buffers[STREAM_BUFFER_NUM_OVERSIZE];
+    int oversize_index;
+} StreamBuffer;
+
+typedef struct StreamAlloc {
+    GLuint buffer;
+    GLintptr offset;
+} StreamAlloc;
+
 typedef struct PGRAPHGLState {
     GLuint gl_framebuffer;
     GLuint gl_display_buffer;
@@ -179,14 +239,16 @@ typedef struct PGRAPHGLState {
 
     Lru element_cache;
     VertexLruNode *element_cache_entries;
-    GLuint gl_inline_array_buffer;
     GLuint gl_memory_buffer;
     GLuint gl_vertex_array;
-    GLuint gl_inline_buffer[NV2A_VERTEXSHADER_ATTRIBUTES];
-    GLuint gl_prim_rewrite_buffer;
+    StreamBuffer stream_buffer;
+    StreamAlloc inline_array_alloc;
     PrimRewriteBuf prim_rewrite_buf;
 
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    XemuMemAccount *surface_mem_account;
+    XemuMemAccount *readback_mem_account;
+    IntervalTreeRoot surface_tree;
     SurfaceBinding *color_binding, *zeta_binding;
     bool downloads_pending;
     QemuEvent downloads_complete;
@@ -196,12 +258,23 @@ typedef struct PGRAPHGLState {
     TextureBinding *texture_binding[NV2A_MAX_TEXTURES];
     Lru texture_cache;
     TextureLruNode *texture_cache_entries;
+    XemuMemAccount *texture_mem_account;
+    GThreadPool *texture_decode_pool;
+    StreamBuffer texture_upload_buffer;
 
     Lru shader_cache;
     ShaderBinding *shader_cache_entries;
     ShaderBinding *shader_binding;
+    ShaderStateCache shader_state_cache;
     QemuMutex shader_cache_lock;
     QemuThread shader_disk_thread;
+    bool parallel_shader_compile;
+
+    QemuThread shader_write_thread;
+    QemuMutex shader_write_lock;
+    QemuCond shader_write_cond;
+    QSIMPLEQ_HEAD(, ShaderWriteJob) shader_write_queue;
+    bool shader_write_shutdown;
 
     Lru shader_module_cache;
     ShaderModuleCacheEntry *shader_module_cache_entries;
@@ -244,6 +317,12 @@ typedef struct PGRAPHGLState {
         GLboolean texture_filter_anisotropic;
     } supported_extensions;
 
+    struct {
+        bool supported;
+        GpuTimerQueries render; // In the render context
+        GpuTimerQueries display; // In the context displays are rendered in
+    } gpu_timer;
+
 #ifdef __ANDROID__
     bool bgra_supported;
 #endif
@@ -253,6 +332,12 @@ extern GloContext *g_nv2a_context_render;
 extern GloContext *g_nv2a_context_display;
 
 unsigned int pgraph_gl_bind_inline_array(NV2AState *d);
+void pgraph_gl_init_stream_buffer(StreamBuffer *s, GLenum target);
+void pgraph_gl_finalize_stream_buffer(StreamBuffer *s);
+StreamAlloc pgraph_gl_stream_upload(PGRAPHGLState *r, const void *data,
+                                    size_t size, size_t alignment);
+uint8_t *pgraph_gl_stream_map(StreamBuffer *s, size_t size, size_t alignment,
+                              StreamAlloc *alloc);
 void pgraph_gl_bind_shaders(PGRAPHState *pg);
 void pgraph_gl_bind_textures(NV2AState *d);
 void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element, unsigned int max_element, bool inline_data, unsigned int inline_stride, unsigned int provoking_element);
@@ -268,12 +353,19 @@ void pgraph_gl_get_report(NV2AState *d, uint32_t parameter);
 void pgraph_gl_image_blit(NV2AState *d);
 void pgraph_gl_mark_textures_possibly_dirty(NV2AState *d, hwaddr addr, hwaddr size);
 void pgraph_gl_process_pending_reports(NV2AState *d);
-void pgraph_gl_surface_flush(NV2AState *d);
+void pgraph_gl_surface_flush(NV2AState *d, bool discard);
+void pgraph_gl_record_surface_readbacks(NV2AState *d);
 void pgraph_gl_surface_update(NV2AState *d, bool upload, bool color_write, bool zeta_write);
 void pgraph_gl_sync(NV2AState *d);
 void pgraph_gl_update_entire_memory_buffer(NV2AState *d);
 void pgraph_gl_init_display(NV2AState *d);
 void pgraph_gl_finalize_display(PGRAPHState *pg);
+void pgraph_gl_init_gpu_timer(PGRAPHState *pg);
+void pgraph_gl_finalize_gpu_timer(PGRAPHState *pg);
+int pgraph_gl_gpu_timer_begin(PGRAPHGLState *r, GpuTimerQueries *q,
+                              enum NV2A_PROF_GPU_TIMERS_ENUM timer);
+void pgraph_gl_gpu_timer_end(PGRAPHGLState *r, GpuTimerQueries *q, int pair);
+void pgraph_gl_gpu_timer_resolve(PGRAPHGLState *r, GpuTimerQueries *q);
 void pgraph_gl_init_reports(NV2AState *d);
 void pgraph_gl_finalize_reports(PGRAPHState *pg);
 void pgraph_gl_init_shaders(PGRAPHState *pg);
@@ -291,10 +383,12 @@ void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta);
 void pgraph_gl_surface_download_if_dirty(NV2AState *d, SurfaceBinding *surface);
 SurfaceBinding *pgraph_gl_surface_get(NV2AState *d, hwaddr addr);
 SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr);
+void pgraph_gl_download_surfaces_in_range_if_dirty(NV2AState *d, hwaddr start,
+                                                   hwaddr size);
 void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *e);
 void pgraph_gl_unbind_surface(NV2AState *d, bool color);
 void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface, bool force);
-void pgraph_gl_shader_cache_to_disk(ShaderBinding *snode);
+void pgraph_gl_shader_cache_to_disk(PGRAPHGLState *r, ShaderBinding *snode);
 bool pgraph_gl_shader_load_from_memory(ShaderBinding *snode);
 void pgraph_gl_shader_write_cache_reload_list(PGRAPHState *pg);
 void pgraph_gl_set_surface_scale_factor(NV2AState *d, unsigned int scale);
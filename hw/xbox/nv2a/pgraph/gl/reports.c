@@ -51,7 +51,8 @@ static void process_pending_report(NV2AState *d, QueryReport *report)
         g_free(report->queries);
     }
 
-    pgraph_write_zpass_pixel_cnt_report(d, report->parameter, r->zpass_pixel_count_result);
+    pgraph_write_zpass_pixel_cnt_report(d, pg->dma_report, report->parameter,
+                                        r->zpass_pixel_count_result);
 }
 
 void pgraph_gl_process_pending_reports(NV2AState *d)
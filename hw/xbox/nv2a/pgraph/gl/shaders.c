@@ -43,7 +43,8 @@ static GLenum get_gl_primitive_mode(enum ShaderPrimitiveMode primitive_mode)
 
 static GLuint create_gl_shader(GLenum gl_shader_type,
                                const char *code,
-                               const char *name)
+                               const char *name,
+                               bool check_status)
 {
     GLint compiled = 0;
 
@@ -55,6 +56,13 @@ static GLuint create_gl_shader(GLenum gl_shader_type,
     glShaderSource(shader, 1, &code, 0);
     glCompileShader(shader);
 
+    /* Querying the status waits for the compile, so with parallel compile
+     * errors are only caught when the program fails to link. */
+    if (!check_status) {
+        NV2A_GL_DGROUP_END();
+        return shader;
+    }
+
     /* Check it compiled */
     compiled = 0;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
@@ -110,11 +118,15 @@ static void update_shader_uniform_locs(ShaderBinding *binding)
         }
         binding->uniform_locs.psh[i] = glGetUniformLocation(binding->gl_program, name);
     }
+
+    binding->vsh_constants_valid = false;
+    binding->uniform_values_valid = false;
 }
 
 static void shader_module_cache_entry_init(Lru *lru, LruNode *node,
                                            const void *key)
 {
+    PGRAPHGLState *r = container_of(lru, PGRAPHGLState, shader_module_cache);
     ShaderModuleCacheEntry *module =
         container_of(node, ShaderModuleCacheEntry, node);
     memcpy(&module->key, key, sizeof(ShaderModuleCacheKey));
@@ -145,7 +157,8 @@ static void shader_module_cache_entry_init(Lru *lru, LruNode *node,
     }
 
     module->gl_shader =
-        create_gl_shader(module->key.kind, mstring_get_str(code), kind_str);
+        create_gl_shader(module->key.kind, mstring_get_str(code), kind_str,
+                         !r->parallel_shader_compile);
     mstring_unref(code);
 }
 
@@ -174,6 +187,11 @@ static GLuint get_shader_module_for_key(PGRAPHGLState *r,
     return module->gl_shader;
 }
 
+/*
+ * Compile the stages of a binding and start linking its program. The link
+ * is finished by finish_shader_link, which waits for it if it is still
+ * running in the background.
+ */
 static void generate_shaders(PGRAPHGLState *r, ShaderBinding *binding)
 {
     GLuint program = glCreateProgram();
@@ -217,6 +235,14 @@ static void generate_shaders(PGRAPHGLState *r, ShaderBinding *binding)
 
     /* link the program */
     glLinkProgram(program);
+    binding->gl_program = program;
+    binding->linking = true;
+}
+
+static void finish_shader_link(ShaderBinding *binding)
+{
+    GLuint program = binding->gl_program;
+
     GLint linked = 0;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
     if(!linked) {
@@ -228,9 +254,9 @@ static void generate_shaders(PGRAPHGLState *r, ShaderBinding *binding)
 
     glUseProgram(program);
 
-    binding->gl_program = program;
+    binding->linking = false;
     binding->gl_primitive_mode =
-        get_gl_primitive_mode(state->geom.primitive_mode);
+        get_gl_primitive_mode(binding->state.geom.primitive_mode);
     binding->initialized = true;
 
     set_texture_sampler_uniforms(binding);
@@ -251,6 +277,21 @@ static void generate_shaders(PGRAPHGLState *r, ShaderBinding *binding)
 
 static const char *shader_gl_vendor = NULL;
 
+/*
+ * A program binary copied out of the driver, queued for the shader writer
+ * thread so the binding doesn't have to outlive the write.
+ */
+struct ShaderWriteJob {
+    QSIMPLEQ_ENTRY(ShaderWriteJob) entry;
+    uint64_t hash;
+    ShaderState state;
+    GLenum program_format;
+    size_t program_size;
+    uint8_t program[];
+};
+
+static void *shader_write_thread(void *arg);
+
 static void shader_create_cache_folder(void)
 {
     char *shader_path = g_strdup_printf("%sshaders", xemu_settings_get_base_path());
@@ -263,14 +304,10 @@ static char *shader_get_lru_cache_path(void)
     return g_strdup_printf("%s/shader_cache_list", xemu_settings_get_base_path());
 }
 
-static void shader_write_lru_list_entry_to_disk(Lru *lru, LruNode *node, void *opaque)
+static void shader_write_lru_list_entry(Lru *lru, LruNode *node, void *opaque)
 {
-    FILE *lru_list_file = (FILE*) opaque;
-    size_t written = fwrite(&node->hash, sizeof(uint64_t), 1, lru_list_file);
-    if (written != 1) {
-        fprintf(stderr, "nv2a: Failed to write shader list entry %llx to disk\n",
-                (unsigned long long) node->hash);
-    }
+    GByteArray *list = opaque;
+    g_byte_array_append(list, (const guint8 *)&node->hash, sizeof(node->hash));
 }
 
 void pgraph_gl_shader_write_cache_reload_list(PGRAPHState *pg)
@@ -286,16 +323,22 @@ void pgraph_gl_shader_write_cache_reload_list(PGRAPHState *pg)
     char *shader_lru_path = shader_get_lru_cache_path();
     qemu_thread_join(&r->shader_disk_thread);
 
-    FILE *lru_list = qemu_fopen(shader_lru_path, "wb");
+    GByteArray *list = g_byte_array_new();
+    lru_visit_active(&r->shader_cache, shader_write_lru_list_entry, list);
+    pgraph_merge_shader_cache_list(list, shader_lru_path,
+                                   r->shader_cache.num_nodes);
+
+    /* Replaced at once, other instances may be reading it */
+    bool written = g_file_set_contents(shader_lru_path,
+                                       (const gchar *)list->data, list->len,
+                                       NULL);
+    g_byte_array_unref(list);
     g_free(shader_lru_path);
-    if (!lru_list) {
-        fprintf(stderr, "nv2a: Failed to open shader LRU cache for writing\n");
+    if (!written) {
+        fprintf(stderr, "nv2a: Failed to write shader LRU cache list\n");
         return;
     }
 
-    lru_visit_active(&r->shader_cache, shader_write_lru_list_entry_to_disk, lru_list);
-    fclose(lru_list);
-
     lru_flush(&r->shader_cache);
 
     qatomic_set(&r->shader_cache_writeback_pending, false);
@@ -479,6 +522,9 @@ error:
 
 static void *shader_reload_lru_from_disk(void *arg)
 {
+    xemu_thread_topology_register(XEMU_THREAD_BACKGROUND,
+                                  "nv2a.gl_shader_cache");
+
     if (!g_config.perf.cache_shaders) {
         return NULL;
     }
@@ -507,26 +553,26 @@ static void shader_cache_entry_init(Lru *lru, LruNode *node, const void *state)
     binding->initialized = false;
     binding->cached = false;
     binding->program = NULL;
-    binding->save_thread = NULL;
+    binding->linking = false;
+    binding->uniform_values = NULL;
+    binding->uniform_values_valid = false;
 }
 
 static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
 {
     ShaderBinding *binding = container_of(node, ShaderBinding, node);
 
-    if (binding->save_thread) {
-        qemu_thread_join(binding->save_thread);
-        g_free(binding->save_thread);
-    }
-
     glDeleteProgram(binding->gl_program);
     if (binding->program) {
         g_free(binding->program);
     }
+    g_free(binding->uniform_values);
 
     binding->cached = false;
-    binding->save_thread = NULL;
+    binding->linking = false;
     binding->program = NULL;
+    binding->uniform_values = NULL;
+    binding->uniform_values_valid = false;
     memset(&binding->state, 0, sizeof(ShaderState));
 }
 
@@ -547,8 +593,22 @@ void pgraph_gl_init_shaders(PGRAPHState *pg)
         shader_gl_vendor = (const char *) glGetString(GL_VENDOR);
     }
 
+    r->parallel_shader_compile =
+        g_config.display.opengl.parallel_shader_compile &&
+        epoxy_has_gl_extension("GL_KHR_parallel_shader_compile");
+    if (r->parallel_shader_compile) {
+        glMaxShaderCompilerThreadsKHR(0xffffffff);
+    }
+
     shader_create_cache_folder();
 
+    qemu_mutex_init(&r->shader_write_lock);
+    qemu_cond_init(&r->shader_write_cond);
+    QSIMPLEQ_INIT(&r->shader_write_queue);
+    r->shader_write_shutdown = false;
+    qemu_thread_create(&r->shader_write_thread, "pgraph.gl_shader_writer",
+                       shader_write_thread, r, QEMU_THREAD_JOINABLE);
+
     /* FIXME: Make this configurable */
     const size_t shader_cache_size = 50*1024;
     lru_init(&r->shader_cache);
@@ -557,6 +617,8 @@ void pgraph_gl_init_shaders(PGRAPHState *pg)
     for (int i = 0; i < shader_cache_size; i++) {
         lru_add_free(&r->shader_cache, &r->shader_cache_entries[i].node);
     }
+    xemu_mem_account_set(xemu_mem_account("gl", "shader cache nodes"),
+                         shader_cache_size * sizeof(ShaderBinding));
 
     r->shader_cache.init_node = shader_cache_entry_init;
     r->shader_cache.compare_nodes = shader_cache_entry_compare;
@@ -574,6 +636,9 @@ void pgraph_gl_init_shaders(PGRAPHState *pg)
     for (int i = 0; i < shader_module_cache_size; i++) {
         lru_add_free(&r->shader_module_cache, &r->shader_module_cache_entries[i].node);
     }
+    xemu_mem_account_set(
+        xemu_mem_account("gl", "shader module cache nodes"),
+        shader_module_cache_size * sizeof(ShaderModuleCacheEntry));
 
     r->shader_module_cache.init_node = shader_module_cache_entry_init;
     r->shader_module_cache.compare_nodes = shader_module_cache_entry_compare;
@@ -586,83 +651,109 @@ void pgraph_gl_finalize_shaders(PGRAPHState *pg)
 
     // Clear out shader cache
     pgraph_gl_shader_write_cache_reload_list(pg); // FIXME: also flushes, rename for clarity
+    lru_destroy(&r->shader_cache);
     free(r->shader_cache_entries);
     r->shader_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("gl", "shader cache nodes"), 0);
 
     lru_flush(&r->shader_module_cache);
+    lru_destroy(&r->shader_module_cache);
     g_free(r->shader_module_cache_entries);
     r->shader_module_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("gl", "shader module cache nodes"),
+                         0);
+
+    // Queued binaries are still written before the thread exits
+    qemu_mutex_lock(&r->shader_write_lock);
+    r->shader_write_shutdown = true;
+    qemu_cond_signal(&r->shader_write_cond);
+    qemu_mutex_unlock(&r->shader_write_lock);
+    qemu_thread_join(&r->shader_write_thread);
+    qemu_cond_destroy(&r->shader_write_cond);
+    qemu_mutex_destroy(&r->shader_write_lock);
 
     qemu_mutex_destroy(&r->shader_cache_lock);
 }
 
-static void *shader_write_to_disk(void *arg)
+static void shader_write_to_disk(const ShaderWriteJob *job)
 {
-    ShaderBinding *binding = (ShaderBinding*) arg;
-
-    char *shader_bin = shader_get_bin_directory(binding->node.hash);
-    char *shader_path = shader_get_binary_path(shader_bin, binding->node.hash);
-
-    static uint64_t gl_vendor_len;
-    if (gl_vendor_len == 0) {
-        gl_vendor_len = (uint64_t) (strlen(shader_gl_vendor) + 1);
-    }
+    char *shader_bin = shader_get_bin_directory(job->hash);
+    char *shader_path = shader_get_binary_path(shader_bin, job->hash);
 
-    static uint64_t xemu_version_len = 0;
-    if (xemu_version_len == 0) {
-        xemu_version_len = (uint64_t) (strlen(xemu_version) + 1);
-    }
+    uint64_t gl_vendor_len = strlen(shader_gl_vendor) + 1;
+    uint64_t xemu_version_len = strlen(xemu_version) + 1;
 
     qemu_mkdir(shader_bin);
     g_free(shader_bin);
 
-    FILE *shader_file = qemu_fopen(shader_path, "wb");
-    if (!shader_file) {
-        goto error;
-    }
+    GByteArray *data = g_byte_array_sized_new(
+        sizeof(xemu_version_len) + xemu_version_len + sizeof(gl_vendor_len) +
+        gl_vendor_len + sizeof(job->program_format) + sizeof(job->state) +
+        sizeof(job->program_size) + job->program_size);
 
-    size_t written;
-    #define WRITE_OR_ERR(data, data_size) \
-        do { \
-            written = fwrite(data, data_size, 1, shader_file); \
-            if (written != 1) { \
-                fclose(shader_file); \
-                goto error; \
-            } \
-        } while (0)
+    #define APPEND(src, src_size) \
+        g_byte_array_append(data, (const guint8 *)(src), (src_size))
 
-    WRITE_OR_ERR(&xemu_version_len, sizeof(xemu_version_len));
-    WRITE_OR_ERR(xemu_version, xemu_version_len);
+    APPEND(&xemu_version_len, sizeof(xemu_version_len));
+    APPEND(xemu_version, xemu_version_len);
 
-    WRITE_OR_ERR(&gl_vendor_len, sizeof(gl_vendor_len));
-    WRITE_OR_ERR(shader_gl_vendor, gl_vendor_len);
+    APPEND(&gl_vendor_len, sizeof(gl_vendor_len));
+    APPEND(shader_gl_vendor, gl_vendor_len);
 
-    WRITE_OR_ERR(&binding->program_format, sizeof(binding->program_format));
-    WRITE_OR_ERR(&binding->state, sizeof(binding->state));
+    APPEND(&job->program_format, sizeof(job->program_format));
+    APPEND(&job->state, sizeof(job->state));
 
-    WRITE_OR_ERR(&binding->program_size, sizeof(binding->program_size));
-    WRITE_OR_ERR(binding->program, binding->program_size);
+    APPEND(&job->program_size, sizeof(job->program_size));
+    APPEND(job->program, job->program_size);
 
-    #undef WRITE_OR_ERR
+    #undef APPEND
 
-    fclose(shader_file);
+    /*
+     * Written to a temporary file and renamed over, so that other instances
+     * sharing the cache never load, and then delete, a partial binary.
+     */
+    if (!g_file_set_contents(shader_path, (const gchar *)data->data,
+                             data->len, NULL)) {
+        fprintf(stderr, "nv2a: Failed to write shader binary file to %s\n",
+                shader_path);
+    }
 
+    g_byte_array_unref(data);
     g_free(shader_path);
-    g_free(binding->program);
-    binding->program = NULL;
+}
 
-    return NULL;
+static void *shader_write_thread(void *arg)
+{
+    PGRAPHGLState *r = arg;
+
+    xemu_trace_set_thread_name("nv2a.gl_shader_writer");
+    xemu_thread_topology_register(XEMU_THREAD_BACKGROUND,
+                                  "nv2a.gl_shader_writer");
+
+    qemu_mutex_lock(&r->shader_write_lock);
+    while (true) {
+        ShaderWriteJob *job = QSIMPLEQ_FIRST(&r->shader_write_queue);
+        if (!job) {
+            if (r->shader_write_shutdown) {
+                break;
+            }
+            qemu_cond_wait(&r->shader_write_cond, &r->shader_write_lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&r->shader_write_queue, entry);
+        qemu_mutex_unlock(&r->shader_write_lock);
+
+        shader_write_to_disk(job);
+        g_free(job);
+
+        qemu_mutex_lock(&r->shader_write_lock);
+    }
+    qemu_mutex_unlock(&r->shader_write_lock);
 
-error:
-    fprintf(stderr, "nv2a: Failed to write shader binary file to %s\n", shader_path);
-    qemu_unlink(shader_path);
-    g_free(shader_path);
-    g_free(binding->program);
-    binding->program = NULL;
     return NULL;
 }
 
-void pgraph_gl_shader_cache_to_disk(ShaderBinding *binding)
+void pgraph_gl_shader_cache_to_disk(PGRAPHGLState *r, ShaderBinding *binding)
 {
 #ifdef __ANDROID__
     (void)binding;
@@ -685,23 +776,30 @@ void pgraph_gl_shader_cache_to_disk(ShaderBinding *binding)
         return;
     }
 
-    binding->program = g_malloc(program_size);
+    ShaderWriteJob *job = g_malloc(sizeof(ShaderWriteJob) + program_size);
     GLsizei program_size_copied;
     glGetProgramBinary(binding->gl_program, program_size, &program_size_copied,
-                       &binding->program_format, binding->program);
+                       &job->program_format, job->program);
     assert(glGetError() == GL_NO_ERROR);
 
-    binding->program_size = program_size_copied;
+    job->hash = binding->node.hash;
+    job->state = binding->state;
+    job->program_size = program_size_copied;
     binding->cached = true;
 
-    char name[24];
-    snprintf(name, sizeof(name), "scache-%llx", (unsigned long long) binding->node.hash);
-    binding->save_thread = g_malloc0(sizeof(QemuThread));
-    qemu_thread_create(binding->save_thread, name, shader_write_to_disk, binding, QEMU_THREAD_JOINABLE);
+    qemu_mutex_lock(&r->shader_write_lock);
+    QSIMPLEQ_INSERT_TAIL(&r->shader_write_queue, job, entry);
+    qemu_cond_signal(&r->shader_write_cond);
+    qemu_mutex_unlock(&r->shader_write_lock);
 }
 
+/*
+ * Upload uniforms with a location. If last_values holds what the program
+ * was last given, uniforms that haven't changed since are skipped.
+ */
 static void apply_uniform_updates(const UniformInfo *info, int *locs,
-                                  void *values, size_t count)
+                                  void *values, void *last_values,
+                                  size_t count)
 {
     for (int i = 0; i < count; i++) {
         if (locs[i] == -1) {
@@ -710,6 +808,16 @@ static void apply_uniform_updates(const UniformInfo *info, int *locs,
 
         void *value = (char*)values + info[i].val_offs;
 
+        if (last_values) {
+            void *last = (char*)last_values + info[i].val_offs;
+            size_t size = info[i].size * info[i].count;
+            if (!memcmp(last, value, size)) {
+                nv2a_profile_inc_counter(NV2A_PROF_SHADER_UNIFORM_SKIPPED);
+                continue;
+            }
+            memcpy(last, value, size);
+        }
+
         switch (info[i].type) {
         case UniformElementType_uint:
             glUniform1uiv(locs[i], info[i].count, value);
@@ -752,17 +860,33 @@ static void apply_uniform_updates(const UniformInfo *info, int *locs,
 #endif
 }
 
-// FIXME: Dirty tracking
 // FIXME: Consider UBO to align with VK renderer
 static void update_shader_uniforms(PGRAPHState *pg, ShaderBinding *binding)
 {
     PGRAPHGLState *r = pg->gl_renderer_state;
 
+    if (!binding->uniform_values) {
+        binding->uniform_values = g_malloc(sizeof(*binding->uniform_values));
+        binding->uniform_values_valid = false;
+    }
+    bool compare = binding->uniform_values_valid;
+
+    // Constants are the bulk of the uniforms, only upload them on change
+    VshUniformLocs vsh_locs;
+    memcpy(vsh_locs, binding->uniform_locs.vsh, sizeof(vsh_locs));
+    if (binding->vsh_constants_valid &&
+        binding->vsh_constants_gen == pg->vsh_constants_gen) {
+        vsh_locs[VshUniform_c] = -1;
+    }
+    binding->vsh_constants_valid = true;
+    binding->vsh_constants_gen = pg->vsh_constants_gen;
+
     VshUniformValues vsh_values;
-    pgraph_glsl_set_vsh_uniform_values(pg, &binding->state.vsh,
-                                  binding->uniform_locs.vsh, &vsh_values);
-    apply_uniform_updates(VshUniformInfo, binding->uniform_locs.vsh,
-                          &vsh_values, VshUniform__COUNT);
+    pgraph_glsl_set_vsh_uniform_values(pg, &binding->state.vsh, vsh_locs,
+                                       &vsh_values);
+    apply_uniform_updates(VshUniformInfo, vsh_locs, &vsh_values,
+                          compare ? &binding->uniform_values->vsh : NULL,
+                          VshUniform__COUNT);
 
     PshUniformValues psh_values;
     pgraph_glsl_set_psh_uniform_values(pg, binding->uniform_locs.psh, &psh_values);
@@ -774,7 +898,39 @@ static void update_shader_uniforms(PGRAPHState *pg, ShaderBinding *binding)
         }
     }
     apply_uniform_updates(PshUniformInfo, binding->uniform_locs.psh,
-                          &psh_values, PshUniform__COUNT);
+                          &psh_values,
+                          compare ? &binding->uniform_values->psh : NULL,
+                          PshUniform__COUNT);
+
+    // Everything was uploaded, so start tracking from these values
+    if (!compare) {
+        binding->uniform_values->vsh = vsh_values;
+        binding->uniform_values->psh = psh_values;
+        binding->uniform_values_valid = true;
+    }
+}
+
+/*
+ * Finish a link started by generate_shaders. With parallel shader compile,
+ * returns false instead of waiting if the driver is still linking.
+ */
+static bool try_finish_shader_link(PGRAPHGLState *r, ShaderBinding *binding)
+{
+    if (r->parallel_shader_compile) {
+        GLint complete = GL_FALSE;
+        glGetProgramiv(binding->gl_program, GL_COMPLETION_STATUS_KHR,
+                       &complete);
+        if (!complete) {
+            return false;
+        }
+    }
+
+    finish_shader_link(binding);
+    if (g_config.perf.cache_shaders) {
+        pgraph_gl_shader_cache_to_disk(r, binding);
+    }
+
+    return true;
 }
 
 void pgraph_gl_bind_shaders(PGRAPHState *pg)
@@ -782,41 +938,51 @@ void pgraph_gl_bind_shaders(PGRAPHState *pg)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     bool binding_changed = false;
-    if (r->shader_binding &&
-        !pgraph_glsl_check_shader_state_dirty(pg, &r->shader_binding->state)) {
+    ShaderStateCache *cache = &r->shader_state_cache;
+    if (!pgraph_glsl_update_shader_state(pg, cache) && r->shader_binding) {
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
+        if (r->shader_binding->linking) {
+            qemu_mutex_lock(&r->shader_cache_lock);
+            try_finish_shader_link(r, r->shader_binding);
+            qemu_mutex_unlock(&r->shader_cache_lock);
+        }
         goto update_uniforms;
     }
 
     ShaderBinding *old_binding = r->shader_binding;
-    ShaderState state = pgraph_glsl_get_shader_state(pg);
+    const ShaderState *state = &cache->state;
 
     NV2A_GL_DGROUP_BEGIN("%s (%s)", __func__,
-                         state.vsh.is_fixed_function ? "FF" : "PROG");
+                         state->vsh.is_fixed_function ? "FF" : "PROG");
 
     qemu_mutex_lock(&r->shader_cache_lock);
 
-    uint64_t shader_state_hash =
-        fast_hash((uint8_t *)&state, sizeof(ShaderState));
-
-    LruNode *node = lru_lookup(&r->shader_cache, shader_state_hash, &state);
+    LruNode *node = lru_lookup(&r->shader_cache, cache->hash, state);
     ShaderBinding *binding = container_of(node, ShaderBinding, node);
-
-    if (!binding->initialized && !pgraph_gl_shader_load_from_memory(binding)) {
-        nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
+    nv2a_profile_inc_counter(binding->initialized || binding->linking ?
+                                 NV2A_PROF_SHADER_CACHE_HIT :
+                                 NV2A_PROF_SHADER_CACHE_MISS);
+
+    if (!binding->initialized && !binding->linking &&
+        !pgraph_gl_shader_load_from_memory(binding)) {
+        nv2a_profile_inc_counter(r->parallel_shader_compile ?
+                                     NV2A_PROF_SHADER_ASYNC_GEN :
+                                     NV2A_PROF_SHADER_GEN);
+        xemu_trace_begin("shader compile", NULL);
         generate_shaders(r, binding);
-        if (g_config.perf.cache_shaders) {
-            pgraph_gl_shader_cache_to_disk(binding);
-        }
+        xemu_trace_end();
     }
-    assert(binding->initialized);
+    if (binding->linking) {
+        try_finish_shader_link(r, binding);
+    }
+    assert(binding->initialized || binding->linking);
     r->shader_binding = binding;
     pg->program_data_dirty = false;
 
     qemu_mutex_unlock(&r->shader_cache_lock);
 
     binding_changed = (r->shader_binding != old_binding);
-    if (binding_changed) {
+    if (binding_changed && binding->initialized) {
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND);
         glUseProgram(r->shader_binding->gl_program);
     }
@@ -825,8 +991,9 @@ void pgraph_gl_bind_shaders(PGRAPHState *pg)
 
 update_uniforms:
     assert(r->shader_binding);
-    assert(r->shader_binding->initialized);
-    update_shader_uniforms(pg, r->shader_binding);
+    if (r->shader_binding->initialized) {
+        update_shader_uniforms(pg, r->shader_binding);
+    }
 }
 
 GLuint pgraph_gl_compile_shader(const char *vs_src, const char *fs_src)
@@ -22,6 +22,7 @@
 #include "hw/xbox/nv2a/pgraph/pgraph.h"
 #include "ui/xemu-settings.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/blit.h"
 #include "hw/xbox/nv2a/pgraph/swizzle.h"
 #include "debug.h"
 #include "renderer.h"
@@ -60,6 +61,7 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
                                        bool swizzle, bool flip, bool downscale,
                                        uint8_t *pixels);
 static void surface_get_dimensions(PGRAPHState *pg, unsigned int *width, unsigned int *height);
+static void update_cpu_access_callback(NV2AState *d, SurfaceBinding *surface);
 
 void pgraph_gl_set_surface_scale_factor(NV2AState *d, unsigned int scale)
 {
@@ -121,6 +123,7 @@ static bool framebuffer_dirty(PGRAPHState *pg)
 
 void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
 {
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     NV2A_DPRINTF("pgraph_set_surface_dirty(%d, %d) -- %d %d\n",
@@ -136,14 +139,14 @@ void pgraph_gl_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
         r->color_binding->draw_dirty |= color;
         r->color_binding->frame_time = pg->frame_time;
         r->color_binding->cleared = false;
-
+        update_cpu_access_callback(d, r->color_binding);
     }
 
     if (r->zeta_binding) {
         r->zeta_binding->draw_dirty |= zeta;
         r->zeta_binding->frame_time = pg->frame_time;
         r->zeta_binding->cleared = false;
-
+        update_cpu_access_callback(d, r->zeta_binding);
     }
 }
 
@@ -349,11 +352,25 @@ static bool render_surface_to(NV2AState *d, SurfaceBinding *surface,
     glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
     glBindVertexArray(r->gl_vertex_array);
     glBindTexture(gl_target, gl_texture);
-    glUseProgram(
-        r->shader_binding ? r->shader_binding->gl_program : 0);
+    glUseProgram(r->shader_binding && r->shader_binding->initialized ?
+                     r->shader_binding->gl_program : 0);
     return true;
 }
 
+/* Fill the lower mip levels of a texture from level 0, texture must be bound */
+static void generate_texture_mipmaps(TextureBinding *texture,
+                                     TextureShape *texture_shape)
+{
+    if (texture_shape->levels <= 1) {
+        return;
+    }
+
+    glTexParameteri(texture->gl_target, GL_TEXTURE_MAX_LEVEL,
+                    texture_shape->levels - 1);
+    glGenerateMipmap(texture->gl_target);
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX_MIPMAPS);
+}
+
 static void render_surface_to_texture_slow(NV2AState *d,
                                            SurfaceBinding *surface,
                                            TextureBinding *texture,
@@ -386,6 +403,7 @@ static void render_surface_to_texture_slow(NV2AState *d,
                  f->gl_format, f->gl_type, buf);
     g_free(buf);
     glBindTexture(texture->gl_target, texture->gl_texture);
+    generate_texture_mipmaps(texture, texture_shape);
 }
 
 /* Note: This function is intended to be called before PGRAPH configures GL
@@ -430,8 +448,9 @@ void pgraph_gl_render_surface_to_texture(NV2AState *d, SurfaceBinding *surface,
         return;
     }
     glBindTexture(texture->gl_target, texture->gl_texture);
-    glUseProgram(
-        r->shader_binding ? r->shader_binding->gl_program : 0);
+    generate_texture_mipmaps(texture, texture_shape);
+    glUseProgram(r->shader_binding && r->shader_binding->initialized ?
+                     r->shader_binding->gl_program : 0);
 }
 
 bool pgraph_gl_check_surface_to_texture_compatibility(
@@ -459,8 +478,8 @@ bool pgraph_gl_check_surface_to_texture_compatibility(
         return false;
     }
 
-    if (shape->levels > 1) {
-        // FIXME: Support rendering surface to mip levels
+    if (shape->levels > 1 && !g_config.display.quality.surface_mipmaps) {
+        // Lower levels would come from guest memory
         return false;
     }
 
@@ -499,12 +518,48 @@ bool pgraph_gl_check_surface_to_texture_compatibility(
     return false;
 }
 
-static bool check_surface_overlaps_range(const SurfaceBinding *surface,
-                                         hwaddr range_start, hwaddr range_len)
+/*
+ * Surfaces in r->surfaces are also kept in an interval tree over their VRAM
+ * range, so range and address lookups don't have to scan the whole list.
+ */
+static void surface_index_insert(PGRAPHGLState *r, SurfaceBinding *surface)
+{
+    surface->itree.start = surface->vram_addr;
+    surface->itree.last = surface->vram_addr + MAX(surface->size, 1) - 1;
+    interval_tree_insert(&surface->itree, &r->surface_tree);
+}
+
+static void surface_index_remove(PGRAPHGLState *r, SurfaceBinding *surface)
+{
+    interval_tree_remove(&surface->itree, &r->surface_tree);
+}
+
+static SurfaceBinding *surface_index_first(PGRAPHGLState *r, hwaddr start,
+                                           hwaddr size)
+{
+    IntervalTreeNode *node = interval_tree_iter_first(
+        &r->surface_tree, start, start + MAX(size, 1) - 1);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
+static SurfaceBinding *surface_index_next(SurfaceBinding *surface,
+                                          hwaddr start, hwaddr size)
 {
-    hwaddr surface_end = surface->vram_addr + surface->size;
-    hwaddr range_end = range_start + range_len;
-    return !(surface->vram_addr >= range_end || range_start >= surface_end);
+    IntervalTreeNode *node = interval_tree_iter_next(
+        &surface->itree, start, start + MAX(size, 1) - 1);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
+void pgraph_gl_download_surfaces_in_range_if_dirty(NV2AState *d, hwaddr start,
+                                                   hwaddr size)
+{
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+    SurfaceBinding *surface;
+
+    for (surface = surface_index_first(r, start, size); surface;
+         surface = surface_index_next(surface, start, size)) {
+        pgraph_gl_surface_download_if_dirty(d, surface);
+    }
 }
 
 static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
@@ -517,11 +572,8 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     bool wait_for_downloads = false;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-        if (!check_surface_overlaps_range(surface, addr, len)) {
-            continue;
-        }
-
+    for (surface = surface_index_first(r, addr, len); surface;
+         surface = surface_index_next(surface, addr, len)) {
         hwaddr offset = addr - surface->vram_addr;
 
         if (write) {
@@ -532,6 +584,7 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
 
         if (surface->draw_dirty) {
             surface->download_pending = true;
+            surface->readback_requested |= !write;
             wait_for_downloads = true;
         }
 
@@ -552,48 +605,53 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     }
 }
 
-static void register_cpu_access_callback(NV2AState *d, SurfaceBinding *surface)
+/*
+ * Under TCG, CPU writes to VRAM land in the DIRTY_MEMORY_NV2A bitmap, which is
+ * all a surface needs while VRAM holds its latest contents. Accesses only have
+ * to trap while the GPU copy is newer, so the access callback is registered
+ * just for that stretch instead of for the lifetime of the surface.
+ */
+static void update_cpu_access_callback(NV2AState *d, SurfaceBinding *surface)
 {
-    if (tcg_enabled()) {
-        if (surface->width && surface->height) {
-            surface->access_cb = mem_access_callback_insert(
-                qemu_get_cpu(0), d->vram, surface->vram_addr, surface->size,
-                &surface_access_callback, d);
-        } else {
-            surface->access_cb = NULL;
-        }
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    bool watch = surface->draw_dirty && surface->width && surface->height;
+
+    if (watch && !surface->access_cb) {
+        surface->access_cb = mem_access_callback_queue_insert(
+            qemu_get_cpu(0), d->vram, surface->vram_addr, surface->size,
+            &surface_access_callback, d);
+    } else if (!watch && surface->access_cb) {
+        mem_access_callback_queue_remove(qemu_get_cpu(0), surface->access_cb);
+        surface->access_cb = NULL;
     }
 }
 
 static void unregister_cpu_access_callback(NV2AState *d,
-                                           SurfaceBinding const *surface)
+                                           SurfaceBinding *surface)
 {
     if (tcg_enabled()) {
-        mem_access_callback_remove_by_ref(qemu_get_cpu(0), surface->access_cb);
+        mem_access_callback_queue_remove(qemu_get_cpu(0), surface->access_cb);
+        surface->access_cb = NULL;
     }
 }
 
-static bool check_surfaces_overlap(const SurfaceBinding *surface,
-                                   const SurfaceBinding *other_surface)
-{
-    return check_surface_overlaps_range(surface, other_surface->vram_addr,
-                                        other_surface->size);
-}
-
 static void invalidate_overlapping_surfaces(NV2AState *d, SurfaceBinding *surface)
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    SurfaceBinding *other_surface, *next_surface;
-    QTAILQ_FOREACH_SAFE(other_surface, &r->surfaces, entry, next_surface) {
-        if (check_surfaces_overlap(surface, other_surface)) {
-            trace_nv2a_pgraph_surface_evict_overlapping(
-                other_surface->vram_addr, other_surface->width, other_surface->height,
-                other_surface->pitch);
-            pgraph_gl_surface_download_if_dirty(d, other_surface);
-            pgraph_gl_surface_invalidate(d, other_surface);
-        }
+    // Invalidation removes the surface from the index, so restart the query
+    SurfaceBinding *other_surface;
+    while ((other_surface = surface_index_first(r, surface->vram_addr,
+                                                surface->size))) {
+        trace_nv2a_pgraph_surface_evict_overlapping(
+            other_surface->vram_addr, other_surface->width, other_surface->height,
+            other_surface->pitch);
+        pgraph_gl_surface_download_if_dirty(d, other_surface);
+        pgraph_gl_surface_invalidate(d, other_surface);
     }
 }
 
@@ -611,9 +669,11 @@ static SurfaceBinding *surface_put(NV2AState *d, hwaddr addr,
     assert(surface_out != NULL);
     *surface_out = *surface_in;
 
-    register_cpu_access_callback(d, surface_out);
+    surface_out->access_cb = NULL;
+    update_cpu_access_callback(d, surface_out);
 
     QTAILQ_INSERT_TAIL(&r->surfaces, surface_out, entry);
+    surface_index_insert(r, surface_out);
 
     return surface_out;
 }
@@ -624,7 +684,8 @@ SurfaceBinding *pgraph_gl_surface_get(NV2AState *d, hwaddr addr)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (surface = surface_index_first(r, addr, 1); surface;
+         surface = surface_index_next(surface, addr, 1)) {
         if (surface->vram_addr == addr) {
             return surface;
         }
@@ -639,9 +700,9 @@ SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr)
     PGRAPHGLState *r = pg->gl_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
-        if (addr >= surface->vram_addr &&
-            addr < (surface->vram_addr + surface->size)) {
+    for (surface = surface_index_first(r, addr, 1); surface;
+         surface = surface_index_next(surface, addr, 1)) {
+        if (addr < surface->vram_addr + surface->size) {
             return surface;
         }
     }
@@ -649,6 +710,28 @@ SurfaceBinding *pgraph_gl_surface_get_within(NV2AState *d, hwaddr addr)
     return NULL;
 }
 
+static bool check_surface_readback_supported(PGRAPHState *pg,
+                                             const SurfaceBinding *surface)
+{
+    // Scaled surfaces would have to be shrunk after the wait anyway
+    return surface->color && pg->surface_scale_factor == 1 &&
+           surface->width && surface->height;
+}
+
+static void destroy_surface_readback(PGRAPHGLState *r, SurfaceBinding *surface)
+{
+    if (surface->readback_fence) {
+        glDeleteSync(surface->readback_fence);
+        surface->readback_fence = 0;
+    }
+    if (surface->readback_buffer) {
+        glDeleteBuffers(1, &surface->readback_buffer);
+        surface->readback_buffer = 0;
+        xemu_mem_account_add(r->readback_mem_account, -(int64_t)surface->size);
+    }
+    surface->readback_valid = false;
+}
+
 void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -668,8 +751,11 @@ void pgraph_gl_surface_invalidate(NV2AState *d, SurfaceBinding *surface)
     unregister_cpu_access_callback(d, surface);
 
     glDeleteTextures(1, &surface->gl_buffer);
+    xemu_mem_account_add(r->surface_mem_account, -(int64_t)surface->mem_size);
+    destroy_surface_readback(r, surface);
 
     QTAILQ_REMOVE(&r->surfaces, surface, entry);
+    surface_index_remove(r, surface);
     g_free(surface);
 }
 
@@ -782,30 +868,45 @@ static void bind_current_surface(NV2AState *d)
     }
 }
 
-static void surface_copy_shrink_row(uint8_t *out, uint8_t *in,
-                                    unsigned int width,
-                                    unsigned int bytes_per_pixel,
-                                    unsigned int factor)
+/*
+ * Attach a surface by itself to the bound framebuffer so it can be read from.
+ * The caller restores the framebuffer afterwards.
+ */
+static bool attach_surface_for_read(SurfaceBinding *surface)
 {
-    if (bytes_per_pixel == 4) {
-        for (unsigned int x = 0; x < width; x++) {
-            *(uint32_t *)out = *(uint32_t *)in;
-            out += 4;
-            in += 4 * factor;
-        }
-    } else if (bytes_per_pixel == 2) {
-        for (unsigned int x = 0; x < width; x++) {
-            *(uint16_t *)out = *(uint16_t *)in;
-            out += 2;
-            in += 2 * factor;
-        }
-    } else {
-        for (unsigned int x = 0; x < width; x++) {
-            memcpy(out, in, bytes_per_pixel);
-            out += bytes_per_pixel;
-            in += bytes_per_pixel * factor;
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
+                           0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                           GL_TEXTURE_2D, 0, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, surface->gl_buffer, 0);
+
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE) {
+#ifdef __ANDROID__
+        const char *status_str = "unknown";
+        switch (status) {
+        case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
+            status_str = "incomplete_attachment";
+            break;
+        case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
+            status_str = "missing_attachment";
+            break;
+        case GL_FRAMEBUFFER_UNSUPPORTED:
+            status_str = "unsupported";
+            break;
+        default:
+            break;
         }
+        fprintf(stderr, "nv2a: download FBO incomplete (%s=0x%x)\n",
+                status_str, status);
+#endif
+        return false;
     }
+
+    return true;
 }
 
 static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
@@ -813,7 +914,6 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
                                        uint8_t *pixels)
 {
     PGRAPHState *pg = &d->pgraph;
-    bool ok = true;
 
     swizzle &= surface->swizzle;
     downscale &= (pg->surface_scale_factor != 1);
@@ -829,41 +929,7 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
         surface->fmt.bytes_per_pixel);
 
     /*  Bind destination surface to framebuffer */
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                           0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-                           0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
-                           GL_TEXTURE_2D, 0, 0);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
-                           GL_TEXTURE_2D, surface->gl_buffer, 0);
-
-    {
-        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        if (status != GL_FRAMEBUFFER_COMPLETE) {
-#ifdef __ANDROID__
-            const char *status_str = "unknown";
-            switch (status) {
-            case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
-                status_str = "incomplete_attachment";
-                break;
-            case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
-                status_str = "missing_attachment";
-                break;
-            case GL_FRAMEBUFFER_UNSUPPORTED:
-                status_str = "unsupported";
-                break;
-            default:
-                break;
-            }
-            fprintf(stderr, "nv2a: download FBO incomplete (%s=0x%x)\n",
-                    status_str, status);
-#endif
-            ok = false;
-        }
-    }
-
-    if (!ok) {
+    if (!attach_surface_for_read(surface)) {
         if (pixels && surface->size) {
             memset(pixels, 0, surface->size);
         }
@@ -896,18 +962,12 @@ static void surface_download_to_buffer(NV2AState *d, SurfaceBinding *surface,
         pg->surface_scale_factor * surface->width,
         pg->surface_scale_factor * surface->height, flip, gl_read_buf);
 
-    /* FIXME: Replace this with a hw accelerated version */
     if (downscale) {
         assert(surface->pitch >= (surface->width * surface->fmt.bytes_per_pixel));
-        uint8_t *out = swizzle_buf, *in = pg->scale_buf;
-        for (unsigned int y = 0; y < surface->height; y++) {
-            surface_copy_shrink_row(out, in, surface->width,
-                                    surface->fmt.bytes_per_pixel,
-                                    pg->surface_scale_factor);
-            in += surface->pitch * pg->surface_scale_factor *
-                  pg->surface_scale_factor;
-            out += surface->pitch;
-        }
+        blit_shrink(pg->scale_buf, swizzle_buf, surface->width,
+                    surface->height, surface->pitch * pg->surface_scale_factor,
+                    surface->pitch, surface->fmt.bytes_per_pixel,
+                    pg->surface_scale_factor);
     }
 
     if (swizzle) {
@@ -923,6 +983,121 @@ cleanup:
     bind_current_surface(d);
 }
 
+/*
+ * Read surfaces the CPU is known to read into their pixel pack buffers at the
+ * end of the frame, so a later CPU access only has to wait on a fence instead
+ * of stalling in glReadPixels.
+ */
+void pgraph_gl_record_surface_readbacks(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHGLState *r = pg->gl_renderer_state;
+    bool attached = false;
+
+    SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        if (!surface->readback_requested || !surface->draw_dirty ||
+            !check_surface_readback_supported(pg, surface) ||
+            (surface->readback_valid &&
+             surface->readback_draw_time == surface->draw_time)) {
+            continue;
+        }
+
+        attached = true;
+        if (!attach_surface_for_read(surface)) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                                   GL_TEXTURE_2D, 0, 0);
+            continue;
+        }
+
+        if (!surface->readback_buffer) {
+            glGenBuffers(1, &surface->readback_buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, surface->size, NULL,
+                         GL_STREAM_READ);
+            xemu_mem_account_add(r->readback_mem_account, surface->size);
+        } else {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_buffer);
+        }
+
+        glo_readpixels(surface->fmt.gl_format, surface->fmt.gl_type,
+                       surface->fmt.bytes_per_pixel, surface->pitch,
+                       surface->width, surface->height, false, NULL);
+
+        if (surface->readback_fence) {
+            glDeleteSync(surface->readback_fence);
+        }
+        surface->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        surface->readback_draw_time = surface->draw_time;
+        surface->readback_valid = true;
+
+        glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+    }
+
+    if (attached) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        bind_current_surface(d);
+    }
+}
+
+/*
+ * Download from the copy made at the end of a frame if nothing was drawn to
+ * the surface since. Only waits for the copy itself to complete.
+ */
+static bool download_surface_from_readback(NV2AState *d,
+                                           SurfaceBinding *surface,
+                                           uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (!surface->readback_valid ||
+        surface->readback_draw_time != surface->draw_time ||
+        !check_surface_readback_supported(pg, surface)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_DEFERRED);
+
+    if (surface->readback_fence) {
+        glClientWaitSync(surface->readback_fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         GL_TIMEOUT_IGNORED);
+        glDeleteSync(surface->readback_fence);
+        surface->readback_fence = 0;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, surface->readback_buffer);
+    const uint8_t *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                             surface->size, GL_MAP_READ_BIT);
+    if (!mapped) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        return false;
+    }
+
+    trace_nv2a_pgraph_surface_download(
+        surface->color ? "COLOR" : "ZETA",
+        surface->swizzle ? "sz" : "lin", surface->vram_addr,
+        surface->width, surface->height, surface->pitch,
+        surface->fmt.bytes_per_pixel);
+
+    if (surface->swizzle) {
+        swizzle_rect(mapped, surface->width, surface->height, pixels,
+                     surface->pitch, surface->fmt.bytes_per_pixel);
+    } else {
+        // Leave the bytes past each row alone, as glReadPixels would
+        unsigned int row_size = surface->width * surface->fmt.bytes_per_pixel;
+        for (unsigned int y = 0; y < surface->height; y++) {
+            memcpy(pixels + y * surface->pitch, mapped + y * surface->pitch,
+                   row_size);
+        }
+    }
+
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    return true;
+}
+
 static void surface_download(NV2AState *d, SurfaceBinding *surface, bool force)
 {
     if (!(surface->download_pending || force) || !surface->width ||
@@ -934,18 +1109,26 @@ static void surface_download(NV2AState *d, SurfaceBinding *surface, bool force)
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
 
-    surface_download_to_buffer(d, surface, true, false, true,
-                               d->vram_ptr + surface->vram_addr);
+    PGRAPHGLState *r = d->pgraph.gl_renderer_state;
+    if (!download_surface_from_readback(d, surface,
+                                        d->vram_ptr + surface->vram_addr)) {
+        int timer_pair = pgraph_gl_gpu_timer_begin(
+            r, &r->gpu_timer.render, NV2A_PROF_GPU_SURFACE_DOWNLOAD);
+        surface_download_to_buffer(d, surface, true, false, true,
+                                   d->vram_ptr + surface->vram_addr);
+        pgraph_gl_gpu_timer_end(r, &r->gpu_timer.render, timer_pair);
+    }
 
     memory_region_set_client_dirty(d->vram, surface->vram_addr,
                                    surface->pitch * surface->height,
                                    DIRTY_MEMORY_VGA);
-    memory_region_set_client_dirty(d->vram, surface->vram_addr,
-                                   surface->pitch * surface->height,
-                                   DIRTY_MEMORY_NV2A_TEX);
+    pgraph_vram_set_dirty(d, surface->vram_addr,
+                          surface->pitch * surface->height,
+                          DIRTY_MEMORY_NV2A_TEX);
 
     surface->download_pending = false;
     surface->draw_dirty = false;
+    update_cpu_access_callback(d, surface);
 }
 
 void pgraph_gl_process_pending_downloads(NV2AState *d)
@@ -976,60 +1159,15 @@ void pgraph_gl_download_dirty_surfaces(NV2AState *d)
     qemu_event_set(&r->dirty_surfaces_download_complete);
 }
 
-static void surface_copy_expand_row(uint8_t *out, uint8_t *in,
-                                    unsigned int width,
-                                    unsigned int bytes_per_pixel,
-                                    unsigned int factor)
-{
-    if (bytes_per_pixel == 4) {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int i = 0; i < factor; i++) {
-                *(uint32_t *)out = *(uint32_t *)in;
-                out += bytes_per_pixel;
-            }
-            in += bytes_per_pixel;
-        }
-    } else if (bytes_per_pixel == 2) {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int i = 0; i < factor; i++) {
-                *(uint16_t *)out = *(uint16_t *)in;
-                out += bytes_per_pixel;
-            }
-            in += bytes_per_pixel;
-        }
-    } else {
-        for (unsigned int x = 0; x < width; x++) {
-            for (unsigned int i = 0; i < factor; i++) {
-                memcpy(out, in, bytes_per_pixel);
-                out += bytes_per_pixel;
-            }
-            in += bytes_per_pixel;
-        }
-    }
-}
-
-static void surface_copy_expand(uint8_t *out, uint8_t *in, unsigned int width,
-                                unsigned int height,
-                                unsigned int bytes_per_pixel,
-                                unsigned int factor)
-{
-    size_t out_pitch = width * bytes_per_pixel * factor;
-
-    for (unsigned int y = 0; y < height; y++) {
-        surface_copy_expand_row(out, in, width, bytes_per_pixel, factor);
-        uint8_t *row_in = out;
-        for (unsigned int i = 1; i < factor; i++) {
-            out += out_pitch;
-            memcpy(out, row_in, out_pitch);
-        }
-        in += width * bytes_per_pixel;
-        out += out_pitch;
-    }
-}
-
 void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                                 bool force)
 {
+    if (tcg_enabled() && !surface->draw_dirty) {
+        /* Pick up CPU writes made since VRAM was last in sync */
+        surface->upload_pending |= pgraph_vram_test_and_clear_dirty(
+            d, surface->vram_addr, surface->size, DIRTY_MEMORY_NV2A);
+    }
+
     if (!(surface->upload_pending || force)) {
         return;
     }
@@ -1046,6 +1184,7 @@ void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
 
     surface->upload_pending = false;
     surface->draw_time = pg->draw_time;
+    surface->readback_valid = false;
 
     if (!surface->width || !surface->height) {
         return;
@@ -1075,13 +1214,12 @@ void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                        surface->fmt.bytes_per_pixel);
     }
 
-    /* FIXME: Replace this scaling */
-
     // This is VRAM so we can't do this inplace!
     uint8_t *optimal_buf = buf;
     unsigned int optimal_pitch = surface->width * surface->fmt.bytes_per_pixel;
 
-    if (surface->pitch != optimal_pitch) {
+    // Scaling repacks the rows anyway
+    if (surface->pitch != optimal_pitch && pg->surface_scale_factor == 1) {
         optimal_buf = (uint8_t *)g_malloc(surface->height * optimal_pitch);
 
         uint8_t *src = buf;
@@ -1102,10 +1240,9 @@ void pgraph_gl_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
         pg->scale_buf = (uint8_t *)g_realloc(
             pg->scale_buf, width * height * surface->fmt.bytes_per_pixel);
         gl_read_buf = pg->scale_buf;
-        uint8_t *out = gl_read_buf, *in = optimal_buf;
-        surface_copy_expand(out, in, surface->width, surface->height,
-                            surface->fmt.bytes_per_pixel,
-                            d->pgraph.surface_scale_factor);
+        blit_expand(buf, gl_read_buf, surface->width, surface->height,
+                    surface->pitch, width * surface->fmt.bytes_per_pixel,
+                    surface->fmt.bytes_per_pixel, pg->surface_scale_factor);
     }
 
     int prev_unpack_alignment;
@@ -1264,6 +1401,10 @@ static void populate_surface_binding_entry_sized(NV2AState *d, bool color,
     entry->frame_time = pg->frame_time;
     entry->draw_time = pg->draw_time;
     entry->cleared = false;
+    entry->readback_requested = false;
+    entry->readback_valid = false;
+    entry->readback_buffer = 0;
+    entry->readback_fence = 0;
 }
 
 static void populate_surface_binding_entry(NV2AState *d, bool color,
@@ -1303,9 +1444,8 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
 
     Surface *surface = color ? &pg->surface_color : &pg->surface_zeta;
 
-    bool mem_dirty = !tcg_enabled() && memory_region_test_and_clear_dirty(
-                                           d->vram, entry.vram_addr, entry.size,
-                                           DIRTY_MEMORY_NV2A);
+    bool mem_dirty = pgraph_vram_test_and_clear_dirty(
+        d, entry.vram_addr, entry.size, DIRTY_MEMORY_NV2A);
 
     if (upload && (surface->buffer_dirty || mem_dirty)) {
         pgraph_gl_unbind_surface(d, color);
@@ -1422,6 +1562,8 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
             glTexImage2D(GL_TEXTURE_2D, 0, entry.fmt.gl_internal_format, width,
                          height, 0, entry.fmt.gl_format, entry.fmt.gl_type,
                          NULL);
+            entry.mem_size = width * height * entry.fmt.bytes_per_pixel;
+            xemu_mem_account_add(r->surface_mem_account, entry.mem_size);
             found = surface_put(d, entry.vram_addr, &entry);
 
             /* FIXME: Refactor */
@@ -1620,6 +1762,9 @@ void pgraph_gl_init_surfaces(PGRAPHState *pg)
     glGenFramebuffers(1, &r->gl_framebuffer);
     glBindFramebuffer(GL_FRAMEBUFFER, r->gl_framebuffer);
     QTAILQ_INIT(&r->surfaces);
+    r->surface_tree = (IntervalTreeRoot){};
+    r->surface_mem_account = xemu_mem_account("gl", "surfaces");
+    r->readback_mem_account = xemu_mem_account("gl", "surface readbacks");
     r->downloads_pending = false;
     qemu_event_init(&r->downloads_complete, false);
     qemu_event_init(&r->dirty_surfaces_download_complete, false);
@@ -1660,12 +1805,13 @@ void pgraph_gl_finalize_surfaces(PGRAPHState *pg)
     finalize_render_to_texture(pg);
 }
 
-void pgraph_gl_surface_flush(NV2AState *d)
+void pgraph_gl_surface_flush(NV2AState *d, bool discard)
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHGLState *r = pg->gl_renderer_state;
 
-    bool update_surface = (r->color_binding || r->zeta_binding);
+    /* After a load, the next draw binds its surfaces again */
+    bool update_surface = !discard && (r->color_binding || r->zeta_binding);
 
     flush_surfaces(d);
 
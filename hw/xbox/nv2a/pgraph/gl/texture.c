@@ -19,6 +19,8 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <math.h>
+
 #include "qemu/fast-hash.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "hw/xbox/nv2a/pgraph/swizzle.h"
@@ -27,7 +29,10 @@
 #include "debug.h"
 #include "renderer.h"
 
-static TextureBinding* generate_texture(const TextureShape s, const uint8_t *texture_data, const uint8_t *palette_data);
+static TextureBinding* generate_texture(PGRAPHGLState *r,
+                                        const TextureShape s,
+                                        const uint8_t *texture_data,
+                                        const uint8_t *palette_data);
 static void texture_binding_destroy(gpointer data);
 
 struct pgraph_texture_possibly_dirty_struct {
@@ -82,8 +87,8 @@ static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
     hwaddr end = TARGET_PAGE_ALIGN(addr + size);
     addr &= TARGET_PAGE_MASK;
     assert(end < memory_region_size(d->vram));
-    return memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
-                                              DIRTY_MEMORY_NV2A_TEX);
+    return pgraph_vram_test_and_clear_dirty(d, addr, end - addr,
+                                            DIRTY_MEMORY_NV2A_TEX);
 }
 
 // Check if any of the pages spanned by the a texture are dirty.
@@ -115,12 +120,11 @@ static void apply_texture_parameters(PGRAPHGLState *r,
                                      unsigned int address,
                                      bool is_bordered,
                                      uint32_t border_color,
-                                     uint32_t max_anisotropy)
+                                     uint32_t max_anisotropy,
+                                     float lod_bias)
 {
     unsigned int min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
     unsigned int mag_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG);
-    unsigned int lod_bias =
-        GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS);
     unsigned int addru = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU);
     unsigned int addrv = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV);
     unsigned int addrp = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRP);
@@ -153,8 +157,7 @@ static void apply_texture_parameters(PGRAPHGLState *r,
 #ifndef __ANDROID__
     if (lod_bias != binding->lod_bias) {
         binding->lod_bias = lod_bias;
-        glTexParameterf(binding->gl_target, GL_TEXTURE_LOD_BIAS,
-                        pgraph_convert_lod_bias_to_float(lod_bias));
+        glTexParameterf(binding->gl_target, GL_TEXTURE_LOD_BIAS, lod_bias);
     }
 #else
     binding->lod_bias = lod_bias;
@@ -232,9 +235,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
         uint32_t filter = pgraph_reg_r(pg, NV_PGRAPH_TEXFILTER0 + i*4);
         uint32_t address = pgraph_reg_r(pg, NV_PGRAPH_TEXADDRESS0 + i*4);
         uint32_t border_color = pgraph_reg_r(pg, NV_PGRAPH_BORDERCOLOR0 + i*4);
-        uint32_t max_anisotropy =
-            1 << (GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_TEXCTL0_0 + i*4),
-                           NV_PGRAPH_TEXCTL0_0_MAX_ANISOTROPY));
+        uint32_t max_anisotropy = pgraph_get_texture_max_anisotropy(pg, i);
+        float lod_bias = pgraph_get_texture_lod_bias(pg, i);
 
         /* Check for unsupported features */
         if (filter & NV_PGRAPH_TEXFILTER0_ASIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_ASIGNED");
@@ -286,7 +288,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
                                          address,
                                          state.border,
                                          border_color,
-                                         max_anisotropy);
+                                         max_anisotropy,
+                                         lod_bias);
                 continue;
             }
         }
@@ -299,7 +302,7 @@ void pgraph_gl_bind_textures(NV2AState *d)
             surf_to_tex = pgraph_gl_check_surface_to_texture_compatibility(
                     surface, &state);
 
-            if (surf_to_tex && surface->upload_pending) {
+            if (surf_to_tex) {
                 pgraph_gl_upload_surface_data(d, surface, false);
             }
         }
@@ -308,15 +311,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
             // FIXME: Restructure to support rendering surfaces to cubemap faces
 
             // Writeback any surfaces which this texture may index
-            hwaddr tex_vram_end = texture_vram_offset + length - 1;
-            QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-                hwaddr surf_vram_end = surface->vram_addr + surface->size - 1;
-                bool overlapping = !(surface->vram_addr >= tex_vram_end
-                                     || texture_vram_offset >= surf_vram_end);
-                if (overlapping) {
-                    pgraph_gl_surface_download_if_dirty(d, surface);
-                }
-            }
+            pgraph_gl_download_surfaces_in_range_if_dirty(
+                d, texture_vram_offset, length);
         }
 
         TextureKey key;
@@ -334,6 +330,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
         LruNode *found = lru_lookup(&r->texture_cache,
                                      tex_binding_hash, &key);
         TextureLruNode *key_out = container_of(found, TextureLruNode, node);
+        nv2a_profile_inc_counter(key_out->binding ? NV2A_PROF_TEX_CACHE_HIT :
+                                                    NV2A_PROF_TEX_CACHE_MISS);
         possibly_dirty |= (key_out->binding == NULL) || key_out->possibly_dirty;
 
         if (!surf_to_tex && !possibly_dirty_checked) {
@@ -368,7 +366,7 @@ void pgraph_gl_bind_textures(NV2AState *d)
 
         if (key_out->binding == NULL) {
             // Must create the texture
-            key_out->binding = generate_texture(state, texture_data, palette_data);
+            key_out->binding = generate_texture(r, state, texture_data, palette_data);
             key_out->binding->data_hash = tex_data_hash;
             key_out->binding->scale = 1;
         } else {
@@ -398,7 +396,8 @@ void pgraph_gl_bind_textures(NV2AState *d)
                                  address,
                                  state.border,
                                  border_color,
-                                 max_anisotropy);
+                                 max_anisotropy,
+                                 lod_bias);
 
         if (r->texture_binding[i]) {
             if (r->texture_binding[i]->gl_target != binding->gl_target) {
@@ -427,225 +426,362 @@ gl_internal_format_to_s3tc_enum(GLint gl_internal_format)
     }
 }
 
-static void upload_gl_texture(GLenum gl_target,
-                              const TextureShape s,
-                              const uint8_t *texture_data,
-                              const uint8_t *palette_data)
+static void upload_linear_texture(const TextureShape s,
+                                  const uint8_t *texture_data,
+                                  const uint8_t *palette_data)
 {
     ColorFormatInfo f = kelvin_color_format_gl_map[s.color_format];
     nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
-    unsigned int adjusted_width = s.width;
-    unsigned int adjusted_height = s.height;
-    unsigned int adjusted_pitch = s.pitch;
-    unsigned int adjusted_depth = s.depth;
-    if (!f.linear && s.border) {
-        adjusted_width = MAX(16, adjusted_width * 2);
-        adjusted_height = MAX(16, adjusted_height * 2);
-        adjusted_pitch = adjusted_width * (s.pitch / s.width);
-        adjusted_depth = MAX(16, s.depth * 2);
+    /* Can't handle strides unaligned to pixels */
+    assert(s.pitch % f.bytes_per_pixel == 0);
+
+    uint8_t *converted = pgraph_convert_texture_data(
+        s, texture_data, palette_data, s.width, s.height, 1, s.pitch, 0, NULL);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH,
+                  converted ? 0 : s.pitch / f.bytes_per_pixel);
+    glTexImage2D(GL_TEXTURE_2D, 0, f.gl_internal_format, s.width, s.height, 0,
+                 f.gl_format, f.gl_type, converted ? converted : texture_data);
+
+    if (converted) {
+        g_free(converted);
     }
 
-    switch(gl_target) {
-    case GL_TEXTURE_1D:
-        assert(false);
-        break;
-    case GL_TEXTURE_2D:
-        if (f.linear) {
-            /* Can't handle strides unaligned to pixels */
-            assert(s.pitch % f.bytes_per_pixel == 0);
-
-            uint8_t *converted = pgraph_convert_texture_data(
-                s, texture_data, palette_data, adjusted_width, adjusted_height, 1,
-                adjusted_pitch, 0, NULL);
-            glPixelStorei(GL_UNPACK_ROW_LENGTH,
-                          converted ? 0 : adjusted_pitch / f.bytes_per_pixel);
-            glTexImage2D(GL_TEXTURE_2D, 0, f.gl_internal_format,
-                         adjusted_width, adjusted_height, 0,
-                         f.gl_format, f.gl_type,
-                         converted ? converted : texture_data);
-
-            if (converted) {
-              g_free(converted);
-            }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+}
 
-            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-            break;
+typedef struct TextureDecodeBatch {
+    QemuMutex lock;
+    QemuCond cond;
+    int remaining;
+} TextureDecodeBatch;
+
+// Decode of one mip level of one face of a swizzled or compressed texture,
+// into its part of the mapped unpack buffer
+typedef struct TextureLevelDecodeJob {
+    const TextureShape *s;
+    const uint8_t *data;
+    const uint8_t *palette_data;
+    GLenum gl_target;
+    int level;
+    unsigned int width, height, depth;
+    size_t decoded_size;
+    size_t buffer_offset;
+    uint8_t *dst;
+    TextureDecodeBatch *batch;
+} TextureLevelDecodeJob;
+
+/*
+ * Size of a level once decoded, matching what s3tc_decompress_* and
+ * pgraph_convert_texture_data produce for swizzled formats.
+ */
+static size_t get_decoded_level_size(const TextureShape *s, unsigned int width,
+                                     unsigned int height, unsigned int depth)
+{
+    ColorFormatInfo f = kelvin_color_format_gl_map[s->color_format];
+    size_t num_texels = (size_t)width * height * depth;
+
+    if (f.gl_format == 0) { /* compressed */
+        return num_texels * 4;
+    }
+
+    switch (s->color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8:
+        return num_texels * 4;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R6G5B5:
+        return num_texels * 3;
+    default:
+        return num_texels * f.bytes_per_pixel;
+    }
+}
+
+static void decode_texture_level(TextureLevelDecodeJob *job)
+{
+    const TextureShape *s = job->s;
+    ColorFormatInfo f = kelvin_color_format_gl_map[s->color_format];
+    unsigned int width = job->width, height = job->height, depth = job->depth;
+
+    if (f.gl_format == 0) { /* compressed */
+        enum S3TC_DECOMPRESS_FORMAT format =
+            gl_internal_format_to_s3tc_enum(f.gl_internal_format);
+        uint8_t *converted =
+            s->dimensionality == 3 ?
+                s3tc_decompress_3d(format, job->data, width, height, depth) :
+                s3tc_decompress_2d(format, job->data, width, height);
+        memcpy(job->dst, converted, job->decoded_size);
+        g_free(converted);
+        return;
+    }
+
+    // Unswizzle straight into the buffer, and only copy again if the format
+    // still needs converting
+    unsigned int row_pitch = width * f.bytes_per_pixel;
+    unsigned int slice_pitch = row_pitch * height;
+    uint8_t *unswizzled = job->dst;
+    if (job->decoded_size != (size_t)slice_pitch * depth) {
+        unswizzled = g_malloc(slice_pitch * depth);
+    }
+    unswizzle_box(job->data, width, height, depth, unswizzled, row_pitch,
+                  slice_pitch, f.bytes_per_pixel);
+
+    size_t converted_size;
+    uint8_t *converted = pgraph_convert_texture_data(
+        *s, unswizzled, job->palette_data, width, height, depth, row_pitch,
+        slice_pitch, &converted_size);
+    if (converted) {
+        assert(converted_size == job->decoded_size);
+        memcpy(job->dst, converted, converted_size);
+        g_free(converted);
+    }
+    if (unswizzled != job->dst) {
+        g_free(unswizzled);
+    }
+}
+
+static void texture_decode_worker(gpointer data, gpointer user_data)
+{
+    TextureLevelDecodeJob *job = data;
+
+    decode_texture_level(job);
+
+    qemu_mutex_lock(&job->batch->lock);
+    if (--job->batch->remaining == 0) {
+        qemu_cond_signal(&job->batch->cond);
+    }
+    qemu_mutex_unlock(&job->batch->lock);
+}
+
+// Below this much decoded data, handing jobs to the pool costs more than it
+// saves
+#define TEXTURE_DECODE_THREAD_MIN_SIZE (64 * KiB)
+
+static void run_texture_level_decode_jobs(PGRAPHGLState *r,
+                                          TextureLevelDecodeJob *jobs,
+                                          int num_jobs, size_t total_size)
+{
+    if (!r->texture_decode_pool || num_jobs < 2 ||
+        total_size < TEXTURE_DECODE_THREAD_MIN_SIZE) {
+        for (int i = 0; i < num_jobs; i++) {
+            decode_texture_level(&jobs[i]);
         }
-        /* fallthru */
-    case GL_TEXTURE_CUBE_MAP_POSITIVE_X:
-    case GL_TEXTURE_CUBE_MAP_NEGATIVE_X:
-    case GL_TEXTURE_CUBE_MAP_POSITIVE_Y:
-    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Y:
-    case GL_TEXTURE_CUBE_MAP_POSITIVE_Z:
-    case GL_TEXTURE_CUBE_MAP_NEGATIVE_Z: {
-
-        unsigned int width = adjusted_width, height = adjusted_height;
-
-        int level;
-        for (level = 0; level < s.levels; level++) {
-            width = MAX(width, 1);
-            height = MAX(height, 1);
+        return;
+    }
 
-            if (f.gl_format == 0) { /* compressed */
-                 // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
-                unsigned int block_size =
-                    f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ?
-                        8 : 16;
-                unsigned int physical_width = (width + 3) & ~3,
-                             physical_height = (height + 3) & ~3;
-                uint8_t *converted = s3tc_decompress_2d(
-                    gl_internal_format_to_s3tc_enum(f.gl_internal_format),
-                    texture_data, width, height);
-                unsigned int tex_width = width;
-                unsigned int tex_height = height;
-
-                if (s.cubemap && adjusted_width != s.width) {
-                    // FIXME: Consider preserving the border.
-                    // There does not seem to be a way to reference the border
-                    // texels in a cubemap, so they are discarded.
-                    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 4);
-                    glPixelStorei(GL_UNPACK_SKIP_ROWS, 4);
-                    tex_width = s.width;
-                    tex_height = s.height;
-                    if (physical_width == width) {
-                        glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                    }
-                }
+    TextureDecodeBatch batch;
+    qemu_mutex_init(&batch.lock);
+    qemu_cond_init(&batch.cond);
+    batch.remaining = num_jobs - 1;
 
-                glTexImage2D(gl_target, level, GL_RGBA, tex_width, tex_height, 0,
-                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV, converted);
-                g_free(converted);
-                if (s.cubemap && adjusted_width != s.width) {
-                    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
-                    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
-                    if (physical_width == width) {
-                        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-                    }
-                }
-                texture_data +=
-                    physical_width / 4 * physical_height / 4 * block_size;
-            } else {
-                unsigned int pitch = width * f.bytes_per_pixel;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                unswizzle_rect(texture_data, width, height,
-                               unswizzled, pitch, f.bytes_per_pixel);
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data, width, height, 1, pitch, 0,
-                    NULL);
-                uint8_t *pixel_data = converted ? converted : unswizzled;
-                unsigned int tex_width = width;
-                unsigned int tex_height = height;
-
-                if (s.cubemap && adjusted_width != s.width) {
-                    // FIXME: Consider preserving the border.
-                    // There does not seem to be a way to reference the border
-                    // texels in a cubemap, so they are discarded.
-                    glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                    tex_width = s.width;
-                    tex_height = s.height;
-                    pixel_data += 4 * f.bytes_per_pixel + 4 * pitch;
-                }
+    // The first level is the largest, decode it here while workers take the
+    // remaining levels and faces
+    for (int i = 1; i < num_jobs; i++) {
+        jobs[i].batch = &batch;
+        g_thread_pool_push(r->texture_decode_pool, &jobs[i], NULL);
+    }
+    decode_texture_level(&jobs[0]);
 
-                glTexImage2D(gl_target, level, f.gl_internal_format, tex_width,
-                             tex_height, 0, f.gl_format, f.gl_type,
-                             pixel_data);
-                if (s.cubemap && s.border) {
-                    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-                }
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
+    qemu_mutex_lock(&batch.lock);
+    while (batch.remaining) {
+        qemu_cond_wait(&batch.cond, &batch.lock);
+    }
+    qemu_mutex_unlock(&batch.lock);
+
+    qemu_cond_destroy(&batch.cond);
+    qemu_mutex_destroy(&batch.lock);
+}
+
+static void upload_texture_level(const TextureLevelDecodeJob *job,
+                                 unsigned int adjusted_width)
+{
+    const TextureShape *s = job->s;
+    ColorFormatInfo f = kelvin_color_format_gl_map[s->color_format];
+    const GLvoid *pixel_data = (const GLvoid *)(uintptr_t)job->buffer_offset;
+    unsigned int width = job->width, height = job->height;
+
+    if (job->gl_target == GL_TEXTURE_3D) {
+        if (f.gl_format == 0) { /* compressed */
+            glTexImage3D(job->gl_target, job->level, GL_RGBA8, width, height,
+                         job->depth, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                         pixel_data);
+        } else {
+            glTexImage3D(job->gl_target, job->level, f.gl_internal_format,
+                         width, height, job->depth, 0, f.gl_format, f.gl_type,
+                         pixel_data);
+        }
+        return;
+    }
 
-                texture_data += width * height * f.bytes_per_pixel;
+    unsigned int tex_width = width;
+    unsigned int tex_height = height;
+
+    if (f.gl_format == 0) { /* compressed */
+        unsigned int physical_width = (width + 3) & ~3;
+
+        if (s->cubemap && adjusted_width != s->width) {
+            // FIXME: Consider preserving the border.
+            // There does not seem to be a way to reference the border
+            // texels in a cubemap, so they are discarded.
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, 4);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, 4);
+            tex_width = s->width;
+            tex_height = s->height;
+            if (physical_width == width) {
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
             }
+        }
 
-            width /= 2;
-            height /= 2;
+        glTexImage2D(job->gl_target, job->level, GL_RGBA, tex_width,
+                     tex_height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
+                     pixel_data);
+        if (s->cubemap && adjusted_width != s->width) {
+            glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+            glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+            if (physical_width == width) {
+                glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            }
+        }
+    } else {
+        unsigned int pitch = width * f.bytes_per_pixel;
+
+        if (s->cubemap && adjusted_width != s->width) {
+            // FIXME: Consider preserving the border.
+            // There does not seem to be a way to reference the border
+            // texels in a cubemap, so they are discarded.
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
+            tex_width = s->width;
+            tex_height = s->height;
+            pixel_data = (const GLvoid *)(uintptr_t)(
+                job->buffer_offset + 4 * f.bytes_per_pixel + 4 * pitch);
         }
 
-        break;
+        glTexImage2D(job->gl_target, job->level, f.gl_internal_format,
+                     tex_width, tex_height, 0, f.gl_format, f.gl_type,
+                     pixel_data);
+        if (s->cubemap && s->border) {
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        }
     }
-    case GL_TEXTURE_3D: {
+}
 
-        unsigned int width = adjusted_width;
-        unsigned int height = adjusted_height;
-        unsigned int depth = adjusted_depth;
+// Offsets into the unpack buffer stay aligned for any pixel type
+#define TEXTURE_DECODE_ALIGNMENT 16
 
-        assert(f.linear == false);
+/*
+ * Decode every level of every face, spread over the decode pool, into one
+ * pixel unpack buffer. The levels are only uploaded once all of them are
+ * done.
+ */
+static void upload_swizzled_texture(PGRAPHGLState *r, GLenum gl_target,
+                                    const TextureShape s,
+                                    const uint8_t *texture_data,
+                                    const uint8_t *palette_data,
+                                    size_t face_size)
+{
+    ColorFormatInfo f = kelvin_color_format_gl_map[s.color_format];
+    assert(gl_target != GL_TEXTURE_1D);
 
-        int level;
-        for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) { /* compressed */
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                unsigned int physical_width = (width + 3) & ~3,
-                             physical_height = (height + 3) & ~3;
-                depth = MAX(depth, 1);
+    unsigned int adjusted_width = s.width;
+    unsigned int adjusted_height = s.height;
+    unsigned int adjusted_depth = s.depth;
+    if (s.border) {
+        adjusted_width = MAX(16, adjusted_width * 2);
+        adjusted_height = MAX(16, adjusted_height * 2);
+        adjusted_depth = MAX(16, s.depth * 2);
+    }
 
-                unsigned int block_size;
-                if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                    block_size = 8;
-                } else {
-                    block_size = 16;
-                }
+    unsigned int block_size =
+        f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT ? 8 : 16;
 
-                size_t texture_size = physical_width/4 * physical_height/4 * depth * block_size;
+    TextureLevelDecodeJob jobs[6 * 16]; // Up to 16 levels of each face
+    int num_jobs = 0;
+    size_t total_size = 0;
 
-                uint8_t *converted = s3tc_decompress_3d(
-                    gl_internal_format_to_s3tc_enum(f.gl_internal_format),
-                    texture_data, width, height, depth);
+    const int num_faces = s.cubemap ? 6 : 1;
+    for (int face = 0; face < num_faces; face++) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
-                glTexImage3D(gl_target, level,  GL_RGBA8,
-                             width, height, depth, 0,
-                             GL_RGBA, GL_UNSIGNED_INT_8_8_8_8_REV,
-                             converted);
+        const uint8_t *level_data = texture_data + face * face_size;
+        unsigned int width = adjusted_width, height = adjusted_height,
+                     depth = gl_target == GL_TEXTURE_3D ? adjusted_depth : 1;
 
-                g_free(converted);
+        for (int level = 0; level < s.levels; level++) {
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+            depth = MAX(depth, 1);
+
+            size_t decoded_size =
+                get_decoded_level_size(&s, width, height, depth);
+            assert(num_jobs < ARRAY_SIZE(jobs));
+            jobs[num_jobs++] = (TextureLevelDecodeJob){
+                .s = &s,
+                .data = level_data,
+                .palette_data = palette_data,
+                .gl_target = s.cubemap ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face :
+                                         gl_target,
+                .level = level,
+                .width = width,
+                .height = height,
+                .depth = depth,
+                .decoded_size = decoded_size,
+                .buffer_offset = total_size,
+            };
+            total_size += ROUND_UP(decoded_size, TEXTURE_DECODE_ALIGNMENT);
 
-                texture_data += texture_size;
+            if (f.gl_format == 0) { /* compressed */
+                // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
+                unsigned int physical_width = (width + 3) & ~3,
+                             physical_height = (height + 3) & ~3;
+                level_data += physical_width / 4 * physical_height / 4 *
+                              depth * block_size;
             } else {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                depth = MAX(depth, 1);
-
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-                uint8_t *unswizzled = (uint8_t*)g_malloc(slice_pitch * depth);
-                unswizzle_box(texture_data, width, height, depth, unswizzled,
-                               row_pitch, slice_pitch, f.bytes_per_pixel);
-
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data, width, height, depth,
-                    row_pitch, slice_pitch, NULL);
-
-                glTexImage3D(gl_target, level, f.gl_internal_format,
-                             width, height, depth, 0,
-                             f.gl_format, f.gl_type,
-                             converted ? converted : unswizzled);
-
-                if (converted) {
-                    g_free(converted);
-                }
-                g_free(unswizzled);
-
-                texture_data += width * height * depth * f.bytes_per_pixel;
+                level_data += width * height * depth * f.bytes_per_pixel;
             }
 
             width /= 2;
             height /= 2;
             depth /= 2;
         }
-        break;
     }
-    default:
-        assert(false);
-        break;
+
+    // Decode straight into the persistently mapped upload ring when the
+    // texture fits, otherwise into a buffer of its own
+    StreamAlloc alloc;
+    GLuint buffer = 0;
+    uint8_t *mapped = pgraph_gl_stream_map(&r->texture_upload_buffer,
+                                           total_size,
+                                           TEXTURE_DECODE_ALIGNMENT, &alloc);
+    if (mapped) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_STREAMED);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, alloc.buffer);
+    } else {
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, total_size, NULL, GL_STREAM_DRAW);
+        mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total_size,
+                                  GL_MAP_WRITE_BIT |
+                                      GL_MAP_INVALIDATE_BUFFER_BIT);
+        assert(mapped);
+        alloc = (StreamAlloc){ .buffer = buffer, .offset = 0 };
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        jobs[i].dst = mapped + jobs[i].buffer_offset;
+        jobs[i].buffer_offset += alloc.offset;
+    }
+
+    run_texture_level_decode_jobs(r, jobs, num_jobs, total_size);
+
+    if (buffer) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    for (int i = 0; i < num_jobs; i++) {
+        upload_texture_level(&jobs[i], adjusted_width);
     }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
 }
 
-static TextureBinding* generate_texture(const TextureShape s,
+static TextureBinding* generate_texture(PGRAPHGLState *r,
+                                        const TextureShape s,
                                         const uint8_t *texture_data,
                                         const uint8_t *palette_data)
 {
@@ -692,51 +828,45 @@ static TextureBinding* generate_texture(const TextureShape s,
                    s.dimensionality, s.cubemap ? " (Cubemap)" : "",
                    s.width, s.height, s.depth);
 
-    if (gl_target == GL_TEXTURE_CUBE_MAP) {
-        unsigned int block_size;
-        if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-            block_size = 8;
-        } else {
-            block_size = 16;
-        }
+    xemu_trace_begin("texture upload", NULL);
+    if (f.linear) {
+        upload_linear_texture(s, texture_data, palette_data);
+    } else {
+        size_t face_size = 0;
+        if (gl_target == GL_TEXTURE_CUBE_MAP) {
+            unsigned int block_size;
+            if (f.gl_internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
+                block_size = 8;
+            } else {
+                block_size = 16;
+            }
 
-        size_t length = 0;
-        unsigned int w = s.width;
-        unsigned int h = s.height;
-        if (!f.linear && s.border) {
-            w = MAX(16, w * 2);
-            h = MAX(16, h * 2);
-        }
+            unsigned int w = s.width;
+            unsigned int h = s.height;
+            if (s.border) {
+                w = MAX(16, w * 2);
+                h = MAX(16, h * 2);
+            }
 
-        int level;
-        for (level = 0; level < s.levels; level++) {
-            if (f.gl_format == 0) {
-                length += w/4 * h/4 * block_size;
-            } else {
-                length += w * h * f.bytes_per_pixel;
+            for (int level = 0; level < s.levels; level++) {
+                if (f.gl_format == 0) {
+                    face_size += w/4 * h/4 * block_size;
+                } else {
+                    face_size += w * h * f.bytes_per_pixel;
+                }
+
+                w /= 2;
+                h /= 2;
             }
 
-            w /= 2;
-            h /= 2;
+            face_size = (face_size + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) &
+                        ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
         }
 
-        length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
-
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_X,
-                          s, texture_data + 0 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_X,
-                          s, texture_data + 1 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Y,
-                          s, texture_data + 2 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Y,
-                          s, texture_data + 3 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_POSITIVE_Z,
-                          s, texture_data + 4 * length, palette_data);
-        upload_gl_texture(GL_TEXTURE_CUBE_MAP_NEGATIVE_Z,
-                          s, texture_data + 5 * length, palette_data);
-    } else {
-        upload_gl_texture(gl_target, s, texture_data, palette_data);
+        upload_swizzled_texture(r, gl_target, s, texture_data, palette_data,
+                                face_size);
     }
+    xemu_trace_end();
 
     /* Linear textures don't support mipmapping */
     if (!f.linear) {
@@ -760,11 +890,16 @@ static TextureBinding* generate_texture(const TextureShape s,
     ret->data_hash = 0;
     ret->min_filter = 0xFFFFFFFF;
     ret->mag_filter = 0xFFFFFFFF;
-    ret->lod_bias = 0xFFFFFFFF;
+    ret->lod_bias = NAN;
     ret->addru = 0xFFFFFFFF;
     ret->addrv = 0xFFFFFFFF;
     ret->addrp = 0xFFFFFFFF;
     ret->border_color_set = false;
+
+    TextureShape shape = s;
+    ret->mem_size = pgraph_get_texture_length(&g_nv2a->pgraph, &shape);
+    ret->mem_account = r->texture_mem_account;
+    xemu_mem_account_add(ret->mem_account, ret->mem_size);
     return ret;
 }
 
@@ -775,6 +910,7 @@ static void texture_binding_destroy(gpointer data)
     binding->refcnt--;
     if (binding->refcnt == 0) {
         glDeleteTextures(1, &binding->gl_texture);
+        xemu_mem_account_add(binding->mem_account, -(int64_t)binding->mem_size);
         g_free(binding);
     }
 }
@@ -818,10 +954,24 @@ void pgraph_gl_init_textures(NV2AState *d)
     for (int i = 0; i < texture_cache_size; i++) {
         lru_add_free(&r->texture_cache, &r->texture_cache_entries[i].node);
     }
+    xemu_mem_account_set(xemu_mem_account("gl", "texture cache nodes"),
+                         texture_cache_size * sizeof(TextureLruNode));
+    r->texture_mem_account = xemu_mem_account("gl", "textures");
 
     r->texture_cache.init_node = texture_cache_entry_init;
     r->texture_cache.compare_nodes = texture_cache_entry_compare;
     r->texture_cache.post_node_evict = texture_cache_entry_post_evict;
+
+    // The calling thread decodes too, so leave a core for everything else
+    int num_decode_threads = MIN((int)g_get_num_processors() - 1, 4);
+    r->texture_decode_pool =
+        num_decode_threads > 0 ?
+            g_thread_pool_new(texture_decode_worker, NULL, num_decode_threads,
+                              FALSE, NULL) :
+            NULL;
+
+    pgraph_gl_init_stream_buffer(&r->texture_upload_buffer,
+                                 GL_PIXEL_UNPACK_BUFFER);
 }
 
 void pgraph_gl_finalize_textures(PGRAPHState *pg)
@@ -833,7 +983,16 @@ void pgraph_gl_finalize_textures(PGRAPHState *pg)
     }
 
     lru_flush(&r->texture_cache);
+    lru_destroy(&r->texture_cache);
     free(r->texture_cache_entries);
 
     r->texture_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("gl", "texture cache nodes"), 0);
+
+    if (r->texture_decode_pool) {
+        g_thread_pool_free(r->texture_decode_pool, FALSE, TRUE);
+        r->texture_decode_pool = NULL;
+    }
+
+    pgraph_gl_finalize_stream_buffer(&r->texture_upload_buffer);
 }
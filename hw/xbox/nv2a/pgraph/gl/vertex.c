@@ -44,8 +44,7 @@ static void update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size,
     last_end = end;
 
     size = end - addr;
-    if (memory_region_test_and_clear_dirty(d->vram, addr, size,
-                                           DIRTY_MEMORY_NV2A)) {
+    if (pgraph_vram_test_and_clear_dirty(d, addr, size, DIRTY_MEMORY_NV2A)) {
         glBufferSubData(GL_ARRAY_BUFFER, addr, size,
                         d->vram_ptr + addr);
         nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
@@ -143,8 +142,9 @@ void pgraph_gl_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
 
         hwaddr start = 0;
         if (inline_data) {
-            glBindBuffer(GL_ARRAY_BUFFER, r->gl_inline_array_buffer);
-            attrib_data_addr = attr->inline_array_offset;
+            glBindBuffer(GL_ARRAY_BUFFER, r->inline_array_alloc.buffer);
+            attrib_data_addr =
+                r->inline_array_alloc.offset + attr->inline_array_offset;
             stride = inline_stride;
         } else {
             hwaddr dma_len;
@@ -222,16 +222,175 @@ unsigned int pgraph_gl_bind_inline_array(NV2AState *d)
     NV2A_DPRINTF("draw inline array %d, %d\n", vertex_size, index_count);
 
     nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_2);
-    glBindBuffer(GL_ARRAY_BUFFER, r->gl_inline_array_buffer);
-    GLsizeiptr buffer_size = index_count * vertex_size;
-    glBufferData(GL_ARRAY_BUFFER, buffer_size, NULL, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, buffer_size, pg->inline_array);
+    r->inline_array_alloc = pgraph_gl_stream_upload(
+        r, pg->inline_array, index_count * vertex_size, 16);
     pgraph_gl_bind_vertex_attributes(d, 0, index_count-1, true, vertex_size,
                                   index_count-1);
 
     return index_count;
 }
 
+static bool stream_buffer_storage_supported(void)
+{
+#ifdef __ANDROID__
+    return glo_check_extension("GL_EXT_buffer_storage");
+#else
+    return epoxy_gl_version() >= 44 ||
+           glo_check_extension("GL_ARB_buffer_storage");
+#endif
+}
+
+void pgraph_gl_init_stream_buffer(StreamBuffer *s, GLenum target)
+{
+    memset(s, 0, sizeof(*s));
+    s->target = target;
+    glGenBuffers(1, &s->buffer);
+    glBindBuffer(target, s->buffer);
+
+    // Without buffer storage, uploads go through glBufferSubData, still to
+    // ranges the fences show are no longer in use
+    if (stream_buffer_storage_supported()) {
+        GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+#ifdef __ANDROID__
+        glBufferStorageEXT(target, STREAM_BUFFER_SIZE, NULL, flags);
+#else
+        glBufferStorage(target, STREAM_BUFFER_SIZE, NULL, flags);
+#endif
+        s->mapped = glMapBufferRange(target, 0, STREAM_BUFFER_SIZE, flags);
+    }
+    if (!s->mapped) {
+        glBufferData(target, STREAM_BUFFER_SIZE, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(target, 0);
+
+    glGenBuffers(STREAM_BUFFER_NUM_OVERSIZE, s->oversize_buffers);
+    xemu_mem_account_add(xemu_mem_account("gl", "stream buffers"),
+                         STREAM_BUFFER_SIZE);
+}
+
+void pgraph_gl_finalize_stream_buffer(StreamBuffer *s)
+{
+    for (int i = 0; i < STREAM_BUFFER_NUM_SEGMENTS; i++) {
+        if (s->fences[i]) {
+            glDeleteSync(s->fences[i]);
+        }
+    }
+    if (s->mapped) {
+        glBindBuffer(s->target, s->buffer);
+        glUnmapBuffer(s->target);
+        glBindBuffer(s->target, 0);
+    }
+    glDeleteBuffers(1, &s->buffer);
+    glDeleteBuffers(STREAM_BUFFER_NUM_OVERSIZE, s->oversize_buffers);
+    memset(s, 0, sizeof(*s));
+    xemu_mem_account_add(xemu_mem_account("gl", "stream buffers"),
+                         -(int64_t)STREAM_BUFFER_SIZE);
+}
+
+/*
+ * Fence the segment being left, and wait until the GPU is done with the
+ * segment being entered.
+ */
+static void enter_stream_segment(StreamBuffer *s, int prev, int next)
+{
+    assert(!s->fences[prev]);
+    s->fences[prev] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    if (s->fences[next]) {
+        GLenum result = glClientWaitSync(s->fences[next], 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            nv2a_profile_inc_counter(NV2A_PROF_STREAM_FENCE_WAIT);
+            glClientWaitSync(s->fences[next], GL_SYNC_FLUSH_COMMANDS_BIT,
+                             GL_TIMEOUT_IGNORED);
+        }
+        glDeleteSync(s->fences[next]);
+        s->fences[next] = 0;
+    }
+}
+
+/*
+ * Reserve size bytes of the ring, waiting for the GPU to be done with any
+ * segment the reservation enters.
+ */
+static size_t stream_reserve(StreamBuffer *s, size_t size, size_t alignment)
+{
+    assert(size <= STREAM_BUFFER_SEGMENT_SIZE);
+
+    size_t offset = ROUND_UP(s->offset, alignment);
+    int segment = s->offset ? (s->offset - 1) / STREAM_BUFFER_SEGMENT_SIZE : 0;
+    if (offset + size > STREAM_BUFFER_SIZE) {
+        nv2a_profile_inc_counter(NV2A_PROF_STREAM_RING_WRAP);
+        offset = 0;
+    }
+    int first = offset / STREAM_BUFFER_SEGMENT_SIZE;
+    int last = (offset + size - 1) / STREAM_BUFFER_SEGMENT_SIZE;
+
+    // Walk through every segment entered, so each is fenced once
+    if (first != segment) {
+        enter_stream_segment(s, segment, first);
+        segment = first;
+    }
+    while (segment != last) {
+        enter_stream_segment(s, segment, segment + 1);
+        segment++;
+    }
+
+    s->offset = offset + size;
+
+    return offset;
+}
+
+/*
+ * Copy transient draw data into the stream ring and return where it went.
+ * The data stays valid until the ring comes back around to it, which is
+ * after the draws using it have completed.
+ */
+StreamAlloc pgraph_gl_stream_upload(PGRAPHGLState *r, const void *data,
+                                    size_t size, size_t alignment)
+{
+    StreamBuffer *s = &r->stream_buffer;
+
+    nv2a_profile_add_counter(NV2A_PROF_STREAM_BYTES, size);
+
+    if (size > STREAM_BUFFER_SEGMENT_SIZE) {
+        GLuint buffer = s->oversize_buffers[s->oversize_index];
+        s->oversize_index = (s->oversize_index + 1) % STREAM_BUFFER_NUM_OVERSIZE;
+        glBindBuffer(s->target, buffer);
+        glBufferData(s->target, size, data, GL_STREAM_DRAW);
+        return (StreamAlloc){ .buffer = buffer, .offset = 0 };
+    }
+
+    size_t offset = stream_reserve(s, size, alignment);
+
+    if (s->mapped) {
+        memcpy(s->mapped + offset, data, size);
+    } else {
+        glBindBuffer(s->target, s->buffer);
+        glBufferSubData(s->target, offset, size, data);
+    }
+
+    return (StreamAlloc){ .buffer = s->buffer, .offset = offset };
+}
+
+/*
+ * Reserve space in a persistently mapped ring for the caller to write into
+ * directly. Returns NULL if the ring is not mapped or the size does not fit
+ * in a segment, in which case the caller must provide its own buffer.
+ */
+uint8_t *pgraph_gl_stream_map(StreamBuffer *s, size_t size, size_t alignment,
+                              StreamAlloc *alloc)
+{
+    if (!s->mapped || size > STREAM_BUFFER_SEGMENT_SIZE) {
+        return NULL;
+    }
+
+    size_t offset = stream_reserve(s, size, alignment);
+    *alloc = (StreamAlloc){ .buffer = s->buffer, .offset = offset };
+
+    return s->mapped + offset;
+}
+
 static void vertex_cache_entry_init(Lru *lru, LruNode *node, const void *key)
 {
     VertexLruNode *vnode = container_of(node, VertexLruNode, node);
@@ -261,6 +420,8 @@ void pgraph_gl_init_buffers(NV2AState *d)
         r->element_cache_entries[i].gl_buffer = element_cache_buffers[i];
         lru_add_free(&r->element_cache, &r->element_cache_entries[i].node);
     }
+    xemu_mem_account_set(xemu_mem_account("gl", "element cache nodes"),
+                         element_cache_size * sizeof(VertexLruNode));
 
     r->element_cache.init_node = vertex_cache_entry_init;
     r->element_cache.compare_nodes = vertex_cache_entry_compare;
@@ -269,15 +430,15 @@ void pgraph_gl_init_buffers(NV2AState *d)
     glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_vertex_attributes);
     assert(max_vertex_attributes >= NV2A_VERTEXSHADER_ATTRIBUTES);
 
-    glGenBuffers(NV2A_VERTEXSHADER_ATTRIBUTES, r->gl_inline_buffer);
-    glGenBuffers(1, &r->gl_inline_array_buffer);
-    glGenBuffers(1, &r->gl_prim_rewrite_buffer);
+    pgraph_gl_init_stream_buffer(&r->stream_buffer, GL_ARRAY_BUFFER);
     pgraph_prim_rewrite_init(&r->prim_rewrite_buf);
 
     glGenBuffers(1, &r->gl_memory_buffer);
     glBindBuffer(GL_ARRAY_BUFFER, r->gl_memory_buffer);
     glBufferData(GL_ARRAY_BUFFER, memory_region_size(d->vram),
                  NULL, GL_DYNAMIC_DRAW);
+    xemu_mem_account_set(xemu_mem_account("gl", "vram buffer"),
+                         memory_region_size(d->vram));
 
     glGenVertexArrays(1, &r->gl_vertex_array);
     glBindVertexArray(r->gl_vertex_array);
@@ -295,22 +456,18 @@ void pgraph_gl_finalize_buffers(PGRAPHState *pg)
     }
     glDeleteBuffers(element_cache_size, element_cache_buffers);
     lru_flush(&r->element_cache);
+    lru_destroy(&r->element_cache);
 
     g_free(r->element_cache_entries);
     r->element_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("gl", "element cache nodes"), 0);
 
-    glDeleteBuffers(NV2A_VERTEXSHADER_ATTRIBUTES, r->gl_inline_buffer);
-    memset(r->gl_inline_buffer, 0, sizeof(r->gl_inline_buffer));
-
-    glDeleteBuffers(1, &r->gl_inline_array_buffer);
-    r->gl_inline_array_buffer = 0;
-
-    glDeleteBuffers(1, &r->gl_prim_rewrite_buffer);
-    r->gl_prim_rewrite_buffer = 0;
+    pgraph_gl_finalize_stream_buffer(&r->stream_buffer);
     pgraph_prim_rewrite_finalize(&r->prim_rewrite_buf);
 
     glDeleteBuffers(1, &r->gl_memory_buffer);
     r->gl_memory_buffer = 0;
+    xemu_mem_account_set(xemu_mem_account("gl", "vram buffer"), 0);
 
     glDeleteVertexArrays(1, &r->gl_vertex_array);
     r->gl_vertex_array = 0;
@@ -25,8 +25,14 @@ const char *uniform_element_type_to_str[] = {
     UNIFORM_ELEMENT_TYPE_X(DECL_UNIFORM_ELEMENT_NAME)
 };
 
+/*
+ * With per_vertex_pos, the flat primitive inputs are replaced by a single
+ * pervertexEXT vtxPosV[] array aliasing vtxPos0, from which the fragment
+ * shader derives them itself.
+ */
 MString *pgraph_glsl_get_vtx_header(MString *out, bool location, bool smooth,
-                                    bool in, bool prefix, bool array)
+                                    bool in, bool prefix, bool array,
+                                    bool per_vertex_pos)
 {
     const char *smooth_s = "";
     const char *flat_s = "flat ";
@@ -56,6 +62,17 @@ MString *pgraph_glsl_get_vtx_header(MString *out, bool location, bool smooth,
     };
 
     for (int i = 0; i < ARRAY_SIZE(attr); i++) {
+        bool is_prim_attr = i >= 9 && i <= 12;
+        if (per_vertex_pos && is_prim_attr) {
+            if (i == 9) {
+                assert(in && location);
+                mstring_append_fmt(out,
+                                   "layout(location = %d) "
+                                   "pervertexEXT in vec4 vtxPosV[3];\n",
+                                   i);
+            }
+            continue;
+        }
         if (location) {
             mstring_append_fmt(out, "layout(location = %d) ", i);
         }
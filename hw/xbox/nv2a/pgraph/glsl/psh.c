@@ -33,6 +33,15 @@
 
 DEF_UNIFORM_INFO_ARR(PshUniform, PSH_UNIFORM_DECL_X)
 
+/* Layout of the combinerRegs uniform read by generic combiner shaders */
+#define COMBINER_REGS_RGB_IN(i) ((i) * 4)
+#define COMBINER_REGS_RGB_OUT(i) ((i) * 4 + 1)
+#define COMBINER_REGS_ALPHA_IN(i) ((i) * 4 + 2)
+#define COMBINER_REGS_ALPHA_OUT(i) ((i) * 4 + 3)
+#define COMBINER_REGS_FINAL_0 32
+#define COMBINER_REGS_FINAL_1 33
+#define COMBINER_REGS_CONTROL 34
+
 // TODO: https://github.com/xemu-project/xemu/issues/2260
 //   Investigate how color keying is handled for components with no alpha or
 //   only alpha.
@@ -232,6 +241,18 @@ void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state)
     }
 }
 
+void pgraph_glsl_set_psh_state_generic(PshState *state)
+{
+    state->combiner_control = 0;
+    state->final_inputs_0 = 0;
+    state->final_inputs_1 = 0;
+    memset(state->rgb_inputs, 0, sizeof(state->rgb_inputs));
+    memset(state->rgb_outputs, 0, sizeof(state->rgb_outputs));
+    memset(state->alpha_inputs, 0, sizeof(state->alpha_inputs));
+    memset(state->alpha_outputs, 0, sizeof(state->alpha_outputs));
+    state->generic_combiners = true;
+}
+
 struct InputInfo {
     int reg, mod, chan;
 };
@@ -802,17 +823,299 @@ static void define_colorkey_comparator(MString *preflight)
     // clang-format on
 }
 
+/*
+ * Register combiners interpreted from the combinerRegs uniform. The register
+ * file is indexed by PS_REGISTER_*, and results are computed and written in
+ * the same order as the code generated for a specific combiner setup.
+ */
+static void define_generic_combiners(MString *preflight)
+{
+    // clang-format off
+    mstring_append_fmt(
+        preflight,
+        "vec4 cmbReg[16];\n"
+        "vec3 cmb_map_input(vec3 x, uint mapping) {\n"
+        "    if (mapping == 0x00u) return max(x, 0.0);\n"
+        "    if (mapping == 0x20u) return 1.0 - clamp(x, 0.0, 1.0);\n"
+        "    if (mapping == 0x40u) return 2.0 * max(x, 0.0) - 1.0;\n"
+        "    if (mapping == 0x60u) return -2.0 * max(x, 0.0) + 1.0;\n"
+        "    if (mapping == 0x80u) return max(x, 0.0) - 0.5;\n"
+        "    if (mapping == 0xA0u) return -max(x, 0.0) + 0.5;\n"
+        "    if (mapping == 0xC0u) return x;\n"
+        "    return -x;\n"
+        "}\n"
+        "vec3 cmb_map_output(vec3 x, uint mapping) {\n"
+        "    if (mapping == 0x08u) return x - 0.5;\n"
+        "    if (mapping == 0x10u) return x * 2.0;\n"
+        "    if (mapping == 0x18u) return (x - 0.5) * 2.0;\n"
+        "    if (mapping == 0x20u) return x * 4.0;\n"
+        "    if (mapping == 0x30u) return x / 2.0;\n"
+        "    return x;\n"
+        "}\n"
+        "vec3 cmb_input_rgb(uint v) {\n"
+        "    vec4 r = cmbReg[v & 0xFu];\n"
+        "    return cmb_map_input((v & 0x10u) != 0u ? r.aaa : r.rgb, v & 0xE0u);\n"
+        "}\n"
+        "float cmb_input_alpha(uint v) {\n"
+        "    vec4 r = cmbReg[v & 0xFu];\n"
+        "    return cmb_map_input(vec3((v & 0x10u) != 0u ? r.a : r.b), v & 0xE0u).x;\n"
+        "}\n"
+        "void cmb_stage(uint i) {\n"
+        "    uint flags = combinerRegs[%d] >> 8;\n"
+        "    cmbReg[%d] = consts[(flags & 0x%xu) != 0u ? i * 2u : 0u];\n"
+        "    cmbReg[%d] = consts[(flags & 0x%xu) != 0u ? i * 2u + 1u : 1u];\n"
+        "    bool mux = (flags & 0x%xu) != 0u ?\n"
+        "        cmbReg[%d].a >= 0.5 : (uint(cmbReg[%d].a * 255.0) & 1u) == 1u;\n"
+        "\n"
+        "    uint rgbIn = combinerRegs[i * 4u];\n"
+        "    uint rgbOut = combinerRegs[i * 4u + 1u];\n"
+        "    uint rgbFlags = rgbOut >> 12;\n"
+        "    vec3 a = cmb_input_rgb(rgbIn >> 24);\n"
+        "    vec3 b = cmb_input_rgb((rgbIn >> 16) & 0xFFu);\n"
+        "    vec3 c = cmb_input_rgb((rgbIn >> 8) & 0xFFu);\n"
+        "    vec3 d = cmb_input_rgb(rgbIn & 0xFFu);\n"
+        "    vec3 rgbAB = (rgbFlags & 0x%xu) != 0u ? vec3(dot(a, b)) : a * b;\n"
+        "    vec3 rgbCD = (rgbFlags & 0x%xu) != 0u ? vec3(dot(c, d)) : c * d;\n"
+        "    vec3 rgbSum = (rgbFlags & 0x%xu) != 0u ? (mux ? rgbCD : rgbAB) :\n"
+        "                                          rgbAB + rgbCD;\n"
+        "    rgbAB = clamp(cmb_map_output(rgbAB, rgbFlags & 0x38u), -1.0, 1.0);\n"
+        "    rgbCD = clamp(cmb_map_output(rgbCD, rgbFlags & 0x38u), -1.0, 1.0);\n"
+        "    rgbSum = clamp(cmb_map_output(rgbSum, rgbFlags & 0x38u), -1.0, 1.0);\n"
+        "\n"
+        "    uint alphaIn = combinerRegs[i * 4u + 2u];\n"
+        "    uint alphaOut = combinerRegs[i * 4u + 3u];\n"
+        "    uint alphaFlags = alphaOut >> 12;\n"
+        "    float alphaAB = cmb_input_alpha(alphaIn >> 24) *\n"
+        "                    cmb_input_alpha((alphaIn >> 16) & 0xFFu);\n"
+        "    float alphaCD = cmb_input_alpha((alphaIn >> 8) & 0xFFu) *\n"
+        "                    cmb_input_alpha(alphaIn & 0xFFu);\n"
+        "    float alphaSum = (alphaFlags & 0x%xu) != 0u ?\n"
+        "        (mux ? alphaCD : alphaAB) : alphaAB + alphaCD;\n"
+        "    alphaAB = clamp(cmb_map_output(vec3(alphaAB), alphaFlags & 0x38u).x, -1.0, 1.0);\n"
+        "    alphaCD = clamp(cmb_map_output(vec3(alphaCD), alphaFlags & 0x38u).x, -1.0, 1.0);\n"
+        "    alphaSum = clamp(cmb_map_output(vec3(alphaSum), alphaFlags & 0x38u).x, -1.0, 1.0);\n"
+        "\n"
+        "    uint dst = (rgbOut >> 4) & 0xFu;\n"
+        "    if (dst != 0u) {\n"
+        "        cmbReg[dst].rgb = rgbAB;\n"
+        "        if ((rgbFlags & 0x%xu) != 0u) cmbReg[dst].a = rgbAB.b;\n"
+        "    }\n"
+        "    dst = rgbOut & 0xFu;\n"
+        "    if (dst != 0u) {\n"
+        "        cmbReg[dst].rgb = rgbCD;\n"
+        "        if ((rgbFlags & 0x%xu) != 0u) cmbReg[dst].a = rgbCD.b;\n"
+        "    }\n"
+        "    dst = (rgbOut >> 8) & 0xFu;\n"
+        "    if (dst != 0u) cmbReg[dst].rgb = rgbSum;\n"
+        "    dst = (alphaOut >> 4) & 0xFu;\n"
+        "    if (dst != 0u) cmbReg[dst].a = alphaAB;\n"
+        "    dst = alphaOut & 0xFu;\n"
+        "    if (dst != 0u) cmbReg[dst].a = alphaCD;\n"
+        "    dst = (alphaOut >> 8) & 0xFu;\n"
+        "    if (dst != 0u) cmbReg[dst].a = alphaSum;\n"
+        "}\n"
+        "void cmb_final() {\n"
+        "    uint final0 = combinerRegs[%d];\n"
+        "    uint final1 = combinerRegs[%d];\n"
+        "    cmbReg[%d] = c0_8;\n"
+        "    cmbReg[%d] = c1_8;\n"
+        "    vec3 v1 = (final1 & 0x%xu) != 0u ? 1.0 - cmbReg[%d].rgb : cmbReg[%d].rgb;\n"
+        "    vec3 r0 = (final1 & 0x%xu) != 0u ? 1.0 - cmbReg[%d].rgb : cmbReg[%d].rgb;\n"
+        "    vec3 sum = v1 + r0;\n"
+        "    if ((final1 & 0x%xu) != 0u) sum = clamp(sum, 0.0, 1.0);\n"
+        "    cmbReg[%d] = vec4(sum, 0.0);\n"
+        "    vec3 e = cmb_input_rgb(final1 >> 24);\n"
+        "    vec3 f = cmb_input_rgb((final1 >> 16) & 0xFFu);\n"
+        "    cmbReg[%d] = vec4(e * f, 0.0);\n"
+        "    fragColor.rgb = cmb_input_rgb(final0 & 0xFFu) +\n"
+        "                    mix(cmb_input_rgb((final0 >> 8) & 0xFFu),\n"
+        "                        cmb_input_rgb((final0 >> 16) & 0xFFu),\n"
+        "                        cmb_input_rgb(final0 >> 24));\n"
+        "    fragColor.a = cmb_input_alpha((final1 >> 8) & 0xFFu);\n"
+        "}\n",
+        COMBINER_REGS_CONTROL,
+        PS_REGISTER_C0, PS_COMBINERCOUNT_UNIQUE_C0,
+        PS_REGISTER_C1, PS_COMBINERCOUNT_UNIQUE_C1,
+        PS_COMBINERCOUNT_MUX_MSB, PS_REGISTER_R0, PS_REGISTER_R0,
+        PS_COMBINEROUTPUT_AB_DOT_PRODUCT, PS_COMBINEROUTPUT_CD_DOT_PRODUCT,
+        PS_COMBINEROUTPUT_AB_CD_MUX, PS_COMBINEROUTPUT_AB_CD_MUX,
+        PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA, PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA,
+        COMBINER_REGS_FINAL_0, COMBINER_REGS_FINAL_1,
+        PS_REGISTER_C0, PS_REGISTER_C1,
+        PS_FINALCOMBINERSETTING_COMPLEMENT_V1, PS_REGISTER_V1, PS_REGISTER_V1,
+        PS_FINALCOMBINERSETTING_COMPLEMENT_R0, PS_REGISTER_R0, PS_REGISTER_R0,
+        PS_FINALCOMBINERSETTING_CLAMP_SUM,
+        PS_REGISTER_V1R0_SUM, PS_REGISTER_EF_PROD);
+    // clang-format on
+}
+
+static void add_generic_combiner_code(struct PixelShader *ps)
+{
+    mstring_append_fmt(ps->code,
+                       "// Generic combiners\n"
+                       "for (int i = 0; i < 16; i++) {\n"
+                       "    cmbReg[i] = vec4(0.0);\n"
+                       "}\n"
+                       "cmbReg[%d] = pFog;\n"
+                       "cmbReg[%d] = v0;\n"
+                       "cmbReg[%d] = v1;\n"
+                       "cmbReg[%d] = t0;\n"
+                       "cmbReg[%d] = t1;\n"
+                       "cmbReg[%d] = t2;\n"
+                       "cmbReg[%d] = t3;\n"
+                       "cmbReg[%d].a = %s;\n"
+                       "uint numStages = min(combinerRegs[%d] & 0xFFu, 8u);\n"
+                       "for (uint i = 0u; i < numStages; i++) {\n"
+                       "    cmb_stage(i);\n"
+                       "}\n"
+                       "if ((combinerRegs[%d] | combinerRegs[%d]) != 0u) {\n"
+                       "    cmb_final();\n"
+                       "}\n",
+                       PS_REGISTER_FOG, PS_REGISTER_V0, PS_REGISTER_V1,
+                       PS_REGISTER_T0, PS_REGISTER_T1, PS_REGISTER_T2,
+                       PS_REGISTER_T3, PS_REGISTER_R0,
+                       ps->tex_modes[0] != PS_TEXTUREMODES_NONE ? "t0.a" :
+                                                                  "1.0",
+                       COMBINER_REGS_CONTROL, COMBINER_REGS_FINAL_0,
+                       COMBINER_REGS_FINAL_1);
+}
+
+static void append_uniform_decl(MString *out, const char *u,
+                                const UniformInfo *info)
+{
+    const char *type_str = uniform_element_type_to_str[info->type];
+    if (info->count == 1) {
+        mstring_append_fmt(out, "%s%s %s;\n", u, type_str, info->name);
+    } else {
+        mstring_append_fmt(out, "%s%s %s[%zd];\n", u, type_str, info->name,
+                           info->count);
+    }
+}
+
+/*
+ * Derive the flat per-primitive inputs that the geometry shader would
+ * otherwise provide (see geom.c) from the vertex positions of the primitive.
+ * Lines get the same synthesized third vertex, and triangles the same depth
+ * slope, so the depth code below works unchanged.
+ */
+static void define_per_vertex_prim_attrs(struct PixelShader *ps,
+                                         MString *preflight)
+{
+    if (ps->opts.per_vertex_lines) {
+        mstring_append(
+            preflight,
+            "void calc_prim_attrs(out vec4 p0, out vec4 p1, out vec4 p2,\n"
+            "                     out float dz) {\n"
+            "  p0 = vtxPosV[0];\n"
+            "  p1 = vtxPosV[1];\n"
+            "  vec2 delta = p1.xy - p0.xy;\n"
+            "  p2 = vec4(vec2(-delta.y, delta.x) + p0.xy, p0.zw);\n"
+            "  dz = 0.0;\n"
+            "}\n");
+        return;
+    }
+
+    mstring_append(
+        preflight,
+        "void calc_prim_attrs(out vec4 p0, out vec4 p1, out vec4 p2,\n"
+        "                     out float dz) {\n"
+        "  p0 = vtxPosV[0];\n"
+        "  p1 = vtxPosV[1];\n"
+        "  p2 = vtxPosV[2];\n"
+        "  mat2 m = mat2(p1.xy - p0.xy, p2.xy - p0.xy);\n");
+    if (ps->state->z_perspective) {
+        mstring_append(preflight,
+                       "  precise vec2 b = vec2(p0.w - p1.w, p0.w - p2.w);\n"
+                       "  b /= vec2(p1.w, p2.w) * p0.w;\n");
+    } else {
+        mstring_append(preflight,
+                       "  precise vec2 b = vec2(p1.z - p0.z, p2.z - p0.z);\n");
+    }
+    mstring_append(
+        preflight,
+        "  float det = kahan_det(m[0], m[1]);\n"
+        "  float dzx = kahan_det(b, vec2(m[0].y, m[1].y)) / det;\n"
+        "  float dzy = kahan_det(b.yx, vec2(m[1].x, m[0].x)) / det;\n"
+        "  dz = max(abs(dzx), abs(dzy));\n"
+        "  if (isnan(dz) || isinf(dz)) {\n"
+        "    dz = 0.0;\n"
+        "  }\n"
+        "}\n");
+}
+
+static const struct {
+    const char *sampler_type;
+    const char *name;
+} bindless_sampler_arrays[PSH_BINDLESS_SAMPLER__COUNT] = {
+    [PSH_BINDLESS_SAMPLER_2D] = { "sampler2D", "texSamplers2D" },
+    [PSH_BINDLESS_SAMPLER_3D] = { "sampler3D", "texSamplers3D" },
+    [PSH_BINDLESS_SAMPLER_CUBE] = { "samplerCube", "texSamplersCube" },
+    [PSH_BINDLESS_USAMPLER_2D] = { "usampler2D", "texUSamplers2D" },
+};
+
+/*
+ * Make texSamp<i> an element of the bindless array for its sampler type,
+ * declaring the array on first use. The index is taken from a push constant,
+ * so it is dynamically uniform.
+ */
+static void declare_bindless_sampler(struct PixelShader *ps, MString *out,
+                                     const char *sampler_type, int i,
+                                     bool *arrays_declared)
+{
+    int array = 0;
+    while (strcmp(bindless_sampler_arrays[array].sampler_type, sampler_type)) {
+        array++;
+        assert(array < PSH_BINDLESS_SAMPLER__COUNT);
+    }
+
+    if (!arrays_declared[array]) {
+        mstring_append_fmt(out,
+                           "layout(set = %d, binding = %d) uniform %s %s[%d];\n",
+                           ps->opts.bindless_set, array, sampler_type,
+                           bindless_sampler_arrays[array].name,
+                           ps->opts.bindless_array_size);
+        arrays_declared[array] = true;
+    }
+
+    mstring_append_fmt(out,
+                       "#define texSamp%d %s[(texIndex.%c >> %du) & 0xffffu]\n",
+                       i, bindless_sampler_arrays[array].name, "xy"[i / 2],
+                       (i % 2) * 16);
+}
+
 static MString* psh_convert(struct PixelShader *ps)
 {
     MString *preflight = mstring_new();
+    if (ps->opts.per_vertex_pos) {
+        mstring_append(preflight, "#extension GL_EXT_fragment_shader_barycentric "
+                                  ": require\n");
+    }
     pgraph_glsl_get_vtx_header(preflight, ps->opts.vulkan,
-                             ps->state->smooth_shading, true, false, false);
+                               ps->state->smooth_shading, true, false, false,
+                               ps->opts.per_vertex_pos);
+
+    bool use_push_constants = ps->opts.vulkan && ps->opts.use_push_constants;
+    assert(use_push_constants || !ps->opts.bindless_textures);
 
     if (ps->opts.vulkan) {
+        mstring_append(preflight,
+                       "layout(location = 0) out vec4 fragColor;\n");
+        if (use_push_constants) {
+            mstring_append(preflight,
+                           "layout(push_constant) uniform PshPushConstants {\n");
+            for (int i = 0; i < ARRAY_SIZE(PshUniformInfo); i++) {
+                if (PSH_UNIFORM_IS_PUSH_CONSTANT(i)) {
+                    append_uniform_decl(preflight, "", &PshUniformInfo[i]);
+                }
+                // Fills the padding between alphaRef and fogColor
+                if (i == PshUniform_alphaRef && ps->opts.bindless_textures) {
+                    mstring_append(preflight, "uvec2 texIndex;\n");
+                }
+            }
+            mstring_append(preflight, "};\n");
+        }
         mstring_append_fmt(
-            preflight,
-            "layout(location = 0) out vec4 fragColor;\n"
-            "layout(binding = %d, std140) uniform PshUniforms {\n",
+            preflight, "layout(binding = %d, std140) uniform PshUniforms {\n",
             ps->opts.ubo_binding);
     } else {
         mstring_append_fmt(preflight,
@@ -821,15 +1124,13 @@ static MString* psh_convert(struct PixelShader *ps)
 
     const char *u = ps->opts.vulkan ? "" : "uniform ";
     for (int i = 0; i < ARRAY_SIZE(PshUniformInfo); i++) {
-        const UniformInfo *info = &PshUniformInfo[i];
-        const char *type_str = uniform_element_type_to_str[info->type];
-        if (info->count == 1) {
-            mstring_append_fmt(preflight, "%s%s %s;\n", u, type_str,
-                               info->name);
-        } else {
-            mstring_append_fmt(preflight, "%s%s %s[%zd];\n", u, type_str,
-                               info->name, info->count);
+        if (use_push_constants && PSH_UNIFORM_IS_PUSH_CONSTANT(i)) {
+            continue;
+        }
+        if (i == PshUniform_combinerRegs && !ps->state->generic_combiners) {
+            continue;
         }
+        append_uniform_decl(preflight, u, &PshUniformInfo[i]);
     }
 
     for (int i = 0; i < 9; i++) {
@@ -969,7 +1270,17 @@ static MString* psh_convert(struct PixelShader *ps)
         "}\n"
         );
 
+    if (ps->opts.per_vertex_pos) {
+        define_per_vertex_prim_attrs(ps, preflight);
+    }
+
     MString *clip = mstring_new();
+    if (ps->opts.per_vertex_pos) {
+        mstring_append(
+            clip, "vec4 vtxPos0, vtxPos1, vtxPos2;\n"
+                  "float triMZ;\n"
+                  "calc_prim_attrs(vtxPos0, vtxPos1, vtxPos2, triMZ);\n");
+    }
     mstring_append_fmt(clip, "/*  Window-clip (%slusive) */\n",
                        ps->state->window_clip_exclusive ? "Exc" : "Inc");
     if (!ps->state->window_clip_exclusive) {
@@ -1085,6 +1396,7 @@ static MString* psh_convert(struct PixelShader *ps)
     ps->code = mstring_new();
 
     bool color_key_comparator_defined = false;
+    bool bindless_arrays_declared[PSH_BINDLESS_SAMPLER__COUNT] = { false };
 
     for (int i = 0; i < 4; i++) {
 
@@ -1357,10 +1669,15 @@ static MString* psh_convert(struct PixelShader *ps)
         }
 
         if (sampler_type != NULL) {
-            if (ps->opts.vulkan) {
-                mstring_append_fmt(preflight, "layout(binding = %d) ", ps->opts.tex_binding + i);
+            if (ps->opts.bindless_textures) {
+                declare_bindless_sampler(ps, preflight, sampler_type, i,
+                                         bindless_arrays_declared);
+            } else {
+                if (ps->opts.vulkan) {
+                    mstring_append_fmt(preflight, "layout(binding = %d) ", ps->opts.tex_binding + i);
+                }
+                mstring_append_fmt(preflight, "uniform %s texSamp%d;\n", sampler_type, i);
             }
-            mstring_append_fmt(preflight, "uniform %s texSamp%d;\n", sampler_type, i);
 
             /* As this means a texture fetch does happen, do alphakill */
             if (ps->state->alphakill[i]) {
@@ -1422,6 +1739,11 @@ static MString* psh_convert(struct PixelShader *ps)
         }
     }
 
+    if (ps->state->generic_combiners) {
+        define_generic_combiners(preflight);
+        add_generic_combiner_code(ps);
+    }
+
     for (int i = 0; i < ps->num_stages; i++) {
         ps->cur_stage = i;
         mstring_append_fmt(ps->code, "// Stage %d\n", i);
@@ -1631,6 +1953,24 @@ void pgraph_glsl_set_psh_uniform_values(PGRAPHState *pg,
             }
         }
     }
+    if (locs[PshUniform_combinerRegs] != -1) {
+        for (int i = 0; i < 8; i++) {
+            values->combinerRegs[COMBINER_REGS_RGB_IN(i)] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORI0 + i * 4);
+            values->combinerRegs[COMBINER_REGS_RGB_OUT(i)] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINECOLORO0 + i * 4);
+            values->combinerRegs[COMBINER_REGS_ALPHA_IN(i)] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAI0 + i * 4);
+            values->combinerRegs[COMBINER_REGS_ALPHA_OUT(i)] =
+                pgraph_reg_r(pg, NV_PGRAPH_COMBINEALPHAO0 + i * 4);
+        }
+        values->combinerRegs[COMBINER_REGS_FINAL_0] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG0);
+        values->combinerRegs[COMBINER_REGS_FINAL_1] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINESPECFOG1);
+        values->combinerRegs[COMBINER_REGS_CONTROL] =
+            pgraph_reg_r(pg, NV_PGRAPH_COMBINECTL);
+    }
     if (locs[PshUniform_alphaRef] != -1) {
         int alpha_ref = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0),
                                  NV_PGRAPH_CONTROL_0_ALPHAREF);
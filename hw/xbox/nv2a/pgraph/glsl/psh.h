@@ -72,10 +72,20 @@ typedef struct PshState {
 
     unsigned int surface_zeta_format;
     enum PshDepthFormat depth_format;
+
+    // Combiners are interpreted from the combinerRegs uniform
+    bool generic_combiners;
 } PshState;
 
 void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state);
 
+/*
+ * Drop the register combiner setup from a state. The shader generated for the
+ * result interprets the combiners at run time, so it can be used in place of
+ * any state which only differs in its combiner setup.
+ */
+void pgraph_glsl_set_psh_state_generic(PshState *state);
+
 #define PSH_UNIFORM_DECL_X(S, DECL) \
     DECL(S, alphaRef, int, 1)       \
     DECL(S, bumpMat, mat2, 4)       \
@@ -85,6 +95,7 @@ void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state);
     DECL(S, clipRegion, ivec4, 8)   \
     DECL(S, colorKey, uint, 4)      \
     DECL(S, colorKeyMask, uint, 4)  \
+    DECL(S, combinerRegs, uint, 35) \
     DECL(S, consts, vec4, 18)       \
     DECL(S, depthFactor, float, 1)  \
     DECL(S, depthOffset, float, 1)  \
@@ -94,12 +105,39 @@ void pgraph_glsl_set_psh_state(PGRAPHState *pg, PshState *state);
 
 DECL_UNIFORM_TYPES(PshUniform, PSH_UNIFORM_DECL_X)
 
+/*
+ * Small, frequently changing uniforms which are placed in a push constant
+ * block instead of the uniform buffer when use_push_constants is set.
+ */
+#define PSH_UNIFORM_IS_PUSH_CONSTANT(i) \
+    ((i) == PshUniform_alphaRef || (i) == PshUniform_fogColor)
+
+// Sampler arrays declared for bindless textures, in binding order
+enum PshBindlessSamplerType {
+    PSH_BINDLESS_SAMPLER_2D,
+    PSH_BINDLESS_SAMPLER_3D,
+    PSH_BINDLESS_SAMPLER_CUBE,
+    PSH_BINDLESS_USAMPLER_2D,
+    PSH_BINDLESS_SAMPLER__COUNT,
+};
+
 typedef struct GenPshGlslOptions {
     bool vulkan;
     bool gles;
     int gles_version;
+    bool use_push_constants;
     int ubo_binding;
     int tex_binding;
+    // Read vertex positions with GL_EXT_fragment_shader_barycentric and derive
+    // the per-primitive inputs otherwise written by the geometry shader
+    bool per_vertex_pos;
+    bool per_vertex_lines;
+    // Sample from arrays in bindless_set instead of per-stage bindings. The
+    // slot of each stage comes from the texIndex push constant, two 16-bit
+    // slots per component.
+    bool bindless_textures;
+    int bindless_set;
+    int bindless_array_size;
 } GenPshGlslOptions;
 
 MString *pgraph_glsl_gen_psh(const PshState *state, GenPshGlslOptions opts);
@@ -17,6 +17,7 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "qemu/fast-hash.h"
 #include "hw/xbox/nv2a/pgraph/pgraph.h"
 #include "shaders.h"
 
@@ -36,29 +37,94 @@ ShaderState pgraph_glsl_get_shader_state(PGRAPHState *pg)
     return state;
 }
 
-bool pgraph_glsl_check_shader_state_dirty(PGRAPHState *pg,
-                                          const ShaderState *state)
+static bool any_reg_dirty(PGRAPHState *pg, const unsigned int *regs,
+                          size_t num_regs)
+{
+    for (int i = 0; i < num_regs; i++) {
+        if (pgraph_is_reg_dirty(pg, regs[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool check_vsh_state_dirty(PGRAPHState *pg, const VshState *vsh)
 {
     if (pg->program_data_dirty) {
         return true;
     }
 
-    unsigned int regs[] = {
-        NV_PGRAPH_COMBINECTL,      NV_PGRAPH_COMBINESPECFOG0,
-        NV_PGRAPH_COMBINESPECFOG1, NV_PGRAPH_CONTROL_0,
-        NV_PGRAPH_CONTROL_3,       NV_PGRAPH_CSV0_C,
-        NV_PGRAPH_CSV0_D,          NV_PGRAPH_CSV1_A,
-        NV_PGRAPH_CSV1_B,          NV_PGRAPH_POINTSIZE,
-        NV_PGRAPH_SETUPRASTER,     NV_PGRAPH_SHADERCLIPMODE,
-        NV_PGRAPH_SHADERCTL,       NV_PGRAPH_SHADERPROG,
-        NV_PGRAPH_SHADOWCTL,       NV_PGRAPH_ZCOMPRESSOCCLUDE,
+    static const unsigned int regs[] = {
+        NV_PGRAPH_CONTROL_0, NV_PGRAPH_CONTROL_3, NV_PGRAPH_CSV0_C,
+        NV_PGRAPH_CSV0_D,    NV_PGRAPH_CSV1_A,    NV_PGRAPH_CSV1_B,
+        NV_PGRAPH_POINTSIZE,
     };
-    for (int i = 0; i < ARRAY_SIZE(regs); i++) {
-        if (pgraph_is_reg_dirty(pg, regs[i])) {
+    if (any_reg_dirty(pg, regs, ARRAY_SIZE(regs))) {
+        return true;
+    }
+
+    if (pg->uniform_attrs != vsh->uniform_attrs ||
+        pg->swizzle_attrs != vsh->swizzle_attrs ||
+        pg->compressed_attrs != vsh->compressed_attrs ||
+        pg->raw_attrs != vsh->raw_attrs ||
+        pg->surface_scale_factor != vsh->surface_scale_factor ||
+        pg->specular_power != vsh->specular_power ||
+        pg->specular_power_back != vsh->specular_power_back) {
+        return true;
+    }
+
+    if (vsh->raw_attrs &&
+        (memcmp(pg->raw_attr_formats, vsh->raw_attr_formats,
+                sizeof(vsh->raw_attr_formats)) ||
+         memcmp(pg->raw_attr_counts, vsh->raw_attr_counts,
+                sizeof(vsh->raw_attr_counts)))) {
+        return true;
+    }
+
+    if (vsh->point_params_enable &&
+        memcmp(pg->point_params, vsh->point_params, sizeof(vsh->point_params))) {
+        return true;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (pg->texture_matrix_enable[i] !=
+            vsh->fixed_function.texture_matrix_enable[i]) {
             return true;
         }
     }
 
+    return false;
+}
+
+static bool check_geom_state_dirty(PGRAPHState *pg, const GeomState *geom)
+{
+    static const unsigned int regs[] = {
+        NV_PGRAPH_CONTROL_0,
+        NV_PGRAPH_CONTROL_3,
+        NV_PGRAPH_SETUPRASTER,
+    };
+    if (any_reg_dirty(pg, regs, ARRAY_SIZE(regs))) {
+        return true;
+    }
+
+    return pg->primitive_mode != geom->primitive_mode;
+}
+
+static bool check_psh_state_dirty(PGRAPHState *pg, const PshState *psh)
+{
+    static const unsigned int regs[] = {
+        NV_PGRAPH_COMBINECTL,      NV_PGRAPH_COMBINESPECFOG0,
+        NV_PGRAPH_COMBINESPECFOG1, NV_PGRAPH_CONTROL_0,
+        NV_PGRAPH_CONTROL_3,       NV_PGRAPH_SETUPRASTER,
+        NV_PGRAPH_SHADERCLIPMODE,  NV_PGRAPH_SHADERCTL,
+        NV_PGRAPH_SHADERPROG,      NV_PGRAPH_SHADOWCTL,
+        NV_PGRAPH_ZCOMPRESSOCCLUDE,
+    };
+    if (any_reg_dirty(pg, regs, ARRAY_SIZE(regs))) {
+        return true;
+    }
+
     int num_stages = pgraph_reg_r(pg, NV_PGRAPH_COMBINECTL) & 0xFF;
     for (int i = 0; i < num_stages; i++) {
         if (pgraph_is_reg_dirty(pg, NV_PGRAPH_COMBINEALPHAI0 + i * 4) ||
@@ -69,27 +135,87 @@ bool pgraph_glsl_check_shader_state_dirty(PGRAPHState *pg,
         }
     }
 
-    if (pg->uniform_attrs != state->vsh.uniform_attrs ||
-        pg->swizzle_attrs != state->vsh.swizzle_attrs ||
-        pg->compressed_attrs != state->vsh.compressed_attrs ||
-        pg->primitive_mode != state->geom.primitive_mode ||
-        pg->surface_scale_factor != state->vsh.surface_scale_factor ||
-        pg->surface_shape.zeta_format != state->psh.surface_zeta_format) {
-        return true;
-    }
-
     for (int i = 0; i < 4; i++) {
         if (pgraph_is_reg_dirty(pg, NV_PGRAPH_TEXCTL0_0 + i * 4) ||
             pgraph_is_reg_dirty(pg, NV_PGRAPH_TEXFILTER0 + i * 4) ||
             pgraph_is_reg_dirty(pg, NV_PGRAPH_TEXFMT0 + i * 4)) {
             return true;
         }
+    }
 
-        if (pg->texture_matrix_enable[i] !=
-            state->vsh.fixed_function.texture_matrix_enable[i]) {
-            return true;
-        }
+    return pg->surface_shape.zeta_format != psh->surface_zeta_format;
+}
+
+bool pgraph_glsl_check_shader_state_dirty(PGRAPHState *pg,
+                                          const ShaderState *state)
+{
+    return check_vsh_state_dirty(pg, &state->vsh) ||
+           check_geom_state_dirty(pg, &state->geom) ||
+           check_psh_state_dirty(pg, &state->psh);
+}
+
+static uint64_t combine_shader_state_hashes(uint64_t vsh_hash,
+                                            uint64_t geom_hash,
+                                            uint64_t psh_hash)
+{
+    uint64_t hash = vsh_hash;
+    hash = hash * 0x100000001b3ULL ^ geom_hash;
+    hash = hash * 0x100000001b3ULL ^ psh_hash;
+    return hash;
+}
+
+/*
+ * Shader caches must key states with this rather than hashing the whole
+ * ShaderState, so that hashes produced incrementally by
+ * pgraph_glsl_update_shader_state match.
+ */
+uint64_t pgraph_glsl_hash_shader_state(const ShaderState *state)
+{
+    return combine_shader_state_hashes(
+        fast_hash((void *)&state->vsh, sizeof(state->vsh)),
+        fast_hash((void *)&state->geom, sizeof(state->geom)),
+        fast_hash((void *)&state->psh, sizeof(state->psh)));
+}
+
+/*
+ * Rebuild the sub-states of the cached ShaderState whose inputs are dirty.
+ * Returns false if nothing had to be rebuilt.
+ */
+bool pgraph_glsl_update_shader_state(PGRAPHState *pg, ShaderStateCache *cache)
+{
+    ShaderState *state = &cache->state;
+
+    bool vsh_dirty = !cache->valid || check_vsh_state_dirty(pg, &state->vsh);
+    bool geom_dirty =
+        !cache->valid || check_geom_state_dirty(pg, &state->geom);
+    bool psh_dirty = !cache->valid || check_psh_state_dirty(pg, &state->psh);
+
+    if (!vsh_dirty && !geom_dirty && !psh_dirty) {
+        return false;
     }
 
-    return false;
+    // Sub-states are hashed separately, so keep their padding zeroed
+    if (vsh_dirty) {
+        pg->program_data_dirty = false;
+        memset(&state->vsh, 0, sizeof(state->vsh));
+        pgraph_glsl_set_vsh_state(pg, &state->vsh);
+        cache->vsh_hash = fast_hash((void *)&state->vsh, sizeof(state->vsh));
+    }
+    if (geom_dirty) {
+        memset(&state->geom, 0, sizeof(state->geom));
+        pgraph_glsl_set_geom_state(pg, &state->geom);
+        cache->geom_hash =
+            fast_hash((void *)&state->geom, sizeof(state->geom));
+    }
+    if (psh_dirty) {
+        memset(&state->psh, 0, sizeof(state->psh));
+        pgraph_glsl_set_psh_state(pg, &state->psh);
+        cache->psh_hash = fast_hash((void *)&state->psh, sizeof(state->psh));
+    }
+
+    cache->hash = combine_shader_state_hashes(cache->vsh_hash, cache->geom_hash,
+                                              cache->psh_hash);
+    cache->valid = true;
+
+    return true;
 }
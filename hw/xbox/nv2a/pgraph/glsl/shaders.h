@@ -30,10 +30,28 @@ typedef struct ShaderState {
     PshState psh;
 } ShaderState;
 
+/*
+ * The most recently built ShaderState, kept alongside the hash of each
+ * sub-state so that only the parts touched by dirty registers need to be
+ * rebuilt and rehashed.
+ */
+typedef struct ShaderStateCache {
+    ShaderState state;
+    uint64_t vsh_hash;
+    uint64_t geom_hash;
+    uint64_t psh_hash;
+    uint64_t hash;
+    bool valid;
+} ShaderStateCache;
+
 typedef struct PGRAPHState PGRAPHState;
 
 ShaderState pgraph_glsl_get_shader_state(PGRAPHState *pg);
 
+uint64_t pgraph_glsl_hash_shader_state(const ShaderState *state);
+
+bool pgraph_glsl_update_shader_state(PGRAPHState *pg, ShaderStateCache *cache);
+
 bool pgraph_glsl_check_shader_state_dirty(PGRAPHState *pg,
                                           const ShaderState *state);
 
@@ -114,6 +114,13 @@ void pgraph_glsl_set_vsh_state(PGRAPHState *pg, VshState *vsh)
     vsh->compressed_attrs = pg->compressed_attrs;
     vsh->uniform_attrs = pg->uniform_attrs;
     vsh->swizzle_attrs = pg->swizzle_attrs;
+    vsh->raw_attrs = pg->raw_attrs;
+    if (pg->raw_attrs) {
+        memcpy(vsh->raw_attr_formats, pg->raw_attr_formats,
+               sizeof(vsh->raw_attr_formats));
+        memcpy(vsh->raw_attr_counts, pg->raw_attr_counts,
+               sizeof(vsh->raw_attr_counts));
+    }
 
     vsh->specular_enable = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CSV0_C),
                                     NV_PGRAPH_CSV0_C_SPECULAR_ENABLE);
@@ -158,6 +165,55 @@ void pgraph_glsl_set_vsh_state(PGRAPHState *pg, VshState *vsh)
     }
 }
 
+static bool is_raw_attr_unsigned(const VshState *state, int i)
+{
+    return state->raw_attr_formats[i] ==
+               NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D ||
+           state->raw_attr_formats[i] ==
+               NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL;
+}
+
+/*
+ * Attributes without a native vertex format on the host are fetched as
+ * integer components, convert them the way the fixed format would have.
+ * Components past the attribute count are not part of the vertex.
+ */
+static void append_raw_attr_decode(const VshState *state, MString *body, int i)
+{
+    static const char *const padding[] = {
+        ".x, 0.0, 0.0, 1.0",
+        ".xy, 0.0, 1.0",
+        ".xyz, 1.0",
+        "",
+    };
+    const char *prefix, *suffix;
+
+    switch (state->raw_attr_formats[i]) {
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D:
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL:
+        prefix = "vec4(";
+        suffix = ") / 255.0";
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S1:
+        prefix = "max(vec4(";
+        suffix = ") / 32767.0, -1.0)";
+        break;
+    case NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S32K:
+        prefix = "vec4(";
+        suffix = ")";
+        break;
+    default:
+        assert(!"Unexpected raw attribute format");
+        return;
+    }
+
+    unsigned int count = state->raw_attr_counts[i];
+    assert(count >= 1 && count <= ARRAY_SIZE(padding));
+
+    mstring_append_fmt(body, "vec4 v%d = vec4((%sv%d_raw%s)%s);\n", i, prefix,
+                       i, suffix, padding[count - 1]);
+}
+
 MString *pgraph_glsl_gen_vsh(const VshState *state, GenVshGlslOptions opts)
 {
     MString *uniforms = mstring_new();
@@ -233,7 +289,7 @@ MString *pgraph_glsl_gen_vsh(const VshState *state, GenVshGlslOptions opts)
         "}\n");
 
     pgraph_glsl_get_vtx_header(header, opts.vulkan, state->smooth_shading,
-                               false, opts.prefix_outputs, false);
+                               false, opts.prefix_outputs, false, false);
 
     if (opts.prefix_outputs) {
         mstring_append(header,
@@ -262,8 +318,12 @@ MString *pgraph_glsl_gen_vsh(const VshState *state, GenVshGlslOptions opts)
         bool is_swizzled = state->swizzle_attrs & (1 << i);
         bool is_compressed = state->compressed_attrs & (1 << i);
 
+        bool is_raw = state->raw_attrs & (1 << i);
+
         assert(!(is_uniform && is_compressed));
         assert(!(is_uniform && is_swizzled));
+        assert(!(is_uniform && is_raw));
+        assert(!(is_raw && is_swizzled));
 
         if (is_uniform) {
             mstring_append_fmt(header, "vec4 v%d = inlineValue[%d];\n", i,
@@ -273,6 +333,12 @@ MString *pgraph_glsl_gen_vsh(const VshState *state, GenVshGlslOptions opts)
             if (state->compressed_attrs & (1 << i)) {
                 mstring_append_fmt(header,
                                    "layout(location = %d) in int v%d_cmp;\n", i, i);
+            } else if (is_raw) {
+                mstring_append_fmt(header,
+                                   "layout(location = %d) in %s v%d_raw;\n", i,
+                                   is_raw_attr_unsigned(state, i) ? "uvec4" :
+                                                                    "ivec4",
+                                   i);
             } else if (state->swizzle_attrs & (1 << i)) {
                 mstring_append_fmt(header, "layout(location = %d) in vec4 v%d_sw;\n",
                                    i, i);
@@ -297,6 +363,10 @@ MString *pgraph_glsl_gen_vsh(const VshState *state, GenVshGlslOptions opts)
             mstring_append_fmt(body, "vec4 v%d = v%d_sw.bgra;\n", i, i);
         }
 
+        if (state->raw_attrs & (1 << i)) {
+            append_raw_attr_decode(state, body, i);
+        }
+
     }
 
     if (state->is_fixed_function) {
@@ -456,8 +526,9 @@ MString *pgraph_glsl_gen_vsh(const VshState *state, GenVshGlslOptions opts)
             opts.use_push_constants_for_uniform_attrs) {
             mstring_append_fmt(output,
                                "layout(push_constant) uniform PushConstants {\n"
-                               "    vec4 inlineValue[%d];\n"
+                               "    layout(offset = %d) vec4 inlineValue[%d];\n"
                                "};\n\n",
+                               opts.uniform_attrs_push_constant_offset,
                                num_uniform_attrs);
         }
         mstring_append_fmt(
@@ -53,6 +53,9 @@ typedef struct {
     uint16_t compressed_attrs;
     uint16_t uniform_attrs;
     uint16_t swizzle_attrs;
+    uint16_t raw_attrs;
+    uint8_t raw_attr_formats[NV2A_VERTEXSHADER_ATTRIBUTES];
+    uint8_t raw_attr_counts[NV2A_VERTEXSHADER_ATTRIBUTES];
 
     bool fog_enable;
     enum VshFogMode fog_mode;
@@ -102,6 +105,7 @@ typedef struct GenVshGlslOptions {
     int gles_version;
     bool prefix_outputs;
     bool use_push_constants_for_uniform_attrs;
+    int uniform_attrs_push_constant_offset;
     int ubo_binding;
 } GenVshGlslOptions;
 
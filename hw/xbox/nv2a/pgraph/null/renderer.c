@@ -18,9 +18,53 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
 #include "qemu/thread.h"
+#include "qemu/timer.h"
 #include "hw/hw.h"
+#include "ui/xemu-settings.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/glsl/shaders.h"
+#include "hw/xbox/nv2a/pgraph/prim_rewrite.h"
+#include "hw/xbox/nv2a/pgraph/swizzle.h"
+#include "hw/xbox/nv2a/pgraph/texture.h"
+
+/*
+ * The null renderer draws nothing, which makes it useful for measuring the
+ * cost of emulating PGRAPH separately from host GPU work, e.g. when replaying
+ * a pushbuffer capture. The CPU side work a real renderer does per draw can
+ * optionally be done as well, so that its cost is included:
+ *
+ * - texture_conversion: unswizzle and convert textures modified since their
+ *   last use, as they would be before upload
+ * - prim_rewrite: rewrite primitives into host supported index lists
+ * - shader_state_hash: build and hash the shader state when it changes, as
+ *   done for shader cache lookups
+ *
+ * Time spent in each is reported with the method costs.
+ */
+
+typedef struct NullWorkStats {
+    uint64_t count;
+    uint64_t bytes; // Or indices, for primitive rewrites
+    uint64_t ns;
+} NullWorkStats;
+
+struct PGRAPHNullState {
+    bool texture_conversion;
+    bool prim_rewrite;
+    bool shader_state_hash;
+
+    PrimRewriteBuf prim_rewrite_buf;
+    ShaderState shader_state;
+    bool shader_state_valid;
+    GHashTable *shader_hashes;
+
+    uint64_t draws;
+    NullWorkStats textures;
+    NullWorkStats prim_rewrites;
+    NullWorkStats shader_states;
+};
 
 static void pgraph_null_sync(NV2AState *d)
 {
@@ -30,6 +74,7 @@ static void pgraph_null_sync(NV2AState *d)
 
 static void pgraph_null_flush(NV2AState *d)
 {
+    qatomic_set(&d->pgraph.flush_discard, false);
     qatomic_set(&d->pgraph.flush_pending, false);
     qemu_event_set(&d->pgraph.flush_complete);
 }
@@ -61,12 +106,163 @@ static void pgraph_null_clear_surface(NV2AState *d, uint32_t parameter)
 {
 }
 
+static void convert_texture(NV2AState *d, int texture_idx)
+{
+    PGRAPHState *pg = &d->pgraph;
+    TextureShape s = pgraph_get_texture_shape(pg, texture_idx);
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s.color_format];
+
+    hwaddr addr = pgraph_get_texture_phys_addr(pg, texture_idx);
+    size_t length = pgraph_get_texture_length(pg, &s);
+    if (addr + length > memory_region_size(d->vram)) {
+        return;
+    }
+
+    bool memory_dirty = pgraph_vram_test_and_clear_dirty(
+        d, addr, length, DIRTY_MEMORY_NV2A_TEX);
+
+    hwaddr palette_addr = 0;
+    if (s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8) {
+        size_t palette_length;
+        palette_addr = pgraph_get_texture_palette_phys_addr_length(
+            pg, texture_idx, &palette_length);
+        memory_dirty |= pgraph_vram_test_and_clear_dirty(
+            d, palette_addr, palette_length, DIRTY_MEMORY_NV2A_TEX);
+    }
+    if (!memory_dirty && !pg->texture_dirty[texture_idx]) {
+        return;
+    }
+    pg->texture_dirty[texture_idx] = false;
+
+    // Compressed formats are uploaded as is
+    if (pgraph_is_texture_format_compressed(pg, s.color_format) ||
+        s.dimensionality != 2) {
+        return;
+    }
+
+    const uint8_t *data = d->vram_ptr + addr;
+    const uint8_t *palette = d->vram_ptr + palette_addr;
+    g_autofree uint8_t *unswizzled = NULL;
+    unsigned int pitch = s.pitch;
+
+    if (!f.linear) {
+        pitch = s.width * f.bytes_per_pixel;
+        unswizzled = g_malloc(pitch * s.height);
+        unswizzle_rect(data, s.width, s.height, unswizzled, pitch,
+                       f.bytes_per_pixel);
+        data = unswizzled;
+    }
+
+    size_t converted_size;
+    g_free(pgraph_convert_texture_data(s, data, palette, s.width, s.height, 1,
+                                       pitch, 0, &converted_size));
+}
+
+static void convert_textures(NV2AState *d)
+{
+    PGRAPHNullState *r = d->pgraph.null_renderer_state;
+    int64_t start = get_clock();
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        if (pgraph_is_texture_enabled(&d->pgraph, i)) {
+            convert_texture(d, i);
+            r->textures.count += 1;
+        }
+    }
+
+    r->textures.ns += get_clock() - start;
+}
+
+static void hash_shader_state(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHNullState *r = pg->null_renderer_state;
+
+    if (r->shader_state_valid &&
+        !pgraph_glsl_check_shader_state_dirty(pg, &r->shader_state)) {
+        return;
+    }
+
+    int64_t start = get_clock();
+
+    r->shader_state = pgraph_glsl_get_shader_state(pg);
+    r->shader_state_valid = true;
+    uint64_t hash = fast_hash((const uint8_t *)&r->shader_state,
+                              sizeof(r->shader_state));
+    if (!g_hash_table_contains(r->shader_hashes, &hash)) {
+        g_hash_table_add(r->shader_hashes, g_memdup2(&hash, sizeof(hash)));
+    }
+    pg->program_data_dirty = false;
+
+    r->shader_states.count += 1;
+    r->shader_states.ns += get_clock() - start;
+}
+
+static void rewrite_primitives(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHNullState *r = pg->null_renderer_state;
+
+    PrimAssemblyState assembly = {
+        .primitive_mode = pg->primitive_mode,
+        .polygon_mode = (enum ShaderPolygonMode)GET_MASK(
+            pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER),
+            NV_PGRAPH_SETUPRASTER_FRONTFACEMODE),
+        .last_provoking = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_3),
+                                   NV_PGRAPH_CONTROL_3_PROVOKING_VERTEX) ==
+                          NV_PGRAPH_CONTROL_3_PROVOKING_VERTEX_LAST,
+        .flat_shading = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_3),
+                                 NV_PGRAPH_CONTROL_3_SHADEMODE) ==
+                        NV_PGRAPH_CONTROL_3_SHADEMODE_FLAT,
+    };
+
+    int64_t start = get_clock();
+    PrimRewrite prim_rw = { NULL, 0 };
+    unsigned int num_indices = 0;
+
+    // Ranges may be followed by elements, see pgraph_expand_draw_arrays
+    if (pg->draw_arrays_length) {
+        prim_rw = pgraph_prim_rewrite_ranges(
+            &r->prim_rewrite_buf, assembly, pg->draw_arrays_start,
+            pg->draw_arrays_count, pg->draw_arrays_length);
+        num_indices += prim_rw.num_indices;
+    }
+    if (pg->inline_elements_length) {
+        prim_rw = pgraph_prim_rewrite_indexed(
+            &r->prim_rewrite_buf, assembly, pg->inline_elements,
+            pg->inline_elements_length);
+        num_indices += prim_rw.num_indices;
+    } else if (pg->inline_buffer_length) {
+        prim_rw = pgraph_prim_rewrite_sequential(
+            &r->prim_rewrite_buf, assembly, 0, pg->inline_buffer_length);
+        num_indices += prim_rw.num_indices;
+    }
+
+    r->prim_rewrites.count += 1;
+    r->prim_rewrites.bytes += num_indices;
+    r->prim_rewrites.ns += get_clock() - start;
+}
+
 static void pgraph_null_draw_begin(NV2AState *d)
 {
+    PGRAPHNullState *r = d->pgraph.null_renderer_state;
+
+    if (r->shader_state_hash) {
+        hash_shader_state(d);
+    }
+    if (r->texture_conversion) {
+        convert_textures(d);
+    }
 }
 
 static void pgraph_null_draw_end(NV2AState *d)
 {
+    PGRAPHNullState *r = d->pgraph.null_renderer_state;
+
+    r->draws += 1;
+    if (r->prim_rewrite) {
+        rewrite_primitives(d);
+    }
 }
 
 static void pgraph_null_flip_stall(NV2AState *d)
@@ -79,7 +275,7 @@ static void pgraph_null_flush_draw(NV2AState *d)
 
 static void pgraph_null_get_report(NV2AState *d, uint32_t parameter)
 {
-    pgraph_write_zpass_pixel_cnt_report(d, parameter, 0);
+    pgraph_write_zpass_pixel_cnt_report(d, d->pgraph.dma_report, parameter, 0);
 }
 
 static void pgraph_null_image_blit(NV2AState *d)
@@ -111,9 +307,66 @@ static void pgraph_null_surface_update(NV2AState *d, bool upload,
 {
 }
 
+static void report_work_stats(const char *name, const char *unit,
+                              const NullWorkStats *stats)
+{
+    fprintf(stderr, "  %-20s %-10" PRIu64 " %-12" PRIu64 " %s, %.3f ms\n",
+            name, stats->count, stats->bytes, unit, stats->ns / 1e6);
+}
+
+static void pgraph_null_report_stats(NV2AState *d)
+{
+    PGRAPHNullState *r = d->pgraph.null_renderer_state;
+
+    fprintf(stderr, "nv2a: Null renderer work (%" PRIu64 " draws)\n",
+            r->draws);
+    if (r->texture_conversion) {
+        report_work_stats("Texture conversion", "bytes", &r->textures);
+    }
+    if (r->prim_rewrite) {
+        report_work_stats("Primitive rewrite", "indices", &r->prim_rewrites);
+    }
+    if (r->shader_state_hash) {
+        fprintf(stderr, "  %-20s %-10" PRIu64 " %-12u unique, %.3f ms\n",
+                "Shader state hash", r->shader_states.count,
+                g_hash_table_size(r->shader_hashes),
+                r->shader_states.ns / 1e6);
+    }
+
+    r->draws = 0;
+    memset(&r->textures, 0, sizeof(r->textures));
+    memset(&r->prim_rewrites, 0, sizeof(r->prim_rewrites));
+    memset(&r->shader_states, 0, sizeof(r->shader_states));
+}
+
 static void pgraph_null_init(NV2AState *d, Error **errp)
 {
     PGRAPHState *pg = &d->pgraph;
+    PGRAPHNullState *r = g_malloc0(sizeof(*r));
+    pg->null_renderer_state = r;
+
+    r->texture_conversion = g_config.display.null_renderer.texture_conversion;
+    r->prim_rewrite = g_config.display.null_renderer.prim_rewrite;
+    r->shader_state_hash = g_config.display.null_renderer.shader_state_hash;
+    r->shader_hashes =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    pgraph_prim_rewrite_init(&r->prim_rewrite_buf);
+
+    g_nv2a_stats.method_costs_enabled =
+        g_config.display.null_renderer.method_costs;
+}
+
+static void pgraph_null_finalize(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHNullState *r = pg->null_renderer_state;
+
+    pgraph_report_stats(d);
+    g_nv2a_stats.method_costs_enabled = false;
+
+    pgraph_prim_rewrite_finalize(&r->prim_rewrite_buf);
+    g_hash_table_destroy(r->shader_hashes);
+    g_free(r);
     pg->null_renderer_state = NULL;
 }
 
@@ -122,6 +375,7 @@ static PGRAPHRenderer pgraph_null_renderer = {
     .name = "Null",
     .ops = {
         .init = pgraph_null_init,
+        .finalize = pgraph_null_finalize,
         .clear_report_value = pgraph_null_clear_report_value,
         .clear_surface = pgraph_null_clear_surface,
         .draw_begin = pgraph_null_draw_begin,
@@ -136,6 +390,7 @@ static PGRAPHRenderer pgraph_null_renderer = {
         .pre_shutdown_wait = pgraph_null_pre_shutdown_wait,
         .process_pending = pgraph_null_process_pending,
         .process_pending_reports = pgraph_null_process_pending_reports,
+        .report_stats = pgraph_null_report_stats,
         .surface_update = pgraph_null_surface_update,
     }
 };
@@ -25,6 +25,7 @@
 #include <android/log.h>
 #endif
 
+#include "qemu/fast-hash.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "ui/xemu-notifications.h"
 #include "ui/xemu-settings.h"
@@ -84,6 +85,18 @@ uint64_t pgraph_read(void *opaque, hwaddr addr, unsigned int size)
     return r;
 }
 
+/* Advance the surface read index, completing a pending flip */
+void pgraph_increment_read_3d(PGRAPHState *pg)
+{
+    PG_SET_MASK(NV_PGRAPH_SURFACE,
+             NV_PGRAPH_SURFACE_READ_3D,
+             (PG_GET_MASK(NV_PGRAPH_SURFACE,
+                      NV_PGRAPH_SURFACE_READ_3D)+1)
+                % PG_GET_MASK(NV_PGRAPH_SURFACE,
+                           NV_PGRAPH_SURFACE_MODULO_3D) );
+    nv2a_profile_increment();
+}
+
 void pgraph_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
 {
     NV2AState *d = (NV2AState *)opaque;
@@ -111,13 +124,7 @@ void pgraph_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
         break;
     case NV_PGRAPH_INCREMENT:
         if (val & NV_PGRAPH_INCREMENT_READ_3D) {
-            PG_SET_MASK(NV_PGRAPH_SURFACE,
-                     NV_PGRAPH_SURFACE_READ_3D,
-                     (PG_GET_MASK(NV_PGRAPH_SURFACE,
-                              NV_PGRAPH_SURFACE_READ_3D)+1)
-                        % PG_GET_MASK(NV_PGRAPH_SURFACE,
-                                   NV_PGRAPH_SURFACE_MODULO_3D) );
-            nv2a_profile_increment();
+            pgraph_increment_read_3d(pg);
             pfifo_kick(d);
         }
         break;
@@ -167,6 +174,7 @@ void pgraph_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     }
     default:
         pgraph_reg_w(pg, addr, val);
+        pg->ctx_switch_subchannel = -1;
         break;
     }
 
@@ -212,6 +220,8 @@ void pgraph_context_switch(NV2AState *d, unsigned int channel_id)
 }
 
 static const PGRAPHRenderer *renderers[CONFIG_DISPLAY_RENDERER__COUNT];
+// Headless instances have no GL context, so only offscreen renderers work
+static bool nv2a_headless;
 #ifdef __ANDROID__
 static bool nv2a_android_early_init_done;
 #ifdef CONFIG_OPENGL
@@ -235,11 +245,13 @@ void pgraph_init(NV2AState *d)
     PGRAPHState *pg = &d->pgraph;
     qemu_mutex_init(&pg->lock);
     qemu_mutex_init(&pg->renderer_lock);
+    pg->ctx_switch_subchannel = -1;
     qemu_event_init(&pg->sync_complete, false);
     qemu_event_init(&pg->flush_complete, false);
     qemu_cond_init(&pg->framebuffer_released);
     qemu_event_init(&pg->renderer_switch_complete, false);
     pg->renderer_switch_phase = PGRAPH_RENDERER_SWITCH_PHASE_IDLE;
+    pgraph_vram_dirty_init(d);
 
     pg->frame_time = 0;
     pg->draw_time = 0;
@@ -257,6 +269,9 @@ void pgraph_init(NV2AState *d)
     }
 
     pgraph_clear_dirty_reg_map(pg);
+
+    g_nv2a_stats.method_cost_sample_interval =
+        g_config.display.debug.video.method_cost_sample_interval;
 }
 
 void pgraph_clear_dirty_reg_map(PGRAPHState *pg)
@@ -279,7 +294,7 @@ static CONFIG_DISPLAY_RENDERER get_default_renderer(void)
 #endif
 #else
 #ifdef CONFIG_OPENGL
-    if (renderers[CONFIG_DISPLAY_RENDERER_OPENGL]) {
+    if (renderers[CONFIG_DISPLAY_RENDERER_OPENGL] && !nv2a_headless) {
         return CONFIG_DISPLAY_RENDERER_OPENGL;
     }
 #endif
@@ -293,6 +308,14 @@ static CONFIG_DISPLAY_RENDERER get_default_renderer(void)
     return CONFIG_DISPLAY_RENDERER_NULL;
 }
 
+static void prewarm_renderer(void)
+{
+    const PGRAPHRenderer *r = renderers[g_config.display.renderer];
+    if (r && r->ops.prewarm) {
+        r->ops.prewarm();
+    }
+}
+
 void nv2a_context_init(void)
 {
     if (!renderers[g_config.display.renderer]) {
@@ -324,7 +347,29 @@ void nv2a_context_init(void)
         }
     }
 #endif
+
+    prewarm_renderer();
+}
+
+#ifndef __ANDROID__
+void nv2a_context_init_headless(void)
+{
+    nv2a_headless = true;
+
+    // Vulkan renders offscreen without a window. The GL contexts that
+    // early_context_init would create are skipped, which also leaves the
+    // Vulkan renderer without GL interop.
+#ifdef CONFIG_VULKAN
+    if (renderers[CONFIG_DISPLAY_RENDERER_VULKAN]) {
+        g_config.display.renderer = CONFIG_DISPLAY_RENDERER_VULKAN;
+        prewarm_renderer();
+        return;
+    }
+#endif
+    fprintf(stderr, "Warning: Vulkan unavailable, rendering disabled\n");
+    g_config.display.renderer = CONFIG_DISPLAY_RENDERER_NULL;
 }
+#endif
 
 #ifdef __ANDROID__
 void nv2a_android_early_context_init(void)
@@ -361,6 +406,7 @@ void nv2a_android_early_context_init(void)
     if (r && r->ops.early_context_init) {
         r->ops.early_context_init();
     }
+    prewarm_renderer();
     nv2a_android_early_init_done = true;
 }
 #endif
@@ -420,6 +466,9 @@ static void init_renderer(PGRAPHState *pg)
                 break;
             }
         }
+        if (nv2a_headless && renderer == CONFIG_DISPLAY_RENDERER_OPENGL) {
+            continue;
+        }
         if (!already_added && renderers[renderer]) {
             attempts[attempt_count++] = renderer;
         }
@@ -454,15 +503,64 @@ void pgraph_destroy(PGRAPHState *pg)
        pg->renderer->ops.finalize(d);
     }
 
+    for (int i = 0; i < VSH_PROGRAM_CACHE_SIZE; i++) {
+        VshProgramCacheEntry *entry = &pg->vsh_program_cache[i];
+        if (entry->valid) {
+            nv2a_vsh_program_destroy(&entry->program);
+            entry->valid = false;
+        }
+    }
+
+    pgraph_vram_dirty_finalize(pg);
     qemu_mutex_destroy(&pg->lock);
 }
 
+/*
+ * Instances sharing a base path share their shader caches too, but each
+ * writes the list of shaders to preload with only the ones it used. Append
+ * the hashes of the list on disk that <list> lacks, up to <max_entries> in
+ * all, so shaders compiled by another instance are preloaded as well.
+ */
+void pgraph_merge_shader_cache_list(GByteArray *list, const char *path,
+                                    unsigned int max_entries)
+{
+    g_autofree gchar *contents = NULL;
+    gsize contents_size;
+
+    if (!g_file_get_contents(path, &contents, &contents_size, NULL)) {
+        return;
+    }
+
+    // Copied, appending to the list may move its data
+    unsigned int num_entries = list->len / sizeof(uint64_t);
+    g_autofree uint64_t *own =
+        g_memdup2(list->data, num_entries * sizeof(uint64_t));
+    g_autoptr(GHashTable) seen =
+        g_hash_table_new(g_int64_hash, g_int64_equal);
+    for (unsigned int i = 0; i < num_entries; i++) {
+        g_hash_table_add(seen, &own[i]);
+    }
+
+    uint64_t *saved = (uint64_t *)contents;
+    for (gsize i = 0; i < contents_size / sizeof(uint64_t) &&
+                      num_entries < max_entries;
+         i++) {
+        if (g_hash_table_add(seen, &saved[i])) {
+            g_byte_array_append(list, (const guint8 *)&saved[i],
+                                sizeof(uint64_t));
+            num_entries++;
+        }
+    }
+}
+
 int nv2a_get_framebuffer_surface(void)
 {
     NV2AState *d = g_nv2a;
     PGRAPHState *pg = &d->pgraph;
     int s = 0;
 
+    nv2a_frame_queue_advance(d);
+
     qemu_mutex_lock(&pg->renderer_lock);
     assert(!pg->framebuffer_in_use);
     pg->framebuffer_in_use = true;
@@ -484,6 +582,86 @@ void nv2a_release_framebuffer_surface(void)
     qemu_mutex_unlock(&pg->renderer_lock);
 }
 
+/*
+ * Present the current frame to the window directly from the renderer. Only
+ * available when the renderer owns the window's swapchain.
+ */
+bool nv2a_present_frame(const NV2APresentRequest *req)
+{
+    NV2AState *d = g_nv2a;
+    PGRAPHState *pg = &d->pgraph;
+    bool presented = false;
+
+    nv2a_frame_queue_advance(d);
+
+    qemu_mutex_lock(&pg->renderer_lock);
+    if (pg->renderer->ops.present_frame) {
+        presented = pg->renderer->ops.present_frame(d, req);
+    }
+    qemu_mutex_unlock(&pg->renderer_lock);
+
+    return presented;
+}
+
+/*
+ * The native surface of the window passed to nv2a_present_frame has been
+ * destroyed. A new one is created for it with the next present.
+ */
+void nv2a_present_surface_lost(void)
+{
+    NV2AState *d = g_nv2a;
+    PGRAPHState *pg = &d->pgraph;
+
+    qemu_mutex_lock(&pg->renderer_lock);
+    if (pg->renderer->ops.present_surface_lost) {
+        pg->renderer->ops.present_surface_lost(d);
+    }
+    qemu_mutex_unlock(&pg->renderer_lock);
+}
+
+/*
+ * Ask the renderer to give back memory it can recreate later, e.g. when the
+ * OS is running low. With @all set, release as much as possible rather than
+ * trimming. Returns immediately; the work happens on the pgraph thread.
+ */
+void nv2a_release_caches(bool all)
+{
+    NV2AState *d = g_nv2a;
+
+    if (!d) {
+        return;
+    }
+
+    qemu_mutex_lock(&d->pgraph.renderer_lock);
+    if (d->pgraph.renderer->ops.release_caches) {
+        d->pgraph.renderer->ops.release_caches(d, all);
+    }
+    qemu_mutex_unlock(&d->pgraph.renderer_lock);
+}
+
+/*
+ * Latest breakdown of renderer memory use. Figures are refreshed once a frame
+ * while they are being asked for, so the first call may return zeroes.
+ */
+bool nv2a_get_memory_stats(NV2AMemoryStats *stats)
+{
+    NV2AState *d = g_nv2a;
+    bool ok = false;
+
+    memset(stats, 0, sizeof(*stats));
+    if (!d) {
+        return false;
+    }
+
+    qemu_mutex_lock(&d->pgraph.renderer_lock);
+    if (d->pgraph.renderer->ops.get_memory_stats) {
+        ok = d->pgraph.renderer->ops.get_memory_stats(d, stats);
+    }
+    qemu_mutex_unlock(&d->pgraph.renderer_lock);
+
+    return ok;
+}
+
 void nv2a_set_surface_scale_factor(unsigned int scale)
 {
     NV2AState *d = g_nv2a;
@@ -617,6 +795,19 @@ static const struct {
 #undef DEF_METHOD_CASE_4_OFFSET
 #undef DEF_METHOD_CASE_4
 
+const char *pgraph_get_method_name(uint32_t graphics_class,
+                                   unsigned int method)
+{
+    int idx = METHOD_ADDR_TO_INDEX(method);
+    if (graphics_class == NV_KELVIN_PRIMITIVE &&
+        idx < ARRAY_SIZE(pgraph_kelvin_methods) &&
+        pgraph_kelvin_methods[idx].handler) {
+        return pgraph_kelvin_methods[idx].name;
+    }
+
+    return NULL;
+}
+
 static void pgraph_method_log(unsigned int subchannel,
                               unsigned int graphics_class,
                               unsigned int method, uint32_t parameter)
@@ -721,12 +912,31 @@ static void pgraph_method_non_inc(MethodFunc handler, METHOD_HANDLER_ARG_DECL)
     }                                                             \
     DEF_METHOD_INT(gclass, name)
 
+/*
+ * Whether a method just executed needs the FIFO to stop handing PGRAPH more
+ * words, e.g. to wait for a flip or for an interrupt to be serviced.
+ */
+bool pgraph_method_should_stall(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    return pg->waiting_for_flip || pg->waiting_for_nop ||
+           pg->waiting_for_context_switch ||
+           !(pgraph_reg_r(pg, NV_PGRAPH_FIFO) & NV_PGRAPH_FIFO_ACCESS);
+}
+
 int pgraph_method(NV2AState *d, unsigned int subchannel,
                    unsigned int method, uint32_t parameter,
                    uint32_t *parameters, size_t num_words_available,
                    size_t max_lookahead_words, bool inc)
 {
     int num_processed = 1;
+    bool method_profiled = qatomic_read(&g_nv2a_stats.method_costs_enabled);
+    int64_t method_start = 0;
+
+    if (unlikely(method_profiled)) {
+        method_start = nv2a_profile_method_start();
+    }
 
     PGRAPHState *pg = &d->pgraph;
 
@@ -755,19 +965,23 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
         pgraph_reg_w(pg, NV_PGRAPH_CTX_CACHE3 + subchannel * 4, ctx_3);
         pgraph_reg_w(pg, NV_PGRAPH_CTX_CACHE4 + subchannel * 4, ctx_4);
         pgraph_reg_w(pg, NV_PGRAPH_CTX_CACHE5 + subchannel * 4, ctx_5);
+        pg->ctx_switch_subchannel = -1;
     }
 
     // is this right?
-    pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH1,
-                 pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE1 + subchannel * 4));
-    pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH2,
-                 pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE2 + subchannel * 4));
-    pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH3,
-                 pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE3 + subchannel * 4));
-    pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH4,
-                 pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE4 + subchannel * 4));
-    pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH5,
-                 pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE5 + subchannel * 4));
+    if (pg->ctx_switch_subchannel != subchannel) {
+        pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH1,
+                     pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE1 + subchannel * 4));
+        pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH2,
+                     pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE2 + subchannel * 4));
+        pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH3,
+                     pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE3 + subchannel * 4));
+        pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH4,
+                     pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE4 + subchannel * 4));
+        pgraph_reg_w(pg, NV_PGRAPH_CTX_SWITCH5,
+                     pgraph_reg_r(pg, NV_PGRAPH_CTX_CACHE5 + subchannel * 4));
+        pg->ctx_switch_subchannel = subchannel;
+    }
 
     uint32_t graphics_class = PG_GET_MASK(NV_PGRAPH_CTX_SWITCH1,
                                        NV_PGRAPH_CTX_SWITCH1_GRCLASS);
@@ -910,11 +1124,21 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
         goto unhandled;
     }
 
-    return num_processed;
+    goto done;
 
 unhandled:
     trace_nv2a_pgraph_method_unhandled(subchannel, graphics_class,
                                            method, parameter);
+done:
+    if (unlikely(method_profiled)) {
+        nv2a_profile_method_cost(graphics_class, method, num_processed,
+                                 method_start);
+    }
+    if (unlikely(qatomic_read(&g_nv2a_capture_active))) {
+        nv2a_capture_method(d, subchannel, method, parameter, parameters,
+                            num_words_available, max_lookahead_words, inc,
+                            num_processed);
+    }
     return num_processed;
 }
 
@@ -1001,12 +1225,80 @@ DEF_METHOD(NV097, FLIP_INCREMENT_WRITE)
     pg->frame_time++;
 }
 
+/*
+ * Decide whether the next frame is skipped. The number of frames skipped after
+ * each rendered one goes up while frames take longer than the target, and
+ * back down once rendered frames alone would meet it.
+ */
+static void pgraph_update_frame_skip(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    FrameSkipState *fs = &pg->frame_skip;
+
+    if (!pg->renderer->ops.set_frame_skip) {
+        return;
+    }
+
+    if (!g_config.display.frame_skip.enabled || !g_nv2a_stats.frame_count) {
+        if (fs->active) {
+            pg->renderer->ops.set_frame_skip(d, false);
+        }
+        memset(fs, 0, sizeof(*fs));
+        return;
+    }
+
+    unsigned int max_level = MAX(g_config.display.frame_skip.max_skipped, 0);
+    int target_fps = MAX(g_config.display.frame_skip.target_fps, 1);
+    float target_ms = 1000.0f / target_fps;
+
+    unsigned int idx = (g_nv2a_stats.frame_ptr + NV2A_PROF_NUM_FRAMES - 1) %
+                       NV2A_PROF_NUM_FRAMES;
+    float frame_ms = g_nv2a_stats.frame_history[idx].mspf;
+
+    if (fs->frame_time_avg == 0) {
+        fs->frame_time_avg = fs->rendered_time_avg = frame_ms;
+        fs->frames_since_change = 0;
+    }
+
+    // Smooth out single slow frames such as loading hitches
+    const float smoothing = 0.1f;
+    fs->frame_time_avg += (frame_ms - fs->frame_time_avg) * smoothing;
+    if (!fs->active) {
+        fs->rendered_time_avg += (frame_ms - fs->rendered_time_avg) * smoothing;
+    }
+    fs->frames_since_change += 1;
+
+    // Give the averages time to settle after each change
+    const int min_frames_between_changes = 60;
+    if (fs->frames_since_change >= min_frames_between_changes) {
+        unsigned int level = fs->level;
+        if (fs->frame_time_avg > target_ms * 1.1f && level < max_level) {
+            level += 1;
+        } else if ((fs->rendered_time_avg < target_ms * 0.9f && level > 0) ||
+                   level > max_level) {
+            level -= 1;
+        }
+        if (level != fs->level) {
+            fs->level = level;
+            fs->frames_since_change = 0;
+        }
+    }
+
+    fs->skipped = fs->active ? fs->skipped + 1 : 0;
+    bool skip = fs->skipped < fs->level;
+    if (skip != fs->active) {
+        pg->renderer->ops.set_frame_skip(d, skip);
+        fs->active = skip;
+    }
+}
+
 DEF_METHOD(NV097, FLIP_STALL)
 {
     trace_nv2a_pgraph_flip_stall();
     d->pgraph.renderer->ops.surface_update(d, false, true, true);
     d->pgraph.renderer->ops.flip_stall(d);
     nv2a_profile_flip_stall();
+    pgraph_update_frame_skip(d);
     pg->waiting_for_flip = true;
 }
 
@@ -1845,7 +2137,7 @@ DEF_METHOD_INC(NV097, SET_PROJECTION_MATRIX)
     // pg->projection_matrix[slot] = *(float*)&parameter;
     unsigned int row = NV_IGRAPH_XF_XFCTX_PMAT0 + slot/4;
     pg->vsh_constants[row][slot%4] = parameter;
-    pg->vsh_constants_dirty[row] = true;
+    pgraph_mark_vsh_constants_dirty(pg, row, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_MODEL_VIEW_MATRIX)
@@ -1855,7 +2147,7 @@ DEF_METHOD_INC(NV097, SET_MODEL_VIEW_MATRIX)
     unsigned int entry = slot % 16;
     unsigned int row = NV_IGRAPH_XF_XFCTX_MMAT0 + matnum*8 + entry/4;
     pg->vsh_constants[row][entry % 4] = parameter;
-    pg->vsh_constants_dirty[row] = true;
+    pgraph_mark_vsh_constants_dirty(pg, row, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_INVERSE_MODEL_VIEW_MATRIX)
@@ -1865,7 +2157,7 @@ DEF_METHOD_INC(NV097, SET_INVERSE_MODEL_VIEW_MATRIX)
     unsigned int entry = slot % 16;
     unsigned int row = NV_IGRAPH_XF_XFCTX_IMMAT0 + matnum*8 + entry/4;
     pg->vsh_constants[row][entry % 4] = parameter;
-    pg->vsh_constants_dirty[row] = true;
+    pgraph_mark_vsh_constants_dirty(pg, row, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_COMPOSITE_MATRIX)
@@ -1873,7 +2165,7 @@ DEF_METHOD_INC(NV097, SET_COMPOSITE_MATRIX)
     int slot = (method - NV097_SET_COMPOSITE_MATRIX) / 4;
     unsigned int row = NV_IGRAPH_XF_XFCTX_CMAT0 + slot/4;
     pg->vsh_constants[row][slot%4] = parameter;
-    pg->vsh_constants_dirty[row] = true;
+    pgraph_mark_vsh_constants_dirty(pg, row, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_TEXTURE_MATRIX)
@@ -1883,7 +2175,7 @@ DEF_METHOD_INC(NV097, SET_TEXTURE_MATRIX)
     unsigned int entry = slot % 16;
     unsigned int row = NV_IGRAPH_XF_XFCTX_T0MAT + tex*8 + entry/4;
     pg->vsh_constants[row][entry%4] = parameter;
-    pg->vsh_constants_dirty[row] = true;
+    pgraph_mark_vsh_constants_dirty(pg, row, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_FOG_PARAMS)
@@ -1907,7 +2199,7 @@ DEF_METHOD_INC(NV097, SET_TEXGEN_PLANE_S)
     unsigned int entry = slot % 16;
     unsigned int row = NV_IGRAPH_XF_XFCTX_TG0MAT + tex*8 + entry/4;
     pg->vsh_constants[row][entry%4] = parameter;
-    pg->vsh_constants_dirty[row] = true;
+    pgraph_mark_vsh_constants_dirty(pg, row, 1);
 }
 
 DEF_METHOD(NV097, SET_TEXGEN_VIEW_MODEL)
@@ -1920,7 +2212,7 @@ DEF_METHOD_INC(NV097, SET_FOG_PLANE)
 {
     int slot = (method - NV097_SET_FOG_PLANE) / 4;
     pg->vsh_constants[NV_IGRAPH_XF_XFCTX_FOG][slot] = parameter;
-    pg->vsh_constants_dirty[NV_IGRAPH_XF_XFCTX_FOG] = true;
+    pgraph_mark_vsh_constants_dirty(pg, NV_IGRAPH_XF_XFCTX_FOG, 1);
 }
 
 struct CurveCoefficients {
@@ -2042,7 +2334,7 @@ DEF_METHOD_INC(NV097, SET_VIEWPORT_OFFSET)
 {
     int slot = (method - NV097_SET_VIEWPORT_OFFSET) / 4;
     pg->vsh_constants[NV_IGRAPH_XF_XFCTX_VPOFF][slot] = parameter;
-    pg->vsh_constants_dirty[NV_IGRAPH_XF_XFCTX_VPOFF] = true;
+    pgraph_mark_vsh_constants_dirty(pg, NV_IGRAPH_XF_XFCTX_VPOFF, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_POINT_PARAMS)
@@ -2055,7 +2347,7 @@ DEF_METHOD_INC(NV097, SET_EYE_POSITION)
 {
     int slot = (method - NV097_SET_EYE_POSITION) / 4;
     pg->vsh_constants[NV_IGRAPH_XF_XFCTX_EYEP][slot] = parameter;
-    pg->vsh_constants_dirty[NV_IGRAPH_XF_XFCTX_EYEP] = true;
+    pgraph_mark_vsh_constants_dirty(pg, NV_IGRAPH_XF_XFCTX_EYEP, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_COMBINER_FACTOR0)
@@ -2092,7 +2384,7 @@ DEF_METHOD_INC(NV097, SET_VIEWPORT_SCALE)
 {
     int slot = (method - NV097_SET_VIEWPORT_SCALE) / 4;
     pg->vsh_constants[NV_IGRAPH_XF_XFCTX_VPSCL][slot] = parameter;
-    pg->vsh_constants_dirty[NV_IGRAPH_XF_XFCTX_VPSCL] = true;
+    pgraph_mark_vsh_constants_dirty(pg, NV_IGRAPH_XF_XFCTX_VPSCL, 1);
 }
 
 DEF_METHOD_INC(NV097, SET_TRANSFORM_PROGRAM)
@@ -2112,22 +2404,51 @@ DEF_METHOD_INC(NV097, SET_TRANSFORM_PROGRAM)
     }
 }
 
-DEF_METHOD_INC(NV097, SET_TRANSFORM_CONSTANT)
+/*
+ * Constants are uploaded in runs of up to 32 words, so take the whole run
+ * at once rather than going through pgraph_method_inc a word at a time.
+ */
+DEF_METHOD(NV097, SET_TRANSFORM_CONSTANT)
 {
     int slot = (method - NV097_SET_TRANSFORM_CONSTANT) / 4;
     int const_load = PG_GET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
                               NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR);
+    size_t count = inc ? MIN(num_words_available,
+                             (METHOD_RANGE_END_NAME(NV097,
+                                                    SET_TRANSFORM_CONSTANT) -
+                              method) / 4) :
+                         1;
+    int first_changed = -1, last_changed = -1;
+
+    for (size_t i = 0; i < count; i++, slot++) {
+        assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
+        if (i) {
+            parameter = ldl_le_p(parameters + i);
+            pgraph_method_log(subchannel, NV_KELVIN_PRIMITIVE,
+                              method + i * 4, parameter);
+        }
+
+        uint32_t *constant = &pg->vsh_constants[const_load][slot % 4];
+        if (*constant != parameter) {
+            *constant = parameter;
+            if (first_changed < 0) {
+                first_changed = const_load;
+            }
+            last_changed = const_load;
+        }
 
-    assert(const_load < NV2A_VERTEXSHADER_CONSTANTS);
-    // VertexShaderConstant *constant = &pg->constants[const_load];
-    pg->vsh_constants_dirty[const_load] |=
-        (parameter != pg->vsh_constants[const_load][slot%4]);
-    pg->vsh_constants[const_load][slot%4] = parameter;
+        if (slot % 4 == 3) {
+            const_load++;
+        }
+    }
 
-    if (slot % 4 == 3) {
-        PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
-                 NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load+1);
+    if (first_changed >= 0) {
+        pgraph_mark_vsh_constants_dirty(pg, first_changed,
+                                        last_changed - first_changed + 1);
     }
+    PG_SET_MASK(NV_PGRAPH_CHEOPS_OFFSET,
+             NV_PGRAPH_CHEOPS_OFFSET_CONST_LD_PTR, const_load);
+    *num_words_consumed = count;
 }
 
 DEF_METHOD_INC(NV097, SET_VERTEX3F)
@@ -2758,25 +3079,54 @@ DEF_METHOD(NV097, SET_TEXTURE_SET_BUMP_ENV_OFFSET)
     pgraph_reg_w(pg, NV_PGRAPH_BUMPOFFSET1 + slot * 4, parameter);
 }
 
+/* Vertices per primitive of list primitive modes, 0 if primitives connect */
+static unsigned int get_list_primitive_size(enum ShaderPrimitiveMode mode)
+{
+    switch (mode) {
+    case PRIM_TYPE_POINTS:
+        return 1;
+    case PRIM_TYPE_LINES:
+        return 2;
+    case PRIM_TYPE_TRIANGLES:
+        return 3;
+    case PRIM_TYPE_QUADS:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Called on the first ARRAY_ELEMENT after DRAW_ARRAYS. The batch then holds
+ * both: renderers draw the ranges first, then the elements.
+ *
+ * Ranges from a set of squashed BEGIN+DA+END triplets are primitives of their
+ * own and stay as they are. Only the range of the BEGIN+DA+ARRAY_ELEMENT+...
+ * chain that got here can connect to the elements, and it is turned into
+ * elements unless it ends on a primitive boundary.
+ */
 static void pgraph_expand_draw_arrays(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
-    uint32_t start = pg->draw_arrays_start[pg->draw_arrays_length - 1];
-    uint32_t count = pg->draw_arrays_count[pg->draw_arrays_length - 1];
-
-    /* Render any previously squashed DRAW_ARRAYS calls. This case would be
-     * triggered if a set of BEGIN+DA+END triplets is followed by the
-     * BEGIN+DA+ARRAY_ELEMENT+... chain that caused this expansion. */
-    if (pg->draw_arrays_length > 1) {
-        d->pgraph.renderer->ops.flush_draw(d);
-        pgraph_reset_inline_buffers(pg);
+    unsigned int last = pg->draw_arrays_length - 1;
+    uint32_t start = pg->draw_arrays_start[last];
+    uint32_t count = pg->draw_arrays_count[last];
+
+    unsigned int prim_size = get_list_primitive_size(pg->primitive_mode);
+    if (prim_size && count % prim_size == 0) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS_KEPT);
+        return;
     }
+
     assert((pg->inline_elements_length + count) < NV2A_MAX_BATCH_LENGTH);
     for (unsigned int i = 0; i < count; i++) {
         pg->inline_elements[pg->inline_elements_length++] = start + i;
     }
 
-    pgraph_reset_draw_arrays(pg);
+    pg->draw_arrays_length = last;
+    if (!pg->draw_arrays_length) {
+        pgraph_reset_draw_arrays(pg);
+    }
 }
 
 void pgraph_check_within_begin_end_block(PGRAPHState *pg)
@@ -2790,7 +3140,7 @@ DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT16)
 {
     pgraph_check_within_begin_end_block(pg);
 
-    if (pg->draw_arrays_length) {
+    if (pg->draw_arrays_length && !pg->inline_elements_length) {
         pgraph_expand_draw_arrays(d);
     }
 
@@ -2803,7 +3153,7 @@ DEF_METHOD_NON_INC(NV097, ARRAY_ELEMENT32)
 {
     pgraph_check_within_begin_end_block(pg);
 
-    if (pg->draw_arrays_length) {
+    if (pg->draw_arrays_length && !pg->inline_elements_length) {
         pgraph_expand_draw_arrays(d);
     }
 
@@ -3085,25 +3435,81 @@ DEF_METHOD_INC(NV097, SET_TRANSFORM_DATA)
     pg->vertex_state_shader_v0[slot] = parameter;
 }
 
+/*
+ * Programs are often launched again without being reloaded, so parsed
+ * programs are kept by the contents of program memory from their start slot.
+ */
+static VshProgramCacheEntry *get_transform_program(PGRAPHState *pg,
+                                                   unsigned int start)
+{
+    uint64_t hash =
+        fast_hash((void *)pg->program_data[start],
+                  (NV2A_MAX_TRANSFORM_PROGRAM_LENGTH - start) *
+                      sizeof(pg->program_data[0]));
+
+    for (int i = 0; i < VSH_PROGRAM_CACHE_SIZE; i++) {
+        VshProgramCacheEntry *entry = &pg->vsh_program_cache[i];
+        if (entry->valid && entry->start == start && entry->hash == hash) {
+            return entry;
+        }
+    }
+
+    VshProgramCacheEntry *entry =
+        &pg->vsh_program_cache[pg->vsh_program_cache_next];
+    pg->vsh_program_cache_next =
+        (pg->vsh_program_cache_next + 1) % VSH_PROGRAM_CACHE_SIZE;
+
+    if (entry->valid) {
+        nv2a_vsh_program_destroy(&entry->program);
+    }
+    Nv2aVshParseResult result = nv2a_vsh_parse_program(
+            &entry->program,
+            pg->program_data[start],
+            NV2A_MAX_TRANSFORM_PROGRAM_LENGTH - start);
+    assert(result == NV2AVPR_SUCCESS);
+
+    entry->valid = true;
+    entry->start = start;
+    entry->hash = hash;
+    entry->has_result = false;
+
+    return entry;
+}
+
+static uint64_t get_transform_program_io_hash(PGRAPHState *pg)
+{
+    return fast_hash((void *)pg->vsh_constants, sizeof(pg->vsh_constants)) ^
+           fast_hash((void *)pg->vertex_state_shader_v0,
+                     sizeof(pg->vertex_state_shader_v0));
+}
+
 DEF_METHOD(NV097, LAUNCH_TRANSFORM_PROGRAM)
 {
     unsigned int program_start = parameter;
     assert(program_start < NV2A_MAX_TRANSFORM_PROGRAM_LENGTH);
-    Nv2aVshProgram program;
-    Nv2aVshParseResult result = nv2a_vsh_parse_program(
-            &program,
-            pg->program_data[program_start],
-            NV2A_MAX_TRANSFORM_PROGRAM_LENGTH - program_start);
-    assert(result == NV2AVPR_SUCCESS);
+    VshProgramCacheEntry *entry = get_transform_program(pg, program_start);
+
+    /*
+     * The program only depends on its inputs and the constants. If the last
+     * run left them as they are now, and did not change them itself, running
+     * it again would not either.
+     */
+    uint64_t io_hash = get_transform_program_io_hash(pg);
+    if (entry->has_result && entry->result_hash == io_hash) {
+        return;
+    }
 
     Nv2aVshCPUXVSSExecutionState state_linkage;
     Nv2aVshExecutionState state = nv2a_vsh_emu_initialize_xss_execution_state(
             &state_linkage, (float*)pg->vsh_constants);
     memcpy(state_linkage.input_regs, pg->vertex_state_shader_v0, sizeof(pg->vertex_state_shader_v0));
 
-    nv2a_vsh_emu_execute_track_context_writes(&state, &program, pg->vsh_constants_dirty);
+    nv2a_vsh_emu_execute_track_context_writes(&state, &entry->program, pg->vsh_constants_dirty);
+    // Any constant may have been written, have renderers pick them all up
+    pgraph_mark_vsh_constants_dirty(pg, 0, NV2A_VERTEXSHADER_CONSTANTS);
 
-    nv2a_vsh_program_destroy(&program);
+    entry->has_result = get_transform_program_io_hash(pg) == io_hash;
+    entry->result_hash = io_hash;
 }
 
 DEF_METHOD(NV097, SET_TRANSFORM_EXECUTION_MODE)
@@ -3241,17 +3647,19 @@ void pgraph_get_clear_depth_stencil_value(PGRAPHState *pg, float *depth,
     }
 }
 
-void pgraph_write_zpass_pixel_cnt_report(NV2AState *d, uint32_t parameter,
-                                         uint32_t result)
+/*
+ * Write a report through dma_report, the report DMA object that was bound
+ * when the report was requested.
+ */
+void pgraph_write_zpass_pixel_cnt_report(NV2AState *d, uint32_t dma_report,
+                                         uint32_t parameter, uint32_t result)
 {
-    PGRAPHState *pg = &d->pgraph;
-
     uint64_t timestamp = 0x0011223344556677; /* FIXME: Update timestamp?! */
     uint32_t done = 0; // FIXME: Check
 
     hwaddr report_dma_len;
     uint8_t *report_data =
-        (uint8_t *)nv_dma_map(d, pg->dma_report, &report_dma_len);
+        (uint8_t *)nv_dma_map(d, dma_report, &report_dma_len);
 
     hwaddr offset = GET_MASK(parameter, NV097_GET_REPORT_OFFSET);
     assert(offset < report_dma_len);
@@ -3343,6 +3751,16 @@ void pgraph_pre_savevm_wait(NV2AState *d)
     pg->renderer->ops.pre_savevm_wait(d);
 }
 
+void pgraph_report_stats(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    nv2a_profile_report_method_costs();
+    if (pg->renderer->ops.report_stats) {
+        pg->renderer->ops.report_stats(d);
+    }
+}
+
 void pgraph_pre_shutdown_trigger(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -33,6 +33,7 @@
 #include "texture.h"
 #include "util.h"
 #include "vsh_regs.h"
+#include "nv2a_vsh_emulator.h"
 
 typedef struct NV2AState NV2AState;
 typedef struct PGRAPHNullState PGRAPHNullState;
@@ -96,11 +97,39 @@ typedef struct BetaState {
   uint32_t beta;
 } BetaState;
 
+#define VSH_PROGRAM_CACHE_SIZE 16
+
+/*
+ * Frame skipping, stepped between none and the configured maximum to keep the
+ * frame time near the target, see pgraph_update_frame_skip.
+ */
+typedef struct FrameSkipState {
+    float frame_time_avg; // ms, of all frames
+    float rendered_time_avg; // ms, of the frames that were not skipped
+    int frames_since_change;
+    unsigned int level; // Frames skipped after each rendered one
+    unsigned int skipped; // In a row before the current frame
+    bool active; // Current frame is skipped
+} FrameSkipState;
+
+// A transform program parsed for CPU execution
+typedef struct VshProgramCacheEntry {
+    bool valid;
+    unsigned int start;
+    uint64_t hash; // Program memory from the start slot onwards
+    Nv2aVshProgram program;
+    // Inputs and constants after an execution which did not change them
+    bool has_result;
+    uint64_t result_hash;
+} VshProgramCacheEntry;
+
 typedef struct PGRAPHRenderer {
     CONFIG_DISPLAY_RENDERER type;
     const char *name;
     struct {
         void (*early_context_init)(void);
+        // Start work init() depends on, while the machine is being created
+        void (*prewarm)(void);
         void (*init)(NV2AState *d, Error **errp);
         void (*finalize)(NV2AState *d);
         void (*clear_report_value)(NV2AState *d);
@@ -117,11 +146,20 @@ typedef struct PGRAPHRenderer {
         void (*pre_shutdown_wait)(NV2AState *d);
         void (*process_pending)(NV2AState *d);
         void (*process_pending_reports)(NV2AState *d);
+        void (*report_stats)(NV2AState *d);
         void (*surface_flush)(NV2AState *d);
         void (*surface_update)(NV2AState *d, bool upload, bool color_write, bool zeta_write);
         void (*set_surface_scale_factor)(NV2AState *d, unsigned int scale);
         unsigned int (*get_surface_scale_factor)(NV2AState *d);
         int (*get_framebuffer_surface)(NV2AState *d);
+        bool (*present_frame)(NV2AState *d, const NV2APresentRequest *req);
+        void (*present_surface_lost)(NV2AState *d);
+        void (*release_caches)(NV2AState *d, bool all);
+        bool (*get_memory_stats)(NV2AState *d, NV2AMemoryStats *stats);
+        // Called at each flip. While skipping, draws whose only effect is
+        // on what gets displayed may be dropped. Renderers without it render
+        // every frame.
+        void (*set_frame_skip)(NV2AState *d, bool skip);
     } ops;
 } PGRAPHRenderer;
 
@@ -178,9 +216,14 @@ typedef struct PGRAPHState {
     uint32_t vertex_state_shader_v0[4];
     uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
     bool program_data_dirty;
+    VshProgramCacheEntry vsh_program_cache[VSH_PROGRAM_CACHE_SIZE];
+    unsigned int vsh_program_cache_next;
 
     uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4];
     bool vsh_constants_dirty[NV2A_VERTEXSHADER_CONSTANTS];
+    /* Lets renderers upload only rows changed since they last looked */
+    uint64_t vsh_constants_gen;
+    uint64_t vsh_constants_row_gen[NV2A_VERTEXSHADER_CONSTANTS];
 
     /* lighting constant arrays */
     uint32_t ltctxa[NV2A_LTCTXA_COUNT][4];
@@ -209,6 +252,9 @@ typedef struct PGRAPHState {
     uint16_t compressed_attrs;
     uint16_t uniform_attrs;
     uint16_t swizzle_attrs;
+    uint16_t raw_attrs; // Fetched as integers, decoded in the vertex shader
+    uint8_t raw_attr_formats[NV2A_VERTEXSHADER_ATTRIBUTES];
+    uint8_t raw_attr_counts[NV2A_VERTEXSHADER_ATTRIBUTES];
 
     unsigned int inline_array_length;
     uint32_t inline_array[NV2A_MAX_BATCH_LENGTH];
@@ -230,12 +276,19 @@ typedef struct PGRAPHState {
     uint32_t regs_[0x2000];
     DECLARE_BITMAP(regs_dirty, 0x2000 / sizeof(uint32_t));
 
+    // Subchannel whose CTX_CACHE* are loaded into CTX_SWITCH*, or -1
+    int ctx_switch_subchannel;
+
     bool clearing; // FIXME: Internal
     bool waiting_for_nop;
     bool waiting_for_flip;
     bool waiting_for_context_switch;
 
+    FrameSkipState frame_skip;
+
     bool flush_pending;
+    // Guest RAM was replaced, GPU copies are dropped instead of written back
+    bool flush_discard;
     QemuEvent flush_complete;
 
     bool sync_pending;
@@ -251,6 +304,10 @@ typedef struct PGRAPHState {
     } renderer_switch_phase;
     QemuEvent renderer_switch_complete;
 
+    /* FIFO thread copy of the NV2A and NV2A_TEX VRAM dirty bitmaps */
+    unsigned long *vram_dirty[2];
+    unsigned long vram_dirty_pages;
+
     unsigned int surface_scale_factor;
     uint8_t *scale_buf;
 
@@ -268,6 +325,7 @@ void pgraph_destroy(PGRAPHState *pg);
 void pgraph_context_switch(NV2AState *d, unsigned int channel_id);
 void pgraph_process_pending(NV2AState *d);
 void pgraph_process_pending_reports(NV2AState *d);
+void pgraph_report_stats(NV2AState *d);
 void pgraph_pre_savevm_trigger(NV2AState *d);
 void pgraph_pre_savevm_wait(NV2AState *d);
 void pgraph_pre_shutdown_trigger(NV2AState *d);
@@ -277,8 +335,23 @@ int pgraph_method(NV2AState *d, unsigned int subchannel, unsigned int method,
                   uint32_t parameter, uint32_t *parameters,
                   size_t num_words_available, size_t max_lookahead_words,
                   bool inc);
+bool pgraph_method_should_stall(NV2AState *d);
+void pgraph_increment_read_3d(PGRAPHState *pg);
 void pgraph_check_within_begin_end_block(PGRAPHState *pg);
 
+void pgraph_vram_dirty_init(NV2AState *d);
+void pgraph_vram_dirty_finalize(PGRAPHState *pg);
+void pgraph_vram_dirty_sync(NV2AState *d);
+bool pgraph_vram_get_dirty(NV2AState *d, hwaddr addr, hwaddr size,
+                           unsigned int client);
+bool pgraph_vram_test_and_clear_dirty(NV2AState *d, hwaddr addr, hwaddr size,
+                                      unsigned int client);
+void pgraph_vram_set_dirty(NV2AState *d, hwaddr addr, hwaddr size,
+                           unsigned int client);
+
+void pgraph_merge_shader_cache_list(GByteArray *list, const char *path,
+                                    unsigned int max_entries);
+
 void *pfifo_thread(void *arg);
 void pfifo_kick(NV2AState *d);
 
@@ -307,6 +380,18 @@ static inline void pgraph_reg_w(PGRAPHState *pg, unsigned int r, uint32_t v)
 
 void pgraph_clear_dirty_reg_map(PGRAPHState *pg);
 
+static inline void pgraph_mark_vsh_constants_dirty(PGRAPHState *pg,
+                                                   unsigned int row,
+                                                   unsigned int count)
+{
+    assert(row + count <= NV2A_VERTEXSHADER_CONSTANTS);
+    uint64_t gen = ++pg->vsh_constants_gen;
+    for (unsigned int i = row; i < row + count; i++) {
+        pg->vsh_constants_dirty[i] = true;
+        pg->vsh_constants_row_gen[i] = gen;
+    }
+}
+
 static inline bool pgraph_is_reg_dirty(PGRAPHState *pg, unsigned int reg)
 {
     return test_bit(reg / sizeof(uint32_t), pg->regs_dirty);
@@ -404,6 +489,7 @@ static inline void pgraph_argb_pack32_to_rgba_float(uint32_t argb, float *rgba)
     rgba[3] = ((argb >> 24) & 0xFF) / 255.0f; /* alpha */
 }
 
-void pgraph_write_zpass_pixel_cnt_report(NV2AState *d, uint32_t parameter, uint32_t result);
+void pgraph_write_zpass_pixel_cnt_report(NV2AState *d, uint32_t dma_report,
+                                         uint32_t parameter, uint32_t result);
 
 #endif
@@ -21,12 +21,32 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "hw/xbox/nv2a/debug.h"
 #include "prim_rewrite.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PRIM_REWRITE_ACCEL_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define PRIM_REWRITE_ACCEL_NEON
+#endif
+
+#ifdef PRIM_REWRITE_DISABLE_ACCEL
+#undef PRIM_REWRITE_ACCEL_X86
+#undef PRIM_REWRITE_ACCEL_NEON
+#endif
+
+/* Smaller rewrites are cheaper to redo than to look up in the cache */
+#define PRIM_REWRITE_CACHE_MIN_OUTPUT 384
+
 void pgraph_prim_rewrite_init(PrimRewriteBuf *buf)
 {
     buf->data = NULL;
     buf->capacity = 0;
+    memset(buf->cache, 0, sizeof(buf->cache));
+    buf->cache_next = 0;
 }
 
 void pgraph_prim_rewrite_finalize(PrimRewriteBuf *buf)
@@ -34,6 +54,12 @@ void pgraph_prim_rewrite_finalize(PrimRewriteBuf *buf)
     g_free(buf->data);
     buf->data = NULL;
     buf->capacity = 0;
+
+    for (int i = 0; i < PRIM_REWRITE_CACHE_SIZE; i++) {
+        g_free(buf->cache[i].indices);
+    }
+    memset(buf->cache, 0, sizeof(buf->cache));
+    buf->cache_next = 0;
 }
 
 static void ensure_capacity(PrimRewriteBuf *buf, unsigned int needed)
@@ -386,9 +412,10 @@ static void rewrite_polygon_line(PrimRewrite *r, const uint32_t *idx,
     emit_line(r, idx_at(idx, count - 1, base), idx_at(idx, 0, base));
 }
 
-static void rewrite_indices(PrimRewrite *r, const PrimAssemblyState *mode,
-                            const uint32_t *idx, uint32_t base,
-                            unsigned int num_indices)
+static void rewrite_indices_scalar(PrimRewrite *r,
+                                   const PrimAssemblyState *mode,
+                                   const uint32_t *idx, uint32_t base,
+                                   unsigned int num_indices)
 {
     switch (mode->primitive_mode) {
     case PRIM_TYPE_LINES:
@@ -436,6 +463,343 @@ static void rewrite_indices(PrimRewrite *r, const PrimAssemblyState *mode,
     }
 }
 
+/*
+ * Most rewrites emit the same pattern of indices for every few primitives,
+ * offset by a fixed number of input vertices. For those, whole periods of
+ * the pattern are emitted at once: added to the base vertex for sequential
+ * input, or gathered from the input indices.
+ */
+#define PATTERN_LEN 12
+#define PATTERN_MAX_GATHER_WINDOW 8
+
+typedef struct RewritePattern {
+    uint32_t offsets[PATTERN_LEN];
+    uint8_t gather[PATTERN_LEN * 4]; /* byte offsets into the input window */
+    unsigned int step; /* input vertices consumed per period */
+    unsigned int window; /* input vertices read per period */
+} RewritePattern;
+
+static bool get_rewrite_pattern(const PrimAssemblyState *mode,
+                                RewritePattern *p)
+{
+    switch (mode->primitive_mode) {
+    case PRIM_TYPE_LINES:
+    case PRIM_TYPE_TRIANGLES:
+        p->step = 12;
+        p->window = 12;
+        break;
+    case PRIM_TYPE_LINE_STRIP:
+        p->step = 6;
+        p->window = 7;
+        break;
+    case PRIM_TYPE_TRIANGLE_STRIP:
+        p->step = 4;
+        p->window = 6;
+        break;
+    case PRIM_TYPE_QUADS:
+        if (mode->polygon_mode == POLY_MODE_LINE) {
+            return false;
+        }
+        p->step = 8;
+        p->window = 8;
+        break;
+    case PRIM_TYPE_QUAD_STRIP:
+        if (mode->polygon_mode == POLY_MODE_LINE) {
+            return false;
+        }
+        p->step = 4;
+        p->window = 6;
+        break;
+    default:
+        return false;
+    }
+
+    /* Let the scalar rewrite define the pattern so the two can't disagree */
+    PrimRewrite r = { .indices = p->offsets, .num_indices = 0 };
+    rewrite_indices_scalar(&r, mode, NULL, 0, p->window);
+    assert(r.num_indices == PATTERN_LEN);
+
+    for (int i = 0; i < PATTERN_LEN; i++) {
+        for (int b = 0; b < 4; b++) {
+            p->gather[i * 4 + b] = p->offsets[i] * 4 + b;
+        }
+    }
+
+    return true;
+}
+
+typedef void (*EmitSequentialFunc)(uint32_t *out, const RewritePattern *p,
+                                   uint32_t base, unsigned int periods);
+typedef unsigned int (*EmitIndexedFunc)(uint32_t *out, const RewritePattern *p,
+                                        const uint32_t *idx,
+                                        unsigned int count,
+                                        unsigned int periods);
+
+static void emit_pattern_sequential_scalar(uint32_t *out,
+                                           const RewritePattern *p,
+                                           uint32_t base, unsigned int periods)
+{
+    for (unsigned int k = 0; k < periods; k++) {
+        for (int i = 0; i < PATTERN_LEN; i++) {
+            out[i] = base + p->offsets[i];
+        }
+        out += PATTERN_LEN;
+        base += p->step;
+    }
+}
+
+static unsigned int emit_pattern_indexed_scalar(uint32_t *out,
+                                                const RewritePattern *p,
+                                                const uint32_t *idx,
+                                                unsigned int count,
+                                                unsigned int periods)
+{
+    for (unsigned int k = 0; k < periods; k++) {
+        for (int i = 0; i < PATTERN_LEN; i++) {
+            out[i] = idx[p->offsets[i]];
+        }
+        out += PATTERN_LEN;
+        idx += p->step;
+    }
+
+    return periods;
+}
+
+#ifdef PRIM_REWRITE_ACCEL_X86
+
+#define TARGET_SSSE3 __attribute__((target("ssse3")))
+
+static TARGET_SSSE3 void emit_pattern_sequential_ssse3(uint32_t *out,
+                                                       const RewritePattern *p,
+                                                       uint32_t base,
+                                                       unsigned int periods)
+{
+    const __m128i o0 = _mm_loadu_si128((const __m128i *)&p->offsets[0]);
+    const __m128i o1 = _mm_loadu_si128((const __m128i *)&p->offsets[4]);
+    const __m128i o2 = _mm_loadu_si128((const __m128i *)&p->offsets[8]);
+    const __m128i step = _mm_set1_epi32(p->step);
+    __m128i b = _mm_set1_epi32(base);
+
+    for (unsigned int k = 0; k < periods; k++) {
+        _mm_storeu_si128((__m128i *)&out[0], _mm_add_epi32(o0, b));
+        _mm_storeu_si128((__m128i *)&out[4], _mm_add_epi32(o1, b));
+        _mm_storeu_si128((__m128i *)&out[8], _mm_add_epi32(o2, b));
+        out += PATTERN_LEN;
+        b = _mm_add_epi32(b, step);
+    }
+}
+
+/*
+ * Gathers from an 8 index window with two byte shuffles per output vector,
+ * one for each half of the window. Returns the number of periods emitted,
+ * stopping early where the window would read past the end of the input.
+ */
+static TARGET_SSSE3 unsigned int
+emit_pattern_indexed_ssse3(uint32_t *out, const RewritePattern *p,
+                           const uint32_t *idx, unsigned int count,
+                           unsigned int periods)
+{
+    const __m128i zero_lane = _mm_set1_epi8((char)0x80);
+    __m128i lo[3], hi[3];
+
+    for (int v = 0; v < 3; v++) {
+        __m128i sel = _mm_loadu_si128((const __m128i *)&p->gather[v * 16]);
+        __m128i in_hi = _mm_cmpgt_epi8(sel, _mm_set1_epi8(15));
+        lo[v] = _mm_or_si128(sel, _mm_and_si128(in_hi, zero_lane));
+        hi[v] = _mm_or_si128(sel, _mm_andnot_si128(in_hi, zero_lane));
+    }
+
+    unsigned int k;
+    for (k = 0; k < periods &&
+                k * p->step + PATTERN_MAX_GATHER_WINDOW <= count;
+         k++) {
+        const uint32_t *in = idx + k * p->step;
+        __m128i a = _mm_loadu_si128((const __m128i *)&in[0]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&in[4]);
+
+        for (int v = 0; v < 3; v++) {
+            __m128i r = _mm_or_si128(_mm_shuffle_epi8(a, lo[v]),
+                                     _mm_shuffle_epi8(b, hi[v]));
+            _mm_storeu_si128((__m128i *)&out[v * 4], r);
+        }
+        out += PATTERN_LEN;
+    }
+
+    return k;
+}
+
+#endif
+
+#ifdef PRIM_REWRITE_ACCEL_NEON
+
+static void emit_pattern_sequential_neon(uint32_t *out,
+                                         const RewritePattern *p,
+                                         uint32_t base, unsigned int periods)
+{
+    const uint32x4_t o0 = vld1q_u32(&p->offsets[0]);
+    const uint32x4_t o1 = vld1q_u32(&p->offsets[4]);
+    const uint32x4_t o2 = vld1q_u32(&p->offsets[8]);
+    const uint32x4_t step = vdupq_n_u32(p->step);
+    uint32x4_t b = vdupq_n_u32(base);
+
+    for (unsigned int k = 0; k < periods; k++) {
+        vst1q_u32(&out[0], vaddq_u32(o0, b));
+        vst1q_u32(&out[4], vaddq_u32(o1, b));
+        vst1q_u32(&out[8], vaddq_u32(o2, b));
+        out += PATTERN_LEN;
+        b = vaddq_u32(b, step);
+    }
+}
+
+static unsigned int emit_pattern_indexed_neon(uint32_t *out,
+                                              const RewritePattern *p,
+                                              const uint32_t *idx,
+                                              unsigned int count,
+                                              unsigned int periods)
+{
+    uint8x16_t sel[3];
+    for (int v = 0; v < 3; v++) {
+        sel[v] = vld1q_u8(&p->gather[v * 16]);
+    }
+
+    unsigned int k;
+    for (k = 0; k < periods &&
+                k * p->step + PATTERN_MAX_GATHER_WINDOW <= count;
+         k++) {
+        const uint32_t *in = idx + k * p->step;
+        uint8x16x2_t window = { { vld1q_u8((const uint8_t *)&in[0]),
+                                  vld1q_u8((const uint8_t *)&in[4]) } };
+
+        for (int v = 0; v < 3; v++) {
+            vst1q_u8((uint8_t *)&out[v * 4], vqtbl2q_u8(window, sel[v]));
+        }
+        out += PATTERN_LEN;
+    }
+
+    return k;
+}
+
+#endif
+
+static EmitSequentialFunc emit_pattern_sequential =
+    emit_pattern_sequential_scalar;
+static EmitIndexedFunc emit_pattern_indexed = emit_pattern_indexed_scalar;
+
+static void __attribute__((constructor)) init_prim_rewrite_accel(void)
+{
+#ifdef PRIM_REWRITE_ACCEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3")) {
+        emit_pattern_sequential = emit_pattern_sequential_ssse3;
+        emit_pattern_indexed = emit_pattern_indexed_ssse3;
+    }
+#endif
+#ifdef PRIM_REWRITE_ACCEL_NEON
+    /* Advanced SIMD is mandatory on AArch64 */
+    emit_pattern_sequential = emit_pattern_sequential_neon;
+    emit_pattern_indexed = emit_pattern_indexed_neon;
+#endif
+}
+
+static void rewrite_indices(PrimRewrite *r, const PrimAssemblyState *mode,
+                            const RewritePattern *pattern,
+                            const uint32_t *idx, uint32_t base,
+                            unsigned int num_indices)
+{
+    if (pattern && num_indices >= pattern->window &&
+        (!idx || pattern->window <= PATTERN_MAX_GATHER_WINDOW)) {
+        unsigned int periods =
+            (num_indices - (pattern->window - pattern->step)) / pattern->step;
+        unsigned int consumed = periods * pattern->step;
+        uint32_t *out = r->indices + r->num_indices;
+
+        if (idx) {
+            unsigned int done =
+                emit_pattern_indexed(out, pattern, idx, num_indices, periods);
+            emit_pattern_indexed_scalar(out + done * PATTERN_LEN, pattern,
+                                        idx + done * pattern->step,
+                                        num_indices - done * pattern->step,
+                                        periods - done);
+            idx += consumed;
+        } else {
+            emit_pattern_sequential(out, pattern, base, periods);
+        }
+
+        r->num_indices += periods * PATTERN_LEN;
+        base += consumed;
+        num_indices -= consumed;
+    }
+
+    rewrite_indices_scalar(r, mode, idx, base, num_indices);
+}
+
+static bool assembly_state_equal(const PrimAssemblyState *a,
+                                 const PrimAssemblyState *b)
+{
+    return a->primitive_mode == b->primitive_mode &&
+           a->polygon_mode == b->polygon_mode &&
+           a->last_provoking == b->last_provoking &&
+           a->flat_shading == b->flat_shading;
+}
+
+/*
+ * Find an earlier rewrite of the same input. Inputs are only stored once
+ * they have been seen twice, so geometry drawn just once costs no more than
+ * the hash.
+ */
+static PrimRewriteCacheEntry *find_cache_entry(PrimRewriteBuf *buf,
+                                               const PrimAssemblyState *mode,
+                                               bool indexed, uint64_t hash,
+                                               unsigned int num_input)
+{
+    for (int i = 0; i < PRIM_REWRITE_CACHE_SIZE; i++) {
+        PrimRewriteCacheEntry *e = &buf->cache[i];
+        if (e->hash == hash && e->num_input == num_input &&
+            e->indexed == indexed && assembly_state_equal(&e->mode, mode)) {
+            return e;
+        }
+    }
+
+    PrimRewriteCacheEntry *e = &buf->cache[buf->cache_next];
+    buf->cache_next = (buf->cache_next + 1) % PRIM_REWRITE_CACHE_SIZE;
+
+    g_free(e->indices);
+    e->hash = hash;
+    e->num_input = num_input;
+    e->indexed = indexed;
+    e->mode = *mode;
+    e->indices = NULL;
+    e->num_indices = 0;
+
+    return NULL;
+}
+
+static bool lookup_cached_rewrite(PrimRewriteCacheEntry *e,
+                                  PrimRewrite *result)
+{
+    if (!e || !e->indices) {
+        nv2a_profile_inc_counter(NV2A_PROF_PRIM_REWRITE_CACHE_MISS);
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_PRIM_REWRITE_CACHE_HIT);
+    result->indices = e->indices;
+    result->num_indices = e->num_indices;
+    return true;
+}
+
+static void store_cached_rewrite(PrimRewriteCacheEntry *e,
+                                 const PrimRewrite *result)
+{
+    if (!e) {
+        return;
+    }
+
+    e->indices =
+        g_memdup2(result->indices, result->num_indices * sizeof(uint32_t));
+    e->num_indices = result->num_indices;
+}
+
 PrimRewrite pgraph_prim_rewrite_ranges(PrimRewriteBuf *buf,
                                        PrimAssemblyState mode,
                                        const int32_t *starts,
@@ -461,17 +825,35 @@ PrimRewrite pgraph_prim_rewrite_ranges(PrimRewriteBuf *buf,
         return result;
     }
 
+    PrimRewriteCacheEntry *entry = NULL;
+    if (total_max_output >= PRIM_REWRITE_CACHE_MIN_OUTPUT) {
+        size_t size = num_ranges * sizeof(int32_t);
+        uint64_t hash = fast_hash((const uint8_t *)starts, size) ^
+                        (fast_hash((const uint8_t *)counts, size) *
+                         0x9e3779b97f4a7c15ULL);
+        entry = find_cache_entry(buf, &mode, false, hash, num_ranges);
+        if (lookup_cached_rewrite(entry, &result)) {
+            return result;
+        }
+    }
+
     ensure_capacity(buf, total_max_output);
     result.indices = buf->data;
 
+    RewritePattern pattern;
+    bool has_pattern = get_rewrite_pattern(&mode, &pattern);
+
     for (unsigned int r = 0; r < num_ranges; r++) {
         if (counts[r] == 0) {
             continue;
         }
 
-        rewrite_indices(&result, &mode, NULL, starts[r], counts[r]);
+        rewrite_indices(&result, &mode, has_pattern ? &pattern : NULL, NULL,
+                        starts[r], counts[r]);
     }
 
+    store_cached_rewrite(entry, &result);
+
     return result;
 }
 
@@ -496,10 +878,26 @@ PrimRewrite pgraph_prim_rewrite_indexed(PrimRewriteBuf *buf,
         return result;
     }
 
+    PrimRewriteCacheEntry *entry = NULL;
+    if (max_output >= PRIM_REWRITE_CACHE_MIN_OUTPUT) {
+        uint64_t hash = fast_hash((const uint8_t *)input_indices,
+                                  num_input_indices * sizeof(uint32_t));
+        entry = find_cache_entry(buf, &mode, true, hash, num_input_indices);
+        if (lookup_cached_rewrite(entry, &result)) {
+            return result;
+        }
+    }
+
     ensure_capacity(buf, max_output);
     result.indices = buf->data;
 
-    rewrite_indices(&result, &mode, input_indices, 0, num_input_indices);
+    RewritePattern pattern;
+    bool has_pattern = get_rewrite_pattern(&mode, &pattern);
+
+    rewrite_indices(&result, &mode, has_pattern ? &pattern : NULL,
+                    input_indices, 0, num_input_indices);
+
+    store_cached_rewrite(entry, &result);
 
     return result;
 }
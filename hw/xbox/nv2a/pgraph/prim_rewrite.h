@@ -27,9 +27,29 @@
 #include <stdint.h>
 #include "vsh_regs.h"
 
+typedef struct PrimAssemblyState {
+    enum ShaderPrimitiveMode primitive_mode;
+    enum ShaderPolygonMode polygon_mode;
+    bool last_provoking;
+    bool flat_shading;
+} PrimAssemblyState;
+
+#define PRIM_REWRITE_CACHE_SIZE 16
+
+typedef struct PrimRewriteCacheEntry {
+    uint64_t hash; /* of the input indices or ranges */
+    unsigned int num_input;
+    bool indexed;
+    PrimAssemblyState mode;
+    uint32_t *indices; /* NULL until the input has been seen twice */
+    unsigned int num_indices;
+} PrimRewriteCacheEntry;
+
 typedef struct PrimRewriteBuf {
     uint32_t *data;
     unsigned int capacity; /* in elements */
+    PrimRewriteCacheEntry cache[PRIM_REWRITE_CACHE_SIZE];
+    unsigned int cache_next;
 } PrimRewriteBuf;
 
 typedef struct PrimRewrite {
@@ -37,13 +57,6 @@ typedef struct PrimRewrite {
     unsigned int num_indices;
 } PrimRewrite;
 
-typedef struct PrimAssemblyState {
-    enum ShaderPrimitiveMode primitive_mode;
-    enum ShaderPolygonMode polygon_mode;
-    bool last_provoking;
-    bool flat_shading;
-} PrimAssemblyState;
-
 void pgraph_prim_rewrite_init(PrimRewriteBuf *buf);
 void pgraph_prim_rewrite_finalize(PrimRewriteBuf *buf);
 enum ShaderPrimitiveMode
@@ -18,6 +18,9 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#ifdef __ANDROID__
+#include "ui/xemu-android-perf.h"
+#endif
 
 NV2AStats g_nv2a_stats;
 
@@ -44,7 +47,19 @@ void nv2a_profile_flip_stall(void)
     int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t render_time = (now-g_nv2a_stats.last_flip_time)/1000;
 
+#ifdef __ANDROID__
+    xemu_android_perf_report_frame((now-g_nv2a_stats.last_flip_time)*1000);
+#endif
+
     g_nv2a_stats.frame_working.mspf = render_time;
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        if (g_nv2a_stats.frame_working.counters[i]) {
+            qatomic_set(&g_nv2a_stats.counter_totals[i],
+                        g_nv2a_stats.counter_totals[i] +
+                            g_nv2a_stats.frame_working.counters[i]);
+        }
+    }
+    qatomic_set(&g_nv2a_stats.total_frames, g_nv2a_stats.total_frames + 1);
     g_nv2a_stats.frame_history[g_nv2a_stats.frame_ptr] =
         g_nv2a_stats.frame_working;
     g_nv2a_stats.frame_ptr =
@@ -72,3 +87,231 @@ int nv2a_profile_get_counter_value(unsigned int cnt)
                        NV2A_PROF_NUM_FRAMES;
     return g_nv2a_stats.frame_history[idx].counters[cnt];
 }
+
+uint64_t nv2a_profile_get_counter_total(unsigned int cnt)
+{
+    assert(cnt < NV2A_PROF__COUNT);
+    return qatomic_read(&g_nv2a_stats.counter_totals[cnt]);
+}
+
+const char *nv2a_profile_get_gpu_timer_name(unsigned int timer)
+{
+    const char *default_names[NV2A_PROF_GPU__COUNT] = {
+        #define _X(x) stringify(x),
+        NV2A_PROF_GPU_TIMERS_XMAC
+        #undef _X
+    };
+
+    assert(timer < NV2A_PROF_GPU__COUNT);
+    return default_names[timer] + 14; /* 'NV2A_PROF_GPU_' */
+}
+
+/*
+ * GPU times are resolved after the work completes, which can be after the
+ * following flip. Report those of the frame before the last one.
+ */
+static unsigned int get_resolved_frame_index(void)
+{
+    return (g_nv2a_stats.frame_ptr + NV2A_PROF_NUM_FRAMES - 2) %
+           NV2A_PROF_NUM_FRAMES;
+}
+
+float nv2a_profile_get_gpu_time(unsigned int timer)
+{
+    assert(timer < NV2A_PROF_GPU__COUNT);
+    return g_nv2a_stats.frame_history[get_resolved_frame_index()].gpu_ms[timer];
+}
+
+float nv2a_profile_get_gpu_total_time(void)
+{
+    return g_nv2a_stats.frame_history[get_resolved_frame_index()].gpu_total_ms;
+}
+
+/*
+ * Add GPU time to the frame which was being emulated when the work was
+ * recorded, as counted by frame_count.
+ */
+void nv2a_profile_add_gpu_time(unsigned int frame,
+                               enum NV2A_PROF_GPU_TIMERS_ENUM timer, float ms)
+{
+    unsigned int age = g_nv2a_stats.frame_count - frame;
+    if (age >= NV2A_PROF_NUM_FRAMES) {
+        return;
+    }
+
+    typeof(g_nv2a_stats.frame_working) *entry =
+        age ? &g_nv2a_stats.frame_history[(g_nv2a_stats.frame_ptr +
+                                           NV2A_PROF_NUM_FRAMES - age) %
+                                          NV2A_PROF_NUM_FRAMES] :
+              &g_nv2a_stats.frame_working;
+    entry->gpu_ms[timer] += ms;
+    if (timer != NV2A_PROF_GPU_COMPUTE) {
+        entry->gpu_total_ms += ms;
+    }
+}
+
+/*
+ * Returns the time a sampled method call started, or 0 if the call is only
+ * counted. Timing every call costs about as much as many cheap handlers.
+ */
+int64_t nv2a_profile_method_start(void)
+{
+    unsigned int interval = MAX(g_nv2a_stats.method_cost_sample_interval, 1);
+    if (++g_nv2a_stats.method_cost_sample_count < interval) {
+        return 0;
+    }
+
+    g_nv2a_stats.method_cost_sample_count = 0;
+    return get_clock();
+}
+
+static NV2AMethodCost *get_method_costs(uint32_t graphics_class)
+{
+    for (int i = 0; i < NV2A_PROF_NUM_METHOD_CLASSES; i++) {
+        if (g_nv2a_stats.method_cost_classes[i] == graphics_class) {
+            return g_nv2a_stats.method_costs[i];
+        }
+        if (!g_nv2a_stats.method_cost_classes[i]) {
+            g_nv2a_stats.method_cost_classes[i] = graphics_class;
+            return g_nv2a_stats.method_costs[i];
+        }
+    }
+
+    return NULL;
+}
+
+void nv2a_profile_method_cost(uint32_t graphics_class, unsigned int method,
+                              size_t num_words, int64_t start)
+{
+    NV2AMethodCost *costs = get_method_costs(graphics_class);
+    if (!costs) {
+        return;
+    }
+
+    NV2AMethodCost *cost = &costs[(method >> 2) % NV2A_PROF_NUM_METHODS];
+    cost->calls += 1;
+    cost->words += num_words;
+    if (start) {
+        cost->sampled_calls += 1;
+        cost->ns += get_clock() - start;
+    }
+}
+
+static gint compare_method_costs(gconstpointer a, gconstpointer b)
+{
+    const NV2AMethodCostEntry *ea = a;
+    const NV2AMethodCostEntry *eb = b;
+    return ea->ns < eb->ns ? 1 : ea->ns > eb->ns ? -1 : 0;
+}
+
+/*
+ * Get the costs of the most expensive methods since the last reset, most
+ * expensive first. Times of unsampled calls are estimated from the sampled
+ * calls of the same method.
+ */
+size_t nv2a_profile_get_method_costs(NV2AMethodCostEntry *entries,
+                                     size_t max_entries, uint64_t *total_ns)
+{
+    g_autoptr(GArray) all =
+        g_array_new(false, false, sizeof(NV2AMethodCostEntry));
+    uint64_t total = 0;
+
+    for (int c = 0; c < NV2A_PROF_NUM_METHOD_CLASSES; c++) {
+        if (!g_nv2a_stats.method_cost_classes[c]) {
+            break;
+        }
+        for (int i = 0; i < NV2A_PROF_NUM_METHODS; i++) {
+            NV2AMethodCost cost = g_nv2a_stats.method_costs[c][i];
+            if (!cost.calls) {
+                continue;
+            }
+            NV2AMethodCostEntry entry = {
+                .graphics_class = g_nv2a_stats.method_cost_classes[c],
+                .method = i << 2,
+                .calls = cost.calls,
+                .words = cost.words,
+                .ns = cost.sampled_calls ?
+                          cost.ns * cost.calls / cost.sampled_calls : 0,
+            };
+            g_array_append_val(all, entry);
+            total += entry.ns;
+        }
+    }
+    g_array_sort(all, compare_method_costs);
+
+    size_t num_entries = MIN(all->len, max_entries);
+    memcpy(entries, all->data, num_entries * sizeof(NV2AMethodCostEntry));
+    if (total_ns) {
+        *total_ns = total;
+    }
+
+    return num_entries;
+}
+
+void nv2a_profile_reset_method_costs(void)
+{
+    memset(g_nv2a_stats.method_cost_classes, 0,
+           sizeof(g_nv2a_stats.method_cost_classes));
+    memset(g_nv2a_stats.method_costs, 0, sizeof(g_nv2a_stats.method_costs));
+}
+
+bool nv2a_profile_save_method_costs(const char *path)
+{
+    size_t max_entries = NV2A_PROF_NUM_METHOD_CLASSES * NV2A_PROF_NUM_METHODS;
+    g_autofree NV2AMethodCostEntry *entries =
+        g_new(NV2AMethodCostEntry, max_entries);
+    size_t num_entries =
+        nv2a_profile_get_method_costs(entries, max_entries, NULL);
+
+    g_autoptr(GString) csv =
+        g_string_new("class,method,name,calls,words,ns\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        const char *name = pgraph_get_method_name(entries[i].graphics_class,
+                                                  entries[i].method);
+        g_string_append_printf(csv,
+                               "0x%02x,0x%04x,%s,%" PRIu64 ",%" PRIu64
+                               ",%" PRIu64 "\n",
+                               entries[i].graphics_class, entries[i].method,
+                               name ? name : "", entries[i].calls,
+                               entries[i].words, entries[i].ns);
+    }
+
+    return g_file_set_contents(path, csv->str, csv->len, NULL);
+}
+
+/*
+ * Print the time spent in each method since the last report, most expensive
+ * first, then reset the costs.
+ */
+void nv2a_profile_report_method_costs(void)
+{
+    if (!g_nv2a_stats.method_costs_enabled) {
+        return;
+    }
+
+    size_t max_entries = NV2A_PROF_NUM_METHOD_CLASSES * NV2A_PROF_NUM_METHODS;
+    g_autofree NV2AMethodCostEntry *entries =
+        g_new(NV2AMethodCostEntry, max_entries);
+    uint64_t total_ns;
+    size_t num_entries =
+        nv2a_profile_get_method_costs(entries, max_entries, &total_ns);
+
+    fprintf(stderr, "nv2a: Method costs (%.3f ms total)\n", total_ns / 1e6);
+    fprintf(stderr, "  class  method   calls       words       ms          "
+                    "ns/call   %%    name\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        NV2AMethodCostEntry *entry = &entries[i];
+        const char *name =
+            pgraph_get_method_name(entry->graphics_class, entry->method);
+        fprintf(stderr,
+                "  0x%02x   0x%04x   %-10" PRIu64 "  %-10" PRIu64
+                "  %-10.3f  %-8.1f  %-4.1f %s\n",
+                entry->graphics_class, entry->method, entry->calls,
+                entry->words, entry->ns / 1e6,
+                (double)entry->ns / entry->calls,
+                total_ns ? entry->ns * 100.0 / total_ns : 0.0,
+                name ? name : "");
+    }
+
+    nv2a_profile_reset_method_costs();
+}
@@ -27,6 +27,19 @@
 
 #include "swizzle.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SWIZZLE_ACCEL_X86
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define SWIZZLE_ACCEL_NEON
+#endif
+
+#ifdef SWIZZLE_DISABLE_ACCEL
+#undef SWIZZLE_ACCEL_X86
+#undef SWIZZLE_ACCEL_NEON
+#endif
+
 /*
  * Helpers for converting to and from swizzled (Z-ordered) texture formats.
  * Swizzled textures store pixels in a more cache-friendly layout for rendering
@@ -69,6 +82,48 @@ static void generate_swizzle_masks(unsigned int width,
     *mask_z = z;
 }
 
+/* Gather the bits of a swizzled offset selected by mask into a coordinate */
+static uint32_t extract_swizzled_coord(uint32_t offset, uint32_t mask)
+{
+    uint32_t coord = 0;
+    uint32_t coord_bit = 1;
+    for (uint32_t bit = 1; bit && bit <= mask; bit <<= 1) {
+        if (mask & bit) {
+            if (offset & bit) {
+                coord |= coord_bit;
+            }
+            coord_bit <<= 1;
+        }
+    }
+    return coord;
+}
+
+void swizzle_get_range_bounds(unsigned int width, unsigned int height,
+                              uint32_t first, uint32_t last,
+                              unsigned int *x0, unsigned int *y0,
+                              unsigned int *x1, unsigned int *y1)
+{
+    uint32_t mask_x, mask_y, mask_z;
+    generate_swizzle_masks(width, height, 1, &mask_x, &mask_y, &mask_z);
+
+    /*
+     * Any aligned power-of-two block of the Z-order curve covers a
+     * rectangle, so use the smallest such block containing the range.
+     */
+    uint32_t diff = first ^ last;
+    uint32_t block_mask = 0;
+    while (block_mask < diff) {
+        block_mask = (block_mask << 1) | 1;
+    }
+    uint32_t block_start = first & ~block_mask;
+    uint32_t block_end = block_start | block_mask;
+
+    *x0 = extract_swizzled_coord(block_start, mask_x);
+    *y0 = extract_swizzled_coord(block_start, mask_y);
+    *x1 = extract_swizzled_coord(block_end, mask_x) + 1;
+    *y1 = extract_swizzled_coord(block_end, mask_y) + 1;
+}
+
 static inline void swizzle_box_internal(
     const uint8_t *src_buf,
     unsigned int width,
@@ -155,9 +210,11 @@ static inline void unswizzle_box_internal(
     m##_internal(src_buf, width, height, depth, dst_buf, row_pitch, \
                  slice_pitch, bpp)
 #define MULTIVERSION(m)                                                     \
-    void m(const uint8_t *src_buf, unsigned int width, unsigned int height, \
-           unsigned int depth, uint8_t *dst_buf, unsigned int row_pitch,    \
-           unsigned int slice_pitch, unsigned int bytes_per_pixel)          \
+    static void m##_scalar(const uint8_t *src_buf, unsigned int width,      \
+                           unsigned int height, unsigned int depth,         \
+                           uint8_t *dst_buf, unsigned int row_pitch,        \
+                           unsigned int slice_pitch,                        \
+                           unsigned int bytes_per_pixel)                    \
     {                                                                       \
         switch (bytes_per_pixel) {                                          \
         case 1:                                                             \
@@ -182,3 +239,311 @@ MULTIVERSION(unswizzle_box)
 
 #undef C
 #undef MULTIVERSION
+
+/*
+ * Accelerated 2D variants. When depth is 1 and both width and height are at
+ * least 4, the low four bits of a swizzled offset are x0 y0 x1 y1, so each
+ * aligned 4x4 block of texels is stored as 16 consecutive swizzled texels.
+ * Within such a tile, rows are (0,1,4,5), (2,3,6,7), (8,9,12,13) and
+ * (10,11,14,15). This permutation is its own inverse, so the same shuffles
+ * convert in either direction.
+ */
+typedef void (*SwizzleRectFunc)(const uint8_t *src_buf, unsigned int width,
+                                unsigned int height, uint8_t *dst_buf,
+                                unsigned int row_pitch);
+
+#define TILED_RECT(name, target, bpp, tile_func, unswizzle)                  \
+    static target void name(const uint8_t *src_buf, unsigned int width,      \
+                            unsigned int height, uint8_t *dst_buf,           \
+                            unsigned int row_pitch)                          \
+    {                                                                        \
+        uint32_t mask_x, mask_y, mask_z;                                     \
+        generate_swizzle_masks(width, height, 1, &mask_x, &mask_y, &mask_z); \
+        /* Step tile origins by letting increments ripple past tile bits */ \
+        uint32_t tile_mask_x = mask_x & ~0x5u, tile_mask_y = mask_y & ~0xau; \
+        uint32_t off_y = 0;                                                  \
+        for (unsigned int y = 0; y < height; y += 4) {                       \
+            uint32_t off_x = 0;                                              \
+            for (unsigned int x = 0; x < width; x += 4) {                    \
+                size_t linear_offset = y * row_pitch + x * (bpp);            \
+                size_t swizzled_offset = (off_x + off_y) * (bpp);            \
+                if (unswizzle) {                                             \
+                    tile_func(dst_buf + linear_offset, row_pitch,            \
+                              (uint8_t *)src_buf + swizzled_offset, true);   \
+                } else {                                                     \
+                    tile_func((uint8_t *)src_buf + linear_offset, row_pitch, \
+                              dst_buf + swizzled_offset, false);             \
+                }                                                            \
+                off_x = (off_x - tile_mask_x) & tile_mask_x;                 \
+            }                                                                \
+            off_y = (off_y - tile_mask_y) & tile_mask_y;                     \
+        }                                                                    \
+    }
+
+#define ACCEL_RECTS(isa, target, bpp)                                        \
+    TILED_RECT(swizzle_rect_##isa##_##bpp, target, bpp,                      \
+               convert_tile_##isa##_##bpp, false)                            \
+    TILED_RECT(unswizzle_rect_##isa##_##bpp, target, bpp,                    \
+               convert_tile_##isa##_##bpp, true)
+
+#ifdef SWIZZLE_ACCEL_X86
+
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+
+static inline TARGET_SSE4 void convert_tile_sse4_1(uint8_t *linear,
+                                                   unsigned int row_pitch,
+                                                   uint8_t *swizzled,
+                                                   bool unswizzle)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12,
+                                          13, 10, 11, 14, 15);
+    if (unswizzle) {
+        __m128i v = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)swizzled), shuffle);
+        for (int i = 0; i < 4; i++) {
+            uint32_t row = _mm_extract_epi32(v, 0);
+            memcpy(linear + i * row_pitch, &row, 4);
+            v = _mm_srli_si128(v, 4);
+        }
+    } else {
+        uint32_t rows[4];
+        for (int i = 0; i < 4; i++) {
+            memcpy(&rows[i], linear + i * row_pitch, 4);
+        }
+        __m128i v = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i *)rows), shuffle);
+        _mm_storeu_si128((__m128i *)swizzled, v);
+    }
+}
+
+static inline TARGET_SSE4 void convert_tile_sse4_2(uint8_t *linear,
+                                                   unsigned int row_pitch,
+                                                   uint8_t *swizzled,
+                                                   bool unswizzle)
+{
+    for (int i = 0; i < 2; i++) {
+        uint8_t *rows = linear + 2 * i * row_pitch;
+        __m128i *tile = (__m128i *)(swizzled + 16 * i);
+        if (unswizzle) {
+            __m128i v = _mm_shuffle_epi32(_mm_loadu_si128(tile),
+                                          _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storel_epi64((__m128i *)rows, v);
+            _mm_storel_epi64((__m128i *)(rows + row_pitch),
+                             _mm_srli_si128(v, 8));
+        } else {
+            __m128i v = _mm_unpacklo_epi64(
+                _mm_loadl_epi64((const __m128i *)rows),
+                _mm_loadl_epi64((const __m128i *)(rows + row_pitch)));
+            _mm_storeu_si128(tile,
+                             _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+    }
+}
+
+static inline TARGET_SSE4 void convert_tile_sse4_4(uint8_t *linear,
+                                                   unsigned int row_pitch,
+                                                   uint8_t *swizzled,
+                                                   bool unswizzle)
+{
+    for (int i = 0; i < 2; i++) {
+        __m128i *row0 = (__m128i *)(linear + 2 * i * row_pitch);
+        __m128i *row1 = (__m128i *)(linear + (2 * i + 1) * row_pitch);
+        __m128i *tile = (__m128i *)(swizzled + 32 * i);
+        __m128i a, b;
+        if (unswizzle) {
+            a = _mm_loadu_si128(tile);
+            b = _mm_loadu_si128(tile + 1);
+            _mm_storeu_si128(row0, _mm_unpacklo_epi64(a, b));
+            _mm_storeu_si128(row1, _mm_unpackhi_epi64(a, b));
+        } else {
+            a = _mm_loadu_si128(row0);
+            b = _mm_loadu_si128(row1);
+            _mm_storeu_si128(tile, _mm_unpacklo_epi64(a, b));
+            _mm_storeu_si128(tile + 1, _mm_unpackhi_epi64(a, b));
+        }
+    }
+}
+
+static inline TARGET_AVX2 void convert_tile_avx2_4(uint8_t *linear,
+                                                   unsigned int row_pitch,
+                                                   uint8_t *swizzled,
+                                                   bool unswizzle)
+{
+    for (int i = 0; i < 2; i++) {
+        __m128i *row0 = (__m128i *)(linear + 2 * i * row_pitch);
+        __m128i *row1 = (__m128i *)(linear + (2 * i + 1) * row_pitch);
+        __m256i *tile = (__m256i *)(swizzled + 32 * i);
+        if (unswizzle) {
+            __m256i v = _mm256_permute4x64_epi64(_mm256_loadu_si256(tile),
+                                                 _MM_SHUFFLE(3, 1, 2, 0));
+            _mm_storeu_si128(row0, _mm256_castsi256_si128(v));
+            _mm_storeu_si128(row1, _mm256_extracti128_si256(v, 1));
+        } else {
+            __m256i v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128(row0)),
+                _mm_loadu_si128(row1), 1);
+            _mm256_storeu_si256(
+                tile, _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0)));
+        }
+    }
+}
+
+ACCEL_RECTS(sse4, TARGET_SSE4, 1)
+ACCEL_RECTS(sse4, TARGET_SSE4, 2)
+ACCEL_RECTS(sse4, TARGET_SSE4, 4)
+ACCEL_RECTS(avx2, TARGET_AVX2, 4)
+
+#endif
+
+#ifdef SWIZZLE_ACCEL_NEON
+
+static const uint8_t neon_tile_shuffle[16] = {
+    0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15
+};
+
+static inline void convert_tile_neon_1(uint8_t *linear, unsigned int row_pitch,
+                                       uint8_t *swizzled, bool unswizzle)
+{
+    uint8x16_t shuffle = vld1q_u8(neon_tile_shuffle);
+    if (unswizzle) {
+        uint32x4_t v =
+            vreinterpretq_u32_u8(vqtbl1q_u8(vld1q_u8(swizzled), shuffle));
+        for (int i = 0; i < 4; i++) {
+            uint32_t row = vgetq_lane_u32(v, 0);
+            memcpy(linear + i * row_pitch, &row, 4);
+            v = vextq_u32(v, v, 1);
+        }
+    } else {
+        uint32_t rows[4];
+        for (int i = 0; i < 4; i++) {
+            memcpy(&rows[i], linear + i * row_pitch, 4);
+        }
+        vst1q_u8(swizzled, vqtbl1q_u8(vld1q_u8((const uint8_t *)rows),
+                                      shuffle));
+    }
+}
+
+static inline void convert_tile_neon_2(uint8_t *linear, unsigned int row_pitch,
+                                       uint8_t *swizzled, bool unswizzle)
+{
+    uint32_t *tile = (uint32_t *)swizzled;
+    if (unswizzle) {
+        uint32x4_t a = vld1q_u32(tile), b = vld1q_u32(tile + 4);
+        uint32x4_t even = vuzp1q_u32(a, b), odd = vuzp2q_u32(a, b);
+        vst1_u32((uint32_t *)linear, vget_low_u32(even));
+        vst1_u32((uint32_t *)(linear + row_pitch), vget_low_u32(odd));
+        vst1_u32((uint32_t *)(linear + 2 * row_pitch), vget_high_u32(even));
+        vst1_u32((uint32_t *)(linear + 3 * row_pitch), vget_high_u32(odd));
+    } else {
+        uint32x4_t even =
+            vcombine_u32(vld1_u32((const uint32_t *)linear),
+                         vld1_u32((const uint32_t *)(linear + 2 * row_pitch)));
+        uint32x4_t odd =
+            vcombine_u32(vld1_u32((const uint32_t *)(linear + row_pitch)),
+                         vld1_u32((const uint32_t *)(linear + 3 * row_pitch)));
+        vst1q_u32(tile, vzip1q_u32(even, odd));
+        vst1q_u32(tile + 4, vzip2q_u32(even, odd));
+    }
+}
+
+static inline void convert_tile_neon_4(uint8_t *linear, unsigned int row_pitch,
+                                       uint8_t *swizzled, bool unswizzle)
+{
+    for (int i = 0; i < 2; i++) {
+        uint64_t *row0 = (uint64_t *)(linear + 2 * i * row_pitch);
+        uint64_t *row1 = (uint64_t *)(linear + (2 * i + 1) * row_pitch);
+        uint64_t *tile = (uint64_t *)(swizzled + 32 * i);
+        uint64x2_t a, b;
+        if (unswizzle) {
+            a = vld1q_u64(tile);
+            b = vld1q_u64(tile + 2);
+            vst1q_u64(row0, vzip1q_u64(a, b));
+            vst1q_u64(row1, vzip2q_u64(a, b));
+        } else {
+            a = vld1q_u64(row0);
+            b = vld1q_u64(row1);
+            vst1q_u64(tile, vzip1q_u64(a, b));
+            vst1q_u64(tile + 2, vzip2q_u64(a, b));
+        }
+    }
+}
+
+ACCEL_RECTS(neon, , 1)
+ACCEL_RECTS(neon, , 2)
+ACCEL_RECTS(neon, , 4)
+
+#endif
+
+static SwizzleRectFunc swizzle_rect_accel[5];
+static SwizzleRectFunc unswizzle_rect_accel[5];
+
+static void __attribute__((constructor)) init_swizzle_accel(void)
+{
+#ifdef SWIZZLE_ACCEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1")) {
+        swizzle_rect_accel[1] = swizzle_rect_sse4_1;
+        swizzle_rect_accel[2] = swizzle_rect_sse4_2;
+        swizzle_rect_accel[4] = swizzle_rect_sse4_4;
+        unswizzle_rect_accel[1] = unswizzle_rect_sse4_1;
+        unswizzle_rect_accel[2] = unswizzle_rect_sse4_2;
+        unswizzle_rect_accel[4] = unswizzle_rect_sse4_4;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        swizzle_rect_accel[4] = swizzle_rect_avx2_4;
+        unswizzle_rect_accel[4] = unswizzle_rect_avx2_4;
+    }
+#endif
+#ifdef SWIZZLE_ACCEL_NEON
+    /* Advanced SIMD is mandatory on AArch64 */
+    swizzle_rect_accel[1] = swizzle_rect_neon_1;
+    swizzle_rect_accel[2] = swizzle_rect_neon_2;
+    swizzle_rect_accel[4] = swizzle_rect_neon_4;
+    unswizzle_rect_accel[1] = unswizzle_rect_neon_1;
+    unswizzle_rect_accel[2] = unswizzle_rect_neon_2;
+    unswizzle_rect_accel[4] = unswizzle_rect_neon_4;
+#endif
+}
+
+static inline SwizzleRectFunc get_accel_func(SwizzleRectFunc *funcs,
+                                             unsigned int width,
+                                             unsigned int height,
+                                             unsigned int depth,
+                                             unsigned int bytes_per_pixel)
+{
+    if (depth != 1 || width < 4 || height < 4 || bytes_per_pixel > 4) {
+        return NULL;
+    }
+    return funcs[bytes_per_pixel];
+}
+
+void swizzle_box(const uint8_t *src_buf, unsigned int width,
+                 unsigned int height, unsigned int depth, uint8_t *dst_buf,
+                 unsigned int row_pitch, unsigned int slice_pitch,
+                 unsigned int bytes_per_pixel)
+{
+    SwizzleRectFunc func = get_accel_func(swizzle_rect_accel, width, height,
+                                          depth, bytes_per_pixel);
+    if (func) {
+        func(src_buf, width, height, dst_buf, row_pitch);
+    } else {
+        swizzle_box_scalar(src_buf, width, height, depth, dst_buf, row_pitch,
+                           slice_pitch, bytes_per_pixel);
+    }
+}
+
+void unswizzle_box(const uint8_t *src_buf, unsigned int width,
+                   unsigned int height, unsigned int depth, uint8_t *dst_buf,
+                   unsigned int row_pitch, unsigned int slice_pitch,
+                   unsigned int bytes_per_pixel)
+{
+    SwizzleRectFunc func = get_accel_func(unswizzle_rect_accel, width, height,
+                                          depth, bytes_per_pixel);
+    if (func) {
+        func(src_buf, width, height, dst_buf, row_pitch);
+    } else {
+        unswizzle_box_scalar(src_buf, width, height, depth, dst_buf,
+                             row_pitch, slice_pitch, bytes_per_pixel);
+    }
+}
@@ -43,6 +43,15 @@ void unswizzle_box(
     unsigned int slice_pitch,
     unsigned int bytes_per_pixel);
 
+/*
+ * Compute the bounding rectangle [x0, x1) x [y0, y1) of all texels whose
+ * swizzled index lies within [first, last] in a 2D swizzled texture.
+ */
+void swizzle_get_range_bounds(unsigned int width, unsigned int height,
+                              uint32_t first, uint32_t last,
+                              unsigned int *x0, unsigned int *y0,
+                              unsigned int *x1, unsigned int *y1);
+
 static inline void unswizzle_rect(
     const uint8_t *src_buf,
     unsigned int width,
@@ -20,6 +20,7 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "ui/xemu-settings.h"
 #include "texture.h"
 #include "util.h"
 
@@ -140,6 +141,42 @@ hwaddr pgraph_get_texture_palette_phys_addr_length(PGRAPHState *pg, int texture_
     return palette_data - d->vram_ptr;
 }
 
+/* The guest setting, unless display.quality.anisotropy forces a level */
+unsigned int pgraph_get_texture_max_anisotropy(PGRAPHState *pg,
+                                               int texture_idx)
+{
+    int forced = g_config.display.quality.anisotropy;
+    if (forced > 0) {
+        return MIN(forced, 16);
+    }
+
+    return 1 << GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_TEXCTL0_0 + texture_idx * 4),
+                         NV_PGRAPH_TEXCTL0_0_MAX_ANISOTROPY);
+}
+
+float pgraph_get_texture_lod_bias(PGRAPHState *pg, int texture_idx)
+{
+    uint32_t filter = pgraph_reg_r(pg, NV_PGRAPH_TEXFILTER0 + texture_idx * 4);
+    return pgraph_convert_lod_bias_to_float(
+               GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS)) +
+           g_config.display.quality.lod_bias;
+}
+
+/*
+ * Number of top mip levels of a texture to leave out on the host, trading
+ * detail for memory and upload bandwidth. At least one level is kept.
+ */
+unsigned int pgraph_get_texture_mip_skip(const TextureShape *shape)
+{
+    int skip = g_config.display.quality.texture_mip_skip;
+    if (skip <= 0 || shape->levels <= 1 || shape->dimensionality != 2 ||
+        kelvin_color_format_info_map[shape->color_format].linear) {
+        return 0;
+    }
+
+    return MIN(skip, shape->levels - 1);
+}
+
 size_t pgraph_get_texture_length(PGRAPHState *pg, TextureShape *shape)
 {
     BasicColorFormatInfo f = kelvin_color_format_info_map[shape->color_format];
@@ -325,6 +362,103 @@ TextureShape pgraph_get_texture_shape(PGRAPHState *pg, int texture_idx)
     return shape;
 }
 
+/*
+ * Each converter handles one row of a single format, so the per-pixel loops
+ * carry no format checks.
+ */
+typedef void (*TextureRowConverter)(uint8_t *dst, const uint8_t *src,
+                                    const uint8_t *palette_data,
+                                    unsigned int width);
+
+static void convert_row_palette(uint8_t *dst, const uint8_t *src,
+                                const uint8_t *palette_data,
+                                unsigned int width)
+{
+    const uint32_t *palette = (const uint32_t *)palette_data;
+    uint32_t *out = (uint32_t *)dst;
+    for (unsigned int x = 0; x < width; x++) {
+        out[x] = palette[src[x]];
+    }
+}
+
+static inline void yuv_to_rgba(uint8_t *pixel, int c, int d, int e)
+{
+    pixel[0] = cliptobyte((298 * c + 409 * e + 128) >> 8);
+    pixel[1] = cliptobyte((298 * c - 100 * d - 208 * e + 128) >> 8);
+    pixel[2] = cliptobyte((298 * c + 516 * d + 128) >> 8);
+    pixel[3] = 255;
+}
+
+/*
+ * Pixels come in pairs sharing chroma, an odd last pixel is done alone.
+ * FIXME: only valid if control0 register allows for colorspace conversion
+ */
+static void convert_row_yuy2(uint8_t *dst, const uint8_t *src,
+                             const uint8_t *palette_data, unsigned int width)
+{
+    unsigned int x;
+    for (x = 0; x + 1 < width; x += 2, src += 4, dst += 8) {
+        int d = (int)src[1] - 128;
+        int e = (int)src[3] - 128;
+        yuv_to_rgba(&dst[0], (int)src[0] - 16, d, e);
+        yuv_to_rgba(&dst[4], (int)src[2] - 16, d, e);
+    }
+    if (x < width) {
+        convert_yuy2_to_rgb(src, 0, &dst[0], &dst[1], &dst[2]);
+        dst[3] = 255;
+    }
+}
+
+static void convert_row_uyvy(uint8_t *dst, const uint8_t *src,
+                             const uint8_t *palette_data, unsigned int width)
+{
+    unsigned int x;
+    for (x = 0; x + 1 < width; x += 2, src += 4, dst += 8) {
+        int d = (int)src[0] - 128;
+        int e = (int)src[2] - 128;
+        yuv_to_rgba(&dst[0], (int)src[1] - 16, d, e);
+        yuv_to_rgba(&dst[4], (int)src[3] - 16, d, e);
+    }
+    if (x < width) {
+        convert_uyvy_to_rgb(src, 0, &dst[0], &dst[1], &dst[2]);
+        dst[3] = 255;
+    }
+}
+
+static void convert_row_r6g5b5(uint8_t *dst, const uint8_t *src,
+                               const uint8_t *palette_data, unsigned int width)
+{
+    int8_t *pixel = (int8_t *)dst;
+    for (unsigned int x = 0; x < width; x++, pixel += 3) {
+        uint16_t rgb655 = lduw_le_p(src + x * 2);
+        /* Maps 5 bit G and B signed value range to 8 bit
+         * signed values. R is probably unsigned.
+         */
+        rgb655 ^= (1 << 9) | (1 << 4);
+        pixel[0] = ((rgb655 & 0xFC00) >> 10) * 0x7F / 0x3F;
+        pixel[1] = ((rgb655 & 0x03E0) >> 5) * 0xFF / 0x1F - 0x80;
+        pixel[2] = (rgb655 & 0x001F) * 0xFF / 0x1F - 0x80;
+    }
+}
+
+typedef struct TextureConverter {
+    TextureRowConverter convert_row;
+    unsigned int bytes_per_pixel;
+    bool volume;
+} TextureConverter;
+
+static const TextureConverter
+    texture_converters[ARRAY_SIZE(kelvin_color_format_info_map)] = {
+#define DEF_TEXTURE_CONVERTER(format, kernel, bpp, vol)             \
+    [NV097_SET_TEXTURE_FORMAT_COLOR_##format] = {                   \
+        .convert_row = convert_row_##kernel,                        \
+        .bytes_per_pixel = (bpp),                                   \
+        .volume = (vol),                                            \
+    },
+#include "texture_converters.h.inc"
+#undef DEF_TEXTURE_CONVERTER
+};
+
 uint8_t *pgraph_convert_texture_data(const TextureShape s, const uint8_t *data,
                                      const uint8_t *palette_data,
                                      unsigned int width, unsigned int height,
@@ -332,70 +466,29 @@ uint8_t *pgraph_convert_texture_data(const TextureShape s, const uint8_t *data,
                                      unsigned int slice_pitch,
                                      size_t *converted_size)
 {
-    size_t size = 0;
-    uint8_t *converted_data;
-
-    if (s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8) {
-        size = width * height * depth * 4;
-        converted_data = g_malloc(size);
-        const uint8_t *src = data;
-        uint32_t *dst = (uint32_t *)converted_data;
-        for (int z = 0; z < depth; z++) {
-            for (int y = 0; y < height; y++) {
-                for (int x = 0; x < width; x++) {
-                    uint8_t index = src[y * row_pitch + x];
-                    uint32_t color = *(uint32_t *)(palette_data + index * 4);
-                    *dst++ = color;
-                }
-            }
-            src += slice_pitch;
-        }
-    } else if (s.color_format ==
-                   NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8 ||
-               s.color_format ==
-                   NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_YB8CR8YA8CB8) {
-        // TODO: Investigate whether a non-1 depth is possible.
-        // Generally the hardware asserts when attempting to use volumetric
-        // textures in linear formats.
-        assert(depth == 1); /* FIXME */
-        // FIXME: only valid if control0 register allows for colorspace
-        // conversion
-        size = width * height * 4;
-        converted_data = g_malloc(size);
-        uint8_t *pixel = converted_data;
-        for (int y = 0; y < height; y++) {
-            const uint8_t *line = &data[y * row_pitch * depth];
-            for (int x = 0; x < width; x++, pixel += 4) {
-                if (s.color_format ==
-                    NV097_SET_TEXTURE_FORMAT_COLOR_LC_IMAGE_CR8YB8CB8YA8) {
-                    convert_yuy2_to_rgb(line, x, &pixel[0], &pixel[1],
-                                        &pixel[2]);
-                } else {
-                    convert_uyvy_to_rgb(line, x, &pixel[0], &pixel[1],
-                                        &pixel[2]);
-                }
-                pixel[3] = 255;
-            }
-        }
-    } else if (s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R6G5B5) {
-        assert(depth == 1); /* FIXME */
-        size = width * height * 3;
-        converted_data = g_malloc(size);
+    assert(s.color_format < ARRAY_SIZE(texture_converters));
+    const TextureConverter *c = &texture_converters[s.color_format];
+    if (!c->convert_row) {
+        return NULL;
+    }
+
+    // TODO: Investigate whether a non-1 depth is possible for the others.
+    // Generally the hardware asserts when attempting to use volumetric
+    // textures in linear formats.
+    assert(c->volume || depth == 1); /* FIXME */
+
+    size_t dst_row_size = width * c->bytes_per_pixel;
+    size_t size = dst_row_size * height * depth;
+    uint8_t *converted_data = g_malloc(size);
+
+    uint8_t *dst = converted_data;
+    for (int z = 0; z < depth; z++) {
+        const uint8_t *src = data + z * slice_pitch;
         for (int y = 0; y < height; y++) {
-            for (int x = 0; x < width; x++) {
-                uint16_t rgb655 = *(uint16_t *)(data + y * row_pitch + x * 2);
-                int8_t *pixel = (int8_t *)&converted_data[(y * width + x) * 3];
-                /* Maps 5 bit G and B signed value range to 8 bit
-                 * signed values. R is probably unsigned.
-                 */
-                rgb655 ^= (1 << 9) | (1 << 4);
-                pixel[0] = ((rgb655 & 0xFC00) >> 10) * 0x7F / 0x3F;
-                pixel[1] = ((rgb655 & 0x03E0) >> 5) * 0xFF / 0x1F - 0x80;
-                pixel[2] = (rgb655 & 0x001F) * 0xFF / 0x1F - 0x80;
-            }
+            c->convert_row(dst, src, palette_data, width);
+            src += row_pitch;
+            dst += dst_row_size;
         }
-    } else {
-        return NULL;
     }
 
     if (converted_size) {
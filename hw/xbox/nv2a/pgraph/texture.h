@@ -63,6 +63,10 @@ hwaddr pgraph_get_texture_phys_addr(PGRAPHState *pg, int texture_idx);
 hwaddr pgraph_get_texture_palette_phys_addr_length(PGRAPHState *pg, int texture_idx, size_t *length);
 TextureShape pgraph_get_texture_shape(PGRAPHState *pg, int texture_idx);
 size_t pgraph_get_texture_length(PGRAPHState *pg, TextureShape *shape);
+unsigned int pgraph_get_texture_max_anisotropy(PGRAPHState *pg,
+                                               int texture_idx);
+float pgraph_get_texture_lod_bias(PGRAPHState *pg, int texture_idx);
+unsigned int pgraph_get_texture_mip_skip(const TextureShape *shape);
 
 static inline float pgraph_convert_lod_bias_to_float(uint32_t lod_bias)
 {
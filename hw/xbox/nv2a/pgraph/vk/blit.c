@@ -24,6 +24,7 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/xbox/nv2a/pgraph/blit.h"
 #include "renderer.h"
 
 static void perform_blit(int operation, uint8_t *source, uint8_t *dest,
@@ -32,45 +33,134 @@ static void perform_blit(int operation, uint8_t *source, uint8_t *dest,
                          BetaState *beta)
 {
     if (operation == NV09F_SET_OPERATION_SRCCOPY) {
-        for (unsigned int y = 0; y < height; y++) {
-            memmove(dest, source, width_bytes);
-            source += source_pitch;
-            dest += dest_pitch;
-        }
+        blit_copy(source, dest, width_bytes, height, source_pitch, dest_pitch);
     } else if (operation == NV09F_SET_OPERATION_BLEND_AND) {
-        uint32_t max_beta_mult = 0x7f80;
-        uint32_t beta_mult = beta->beta >> 16;
-        uint32_t inv_beta_mult = max_beta_mult - beta_mult;
-
-        for (unsigned int y = 0; y < height; y++) {
-            uint8_t *s = source;
-            uint8_t *d = dest;
-            for (unsigned int x = 0; x < width; x++) {
-                for (unsigned int ch = 0; ch < 3; ch++) {
-                    uint32_t a = s[x * 4 + ch] * beta_mult;
-                    uint32_t b = d[x * 4 + ch] * inv_beta_mult;
-                    d[x * 4 + ch] = (a + b) / max_beta_mult;
-                }
-            }
-            source += source_pitch;
-            dest += dest_pitch;
-        }
+        blit_blend_and(source, dest, width, height, source_pitch, dest_pitch,
+                       beta->beta);
     } else {
         fprintf(stderr, "Unknown blit operation: 0x%x\n", operation);
         assert(false && "Unknown blit operation");
     }
 }
 
-static void patch_alpha(uint8_t *dest, size_t width_pixels, size_t height,
-                        size_t dest_pitch, uint8_t alpha_val)
+static bool check_gpu_blit_surface(SurfaceBinding *surface,
+                                   unsigned int bytes_per_pixel,
+                                   unsigned int pitch, unsigned int x,
+                                   unsigned int y, unsigned int width,
+                                   unsigned int height)
 {
-    for (unsigned int y = 0; y < height; y++) {
-        uint8_t *d = dest;
-        for (unsigned int x = 0; x < width_pixels; x++) {
-            d[x * 4 + 3] = alpha_val;
-        }
-        dest += dest_pitch;
+    // Transient images can't be copied from or to
+    return surface && surface->color && !surface->swizzle &&
+           !surface->transient && surface->initialized &&
+           surface->fmt.bytes_per_pixel == bytes_per_pixel &&
+           surface->pitch == pitch && x + width <= surface->width &&
+           y + height <= surface->height;
+}
+
+/*
+ * Copy between two surfaces that live on the GPU without a round trip
+ * through guest memory. The destination is left dirty and downloaded when
+ * the CPU reads it, like after a draw. Returns false if the blit has to be
+ * done on the CPU.
+ */
+static bool gpu_blit(NV2AState *d, SurfaceBinding *surf_src,
+                     SurfaceBinding *surf_dest, unsigned int bytes_per_pixel)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    ContextSurfaces2DState *context_surfaces = &pg->context_surfaces_2d;
+    ImageBlitState *image_blit = &pg->image_blit;
+
+    // FIXME: Do BLEND_AND with a blend pipeline
+    if (image_blit->operation != NV09F_SET_OPERATION_SRCCOPY) {
+        return false;
     }
+
+    // X8 formats force the alpha channel, which a copy can't do
+    switch (context_surfaces->color_format) {
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+        return false;
+    default:
+        break;
+    }
+
+    if (!image_blit->width || !image_blit->height || surf_src == surf_dest ||
+        !check_gpu_blit_surface(surf_src, bytes_per_pixel,
+                                context_surfaces->source_pitch,
+                                image_blit->in_x, image_blit->in_y,
+                                image_blit->width, image_blit->height) ||
+        !check_gpu_blit_surface(surf_dest, bytes_per_pixel,
+                                context_surfaces->dest_pitch,
+                                image_blit->out_x, image_blit->out_y,
+                                image_blit->width, image_blit->height) ||
+        surf_src->host_fmt.vk_format != surf_dest->host_fmt.vk_format) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_BLIT);
+
+    // Bring both images up to date with guest memory first
+    pgraph_vk_upload_surface_data(d, surf_src, false);
+    pgraph_vk_upload_surface_data(d, surf_dest, false);
+
+    unsigned int src_x = image_blit->in_x, src_y = image_blit->in_y;
+    unsigned int dest_x = image_blit->out_x, dest_y = image_blit->out_y;
+    unsigned int width = image_blit->width, height = image_blit->height;
+    pgraph_apply_scaling_factor(pg, &src_x, &src_y);
+    pgraph_apply_scaling_factor(pg, &dest_x, &dest_y);
+    pgraph_apply_scaling_factor(pg, &width, &height);
+
+    VkImageCopy region = {
+        .srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .srcSubresource.layerCount = 1,
+        .srcOffset = { src_x, src_y, 0 },
+        .dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .dstSubresource.layerCount = 1,
+        .dstOffset = { dest_x, dest_y, 0 },
+        .extent = { width, height, 1 },
+    };
+
+    VkCommandBuffer cmd = pgraph_vk_begin_nondraw_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_GREEN, __func__);
+
+    pgraph_vk_transition_image_layout(pg, cmd, surf_src->image,
+                                      surf_src->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    pgraph_vk_transition_image_layout(pg, cmd, surf_dest->image,
+                                      surf_dest->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    vkCmdCopyImage(cmd, surf_src->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   surf_dest->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                   &region);
+
+    pgraph_vk_transition_image_layout(pg, cmd, surf_src->image,
+                                      surf_src->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    pgraph_vk_transition_image_layout(pg, cmd, surf_dest->image,
+                                      surf_dest->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+    pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_end_nondraw_commands(pg, cmd);
+
+    // Neither image may become transient now that it holds blitted contents
+    surf_src->attachment_only = false;
+    surf_dest->attachment_only = false;
+
+    pg->draw_time++;
+    surf_dest->draw_time = pg->draw_time;
+    surf_dest->frame_time = pg->frame_time;
+    surf_dest->draw_dirty = true;
+    surf_dest->cleared = false;
+    pgraph_vk_surface_update_access_callback(d, surf_dest);
+
+    return true;
 }
 
 void pgraph_vk_image_blit(NV2AState *d)
@@ -119,11 +209,6 @@ void pgraph_vk_image_blit(NV2AState *d)
     dest += context_surfaces->dest_offset;
     hwaddr dest_addr = dest - d->vram_ptr;
 
-    SurfaceBinding *surf_src = pgraph_vk_surface_get(d, source_addr);
-    if (surf_src) {
-        pgraph_vk_surface_download_if_dirty(d, surf_src);
-    }
-
     hwaddr source_offset = image_blit->in_y * context_surfaces->source_pitch +
                            image_blit->in_x * bytes_per_pixel;
     hwaddr dest_offset = image_blit->out_y * context_surfaces->dest_pitch +
@@ -154,7 +239,18 @@ void pgraph_vk_image_blit(NV2AState *d)
         leftover_bytes = clipped_dest_size - consumed_bytes;
     }
 
+    SurfaceBinding *surf_src = pgraph_vk_surface_get(d, source_addr);
     SurfaceBinding *surf_dest = pgraph_vk_surface_get(d, dest_addr);
+
+    if (clipped_dest_size == dest_size && row_pixels == image_blit->width &&
+        gpu_blit(d, surf_src, surf_dest, bytes_per_pixel)) {
+        return;
+    }
+
+    if (surf_src) {
+        pgraph_vk_surface_download_if_dirty(d, surf_src);
+    }
+
     if (surf_dest) {
         if (adjusted_height < surf_dest->height ||
             row_pixels < surf_dest->width) {
@@ -208,20 +304,20 @@ void pgraph_vk_image_blit(NV2AState *d)
 
     if (needs_alpha_patching) {
         if (adjusted_height > 0) {
-            patch_alpha(dest_row, row_pixels, adjusted_height,
-                        context_surfaces->dest_pitch, alpha_override);
+            blit_patch_alpha(dest_row, row_pixels, adjusted_height,
+                             context_surfaces->dest_pitch, alpha_override);
         }
 
         if (leftover_bytes > 0) {
             uint8_t *dest =
                 dest_row + adjusted_height * context_surfaces->dest_pitch;
-            patch_alpha(dest, leftover_bytes / 4, 1, 0, alpha_override);
+            blit_patch_alpha(dest, leftover_bytes / 4, 1, 0, alpha_override);
         }
     }
 
     dest_addr += dest_offset;
     memory_region_set_client_dirty(d->vram, dest_addr, clipped_dest_size,
                                    DIRTY_MEMORY_VGA);
-    memory_region_set_client_dirty(d->vram, dest_addr, clipped_dest_size,
-                                   DIRTY_MEMORY_NV2A_TEX);
+    pgraph_vram_set_dirty(d, dest_addr, clipped_dest_size,
+                          DIRTY_MEMORY_NV2A_TEX);
 }
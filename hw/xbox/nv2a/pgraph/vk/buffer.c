@@ -37,17 +37,58 @@ static const char *const buffer_names[BUFFER_COUNT] = {
     "BUFFER_UNIFORM_STAGING",
 };
 
-static bool create_buffer(PGRAPHState *pg, StorageBuffer *buffer,
+/*
+ * Streamed through staging as rings. Bytes between ring_tail and
+ * buffer_offset are still referenced, either by the frame being recorded
+ * (from frame_offset) or by frames in flight, and are reclaimed as their
+ * fences signal. The head never catches up with the tail, so equal offsets
+ * always mean the ring is empty.
+ */
+static const char *const image_mem_names[IMAGE_MEM_COUNT] = {
+    [IMAGE_MEM_SURFACE] = "surface images",
+    [IMAGE_MEM_TEXTURE] = "texture images",
+    [IMAGE_MEM_DISPLAY] = "display images",
+    [IMAGE_MEM_BENCH] = "bench images",
+};
+
+static const int stream_buffers[] = {
+    BUFFER_INDEX_STAGING,
+    BUFFER_VERTEX_INLINE_STAGING,
+    BUFFER_UNIFORM_STAGING,
+};
+
+/*
+ * Staging and compute buffers hold the data of one transfer or compute pass
+ * at a time. They start at a chunk and are recreated larger when a pass needs
+ * more, up to max_size. Every SCRATCH_SHRINK_INTERVAL frames, a buffer much
+ * larger than what those frames needed is shrunk back. Replaced buffers are
+ * destroyed once the frame that may still reference them is retired.
+ */
+static const int scratch_buffers[] = {
+    BUFFER_STAGING_DST,
+    BUFFER_STAGING_SRC,
+    BUFFER_COMPUTE_DST,
+    BUFFER_COMPUTE_SRC,
+};
+
+#define SCRATCH_BUFFER_CHUNK_SIZE (4 * 1024 * 1024)
+#define SCRATCH_SHRINK_INTERVAL 600
+
+static bool create_buffer(PGRAPHVkState *r, StorageBuffer *buffer,
                           const char *name, Error **errp)
 {
-    PGRAPHVkState *r = pg->vk_renderer_state;
-
     VkBufferCreateInfo buffer_create_info = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
         .size = buffer->buffer_size,
         .usage = buffer->usage,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
+    uint32_t queue_families[] = { r->queue_family, r->transfer_queue_family };
+    if (buffer->transfer_queue_shared && r->transfer_queue_enabled) {
+        buffer_create_info.sharingMode = VK_SHARING_MODE_CONCURRENT;
+        buffer_create_info.queueFamilyIndexCount = ARRAY_SIZE(queue_families);
+        buffer_create_info.pQueueFamilyIndices = queue_families;
+    }
     VkResult result = vmaCreateBuffer(r->allocator, &buffer_create_info,
                                       &buffer->alloc_info, &buffer->buffer,
                                       &buffer->allocation, NULL);
@@ -56,6 +97,111 @@ static bool create_buffer(PGRAPHState *pg, StorageBuffer *buffer,
                    name, buffer->buffer_size, result);
         return false;
     }
+    pgraph_vk_account_allocation(r, buffer->mem_account, buffer->allocation,
+                                 false);
+    return true;
+}
+
+/*
+ * Guest RAM is ordinary host memory, so with VK_EXT_external_memory_host it
+ * can back the vertex RAM buffer directly. Vertex fetch then reads guest
+ * memory instead of a copy of it.
+ */
+static bool import_vertex_ram_buffer(NV2AState *d, StorageBuffer *buffer)
+{
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
+    VkPhysicalDeviceExternalMemoryHostPropertiesEXT host_props = {
+        .sType =
+            VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT,
+    };
+    VkPhysicalDeviceProperties2 props = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &host_props,
+    };
+    vkGetPhysicalDeviceProperties2(r->physical_device, &props);
+
+    VkDeviceSize alignment = host_props.minImportedHostPointerAlignment;
+    if (!alignment || (uintptr_t)d->vram_ptr % alignment ||
+        buffer->buffer_size % alignment) {
+        return false;
+    }
+
+    VkMemoryHostPointerPropertiesEXT pointer_props = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT,
+    };
+    if (vkGetMemoryHostPointerPropertiesEXT(
+            r->device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+            d->vram_ptr, &pointer_props) != VK_SUCCESS) {
+        return false;
+    }
+
+    VkExternalMemoryBufferCreateInfo external_create_info = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+    };
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .pNext = &external_create_info,
+        .size = buffer->buffer_size,
+        .usage = buffer->usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VkBuffer vk_buffer;
+    if (vkCreateBuffer(r->device, &buffer_create_info, NULL, &vk_buffer) !=
+        VK_SUCCESS) {
+        return false;
+    }
+
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(r->device, vk_buffer, &reqs);
+    uint32_t type_bits = reqs.memoryTypeBits & pointer_props.memoryTypeBits;
+
+    // Prefer a coherent type, so host writes need no flush
+    VkPhysicalDeviceMemoryProperties mem_props;
+    vkGetPhysicalDeviceMemoryProperties(r->physical_device, &mem_props);
+    int type_index = -1;
+    for (int i = 0; i < mem_props.memoryTypeCount; i++) {
+        if (!(type_bits & (1 << i))) {
+            continue;
+        }
+        if (type_index < 0 || (mem_props.memoryTypes[i].propertyFlags &
+                               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+            type_index = i;
+        }
+    }
+    if (type_index < 0 || reqs.size > buffer->buffer_size) {
+        vkDestroyBuffer(r->device, vk_buffer, NULL);
+        return false;
+    }
+
+    VkImportMemoryHostPointerInfoEXT import_info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT,
+        .pHostPointer = d->vram_ptr,
+    };
+    VkMemoryAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &import_info,
+        .allocationSize = buffer->buffer_size,
+        .memoryTypeIndex = type_index,
+    };
+    VkDeviceMemory memory;
+    if (vkAllocateMemory(r->device, &alloc_info, NULL, &memory) !=
+        VK_SUCCESS) {
+        vkDestroyBuffer(r->device, vk_buffer, NULL);
+        return false;
+    }
+    if (vkBindBufferMemory(r->device, vk_buffer, memory, 0) != VK_SUCCESS) {
+        vkFreeMemory(r->device, memory, NULL);
+        vkDestroyBuffer(r->device, vk_buffer, NULL);
+        return false;
+    }
+
+    buffer->buffer = vk_buffer;
+    buffer->imported_memory = memory;
+    buffer->properties = mem_props.memoryTypes[type_index].propertyFlags;
+    buffer->mapped = d->vram_ptr;
     return true;
 }
 
@@ -63,20 +209,157 @@ static void destroy_buffer(PGRAPHState *pg, StorageBuffer *buffer)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    if (buffer->imported_memory != VK_NULL_HANDLE) {
+        vkDestroyBuffer(r->device, buffer->buffer, NULL);
+        vkFreeMemory(r->device, buffer->imported_memory, NULL);
+        buffer->buffer = VK_NULL_HANDLE;
+        buffer->imported_memory = VK_NULL_HANDLE;
+        buffer->mapped = NULL;
+        return;
+    }
+
     if (buffer->buffer == VK_NULL_HANDLE && buffer->allocation == VK_NULL_HANDLE) {
         return;
     }
+    pgraph_vk_account_allocation(r, buffer->mem_account, buffer->allocation,
+                                 true);
     vmaDestroyBuffer(r->allocator, buffer->buffer, buffer->allocation);
     buffer->buffer = VK_NULL_HANDLE;
     buffer->allocation = VK_NULL_HANDLE;
 }
 
+static void destroy_retired_buffers(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    if (!frame->retired_buffers) {
+        return;
+    }
+
+    for (int i = 0; i < frame->retired_buffers->len; i++) {
+        RetiredBuffer *b =
+            &g_array_index(frame->retired_buffers, RetiredBuffer, i);
+        pgraph_vk_account_allocation(r, b->mem_account, b->allocation, true);
+        vmaDestroyBuffer(r->allocator, b->buffer, b->allocation);
+    }
+    g_array_set_size(frame->retired_buffers, 0);
+}
+
+/*
+ * Replace a scratch buffer with one of a new size. The old one may still be
+ * referenced by frame or frames before it, so it lives until frame retires.
+ * Aux and transfer submits are waited on, so nothing else can reference it.
+ */
+static void resize_scratch_buffer(PGRAPHVkState *r, int index, size_t size,
+                                  FrameInFlight *frame)
+{
+    StorageBuffer *b = &r->storage_buffers[index];
+
+    if (!frame->retired_buffers) {
+        frame->retired_buffers =
+            g_array_new(false, false, sizeof(RetiredBuffer));
+    }
+    RetiredBuffer retired = { b->buffer, b->allocation, b->mem_account };
+    g_array_append_val(frame->retired_buffers, retired);
+
+    b->buffer = VK_NULL_HANDLE;
+    b->allocation = VK_NULL_HANDLE;
+    b->buffer_size = size;
+    create_buffer(r, b, buffer_names[index], &error_fatal);
+}
+
+/*
+ * Make sure a scratch buffer holds at least size bytes. Must be called before
+ * the buffer is looked up for a pass, as growing replaces it.
+ */
+void pgraph_vk_reserve_scratch_buffer(PGRAPHState *pg, int index, size_t size)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    StorageBuffer *b = &r->storage_buffers[index];
+
+    assert(size <= b->max_size);
+    b->high_water = MAX(b->high_water, size);
+    b->title_high_water = MAX(b->title_high_water, size);
+
+    if (size <= b->buffer_size) {
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SCRATCH_BUFFER_GROW);
+    resize_scratch_buffer(
+        r, index, MIN(ROUND_UP(size, SCRATCH_BUFFER_CHUNK_SIZE), b->max_size),
+        r->frame);
+}
+
+static void shrink_scratch_buffers(PGRAPHVkState *r, int frame_index)
+{
+    size_t total_size = 0;
+    for (int i = 0; i < ARRAY_SIZE(scratch_buffers); i++) {
+        total_size += r->storage_buffers[scratch_buffers[i]].buffer_size;
+    }
+    nv2a_profile_add_counter(NV2A_PROF_SCRATCH_BUFFER_KB, total_size / 1024);
+
+    if (++r->scratch_shrink_frames < SCRATCH_SHRINK_INTERVAL) {
+        return;
+    }
+    r->scratch_shrink_frames = 0;
+
+    for (int i = 0; i < ARRAY_SIZE(scratch_buffers); i++) {
+        StorageBuffer *b = &r->storage_buffers[scratch_buffers[i]];
+        size_t size = MAX(ROUND_UP(b->high_water, SCRATCH_BUFFER_CHUNK_SIZE),
+                          SCRATCH_BUFFER_CHUNK_SIZE);
+        b->high_water = 0;
+        if (size * 2 > b->buffer_size) {
+            continue;
+        }
+
+        nv2a_profile_inc_counter(NV2A_PROF_SCRATCH_BUFFER_SHRINK);
+        resize_scratch_buffer(r, scratch_buffers[i], size,
+                              &r->frames[frame_index]);
+    }
+}
+
+/*
+ * Add the size of a VMA allocation to account as it is created, or take it
+ * off as it is about to be freed.
+ */
+void pgraph_vk_account_allocation(PGRAPHVkState *r, XemuMemAccount *account,
+                                  VmaAllocation allocation, bool freed)
+{
+    if (allocation == VK_NULL_HANDLE) {
+        return;
+    }
+
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(r->allocator, allocation, &info);
+    xemu_mem_account_add(account, freed ? -(int64_t)info.size : info.size);
+}
+
+/*
+ * Report how much scratch space the title that was running needed, which is
+ * what the buffers would have to be allocated at up front.
+ */
+void pgraph_vk_buffers_title_changed(PGRAPHVkState *r, uint32_t title_id)
+{
+    if (title_id) {
+        fprintf(stderr, "nv2a: Title %08x scratch high-water:", title_id);
+        for (int i = 0; i < ARRAY_SIZE(scratch_buffers); i++) {
+            int index = scratch_buffers[i];
+            fprintf(stderr, " %s=%zuK", buffer_names[index],
+                    r->storage_buffers[index].title_high_water / 1024);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(scratch_buffers); i++) {
+        r->storage_buffers[scratch_buffers[i]].title_high_water = 0;
+    }
+}
+
 bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    // FIXME: Profile buffer sizes
+    // Limits for the scratch buffers, which grow on demand
 
     const size_t mib = 1024 * 1024;
     size_t vram_size = memory_region_size(d->vram);
@@ -100,7 +383,7 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
 
 #ifdef __ANDROID__
     __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                        "vk buffer init: vram=%zu staging=%zu compute=%zu",
+                        "vk buffer init: vram=%zu staging<=%zu compute<=%zu",
                         vram_size, staging_size, compute_size);
 #endif
 
@@ -116,28 +399,39 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
     r->storage_buffers[BUFFER_STAGING_DST] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-        .buffer_size = staging_size,
+        .buffer_size = SCRATCH_BUFFER_CHUNK_SIZE,
+        .max_size = staging_size,
     };
 
     r->storage_buffers[BUFFER_STAGING_SRC] = (StorageBuffer){
         .alloc_info = host_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        .buffer_size = r->storage_buffers[BUFFER_STAGING_DST].buffer_size,
+        .buffer_size = SCRATCH_BUFFER_CHUNK_SIZE,
+        .max_size = staging_size,
+        .transfer_queue_shared = true,
     };
 
     r->storage_buffers[BUFFER_COMPUTE_DST] = (StorageBuffer){
         .alloc_info = device_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        .buffer_size = compute_size,
+        .buffer_size = SCRATCH_BUFFER_CHUNK_SIZE,
+        .max_size = compute_size,
     };
 
     r->storage_buffers[BUFFER_COMPUTE_SRC] = (StorageBuffer){
         .alloc_info = device_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
                  VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-        .buffer_size = r->storage_buffers[BUFFER_COMPUTE_DST].buffer_size,
+        .buffer_size = SCRATCH_BUFFER_CHUNK_SIZE,
+        .max_size = compute_size,
     };
+    r->scratch_shrink_frames = 0;
+
+    for (int i = 0; i < IMAGE_MEM_COUNT; i++) {
+        r->image_mem_accounts[i] = xemu_mem_account("vk", image_mem_names[i]);
+    }
+    r->readback_mem_account = xemu_mem_account("vk", "surface readbacks");
 
     r->storage_buffers[BUFFER_INDEX] = (StorageBuffer){
         .alloc_info = device_alloc_create_info,
@@ -160,12 +454,16 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
     };
 
     r->bitmap_size = memory_region_size(d->vram) / 4096;
-    r->uploaded_bitmap = bitmap_new(r->bitmap_size);
-    if (!r->uploaded_bitmap) {
-        error_setg(errp, "Failed to allocate uploaded surface bitmap");
-        return false;
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        r->frames[i].uploaded_bitmap = bitmap_new(r->bitmap_size);
+        if (!r->frames[i].uploaded_bitmap) {
+            error_setg(errp, "Failed to allocate uploaded surface bitmap");
+            goto fail;
+        }
+        bitmap_clear(r->frames[i].uploaded_bitmap, 0, r->bitmap_size);
     }
-    bitmap_clear(r->uploaded_bitmap, 0, r->bitmap_size);
+    r->uploaded_bitmap = r->frame->uploaded_bitmap;
+    r->num_vertex_ram_versions = 0;
 
     r->storage_buffers[BUFFER_VERTEX_INLINE] = (StorageBuffer){
         .alloc_info = device_alloc_create_info,
@@ -185,7 +483,7 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
         .alloc_info = device_alloc_create_info,
         .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT |
                  VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-        .buffer_size = 8 * 1024 * 1024,
+        .buffer_size = 8 * 1024 * 1024 * NUM_FRAMES_IN_FLIGHT,
     };
 
     r->storage_buffers[BUFFER_UNIFORM_STAGING] = (StorageBuffer){
@@ -194,13 +492,27 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
         .buffer_size = r->storage_buffers[BUFFER_UNIFORM].buffer_size,
     };
 
+    r->vertex_ram_imported =
+        r->external_memory_host_extension_enabled &&
+        import_vertex_ram_buffer(d, &r->storage_buffers[BUFFER_VERTEX_RAM]);
+    if (r->external_memory_host_extension_enabled) {
+        fprintf(stderr, "nv2a: %s guest RAM for vertex data\n",
+                r->vertex_ram_imported ? "Mapped" : "Failed to map");
+    }
+
     for (int i = 0; i < BUFFER_COUNT; i++) {
+        if (i == BUFFER_VERTEX_RAM && r->vertex_ram_imported) {
+            continue;
+        }
 #ifdef __ANDROID__
         __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                             "vk buffer init: create %s size=%zu",
                             buffer_names[i], r->storage_buffers[i].buffer_size);
 #endif
-        if (!create_buffer(pg, &r->storage_buffers[i], buffer_names[i], errp)) {
+        g_autofree char *mem_name =
+            g_ascii_strdown(buffer_names[i] + strlen("BUFFER_"), -1);
+        r->storage_buffers[i].mem_account = xemu_mem_account("vk", mem_name);
+        if (!create_buffer(r, &r->storage_buffers[i], buffer_names[i], errp)) {
             goto fail;
         }
     }
@@ -214,6 +526,9 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
 
     for (int i = 0; i < ARRAY_SIZE(buffers_to_map); i++) {
         int idx = buffers_to_map[i];
+        if (r->storage_buffers[idx].mapped) {
+            continue;
+        }
         VkResult result = vmaMapMemory(
             r->allocator, r->storage_buffers[idx].allocation,
             (void **)&r->storage_buffers[idx].mapped);
@@ -226,17 +541,25 @@ bool pgraph_vk_init_buffers(NV2AState *d, Error **errp)
     }
 
     pgraph_prim_rewrite_init(&r->prim_rewrite_buf);
+    r->index_data_cache =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    r->vertex_inline_data_cache =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
     return true;
 
 fail:
     for (int i = 0; i < BUFFER_COUNT; i++) {
-        if (r->storage_buffers[i].mapped) {
+        if (r->storage_buffers[i].mapped &&
+            r->storage_buffers[i].allocation) {
             vmaUnmapMemory(r->allocator, r->storage_buffers[i].allocation);
             r->storage_buffers[i].mapped = NULL;
         }
         destroy_buffer(pg, &r->storage_buffers[i]);
     }
-    g_free(r->uploaded_bitmap);
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        g_free(r->frames[i].uploaded_bitmap);
+        r->frames[i].uploaded_bitmap = NULL;
+    }
     r->uploaded_bitmap = NULL;
     r->bitmap_size = 0;
     return false;
@@ -248,25 +571,149 @@ void pgraph_vk_finalize_buffers(NV2AState *d)
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     for (int i = 0; i < BUFFER_COUNT; i++) {
-        if (r->storage_buffers[i].mapped) {
+        if (r->storage_buffers[i].mapped &&
+            r->storage_buffers[i].allocation) {
             vmaUnmapMemory(r->allocator, r->storage_buffers[i].allocation);
         }
         destroy_buffer(pg, &r->storage_buffers[i]);
     }
 
     pgraph_prim_rewrite_finalize(&r->prim_rewrite_buf);
-
-    g_free(r->uploaded_bitmap);
+    g_hash_table_destroy(r->index_data_cache);
+    r->index_data_cache = NULL;
+    g_hash_table_destroy(r->vertex_inline_data_cache);
+    r->vertex_inline_data_cache = NULL;
+    g_free(r->narrow_indices);
+    r->narrow_indices = NULL;
+    r->narrow_indices_capacity = 0;
+
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        g_free(r->frames[i].uploaded_bitmap);
+        r->frames[i].uploaded_bitmap = NULL;
+        destroy_retired_buffers(r, &r->frames[i]);
+        if (r->frames[i].retired_buffers) {
+            g_array_free(r->frames[i].retired_buffers, true);
+            r->frames[i].retired_buffers = NULL;
+        }
+    }
     r->uploaded_bitmap = NULL;
 }
 
+static void reset_ring_if_empty(StorageBuffer *b)
+{
+    if (b->buffer_offset != b->ring_tail) {
+        return;
+    }
+
+    // In-flight frames with nothing left in the ring now end at 0 as well
+    b->buffer_offset = b->ring_tail = 0;
+    b->frame_offset = b->frame_wrap_offset = 0;
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        b->frame_ends[i] = 0;
+    }
+}
+
+static bool find_ring_space(StorageBuffer *b, VkDeviceSize size,
+                            VkDeviceAddress alignment, size_t *offset)
+{
+    size_t head = ROUND_UP(b->buffer_offset, alignment);
+
+    if (b->buffer_offset >= b->ring_tail) {
+        assert(!b->frame_wrap_offset);
+        if (head + size <= b->buffer_size) {
+            *offset = head;
+            return true;
+        }
+        if (size < b->ring_tail) {
+            *offset = 0;
+            return true;
+        }
+        return false;
+    }
+
+    if (head + size < b->ring_tail) {
+        *offset = head;
+        return true;
+    }
+    return false;
+}
+
 bool pgraph_vk_buffer_has_space_for(PGRAPHState *pg, int index,
                                     VkDeviceSize size,
                                     VkDeviceAddress alignment)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
     StorageBuffer *b = &r->storage_buffers[index];
-    return (ROUND_UP(b->buffer_offset, alignment) + size) <= b->buffer_size;
+    size_t offset;
+
+    reset_ring_if_empty(b);
+    return find_ring_space(b, size, alignment, &offset);
+}
+
+bool pgraph_vk_buffer_reclaim_space_for(PGRAPHState *pg, int index,
+                                        VkDeviceSize size,
+                                        VkDeviceAddress alignment)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    while (!pgraph_vk_buffer_has_space_for(pg, index, size, alignment)) {
+        if (!pgraph_vk_retire_oldest_frame(r)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+VkDeviceSize pgraph_vk_allocate_from_buffer(PGRAPHState *pg, int index,
+                                            VkDeviceSize size,
+                                            VkDeviceAddress alignment)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    StorageBuffer *b = &r->storage_buffers[index];
+    size_t offset;
+
+    reset_ring_if_empty(b);
+    bool found = find_ring_space(b, size, alignment, &offset);
+    assert(found);
+
+    if (offset < b->buffer_offset) {
+        nv2a_profile_inc_counter(NV2A_PROF_STREAM_RING_WRAP);
+        if (b->frame_offset == b->buffer_offset) {
+            b->frame_offset = 0;
+        } else {
+            b->frame_wrap_offset = b->buffer_offset;
+        }
+    }
+    b->buffer_offset = offset + size;
+    nv2a_profile_add_counter(NV2A_PROF_STREAM_BYTES, size);
+
+    return offset;
+}
+
+void pgraph_vk_buffers_frame_submitted(PGRAPHVkState *r, int frame_index)
+{
+    for (int i = 0; i < ARRAY_SIZE(stream_buffers); i++) {
+        StorageBuffer *b = &r->storage_buffers[stream_buffers[i]];
+        assert(b->frame_offset == b->buffer_offset);
+        b->frame_ends[frame_index] = b->buffer_offset;
+    }
+
+    // Cached data is only kept alive by the frame that streamed it
+    g_hash_table_remove_all(r->index_data_cache);
+    g_hash_table_remove_all(r->vertex_inline_data_cache);
+
+    shrink_scratch_buffers(r, frame_index);
+}
+
+void pgraph_vk_buffers_frame_retired(PGRAPHVkState *r, int frame_index)
+{
+    for (int i = 0; i < ARRAY_SIZE(stream_buffers); i++) {
+        StorageBuffer *b = &r->storage_buffers[stream_buffers[i]];
+        b->ring_tail = b->frame_ends[frame_index];
+    }
+
+    destroy_retired_buffers(r, &r->frames[frame_index]);
 }
 
 VkDeviceSize pgraph_vk_append_to_buffer(PGRAPHState *pg, int index, void **data,
@@ -275,21 +722,22 @@ VkDeviceSize pgraph_vk_append_to_buffer(PGRAPHState *pg, int index, void **data,
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    // Pieces are packed back to back, only the start is aligned
     VkDeviceSize total_size = 0;
     for (int i = 0; i < count; i++) {
         total_size += sizes[i];
     }
-    assert(pgraph_vk_buffer_has_space_for(pg, index, total_size, alignment));
 
     StorageBuffer *b = &r->storage_buffers[index];
-    VkDeviceSize starting_offset = ROUND_UP(b->buffer_offset, alignment);
+    VkDeviceSize starting_offset =
+        pgraph_vk_allocate_from_buffer(pg, index, total_size, alignment);
 
     assert(b->mapped);
 
+    VkDeviceSize offset = starting_offset;
     for (int i = 0; i < count; i++) {
-        b->buffer_offset = ROUND_UP(b->buffer_offset, alignment);
-        memcpy(b->mapped + b->buffer_offset, data[i], sizes[i]);
-        b->buffer_offset += sizes[i];
+        memcpy(b->mapped + offset, data[i], sizes[i]);
+        offset += sizes[i];
     }
 
     return starting_offset;
@@ -17,6 +17,7 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 
 static void create_command_pool(PGRAPHState *pg)
@@ -42,34 +43,443 @@ static void destroy_command_pool(PGRAPHState *pg)
     vkDestroyCommandPool(r->device, r->command_pool, NULL);
 }
 
+static VkSemaphore create_timeline_semaphore(PGRAPHVkState *r)
+{
+    VkSemaphoreTypeCreateInfoKHR type_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR,
+        .initialValue = 0,
+    };
+    VkSemaphoreCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info,
+    };
+    VkSemaphore semaphore;
+    VK_CHECK(vkCreateSemaphore(r->device, &create_info, NULL, &semaphore));
+
+    return semaphore;
+}
+
+static void create_timeline(PGRAPHVkState *r)
+{
+    r->timeline_value = 0;
+    r->timeline = r->timeline_semaphore_extension_enabled ?
+                      create_timeline_semaphore(r) :
+                      VK_NULL_HANDLE;
+}
+
+static void destroy_timeline(PGRAPHVkState *r)
+{
+    if (r->timeline != VK_NULL_HANDLE) {
+        vkDestroySemaphore(r->device, r->timeline, NULL);
+        r->timeline = VK_NULL_HANDLE;
+    }
+}
+
 static void create_command_buffers(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    VkCommandBuffer command_buffers[2 * NUM_FRAMES_IN_FLIGHT];
+
     VkCommandBufferAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
         .commandPool = r->command_pool,
         .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-        .commandBufferCount = ARRAY_SIZE(r->command_buffers),
+        .commandBufferCount = ARRAY_SIZE(command_buffers),
     };
     VK_CHECK(
-        vkAllocateCommandBuffers(r->device, &alloc_info, r->command_buffers));
+        vkAllocateCommandBuffers(r->device, &alloc_info, command_buffers));
+
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
+    };
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame = &r->frames[i];
+        frame->command_buffer = command_buffers[2 * i];
+        frame->aux_command_buffer = command_buffers[2 * i + 1];
+        VK_CHECK(vkCreateSemaphore(r->device, &semaphore_info, NULL,
+                                   &frame->semaphore));
+        VK_CHECK(vkCreateFence(r->device, &fence_info, NULL, &frame->fence));
+        frame->timeline_value = 0;
+        frame->in_flight = false;
+        frame->submit_queued = false;
+        frame->framebuffer_index = 0;
+    }
 
-    r->command_buffer = r->command_buffers[0];
-    r->aux_command_buffer = r->command_buffers[1];
+    r->frame_index = 0;
+    r->frame = &r->frames[0];
+    r->num_frames_in_flight = 0;
+    r->command_buffer = r->frame->command_buffer;
+    r->aux_command_buffer = r->frame->aux_command_buffer;
 }
 
 static void destroy_command_buffers(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    vkFreeCommandBuffers(r->device, r->command_pool,
-                         ARRAY_SIZE(r->command_buffers), r->command_buffers);
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame = &r->frames[i];
+        assert(!frame->in_flight);
+
+        VkCommandBuffer command_buffers[] = { frame->command_buffer,
+                                              frame->aux_command_buffer };
+        vkFreeCommandBuffers(r->device, r->command_pool,
+                             ARRAY_SIZE(command_buffers), command_buffers);
+        vkDestroyFence(r->device, frame->fence, NULL);
+        vkDestroySemaphore(r->device, frame->semaphore, NULL);
 
+        frame->command_buffer = VK_NULL_HANDLE;
+        frame->aux_command_buffer = VK_NULL_HANDLE;
+        frame->fence = VK_NULL_HANDLE;
+        frame->semaphore = VK_NULL_HANDLE;
+    }
+
+    r->frame = NULL;
     r->command_buffer = VK_NULL_HANDLE;
     r->aux_command_buffer = VK_NULL_HANDLE;
 }
 
+static void destroy_frame_framebuffers(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    for (int i = 0; i < frame->framebuffer_index; i++) {
+        vkDestroyFramebuffer(r->device, frame->framebuffers[i], NULL);
+        frame->framebuffers[i] = VK_NULL_HANDLE;
+    }
+    frame->framebuffer_index = 0;
+}
+
+static void wait_for_frame_submitted(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    if (!qatomic_load_acquire(&frame->submit_queued)) {
+        return;
+    }
+
+    qemu_mutex_lock(&r->submit_lock);
+    while (frame->submit_queued) {
+        qemu_cond_wait(&r->submit_cond, &r->submit_lock);
+    }
+    qemu_mutex_unlock(&r->submit_lock);
+}
+
+static void wait_for_timeline_value(PGRAPHVkState *r, VkSemaphore timeline,
+                                    uint64_t value)
+{
+    VkSemaphoreWaitInfoKHR wait_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR,
+        .semaphoreCount = 1,
+        .pSemaphores = &timeline,
+        .pValues = &value,
+    };
+    VK_CHECK(vkWaitSemaphoresKHR(r->device, &wait_info, UINT64_MAX));
+}
+
+static bool frame_completed(PGRAPHVkState *r, FrameInFlight *frame,
+                            uint64_t completed_value)
+{
+    if (r->timeline_semaphore_extension_enabled) {
+        return frame->timeline_value <= completed_value;
+    }
+
+    return vkGetFenceStatus(r->device, frame->fence) == VK_SUCCESS;
+}
+
+static void retire_frame(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    assert(frame->in_flight);
+
+    // The fence can only be waited on once it has been submitted, and the
+    // frame slot must not be reused while the submit thread still has it
+    wait_for_frame_submitted(r, frame);
+
+    if (r->timeline_semaphore_extension_enabled) {
+        wait_for_timeline_value(r, r->timeline, frame->timeline_value);
+    } else {
+        VK_CHECK(vkWaitForFences(r->device, 1, &frame->fence, VK_TRUE,
+                                 UINT64_MAX));
+    }
+    destroy_frame_framebuffers(r, frame);
+    pgraph_vk_reports_frame_retired(r, frame);
+    pgraph_vk_gpu_timer_frame_retired(r, frame - r->frames);
+    bitmap_clear(frame->uploaded_bitmap, 0, r->bitmap_size);
+    pgraph_vk_buffers_frame_retired(r, frame - r->frames);
+    frame->in_flight = false;
+
+    r->num_frames_in_flight -= 1;
+}
+
+/*
+ * Submit the aux (staging sync) and main command buffers of the frame being
+ * recorded. The frame's resources stay reserved until it is retired.
+ */
+static void queue_submit_frame(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    // Render passes recorded in parallel split the frame into several
+    GArray *cmds = frame->recording.submit_cmds;
+    bool split = cmds && cmds->len;
+
+    // The binary semaphore's entry in the value arrays is ignored
+    uint64_t wait_value = 0;
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &wait_value,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &frame->timeline_value,
+    };
+    bool use_timeline = r->timeline_semaphore_extension_enabled;
+
+    // The aux command buffer acquires images uploaded on the transfer queue
+    VkTimelineSemaphoreSubmitInfoKHR transfer_timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .waitSemaphoreValueCount = 1,
+        .pWaitSemaphoreValues = &frame->transfer_wait_value,
+    };
+    bool wait_transfer = frame->transfer_wait_value != 0;
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submit_infos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = wait_transfer ? &transfer_timeline_info : NULL,
+            .waitSemaphoreCount = wait_transfer ? 1 : 0,
+            .pWaitSemaphores = &r->transfer_timeline,
+            .pWaitDstStageMask = &wait_stage,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &frame->aux_command_buffer,
+            .signalSemaphoreCount = 1,
+            .pSignalSemaphores = &frame->semaphore,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .pNext = use_timeline ? &timeline_info : NULL,
+            .commandBufferCount = split ? cmds->len : 1,
+            .pCommandBuffers = split ? (VkCommandBuffer *)cmds->data :
+                                       &frame->command_buffer,
+            .waitSemaphoreCount = 1,
+            .pWaitSemaphores = &frame->semaphore,
+            .pWaitDstStageMask = &wait_stage,
+            .signalSemaphoreCount = use_timeline ? 1 : 0,
+            .pSignalSemaphores = &r->timeline,
+        }
+    };
+    VK_CHECK(vkQueueSubmit(r->queue, ARRAY_SIZE(submit_infos), submit_infos,
+                           use_timeline ? VK_NULL_HANDLE : frame->fence));
+}
+
+static void *submit_thread_func(void *opaque)
+{
+    PGRAPHVkState *r = opaque;
+
+    xemu_thread_topology_register(XEMU_THREAD_LATENCY, "nv2a.vk_submit");
+
+    qemu_mutex_lock(&r->submit_lock);
+    for (;;) {
+        if (!r->submit_queue_len) {
+            if (r->submit_shutdown) {
+                break;
+            }
+            qemu_cond_wait(&r->submit_cond, &r->submit_lock);
+            continue;
+        }
+
+        FrameInFlight *frame = r->submit_queue[r->submit_queue_head];
+        qemu_mutex_unlock(&r->submit_lock);
+
+        queue_submit_frame(r, frame);
+
+        qemu_mutex_lock(&r->submit_lock);
+        r->submit_queue_head =
+            (r->submit_queue_head + 1) % ARRAY_SIZE(r->submit_queue);
+        r->submit_queue_len -= 1;
+        qatomic_store_release(&frame->submit_queued, false);
+        qemu_cond_broadcast(&r->submit_cond);
+    }
+    qemu_mutex_unlock(&r->submit_lock);
+
+    return NULL;
+}
+
+/*
+ * Wait until the submit thread has handed every queued frame to the queue, so
+ * the caller can use the queue itself.
+ */
+void pgraph_vk_wait_for_queued_submits(PGRAPHVkState *r)
+{
+    if (!r->threaded_submit) {
+        return;
+    }
+
+    qemu_mutex_lock(&r->submit_lock);
+    while (r->submit_queue_len) {
+        qemu_cond_wait(&r->submit_cond, &r->submit_lock);
+    }
+    qemu_mutex_unlock(&r->submit_lock);
+}
+
+void pgraph_vk_submit_frame(PGRAPHVkState *r)
+{
+    FrameInFlight *frame = r->frame;
+
+    assert(!frame->in_flight);
+
+    pgraph_vk_reports_frame_submitted(r, frame);
+
+    frame->transfer_wait_value = r->aux_transfer_wait_value;
+    r->aux_transfer_wait_value = 0;
+
+    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT);
+    if (r->timeline_semaphore_extension_enabled) {
+        // Values are taken in queue submission order, which the submit
+        // thread preserves
+        frame->timeline_value = ++r->timeline_value;
+    } else {
+        // Reset here rather than on the submit thread, so a fence status
+        // query never sees the signal from the frame slot's previous use
+        vkResetFences(r->device, 1, &frame->fence);
+    }
+
+    if (r->threaded_submit) {
+        qemu_mutex_lock(&r->submit_lock);
+        assert(r->submit_queue_len < ARRAY_SIZE(r->submit_queue));
+        int tail = (r->submit_queue_head + r->submit_queue_len) %
+                   ARRAY_SIZE(r->submit_queue);
+        r->submit_queue[tail] = frame;
+        r->submit_queue_len += 1;
+        frame->submit_queued = true;
+        qemu_cond_broadcast(&r->submit_cond);
+        qemu_mutex_unlock(&r->submit_lock);
+    } else {
+        queue_submit_frame(r, frame);
+    }
+
+    pgraph_vk_buffers_frame_submitted(r, r->frame_index);
+
+    frame->in_flight = true;
+    frame->submit_index = r->submit_count;
+    frame->start_time = r->command_buffer_start_time;
+    r->submit_count += 1;
+    r->num_frames_in_flight += 1;
+}
+
+/*
+ * Begin recording into the next frame slot without waiting on previously
+ * submitted frames, unless the slot is still in use.
+ */
+void pgraph_vk_advance_frame(PGRAPHVkState *r)
+{
+    r->frame_index = (r->frame_index + 1) % NUM_FRAMES_IN_FLIGHT;
+    r->frame = &r->frames[r->frame_index];
+
+    if (r->frame->in_flight) {
+        nv2a_profile_inc_counter(NV2A_PROF_FRAME_SLOT_WAIT);
+        retire_frame(r, r->frame);
+    }
+
+    r->command_buffer = r->frame->command_buffer;
+    r->aux_command_buffer = r->frame->aux_command_buffer;
+    r->uploaded_bitmap = r->frame->uploaded_bitmap;
+    r->query_pool = r->frame->query_pool;
+}
+
+void pgraph_vk_wait_for_frames_in_flight(PGRAPHVkState *r)
+{
+    // Oldest first
+    for (int i = 1; i <= NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame =
+            &r->frames[(r->frame_index + i) % NUM_FRAMES_IN_FLIGHT];
+        if (frame->in_flight) {
+            retire_frame(r, frame);
+        }
+    }
+}
+
+bool pgraph_vk_retire_oldest_frame(PGRAPHVkState *r)
+{
+    for (int i = 1; i <= NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame =
+            &r->frames[(r->frame_index + i) % NUM_FRAMES_IN_FLIGHT];
+        if (frame->in_flight) {
+            retire_frame(r, frame);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Retire frames the GPU has finished with, oldest first, without waiting.
+ */
+void pgraph_vk_retire_completed_frames(PGRAPHVkState *r)
+{
+    uint64_t completed_value = 0;
+    if (r->timeline_semaphore_extension_enabled) {
+        VK_CHECK(vkGetSemaphoreCounterValueKHR(r->device, r->timeline,
+                                               &completed_value));
+    }
+
+    for (int i = 1; i <= NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame =
+            &r->frames[(r->frame_index + i) % NUM_FRAMES_IN_FLIGHT];
+        if (!frame->in_flight) {
+            continue;
+        }
+        if (!frame_completed(r, frame, completed_value)) {
+            break;
+        }
+        retire_frame(r, frame);
+    }
+}
+
+/*
+ * Wait for submitted frames which may reference a resource last used at
+ * draw_time.
+ */
+void pgraph_vk_wait_for_draw_time(PGRAPHVkState *r, unsigned int draw_time)
+{
+    for (int i = 1; i <= NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame =
+            &r->frames[(r->frame_index + i) % NUM_FRAMES_IN_FLIGHT];
+        if (frame->in_flight && frame->start_time <= draw_time) {
+            retire_frame(r, frame);
+        }
+    }
+}
+
+void pgraph_vk_wait_for_submit(PGRAPHVkState *r, uint32_t submit_index)
+{
+    for (int i = 1; i <= NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame =
+            &r->frames[(r->frame_index + i) % NUM_FRAMES_IN_FLIGHT];
+        if (frame->in_flight && frame->submit_index <= submit_index) {
+            retire_frame(r, frame);
+        }
+    }
+}
+
+/*
+ * Complete the ownership transfer of images uploaded on the transfer queue.
+ * The submit of the command buffer must wait for the transfers to finish.
+ */
+static void record_transfer_acquires(PGRAPHVkState *r, VkCommandBuffer cmd)
+{
+    if (!r->transfer_acquires->len) {
+        return;
+    }
+
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0,
+                         NULL, r->transfer_acquires->len,
+                         (VkImageMemoryBarrier *)r->transfer_acquires->data);
+    g_array_set_size(r->transfer_acquires, 0);
+    r->aux_transfer_wait_value = r->transfer_timeline_value;
+}
+
 VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -82,6 +492,8 @@ VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg)
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
     VK_CHECK(vkBeginCommandBuffer(r->aux_command_buffer, &begin_info));
+    pgraph_vk_gpu_timer_reset(r, r->aux_command_buffer);
+    record_transfer_acquires(r, r->aux_command_buffer);
 
     return r->aux_command_buffer;
 }
@@ -94,26 +506,244 @@ void pgraph_vk_end_single_time_commands(PGRAPHState *pg, VkCommandBuffer cmd)
 
     VK_CHECK(vkEndCommandBuffer(cmd));
 
+    pgraph_vk_wait_for_queued_submits(r);
+
+    // Only wait for this submit rather than the whole queue
+    bool use_timeline = r->timeline_semaphore_extension_enabled;
+    uint64_t signal_value = use_timeline ? ++r->timeline_value : 0;
+    uint64_t transfer_wait_value = r->aux_transfer_wait_value;
+    r->aux_transfer_wait_value = 0;
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .waitSemaphoreValueCount = transfer_wait_value ? 1 : 0,
+        .pWaitSemaphoreValues = &transfer_wait_value,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value,
+    };
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
     VkSubmitInfo submit_info = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = use_timeline ? &timeline_info : NULL,
+        .waitSemaphoreCount = transfer_wait_value ? 1 : 0,
+        .pWaitSemaphores = &r->transfer_timeline,
+        .pWaitDstStageMask = &wait_stage,
         .commandBufferCount = 1,
         .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = use_timeline ? 1 : 0,
+        .pSignalSemaphores = &r->timeline,
     };
     VK_CHECK(vkQueueSubmit(r->queue, 1, &submit_info, VK_NULL_HANDLE));
     nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_AUX);
-    VK_CHECK(vkQueueWaitIdle(r->queue));
+    if (use_timeline) {
+        wait_for_timeline_value(r, r->timeline, signal_value);
+    } else {
+        VK_CHECK(vkQueueWaitIdle(r->queue));
+    }
+    pgraph_vk_gpu_timer_aux_complete(r);
 
     r->in_aux_command_buffer = false;
 }
 
+/*
+ * Record into the transfer queue's command buffer. Only copies into images
+ * with no contents to preserve belong here, as nothing orders this against
+ * the graphics queue.
+ */
+VkCommandBuffer pgraph_vk_begin_transfer_commands(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    assert(r->transfer_queue_enabled);
+    assert(!r->in_transfer_command_buffer);
+    r->in_transfer_command_buffer = true;
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VK_CHECK(vkBeginCommandBuffer(r->transfer_command_buffer, &begin_info));
+
+    return r->transfer_command_buffer;
+}
+
+void pgraph_vk_end_transfer_commands(PGRAPHState *pg, VkCommandBuffer cmd)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    assert(r->in_transfer_command_buffer);
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+
+    uint64_t signal_value = ++r->transfer_timeline_value;
+    VkTimelineSemaphoreSubmitInfoKHR timeline_info = {
+        .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR,
+        .signalSemaphoreValueCount = 1,
+        .pSignalSemaphoreValues = &signal_value,
+    };
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .pNext = &timeline_info,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmd,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &r->transfer_timeline,
+    };
+    VK_CHECK(vkQueueSubmit(r->transfer_queue, 1, &submit_info,
+                           VK_NULL_HANDLE));
+    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_TRANSFER);
+
+    // The staging buffer is reused by the next upload
+    wait_for_timeline_value(r, r->transfer_timeline, signal_value);
+
+    r->in_transfer_command_buffer = false;
+}
+
+/*
+ * Hand an image written on the transfer queue over to the graphics queue,
+ * transitioning it to new_layout. The matching acquire is recorded at the
+ * start of the next aux command buffer.
+ */
+void pgraph_vk_release_image_to_graphics(PGRAPHState *pg, VkCommandBuffer cmd,
+                                         VkImage image,
+                                         VkImageAspectFlags aspect,
+                                         VkImageLayout layout,
+                                         VkImageLayout new_layout)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .oldLayout = layout,
+        .newLayout = new_layout,
+        .srcQueueFamilyIndex = r->transfer_queue_family,
+        .dstQueueFamilyIndex = r->queue_family,
+        .image = image,
+        .subresourceRange.aspectMask = aspect,
+        .subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS,
+        .subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS,
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, 0,
+                         NULL, 1, &barrier);
+
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    g_array_append_val(r->transfer_acquires, barrier);
+}
+
+/* Drop the pending acquire of an image about to be destroyed */
+void pgraph_vk_discard_image_acquire(PGRAPHVkState *r, VkImage image)
+{
+    for (int i = r->transfer_acquires->len - 1; i >= 0; i--) {
+        if (g_array_index(r->transfer_acquires, VkImageMemoryBarrier, i)
+                .image == image) {
+            g_array_remove_index_fast(r->transfer_acquires, i);
+        }
+    }
+}
+
+static void init_transfer_queue(PGRAPHVkState *r)
+{
+    r->transfer_acquires =
+        g_array_new(FALSE, FALSE, sizeof(VkImageMemoryBarrier));
+    r->aux_transfer_wait_value = 0;
+    r->in_transfer_command_buffer = false;
+    r->transfer_timeline_value = 0;
+
+    if (!r->transfer_queue_enabled) {
+        r->transfer_timeline = VK_NULL_HANDLE;
+        return;
+    }
+
+    VkCommandPoolCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = r->transfer_queue_family,
+    };
+    VK_CHECK(vkCreateCommandPool(r->device, &create_info, NULL,
+                                 &r->transfer_command_pool));
+
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = r->transfer_command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VK_CHECK(vkAllocateCommandBuffers(r->device, &alloc_info,
+                                      &r->transfer_command_buffer));
+
+    r->transfer_timeline = create_timeline_semaphore(r);
+}
+
+static void finalize_transfer_queue(PGRAPHVkState *r)
+{
+    g_array_free(r->transfer_acquires, TRUE);
+    r->transfer_acquires = NULL;
+
+    if (!r->transfer_queue_enabled) {
+        return;
+    }
+
+    vkFreeCommandBuffers(r->device, r->transfer_command_pool, 1,
+                         &r->transfer_command_buffer);
+    vkDestroyCommandPool(r->device, r->transfer_command_pool, NULL);
+    vkDestroySemaphore(r->device, r->transfer_timeline, NULL);
+    r->transfer_command_buffer = VK_NULL_HANDLE;
+    r->transfer_command_pool = VK_NULL_HANDLE;
+    r->transfer_timeline = VK_NULL_HANDLE;
+}
+
+static void init_submit_thread(PGRAPHVkState *r)
+{
+    r->threaded_submit = g_config.display.vulkan.threaded_submit;
+    if (!r->threaded_submit) {
+        return;
+    }
+
+    qemu_mutex_init(&r->submit_lock);
+    qemu_cond_init(&r->submit_cond);
+    r->submit_queue_head = 0;
+    r->submit_queue_len = 0;
+    r->submit_shutdown = false;
+    qemu_thread_create(&r->submit_thread, "nv2a.vk_submit", submit_thread_func,
+                       r, QEMU_THREAD_JOINABLE);
+}
+
+static void finalize_submit_thread(PGRAPHVkState *r)
+{
+    if (!r->threaded_submit) {
+        return;
+    }
+
+    qemu_mutex_lock(&r->submit_lock);
+    r->submit_shutdown = true;
+    qemu_cond_broadcast(&r->submit_cond);
+    qemu_mutex_unlock(&r->submit_lock);
+    qemu_thread_join(&r->submit_thread);
+
+    qemu_cond_destroy(&r->submit_cond);
+    qemu_mutex_destroy(&r->submit_lock);
+    r->threaded_submit = false;
+}
+
 void pgraph_vk_init_command_buffers(PGRAPHState *pg)
 {
+    create_timeline(pg->vk_renderer_state);
+    init_transfer_queue(pg->vk_renderer_state);
     create_command_pool(pg);
     create_command_buffers(pg);
+    init_submit_thread(pg->vk_renderer_state);
+    pgraph_vk_init_recording(pg);
 }
 
 void pgraph_vk_finalize_command_buffers(PGRAPHState *pg)
 {
+    pgraph_vk_finalize_recording(pg);
+    finalize_submit_thread(pg->vk_renderer_state);
     destroy_command_buffers(pg);
     destroy_command_pool(pg);
+    finalize_transfer_queue(pg->vk_renderer_state);
+    destroy_timeline(pg->vk_renderer_state);
 }
\ No newline at end of file
@@ -0,0 +1,620 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "ui/xemu-settings.h"
+#include "renderer.h"
+
+#ifdef __ANDROID__
+#include <android/log.h>
+#endif
+
+/*
+ * Device profiles record what a GPU and driver can do and how fast a few
+ * paths are on it, so the renderer can pick between alternatives without
+ * hardcoding vendors. The probe runs once per driver build, the result is
+ * kept next to the pipeline cache and reused on later starts.
+ *
+ * Profile file layout:
+ *   char[8]              magic
+ *   DeviceProfileRecord  record
+ */
+static const char device_profile_magic[8] = "NV2ADVP1";
+
+enum {
+    DEVICE_CAP_GEOMETRY_SHADER = 1 << 0,
+    DEVICE_CAP_BARYCENTRICS = 1 << 1,
+    DEVICE_CAP_TEXTURE_BC = 1 << 2,
+    DEVICE_CAP_TEXTURE_ASTC = 1 << 3,
+    DEVICE_CAP_EXTERNAL_MEMORY_HOST = 1 << 4,
+    DEVICE_CAP_EXTENDED_DYNAMIC_STATE = 1 << 5,
+    DEVICE_CAP_EXTENDED_DYNAMIC_STATE3 = 1 << 6,
+    DEVICE_CAP_VERTEX_INPUT_DYNAMIC_STATE = 1 << 7,
+    DEVICE_CAP_GRAPHICS_PIPELINE_LIBRARY = 1 << 8,
+    DEVICE_CAP_UNIFIED_MEMORY = 1 << 9,
+};
+
+typedef struct DeviceProfileRecord {
+    uint32_t caps;
+    float geometry_shader_cost;
+    float pipeline_compile_ms;
+    float pipeline_cache_hit_ms;
+} DeviceProfileRecord;
+
+// Geometry shader slowdown above which barycentrics are used instead
+#define GEOMETRY_SHADER_MAX_COST 1.5f
+
+// Pipelines slower than this to compile get a larger in-memory cache
+#define SLOW_PIPELINE_COMPILE_MS 10.0f
+
+// Memory budget cap when the GPU shares system memory with everything else
+#define UNIFIED_MEMORY_BUDGET_PERCENT 70
+
+// Limits used by the low memory profile
+#define LOW_MEMORY_PIPELINE_CACHE_SIZE 512
+#define LOW_MEMORY_BUDGET_PERCENT 50
+
+#define BENCH_TARGET_SIZE 256
+#define BENCH_TRIANGLES_PER_INSTANCE 4096
+#define BENCH_INSTANCES 64
+#define BENCH_RUNS 3
+
+static const char bench_vert_glsl[] =
+    "#version 450\n"
+    "layout(location = 0) out vec4 v_color;\n"
+    "void main() {\n"
+    "    int tri = gl_VertexIndex / 3;\n"
+    "    int corner = gl_VertexIndex % 3;\n"
+    "    vec2 base = vec2(float(tri % 64), float((tri / 64) % 64)) / 32.0 -\n"
+    "                1.0 + float(gl_InstanceIndex) / 4096.0;\n"
+    "    vec2 offset = vec2(corner == 1 ? 1.0 : 0.0,\n"
+    "                       corner == 2 ? 1.0 : 0.0) / 16.0;\n"
+    "    gl_Position = vec4(base + offset, 0.5, 1.0);\n"
+    "    v_color = vec4(base * 0.5 + 0.5, float(corner) * 0.5, 1.0);\n"
+    "}\n";
+
+/* Pass-through, as for the primitive attributes the renderer generates */
+static const char bench_geom_glsl[] =
+    "#version 450\n"
+    "layout(triangles) in;\n"
+    "layout(triangle_strip, max_vertices = 3) out;\n"
+    "layout(location = 0) in vec4 v_color[];\n"
+    "layout(location = 0) out vec4 g_color;\n"
+    "void main() {\n"
+    "    for (int i = 0; i < 3; i++) {\n"
+    "        gl_Position = gl_in[i].gl_Position;\n"
+    "        g_color = v_color[i];\n"
+    "        EmitVertex();\n"
+    "    }\n"
+    "    EndPrimitive();\n"
+    "}\n";
+
+/*
+ * The salt keeps the driver's own shader cache from answering the cold
+ * pipeline compile.
+ */
+static const char bench_frag_glsl_fmt[] =
+    "#version 450\n"
+    "layout(location = 0) in vec4 color;\n"
+    "layout(location = 0) out vec4 out_color;\n"
+    "void main() {\n"
+    "    out_color = color + vec4(%u.0 / 4294967296.0);\n"
+    "}\n";
+
+typedef struct DeviceBench {
+    VkImage image;
+    VmaAllocation allocation;
+    VkImageView image_view;
+    VkRenderPass render_pass;
+    VkFramebuffer framebuffer;
+    VkPipelineLayout pipeline_layout;
+    ShaderModuleInfo *vert, *geom, *frag;
+} DeviceBench;
+
+static char *get_device_profile_path(PGRAPHVkState *r)
+{
+    const uint8_t *uuid = r->device_props.pipelineCacheUUID;
+    char uuid_str[VK_UUID_SIZE * 2 + 1];
+
+    for (int i = 0; i < VK_UUID_SIZE; i++) {
+        snprintf(&uuid_str[i * 2], 3, "%02x", uuid[i]);
+    }
+
+    return g_strdup_printf("%sdevice_profiles/%08x_%08x_%08x_%s.bin",
+                           xemu_settings_get_base_path(),
+                           r->device_props.vendorID,
+                           r->device_props.deviceID,
+                           r->device_props.driverVersion, uuid_str);
+}
+
+static bool load_device_profile(PGRAPHVkState *r, DeviceProfileRecord *record)
+{
+    g_autofree char *path = get_device_profile_path(r);
+    g_autofree gchar *contents = NULL;
+    gsize size;
+
+    if (!g_file_get_contents(path, &contents, &size, NULL) ||
+        size != sizeof(device_profile_magic) + sizeof(*record) ||
+        memcmp(contents, device_profile_magic, sizeof(device_profile_magic))) {
+        return false;
+    }
+
+    memcpy(record, contents + sizeof(device_profile_magic), sizeof(*record));
+    return true;
+}
+
+static void save_device_profile(PGRAPHVkState *r,
+                                const DeviceProfileRecord *record)
+{
+    g_autofree char *dir =
+        g_strdup_printf("%sdevice_profiles", xemu_settings_get_base_path());
+    qemu_mkdir(dir);
+
+    g_autoptr(GByteArray) data = g_byte_array_new();
+    g_byte_array_append(data, (const guint8 *)device_profile_magic,
+                        sizeof(device_profile_magic));
+    g_byte_array_append(data, (const guint8 *)record, sizeof(*record));
+
+    g_autofree char *path = get_device_profile_path(r);
+    if (!g_file_set_contents(path, (const gchar *)data->data, data->len,
+                             NULL)) {
+        fprintf(stderr, "nv2a: Failed to write device profile to %s\n", path);
+    }
+}
+
+static bool has_device_extension(PGRAPHVkState *r, const char *name)
+{
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(r->physical_device, NULL, &count,
+                                         NULL);
+    g_autofree VkExtensionProperties *props =
+        g_new(VkExtensionProperties, count);
+    vkEnumerateDeviceExtensionProperties(r->physical_device, NULL, &count,
+                                         props);
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!strcmp(props[i].extensionName, name)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Integrated and mobile GPUs share memory with the rest of the system */
+static bool has_unified_memory(PGRAPHVkState *r)
+{
+    return r->device_props.deviceType ==
+               VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+           r->device_props.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+}
+
+static uint32_t probe_capabilities(PGRAPHVkState *r)
+{
+    uint32_t caps = 0;
+
+    VkPhysicalDeviceFeatures features;
+    vkGetPhysicalDeviceFeatures(r->physical_device, &features);
+
+    if (features.geometryShader) {
+        caps |= DEVICE_CAP_GEOMETRY_SHADER;
+    }
+    if (features.textureCompressionBC) {
+        caps |= DEVICE_CAP_TEXTURE_BC;
+    }
+    if (features.textureCompressionASTC_LDR) {
+        caps |= DEVICE_CAP_TEXTURE_ASTC;
+    }
+    if (r->fragment_shader_barycentric_extension_enabled) {
+        caps |= DEVICE_CAP_BARYCENTRICS;
+    }
+    if (has_device_extension(r, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+        caps |= DEVICE_CAP_EXTERNAL_MEMORY_HOST;
+    }
+    if (r->extended_dynamic_state_extension_enabled) {
+        caps |= DEVICE_CAP_EXTENDED_DYNAMIC_STATE;
+    }
+    if (r->extended_dynamic_state3_extension_enabled) {
+        caps |= DEVICE_CAP_EXTENDED_DYNAMIC_STATE3;
+    }
+    if (r->vertex_input_dynamic_state_extension_enabled) {
+        caps |= DEVICE_CAP_VERTEX_INPUT_DYNAMIC_STATE;
+    }
+    if (r->graphics_pipeline_library_extension_enabled) {
+        caps |= DEVICE_CAP_GRAPHICS_PIPELINE_LIBRARY;
+    }
+    if (has_unified_memory(r)) {
+        caps |= DEVICE_CAP_UNIFIED_MEMORY;
+    }
+
+    return caps;
+}
+
+static void create_bench_target(PGRAPHVkState *r, DeviceBench *b)
+{
+    VkImageCreateInfo image_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent = { BENCH_TARGET_SIZE, BENCH_TARGET_SIZE, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
+                            &alloc_create_info, &b->image, &b->allocation,
+                            NULL));
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_BENCH],
+                                 b->allocation, false);
+
+    VkImageViewCreateInfo image_view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = b->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.layerCount = 1,
+    };
+    VK_CHECK(vkCreateImageView(r->device, &image_view_create_info, NULL,
+                               &b->image_view));
+
+    VkAttachmentDescription attachment = {
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+        .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+    VkAttachmentReference color_reference = {
+        0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    };
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_reference,
+    };
+    VkRenderPassCreateInfo render_pass_create_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+    };
+    VK_CHECK(vkCreateRenderPass(r->device, &render_pass_create_info, NULL,
+                                &b->render_pass));
+
+    VkFramebufferCreateInfo framebuffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = b->render_pass,
+        .attachmentCount = 1,
+        .pAttachments = &b->image_view,
+        .width = BENCH_TARGET_SIZE,
+        .height = BENCH_TARGET_SIZE,
+        .layers = 1,
+    };
+    VK_CHECK(vkCreateFramebuffer(r->device, &framebuffer_create_info, NULL,
+                                 &b->framebuffer));
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+    };
+    VK_CHECK(vkCreatePipelineLayout(r->device, &pipeline_layout_info, NULL,
+                                    &b->pipeline_layout));
+}
+
+static void destroy_bench_target(PGRAPHVkState *r, DeviceBench *b)
+{
+    vkDestroyPipelineLayout(r->device, b->pipeline_layout, NULL);
+    vkDestroyFramebuffer(r->device, b->framebuffer, NULL);
+    vkDestroyRenderPass(r->device, b->render_pass, NULL);
+    vkDestroyImageView(r->device, b->image_view, NULL);
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_BENCH],
+                                 b->allocation, true);
+    vmaDestroyImage(r->allocator, b->image, b->allocation);
+}
+
+static VkPipeline create_bench_pipeline(PGRAPHVkState *r, DeviceBench *b,
+                                        VkPipelineCache cache,
+                                        bool with_geometry_shader)
+{
+    VkPipelineShaderStageCreateInfo shader_stages[3];
+    int num_stages = 0;
+
+    shader_stages[num_stages++] = (VkPipelineShaderStageCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_VERTEX_BIT,
+        .module = b->vert->module,
+        .pName = "main",
+    };
+    if (with_geometry_shader) {
+        shader_stages[num_stages++] = (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_GEOMETRY_BIT,
+            .module = b->geom->module,
+            .pName = "main",
+        };
+    }
+    shader_stages[num_stages++] = (VkPipelineShaderStageCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+        .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .module = b->frag->module,
+        .pName = "main",
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    };
+
+    VkViewport viewport = {
+        .width = BENCH_TARGET_SIZE,
+        .height = BENCH_TARGET_SIZE,
+        .maxDepth = 1.0f,
+    };
+    VkRect2D scissor = {
+        .extent = { BENCH_TARGET_SIZE, BENCH_TARGET_SIZE },
+    };
+    VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .pViewports = &viewport,
+        .scissorCount = 1,
+        .pScissors = &scissor,
+    };
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .lineWidth = 1.0f,
+        .cullMode = VK_CULL_MODE_NONE,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+    };
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    VkPipelineColorBlendAttachmentState color_blend_attachment = {
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+        .blendEnable = VK_TRUE,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ONE,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+    };
+    VkPipelineColorBlendStateCreateInfo color_blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attachment,
+    };
+
+    VkGraphicsPipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = num_stages,
+        .pStages = shader_stages,
+        .pVertexInputState = &vertex_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pColorBlendState = &color_blending,
+        .layout = b->pipeline_layout,
+        .renderPass = b->render_pass,
+        .subpass = 0,
+    };
+
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateGraphicsPipelines(r->device, cache, 1, &pipeline_info,
+                                       NULL, &pipeline));
+    return pipeline;
+}
+
+/* Returns the wall time in ms to record, submit and finish the draws */
+static float time_bench_draws(PGRAPHState *pg, DeviceBench *b,
+                              VkPipeline pipeline)
+{
+    int64_t start = get_clock_realtime();
+
+    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+
+    VkClearValue clear_value = { 0 };
+    VkRenderPassBeginInfo render_pass_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = b->render_pass,
+        .framebuffer = b->framebuffer,
+        .renderArea.extent = { BENCH_TARGET_SIZE, BENCH_TARGET_SIZE },
+        .clearValueCount = 1,
+        .pClearValues = &clear_value,
+    };
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    if (pipeline != VK_NULL_HANDLE) {
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        vkCmdDraw(cmd, 3 * BENCH_TRIANGLES_PER_INSTANCE, BENCH_INSTANCES, 0,
+                  0);
+    }
+    vkCmdEndRenderPass(cmd);
+
+    pgraph_vk_end_single_time_commands(pg, cmd);
+
+    return (get_clock_realtime() - start) / 1e6f;
+}
+
+static void run_benchmark(PGRAPHState *pg, DeviceProfileRecord *record)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    DeviceBench b = { 0 };
+
+    create_bench_target(r, &b);
+
+    g_autofree char *frag_glsl =
+        g_strdup_printf(bench_frag_glsl_fmt, g_random_int());
+    b.vert = pgraph_vk_create_shader_module_from_glsl(
+        r, VK_SHADER_STAGE_VERTEX_BIT, bench_vert_glsl);
+    b.frag = pgraph_vk_create_shader_module_from_glsl(
+        r, VK_SHADER_STAGE_FRAGMENT_BIT, frag_glsl);
+
+    /*
+     * Pipeline cache behaviour: compile once into an empty cache, then
+     * compile the same pipeline again through it.
+     */
+    VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+    };
+    VkPipelineCache cache;
+    VK_CHECK(vkCreatePipelineCache(r->device, &cache_info, NULL, &cache));
+
+    int64_t start = get_clock_realtime();
+    VkPipeline plain = create_bench_pipeline(r, &b, cache, false);
+    record->pipeline_compile_ms = (get_clock_realtime() - start) / 1e6f;
+
+    start = get_clock_realtime();
+    VkPipeline cached = create_bench_pipeline(r, &b, cache, false);
+    record->pipeline_cache_hit_ms = (get_clock_realtime() - start) / 1e6f;
+    vkDestroyPipeline(r->device, cached, NULL);
+
+    /*
+     * Geometry shader cost: the same draws with and without a pass-through
+     * geometry stage, less the cost of an empty submission.
+     */
+    record->geometry_shader_cost = 0;
+    if ((record->caps & DEVICE_CAP_GEOMETRY_SHADER) &&
+        r->enabled_physical_device_features.geometryShader) {
+        b.geom = pgraph_vk_create_shader_module_from_glsl(
+            r, VK_SHADER_STAGE_GEOMETRY_BIT, bench_geom_glsl);
+        VkPipeline with_gs = create_bench_pipeline(r, &b, cache, true);
+
+        float empty_ms = G_MAXFLOAT, plain_ms = G_MAXFLOAT, gs_ms = G_MAXFLOAT;
+        time_bench_draws(pg, &b, plain); // Warm up
+        for (int i = 0; i < BENCH_RUNS; i++) {
+            empty_ms = MIN(empty_ms, time_bench_draws(pg, &b, VK_NULL_HANDLE));
+            plain_ms = MIN(plain_ms, time_bench_draws(pg, &b, plain));
+            gs_ms = MIN(gs_ms, time_bench_draws(pg, &b, with_gs));
+        }
+        if (plain_ms > empty_ms) {
+            record->geometry_shader_cost =
+                MAX(gs_ms - empty_ms, 0) / (plain_ms - empty_ms);
+        }
+
+        vkDestroyPipeline(r->device, with_gs, NULL);
+        pgraph_vk_destroy_shader_module(r, b.geom);
+    }
+
+    vkDestroyPipeline(r->device, plain, NULL);
+    vkDestroyPipelineCache(r->device, cache, NULL);
+    pgraph_vk_destroy_shader_module(r, b.frag);
+    pgraph_vk_destroy_shader_module(r, b.vert);
+    destroy_bench_target(r, &b);
+}
+
+static void apply_device_profile(PGRAPHVkState *r,
+                                 const DeviceProfileRecord *record)
+{
+    DeviceProfile *p = &r->device_profile;
+
+    p->caps = record->caps;
+    p->geometry_shader_cost = record->geometry_shader_cost;
+    p->pipeline_compile_ms = record->pipeline_compile_ms;
+    p->pipeline_cache_hit_ms = record->pipeline_cache_hit_ms;
+
+    /*
+     * Only a measured choice overrides the vendor defaults, and only when
+     * both paths are usable and the user left it on auto.
+     */
+    if (g_config.display.vulkan.geometry_shaders ==
+            CONFIG_DISPLAY_VULKAN_GEOMETRY_SHADERS_AUTO &&
+        record->geometry_shader_cost > 0 &&
+        r->enabled_physical_device_features.geometryShader &&
+        r->fragment_shader_barycentric_extension_enabled) {
+        r->use_geometry_shader =
+            record->geometry_shader_cost <= GEOMETRY_SHADER_MAX_COST;
+    }
+
+    // Drivers with their own shader cache gain little from ours
+    p->pipeline_cache_effective =
+        record->pipeline_compile_ms < 1.0f ||
+        record->pipeline_cache_hit_ms < 0.5f * record->pipeline_compile_ms;
+    p->pipeline_cache_size =
+        record->pipeline_compile_ms > SLOW_PIPELINE_COMPILE_MS ? 4096 : 2048;
+    p->memory_budget_cap_percent =
+        (record->caps & DEVICE_CAP_UNIFIED_MEMORY) ?
+            UNIFIED_MEMORY_BUDGET_PERCENT : 100;
+    if (r->low_memory) {
+        p->pipeline_cache_size = LOW_MEMORY_PIPELINE_CACHE_SIZE;
+        p->memory_budget_cap_percent =
+            MIN(p->memory_budget_cap_percent, LOW_MEMORY_BUDGET_PERCENT);
+    }
+
+    fprintf(stderr,
+            "nv2a: Device profile: caps=%#x gs_cost=%.2f compile=%.2fms "
+            "cache_hit=%.2fms\n",
+            p->caps, p->geometry_shader_cost, p->pipeline_compile_ms,
+            p->pipeline_cache_hit_ms);
+    fprintf(stderr,
+            "nv2a: Primitive attributes from %s, pipeline cache %s "
+            "(%d entries), memory budget cap %d%%\n",
+            r->use_geometry_shader ? "geometry shader" : "barycentrics",
+            p->pipeline_cache_effective ? "persisted" : "not persisted",
+            p->pipeline_cache_size, p->memory_budget_cap_percent);
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_INFO, "xemu-vk",
+                        "Device profile: caps=%#x gs_cost=%.2f "
+                        "compile=%.2fms cache_hit=%.2fms gs=%d",
+                        p->caps, p->geometry_shader_cost,
+                        p->pipeline_compile_ms, p->pipeline_cache_hit_ms,
+                        r->use_geometry_shader);
+#endif
+}
+
+void pgraph_vk_init_device_profile(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    DeviceProfileRecord record;
+
+    uint32_t caps = probe_capabilities(r);
+
+    // Capabilities can change with settings that enable extensions
+    if (!load_device_profile(r, &record) || record.caps != caps) {
+        memset(&record, 0, sizeof(record));
+        record.caps = caps;
+        run_benchmark(pg, &record);
+        save_device_profile(r, &record);
+    }
+
+    apply_device_profile(r, &record);
+}
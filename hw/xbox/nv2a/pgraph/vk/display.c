@@ -68,25 +68,6 @@ bool pgraph_vk_gl_external_memory_available(void)
 }
 #endif
 
-static uint8_t *convert_texture_data__CR8YB8CB8YA8(uint8_t *data_out,
-                                                   const uint8_t *data_in,
-                                                   unsigned int width,
-                                                   unsigned int height,
-                                                   unsigned int pitch)
-{
-    int x, y;
-    for (y = 0; y < height; y++) {
-        const uint8_t *line = &data_in[y * pitch];
-        const uint32_t row_offset = y * width;
-        for (x = 0; x < width; x++) {
-            uint8_t *pixel = &data_out[(row_offset + x) * 4];
-            convert_yuy2_to_rgb(line, x, &pixel[0], &pixel[1], &pixel[2]);
-            pixel[3] = 255;
-        }
-    }
-    return data_out;
-}
-
 static float pvideo_calculate_scale(unsigned int din_dout,
                                     unsigned int output_size)
 {
@@ -111,6 +92,9 @@ static void destroy_pvideo_image(PGRAPHState *pg)
     }
 
     if (d->pvideo.image != VK_NULL_HANDLE) {
+        pgraph_vk_account_allocation(r,
+                                     r->image_mem_accounts[IMAGE_MEM_DISPLAY],
+                                     d->pvideo.allocation, true);
         vmaDestroyImage(r->allocator, d->pvideo.image, d->pvideo.allocation);
         d->pvideo.image = VK_NULL_HANDLE;
         d->pvideo.allocation = VK_NULL_HANDLE;
@@ -122,11 +106,15 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
     PGRAPHVkState *r = pg->vk_renderer_state;
     PGRAPHVkDisplayState *d = &r->display;
 
-    if (d->pvideo.image == VK_NULL_HANDLE || d->pvideo.width != width ||
-        d->pvideo.height != height) {
-        destroy_pvideo_image(pg);
+    if (d->pvideo.image != VK_NULL_HANDLE && d->pvideo.width == width &&
+        d->pvideo.height == height) {
+        return;
     }
 
+    destroy_pvideo_image(pg);
+    d->pvideo.width = width;
+    d->pvideo.height = height;
+
     VkImageCreateInfo image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
@@ -149,6 +137,8 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
     VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
                             &alloc_create_info, &d->pvideo.image,
                             &d->pvideo.allocation, NULL));
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_DISPLAY],
+                                 d->pvideo.allocation, false);
 
     VkImageViewCreateInfo image_view_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -166,7 +156,7 @@ static void create_pvideo_image(PGRAPHState *pg, int width, int height)
 
     VkSamplerCreateInfo sampler_create_info = {
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
-        .magFilter = VK_FILTER_LINEAR,
+        .magFilter = VK_FILTER_NEAREST,
         .minFilter = VK_FILTER_NEAREST,
         .addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT,
         .addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT,
@@ -184,20 +174,32 @@ static void upload_pvideo_image(PGRAPHState *pg, PvideoState state)
     PGRAPHVkState *r = pg->vk_renderer_state;
     PGRAPHVkDisplayState *disp = &r->display;
 
-    create_pvideo_image(pg, state.in_width, state.in_height);
+    // The packed CR8YB8CB8YA8 data is uploaded as is, one RGBA texel per
+    // pair of pixels, and converted to RGB by the display shader
+    int width = (state.in_width + 1) / 2;
+    size_t row_size = width * 4;
+    create_pvideo_image(pg, width, state.in_height);
 
     // FIXME: Dirty tracking. We don't necessarily need to upload so much.
 
     // Copy texture data to mapped device buffer
     uint8_t *mapped_memory_ptr;
 
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_SRC,
+                                     row_size * state.in_height);
     VK_CHECK(vmaMapMemory(r->allocator,
                           r->storage_buffers[BUFFER_STAGING_SRC].allocation,
                           (void *)&mapped_memory_ptr));
 
-    convert_texture_data__CR8YB8CB8YA8(
-        mapped_memory_ptr, d->vram_ptr + state.base + state.offset,
-        state.in_width, state.in_height, state.pitch);
+    const uint8_t *src = d->vram_ptr + state.base + state.offset;
+    if (state.pitch == row_size) {
+        memcpy(mapped_memory_ptr, src, row_size * state.in_height);
+    } else {
+        for (int y = 0; y < state.in_height; y++) {
+            memcpy(mapped_memory_ptr + y * row_size, src + y * state.pitch,
+                   MIN(row_size, state.pitch));
+        }
+    }
 
     vmaFlushAllocation(r->allocator,
                        r->storage_buffers[BUFFER_STAGING_SRC].allocation, 0,
@@ -236,7 +238,7 @@ static void upload_pvideo_image(PGRAPHState *pg, PvideoState state)
         .imageSubresource.baseArrayLayer = 0,
         .imageSubresource.layerCount = 1,
         .imageOffset = (VkOffset3D){ 0, 0, 0 },
-        .imageExtent = (VkExtent3D){ state.in_width, state.in_height, 1 },
+        .imageExtent = (VkExtent3D){ width, state.in_height, 1 },
     };
     vkCmdCopyBufferToImage(cmd, r->storage_buffers[BUFFER_STAGING_SRC].buffer,
                            disp->pvideo.image,
@@ -264,6 +266,28 @@ static const char *display_frag_glsl =
     "    vec3 pvideo_color_key;\n"
     "};\n"
     "layout(location = 0) out vec4 out_Color;\n"
+    // Each pvideo texel holds a pair of pixels as Y0, Cb, Y1, Cr
+    "vec3 pvideo_fetch(ivec2 p)\n"
+    "{\n"
+    "    ivec2 size = textureSize(pvideo_tex, 0) * ivec2(2, 1);\n"
+    "    p = clamp(p, ivec2(0), size - 1);\n"
+    "    vec4 texel = texelFetch(pvideo_tex, ivec2(p.x / 2, p.y), 0);\n"
+    "    vec3 ycbcr = vec3((p.x & 1) != 0 ? texel.b : texel.r, texel.ga)\n"
+    "                 - vec3(16.0, 128.0, 128.0) / 255.0;\n"
+    "    const mat3 bt601 = mat3(1.1640625, 1.1640625, 1.1640625,\n"
+    "                            0.0, -0.390625, 2.015625,\n"
+    "                            1.59765625, -0.8125, 0.0);\n"
+    "    return clamp(bt601 * ycbcr, 0.0, 1.0);\n"
+    "}\n"
+    "vec3 pvideo_sample(vec2 pos)\n"
+    "{\n"
+    "    pos -= 0.5;\n"
+    "    ivec2 p = ivec2(floor(pos));\n"
+    "    vec2 f = fract(pos);\n"
+    "    return mix(mix(pvideo_fetch(p), pvideo_fetch(p + ivec2(1, 0)), f.x),\n"
+    "               mix(pvideo_fetch(p + ivec2(0, 1)), pvideo_fetch(p + ivec2(1, 1)), f.x),\n"
+    "               f.y);\n"
+    "}\n"
     "void main()\n"
     "{\n"
     "    vec2 tex_coord = gl_FragCoord.xy/display_size;\n"
@@ -278,8 +302,8 @@ static const char *display_frag_glsl =
     "                           greaterThan(screen_coord, output_region.zw));\n"
     "        if (!any(clip) && (!pvideo_color_key_enable || out_Color.rgb == pvideo_color_key)) {\n"
     "            vec2 out_xy = screen_coord - pvideo_pos.xy;\n"
-    "            vec2 in_st = (pvideo_in_pos + out_xy * pvideo_scale.xy) / textureSize(pvideo_tex, 0);\n"
-    "            out_Color.rgba = texture(pvideo_tex, in_st);\n"
+    "            vec2 in_xy = pvideo_in_pos + out_xy * pvideo_scale.xy;\n"
+    "            out_Color.rgba = vec4(pvideo_sample(in_xy), 1.0);\n"
     "        }\n"
     "    }\n"
     "}\n";
@@ -614,6 +638,9 @@ static void destroy_current_display_image(PGRAPHState *pg)
 
     vkFreeMemory(r->device, d->memory, NULL);
     d->memory = VK_NULL_HANDLE;
+    xemu_mem_account_add(r->image_mem_accounts[IMAGE_MEM_DISPLAY],
+                         -(int64_t)d->memory_size);
+    d->memory_size = 0;
 
     d->draw_time = 0;
 }
@@ -679,7 +706,9 @@ static bool create_display_image(PGRAPHState *pg, int width, int height)
         .format = VK_FORMAT_R8G8B8A8_UNORM,
         .tiling = use_optimal_tiling ? VK_IMAGE_TILING_OPTIMAL : VK_IMAGE_TILING_LINEAR,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        // Blitted to the swapchain for native presentation
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
         .samples = VK_SAMPLE_COUNT_1_BIT,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
@@ -890,6 +919,9 @@ static bool create_display_image(PGRAPHState *pg, int width, int height)
 
     d->width = image_create_info.extent.width;
     d->height = image_create_info.extent.height;
+    d->memory_size = alloc_info.allocationSize;
+    xemu_mem_account_add(r->image_mem_accounts[IMAGE_MEM_DISPLAY],
+                         d->memory_size);
 
     create_frame_buffer(pg);
     return true;
@@ -1096,6 +1128,7 @@ static void render_display(PGRAPHState *pg, SurfaceBinding *surface)
     VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
     pgraph_vk_begin_debug_marker(r, cmd, RGBA_YELLOW,
         "Display Surface %08"HWADDR_PRIx, surface->vram_addr);
+    int timer_query = pgraph_vk_gpu_timer_begin(r, cmd, NV2A_PROF_GPU_DISPLAY);
 
     pgraph_vk_transition_image_layout(pg, cmd, surface->image,
                                       surface->host_fmt.vk_format,
@@ -1172,6 +1205,7 @@ static void render_display(PGRAPHState *pg, SurfaceBinding *surface)
                                       VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
     pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_gpu_timer_end(r, cmd, timer_query);
     pgraph_vk_end_single_time_commands(pg, cmd);
     nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_5);
 
@@ -1245,12 +1279,23 @@ void pgraph_vk_render_display(PGRAPHState *pg)
     d->vga.get_params(&d->vga, &vga_display_params);
 
     SurfaceBinding *surface = pgraph_vk_surface_get_within(
-        d, d->pcrtc.start + vga_display_params.line_offset);
+        d, nv2a_get_display_start(d) + vga_display_params.line_offset);
     if (surface == NULL || !surface->color || !surface->width ||
         !surface->height) {
         return;
     }
 
+    surface->attachment_only = false;
+    if (surface->transient) {
+        return;
+    }
+
+    // Keep showing the last complete frame
+    surface->displayed = true;
+    if (surface->frame_skipped) {
+        return;
+    }
+
     unsigned int width = 0, height = 0;
     d->vga.get_resolution(&d->vga, (int *)&width, (int *)&height);
 
@@ -19,11 +19,11 @@
 
 #include "qemu/osdep.h"
 #include "qemu/fast-hash.h"
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 #include "hw/xbox/nv2a/pgraph/prim_rewrite.h"
 #include <math.h>
 #ifdef __ANDROID__
-#include <SDL.h>
 #include <android/log.h>
 #endif
 
@@ -52,11 +52,9 @@ void pgraph_vk_draw_begin(NV2AState *d)
     }
 }
 
-static VkPrimitiveTopology get_primitive_topology(PGRAPHState *pg)
+static VkPrimitiveTopology get_primitive_topology(ShaderBinding *binding)
 {
-    PGRAPHVkState *r = pg->vk_renderer_state;
-
-    int primitive_mode = r->shader_binding->state.geom.primitive_mode;
+    int primitive_mode = binding->state.geom.primitive_mode;
 
     switch (primitive_mode) {
     case PRIM_TYPE_POINTS:
@@ -71,6 +69,114 @@ static VkPrimitiveTopology get_primitive_topology(PGRAPHState *pg)
     }
 }
 
+#define MAX_PIPELINE_WORKERS 4
+
+// Pipeline create info with all of its sub-structures held by value, so that
+// the pipeline can be compiled on a worker thread.
+struct PipelineCompileJob {
+    QSIMPLEQ_ENTRY(PipelineCompileJob) entry;
+    VkGraphicsPipelineCreateInfo create_info;
+    VkPipelineShaderStageCreateInfo shader_stages[3];
+    VkPipelineVertexInputStateCreateInfo vertex_input;
+    VkPipelineInputAssemblyStateCreateInfo input_assembly;
+    VkPipelineViewportStateCreateInfo viewport_state;
+    VkPipelineRasterizationStateCreateInfo rasterizer;
+    VkPipelineMultisampleStateCreateInfo multisampling;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil;
+    VkPipelineColorBlendAttachmentState color_blend_attachment;
+    VkPipelineColorBlendStateCreateInfo color_blending;
+    VkDynamicState dynamic_states[18];
+    VkPipelineDynamicStateCreateInfo dynamic_state;
+    RenderPassState render_pass_state; // Formats of rendering_info
+    VkPipelineRenderingCreateInfoKHR rendering_info;
+    ShaderModuleInfo *module_infos[3];
+    VkPipeline pipeline;
+    bool complete;
+};
+
+static uint64_t hash_combine(uint64_t hash, const void *data, size_t size)
+{
+    return size ? hash * 0x100000001b3ULL ^ fast_hash(data, size) : hash;
+}
+
+// The shader state was already hashed for the shader cache, so that hash is
+// reused rather than hashing the whole key.
+static uint64_t hash_pipeline_key(const PipelineKey *key, bool with_regs)
+{
+    uint64_t hash = key->shader_state_hash;
+    hash = hash_combine(hash, key, offsetof(PipelineKey, regs));
+    if (with_regs) {
+        hash = hash_combine(hash, key->regs, sizeof(key->regs));
+    }
+    hash = hash_combine(hash, key->binding_descriptions,
+                        key->num_binding_descriptions *
+                            sizeof(key->binding_descriptions[0]));
+    hash = hash_combine(hash, key->attribute_descriptions,
+                        key->num_attribute_descriptions *
+                            sizeof(key->attribute_descriptions[0]));
+    return hash;
+}
+
+static uint64_t get_pipeline_key_hash(const PipelineKey *key)
+{
+    return hash_pipeline_key(key, true);
+}
+
+// Pipelines which only differ in fixed-function register state share a
+// variant hash, and can stand in for each other while one is being compiled.
+static uint64_t get_pipeline_variant_hash(const PipelineKey *key)
+{
+    return hash_pipeline_key(key, false);
+}
+
+static bool pipeline_keys_are_variants(const PipelineKey *a,
+                                       const PipelineKey *b)
+{
+    return a->clear == b->clear &&
+           !memcmp(&a->render_pass_state, &b->render_pass_state,
+                   sizeof(a->render_pass_state)) &&
+           a->num_binding_descriptions == b->num_binding_descriptions &&
+           a->num_attribute_descriptions == b->num_attribute_descriptions &&
+           !memcmp(a->binding_descriptions, b->binding_descriptions,
+                   a->num_binding_descriptions *
+                       sizeof(a->binding_descriptions[0])) &&
+           !memcmp(a->attribute_descriptions, b->attribute_descriptions,
+                   a->num_attribute_descriptions *
+                       sizeof(a->attribute_descriptions[0])) &&
+           a->shader_state_hash == b->shader_state_hash &&
+           !memcmp(&a->shader_state, &b->shader_state,
+                   sizeof(a->shader_state));
+}
+
+static void add_pipeline_variant(PGRAPHVkState *r, PipelineBinding *snode)
+{
+    g_hash_table_replace(r->pipeline_variants, &snode->variant_hash, snode);
+}
+
+static void remove_pipeline_variant(PGRAPHVkState *r, PipelineBinding *snode)
+{
+    if (g_hash_table_lookup(r->pipeline_variants, &snode->variant_hash) ==
+        snode) {
+        g_hash_table_remove(r->pipeline_variants, &snode->variant_hash);
+    }
+}
+
+static PipelineBinding *find_pipeline_variant(PGRAPHVkState *r,
+                                              PipelineBinding *snode)
+{
+    PipelineBinding *variant =
+        g_hash_table_lookup(r->pipeline_variants, &snode->variant_hash);
+    if (!variant || variant == snode || variant->pipeline == VK_NULL_HANDLE ||
+        !pipeline_keys_are_variants(&variant->key, &snode->key)) {
+        return NULL;
+    }
+    return variant;
+}
+
+static bool try_finish_pipeline_compile_job(PGRAPHVkState *r,
+                                            PipelineBinding *snode);
+static void stop_pipeline_workers(PGRAPHVkState *r);
+
 static void pipeline_cache_entry_init(Lru *lru, LruNode *node,
                                       const void *state)
 {
@@ -78,6 +184,23 @@ static void pipeline_cache_entry_init(Lru *lru, LruNode *node,
     snode->layout = VK_NULL_HANDLE;
     snode->pipeline = VK_NULL_HANDLE;
     snode->draw_time = 0;
+    snode->variant_hash = 0;
+    snode->job = NULL;
+    snode->fast_linked_pipeline = VK_NULL_HANDLE;
+}
+
+static bool pipeline_cache_entry_pre_evict(Lru *lru, LruNode *node)
+{
+    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, pipeline_cache);
+    PipelineBinding *snode = container_of(node, PipelineBinding, node);
+
+    // Can't evict while a worker is still compiling the pipeline
+    if (snode->job && !try_finish_pipeline_compile_job(r, snode)) {
+        return false;
+    }
+
+    pgraph_vk_wait_for_draw_time(r, snode->draw_time);
+    return true;
 }
 
 static void pipeline_cache_entry_post_evict(Lru *lru, LruNode *node)
@@ -89,8 +212,12 @@ static void pipeline_cache_entry_post_evict(Lru *lru, LruNode *node)
             snode->draw_time < r->command_buffer_start_time) &&
            "Pipeline evicted while in use!");
 
+    remove_pipeline_variant(r, snode);
+
     vkDestroyPipeline(r->device, snode->pipeline, NULL);
     snode->pipeline = VK_NULL_HANDLE;
+    vkDestroyPipeline(r->device, snode->fast_linked_pipeline, NULL);
+    snode->fast_linked_pipeline = VK_NULL_HANDLE;
 
     vkDestroyPipelineLayout(r->device, snode->layout, NULL);
     snode->layout = VK_NULL_HANDLE;
@@ -100,24 +227,49 @@ static bool pipeline_cache_entry_compare(Lru *lru, LruNode *node,
                                          const void *key)
 {
     PipelineBinding *snode = container_of(node, PipelineBinding, node);
-    return memcmp(&snode->key, key, sizeof(PipelineKey));
+    const PipelineKey *a = &snode->key, *b = key;
+
+    return !pipeline_keys_are_variants(a, b) ||
+           memcmp(a->regs, b->regs, sizeof(a->regs));
 }
 
-#ifdef __ANDROID__
 static char *get_pipeline_cache_path(PGRAPHVkState *r)
 {
-    char *pref_path = SDL_GetPrefPath("xemu", "xemu");
-    if (!pref_path) {
-        return NULL;
+    const uint8_t *uuid = r->device_props.pipelineCacheUUID;
+    char uuid_str[VK_UUID_SIZE * 2 + 1];
+
+    for (int i = 0; i < VK_UUID_SIZE; i++) {
+        snprintf(&uuid_str[i * 2], 3, "%02x", uuid[i]);
     }
-    char *path = g_strdup_printf("%svk_pipeline_cache_%08x_%08x.bin",
-                                 pref_path,
-                                 r->device_props.deviceID,
-                                 r->device_props.driverVersion);
-    SDL_free(pref_path);
-    return path;
+
+    return g_strdup_printf("%svk_pipeline_cache_%08x_%08x_%08x_%s.bin",
+                           xemu_settings_get_base_path(),
+                           r->device_props.vendorID,
+                           r->device_props.deviceID,
+                           r->device_props.driverVersion, uuid_str);
+}
+
+/*
+ * Drivers are supposed to reject foreign cache blobs themselves, but some are
+ * known to crash on them instead, so check the header before handing it over.
+ */
+static bool pipeline_cache_data_is_compatible(PGRAPHVkState *r,
+                                              const void *data, size_t size)
+{
+    VkPipelineCacheHeaderVersionOne header;
+
+    if (size < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+
+    return header.headerSize >= sizeof(header) && header.headerSize <= size &&
+           header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == r->device_props.vendorID &&
+           header.deviceID == r->device_props.deviceID &&
+           !memcmp(header.pipelineCacheUUID,
+                   r->device_props.pipelineCacheUUID, VK_UUID_SIZE);
 }
-#endif
 
 static void init_pipeline_cache(PGRAPHState *pg)
 {
@@ -131,33 +283,43 @@ static void init_pipeline_cache(PGRAPHState *pg)
         .pNext = NULL,
     };
 
-#ifdef __ANDROID__
-    g_autofree char *cache_path = get_pipeline_cache_path(r);
-    gchar *cache_data = NULL;
+    g_autofree char *cache_path = NULL;
+    g_autofree gchar *cache_data = NULL;
     gsize cache_data_size = 0;
-    if (cache_path) {
-        GError *err = NULL;
-        if (g_file_get_contents(cache_path, &cache_data, &cache_data_size, &err)) {
-            cache_info.initialDataSize = (size_t)cache_data_size;
-            cache_info.pInitialData = (const void *)cache_data;
-            __android_log_print(ANDROID_LOG_INFO, "xemu-vk",
-                                "Loaded pipeline cache: %zu bytes", cache_data_size);
-        } else {
-            if (err) {
-                g_error_free(err);
+
+    if (g_config.perf.cache_shaders &&
+        r->device_profile.pipeline_cache_effective) {
+        cache_path = get_pipeline_cache_path(r);
+        if (g_file_get_contents(cache_path, &cache_data, &cache_data_size,
+                                NULL)) {
+            if (pipeline_cache_data_is_compatible(r, cache_data,
+                                                  cache_data_size)) {
+                cache_info.initialDataSize = cache_data_size;
+                cache_info.pInitialData = cache_data;
+#ifdef __ANDROID__
+                __android_log_print(ANDROID_LOG_INFO, "xemu-vk",
+                                    "Loaded pipeline cache: %zu bytes",
+                                    (size_t)cache_data_size);
+#endif
+            } else {
+                NV2A_VK_DPRINTF("Discarding incompatible pipeline cache %s",
+                                cache_path);
+                qemu_unlink(cache_path);
             }
         }
     }
-#endif
-
-    VK_CHECK(vkCreatePipelineCache(r->device, &cache_info, NULL,
-                                   &r->vk_pipeline_cache));
 
-#ifdef __ANDROID__
-    g_free(cache_data);
-#endif
+    if (vkCreatePipelineCache(r->device, &cache_info, NULL,
+                              &r->vk_pipeline_cache) != VK_SUCCESS &&
+        cache_info.pInitialData) {
+        /* Driver refused the blob, start over with an empty cache */
+        cache_info.initialDataSize = 0;
+        cache_info.pInitialData = NULL;
+        VK_CHECK(vkCreatePipelineCache(r->device, &cache_info, NULL,
+                                       &r->vk_pipeline_cache));
+    }
 
-    const size_t pipeline_cache_size = 2048;
+    const size_t pipeline_cache_size = r->device_profile.pipeline_cache_size;
     lru_init(&r->pipeline_cache);
     r->pipeline_cache_entries =
         g_malloc_n(pipeline_cache_size, sizeof(PipelineBinding));
@@ -165,47 +327,124 @@ static void init_pipeline_cache(PGRAPHState *pg)
     for (int i = 0; i < pipeline_cache_size; i++) {
         lru_add_free(&r->pipeline_cache, &r->pipeline_cache_entries[i].node);
     }
+    xemu_mem_account_set(xemu_mem_account("vk", "pipeline cache nodes"),
+                         pipeline_cache_size * sizeof(PipelineBinding));
 
     r->pipeline_cache.init_node = pipeline_cache_entry_init;
     r->pipeline_cache.compare_nodes = pipeline_cache_entry_compare;
+    r->pipeline_cache.pre_node_evict = pipeline_cache_entry_pre_evict;
     r->pipeline_cache.post_node_evict = pipeline_cache_entry_post_evict;
+
+    r->pipeline_variants = g_hash_table_new(g_int64_hash, g_int64_equal);
+
+    qemu_mutex_init(&r->pipeline_job_lock);
+    qemu_cond_init(&r->pipeline_job_cond);
+    QSIMPLEQ_INIT(&r->pipeline_job_queue);
+}
+
+/*
+ * Other instances sharing the base path save their pipelines to the same
+ * file. Create a cache from what is on disk now, to merge this instance's
+ * pipelines into, so that saving doesn't drop theirs. The live cache isn't
+ * merged into as pipeline workers may be using it.
+ */
+static VkPipelineCache load_saved_pipeline_cache(PGRAPHVkState *r,
+                                                 const char *cache_path)
+{
+    g_autofree gchar *data = NULL;
+    gsize data_size;
+
+    if (!g_file_get_contents(cache_path, &data, &data_size, NULL) ||
+        !pipeline_cache_data_is_compatible(r, data, data_size)) {
+        return VK_NULL_HANDLE;
+    }
+
+    VkPipelineCacheCreateInfo cache_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data_size,
+        .pInitialData = data,
+    };
+    VkPipelineCache cache;
+    if (vkCreatePipelineCache(r->device, &cache_info, NULL, &cache) !=
+        VK_SUCCESS) {
+        return VK_NULL_HANDLE;
+    }
+
+    if (vkMergePipelineCaches(r->device, cache, 1, &r->vk_pipeline_cache) !=
+        VK_SUCCESS) {
+        vkDestroyPipelineCache(r->device, cache, NULL);
+        return VK_NULL_HANDLE;
+    }
+
+    return cache;
+}
+
+static void save_pipeline_cache(PGRAPHVkState *r)
+{
+    g_autofree char *cache_path = get_pipeline_cache_path(r);
+    g_autofree void *data = NULL;
+    size_t data_size = 0;
+
+    VkPipelineCache merged = load_saved_pipeline_cache(r, cache_path);
+    VkPipelineCache cache =
+        merged != VK_NULL_HANDLE ? merged : r->vk_pipeline_cache;
+
+    VkResult res = vkGetPipelineCacheData(r->device, cache, &data_size, NULL);
+    if (res == VK_SUCCESS && data_size) {
+        data = g_malloc(data_size);
+        res = vkGetPipelineCacheData(r->device, cache, &data_size, data);
+    }
+    if (merged != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(r->device, merged, NULL);
+    }
+    if (res != VK_SUCCESS || data_size == 0 ||
+        !pipeline_cache_data_is_compatible(r, data, data_size)) {
+        return;
+    }
+
+    /* Writes to a temporary file and renames it over the old cache */
+    GError *err = NULL;
+    if (!g_file_set_contents(cache_path, data, data_size, &err)) {
+        fprintf(stderr, "nv2a: Failed to save pipeline cache to %s: %s\n",
+                cache_path, err->message);
+        g_error_free(err);
+        return;
+    }
+
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_INFO, "xemu-vk",
+                        "Saved pipeline cache: %zu bytes", data_size);
+#endif
+}
+
+void pgraph_vk_write_pipeline_cache(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (g_config.perf.cache_shaders &&
+        r->device_profile.pipeline_cache_effective) {
+        save_pipeline_cache(r);
+    }
 }
 
 static void finalize_pipeline_cache(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    stop_pipeline_workers(r);
+    qemu_cond_destroy(&r->pipeline_job_cond);
+    qemu_mutex_destroy(&r->pipeline_job_lock);
+
     lru_flush(&r->pipeline_cache);
+    lru_destroy(&r->pipeline_cache);
     g_free(r->pipeline_cache_entries);
     r->pipeline_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("vk", "pipeline cache nodes"), 0);
 
-#ifdef __ANDROID__
-    g_autofree char *cache_path = get_pipeline_cache_path(r);
-    if (cache_path) {
-        size_t data_size = 0;
-        VkResult res = vkGetPipelineCacheData(r->device, r->vk_pipeline_cache,
-                                              &data_size, NULL);
-        if (res == VK_SUCCESS && data_size > 0) {
-            g_autofree void *data = g_malloc(data_size);
-            res = vkGetPipelineCacheData(r->device, r->vk_pipeline_cache,
-                                         &data_size, data);
-            if (res == VK_SUCCESS) {
-                GError *err = NULL;
-                if (g_file_set_contents(cache_path, (const gchar *)data,
-                                        (gssize)data_size, &err)) {
-                    __android_log_print(ANDROID_LOG_INFO, "xemu-vk",
-                                        "Saved pipeline cache: %zu bytes", data_size);
-                } else {
-                    __android_log_print(ANDROID_LOG_WARN, "xemu-vk",
-                                        "Failed to save pipeline cache");
-                    if (err) {
-                        g_error_free(err);
-                    }
-                }
-            }
-        }
-    }
-#endif
+    g_hash_table_destroy(r->pipeline_variants);
+    r->pipeline_variants = NULL;
+
+    pgraph_vk_write_pipeline_cache(pg);
 
     vkDestroyPipelineCache(r->device, r->vk_pipeline_cache, NULL);
 }
@@ -247,6 +486,8 @@ static void finalize_clear_shaders(PGRAPHState *pg)
 static void init_render_passes(PGRAPHVkState *r)
 {
     r->render_passes = g_array_new(false, false, sizeof(RenderPass));
+    r->tiler_render_passes = g_config.display.vulkan.tiler_render_passes;
+    memset(&r->pending_clear, 0, sizeof(r->pending_clear));
 }
 
 static void finalize_render_passes(PGRAPHVkState *r)
@@ -266,18 +507,24 @@ void pgraph_vk_init_pipelines(PGRAPHState *pg)
     init_pipeline_cache(pg);
     init_clear_shaders(pg);
     init_render_passes(r);
+}
 
-    VkSemaphoreCreateInfo semaphore_info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
-    };
-    VK_CHECK(vkCreateSemaphore(r->device, &semaphore_info, NULL,
-                               &r->command_buffer_semaphore));
+void pgraph_vk_trim_pipeline_cache(PGRAPHState *pg, bool all)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
 
-    VkFenceCreateInfo fence_info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-    };
-    VK_CHECK(
-        vkCreateFence(r->device, &fence_info, NULL, &r->command_buffer_fence));
+    // Pipelines carry no size we can query, so drop the least recently
+    // used quarter, or everything not in use
+    int num_to_evict =
+        all ? r->pipeline_cache.num_used : r->pipeline_cache.num_used / 4;
+    int num_evicted = 0;
+
+    while (num_to_evict-- && lru_try_evict_one(&r->pipeline_cache)) {
+        num_evicted += 1;
+    }
+
+    NV2A_VK_DPRINTF("Evicted %d pipelines, %d remain", num_evicted,
+                    r->pipeline_cache.num_used);
 }
 
 void pgraph_vk_finalize_pipelines(PGRAPHState *pg)
@@ -287,9 +534,6 @@ void pgraph_vk_finalize_pipelines(PGRAPHState *pg)
     finalize_clear_shaders(pg);
     finalize_pipeline_cache(pg);
     finalize_render_passes(r);
-
-    vkDestroyFence(r->device, r->command_buffer_fence, NULL);
-    vkDestroySemaphore(r->device, r->command_buffer_semaphore, NULL);
 }
 
 static void init_render_pass_state(PGRAPHState *pg, RenderPassState *state)
@@ -303,7 +547,17 @@ static void init_render_pass_state(PGRAPHState *pg, RenderPassState *state)
                                            VK_FORMAT_UNDEFINED;
 }
 
-static VkRenderPass create_render_pass(PGRAPHVkState *r, RenderPassState *state)
+static const RenderPassOps default_render_pass_ops = {
+    .color_load_op = VK_ATTACHMENT_LOAD_OP_LOAD,
+    .depth_load_op = VK_ATTACHMENT_LOAD_OP_LOAD,
+    .stencil_load_op = VK_ATTACHMENT_LOAD_OP_LOAD,
+    .depth_store_op = VK_ATTACHMENT_STORE_OP_STORE,
+    .stencil_store_op = VK_ATTACHMENT_STORE_OP_STORE,
+};
+
+static VkRenderPass create_render_pass(PGRAPHVkState *r,
+                                       const RenderPassState *state,
+                                       const RenderPassOps *ops)
 {
     NV2A_VK_DPRINTF("Creating render pass");
 
@@ -318,7 +572,7 @@ static VkRenderPass create_render_pass(PGRAPHVkState *r, RenderPassState *state)
         attachments[num_attachments] = (VkAttachmentDescription){
             .format = state->color_format,
             .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+            .loadOp = ops->color_load_op,
             .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
             .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
             .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
@@ -336,10 +590,10 @@ static VkRenderPass create_render_pass(PGRAPHVkState *r, RenderPassState *state)
         attachments[num_attachments] = (VkAttachmentDescription){
             .format = state->zeta_format,
             .samples = VK_SAMPLE_COUNT_1_BIT,
-            .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-            .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
-            .stencilStoreOp = VK_ATTACHMENT_STORE_OP_STORE,
+            .loadOp = ops->depth_load_op,
+            .storeOp = ops->depth_store_op,
+            .stencilLoadOp = ops->stencil_load_op,
+            .stencilStoreOp = ops->stencil_store_op,
             .initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
             .finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
         };
@@ -401,24 +655,63 @@ static VkRenderPass create_render_pass(PGRAPHVkState *r, RenderPassState *state)
     return render_pass;
 }
 
-static VkRenderPass add_new_render_pass(PGRAPHVkState *r, RenderPassState *state)
+static VkRenderPass add_new_render_pass(PGRAPHVkState *r,
+                                        const RenderPassState *state,
+                                        const RenderPassOps *ops)
 {
     RenderPass new_pass;
     memcpy(&new_pass.state, state, sizeof(*state));
-    new_pass.render_pass = create_render_pass(r, state);
+    memcpy(&new_pass.ops, ops, sizeof(*ops));
+    new_pass.render_pass = create_render_pass(r, state, ops);
     g_array_append_vals(r->render_passes, &new_pass, 1);
     return new_pass.render_pass;
 }
 
-static VkRenderPass get_render_pass(PGRAPHVkState *r, RenderPassState *state)
+static VkRenderPass get_render_pass_variant(PGRAPHVkState *r,
+                                            const RenderPassState *state,
+                                            const RenderPassOps *ops)
 {
     for (int i = 0; i < r->render_passes->len; i++) {
         RenderPass *p = &g_array_index(r->render_passes, RenderPass, i);
-        if (!memcmp(&p->state, state, sizeof(*state))) {
+        if (!memcmp(&p->state, state, sizeof(*state)) &&
+            !memcmp(&p->ops, ops, sizeof(*ops))) {
             return p->render_pass;
         }
     }
-    return add_new_render_pass(r, state);
+    return add_new_render_pass(r, state, ops);
+}
+
+static VkRenderPass get_render_pass(PGRAPHVkState *r,
+                                    const RenderPassState *state)
+{
+    return get_render_pass_variant(r, state, &default_render_pass_ops);
+}
+
+/*
+ * With dynamic rendering, pipelines are only built against the attachment
+ * formats, and the returned render pass is VK_NULL_HANDLE. The formats are
+ * referenced by rendering_info, so state has to outlive pipeline creation.
+ */
+static VkRenderPass
+init_pipeline_rendering_info(PGRAPHVkState *r, const RenderPassState *state,
+                             VkPipelineRenderingCreateInfoKHR *rendering_info)
+{
+    if (!r->dynamic_rendering_extension_enabled) {
+        return get_render_pass(r, state);
+    }
+
+    bool color = state->color_format != VK_FORMAT_UNDEFINED;
+    *rendering_info = (VkPipelineRenderingCreateInfoKHR){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR,
+        .colorAttachmentCount = color ? 1 : 0,
+        .pColorAttachmentFormats = color ? &state->color_format : NULL,
+        .depthAttachmentFormat = state->zeta_format,
+        .stencilAttachmentFormat =
+            pgraph_vk_format_has_stencil_component(state->zeta_format) ?
+                state->zeta_format :
+                VK_FORMAT_UNDEFINED,
+    };
+    return VK_NULL_HANDLE;
 }
 
 static void create_frame_buffer(PGRAPHState *pg)
@@ -429,7 +722,7 @@ static void create_frame_buffer(PGRAPHState *pg)
 
     assert(r->color_binding || r->zeta_binding);
 
-    if (r->framebuffer_index >= ARRAY_SIZE(r->framebuffers)) {
+    if (r->frame->framebuffer_index >= ARRAY_SIZE(r->frame->framebuffers)) {
         pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
     }
 
@@ -455,20 +748,32 @@ static void create_frame_buffer(PGRAPHState *pg)
         .layers = 1,
     };
     pgraph_apply_scaling_factor(pg, &create_info.width, &create_info.height);
-    VK_CHECK(vkCreateFramebuffer(r->device, &create_info, NULL,
-                                 &r->framebuffers[r->framebuffer_index++]));
+    FrameInFlight *frame = r->frame;
+    VK_CHECK(vkCreateFramebuffer(
+        r->device, &create_info, NULL,
+        &frame->framebuffers[frame->framebuffer_index++]));
+    r->render_target.framebuffer =
+        frame->framebuffers[frame->framebuffer_index - 1];
 }
 
-static void destroy_framebuffers(PGRAPHState *pg)
+/*
+ * Dynamic rendering begins passes on the surface views directly. Otherwise a
+ * framebuffer is created for them, again in each frame as framebuffers are
+ * destroyed along with the frame that used them.
+ */
+static void update_render_target(PGRAPHState *pg)
 {
-    NV2A_VK_DPRINTF("Destroying framebuffer");
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    for (int i = 0; i < r->framebuffer_index; i++) {
-        vkDestroyFramebuffer(r->device, r->framebuffers[i], NULL);
-        r->framebuffers[i] = VK_NULL_HANDLE;
+    r->render_target = (RenderTarget){
+        .color_view = r->color_binding ? r->color_binding->image_view :
+                                         VK_NULL_HANDLE,
+        .zeta_view = r->zeta_binding ? r->zeta_binding->image_view :
+                                       VK_NULL_HANDLE,
+    };
+    if (!r->dynamic_rendering_extension_enabled) {
+        create_frame_buffer(pg);
     }
-    r->framebuffer_index = 0;
 }
 
 static void create_clear_pipeline(PGRAPHState *pg)
@@ -484,12 +789,13 @@ static void create_clear_pipeline(PGRAPHState *pg)
 
     key.regs[0] = r->clear_parameter;
 
-    uint64_t hash = fast_hash((void *)&key, sizeof(key));
+    uint64_t hash = get_pipeline_key_hash(&key);
     LruNode *node = lru_lookup(&r->pipeline_cache, hash, &key);
     PipelineBinding *snode = container_of(node, PipelineBinding, node);
 
     if (snode->pipeline != VK_NULL_HANDLE) {
         NV2A_VK_DPRINTF("Cache hit");
+        nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_CACHE_HIT);
         r->pipeline_binding_changed = r->pipeline_binding != snode;
         r->pipeline_binding = snode;
         NV2A_VK_DGROUP_END();
@@ -497,6 +803,7 @@ static void create_clear_pipeline(PGRAPHState *pg)
     }
 
     NV2A_VK_DPRINTF("Cache miss");
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_CACHE_MISS);
     nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_GEN);
     memcpy(&snode->key, &key, sizeof(key));
 
@@ -628,8 +935,11 @@ static void create_clear_pipeline(PGRAPHState *pg)
     VK_CHECK(vkCreatePipelineLayout(r->device, &pipeline_layout_info, NULL,
                                     &layout));
 
+    VkPipelineRenderingCreateInfoKHR rendering_info;
     VkGraphicsPipelineCreateInfo pipeline_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = r->dynamic_rendering_extension_enabled ? &rendering_info :
+                                                          NULL,
         .stageCount = num_active_shader_stages,
         .pStages = shader_stages,
         .pVertexInputState = &vertex_input,
@@ -641,7 +951,8 @@ static void create_clear_pipeline(PGRAPHState *pg)
         .pColorBlendState = &color_blending,
         .pDynamicState = &dynamic_state,
         .layout = layout,
-        .renderPass = get_render_pass(r, &key.render_pass_state),
+        .renderPass = init_pipeline_rendering_info(
+            r, &key.render_pass_state, &rendering_info),
         .subpass = 0,
         .basePipelineHandle = VK_NULL_HANDLE,
     };
@@ -661,6 +972,12 @@ static void create_clear_pipeline(PGRAPHState *pg)
     NV2A_VK_DGROUP_END();
 }
 
+static const unsigned int pipeline_key_regs[] = {
+    NV_PGRAPH_BLEND,       NV_PGRAPH_BLENDCOLOR,  NV_PGRAPH_CONTROL_0,
+    NV_PGRAPH_CONTROL_1,   NV_PGRAPH_CONTROL_2,   NV_PGRAPH_CONTROL_3,
+    NV_PGRAPH_SETUPRASTER, NV_PGRAPH_ZOFFSETBIAS, NV_PGRAPH_ZOFFSETFACTOR,
+};
+
 static bool check_render_pass_dirty(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -678,25 +995,21 @@ static bool check_pipeline_dirty(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    if (!r->pipeline_binding || r->shader_bindings_changed ||
+    if (!r->pipeline_binding || r->pipeline_binding_pending ||
+        r->shader_bindings_changed ||
         r->texture_bindings_changed || check_render_pass_dirty(pg)) {
         return true;
     }
 
-    const unsigned int regs[] = {
-        NV_PGRAPH_BLEND,       NV_PGRAPH_BLENDCOLOR,  NV_PGRAPH_CONTROL_0,
-        NV_PGRAPH_CONTROL_1,   NV_PGRAPH_CONTROL_2,   NV_PGRAPH_CONTROL_3,
-        NV_PGRAPH_SETUPRASTER, NV_PGRAPH_ZOFFSETBIAS, NV_PGRAPH_ZOFFSETFACTOR,
-    };
-
-    for (int i = 0; i < ARRAY_SIZE(regs); i++) {
-        if (pgraph_is_reg_dirty(pg, regs[i])) {
+    for (int i = 0; i < ARRAY_SIZE(pipeline_key_regs); i++) {
+        if (pgraph_is_reg_dirty(pg, pipeline_key_regs[i])) {
             return true;
         }
     }
 
     // FIXME: Use dirty bits instead
-    if (memcmp(r->vertex_attribute_descriptions,
+    if (!r->vertex_input_dynamic_state_extension_enabled &&
+        memcmp(r->vertex_attribute_descriptions,
                r->pipeline_binding->key.attribute_descriptions,
                r->num_active_vertex_attribute_descriptions *
                    sizeof(r->vertex_attribute_descriptions[0])) ||
@@ -719,118 +1032,299 @@ static void init_pipeline_key(PGRAPHState *pg, PipelineKey *key)
     memset(key, 0, sizeof(*key));
     init_render_pass_state(pg, &key->render_pass_state);
     memcpy(&key->shader_state, &r->shader_binding->state, sizeof(ShaderState));
-    memcpy(key->binding_descriptions, r->vertex_binding_descriptions,
-           sizeof(key->binding_descriptions[0]) *
-               r->num_active_vertex_binding_descriptions);
-    memcpy(key->attribute_descriptions, r->vertex_attribute_descriptions,
-           sizeof(key->attribute_descriptions[0]) *
-               r->num_active_vertex_attribute_descriptions);
-
-    // FIXME: Register masking
-    // FIXME: Use more dynamic state updates
-    const int regs[] = {
-        NV_PGRAPH_BLEND,       NV_PGRAPH_BLENDCOLOR,  NV_PGRAPH_CONTROL_0,
-        NV_PGRAPH_CONTROL_1,   NV_PGRAPH_CONTROL_2,   NV_PGRAPH_CONTROL_3,
-        NV_PGRAPH_SETUPRASTER, NV_PGRAPH_ZOFFSETBIAS, NV_PGRAPH_ZOFFSETFACTOR,
-    };
-    assert(ARRAY_SIZE(regs) == ARRAY_SIZE(key->regs));
-    for (int i = 0; i < ARRAY_SIZE(regs); i++) {
-        key->regs[i] = pgraph_reg_r(pg, regs[i]);
+    key->shader_state_hash = r->shader_binding->node.hash;
+
+    if (!r->vertex_input_dynamic_state_extension_enabled) {
+        memcpy(key->binding_descriptions, r->vertex_binding_descriptions,
+               sizeof(key->binding_descriptions[0]) *
+                   r->num_active_vertex_binding_descriptions);
+        memcpy(key->attribute_descriptions, r->vertex_attribute_descriptions,
+               sizeof(key->attribute_descriptions[0]) *
+                   r->num_active_vertex_attribute_descriptions);
+
+        key->num_binding_descriptions =
+            r->num_active_vertex_binding_descriptions;
+        key->num_attribute_descriptions =
+            r->num_active_vertex_attribute_descriptions;
+    }
+
+    assert(ARRAY_SIZE(pipeline_key_regs) == ARRAY_SIZE(key->regs));
+    for (int i = 0; i < ARRAY_SIZE(pipeline_key_regs); i++) {
+        key->regs[i] = pgraph_reg_r(pg, pipeline_key_regs[i]);
     }
+    mask_pipeline_key_regs(r, key);
 }
 
-static void create_pipeline(PGRAPHState *pg)
+static uint32_t pipeline_key_reg(const uint32_t *regs, unsigned int reg)
 {
-    NV2A_VK_DGROUP_BEGIN("Creating pipeline");
+    for (int i = 0; i < ARRAY_SIZE(pipeline_key_regs); i++) {
+        if (pipeline_key_regs[i] == reg) {
+            return regs[i];
+        }
+    }
 
-    NV2AState *d = container_of(pg, NV2AState, pgraph);
-    PGRAPHVkState *r = pg->vk_renderer_state;
+    assert(!"Register is not part of the pipeline key");
+    return 0;
+}
 
-    pgraph_vk_bind_textures(d);
-    pgraph_vk_bind_shaders(pg);
+// Bits of a pipeline key register which are baked into the pipeline. The rest
+// are either not used by the pipeline or set as dynamic state.
+static uint32_t get_pipeline_key_reg_mask(PGRAPHVkState *r, unsigned int reg)
+{
+    bool eds = r->extended_dynamic_state_extension_enabled;
+    bool eds3 = r->extended_dynamic_state3_extension_enabled;
+    uint32_t mask = 0;
+
+    switch (reg) {
+    case NV_PGRAPH_BLEND:
+        if (!eds3) {
+            mask = NV_PGRAPH_BLEND_EQN | NV_PGRAPH_BLEND_EN |
+                   NV_PGRAPH_BLEND_SFACTOR | NV_PGRAPH_BLEND_DFACTOR;
+        }
+        break;
+    case NV_PGRAPH_CONTROL_0:
+        if (!eds) {
+            mask |= NV_PGRAPH_CONTROL_0_ZENABLE | NV_PGRAPH_CONTROL_0_ZFUNC |
+                    NV_PGRAPH_CONTROL_0_ZWRITEENABLE;
+        }
+        if (!eds3) {
+            mask |= NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE |
+                    NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE |
+                    NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE |
+                    NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE;
+        }
+        break;
+    case NV_PGRAPH_CONTROL_1:
+        if (!eds) {
+            mask = NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE |
+                   NV_PGRAPH_CONTROL_1_STENCIL_FUNC;
+        }
+        break;
+    case NV_PGRAPH_CONTROL_2:
+        if (!eds) {
+            mask = NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL |
+                   NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL |
+                   NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS;
+        }
+        break;
+    case NV_PGRAPH_SETUPRASTER:
+        if (!eds) {
+            mask = NV_PGRAPH_SETUPRASTER_FRONTFACE |
+                   NV_PGRAPH_SETUPRASTER_CULLENABLE |
+                   NV_PGRAPH_SETUPRASTER_CULLCTRL;
+        }
+        break;
+    default:
+        // Blend color and stencil masks are always dynamic
+        break;
+    }
 
-    // FIXME: If nothing was dirty, don't even try creating the key or hashing.
-    //        Just use the same pipeline.
-    bool pipeline_dirty = check_pipeline_dirty(pg);
+    return mask;
+}
 
-    pgraph_clear_dirty_reg_map(pg);
-    // FIXME: We could clear less
+static void mask_pipeline_key_regs(PGRAPHVkState *r, PipelineKey *key)
+{
+    for (int i = 0; i < ARRAY_SIZE(pipeline_key_regs); i++) {
+        key->regs[i] &= get_pipeline_key_reg_mask(r, pipeline_key_regs[i]);
+    }
+}
 
-    if (r->pipeline_binding && !pipeline_dirty) {
-        NV2A_VK_DPRINTF("Cache hit");
-        NV2A_VK_DGROUP_END();
-        return;
+static void get_dynamic_draw_state(const uint32_t *regs,
+                                   DynamicDrawState *state)
+{
+    memset(state, 0, sizeof(*state));
+
+    uint32_t setupraster = pipeline_key_reg(regs, NV_PGRAPH_SETUPRASTER);
+    state->front_face = (setupraster & NV_PGRAPH_SETUPRASTER_FRONTFACE) ?
+                            VK_FRONT_FACE_COUNTER_CLOCKWISE :
+                            VK_FRONT_FACE_CLOCKWISE;
+    if (setupraster & NV_PGRAPH_SETUPRASTER_CULLENABLE) {
+        uint32_t cull_face =
+            GET_MASK(setupraster, NV_PGRAPH_SETUPRASTER_CULLCTRL);
+        assert(cull_face < ARRAY_SIZE(pgraph_cull_face_vk_map));
+        state->cull_mode = pgraph_cull_face_vk_map[cull_face];
+    } else {
+        state->cull_mode = VK_CULL_MODE_NONE;
     }
 
-    PipelineKey key;
-    init_pipeline_key(pg, &key);
-    uint64_t hash = fast_hash((void *)&key, sizeof(key));
+    uint32_t control_0 = pipeline_key_reg(regs, NV_PGRAPH_CONTROL_0);
+    state->depth_write_enable =
+        (control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE) ? VK_TRUE : VK_FALSE;
+    if (control_0 & NV_PGRAPH_CONTROL_0_ZENABLE) {
+        state->depth_test_enable = VK_TRUE;
+        uint32_t depth_func = GET_MASK(control_0, NV_PGRAPH_CONTROL_0_ZFUNC);
+        assert(depth_func < ARRAY_SIZE(pgraph_depth_func_vk_map));
+        state->depth_compare_op = pgraph_depth_func_vk_map[depth_func];
+    }
 
-    LruNode *node = lru_lookup(&r->pipeline_cache, hash, &key);
-    PipelineBinding *snode = container_of(node, PipelineBinding, node);
-    if (snode->pipeline != VK_NULL_HANDLE) {
-        NV2A_VK_DPRINTF("Cache hit");
-        r->pipeline_binding_changed = r->pipeline_binding != snode;
-        r->pipeline_binding = snode;
-        NV2A_VK_DGROUP_END();
-        return;
+    uint32_t control_1 = pipeline_key_reg(regs, NV_PGRAPH_CONTROL_1);
+    if (control_1 & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE) {
+        uint32_t control_2 = pipeline_key_reg(regs, NV_PGRAPH_CONTROL_2);
+        state->stencil_test_enable = VK_TRUE;
+        uint32_t stencil_func =
+            GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
+        uint32_t op_fail = GET_MASK(control_2, NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL);
+        uint32_t op_zfail =
+            GET_MASK(control_2, NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL);
+        uint32_t op_zpass =
+            GET_MASK(control_2, NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS);
+
+        assert(stencil_func < ARRAY_SIZE(pgraph_stencil_func_vk_map));
+        assert(op_fail < ARRAY_SIZE(pgraph_stencil_op_vk_map));
+        assert(op_zfail < ARRAY_SIZE(pgraph_stencil_op_vk_map));
+        assert(op_zpass < ARRAY_SIZE(pgraph_stencil_op_vk_map));
+
+        state->stencil.failOp = pgraph_stencil_op_vk_map[op_fail];
+        state->stencil.passOp = pgraph_stencil_op_vk_map[op_zpass];
+        state->stencil.depthFailOp = pgraph_stencil_op_vk_map[op_zfail];
+        state->stencil.compareOp = pgraph_stencil_func_vk_map[stencil_func];
+        state->stencil.compareMask =
+            GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_MASK_READ);
+        state->stencil.writeMask =
+            GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE);
+        state->stencil.reference =
+            GET_MASK(control_1, NV_PGRAPH_CONTROL_1_STENCIL_REF);
     }
 
-    NV2A_VK_DPRINTF("Cache miss");
-    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_GEN);
+    if (control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE)
+        state->color_write_mask |= VK_COLOR_COMPONENT_R_BIT;
+    if (control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE)
+        state->color_write_mask |= VK_COLOR_COMPONENT_G_BIT;
+    if (control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE)
+        state->color_write_mask |= VK_COLOR_COMPONENT_B_BIT;
+    if (control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE)
+        state->color_write_mask |= VK_COLOR_COMPONENT_A_BIT;
 
-    memcpy(&snode->key, &key, sizeof(key));
+    uint32_t blend = pipeline_key_reg(regs, NV_PGRAPH_BLEND);
+    if (blend & NV_PGRAPH_BLEND_EN) {
+        state->color_blend_enable = VK_TRUE;
 
-    uint32_t control_0 = pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0);
-    bool depth_test = control_0 & NV_PGRAPH_CONTROL_0_ZENABLE;
-    bool depth_write = !!(control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE);
-    bool stencil_test =
-        pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1) & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
+        uint32_t sfactor = GET_MASK(blend, NV_PGRAPH_BLEND_SFACTOR);
+        uint32_t dfactor = GET_MASK(blend, NV_PGRAPH_BLEND_DFACTOR);
+        uint32_t equation = GET_MASK(blend, NV_PGRAPH_BLEND_EQN);
+        assert(sfactor < ARRAY_SIZE(pgraph_blend_factor_vk_map));
+        assert(dfactor < ARRAY_SIZE(pgraph_blend_factor_vk_map));
+        assert(equation < ARRAY_SIZE(pgraph_blend_equation_vk_map));
 
-    int num_active_shader_stages = 0;
-    VkPipelineShaderStageCreateInfo shader_stages[3];
+        VkColorBlendEquationEXT *eq = &state->color_blend_equation;
+        eq->srcColorBlendFactor = pgraph_blend_factor_vk_map[sfactor];
+        eq->dstColorBlendFactor = pgraph_blend_factor_vk_map[dfactor];
+        eq->colorBlendOp = pgraph_blend_equation_vk_map[equation];
+        eq->srcAlphaBlendFactor = pgraph_blend_factor_vk_map[sfactor];
+        eq->dstAlphaBlendFactor = pgraph_blend_factor_vk_map[dfactor];
+        eq->alphaBlendOp = pgraph_blend_equation_vk_map[equation];
 
-    shader_stages[num_active_shader_stages++] =
-        (VkPipelineShaderStageCreateInfo){
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_VERTEX_BIT,
-            .module = r->shader_binding->vsh.module_info->module,
-            .pName = "main",
-        };
-    if (r->shader_binding->geom.module_info) {
-        shader_stages[num_active_shader_stages++] =
-            (VkPipelineShaderStageCreateInfo){
-                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-                .stage = VK_SHADER_STAGE_GEOMETRY_BIT,
-                .module = r->shader_binding->geom.module_info->module,
-                .pName = "main",
-            };
+        uint32_t blend_color = pipeline_key_reg(regs, NV_PGRAPH_BLENDCOLOR);
+        pgraph_argb_pack32_to_rgba_float(blend_color, state->blend_constants);
     }
-    shader_stages[num_active_shader_stages++] =
-        (VkPipelineShaderStageCreateInfo){
-            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
-            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-            .module = r->shader_binding->psh.module_info->module,
-            .pName = "main",
-        };
+}
 
-    VkPipelineVertexInputStateCreateInfo vertex_input = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-        .vertexBindingDescriptionCount =
-            r->num_active_vertex_binding_descriptions,
-        .pVertexBindingDescriptions = r->vertex_binding_descriptions,
-        .vertexAttributeDescriptionCount =
-            r->num_active_vertex_attribute_descriptions,
-        .pVertexAttributeDescriptions = r->vertex_attribute_descriptions,
+static VkPipelineLayout create_pipeline_layout(PGRAPHVkState *r,
+                                               ShaderBinding *binding)
+{
+    VkDescriptorSetLayout set_layouts[] = {
+        r->descriptor_set_layout,
+        r->bindless.descriptor_set_layout,
     };
-
-    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = r->bindless.enabled ? 2 : 1,
+        .pSetLayouts = set_layouts,
+    };
+
+    VkPushConstantRange push_constant_ranges[2];
+    int num_push_constant_ranges = 0;
+    ShaderUniformLayout *psh_push_constants =
+        &binding->psh.module_info->push_constants;
+    if (psh_push_constants->total_size) {
+        assert(psh_push_constants->total_size <= PSH_PUSH_CONSTANTS_SIZE);
+        push_constant_ranges[num_push_constant_ranges++] =
+            (VkPushConstantRange){
+                .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+                .offset = 0,
+                .size = psh_push_constants->total_size,
+            };
+    }
+    if (binding->vsh.module_info->push_constants.num_uniforms) {
+        int num_uniform_attributes =
+            __builtin_popcount(binding->state.vsh.uniform_attrs);
+        push_constant_ranges[num_push_constant_ranges++] =
+            (VkPushConstantRange){
+                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+                .offset = PSH_PUSH_CONSTANTS_SIZE,
+                // FIXME: Minimize push constants
+                .size = num_uniform_attributes * 4 * sizeof(float),
+            };
+    }
+    pipeline_layout_info.pushConstantRangeCount = num_push_constant_ranges;
+    pipeline_layout_info.pPushConstantRanges = push_constant_ranges;
+
+    VkPipelineLayout layout;
+    VK_CHECK(vkCreatePipelineLayout(r->device, &pipeline_layout_info, NULL,
+                                    &layout));
+
+    return layout;
+}
+
+// Everything here is derived from the pipeline key, so that recorded keys can
+// be compiled without the matching PGRAPH state.
+static void init_pipeline_compile_job(PGRAPHVkState *r,
+                                      ShaderBinding *binding,
+                                      PipelineBinding *snode,
+                                      PipelineCompileJob *job)
+{
+    const PipelineKey *key = &snode->key;
+    bool has_color =
+        key->render_pass_state.color_format != VK_FORMAT_UNDEFINED;
+    bool has_zeta = key->render_pass_state.zeta_format != VK_FORMAT_UNDEFINED;
+
+    // State that is set dynamically was masked out of the key, and is ignored
+    DynamicDrawState state;
+    get_dynamic_draw_state(key->regs, &state);
+
+    int num_active_shader_stages = 0;
+
+    job->shader_stages[num_active_shader_stages++] =
+        (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = binding->vsh.module_info->module,
+            .pName = "main",
+        };
+    if (binding->geom.module_info) {
+        job->shader_stages[num_active_shader_stages++] =
+            (VkPipelineShaderStageCreateInfo){
+                .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+                .stage = VK_SHADER_STAGE_GEOMETRY_BIT,
+                .module = binding->geom.module_info->module,
+                .pName = "main",
+            };
+    }
+    job->shader_stages[num_active_shader_stages++] =
+        (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = binding->psh.module_info->module,
+            .pName = "main",
+        };
+
+    job->vertex_input = (VkPipelineVertexInputStateCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount =
+            key->num_binding_descriptions,
+        .pVertexBindingDescriptions = snode->key.binding_descriptions,
+        .vertexAttributeDescriptionCount =
+            key->num_attribute_descriptions,
+        .pVertexAttributeDescriptions = snode->key.attribute_descriptions,
+    };
+
+    job->input_assembly = (VkPipelineInputAssemblyStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-        .topology = get_primitive_topology(pg),
+        .topology = get_primitive_topology(binding),
         .primitiveRestartEnable = VK_FALSE,
     };
 
-    VkPipelineViewportStateCreateInfo viewport_state = {
+    job->viewport_state = (VkPipelineViewportStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
         .viewportCount = 1,
         .scissorCount = 1,
@@ -839,13 +1333,13 @@ static void create_pipeline(PGRAPHState *pg)
     void *rasterizer_next_struct = NULL;
 
     VkPolygonMode polygon_mode =
-        pgraph_polygon_mode_vk_map[r->shader_binding->state.geom.polygon_front_mode];
+        pgraph_polygon_mode_vk_map[binding->state.geom.polygon_front_mode];
     if (polygon_mode != VK_POLYGON_MODE_FILL &&
         r->enabled_physical_device_features.fillModeNonSolid != VK_TRUE) {
         polygon_mode = VK_POLYGON_MODE_FILL;
     }
 
-    VkPipelineRasterizationStateCreateInfo rasterizer = {
+    job->rasterizer = (VkPipelineRasterizationStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
         .depthClampEnable =
             r->enabled_physical_device_features.depthClamp == VK_TRUE ?
@@ -853,152 +1347,102 @@ static void create_pipeline(PGRAPHState *pg)
         .rasterizerDiscardEnable = VK_FALSE,
         .polygonMode = polygon_mode,
         .lineWidth = 1.0f,
-        .frontFace = (pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER) &
-                      NV_PGRAPH_SETUPRASTER_FRONTFACE) ?
-                          VK_FRONT_FACE_COUNTER_CLOCKWISE :
-                          VK_FRONT_FACE_CLOCKWISE,
+        .cullMode = state.cull_mode,
+        .frontFace = state.front_face,
         .depthBiasEnable = VK_FALSE,
         .pNext = rasterizer_next_struct,
     };
 
-    if (pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER) & NV_PGRAPH_SETUPRASTER_CULLENABLE) {
-        uint32_t cull_face = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_SETUPRASTER),
-                                      NV_PGRAPH_SETUPRASTER_CULLCTRL);
-        assert(cull_face < ARRAY_SIZE(pgraph_cull_face_vk_map));
-        rasterizer.cullMode = pgraph_cull_face_vk_map[cull_face];
-    } else {
-        rasterizer.cullMode = VK_CULL_MODE_NONE;
-    }
-
-    VkPipelineMultisampleStateCreateInfo multisampling = {
+    job->multisampling = (VkPipelineMultisampleStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
         .sampleShadingEnable = VK_FALSE,
         .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
     };
 
-    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+    job->depth_stencil = (VkPipelineDepthStencilStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
-        .depthWriteEnable = depth_write ? VK_TRUE : VK_FALSE,
+        .depthTestEnable = state.depth_test_enable,
+        .depthWriteEnable = state.depth_write_enable,
+        .depthCompareOp = state.depth_compare_op,
+        .stencilTestEnable = state.stencil_test_enable,
+        .front = state.stencil,
+        .back = state.stencil,
     };
 
-    if (depth_test) {
-        depth_stencil.depthTestEnable = VK_TRUE;
-        uint32_t depth_func =
-            GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_0), NV_PGRAPH_CONTROL_0_ZFUNC);
-        assert(depth_func < ARRAY_SIZE(pgraph_depth_func_vk_map));
-        depth_stencil.depthCompareOp = pgraph_depth_func_vk_map[depth_func];
-    }
-
-    if (stencil_test) {
-        depth_stencil.stencilTestEnable = VK_TRUE;
-        uint32_t stencil_func = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1),
-                                         NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
-        uint32_t stencil_ref = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1),
-                                        NV_PGRAPH_CONTROL_1_STENCIL_REF);
-        uint32_t mask_read = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1),
-                                      NV_PGRAPH_CONTROL_1_STENCIL_MASK_READ);
-        uint32_t mask_write = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_1),
-                                       NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE);
-        uint32_t op_fail = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_2),
-                                    NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL);
-        uint32_t op_zfail = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_2),
-                                     NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL);
-        uint32_t op_zpass = GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_CONTROL_2),
-                                     NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS);
-
-        assert(stencil_func < ARRAY_SIZE(pgraph_stencil_func_vk_map));
-        assert(op_fail < ARRAY_SIZE(pgraph_stencil_op_vk_map));
-        assert(op_zfail < ARRAY_SIZE(pgraph_stencil_op_vk_map));
-        assert(op_zpass < ARRAY_SIZE(pgraph_stencil_op_vk_map));
-
-        depth_stencil.front.failOp = pgraph_stencil_op_vk_map[op_fail];
-        depth_stencil.front.passOp = pgraph_stencil_op_vk_map[op_zpass];
-        depth_stencil.front.depthFailOp = pgraph_stencil_op_vk_map[op_zfail];
-        depth_stencil.front.compareOp =
-            pgraph_stencil_func_vk_map[stencil_func];
-        depth_stencil.front.compareMask = mask_read;
-        depth_stencil.front.writeMask = mask_write;
-        depth_stencil.front.reference = stencil_ref;
-        depth_stencil.back = depth_stencil.front;
-    }
-
-    VkColorComponentFlags write_mask = 0;
-    if (control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE)
-        write_mask |= VK_COLOR_COMPONENT_R_BIT;
-    if (control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE)
-        write_mask |= VK_COLOR_COMPONENT_G_BIT;
-    if (control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE)
-        write_mask |= VK_COLOR_COMPONENT_B_BIT;
-    if (control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE)
-        write_mask |= VK_COLOR_COMPONENT_A_BIT;
-
-    VkPipelineColorBlendAttachmentState color_blend_attachment = {
-        .colorWriteMask = write_mask,
+    const VkColorBlendEquationEXT *eq = &state.color_blend_equation;
+    job->color_blend_attachment = (VkPipelineColorBlendAttachmentState){
+        .blendEnable = state.color_blend_enable,
+        .srcColorBlendFactor = eq->srcColorBlendFactor,
+        .dstColorBlendFactor = eq->dstColorBlendFactor,
+        .colorBlendOp = eq->colorBlendOp,
+        .srcAlphaBlendFactor = eq->srcAlphaBlendFactor,
+        .dstAlphaBlendFactor = eq->dstAlphaBlendFactor,
+        .alphaBlendOp = eq->alphaBlendOp,
+        .colorWriteMask = state.color_write_mask,
     };
 
-    float blend_constant[4] = { 0, 0, 0, 0 };
-
-    if (pgraph_reg_r(pg, NV_PGRAPH_BLEND) & NV_PGRAPH_BLEND_EN) {
-        color_blend_attachment.blendEnable = VK_TRUE;
-
-        uint32_t sfactor =
-            GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_BLEND), NV_PGRAPH_BLEND_SFACTOR);
-        uint32_t dfactor =
-            GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_BLEND), NV_PGRAPH_BLEND_DFACTOR);
-        assert(sfactor < ARRAY_SIZE(pgraph_blend_factor_vk_map));
-        assert(dfactor < ARRAY_SIZE(pgraph_blend_factor_vk_map));
-        color_blend_attachment.srcColorBlendFactor =
-            pgraph_blend_factor_vk_map[sfactor];
-        color_blend_attachment.dstColorBlendFactor =
-            pgraph_blend_factor_vk_map[dfactor];
-        color_blend_attachment.srcAlphaBlendFactor =
-            pgraph_blend_factor_vk_map[sfactor];
-        color_blend_attachment.dstAlphaBlendFactor =
-            pgraph_blend_factor_vk_map[dfactor];
-
-        uint32_t equation =
-            GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_BLEND), NV_PGRAPH_BLEND_EQN);
-        assert(equation < ARRAY_SIZE(pgraph_blend_equation_vk_map));
-
-        color_blend_attachment.colorBlendOp =
-            pgraph_blend_equation_vk_map[equation];
-        color_blend_attachment.alphaBlendOp =
-            pgraph_blend_equation_vk_map[equation];
-
-        uint32_t blend_color = pgraph_reg_r(pg, NV_PGRAPH_BLENDCOLOR);
-        pgraph_argb_pack32_to_rgba_float(blend_color, blend_constant);
-    }
-
-    VkPipelineColorBlendStateCreateInfo color_blending = {
+    job->color_blending = (VkPipelineColorBlendStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
         .logicOpEnable = VK_FALSE,
         .logicOp = VK_LOGIC_OP_COPY,
-        .attachmentCount = r->color_binding ? 1 : 0,
-        .pAttachments = r->color_binding ? &color_blend_attachment : NULL,
-        .blendConstants[0] = blend_constant[0],
-        .blendConstants[1] = blend_constant[1],
-        .blendConstants[2] = blend_constant[2],
-        .blendConstants[3] = blend_constant[3],
+        .attachmentCount = has_color ? 1 : 0,
+        .pAttachments = has_color ? &job->color_blend_attachment : NULL,
     };
 
-    VkDynamicState dynamic_states[3] = { VK_DYNAMIC_STATE_VIEWPORT,
-                                         VK_DYNAMIC_STATE_SCISSOR };
-    int num_dynamic_states = 2;
+    int num_dynamic_states = 0;
+    job->dynamic_states[num_dynamic_states++] = VK_DYNAMIC_STATE_VIEWPORT;
+    job->dynamic_states[num_dynamic_states++] = VK_DYNAMIC_STATE_SCISSOR;
+    job->dynamic_states[num_dynamic_states++] =
+        VK_DYNAMIC_STATE_BLEND_CONSTANTS;
+    job->dynamic_states[num_dynamic_states++] =
+        VK_DYNAMIC_STATE_STENCIL_COMPARE_MASK;
+    job->dynamic_states[num_dynamic_states++] =
+        VK_DYNAMIC_STATE_STENCIL_WRITE_MASK;
+    job->dynamic_states[num_dynamic_states++] =
+        VK_DYNAMIC_STATE_STENCIL_REFERENCE;
+    if (r->extended_dynamic_state_extension_enabled) {
+        static const VkDynamicState extended_dynamic_states[] = {
+            VK_DYNAMIC_STATE_CULL_MODE_EXT,
+            VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+            VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+            VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+            VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT,
+            VK_DYNAMIC_STATE_STENCIL_TEST_ENABLE_EXT,
+            VK_DYNAMIC_STATE_STENCIL_OP_EXT,
+        };
+        for (int i = 0; i < ARRAY_SIZE(extended_dynamic_states); i++) {
+            job->dynamic_states[num_dynamic_states++] =
+                extended_dynamic_states[i];
+        }
+    }
+    if (r->extended_dynamic_state3_extension_enabled) {
+        job->dynamic_states[num_dynamic_states++] =
+            VK_DYNAMIC_STATE_COLOR_BLEND_ENABLE_EXT;
+        job->dynamic_states[num_dynamic_states++] =
+            VK_DYNAMIC_STATE_COLOR_BLEND_EQUATION_EXT;
+        job->dynamic_states[num_dynamic_states++] =
+            VK_DYNAMIC_STATE_COLOR_WRITE_MASK_EXT;
+    }
 
     snode->has_dynamic_line_width =
         (r->enabled_physical_device_features.wideLines == VK_TRUE) &&
-        (r->shader_binding->state.geom.polygon_front_mode == POLY_MODE_LINE ||
-         r->shader_binding->state.geom.primitive_mode == PRIM_TYPE_LINES ||
-         r->shader_binding->state.geom.primitive_mode == PRIM_TYPE_LINE_LOOP ||
-         r->shader_binding->state.geom.primitive_mode == PRIM_TYPE_LINE_STRIP);
+        (binding->state.geom.polygon_front_mode == POLY_MODE_LINE ||
+         binding->state.geom.primitive_mode == PRIM_TYPE_LINES ||
+         binding->state.geom.primitive_mode == PRIM_TYPE_LINE_LOOP ||
+         binding->state.geom.primitive_mode == PRIM_TYPE_LINE_STRIP);
     if (snode->has_dynamic_line_width) {
-        dynamic_states[num_dynamic_states++] = VK_DYNAMIC_STATE_LINE_WIDTH;
+        job->dynamic_states[num_dynamic_states++] = VK_DYNAMIC_STATE_LINE_WIDTH;
+    }
+    if (r->vertex_input_dynamic_state_extension_enabled) {
+        job->dynamic_states[num_dynamic_states++] =
+            VK_DYNAMIC_STATE_VERTEX_INPUT_EXT;
     }
+    assert(num_dynamic_states <= ARRAY_SIZE(job->dynamic_states));
 
-    VkPipelineDynamicStateCreateInfo dynamic_state = {
+    job->dynamic_state = (VkPipelineDynamicStateCreateInfo){
         .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
         .dynamicStateCount = num_dynamic_states,
-        .pDynamicStates = dynamic_states,
+        .pDynamicStates = job->dynamic_states,
     };
 
     // FIXME: Dither
@@ -1018,70 +1462,632 @@ static void create_pipeline(PGRAPHState *pg)
     // FIXME: No direct analog. Just do it with MSAA.
     // }
 
+    VkPipelineLayout layout = create_pipeline_layout(r, binding);
 
-    VkPipelineLayoutCreateInfo pipeline_layout_info = {
-        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-        .setLayoutCount = 1,
-        .pSetLayouts = &r->descriptor_set_layout,
+    job->render_pass_state = key->render_pass_state;
+    job->create_info = (VkGraphicsPipelineCreateInfo){
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = r->dynamic_rendering_extension_enabled ? &job->rendering_info :
+                                                          NULL,
+        .stageCount = num_active_shader_stages,
+        .pStages = job->shader_stages,
+        .pVertexInputState = &job->vertex_input,
+        .pInputAssemblyState = &job->input_assembly,
+        .pViewportState = &job->viewport_state,
+        .pRasterizationState = &job->rasterizer,
+        .pMultisampleState = &job->multisampling,
+        .pDepthStencilState = has_zeta ? &job->depth_stencil : NULL,
+        .pColorBlendState = &job->color_blending,
+        .pDynamicState = &job->dynamic_state,
+        .layout = layout,
+        .renderPass = init_pipeline_rendering_info(
+            r, &job->render_pass_state, &job->rendering_info),
+        .subpass = 0,
+        .basePipelineHandle = VK_NULL_HANDLE,
     };
+}
 
-    VkPushConstantRange push_constant_range;
-    if (r->use_push_constants_for_uniform_attrs) {
-        int num_uniform_attributes =
-            __builtin_popcount(r->shader_binding->state.vsh.uniform_attrs);
-        if (num_uniform_attributes) {
-            push_constant_range = (VkPushConstantRange){
-                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
-                .offset = 0,
-                // FIXME: Minimize push constants
-                .size = num_uniform_attributes * 4 * sizeof(float),
-            };
-            pipeline_layout_info.pushConstantRangeCount = 1;
-            pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+static VkPipeline create_pipeline_library(PGRAPHVkState *r,
+                                          const PipelineCompileJob *job,
+                                          VkGraphicsPipelineLibraryFlagsEXT flags,
+                                          VkPipelineLayout layout)
+{
+    VkGraphicsPipelineLibraryCreateInfoEXT library_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_LIBRARY_CREATE_INFO_EXT,
+        .pNext = job->create_info.pNext,
+        .flags = flags,
+    };
+
+    // State that doesn't belong to the library being built is ignored
+    VkGraphicsPipelineCreateInfo create_info = job->create_info;
+    create_info.pNext = &library_info;
+    create_info.flags = VK_PIPELINE_CREATE_LIBRARY_BIT_KHR;
+    create_info.layout = layout;
+
+    VkPipelineShaderStageCreateInfo stages[3];
+    create_info.stageCount = 0;
+    create_info.pStages = stages;
+    for (int i = 0; i < job->create_info.stageCount; i++) {
+        bool is_fragment = job->shader_stages[i].stage ==
+                           VK_SHADER_STAGE_FRAGMENT_BIT;
+        if ((is_fragment &&
+             (flags &
+              VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT)) ||
+            (!is_fragment &&
+             (flags &
+              VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT))) {
+            stages[create_info.stageCount++] = job->shader_stages[i];
         }
     }
 
-    VkPipelineLayout layout;
-    VK_CHECK(vkCreatePipelineLayout(r->device, &pipeline_layout_info, NULL,
-                                    &layout));
+    VkPipeline library;
+    VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
+                                       &create_info, NULL, &library));
+    return library;
+}
+
+void pgraph_vk_destroy_pipeline_libraries(PGRAPHVkState *r,
+                                          ShaderBinding *binding)
+{
+    vkDestroyPipeline(r->device, binding->library.pre_rasterization, NULL);
+    vkDestroyPipeline(r->device, binding->library.fragment_shader, NULL);
+    vkDestroyPipelineLayout(r->device, binding->library.layout, NULL);
+    memset(&binding->library, 0, sizeof(binding->library));
+}
 
-    VkGraphicsPipelineCreateInfo pipeline_create_info = {
+/*
+ * The shader stages are the expensive part of a pipeline to compile. They are
+ * built into libraries once per shader binding and attachment formats, and only
+ * fixed-function state remains to be built for each pipeline. That is cheap
+ * as most of it is dynamic state.
+ */
+static void ensure_shader_pipeline_libraries(PGRAPHVkState *r,
+                                             ShaderBinding *binding,
+                                             const PipelineCompileJob *job)
+{
+    const RenderPassState *state = &job->render_pass_state;
+    if (binding->library.pre_rasterization &&
+        !memcmp(&binding->library.render_pass_state, state, sizeof(*state))) {
+        return;
+    }
+
+    pgraph_vk_destroy_pipeline_libraries(r, binding);
+
+    binding->library.render_pass_state = *state;
+    binding->library.layout = create_pipeline_layout(r, binding);
+    binding->library.pre_rasterization = create_pipeline_library(
+        r, job, VK_GRAPHICS_PIPELINE_LIBRARY_PRE_RASTERIZATION_SHADERS_BIT_EXT,
+        binding->library.layout);
+    binding->library.fragment_shader = create_pipeline_library(
+        r, job, VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_SHADER_BIT_EXT,
+        binding->library.layout);
+}
+
+// Link a pipeline from libraries without link-time optimization. It stands in
+// until the optimized pipeline compiled from the same job is ready.
+static VkPipeline fast_link_pipeline(PGRAPHVkState *r, ShaderBinding *binding,
+                                     const PipelineCompileJob *job)
+{
+    ensure_shader_pipeline_libraries(r, binding, job);
+
+    VkPipeline libraries[] = {
+        create_pipeline_library(
+            r, job, VK_GRAPHICS_PIPELINE_LIBRARY_VERTEX_INPUT_INTERFACE_BIT_EXT,
+            VK_NULL_HANDLE),
+        binding->library.pre_rasterization,
+        binding->library.fragment_shader,
+        create_pipeline_library(
+            r, job,
+            VK_GRAPHICS_PIPELINE_LIBRARY_FRAGMENT_OUTPUT_INTERFACE_BIT_EXT,
+            VK_NULL_HANDLE),
+    };
+
+    VkPipelineLibraryCreateInfoKHR library_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LIBRARY_CREATE_INFO_KHR,
+        .libraryCount = ARRAY_SIZE(libraries),
+        .pLibraries = libraries,
+    };
+    VkGraphicsPipelineCreateInfo create_info = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
-        .stageCount = num_active_shader_stages,
-        .pStages = shader_stages,
-        .pVertexInputState = &vertex_input,
-        .pInputAssemblyState = &input_assembly,
-        .pViewportState = &viewport_state,
-        .pRasterizationState = &rasterizer,
-        .pMultisampleState = &multisampling,
-        .pDepthStencilState = r->zeta_binding ? &depth_stencil : NULL,
-        .pColorBlendState = &color_blending,
-        .pDynamicState = &dynamic_state,
-        .layout = layout,
-        .renderPass = get_render_pass(r, &key.render_pass_state),
-        .subpass = 0,
-        .basePipelineHandle = VK_NULL_HANDLE,
+        .pNext = &library_info,
+        .layout = job->create_info.layout,
     };
+
+    VkPipeline pipeline;
+    VK_CHECK(vkCreateGraphicsPipelines(r->device, VK_NULL_HANDLE, 1,
+                                       &create_info, NULL, &pipeline));
+
+    // Linked pipelines don't reference their libraries
+    vkDestroyPipeline(r->device, libraries[0], NULL);
+    vkDestroyPipeline(r->device, libraries[3], NULL);
+
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_FAST_LINK);
+
+    return pipeline;
+}
+
+static void *pipeline_compile_worker_thread(void *opaque)
+{
+    PGRAPHVkState *r = opaque;
+
+    xemu_trace_set_thread_name("nv2a.vk_pipeline_worker");
+    xemu_thread_topology_register(XEMU_THREAD_THROUGHPUT,
+                                  "nv2a.vk_pipeline_worker");
+    qemu_mutex_lock(&r->pipeline_job_lock);
+    while (true) {
+        PipelineCompileJob *job;
+        while (!(job = QSIMPLEQ_FIRST(&r->pipeline_job_queue)) &&
+               !r->pipeline_workers_shutdown) {
+            qemu_cond_wait(&r->pipeline_job_cond, &r->pipeline_job_lock);
+        }
+        if (!job) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&r->pipeline_job_queue, entry);
+        qemu_mutex_unlock(&r->pipeline_job_lock);
+
+        VkPipeline pipeline;
+        VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
+                                           &job->create_info, NULL,
+                                           &pipeline));
+        job->pipeline = pipeline;
+        qatomic_store_release(&job->complete, true);
+
+        qemu_mutex_lock(&r->pipeline_job_lock);
+    }
+    qemu_mutex_unlock(&r->pipeline_job_lock);
+
+    return NULL;
+}
+
+static void start_pipeline_workers(PGRAPHVkState *r)
+{
+    if (r->num_pipeline_workers) {
+        return;
+    }
+
+    r->num_pipeline_workers =
+        MAX(1, MIN(MAX_PIPELINE_WORKERS, (int)g_get_num_processors() / 2));
+    r->pipeline_workers = g_new(QemuThread, r->num_pipeline_workers);
+    for (int i = 0; i < r->num_pipeline_workers; i++) {
+        qemu_thread_create(&r->pipeline_workers[i], "nv2a.vk_pipeline_worker",
+                           pipeline_compile_worker_thread, r,
+                           QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void stop_pipeline_workers(PGRAPHVkState *r)
+{
+    if (!r->num_pipeline_workers) {
+        return;
+    }
+
+    /* Workers drain the queue before exiting */
+    qemu_mutex_lock(&r->pipeline_job_lock);
+    r->pipeline_workers_shutdown = true;
+    qemu_cond_broadcast(&r->pipeline_job_cond);
+    qemu_mutex_unlock(&r->pipeline_job_lock);
+
+    for (int i = 0; i < r->num_pipeline_workers; i++) {
+        qemu_thread_join(&r->pipeline_workers[i]);
+    }
+    g_free(r->pipeline_workers);
+    r->pipeline_workers = NULL;
+    r->num_pipeline_workers = 0;
+    r->pipeline_workers_shutdown = false;
+}
+
+static void submit_pipeline_compile_job(PGRAPHState *pg,
+                                        ShaderBinding *binding,
+                                        PipelineBinding *snode,
+                                        bool fast_link)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    start_pipeline_workers(r);
+
+    PipelineCompileJob *job = g_malloc0(sizeof(PipelineCompileJob));
+    init_pipeline_compile_job(r, binding, snode, job);
+
+    if (fast_link) {
+        snode->pipeline = fast_link_pipeline(r, binding, job);
+        add_pipeline_variant(r, snode);
+    }
+
+    /* Keep the modules alive while the worker is using them */
+    job->module_infos[0] = binding->vsh.module_info;
+    job->module_infos[1] = binding->geom.module_info;
+    job->module_infos[2] = binding->psh.module_info;
+    for (int i = 0; i < ARRAY_SIZE(job->module_infos); i++) {
+        if (job->module_infos[i]) {
+            pgraph_vk_ref_shader_module(job->module_infos[i]);
+        }
+    }
+
+    snode->layout = job->create_info.layout;
+    snode->render_pass = job->create_info.renderPass;
+    snode->draw_time = pg->draw_time;
+    snode->job = job;
+
+    qemu_mutex_lock(&r->pipeline_job_lock);
+    QSIMPLEQ_INSERT_TAIL(&r->pipeline_job_queue, job, entry);
+    qemu_cond_signal(&r->pipeline_job_cond);
+    qemu_mutex_unlock(&r->pipeline_job_lock);
+
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_ASYNC_GEN);
+}
+
+static bool try_finish_pipeline_compile_job(PGRAPHVkState *r,
+                                            PipelineBinding *snode)
+{
+    PipelineCompileJob *job = snode->job;
+
+    if (!qatomic_load_acquire(&job->complete)) {
+        return false;
+    }
+
+    if (snode->pipeline != VK_NULL_HANDLE) {
+        // Command buffers may still reference the fast-linked pipeline
+        assert(snode->fast_linked_pipeline == VK_NULL_HANDLE);
+        snode->fast_linked_pipeline = snode->pipeline;
+        if (r->pipeline_binding == snode) {
+            r->pipeline_binding_changed = true;
+        }
+    }
+    snode->pipeline = job->pipeline;
+    for (int i = 0; i < ARRAY_SIZE(job->module_infos); i++) {
+        if (job->module_infos[i]) {
+            pgraph_vk_unref_shader_module(r, job->module_infos[i]);
+        }
+    }
+    g_free(job);
+    snode->job = NULL;
+
+    add_pipeline_variant(r, snode);
+
+    return true;
+}
+
+// While a pipeline is being compiled, either skip the draw or draw with an
+// already compiled pipeline built from the same shaders and vertex layout.
+static bool bind_pending_pipeline_fallback(PGRAPHState *pg,
+                                           PipelineBinding *snode)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_PENDING);
+    r->pipeline_binding_pending = true;
+
+    PipelineBinding *fallback = NULL;
+    if (g_config.display.vulkan.async_pipeline_compile ==
+        CONFIG_DISPLAY_VULKAN_ASYNC_PIPELINE_COMPILE_FALLBACK) {
+        fallback = find_pipeline_variant(r, snode);
+    }
+    if (!fallback) {
+        NV2A_VK_DPRINTF("Skipping draw, pipeline pending");
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_FALLBACK);
+    r->pipeline_binding_changed = r->pipeline_binding != fallback;
+    r->pipeline_binding = fallback;
+
+    return true;
+}
+
+static bool create_pipeline(PGRAPHState *pg)
+{
+    NV2A_VK_DGROUP_BEGIN("Creating pipeline");
+
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    pgraph_vk_bind_textures(d);
+    pgraph_vk_bind_shaders(pg);
+
+    // FIXME: If nothing was dirty, don't even try creating the key or hashing.
+    //        Just use the same pipeline.
+    bool pipeline_dirty = check_pipeline_dirty(pg);
+
+    pgraph_clear_dirty_reg_map(pg);
+    // FIXME: We could clear less
+
+    if (r->pipeline_binding && !pipeline_dirty) {
+        // Pick up the optimized pipeline once it replaces a fast-linked one
+        if (r->pipeline_binding->job) {
+            try_finish_pipeline_compile_job(r, r->pipeline_binding);
+        }
+        NV2A_VK_DPRINTF("Cache hit");
+        NV2A_VK_DGROUP_END();
+        return true;
+    }
+
+    PipelineKey key;
+    init_pipeline_key(pg, &key);
+    uint64_t hash = get_pipeline_key_hash(&key);
+
+    LruNode *node = lru_lookup(&r->pipeline_cache, hash, &key);
+    PipelineBinding *snode = container_of(node, PipelineBinding, node);
+    if (snode->job && !try_finish_pipeline_compile_job(r, snode) &&
+        snode->pipeline == VK_NULL_HANDLE) {
+        bool can_draw = bind_pending_pipeline_fallback(pg, snode);
+        NV2A_VK_DGROUP_END();
+        return can_draw;
+    }
+    if (snode->pipeline != VK_NULL_HANDLE) {
+        NV2A_VK_DPRINTF("Cache hit");
+        nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_CACHE_HIT);
+        r->pipeline_binding_changed = r->pipeline_binding != snode;
+        r->pipeline_binding = snode;
+        r->pipeline_binding_pending = false;
+        NV2A_VK_DGROUP_END();
+        return true;
+    }
+
+    NV2A_VK_DPRINTF("Cache miss");
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_CACHE_MISS);
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_GEN);
+
+    memcpy(&snode->key, &key, sizeof(key));
+    snode->variant_hash = get_pipeline_variant_hash(&key);
+    pgraph_vk_trace_pipeline(r, &key);
+
+    if (r->graphics_pipeline_library_extension_enabled) {
+        submit_pipeline_compile_job(pg, r->shader_binding, snode, true);
+        r->pipeline_binding = snode;
+        r->pipeline_binding_changed = true;
+        r->pipeline_binding_pending = false;
+        NV2A_VK_DGROUP_END();
+        return true;
+    }
+
+    if (g_config.display.vulkan.async_pipeline_compile !=
+        CONFIG_DISPLAY_VULKAN_ASYNC_PIPELINE_COMPILE_OFF) {
+        submit_pipeline_compile_job(pg, r->shader_binding, snode, false);
+        bool can_draw = bind_pending_pipeline_fallback(pg, snode);
+        NV2A_VK_DGROUP_END();
+        return can_draw;
+    }
+
+    PipelineCompileJob job;
+    init_pipeline_compile_job(r, r->shader_binding, snode, &job);
+
     VkPipeline pipeline;
     VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
-                                       &pipeline_create_info, NULL, &pipeline));
+                                       &job.create_info, NULL, &pipeline));
 
     snode->pipeline = pipeline;
-    snode->layout = layout;
-    snode->render_pass = pipeline_create_info.renderPass;
+    snode->layout = job.create_info.layout;
+    snode->render_pass = job.create_info.renderPass;
     snode->draw_time = pg->draw_time;
+    add_pipeline_variant(r, snode);
 
     r->pipeline_binding = snode;
     r->pipeline_binding_changed = true;
+    r->pipeline_binding_pending = false;
 
     NV2A_VK_DGROUP_END();
+
+    return true;
+}
+
+// Compile a recorded pipeline ahead of its first use
+void pgraph_vk_prewarm_pipeline(PGRAPHState *pg, const PipelineKey *key)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->pipeline_cache.num_free) {
+        return;
+    }
+
+    // Bring the recorded key into the form init_pipeline_key produces
+    PipelineKey canonical_key;
+    memcpy(&canonical_key, key, sizeof(canonical_key));
+    canonical_key.shader_state_hash =
+        pgraph_glsl_hash_shader_state(&key->shader_state);
+    mask_pipeline_key_regs(r, &canonical_key);
+    if (r->vertex_input_dynamic_state_extension_enabled) {
+        canonical_key.num_binding_descriptions = 0;
+        canonical_key.num_attribute_descriptions = 0;
+        memset(canonical_key.binding_descriptions, 0,
+               sizeof(canonical_key.binding_descriptions));
+        memset(canonical_key.attribute_descriptions, 0,
+               sizeof(canonical_key.attribute_descriptions));
+    }
+    key = &canonical_key;
+
+    // Only fill free entries, never evict
+    uint64_t hash = get_pipeline_key_hash(key);
+    if (lru_contains_hash(&r->pipeline_cache, hash)) {
+        return;
+    }
+
+    ShaderBinding *binding =
+        pgraph_vk_get_shader_binding(pg, &key->shader_state);
+
+    LruNode *node = lru_lookup(&r->pipeline_cache, hash, key);
+    PipelineBinding *snode = container_of(node, PipelineBinding, node);
+    memcpy(&snode->key, key, sizeof(*key));
+    snode->variant_hash = get_pipeline_variant_hash(key);
+
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_GEN);
+    submit_pipeline_compile_job(pg, binding, snode, false);
+}
+
+/*
+ * Consecutive non-indexed draws that need no other command in between are
+ * collected into a batch. The batch is recorded as a single multi-draw when
+ * VK_EXT_multi_draw is available, and contiguous ranges are merged into one
+ * draw (all topologies are lists). Anything else recorded into the render
+ * pass flushes the batch first, so command order is unchanged.
+ */
+static void flush_draw_batch(PGRAPHVkState *r)
+{
+    DrawBatch *b = &r->draw_batch;
+
+    if (!b->num_draws) {
+        return;
+    }
+
+    if (b->num_draws > 1 && r->multi_draw_extension_enabled) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_BATCH_MULTI);
+        pgraph_vk_cmd_draw_multi(r, b->num_draws, b->draws);
+    } else {
+        for (int i = 0; i < b->num_draws; i++) {
+            pgraph_vk_cmd_draw(r, b->draws[i].vertexCount, 1,
+                               b->draws[i].firstVertex, 0);
+        }
+    }
+    b->num_draws = 0;
+}
+
+static int get_vertices_per_primitive(PGRAPHVkState *r)
+{
+    switch (r->shader_binding->state.geom.primitive_mode) {
+    case PRIM_TYPE_POINTS:
+        return 1;
+    case PRIM_TYPE_LINES:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+static void record_draw(PGRAPHState *pg, uint32_t first, uint32_t count)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    DrawBatch *b = &r->draw_batch;
+    int vertices_per_primitive = get_vertices_per_primitive(r);
+
+    if (b->num_draws) {
+        VkMultiDrawInfoEXT *last = &b->draws[b->num_draws - 1];
+        if (last->firstVertex + last->vertexCount == first &&
+            last->vertexCount % vertices_per_primitive == 0) {
+            nv2a_profile_inc_counter(NV2A_PROF_DRAW_BATCH_MERGE);
+            last->vertexCount += count;
+            return;
+        }
+    }
+
+    int max_draws = r->multi_draw_extension_enabled ?
+                        MIN(MAX_BATCHED_DRAWS, r->max_multi_draw_count) :
+                        MAX_BATCHED_DRAWS;
+    if (b->num_draws == max_draws) {
+        flush_draw_batch(r);
+    }
+    b->draws[b->num_draws++] =
+        (VkMultiDrawInfoEXT){ .firstVertex = first, .vertexCount = count };
+
+    // Keep each draw inside its debug label
+    if (r->debug_utils_extension_enabled) {
+        flush_draw_batch(r);
+    }
+}
+
+// Called when the pipeline is bound, other state is then re-recorded
+static void invalidate_bound_draw_state(PGRAPHVkState *r)
+{
+    r->bound_state.descriptor_set = VK_NULL_HANDLE;
+    r->bound_state.num_vertex_buffers = -1;
+    r->bound_state.num_vertex_bindings = -1;
+    r->bound_state.dynamic_state_valid = false;
+    r->bound_state.vsh_push_size = -1;
+    r->bound_state.psh_push_size = -1;
+}
+
+static void set_vertex_input(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->vertex_input_dynamic_state_extension_enabled) {
+        return;
+    }
+
+    BoundDrawState *bound = &r->bound_state;
+    int num_bindings = r->num_active_vertex_binding_descriptions;
+    int num_attributes = r->num_active_vertex_attribute_descriptions;
+
+    if (bound->num_vertex_bindings == num_bindings &&
+        bound->num_vertex_attributes == num_attributes &&
+        !memcmp(bound->vertex_bindings, r->vertex_binding_descriptions,
+                num_bindings * sizeof(bound->vertex_bindings[0])) &&
+        !memcmp(bound->vertex_attributes, r->vertex_attribute_descriptions,
+                num_attributes * sizeof(bound->vertex_attributes[0]))) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_STATE_BIND_SKIPPED);
+        return;
+    }
+
+    VkVertexInputBindingDescription2EXT bindings[NV2A_VERTEXSHADER_ATTRIBUTES];
+    for (int i = 0; i < num_bindings; i++) {
+        const VkVertexInputBindingDescription *desc =
+            &r->vertex_binding_descriptions[i];
+        bindings[i] = (VkVertexInputBindingDescription2EXT){
+            .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_BINDING_DESCRIPTION_2_EXT,
+            .binding = desc->binding,
+            .stride = desc->stride,
+            .inputRate = desc->inputRate,
+            .divisor = 1,
+        };
+    }
+
+    VkVertexInputAttributeDescription2EXT
+        attributes[NV2A_VERTEXSHADER_ATTRIBUTES];
+    for (int i = 0; i < num_attributes; i++) {
+        const VkVertexInputAttributeDescription *desc =
+            &r->vertex_attribute_descriptions[i];
+        attributes[i] = (VkVertexInputAttributeDescription2EXT){
+            .sType = VK_STRUCTURE_TYPE_VERTEX_INPUT_ATTRIBUTE_DESCRIPTION_2_EXT,
+            .location = desc->location,
+            .binding = desc->binding,
+            .format = desc->format,
+            .offset = desc->offset,
+        };
+    }
+
+    flush_draw_batch(r);
+    pgraph_vk_cmd_set_vertex_input(r, num_bindings, bindings, num_attributes,
+                                   attributes);
+    bound->num_vertex_bindings = num_bindings;
+    bound->num_vertex_attributes = num_attributes;
+    memcpy(bound->vertex_bindings, r->vertex_binding_descriptions,
+           num_bindings * sizeof(bound->vertex_bindings[0]));
+    memcpy(bound->vertex_attributes, r->vertex_attribute_descriptions,
+           num_attributes * sizeof(bound->vertex_attributes[0]));
+}
+
+static void set_dynamic_draw_state(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    BoundDrawState *bound = &r->bound_state;
+
+    uint32_t regs[ARRAY_SIZE(pipeline_key_regs)];
+    for (int i = 0; i < ARRAY_SIZE(pipeline_key_regs); i++) {
+        regs[i] = pgraph_reg_r(pg, pipeline_key_regs[i]);
+    }
+
+    DynamicDrawState state;
+    get_dynamic_draw_state(regs, &state);
+
+    const DynamicDrawState *old =
+        bound->dynamic_state_valid ? &bound->dynamic_state : NULL;
+    if (old && !memcmp(old, &state, sizeof(state))) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_STATE_BIND_SKIPPED);
+        return;
+    }
+
+    flush_draw_batch(r);
+    pgraph_vk_cmd_set_dynamic_state(r, old, &state);
+
+    memcpy(&bound->dynamic_state, &state, sizeof(state));
+    bound->dynamic_state_valid = true;
 }
 
 static void push_vertex_attr_values(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
+    BoundDrawState *bound = &r->bound_state;
 
-    if (!r->use_push_constants_for_uniform_attrs) {
+    if (!r->shader_binding->vsh.module_info->push_constants.num_uniforms) {
         return;
     }
 
@@ -1094,22 +2100,79 @@ static void push_vertex_attr_values(PGRAPHState *pg)
                              values, &num_uniform_attrs);
 
     if (num_uniform_attrs > 0) {
-        vkCmdPushConstants(r->command_buffer, r->pipeline_binding->layout,
-                           VK_SHADER_STAGE_VERTEX_BIT, 0,
-                           num_uniform_attrs * 4 * sizeof(float),
-                           &values);
+        int size = num_uniform_attrs * 4 * sizeof(float);
+        if (bound->vsh_push_size == size &&
+            !memcmp(bound->vsh_push, values, size)) {
+            nv2a_profile_inc_counter(NV2A_PROF_DRAW_STATE_BIND_SKIPPED);
+            return;
+        }
+
+        flush_draw_batch(r);
+        pgraph_vk_cmd_push_constants(r, r->pipeline_binding->layout,
+                                     VK_SHADER_STAGE_VERTEX_BIT,
+                                     PSH_PUSH_CONSTANTS_SIZE, size, &values);
+        bound->vsh_push_size = size;
+        memcpy(bound->vsh_push, values, size);
+    }
+}
+
+static void push_psh_uniform_values(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    BoundDrawState *bound = &r->bound_state;
+    ShaderUniformLayout *push_constants =
+        &r->shader_binding->psh.module_info->push_constants;
+
+    if (push_constants->total_size) {
+        int size = push_constants->total_size;
+        if (bound->psh_push_size == size &&
+            !memcmp(bound->psh_push, push_constants->allocation, size)) {
+            nv2a_profile_inc_counter(NV2A_PROF_DRAW_STATE_BIND_SKIPPED);
+            return;
+        }
+
+        flush_draw_batch(r);
+        pgraph_vk_cmd_push_constants(r, r->pipeline_binding->layout,
+                                     VK_SHADER_STAGE_FRAGMENT_BIT, 0, size,
+                                     push_constants->allocation);
+        bound->psh_push_size = size;
+        memcpy(bound->psh_push, push_constants->allocation, size);
     }
 }
 
 static void bind_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
-    assert(r->descriptor_set_index >= 1);
+    BoundDrawState *bound = &r->bound_state;
+    assert(r->bound_descriptor_set < r->descriptor_set_index);
+
+    // In binding order, vertex shader uniforms first
+    uint32_t dynamic_offsets[2] = {
+        r->uniform_buffer_offsets[0],
+        r->uniform_buffer_offsets[1],
+    };
+    // The bindless set is never replaced, so it goes along with the other
+    VkDescriptorSet descriptor_sets[] = {
+        r->frame->descriptor_sets[r->bound_descriptor_set],
+        r->bindless.descriptor_set,
+    };
+    VkDescriptorSet descriptor_set = descriptor_sets[0];
+
+    if (bound->descriptor_set == descriptor_set &&
+        !memcmp(bound->dynamic_offsets, dynamic_offsets,
+                sizeof(dynamic_offsets))) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_STATE_BIND_SKIPPED);
+        return;
+    }
 
-    vkCmdBindDescriptorSets(r->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            r->pipeline_binding->layout, 0, 1,
-                            &r->descriptor_sets[r->descriptor_set_index - 1], 0,
-                            NULL);
+    flush_draw_batch(r);
+    pgraph_vk_cmd_bind_descriptor_sets(r, r->pipeline_binding->layout,
+                                       r->bindless.enabled ? 2 : 1,
+                                       descriptor_sets,
+                                       ARRAY_SIZE(dynamic_offsets),
+                                       dynamic_offsets);
+    bound->descriptor_set = descriptor_set;
+    memcpy(bound->dynamic_offsets, dynamic_offsets, sizeof(dynamic_offsets));
 }
 
 static void begin_query(PGRAPHVkState *r)
@@ -1154,12 +2217,37 @@ static void sync_staging_buffer(PGRAPHState *pg, VkCommandBuffer cmd,
     StorageBuffer *b_src = &r->storage_buffers[index_src];
     StorageBuffer *b_dst = &r->storage_buffers[index_dst];
 
-    if (!b_src->buffer_offset) {
+    // Destination mirrors the staging ring, so frames never overlap
+    VkBufferCopy copy_regions[2];
+    int num_copy_regions = 0;
+    if (b_src->frame_wrap_offset) {
+        copy_regions[num_copy_regions++] = (VkBufferCopy){
+            .srcOffset = b_src->frame_offset,
+            .dstOffset = b_src->frame_offset,
+            .size = b_src->frame_wrap_offset - b_src->frame_offset,
+        };
+        copy_regions[num_copy_regions++] = (VkBufferCopy){
+            .srcOffset = 0,
+            .dstOffset = 0,
+            .size = b_src->buffer_offset,
+        };
+    } else if (b_src->buffer_offset > b_src->frame_offset) {
+        copy_regions[num_copy_regions++] = (VkBufferCopy){
+            .srcOffset = b_src->frame_offset,
+            .dstOffset = b_src->frame_offset,
+            .size = b_src->buffer_offset - b_src->frame_offset,
+        };
+    }
+
+    b_src->frame_offset = b_src->buffer_offset;
+    b_src->frame_wrap_offset = 0;
+
+    if (!num_copy_regions) {
         return;
     }
 
-    VkBufferCopy copy_region = { .size = b_src->buffer_offset };
-    vkCmdCopyBuffer(cmd, b_src->buffer, b_dst->buffer, 1, &copy_region);
+    vkCmdCopyBuffer(cmd, b_src->buffer, b_dst->buffer, num_copy_regions,
+                    copy_regions);
 
     VkAccessFlags dst_access_mask;
     VkPipelineStageFlags dst_stage_mask;
@@ -1189,21 +2277,30 @@ static void sync_staging_buffer(PGRAPHState *pg, VkCommandBuffer cmd,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .buffer = b_dst->buffer,
-        .size = b_src->buffer_offset
+        .offset = 0,
+        .size = VK_WHOLE_SIZE,
     };
     vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage_mask, 0,
                          0, NULL, 1, &barrier, 0, NULL);
-
-    b_src->buffer_offset = 0;
 }
 
 static void flush_memory_buffer(PGRAPHState *pg, VkCommandBuffer cmd)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
-
-    VK_CHECK(vmaFlushAllocation(
-        r->allocator, r->storage_buffers[BUFFER_VERTEX_RAM].allocation, 0,
-        VK_WHOLE_SIZE));
+    StorageBuffer *b = &r->storage_buffers[BUFFER_VERTEX_RAM];
+
+    if (b->imported_memory == VK_NULL_HANDLE) {
+        VK_CHECK(vmaFlushAllocation(r->allocator, b->allocation, 0,
+                                    VK_WHOLE_SIZE));
+    } else if (!(b->properties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        VkMappedMemoryRange range = {
+            .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+            .memory = b->imported_memory,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE,
+        };
+        VK_CHECK(vkFlushMappedMemoryRanges(r->device, 1, &range));
+    }
 
     VkBufferMemoryBarrier barrier = {
         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
@@ -1211,7 +2308,7 @@ static void flush_memory_buffer(PGRAPHState *pg, VkCommandBuffer cmd)
         .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .buffer = r->storage_buffers[BUFFER_VERTEX_RAM].buffer,
+        .buffer = b->buffer,
         .offset = 0,
         .size = VK_WHOLE_SIZE,
     };
@@ -1221,40 +2318,352 @@ static void flush_memory_buffer(PGRAPHState *pg, VkCommandBuffer cmd)
                          &barrier, 0, NULL);
 }
 
-static void begin_render_pass(PGRAPHState *pg)
+/*
+ * Dynamic rendering takes the load and store ops when beginning, and the
+ * external dependency declared by render pass objects is recorded as a
+ * barrier ahead of it instead.
+ */
+static void cmd_begin_rendering(VkCommandBuffer cmd,
+                                const RenderPassBegin *begin,
+                                bool secondary_contents)
 {
-    PGRAPHVkState *r = pg->vk_renderer_state;
+    bool color = begin->state.color_format != VK_FORMAT_UNDEFINED;
+    bool zeta = begin->state.zeta_format != VK_FORMAT_UNDEFINED;
+    bool stencil =
+        pgraph_vk_format_has_stencil_component(begin->state.zeta_format);
+
+    VkMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+    };
+    VkPipelineStageFlags stages = 0;
+    if (color) {
+        stages |= VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        barrier.srcAccessMask |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                 VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    }
+    if (zeta) {
+        stages |= VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                  VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        barrier.srcAccessMask |= VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    }
+    barrier.dstAccessMask = barrier.srcAccessMask;
+    vkCmdPipelineBarrier(cmd, stages, stages, 0, 1, &barrier, 0, NULL, 0,
+                         NULL);
+
+    VkRenderingAttachmentInfoKHR color_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+        .imageView = begin->target.color_view,
+        .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .loadOp = begin->ops.color_load_op,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .clearValue = begin->clear_values[0],
+    };
+    VkRenderingAttachmentInfoKHR depth_attachment = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR,
+        .imageView = begin->target.zeta_view,
+        .imageLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+        .loadOp = begin->ops.depth_load_op,
+        .storeOp = begin->ops.depth_store_op,
+        .clearValue = begin->clear_values[color ? 1 : 0],
+    };
+    VkRenderingAttachmentInfoKHR stencil_attachment = depth_attachment;
+    stencil_attachment.loadOp = begin->ops.stencil_load_op;
+    stencil_attachment.storeOp = begin->ops.stencil_store_op;
+
+    VkRenderingInfoKHR rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR,
+        .flags = secondary_contents ?
+                     VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR :
+                     0,
+        .renderArea = begin->render_area,
+        .layerCount = 1,
+        .colorAttachmentCount = color ? 1 : 0,
+        .pColorAttachments = color ? &color_attachment : NULL,
+        .pDepthAttachment = zeta ? &depth_attachment : NULL,
+        .pStencilAttachment = stencil ? &stencil_attachment : NULL,
+    };
+    vkCmdBeginRenderingKHR(cmd, &rendering_info);
+}
+
+void pgraph_vk_cmd_begin_render_pass(PGRAPHVkState *r, VkCommandBuffer cmd,
+                                     const RenderPassBegin *begin,
+                                     bool secondary_contents)
+{
+    if (r->dynamic_rendering_extension_enabled) {
+        cmd_begin_rendering(cmd, begin, secondary_contents);
+        return;
+    }
+
+    VkRenderPassBeginInfo render_pass_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = begin->render_pass,
+        .framebuffer = begin->target.framebuffer,
+        .renderArea = begin->render_area,
+        .clearValueCount = begin->num_clear_values,
+        .pClearValues = begin->clear_values,
+    };
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info,
+                         secondary_contents ?
+                             VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS :
+                             VK_SUBPASS_CONTENTS_INLINE);
+}
+
+void pgraph_vk_cmd_end_render_pass(PGRAPHVkState *r, VkCommandBuffer cmd)
+{
+    if (r->dynamic_rendering_extension_enabled) {
+        vkCmdEndRenderingKHR(cmd);
+    } else {
+        vkCmdEndRenderPass(cmd);
+    }
+}
+
+static void init_render_pass_begin(PGRAPHVkState *r, RenderPassBegin *begin,
+                                   const RenderPassState *state,
+                                   const RenderPassOps *ops,
+                                   const RenderTarget *target,
+                                   unsigned int width, unsigned int height)
+{
+    *begin = (RenderPassBegin){
+        .state = *state,
+        .ops = *ops,
+        .render_pass = r->dynamic_rendering_extension_enabled ?
+                           VK_NULL_HANDLE :
+                           get_render_pass_variant(r, state, ops),
+        .target = *target,
+        .render_area.extent.width = width,
+        .render_area.extent.height = height,
+    };
+}
+
+static void flush_pending_clear(PGRAPHVkState *r)
+{
+    PendingClear *clear = &r->pending_clear;
+
+    if (!clear->active) {
+        return;
+    }
 
     assert(r->in_command_buffer);
     assert(!r->in_render_pass);
 
     nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_RENDERPASSES);
+    nv2a_profile_inc_counter(NV2A_PROF_RENDERPASS_CLEAR_LOAD);
+
+    // Nothing else is drawn, so the cleared contents are always stored
+    RenderPassBegin begin;
+    init_render_pass_begin(r, &begin, &clear->state, &clear->ops,
+                           &clear->target, clear->width, clear->height);
+    begin.num_clear_values = ARRAY_SIZE(clear->clear_values);
+    memcpy(begin.clear_values, clear->clear_values,
+           sizeof(begin.clear_values));
+    pgraph_vk_cmd_begin_render_pass(r, r->command_buffer, &begin, false);
+    pgraph_vk_cmd_end_render_pass(r, r->command_buffer);
+
+    clear->active = false;
+}
+
+// Whether the pending clear can become the load ops of the next pass
+static bool pending_clear_matches(PGRAPHVkState *r)
+{
+    PendingClear *clear = &r->pending_clear;
+
+    return !memcmp(&clear->target, &r->render_target,
+                   sizeof(clear->target)) &&
+           !memcmp(&clear->state, &r->render_pass_state,
+                   sizeof(clear->state));
+}
+
+// Surfaces whose first render pass does not clear them need their contents
+static void note_attachment_use(SurfaceBinding *surface, bool cleared)
+{
+    if (!surface->attachment_used) {
+        surface->attachment_used = true;
+        surface->attachment_only &= cleared;
+    }
+}
+
+/*
+ * Skip storing depth for passes that start by clearing it, once no earlier
+ * pass on the surface has loaded its contents and nothing has read it back.
+ * A pass that does load it marks the surface as needed from then on.
+ */
+static void update_zeta_store_ops(PGRAPHVkState *r, RenderPassOps *ops)
+{
+    SurfaceBinding *zeta = r->zeta_binding;
+
+    if (!zeta) {
+        return;
+    }
+
+    bool has_stencil = zeta->host_fmt.aspect & VK_IMAGE_ASPECT_STENCIL_BIT;
+    bool cleared =
+        ops->depth_load_op == VK_ATTACHMENT_LOAD_OP_CLEAR &&
+        (!has_stencil || ops->stencil_load_op == VK_ATTACHMENT_LOAD_OP_CLEAR);
+    note_attachment_use(zeta, cleared);
+
+    if (r->tiler_render_passes && cleared && zeta->zeta_last_pass_cleared &&
+        !zeta->zeta_contents_needed) {
+        nv2a_profile_inc_counter(NV2A_PROF_RENDERPASS_DEPTH_DISCARD);
+        ops->depth_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        ops->stencil_store_op = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
+
+    zeta->zeta_contents_needed |= !cleared;
+    zeta->zeta_last_pass_cleared = cleared;
+}
+
+static void transition_aliased_surfaces(PGRAPHVkState *r, bool sampled)
+{
+    VkImageMemoryBarrier barriers[NV2A_MAX_TEXTURES];
+
+    for (int i = 0; i < r->num_aliased_surface_images; i++) {
+        barriers[i] = (VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = sampled ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : 0,
+            .dstAccessMask = sampled ?
+                                 VK_ACCESS_SHADER_READ_BIT :
+                                 (VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                                  VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT),
+            .oldLayout = sampled ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+                                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .newLayout = sampled ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL :
+                                   VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = r->aliased_surface_images[i],
+            .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .subresourceRange.levelCount = 1,
+            .subresourceRange.layerCount = 1,
+        };
+    }
+
+    VkPipelineStageFlags attachment_stage =
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkPipelineStageFlags shader_stage = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    vkCmdPipelineBarrier(r->command_buffer,
+                         sampled ? attachment_stage : shader_stage,
+                         sampled ? shader_stage : attachment_stage, 0, 0, NULL,
+                         0, NULL, r->num_aliased_surface_images, barriers);
+}
+
+/*
+ * Surfaces sampled in place by the bound textures leave the attachment layout
+ * for the duration of the pass. Surfaces are kept in the attachment layout
+ * everywhere else.
+ */
+static void begin_aliased_surfaces(PGRAPHVkState *r)
+{
+    r->num_aliased_surface_images = 0;
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        TextureBinding *binding = r->texture_bindings[i];
+        if (!binding || !binding->key.surface_alias ||
+            (r->color_binding && binding->image == r->color_binding->image)) {
+            continue;
+        }
+
+        bool found = false;
+        for (int j = 0; j < r->num_aliased_surface_images; j++) {
+            found |= r->aliased_surface_images[j] == binding->image;
+        }
+        if (!found) {
+            r->aliased_surface_images[r->num_aliased_surface_images++] =
+                binding->image;
+        }
+    }
+
+    if (r->num_aliased_surface_images) {
+        transition_aliased_surfaces(r, true);
+    }
+}
+
+static void end_aliased_surfaces(PGRAPHVkState *r)
+{
+    if (r->num_aliased_surface_images) {
+        transition_aliased_surfaces(r, false);
+        r->num_aliased_surface_images = 0;
+    }
+}
+
+static void begin_render_pass(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    assert(r->in_command_buffer);
+    assert(!r->in_render_pass);
 
     unsigned int vp_width = pg->surface_binding_dim.width,
                  vp_height = pg->surface_binding_dim.height;
     pgraph_apply_scaling_factor(pg, &vp_width, &vp_height);
 
-    assert(r->framebuffer_index > 0);
+    assert(r->dynamic_rendering_extension_enabled ||
+           r->frame->framebuffer_index > 0);
 
-    VkRenderPassBeginInfo render_pass_begin_info = {
-        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-        .renderPass = r->render_pass,
-        .framebuffer = r->framebuffers[r->framebuffer_index - 1],
-        .renderArea.extent.width = vp_width,
-        .renderArea.extent.height = vp_height,
-        .clearValueCount = 0,
-        .pClearValues = NULL,
-    };
-    vkCmdBeginRenderPass(r->command_buffer, &render_pass_begin_info,
-                         VK_SUBPASS_CONTENTS_INLINE);
-    r->in_render_pass = true;
+    PendingClear *clear = &r->pending_clear;
+    if (clear->active && !pending_clear_matches(r)) {
+        flush_pending_clear(r);
+    }
+
+    RenderPassOps ops = default_render_pass_ops;
+
+    if (clear->active) {
+        nv2a_profile_inc_counter(NV2A_PROF_RENDERPASS_CLEAR_LOAD);
+        ops = clear->ops;
+    }
+
+    if (r->color_binding) {
+        note_attachment_use(r->color_binding,
+                            ops.color_load_op == VK_ATTACHMENT_LOAD_OP_CLEAR);
+    }
+    update_zeta_store_ops(r, &ops);
+
+    nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_RENDERPASSES);
+
+    RenderPassBegin begin;
+    init_render_pass_begin(r, &begin, &r->render_pass_state, &ops,
+                           &r->render_target, vp_width, vp_height);
+    if (clear->active) {
+        begin.num_clear_values = ARRAY_SIZE(clear->clear_values);
+        memcpy(begin.clear_values, clear->clear_values,
+               sizeof(begin.clear_values));
+        clear->active = false;
+    }
 
+    begin_aliased_surfaces(r);
+    r->gpu_timer.render_pass_query = pgraph_vk_gpu_timer_begin(
+        r, r->command_buffer, NV2A_PROF_GPU_RENDER_PASS);
+    if (!pgraph_vk_begin_recorded_pass(r, &begin)) {
+        pgraph_vk_cmd_begin_render_pass(r, r->command_buffer, &begin, false);
+    }
+    r->in_render_pass = true;
 }
 
-static void end_render_pass(PGRAPHVkState *r)
+static const enum NV2A_PROF_COUNTERS_ENUM render_pass_end_reason_to_counter_enum[] = {
+    [VK_RENDER_PASS_END_FINISH] = NV2A_PROF_RENDERPASS_END_FINISH,
+    [VK_RENDER_PASS_END_SURFACE_CHANGE] = NV2A_PROF_RENDERPASS_END_SURFACE_CHANGE,
+    [VK_RENDER_PASS_END_FRAMEBUFFER_CHANGE] =
+        NV2A_PROF_RENDERPASS_END_FRAMEBUFFER_CHANGE,
+    [VK_RENDER_PASS_END_QUERY] = NV2A_PROF_RENDERPASS_END_QUERY,
+    [VK_RENDER_PASS_END_TRANSFER] = NV2A_PROF_RENDERPASS_END_TRANSFER,
+};
+
+static void end_render_pass(PGRAPHVkState *r, RenderPassEndReason why)
 {
     if (r->in_render_pass) {
-        vkCmdEndRenderPass(r->command_buffer);
+        nv2a_profile_inc_counter(render_pass_end_reason_to_counter_enum[why]);
+        flush_draw_batch(r);
+        if (r->recording) {
+            pgraph_vk_end_recorded_pass(r);
+        } else {
+            pgraph_vk_cmd_end_render_pass(r, r->command_buffer);
+        }
+        // Outside of the pass, which may have been recorded separately
+        pgraph_vk_gpu_timer_end(r, r->command_buffer,
+                                r->gpu_timer.render_pass_query);
+        r->gpu_timer.render_pass_query = -1;
+        end_aliased_surfaces(r);
         r->in_render_pass = false;
     }
 }
@@ -1271,58 +2680,63 @@ const enum NV2A_PROF_COUNTERS_ENUM finish_reason_to_counter_enum[] = {
     [VK_FINISH_REASON_STALLED] = NV2A_PROF_FINISH_STALLED,
 };
 
-void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
+/*
+ * Presentation and flip stalls only need the work to be queued, so they may
+ * leave frames in flight. Everything else expects an idle GPU on return.
+ */
+static bool finish_needs_wait(PGRAPHVkState *r, FinishReason finish_reason)
+{
+    // Reports are written back when the frame recording them is retired
+    return finish_reason != VK_FINISH_REASON_PRESENTING &&
+           finish_reason != VK_FINISH_REASON_FLIP_STALL;
+}
+
+static void finish(PGRAPHState *pg, FinishReason finish_reason)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     assert(!r->in_draw);
     assert(r->debug_depth == 0);
 
+    bool wait = true;
+
     if (r->in_command_buffer) {
         nv2a_profile_inc_counter(finish_reason_to_counter_enum[finish_reason]);
 
-        if (r->in_render_pass) {
-            end_render_pass(r);
-        }
+        end_render_pass(r, VK_RENDER_PASS_END_FINISH);
+        flush_pending_clear(r);
         if (r->query_in_flight) {
             end_query(r);
         }
+        if (finish_reason == VK_FINISH_REASON_FLIP_STALL) {
+            pgraph_vk_record_surface_readbacks(pg);
+        }
         VK_CHECK(vkEndCommandBuffer(r->command_buffer));
+        pgraph_vk_finish_recorded_passes(r);
 
         VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg); // FIXME: Cleanup
+        if (r->num_frames_in_flight) {
+            // Keep GPU execution ordered behind frames still in flight
+            VkMemoryBarrier barrier = {
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT,
+                .dstAccessMask =
+                    VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT,
+            };
+            vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                                 VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1,
+                                 &barrier, 0, NULL, 0, NULL);
+        }
         sync_staging_buffer(pg, cmd, BUFFER_INDEX_STAGING, BUFFER_INDEX);
         sync_staging_buffer(pg, cmd, BUFFER_VERTEX_INLINE_STAGING,
                                 BUFFER_VERTEX_INLINE);
         sync_staging_buffer(pg, cmd, BUFFER_UNIFORM_STAGING, BUFFER_UNIFORM);
-        bitmap_clear(r->uploaded_bitmap, 0, r->bitmap_size);
         flush_memory_buffer(pg, cmd);
         VK_CHECK(vkEndCommandBuffer(r->aux_command_buffer));
         r->in_aux_command_buffer = false;
 
-        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
-        VkSubmitInfo submit_infos[] = {
-            {
-                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .commandBufferCount = 1,
-                .pCommandBuffers = &r->aux_command_buffer,
-                .signalSemaphoreCount = 1,
-                .pSignalSemaphores = &r->command_buffer_semaphore,
-            },
-            {
-
-                .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-                .commandBufferCount = 1,
-                .pCommandBuffers = &r->command_buffer,
-                .waitSemaphoreCount = 1,
-                .pWaitSemaphores = &r->command_buffer_semaphore,
-                .pWaitDstStageMask = &wait_stage,
-            }
-        };
-        nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT);
-        vkResetFences(r->device, 1, &r->command_buffer_fence);
-        VK_CHECK(vkQueueSubmit(r->queue, ARRAY_SIZE(submit_infos), submit_infos,
-                               r->command_buffer_fence));
-        r->submit_count += 1;
+        wait = finish_needs_wait(r, finish_reason);
+        pgraph_vk_submit_frame(r);
 
         bool check_budget = false;
 
@@ -1338,22 +2752,46 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
             check_budget = true;
         }
 
-        VK_CHECK(vkWaitForFences(r->device, 1, &r->command_buffer_fence,
-                                 VK_TRUE, UINT64_MAX));
+        if (wait) {
+            pgraph_vk_wait_for_frames_in_flight(r);
+        } else {
+            nv2a_profile_inc_counter(NV2A_PROF_FRAME_NOWAIT);
+            pgraph_vk_advance_frame(r);
+        }
 
         r->descriptor_set_index = 0;
         r->in_command_buffer = false;
-        destroy_framebuffers(pg);
 
         if (check_budget) {
             pgraph_vk_check_memory_budget(pg);
         }
+        if (finish_reason == VK_FINISH_REASON_FLIP_STALL) {
+            pgraph_vk_defragment_surfaces(container_of(pg, NV2AState, pgraph));
+        }
+    } else {
+        wait = finish_needs_wait(r, finish_reason);
+        if (wait) {
+            pgraph_vk_wait_for_frames_in_flight(r);
+        }
+    }
+
+    pgraph_vk_release_vertex_ram_versions(pg);
+
+    if (!wait) {
+        return;
     }
 
     NV2AState *d = container_of(pg, NV2AState, pgraph);
     pgraph_vk_process_pending_reports_internal(d);
+}
 
-    pgraph_vk_compute_finish_complete(r);
+void pgraph_vk_finish(PGRAPHState *pg, FinishReason finish_reason)
+{
+    xemu_trace_begin("pgraph_vk_finish",
+                     nv2a_profile_get_counter_name(
+                         finish_reason_to_counter_enum[finish_reason]));
+    finish(pg, finish_reason);
+    xemu_trace_end();
 }
 
 void pgraph_vk_begin_command_buffer(PGRAPHState *pg)
@@ -1365,8 +2803,10 @@ void pgraph_vk_begin_command_buffer(PGRAPHState *pg)
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
+    pgraph_vk_begin_frame_recording(r);
     VK_CHECK(vkBeginCommandBuffer(r->command_buffer,
                                   &command_buffer_begin_info));
+    pgraph_vk_gpu_timer_reset(r, r->command_buffer);
     r->command_buffer_start_time = pg->draw_time;
     r->in_command_buffer = true;
 }
@@ -1382,11 +2822,13 @@ void pgraph_vk_ensure_command_buffer(PGRAPHState *pg)
     }
 }
 
-void pgraph_vk_ensure_not_in_render_pass(PGRAPHState *pg)
+void pgraph_vk_ensure_not_in_render_pass(PGRAPHState *pg,
+                                         RenderPassEndReason why)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    end_render_pass(r);
+    end_render_pass(r, why);
+    flush_pending_clear(r);
     if (r->query_in_flight) {
         end_query(r);
     }
@@ -1396,7 +2838,7 @@ VkCommandBuffer pgraph_vk_begin_nondraw_commands(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
     pgraph_vk_ensure_command_buffer(pg);
-    pgraph_vk_ensure_not_in_render_pass(pg);
+    pgraph_vk_ensure_not_in_render_pass(pg, VK_RENDER_PASS_END_TRANSFER);
     return r->command_buffer;
 }
 
@@ -1413,7 +2855,7 @@ void pgraph_vk_end_nondraw_commands(PGRAPHState *pg, VkCommandBuffer cmd)
 // buffer. For other reasons though (like descriptor set amount, surface
 // changes, etc) we do flush often.
 
-static void begin_pre_draw(PGRAPHState *pg)
+static bool begin_pre_draw(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
@@ -1423,30 +2865,38 @@ static void begin_pre_draw(PGRAPHState *pg)
 
     if (pg->clearing) {
         create_clear_pipeline(pg);
-    } else {
-        create_pipeline(pg);
+    } else if (!create_pipeline(pg)) {
+        return false;
     }
 
-    bool render_pass_dirty = r->pipeline_binding->render_pass != r->render_pass;
+    // Pipelines have no render pass with dynamic rendering, only formats
+    bool render_pass_dirty =
+        memcmp(&r->pipeline_binding->key.render_pass_state,
+               &r->render_pass_state, sizeof(r->render_pass_state));
 
     if (r->framebuffer_dirty || render_pass_dirty) {
-        pgraph_vk_ensure_not_in_render_pass(pg);
+        pgraph_vk_ensure_not_in_render_pass(
+            pg, VK_RENDER_PASS_END_FRAMEBUFFER_CHANGE);
     }
     if (render_pass_dirty) {
         r->render_pass = r->pipeline_binding->render_pass;
+        r->render_pass_state = r->pipeline_binding->key.render_pass_state;
     }
     if (r->framebuffer_dirty) {
-        create_frame_buffer(pg);
+        update_render_target(pg);
         r->framebuffer_dirty = false;
     }
     if (!pg->clearing) {
         pgraph_vk_update_descriptor_sets(pg);
     }
-    if (r->framebuffer_index == 0) {
-        create_frame_buffer(pg);
+    if (!r->dynamic_rendering_extension_enabled &&
+        r->frame->framebuffer_index == 0) {
+        update_render_target(pg);
     }
 
     pgraph_vk_ensure_command_buffer(pg);
+
+    return true;
 }
 
 static float clamp_line_width_to_device_limits(PGRAPHState *pg, float width)
@@ -1473,22 +2923,18 @@ static void begin_draw(PGRAPHState *pg)
     // Visibility testing
     if (!pg->clearing && pg->zpass_pixel_count_enable) {
         if (r->new_query_needed && r->query_in_flight) {
-            end_render_pass(r);
+            end_render_pass(r, VK_RENDER_PASS_END_QUERY);
             end_query(r);
         }
         if (!r->query_in_flight) {
-            end_render_pass(r);
+            end_render_pass(r, VK_RENDER_PASS_END_QUERY);
             begin_query(r);
         }
     } else if (r->query_in_flight) {
-        end_render_pass(r);
+        end_render_pass(r, VK_RENDER_PASS_END_QUERY);
         end_query(r);
     }
 
-    if (pg->clearing) {
-        end_render_pass(r);
-    }
-
     bool must_bind_pipeline = r->pipeline_binding_changed;
 
     if (!r->in_render_pass) {
@@ -1497,9 +2943,10 @@ static void begin_draw(PGRAPHState *pg)
     }
 
     if (must_bind_pipeline) {
+        flush_draw_batch(r);
+        invalidate_bound_draw_state(r);
         nv2a_profile_inc_counter(NV2A_PROF_PIPELINE_BIND);
-        vkCmdBindPipeline(r->command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                          r->pipeline_binding->pipeline);
+        pgraph_vk_cmd_bind_pipeline(r, r->pipeline_binding->pipeline);
         r->pipeline_binding->draw_time = pg->draw_time;
 
         unsigned int vp_width = pg->surface_binding_dim.width,
@@ -1512,7 +2959,7 @@ static void begin_draw(PGRAPHState *pg)
             .minDepth = 0.0,
             .maxDepth = 1.0,
         };
-        vkCmdSetViewport(r->command_buffer, 0, 1, &viewport);
+        pgraph_vk_cmd_set_viewport(r, &viewport);
 
         /* Surface clip */
         /* FIXME: Consider moving to PSH w/ window clip */
@@ -1534,18 +2981,21 @@ static void begin_draw(PGRAPHState *pg)
             .extent.width = scissor_width,
             .extent.height = scissor_height,
         };
-        vkCmdSetScissor(r->command_buffer, 0, 1, &scissor);
+        pgraph_vk_cmd_set_scissor(r, &scissor);
 
         if (r->pipeline_binding->has_dynamic_line_width) {
             float line_width =
                 clamp_line_width_to_device_limits(pg, pg->surface_scale_factor);
-            vkCmdSetLineWidth(r->command_buffer, line_width);
+            pgraph_vk_cmd_set_line_width(r, line_width);
         }
     }
 
     if (!pg->clearing) {
         bind_descriptor_sets(pg);
+        set_vertex_input(pg);
+        set_dynamic_draw_state(pg);
         push_vertex_attr_values(pg);
+        push_psh_uniform_values(pg);
     }
 
     r->in_draw = true;
@@ -1558,10 +3008,6 @@ static void end_draw(PGRAPHState *pg)
     assert(r->in_command_buffer);
     assert(r->in_render_pass);
 
-    if (pg->clearing) {
-        end_render_pass(r);
-    }
-
     r->in_draw = false;
 }
 
@@ -1593,6 +3039,10 @@ void pgraph_vk_draw_end(NV2AState *d)
         return;
     }
 
+    if (pgraph_vk_frame_skip_draw(pg)) {
+        return;
+    }
+
     pgraph_vk_flush_draw(d);
 
     pg->draw_time++;
@@ -1687,8 +3137,8 @@ static void sync_vertex_ram_buffer(PGRAPHState *pg)
 
         NV2A_VK_DPRINTF("- %d: %08"HWADDR_PRIx" %zd bytes", i, addr, size);
 
-        if (memory_region_test_and_clear_dirty(d->vram, addr, size,
-                                               DIRTY_MEMORY_NV2A)) {
+        if (pgraph_vram_test_and_clear_dirty(d, addr, size,
+                                             DIRTY_MEMORY_NV2A)) {
             NV2A_VK_DPRINTF("Memory dirty. Synchronizing...");
             pgraph_vk_update_vertex_ram_buffer(pg, addr, d->vram_ptr + addr,
                                                size);
@@ -1700,6 +3150,78 @@ static void sync_vertex_ram_buffer(PGRAPHState *pg)
     NV2A_VK_DGROUP_END();
 }
 
+/*
+ * Turn a clear of the whole render area into load ops of the next render pass
+ * on this render target, instead of beginning a pass just to clear it.
+ */
+static bool defer_clear(PGRAPHState *pg, uint32_t parameter,
+                        const VkRect2D *rect)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->tiler_render_passes || r->in_render_pass) {
+        return false;
+    }
+
+    unsigned int vp_width = pg->surface_binding_dim.width,
+                 vp_height = pg->surface_binding_dim.height;
+    pgraph_apply_scaling_factor(pg, &vp_width, &vp_height);
+
+    if (rect->offset.x || rect->offset.y || rect->extent.width < vp_width ||
+        rect->extent.height < vp_height) {
+        return false;
+    }
+
+    // Masked color clears need a draw
+    bool write_color = (parameter & NV097_CLEAR_SURFACE_COLOR) &&
+                       r->color_binding;
+    if (write_color && (parameter & NV097_CLEAR_SURFACE_COLOR) !=
+                           (NV097_CLEAR_SURFACE_R | NV097_CLEAR_SURFACE_G |
+                            NV097_CLEAR_SURFACE_B | NV097_CLEAR_SURFACE_A)) {
+        return false;
+    }
+
+    PendingClear *clear = &r->pending_clear;
+
+    if (clear->active && !pending_clear_matches(r)) {
+        flush_pending_clear(r);
+    }
+    if (!clear->active) {
+        clear->active = true;
+        clear->target = r->render_target;
+        clear->state = r->render_pass_state;
+        clear->ops = default_render_pass_ops;
+        clear->width = vp_width;
+        clear->height = vp_height;
+        memset(clear->clear_values, 0, sizeof(clear->clear_values));
+    }
+
+    if (write_color) {
+        clear->ops.color_load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        pgraph_get_clear_color(pg, clear->clear_values[0].color.float32);
+    }
+
+    if ((parameter & (NV097_CLEAR_SURFACE_Z | NV097_CLEAR_SURFACE_STENCIL)) &&
+        r->zeta_binding) {
+        VkClearValue *value = &clear->clear_values[r->color_binding ? 1 : 0];
+        int stencil_value = 0;
+        float depth_value = 1.0;
+        pgraph_get_clear_depth_stencil_value(pg, &depth_value, &stencil_value);
+
+        if (parameter & NV097_CLEAR_SURFACE_Z) {
+            clear->ops.depth_load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            value->depthStencil.depth = depth_value;
+        }
+        if ((parameter & NV097_CLEAR_SURFACE_STENCIL) &&
+            (r->zeta_binding->host_fmt.aspect & VK_IMAGE_ASPECT_STENCIL_BIT)) {
+            clear->ops.stencil_load_op = VK_ATTACHMENT_LOAD_OP_CLEAR;
+            value->depthStencil.stencil = stencil_value;
+        }
+    }
+
+    return true;
+}
+
 void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -1724,6 +3246,11 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
         return;
     }
 
+    if (pgraph_vk_frame_skip_draw(pg)) {
+        pg->clearing = false;
+        return;
+    }
+
     r->clear_parameter = parameter;
 
     uint32_t clearrectx = pgraph_reg_r(pg, NV_PGRAPH_CLEARRECTX);
@@ -1739,10 +3266,6 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
                          write_zeta ? " zeta" : "");
 
     begin_pre_draw(pg);
-    pgraph_vk_begin_debug_marker(r, r->command_buffer,
-        RGBA_BLUE, "Clear %08" HWADDR_PRIx,
-        binding->vram_addr);
-    begin_draw(pg);
 
     // FIXME: What does hardware do when min >= max?
     // FIXME: What does hardware do when min >= surface size?
@@ -1769,6 +3292,16 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
         .layerCount = 1,
     };
 
+    if (defer_clear(pg, parameter, &clear_rect.rect)) {
+        goto done;
+    }
+
+    pgraph_vk_begin_debug_marker(r, r->command_buffer,
+        RGBA_BLUE, "Clear %08" HWADDR_PRIx,
+        binding->vram_addr);
+    begin_draw(pg);
+    flush_draw_batch(r);
+
     int num_attachments = 0;
     VkClearAttachment attachments[2];
 
@@ -1789,9 +3322,9 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
         } else {
             float blend_constants[4];
             pgraph_get_clear_color(pg, blend_constants);
-            vkCmdSetScissor(r->command_buffer, 0, 1, &clear_rect.rect);
-            vkCmdSetBlendConstants(r->command_buffer, blend_constants);
-            vkCmdDraw(r->command_buffer, 3, 1, 0, 0);
+            pgraph_vk_cmd_set_scissor(r, &clear_rect.rect);
+            pgraph_vk_cmd_set_blend_constants(r, blend_constants);
+            pgraph_vk_cmd_draw(r, 3, 1, 0, 0);
         }
     }
 
@@ -1817,12 +3350,17 @@ void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter)
     }
 
     if (num_attachments) {
-        vkCmdClearAttachments(r->command_buffer, num_attachments, attachments,
-                              1, &clear_rect);
+        pgraph_vk_cmd_clear_attachments(r, num_attachments, attachments,
+                                        &clear_rect);
     }
     end_draw(pg);
     pgraph_vk_end_debug_marker(r, r->command_buffer);
 
+    // The render pass stays open for following draws, which must restore the
+    // scissor and blend constants the clear may have changed
+    r->pipeline_binding_changed = true;
+
+done:
     pg->clearing = false;
 
     pgraph_vk_set_surface_dirty(pg, write_color, write_zeta);
@@ -1868,10 +3406,12 @@ static void bind_vertex_buffer(PGRAPHState *pg, uint16_t inline_map,
         return;
     }
 
+    BoundDrawState *bound = &r->bound_state;
+    int num_buffers = r->num_active_vertex_binding_descriptions;
     VkBuffer buffers[NV2A_VERTEXSHADER_ATTRIBUTES];
     VkDeviceSize offsets[NV2A_VERTEXSHADER_ATTRIBUTES];
 
-    for (int i = 0; i < r->num_active_vertex_binding_descriptions; i++) {
+    for (int i = 0; i < num_buffers; i++) {
         int attr_idx = r->vertex_attribute_descriptions[i].location;
         int buffer_idx = (inline_map & (1 << attr_idx)) ? BUFFER_VERTEX_INLINE :
                                                           BUFFER_VERTEX_RAM;
@@ -1879,9 +3419,69 @@ static void bind_vertex_buffer(PGRAPHState *pg, uint16_t inline_map,
         offsets[i] = offset + r->vertex_attribute_offsets[attr_idx];
     }
 
-    vkCmdBindVertexBuffers(r->command_buffer, 0,
-                           r->num_active_vertex_binding_descriptions, buffers,
-                           offsets);
+    if (bound->num_vertex_buffers == num_buffers &&
+        !memcmp(bound->vertex_buffers, buffers, num_buffers * sizeof(*buffers)) &&
+        !memcmp(bound->vertex_buffer_offsets, offsets,
+                num_buffers * sizeof(*offsets))) {
+        nv2a_profile_inc_counter(NV2A_PROF_DRAW_STATE_BIND_SKIPPED);
+        return;
+    }
+
+    flush_draw_batch(r);
+    pgraph_vk_cmd_bind_vertex_buffers(r, num_buffers, buffers, offsets);
+    bound->num_vertex_buffers = num_buffers;
+    memcpy(bound->vertex_buffers, buffers, num_buffers * sizeof(*buffers));
+    memcpy(bound->vertex_buffer_offsets, offsets,
+           num_buffers * sizeof(*offsets));
+}
+
+static void bind_index_buffer(PGRAPHVkState *r, VkDeviceSize offset,
+                              VkIndexType type)
+{
+    flush_draw_batch(r);
+    pgraph_vk_cmd_bind_index_buffer(r, r->storage_buffers[BUFFER_INDEX].buffer,
+                                    offset, type);
+}
+
+static void get_index_range(const uint32_t *indices, unsigned int count,
+                            uint32_t *min_out, uint32_t *max_out)
+{
+    uint32_t min_element = (uint32_t)-1;
+    uint32_t max_element = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        max_element = MAX(indices[i], max_element);
+        min_element = MIN(indices[i], min_element);
+    }
+    *min_out = min_element;
+    *max_out = max_element;
+}
+
+/*
+ * Most indexed draws touch fewer than 64K vertices. Rebase the indices to the
+ * smallest one, which is added back with the draw's vertex offset, and narrow
+ * them to 16 bits to halve the index data streamed. Returns NULL if the
+ * range does not fit.
+ */
+static uint16_t *narrow_indices(PGRAPHVkState *r, const uint32_t *indices,
+                                unsigned int count, uint32_t min_element,
+                                uint32_t max_element)
+{
+    if (max_element - min_element >= 0xffff) {
+        return NULL;
+    }
+
+    if (r->narrow_indices_capacity < count) {
+        r->narrow_indices_capacity = MAX(count, 2 * r->narrow_indices_capacity);
+        r->narrow_indices = g_renew(uint16_t, r->narrow_indices,
+                                    r->narrow_indices_capacity);
+    }
+
+    uint16_t *out = r->narrow_indices;
+    for (unsigned int i = 0; i < count; i++) {
+        out[i] = indices[i] - min_element;
+    }
+
+    return out;
 }
 
 static void bind_inline_vertex_buffer(PGRAPHState *pg, VkDeviceSize offset)
@@ -1894,6 +3494,7 @@ void pgraph_vk_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
     NV2A_DPRINTF("pgraph_set_surface_dirty(%d, %d) -- %d %d\n", color, zeta,
                  pgraph_color_write_enabled(pg), pgraph_zeta_write_enabled(pg));
 
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     /* FIXME: Does this apply to CLEARs too? */
@@ -1906,18 +3507,22 @@ void pgraph_vk_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta)
         r->color_binding->draw_dirty |= color;
         r->color_binding->frame_time = pg->frame_time;
         r->color_binding->cleared = false;
+        pgraph_vk_surface_update_access_callback(d, r->color_binding);
     }
 
     if (r->zeta_binding) {
         r->zeta_binding->draw_dirty |= zeta;
         r->zeta_binding->frame_time = pg->frame_time;
         r->zeta_binding->cleared = false;
+        pgraph_vk_surface_update_access_callback(d, r->zeta_binding);
     }
 }
 
-static bool ensure_buffer_space(PGRAPHState *pg, int index, VkDeviceSize size)
+static bool ensure_buffer_space(PGRAPHState *pg, int index, VkDeviceSize size,
+                                VkDeviceAddress alignment)
 {
-    if (!pgraph_vk_buffer_has_space_for(pg, index, size, 1)) {
+    // Finish only if retiring older frames cannot free enough of the ring
+    if (!pgraph_vk_buffer_reclaim_space_for(pg, index, size, alignment)) {
         pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
         return true;
     }
@@ -1964,6 +3569,7 @@ typedef struct VertexBufferRemap {
         VkDeviceAddress offset;
         VkDeviceSize old_stride;
         VkDeviceSize new_stride;
+        VkDeviceSize size; // Copied as one block if set, else per vertex
     } map[NV2A_VERTEXSHADER_ATTRIBUTES];
 } VertexBufferRemap;
 
@@ -1995,6 +3601,23 @@ static VertexBufferRemap remap_unaligned_attributes(PGRAPHState *pg,
         bool stride_valid = (desc->stride % element_size == 0);
 
         if (offset_valid && stride_valid) {
+            if (!pgraph_vk_vertex_ram_range_is_versioned(
+                    r, r->vertex_attribute_offsets[attr_id],
+                    desc->stride * num_vertices)) {
+                continue;
+            }
+
+            // Vertex RAM buffer is stale for this range, stream the data in
+            // its original layout instead
+            remap.attributes |= 1 << attr_id;
+            remap.map[attr_id].offset = ROUND_UP(output_offset, element_size);
+            remap.map[attr_id].old_stride = desc->stride;
+            remap.map[attr_id].new_stride = desc->stride;
+            remap.map[attr_id].size =
+                num_vertices ? desc->stride * (num_vertices - 1) +
+                                   element_size * element_count :
+                               0;
+            output_offset = remap.map[attr_id].offset + remap.map[attr_id].size;
             continue;
         }
 
@@ -2021,12 +3644,8 @@ static VertexBufferRemap remap_unaligned_attributes(PGRAPHState *pg,
 
     // reserve space
     if (remap.attributes) {
-        StorageBuffer *buffer = &r->storage_buffers[BUFFER_VERTEX_INLINE_STAGING];
-        VkDeviceSize starting_offset = ROUND_UP(buffer->buffer_offset, 16);
-        size_t total_space_required =
-            (starting_offset - buffer->buffer_offset) + remap.buffer_space_required;
-        ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING, total_space_required);
-        buffer->buffer_offset = ROUND_UP(buffer->buffer_offset, 16);
+        ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING,
+                            remap.buffer_space_required, 16);
     }
 
     return remap;
@@ -2045,8 +3664,8 @@ static void copy_remapped_attributes_to_inline_buffer(PGRAPHState *pg,
         return;
     }
 
-    assert(pgraph_vk_buffer_has_space_for(pg, BUFFER_VERTEX_INLINE_STAGING,
-                                          remap.buffer_space_required, 256));
+    VkDeviceSize base_offset = pgraph_vk_allocate_from_buffer(
+        pg, BUFFER_VERTEX_INLINE_STAGING, remap.buffer_space_required, 16);
 
     // FIXME: SIMD memcpy
     // FIXME: Caching
@@ -2061,22 +3680,23 @@ static void copy_remapped_attributes_to_inline_buffer(PGRAPHState *pg,
         }
 
         VkDeviceSize attr_buffer_offset =
-            buffer->buffer_offset + remap.map[attr_id].offset;
+            base_offset + remap.map[attr_id].offset;
 
         uint8_t *out_ptr = buffer->mapped + attr_buffer_offset;
         uint8_t *in_ptr = d->vram_ptr + r->vertex_attribute_offsets[attr_id];
 
-        for (int vertex_id = 0; vertex_id < num_vertices; vertex_id++) {
-            memcpy(out_ptr, in_ptr, remap.map[attr_id].new_stride);
-            out_ptr += remap.map[attr_id].new_stride;
-            in_ptr += remap.map[attr_id].old_stride;
+        if (remap.map[attr_id].size) {
+            memcpy(out_ptr, in_ptr, remap.map[attr_id].size);
+        } else {
+            for (int vertex_id = 0; vertex_id < num_vertices; vertex_id++) {
+                memcpy(out_ptr, in_ptr, remap.map[attr_id].new_stride);
+                out_ptr += remap.map[attr_id].new_stride;
+                in_ptr += remap.map[attr_id].old_stride;
+            }
         }
 
         r->vertex_attribute_offsets[attr_id] = attr_buffer_offset;
     }
-
-
-    buffer->buffer_offset += remap.buffer_space_required;
 }
 
 void pgraph_vk_flush_draw(NV2AState *d)
@@ -2108,7 +3728,6 @@ void pgraph_vk_flush_draw(NV2AState *d)
         NV2A_VK_DGROUP_BEGIN("Draw Arrays");
         nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS);
 
-        assert(pg->inline_elements_length == 0);
         assert(pg->inline_buffer_length == 0);
         assert(pg->inline_array_length == 0);
 
@@ -2132,10 +3751,14 @@ void pgraph_vk_flush_draw(NV2AState *d)
         if (prim_rw.num_indices > 0) {
             size_t rewrite_size =
                 prim_rw.num_indices * sizeof(uint32_t);
-            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, rewrite_size);
+            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, rewrite_size,
+                                sizeof(uint32_t));
         }
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         copy_remapped_attributes_to_inline_buffer(pg, remap, 0, max_element);
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
                                      "Draw Arrays");
@@ -2146,17 +3769,14 @@ void pgraph_vk_flush_draw(NV2AState *d)
             size_t rewrite_size = prim_rw.num_indices * sizeof(uint32_t);
             VkDeviceSize buffer_offset = pgraph_vk_update_index_buffer(
                 pg, prim_rw.indices, rewrite_size);
-            vkCmdBindIndexBuffer(r->command_buffer,
-                                 r->storage_buffers[BUFFER_INDEX].buffer,
-                                 buffer_offset, VK_INDEX_TYPE_UINT32);
-            vkCmdDrawIndexed(r->command_buffer, prim_rw.num_indices, 1, 0, 0,
-                             0);
+            bind_index_buffer(r, buffer_offset, VK_INDEX_TYPE_UINT32);
+            pgraph_vk_cmd_draw_indexed(r, prim_rw.num_indices, 1, 0, 0, 0);
         } else {
             for (int i = 0; i < pg->draw_arrays_length; i++) {
                 uint32_t start = pg->draw_arrays_start[i],
                          count = pg->draw_arrays_count[i];
                 NV2A_VK_DPRINTF("- [%d] Start:%d Count:%d", i, start, count);
-                vkCmdDraw(r->command_buffer, count, 1, start, 0);
+                record_draw(pg, start, count);
             }
         }
 
@@ -2164,7 +3784,15 @@ void pgraph_vk_flush_draw(NV2AState *d)
         pgraph_vk_end_debug_marker(r, r->command_buffer);
 
         NV2A_VK_DGROUP_END();
-    } else if (pg->inline_elements_length) {
+
+        // Elements following the ranges in the batch are drawn after them,
+        // see pgraph_expand_draw_arrays
+        if (!pg->inline_elements_length) {
+            return;
+        }
+    }
+
+    if (pg->inline_elements_length) {
         NV2A_VK_DGROUP_BEGIN("Inline Elements");
         assert(pg->inline_buffer_length == 0);
         assert(pg->inline_array_length == 0);
@@ -2181,33 +3809,45 @@ void pgraph_vk_flush_draw(NV2AState *d)
             draw_index_count = prim_rw.num_indices;
         }
 
-        size_t index_data_size = draw_index_count * sizeof(uint32_t);
-        ensure_buffer_space(pg, BUFFER_INDEX_STAGING, index_data_size);
+        uint32_t min_element, max_element;
+        get_index_range(draw_indices, draw_index_count, &min_element,
+                        &max_element);
 
-        uint32_t min_element = (uint32_t)-1;
-        uint32_t max_element = 0;
-        for (unsigned int i = 0; i < draw_index_count; i++) {
-            max_element = MAX(draw_indices[i], max_element);
-            min_element = MIN(draw_indices[i], min_element);
+        void *index_data = draw_indices;
+        size_t index_data_size = draw_index_count * sizeof(uint32_t);
+        VkIndexType index_type = VK_INDEX_TYPE_UINT32;
+        int32_t vertex_offset = 0;
+        uint16_t *narrowed = narrow_indices(r, draw_indices, draw_index_count,
+                                            min_element, max_element);
+        if (narrowed) {
+            nv2a_profile_inc_counter(NV2A_PROF_INLINE_ELEMENTS_16BIT);
+            index_data = narrowed;
+            index_data_size = draw_index_count * sizeof(uint16_t);
+            index_type = VK_INDEX_TYPE_UINT16;
+            vertex_offset = min_element;
         }
+        ensure_buffer_space(pg, BUFFER_INDEX_STAGING, index_data_size,
+                            sizeof(uint32_t));
         pgraph_vk_bind_vertex_attributes(
             d, min_element, max_element, false, 0,
             draw_indices[draw_index_count - 1]);
         sync_vertex_ram_buffer(pg);
         VertexBufferRemap remap = remap_unaligned_attributes(pg, max_element + 1);
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         copy_remapped_attributes_to_inline_buffer(pg, remap, 0, max_element + 1);
         VkDeviceSize buffer_offset = pgraph_vk_update_index_buffer(
-            pg, draw_indices, index_data_size);
+            pg, index_data, index_data_size);
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
                                      "Inline Elements");
         begin_draw(pg);
         bind_vertex_buffer(pg, remap.attributes, 0);
-        vkCmdBindIndexBuffer(r->command_buffer,
-                             r->storage_buffers[BUFFER_INDEX].buffer,
-                             buffer_offset, VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(r->command_buffer, draw_index_count, 1, 0, 0, 0);
+        bind_index_buffer(r, buffer_offset, index_type);
+        pgraph_vk_cmd_draw_indexed(r, draw_index_count, 1, 0, vertex_offset,
+                                   0);
         end_draw(pg);
         pgraph_vk_end_debug_marker(r, r->command_buffer);
 
@@ -2238,13 +3878,17 @@ void pgraph_vk_flush_draw(NV2AState *d)
         PrimRewrite prim_rw = pgraph_prim_rewrite_sequential(
             &r->prim_rewrite_buf, assembly, 0, pg->inline_buffer_length);
 
-        ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING, offset);
+        ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING, offset, 1);
         if (prim_rw.num_indices > 0) {
             size_t rewrite_size = prim_rw.num_indices * sizeof(uint32_t);
-            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, rewrite_size);
+            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, rewrite_size,
+                                sizeof(uint32_t));
         }
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         VkDeviceSize buffer_offset = pgraph_vk_update_vertex_inline_buffer(
             pg, data, sizes, r->num_active_vertex_attribute_descriptions);
         pgraph_vk_begin_debug_marker(r, r->command_buffer, RGBA_BLUE,
@@ -2256,13 +3900,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
             size_t rewrite_size = prim_rw.num_indices * sizeof(uint32_t);
             VkDeviceSize idx_offset = pgraph_vk_update_index_buffer(
                 pg, prim_rw.indices, rewrite_size);
-            vkCmdBindIndexBuffer(r->command_buffer,
-                                 r->storage_buffers[BUFFER_INDEX].buffer,
-                                 idx_offset, VK_INDEX_TYPE_UINT32);
-            vkCmdDrawIndexed(r->command_buffer, prim_rw.num_indices, 1, 0, 0,
-                             0);
+            bind_index_buffer(r, idx_offset, VK_INDEX_TYPE_UINT32);
+            pgraph_vk_cmd_draw_indexed(r, prim_rw.num_indices, 1, 0, 0, 0);
         } else {
-            vkCmdDraw(r->command_buffer, pg->inline_buffer_length, 1, 0, 0);
+            record_draw(pg, 0, pg->inline_buffer_length);
         }
 
         end_draw(pg);
@@ -2275,7 +3916,7 @@ void pgraph_vk_flush_draw(NV2AState *d)
 
         VkDeviceSize inline_array_data_size = pg->inline_array_length * 4;
         ensure_buffer_space(pg, BUFFER_VERTEX_INLINE_STAGING,
-                               inline_array_data_size);
+                            inline_array_data_size, 1);
 
         unsigned int offset = 0;
         for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
@@ -2305,10 +3946,14 @@ void pgraph_vk_flush_draw(NV2AState *d)
 
         if (prim_rw.num_indices > 0) {
             size_t rewrite_size = prim_rw.num_indices * sizeof(uint32_t);
-            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, rewrite_size);
+            ensure_buffer_space(pg, BUFFER_INDEX_STAGING, rewrite_size,
+                                sizeof(uint32_t));
         }
 
-        begin_pre_draw(pg);
+        if (!begin_pre_draw(pg)) {
+            NV2A_VK_DGROUP_END();
+            return;
+        }
         void *inline_array_data = pg->inline_array;
         VkDeviceSize buffer_offset = pgraph_vk_update_vertex_inline_buffer(
             pg, &inline_array_data, &inline_array_data_size, 1);
@@ -2321,13 +3966,10 @@ void pgraph_vk_flush_draw(NV2AState *d)
             size_t rewrite_size = prim_rw.num_indices * sizeof(uint32_t);
             VkDeviceSize idx_offset = pgraph_vk_update_index_buffer(
                 pg, prim_rw.indices, rewrite_size);
-            vkCmdBindIndexBuffer(r->command_buffer,
-                                 r->storage_buffers[BUFFER_INDEX].buffer,
-                                 idx_offset, VK_INDEX_TYPE_UINT32);
-            vkCmdDrawIndexed(r->command_buffer, prim_rw.num_indices, 1, 0, 0,
-                             0);
+            bind_index_buffer(r, idx_offset, VK_INDEX_TYPE_UINT32);
+            pgraph_vk_cmd_draw_indexed(r, prim_rw.num_indices, 1, 0, 0, 0);
         } else {
-            vkCmdDraw(r->command_buffer, index_count, 1, 0, 0);
+            record_draw(pg, 0, index_count);
         }
 
         end_draw(pg);
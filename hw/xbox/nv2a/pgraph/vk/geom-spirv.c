@@ -0,0 +1,515 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Geometry shader written directly as SPIR-V. This is the same program
+ * pgraph_glsl_gen_geom() writes as GLSL, which remains the reference and is
+ * still used when shaders are being debugged. Keep the two in sync.
+ */
+
+#include "renderer.h"
+#include "spirv.h"
+
+// GLSL.std.450 extended instructions
+#define GLSL_STD_450_FABS 4
+#define GLSL_STD_450_FMAX 40
+#define GLSL_STD_450_FMA 50
+
+// Varyings, in pgraph_glsl_get_vtx_header() order, which gives the locations
+enum GeomVarying {
+    VAR_D0,
+    VAR_D1,
+    VAR_B0,
+    VAR_B1,
+    VAR_FOG,
+    VAR_T0,
+    VAR_T1,
+    VAR_T2,
+    VAR_T3,
+    VAR_POS0,
+    VAR_POS1,
+    VAR_POS2,
+    VAR_TRI_MZ,
+    VAR_POINT_SIZE,
+    VAR_COUNT,
+};
+
+typedef struct GeomSpirv {
+    SpirvBuilder b;
+    const GeomState *state;
+    int num_in; // Vertices per input primitive
+
+    uint32_t glsl_ext;
+    uint32_t t_void, t_bool, t_float, t_int, t_vec4, t_main;
+    uint32_t t_in_float, t_in_vec4, t_out_float, t_out_vec4;
+    uint32_t c_int[4];
+    uint32_t c_zero;
+
+    uint32_t gl_in, gl_out;
+    uint32_t in[VAR_COUNT];  // Zero for varyings the shader doesn't read
+    uint32_t out[VAR_COUNT];
+} GeomSpirv;
+
+// Positions of the primitive's vertices and its maximum depth slope
+typedef struct GeomPz {
+    uint32_t pos[3];
+    uint32_t dz;
+} GeomPz;
+
+static bool varying_is_vec4(enum GeomVarying v)
+{
+    return v != VAR_FOG && v != VAR_TRI_MZ && v != VAR_POINT_SIZE;
+}
+
+static bool varying_is_flat(const GeomSpirv *g, enum GeomVarying v)
+{
+    switch (v) {
+    case VAR_D0:
+    case VAR_D1:
+    case VAR_B0:
+    case VAR_B1:
+        return !g->state->smooth_shading;
+    case VAR_POS0:
+    case VAR_POS1:
+    case VAR_POS2:
+    case VAR_TRI_MZ:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool varying_is_read(enum GeomVarying v)
+{
+    return v != VAR_POS1 && v != VAR_POS2 && v != VAR_TRI_MZ;
+}
+
+static uint32_t declare_pointer(GeomSpirv *g, SpvStorageClass storage,
+                                uint32_t type)
+{
+    uint32_t id = spirv_id(&g->b);
+    SPIRV_EMIT(g->b.globals, SpvOpTypePointer, id, storage, type);
+    return id;
+}
+
+static uint32_t declare_array(GeomSpirv *g, uint32_t type, int length)
+{
+    uint32_t id = spirv_id(&g->b);
+    SPIRV_EMIT(g->b.globals, SpvOpTypeArray, id, type, g->c_int[length]);
+    return id;
+}
+
+static uint32_t declare_variable(GeomSpirv *g, SpvStorageClass storage,
+                                 uint32_t pointer_type)
+{
+    uint32_t id = spirv_id(&g->b);
+    SPIRV_EMIT(g->b.globals, SpvOpVariable, pointer_type, id, storage);
+    return id;
+}
+
+static void decorate(GeomSpirv *g, uint32_t id, SpvDecoration decoration)
+{
+    SPIRV_EMIT(g->b.annotations, SpvOpDecorate, id, decoration);
+}
+
+static void declare_types(GeomSpirv *g)
+{
+    GArray *globals = g->b.globals;
+
+    g->t_void = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpTypeVoid, g->t_void);
+    g->t_bool = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpTypeBool, g->t_bool);
+    g->t_float = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpTypeFloat, g->t_float, 32);
+    g->t_int = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpTypeInt, g->t_int, 32, 1);
+    g->t_vec4 = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpTypeVector, g->t_vec4, g->t_float, 4);
+    g->t_main = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpTypeFunction, g->t_main, g->t_void);
+
+    for (int i = 0; i < ARRAY_SIZE(g->c_int); i++) {
+        g->c_int[i] = spirv_id(&g->b);
+        SPIRV_EMIT(globals, SpvOpConstant, g->t_int, g->c_int[i], i);
+    }
+    g->c_zero = spirv_id(&g->b);
+    SPIRV_EMIT(globals, SpvOpConstant, g->t_float, g->c_zero, 0);
+
+    g->t_in_float = declare_pointer(g, SpvStorageClassInput, g->t_float);
+    g->t_in_vec4 = declare_pointer(g, SpvStorageClassInput, g->t_vec4);
+    g->t_out_float = declare_pointer(g, SpvStorageClassOutput, g->t_float);
+    g->t_out_vec4 = declare_pointer(g, SpvStorageClassOutput, g->t_vec4);
+}
+
+/*
+ * gl_PerVertex as glslang declares it, so the block matches the one the
+ * vertex shader writes
+ */
+static uint32_t declare_per_vertex_block(GeomSpirv *g)
+{
+    uint32_t t_clip = declare_array(g, g->t_float, 1);
+    uint32_t id = spirv_id(&g->b);
+    SPIRV_EMIT(g->b.globals, SpvOpTypeStruct, id, g->t_vec4, g->t_float,
+               t_clip, t_clip);
+
+    static const SpvBuiltIn members[] = {
+        SpvBuiltInPosition,
+        SpvBuiltInPointSize,
+        SpvBuiltInClipDistance,
+        SpvBuiltInCullDistance,
+    };
+    for (int i = 0; i < ARRAY_SIZE(members); i++) {
+        SPIRV_EMIT(g->b.annotations, SpvOpMemberDecorate, id, i,
+                   SpvDecorationBuiltIn, members[i]);
+    }
+    decorate(g, id, SpvDecorationBlock);
+
+    return id;
+}
+
+static void declare_interface(GeomSpirv *g)
+{
+    uint32_t t_per_vertex = declare_per_vertex_block(g);
+    uint32_t t_per_vertex_in = declare_array(g, t_per_vertex, g->num_in);
+    g->gl_in = declare_variable(
+        g, SpvStorageClassInput,
+        declare_pointer(g, SpvStorageClassInput, t_per_vertex_in));
+    g->gl_out = declare_variable(
+        g, SpvStorageClassOutput,
+        declare_pointer(g, SpvStorageClassOutput, t_per_vertex));
+
+    uint32_t t_in_arrays[2] = {
+        declare_pointer(g, SpvStorageClassInput,
+                        declare_array(g, g->t_float, g->num_in)),
+        declare_pointer(g, SpvStorageClassInput,
+                        declare_array(g, g->t_vec4, g->num_in)),
+    };
+
+    for (int v = 0; v < VAR_COUNT; v++) {
+        bool is_vec4 = varying_is_vec4(v);
+        bool is_flat = varying_is_flat(g, v);
+
+        if (varying_is_read(v)) {
+            g->in[v] = declare_variable(g, SpvStorageClassInput,
+                                        t_in_arrays[is_vec4]);
+            SPIRV_EMIT(g->b.annotations, SpvOpDecorate, g->in[v],
+                       SpvDecorationLocation, v);
+            if (is_flat) {
+                decorate(g, g->in[v], SpvDecorationFlat);
+            }
+        }
+
+        g->out[v] = declare_variable(g, SpvStorageClassOutput,
+                                     is_vec4 ? g->t_out_vec4 :
+                                               g->t_out_float);
+        SPIRV_EMIT(g->b.annotations, SpvOpDecorate, g->out[v],
+                   SpvDecorationLocation, v);
+        if (is_flat) {
+            decorate(g, g->out[v], SpvDecorationFlat);
+        }
+    }
+}
+
+static void emit_preamble(GeomSpirv *g, SpvExecutionMode input_mode,
+                          SpvExecutionMode output_mode, int max_vertices,
+                          uint32_t main_id)
+{
+    GArray *p = g->b.preamble;
+
+    SPIRV_EMIT(p, SpvOpCapability, SpvCapabilityGeometry);
+    SPIRV_EMIT(p, SpvOpCapability, SpvCapabilityGeometryPointSize);
+    spirv_emit_with_string(p, SpvOpExtInstImport, &g->glsl_ext, 1,
+                           "GLSL.std.450", NULL, 0);
+    SPIRV_EMIT(p, SpvOpMemoryModel, SpvAddressingModelLogical,
+               SpvMemoryModelGLSL450);
+
+    GArray *interface = g_array_new(false, false, sizeof(uint32_t));
+    g_array_append_val(interface, g->gl_in);
+    g_array_append_val(interface, g->gl_out);
+    for (int v = 0; v < VAR_COUNT; v++) {
+        if (g->in[v]) {
+            g_array_append_val(interface, g->in[v]);
+        }
+        g_array_append_val(interface, g->out[v]);
+    }
+    spirv_emit_with_string(p, SpvOpEntryPoint,
+                           SPIRV_OPERANDS(SpvExecutionModelGeometry, main_id),
+                           "main", (const uint32_t *)interface->data,
+                           interface->len);
+    g_array_free(interface, true);
+
+    SPIRV_EMIT(p, SpvOpExecutionMode, main_id, input_mode);
+    SPIRV_EMIT(p, SpvOpExecutionMode, main_id, SpvExecutionModeInvocations, 1);
+    SPIRV_EMIT(p, SpvOpExecutionMode, main_id, output_mode);
+    SPIRV_EMIT(p, SpvOpExecutionMode, main_id, SpvExecutionModeOutputVertices,
+               max_vertices);
+}
+
+static uint32_t load_varying(GeomSpirv *g, enum GeomVarying v, int index)
+{
+    uint32_t type = varying_is_vec4(v) ? g->t_vec4 : g->t_float;
+    uint32_t ptr = SPIRV_OP(&g->b, SpvOpAccessChain,
+                            varying_is_vec4(v) ? g->t_in_vec4 : g->t_in_float,
+                            g->in[v], g->c_int[index]);
+    return SPIRV_OP(&g->b, SpvOpLoad, type, ptr);
+}
+
+static uint32_t load_per_vertex(GeomSpirv *g, int index, int member)
+{
+    uint32_t ptr = SPIRV_OP(&g->b, SpvOpAccessChain,
+                            member ? g->t_in_float : g->t_in_vec4, g->gl_in,
+                            g->c_int[index], g->c_int[member]);
+    return SPIRV_OP(&g->b, SpvOpLoad, member ? g->t_float : g->t_vec4, ptr);
+}
+
+static void store(GeomSpirv *g, uint32_t ptr, uint32_t value)
+{
+    SPIRV_EMIT(g->b.code, SpvOpStore, ptr, value);
+}
+
+static uint32_t extract(GeomSpirv *g, uint32_t vec, int component)
+{
+    return SPIRV_OP(&g->b, SpvOpCompositeExtract, g->t_float, vec, component);
+}
+
+static uint32_t binop(GeomSpirv *g, SpvOp op, uint32_t a, uint32_t b)
+{
+    return SPIRV_OP(&g->b, op, g->t_float, a, b);
+}
+
+// The result of an operation on a GLSL `precise` variable
+static uint32_t precise(GeomSpirv *g, uint32_t id)
+{
+    decorate(g, id, SpvDecorationNoContraction);
+    return id;
+}
+
+static uint32_t negate(GeomSpirv *g, uint32_t a)
+{
+    return SPIRV_OP(&g->b, SpvOpFNegate, g->t_float, a);
+}
+
+static uint32_t ext_fma(GeomSpirv *g, uint32_t a, uint32_t b, uint32_t c)
+{
+    return SPIRV_OP(&g->b, SpvOpExtInst, g->t_float, g->glsl_ext,
+                    GLSL_STD_450_FMA, a, b, c);
+}
+
+// a*b - c*d with Kahan's algorithm, see kahan_det() in glsl/geom.c
+static uint32_t kahan_det(GeomSpirv *g, uint32_t a, uint32_t b, uint32_t c,
+                          uint32_t d)
+{
+    uint32_t cd = precise(g, binop(g, SpvOpFMul, c, d));
+    uint32_t err = ext_fma(g, negate(g, c), d, cd);
+    return precise(g, binop(g, SpvOpFAdd, ext_fma(g, a, b, negate(g, cd)), err));
+}
+
+static GeomPz calc_triz(GeomSpirv *g, int i0, int i1, int i2)
+{
+    GeomPz pz;
+    pz.pos[0] = load_varying(g, VAR_POS0, i0);
+    pz.pos[1] = load_varying(g, VAR_POS0, i1);
+    pz.pos[2] = load_varying(g, VAR_POS0, i2);
+
+    uint32_t c[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 4; j++) {
+            c[i][j] = extract(g, pz.pos[i], j);
+        }
+    }
+
+    uint32_t m0x = binop(g, SpvOpFSub, c[1][0], c[0][0]);
+    uint32_t m0y = binop(g, SpvOpFSub, c[1][1], c[0][1]);
+    uint32_t m1x = binop(g, SpvOpFSub, c[2][0], c[0][0]);
+    uint32_t m1y = binop(g, SpvOpFSub, c[2][1], c[0][1]);
+
+    uint32_t bx, by;
+    if (g->state->z_perspective) {
+        bx = precise(g, binop(g, SpvOpFSub, c[0][3], c[1][3]));
+        by = precise(g, binop(g, SpvOpFSub, c[0][3], c[2][3]));
+        uint32_t wx = precise(g, binop(g, SpvOpFMul, c[1][3], c[0][3]));
+        uint32_t wy = precise(g, binop(g, SpvOpFMul, c[2][3], c[0][3]));
+        bx = precise(g, binop(g, SpvOpFDiv, bx, wx));
+        by = precise(g, binop(g, SpvOpFDiv, by, wy));
+    } else {
+        bx = precise(g, binop(g, SpvOpFSub, c[1][2], c[0][2]));
+        by = precise(g, binop(g, SpvOpFSub, c[2][2], c[0][2]));
+    }
+
+    uint32_t det = kahan_det(g, m0x, m1y, m1x, m0y);
+    uint32_t dzx =
+        binop(g, SpvOpFDiv, kahan_det(g, bx, m1y, by, m0y), det);
+    uint32_t dzy =
+        binop(g, SpvOpFDiv, kahan_det(g, by, m0x, bx, m1x), det);
+    pz.dz = SPIRV_OP(
+        &g->b, SpvOpExtInst, g->t_float, g->glsl_ext, GLSL_STD_450_FMAX,
+        SPIRV_OP(&g->b, SpvOpExtInst, g->t_float, g->glsl_ext,
+                 GLSL_STD_450_FABS, dzx),
+        SPIRV_OP(&g->b, SpvOpExtInst, g->t_float, g->glsl_ext,
+                 GLSL_STD_450_FABS, dzy));
+
+    return pz;
+}
+
+static void emit_vertex(GeomSpirv *g, int index, const GeomPz *pz)
+{
+    int provoking = g->state->smooth_shading ? index : 0;
+
+    uint32_t ptr = SPIRV_OP(&g->b, SpvOpAccessChain, g->t_out_vec4, g->gl_out,
+                            g->c_int[0]);
+    store(g, ptr, load_per_vertex(g, index, 0));
+    ptr = SPIRV_OP(&g->b, SpvOpAccessChain, g->t_out_float, g->gl_out,
+                   g->c_int[1]);
+    store(g, ptr, load_per_vertex(g, index, 1));
+
+    for (int v = VAR_D0; v <= VAR_B1; v++) {
+        store(g, g->out[v], load_varying(g, v, provoking));
+    }
+    for (int v = VAR_FOG; v <= VAR_T3; v++) {
+        store(g, g->out[v], load_varying(g, v, index));
+    }
+    for (int i = 0; i < 3; i++) {
+        store(g, g->out[VAR_POS0 + i], pz->pos[i]);
+    }
+
+    uint32_t invalid = SPIRV_OP(
+        &g->b, SpvOpLogicalOr, g->t_bool,
+        SPIRV_OP(&g->b, SpvOpIsNan, g->t_bool, pz->dz),
+        SPIRV_OP(&g->b, SpvOpIsInf, g->t_bool, pz->dz));
+    store(g, g->out[VAR_TRI_MZ],
+          SPIRV_OP(&g->b, SpvOpSelect, g->t_float, invalid, g->c_zero,
+                   pz->dz));
+
+    store(g, g->out[VAR_POINT_SIZE],
+          load_varying(g, VAR_POINT_SIZE, index));
+
+    spirv_emit(g->b.code, SpvOpEmitVertex, NULL, 0);
+}
+
+static void end_primitive(GeomSpirv *g)
+{
+    spirv_emit(g->b.code, SpvOpEndPrimitive, NULL, 0);
+}
+
+/*
+ * Add a third vertex by rotating the line 90 degrees, so triangle
+ * interpolation in the fragment shader works as is for lines
+ */
+static void emit_line(GeomSpirv *g, int i0, int i1, uint32_t dz)
+{
+    GeomPz pz;
+    pz.pos[0] = load_varying(g, VAR_POS0, i0);
+    pz.pos[1] = load_varying(g, VAR_POS0, i1);
+    pz.dz = dz;
+
+    uint32_t x0 = extract(g, pz.pos[0], 0);
+    uint32_t y0 = extract(g, pz.pos[0], 1);
+    uint32_t dx = binop(g, SpvOpFSub, extract(g, pz.pos[1], 0), x0);
+    uint32_t dy = binop(g, SpvOpFSub, extract(g, pz.pos[1], 1), y0);
+    pz.pos[2] = SPIRV_OP(&g->b, SpvOpCompositeConstruct, g->t_vec4,
+                         binop(g, SpvOpFAdd, negate(g, dy), x0),
+                         binop(g, SpvOpFAdd, dx, y0),
+                         extract(g, pz.pos[0], 2),
+                         extract(g, pz.pos[0], 3));
+
+    emit_vertex(g, i0, &pz);
+    emit_vertex(g, i1, &pz);
+    end_primitive(g);
+}
+
+GByteArray *pgraph_vk_gen_geom_spv(const GeomState *state)
+{
+    /* FIXME: Missing support for 2-sided-poly mode */
+    assert(state->polygon_front_mode == state->polygon_back_mode);
+    enum ShaderPolygonMode polygon_mode = state->polygon_front_mode;
+
+    GeomSpirv g = { .state = state };
+    SpvExecutionMode input_mode, output_mode;
+    int max_vertices;
+
+    switch (state->primitive_mode) {
+    case PRIM_TYPE_LINES:
+        g.num_in = 2;
+        input_mode = SpvExecutionModeInputLines;
+        output_mode = SpvExecutionModeOutputLineStrip;
+        max_vertices = 2;
+        break;
+    case PRIM_TYPE_TRIANGLES:
+        g.num_in = 3;
+        input_mode = SpvExecutionModeTriangles;
+        if (polygon_mode == POLY_MODE_FILL) {
+            output_mode = SpvExecutionModeOutputTriangleStrip;
+            max_vertices = 3;
+        } else if (polygon_mode == POLY_MODE_LINE) {
+            output_mode = SpvExecutionModeOutputLineStrip;
+            max_vertices = 6;
+        } else {
+            assert(polygon_mode == POLY_MODE_POINT);
+            output_mode = SpvExecutionModeOutputPoints;
+            max_vertices = 3;
+        }
+        break;
+    default:
+        assert(!"Primitive mode needs no geometry shader");
+        return NULL;
+    }
+
+    spirv_builder_init(&g.b);
+    g.glsl_ext = spirv_id(&g.b);
+    declare_types(&g);
+    declare_interface(&g);
+
+    uint32_t main_id = spirv_id(&g.b);
+    SPIRV_EMIT(g.b.code, SpvOpFunction, g.t_void, main_id,
+               SpvFunctionControlMaskNone, g.t_main);
+    SPIRV_EMIT(g.b.code, SpvOpLabel, spirv_id(&g.b));
+
+    if (state->primitive_mode == PRIM_TYPE_LINES) {
+        emit_line(&g, 0, 1, g.c_zero);
+    } else if (polygon_mode == POLY_MODE_FILL) {
+        GeomPz pz = calc_triz(&g, 0, 1, 2);
+        emit_vertex(&g, 0, &pz);
+        emit_vertex(&g, 1, &pz);
+        emit_vertex(&g, 2, &pz);
+        end_primitive(&g);
+    } else if (polygon_mode == POLY_MODE_LINE) {
+        uint32_t dz = calc_triz(&g, 0, 1, 2).dz;
+        emit_line(&g, 0, 1, dz);
+        emit_line(&g, 1, 2, dz);
+        emit_line(&g, 2, 0, dz);
+    } else {
+        GeomPz pz = calc_triz(&g, 0, 1, 2);
+        for (int i = 0; i < 3; i++) {
+            GeomPz point = {
+                .pos = { pz.pos[i], pz.pos[i], pz.pos[i] },
+                .dz = pz.dz,
+            };
+            emit_vertex(&g, i, &point);
+            end_primitive(&g);
+        }
+    }
+
+    spirv_emit(g.b.code, SpvOpReturn, NULL, 0);
+    spirv_emit(g.b.code, SpvOpFunctionEnd, NULL, 0);
+
+    emit_preamble(&g, input_mode, output_mode, max_vertices, main_id);
+
+    return spirv_builder_finish(&g.b);
+}
@@ -130,13 +130,160 @@ static const glslang_resource_t
                             .general_constant_matrix_vector_indexing = 1,
                         } };
 
-void pgraph_vk_init_glsl_compiler(void)
+#define MAX_GLSL_COMPILER_THREADS 8
+
+struct ShaderModuleFuture {
+    QSIMPLEQ_ENTRY(ShaderModuleFuture) entry;
+    PGRAPHVkState *r;
+    VkShaderStageFlagBits stage;
+    char *glsl;
+    ShaderModuleInfo *info;
+    bool done;
+    QemuEvent complete;
+};
+
+static struct {
+    QemuThread *threads;
+    int num_threads;
+    bool shutdown;
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, ShaderModuleFuture) queue;
+} compiler_pool;
+
+static void *glsl_compiler_thread(void *opaque)
 {
+    xemu_trace_set_thread_name("nv2a.vk_glsl_compiler");
+    xemu_thread_topology_register(XEMU_THREAD_THROUGHPUT,
+                                  "nv2a.vk_glsl_compiler");
     glslang_initialize_process();
+
+    qemu_mutex_lock(&compiler_pool.lock);
+    while (true) {
+        ShaderModuleFuture *future;
+        while (!(future = QSIMPLEQ_FIRST(&compiler_pool.queue)) &&
+               !compiler_pool.shutdown) {
+            qemu_cond_wait(&compiler_pool.cond, &compiler_pool.lock);
+        }
+        if (!future) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&compiler_pool.queue, entry);
+        qemu_mutex_unlock(&compiler_pool.lock);
+
+        future->info = pgraph_vk_create_shader_module_from_glsl(
+            future->r, future->stage, future->glsl);
+        qatomic_store_release(&future->done, true);
+        qemu_event_set(&future->complete);
+
+        qemu_mutex_lock(&compiler_pool.lock);
+    }
+    qemu_mutex_unlock(&compiler_pool.lock);
+
+    glslang_finalize_process();
+
+    return NULL;
+}
+
+/*
+ * glslang builds the tables of built-in symbols the first time each stage is
+ * compiled, which makes the first compiles slow. They are built on a thread
+ * while the machine is being created, and the process reference taken there
+ * is handed over to the compiler.
+ */
+static struct {
+    QemuThread thread;
+    bool started;
+} glsl_prewarm;
+
+static const struct {
+    glslang_stage_t stage;
+    const char *glsl;
+} glsl_prewarm_shaders[] = {
+    { GLSLANG_STAGE_VERTEX,
+      "#version 450\n"
+      "void main() { gl_Position = vec4(0.0); }\n" },
+    { GLSLANG_STAGE_FRAGMENT,
+      "#version 450\n"
+      "layout(location = 0) out vec4 color;\n"
+      "void main() { color = vec4(0.0); }\n" },
+    { GLSLANG_STAGE_COMPUTE,
+      "#version 450\n"
+      "layout(local_size_x = 1) in;\n"
+      "void main() {}\n" },
+};
+
+static void *glsl_prewarm_thread(void *opaque)
+{
+    xemu_trace_set_thread_name("nv2a.vk_glsl_prewarm");
+    xemu_thread_topology_register(XEMU_THREAD_BACKGROUND,
+                                  "nv2a.vk_glsl_prewarm");
+    glslang_initialize_process();
+
+    for (int i = 0; i < ARRAY_SIZE(glsl_prewarm_shaders); i++) {
+        g_byte_array_unref(pgraph_vk_compile_glsl_to_spv(
+            glsl_prewarm_shaders[i].stage, glsl_prewarm_shaders[i].glsl));
+    }
+    return NULL;
+}
+
+void pgraph_vk_prewarm_glsl_compiler(void)
+{
+    if (glsl_prewarm.started) {
+        return;
+    }
+    glsl_prewarm.started = true;
+    qemu_thread_create(&glsl_prewarm.thread, "nv2a.vk_glsl_prewarm",
+                       glsl_prewarm_thread, NULL, QEMU_THREAD_JOINABLE);
+}
+
+void pgraph_vk_init_glsl_compiler(void)
+{
+    if (glsl_prewarm.started) {
+        qemu_thread_join(&glsl_prewarm.thread);
+        glsl_prewarm.started = false;
+    } else {
+        glslang_initialize_process();
+    }
+
+    qemu_mutex_init(&compiler_pool.lock);
+    qemu_cond_init(&compiler_pool.cond);
+    QSIMPLEQ_INIT(&compiler_pool.queue);
+    compiler_pool.shutdown = false;
+
+    // Leave a core for the pfifo thread, which waits on the results
+    compiler_pool.num_threads = MIN(MAX_GLSL_COMPILER_THREADS,
+                                    (int)g_get_num_processors() - 1);
+    if (compiler_pool.num_threads < 1) {
+        compiler_pool.num_threads = 0;
+        return;
+    }
+
+    compiler_pool.threads = g_new(QemuThread, compiler_pool.num_threads);
+    for (int i = 0; i < compiler_pool.num_threads; i++) {
+        qemu_thread_create(&compiler_pool.threads[i], "nv2a.vk_glsl_compiler",
+                           glsl_compiler_thread, NULL, QEMU_THREAD_JOINABLE);
+    }
 }
 
 void pgraph_vk_finalize_glsl_compiler(void)
 {
+    qemu_mutex_lock(&compiler_pool.lock);
+    assert(QSIMPLEQ_EMPTY(&compiler_pool.queue));
+    compiler_pool.shutdown = true;
+    qemu_cond_broadcast(&compiler_pool.cond);
+    qemu_mutex_unlock(&compiler_pool.lock);
+
+    for (int i = 0; i < compiler_pool.num_threads; i++) {
+        qemu_thread_join(&compiler_pool.threads[i]);
+    }
+    g_free(compiler_pool.threads);
+    compiler_pool.threads = NULL;
+    compiler_pool.num_threads = 0;
+
+    qemu_cond_destroy(&compiler_pool.cond);
+    qemu_mutex_destroy(&compiler_pool.lock);
+
     glslang_finalize_process();
 }
 
@@ -367,6 +514,7 @@ static glslang_stage_t vk_shader_stage_to_glslang_stage(VkShaderStageFlagBits st
 ShaderModuleInfo *pgraph_vk_create_shader_module_from_glsl(
     PGRAPHVkState *r, VkShaderStageFlagBits stage, const char *glsl)
 {
+    xemu_trace_begin("shader compile", NULL);
     ShaderModuleInfo *info = g_malloc0(sizeof(*info));
     info->refcnt = 0;
     info->glsl = strdup(glsl);
@@ -374,6 +522,79 @@ ShaderModuleInfo *pgraph_vk_create_shader_module_from_glsl(
         vk_shader_stage_to_glslang_stage(stage), glsl);
     info->module = pgraph_vk_create_shader_module_from_spv(r, info->spirv);
     init_layout_from_spv(info);
+    xemu_trace_end();
+    return info;
+}
+
+/*
+ * Start compiling a shader module on the compiler pool. The result must be
+ * collected with pgraph_vk_wait_shader_module, which also frees the future.
+ */
+ShaderModuleFuture *pgraph_vk_create_shader_module_from_glsl_async(
+    PGRAPHVkState *r, VkShaderStageFlagBits stage, const char *glsl)
+{
+    ShaderModuleFuture *future = g_malloc0(sizeof(*future));
+    future->r = r;
+    future->stage = stage;
+    qemu_event_init(&future->complete, false);
+
+    if (!compiler_pool.num_threads) {
+        future->info = pgraph_vk_create_shader_module_from_glsl(r, stage, glsl);
+        future->done = true;
+        qemu_event_set(&future->complete);
+        return future;
+    }
+
+    future->glsl = g_strdup(glsl);
+
+    qemu_mutex_lock(&compiler_pool.lock);
+    QSIMPLEQ_INSERT_TAIL(&compiler_pool.queue, future, entry);
+    qemu_cond_signal(&compiler_pool.cond);
+    qemu_mutex_unlock(&compiler_pool.lock);
+
+    return future;
+}
+
+bool pgraph_vk_shader_module_is_ready(ShaderModuleFuture *future)
+{
+    return qatomic_load_acquire(&future->done);
+}
+
+ShaderModuleInfo *pgraph_vk_wait_shader_module(ShaderModuleFuture *future)
+{
+    qemu_event_wait(&future->complete);
+    qemu_event_destroy(&future->complete);
+
+    ShaderModuleInfo *info = future->info;
+    g_free(future->glsl);
+    g_free(future);
+
+    return info;
+}
+
+/*
+ * Wrap a module that needed no compiling, e.g. one generated directly as
+ * SPIR-V, so it can be collected like any other
+ */
+ShaderModuleFuture *pgraph_vk_shader_module_future_from_info(
+    ShaderModuleInfo *info)
+{
+    ShaderModuleFuture *future = g_malloc0(sizeof(*future));
+    future->info = info;
+    future->done = true;
+    qemu_event_init(&future->complete, true);
+    return future;
+}
+
+ShaderModuleInfo *pgraph_vk_create_shader_module_from_spv_data(
+    PGRAPHVkState *r, GByteArray *spv)
+{
+    ShaderModuleInfo *info = g_malloc0(sizeof(*info));
+    info->refcnt = 0;
+    info->glsl = NULL;
+    info->spirv = g_byte_array_ref(spv);
+    info->module = pgraph_vk_create_shader_module_from_spv(r, info->spirv);
+    init_layout_from_spv(info);
     return info;
 }
 
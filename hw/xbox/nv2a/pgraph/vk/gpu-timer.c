@@ -0,0 +1,187 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "renderer.h"
+
+/*
+ * Each command buffer gets its own timestamp query pool, reset when
+ * recording starts. Results of a frame's command buffer are read when the
+ * frame is retired; those of single time commands when they complete. Both
+ * are then known to be available, so reading them never waits.
+ */
+
+static void create_slot(PGRAPHVkState *r, GpuTimerSlot *slot)
+{
+    VkQueryPoolCreateInfo pool_create_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = GPU_TIMER_MAX_QUERIES,
+    };
+    VK_CHECK(vkCreateQueryPool(r->device, &pool_create_info, NULL,
+                               &slot->pool));
+    slot->active = false;
+    slot->num_queries = 0;
+}
+
+void pgraph_vk_init_gpu_timer(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    QueueFamilyIndices indices =
+        pgraph_vk_find_queue_families(r->physical_device);
+
+    uint32_t num_queue_families = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(r->physical_device,
+                                             &num_queue_families, NULL);
+    g_autofree VkQueueFamilyProperties *queue_families =
+        g_malloc_n(num_queue_families, sizeof(VkQueueFamilyProperties));
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        r->physical_device, &num_queue_families, queue_families);
+
+    uint32_t valid_bits =
+        queue_families[indices.queue_family].timestampValidBits;
+    r->gpu_timer.supported =
+        valid_bits > 0 && r->device_props.limits.timestampPeriod > 0;
+    r->gpu_timer.period = r->device_props.limits.timestampPeriod;
+    r->gpu_timer.mask = valid_bits >= 64 ? UINT64_MAX :
+                                           (UINT64_C(1) << valid_bits) - 1;
+    r->gpu_timer.render_pass_query = -1;
+
+    if (!r->gpu_timer.supported) {
+        return;
+    }
+
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        create_slot(r, &r->gpu_timer.frames[i]);
+    }
+    create_slot(r, &r->gpu_timer.aux);
+}
+
+void pgraph_vk_finalize_gpu_timer(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->gpu_timer.supported) {
+        return;
+    }
+
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyQueryPool(r->device, r->gpu_timer.frames[i].pool, NULL);
+    }
+    vkDestroyQueryPool(r->device, r->gpu_timer.aux.pool, NULL);
+}
+
+static GpuTimerSlot *get_slot(PGRAPHVkState *r, VkCommandBuffer cmd)
+{
+    if (!r->gpu_timer.supported) {
+        return NULL;
+    }
+
+    return cmd == r->aux_command_buffer ? &r->gpu_timer.aux :
+                                          &r->gpu_timer.frames[r->frame_index];
+}
+
+/*
+ * Called when recording of a command buffer begins, outside of any render
+ * pass.
+ */
+void pgraph_vk_gpu_timer_reset(PGRAPHVkState *r, VkCommandBuffer cmd)
+{
+    GpuTimerSlot *slot = get_slot(r, cmd);
+    if (!slot) {
+        return;
+    }
+
+    slot->num_queries = 0;
+    slot->frame = g_nv2a_stats.frame_count;
+    slot->active = qatomic_read(&g_nv2a_stats.gpu_timers_enabled);
+    if (slot->active) {
+        vkCmdResetQueryPool(cmd, slot->pool, 0, GPU_TIMER_MAX_QUERIES);
+    }
+}
+
+int pgraph_vk_gpu_timer_begin(PGRAPHVkState *r, VkCommandBuffer cmd,
+                              enum NV2A_PROF_GPU_TIMERS_ENUM timer)
+{
+    GpuTimerSlot *slot = get_slot(r, cmd);
+    if (!slot || !slot->active ||
+        slot->num_queries + 2 > GPU_TIMER_MAX_QUERIES) {
+        return -1;
+    }
+
+    int query = slot->num_queries;
+    slot->timers[query / 2] = timer;
+    slot->num_queries += 2;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot->pool,
+                        query);
+
+    return query;
+}
+
+void pgraph_vk_gpu_timer_end(PGRAPHVkState *r, VkCommandBuffer cmd,
+                             int query)
+{
+    if (query < 0) {
+        return;
+    }
+
+    GpuTimerSlot *slot = get_slot(r, cmd);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, slot->pool,
+                        query + 1);
+}
+
+static void resolve_slot(PGRAPHVkState *r, GpuTimerSlot *slot)
+{
+    if (!slot->active || !slot->num_queries) {
+        slot->active = false;
+        return;
+    }
+
+    uint64_t timestamps[GPU_TIMER_MAX_QUERIES];
+    VkResult result = vkGetQueryPoolResults(
+        r->device, slot->pool, 0, slot->num_queries,
+        slot->num_queries * sizeof(uint64_t), timestamps, sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT);
+
+    if (result == VK_SUCCESS) {
+        for (int i = 0; i < slot->num_queries; i += 2) {
+            uint64_t ticks = (timestamps[i + 1] - timestamps[i]) &
+                             r->gpu_timer.mask;
+            nv2a_profile_add_gpu_time(slot->frame, slot->timers[i / 2],
+                                      ticks * r->gpu_timer.period / 1e6f);
+        }
+    }
+
+    slot->active = false;
+    slot->num_queries = 0;
+}
+
+void pgraph_vk_gpu_timer_frame_retired(PGRAPHVkState *r, int frame_index)
+{
+    if (r->gpu_timer.supported) {
+        resolve_slot(r, &r->gpu_timer.frames[frame_index]);
+    }
+}
+
+void pgraph_vk_gpu_timer_aux_complete(PGRAPHVkState *r)
+{
+    if (r->gpu_timer.supported) {
+        resolve_slot(r, &r->gpu_timer.aux);
+    }
+}
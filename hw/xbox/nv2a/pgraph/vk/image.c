@@ -26,7 +26,7 @@ static bool check_format_has_depth_component(VkFormat format)
            format == VK_FORMAT_D16_UNORM;
 }
 
-static bool check_format_has_stencil_component(VkFormat format)
+bool pgraph_vk_format_has_stencil_component(VkFormat format)
 {
     return format == VK_FORMAT_D32_SFLOAT_S8_UINT ||
            format == VK_FORMAT_D24_UNORM_S8_UINT;
@@ -53,7 +53,7 @@ void pgraph_vk_transition_image_layout(PGRAPHState *pg, VkCommandBuffer cmd,
     if (check_format_has_depth_component(format)) {
         barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
 
-        if (check_format_has_stencil_component(format)) {
+        if (pgraph_vk_format_has_stencil_component(format)) {
             barrier.subresourceRange.aspectMask |= VK_IMAGE_ASPECT_STENCIL_BIT;
         }
     } else {
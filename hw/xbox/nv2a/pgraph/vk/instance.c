@@ -26,6 +26,7 @@
 #include <android/log.h>
 #endif
 #include <volk.h>
+#include <SDL_vulkan.h>
 
 #define VkExtensionPropertiesArray GArray
 #define StringArray GArray
@@ -147,6 +148,72 @@ add_optional_instance_extension_names(PGRAPHState *pg,
         g_config.display.vulkan.validation_layers &&
         add_extension_if_available(available_extensions, enabled_extension_names,
                                    VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+
+    if (g_config.display.vulkan.native_present) {
+        // Surface extensions for the window, SDL keeps the names alive
+        unsigned int num_sdl_extensions = 0;
+        if (!SDL_Vulkan_GetInstanceExtensions(NULL, &num_sdl_extensions,
+                                              NULL)) {
+            fprintf(stderr, "Warning: no Vulkan surface extensions: %s\n",
+                    SDL_GetError());
+            return;
+        }
+
+        g_autofree const char **sdl_extensions =
+            g_malloc_n(num_sdl_extensions, sizeof(char *));
+        SDL_Vulkan_GetInstanceExtensions(NULL, &num_sdl_extensions,
+                                         sdl_extensions);
+        for (int i = 0; i < num_sdl_extensions; i++) {
+            add_extension_if_available(available_extensions,
+                                       enabled_extension_names,
+                                       sdl_extensions[i]);
+        }
+    }
+}
+
+/*
+ * Loading the Vulkan loader and the drivers it finds takes a while, so it is
+ * started on a thread as soon as the renderer is known, while the machine is
+ * still being created.
+ */
+static struct {
+    QemuThread thread;
+    bool started;
+    VkResult result;
+} loader_prewarm;
+
+static void *loader_prewarm_thread(void *opaque)
+{
+    xemu_trace_set_thread_name("nv2a.vk_prewarm");
+    xemu_thread_topology_register(XEMU_THREAD_BACKGROUND, "nv2a.vk_prewarm");
+
+    loader_prewarm.result = volkInitialize();
+    if (loader_prewarm.result == VK_SUCCESS) {
+        // Makes the loader read the driver manifests
+        uint32_t count = 0;
+        vkEnumerateInstanceExtensionProperties(NULL, &count, NULL);
+    }
+    return NULL;
+}
+
+void pgraph_vk_prewarm_loader(void)
+{
+    if (loader_prewarm.started) {
+        return;
+    }
+    loader_prewarm.started = true;
+    qemu_thread_create(&loader_prewarm.thread, "nv2a.vk_prewarm",
+                       loader_prewarm_thread, NULL, QEMU_THREAD_JOINABLE);
+}
+
+static VkResult init_loader(void)
+{
+    if (loader_prewarm.started) {
+        qemu_thread_join(&loader_prewarm.thread);
+        loader_prewarm.started = false;
+        return loader_prewarm.result;
+    }
+    return volkInitialize();
 }
 
 static bool create_instance(PGRAPHState *pg, Error **errp)
@@ -154,7 +221,7 @@ static bool create_instance(PGRAPHState *pg, Error **errp)
     PGRAPHVkState *r = pg->vk_renderer_state;
     VkResult result;
 
-    result = volkInitialize();
+    result = init_loader();
     if (result != VK_SUCCESS) {
         error_setg(errp, "volkInitialize failed");
         return false;
@@ -259,6 +326,7 @@ QueueFamilyIndices pgraph_vk_find_queue_families(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices = {
         .queue_family = -1,
+        .transfer_family = -1,
     };
 
     uint32_t num_queue_families = 0;
@@ -273,11 +341,18 @@ QueueFamilyIndices pgraph_vk_find_queue_families(VkPhysicalDevice device)
         VkQueueFamilyProperties queueFamily = queue_families[i];
         // FIXME: Support independent graphics, compute queues
         int required_flags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
-        if ((queueFamily.queueFlags & required_flags) == required_flags) {
+        if ((queueFamily.queueFlags & required_flags) == required_flags &&
+            !is_queue_family_indicies_complete(indices)) {
             indices.queue_family = i;
         }
-        if (is_queue_family_indicies_complete(indices)) {
-            break;
+
+        // A copy engine, if it can copy whole mip levels of any size
+        VkExtent3D granularity = queueFamily.minImageTransferGranularity;
+        if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+            !(queueFamily.queueFlags & required_flags) &&
+            granularity.width == 1 && granularity.height == 1 &&
+            granularity.depth == 1 && indices.transfer_family < 0) {
+            indices.transfer_family = i;
         }
     }
 
@@ -328,6 +403,70 @@ static void add_optional_device_extension_names(
     r->memory_budget_extension_enabled = add_extension_if_available(
         available_extensions, enabled_extension_names,
         VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+    r->multi_draw_extension_enabled =
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_EXT_MULTI_DRAW_EXTENSION_NAME);
+
+    r->external_memory_host_extension_enabled =
+        g_config.display.vulkan.host_mapped_vertex_ram &&
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+
+    r->fragment_shader_barycentric_extension_enabled =
+        g_config.display.vulkan.geometry_shaders !=
+            CONFIG_DISPLAY_VULKAN_GEOMETRY_SHADERS_ON &&
+        add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_KHR_FRAGMENT_SHADER_BARYCENTRIC_EXTENSION_NAME);
+
+    r->vertex_input_dynamic_state_extension_enabled =
+        add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_EXT_VERTEX_INPUT_DYNAMIC_STATE_EXTENSION_NAME);
+
+    r->extended_dynamic_state_extension_enabled =
+        add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+
+    r->extended_dynamic_state3_extension_enabled =
+        add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_EXT_EXTENDED_DYNAMIC_STATE_3_EXTENSION_NAME);
+
+    r->graphics_pipeline_library_extension_enabled =
+        add_extension_if_available(available_extensions,
+                                   enabled_extension_names,
+                                   VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME) &&
+        add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME);
+
+    r->timeline_semaphore_extension_enabled =
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+
+    r->descriptor_indexing_extension_enabled =
+        g_config.display.vulkan.bindless_textures &&
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+    // Promoted in Vulkan 1.3, and depends on these two before that
+    r->dynamic_rendering_extension_enabled =
+        g_config.display.vulkan.dynamic_rendering &&
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME) &&
+        add_extension_if_available(
+            available_extensions, enabled_extension_names,
+            VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME) &&
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+
+    r->swapchain_extension_enabled =
+        g_config.display.vulkan.native_present &&
+        add_extension_if_available(available_extensions, enabled_extension_names,
+                                   VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 }
 
 static bool check_device_support_required_extensions(VkPhysicalDevice device)
@@ -433,6 +572,42 @@ static bool select_physical_device(PGRAPHState *pg, Error **errp)
     return true;
 }
 
+/*
+ * Decide whether per-primitive attributes are produced by a geometry shader or
+ * read per-vertex in the fragment shader. Tile-based GPUs tend to run geometry
+ * shaders poorly (or not at all), so prefer barycentrics on them when the
+ * device supports it. This is only a starting point, the device profile
+ * replaces it with a measured choice.
+ */
+static bool use_geometry_shader(PGRAPHVkState *r)
+{
+    if (!r->enabled_physical_device_features.geometryShader) {
+        return false;
+    }
+    if (!r->fragment_shader_barycentric_extension_enabled) {
+        return true;
+    }
+
+    switch (g_config.display.vulkan.geometry_shaders) {
+    case CONFIG_DISPLAY_VULKAN_GEOMETRY_SHADERS_ON:
+        return true;
+    case CONFIG_DISPLAY_VULKAN_GEOMETRY_SHADERS_OFF:
+        return false;
+    default:
+        break;
+    }
+
+    switch (r->device_props.vendorID) {
+    case 0x106B: // Apple
+    case 0x1010: // Imagination
+    case 0x13B5: // ARM
+    case 0x5143: // Qualcomm
+        return false;
+    default:
+        return true;
+    }
+}
+
 static bool create_logical_device(PGRAPHState *pg, Error **errp)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -462,15 +637,6 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
                 g_array_index(enabled_extension_names, char *, i));
     }
 
-    float queuePriority = 1.0f;
-
-    VkDeviceQueueCreateInfo queue_create_info = {
-        .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
-        .queueFamilyIndex = indices.queue_family,
-        .queueCount = 1,
-        .pQueuePriorities = &queuePriority,
-    };
-
     // Check device features
     VkPhysicalDeviceFeatures physical_device_features;
     vkGetPhysicalDeviceFeatures(r->physical_device, &physical_device_features);
@@ -491,11 +657,14 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
         }
         F(depthClamp, false),
         F(fillModeNonSolid, false),
-        F(geometryShader, true),
+        F(geometryShader, false),
         F(occlusionQueryPrecise, false),
         F(samplerAnisotropy, false),
         F(shaderClipDistance, false),
+        F(shaderSampledImageArrayDynamicIndexing, false),
         F(shaderTessellationAndGeometryPointSize, false),
+        F(textureCompressionASTC_LDR, false),
+        F(textureCompressionBC, false),
         F(wideLines, false),
         #undef F
         // clang-format on
@@ -562,10 +731,349 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
         next_struct = &custom_border_features;
     }
 
+    VkPhysicalDeviceMultiDrawFeaturesEXT multi_draw_features;
+    if (r->multi_draw_extension_enabled) {
+        VkPhysicalDeviceMultiDrawFeaturesEXT supported_features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_FEATURES_EXT,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+
+        VkPhysicalDeviceMultiDrawPropertiesEXT multi_draw_props = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceProperties2 props = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &multi_draw_props,
+        };
+        vkGetPhysicalDeviceProperties2(r->physical_device, &props);
+        r->max_multi_draw_count = multi_draw_props.maxMultiDrawCount;
+
+        r->multi_draw_extension_enabled = supported_features.multiDraw &&
+                                          r->max_multi_draw_count > 1;
+    }
+    if (r->multi_draw_extension_enabled) {
+        multi_draw_features = (VkPhysicalDeviceMultiDrawFeaturesEXT){
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTI_DRAW_FEATURES_EXT,
+            .multiDraw = VK_TRUE,
+            .pNext = next_struct,
+        };
+        next_struct = &multi_draw_features;
+    }
+
+    VkPhysicalDeviceFragmentShaderBarycentricFeaturesKHR barycentric_features;
+    if (r->fragment_shader_barycentric_extension_enabled) {
+        VkPhysicalDeviceFragmentShaderBarycentricFeaturesKHR supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADER_BARYCENTRIC_FEATURES_KHR,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+        r->fragment_shader_barycentric_extension_enabled =
+            supported_features.fragmentShaderBarycentric;
+    }
+    if (r->fragment_shader_barycentric_extension_enabled) {
+        barycentric_features =
+            (VkPhysicalDeviceFragmentShaderBarycentricFeaturesKHR){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FRAGMENT_SHADER_BARYCENTRIC_FEATURES_KHR,
+                .fragmentShaderBarycentric = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &barycentric_features;
+    }
+
+    VkPhysicalDeviceVertexInputDynamicStateFeaturesEXT
+        vertex_input_dynamic_state_features;
+    if (r->vertex_input_dynamic_state_extension_enabled) {
+        VkPhysicalDeviceVertexInputDynamicStateFeaturesEXT supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VERTEX_INPUT_DYNAMIC_STATE_FEATURES_EXT,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+        r->vertex_input_dynamic_state_extension_enabled =
+            supported_features.vertexInputDynamicState;
+    }
+    if (r->vertex_input_dynamic_state_extension_enabled) {
+        vertex_input_dynamic_state_features =
+            (VkPhysicalDeviceVertexInputDynamicStateFeaturesEXT){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VERTEX_INPUT_DYNAMIC_STATE_FEATURES_EXT,
+                .vertexInputDynamicState = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &vertex_input_dynamic_state_features;
+    }
+
+    VkPhysicalDeviceExtendedDynamicStateFeaturesEXT
+        extended_dynamic_state_features;
+    if (r->extended_dynamic_state_extension_enabled) {
+        VkPhysicalDeviceExtendedDynamicStateFeaturesEXT supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+        r->extended_dynamic_state_extension_enabled =
+            supported_features.extendedDynamicState;
+    }
+    if (r->extended_dynamic_state_extension_enabled) {
+        extended_dynamic_state_features =
+            (VkPhysicalDeviceExtendedDynamicStateFeaturesEXT){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT,
+                .extendedDynamicState = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &extended_dynamic_state_features;
+    }
+
+    VkPhysicalDeviceExtendedDynamicState3FeaturesEXT
+        extended_dynamic_state3_features;
+    if (r->extended_dynamic_state3_extension_enabled) {
+        VkPhysicalDeviceExtendedDynamicState3FeaturesEXT supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+        r->extended_dynamic_state3_extension_enabled =
+            supported_features.extendedDynamicState3ColorBlendEnable &&
+            supported_features.extendedDynamicState3ColorBlendEquation &&
+            supported_features.extendedDynamicState3ColorWriteMask;
+    }
+    if (r->extended_dynamic_state3_extension_enabled) {
+        extended_dynamic_state3_features =
+            (VkPhysicalDeviceExtendedDynamicState3FeaturesEXT){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_3_FEATURES_EXT,
+                .extendedDynamicState3ColorBlendEnable = VK_TRUE,
+                .extendedDynamicState3ColorBlendEquation = VK_TRUE,
+                .extendedDynamicState3ColorWriteMask = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &extended_dynamic_state3_features;
+    }
+
+    // Cached pipeline libraries are only reusable with the fixed-function
+    // state made dynamic, and linking must be fast for this to pay off
+    VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT
+        graphics_pipeline_library_features;
+    if (r->graphics_pipeline_library_extension_enabled) {
+        VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+
+        VkPhysicalDeviceGraphicsPipelineLibraryPropertiesEXT library_props = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceProperties2 props = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &library_props,
+        };
+        vkGetPhysicalDeviceProperties2(r->physical_device, &props);
+
+        r->graphics_pipeline_library_extension_enabled =
+            supported_features.graphicsPipelineLibrary &&
+            library_props.graphicsPipelineLibraryFastLinking &&
+            r->extended_dynamic_state_extension_enabled;
+    }
+    if (r->graphics_pipeline_library_extension_enabled) {
+        graphics_pipeline_library_features =
+            (VkPhysicalDeviceGraphicsPipelineLibraryFeaturesEXT){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GRAPHICS_PIPELINE_LIBRARY_FEATURES_EXT,
+                .graphicsPipelineLibrary = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &graphics_pipeline_library_features;
+    }
+
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_semaphore_features;
+    if (r->timeline_semaphore_extension_enabled) {
+        VkPhysicalDeviceTimelineSemaphoreFeaturesKHR supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+        r->timeline_semaphore_extension_enabled =
+            supported_features.timelineSemaphore;
+    }
+    if (r->timeline_semaphore_extension_enabled) {
+        timeline_semaphore_features =
+            (VkPhysicalDeviceTimelineSemaphoreFeaturesKHR){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR,
+                .timelineSemaphore = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &timeline_semaphore_features;
+    }
+    /*
+     * Bindless textures are written when they enter the texture cache, which
+     * may be while sets using other slots of the arrays are bound or pending.
+     */
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptor_indexing_features;
+    if (r->descriptor_indexing_extension_enabled) {
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+
+        VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexing_props = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT,
+        };
+        VkPhysicalDeviceProperties2 props = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &indexing_props,
+        };
+        vkGetPhysicalDeviceProperties2(r->physical_device, &props);
+
+        // One array per sampler type, plus the per-draw set
+        uint32_t num_samplers =
+            PSH_BINDLESS_SAMPLER__COUNT * MAX_BINDLESS_TEXTURES;
+        r->descriptor_indexing_extension_enabled =
+            r->enabled_physical_device_features
+                .shaderSampledImageArrayDynamicIndexing &&
+            supported_features.descriptorBindingPartiallyBound &&
+            supported_features.descriptorBindingSampledImageUpdateAfterBind &&
+            supported_features.descriptorBindingUpdateUnusedWhilePending &&
+            indexing_props.maxPerStageDescriptorUpdateAfterBindSamplers >=
+                num_samplers &&
+            indexing_props.maxPerStageDescriptorUpdateAfterBindSampledImages >=
+                num_samplers &&
+            indexing_props.maxPerStageUpdateAfterBindResources >=
+                num_samplers + 2 &&
+            indexing_props.maxDescriptorSetUpdateAfterBindSamplers >=
+                num_samplers &&
+            indexing_props.maxDescriptorSetUpdateAfterBindSampledImages >=
+                num_samplers;
+    }
+    if (r->descriptor_indexing_extension_enabled) {
+        descriptor_indexing_features =
+            (VkPhysicalDeviceDescriptorIndexingFeaturesEXT){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT,
+                .descriptorBindingPartiallyBound = VK_TRUE,
+                .descriptorBindingSampledImageUpdateAfterBind = VK_TRUE,
+                .descriptorBindingUpdateUnusedWhilePending = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &descriptor_indexing_features;
+    }
+    r->bindless.enabled = r->descriptor_indexing_extension_enabled;
+    if (g_config.display.vulkan.bindless_textures) {
+        fprintf(stderr, "Bindless textures: %s\n",
+                r->bindless.enabled ? "enabled" : "not supported");
+    }
+
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features;
+    if (r->dynamic_rendering_extension_enabled) {
+        VkPhysicalDeviceDynamicRenderingFeaturesKHR supported_features = {
+            .sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+        };
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &supported_features,
+        };
+        vkGetPhysicalDeviceFeatures2(r->physical_device, &features);
+        r->dynamic_rendering_extension_enabled =
+            supported_features.dynamicRendering;
+    }
+    if (r->dynamic_rendering_extension_enabled) {
+        dynamic_rendering_features =
+            (VkPhysicalDeviceDynamicRenderingFeaturesKHR){
+                .sType =
+                    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR,
+                .dynamicRendering = VK_TRUE,
+                .pNext = next_struct,
+            };
+        next_struct = &dynamic_rendering_features;
+    }
+    if (g_config.display.vulkan.dynamic_rendering) {
+        fprintf(stderr, "Dynamic rendering: %s\n",
+                r->dynamic_rendering_extension_enabled ? "enabled" :
+                                                         "not supported");
+    }
+
+    fprintf(stderr, "Frame completion tracked with: %s\n",
+            r->timeline_semaphore_extension_enabled ? "timeline semaphore" :
+                                                      "fences");
+
+    r->use_geometry_shader = use_geometry_shader(r);
+    if (!r->use_geometry_shader &&
+        !r->fragment_shader_barycentric_extension_enabled) {
+        error_setg(errp, "Device supports neither geometry shaders nor "
+                         "fragment shader barycentrics");
+        return false;
+    }
+    fprintf(stderr, "Primitive attributes from: %s\n",
+            r->use_geometry_shader ? "geometry shader" :
+                                     "fragment shader barycentrics");
+
+    // Transfers are waited on by the graphics queue with a timeline value
+    r->transfer_queue_enabled = g_config.display.vulkan.transfer_queue &&
+                                indices.transfer_family >= 0 &&
+                                r->timeline_semaphore_extension_enabled;
+    fprintf(stderr, "Transfer queue: %s\n",
+            r->transfer_queue_enabled ? "enabled" : "disabled");
+
+    float queuePriority = 1.0f;
+
+    VkDeviceQueueCreateInfo queue_create_infos[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = indices.queue_family,
+            .queueCount = 1,
+            .pQueuePriorities = &queuePriority,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+            .queueFamilyIndex = indices.transfer_family,
+            .queueCount = 1,
+            .pQueuePriorities = &queuePriority,
+        },
+    };
+
     VkDeviceCreateInfo device_create_info = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-        .queueCreateInfoCount = 1,
-        .pQueueCreateInfos = &queue_create_info,
+        .queueCreateInfoCount = r->transfer_queue_enabled ? 2 : 1,
+        .pQueueCreateInfos = queue_create_infos,
         .pEnabledFeatures = &r->enabled_physical_device_features,
         .enabledExtensionCount = enabled_extension_names->len,
         .ppEnabledExtensionNames = enabled_device_extension_names,
@@ -592,7 +1100,13 @@ static bool create_logical_device(PGRAPHState *pg, Error **errp)
                         "vk init stage: vkCreateDevice done");
 #endif
 
+    r->queue_family = indices.queue_family;
     vkGetDeviceQueue(r->device, indices.queue_family, 0, &r->queue);
+    if (r->transfer_queue_enabled) {
+        r->transfer_queue_family = indices.transfer_family;
+        vkGetDeviceQueue(r->device, indices.transfer_family, 0,
+                         &r->transfer_queue);
+    }
     return true;
 }
 
@@ -663,6 +1177,8 @@ static bool init_allocator(PGRAPHState *pg, Error **errp)
         .instance = r->instance,
         .physicalDevice = r->physical_device,
         .device = r->device,
+        // Smaller blocks leave less unused memory in each one
+        .preferredLargeHeapBlockSize = r->low_memory ? 32 * MiB : 0,
         .pVulkanFunctions = &vulkanFunctions,
     };
 
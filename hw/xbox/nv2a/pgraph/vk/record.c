@@ -0,0 +1,890 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "ui/xemu-settings.h"
+#include "renderer.h"
+
+/*
+ * Commands recorded inside a render pass go through the pgraph_vk_cmd_*
+ * functions below. Normally they are recorded into the frame's command buffer
+ * right away. With parallel recording, they are captured into a compact
+ * command stream per render pass instead, and worker threads record each
+ * stream into a secondary command buffer while PFIFO carries on.
+ *
+ * The frame's primary command buffer is split around each such pass: commands
+ * before the pass end one primary and those after it start the next. When the
+ * frame is finished, every pass gets a small primary which begins the render
+ * pass and executes the pass's secondary. The frame is submitted as the
+ * sequence of primaries, so GPU execution order is unchanged.
+ *
+ * Passes inside an occlusion query are recorded inline, so that queries never
+ * span command buffers.
+ */
+
+typedef enum RecordedCommandType {
+    CMD_BIND_PIPELINE,
+    CMD_SET_VIEWPORT,
+    CMD_SET_SCISSOR,
+    CMD_SET_LINE_WIDTH,
+    CMD_SET_BLEND_CONSTANTS,
+    CMD_SET_DYNAMIC_STATE,
+    CMD_SET_VERTEX_INPUT,
+    CMD_BIND_DESCRIPTOR_SETS,
+    CMD_BIND_VERTEX_BUFFERS,
+    CMD_BIND_INDEX_BUFFER,
+    CMD_PUSH_CONSTANTS,
+    CMD_DRAW,
+    CMD_DRAW_MULTI,
+    CMD_DRAW_INDEXED,
+    CMD_CLEAR_ATTACHMENTS,
+} RecordedCommandType;
+
+typedef struct RecordedCommand {
+    uint32_t type;
+    uint32_t size; // Bytes used, including this header
+} RecordedCommand;
+
+#define COMMAND_ALIGNMENT 8
+
+typedef struct CmdBindPipeline {
+    RecordedCommand hdr;
+    VkPipeline pipeline;
+} CmdBindPipeline;
+
+typedef struct CmdSetViewport {
+    RecordedCommand hdr;
+    VkViewport viewport;
+} CmdSetViewport;
+
+typedef struct CmdSetScissor {
+    RecordedCommand hdr;
+    VkRect2D scissor;
+} CmdSetScissor;
+
+typedef struct CmdSetLineWidth {
+    RecordedCommand hdr;
+    float width;
+} CmdSetLineWidth;
+
+typedef struct CmdSetBlendConstants {
+    RecordedCommand hdr;
+    float constants[4];
+} CmdSetBlendConstants;
+
+typedef struct CmdSetDynamicState {
+    RecordedCommand hdr;
+    bool has_old;
+    DynamicDrawState old;
+    DynamicDrawState state;
+} CmdSetDynamicState;
+
+typedef struct CmdSetVertexInput {
+    RecordedCommand hdr;
+    uint32_t num_bindings;
+    uint32_t num_attributes;
+    VkVertexInputBindingDescription2EXT bindings[NV2A_VERTEXSHADER_ATTRIBUTES];
+    VkVertexInputAttributeDescription2EXT
+        attributes[NV2A_VERTEXSHADER_ATTRIBUTES];
+} CmdSetVertexInput;
+
+typedef struct CmdBindDescriptorSets {
+    RecordedCommand hdr;
+    VkPipelineLayout layout;
+    uint32_t num_sets;
+    VkDescriptorSet sets[2];
+    uint32_t num_offsets;
+    uint32_t offsets[2];
+} CmdBindDescriptorSets;
+
+typedef struct CmdBindVertexBuffers {
+    RecordedCommand hdr;
+    uint32_t count;
+    VkBuffer buffers[NV2A_VERTEXSHADER_ATTRIBUTES];
+    VkDeviceSize offsets[NV2A_VERTEXSHADER_ATTRIBUTES];
+} CmdBindVertexBuffers;
+
+typedef struct CmdBindIndexBuffer {
+    RecordedCommand hdr;
+    VkBuffer buffer;
+    VkDeviceSize offset;
+    VkIndexType type;
+} CmdBindIndexBuffer;
+
+typedef struct CmdPushConstants {
+    RecordedCommand hdr;
+    VkPipelineLayout layout;
+    VkShaderStageFlags stages;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t data[NV2A_VERTEXSHADER_ATTRIBUTES * 4 * sizeof(float)];
+} CmdPushConstants;
+
+typedef struct CmdDraw {
+    RecordedCommand hdr;
+    uint32_t vertex_count;
+    uint32_t instance_count;
+    uint32_t first_vertex;
+    uint32_t first_instance;
+} CmdDraw;
+
+typedef struct CmdDrawMulti {
+    RecordedCommand hdr;
+    uint32_t count;
+    VkMultiDrawInfoEXT draws[MAX_BATCHED_DRAWS];
+} CmdDrawMulti;
+
+typedef struct CmdDrawIndexed {
+    RecordedCommand hdr;
+    uint32_t index_count;
+    uint32_t instance_count;
+    uint32_t first_index;
+    int32_t vertex_offset;
+    uint32_t first_instance;
+} CmdDrawIndexed;
+
+typedef struct CmdClearAttachments {
+    RecordedCommand hdr;
+    uint32_t num_attachments;
+    VkClearAttachment attachments[2];
+    VkClearRect rect;
+} CmdClearAttachments;
+
+struct RecordedPass {
+    QSIMPLEQ_ENTRY(RecordedPass) entry;
+    FrameInFlight *frame;
+
+    RenderPassBegin begin;
+
+    uint8_t *commands; // Stream of RecordedCommand
+    size_t size, capacity;
+
+    int submit_index; // Of the pass in the frame's submitted command buffers
+    VkCommandBuffer secondary;
+    bool done;
+};
+
+struct RecordWorker {
+    PGRAPHVkState *r;
+    int index; // Into FrameRecording.worker_pools
+    QemuThread thread;
+};
+
+static void set_dynamic_state(PGRAPHVkState *r, VkCommandBuffer cmd,
+                              const DynamicDrawState *old,
+                              const DynamicDrawState *state)
+{
+#define CHANGED(field) \
+    (!old || memcmp(&old->field, &state->field, sizeof(state->field)))
+
+    const VkStencilFaceFlags faces = VK_STENCIL_FACE_FRONT_AND_BACK;
+
+    if (CHANGED(blend_constants)) {
+        vkCmdSetBlendConstants(cmd, state->blend_constants);
+    }
+    if (CHANGED(stencil.compareMask)) {
+        vkCmdSetStencilCompareMask(cmd, faces, state->stencil.compareMask);
+    }
+    if (CHANGED(stencil.writeMask)) {
+        vkCmdSetStencilWriteMask(cmd, faces, state->stencil.writeMask);
+    }
+    if (CHANGED(stencil.reference)) {
+        vkCmdSetStencilReference(cmd, faces, state->stencil.reference);
+    }
+
+    if (r->extended_dynamic_state_extension_enabled) {
+        if (CHANGED(cull_mode)) {
+            vkCmdSetCullModeEXT(cmd, state->cull_mode);
+        }
+        if (CHANGED(front_face)) {
+            vkCmdSetFrontFaceEXT(cmd, state->front_face);
+        }
+        if (CHANGED(depth_test_enable)) {
+            vkCmdSetDepthTestEnableEXT(cmd, state->depth_test_enable);
+        }
+        if (CHANGED(depth_write_enable)) {
+            vkCmdSetDepthWriteEnableEXT(cmd, state->depth_write_enable);
+        }
+        if (CHANGED(depth_compare_op)) {
+            vkCmdSetDepthCompareOpEXT(cmd, state->depth_compare_op);
+        }
+        if (CHANGED(stencil_test_enable)) {
+            vkCmdSetStencilTestEnableEXT(cmd, state->stencil_test_enable);
+        }
+        if (CHANGED(stencil.failOp) || CHANGED(stencil.passOp) ||
+            CHANGED(stencil.depthFailOp) || CHANGED(stencil.compareOp)) {
+            vkCmdSetStencilOpEXT(cmd, faces, state->stencil.failOp,
+                                 state->stencil.passOp,
+                                 state->stencil.depthFailOp,
+                                 state->stencil.compareOp);
+        }
+    }
+
+    if (r->extended_dynamic_state3_extension_enabled) {
+        if (CHANGED(color_blend_enable)) {
+            vkCmdSetColorBlendEnableEXT(cmd, 0, 1, &state->color_blend_enable);
+        }
+        if (CHANGED(color_blend_equation)) {
+            vkCmdSetColorBlendEquationEXT(cmd, 0, 1,
+                                          &state->color_blend_equation);
+        }
+        if (CHANGED(color_write_mask)) {
+            vkCmdSetColorWriteMaskEXT(cmd, 0, 1, &state->color_write_mask);
+        }
+    }
+
+#undef CHANGED
+}
+
+static void execute_command(PGRAPHVkState *r, VkCommandBuffer cmd,
+                            const RecordedCommand *c)
+{
+    switch (c->type) {
+    case CMD_BIND_PIPELINE: {
+        const CmdBindPipeline *b = (const CmdBindPipeline *)c;
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, b->pipeline);
+        break;
+    }
+    case CMD_SET_VIEWPORT: {
+        const CmdSetViewport *s = (const CmdSetViewport *)c;
+        vkCmdSetViewport(cmd, 0, 1, &s->viewport);
+        break;
+    }
+    case CMD_SET_SCISSOR: {
+        const CmdSetScissor *s = (const CmdSetScissor *)c;
+        vkCmdSetScissor(cmd, 0, 1, &s->scissor);
+        break;
+    }
+    case CMD_SET_LINE_WIDTH: {
+        const CmdSetLineWidth *s = (const CmdSetLineWidth *)c;
+        vkCmdSetLineWidth(cmd, s->width);
+        break;
+    }
+    case CMD_SET_BLEND_CONSTANTS: {
+        const CmdSetBlendConstants *s = (const CmdSetBlendConstants *)c;
+        vkCmdSetBlendConstants(cmd, s->constants);
+        break;
+    }
+    case CMD_SET_DYNAMIC_STATE: {
+        const CmdSetDynamicState *s = (const CmdSetDynamicState *)c;
+        set_dynamic_state(r, cmd, s->has_old ? &s->old : NULL, &s->state);
+        break;
+    }
+    case CMD_SET_VERTEX_INPUT: {
+        const CmdSetVertexInput *s = (const CmdSetVertexInput *)c;
+        vkCmdSetVertexInputEXT(cmd, s->num_bindings, s->bindings,
+                               s->num_attributes, s->attributes);
+        break;
+    }
+    case CMD_BIND_DESCRIPTOR_SETS: {
+        const CmdBindDescriptorSets *b = (const CmdBindDescriptorSets *)c;
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                                b->layout, 0, b->num_sets, b->sets,
+                                b->num_offsets, b->offsets);
+        break;
+    }
+    case CMD_BIND_VERTEX_BUFFERS: {
+        const CmdBindVertexBuffers *b = (const CmdBindVertexBuffers *)c;
+        vkCmdBindVertexBuffers(cmd, 0, b->count, b->buffers, b->offsets);
+        break;
+    }
+    case CMD_BIND_INDEX_BUFFER: {
+        const CmdBindIndexBuffer *b = (const CmdBindIndexBuffer *)c;
+        vkCmdBindIndexBuffer(cmd, b->buffer, b->offset, b->type);
+        break;
+    }
+    case CMD_PUSH_CONSTANTS: {
+        const CmdPushConstants *p = (const CmdPushConstants *)c;
+        vkCmdPushConstants(cmd, p->layout, p->stages, p->offset, p->size,
+                           p->data);
+        break;
+    }
+    case CMD_DRAW: {
+        const CmdDraw *d = (const CmdDraw *)c;
+        vkCmdDraw(cmd, d->vertex_count, d->instance_count, d->first_vertex,
+                  d->first_instance);
+        break;
+    }
+    case CMD_DRAW_MULTI: {
+        const CmdDrawMulti *d = (const CmdDrawMulti *)c;
+        vkCmdDrawMultiEXT(cmd, d->count, d->draws, 1, 0,
+                          sizeof(VkMultiDrawInfoEXT));
+        break;
+    }
+    case CMD_DRAW_INDEXED: {
+        const CmdDrawIndexed *d = (const CmdDrawIndexed *)c;
+        vkCmdDrawIndexed(cmd, d->index_count, d->instance_count,
+                         d->first_index, d->vertex_offset, d->first_instance);
+        break;
+    }
+    case CMD_CLEAR_ATTACHMENTS: {
+        const CmdClearAttachments *s = (const CmdClearAttachments *)c;
+        vkCmdClearAttachments(cmd, s->num_attachments, s->attachments, 1,
+                              &s->rect);
+        break;
+    }
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * Record the command now, or append it to the stream of the render pass being
+ * captured. Only the used part of the command is copied.
+ */
+static void submit_command(PGRAPHVkState *r, RecordedCommand *c,
+                           RecordedCommandType type, size_t size)
+{
+    c->type = type;
+    c->size = size;
+
+    RecordedPass *pass = r->recording;
+    if (!pass) {
+        execute_command(r, r->command_buffer, c);
+        return;
+    }
+
+    size_t aligned_size = ROUND_UP(size, COMMAND_ALIGNMENT);
+    if (pass->size + aligned_size > pass->capacity) {
+        pass->capacity = MAX(pass->capacity * 2, pass->size + aligned_size);
+        pass->commands = g_realloc(pass->commands, pass->capacity);
+    }
+    memcpy(pass->commands + pass->size, c, size);
+    pass->size += aligned_size;
+}
+
+#define SUBMIT(r, c, type) submit_command((r), &(c).hdr, (type), sizeof(c))
+
+void pgraph_vk_cmd_bind_pipeline(PGRAPHVkState *r, VkPipeline pipeline)
+{
+    CmdBindPipeline c = { .pipeline = pipeline };
+    SUBMIT(r, c, CMD_BIND_PIPELINE);
+}
+
+void pgraph_vk_cmd_set_viewport(PGRAPHVkState *r, const VkViewport *viewport)
+{
+    CmdSetViewport c = { .viewport = *viewport };
+    SUBMIT(r, c, CMD_SET_VIEWPORT);
+}
+
+void pgraph_vk_cmd_set_scissor(PGRAPHVkState *r, const VkRect2D *scissor)
+{
+    CmdSetScissor c = { .scissor = *scissor };
+    SUBMIT(r, c, CMD_SET_SCISSOR);
+}
+
+void pgraph_vk_cmd_set_line_width(PGRAPHVkState *r, float width)
+{
+    CmdSetLineWidth c = { .width = width };
+    SUBMIT(r, c, CMD_SET_LINE_WIDTH);
+}
+
+void pgraph_vk_cmd_set_blend_constants(PGRAPHVkState *r,
+                                       const float constants[4])
+{
+    CmdSetBlendConstants c;
+    memcpy(c.constants, constants, sizeof(c.constants));
+    SUBMIT(r, c, CMD_SET_BLEND_CONSTANTS);
+}
+
+/* Set the dynamic state which differs from old, or all of it if old is NULL */
+void pgraph_vk_cmd_set_dynamic_state(PGRAPHVkState *r,
+                                     const DynamicDrawState *old,
+                                     const DynamicDrawState *state)
+{
+    if (!r->recording) {
+        set_dynamic_state(r, r->command_buffer, old, state);
+        return;
+    }
+
+    CmdSetDynamicState c = { .has_old = old != NULL, .state = *state };
+    if (old) {
+        c.old = *old;
+    }
+    SUBMIT(r, c, CMD_SET_DYNAMIC_STATE);
+}
+
+void pgraph_vk_cmd_set_vertex_input(
+    PGRAPHVkState *r, uint32_t num_bindings,
+    const VkVertexInputBindingDescription2EXT *bindings,
+    uint32_t num_attributes,
+    const VkVertexInputAttributeDescription2EXT *attributes)
+{
+    CmdSetVertexInput c = {
+        .num_bindings = num_bindings,
+        .num_attributes = num_attributes,
+    };
+    assert(num_bindings <= ARRAY_SIZE(c.bindings));
+    assert(num_attributes <= ARRAY_SIZE(c.attributes));
+    memcpy(c.bindings, bindings, num_bindings * sizeof(*bindings));
+    memcpy(c.attributes, attributes, num_attributes * sizeof(*attributes));
+    SUBMIT(r, c, CMD_SET_VERTEX_INPUT);
+}
+
+void pgraph_vk_cmd_bind_descriptor_sets(PGRAPHVkState *r,
+                                        VkPipelineLayout layout,
+                                        uint32_t num_sets,
+                                        const VkDescriptorSet *sets,
+                                        uint32_t num_offsets,
+                                        const uint32_t *offsets)
+{
+    CmdBindDescriptorSets c = {
+        .layout = layout,
+        .num_sets = num_sets,
+        .num_offsets = num_offsets,
+    };
+    assert(num_sets <= ARRAY_SIZE(c.sets));
+    assert(num_offsets <= ARRAY_SIZE(c.offsets));
+    memcpy(c.sets, sets, num_sets * sizeof(*sets));
+    memcpy(c.offsets, offsets, num_offsets * sizeof(*offsets));
+    SUBMIT(r, c, CMD_BIND_DESCRIPTOR_SETS);
+}
+
+void pgraph_vk_cmd_bind_vertex_buffers(PGRAPHVkState *r, uint32_t count,
+                                       const VkBuffer *buffers,
+                                       const VkDeviceSize *offsets)
+{
+    CmdBindVertexBuffers c = { .count = count };
+    assert(count <= ARRAY_SIZE(c.buffers));
+    memcpy(c.buffers, buffers, count * sizeof(*buffers));
+    memcpy(c.offsets, offsets, count * sizeof(*offsets));
+    SUBMIT(r, c, CMD_BIND_VERTEX_BUFFERS);
+}
+
+void pgraph_vk_cmd_bind_index_buffer(PGRAPHVkState *r, VkBuffer buffer,
+                                     VkDeviceSize offset, VkIndexType type)
+{
+    CmdBindIndexBuffer c = { .buffer = buffer, .offset = offset, .type = type };
+    SUBMIT(r, c, CMD_BIND_INDEX_BUFFER);
+}
+
+void pgraph_vk_cmd_push_constants(PGRAPHVkState *r, VkPipelineLayout layout,
+                                  VkShaderStageFlags stages, uint32_t offset,
+                                  uint32_t size, const void *data)
+{
+    CmdPushConstants c = {
+        .layout = layout,
+        .stages = stages,
+        .offset = offset,
+        .size = size,
+    };
+    assert(size <= sizeof(c.data));
+    memcpy(c.data, data, size);
+    submit_command(r, &c.hdr, CMD_PUSH_CONSTANTS,
+                   offsetof(CmdPushConstants, data) + size);
+}
+
+void pgraph_vk_cmd_draw(PGRAPHVkState *r, uint32_t vertex_count,
+                        uint32_t instance_count, uint32_t first_vertex,
+                        uint32_t first_instance)
+{
+    CmdDraw c = {
+        .vertex_count = vertex_count,
+        .instance_count = instance_count,
+        .first_vertex = first_vertex,
+        .first_instance = first_instance,
+    };
+    SUBMIT(r, c, CMD_DRAW);
+}
+
+void pgraph_vk_cmd_draw_multi(PGRAPHVkState *r, uint32_t count,
+                              const VkMultiDrawInfoEXT *draws)
+{
+    CmdDrawMulti c = { .count = count };
+    assert(count <= ARRAY_SIZE(c.draws));
+    memcpy(c.draws, draws, count * sizeof(*draws));
+    submit_command(r, &c.hdr, CMD_DRAW_MULTI,
+                   offsetof(CmdDrawMulti, draws) + count * sizeof(*draws));
+}
+
+void pgraph_vk_cmd_draw_indexed(PGRAPHVkState *r, uint32_t index_count,
+                                uint32_t instance_count, uint32_t first_index,
+                                int32_t vertex_offset, uint32_t first_instance)
+{
+    CmdDrawIndexed c = {
+        .index_count = index_count,
+        .instance_count = instance_count,
+        .first_index = first_index,
+        .vertex_offset = vertex_offset,
+        .first_instance = first_instance,
+    };
+    SUBMIT(r, c, CMD_DRAW_INDEXED);
+}
+
+void pgraph_vk_cmd_clear_attachments(PGRAPHVkState *r,
+                                     uint32_t num_attachments,
+                                     const VkClearAttachment *attachments,
+                                     const VkClearRect *rect)
+{
+    CmdClearAttachments c = {
+        .num_attachments = num_attachments,
+        .rect = *rect,
+    };
+    assert(num_attachments <= ARRAY_SIZE(c.attachments));
+    memcpy(c.attachments, attachments, num_attachments * sizeof(*attachments));
+    SUBMIT(r, c, CMD_CLEAR_ATTACHMENTS);
+}
+
+#undef SUBMIT
+
+static VkCommandBuffer get_command_buffer(PGRAPHVkState *r, VkCommandPool pool,
+                                          VkCommandBufferLevel level,
+                                          GArray *buffers, int *num_used)
+{
+    if (*num_used == buffers->len) {
+        VkCommandBufferAllocateInfo alloc_info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = pool,
+            .level = level,
+            .commandBufferCount = 1,
+        };
+        VkCommandBuffer cmd;
+        VK_CHECK(vkAllocateCommandBuffers(r->device, &alloc_info, &cmd));
+        g_array_append_val(buffers, cmd);
+    }
+
+    return g_array_index(buffers, VkCommandBuffer, (*num_used)++);
+}
+
+static VkCommandBuffer begin_primary(PGRAPHVkState *r)
+{
+    FrameRecording *rec = &r->frame->recording;
+    VkCommandBuffer cmd =
+        get_command_buffer(r, r->command_pool, VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+                           rec->primaries, &rec->num_primaries);
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+
+    return cmd;
+}
+
+static void record_pass(PGRAPHVkState *r, int worker, RecordedPass *pass)
+{
+    RecordWorkerPool *wp = &pass->frame->recording.worker_pools[worker];
+    VkCommandBuffer cmd = get_command_buffer(
+        r, wp->pool, VK_COMMAND_BUFFER_LEVEL_SECONDARY, wp->buffers,
+        &wp->num_used);
+
+    // With dynamic rendering, only the attachment formats are inherited
+    const RenderPassState *state = &pass->begin.state;
+    bool color = state->color_format != VK_FORMAT_UNDEFINED;
+    VkCommandBufferInheritanceRenderingInfoKHR rendering_info = {
+        .sType =
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR,
+        .colorAttachmentCount = color ? 1 : 0,
+        .pColorAttachmentFormats = color ? &state->color_format : NULL,
+        .depthAttachmentFormat = state->zeta_format,
+        .stencilAttachmentFormat =
+            pgraph_vk_format_has_stencil_component(state->zeta_format) ?
+                state->zeta_format :
+                VK_FORMAT_UNDEFINED,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = r->dynamic_rendering_extension_enabled ? &rendering_info :
+                                                          NULL,
+        .renderPass = pass->begin.render_pass,
+        .subpass = 0,
+        .framebuffer = pass->begin.target.framebuffer,
+    };
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                 VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+    VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+
+    for (size_t offset = 0; offset < pass->size;) {
+        const RecordedCommand *c =
+            (const RecordedCommand *)(pass->commands + offset);
+        execute_command(r, cmd, c);
+        offset += ROUND_UP(c->size, COMMAND_ALIGNMENT);
+    }
+
+    VK_CHECK(vkEndCommandBuffer(cmd));
+    pass->secondary = cmd;
+}
+
+static void *record_worker_thread(void *opaque)
+{
+    RecordWorker *w = opaque;
+    PGRAPHVkState *r = w->r;
+
+    xemu_trace_set_thread_name("nv2a.vk_record_worker");
+    xemu_thread_topology_register(XEMU_THREAD_THROUGHPUT,
+                                  "nv2a.vk_record_worker");
+    qemu_mutex_lock(&r->record_lock);
+    while (true) {
+        RecordedPass *pass;
+        while (!(pass = QSIMPLEQ_FIRST(&r->record_queue)) &&
+               !r->record_workers_shutdown) {
+            qemu_cond_wait(&r->record_cond, &r->record_lock);
+        }
+        if (!pass) {
+            break;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&r->record_queue, entry);
+        qemu_mutex_unlock(&r->record_lock);
+
+        record_pass(r, w->index, pass);
+
+        qemu_mutex_lock(&r->record_lock);
+        qatomic_store_release(&pass->done, true);
+        qemu_cond_broadcast(&r->record_done_cond);
+    }
+    qemu_mutex_unlock(&r->record_lock);
+
+    return NULL;
+}
+
+/*
+ * Begin capturing the commands of a render pass for a worker to record. Returns
+ * false if the pass has to be recorded inline.
+ */
+bool pgraph_vk_begin_recorded_pass(PGRAPHVkState *r,
+                                   const RenderPassBegin *begin)
+{
+    assert(!r->recording);
+
+    if (!r->parallel_recording || r->query_in_flight) {
+        return false;
+    }
+
+    FrameRecording *rec = &r->frame->recording;
+    if (rec->num_passes == rec->passes->len) {
+        g_ptr_array_add(rec->passes, g_new0(RecordedPass, 1));
+    }
+    RecordedPass *pass = g_ptr_array_index(rec->passes, rec->num_passes++);
+
+    pass->frame = r->frame;
+    pass->begin = *begin;
+    pass->size = 0;
+    pass->secondary = VK_NULL_HANDLE;
+    pass->done = false;
+
+    // Commands before the pass end up in their own primary, the pass itself
+    // is filled in once its secondary is recorded
+    VK_CHECK(vkEndCommandBuffer(r->command_buffer));
+    g_array_append_val(rec->submit_cmds, r->command_buffer);
+    pass->submit_index = rec->submit_cmds->len;
+    VkCommandBuffer pending = VK_NULL_HANDLE;
+    g_array_append_val(rec->submit_cmds, pending);
+
+    r->command_buffer = begin_primary(r);
+    r->recording = pass;
+    nv2a_profile_inc_counter(NV2A_PROF_RENDERPASS_RECORDED_PARALLEL);
+
+    return true;
+}
+
+/* Hand the captured render pass over to the workers */
+void pgraph_vk_end_recorded_pass(PGRAPHVkState *r)
+{
+    RecordedPass *pass = r->recording;
+    assert(pass);
+    r->recording = NULL;
+
+    qemu_mutex_lock(&r->record_lock);
+    QSIMPLEQ_INSERT_TAIL(&r->record_queue, pass, entry);
+    qemu_cond_signal(&r->record_cond);
+    qemu_mutex_unlock(&r->record_lock);
+}
+
+/*
+ * Called once the last primary of the frame has ended. Waits for the workers
+ * and completes the list of command buffers to submit.
+ */
+void pgraph_vk_finish_recorded_passes(PGRAPHVkState *r)
+{
+    FrameRecording *rec = &r->frame->recording;
+
+    assert(!r->recording);
+    if (!rec->num_passes) {
+        return;
+    }
+
+    g_array_append_val(rec->submit_cmds, r->command_buffer);
+
+    for (int i = 0; i < rec->num_passes; i++) {
+        RecordedPass *pass = g_ptr_array_index(rec->passes, i);
+
+        if (!qatomic_load_acquire(&pass->done)) {
+            nv2a_profile_inc_counter(NV2A_PROF_RENDERPASS_RECORD_WAIT);
+            qemu_mutex_lock(&r->record_lock);
+            while (!pass->done) {
+                qemu_cond_wait(&r->record_done_cond, &r->record_lock);
+            }
+            qemu_mutex_unlock(&r->record_lock);
+        }
+
+        VkCommandBuffer cmd = begin_primary(r);
+        pgraph_vk_cmd_begin_render_pass(r, cmd, &pass->begin, true);
+        vkCmdExecuteCommands(cmd, 1, &pass->secondary);
+        pgraph_vk_cmd_end_render_pass(r, cmd);
+        VK_CHECK(vkEndCommandBuffer(cmd));
+
+        g_array_index(rec->submit_cmds, VkCommandBuffer, pass->submit_index) =
+            cmd;
+    }
+}
+
+/*
+ * Called before recording of a frame begins. Its previous submission has been
+ * retired, so the command buffers of the slot can all be reused.
+ */
+void pgraph_vk_begin_frame_recording(PGRAPHVkState *r)
+{
+    FrameInFlight *frame = r->frame;
+    FrameRecording *rec = &frame->recording;
+
+    assert(!frame->in_flight);
+    r->command_buffer = frame->command_buffer;
+
+    if (!r->parallel_recording) {
+        return;
+    }
+
+    if (rec->num_passes) {
+        for (int i = 0; i < r->num_record_workers; i++) {
+            RecordWorkerPool *wp = &rec->worker_pools[i];
+            if (wp->num_used) {
+                VK_CHECK(vkResetCommandPool(r->device, wp->pool, 0));
+                wp->num_used = 0;
+            }
+        }
+    }
+    rec->num_passes = 0;
+    rec->num_primaries = 0;
+    g_array_set_size(rec->submit_cmds, 0);
+}
+
+void pgraph_vk_init_recording(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    // Debug labels are only recorded inline
+    r->parallel_recording = g_config.display.vulkan.parallel_recording &&
+                            !r->debug_utils_extension_enabled;
+    r->recording = NULL;
+    if (!r->parallel_recording) {
+        return;
+    }
+
+    r->num_record_workers =
+        MAX(1, MIN(MAX_RECORD_WORKERS, (int)g_get_num_processors() / 2));
+
+    QueueFamilyIndices indices =
+        pgraph_vk_find_queue_families(r->physical_device);
+    VkCommandPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = indices.queue_family,
+    };
+
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameRecording *rec = &r->frames[i].recording;
+        for (int j = 0; j < r->num_record_workers; j++) {
+            RecordWorkerPool *wp = &rec->worker_pools[j];
+            VK_CHECK(
+                vkCreateCommandPool(r->device, &pool_info, NULL, &wp->pool));
+            wp->buffers = g_array_new(false, false, sizeof(VkCommandBuffer));
+            wp->num_used = 0;
+        }
+        rec->primaries = g_array_new(false, false, sizeof(VkCommandBuffer));
+        rec->num_primaries = 0;
+        rec->submit_cmds = g_array_new(false, false, sizeof(VkCommandBuffer));
+        rec->passes = g_ptr_array_new();
+        rec->num_passes = 0;
+    }
+
+    qemu_mutex_init(&r->record_lock);
+    qemu_cond_init(&r->record_cond);
+    qemu_cond_init(&r->record_done_cond);
+    QSIMPLEQ_INIT(&r->record_queue);
+    r->record_workers_shutdown = false;
+
+    r->record_workers = g_new0(RecordWorker, r->num_record_workers);
+    for (int i = 0; i < r->num_record_workers; i++) {
+        RecordWorker *w = &r->record_workers[i];
+        w->r = r;
+        w->index = i;
+        qemu_thread_create(&w->thread, "nv2a.vk_record_worker",
+                           record_worker_thread, w, QEMU_THREAD_JOINABLE);
+    }
+}
+
+void pgraph_vk_finalize_recording(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->parallel_recording) {
+        return;
+    }
+
+    // Frames have all been retired, so no pass is left in the queue
+    qemu_mutex_lock(&r->record_lock);
+    r->record_workers_shutdown = true;
+    qemu_cond_broadcast(&r->record_cond);
+    qemu_mutex_unlock(&r->record_lock);
+
+    for (int i = 0; i < r->num_record_workers; i++) {
+        qemu_thread_join(&r->record_workers[i].thread);
+    }
+    g_free(r->record_workers);
+    r->record_workers = NULL;
+
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameRecording *rec = &r->frames[i].recording;
+        for (int j = 0; j < r->num_record_workers; j++) {
+            RecordWorkerPool *wp = &rec->worker_pools[j];
+            vkDestroyCommandPool(r->device, wp->pool, NULL);
+            wp->pool = VK_NULL_HANDLE;
+            g_array_unref(wp->buffers);
+            wp->buffers = NULL;
+        }
+        if (rec->primaries->len) {
+            vkFreeCommandBuffers(r->device, r->command_pool,
+                                 rec->primaries->len,
+                                 (VkCommandBuffer *)rec->primaries->data);
+        }
+        g_array_unref(rec->primaries);
+        rec->primaries = NULL;
+        g_array_unref(rec->submit_cmds);
+        rec->submit_cmds = NULL;
+        for (int j = 0; j < rec->passes->len; j++) {
+            RecordedPass *pass = g_ptr_array_index(rec->passes, j);
+            g_free(pass->commands);
+            g_free(pass);
+        }
+        g_ptr_array_unref(rec->passes);
+        rec->passes = NULL;
+    }
+
+    qemu_cond_destroy(&r->record_done_cond);
+    qemu_cond_destroy(&r->record_cond);
+    qemu_mutex_destroy(&r->record_lock);
+    r->num_record_workers = 0;
+    r->parallel_recording = false;
+}
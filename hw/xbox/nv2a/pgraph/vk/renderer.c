@@ -18,6 +18,8 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "qemu/units.h"
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 
 #include "gloffscreen.h"
@@ -45,11 +47,22 @@ static void early_context_init(void)
 #endif
 }
 
+static void pgraph_vk_prewarm(void)
+{
+    pgraph_vk_prewarm_loader();
+    pgraph_vk_prewarm_glsl_compiler();
+}
+
 static void pgraph_vk_init(NV2AState *d, Error **errp)
 {
     PGRAPHState *pg = &d->pgraph;
 
     pg->vk_renderer_state = (PGRAPHVkState *)g_malloc0(sizeof(PGRAPHVkState));
+    pg->vk_renderer_state->low_memory = xemu_settings_low_memory_mode();
+    qemu_spin_init(&pg->vk_renderer_state->memory_stats_lock);
+    if (pg->vk_renderer_state->low_memory) {
+        fprintf(stderr, "nv2a: Using the low memory profile\n");
+    }
 
 #if HAVE_EXTERNAL_MEMORY
     bool use_external_memory = false;
@@ -111,12 +124,18 @@ static void pgraph_vk_init(NV2AState *d, Error **errp)
     __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                         "vk init stage: surfaces");
 #endif
+    pgraph_vk_init_vertex_formats(pg);
     pgraph_vk_init_surfaces(pg);
 #ifdef __ANDROID__
     __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                         "vk init stage: shaders");
 #endif
     pgraph_vk_init_shaders(pg);
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "vk init stage: device_profile");
+#endif
+    pgraph_vk_init_device_profile(pg);
 #ifdef __ANDROID__
     __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                         "vk init stage: pipelines");
@@ -132,6 +151,7 @@ static void pgraph_vk_init(NV2AState *d, Error **errp)
                         "vk init stage: reports");
 #endif
     pgraph_vk_init_reports(pg);
+    pgraph_vk_init_gpu_timer(pg);
 #ifdef __ANDROID__
     __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                         "vk init stage: compute");
@@ -142,6 +162,8 @@ static void pgraph_vk_init(NV2AState *d, Error **errp)
                         "vk init stage: display");
 #endif
     pgraph_vk_init_display(pg);
+    pgraph_vk_init_swapchain(pg);
+    pgraph_vk_init_shader_trace(pg);
 
     pgraph_vk_update_vertex_ram_buffer(&d->pgraph, 0, d->vram_ptr,
                                    memory_region_size(d->vram));
@@ -157,8 +179,12 @@ static void pgraph_vk_finalize(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
 
+    pgraph_vk_wait_for_frames_in_flight(pg->vk_renderer_state);
+    pgraph_vk_finalize_shader_trace(pg);
+    pgraph_vk_finalize_swapchain(pg);
     pgraph_vk_finalize_display(pg);
     pgraph_vk_finalize_compute(pg);
+    pgraph_vk_finalize_gpu_timer(pg);
     pgraph_vk_finalize_reports(pg);
     pgraph_vk_finalize_textures(pg);
     pgraph_vk_finalize_pipelines(pg);
@@ -183,17 +209,23 @@ static void pgraph_vk_flush(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
 
+    bool discard = qatomic_read(&pg->flush_discard);
+
     pgraph_vk_finish(pg, VK_FINISH_REASON_FLUSH);
-    pgraph_vk_surface_flush(d);
+    pgraph_vk_surface_flush(d, discard);
     pgraph_vk_mark_textures_possibly_dirty(d, 0, memory_region_size(d->vram));
-    pgraph_vk_update_vertex_ram_buffer(&d->pgraph, 0, d->vram_ptr,
-                                       memory_region_size(d->vram));
+    if (!discard) {
+        /* Otherwise RAM is dirty, draws upload the ranges they use */
+        pgraph_vk_update_vertex_ram_buffer(&d->pgraph, 0, d->vram_ptr,
+                                           memory_region_size(d->vram));
+    }
     for (int i = 0; i < 4; i++) {
         pg->texture_dirty[i] = true;
     }
 
     /* FIXME: Flush more? */
 
+    qatomic_set(&d->pgraph.flush_discard, false);
     qatomic_set(&d->pgraph.flush_pending, false);
     qemu_event_set(&d->pgraph.flush_complete);
 }
@@ -213,6 +245,116 @@ static void pgraph_vk_sync(NV2AState *d)
     qemu_event_set(&d->pgraph.sync_complete);
 }
 
+typedef struct MemoryStatsState {
+    PGRAPHVkState *r;
+    NV2AMemoryStats *stats;
+} MemoryStatsState;
+
+static VkDeviceSize get_allocation_size(PGRAPHVkState *r,
+                                        VmaAllocation allocation)
+{
+    if (allocation == VK_NULL_HANDLE) {
+        return 0;
+    }
+
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(r->allocator, allocation, &info);
+    return info.size;
+}
+
+static void count_texture_memory(Lru *lru, LruNode *node, void *opaque)
+{
+    MemoryStatsState *state = opaque;
+    TextureBinding *snode = container_of(node, TextureBinding, node);
+
+    state->stats->textures += 1;
+    state->stats->texture_bytes +=
+        get_allocation_size(state->r, snode->allocation);
+}
+
+static void update_memory_stats(PGRAPHVkState *r)
+{
+    NV2AMemoryStats stats = {
+        .pipelines = r->pipeline_cache.num_used,
+        .shader_modules = r->shader_module_cache.num_used,
+    };
+    MemoryStatsState state = { .r = r, .stats = &stats };
+
+    lru_visit_active(&r->texture_cache, count_texture_memory, &state);
+
+    SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        stats.surfaces += 1;
+        stats.surface_bytes += get_allocation_size(r, surface->allocation);
+    }
+    QTAILQ_FOREACH(surface, &r->invalid_surfaces, entry) {
+        stats.surfaces += 1;
+        stats.surface_bytes += get_allocation_size(r, surface->allocation);
+    }
+
+    VkPhysicalDeviceMemoryProperties const *props;
+    vmaGetMemoryProperties(r->allocator, &props);
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(r->allocator, budgets);
+    for (int i = 0; i < props->memoryHeapCount; i++) {
+        stats.device_bytes += budgets[i].statistics.blockBytes;
+    }
+
+    qemu_spin_lock(&r->memory_stats_lock);
+    r->memory_stats = stats;
+    qemu_spin_unlock(&r->memory_stats_lock);
+}
+
+/*
+ * Give back what can be recreated later: half of the texture and surface
+ * memory and a quarter of the pipelines on a trim request, everything not
+ * in use when asked to release all.
+ */
+static void pgraph_vk_process_pending_cache_release(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    bool all = qatomic_xchg(&r->cache_release_pending, 0) > 1;
+
+    pgraph_vk_finish(pg, VK_FINISH_REASON_FLUSH);
+
+    VkPhysicalDeviceMemoryProperties const *props;
+    vmaGetMemoryProperties(r->allocator, &props);
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(r->allocator, budgets);
+
+    VkDeviceSize heap_excess[VK_MAX_MEMORY_HEAPS] = { 0 };
+    for (int i = 0; i < props->memoryHeapCount; i++) {
+        VkDeviceSize used = budgets[i].statistics.allocationBytes;
+        heap_excess[i] = all ? used : used / 2;
+    }
+
+    if (!pgraph_vk_trim_texture_cache(pg, heap_excess)) {
+        pgraph_vk_trim_surfaces(d, heap_excess);
+    }
+    pgraph_vk_trim_pipeline_cache(pg, all);
+
+    update_memory_stats(r);
+    fprintf(stderr,
+            "nv2a: Released caches (%s), %" PRIu64 " MiB of device memory "
+            "in use\n",
+            all ? "all" : "trim", r->memory_stats.device_bytes / MiB);
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "nv2a: released caches (%s): device %" PRIu64
+                        " MiB, textures %u/%" PRIu64 " MiB, surfaces %u/%"
+                        PRIu64 " MiB, pipelines %u, shader modules %u",
+                        all ? "all" : "trim",
+                        r->memory_stats.device_bytes / MiB,
+                        r->memory_stats.textures,
+                        r->memory_stats.texture_bytes / MiB,
+                        r->memory_stats.surfaces,
+                        r->memory_stats.surface_bytes / MiB,
+                        r->memory_stats.pipelines,
+                        r->memory_stats.shader_modules);
+#endif
+}
+
 static void pgraph_vk_process_pending(NV2AState *d)
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
@@ -220,7 +362,11 @@ static void pgraph_vk_process_pending(NV2AState *d)
     if (qatomic_read(&r->downloads_pending) ||
         qatomic_read(&r->download_dirty_surfaces_pending) ||
         qatomic_read(&d->pgraph.sync_pending) ||
-        qatomic_read(&d->pgraph.flush_pending)
+        qatomic_read(&d->pgraph.flush_pending) ||
+        qatomic_read(&r->surface_rescale_pending) ||
+        qatomic_read(&r->swapchain.present_pending) ||
+        qatomic_read(&r->shader_cache_writeback_pending) ||
+        qatomic_read(&r->cache_release_pending)
     ) {
         qemu_mutex_unlock(&d->pfifo.lock);
         qemu_mutex_lock(&d->pgraph.lock);
@@ -236,6 +382,18 @@ static void pgraph_vk_process_pending(NV2AState *d)
         if (qatomic_read(&d->pgraph.flush_pending)) {
             pgraph_vk_flush(d);
         }
+        if (qatomic_read(&r->surface_rescale_pending)) {
+            pgraph_vk_process_pending_surface_rescale(d);
+        }
+        if (qatomic_read(&r->swapchain.present_pending)) {
+            pgraph_vk_process_pending_present(d);
+        }
+        if (qatomic_read(&r->shader_cache_writeback_pending)) {
+            pgraph_vk_shader_write_cache_reload_list(&d->pgraph);
+        }
+        if (qatomic_read(&r->cache_release_pending)) {
+            pgraph_vk_process_pending_cache_release(d);
+        }
         qemu_mutex_unlock(&d->pgraph.lock);
         qemu_mutex_lock(&d->pfifo.lock);
     }
@@ -243,10 +401,21 @@ static void pgraph_vk_process_pending(NV2AState *d)
 
 static void pgraph_vk_flip_stall(NV2AState *d)
 {
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
     pgraph_vk_finish(&d->pgraph, VK_FINISH_REASON_FLIP_STALL);
+    pgraph_vk_update_dynamic_surface_scale(d);
+    if (qatomic_xchg(&r->memory_stats_requested, false)) {
+        update_memory_stats(r);
+    }
     pgraph_vk_debug_frame_terminator();
 }
 
+static void pgraph_vk_set_frame_skip(NV2AState *d, bool skip)
+{
+    d->pgraph.vk_renderer_state->frame_skip = skip;
+}
+
 static void pgraph_vk_pre_savevm_trigger(NV2AState *d)
 {
     qatomic_set(&d->pgraph.vk_renderer_state->download_dirty_surfaces_pending, true);
@@ -260,13 +429,13 @@ static void pgraph_vk_pre_savevm_wait(NV2AState *d)
 
 static void pgraph_vk_pre_shutdown_trigger(NV2AState *d)
 {
-    // qatomic_set(&d->pgraph.vk_renderer_state->shader_cache_writeback_pending, true);
-    // qemu_event_reset(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);
+    qatomic_set(&d->pgraph.vk_renderer_state->shader_cache_writeback_pending, true);
+    qemu_event_reset(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);
 }
 
 static void pgraph_vk_pre_shutdown_wait(NV2AState *d)
 {
-    // qemu_event_wait(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);   
+    qemu_event_wait(&d->pgraph.vk_renderer_state->shader_cache_writeback_complete);
 }
 
 static int pgraph_vk_get_framebuffer_surface(NV2AState *d)
@@ -280,8 +449,11 @@ static int pgraph_vk_get_framebuffer_surface(NV2AState *d)
     d->vga.get_params(&d->vga, &vga_display_params);
 
     SurfaceBinding *surface = pgraph_vk_surface_get_within(
-        d, d->pcrtc.start + vga_display_params.line_offset);
-    if (surface == NULL || !surface->color) {
+        d, nv2a_get_display_start(d) + vga_display_params.line_offset);
+    if (surface == NULL || !surface->color || surface->transient) {
+        if (surface) {
+            surface->attachment_only = false;
+        }
         qemu_mutex_unlock(&d->pfifo.lock);
         return 0;
     }
@@ -309,12 +481,45 @@ static int pgraph_vk_get_framebuffer_surface(NV2AState *d)
 #endif
 }
 
+static void pgraph_vk_release_caches(NV2AState *d, bool all)
+{
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
+    if (!r) {
+        return;
+    }
+
+    int level = all ? 2 : 1;
+    if (qatomic_read(&r->cache_release_pending) < level) {
+        qatomic_set(&r->cache_release_pending, level);
+    }
+    qemu_mutex_lock(&d->pfifo.lock);
+    pfifo_kick(d);
+    qemu_mutex_unlock(&d->pfifo.lock);
+}
+
+static bool pgraph_vk_get_memory_stats(NV2AState *d, NV2AMemoryStats *stats)
+{
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
+    if (!r) {
+        return false;
+    }
+
+    qatomic_set(&r->memory_stats_requested, true);
+    qemu_spin_lock(&r->memory_stats_lock);
+    *stats = r->memory_stats;
+    qemu_spin_unlock(&r->memory_stats_lock);
+    return true;
+}
+
 static PGRAPHRenderer pgraph_vk_renderer = {
     .type = CONFIG_DISPLAY_RENDERER_VULKAN,
     .name = "Vulkan",
     .ops = {
         .init = pgraph_vk_init,
         .early_context_init = early_context_init,
+        .prewarm = pgraph_vk_prewarm,
         .finalize = pgraph_vk_finalize,
         .clear_report_value = pgraph_vk_clear_report_value,
         .clear_surface = pgraph_vk_clear_surface,
@@ -334,6 +539,11 @@ static PGRAPHRenderer pgraph_vk_renderer = {
         .set_surface_scale_factor = pgraph_vk_set_surface_scale_factor,
         .get_surface_scale_factor = pgraph_vk_get_surface_scale_factor,
         .get_framebuffer_surface = pgraph_vk_get_framebuffer_surface,
+        .present_frame = pgraph_vk_present_frame,
+        .present_surface_lost = pgraph_vk_present_surface_lost,
+        .release_caches = pgraph_vk_release_caches,
+        .get_memory_stats = pgraph_vk_get_memory_stats,
+        .set_frame_skip = pgraph_vk_set_frame_skip,
     }
 };
 
@@ -352,35 +562,118 @@ void pgraph_vk_force_register(void)
     registered = true;
 }
 
+static VkDeviceSize get_allocation_heap_size(PGRAPHVkState *r,
+                                             VmaAllocation allocation,
+                                             uint32_t *heap_index)
+{
+    VkPhysicalDeviceMemoryProperties const *props;
+    vmaGetMemoryProperties(r->allocator, &props);
+
+    VmaAllocationInfo info;
+    vmaGetAllocationInfo(r->allocator, allocation, &info);
+    *heap_index = props->memoryTypes[info.memoryType].heapIndex;
+
+    return info.size;
+}
+
+/*
+ * Weight used to order evictions: large resources which have not been used
+ * for a while go first. Returns 0 if the allocation does not live in a heap
+ * which is over budget.
+ */
+uint64_t pgraph_vk_get_eviction_weight(PGRAPHVkState *r,
+                                       VmaAllocation allocation,
+                                       unsigned int age,
+                                       const VkDeviceSize *heap_excess)
+{
+    if (allocation == VK_NULL_HANDLE) {
+        return 0;
+    }
+
+    uint32_t heap_index;
+    VkDeviceSize size = get_allocation_heap_size(r, allocation, &heap_index);
+    if (!heap_excess[heap_index]) {
+        return 0;
+    }
+
+    return size * ((uint64_t)age + 1);
+}
+
+/*
+ * Credit an allocation about to be freed against the excess of its heap.
+ * Returns true once no heap is over budget anymore.
+ */
+bool pgraph_vk_release_heap_excess(PGRAPHVkState *r, VmaAllocation allocation,
+                                   VkDeviceSize *heap_excess)
+{
+    VkPhysicalDeviceMemoryProperties const *props;
+    vmaGetMemoryProperties(r->allocator, &props);
+
+    if (allocation != VK_NULL_HANDLE) {
+        uint32_t heap_index;
+        VkDeviceSize size =
+            get_allocation_heap_size(r, allocation, &heap_index);
+        heap_excess[heap_index] -= MIN(size, heap_excess[heap_index]);
+    }
+
+    for (int i = 0; i < props->memoryHeapCount; i++) {
+        if (heap_excess[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void pgraph_vk_check_memory_budget(PGRAPHState *pg)
 {
-#if 0 // FIXME
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     VkPhysicalDeviceMemoryProperties const *props;
     vmaGetMemoryProperties(r->allocator, &props);
 
-    g_autofree VmaBudget *budgets = g_malloc_n(props->memoryHeapCount, sizeof(VmaBudget));
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
     vmaGetHeapBudgets(r->allocator, budgets);
 
-    const float budget_threshold = 0.8;
-    bool near_budget = false;
+    const int budget_percent =
+        MAX(10, MIN(r->device_profile.memory_budget_cap_percent,
+                    g_config.display.vulkan.memory_budget_percent));
+    VkDeviceSize heap_excess[VK_MAX_MEMORY_HEAPS] = { 0 };
+    bool over_budget = false;
 
     for (int i = 0; i < props->memoryHeapCount; i++) {
         VmaBudget *b = &budgets[i];
-        float use_to_budget_ratio =
-            (double)b->statistics.allocationBytes / (double)b->budget;
-        NV2A_VK_DPRINTF("Heap %d: used %lu/%lu MiB (%.2f%%)", i,
-                        b->statistics.allocationBytes / (1024 * 1024),
-                        b->budget / (1024 * 1024), use_to_budget_ratio * 100);
-        near_budget |= use_to_budget_ratio > budget_threshold;
+
+        // Count what others use of the heap, but only our live allocations
+        // rather than whole blocks, so freeing resources shows up right away
+        VkDeviceSize external_usage =
+            b->usage - MIN(b->usage, b->statistics.blockBytes);
+        VkDeviceSize usage = external_usage + b->statistics.allocationBytes;
+        VkDeviceSize limit = b->budget / 100 * budget_percent;
+
+        NV2A_VK_DPRINTF("Heap %d: used %lu/%lu MiB", i, usage / MiB,
+                        limit / MiB);
+        if (usage > limit) {
+            heap_excess[i] = usage - limit;
+            over_budget = true;
+        }
     }
 
-    // If any heaps are near budget, free up some resources
-    if (near_budget) {
-        pgraph_vk_trim_texture_cache(pg);
+    if (!over_budget) {
+        return;
     }
-#endif
+
+    nv2a_profile_inc_counter(NV2A_PROF_MEMORY_BUDGET_TRIM);
+
+    // Textures are cheapest to recreate, then surfaces which may need to be
+    // written back. Pipelines hold no heap memory we can see but are
+    // trimmed last to release driver allocations.
+    if (pgraph_vk_trim_texture_cache(pg, heap_excess) ||
+        pgraph_vk_trim_surfaces(d, heap_excess)) {
+        return;
+    }
+    pgraph_vk_trim_pipeline_cache(pg, false);
 
 #if 0
     char *s;
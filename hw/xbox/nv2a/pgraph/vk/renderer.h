@@ -24,6 +24,7 @@
 #include "qemu/thread.h"
 #include "qemu/queue.h"
 #include "qemu/lru.h"
+#include "qemu/interval-tree.h"
 #include "hw/hw.h"
 #include "hw/xbox/nv2a/nv2a_int.h"
 #include "hw/xbox/nv2a/nv2a_regs.h"
@@ -31,6 +32,7 @@
 #include "hw/xbox/nv2a/pgraph/surface.h"
 #include "hw/xbox/nv2a/pgraph/texture.h"
 #include "hw/xbox/nv2a/pgraph/glsl/shaders.h"
+#include "ui/xemu-mem-stats.h"
 
 #include <vulkan/vulkan.h>
 #include <glslang/Include/glslang_c_interface.h>
@@ -46,6 +48,7 @@
 
 typedef struct QueueFamilyIndices {
     int queue_family;
+    int transfer_family; // Copy engine without graphics or compute, if any
 } QueueFamilyIndices;
 
 typedef struct MemorySyncRequirement {
@@ -57,28 +60,87 @@ typedef struct RenderPassState {
     VkFormat zeta_format;
 } RenderPassState;
 
+/*
+ * Render pass compatibility ignores load and store ops, so pipelines are
+ * created against the plain LOAD/STORE pass and used with any variant of it.
+ */
+typedef struct RenderPassOps {
+    VkAttachmentLoadOp color_load_op;
+    VkAttachmentLoadOp depth_load_op;
+    VkAttachmentLoadOp stencil_load_op;
+    VkAttachmentStoreOp depth_store_op;
+    VkAttachmentStoreOp stencil_store_op;
+} RenderPassOps;
+
 typedef struct RenderPass {
     RenderPassState state;
+    RenderPassOps ops;
     VkRenderPass render_pass;
 } RenderPass;
 
+/*
+ * Attachments rendered to. With dynamic rendering there is no framebuffer
+ * object and passes begin on the views directly.
+ */
+typedef struct RenderTarget {
+    VkFramebuffer framebuffer;
+    VkImageView color_view;
+    VkImageView zeta_view;
+} RenderTarget;
+
+// Everything needed to begin a render pass, possibly on another thread
+typedef struct RenderPassBegin {
+    RenderPassState state;
+    RenderPassOps ops;
+    VkRenderPass render_pass; // VK_NULL_HANDLE with dynamic rendering
+    RenderTarget target;
+    VkRect2D render_area;
+    uint32_t num_clear_values;
+    VkClearValue clear_values[2]; // Indexed by attachment
+} RenderPassBegin;
+
+// A clear of the whole render area, waiting to become the load op of the next
+// render pass on the same render target
+typedef struct PendingClear {
+    bool active;
+    RenderTarget target;
+    RenderPassState state; // Of the pass the clear was recorded against
+    RenderPassOps ops;
+    unsigned int width, height;
+    VkClearValue clear_values[2]; // Indexed by attachment
+} PendingClear;
+
+/*
+ * Keys are zeroed before being filled in, and only the first num_*
+ * descriptions are used. Vertex input is left out entirely when it is dynamic
+ * state. The shader state comes last and is only compared once everything
+ * else, including its hash, matches.
+ */
 typedef struct PipelineKey {
     bool clear;
     RenderPassState render_pass_state;
-    ShaderState shader_state;
     uint32_t regs[9];
+    uint32_t num_binding_descriptions;
+    uint32_t num_attribute_descriptions;
     VkVertexInputBindingDescription binding_descriptions[NV2A_VERTEXSHADER_ATTRIBUTES];
     VkVertexInputAttributeDescription attribute_descriptions[NV2A_VERTEXSHADER_ATTRIBUTES];
+    uint64_t shader_state_hash;
+    ShaderState shader_state;
 } PipelineKey;
 
+typedef struct PipelineCompileJob PipelineCompileJob;
+
 typedef struct PipelineBinding {
     LruNode node;
     PipelineKey key;
+    uint64_t variant_hash;
     VkPipelineLayout layout;
     VkPipeline pipeline;
     VkRenderPass render_pass;
     unsigned int draw_time;
     bool has_dynamic_line_width;
+    PipelineCompileJob *job; // Non-NULL while compiling asynchronously
+    VkPipeline fast_linked_pipeline; // Replaced by pipeline, freed on evict
 } PipelineBinding;
 
 enum Buffer {
@@ -96,6 +158,8 @@ enum Buffer {
     BUFFER_COUNT
 };
 
+#define NUM_FRAMES_IN_FLIGHT 2
+
 typedef struct StorageBuffer {
     VkBuffer buffer;
     VkBufferUsageFlags usage;
@@ -104,11 +168,48 @@ typedef struct StorageBuffer {
     VkMemoryPropertyFlags properties;
     size_t buffer_offset;
     size_t buffer_size;
+    // Streaming ring state, see buffer.c
+    size_t frame_offset; // Start of the data written by the current frame
+    size_t frame_wrap_offset; // End of its data before wrapping, if it did
+    size_t ring_tail;
+    size_t frame_ends[NUM_FRAMES_IN_FLIGHT];
     uint8_t *mapped;
+    VkDeviceMemory imported_memory; // Host memory imported instead of allocation
+    bool transfer_queue_shared; // Also used on the transfer queue
+    // Scratch buffer sizing, see buffer.c
+    size_t max_size;
+    size_t high_water; // Largest reservation since the last shrink check
+    size_t title_high_water; // Largest reservation by the running title
+    XemuMemAccount *mem_account;
 } StorageBuffer;
 
+typedef struct RetiredBuffer {
+    VkBuffer buffer;
+    VmaAllocation allocation;
+    XemuMemAccount *mem_account;
+} RetiredBuffer;
+
+// Memory accounts of images, by what they are used for
+enum ImageMemCategory {
+    IMAGE_MEM_SURFACE,
+    IMAGE_MEM_TEXTURE,
+    IMAGE_MEM_DISPLAY,
+    IMAGE_MEM_BENCH,
+    IMAGE_MEM_COUNT
+};
+
+// Memory shared by the scratch images of all surfaces, see surface.c
+typedef struct SurfaceScratchArena {
+    VmaAllocation allocation;
+    VkDeviceSize size;
+    VkDeviceSize offset;
+    uint32_t memory_type;
+    int refs;
+} SurfaceScratchArena;
+
 typedef struct SurfaceBinding {
     QTAILQ_ENTRY(SurfaceBinding) entry;
+    IntervalTreeNode itree; // Indexed by VRAM range while in surfaces
     MemAccessCallback *access_cb;
 
     hwaddr vram_addr;
@@ -141,7 +242,41 @@ typedef struct SurfaceBinding {
     // Used for scaling
     VkImage image_scratch;
     VkImageLayout image_scratch_current_layout;
-    VmaAllocation allocation_scratch;
+    SurfaceScratchArena *scratch_arena;
+
+    // Tracks whether depth contents outlive the render pass that wrote them,
+    // so passes that start by clearing it may skip storing depth
+    bool zeta_contents_needed;
+    bool zeta_last_pass_cleared;
+
+    // Surfaces only ever used as attachments, starting with a clear, are
+    // recreated at the same address as transient, lazily allocated images.
+    // Reading a transient surface demotes it at the next surface update.
+    bool attachment_used;
+    bool attachment_only;
+    bool transient;
+
+    // Once the CPU has been seen reading the surface, it is copied to a
+    // host visible buffer at the end of each frame so later downloads only
+    // wait for that copy
+    bool readback_requested;
+    bool readback_valid;
+    int readback_draw_time;
+    uint32_t readback_submit;
+    VkBuffer readback_buffer;
+    VmaAllocation readback_allocation;
+    void *readback_mapped;
+
+    // Downloaded for a CPU write and not read by the CPU since, see
+    // surface-profile.c
+    bool cpu_write_download_unread;
+
+    // Frame skipping drops draws to surfaces that have been displayed and are
+    // never read otherwise. Skipped surfaces are not displayed until drawn to
+    // in a rendered frame, see pgraph_vk_frame_skip_draw.
+    bool displayed;
+    bool frame_skip_pinned; // Sampled or downloaded, always drawn to
+    bool frame_skipped;
 
     bool initialized;
 } SurfaceBinding;
@@ -150,13 +285,18 @@ typedef struct ShaderModuleInfo {
     int refcnt;
     char *glsl;
     GByteArray *spirv;
+    bool cached; // SPIR-V is in the disk cache
     VkShaderModule module;
     SpvReflectShaderModule reflect_module;
     SpvReflectDescriptorSet **descriptor_sets;
     ShaderUniformLayout uniforms;
     ShaderUniformLayout push_constants;
+    bool vsh_constants_valid; // uniforms hold constants up to vsh_constants_gen
+    uint64_t vsh_constants_gen;
 } ShaderModuleInfo;
 
+typedef struct ShaderModuleFuture ShaderModuleFuture;
+
 typedef struct ShaderModuleCacheKey {
     VkShaderStageFlagBits kind;
     union {
@@ -179,11 +319,69 @@ typedef struct ShaderModuleCacheEntry {
     LruNode node;
     ShaderModuleCacheKey key;
     ShaderModuleInfo *module_info;
+    ShaderModuleFuture *future; // Non-NULL while compiling in the background
 } ShaderModuleCacheEntry;
 
+enum ShaderBindingStage {
+    SHADER_STAGE_VSH,
+    SHADER_STAGE_GEOM,
+    SHADER_STAGE_PSH,
+    SHADER_STAGE_COUNT,
+};
+
+// Pixel shader push constants, followed by uniform vertex attributes
+#define PSH_PUSH_CONSTANTS_SIZE 32
+
+#define MAX_BATCHED_DRAWS 64
+
+// Non-indexed draws recorded with the same state, see draw.c
+typedef struct DrawBatch {
+    VkMultiDrawInfoEXT draws[MAX_BATCHED_DRAWS];
+    int num_draws;
+} DrawBatch;
+
+// State last recorded into the render pass, to skip redundant commands
+// Fixed-function state decoded from the pipeline key registers. Whatever the
+// device can't set dynamically is baked into the pipeline instead.
+typedef struct DynamicDrawState {
+    VkCullModeFlags cull_mode;
+    VkFrontFace front_face;
+    VkBool32 depth_test_enable;
+    VkBool32 depth_write_enable;
+    VkCompareOp depth_compare_op;
+    VkBool32 stencil_test_enable;
+    VkStencilOpState stencil;
+    VkBool32 color_blend_enable;
+    VkColorBlendEquationEXT color_blend_equation;
+    VkColorComponentFlags color_write_mask;
+    float blend_constants[4];
+} DynamicDrawState;
+
+typedef struct BoundDrawState {
+    VkDescriptorSet descriptor_set;
+    uint32_t dynamic_offsets[2];
+    int num_vertex_buffers;
+    VkBuffer vertex_buffers[NV2A_VERTEXSHADER_ATTRIBUTES];
+    VkDeviceSize vertex_buffer_offsets[NV2A_VERTEXSHADER_ATTRIBUTES];
+    int num_vertex_bindings; // Dynamic vertex input, -1 if unknown
+    int num_vertex_attributes;
+    VkVertexInputBindingDescription vertex_bindings[NV2A_VERTEXSHADER_ATTRIBUTES];
+    VkVertexInputAttributeDescription vertex_attributes[NV2A_VERTEXSHADER_ATTRIBUTES];
+    bool dynamic_state_valid;
+    DynamicDrawState dynamic_state;
+    int vsh_push_size;
+    float vsh_push[NV2A_VERTEXSHADER_ATTRIBUTES][4];
+    int psh_push_size;
+    uint8_t psh_push[PSH_PUSH_CONSTANTS_SIZE];
+} BoundDrawState;
+
 typedef struct ShaderBinding {
     LruNode node;
     ShaderState state;
+    bool initialized;
+    bool pending; // Pixel shader is compiling, draw with the generic one
+    bool cached;
+    GByteArray *cached_spirv[SHADER_STAGE_COUNT]; // Loaded from disk cache
     struct {
         ShaderModuleInfo *module_info;
         VshUniformLocs uniform_locs;
@@ -194,7 +392,15 @@ typedef struct ShaderBinding {
     struct {
         ShaderModuleInfo *module_info;
         PshUniformLocs uniform_locs;
+        PshUniformLocs push_constant_locs;
+        int tex_index_loc; // Bindless texture slots, -1 if not used
     } psh;
+    struct {
+        RenderPassState render_pass_state;
+        VkPipelineLayout layout;
+        VkPipeline pre_rasterization;
+        VkPipeline fragment_shader;
+    } library; // Graphics pipeline library parts for fast linking
 } ShaderBinding;
 
 typedef struct TextureKey {
@@ -208,11 +414,78 @@ typedef struct TextureKey {
     uint32_t address;
     uint32_t border_color;
     uint32_t max_anisotropy;
+    float lod_bias;
+    uint32_t mip_skip; // Top levels left out of the image
+    uint32_t surface_alias; // Samples the surface image in place
 } TextureKey;
 
+// Identifies converted texture data independent of where it lives in memory
+typedef struct TextureDiskCacheKey {
+    TextureShape state;
+    uint64_t content_hash;
+    uint32_t host_format;
+    uint32_t reserved;
+} TextureDiskCacheKey;
+
+typedef struct TextureDiskCache {
+    bool enabled;
+    GHashTable *entries; // TextureDiskCacheEntry by key hash
+    QTAILQ_HEAD(, TextureDiskCacheEntry) lru;
+    uint64_t size, max_size;
+    GThreadPool *write_pool;
+} TextureDiskCache;
+
+typedef struct TexturePackEntry TexturePackEntry;
+typedef struct TextureReplacementLoad TextureReplacementLoad;
+
+// Texture pack images replacing guest textures, see texture-replacement.c
+typedef struct TextureReplacementState {
+    bool enabled;
+    GPtrArray *packs; // GMappedFile
+    GHashTable *entries; // TexturePackEntry by TexturePackKey
+    GThreadPool *load_pool;
+    QemuMutex lock;
+    QSIMPLEQ_HEAD(, TextureReplacementLoad) loaded; // Protected by lock
+    unsigned int num_loading;
+} TextureReplacementState;
+
+typedef struct TextureReplacement {
+    uint64_t content_hash; // Of the guest texture it replaces
+    VkImage image;
+    VmaAllocation allocation;
+    VkImageView image_view;
+    int bindless_slot;
+} TextureReplacement;
+
+typedef struct DynamicSurfaceScale {
+    float frame_time_avg; // ms
+    int frames_since_change;
+} DynamicSurfaceScale;
+
+typedef struct DeviceProfile {
+    uint32_t caps;
+    float geometry_shader_cost; // Draw time with a geometry stage vs without
+    float pipeline_compile_ms, pipeline_cache_hit_ms;
+    bool pipeline_cache_effective; // Worth saving across runs
+    int pipeline_cache_size;
+    int memory_budget_cap_percent;
+} DeviceProfile;
+
+typedef struct SurfaceProfile {
+    GHashTable *records; // SurfaceReadbackRecord by surface key
+    uint32_t title_id;
+    int mode; // CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE
+    bool dirty;
+    int64_t title_check_time;
+} SurfaceProfile;
+
 typedef struct TextureBinding {
     LruNode node;
     TextureKey key;
+    // Indexed by VRAM range in texture_tree and palette_tree
+    bool indexed;
+    IntervalTreeNode tex_itree;
+    IntervalTreeNode pal_itree;
     VkImage image;
     VkImageLayout current_layout;
     VkImageView image_view;
@@ -220,17 +493,31 @@ typedef struct TextureBinding {
     VkSampler sampler;
     bool possibly_dirty;
     uint64_t hash;
+    // Per-page content hashes of the texture data, rehashed when dirty
+    unsigned int num_pages;
+    uint64_t *page_hashes;
+    unsigned long *dirty_pages;
+    // Pages whose content changed since the image was last uploaded
+    unsigned long *changed_pages;
+    uint64_t palette_hash;
     unsigned int draw_time;
     uint32_t submit_time;
+    int bindless_slot; // Index in the bindless sampler arrays, -1 if none
+    // Sampled instead of image while the content hash matches
+    TextureReplacement *replacement;
+    TextureReplacementLoad *replacement_load;
 } TextureBinding;
 
 typedef struct QueryReport {
     QSIMPLEQ_ENTRY(QueryReport) entry;
     bool clear;
     uint32_t parameter;
+    uint32_t dma_report;
     unsigned int query_count;
 } QueryReport;
 
+typedef QSIMPLEQ_HEAD(, QueryReport) QueryReportQueue;
+
 typedef struct PvideoState {
     bool enabled;
     hwaddr base;
@@ -273,6 +560,7 @@ typedef struct PGRAPHVkDisplayState {
     VkImage image;
     VkImageView image_view;
     VkDeviceMemory memory;
+    VkDeviceSize memory_size;
     VkSampler sampler;
 
     struct {
@@ -298,9 +586,78 @@ typedef struct PGRAPHVkDisplayState {
     GLuint gl_texture_id;
 } PGRAPHVkDisplayState;
 
+typedef struct PGRAPHVkSwapchainState {
+    bool failed; // Native presentation is unavailable, don't retry
+    bool surface_lost; // Release the surface with the next request
+    void *window;
+    VkSurfaceKHR surface;
+    uint32_t queue_family;
+    VkSwapchainKHR swapchain;
+    VkFormat format;
+    VkColorSpaceKHR color_space;
+    VkPresentModeKHR present_mode, requested_present_mode;
+    VkExtent2D extent, requested_extent;
+    uint32_t min_image_count;
+    uint32_t num_images;
+    VkImage *images;
+    VkImageView *image_views;
+    VkFramebuffer *framebuffers;
+    VkSemaphore *render_semaphores; // Per image, signaled for present
+    bool needs_recreate;
+
+    VkRenderPass render_pass; // Overlay pass, kept across recreation
+    VkDescriptorPool overlay_descriptor_pool;
+    VkCommandBuffer command_buffer;
+    VkFence fence;
+    VkSemaphore acquire_semaphore;
+
+    // FSR 1.0 style upscaling, EASU into the image below then RCAS into
+    // the window
+    struct {
+        ShaderModuleInfo *easu_frag, *rcas_frag;
+        VkDescriptorPool descriptor_pool;
+        VkDescriptorSetLayout descriptor_set_layout;
+        VkDescriptorSet easu_descriptor_set, rcas_descriptor_set;
+        VkPipelineLayout easu_pipeline_layout, rcas_pipeline_layout;
+        VkPipeline easu_pipeline, rcas_pipeline;
+        VkRenderPass render_pass;
+        int width, height;
+        VkImage image;
+        VkImageView image_view;
+        VmaAllocation allocation;
+        VkFramebuffer framebuffer;
+    } upscale;
+
+    NV2APresentRequest request;
+    bool presented;
+    bool present_pending;
+    QemuEvent present_complete;
+} PGRAPHVkSwapchainState;
+
+typedef enum TextureDecodeKernel {
+    TEXTURE_DECODE_NONE,
+    TEXTURE_DECODE_UNSWIZZLE_8,
+    TEXTURE_DECODE_UNSWIZZLE_16,
+    TEXTURE_DECODE_UNSWIZZLE_32,
+    TEXTURE_DECODE_SWIZZLE_16,
+    TEXTURE_DECODE_SWIZZLE_32,
+    TEXTURE_DECODE_PALETTE_8,
+    TEXTURE_DECODE_BC1,
+    TEXTURE_DECODE_BC2,
+    TEXTURE_DECODE_BC3,
+} TextureDecodeKernel;
+
+// One mip level or cubemap face to be decoded by a compute dispatch
+typedef struct TextureDecodeRegion {
+    uint32_t width, height, depth;
+    uint32_t in_offset;
+    uint32_t out_offset;
+} TextureDecodeRegion;
+
 typedef struct ComputePipelineKey {
     VkFormat host_fmt;
     bool pack;
+    TextureDecodeKernel texture_kernel;
     int workgroup_size;
 } ComputePipelineKey;
 
@@ -314,12 +671,102 @@ typedef struct PGRAPHVkComputeState {
     VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_set_layout;
     VkDescriptorSet descriptor_sets[1024];
-    int descriptor_set_index;
+    // Submit index + 1 of the frame that last used each set, 0 if unused
+    uint32_t descriptor_set_submit[1024];
+    int descriptor_set_index; // Next set to use, sets are reused in order
     VkPipelineLayout pipeline_layout;
     Lru pipeline_cache;
     ComputePipeline *pipeline_cache_entries;
 } PGRAPHVkComputeState;
 
+/*
+ * Every cached texture is written once into a persistent set of sampler
+ * arrays, one per sampler type, and draws select theirs with push constants.
+ * There is a slot for each texture cache entry plus the dummy texture, and
+ * slots must fit in the 16 bits they are packed into. Texture pack
+ * replacements use whatever slots are left.
+ */
+#define MAX_BINDLESS_TEXTURES (64 * 256 + 1)
+
+typedef struct PGRAPHVkBindlessState {
+    bool enabled;
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSetLayout descriptor_set_layout;
+    VkDescriptorSet descriptor_set;
+    GArray *free_slots; // int
+} PGRAPHVkBindlessState;
+
+#define MAX_DESCRIPTOR_SETS_PER_FRAME 1024
+#define MAX_FRAMEBUFFERS_PER_FRAME 50
+#define DESCRIPTOR_SET_CACHE_SIZE 256
+
+typedef struct DescriptorSetKey {
+    VkDeviceSize ubo_ranges[2];
+    VkImageView image_views[NV2A_MAX_TEXTURES];
+    VkSampler samplers[NV2A_MAX_TEXTURES];
+} DescriptorSetKey;
+
+#define GPU_TIMER_MAX_QUERIES 256
+
+// Timestamp queries recorded into one command buffer
+typedef struct GpuTimerSlot {
+    VkQueryPool pool;
+    bool active;
+    unsigned int num_queries;
+    unsigned int frame; // Emulated frame the commands were recorded in
+    uint8_t timers[GPU_TIMER_MAX_QUERIES / 2];
+} GpuTimerSlot;
+
+#define MAX_RECORD_WORKERS 4
+
+typedef struct RecordedPass RecordedPass;
+typedef struct RecordWorker RecordWorker;
+
+// Secondaries recorded by one worker for a frame, see record.c
+typedef struct RecordWorkerPool {
+    VkCommandPool pool;
+    GArray *buffers; // VkCommandBuffer
+    int num_used;
+} RecordWorkerPool;
+
+// Render passes of a frame recorded in parallel, see record.c
+typedef struct FrameRecording {
+    RecordWorkerPool worker_pools[MAX_RECORD_WORKERS];
+    GArray *primaries; // VkCommandBuffer, allocated from command_pool
+    int num_primaries;
+    GPtrArray *passes; // RecordedPass
+    int num_passes;
+    GArray *submit_cmds; // VkCommandBuffer, empty if recorded inline
+} FrameRecording;
+
+typedef struct FrameInFlight {
+    VkCommandBuffer command_buffer;
+    VkCommandBuffer aux_command_buffer;
+    VkSemaphore semaphore;
+    VkFence fence; // Unused with timeline semaphores
+    uint64_t timeline_value; // Signaled on r->timeline when complete
+    uint64_t transfer_wait_value; // Of r->transfer_timeline, 0 if none
+    bool in_flight;
+    bool submit_queued; // Waiting for the submit thread to reach vkQueueSubmit
+    uint32_t submit_index;
+    unsigned int start_time;
+    unsigned long *uploaded_bitmap; // Vertex RAM pages read by the frame
+    GArray *retired_buffers; // RetiredBuffer, destroyed with the frame
+
+    VkDescriptorSet descriptor_sets[MAX_DESCRIPTOR_SETS_PER_FRAME];
+    DescriptorSetKey descriptor_set_keys[MAX_DESCRIPTOR_SETS_PER_FRAME];
+    // Index + 1 of a written set by key hash, 0 if none
+    int descriptor_set_cache[DESCRIPTOR_SET_CACHE_SIZE];
+    VkFramebuffer framebuffers[MAX_FRAMEBUFFERS_PER_FRAME];
+    int framebuffer_index;
+
+    VkQueryPool query_pool;
+    int num_queries;
+    QueryReportQueue reports; // Written back when the frame is retired
+
+    FrameRecording recording;
+} FrameInFlight;
+
 typedef struct PGRAPHVkState {
     VkInstance instance;
     VkDebugUtilsMessengerEXT debug_messenger;
@@ -328,21 +775,79 @@ typedef struct PGRAPHVkState {
     bool debug_utils_extension_enabled;
     bool custom_border_color_extension_enabled;
     bool memory_budget_extension_enabled;
+    bool swapchain_extension_enabled;
+    bool external_memory_host_extension_enabled;
+    bool multi_draw_extension_enabled;
+    uint32_t max_multi_draw_count;
+    bool fragment_shader_barycentric_extension_enabled;
+    bool use_geometry_shader; // Otherwise primitive attributes use barycentrics
+    bool vertex_input_dynamic_state_extension_enabled;
+    bool extended_dynamic_state_extension_enabled;
+    bool extended_dynamic_state3_extension_enabled; // Blend and write mask
+    bool graphics_pipeline_library_extension_enabled;
+    bool timeline_semaphore_extension_enabled;
+    bool descriptor_indexing_extension_enabled;
+    bool dynamic_rendering_extension_enabled; // No render pass objects
 
     VkPhysicalDevice physical_device;
     VkPhysicalDeviceFeatures enabled_physical_device_features;
     VkPhysicalDeviceProperties device_props;
+    DeviceProfile device_profile;
+    bool low_memory; // Smaller caches and pools, see perf.low_memory
     VkDevice device;
     VmaAllocator allocator;
     uint32_t allocator_last_submit_index;
 
     VkQueue queue;
+    uint32_t queue_family;
     VkCommandPool command_pool;
-    VkCommandBuffer command_buffers[2];
+
+    // Uploads into fresh images go through this queue when enabled. Images
+    // are released to the graphics queue and acquired by the next aux
+    // command buffer, which waits for the transfer to complete.
+    bool transfer_queue_enabled;
+    VkQueue transfer_queue;
+    uint32_t transfer_queue_family;
+    VkCommandPool transfer_command_pool;
+    VkCommandBuffer transfer_command_buffer;
+    bool in_transfer_command_buffer;
+    VkSemaphore transfer_timeline;
+    uint64_t transfer_timeline_value;
+    GArray *transfer_acquires; // VkImageMemoryBarrier
+    uint64_t aux_transfer_wait_value; // Waited on by the aux submit
+
+    // Every queue submit signals the next value, in submission order
+    VkSemaphore timeline;
+    uint64_t timeline_value; // Last value handed to a submit
+
+    // Frames are handed to this thread for vkQueueSubmit when enabled. Any
+    // other use of the queue first waits for queued submits to drain.
+    bool threaded_submit;
+    QemuThread submit_thread;
+    QemuMutex submit_lock;
+    QemuCond submit_cond;
+    FrameInFlight *submit_queue[NUM_FRAMES_IN_FLIGHT];
+    int submit_queue_head, submit_queue_len;
+    bool submit_shutdown;
+
+    // Render passes are captured and recorded into secondaries by these
+    // workers when enabled, see record.c
+    bool parallel_recording;
+    RecordedPass *recording; // Render pass being captured
+    RecordWorker *record_workers;
+    int num_record_workers;
+    bool record_workers_shutdown;
+    QemuMutex record_lock;
+    QemuCond record_cond;
+    QemuCond record_done_cond;
+    QSIMPLEQ_HEAD(, RecordedPass) record_queue;
+
+    FrameInFlight frames[NUM_FRAMES_IN_FLIGHT];
+    FrameInFlight *frame; // Frame being recorded
+    int frame_index;
+    int num_frames_in_flight;
 
     VkCommandBuffer command_buffer;
-    VkSemaphore command_buffer_semaphore;
-    VkFence command_buffer_fence;
     unsigned int command_buffer_start_time;
     bool in_command_buffer;
     uint32_t submit_count;
@@ -350,34 +855,64 @@ typedef struct PGRAPHVkState {
     VkCommandBuffer aux_command_buffer;
     bool in_aux_command_buffer;
 
-    VkFramebuffer framebuffers[50];
-    int framebuffer_index;
     bool framebuffer_dirty;
+    RenderTarget render_target;
 
     VkRenderPass render_pass;
+    RenderPassState render_pass_state;
     GArray *render_passes; // RenderPass
     bool in_render_pass;
+    bool tiler_render_passes; // Defer clears to load ops, discard depth
+    PendingClear pending_clear;
     bool in_draw;
+    DrawBatch draw_batch;
+    BoundDrawState bound_state;
 
     Lru pipeline_cache;
     VkPipelineCache vk_pipeline_cache;
     PipelineBinding *pipeline_cache_entries;
     PipelineBinding *pipeline_binding;
     bool pipeline_binding_changed;
+    bool pipeline_binding_pending;
+    GHashTable *pipeline_variants; // variant_hash -> PipelineBinding
+
+    QemuThread *pipeline_workers;
+    int num_pipeline_workers;
+    bool pipeline_workers_shutdown;
+    QemuMutex pipeline_job_lock;
+    QemuCond pipeline_job_cond;
+    QSIMPLEQ_HEAD(, PipelineCompileJob) pipeline_job_queue;
 
     VkDescriptorPool descriptor_pool;
     VkDescriptorSetLayout descriptor_set_layout;
-    VkDescriptorSet descriptor_sets[1024];
     int descriptor_set_index;
+    int bound_descriptor_set;
+    PGRAPHVkBindlessState bindless;
 
     StorageBuffer storage_buffers[BUFFER_COUNT];
+    unsigned int scratch_shrink_frames; // Frames since the last shrink check
+    XemuMemAccount *image_mem_accounts[IMAGE_MEM_COUNT];
+    XemuMemAccount *readback_mem_account;
     PrimRewriteBuf prim_rewrite_buf;
+    uint16_t *narrow_indices; // Scratch for 16-bit inline element indices
+    size_t narrow_indices_capacity;
+
+    // Index and inline vertex data streamed by the frame being recorded,
+    // keyed by content hash, see vertex.c
+    GHashTable *index_data_cache;
+    GHashTable *vertex_inline_data_cache;
 
+    bool vertex_ram_imported; // BUFFER_VERTEX_RAM is guest RAM itself
     MemorySyncRequirement vertex_ram_buffer_syncs[NV2A_VERTEXSHADER_ATTRIBUTES];
     size_t num_vertex_ram_buffer_syncs;
-    unsigned long *uploaded_bitmap;
+    unsigned long *uploaded_bitmap; // Current frame's
     size_t bitmap_size;
 
+    // Ranges left stale in the vertex RAM buffer until the next finish, draws
+    // reading them copy the data from guest RAM instead
+    MemorySyncRequirement vertex_ram_versions[64];
+    size_t num_vertex_ram_versions;
+
     VkVertexInputAttributeDescription vertex_attribute_descriptions[NV2A_VERTEXSHADER_ATTRIBUTES];
     int vertex_attribute_to_description_location[NV2A_VERTEXSHADER_ATTRIBUTES];
     int num_active_vertex_attribute_descriptions;
@@ -385,25 +920,61 @@ typedef struct PGRAPHVkState {
     VkVertexInputBindingDescription vertex_binding_descriptions[NV2A_VERTEXSHADER_ATTRIBUTES];
     int num_active_vertex_binding_descriptions;
     hwaddr vertex_attribute_offsets[NV2A_VERTEXSHADER_ATTRIBUTES];
+    bool vertex_format_native[8][4]; // [format type][count - 1]
 
     QTAILQ_HEAD(, SurfaceBinding) surfaces;
+    IntervalTreeRoot surface_tree;
     QTAILQ_HEAD(, SurfaceBinding) invalid_surfaces;
     SurfaceBinding *color_binding, *zeta_binding;
+    bool transient_surfaces;
+    GHashTable *transient_surface_addrs; // Attachment-only surfaces seen
+    SurfaceScratchArena *surface_scratch_arena;
+    VmaDefragmentationContext surface_defrag;
+    int surface_defrag_check_frame;
+    SurfaceProfile surface_profile;
     bool downloads_pending;
     QemuEvent downloads_complete;
     bool download_dirty_surfaces_pending;
     QemuEvent dirty_surfaces_download_complete; // common
+    bool surface_rescale_pending;
+    QemuEvent surface_rescale_complete;
+    DynamicSurfaceScale dynamic_scale;
+    bool frame_skip; // Set by the frontend for skipped frames
 
     Lru texture_cache;
-    TextureBinding *texture_cache_entries;
+    GPtrArray *texture_cache_chunks; // TextureBinding[]
+    IntervalTreeRoot texture_tree;
+    IntervalTreeRoot palette_tree;
     TextureBinding *texture_bindings[NV2A_MAX_TEXTURES];
     TextureBinding dummy_texture;
     bool texture_bindings_changed;
+    // Surface images sampled in place by the current render pass
+    VkImage aliased_surface_images[NV2A_MAX_TEXTURES];
+    int num_aliased_surface_images;
     VkFormatProperties *texture_format_properties;
+    bool native_bc_textures;
+    GThreadPool *texture_decode_pool;
+    TextureDiskCache texture_disk_cache;
+    TextureReplacementState texture_replacement;
 
     Lru shader_cache;
     ShaderBinding *shader_cache_entries;
     ShaderBinding *shader_binding;
+    ShaderBinding *pending_shader_binding; // Stood in for by shader_binding
+    ShaderStateCache shader_state_cache;
+    QemuMutex shader_cache_lock;
+    QemuThread shader_disk_thread;
+    bool shader_disk_thread_started;
+    bool shader_cache_writeback_pending;
+    QemuEvent shader_cache_writeback_complete;
+
+    int cache_release_pending; // 1: trim caches, 2: release all we can
+    bool memory_stats_requested;
+    QemuSpin memory_stats_lock;
+    NV2AMemoryStats memory_stats;
+
+    FILE *shader_trace_file;
+    GHashTable *shader_trace_recorded; // Record payload hashes
     ShaderModuleInfo *quad_vert_module, *solid_frag_module;
     bool shader_bindings_changed;
     bool use_push_constants_for_uniform_attrs;
@@ -414,26 +985,45 @@ typedef struct PGRAPHVkState {
     // FIXME: Merge these into a structure
     uint64_t uniform_buffer_hashes[2];
     size_t uniform_buffer_offsets[2];
+    bool uniform_block_changed[2];
     bool uniforms_changed;
 
-    VkQueryPool query_pool;
+    struct {
+        bool supported;
+        float period; // ns per timestamp tick
+        uint64_t mask;
+        GpuTimerSlot frames[NUM_FRAMES_IN_FLIGHT];
+        GpuTimerSlot aux;
+        int render_pass_query;
+    } gpu_timer;
+
+    VkQueryPool query_pool; // Of the frame being recorded
     int max_queries_in_flight; // FIXME: Move out to constant
     int num_queries_in_flight;
     bool new_query_needed;
     bool query_in_flight;
     uint32_t zpass_pixel_count_result;
-    QSIMPLEQ_HEAD(, QueryReport) report_queue; // FIXME: Statically allocate
+    QueryReportQueue report_queue; // Not yet submitted
+    QueryReportQueue report_free_list;
+    uint64_t *query_results;
 
     SurfaceFormatInfo kelvin_surface_zeta_vk_map[3];
 
     uint32_t clear_parameter;
 
     PGRAPHVkDisplayState display;
+    PGRAPHVkSwapchainState swapchain;
     PGRAPHVkComputeState compute;
 } PGRAPHVkState;
 
 // renderer.c
 void pgraph_vk_check_memory_budget(PGRAPHState *pg);
+uint64_t pgraph_vk_get_eviction_weight(PGRAPHVkState *r,
+                                       VmaAllocation allocation,
+                                       unsigned int age,
+                                       const VkDeviceSize *heap_excess);
+bool pgraph_vk_release_heap_excess(PGRAPHVkState *r, VmaAllocation allocation,
+                                   VkDeviceSize *heap_excess);
 
 // debug.c
 #define RGBA_RED     (float[4]){1,0,0,1}
@@ -451,13 +1041,18 @@ void pgraph_vk_begin_debug_marker(PGRAPHVkState *r, VkCommandBuffer cmd,
 void pgraph_vk_end_debug_marker(PGRAPHVkState *r, VkCommandBuffer cmd);
 
 // instance.c
+void pgraph_vk_prewarm_loader(void);
 void pgraph_vk_init_instance(PGRAPHState *pg, Error **errp);
 void pgraph_vk_finalize_instance(PGRAPHState *pg);
+
+// device-profile.c
+void pgraph_vk_init_device_profile(PGRAPHState *pg);
 QueueFamilyIndices pgraph_vk_find_queue_families(VkPhysicalDevice device);
 uint32_t pgraph_vk_get_memory_type(PGRAPHState *pg, uint32_t type_bits,
                                    VkMemoryPropertyFlags properties);
 
 // glsl.c
+void pgraph_vk_prewarm_glsl_compiler(void);
 void pgraph_vk_init_glsl_compiler(void);
 void pgraph_vk_finalize_glsl_compiler(void);
 GByteArray *pgraph_vk_compile_glsl_to_spv(glslang_stage_t stage,
@@ -466,33 +1061,124 @@ VkShaderModule pgraph_vk_create_shader_module_from_spv(PGRAPHVkState *r,
                                                        GByteArray *spv);
 ShaderModuleInfo *pgraph_vk_create_shader_module_from_glsl(
     PGRAPHVkState *r, VkShaderStageFlagBits stage, const char *glsl);
+ShaderModuleFuture *pgraph_vk_create_shader_module_from_glsl_async(
+    PGRAPHVkState *r, VkShaderStageFlagBits stage, const char *glsl);
+bool pgraph_vk_shader_module_is_ready(ShaderModuleFuture *future);
+ShaderModuleInfo *pgraph_vk_wait_shader_module(ShaderModuleFuture *future);
+ShaderModuleInfo *pgraph_vk_create_shader_module_from_spv_data(
+    PGRAPHVkState *r, GByteArray *spv);
+ShaderModuleFuture *pgraph_vk_shader_module_future_from_info(
+    ShaderModuleInfo *info);
 void pgraph_vk_ref_shader_module(ShaderModuleInfo *info);
 void pgraph_vk_unref_shader_module(PGRAPHVkState *r, ShaderModuleInfo *info);
 void pgraph_vk_destroy_shader_module(PGRAPHVkState *r, ShaderModuleInfo *info);
 
+// geom-spirv.c
+GByteArray *pgraph_vk_gen_geom_spv(const GeomState *state);
+
 // buffer.c
 bool pgraph_vk_init_buffers(NV2AState *d, Error **errp);
 void pgraph_vk_finalize_buffers(NV2AState *d);
 bool pgraph_vk_buffer_has_space_for(PGRAPHState *pg, int index,
                                     VkDeviceSize size,
                                     VkDeviceAddress alignment);
+bool pgraph_vk_buffer_reclaim_space_for(PGRAPHState *pg, int index,
+                                        VkDeviceSize size,
+                                        VkDeviceAddress alignment);
+VkDeviceSize pgraph_vk_allocate_from_buffer(PGRAPHState *pg, int index,
+                                            VkDeviceSize size,
+                                            VkDeviceAddress alignment);
 VkDeviceSize pgraph_vk_append_to_buffer(PGRAPHState *pg, int index, void **data,
                                         VkDeviceSize *sizes, size_t count,
                                         VkDeviceAddress alignment);
+void pgraph_vk_buffers_frame_submitted(PGRAPHVkState *r, int frame_index);
+void pgraph_vk_buffers_frame_retired(PGRAPHVkState *r, int frame_index);
+void pgraph_vk_reserve_scratch_buffer(PGRAPHState *pg, int index,
+                                      size_t size);
+void pgraph_vk_buffers_title_changed(PGRAPHVkState *r, uint32_t title_id);
+void pgraph_vk_account_allocation(PGRAPHVkState *r, XemuMemAccount *account,
+                                  VmaAllocation allocation, bool freed);
 
 // command.c
 void pgraph_vk_init_command_buffers(PGRAPHState *pg);
 void pgraph_vk_finalize_command_buffers(PGRAPHState *pg);
 VkCommandBuffer pgraph_vk_begin_single_time_commands(PGRAPHState *pg);
 void pgraph_vk_end_single_time_commands(PGRAPHState *pg, VkCommandBuffer cmd);
+VkCommandBuffer pgraph_vk_begin_transfer_commands(PGRAPHState *pg);
+void pgraph_vk_end_transfer_commands(PGRAPHState *pg, VkCommandBuffer cmd);
+void pgraph_vk_release_image_to_graphics(PGRAPHState *pg, VkCommandBuffer cmd,
+                                         VkImage image,
+                                         VkImageAspectFlags aspect,
+                                         VkImageLayout layout,
+                                         VkImageLayout new_layout);
+void pgraph_vk_discard_image_acquire(PGRAPHVkState *r, VkImage image);
+void pgraph_vk_submit_frame(PGRAPHVkState *r);
+void pgraph_vk_advance_frame(PGRAPHVkState *r);
+void pgraph_vk_wait_for_frames_in_flight(PGRAPHVkState *r);
+bool pgraph_vk_retire_oldest_frame(PGRAPHVkState *r);
+void pgraph_vk_retire_completed_frames(PGRAPHVkState *r);
+void pgraph_vk_wait_for_draw_time(PGRAPHVkState *r, unsigned int draw_time);
+void pgraph_vk_wait_for_submit(PGRAPHVkState *r, uint32_t submit_index);
+void pgraph_vk_wait_for_queued_submits(PGRAPHVkState *r);
+
+// record.c
+void pgraph_vk_init_recording(PGRAPHState *pg);
+void pgraph_vk_finalize_recording(PGRAPHState *pg);
+void pgraph_vk_begin_frame_recording(PGRAPHVkState *r);
+bool pgraph_vk_begin_recorded_pass(PGRAPHVkState *r,
+                                   const RenderPassBegin *begin);
+void pgraph_vk_end_recorded_pass(PGRAPHVkState *r);
+void pgraph_vk_finish_recorded_passes(PGRAPHVkState *r);
+void pgraph_vk_cmd_bind_pipeline(PGRAPHVkState *r, VkPipeline pipeline);
+void pgraph_vk_cmd_set_viewport(PGRAPHVkState *r, const VkViewport *viewport);
+void pgraph_vk_cmd_set_scissor(PGRAPHVkState *r, const VkRect2D *scissor);
+void pgraph_vk_cmd_set_line_width(PGRAPHVkState *r, float width);
+void pgraph_vk_cmd_set_blend_constants(PGRAPHVkState *r,
+                                       const float constants[4]);
+void pgraph_vk_cmd_set_dynamic_state(PGRAPHVkState *r,
+                                     const DynamicDrawState *old,
+                                     const DynamicDrawState *state);
+void pgraph_vk_cmd_set_vertex_input(
+    PGRAPHVkState *r, uint32_t num_bindings,
+    const VkVertexInputBindingDescription2EXT *bindings,
+    uint32_t num_attributes,
+    const VkVertexInputAttributeDescription2EXT *attributes);
+void pgraph_vk_cmd_bind_descriptor_sets(PGRAPHVkState *r,
+                                        VkPipelineLayout layout,
+                                        uint32_t num_sets,
+                                        const VkDescriptorSet *sets,
+                                        uint32_t num_offsets,
+                                        const uint32_t *offsets);
+void pgraph_vk_cmd_bind_vertex_buffers(PGRAPHVkState *r, uint32_t count,
+                                       const VkBuffer *buffers,
+                                       const VkDeviceSize *offsets);
+void pgraph_vk_cmd_bind_index_buffer(PGRAPHVkState *r, VkBuffer buffer,
+                                     VkDeviceSize offset, VkIndexType type);
+void pgraph_vk_cmd_push_constants(PGRAPHVkState *r, VkPipelineLayout layout,
+                                  VkShaderStageFlags stages, uint32_t offset,
+                                  uint32_t size, const void *data);
+void pgraph_vk_cmd_draw(PGRAPHVkState *r, uint32_t vertex_count,
+                        uint32_t instance_count, uint32_t first_vertex,
+                        uint32_t first_instance);
+void pgraph_vk_cmd_draw_multi(PGRAPHVkState *r, uint32_t count,
+                              const VkMultiDrawInfoEXT *draws);
+void pgraph_vk_cmd_draw_indexed(PGRAPHVkState *r, uint32_t index_count,
+                                uint32_t instance_count, uint32_t first_index,
+                                int32_t vertex_offset, uint32_t first_instance);
+void pgraph_vk_cmd_clear_attachments(PGRAPHVkState *r,
+                                     uint32_t num_attachments,
+                                     const VkClearAttachment *attachments,
+                                     const VkClearRect *rect);
 
 // image.c
 void pgraph_vk_transition_image_layout(PGRAPHState *pg, VkCommandBuffer cmd,
                                        VkImage image, VkFormat format,
                                        VkImageLayout oldLayout,
                                        VkImageLayout newLayout);
+bool pgraph_vk_format_has_stencil_component(VkFormat format);
 
 // vertex.c
+void pgraph_vk_init_vertex_formats(PGRAPHState *pg);
 void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
                                       unsigned int max_element,
                                       bool inline_data,
@@ -501,6 +1187,9 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
 void pgraph_vk_bind_vertex_attributes_inline(NV2AState *d);
 void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset, void *data,
                                     VkDeviceSize size);
+bool pgraph_vk_vertex_ram_range_is_versioned(PGRAPHVkState *r, hwaddr addr,
+                                             VkDeviceSize size);
+void pgraph_vk_release_vertex_ram_versions(PGRAPHState *pg);
 VkDeviceSize pgraph_vk_update_index_buffer(PGRAPHState *pg, void *data,
                                            VkDeviceSize size);
 VkDeviceSize pgraph_vk_update_vertex_inline_buffer(PGRAPHState *pg, void **data,
@@ -510,9 +1199,11 @@ VkDeviceSize pgraph_vk_update_vertex_inline_buffer(PGRAPHState *pg, void **data,
 // surface.c
 void pgraph_vk_init_surfaces(PGRAPHState *pg);
 void pgraph_vk_finalize_surfaces(PGRAPHState *pg);
-void pgraph_vk_surface_flush(NV2AState *d);
+void pgraph_vk_surface_flush(NV2AState *d, bool discard);
 void pgraph_vk_process_pending_downloads(NV2AState *d);
 void pgraph_vk_surface_download_if_dirty(NV2AState *d, SurfaceBinding *surface);
+void pgraph_vk_surface_update_access_callback(NV2AState *d,
+                                              SurfaceBinding *surface);
 SurfaceBinding *pgraph_vk_surface_get_within(NV2AState *d, hwaddr addr);
 void pgraph_vk_wait_for_surface_download(SurfaceBinding *e);
 void pgraph_vk_download_dirty_surfaces(NV2AState *d);
@@ -526,18 +1217,47 @@ void pgraph_vk_set_surface_dirty(PGRAPHState *pg, bool color, bool zeta);
 void pgraph_vk_set_surface_scale_factor(NV2AState *d, unsigned int scale);
 unsigned int pgraph_vk_get_surface_scale_factor(NV2AState *d);
 void pgraph_vk_reload_surface_scale_factor(PGRAPHState *pg);
+void pgraph_vk_rescale_surfaces(NV2AState *d, unsigned int scale);
+void pgraph_vk_process_pending_surface_rescale(NV2AState *d);
+void pgraph_vk_update_dynamic_surface_scale(NV2AState *d);
+bool pgraph_vk_frame_skip_draw(PGRAPHState *pg);
+bool pgraph_vk_trim_surfaces(NV2AState *d, VkDeviceSize *heap_excess);
+void pgraph_vk_record_surface_readbacks(PGRAPHState *pg);
+void pgraph_vk_defragment_surfaces(NV2AState *d);
+
+// surface-profile.c
+void pgraph_vk_init_surface_profile(PGRAPHState *pg);
+void pgraph_vk_finalize_surface_profile(PGRAPHState *pg);
+void pgraph_vk_surface_profile_update_title(PGRAPHVkState *r);
+void pgraph_vk_surface_profile_record(PGRAPHVkState *r,
+                                      const SurfaceBinding *surface, bool read);
+bool pgraph_vk_surface_profile_should_skip_download(
+    PGRAPHVkState *r, const SurfaceBinding *surface);
 
 // surface-compute.c
 void pgraph_vk_init_compute(PGRAPHState *pg);
 bool pgraph_vk_compute_needs_finish(PGRAPHVkState *r);
-void pgraph_vk_compute_finish_complete(PGRAPHVkState *r);
 void pgraph_vk_finalize_compute(PGRAPHState *pg);
 void pgraph_vk_pack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
                                   VkCommandBuffer cmd, VkBuffer src,
-                                  VkBuffer dst, bool downscale);
+                                  VkBuffer dst, bool downscale, bool swizzle);
 void pgraph_vk_unpack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
                                     VkCommandBuffer cmd, VkBuffer src,
-                                    VkBuffer dst);
+                                    VkBuffer dst, bool swizzle);
+bool pgraph_vk_check_surface_swizzle_supported(PGRAPHVkState *r,
+                                               SurfaceBinding *surface);
+void pgraph_vk_swizzle_surface(PGRAPHState *pg, SurfaceBinding *surface,
+                               VkCommandBuffer cmd, VkBuffer src, VkBuffer dst,
+                               bool unswizzle);
+size_t pgraph_vk_get_texture_decode_output_size(
+    TextureDecodeKernel kernel, const TextureDecodeRegion *region);
+bool pgraph_vk_decode_texture(PGRAPHState *pg, VkCommandBuffer cmd,
+                              TextureDecodeKernel kernel, VkBuffer src,
+                              size_t src_size, size_t palette_offset,
+                              size_t palette_size, VkBuffer dst,
+                              size_t dst_size,
+                              const TextureDecodeRegion *regions,
+                              int num_regions);
 
 // display.c
 void pgraph_vk_init_display(PGRAPHState *pg);
@@ -545,19 +1265,100 @@ void pgraph_vk_finalize_display(PGRAPHState *pg);
 void pgraph_vk_render_display(PGRAPHState *pg);
 bool pgraph_vk_gl_external_memory_available(void);
 
+// swapchain.c
+void pgraph_vk_init_swapchain(PGRAPHState *pg);
+void pgraph_vk_finalize_swapchain(PGRAPHState *pg);
+bool pgraph_vk_present_frame(NV2AState *d, const NV2APresentRequest *req);
+void pgraph_vk_present_surface_lost(NV2AState *d);
+void pgraph_vk_process_pending_present(NV2AState *d);
+
 // texture.c
 void pgraph_vk_init_textures(PGRAPHState *pg);
 void pgraph_vk_finalize_textures(PGRAPHState *pg);
 void pgraph_vk_bind_textures(NV2AState *d);
 void pgraph_vk_mark_textures_possibly_dirty(NV2AState *d, hwaddr addr,
                                             hwaddr size);
-void pgraph_vk_trim_texture_cache(PGRAPHState *pg);
+bool pgraph_vk_trim_texture_cache(PGRAPHState *pg, VkDeviceSize *heap_excess);
+void pgraph_vk_release_surface_texture_aliases(PGRAPHState *pg, VkImage image);
 
 // shaders.c
 void pgraph_vk_init_shaders(PGRAPHState *pg);
 void pgraph_vk_finalize_shaders(PGRAPHState *pg);
 void pgraph_vk_update_descriptor_sets(PGRAPHState *pg);
+int pgraph_vk_bindless_add_view(PGRAPHVkState *r, VkImageView image_view,
+                                VkSampler sampler,
+                                enum PshBindlessSamplerType type);
+void pgraph_vk_bindless_remove_view(PGRAPHVkState *r, int slot);
+void pgraph_vk_bindless_add_texture(PGRAPHVkState *r, TextureBinding *binding,
+                                    enum PshBindlessSamplerType type);
+void pgraph_vk_bindless_remove_texture(PGRAPHVkState *r,
+                                       TextureBinding *binding);
 void pgraph_vk_bind_shaders(PGRAPHState *pg);
+void pgraph_vk_shader_write_cache_reload_list(PGRAPHState *pg);
+ShaderBinding *pgraph_vk_get_shader_binding(PGRAPHState *pg,
+                                            const ShaderState *state);
+
+// texture-disk-cache.c
+void pgraph_vk_init_texture_disk_cache(PGRAPHState *pg);
+void pgraph_vk_finalize_texture_disk_cache(PGRAPHState *pg);
+GMappedFile *pgraph_vk_texture_disk_cache_lookup(PGRAPHVkState *r,
+                                                 const TextureDiskCacheKey *key,
+                                                 const uint8_t **payload,
+                                                 size_t *payload_size);
+GByteArray *
+pgraph_vk_texture_disk_cache_begin_store(const TextureDiskCacheKey *key);
+void pgraph_vk_texture_disk_cache_store(PGRAPHVkState *r,
+                                        const TextureDiskCacheKey *key,
+                                        GByteArray *data);
+
+// texture-replacement.c
+void pgraph_vk_init_texture_replacement(PGRAPHState *pg);
+void pgraph_vk_finalize_texture_replacement(PGRAPHState *pg);
+void pgraph_vk_request_texture_replacement(PGRAPHState *pg,
+                                           TextureBinding *binding);
+bool pgraph_vk_process_texture_replacements(PGRAPHState *pg);
+void pgraph_vk_release_texture_replacement(PGRAPHVkState *r,
+                                           TextureBinding *binding);
+
+static inline bool pgraph_vk_is_texture_replaced(const TextureBinding *binding)
+{
+    return binding->replacement &&
+           binding->replacement->content_hash == binding->hash;
+}
+
+static inline VkImageView pgraph_vk_get_texture_view(
+    const TextureBinding *binding)
+{
+    return pgraph_vk_is_texture_replaced(binding) ?
+               binding->replacement->image_view :
+               binding->image_view;
+}
+
+static inline int pgraph_vk_get_texture_bindless_slot(
+    const TextureBinding *binding)
+{
+    return pgraph_vk_is_texture_replaced(binding) &&
+                   binding->replacement->bindless_slot >= 0 ?
+               binding->replacement->bindless_slot :
+               binding->bindless_slot;
+}
+
+// trace.c
+void pgraph_vk_init_shader_trace(PGRAPHState *pg);
+void pgraph_vk_finalize_shader_trace(PGRAPHState *pg);
+void pgraph_vk_trace_shader_state(PGRAPHVkState *r, const ShaderState *state);
+void pgraph_vk_trace_pipeline(PGRAPHVkState *r, const PipelineKey *key);
+
+// gpu-timer.c
+void pgraph_vk_init_gpu_timer(PGRAPHState *pg);
+void pgraph_vk_finalize_gpu_timer(PGRAPHState *pg);
+void pgraph_vk_gpu_timer_reset(PGRAPHVkState *r, VkCommandBuffer cmd);
+int pgraph_vk_gpu_timer_begin(PGRAPHVkState *r, VkCommandBuffer cmd,
+                              enum NV2A_PROF_GPU_TIMERS_ENUM timer);
+void pgraph_vk_gpu_timer_end(PGRAPHVkState *r, VkCommandBuffer cmd,
+                             int query);
+void pgraph_vk_gpu_timer_frame_retired(PGRAPHVkState *r, int frame_index);
+void pgraph_vk_gpu_timer_aux_complete(PGRAPHVkState *r);
 
 // reports.c
 void pgraph_vk_init_reports(PGRAPHState *pg);
@@ -566,6 +1367,8 @@ void pgraph_vk_clear_report_value(NV2AState *d);
 void pgraph_vk_get_report(NV2AState *d, uint32_t parameter);
 void pgraph_vk_process_pending_reports(NV2AState *d);
 void pgraph_vk_process_pending_reports_internal(NV2AState *d);
+void pgraph_vk_reports_frame_submitted(PGRAPHVkState *r, FrameInFlight *frame);
+void pgraph_vk_reports_frame_retired(PGRAPHVkState *r, FrameInFlight *frame);
 
 typedef enum FinishReason {
     VK_FINISH_REASON_VERTEX_BUFFER_DIRTY,
@@ -579,9 +1382,22 @@ typedef enum FinishReason {
     VK_FINISH_REASON_STALLED,
 } FinishReason;
 
+typedef enum RenderPassEndReason {
+    VK_RENDER_PASS_END_FINISH,
+    VK_RENDER_PASS_END_SURFACE_CHANGE,
+    VK_RENDER_PASS_END_FRAMEBUFFER_CHANGE,
+    VK_RENDER_PASS_END_QUERY,
+    VK_RENDER_PASS_END_TRANSFER,
+} RenderPassEndReason;
+
 // draw.c
 void pgraph_vk_init_pipelines(PGRAPHState *pg);
 void pgraph_vk_finalize_pipelines(PGRAPHState *pg);
+void pgraph_vk_write_pipeline_cache(PGRAPHState *pg);
+void pgraph_vk_prewarm_pipeline(PGRAPHState *pg, const PipelineKey *key);
+void pgraph_vk_destroy_pipeline_libraries(PGRAPHVkState *r,
+                                          ShaderBinding *binding);
+void pgraph_vk_trim_pipeline_cache(PGRAPHState *pg, bool all);
 void pgraph_vk_clear_surface(NV2AState *d, uint32_t parameter);
 void pgraph_vk_draw_begin(NV2AState *d);
 void pgraph_vk_draw_end(NV2AState *d);
@@ -589,7 +1405,12 @@ void pgraph_vk_finish(PGRAPHState *pg, FinishReason why);
 void pgraph_vk_flush_draw(NV2AState *d);
 void pgraph_vk_begin_command_buffer(PGRAPHState *pg);
 void pgraph_vk_ensure_command_buffer(PGRAPHState *pg);
-void pgraph_vk_ensure_not_in_render_pass(PGRAPHState *pg);
+void pgraph_vk_ensure_not_in_render_pass(PGRAPHState *pg,
+                                         RenderPassEndReason why);
+void pgraph_vk_cmd_begin_render_pass(PGRAPHVkState *r, VkCommandBuffer cmd,
+                                     const RenderPassBegin *begin,
+                                     bool secondary_contents);
+void pgraph_vk_cmd_end_render_pass(PGRAPHVkState *r, VkCommandBuffer cmd);
 
 VkCommandBuffer pgraph_vk_begin_nondraw_commands(PGRAPHState *pg);
 void pgraph_vk_end_nondraw_commands(PGRAPHState *pg, VkCommandBuffer cmd);
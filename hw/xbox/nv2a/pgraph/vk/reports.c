@@ -19,104 +19,120 @@
 
 #include "renderer.h"
 
+/*
+ * Each frame in flight has its own occlusion query pool. Reports requested
+ * while a frame is recorded are handed to the frame when it is submitted,
+ * and written back once it is retired and its query results are available,
+ * so presenting doesn't have to wait for them. The pusher only waits for
+ * outstanding reports when it runs out of work, which is when the guest may
+ * be spinning on one.
+ */
+
 void pgraph_vk_init_reports(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     QSIMPLEQ_INIT(&r->report_queue);
+    QSIMPLEQ_INIT(&r->report_free_list);
     r->num_queries_in_flight = 0;
     r->max_queries_in_flight = 1024;
     r->new_query_needed = false;
     r->query_in_flight = false;
     r->zpass_pixel_count_result = 0;
+    r->query_results = g_malloc_n(r->max_queries_in_flight, sizeof(uint64_t));
 
     VkQueryPoolCreateInfo pool_create_info = (VkQueryPoolCreateInfo){
         .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
         .queryType = VK_QUERY_TYPE_OCCLUSION,
         .queryCount = r->max_queries_in_flight,
     };
-    VK_CHECK(
-        vkCreateQueryPool(r->device, &pool_create_info, NULL, &r->query_pool));
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame = &r->frames[i];
+        VK_CHECK(vkCreateQueryPool(r->device, &pool_create_info, NULL,
+                                   &frame->query_pool));
+        frame->num_queries = 0;
+        QSIMPLEQ_INIT(&frame->reports);
+    }
+    r->query_pool = r->frame->query_pool;
 }
 
-void pgraph_vk_finalize_reports(PGRAPHState *pg)
+static void free_report_queue(QueryReportQueue *queue)
 {
-    PGRAPHVkState *r = pg->vk_renderer_state;
-
     QueryReport *report;
-    while ((report = QSIMPLEQ_FIRST(&r->report_queue)) != NULL) {
-        QSIMPLEQ_REMOVE_HEAD(&r->report_queue, entry);
+    while ((report = QSIMPLEQ_FIRST(queue)) != NULL) {
+        QSIMPLEQ_REMOVE_HEAD(queue, entry);
         g_free(report);
     }
-
-    vkDestroyQueryPool(r->device, r->query_pool, NULL);
 }
 
-void pgraph_vk_clear_report_value(NV2AState *d)
+void pgraph_vk_finalize_reports(PGRAPHState *pg)
 {
-    PGRAPHState *pg = &d->pgraph;
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    QueryReport *report = g_malloc(sizeof(QueryReport)); // FIXME: Pre-allocate
-    report->clear = true;
-    report->parameter = 0;
-    report->query_count = r->num_queries_in_flight;
-    QSIMPLEQ_INSERT_TAIL(&r->report_queue, report, entry);
+    free_report_queue(&r->report_queue);
+    free_report_queue(&r->report_free_list);
 
-    r->new_query_needed = true;
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        free_report_queue(&r->frames[i].reports);
+        vkDestroyQueryPool(r->device, r->frames[i].query_pool, NULL);
+    }
+
+    g_free(r->query_results);
+    r->query_results = NULL;
 }
 
-void pgraph_vk_get_report(NV2AState *d, uint32_t parameter)
+static void queue_report(NV2AState *d, bool clear, uint32_t parameter)
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    uint8_t type = GET_MASK(parameter, NV097_GET_REPORT_TYPE);
-    assert(type == NV097_GET_REPORT_TYPE_ZPASS_PIXEL_CNT);
+    QueryReport *report = QSIMPLEQ_FIRST(&r->report_free_list);
+    if (report) {
+        QSIMPLEQ_REMOVE_HEAD(&r->report_free_list, entry);
+    } else {
+        report = g_malloc(sizeof(QueryReport));
+    }
 
-    QueryReport *report = g_malloc(sizeof(QueryReport)); // FIXME: Pre-allocate
-    report->clear = false;
+    report->clear = clear;
     report->parameter = parameter;
+    report->dma_report = pg->dma_report;
     report->query_count = r->num_queries_in_flight;
     QSIMPLEQ_INSERT_TAIL(&r->report_queue, report, entry);
 
     r->new_query_needed = true;
 }
 
-void pgraph_vk_process_pending_reports_internal(NV2AState *d)
+void pgraph_vk_clear_report_value(NV2AState *d)
 {
-    PGRAPHState *pg = &d->pgraph;
-    PGRAPHVkState *r = pg->vk_renderer_state;
+    queue_report(d, true, 0);
+}
 
-    NV2A_VK_DGROUP_BEGIN("Processing queries");
+void pgraph_vk_get_report(NV2AState *d, uint32_t parameter)
+{
+    uint8_t type = GET_MASK(parameter, NV097_GET_REPORT_TYPE);
+    assert(type == NV097_GET_REPORT_TYPE_ZPASS_PIXEL_CNT);
 
-    assert(!r->in_command_buffer);
+    queue_report(d, false, parameter);
+}
 
-    // Fetch all query results
-    g_autofree uint64_t *query_results = NULL;
-
-    if (r->num_queries_in_flight > 0) {
-        size_t size_of_results = r->num_queries_in_flight * sizeof(uint64_t);
-        query_results = g_malloc_n(r->num_queries_in_flight,
-                                   sizeof(uint64_t)); // FIXME: Pre-allocate
-        VkResult result;
-        do {
-            result = vkGetQueryPoolResults(
-                r->device, r->query_pool, 0, r->num_queries_in_flight,
-                size_of_results, query_results, sizeof(uint64_t),
-                VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
-        } while (result == VK_NOT_READY);
-    }
+/*
+ * Accumulate query results in order, writing out each report once the
+ * queries recorded before it have been counted.
+ */
+static void write_reports(NV2AState *d, QueryReportQueue *queue,
+                          const uint64_t *query_results, int num_results)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
 
-    // Write out queries
     int num_results_counted = 0;
     const int result_divisor =
         pg->surface_scale_factor * pg->surface_scale_factor;
 
     QueryReport *report;
-    while ((report = QSIMPLEQ_FIRST(&r->report_queue)) != NULL) {
+    while ((report = QSIMPLEQ_FIRST(queue)) != NULL) {
         assert(report->query_count >= num_results_counted);
-        assert(report->query_count <= r->num_queries_in_flight);
+        assert(report->query_count <= num_results);
 
         while (num_results_counted < report->query_count) {
             r->zpass_pixel_count_result +=
@@ -128,23 +144,82 @@ void pgraph_vk_process_pending_reports_internal(NV2AState *d)
             r->zpass_pixel_count_result = 0;
         } else {
             pgraph_write_zpass_pixel_cnt_report(
-                d, report->parameter,
+                d, report->dma_report, report->parameter,
                 r->zpass_pixel_count_result / result_divisor);
         }
 
-        QSIMPLEQ_REMOVE_HEAD(&r->report_queue, entry);
-        g_free(report);
+        QSIMPLEQ_REMOVE_HEAD(queue, entry);
+        QSIMPLEQ_INSERT_HEAD(&r->report_free_list, report, entry);
     }
 
     // Add remaining results
-    while (num_results_counted < r->num_queries_in_flight) {
+    while (num_results_counted < num_results) {
         r->zpass_pixel_count_result += query_results[num_results_counted++];
     }
+}
 
+void pgraph_vk_reports_frame_submitted(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    assert(!r->query_in_flight);
+    assert(frame->num_queries == 0 && QSIMPLEQ_EMPTY(&frame->reports));
+
+    frame->num_queries = r->num_queries_in_flight;
+    QSIMPLEQ_CONCAT(&frame->reports, &r->report_queue);
     r->num_queries_in_flight = 0;
+}
+
+/*
+ * Called once the frame's fence has signaled, so its query results are
+ * available without waiting.
+ */
+void pgraph_vk_reports_frame_retired(PGRAPHVkState *r, FrameInFlight *frame)
+{
+    if (frame->num_queries == 0 && QSIMPLEQ_EMPTY(&frame->reports)) {
+        return;
+    }
+
+    NV2A_VK_DGROUP_BEGIN("Processing queries");
+
+    if (frame->num_queries > 0) {
+        VK_CHECK(vkGetQueryPoolResults(
+            r->device, frame->query_pool, 0, frame->num_queries,
+            frame->num_queries * sizeof(uint64_t), r->query_results,
+            sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    }
+    write_reports(g_nv2a, &frame->reports, r->query_results,
+                  frame->num_queries);
+    frame->num_queries = 0;
+
     NV2A_VK_DGROUP_END();
 }
 
+/*
+ * Write reports requested while no command buffer was being recorded. Called
+ * once all frames have been retired.
+ */
+void pgraph_vk_process_pending_reports_internal(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    assert(!r->in_command_buffer);
+    assert(r->num_queries_in_flight == 0);
+
+    write_reports(d, &r->report_queue, NULL, 0);
+}
+
+static bool frames_have_pending_reports(PGRAPHVkState *r)
+{
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        if (r->frames[i].in_flight && !QSIMPLEQ_EMPTY(&r->frames[i].reports)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void pgraph_vk_process_pending_reports(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -153,7 +228,13 @@ void pgraph_vk_process_pending_reports(NV2AState *d)
     uint32_t *dma_get = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET];
     uint32_t *dma_put = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT];
 
-    if (*dma_get == *dma_put && r->in_command_buffer) {
+    bool reports_pending = !QSIMPLEQ_EMPTY(&r->report_queue) ||
+                           frames_have_pending_reports(r);
+
+    if (*dma_get == *dma_put &&
+        (r->in_command_buffer || reports_pending)) {
         pgraph_vk_finish(pg, VK_FINISH_REASON_STALLED);
+    } else if (reports_pending) {
+        pgraph_vk_retire_completed_frames(r);
     }
 }
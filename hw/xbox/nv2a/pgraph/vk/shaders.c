@@ -20,11 +20,14 @@
 #include "qemu/osdep.h"
 #include "qemu/fast-hash.h"
 #include "qemu/mstring.h"
+#include "xemu-version.h"
+#include "ui/xemu-settings.h"
 #include "renderer.h"
 
 #define VSH_UBO_BINDING 0
 #define PSH_UBO_BINDING 1
 #define PSH_TEX_BINDING 2
+#define BINDLESS_SET 1
 
 const size_t MAX_UNIFORM_ATTR_VALUES_SIZE = NV2A_VERTEXSHADER_ATTRIBUTES * 4 * sizeof(float);
 
@@ -32,11 +35,11 @@ static void create_descriptor_pool(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    size_t num_sets = ARRAY_SIZE(r->descriptor_sets);
+    size_t num_sets = MAX_DESCRIPTOR_SETS_PER_FRAME * NUM_FRAMES_IN_FLIGHT;
 
     VkDescriptorPoolSize pool_sizes[] = {
         {
-            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
             .descriptorCount = 2 * num_sets,
         },
         {
@@ -49,7 +52,7 @@ static void create_descriptor_pool(PGRAPHState *pg)
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
         .poolSizeCount = ARRAY_SIZE(pool_sizes),
         .pPoolSizes = pool_sizes,
-        .maxSets = ARRAY_SIZE(r->descriptor_sets),
+        .maxSets = num_sets,
         .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
     };
     VK_CHECK(vkCreateDescriptorPool(r->device, &pool_info, NULL,
@@ -73,13 +76,13 @@ static void create_descriptor_set_layout(PGRAPHState *pg)
     bindings[0] = (VkDescriptorSetLayoutBinding){
         .binding = VSH_UBO_BINDING,
         .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
     };
     bindings[1] = (VkDescriptorSetLayoutBinding){
         .binding = PSH_UBO_BINDING,
         .descriptorCount = 1,
-        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
         .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
     };
     for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
@@ -92,7 +95,8 @@ static void create_descriptor_set_layout(PGRAPHState *pg)
     }
     VkDescriptorSetLayoutCreateInfo layout_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
-        .bindingCount = ARRAY_SIZE(bindings),
+        // Textures are in the bindless set instead
+        .bindingCount = r->bindless.enabled ? 2 : ARRAY_SIZE(bindings),
         .pBindings = bindings,
     };
     VK_CHECK(vkCreateDescriptorSetLayout(r->device, &layout_info, NULL,
@@ -111,7 +115,7 @@ static void create_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    VkDescriptorSetLayout layouts[ARRAY_SIZE(r->descriptor_sets)];
+    VkDescriptorSetLayout layouts[MAX_DESCRIPTOR_SETS_PER_FRAME];
     for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
         layouts[i] = r->descriptor_set_layout;
     }
@@ -119,34 +123,212 @@ static void create_descriptor_sets(PGRAPHState *pg)
     VkDescriptorSetAllocateInfo alloc_info = {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
         .descriptorPool = r->descriptor_pool,
-        .descriptorSetCount = ARRAY_SIZE(r->descriptor_sets),
+        .descriptorSetCount = ARRAY_SIZE(layouts),
         .pSetLayouts = layouts,
     };
-    VK_CHECK(
-        vkAllocateDescriptorSets(r->device, &alloc_info, r->descriptor_sets));
+
+    // Each in-flight frame writes its own sets
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        VK_CHECK(vkAllocateDescriptorSets(r->device, &alloc_info,
+                                          r->frames[i].descriptor_sets));
+    }
 }
 
 static void destroy_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    vkFreeDescriptorSets(r->device, r->descriptor_pool,
-                         ARRAY_SIZE(r->descriptor_sets), r->descriptor_sets);
-    for (int i = 0; i < ARRAY_SIZE(r->descriptor_sets); i++) {
-        r->descriptor_sets[i] = VK_NULL_HANDLE;
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame = &r->frames[i];
+        vkFreeDescriptorSets(r->device, r->descriptor_pool,
+                             ARRAY_SIZE(frame->descriptor_sets),
+                             frame->descriptor_sets);
+        for (int j = 0; j < ARRAY_SIZE(frame->descriptor_sets); j++) {
+            frame->descriptor_sets[j] = VK_NULL_HANDLE;
+        }
+    }
+}
+
+static void create_bindless_descriptor_set(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->bindless.enabled) {
+        return;
+    }
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = PSH_BINDLESS_SAMPLER__COUNT * MAX_BINDLESS_TEXTURES,
+    };
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+        .maxSets = 1,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT,
+    };
+    VK_CHECK(vkCreateDescriptorPool(r->device, &pool_info, NULL,
+                                    &r->bindless.descriptor_pool));
+
+    VkDescriptorSetLayoutBinding bindings[PSH_BINDLESS_SAMPLER__COUNT];
+    VkDescriptorBindingFlagsEXT binding_flags[PSH_BINDLESS_SAMPLER__COUNT];
+    for (int i = 0; i < PSH_BINDLESS_SAMPLER__COUNT; i++) {
+        bindings[i] = (VkDescriptorSetLayoutBinding){
+            .binding = i,
+            .descriptorCount = MAX_BINDLESS_TEXTURES,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        };
+        // A slot is only written in the array matching its texture's type
+        binding_flags[i] =
+            VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+            VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+            VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+    }
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_info = {
+        .sType =
+            VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT,
+        .bindingCount = ARRAY_SIZE(binding_flags),
+        .pBindingFlags = binding_flags,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT,
+        .bindingCount = ARRAY_SIZE(bindings),
+        .pBindings = bindings,
+        .pNext = &binding_flags_info,
+    };
+    VK_CHECK(vkCreateDescriptorSetLayout(r->device, &layout_info, NULL,
+                                         &r->bindless.descriptor_set_layout));
+
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = r->bindless.descriptor_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = &r->bindless.descriptor_set_layout,
+    };
+    VK_CHECK(vkAllocateDescriptorSets(r->device, &alloc_info,
+                                      &r->bindless.descriptor_set));
+
+    // Handed out from the end, so the lowest slots are used first
+    r->bindless.free_slots = g_array_sized_new(FALSE, FALSE, sizeof(int),
+                                               MAX_BINDLESS_TEXTURES);
+    for (int i = MAX_BINDLESS_TEXTURES - 1; i >= 0; i--) {
+        g_array_append_val(r->bindless.free_slots, i);
+    }
+}
+
+static void destroy_bindless_descriptor_set(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!r->bindless.enabled) {
+        return;
     }
+
+    assert(r->bindless.free_slots->len == MAX_BINDLESS_TEXTURES);
+    g_array_free(r->bindless.free_slots, TRUE);
+    r->bindless.free_slots = NULL;
+
+    // Freed along with the pool
+    r->bindless.descriptor_set = VK_NULL_HANDLE;
+    vkDestroyDescriptorSetLayout(r->device, r->bindless.descriptor_set_layout,
+                                 NULL);
+    r->bindless.descriptor_set_layout = VK_NULL_HANDLE;
+    vkDestroyDescriptorPool(r->device, r->bindless.descriptor_pool, NULL);
+    r->bindless.descriptor_pool = VK_NULL_HANDLE;
+}
+
+/*
+ * Take a slot in the bindless arrays and write the descriptor of a view into
+ * it. Returns -1 if every slot is taken.
+ */
+int pgraph_vk_bindless_add_view(PGRAPHVkState *r, VkImageView image_view,
+                                VkSampler sampler,
+                                enum PshBindlessSamplerType type)
+{
+    GArray *free_slots = r->bindless.free_slots;
+    if (!free_slots->len) {
+        return -1;
+    }
+    int slot = g_array_index(free_slots, int, free_slots->len - 1);
+    g_array_set_size(free_slots, free_slots->len - 1);
+
+    VkDescriptorImageInfo image_info = {
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .imageView = image_view,
+        .sampler = sampler,
+    };
+    VkWriteDescriptorSet descriptor_write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = r->bindless.descriptor_set,
+        .dstBinding = type,
+        .dstArrayElement = slot,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(r->device, 1, &descriptor_write, 0, NULL);
+    nv2a_profile_inc_counter(NV2A_PROF_DESCRIPTOR_SET_WRITE);
+
+    return slot;
+}
+
+/* Return a slot no pending command buffer uses anymore */
+void pgraph_vk_bindless_remove_view(PGRAPHVkState *r, int slot)
+{
+    if (slot < 0) {
+        return;
+    }
+
+    g_array_append_val(r->bindless.free_slots, slot);
+}
+
+/*
+ * Give a texture a slot in the bindless arrays and write its descriptor. This
+ * is the only descriptor write for the texture until it leaves the cache.
+ */
+void pgraph_vk_bindless_add_texture(PGRAPHVkState *r, TextureBinding *binding,
+                                    enum PshBindlessSamplerType type)
+{
+    binding->bindless_slot = -1;
+
+    if (!r->bindless.enabled) {
+        return;
+    }
+
+    binding->bindless_slot = pgraph_vk_bindless_add_view(
+        r, binding->image_view, binding->sampler, type);
+    assert(binding->bindless_slot >= 0);
+}
+
+/*
+ * Return the slot of a texture leaving the cache. The texture is no longer
+ * used by any pending command buffer, so the slot can be rewritten at once.
+ */
+void pgraph_vk_bindless_remove_texture(PGRAPHVkState *r,
+                                       TextureBinding *binding)
+{
+    pgraph_vk_bindless_remove_view(r, binding->bindless_slot);
+    binding->bindless_slot = -1;
 }
 
 void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    // Uniforms are streamed every frame and bound with dynamic offsets, so
+    // only binding changes need a new descriptor set
     bool need_uniform_write =
-        r->uniforms_changed ||
-        !r->storage_buffers[BUFFER_UNIFORM_STAGING].buffer_offset;
-
-    if (!(r->shader_bindings_changed || r->texture_bindings_changed ||
-          (r->descriptor_set_index == 0) || need_uniform_write)) {
+        r->uniforms_changed || (r->descriptor_set_index == 0);
+    bool write_all_uniforms = r->descriptor_set_index == 0;
+    bool need_descriptor_write =
+        r->shader_bindings_changed ||
+        (r->texture_bindings_changed && !r->bindless.enabled) ||
+        (r->descriptor_set_index == 0);
+
+    if (!(need_descriptor_write || need_uniform_write)) {
         return; // Nothing changed
     }
 
@@ -155,28 +337,39 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
                                        &binding->psh.module_info->uniforms };
     VkDeviceSize ubo_buffer_total_size = 0;
     for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
-        ubo_buffer_total_size += layouts[i]->total_size;
+        if (!write_all_uniforms && !r->uniform_block_changed[i]) {
+            continue;
+        }
+        ubo_buffer_total_size += ROUND_UP(
+            layouts[i]->total_size,
+            r->device_props.limits.minUniformBufferOffsetAlignment);
     }
     bool need_ubo_staging_buffer_reset =
-        r->uniforms_changed &&
-        !pgraph_vk_buffer_has_space_for(pg, BUFFER_UNIFORM_STAGING,
-                                        ubo_buffer_total_size,
-                                        r->device_props.limits.minUniformBufferOffsetAlignment);
+        need_uniform_write &&
+        !pgraph_vk_buffer_reclaim_space_for(
+            pg, BUFFER_UNIFORM_STAGING, ubo_buffer_total_size,
+            r->device_props.limits.minUniformBufferOffsetAlignment);
 
     bool need_descriptor_write_reset =
-        (r->descriptor_set_index >= ARRAY_SIZE(r->descriptor_sets));
+        need_descriptor_write &&
+        (r->descriptor_set_index >= ARRAY_SIZE(r->frame->descriptor_sets));
 
     if (need_descriptor_write_reset || need_ubo_staging_buffer_reset) {
         pgraph_vk_finish(pg, VK_FINISH_REASON_NEED_BUFFER_SPACE);
         need_uniform_write = true;
+        need_descriptor_write = true;
+        write_all_uniforms = true;
     }
 
-    VkWriteDescriptorSet descriptor_writes[2 + NV2A_MAX_TEXTURES];
-
-    assert(r->descriptor_set_index < ARRAY_SIZE(r->descriptor_sets));
-
     if (need_uniform_write) {
+        // A block that didn't change is still in the staging buffer from an
+        // earlier draw this frame, so keep binding it at its old offset
         for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
+            if (!write_all_uniforms && !r->uniform_block_changed[i]) {
+                nv2a_profile_inc_counter(NV2A_PROF_SHADER_UBO_BLOCK_REUSED);
+                continue;
+            }
+            r->uniform_block_changed[i] = false;
             void *data = layouts[i]->allocation;
             VkDeviceSize size = layouts[i]->total_size;
             r->uniform_buffer_offsets[i] = pgraph_vk_append_to_buffer(
@@ -187,19 +380,58 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         r->uniforms_changed = false;
     }
 
+    if (!need_descriptor_write) {
+        return;
+    }
+
+    // Sets written earlier in the frame are still valid for reuse
+    FrameInFlight *frame = r->frame;
+    if (r->descriptor_set_index == 0) {
+        memset(frame->descriptor_set_cache, 0,
+               sizeof(frame->descriptor_set_cache));
+    }
+
+    DescriptorSetKey key;
+    memset(&key, 0, sizeof(key));
+    for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
+        key.ubo_ranges[i] = layouts[i]->total_size;
+    }
+    for (int i = 0; i < NV2A_MAX_TEXTURES && !r->bindless.enabled; i++) {
+        key.image_views[i] =
+            pgraph_vk_get_texture_view(r->texture_bindings[i]);
+        key.samplers[i] = r->texture_bindings[i]->sampler;
+    }
+
+    int *cache_entry =
+        &frame->descriptor_set_cache[fast_hash((void *)&key, sizeof(key)) %
+                                     DESCRIPTOR_SET_CACHE_SIZE];
+    if (*cache_entry &&
+        !memcmp(&frame->descriptor_set_keys[*cache_entry - 1], &key,
+                sizeof(key))) {
+        nv2a_profile_inc_counter(NV2A_PROF_DESCRIPTOR_SET_CACHE_HIT);
+        r->bound_descriptor_set = *cache_entry - 1;
+        return;
+    }
+
+    assert(r->descriptor_set_index < ARRAY_SIZE(frame->descriptor_sets));
+
+    VkDescriptorSet descriptor_set =
+        frame->descriptor_sets[r->descriptor_set_index];
+    VkWriteDescriptorSet descriptor_writes[2 + NV2A_MAX_TEXTURES];
+
     VkDescriptorBufferInfo ubo_buffer_infos[2];
     for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
         ubo_buffer_infos[i] = (VkDescriptorBufferInfo){
             .buffer = r->storage_buffers[BUFFER_UNIFORM].buffer,
-            .offset = r->uniform_buffer_offsets[i],
-            .range = layouts[i]->total_size,
+            .offset = 0,
+            .range = key.ubo_ranges[i],
         };
         descriptor_writes[i] = (VkWriteDescriptorSet){
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = r->descriptor_sets[r->descriptor_set_index],
+            .dstSet = descriptor_set,
             .dstBinding = i == 0 ? VSH_UBO_BINDING : PSH_UBO_BINDING,
             .dstArrayElement = 0,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
             .descriptorCount = 1,
             .pBufferInfo = &ubo_buffer_infos[i],
         };
@@ -209,12 +441,12 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
     for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
         image_infos[i] = (VkDescriptorImageInfo){
             .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .imageView = r->texture_bindings[i]->image_view,
-            .sampler = r->texture_bindings[i]->sampler,
+            .imageView = key.image_views[i],
+            .sampler = key.samplers[i],
         };
         descriptor_writes[2 + i] = (VkWriteDescriptorSet){
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet = r->descriptor_sets[r->descriptor_set_index],
+            .dstSet = descriptor_set,
             .dstBinding = PSH_TEX_BINDING + i,
             .dstArrayElement = 0,
             .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
@@ -223,8 +455,13 @@ void pgraph_vk_update_descriptor_sets(PGRAPHState *pg)
         };
     }
 
-    vkUpdateDescriptorSets(r->device, 6, descriptor_writes, 0, NULL);
+    vkUpdateDescriptorSets(r->device, r->bindless.enabled ? 2 : 6,
+                           descriptor_writes, 0, NULL);
+    nv2a_profile_inc_counter(NV2A_PROF_DESCRIPTOR_SET_WRITE);
 
+    frame->descriptor_set_keys[r->descriptor_set_index] = key;
+    *cache_entry = r->descriptor_set_index + 1;
+    r->bound_descriptor_set = r->descriptor_set_index;
     r->descriptor_set_index++;
 }
 
@@ -238,62 +475,638 @@ static void update_shader_uniform_locs(ShaderBinding *binding)
     for (int i = 0; i < ARRAY_SIZE(binding->psh.uniform_locs); i++) {
         binding->psh.uniform_locs[i] = uniform_index(
             &binding->psh.module_info->uniforms, PshUniformInfo[i].name);
+        binding->psh.push_constant_locs[i] = uniform_index(
+            &binding->psh.module_info->push_constants, PshUniformInfo[i].name);
     }
+
+    binding->psh.tex_index_loc = uniform_index(
+        &binding->psh.module_info->push_constants, "texIndex");
 }
 
-static ShaderModuleInfo *
-get_and_ref_shader_module_for_key(PGRAPHVkState *r,
-                                  const ShaderModuleCacheKey *key)
+static ShaderModuleCacheEntry *
+get_shader_module_cache_entry(PGRAPHVkState *r,
+                              const ShaderModuleCacheKey *key)
 {
     uint64_t hash = fast_hash((void *)key, sizeof(ShaderModuleCacheKey));
     LruNode *node = lru_lookup(&r->shader_module_cache, hash, key);
-    ShaderModuleCacheEntry *module =
-        container_of(node, ShaderModuleCacheEntry, node);
-    pgraph_vk_ref_shader_module(module->module_info);
-    return module->module_info;
+    return container_of(node, ShaderModuleCacheEntry, node);
 }
 
-static void shader_cache_entry_init(Lru *lru, LruNode *node, const void *state)
+static ShaderModuleFuture *
+begin_shader_module_compile(PGRAPHVkState *r, const ShaderModuleCacheKey *key)
 {
-    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
-    ShaderBinding *binding = container_of(node, ShaderBinding, node);
-    memcpy(&binding->state, state, sizeof(ShaderState));
+    MString *code;
 
-    NV2A_VK_DPRINTF("cache miss");
-    nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
+    switch (key->kind) {
+    case VK_SHADER_STAGE_VERTEX_BIT:
+        code = pgraph_glsl_gen_vsh(&key->vsh.state, key->vsh.glsl_opts);
+        break;
+    case VK_SHADER_STAGE_GEOMETRY_BIT:
+        // Written directly as SPIR-V unless the GLSL is wanted for debugging
+        if (!g_config.display.vulkan.debug_shaders) {
+            nv2a_profile_inc_counter(NV2A_PROF_SHADER_MODULE_GEN);
+            GByteArray *spv = pgraph_vk_gen_geom_spv(&key->geom.state);
+            ShaderModuleInfo *info =
+                pgraph_vk_create_shader_module_from_spv_data(r, spv);
+            g_byte_array_unref(spv);
+            return pgraph_vk_shader_module_future_from_info(info);
+        }
+        code = pgraph_glsl_gen_geom(&key->geom.state, key->geom.glsl_opts);
+        break;
+    case VK_SHADER_STAGE_FRAGMENT_BIT:
+        code = pgraph_glsl_gen_psh(&key->psh.state, key->psh.glsl_opts);
+        break;
+    default:
+        assert(!"Invalid shader module kind");
+        code = NULL;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SHADER_MODULE_GEN);
 
-    ShaderModuleCacheKey key;
+    ShaderModuleFuture *future = pgraph_vk_create_shader_module_from_glsl_async(
+        r, key->kind, mstring_get_str(code));
+    mstring_unref(code);
+
+    return future;
+}
+
+/*
+ * Build the module cache keys for each stage of a shader state. The geometry
+ * stage key is left zeroed if no geometry shader is needed, or if the fragment
+ * shader reads the primitive's vertex positions through barycentrics instead.
+ */
+static void get_shader_module_keys(PGRAPHVkState *r, const ShaderState *state,
+                                   ShaderModuleCacheKey keys[SHADER_STAGE_COUNT])
+{
+    memset(keys, 0, sizeof(ShaderModuleCacheKey) * SHADER_STAGE_COUNT);
 
-    bool need_geometry_shader = pgraph_glsl_need_geom(&binding->state.geom);
+    bool need_primitive_attrs = pgraph_glsl_need_geom(&state->geom);
+    bool need_geometry_shader = need_primitive_attrs && r->use_geometry_shader;
     if (need_geometry_shader) {
-        memset(&key, 0, sizeof(key));
-        key.kind = VK_SHADER_STAGE_GEOMETRY_BIT;
-        key.geom.state = binding->state.geom;
-        key.geom.glsl_opts.vulkan = true;
-        binding->geom.module_info = get_and_ref_shader_module_for_key(r, &key);
-    } else {
-        binding->geom.module_info = NULL;
+        ShaderModuleCacheKey *key = &keys[SHADER_STAGE_GEOM];
+        key->kind = VK_SHADER_STAGE_GEOMETRY_BIT;
+        key->geom.state = state->geom;
+        key->geom.glsl_opts.vulkan = true;
     }
 
-    memset(&key, 0, sizeof(key));
-    key.kind = VK_SHADER_STAGE_VERTEX_BIT;
-    key.vsh.state = binding->state.vsh;
-    key.vsh.glsl_opts.vulkan = true;
-    key.vsh.glsl_opts.prefix_outputs = need_geometry_shader;
-    key.vsh.glsl_opts.use_push_constants_for_uniform_attrs =
-        r->use_push_constants_for_uniform_attrs;
-    key.vsh.glsl_opts.ubo_binding = VSH_UBO_BINDING;
-    binding->vsh.module_info = get_and_ref_shader_module_for_key(r, &key);
+    ShaderModuleCacheKey *key = &keys[SHADER_STAGE_VSH];
+    key->kind = VK_SHADER_STAGE_VERTEX_BIT;
+    key->vsh.state = state->vsh;
+    key->vsh.glsl_opts.vulkan = true;
+    key->vsh.glsl_opts.prefix_outputs = need_geometry_shader;
+    size_t uniform_attrs_size =
+        __builtin_popcount(state->vsh.uniform_attrs) * 4 * sizeof(float);
+    key->vsh.glsl_opts.use_push_constants_for_uniform_attrs =
+        r->use_push_constants_for_uniform_attrs &&
+        (PSH_PUSH_CONSTANTS_SIZE + uniform_attrs_size <=
+         r->device_props.limits.maxPushConstantsSize);
+    key->vsh.glsl_opts.uniform_attrs_push_constant_offset =
+        PSH_PUSH_CONSTANTS_SIZE;
+    key->vsh.glsl_opts.ubo_binding = VSH_UBO_BINDING;
+
+    key = &keys[SHADER_STAGE_PSH];
+    key->kind = VK_SHADER_STAGE_FRAGMENT_BIT;
+    key->psh.state = state->psh;
+    key->psh.glsl_opts.vulkan = true;
+    key->psh.glsl_opts.use_push_constants = true;
+    key->psh.glsl_opts.ubo_binding = PSH_UBO_BINDING;
+    key->psh.glsl_opts.tex_binding = PSH_TEX_BINDING;
+    if (r->bindless.enabled) {
+        key->psh.glsl_opts.bindless_textures = true;
+        key->psh.glsl_opts.bindless_set = BINDLESS_SET;
+        key->psh.glsl_opts.bindless_array_size = MAX_BINDLESS_TEXTURES;
+    }
+    if (need_primitive_attrs && !need_geometry_shader) {
+        key->psh.glsl_opts.per_vertex_pos = true;
+        key->psh.glsl_opts.per_vertex_lines =
+            state->geom.primitive_mode == PRIM_TYPE_LINES;
+    }
+}
 
-    memset(&key, 0, sizeof(key));
-    key.kind = VK_SHADER_STAGE_FRAGMENT_BIT;
-    key.psh.state = binding->state.psh;
-    key.psh.glsl_opts.vulkan = true;
-    key.psh.glsl_opts.ubo_binding = PSH_UBO_BINDING;
-    key.psh.glsl_opts.tex_binding = PSH_TEX_BINDING;
-    binding->psh.module_info = get_and_ref_shader_module_for_key(r, &key);
+static GByteArray *shader_module_load_from_disk(const ShaderModuleCacheKey *key);
+
+static void shader_binding_init_modules(PGRAPHVkState *r,
+                                        ShaderBinding *binding)
+{
+    ShaderModuleCacheKey keys[SHADER_STAGE_COUNT];
+    get_shader_module_keys(r, &binding->state, keys);
+
+    if (!binding->cached) {
+        NV2A_VK_DPRINTF("cache miss");
+        nv2a_profile_inc_counter(NV2A_PROF_SHADER_GEN);
+    }
+
+    ShaderModuleCacheEntry *entries[SHADER_STAGE_COUNT] = { NULL };
+    ShaderModuleFuture *futures[SHADER_STAGE_COUNT] = { NULL };
+
+    // Kick off compilation of every missing stage before waiting on any
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (!keys[i].kind) {
+            continue;
+        }
+        entries[i] = get_shader_module_cache_entry(r, &keys[i]);
+        if (entries[i]->module_info) {
+            continue;
+        }
+        // Already being compiled in the background
+        if (entries[i]->future) {
+            futures[i] = entries[i]->future;
+            entries[i]->future = NULL;
+            continue;
+        }
+        // Another shader state may have left this stage in the disk cache
+        if (!binding->cached_spirv[i] && g_config.perf.cache_shaders) {
+            binding->cached_spirv[i] = shader_module_load_from_disk(&keys[i]);
+        }
+        if (binding->cached_spirv[i]) {
+            entries[i]->module_info =
+                pgraph_vk_create_shader_module_from_spv_data(
+                    r, binding->cached_spirv[i]);
+            entries[i]->module_info->cached = true;
+            pgraph_vk_ref_shader_module(entries[i]->module_info);
+        } else {
+            futures[i] = begin_shader_module_compile(r, &entries[i]->key);
+        }
+    }
+
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (futures[i]) {
+            entries[i]->module_info = pgraph_vk_wait_shader_module(futures[i]);
+            pgraph_vk_ref_shader_module(entries[i]->module_info);
+        }
+        if (entries[i]) {
+            pgraph_vk_ref_shader_module(entries[i]->module_info);
+        }
+    }
+
+    binding->vsh.module_info = entries[SHADER_STAGE_VSH]->module_info;
+    binding->geom.module_info = entries[SHADER_STAGE_GEOM] ?
+                                    entries[SHADER_STAGE_GEOM]->module_info :
+                                    NULL;
+    binding->psh.module_info = entries[SHADER_STAGE_PSH]->module_info;
+
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (binding->cached_spirv[i]) {
+            g_byte_array_unref(binding->cached_spirv[i]);
+            binding->cached_spirv[i] = NULL;
+        }
+    }
 
     update_shader_uniform_locs(binding);
+    binding->initialized = true;
+}
+
+// Collect a background compile of a module once it has finished
+static bool shader_module_cache_entry_ready(ShaderModuleCacheEntry *entry)
+{
+    if (entry->future) {
+        if (!pgraph_vk_shader_module_is_ready(entry->future)) {
+            return false;
+        }
+        entry->module_info = pgraph_vk_wait_shader_module(entry->future);
+        entry->future = NULL;
+        pgraph_vk_ref_shader_module(entry->module_info);
+    }
+
+    return entry->module_info != NULL;
+}
+
+/*
+ * With ubershaders enabled, a pixel shader which has to be generated is
+ * compiled in the background, and draws use the generic combiner shader for
+ * the same state until it is done. Returns false if the pixel shader can be
+ * had without waiting on a compile.
+ */
+static bool begin_background_psh_compile(PGRAPHVkState *r,
+                                         ShaderBinding *binding)
+{
+    if (!g_config.display.vulkan.ubershaders ||
+        binding->state.psh.generic_combiners) {
+        return false;
+    }
+
+    ShaderModuleCacheKey keys[SHADER_STAGE_COUNT];
+    get_shader_module_keys(r, &binding->state, keys);
+
+    ShaderModuleCacheEntry *entry =
+        get_shader_module_cache_entry(r, &keys[SHADER_STAGE_PSH]);
+    if (shader_module_cache_entry_ready(entry)) {
+        return false;
+    }
+    if (entry->future) {
+        return true;
+    }
+
+    if (!binding->cached_spirv[SHADER_STAGE_PSH] && g_config.perf.cache_shaders) {
+        binding->cached_spirv[SHADER_STAGE_PSH] =
+            shader_module_load_from_disk(&keys[SHADER_STAGE_PSH]);
+    }
+    if (binding->cached_spirv[SHADER_STAGE_PSH]) {
+        return false;
+    }
+
+    entry->future = begin_shader_module_compile(r, &entry->key);
+    nv2a_profile_inc_counter(NV2A_PROF_SHADER_ASYNC_GEN);
+
+    return true;
+}
+
+static char *shader_get_cache_directory(void)
+{
+    return g_strdup_printf("%svk_shaders", xemu_settings_get_base_path());
+}
+
+static char *shader_get_lru_cache_path(void)
+{
+    return g_strdup_printf("%svk_shader_cache_list",
+                           xemu_settings_get_base_path());
+}
+
+static char *shader_get_bin_directory(uint64_t hash)
+{
+    return g_strdup_printf("%svk_shaders/%04x", xemu_settings_get_base_path(),
+                           (uint32_t)(hash >> 48));
+}
+
+static char *shader_get_binary_path(const char *shader_bin_dir, uint64_t hash)
+{
+    uint64_t bin_mask = (uint64_t)0xffff << 48;
+    return g_strdup_printf("%s/%012" PRIx64, shader_bin_dir, hash & ~bin_mask);
+}
+
+static char *shader_get_module_directory(uint64_t hash)
+{
+    return g_strdup_printf("%svk_shaders/modules/%04x",
+                           xemu_settings_get_base_path(),
+                           (uint32_t)(hash >> 48));
+}
+
+/*
+ * Stages are cached on disk by the hash of their module key, so shader
+ * states which share a stage also share its SPIR-V. A shader state file
+ * only lists the keys of its stages.
+ *
+ * Shader cache file layout:
+ *   uint64_t             xemu version string length (including terminator)
+ *   char[]               xemu version string
+ *   ShaderState          state
+ *   ShaderModuleCacheKey keys[SHADER_STAGE_COUNT] (zeroes for unused stages)
+ *
+ * Shader module cache file layout:
+ *   uint64_t             xemu version string length (including terminator)
+ *   char[]               xemu version string
+ *   ShaderModuleCacheKey key
+ *   uint8_t[]            SPIR-V, up to the end of the file
+ */
+typedef struct ShaderCacheReader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+} ShaderCacheReader;
+
+static const void *shader_cache_read(ShaderCacheReader *rd, size_t len)
+{
+    if (len > rd->size - rd->pos) {
+        return NULL;
+    }
+    const void *ptr = rd->data + rd->pos;
+    rd->pos += len;
+    return ptr;
+}
+
+static bool shader_cache_read_version(ShaderCacheReader *rd)
+{
+    const uint64_t *version_len = shader_cache_read(rd, sizeof(uint64_t));
+    if (!version_len) {
+        return false;
+    }
+    const char *version = shader_cache_read(rd, *version_len);
+    return version && *version_len == strlen(xemu_version) + 1 &&
+           !memcmp(version, xemu_version, *version_len);
+}
+
+static void shader_cache_append_version(GByteArray *data)
+{
+    uint64_t version_len = strlen(xemu_version) + 1;
+    g_byte_array_append(data, (const guint8 *)&version_len,
+                        sizeof(version_len));
+    g_byte_array_append(data, (const guint8 *)xemu_version, version_len);
+}
+
+static GByteArray *shader_module_load_from_disk(const ShaderModuleCacheKey *key)
+{
+    uint64_t hash = fast_hash((void *)key, sizeof(*key));
+    g_autofree char *module_dir = shader_get_module_directory(hash);
+    g_autofree char *module_path = shader_get_binary_path(module_dir, hash);
+    g_autofree gchar *contents = NULL;
+    gsize contents_size;
+
+    if (!g_file_get_contents(module_path, &contents, &contents_size, NULL)) {
+        return NULL;
+    }
+
+    ShaderCacheReader rd = {
+        .data = (const uint8_t *)contents,
+        .size = contents_size,
+        .pos = 0,
+    };
+
+    if (!shader_cache_read_version(&rd)) {
+        goto error;
+    }
+    const void *file_key = shader_cache_read(&rd, sizeof(*key));
+    if (!file_key || memcmp(file_key, key, sizeof(*key)) ||
+        rd.pos == rd.size) {
+        goto error;
+    }
+
+    GByteArray *spirv = g_byte_array_sized_new(rd.size - rd.pos);
+    g_byte_array_append(spirv, rd.data + rd.pos, rd.size - rd.pos);
+    return spirv;
+
+error:
+    /* Delete the module so it won't be loaded again */
+    qemu_unlink(module_path);
+    return NULL;
+}
+
+static void shader_load_from_disk(PGRAPHVkState *r, uint64_t hash)
+{
+    g_autofree char *shader_bin_dir = shader_get_bin_directory(hash);
+    g_autofree char *shader_path =
+        shader_get_binary_path(shader_bin_dir, hash);
+    g_autofree gchar *contents = NULL;
+    gsize contents_size;
+    GByteArray *spirv[SHADER_STAGE_COUNT] = { NULL };
+
+    qemu_mutex_lock(&r->shader_cache_lock);
+    bool skip = lru_contains_hash(&r->shader_cache, hash) ||
+                !r->shader_cache.num_free;
+    qemu_mutex_unlock(&r->shader_cache_lock);
+    if (skip) {
+        return;
+    }
+
+    if (!g_file_get_contents(shader_path, &contents, &contents_size, NULL)) {
+        return;
+    }
+
+    ShaderCacheReader rd = {
+        .data = (const uint8_t *)contents,
+        .size = contents_size,
+        .pos = 0,
+    };
+
+    if (!shader_cache_read_version(&rd)) {
+        goto error;
+    }
+
+    ShaderState state;
+    const void *state_data = shader_cache_read(&rd, sizeof(state));
+    if (!state_data) {
+        goto error;
+    }
+    memcpy(&state, state_data, sizeof(state));
+    if (pgraph_glsl_hash_shader_state(&state) != hash) {
+        goto error;
+    }
+
+    ShaderModuleCacheKey keys[SHADER_STAGE_COUNT];
+    get_shader_module_keys(r, &state, keys);
+
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        const void *key = shader_cache_read(&rd, sizeof(keys[i]));
+        if (!key || memcmp(key, &keys[i], sizeof(keys[i]))) {
+            goto error;
+        }
+    }
+    if (rd.pos != rd.size) {
+        goto error;
+    }
+
+    // A missing module is compiled again once the state is used
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (keys[i].kind) {
+            spirv[i] = shader_module_load_from_disk(&keys[i]);
+            if (!spirv[i]) {
+                goto out;
+            }
+        }
+    }
+
+    qemu_mutex_lock(&r->shader_cache_lock);
+
+    /* Never evict here, the pfifo thread may be using any bound shader */
+    if (lru_contains_hash(&r->shader_cache, hash) ||
+        !r->shader_cache.num_free) {
+        qemu_mutex_unlock(&r->shader_cache_lock);
+        goto out;
+    }
+
+    LruNode *node = lru_lookup(&r->shader_cache, hash, &state);
+    ShaderBinding *binding = container_of(node, ShaderBinding, node);
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        binding->cached_spirv[i] = spirv[i];
+        spirv[i] = NULL;
+    }
+    binding->cached = true;
+
+    qemu_mutex_unlock(&r->shader_cache_lock);
+    return;
+
+error:
+    /* Delete the shader so it won't be loaded again */
+    qemu_unlink(shader_path);
+out:
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (spirv[i]) {
+            g_byte_array_unref(spirv[i]);
+        }
+    }
+}
+
+static void *shader_reload_lru_from_disk(void *arg)
+{
+    PGRAPHVkState *r = arg;
+    g_autofree char *shader_lru_path = shader_get_lru_cache_path();
+    g_autofree gchar *contents = NULL;
+    gsize contents_size;
+
+    xemu_thread_topology_register(XEMU_THREAD_BACKGROUND,
+                                  "nv2a.vk_shader_cache");
+
+    if (!g_file_get_contents(shader_lru_path, &contents, &contents_size,
+                             NULL)) {
+        return NULL;
+    }
+
+    for (gsize i = 0; i + sizeof(uint64_t) <= contents_size;
+         i += sizeof(uint64_t)) {
+        uint64_t hash;
+        memcpy(&hash, contents + i, sizeof(hash));
+        shader_load_from_disk(r, hash);
+    }
+
+    return NULL;
+}
+
+typedef struct ShaderCacheFile {
+    uint64_t hash;
+    bool module;
+    GByteArray *data;
+} ShaderCacheFile;
+
+// A shader state file, and the files of any modules not yet on disk
+typedef struct ShaderCacheWrite {
+    int num_files;
+    ShaderCacheFile files[1 + SHADER_STAGE_COUNT];
+} ShaderCacheWrite;
+
+static void *shader_write_to_disk(void *arg)
+{
+    ShaderCacheWrite *w = arg;
+
+    xemu_thread_topology_register(XEMU_THREAD_BACKGROUND,
+                                  "nv2a.vk_shader_cache_write");
+
+    // Modules are written first, so that a state is never listed before its
+    // modules can be loaded
+    for (int i = w->num_files - 1; i >= 0; i--) {
+        ShaderCacheFile *file = &w->files[i];
+        g_autofree char *shader_bin_dir =
+            file->module ? shader_get_module_directory(file->hash) :
+                           shader_get_bin_directory(file->hash);
+        g_autofree char *shader_path =
+            shader_get_binary_path(shader_bin_dir, file->hash);
+
+        qemu_mkdir(shader_bin_dir);
+
+        if (!g_file_set_contents(shader_path, (const gchar *)file->data->data,
+                                 file->data->len, NULL)) {
+            fprintf(stderr, "nv2a: Failed to write shader binary file to %s\n",
+                    shader_path);
+            qemu_unlink(shader_path);
+        }
+
+        g_byte_array_unref(file->data);
+    }
+
+    g_free(w);
+    return NULL;
+}
+
+static void shader_cache_to_disk(PGRAPHVkState *r, ShaderBinding *binding)
+{
+    ShaderModuleCacheKey keys[SHADER_STAGE_COUNT];
+    get_shader_module_keys(r, &binding->state, keys);
+
+    ShaderModuleInfo *modules[SHADER_STAGE_COUNT] = {
+        [SHADER_STAGE_VSH] = binding->vsh.module_info,
+        [SHADER_STAGE_GEOM] = binding->geom.module_info,
+        [SHADER_STAGE_PSH] = binding->psh.module_info,
+    };
+
+    ShaderCacheWrite *w = g_malloc0(sizeof(*w));
+
+    GByteArray *data = g_byte_array_new();
+    shader_cache_append_version(data);
+    g_byte_array_append(data, (const guint8 *)&binding->state,
+                        sizeof(binding->state));
+    g_byte_array_append(data, (const guint8 *)keys, sizeof(keys));
+    w->files[w->num_files++] = (ShaderCacheFile){
+        .hash = binding->node.hash,
+        .module = false,
+        .data = data,
+    };
+
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (!modules[i] || modules[i]->cached) {
+            continue;
+        }
+
+        data = g_byte_array_new();
+        shader_cache_append_version(data);
+        g_byte_array_append(data, (const guint8 *)&keys[i], sizeof(keys[i]));
+        g_byte_array_append(data, modules[i]->spirv->data,
+                            modules[i]->spirv->len);
+        w->files[w->num_files++] = (ShaderCacheFile){
+            .hash = fast_hash((void *)&keys[i], sizeof(keys[i])),
+            .module = true,
+            .data = data,
+        };
+        modules[i]->cached = true;
+    }
+
+    QemuThread thread;
+    qemu_thread_create(&thread, "nv2a.vk_shader_cache_write",
+                       shader_write_to_disk, w, QEMU_THREAD_DETACHED);
+
+    binding->cached = true;
+}
+
+static void shader_write_lru_list_entry(Lru *lru, LruNode *node, void *opaque)
+{
+    ShaderBinding *binding = container_of(node, ShaderBinding, node);
+    GByteArray *list = opaque;
+
+    if (binding->cached) {
+        g_byte_array_append(list, (const guint8 *)&node->hash,
+                            sizeof(node->hash));
+    }
+}
+
+static void shader_write_cache_reload_list(PGRAPHVkState *r)
+{
+    if (r->shader_disk_thread_started) {
+        qemu_thread_join(&r->shader_disk_thread);
+        r->shader_disk_thread_started = false;
+    }
+
+    if (!g_config.perf.cache_shaders) {
+        return;
+    }
+
+    g_autofree char *shader_lru_path = shader_get_lru_cache_path();
+    GByteArray *list = g_byte_array_new();
+
+    qemu_mutex_lock(&r->shader_cache_lock);
+    lru_visit_active(&r->shader_cache, shader_write_lru_list_entry, list);
+    qemu_mutex_unlock(&r->shader_cache_lock);
+    pgraph_merge_shader_cache_list(list, shader_lru_path,
+                                   r->shader_cache.num_nodes);
+
+    if (!g_file_set_contents(shader_lru_path, (const gchar *)list->data,
+                             list->len, NULL)) {
+        fprintf(stderr, "nv2a: Failed to write shader LRU cache list\n");
+    }
+    g_byte_array_unref(list);
+}
+
+void pgraph_vk_shader_write_cache_reload_list(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    shader_write_cache_reload_list(r);
+    pgraph_vk_write_pipeline_cache(pg);
+
+    qatomic_set(&r->shader_cache_writeback_pending, false);
+    qemu_event_set(&r->shader_cache_writeback_complete);
+}
+
+static void shader_cache_entry_init(Lru *lru, LruNode *node, const void *state)
+{
+    ShaderBinding *binding = container_of(node, ShaderBinding, node);
+    memcpy(&binding->state, state, sizeof(ShaderState));
+    binding->initialized = false;
+    binding->pending = false;
+    binding->cached = false;
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        binding->cached_spirv[i] = NULL;
+    }
+    binding->vsh.module_info = NULL;
+    binding->geom.module_info = NULL;
+    binding->psh.module_info = NULL;
+    memset(&binding->library, 0, sizeof(binding->library));
 }
 
 static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
@@ -301,6 +1114,8 @@ static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
     ShaderBinding *snode = container_of(node, ShaderBinding, node);
 
+    pgraph_vk_destroy_pipeline_libraries(r, snode);
+
     ShaderModuleInfo *modules[] = {
         snode->vsh.module_info,
         snode->geom.module_info,
@@ -311,6 +1126,24 @@ static void shader_cache_entry_post_evict(Lru *lru, LruNode *node)
             pgraph_vk_unref_shader_module(r, modules[i]);
         }
     }
+
+    for (int i = 0; i < SHADER_STAGE_COUNT; i++) {
+        if (snode->cached_spirv[i]) {
+            g_byte_array_unref(snode->cached_spirv[i]);
+            snode->cached_spirv[i] = NULL;
+        }
+    }
+    snode->initialized = false;
+    snode->pending = false;
+}
+
+static bool shader_cache_entry_pre_evict(Lru *lru, LruNode *node)
+{
+    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_cache);
+    ShaderBinding *snode = container_of(node, ShaderBinding, node);
+
+    // Still wanted once its pixel shader is ready
+    return snode != r->pending_shader_binding;
 }
 
 static bool shader_cache_entry_compare(Lru *lru, LruNode *node, const void *key)
@@ -322,35 +1155,30 @@ static bool shader_cache_entry_compare(Lru *lru, LruNode *node, const void *key)
 static void shader_module_cache_entry_init(Lru *lru, LruNode *node,
                                            const void *key)
 {
-    PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_module_cache);
     ShaderModuleCacheEntry *module =
         container_of(node, ShaderModuleCacheEntry, node);
     memcpy(&module->key, key, sizeof(ShaderModuleCacheKey));
+    module->module_info = NULL;
+    module->future = NULL;
+}
 
-    MString *code;
+static bool shader_module_cache_entry_pre_evict(Lru *lru, LruNode *node)
+{
+    ShaderModuleCacheEntry *module =
+        container_of(node, ShaderModuleCacheEntry, node);
+    return !module->future || shader_module_cache_entry_ready(module);
+}
 
-    switch (module->key.kind) {
-    case VK_SHADER_STAGE_VERTEX_BIT:
-        code = pgraph_glsl_gen_vsh(&module->key.vsh.state,
-                                   module->key.vsh.glsl_opts);
-        break;
-    case VK_SHADER_STAGE_GEOMETRY_BIT:
-        code = pgraph_glsl_gen_geom(&module->key.geom.state,
-                                    module->key.geom.glsl_opts);
-        break;
-    case VK_SHADER_STAGE_FRAGMENT_BIT:
-        code = pgraph_glsl_gen_psh(&module->key.psh.state,
-                                   module->key.psh.glsl_opts);
-        break;
-    default:
-        assert(!"Invalid shader module kind");
-        code = NULL;
+static void shader_module_cache_entry_wait(Lru *lru, LruNode *node,
+                                           void *opaque)
+{
+    ShaderModuleCacheEntry *module =
+        container_of(node, ShaderModuleCacheEntry, node);
+    if (module->future) {
+        module->module_info = pgraph_vk_wait_shader_module(module->future);
+        module->future = NULL;
+        pgraph_vk_ref_shader_module(module->module_info);
     }
-
-    module->module_info = pgraph_vk_create_shader_module_from_glsl(
-        r, module->key.kind, mstring_get_str(code));
-    pgraph_vk_ref_shader_module(module->module_info);
-    mstring_unref(code);
 }
 
 static void shader_module_cache_entry_post_evict(Lru *lru, LruNode *node)
@@ -358,8 +1186,10 @@ static void shader_module_cache_entry_post_evict(Lru *lru, LruNode *node)
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, shader_module_cache);
     ShaderModuleCacheEntry *module =
         container_of(node, ShaderModuleCacheEntry, node);
-    pgraph_vk_unref_shader_module(r, module->module_info);
-    module->module_info = NULL;
+    if (module->module_info) {
+        pgraph_vk_unref_shader_module(r, module->module_info);
+        module->module_info = NULL;
+    }
 }
 
 static bool shader_module_cache_entry_compare(Lru *lru, LruNode *node,
@@ -374,19 +1204,26 @@ static void shader_cache_init(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    const size_t shader_cache_size = 1024;
+    qemu_mutex_init(&r->shader_cache_lock);
+    qemu_event_init(&r->shader_cache_writeback_complete, false);
+
+    const size_t shader_cache_size = r->low_memory ? 256 : 1024;
     lru_init(&r->shader_cache);
     r->shader_cache_entries = g_malloc_n(shader_cache_size, sizeof(ShaderBinding));
     assert(r->shader_cache_entries != NULL);
     for (int i = 0; i < shader_cache_size; i++) {
         lru_add_free(&r->shader_cache, &r->shader_cache_entries[i].node);
     }
+    xemu_mem_account_set(xemu_mem_account("vk", "shader cache nodes"),
+                         shader_cache_size * sizeof(ShaderBinding));
     r->shader_cache.init_node = shader_cache_entry_init;
     r->shader_cache.compare_nodes = shader_cache_entry_compare;
+    r->shader_cache.pre_node_evict = shader_cache_entry_pre_evict;
     r->shader_cache.post_node_evict = shader_cache_entry_post_evict;
 
     /* FIXME: Make this configurable */
-    const size_t shader_module_cache_size = 50 * 1024;
+    const size_t shader_module_cache_size =
+        r->low_memory ? 8 * 1024 : 50 * 1024;
     lru_init(&r->shader_module_cache);
     r->shader_module_cache_entries =
         g_malloc_n(shader_module_cache_size, sizeof(ShaderModuleCacheEntry));
@@ -395,36 +1232,117 @@ static void shader_cache_init(PGRAPHState *pg)
         lru_add_free(&r->shader_module_cache,
                      &r->shader_module_cache_entries[i].node);
     }
+    xemu_mem_account_set(
+        xemu_mem_account("vk", "shader module cache nodes"),
+        shader_module_cache_size * sizeof(ShaderModuleCacheEntry));
 
     r->shader_module_cache.init_node = shader_module_cache_entry_init;
     r->shader_module_cache.compare_nodes = shader_module_cache_entry_compare;
+    r->shader_module_cache.pre_node_evict = shader_module_cache_entry_pre_evict;
     r->shader_module_cache.post_node_evict =
         shader_module_cache_entry_post_evict;
+
+    if (g_config.perf.cache_shaders) {
+        g_autofree char *cache_dir = shader_get_cache_directory();
+        qemu_mkdir(cache_dir);
+        g_autofree char *module_dir = g_strdup_printf("%s/modules", cache_dir);
+        qemu_mkdir(module_dir);
+        qemu_thread_create(&r->shader_disk_thread, "nv2a.vk_shader_cache",
+                           shader_reload_lru_from_disk, r,
+                           QEMU_THREAD_JOINABLE);
+        r->shader_disk_thread_started = true;
+    }
 }
 
 static void shader_cache_finalize(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    shader_write_cache_reload_list(r);
+
+    r->pending_shader_binding = NULL;
     lru_flush(&r->shader_cache);
+    lru_destroy(&r->shader_cache);
     g_free(r->shader_cache_entries);
     r->shader_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("vk", "shader cache nodes"), 0);
 
+    lru_visit_active(&r->shader_module_cache, shader_module_cache_entry_wait,
+                     NULL);
     lru_flush(&r->shader_module_cache);
+    lru_destroy(&r->shader_module_cache);
     g_free(r->shader_module_cache_entries);
     r->shader_module_cache_entries = NULL;
+    xemu_mem_account_set(xemu_mem_account("vk", "shader module cache nodes"),
+                         0);
+
+    qemu_mutex_destroy(&r->shader_cache_lock);
+    qemu_event_destroy(&r->shader_cache_writeback_complete);
+}
+
+// Must be called with shader_cache_lock held
+static void shader_binding_update(PGRAPHVkState *r, ShaderBinding *binding,
+                                  bool allow_pending)
+{
+    if (binding->initialized) {
+        return;
+    }
+
+    if (!binding->pending) {
+        pgraph_vk_trace_shader_state(r, &binding->state);
+    }
+
+    binding->pending =
+        allow_pending && begin_background_psh_compile(r, binding);
+    if (binding->pending) {
+        return;
+    }
+
+    shader_binding_init_modules(r, binding);
+    if (g_config.perf.cache_shaders && !binding->cached) {
+        shader_cache_to_disk(r, binding);
+    }
 }
 
 static ShaderBinding *get_shader_binding_for_state(PGRAPHVkState *r,
-                                                   const ShaderState *state)
+                                                   const ShaderState *state,
+                                                   uint64_t hash,
+                                                   bool allow_pending)
 {
-    uint64_t hash = fast_hash((void *)state, sizeof(*state));
+    qemu_mutex_lock(&r->shader_cache_lock);
+
     LruNode *node = lru_lookup(&r->shader_cache, hash, state);
     ShaderBinding *binding = container_of(node, ShaderBinding, node);
     NV2A_VK_DPRINTF("shader state hash: %016" PRIx64 " %p", hash, binding);
+    nv2a_profile_inc_counter(binding->initialized || binding->pending ?
+                                 NV2A_PROF_SHADER_CACHE_HIT :
+                                 NV2A_PROF_SHADER_CACHE_MISS);
+
+    shader_binding_update(r, binding, allow_pending);
+
+    qemu_mutex_unlock(&r->shader_cache_lock);
+
     return binding;
 }
 
+ShaderBinding *pgraph_vk_get_shader_binding(PGRAPHState *pg,
+                                            const ShaderState *state)
+{
+    return get_shader_binding_for_state(pg->vk_renderer_state, state,
+                                        pgraph_glsl_hash_shader_state(state),
+                                        false);
+}
+
+static ShaderBinding *get_generic_shader_binding(PGRAPHVkState *r,
+                                                 const ShaderBinding *binding)
+{
+    ShaderState state;
+    memcpy(&state, &binding->state, sizeof(state));
+    pgraph_glsl_set_psh_state_generic(&state.psh);
+    return get_shader_binding_for_state(
+        r, &state, pgraph_glsl_hash_shader_state(&state), false);
+}
+
 static void apply_uniform_updates(ShaderUniformLayout *layout,
                                   const UniformInfo *info, int *locs,
                                   void *values, size_t count)
@@ -437,6 +1355,32 @@ static void apply_uniform_updates(ShaderUniformLayout *layout,
     }
 }
 
+/* Copy only the constant rows written since the module last saw them */
+static void update_vsh_constants(PGRAPHState *pg, ShaderModuleInfo *module,
+                                 int loc)
+{
+    if (loc == -1 || (module->vsh_constants_valid &&
+                      module->vsh_constants_gen == pg->vsh_constants_gen)) {
+        return;
+    }
+
+    ShaderUniform *u = &module->uniforms.uniforms[loc - 1];
+    assert(u->dim_v == 4 && u->dim_a >= NV2A_VERTEXSHADER_CONSTANTS);
+    char *base = uniform_ptr(&module->uniforms, loc);
+
+    for (int row = 0; row < NV2A_VERTEXSHADER_CONSTANTS; row++) {
+        if (module->vsh_constants_valid &&
+            pg->vsh_constants_row_gen[row] <= module->vsh_constants_gen) {
+            continue;
+        }
+        memcpy(base + row * u->stride, pg->vsh_constants[row],
+               sizeof(pg->vsh_constants[row]));
+    }
+
+    module->vsh_constants_valid = true;
+    module->vsh_constants_gen = pg->vsh_constants_gen;
+}
+
 // FIXME: Dirty tracking
 static void update_shader_uniforms(PGRAPHState *pg)
 {
@@ -450,16 +1394,28 @@ static void update_shader_uniforms(PGRAPHState *pg)
     ShaderUniformLayout *layouts[] = { &binding->vsh.module_info->uniforms,
                                        &binding->psh.module_info->uniforms };
 
+    // Constants are handled separately, they are the bulk of the uniforms
+    VshUniformLocs vsh_locs;
+    memcpy(vsh_locs, binding->vsh.uniform_locs, sizeof(vsh_locs));
+    vsh_locs[VshUniform_c] = -1;
+
     VshUniformValues vsh_values;
-    pgraph_glsl_set_vsh_uniform_values(pg, &binding->state.vsh,
-                                  binding->vsh.uniform_locs, &vsh_values);
+    pgraph_glsl_set_vsh_uniform_values(pg, &binding->state.vsh, vsh_locs,
+                                       &vsh_values);
     apply_uniform_updates(&binding->vsh.module_info->uniforms, VshUniformInfo,
-                          binding->vsh.uniform_locs, &vsh_values,
-                          VshUniform__COUNT);
-
+                          vsh_locs, &vsh_values, VshUniform__COUNT);
+    update_vsh_constants(pg, binding->vsh.module_info,
+                         binding->vsh.uniform_locs[VshUniform_c]);
+
+    // Values are needed for uniforms in either block
+    PshUniformLocs psh_locs;
+    for (int i = 0; i < PshUniform__COUNT; i++) {
+        psh_locs[i] = binding->psh.push_constant_locs[i] != -1 ?
+                          binding->psh.push_constant_locs[i] :
+                          binding->psh.uniform_locs[i];
+    }
     PshUniformValues psh_values;
-    pgraph_glsl_set_psh_uniform_values(pg, binding->psh.uniform_locs,
-                                       &psh_values);
+    pgraph_glsl_set_psh_uniform_values(pg, psh_locs, &psh_values);
     for (int i = 0; i < 4; i++) {
         assert(r->texture_bindings[i] != NULL);
         float scale = r->texture_bindings[i]->key.scale;
@@ -477,11 +1433,29 @@ static void update_shader_uniforms(PGRAPHState *pg)
     apply_uniform_updates(&binding->psh.module_info->uniforms, PshUniformInfo,
                           binding->psh.uniform_locs, &psh_values,
                           PshUniform__COUNT);
+    apply_uniform_updates(&binding->psh.module_info->push_constants,
+                          PshUniformInfo, binding->psh.push_constant_locs,
+                          &psh_values, PshUniform__COUNT);
+
+    if (binding->psh.tex_index_loc != -1) {
+        uint32_t tex_index[2] = { 0, 0 };
+        for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+            int slot =
+                pgraph_vk_get_texture_bindless_slot(r->texture_bindings[i]);
+            assert(slot >= 0 && slot <= 0xffff);
+            tex_index[i / 2] |= slot << ((i % 2) * 16);
+        }
+        uniform_copy(&binding->psh.module_info->push_constants,
+                     binding->psh.tex_index_loc, tex_index, sizeof(uint32_t),
+                     2);
+    }
 
     for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
         uint64_t hash =
             fast_hash(layouts[i]->allocation, layouts[i]->total_size);
-        r->uniforms_changed |= (hash != r->uniform_buffer_hashes[i]);
+        bool changed = hash != r->uniform_buffer_hashes[i];
+        r->uniform_block_changed[i] |= changed;
+        r->uniforms_changed |= changed;
         r->uniform_buffer_hashes[i] = hash;
     }
 
@@ -500,18 +1474,44 @@ void pgraph_vk_bind_shaders(PGRAPHState *pg)
 
     r->shader_bindings_changed = false;
 
-    if (!r->shader_binding ||
-        pgraph_glsl_check_shader_state_dirty(pg, &r->shader_binding->state)) {
-        ShaderState new_state = pgraph_glsl_get_shader_state(pg);
-        if (!r->shader_binding || memcmp(&r->shader_binding->state, &new_state,
-                                         sizeof(ShaderState))) {
-            r->shader_binding = get_shader_binding_for_state(r, &new_state);
-            r->shader_bindings_changed = true;
+    ShaderBinding *binding = r->pending_shader_binding ?
+                                 r->pending_shader_binding :
+                                 r->shader_binding;
+
+    ShaderStateCache *cache = &r->shader_state_cache;
+    if (pgraph_glsl_update_shader_state(pg, cache) || !binding) {
+        if (!binding ||
+            memcmp(&binding->state, &cache->state, sizeof(ShaderState))) {
+            binding = get_shader_binding_for_state(r, &cache->state,
+                                                   cache->hash, true);
         }
     } else {
         nv2a_profile_inc_counter(NV2A_PROF_SHADER_BIND_NOTDIRTY);
     }
 
+    if (binding->pending) {
+        qemu_mutex_lock(&r->shader_cache_lock);
+        shader_binding_update(r, binding, true);
+        qemu_mutex_unlock(&r->shader_cache_lock);
+    }
+
+    if (binding->pending) {
+        nv2a_profile_inc_counter(NV2A_PROF_SHADER_PENDING);
+        if (binding != r->pending_shader_binding) {
+            r->pending_shader_binding = binding;
+            binding = get_generic_shader_binding(r, binding);
+        } else {
+            binding = r->shader_binding;
+        }
+    } else {
+        r->pending_shader_binding = NULL;
+    }
+
+    if (binding != r->shader_binding) {
+        r->shader_binding = binding;
+        r->shader_bindings_changed = true;
+    }
+
     update_shader_uniforms(pg);
 
     NV2A_VK_DGROUP_END();
@@ -525,16 +1525,20 @@ void pgraph_vk_init_shaders(PGRAPHState *pg)
     create_descriptor_pool(pg);
     create_descriptor_set_layout(pg);
     create_descriptor_sets(pg);
-    shader_cache_init(pg);
+    create_bindless_descriptor_set(pg);
 
     r->use_push_constants_for_uniform_attrs =
         (r->device_props.limits.maxPushConstantsSize >=
          MAX_UNIFORM_ATTR_VALUES_SIZE);
+
+    /* Module keys depend on use_push_constants_for_uniform_attrs */
+    shader_cache_init(pg);
 }
 
 void pgraph_vk_finalize_shaders(PGRAPHState *pg)
 {
     shader_cache_finalize(pg);
+    destroy_bindless_descriptor_set(pg);
     destroy_descriptor_sets(pg);
     destroy_descriptor_set_layout(pg);
     destroy_descriptor_pool(pg);
@@ -0,0 +1,104 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "spirv.h"
+
+// SPIR-V 1.0 is enough for what is generated here, and every device has it
+#define SPIRV_VERSION 0x00010000
+
+void spirv_builder_init(SpirvBuilder *b)
+{
+    b->bound = 1;
+    b->preamble = g_array_new(false, false, sizeof(uint32_t));
+    b->annotations = g_array_new(false, false, sizeof(uint32_t));
+    b->globals = g_array_new(false, false, sizeof(uint32_t));
+    b->code = g_array_new(false, false, sizeof(uint32_t));
+}
+
+GByteArray *spirv_builder_finish(SpirvBuilder *b)
+{
+    const uint32_t header[] = {
+        SpvMagicNumber, SPIRV_VERSION, 0, b->bound, 0,
+    };
+    GArray *sections[] = {
+        b->preamble, b->annotations, b->globals, b->code,
+    };
+
+    GByteArray *spv = g_byte_array_new();
+    g_byte_array_append(spv, (const guint8 *)header, sizeof(header));
+    for (int i = 0; i < ARRAY_SIZE(sections); i++) {
+        g_byte_array_append(spv, (const guint8 *)sections[i]->data,
+                            sections[i]->len * sizeof(uint32_t));
+        g_array_free(sections[i], true);
+    }
+    memset(b, 0, sizeof(*b));
+
+    return spv;
+}
+
+static void emit_opcode(GArray *section, SpvOp op, size_t num_words)
+{
+    assert(num_words < (1 << 16));
+    uint32_t word = ((uint32_t)num_words << SpvWordCountShift) | op;
+    g_array_append_val(section, word);
+}
+
+void spirv_emit(GArray *section, SpvOp op, const uint32_t *operands,
+                size_t num_operands)
+{
+    emit_opcode(section, op, 1 + num_operands);
+    g_array_append_vals(section, operands, num_operands);
+}
+
+/*
+ * Literal strings are nul-terminated and padded with zeros to a whole number
+ * of words, and may be followed by more operands, e.g. the interface of an
+ * OpEntryPoint.
+ */
+void spirv_emit_with_string(GArray *section, SpvOp op,
+                            const uint32_t *operands, size_t num_operands,
+                            const char *str, const uint32_t *trailing,
+                            size_t num_trailing)
+{
+    size_t str_words = strlen(str) / sizeof(uint32_t) + 1;
+
+    emit_opcode(section, op,
+                1 + num_operands + str_words + num_trailing);
+    g_array_append_vals(section, operands, num_operands);
+
+    uint32_t *words = g_new0(uint32_t, str_words);
+    memcpy(words, str, strlen(str));
+    g_array_append_vals(section, words, str_words);
+    g_free(words);
+
+    g_array_append_vals(section, trailing, num_trailing);
+}
+
+uint32_t spirv_op(SpirvBuilder *b, SpvOp op, uint32_t type,
+                  const uint32_t *operands, size_t num_operands)
+{
+    uint32_t result = spirv_id(b);
+
+    emit_opcode(b->code, op, 3 + num_operands);
+    g_array_append_val(b->code, type);
+    g_array_append_val(b->code, result);
+    g_array_append_vals(b->code, operands, num_operands);
+
+    return result;
+}
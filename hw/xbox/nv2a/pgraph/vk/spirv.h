@@ -0,0 +1,68 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_NV2A_PGRAPH_VK_SPIRV_H
+#define HW_XBOX_NV2A_PGRAPH_VK_SPIRV_H
+
+#include "qemu/osdep.h"
+#include <spirv_reflect.h>
+
+/*
+ * Minimal SPIR-V module writer for shaders generated without glslang.
+ * Instructions are appended to the section of the module they belong in, so
+ * callers may declare types and decorations while emitting function code.
+ */
+typedef struct SpirvBuilder {
+    uint32_t bound;
+    GArray *preamble;    // Capabilities through execution modes
+    GArray *annotations; // Decorations
+    GArray *globals;     // Types, constants and global variables
+    GArray *code;        // Function bodies
+} SpirvBuilder;
+
+void spirv_builder_init(SpirvBuilder *b);
+GByteArray *spirv_builder_finish(SpirvBuilder *b);
+
+static inline uint32_t spirv_id(SpirvBuilder *b)
+{
+    return b->bound++;
+}
+
+void spirv_emit(GArray *section, SpvOp op, const uint32_t *operands,
+                size_t num_operands);
+void spirv_emit_with_string(GArray *section, SpvOp op,
+                            const uint32_t *operands, size_t num_operands,
+                            const char *str, const uint32_t *trailing,
+                            size_t num_trailing);
+
+#define SPIRV_OPERANDS(...) \
+    (const uint32_t[]){ __VA_ARGS__ }, \
+    sizeof((const uint32_t[]){ __VA_ARGS__ }) / sizeof(uint32_t)
+
+#define SPIRV_EMIT(section, op, ...) \
+    spirv_emit((section), (op), SPIRV_OPERANDS(__VA_ARGS__))
+
+// Emit an instruction producing a new result id of the given type
+uint32_t spirv_op(SpirvBuilder *b, SpvOp op, uint32_t type,
+                  const uint32_t *operands, size_t num_operands);
+
+#define SPIRV_OP(b, op, type, ...) \
+    spirv_op((b), (op), (type), SPIRV_OPERANDS(__VA_ARGS__))
+
+#endif
@@ -23,14 +23,28 @@
 #include "renderer.h"
 #include <vulkan/vulkan_core.h>
 
-// TODO: Swizzle/Unswizzle
 // TODO: Float depth format (low priority, but would be better for accuracy)
 
-// FIXME: Below pipeline creation assumes identical 3 buffer setup. For
-//        swizzle shader we will need more flexibility.
+//
+// Depth-stencil kernels convert between the host depth and stencil planes and
+// the guest Z24S8 layout. When swizzled_height is non-zero the guest side
+// (output of pack, input of unpack) is swizzled at guest resolution.
+//
+const char *depth_stencil_common_glsl =
+    "layout(push_constant) uniform PushConstants {\n"
+    "    uint width_in, width_out, swizzled_height;\n"
+    "};\n"
+    // Must match generate_swizzle_masks
+    "uint get_swizzled_offset(uint x, uint y, uint width, uint height) {\n"
+    "    uint offset = 0u, bit = 0u;\n"
+    "    for (uint i = 1u; i < width || i < height; i <<= 1) {\n"
+    "        if (i < width) { offset |= ((x & i) != 0u ? 1u : 0u) << bit++; }\n"
+    "        if (i < height) { offset |= ((y & i) != 0u ? 1u : 0u) << bit++; }\n"
+    "    }\n"
+    "    return offset;\n"
+    "}\n";
 
 const char *pack_d24_unorm_s8_uint_to_z24s8_glsl =
-    "layout(push_constant) uniform PushConstants { uint width_in, width_out; };\n"
     "layout(set = 0, binding = 0) buffer DepthIn { uint depth_in[]; };\n"
     "layout(set = 0, binding = 1) buffer StencilIn { uint stencil_in[]; };\n"
     "layout(set = 0, binding = 2) buffer DepthStencilOut { uint depth_stencil_out[]; };\n"
@@ -40,16 +54,20 @@ const char *pack_d24_unorm_s8_uint_to_z24s8_glsl =
     "    uint x = (idx_out % width_out) * scale;\n"
     "    return y * width_in + x;\n"
     "}\n"
+    "uint get_output_idx(uint idx_out) {\n"
+    "    if (swizzled_height == 0u) return idx_out;\n"
+    "    return get_swizzled_offset(idx_out % width_out, idx_out / width_out,\n"
+    "                               width_out, swizzled_height);\n"
+    "}\n"
     "void main() {\n"
     "    uint idx_out = gl_GlobalInvocationID.x;\n"
     "    uint idx_in = get_input_idx(idx_out);\n"
     "    uint depth_value = depth_in[idx_in];\n"
     "    uint stencil_value = (stencil_in[idx_in / 4] >> ((idx_in % 4) * 8)) & 0xff;\n"
-    "    depth_stencil_out[idx_out] = depth_value << 8 | stencil_value;\n"
+    "    depth_stencil_out[get_output_idx(idx_out)] = depth_value << 8 | stencil_value;\n"
     "}\n";
 
 const char *unpack_z24s8_to_d24_unorm_s8_uint_glsl =
-    "layout(push_constant) uniform PushConstants { uint width_in, width_out; };\n"
     "layout(set = 0, binding = 0) buffer DepthOut { uint depth_out[]; };\n"
     "layout(set = 0, binding = 1) buffer StencilOut { uint stencil_out[]; };\n"
     "layout(set = 0, binding = 2) buffer DepthStencilIn { uint depth_stencil_in[]; };\n"
@@ -57,6 +75,9 @@ const char *unpack_z24s8_to_d24_unorm_s8_uint_glsl =
     "    uint scale = width_out / width_in;\n"
     "    uint y = (idx_out / width_out) / scale;\n"
     "    uint x = (idx_out % width_out) / scale;\n"
+    "    if (swizzled_height != 0u) {\n"
+    "        return get_swizzled_offset(x, y, width_in, swizzled_height);\n"
+    "    }\n"
     "    return y * width_in + x;\n"
     "}\n"
     "void main() {\n"
@@ -74,7 +95,6 @@ const char *unpack_z24s8_to_d24_unorm_s8_uint_glsl =
     "}\n";
 
 const char *pack_d32_sfloat_s8_uint_to_z24s8_glsl =
-    "layout(push_constant) uniform PushConstants { uint width_in, width_out; };\n"
     "layout(set = 0, binding = 0) buffer DepthIn { float depth_in[]; };\n"
     "layout(set = 0, binding = 1) buffer StencilIn { uint stencil_in[]; };\n"
     "layout(set = 0, binding = 2) buffer DepthStencilOut { uint depth_stencil_out[]; };\n"
@@ -84,16 +104,20 @@ const char *pack_d32_sfloat_s8_uint_to_z24s8_glsl =
     "    uint x = (idx_out % width_out) * scale;\n"
     "    return y * width_in + x;\n"
     "}\n"
+    "uint get_output_idx(uint idx_out) {\n"
+    "    if (swizzled_height == 0u) return idx_out;\n"
+    "    return get_swizzled_offset(idx_out % width_out, idx_out / width_out,\n"
+    "                               width_out, swizzled_height);\n"
+    "}\n"
     "void main() {\n"
     "    uint idx_out = gl_GlobalInvocationID.x;\n"
     "    uint idx_in = get_input_idx(idx_out);\n"
     "    uint depth_value = int(depth_in[idx_in] * float(0xffffff));\n"
     "    uint stencil_value = (stencil_in[idx_in / 4] >> ((idx_in % 4) * 8)) & 0xff;\n"
-    "    depth_stencil_out[idx_out] = depth_value << 8 | stencil_value;\n"
+    "    depth_stencil_out[get_output_idx(idx_out)] = depth_value << 8 | stencil_value;\n"
     "}\n";
 
 const char *unpack_z24s8_to_d32_sfloat_s8_uint_glsl =
-    "layout(push_constant) uniform PushConstants { uint width_in, width_out; };\n"
     "layout(set = 0, binding = 0) buffer DepthOut { float depth_out[]; };\n"
     "layout(set = 0, binding = 1) buffer StencilOut { uint stencil_out[]; };\n"
     "layout(set = 0, binding = 2) buffer DepthStencilIn { uint depth_stencil_in[]; };\n"
@@ -101,6 +125,9 @@ const char *unpack_z24s8_to_d32_sfloat_s8_uint_glsl =
     "    uint scale = width_out / width_in;\n"
     "    uint y = (idx_out / width_out) / scale;\n"
     "    uint x = (idx_out % width_out) / scale;\n"
+    "    if (swizzled_height != 0u) {\n"
+    "        return get_swizzled_offset(x, y, width_in, swizzled_height);\n"
+    "    }\n"
     "    return y * width_in + x;\n"
     "}\n"
     "void main() {\n"
@@ -118,6 +145,258 @@ const char *unpack_z24s8_to_d32_sfloat_s8_uint_glsl =
     "    }\n"
     "}\n";
 
+//
+// Texture decode kernels read raw guest texture data from binding 2 and write
+// host texels to binding 0. Palette entries, if any, are read from binding 1.
+// Each invocation produces one 32-bit word of output. The swizzle kernels go
+// the other way, from linear surface data to guest swizzled layout.
+//
+const char *texture_decode_common_glsl =
+    "layout(push_constant) uniform PushConstants {\n"
+    "    uint width, height, depth, in_offset, out_offset, num_units;\n"
+    "};\n"
+    "layout(set = 0, binding = 0) buffer DataOut { uint data_out[]; };\n"
+    "layout(set = 0, binding = 1) buffer PaletteIn { uint palette_in[]; };\n"
+    "layout(set = 0, binding = 2) buffer DataIn { uint data_in[]; };\n"
+    "uint read_u8(uint addr) {\n"
+    "    return (data_in[addr >> 2] >> ((addr & 3u) * 8u)) & 0xffu;\n"
+    "}\n"
+    "uint read_u16(uint addr) {\n"
+    "    return (data_in[addr >> 2] >> ((addr & 2u) * 8u)) & 0xffffu;\n"
+    "}\n"
+    // Must match generate_swizzle_masks
+    "uint get_swizzled_offset(uint idx) {\n"
+    "    uint x = idx % width;\n"
+    "    uint y = (idx / width) % height;\n"
+    "    uint z = idx / (width * height);\n"
+    "    uint offset = 0u, bit = 0u;\n"
+    "    for (uint i = 1u; i < width || i < height || i < depth; i <<= 1) {\n"
+    "        if (i < width) { offset |= ((x & i) != 0u ? 1u : 0u) << bit++; }\n"
+    "        if (i < height) { offset |= ((y & i) != 0u ? 1u : 0u) << bit++; }\n"
+    "        if (i < depth) { offset |= ((z & i) != 0u ? 1u : 0u) << bit++; }\n"
+    "    }\n"
+    "    return offset;\n"
+    "}\n"
+    // Inverse of get_swizzled_offset
+    "uint get_unswizzled_idx(uint offset) {\n"
+    "    uint x = 0u, y = 0u, z = 0u, bit = 0u;\n"
+    "    for (uint i = 1u; i < width || i < height || i < depth; i <<= 1) {\n"
+    "        if (i < width) { x |= ((offset >> bit++) & 1u) != 0u ? i : 0u; }\n"
+    "        if (i < height) { y |= ((offset >> bit++) & 1u) != 0u ? i : 0u; }\n"
+    "        if (i < depth) { z |= ((offset >> bit++) & 1u) != 0u ? i : 0u; }\n"
+    "    }\n"
+    "    return (z * height + y) * width + x;\n"
+    "}\n";
+
+const char *unswizzle_8_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint num_texels = width * height * depth;\n"
+    "    uint value = 0u;\n"
+    "    for (uint i = 0u; i < 4u; i++) {\n"
+    "        uint texel = idx * 4u + i;\n"
+    "        if (texel < num_texels) {\n"
+    "            value |= read_u8(in_offset + get_swizzled_offset(texel)) << (i * 8u);\n"
+    "        }\n"
+    "    }\n"
+    "    data_out[out_offset + idx] = value;\n"
+    "}\n";
+
+const char *unswizzle_16_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint num_texels = width * height * depth;\n"
+    "    uint value = 0u;\n"
+    "    for (uint i = 0u; i < 2u; i++) {\n"
+    "        uint texel = idx * 2u + i;\n"
+    "        if (texel < num_texels) {\n"
+    "            value |= read_u16(in_offset + get_swizzled_offset(texel) * 2u) << (i * 16u);\n"
+    "        }\n"
+    "    }\n"
+    "    data_out[out_offset + idx] = value;\n"
+    "}\n";
+
+const char *unswizzle_32_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    data_out[out_offset + idx] = data_in[in_offset / 4u + get_swizzled_offset(idx)];\n"
+    "}\n";
+
+const char *swizzle_16_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint num_texels = width * height * depth;\n"
+    "    uint value = 0u;\n"
+    "    for (uint i = 0u; i < 2u; i++) {\n"
+    "        uint offset = idx * 2u + i;\n"
+    "        if (offset < num_texels) {\n"
+    "            value |= read_u16(in_offset + get_unswizzled_idx(offset) * 2u) << (i * 16u);\n"
+    "        }\n"
+    "    }\n"
+    "    data_out[out_offset + idx] = value;\n"
+    "}\n";
+
+const char *swizzle_32_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    data_out[out_offset + idx] = data_in[in_offset / 4u + get_unswizzled_idx(idx)];\n"
+    "}\n";
+
+const char *palette_8_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint index = read_u8(in_offset + get_swizzled_offset(idx));\n"
+    "    data_out[out_offset + idx] = palette_in[min(index, uint(palette_in.length()) - 1u)];\n"
+    "}\n";
+
+// Must match s3tc.c
+const char *bc_common_glsl =
+    "uvec3 bc1_endpoint(uint c) {\n"
+    "    return uvec3(((c & 0xf800u) >> 8) * 0xffu / 0xf8u,\n"
+    "                 ((c & 0x07e0u) >> 3) * 0xffu / 0xfcu,\n"
+    "                 ((c & 0x001fu) << 3) * 0xffu / 0xf8u);\n"
+    "}\n"
+    "uvec4 bc1_color(uint c0, uint c1, uint index, bool transparent) {\n"
+    "    uvec3 e0 = bc1_endpoint(c0), e1 = bc1_endpoint(c1);\n"
+    "    if (index == 0u) return uvec4(e0, 255u);\n"
+    "    if (index == 1u) return uvec4(e1, 255u);\n"
+    "    if (transparent) {\n"
+    "        return index == 2u ? uvec4((e0 + e1) / 2u, 255u) : uvec4(0u);\n"
+    "    }\n"
+    "    return index == 2u ? uvec4((2u * e0 + e1) / 3u, 255u) :\n"
+    "                         uvec4((e0 + 2u * e1) / 3u, 255u);\n"
+    "}\n"
+    "uint pack_rgba(uvec4 c) {\n"
+    "    return c.r | (c.g << 8) | (c.b << 16) | (c.a << 24);\n"
+    "}\n"
+    "uint get_block_base(uint idx, uint block_words, out uint texel) {\n"
+    "    uint x = idx % width, y = idx / width;\n"
+    "    uint block = (y / 4u) * ((width + 3u) / 4u) + x / 4u;\n"
+    "    texel = (y % 4u) * 4u + x % 4u;\n"
+    "    return in_offset / 4u + block * block_words;\n"
+    "}\n";
+
+const char *bc1_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint texel;\n"
+    "    uint base = get_block_base(idx, 2u, texel);\n"
+    "    uint colors = data_in[base];\n"
+    "    uint c0 = colors & 0xffffu, c1 = colors >> 16;\n"
+    "    uint index = (data_in[base + 1u] >> (texel * 2u)) & 3u;\n"
+    "    data_out[out_offset + idx] = pack_rgba(bc1_color(c0, c1, index, c0 <= c1));\n"
+    "}\n";
+
+const char *bc2_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint texel;\n"
+    "    uint base = get_block_base(idx, 4u, texel);\n"
+    "    uint alpha = (data_in[base + texel / 8u] >> ((texel % 8u) * 4u)) & 0xfu;\n"
+    "    uint colors = data_in[base + 2u];\n"
+    "    uint index = (data_in[base + 3u] >> (texel * 2u)) & 3u;\n"
+    "    uvec4 color = bc1_color(colors & 0xffffu, colors >> 16, index, false);\n"
+    "    color.a = (alpha << 4) * 0xffu / 0xf0u;\n"
+    "    data_out[out_offset + idx] = pack_rgba(color);\n"
+    "}\n";
+
+const char *bc3_glsl =
+    "void main() {\n"
+    "    uint idx = gl_GlobalInvocationID.x;\n"
+    "    if (idx >= num_units) return;\n"
+    "    uint texel;\n"
+    "    uint base = get_block_base(idx, 4u, texel);\n"
+    "    uint w0 = data_in[base], w1 = data_in[base + 1u];\n"
+    "    uint a0 = w0 & 0xffu, a1 = (w0 >> 8) & 0xffu;\n"
+    "    uint bit = 16u + texel * 3u;\n"
+    "    uint code;\n"
+    "    if (bit + 3u <= 32u) {\n"
+    "        code = (w0 >> bit) & 7u;\n"
+    "    } else if (bit >= 32u) {\n"
+    "        code = (w1 >> (bit - 32u)) & 7u;\n"
+    "    } else {\n"
+    "        code = ((w0 >> bit) | (w1 << (32u - bit))) & 7u;\n"
+    "    }\n"
+    "    uint alpha;\n"
+    "    if (code == 0u) {\n"
+    "        alpha = a0;\n"
+    "    } else if (code == 1u) {\n"
+    "        alpha = a1;\n"
+    "    } else if (a0 > a1) {\n"
+    "        alpha = ((8u - code) * a0 + (code - 1u) * a1) / 7u;\n"
+    "    } else if (code < 6u) {\n"
+    "        alpha = ((6u - code) * a0 + (code - 1u) * a1) / 5u;\n"
+    "    } else {\n"
+    "        alpha = code == 6u ? 0u : 255u;\n"
+    "    }\n"
+    "    uint colors = data_in[base + 2u];\n"
+    "    uint index = (data_in[base + 3u] >> (texel * 2u)) & 3u;\n"
+    "    uvec4 color = bc1_color(colors & 0xffffu, colors >> 16, index, false);\n"
+    "    color.a = alpha;\n"
+    "    data_out[out_offset + idx] = pack_rgba(color);\n"
+    "}\n";
+
+static gchar *get_texture_decode_glsl(TextureDecodeKernel kernel,
+                                      int workgroup_size)
+{
+    const char *bc_common = "";
+    const char *template;
+
+    switch (kernel) {
+    case TEXTURE_DECODE_UNSWIZZLE_8:
+        template = unswizzle_8_glsl;
+        break;
+    case TEXTURE_DECODE_UNSWIZZLE_16:
+        template = unswizzle_16_glsl;
+        break;
+    case TEXTURE_DECODE_UNSWIZZLE_32:
+        template = unswizzle_32_glsl;
+        break;
+    case TEXTURE_DECODE_SWIZZLE_16:
+        template = swizzle_16_glsl;
+        break;
+    case TEXTURE_DECODE_SWIZZLE_32:
+        template = swizzle_32_glsl;
+        break;
+    case TEXTURE_DECODE_PALETTE_8:
+        template = palette_8_glsl;
+        break;
+    case TEXTURE_DECODE_BC1:
+        bc_common = bc_common_glsl;
+        template = bc1_glsl;
+        break;
+    case TEXTURE_DECODE_BC2:
+        bc_common = bc_common_glsl;
+        template = bc2_glsl;
+        break;
+    case TEXTURE_DECODE_BC3:
+        bc_common = bc_common_glsl;
+        template = bc3_glsl;
+        break;
+    default:
+        assert(!"Unsupported texture decode kernel");
+        break;
+    }
+    assert(template);
+
+    gchar *glsl = g_strdup_printf(
+        "#version 450\n"
+        "layout(local_size_x = %d, local_size_y = 1, local_size_z = 1) in;\n"
+        "%s%s%s", workgroup_size, texture_decode_common_glsl, bc_common,
+        template);
+    assert(glsl);
+
+    return glsl;
+}
+
 static gchar *get_compute_shader_glsl(VkFormat host_fmt, bool pack,
                                       int workgroup_size)
 {
@@ -141,7 +420,7 @@ static gchar *get_compute_shader_glsl(VkFormat host_fmt, bool pack,
     gchar *glsl = g_strdup_printf(
         "#version 450\n"
         "layout(local_size_x = %d, local_size_y = 1, local_size_z = 1) in;\n"
-        "%s", workgroup_size, template);
+        "%s%s", workgroup_size, depth_stencil_common_glsl, template);
     assert(glsl);
 
     return glsl;
@@ -226,6 +505,9 @@ static void create_descriptor_sets(PGRAPHState *pg)
     };
     VK_CHECK(vkAllocateDescriptorSets(r->device, &alloc_info,
                                       r->compute.descriptor_sets));
+    memset(r->compute.descriptor_set_submit, 0,
+           sizeof(r->compute.descriptor_set_submit));
+    r->compute.descriptor_set_index = 0;
 }
 
 static void destroy_descriptor_sets(PGRAPHState *pg)
@@ -246,7 +528,7 @@ static void create_compute_pipeline_layout(PGRAPHState *pg)
 
     VkPushConstantRange push_constant_range = {
         .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
-        .size = 2 * sizeof(uint32_t),
+        .size = 6 * sizeof(uint32_t),
     };
     VkPipelineLayoutCreateInfo pipeline_layout_info = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
@@ -291,22 +573,32 @@ static VkPipeline create_compute_pipeline(PGRAPHVkState *r, const char *glsl)
     return pipeline;
 }
 
-static void update_descriptor_sets(PGRAPHState *pg,
-                                   VkDescriptorBufferInfo *buffers, int count)
+/*
+ * Take the next set in the ring. A set is only rewritten once the frame that
+ * last used it has completed, so this waits on that frame alone.
+ */
+static VkDescriptorSet update_descriptor_sets(PGRAPHState *pg,
+                                              VkDescriptorBufferInfo *buffers,
+                                              int count)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     assert(count == 3);
     VkWriteDescriptorSet descriptor_writes[3];
 
-    assert(r->compute.descriptor_set_index <
-           ARRAY_SIZE(r->compute.descriptor_sets));
+    assert(!pgraph_vk_compute_needs_finish(r));
+
+    int index = r->compute.descriptor_set_index;
+    uint32_t last_submit = r->compute.descriptor_set_submit[index];
+    if (last_submit && last_submit - 1 < r->submit_count) {
+        pgraph_vk_wait_for_submit(r, last_submit - 1);
+    }
+    VkDescriptorSet set = r->compute.descriptor_sets[index];
 
     for (int i = 0; i < count; i++) {
         descriptor_writes[i] = (VkWriteDescriptorSet){
             .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-            .dstSet =
-                r->compute.descriptor_sets[r->compute.descriptor_set_index],
+            .dstSet = set,
             .dstBinding = i,
             .dstArrayElement = 0,
             .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
@@ -316,20 +608,24 @@ static void update_descriptor_sets(PGRAPHState *pg,
     }
     vkUpdateDescriptorSets(r->device, count, descriptor_writes, 0, NULL);
 
-    r->compute.descriptor_set_index += 1;
+    // Recorded work is submitted as submit_count, see pgraph_vk_submit_frame
+    r->compute.descriptor_set_submit[index] = r->submit_count + 1;
+    r->compute.descriptor_set_index =
+        (index + 1) % ARRAY_SIZE(r->compute.descriptor_sets);
+
+    return set;
 }
 
+/*
+ * Only when every set is used by the command buffer being recorded does the
+ * caller need to submit it before more compute work can be recorded.
+ */
 bool pgraph_vk_compute_needs_finish(PGRAPHVkState *r)
 {
-    bool need_descriptor_write_reset = (r->compute.descriptor_set_index >=
-                                        ARRAY_SIZE(r->compute.descriptor_sets));
-
-    return need_descriptor_write_reset;
-}
+    uint32_t last_submit =
+        r->compute.descriptor_set_submit[r->compute.descriptor_set_index];
 
-void pgraph_vk_compute_finish_complete(PGRAPHVkState *r)
-{
-    r->compute.descriptor_set_index = 0;
+    return r->in_command_buffer && last_submit == r->submit_count + 1;
 }
 
 static int get_workgroup_size_for_output_units(PGRAPHVkState *r, int output_units)
@@ -353,6 +649,18 @@ static int get_workgroup_size_for_output_units(PGRAPHVkState *r, int output_unit
     return group_size;
 }
 
+static ComputePipeline *lookup_compute_pipeline(PGRAPHVkState *r,
+                                                ComputePipelineKey *key)
+{
+    LruNode *node = lru_lookup(&r->compute.pipeline_cache,
+                      fast_hash((void *)key, sizeof(*key)), key);
+    ComputePipeline *pipeline = container_of(node, ComputePipeline, node);
+
+    assert(pipeline);
+
+    return pipeline;
+}
+
 static ComputePipeline *get_compute_pipeline(PGRAPHVkState *r, VkFormat host_fmt, bool pack, int output_units)
 {
     int workgroup_size = get_workgroup_size_for_output_units(r, output_units);
@@ -364,22 +672,18 @@ static ComputePipeline *get_compute_pipeline(PGRAPHVkState *r, VkFormat host_fmt
     key.pack = pack;
     key.workgroup_size = workgroup_size;
 
-    LruNode *node = lru_lookup(&r->compute.pipeline_cache,
-                      fast_hash((void *)&key, sizeof(key)), &key);
-    ComputePipeline *pipeline = container_of(node, ComputePipeline, node);
-
-    assert(pipeline);
-
-    return pipeline;
+    return lookup_compute_pipeline(r, &key);
 }
 
 //
 // Pack depth+stencil into NV097_SET_SURFACE_FORMAT_ZETA_Z24S8
 // formatted buffer with depth in bits 31-8 and stencil in bits 7-0.
+// If swizzle is set the output is written in guest swizzled layout, which
+// requires the output to be at guest resolution.
 //
 void pgraph_vk_pack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
                                   VkCommandBuffer cmd, VkBuffer src,
-                                  VkBuffer dst, bool downscale)
+                                  VkBuffer dst, bool downscale, bool swizzle)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
@@ -420,7 +724,8 @@ void pgraph_vk_pack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
         },
     };
 
-    update_descriptor_sets(pg, buffers, ARRAY_SIZE(buffers));
+    VkDescriptorSet descriptor_set =
+        update_descriptor_sets(pg, buffers, ARRAY_SIZE(buffers));
 
     size_t output_size_in_units = output_width * output_height;
     ComputePipeline *pipeline = get_compute_pipeline(
@@ -439,24 +744,31 @@ void pgraph_vk_pack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
     vkCmdBindDescriptorSets(
         cmd, VK_PIPELINE_BIND_POINT_COMPUTE, r->compute.pipeline_layout, 0, 1,
-        &r->compute.descriptor_sets[r->compute.descriptor_set_index - 1], 0,
-        NULL);
+        &descriptor_set, 0, NULL);
 
-    uint32_t push_constants[2] = { input_width, output_width };
-    assert(sizeof(push_constants) == 8);
+    assert(!swizzle || output_width == surface->width);
+    uint32_t push_constants[3] = { input_width, output_width,
+                                   swizzle ? output_height : 0 };
+    assert(sizeof(push_constants) == 12);
     vkCmdPushConstants(cmd, r->compute.pipeline_layout,
                        VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants),
                        push_constants);
 
     // FIXME: Check max group count
 
+    int timer_query = pgraph_vk_gpu_timer_begin(r, cmd, NV2A_PROF_GPU_COMPUTE);
     vkCmdDispatch(cmd, group_count, 1, 1);
+    pgraph_vk_gpu_timer_end(r, cmd, timer_query);
     pgraph_vk_end_debug_marker(r, cmd);
 }
 
+//
+// Inverse of pgraph_vk_pack_depth_stencil, scaling up from guest resolution.
+// If swizzle is set the input is read in guest swizzled layout.
+//
 void pgraph_vk_unpack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
                                     VkCommandBuffer cmd, VkBuffer src,
-                                    VkBuffer dst)
+                                    VkBuffer dst, bool swizzle)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
@@ -493,7 +805,8 @@ void pgraph_vk_unpack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
             .range = input_size,
         },
     };
-    update_descriptor_sets(pg, buffers, ARRAY_SIZE(buffers));
+    VkDescriptorSet descriptor_set =
+        update_descriptor_sets(pg, buffers, ARRAY_SIZE(buffers));
 
     size_t output_size_in_units = output_width * output_height;
     ComputePipeline *pipeline = get_compute_pipeline(
@@ -512,17 +825,196 @@ void pgraph_vk_unpack_depth_stencil(PGRAPHState *pg, SurfaceBinding *surface,
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
     vkCmdBindDescriptorSets(
         cmd, VK_PIPELINE_BIND_POINT_COMPUTE, r->compute.pipeline_layout, 0, 1,
-        &r->compute.descriptor_sets[r->compute.descriptor_set_index - 1], 0,
-        NULL);
+        &descriptor_set, 0, NULL);
 
     assert(output_width >= input_width);
-    uint32_t push_constants[2] = { input_width, output_width };
-    assert(sizeof(push_constants) == 8);
+    uint32_t push_constants[3] = { input_width, output_width,
+                                   swizzle ? input_height : 0 };
+    assert(sizeof(push_constants) == 12);
     vkCmdPushConstants(cmd, r->compute.pipeline_layout,
                        VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants),
                        push_constants);
+    int timer_query = pgraph_vk_gpu_timer_begin(r, cmd, NV2A_PROF_GPU_COMPUTE);
     vkCmdDispatch(cmd, group_count, 1, 1);
+    pgraph_vk_gpu_timer_end(r, cmd, timer_query);
+    pgraph_vk_end_debug_marker(r, cmd);
+}
+
+size_t pgraph_vk_get_texture_decode_output_size(
+    TextureDecodeKernel kernel, const TextureDecodeRegion *region)
+{
+    size_t num_texels = region->width * region->height * region->depth;
+
+    switch (kernel) {
+    case TEXTURE_DECODE_UNSWIZZLE_8:
+        return num_texels;
+    case TEXTURE_DECODE_UNSWIZZLE_16:
+    case TEXTURE_DECODE_SWIZZLE_16:
+        return num_texels * 2;
+    default:
+        return num_texels * 4;
+    }
+}
+
+static int get_texture_decode_workgroup_size(PGRAPHVkState *r)
+{
+    return MIN(64, r->device_props.limits.maxComputeWorkGroupSize[0]);
+}
+
+static bool check_texture_decode_group_count(PGRAPHVkState *r,
+                                             TextureDecodeKernel kernel,
+                                             const TextureDecodeRegion *region)
+{
+    size_t output_size_in_units =
+        DIV_ROUND_UP(pgraph_vk_get_texture_decode_output_size(kernel, region), 4);
+    size_t group_count = DIV_ROUND_UP(output_size_in_units,
+                                      get_texture_decode_workgroup_size(r));
+
+    return group_count <= r->device_props.limits.maxComputeWorkGroupCount[0];
+}
+
+//
+// Decode raw guest texture data in src into host texels in dst, one dispatch
+// per region. Returns false if the decode could not be recorded, in which case
+// the caller should fall back to decoding on the CPU.
+//
+bool pgraph_vk_decode_texture(PGRAPHState *pg, VkCommandBuffer cmd,
+                              TextureDecodeKernel kernel, VkBuffer src,
+                              size_t src_size, size_t palette_offset,
+                              size_t palette_size, VkBuffer dst,
+                              size_t dst_size,
+                              const TextureDecodeRegion *regions,
+                              int num_regions)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (pgraph_vk_compute_needs_finish(r)) {
+        return false;
+    }
+
+    ComputePipelineKey key;
+    memset(&key, 0, sizeof(key));
+    key.texture_kernel = kernel;
+    key.workgroup_size = get_texture_decode_workgroup_size(r);
+
+    for (int i = 0; i < num_regions; i++) {
+        if (!check_texture_decode_group_count(r, kernel, &regions[i])) {
+            return false;
+        }
+    }
+
+    VkDescriptorBufferInfo buffers[] = {
+        {
+            .buffer = dst,
+            .offset = 0,
+            .range = dst_size,
+        },
+        {
+            .buffer = src,
+            .offset = palette_size ? palette_offset : 0,
+            .range = palette_size ? palette_size : src_size,
+        },
+        {
+            .buffer = src,
+            .offset = 0,
+            .range = src_size,
+        },
+    };
+    VkDescriptorSet descriptor_set =
+        update_descriptor_sets(pg, buffers, ARRAY_SIZE(buffers));
+
+    ComputePipeline *pipeline = lookup_compute_pipeline(r, &key);
+
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_PINK, __func__);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->pipeline);
+    vkCmdBindDescriptorSets(
+        cmd, VK_PIPELINE_BIND_POINT_COMPUTE, r->compute.pipeline_layout, 0, 1,
+        &descriptor_set, 0, NULL);
+
+    int timer_query = pgraph_vk_gpu_timer_begin(r, cmd, NV2A_PROF_GPU_COMPUTE);
+    for (int i = 0; i < num_regions; i++) {
+        const TextureDecodeRegion *region = &regions[i];
+        assert(region->out_offset % 4 == 0);
+
+        size_t output_size_in_units = DIV_ROUND_UP(
+            pgraph_vk_get_texture_decode_output_size(kernel, region), 4);
+        uint32_t push_constants[6] = {
+            region->width,         region->height,
+            region->depth,         region->in_offset,
+            region->out_offset / 4, output_size_in_units,
+        };
+        vkCmdPushConstants(cmd, r->compute.pipeline_layout,
+                           VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                           sizeof(push_constants), push_constants);
+        vkCmdDispatch(cmd,
+                      DIV_ROUND_UP(output_size_in_units, key.workgroup_size),
+                      1, 1);
+    }
+    pgraph_vk_gpu_timer_end(r, cmd, timer_query);
+
     pgraph_vk_end_debug_marker(r, cmd);
+
+    return true;
+}
+
+static TextureDecodeKernel get_surface_swizzle_kernel(SurfaceBinding *surface,
+                                                      bool unswizzle)
+{
+    switch (surface->fmt.bytes_per_pixel) {
+    case 2:
+        return unswizzle ? TEXTURE_DECODE_UNSWIZZLE_16 :
+                           TEXTURE_DECODE_SWIZZLE_16;
+    case 4:
+        return unswizzle ? TEXTURE_DECODE_UNSWIZZLE_32 :
+                           TEXTURE_DECODE_SWIZZLE_32;
+    default:
+        return TEXTURE_DECODE_NONE;
+    }
+}
+
+static TextureDecodeRegion get_surface_swizzle_region(SurfaceBinding *surface)
+{
+    return (TextureDecodeRegion){
+        .width = surface->width,
+        .height = surface->height,
+        .depth = 1,
+    };
+}
+
+/*
+ * Whether pgraph_vk_swizzle_surface can convert this surface. Depth-stencil
+ * surfaces converted by the pack and unpack kernels swizzle there instead.
+ */
+bool pgraph_vk_check_surface_swizzle_supported(PGRAPHVkState *r,
+                                               SurfaceBinding *surface)
+{
+    TextureDecodeKernel kernel = get_surface_swizzle_kernel(surface, false);
+    TextureDecodeRegion region = get_surface_swizzle_region(surface);
+
+    return kernel != TEXTURE_DECODE_NONE &&
+           check_texture_decode_group_count(r, kernel, &region);
+}
+
+//
+// Convert a tightly packed surface at guest resolution between linear layout
+// in src and guest swizzled layout in dst, or the reverse if unswizzle is set.
+//
+void pgraph_vk_swizzle_surface(PGRAPHState *pg, SurfaceBinding *surface,
+                               VkCommandBuffer cmd, VkBuffer src, VkBuffer dst,
+                               bool unswizzle)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    assert(pgraph_vk_check_surface_swizzle_supported(r, surface));
+
+    TextureDecodeKernel kernel = get_surface_swizzle_kernel(surface, unswizzle);
+    TextureDecodeRegion region = get_surface_swizzle_region(surface);
+    size_t size = surface->width * surface->height *
+                  surface->fmt.bytes_per_pixel;
+
+    bool recorded = pgraph_vk_decode_texture(pg, cmd, kernel, src, size, 0, 0,
+                                             dst, size, &region, 1);
+    assert(recorded);
 }
 
 static void pipeline_cache_entry_init(Lru *lru, LruNode *node,
@@ -538,8 +1030,12 @@ static void pipeline_cache_entry_init(Lru *lru, LruNode *node,
                 "Warning: Needed compute shader with workgroup size = 1\n");
     }
 
-    gchar *glsl = get_compute_shader_glsl(
-        snode->key.host_fmt, snode->key.pack, snode->key.workgroup_size);
+    gchar *glsl =
+        snode->key.texture_kernel ?
+            get_texture_decode_glsl(snode->key.texture_kernel,
+                                    snode->key.workgroup_size) :
+            get_compute_shader_glsl(snode->key.host_fmt, snode->key.pack,
+                                    snode->key.workgroup_size);
     assert(glsl);
     snode->pipeline = create_compute_pipeline(r, glsl);
     g_free(glsl);
@@ -574,6 +1070,9 @@ static void pipeline_cache_init(PGRAPHVkState *r)
     for (int i = 0; i < pipeline_cache_size; i++) {
         lru_add_free(&r->compute.pipeline_cache, &r->compute.pipeline_cache_entries[i].node);
     }
+    xemu_mem_account_set(
+        xemu_mem_account("vk", "compute pipeline cache nodes"),
+        pipeline_cache_size * sizeof(ComputePipeline));
     r->compute.pipeline_cache.init_node = pipeline_cache_entry_init;
     r->compute.pipeline_cache.compare_nodes = pipeline_cache_entry_compare;
     r->compute.pipeline_cache.post_node_evict = pipeline_cache_entry_post_evict;
@@ -582,8 +1081,11 @@ static void pipeline_cache_init(PGRAPHVkState *r)
 static void pipeline_cache_finalize(PGRAPHVkState *r)
 {
     lru_flush(&r->compute.pipeline_cache);
+    lru_destroy(&r->compute.pipeline_cache);
     g_free(r->compute.pipeline_cache_entries);
     r->compute.pipeline_cache_entries = NULL;
+    xemu_mem_account_set(
+        xemu_mem_account("vk", "compute pipeline cache nodes"), 0);
 }
 
 void pgraph_vk_init_compute(PGRAPHState *pg)
@@ -0,0 +1,250 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/timer.h"
+#include "ui/xemu-settings.h"
+#include "ui/xemu-title-profile.h"
+#include "xemu-xbe.h"
+#include "renderer.h"
+
+/*
+ * Surface readback profiles record, per title, which surfaces the CPU reads
+ * after they were downloaded because of a CPU write. Surfaces whose
+ * downloads were never read are not downloaded for CPU writes anymore; the
+ * write then replaces the GPU contents on the next upload.
+ *
+ * Profile file layout:
+ *   char[8]                  magic
+ *   SurfaceReadbackRecord[]  records
+ */
+static const char surface_profile_magic[8] = "NV2ASRP1";
+
+// Unread downloads needed, without any read, before downloads are skipped
+#define SURFACE_PROFILE_MIN_UNREAD 4
+
+// How often the running title is checked, in milliseconds
+#define SURFACE_PROFILE_TITLE_CHECK_INTERVAL 1000
+
+typedef struct SurfaceReadbackRecord {
+    uint64_t key;
+    uint32_t unread;
+    uint32_t read;
+} SurfaceReadbackRecord;
+
+static uint64_t get_surface_profile_key(const SurfaceBinding *surface)
+{
+    unsigned int format = surface->color ? surface->shape.color_format :
+                                           surface->shape.zeta_format;
+    return (uint64_t)surface->vram_addr | ((uint64_t)format << 32) |
+           ((uint64_t)surface->color << 40);
+}
+
+static char *get_surface_profile_path(uint32_t title_id)
+{
+    return g_strdup_printf("%ssurface_profiles/%08x.bin",
+                           xemu_settings_get_base_path(), title_id);
+}
+
+static CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE
+get_title_override(uint32_t title_id)
+{
+    int profile = xemu_title_profile_find(title_id);
+    if (profile >= 0) {
+        switch (g_config.perf.title_profiles[profile].surface_readback) {
+        case CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK_ALWAYS:
+            return CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE_ALWAYS;
+        case CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK_NEVER:
+            return CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE_NEVER;
+        default:
+            break;
+        }
+    }
+
+    for (int i = 0; i < g_config.perf.surface_readback.overrides_count; i++) {
+        const char *id = g_config.perf.surface_readback.overrides[i].title_id;
+        if (id && g_ascii_strtoull(id, NULL, 16) == title_id) {
+            return g_config.perf.surface_readback.overrides[i].mode;
+        }
+    }
+
+    return CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE_AUTO;
+}
+
+static void load_surface_profile(PGRAPHVkState *r)
+{
+    g_hash_table_remove_all(r->surface_profile.records);
+    r->surface_profile.dirty = false;
+    r->surface_profile.mode = get_title_override(r->surface_profile.title_id);
+
+    if (!r->surface_profile.title_id) {
+        return;
+    }
+
+    g_autofree char *path = get_surface_profile_path(r->surface_profile.title_id);
+    g_autofree gchar *contents = NULL;
+    gsize size;
+    if (!g_file_get_contents(path, &contents, &size, NULL) ||
+        size < sizeof(surface_profile_magic) ||
+        memcmp(contents, surface_profile_magic,
+               sizeof(surface_profile_magic))) {
+        return;
+    }
+
+    for (gsize pos = sizeof(surface_profile_magic);
+         pos + sizeof(SurfaceReadbackRecord) <= size;
+         pos += sizeof(SurfaceReadbackRecord)) {
+        SurfaceReadbackRecord *record =
+            g_memdup2(contents + pos, sizeof(SurfaceReadbackRecord));
+        g_hash_table_insert(r->surface_profile.records, &record->key, record);
+    }
+}
+
+static void save_surface_profile(PGRAPHVkState *r)
+{
+    if (!r->surface_profile.dirty || !r->surface_profile.title_id) {
+        return;
+    }
+
+    g_autofree char *dir =
+        g_strdup_printf("%ssurface_profiles", xemu_settings_get_base_path());
+    qemu_mkdir(dir);
+
+    g_autoptr(GByteArray) data = g_byte_array_new();
+    g_byte_array_append(data, (const guint8 *)surface_profile_magic,
+                        sizeof(surface_profile_magic));
+
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, r->surface_profile.records);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_byte_array_append(data, value, sizeof(SurfaceReadbackRecord));
+    }
+
+    g_autofree char *path = get_surface_profile_path(r->surface_profile.title_id);
+    if (!g_file_set_contents(path, (const gchar *)data->data, data->len,
+                             NULL)) {
+        fprintf(stderr, "nv2a: Failed to write surface profile to %s\n",
+                path);
+    }
+    r->surface_profile.dirty = false;
+}
+
+/*
+ * Called from CPU access callbacks, where the guest's page tables can be
+ * walked to find the running XBE.
+ */
+void pgraph_vk_surface_profile_update_title(PGRAPHVkState *r)
+{
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (now - r->surface_profile.title_check_time <
+        SURFACE_PROFILE_TITLE_CHECK_INTERVAL) {
+        return;
+    }
+    r->surface_profile.title_check_time = now;
+
+    struct xbe *xbe = xemu_get_xbe_info();
+    uint32_t title_id = xbe && xbe->cert ? le32_to_cpu(xbe->cert->m_titleid) : 0;
+    if (title_id == r->surface_profile.title_id) {
+        return;
+    }
+
+    pgraph_vk_buffers_title_changed(r, r->surface_profile.title_id);
+    save_surface_profile(r);
+    r->surface_profile.title_id = title_id;
+    load_surface_profile(r);
+}
+
+static SurfaceReadbackRecord *get_record(PGRAPHVkState *r,
+                                         const SurfaceBinding *surface)
+{
+    uint64_t key = get_surface_profile_key(surface);
+    SurfaceReadbackRecord *record =
+        g_hash_table_lookup(r->surface_profile.records, &key);
+    if (!record) {
+        record = g_malloc0(sizeof(*record));
+        record->key = key;
+        g_hash_table_insert(r->surface_profile.records, &record->key, record);
+    }
+
+    return record;
+}
+
+/*
+ * Record whether a download made for a CPU write was read by the CPU before
+ * the surface was downloaded again or evicted.
+ */
+void pgraph_vk_surface_profile_record(PGRAPHVkState *r,
+                                      const SurfaceBinding *surface, bool read)
+{
+    if (r->surface_profile.mode !=
+            CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE_AUTO ||
+        !g_config.perf.surface_readback.learn) {
+        return;
+    }
+
+    SurfaceReadbackRecord *record = get_record(r, surface);
+    if (read) {
+        record->read += 1;
+    } else {
+        record->unread += 1;
+    }
+    r->surface_profile.dirty = true;
+}
+
+bool pgraph_vk_surface_profile_should_skip_download(
+    PGRAPHVkState *r, const SurfaceBinding *surface)
+{
+    switch (r->surface_profile.mode) {
+    case CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE_ALWAYS:
+        return false;
+    case CONFIG_PERF_SURFACE_READBACK_OVERRIDES_MODE_NEVER:
+        return true;
+    default:
+        break;
+    }
+
+    uint64_t key = get_surface_profile_key(surface);
+    SurfaceReadbackRecord *record =
+        g_hash_table_lookup(r->surface_profile.records, &key);
+
+    return record && !record->read &&
+           record->unread >= SURFACE_PROFILE_MIN_UNREAD;
+}
+
+void pgraph_vk_init_surface_profile(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    r->surface_profile.records =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    r->surface_profile.title_id = 0;
+    r->surface_profile.title_check_time = 0;
+    load_surface_profile(r);
+}
+
+void pgraph_vk_finalize_surface_profile(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    save_surface_profile(r);
+    g_hash_table_destroy(r->surface_profile.records);
+    r->surface_profile.records = NULL;
+}
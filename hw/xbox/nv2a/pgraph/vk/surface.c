@@ -34,35 +34,19 @@ const int max_surface_frame_time_delta = 5;
 
 void pgraph_vk_set_surface_scale_factor(NV2AState *d, unsigned int scale)
 {
-    g_config.display.quality.surface_scale = scale < 1 ? 1 : scale;
-
-    qemu_mutex_lock(&d->pfifo.lock);
-    qatomic_set(&d->pfifo.halt, true);
-    qemu_mutex_unlock(&d->pfifo.lock);
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
-    // FIXME: It's just flush
-    qemu_mutex_lock(&d->pgraph.lock);
-    qemu_event_reset(&d->pgraph.vk_renderer_state->dirty_surfaces_download_complete);
-    qatomic_set(&d->pgraph.vk_renderer_state->download_dirty_surfaces_pending, true);
-    qemu_mutex_unlock(&d->pgraph.lock);
-    qemu_mutex_lock(&d->pfifo.lock);
-    pfifo_kick(d);
-    qemu_mutex_unlock(&d->pfifo.lock);
-    qemu_event_wait(&d->pgraph.vk_renderer_state->dirty_surfaces_download_complete);
+    g_config.display.quality.surface_scale = scale < 1 ? 1 : scale;
 
+    // Surfaces are rescaled on the GPU by the pgraph thread
     qemu_mutex_lock(&d->pgraph.lock);
-    qemu_event_reset(&d->pgraph.flush_complete);
-    qatomic_set(&d->pgraph.flush_pending, true);
+    qemu_event_reset(&r->surface_rescale_complete);
+    qatomic_set(&r->surface_rescale_pending, true);
     qemu_mutex_unlock(&d->pgraph.lock);
     qemu_mutex_lock(&d->pfifo.lock);
     pfifo_kick(d);
     qemu_mutex_unlock(&d->pfifo.lock);
-    qemu_event_wait(&d->pgraph.flush_complete);
-
-    qemu_mutex_lock(&d->pfifo.lock);
-    qatomic_set(&d->pfifo.halt, false);
-    pfifo_kick(d);
-    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_event_wait(&r->surface_rescale_complete);
 }
 
 unsigned int pgraph_vk_get_surface_scale_factor(NV2AState *d)
@@ -122,12 +106,36 @@ static void memcpy_image(void *dst, void const *src, int dst_stride,
     }
 }
 
-static bool check_surface_overlaps_range(const SurfaceBinding *surface,
-                                         hwaddr range_start, hwaddr range_len)
+/*
+ * Surfaces in r->surfaces are also kept in an interval tree over their VRAM
+ * range, so range and address lookups don't have to scan the whole list.
+ */
+static void surface_index_insert(PGRAPHVkState *r, SurfaceBinding *surface)
+{
+    surface->itree.start = surface->vram_addr;
+    surface->itree.last = surface->vram_addr + MAX(surface->size, 1) - 1;
+    interval_tree_insert(&surface->itree, &r->surface_tree);
+}
+
+static void surface_index_remove(PGRAPHVkState *r, SurfaceBinding *surface)
+{
+    interval_tree_remove(&surface->itree, &r->surface_tree);
+}
+
+static SurfaceBinding *surface_index_first(PGRAPHVkState *r, hwaddr start,
+                                           hwaddr size)
 {
-    hwaddr surface_end = surface->vram_addr + surface->size;
-    hwaddr range_end = range_start + range_len;
-    return !(surface->vram_addr >= range_end || range_start >= surface_end);
+    IntervalTreeNode *node = interval_tree_iter_first(
+        &r->surface_tree, start, start + MAX(size, 1) - 1);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
+}
+
+static SurfaceBinding *surface_index_next(SurfaceBinding *surface,
+                                          hwaddr start, hwaddr size)
+{
+    IntervalTreeNode *node = interval_tree_iter_next(
+        &surface->itree, start, start + MAX(size, 1) - 1);
+    return node ? container_of(node, SurfaceBinding, itree) : NULL;
 }
 
 void pgraph_vk_download_surfaces_in_range_if_dirty(PGRAPHState *pg,
@@ -136,14 +144,165 @@ void pgraph_vk_download_surfaces_in_range_if_dirty(PGRAPHState *pg,
     PGRAPHVkState *r = pg->vk_renderer_state;
     SurfaceBinding *surface;
 
+    for (surface = surface_index_first(r, start, size); surface;
+         surface = surface_index_next(surface, start, size)) {
+        pgraph_vk_surface_download_if_dirty(
+            container_of(pg, NV2AState, pgraph), surface);
+    }
+}
+
+static bool check_surface_readback_supported(PGRAPHState *pg,
+                                             const SurfaceBinding *surface)
+{
+    // Scaled and depth surfaces need a blit or compute pass to download
+    return surface->color && !surface->transient &&
+           pg->surface_scale_factor == 1 && surface->width && surface->height;
+}
+
+static void create_surface_readback_buffer(PGRAPHVkState *r,
+                                           SurfaceBinding *surface)
+{
+    VkBufferCreateInfo buffer_create_info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = surface->host_fmt.host_bytes_per_pixel * surface->width *
+                surface->height,
+        .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+        .flags = VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT |
+                 VMA_ALLOCATION_CREATE_MAPPED_BIT,
+    };
+    VmaAllocationInfo alloc_info;
+    VK_CHECK(vmaCreateBuffer(r->allocator, &buffer_create_info,
+                             &alloc_create_info, &surface->readback_buffer,
+                             &surface->readback_allocation, &alloc_info));
+    surface->readback_mapped = alloc_info.pMappedData;
+    pgraph_vk_account_allocation(r, r->readback_mem_account,
+                                 surface->readback_allocation, false);
+}
+
+static void destroy_surface_readback_buffer(PGRAPHVkState *r,
+                                            SurfaceBinding *surface)
+{
+    if (surface->readback_buffer == VK_NULL_HANDLE) {
+        return;
+    }
+
+    pgraph_vk_wait_for_submit(r, surface->readback_submit);
+    pgraph_vk_account_allocation(r, r->readback_mem_account,
+                                 surface->readback_allocation, true);
+    vmaDestroyBuffer(r->allocator, surface->readback_buffer,
+                     surface->readback_allocation);
+    surface->readback_buffer = VK_NULL_HANDLE;
+    surface->readback_allocation = VK_NULL_HANDLE;
+    surface->readback_mapped = NULL;
+    surface->readback_valid = false;
+}
+
+/*
+ * Copy surfaces the CPU is known to read into their readback buffers at the
+ * end of the frame, so a later CPU access only has to wait for this frame.
+ */
+void pgraph_vk_record_surface_readbacks(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    VkCommandBuffer cmd = r->command_buffer;
+
+    assert(r->in_command_buffer && !r->in_render_pass);
+
+    SurfaceBinding *surface;
     QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-        if (check_surface_overlaps_range(surface, start, size)) {
-            pgraph_vk_surface_download_if_dirty(
-                container_of(pg, NV2AState, pgraph), surface);
+        if (!surface->readback_requested ||
+            !qatomic_read(&surface->draw_dirty) ||
+            !check_surface_readback_supported(pg, surface) ||
+            (surface->readback_valid &&
+             surface->readback_draw_time == surface->draw_time)) {
+            continue;
         }
+
+        if (surface->readback_buffer == VK_NULL_HANDLE) {
+            create_surface_readback_buffer(r, surface);
+        }
+
+        pgraph_vk_transition_image_layout(
+            pg, cmd, surface->image, surface->host_fmt.vk_format,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+        VkBufferImageCopy copy_region = {
+            .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .imageSubresource.layerCount = 1,
+            .imageExtent = (VkExtent3D){ surface->width, surface->height, 1 },
+        };
+        vkCmdCopyImageToBuffer(cmd, surface->image,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               surface->readback_buffer, 1, &copy_region);
+
+        pgraph_vk_transition_image_layout(
+            pg, cmd, surface->image, surface->host_fmt.vk_format,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+
+        VkBufferMemoryBarrier post_copy_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = surface->readback_buffer,
+            .size = VK_WHOLE_SIZE
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
+                             &post_copy_barrier, 0, NULL);
+
+        // Submitted right after this, see pgraph_vk_submit_frame
+        surface->readback_submit = r->submit_count;
+        surface->readback_draw_time = surface->draw_time;
+        surface->readback_valid = true;
     }
 }
 
+/*
+ * Download from the copy made at the end of a submitted frame if nothing was
+ * drawn to the surface since. Only waits for that frame to complete.
+ */
+static bool download_surface_from_readback(NV2AState *d,
+                                           SurfaceBinding *surface,
+                                           uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (!surface->readback_valid ||
+        surface->readback_draw_time != surface->draw_time ||
+        surface->readback_submit >= r->submit_count ||
+        !check_surface_readback_supported(pg, surface)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_DEFERRED);
+
+    pgraph_vk_wait_for_submit(r, surface->readback_submit);
+    vmaInvalidateAllocation(r->allocator, surface->readback_allocation, 0,
+                            VK_WHOLE_SIZE);
+
+    unsigned int row_size = surface->width * surface->fmt.bytes_per_pixel;
+    if (surface->swizzle) {
+        swizzle_rect(surface->readback_mapped, surface->width,
+                     surface->height, pixels, row_size,
+                     surface->fmt.bytes_per_pixel);
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_SWIZZLE);
+    } else {
+        memcpy_image(pixels, surface->readback_mapped, surface->pitch,
+                     row_size, surface->height);
+    }
+
+    return true;
+}
+
 static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
                                        uint8_t *pixels)
 {
@@ -154,6 +313,25 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
         return;
     }
 
+    surface->zeta_contents_needed = true;
+    surface->attachment_only = false;
+    surface->frame_skip_pinned = true;
+
+    // Mispredicted, guest memory keeps its old contents until demotion
+    if (surface->transient) {
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_TRANSIENT_MISS);
+        return;
+    }
+
+    if (download_surface_from_readback(d, surface, pixels)) {
+        trace_nv2a_pgraph_surface_download(
+            surface->color ? "COLOR" : "ZETA",
+            surface->swizzle ? "sz" : "lin", surface->vram_addr,
+            surface->width, surface->height, surface->pitch,
+            surface->fmt.bytes_per_pixel);
+        return;
+    }
+
     nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD);
 
     bool use_compute_to_convert_depth_stencil_format =
@@ -166,8 +344,15 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
 
     assert(no_conversion_necessary);
 
-    bool compute_needs_finish = (use_compute_to_convert_depth_stencil_format &&
-                                 pgraph_vk_compute_needs_finish(r));
+    // Swizzled on the GPU as part of the copy to the staging buffer
+    bool use_compute_to_swizzle =
+        surface->swizzle && !use_compute_to_convert_depth_stencil_format &&
+        pgraph_vk_check_surface_swizzle_supported(r, surface);
+    bool use_compute = use_compute_to_convert_depth_stencil_format ||
+                       use_compute_to_swizzle;
+
+    bool compute_needs_finish =
+        (use_compute && pgraph_vk_compute_needs_finish(r));
 
     if (r->in_command_buffer &&
         surface->draw_time >= r->command_buffer_start_time) {
@@ -188,9 +373,9 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
     uint8_t *gl_read_buf = pixels;
 
     uint8_t *swizzle_buf = pixels;
-    if (surface->swizzle) {
-        // FIXME: Swizzle in shader
-        assert(pg->surface_scale_factor == 1 || downscale);
+    bool cpu_swizzle = surface->swizzle && !use_compute;
+    assert(!surface->swizzle || pg->surface_scale_factor == 1 || downscale);
+    if (cpu_swizzle) {
         swizzle_buf = (uint8_t *)g_malloc(surface->size);
         gl_read_buf = swizzle_buf;
     }
@@ -199,8 +384,36 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
                  scaled_height = surface->height;
     pgraph_apply_scaling_factor(pg, &scaled_width, &scaled_height);
 
+    // Grow the buffers used below before any command refers to them
+    bool copy_downscaled =
+        downscale && !use_compute_to_convert_depth_stencil_format;
+    size_t copied_size = surface->host_fmt.host_bytes_per_pixel *
+                         (copy_downscaled ? surface->width * surface->height :
+                                            scaled_width * scaled_height);
+    if (surface->host_fmt.aspect & VK_IMAGE_ASPECT_STENCIL_BIT) {
+        copied_size =
+            ROUND_UP(scaled_width * scaled_height * 4,
+                     r->device_props.limits.minStorageBufferOffsetAlignment) +
+            scaled_width * scaled_height;
+    }
+    if (use_compute) {
+        size_t packed_size =
+            (use_compute_to_convert_depth_stencil_format ?
+                 4 :
+                 surface->fmt.bytes_per_pixel) *
+            (downscale ? surface->width * surface->height :
+                         scaled_width * scaled_height);
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_DST, copied_size);
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_SRC, packed_size);
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_DST, packed_size);
+    } else {
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_DST, copied_size);
+    }
+
     VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
     pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+    int timer_query =
+        pgraph_vk_gpu_timer_begin(r, cmd, NV2A_PROF_GPU_SURFACE_DOWNLOAD);
 
     pgraph_vk_transition_image_layout(
         pg, cmd, surface->image, surface->host_fmt.vk_format,
@@ -222,15 +435,13 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
         copy_regions[0].imageExtent =
             (VkExtent3D){ surface->width, surface->height, 1 };
 
-        if (surface->image_scratch_current_layout !=
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-            pgraph_vk_transition_image_layout(
-                pg, cmd, surface->image_scratch, surface->host_fmt.vk_format,
-                surface->image_scratch_current_layout,
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            surface->image_scratch_current_layout =
-                VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        }
+        // Another surface may have used the scratch memory since, so
+        // nothing it held is kept
+        pgraph_vk_transition_image_layout(
+            pg, cmd, surface->image_scratch, surface->host_fmt.vk_format,
+            VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        surface->image_scratch_current_layout =
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 
         VkImageBlit blit_region = {
             .srcSubresource.aspectMask = surface->host_fmt.aspect,
@@ -288,9 +499,7 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
     assert((downloaded_image_size) <=
            r->storage_buffers[BUFFER_STAGING_DST].buffer_size);
 
-    int copy_buffer_idx = use_compute_to_convert_depth_stencil_format ?
-                             BUFFER_COMPUTE_DST :
-                             BUFFER_STAGING_DST;
+    int copy_buffer_idx = use_compute ? BUFFER_COMPUTE_DST : BUFFER_STAGING_DST;
     VkBuffer copy_buffer = r->storage_buffers[copy_buffer_idx].buffer;
 
     {
@@ -320,14 +529,17 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
     // FIXME: Verify output of depth stencil conversion
     // FIXME: Track current layout and only transition when required
 
-    if (use_compute_to_convert_depth_stencil_format) {
-        size_t bytes_per_pixel = 4;
+    if (use_compute) {
+        size_t bytes_per_pixel = use_compute_to_convert_depth_stencil_format ?
+                                     4 :
+                                     surface->fmt.bytes_per_pixel;
         size_t packed_size =
             downscale ? (surface->width * surface->height * bytes_per_pixel) :
                         (scaled_width * scaled_height * bytes_per_pixel);
 
         //
-        // Pack the depth-stencil image into compute_src buffer
+        // Pack the depth-stencil image, or swizzle the image, into
+        // compute_src buffer
         //
 
         VkBufferMemoryBarrier pre_compute_src_barrier = {
@@ -358,8 +570,14 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
                              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
                              1, &pre_compute_dst_barrier, 0, NULL);
 
-        pgraph_vk_pack_depth_stencil(pg, surface, cmd, copy_buffer, pack_buffer,
-                                     downscale);
+        if (use_compute_to_convert_depth_stencil_format) {
+            pgraph_vk_pack_depth_stencil(pg, surface, cmd, copy_buffer,
+                                         pack_buffer, downscale,
+                                         surface->swizzle);
+        } else {
+            pgraph_vk_swizzle_surface(pg, surface, cmd, copy_buffer,
+                                      pack_buffer, false);
+        }
 
         VkBufferMemoryBarrier post_compute_src_barrier = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
@@ -444,6 +662,7 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
 
     nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_1);
     pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_gpu_timer_end(r, cmd, timer_query);
     pgraph_vk_end_single_time_commands(pg, cmd);
 
     void *mapped_memory_ptr = NULL;
@@ -455,15 +674,19 @@ static void download_surface_to_buffer(NV2AState *d, SurfaceBinding *surface,
                             r->storage_buffers[BUFFER_STAGING_DST].allocation,
                             0, VK_WHOLE_SIZE);
 
-    memcpy_image(gl_read_buf, mapped_memory_ptr, surface->pitch,
-                 surface->width * surface->fmt.bytes_per_pixel,
-                 surface->height);
+    if (surface->swizzle && !cpu_swizzle) {
+        memcpy(pixels, mapped_memory_ptr,
+               surface->width * surface->height * surface->fmt.bytes_per_pixel);
+    } else {
+        memcpy_image(gl_read_buf, mapped_memory_ptr, surface->pitch,
+                     surface->width * surface->fmt.bytes_per_pixel,
+                     surface->height);
+    }
 
     vmaUnmapMemory(r->allocator,
                    r->storage_buffers[BUFFER_STAGING_DST].allocation);
 
-    if (surface->swizzle) {
-        // FIXME: Swizzle in shader
+    if (cpu_swizzle) {
         swizzle_rect(swizzle_buf, surface->width, surface->height, pixels,
                      surface->pitch, surface->fmt.bytes_per_pixel);
         nv2a_profile_inc_counter(NV2A_PROF_SURF_SWIZZLE);
@@ -485,12 +708,13 @@ static void download_surface(NV2AState *d, SurfaceBinding *surface, bool force)
     memory_region_set_client_dirty(d->vram, surface->vram_addr,
                                    surface->pitch * surface->height,
                                    DIRTY_MEMORY_VGA);
-    memory_region_set_client_dirty(d->vram, surface->vram_addr,
-                                   surface->pitch * surface->height,
-                                   DIRTY_MEMORY_NV2A_TEX);
+    pgraph_vram_set_dirty(d, surface->vram_addr,
+                          surface->pitch * surface->height,
+                          DIRTY_MEMORY_NV2A_TEX);
 
     surface->download_pending = false;
     surface->draw_dirty = false;
+    pgraph_vk_surface_update_access_callback(d, surface);
 }
 
 void pgraph_vk_wait_for_surface_download(SurfaceBinding *surface)
@@ -553,12 +777,11 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
     bool wait_for_downloads = false;
 
-    SurfaceBinding *surface;
-    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
-        if (!check_surface_overlaps_range(surface, addr, len)) {
-            continue;
-        }
+    pgraph_vk_surface_profile_update_title(r);
 
+    SurfaceBinding *surface;
+    for (surface = surface_index_first(r, addr, len); surface;
+         surface = surface_index_next(surface, addr, len)) {
         hwaddr offset = addr - surface->vram_addr;
 
         if (write) {
@@ -567,8 +790,24 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
             trace_nv2a_pgraph_surface_cpu_read(surface->vram_addr, offset);
         }
 
-        if (surface->draw_dirty) {
+        if (surface->cpu_write_download_unread && !write) {
+            pgraph_vk_surface_profile_record(r, surface, true);
+            surface->cpu_write_download_unread = false;
+        }
+
+        if (surface->draw_dirty && write &&
+            pgraph_vk_surface_profile_should_skip_download(r, surface)) {
+            // The CPU is not expected to read back what the GPU rendered
+            // here, let the write replace it on the next upload
+            nv2a_profile_inc_counter(NV2A_PROF_SURF_DOWNLOAD_ELIDED);
+            surface->draw_dirty = false;
+        } else if (surface->draw_dirty) {
+            if (surface->cpu_write_download_unread) {
+                pgraph_vk_surface_profile_record(r, surface, false);
+            }
+            surface->cpu_write_download_unread = write;
             surface->download_pending = true;
+            surface->readback_requested |= !write;
             wait_for_downloads = true;
         }
 
@@ -589,24 +828,38 @@ static void surface_access_callback(void *opaque, MemoryRegion *mr, hwaddr addr,
     }
 }
 
-static void register_cpu_access_callback(NV2AState *d, SurfaceBinding *surface)
+/*
+ * Under TCG, CPU writes to VRAM land in the DIRTY_MEMORY_NV2A bitmap, which is
+ * all a surface needs while VRAM holds its latest contents. Accesses only have
+ * to trap while the GPU copy is newer, or while the download profile waits to
+ * see whether a downloaded surface gets read.
+ */
+void pgraph_vk_surface_update_access_callback(NV2AState *d,
+                                              SurfaceBinding *surface)
 {
-    if (tcg_enabled()) {
-        if (surface->width && surface->height) {
-            surface->access_cb = mem_access_callback_insert(
-                qemu_get_cpu(0), d->vram, surface->vram_addr, surface->size,
-                &surface_access_callback, d);
-        } else {
-            surface->access_cb = NULL;
-        }
+    if (!tcg_enabled()) {
+        return;
+    }
+
+    bool watch = (surface->draw_dirty || surface->cpu_write_download_unread) &&
+                 surface->width && surface->height;
+
+    if (watch && !surface->access_cb) {
+        surface->access_cb = mem_access_callback_queue_insert(
+            qemu_get_cpu(0), d->vram, surface->vram_addr, surface->size,
+            &surface_access_callback, d);
+    } else if (!watch && surface->access_cb) {
+        mem_access_callback_queue_remove(qemu_get_cpu(0), surface->access_cb);
+        surface->access_cb = NULL;
     }
 }
 
 static void unregister_cpu_access_callback(NV2AState *d,
-                                           SurfaceBinding const *surface)
+                                           SurfaceBinding *surface)
 {
     if (tcg_enabled()) {
-        mem_access_callback_remove_by_ref(qemu_get_cpu(0), surface->access_cb);
+        mem_access_callback_queue_remove(qemu_get_cpu(0), surface->access_cb);
+        surface->access_cb = NULL;
     }
 }
 
@@ -639,12 +892,31 @@ static void unbind_surface(NV2AState *d, bool color)
     }
 }
 
+static gpointer transient_surface_key(const SurfaceBinding *surface)
+{
+    return GSIZE_TO_POINTER(surface->vram_addr << 1 | surface->color);
+}
+
 static void invalidate_surface(NV2AState *d, SurfaceBinding *surface)
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
     trace_nv2a_pgraph_surface_invalidated(surface->vram_addr);
 
+    if (r->transient_surfaces) {
+        gpointer key = transient_surface_key(surface);
+        if (surface->attachment_used && surface->attachment_only) {
+            g_hash_table_add(r->transient_surface_addrs, key);
+        } else {
+            g_hash_table_remove(r->transient_surface_addrs, key);
+        }
+    }
+
+    if (surface->cpu_write_download_unread) {
+        pgraph_vk_surface_profile_record(r, surface, false);
+        surface->cpu_write_download_unread = false;
+    }
+
     // FIXME: We may be reading from the surface in the current command buffer!
     // Add a detection to handle it. For now, finish to be safe.
     pgraph_vk_finish(&d->pgraph, VK_FINISH_REASON_SURFACE_DOWN);
@@ -653,6 +925,8 @@ static void invalidate_surface(NV2AState *d, SurfaceBinding *surface)
             surface->draw_time < r->command_buffer_start_time) &&
            "Surface evicted while in use!");
 
+    pgraph_vk_release_surface_texture_aliases(&d->pgraph, surface->image);
+
     if (surface == r->color_binding) {
         assert(d->pgraph.surface_color.buffer_dirty);
         unbind_surface(d, true);
@@ -665,30 +939,24 @@ static void invalidate_surface(NV2AState *d, SurfaceBinding *surface)
     unregister_cpu_access_callback(d, surface);
 
     QTAILQ_REMOVE(&r->surfaces, surface, entry);
+    surface_index_remove(r, surface);
     QTAILQ_INSERT_HEAD(&r->invalid_surfaces, surface, entry);
 }
 
-static bool check_surfaces_overlap(const SurfaceBinding *surface,
-                                   const SurfaceBinding *other_surface)
-{
-    return check_surface_overlaps_range(surface, other_surface->vram_addr,
-                                        other_surface->size);
-}
-
 static void invalidate_overlapping_surfaces(NV2AState *d,
                                             SurfaceBinding const *surface)
 {
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
-    SurfaceBinding *other_surface, *next_surface;
-    QTAILQ_FOREACH_SAFE (other_surface, &r->surfaces, entry, next_surface) {
-        if (check_surfaces_overlap(surface, other_surface)) {
-            trace_nv2a_pgraph_surface_evict_overlapping(
-                other_surface->vram_addr, other_surface->width,
-                other_surface->height, other_surface->pitch);
-            pgraph_vk_surface_download_if_dirty(d, other_surface);
-            invalidate_surface(d, other_surface);
-        }
+    // Invalidation removes the surface from the index, so restart the query
+    SurfaceBinding *other_surface;
+    while ((other_surface = surface_index_first(r, surface->vram_addr,
+                                                surface->size))) {
+        trace_nv2a_pgraph_surface_evict_overlapping(
+            other_surface->vram_addr, other_surface->width,
+            other_surface->height, other_surface->pitch);
+        pgraph_vk_surface_download_if_dirty(d, other_surface);
+        invalidate_surface(d, other_surface);
     }
 }
 
@@ -699,9 +967,11 @@ static void surface_put(NV2AState *d, SurfaceBinding *surface)
     assert(pgraph_vk_surface_get(d, surface->vram_addr) == NULL);
 
     invalidate_overlapping_surfaces(d, surface);
-    register_cpu_access_callback(d, surface);
+    surface->access_cb = NULL;
+    pgraph_vk_surface_update_access_callback(d, surface);
 
     QTAILQ_INSERT_HEAD(&r->surfaces, surface, entry);
+    surface_index_insert(r, surface);
 }
 
 SurfaceBinding *pgraph_vk_surface_get(NV2AState *d, hwaddr addr)
@@ -709,7 +979,8 @@ SurfaceBinding *pgraph_vk_surface_get(NV2AState *d, hwaddr addr)
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
+    for (surface = surface_index_first(r, addr, 1); surface;
+         surface = surface_index_next(surface, addr, 1)) {
         if (surface->vram_addr == addr) {
             return surface;
         }
@@ -723,9 +994,9 @@ SurfaceBinding *pgraph_vk_surface_get_within(NV2AState *d, hwaddr addr)
     PGRAPHVkState *r = d->pgraph.vk_renderer_state;
 
     SurfaceBinding *surface;
-    QTAILQ_FOREACH (surface, &r->surfaces, entry) {
-        if (addr >= surface->vram_addr &&
-            addr < (surface->vram_addr + surface->size)) {
+    for (surface = surface_index_first(r, addr, 1); surface;
+         surface = surface_index_next(surface, addr, 1)) {
+        if (addr < surface->vram_addr + surface->size) {
             return surface;
         }
     }
@@ -764,27 +1035,81 @@ static void set_surface_label(PGRAPHState *pg, SurfaceBinding const *surface)
         if (r->debug_utils_extension_enabled) {
             vkSetDebugUtilsObjectNameEXT(r->device, &name_info);
         }
-        vmaSetAllocationName(r->allocator, surface->allocation_scratch,
-                             label_scratch);
     }
 }
 
-static void create_surface_image(PGRAPHState *pg, SurfaceBinding *surface)
+static void surface_scratch_arena_unref(PGRAPHVkState *r,
+                                        SurfaceScratchArena *arena)
 {
-    PGRAPHVkState *r = pg->vk_renderer_state;
+    if (!arena || --arena->refs) {
+        return;
+    }
+
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_SURFACE],
+                                 arena->allocation, true);
+    vmaFreeMemory(r->allocator, arena->allocation);
+    g_free(arena);
+}
+
+/*
+ * The scratch image is only used inside the upload and download submissions,
+ * which are waited on before they return, so no two surfaces ever use theirs
+ * at the same time. Rather than giving each one memory the size of the
+ * surface, all scratch images alias one allocation grown to fit the largest.
+ * Images bound to an outgrown allocation keep it alive until destroyed.
+ */
+static void create_surface_scratch_image(PGRAPHVkState *r,
+                                         SurfaceBinding *surface,
+                                         const VkImageCreateInfo *create_info)
+{
+    VK_CHECK(vkCreateImage(r->device, create_info, NULL,
+                           &surface->image_scratch));
+
+    VkMemoryRequirements reqs;
+    vkGetImageMemoryRequirements(r->device, surface->image_scratch, &reqs);
+
+    SurfaceScratchArena *arena = r->surface_scratch_arena;
+    if (!arena || arena->size < reqs.size || arena->offset % reqs.alignment ||
+        !(reqs.memoryTypeBits & (1 << arena->memory_type))) {
+        if (arena && (reqs.memoryTypeBits & (1 << arena->memory_type))) {
+            reqs.size = MAX(reqs.size, arena->size);
+        }
 
+        VmaAllocationCreateInfo alloc_create_info = {
+            .preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        };
+        VmaAllocationInfo alloc_info;
+        arena = g_new0(SurfaceScratchArena, 1);
+        VK_CHECK(vmaAllocateMemory(r->allocator, &reqs, &alloc_create_info,
+                                   &arena->allocation, &alloc_info));
+        vmaSetAllocationName(r->allocator, arena->allocation,
+                             "Surface scratch");
+        pgraph_vk_account_allocation(
+            r, r->image_mem_accounts[IMAGE_MEM_SURFACE], arena->allocation,
+            false);
+        arena->size = alloc_info.size;
+        arena->offset = alloc_info.offset;
+        arena->memory_type = alloc_info.memoryType;
+        arena->refs = 1; // Held while it is the current arena
+
+        surface_scratch_arena_unref(r, r->surface_scratch_arena);
+        r->surface_scratch_arena = arena;
+    }
+
+    VK_CHECK(vmaBindImageMemory(r->allocator, arena->allocation,
+                                surface->image_scratch));
+    arena->refs++;
+    surface->scratch_arena = arena;
+}
+
+static VkImageCreateInfo get_surface_image_create_info(PGRAPHState *pg,
+                                                       SurfaceBinding *surface)
+{
     unsigned int width = surface->width ? surface->width : 1;
     unsigned int height = surface->height ? surface->height : 1;
     pgraph_apply_scaling_factor(pg, &width, &height);
 
-    assert(!surface->image);
-    assert(!surface->image_scratch);
-
-    NV2A_VK_DPRINTF(
-        "Creating new surface image width=%d height=%d @ %08" HWADDR_PRIx,
-        width, height, surface->vram_addr);
-
-    VkImageCreateInfo image_create_info = {
+    return (VkImageCreateInfo){
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = VK_IMAGE_TYPE_2D,
         .extent.width = width,
@@ -801,20 +1126,11 @@ static void create_surface_image(PGRAPHState *pg, SurfaceBinding *surface)
         .samples = VK_SAMPLE_COUNT_1_BIT,
         .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
     };
+}
 
-    VmaAllocationCreateInfo alloc_create_info = {
-        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-    };
-
-    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
-                            &alloc_create_info, &surface->image,
-                            &surface->allocation, NULL));
-
-    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
-                            &alloc_create_info, &surface->image_scratch,
-                            &surface->allocation_scratch, NULL));
-    surface->image_scratch_current_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-
+static void create_surface_image_view(PGRAPHVkState *r,
+                                      SurfaceBinding *surface)
+{
     VkImageViewCreateInfo image_view_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
         .image = surface->image,
@@ -826,91 +1142,557 @@ static void create_surface_image(PGRAPHState *pg, SurfaceBinding *surface)
     };
     VK_CHECK(vkCreateImageView(r->device, &image_view_create_info, NULL,
                                &surface->image_view));
+}
+
+static void create_surface_image(PGRAPHState *pg, SurfaceBinding *surface)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    assert(!surface->image);
+    assert(!surface->image_scratch);
+
+    VkImageCreateInfo image_create_info =
+        get_surface_image_create_info(pg, surface);
+
+    NV2A_VK_DPRINTF(
+        "Creating new surface image width=%d height=%d @ %08" HWADDR_PRIx,
+        image_create_info.extent.width, image_create_info.extent.height,
+        surface->vram_addr);
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+
+    // Tiles that are cleared on load and never stored need no memory at all
+    if (surface->transient) {
+        image_create_info.usage = VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT |
+                                  surface->host_fmt.usage;
+        alloc_create_info.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_TRANSIENT);
+    }
+
+    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
+                            &alloc_create_info, &surface->image,
+                            &surface->allocation, NULL));
+
+    // Only uploads and downloads go through the scratch image
+    if (!surface->transient) {
+        create_surface_scratch_image(r, surface, &image_create_info);
+    }
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_SURFACE],
+                                 surface->allocation, false);
+    surface->image_scratch_current_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    create_surface_image_view(r, surface);
+
+    // FIXME: Go right into main command buffer
+    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+
+    pgraph_vk_transition_image_layout(
+        pg, cmd, surface->image, surface->host_fmt.vk_format,
+        VK_IMAGE_LAYOUT_UNDEFINED,
+        surface->color ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_3);
+    pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_end_single_time_commands(pg, cmd);
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_CREATE);
+}
+
+static void migrate_surface_image(SurfaceBinding *dst, SurfaceBinding *src)
+{
+    dst->image = src->image;
+    dst->image_view = src->image_view;
+    dst->allocation = src->allocation;
+    dst->image_scratch = src->image_scratch;
+    dst->image_scratch_current_layout = src->image_scratch_current_layout;
+    dst->scratch_arena = src->scratch_arena;
+    dst->readback_buffer = src->readback_buffer;
+    dst->readback_allocation = src->readback_allocation;
+    dst->readback_mapped = src->readback_mapped;
+    dst->readback_submit = src->readback_submit;
+
+    src->image = VK_NULL_HANDLE;
+    src->image_view = VK_NULL_HANDLE;
+    src->allocation = VK_NULL_HANDLE;
+    src->image_scratch = VK_NULL_HANDLE;
+    src->image_scratch_current_layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    src->scratch_arena = NULL;
+    src->readback_buffer = VK_NULL_HANDLE;
+    src->readback_allocation = VK_NULL_HANDLE;
+    src->readback_mapped = NULL;
+}
+
+static void destroy_surface_image(PGRAPHVkState *r, SurfaceBinding *surface)
+{
+    vkDestroyImageView(r->device, surface->image_view, NULL);
+    surface->image_view = VK_NULL_HANDLE;
+
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_SURFACE],
+                                 surface->allocation, true);
+    vmaDestroyImage(r->allocator, surface->image, surface->allocation);
+    surface->image = VK_NULL_HANDLE;
+    surface->allocation = VK_NULL_HANDLE;
+
+    vkDestroyImage(r->device, surface->image_scratch, NULL);
+    surface->image_scratch = VK_NULL_HANDLE;
+    surface_scratch_arena_unref(r, surface->scratch_arena);
+    surface->scratch_arena = NULL;
+
+    destroy_surface_readback_buffer(r, surface);
+}
+
+static bool check_invalid_surface_is_compatibile(SurfaceBinding *surface,
+                                                 SurfaceBinding *target)
+{
+    return surface->transient == target->transient &&
+           surface->host_fmt.vk_format == target->host_fmt.vk_format &&
+           surface->width == target->width &&
+           surface->height == target->height &&
+           surface->host_fmt.usage == target->host_fmt.usage;
+}
+
+static SurfaceBinding *
+get_any_compatible_invalid_surface(PGRAPHVkState *r, SurfaceBinding *target)
+{
+    SurfaceBinding *surface, *next;
+    QTAILQ_FOREACH_SAFE(surface, &r->invalid_surfaces, entry, next) {
+        if (check_invalid_surface_is_compatibile(surface, target)) {
+            QTAILQ_REMOVE(&r->invalid_surfaces, surface, entry);
+            return surface;
+        }
+    }
+
+    return NULL;
+}
+
+static void prune_invalid_surfaces(PGRAPHVkState *r, int keep)
+{
+    int num_surfaces = 0;
+
+    SurfaceBinding *surface, *next;
+    QTAILQ_FOREACH_SAFE(surface, &r->invalid_surfaces, entry, next) {
+        num_surfaces += 1;
+        if (num_surfaces > keep) {
+            QTAILQ_REMOVE(&r->invalid_surfaces, surface, entry);
+            destroy_surface_image(r, surface);
+            g_free(surface);
+        }
+    }
+}
+
+static bool check_surface_rescale_supported(PGRAPHVkState *r,
+                                            SurfaceBinding *surface)
+{
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(
+        r->physical_device, surface->host_fmt.vk_format, &props);
+
+    VkFormatFeatureFlags required =
+        VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+    return (props.optimalTilingFeatures & required) == required;
+}
+
+static void rescale_surface(PGRAPHState *pg, SurfaceBinding *surface,
+                            unsigned int old_scale)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    pgraph_vk_release_surface_texture_aliases(pg, surface->image);
+
+    SurfaceBinding old;
+    memset(&old, 0, sizeof(old));
+    migrate_surface_image(&old, surface);
+    surface->readback_valid = false;
+
+    // Transient images can't be blitted, their contents are cleared away
+    // before use anyway
+    bool was_transient = surface->transient;
+    surface->transient = r->transient_surfaces && surface->attachment_used &&
+                         surface->attachment_only;
+
+    create_surface_image(pg, surface);
+
+    if (was_transient || surface->transient) {
+        destroy_surface_image(r, &old);
+        set_surface_label(pg, surface);
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_RESCALE);
+        return;
+    }
+
+    unsigned int old_width = surface->width * old_scale;
+    unsigned int old_height = surface->height * old_scale;
+    unsigned int new_width = surface->width, new_height = surface->height;
+    pgraph_apply_scaling_factor(pg, &new_width, &new_height);
+
+    VkImageLayout attachment_layout =
+        surface->color ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+
+    pgraph_vk_transition_image_layout(pg, cmd, old.image,
+                                      surface->host_fmt.vk_format,
+                                      attachment_layout,
+                                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    pgraph_vk_transition_image_layout(pg, cmd, surface->image,
+                                      surface->host_fmt.vk_format,
+                                      attachment_layout,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkImageBlit blit_region = {
+        .srcSubresource.aspectMask = surface->host_fmt.aspect,
+        .srcSubresource.layerCount = 1,
+        .srcOffsets[1] = (VkOffset3D){ old_width, old_height, 1 },
+        .dstSubresource.aspectMask = surface->host_fmt.aspect,
+        .dstSubresource.layerCount = 1,
+        .dstOffsets[1] = (VkOffset3D){ new_width, new_height, 1 },
+    };
+    vkCmdBlitImage(cmd, old.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   surface->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                   &blit_region,
+                   surface->color ? VK_FILTER_LINEAR : VK_FILTER_NEAREST);
+
+    pgraph_vk_transition_image_layout(pg, cmd, surface->image,
+                                      surface->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      attachment_layout);
+
+    pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_end_single_time_commands(pg, cmd);
+
+    destroy_surface_image(r, &old);
+    set_surface_label(pg, surface);
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_RESCALE);
+}
+
+/*
+ * Change the surface scale factor, resampling the contents of existing
+ * surfaces on the GPU instead of round-tripping them through guest RAM.
+ */
+void pgraph_vk_rescale_surfaces(NV2AState *d, unsigned int scale)
+{
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    scale = MAX(scale, 1);
+    if (scale == pg->surface_scale_factor) {
+        return;
+    }
+
+    pgraph_vk_finish(pg, VK_FINISH_REASON_SURFACE_CREATE);
+    pgraph_vk_wait_for_frames_in_flight(r);
+
+    unbind_surface(d, true);
+    unbind_surface(d, false);
+    memset(&pg->last_surface_shape, 0, sizeof(pg->last_surface_shape));
+
+    // Cached images were created at the old scale
+    prune_invalid_surfaces(r, 0);
+
+    unsigned int old_scale = pg->surface_scale_factor;
+    pg->surface_scale_factor = scale;
+
+    SurfaceBinding *surface, *next;
+    QTAILQ_FOREACH_SAFE(surface, &r->surfaces, entry, next) {
+        if (check_surface_rescale_supported(r, surface)) {
+            rescale_surface(pg, surface, old_scale);
+            continue;
+        }
+
+        // Scaling is applied when the surface is downloaded, so it has to be
+        // done while the old factor is in effect
+        pg->surface_scale_factor = old_scale;
+        pgraph_vk_surface_download_if_dirty(d, surface);
+        invalidate_surface(d, surface);
+        pg->surface_scale_factor = scale;
+    }
+    prune_invalid_surfaces(r, 0);
+}
+
+#define SURFACE_DEFRAG_CHECK_INTERVAL 600 // Frames
+#define SURFACE_DEFRAG_MIN_UNUSED (64 * MiB)
+#define SURFACE_DEFRAG_MAX_BYTES_PER_PASS (32 * MiB)
+
+/*
+ * Surfaces come and go all session long and leave holes in the blocks VMA
+ * allocated them from. Once a device heap spans several blocks with a
+ * quarter of the space unused, VMA plans a compaction and one pass of it is
+ * carried out per frame. Only surface images are moved, by copying them into
+ * a new image bound to the new location. Anything else VMA proposes stays
+ * where it is, and cached invalid surfaces are dropped up front to make room.
+ */
+static bool check_surface_heaps_fragmented(PGRAPHVkState *r)
+{
+    VkPhysicalDeviceMemoryProperties const *props;
+    vmaGetMemoryProperties(r->allocator, &props);
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets(r->allocator, budgets);
+
+    for (int i = 0; i < props->memoryHeapCount; i++) {
+        VmaStatistics *stats = &budgets[i].statistics;
+        if (!(props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) ||
+            stats->blockCount < 2) {
+            continue;
+        }
+        VkDeviceSize unused = stats->blockBytes - stats->allocationBytes;
+        if (unused >= SURFACE_DEFRAG_MIN_UNUSED &&
+            unused >= stats->blockBytes / 4) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void end_surface_defrag(PGRAPHVkState *r)
+{
+    vmaEndDefragmentation(r->allocator, r->surface_defrag, NULL);
+    r->surface_defrag = VK_NULL_HANDLE;
+}
+
+static void copy_surface_image(PGRAPHState *pg, VkCommandBuffer cmd,
+                               SurfaceBinding *surface, VkImage src,
+                               VkImage dst, const VkExtent3D *extent)
+{
+    VkImageLayout attachment_layout =
+        surface->color ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    pgraph_vk_transition_image_layout(pg, cmd, src,
+                                      surface->host_fmt.vk_format,
+                                      attachment_layout,
+                                      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+    pgraph_vk_transition_image_layout(pg, cmd, dst,
+                                      surface->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_UNDEFINED,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    VkImageCopy copy_region = {
+        .srcSubresource.aspectMask = surface->host_fmt.aspect,
+        .srcSubresource.layerCount = 1,
+        .dstSubresource.aspectMask = surface->host_fmt.aspect,
+        .dstSubresource.layerCount = 1,
+        .extent = *extent,
+    };
+    vkCmdCopyImage(cmd, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst,
+                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+
+    pgraph_vk_transition_image_layout(pg, cmd, dst,
+                                      surface->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                      attachment_layout);
+}
+
+static bool run_surface_defrag_pass(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    VmaDefragmentationPassMoveInfo pass;
+    if (vmaBeginDefragmentationPass(r->allocator, r->surface_defrag, &pass) ==
+        VK_SUCCESS) {
+        return true;
+    }
+
+    g_autoptr(GHashTable) owners = g_hash_table_new(NULL, NULL);
+    SurfaceBinding *surface;
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        if (!surface->transient) {
+            g_hash_table_insert(owners, surface->allocation, surface);
+        }
+    }
+
+    g_autofree SurfaceBinding **moved =
+        g_new0(SurfaceBinding *, pass.moveCount);
+    g_autofree VkImage *old_images = g_new0(VkImage, pass.moveCount);
+    VkCommandBuffer cmd = VK_NULL_HANDLE;
+
+    for (uint32_t i = 0; i < pass.moveCount; i++) {
+        VmaDefragmentationMove *move = &pass.pMoves[i];
+        surface = g_hash_table_lookup(owners, move->srcAllocation);
+        if (!surface) {
+            move->operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+            continue;
+        }
 
-    // FIXME: Go right into main command buffer
-    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
-    pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+        if (!cmd) {
+            pgraph_vk_wait_for_frames_in_flight(r);
+            cmd = pgraph_vk_begin_single_time_commands(pg);
+            pgraph_vk_begin_debug_marker(r, cmd, RGBA_RED, __func__);
+        }
 
-    pgraph_vk_transition_image_layout(
-        pg, cmd, surface->image, surface->host_fmt.vk_format,
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        surface->color ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
-                         VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+        VkImageCreateInfo image_create_info =
+            get_surface_image_create_info(pg, surface);
+        VkImage image;
+        VK_CHECK(vkCreateImage(r->device, &image_create_info, NULL, &image));
+        VK_CHECK(vmaBindImageMemory(r->allocator, move->dstTmpAllocation,
+                                    image));
+        copy_surface_image(pg, cmd, surface, surface->image, image,
+                           &image_create_info.extent);
+
+        old_images[i] = surface->image;
+        surface->image = image;
+        moved[i] = surface;
+    }
 
-    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_3);
-    pgraph_vk_end_debug_marker(r, cmd);
-    pgraph_vk_end_single_time_commands(pg, cmd);
-    nv2a_profile_inc_counter(NV2A_PROF_SURF_CREATE);
-}
+    if (cmd) {
+        pgraph_vk_end_debug_marker(r, cmd);
+        pgraph_vk_end_single_time_commands(pg, cmd);
+    }
 
-static void migrate_surface_image(SurfaceBinding *dst, SurfaceBinding *src)
-{
-    dst->image = src->image;
-    dst->image_view = src->image_view;
-    dst->allocation = src->allocation;
-    dst->image_scratch = src->image_scratch;
-    dst->image_scratch_current_layout = src->image_scratch_current_layout;
-    dst->allocation_scratch = src->allocation_scratch;
+    for (uint32_t i = 0; i < pass.moveCount; i++) {
+        surface = moved[i];
+        if (!surface) {
+            continue;
+        }
 
-    src->image = VK_NULL_HANDLE;
-    src->image_view = VK_NULL_HANDLE;
-    src->allocation = VK_NULL_HANDLE;
-    src->image_scratch = VK_NULL_HANDLE;
-    src->image_scratch_current_layout = VK_IMAGE_LAYOUT_UNDEFINED;
-    src->allocation_scratch = VK_NULL_HANDLE;
+        pgraph_vk_release_surface_texture_aliases(pg, old_images[i]);
+        vkDestroyImageView(r->device, surface->image_view, NULL);
+        vkDestroyImage(r->device, old_images[i], NULL);
+        create_surface_image_view(r, surface);
+        set_surface_label(pg, surface);
+        if (surface == r->color_binding || surface == r->zeta_binding) {
+            r->framebuffer_dirty = true;
+        }
+        nv2a_profile_inc_counter(NV2A_PROF_SURF_DEFRAG_MOVE);
+    }
+
+    // Moved allocations now refer to their new place
+    return vmaEndDefragmentationPass(r->allocator, r->surface_defrag,
+                                     &pass) == VK_SUCCESS;
 }
 
-static void destroy_surface_image(PGRAPHVkState *r, SurfaceBinding *surface)
+/* Called at each flip, after the frame has been submitted */
+void pgraph_vk_defragment_surfaces(NV2AState *d)
 {
-    vkDestroyImageView(r->device, surface->image_view, NULL);
-    surface->image_view = VK_NULL_HANDLE;
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
 
-    vmaDestroyImage(r->allocator, surface->image, surface->allocation);
-    surface->image = VK_NULL_HANDLE;
-    surface->allocation = VK_NULL_HANDLE;
+    if (!r->surface_defrag) {
+        if (pg->frame_time - r->surface_defrag_check_frame <
+            SURFACE_DEFRAG_CHECK_INTERVAL) {
+            return;
+        }
+        r->surface_defrag_check_frame = pg->frame_time;
+        if (!check_surface_heaps_fragmented(r)) {
+            return;
+        }
 
-    vmaDestroyImage(r->allocator, surface->image_scratch,
-                    surface->allocation_scratch);
-    surface->image_scratch = VK_NULL_HANDLE;
-    surface->allocation_scratch = VK_NULL_HANDLE;
+        prune_invalid_surfaces(r, 0);
+
+        VmaDefragmentationInfo info = {
+            .flags = VMA_DEFRAGMENTATION_FLAG_ALGORITHM_FAST_BIT,
+            .maxBytesPerPass = SURFACE_DEFRAG_MAX_BYTES_PER_PASS,
+        };
+        if (vmaBeginDefragmentation(r->allocator, &info, &r->surface_defrag) !=
+            VK_SUCCESS) {
+            r->surface_defrag = VK_NULL_HANDLE;
+            return;
+        }
+    }
+
+    if (run_surface_defrag_pass(pg)) {
+        end_surface_defrag(r);
+    }
 }
 
-static bool check_invalid_surface_is_compatibile(SurfaceBinding *surface,
-                                                 SurfaceBinding *target)
+void pgraph_vk_process_pending_surface_rescale(NV2AState *d)
 {
-    return surface->host_fmt.vk_format == target->host_fmt.vk_format &&
-           surface->width == target->width &&
-           surface->height == target->height &&
-           surface->host_fmt.usage == target->host_fmt.usage;
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
+    r->dynamic_scale.frame_time_avg = 0;
+    pgraph_vk_rescale_surfaces(d, g_config.display.quality.surface_scale);
+
+    qatomic_set(&r->surface_rescale_pending, false);
+    qemu_event_set(&r->surface_rescale_complete);
 }
 
-static SurfaceBinding *
-get_any_compatible_invalid_surface(PGRAPHVkState *r, SurfaceBinding *target)
+/*
+ * Dynamic resolution: step the scale factor between 1 and the configured
+ * surface scale to keep the frame time, as measured between flip stalls,
+ * near the target.
+ */
+void pgraph_vk_update_dynamic_surface_scale(NV2AState *d)
 {
-    SurfaceBinding *surface, *next;
-    QTAILQ_FOREACH_SAFE(surface, &r->invalid_surfaces, entry, next) {
-        if (check_invalid_surface_is_compatibile(surface, target)) {
-            QTAILQ_REMOVE(&r->invalid_surfaces, surface, entry);
-            return surface;
-        }
+    PGRAPHState *pg = &d->pgraph;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    DynamicSurfaceScale *ds = &r->dynamic_scale;
+
+    if (!g_config.display.quality.dynamic_scale.enabled ||
+        !g_nv2a_stats.frame_count) {
+        return;
     }
 
-    return NULL;
+    unsigned int max_scale = MAX(g_config.display.quality.surface_scale, 1);
+    int target_fps = MAX(g_config.display.quality.dynamic_scale.target_fps, 1);
+    float target_ms = 1000.0f / target_fps;
+
+    unsigned int idx = (g_nv2a_stats.frame_ptr + NV2A_PROF_NUM_FRAMES - 1) %
+                       NV2A_PROF_NUM_FRAMES;
+    float frame_ms = g_nv2a_stats.frame_history[idx].mspf;
+
+    if (ds->frame_time_avg == 0) {
+        ds->frame_time_avg = frame_ms;
+        ds->frames_since_change = 0;
+    }
+
+    // Smooth out single slow frames such as loading hitches
+    const float smoothing = 0.1f;
+    ds->frame_time_avg += (frame_ms - ds->frame_time_avg) * smoothing;
+    ds->frames_since_change += 1;
+
+    // Give the average time to settle after each change
+    const int min_frames_between_changes = 60;
+    if (ds->frames_since_change < min_frames_between_changes) {
+        return;
+    }
+
+    unsigned int scale = pg->surface_scale_factor;
+    if (ds->frame_time_avg > target_ms * 1.1f && scale > 1) {
+        scale -= 1;
+    } else if (ds->frame_time_avg < target_ms * 0.7f && scale < max_scale) {
+        scale += 1;
+    } else if (scale > max_scale) {
+        scale = max_scale;
+    }
+
+    if (scale != pg->surface_scale_factor) {
+        pgraph_vk_rescale_surfaces(d, scale);
+        ds->frames_since_change = 0;
+    }
 }
 
-static void prune_invalid_surfaces(PGRAPHVkState *r, int keep)
+/*
+ * While the frame is skipped, drop draws and clears to surfaces that are only
+ * ever displayed. Draws counted by an occlusion query are kept so reports
+ * stay exact, as are draws to surfaces that get sampled or read back. Returns
+ * true if the draw is to be dropped.
+ */
+bool pgraph_vk_frame_skip_draw(PGRAPHState *pg)
 {
-    int num_surfaces = 0;
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    SurfaceBinding *color = r->color_binding, *zeta = r->zeta_binding;
 
-    SurfaceBinding *surface, *next;
-    QTAILQ_FOREACH_SAFE(surface, &r->invalid_surfaces, entry, next) {
-        num_surfaces += 1;
-        if (num_surfaces > keep) {
-            QTAILQ_REMOVE(&r->invalid_surfaces, surface, entry);
-            destroy_surface_image(r, surface);
-            g_free(surface);
+    if (!r->frame_skip) {
+        if (color) {
+            color->frame_skipped = false;
         }
+        return false;
+    }
+
+    if (pg->zpass_pixel_count_enable || !color || !color->displayed ||
+        color->frame_skip_pinned || color->readback_requested ||
+        (zeta && zeta->frame_skip_pinned)) {
+        return false;
     }
+
+    color->frame_skipped = true;
+    nv2a_profile_inc_counter(NV2A_PROF_DRAW_FRAMESKIP);
+    return true;
 }
 
 static void expire_old_surfaces(NV2AState *d)
@@ -928,6 +1710,90 @@ static void expire_old_surfaces(NV2AState *d)
     }
 }
 
+typedef struct SurfaceEvictionCandidate {
+    SurfaceBinding *surface;
+    uint64_t weight;
+} SurfaceEvictionCandidate;
+
+static gint compare_surface_eviction_candidates(gconstpointer a,
+                                                gconstpointer b)
+{
+    const SurfaceEvictionCandidate *ca = a, *cb = b;
+    return ca->weight < cb->weight ? 1 : ca->weight > cb->weight ? -1 : 0;
+}
+
+static bool release_surface_heap_excess(PGRAPHVkState *r,
+                                        SurfaceBinding *surface,
+                                        VkDeviceSize *heap_excess)
+{
+    return pgraph_vk_release_heap_excess(r, surface->allocation, heap_excess);
+}
+
+/*
+ * Free surfaces from the heaps with a non-zero entry in heap_excess. Cached
+ * invalid surfaces go first, then surfaces not used in the current frame,
+ * which are written back if dirty. Returns true if all heaps are within
+ * budget.
+ */
+bool pgraph_vk_trim_surfaces(NV2AState *d, VkDeviceSize *heap_excess)
+{
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+    SurfaceBinding *surface, *next;
+
+    QTAILQ_FOREACH_SAFE(surface, &r->invalid_surfaces, entry, next) {
+        if (!pgraph_vk_get_eviction_weight(r, surface->allocation, 0,
+                                           heap_excess)) {
+            continue;
+        }
+        bool within_budget =
+            release_surface_heap_excess(r, surface, heap_excess);
+        QTAILQ_REMOVE(&r->invalid_surfaces, surface, entry);
+        destroy_surface_image(r, surface);
+        g_free(surface);
+        if (within_budget) {
+            return true;
+        }
+    }
+
+    g_autoptr(GArray) candidates =
+        g_array_new(FALSE, FALSE, sizeof(SurfaceEvictionCandidate));
+    QTAILQ_FOREACH(surface, &r->surfaces, entry) {
+        int last_used = d->pgraph.frame_time - surface->frame_time;
+        if (last_used < 1 || surface == r->color_binding ||
+            surface == r->zeta_binding) {
+            continue;
+        }
+        SurfaceEvictionCandidate candidate = {
+            .surface = surface,
+            .weight = pgraph_vk_get_eviction_weight(r, surface->allocation,
+                                                    last_used, heap_excess),
+        };
+        if (candidate.weight) {
+            g_array_append_val(candidates, candidate);
+        }
+    }
+    g_array_sort(candidates, compare_surface_eviction_candidates);
+
+    for (int i = 0; i < candidates->len; i++) {
+        surface =
+            g_array_index(candidates, SurfaceEvictionCandidate, i).surface;
+        trace_nv2a_pgraph_surface_evict_reason("budget", surface->vram_addr);
+        pgraph_vk_surface_download_if_dirty(d, surface);
+        invalidate_surface(d, surface);
+
+        bool within_budget =
+            release_surface_heap_excess(r, surface, heap_excess);
+        QTAILQ_REMOVE(&r->invalid_surfaces, surface, entry);
+        destroy_surface_image(r, surface);
+        g_free(surface);
+        if (within_budget) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static bool check_surface_compatibility(SurfaceBinding const *s1,
                                         SurfaceBinding const *s2, bool strict)
 {
@@ -959,6 +1825,12 @@ void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
     PGRAPHState *pg = &d->pgraph;
     PGRAPHVkState *r = pg->vk_renderer_state;
 
+    if (tcg_enabled() && !surface->draw_dirty) {
+        /* Pick up CPU writes made since VRAM was last in sync */
+        surface->upload_pending |= pgraph_vram_test_and_clear_dirty(
+            d, surface->vram_addr, surface->size, DIRTY_MEMORY_NV2A);
+    }
+
     if (!(surface->upload_pending || force)) {
         return;
     }
@@ -981,13 +1853,37 @@ void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
         return;
     }
 
+    // The initial upload is expected to be cleared away, any later one means
+    // the guest wrote to the surface and it has to be demoted
+    if (surface->transient) {
+        if (surface->attachment_used) {
+            nv2a_profile_inc_counter(NV2A_PROF_SURF_TRANSIENT_MISS);
+            surface->attachment_only = false;
+        }
+        surface->initialized = true;
+        return;
+    }
+
     uint8_t *data = d->vram_ptr;
     uint8_t *buf = data + surface->vram_addr;
 
+    bool use_compute_to_convert_depth_stencil_format =
+        surface->host_fmt.vk_format == VK_FORMAT_D24_UNORM_S8_UINT ||
+        surface->host_fmt.vk_format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+
+    // Unswizzled on the GPU after the copy from the staging buffer
+    bool use_compute_to_unswizzle =
+        surface->swizzle && !use_compute_to_convert_depth_stencil_format &&
+        pgraph_vk_check_surface_swizzle_supported(r, surface);
+
+    bool cpu_unswizzle = surface->swizzle &&
+                         !use_compute_to_convert_depth_stencil_format &&
+                         !use_compute_to_unswizzle;
+
     g_autofree uint8_t *swizzle_buf = NULL;
     uint8_t *gl_read_buf = NULL;
 
-    if (surface->swizzle) {
+    if (cpu_unswizzle) {
         swizzle_buf = (uint8_t*)g_malloc(surface->size);
         gl_read_buf = swizzle_buf;
         unswizzle_rect(data + surface->vram_addr,
@@ -1004,27 +1900,45 @@ void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
     // Upload image data from host to staging buffer
     //
 
-    StorageBuffer *copy_buffer = &r->storage_buffers[BUFFER_STAGING_SRC];
     size_t uploaded_image_size = surface->height * surface->width *
                                  surface->fmt.bytes_per_pixel;
-    assert(uploaded_image_size <= copy_buffer->buffer_size);
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_SRC,
+                                     uploaded_image_size);
+    if (use_compute_to_convert_depth_stencil_format) {
+        unsigned int w = surface->width, h = surface->height;
+        pgraph_apply_scaling_factor(pg, &w, &h);
+        size_t unpacked_size =
+            ROUND_UP(w * h * 4,
+                     r->device_props.limits.minStorageBufferOffsetAlignment) +
+            w * h;
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_DST,
+                                         uploaded_image_size);
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_SRC, unpacked_size);
+    } else if (use_compute_to_unswizzle) {
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_DST,
+                                         uploaded_image_size);
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_SRC,
+                                         uploaded_image_size);
+    }
+
+    StorageBuffer *copy_buffer = &r->storage_buffers[BUFFER_STAGING_SRC];
 
     void *mapped_memory_ptr = NULL;
     VK_CHECK(vmaMapMemory(r->allocator, copy_buffer->allocation,
                           &mapped_memory_ptr));
 
-    bool use_compute_to_convert_depth_stencil_format =
-        surface->host_fmt.vk_format == VK_FORMAT_D24_UNORM_S8_UINT ||
-        surface->host_fmt.vk_format == VK_FORMAT_D32_SFLOAT_S8_UINT;
-
     bool no_conversion_necessary =
         surface->color || surface->host_fmt.vk_format == VK_FORMAT_D16_UNORM ||
         use_compute_to_convert_depth_stencil_format;
     assert(no_conversion_necessary);
 
-    memcpy_image(mapped_memory_ptr, gl_read_buf,
-                 surface->width * surface->fmt.bytes_per_pixel, surface->pitch,
-                 surface->height);
+    if (surface->swizzle && !cpu_unswizzle) {
+        memcpy(mapped_memory_ptr, buf, uploaded_image_size);
+    } else {
+        memcpy_image(mapped_memory_ptr, gl_read_buf,
+                     surface->width * surface->fmt.bytes_per_pixel,
+                     surface->pitch, surface->height);
+    }
 
     vmaFlushAllocation(r->allocator, copy_buffer->allocation, 0, VK_WHOLE_SIZE);
     vmaUnmapMemory(r->allocator, copy_buffer->allocation);
@@ -1137,7 +2051,7 @@ void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
 
         pgraph_vk_unpack_depth_stencil(
             pg, surface, cmd, r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
-            unpack_buffer->buffer);
+            unpack_buffer->buffer, surface->swizzle);
 
         VkBufferMemoryBarrier post_unpack_src_barrier = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
@@ -1173,21 +2087,110 @@ void pgraph_vk_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
                      r->device_props.limits.minStorageBufferOffsetAlignment);
 
         copy_buffer = unpack_buffer;
+    } else if (use_compute_to_unswizzle) {
+
+        //
+        // Copy swizzled image buffer to compute_dst for unswizzling
+        //
+
+        VkBufferCopy buffer_copy_region = {
+            .size = uploaded_image_size,
+        };
+        vkCmdCopyBuffer(cmd, copy_buffer->buffer,
+                        r->storage_buffers[BUFFER_COMPUTE_DST].buffer, 1,
+                        &buffer_copy_region);
+
+        VkBufferMemoryBarrier post_copy_src_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = copy_buffer->buffer,
+            .size = VK_WHOLE_SIZE
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                             &post_copy_src_barrier, 0, NULL);
+
+        //
+        // Unswizzle image into compute_src
+        //
+
+        VkBufferMemoryBarrier pre_unswizzle_src_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+            .size = VK_WHOLE_SIZE
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                             1, &pre_unswizzle_src_barrier, 0, NULL);
+
+        StorageBuffer *unswizzle_buffer =
+            &r->storage_buffers[BUFFER_COMPUTE_SRC];
+
+        VkBufferMemoryBarrier pre_unswizzle_dst_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = unswizzle_buffer->buffer,
+            .size = uploaded_image_size
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 1,
+                             &pre_unswizzle_dst_barrier, 0, NULL);
+
+        pgraph_vk_swizzle_surface(
+            pg, surface, cmd, r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+            unswizzle_buffer->buffer, true);
+
+        VkBufferMemoryBarrier post_unswizzle_src_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
+            .size = VK_WHOLE_SIZE
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                             &post_unswizzle_src_barrier, 0, NULL);
+
+        VkBufferMemoryBarrier post_unswizzle_dst_barrier = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = unswizzle_buffer->buffer,
+            .size = uploaded_image_size
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                             &post_unswizzle_dst_barrier, 0, NULL);
+
+        copy_buffer = unswizzle_buffer;
     }
 
     //
     // Copy image data from buffer to staging image
     //
 
-    if (surface->image_scratch_current_layout !=
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
-        pgraph_vk_transition_image_layout(pg, cmd, surface->image_scratch,
-                                          surface->host_fmt.vk_format,
-                                          surface->image_scratch_current_layout,
-                                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-        surface->image_scratch_current_layout =
-            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-    }
+    // Another surface may have used the scratch memory since, so nothing it
+    // held is kept
+    pgraph_vk_transition_image_layout(pg, cmd, surface->image_scratch,
+                                      surface->host_fmt.vk_format,
+                                      VK_IMAGE_LAYOUT_UNDEFINED,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+    surface->image_scratch_current_layout =
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 
     vkCmdCopyBufferToImage(cmd, copy_buffer->buffer, surface->image_scratch,
                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, num_regions,
@@ -1376,6 +2379,11 @@ static void populate_surface_binding_target_sized(NV2AState *d, bool color,
     target->frame_time = pg->frame_time;
     target->draw_time = pg->draw_time;
     target->cleared = false;
+    target->zeta_contents_needed = false;
+    target->zeta_last_pass_cleared = false;
+    target->attachment_used = false;
+    target->attachment_only = true;
+    target->transient = false;
 
     target->initialized = false;
 }
@@ -1417,9 +2425,17 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
 
     Surface *pg_surface = color ? &pg->surface_color : &pg->surface_zeta;
 
-    bool mem_dirty = !tcg_enabled() && memory_region_test_and_clear_dirty(
-                                           d->vram, target.vram_addr,
-                                           target.size, DIRTY_MEMORY_NV2A);
+    SurfaceBinding *transient_binding = color ? r->color_binding
+                                              : r->zeta_binding;
+    if (transient_binding && transient_binding->transient &&
+        !transient_binding->attachment_only) {
+        // Recreate a transient surface that turned out to be read
+        pg_surface->buffer_dirty = true;
+        invalidate_surface(d, transient_binding);
+    }
+
+    bool mem_dirty = pgraph_vram_test_and_clear_dirty(
+        d, target.vram_addr, target.size, DIRTY_MEMORY_NV2A);
 
     SurfaceBinding *current_binding = color ? r->color_binding
                                             : r->zeta_binding;
@@ -1428,7 +2444,8 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
         (upload && (pg_surface->buffer_dirty || mem_dirty))) {
         // FIXME: We don't need to be so aggressive flushing the command list
         // pgraph_vk_finish(pg, VK_FINISH_REASON_SURFACE_CREATE);
-        pgraph_vk_ensure_not_in_render_pass(pg);
+        pgraph_vk_ensure_not_in_render_pass(pg,
+                                            VK_RENDER_PASS_END_SURFACE_CHANGE);
 
         unbind_surface(d, color);
 
@@ -1528,6 +2545,10 @@ static void update_surface_part(NV2AState *d, bool upload, bool color)
         }
 
         if (should_create) {
+            target.transient =
+                r->transient_surfaces && pg->clearing &&
+                g_hash_table_contains(r->transient_surface_addrs,
+                                      transient_surface_key(&target));
             surface = get_any_compatible_invalid_surface(r, &target);
             if (surface) {
                 migrate_surface_image(&target, surface);
@@ -1700,6 +2721,21 @@ static bool check_surface_internal_formats_supported(
     return all_supported;
 }
 
+static bool check_lazily_allocated_memory_supported(PGRAPHVkState *r)
+{
+    VkPhysicalDeviceMemoryProperties props;
+    vkGetPhysicalDeviceMemoryProperties(r->physical_device, &props);
+
+    for (uint32_t i = 0; i < props.memoryTypeCount; i++) {
+        if (props.memoryTypes[i].propertyFlags &
+            VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 void pgraph_vk_init_surfaces(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -1735,25 +2771,50 @@ void pgraph_vk_init_surfaces(PGRAPHState *pg)
     }
 
     QTAILQ_INIT(&r->surfaces);
+    r->surface_tree = (IntervalTreeRoot){};
     QTAILQ_INIT(&r->invalid_surfaces);
 
     r->downloads_pending = false;
     qemu_event_init(&r->downloads_complete, false);
     qemu_event_init(&r->dirty_surfaces_download_complete, false);
+    r->surface_rescale_pending = false;
+    qemu_event_init(&r->surface_rescale_complete, false);
+    r->dynamic_scale.frame_time_avg = 0;
+    r->dynamic_scale.frames_since_change = 0;
 
     r->color_binding = NULL;
     r->zeta_binding = NULL;
     r->framebuffer_dirty = true;
 
+    r->transient_surfaces = (g_config.display.vulkan.tiler_render_passes ||
+                             r->low_memory) &&
+                            check_lazily_allocated_memory_supported(r);
+    r->transient_surface_addrs = g_hash_table_new(NULL, NULL);
+    r->surface_scratch_arena = NULL;
+    r->surface_defrag = VK_NULL_HANDLE;
+    r->surface_defrag_check_frame = 0;
+
+    pgraph_vk_init_surface_profile(pg);
+
     pgraph_vk_reload_surface_scale_factor(pg); // FIXME: Move internal
 }
 
 void pgraph_vk_finalize_surfaces(PGRAPHState *pg)
 {
-    pgraph_vk_surface_flush(container_of(pg, NV2AState, pgraph));
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->surface_defrag) {
+        end_surface_defrag(r);
+    }
+    pgraph_vk_surface_flush(container_of(pg, NV2AState, pgraph), false);
+    surface_scratch_arena_unref(r, r->surface_scratch_arena);
+    r->surface_scratch_arena = NULL;
+    pgraph_vk_finalize_surface_profile(pg);
+    g_hash_table_destroy(r->transient_surface_addrs);
+    r->transient_surface_addrs = NULL;
 }
 
-void pgraph_vk_surface_flush(NV2AState *d)
+void pgraph_vk_surface_flush(NV2AState *d, bool discard)
 {
     PGRAPHState *pg = &d->pgraph;
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -1769,7 +2830,11 @@ void pgraph_vk_surface_flush(NV2AState *d)
     QTAILQ_FOREACH_SAFE(s, &r->surfaces, entry, next) {
         // FIXME: We should download all surfaces to ram, but need to
         //        investigate corruption issue
-        pgraph_vk_surface_download_if_dirty(d, s);
+        // After a load the GPU contents are stale, writing them back would
+        // overwrite restored RAM
+        if (!discard) {
+            pgraph_vk_surface_download_if_dirty(d, s);
+        }
         invalidate_surface(d, s);
     }
     prune_invalid_surfaces(r, 0);
@@ -0,0 +1,1399 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "ui/xemu-settings.h"
+#include "ui/xemu-widescreen.h"
+#include "hw/xbox/nv2a/nv2a_vk_present.h"
+#include "renderer.h"
+#include "ui/shader/display-upscale-glsl.h"
+
+#include <SDL_vulkan.h>
+
+/*
+ * Native presentation draws the display image straight into a swapchain
+ * owned by the renderer, instead of handing it over to the GL window. The
+ * requesting thread creates the window surface, then blocks while the
+ * renderer thread draws the frame and the overlay, and presents it.
+ */
+
+// Descriptor sets reserved for the overlay's textures
+#define OVERLAY_DESCRIPTOR_POOL_SIZE 16
+
+// RCAS sharpness, as in the GL path
+#define UPSCALE_SHARPNESS 0.87f
+
+static void fail_native_present(PGRAPHVkSwapchainState *sc, const char *msg)
+{
+    fprintf(stderr, "nv2a: Native presentation unavailable: %s\n", msg);
+    sc->failed = true;
+}
+
+static bool create_surface(PGRAPHVkState *r, void *window)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (sc->failed) {
+        return false;
+    }
+    if (sc->surface != VK_NULL_HANDLE) {
+        return true;
+    }
+    if (!r->swapchain_extension_enabled) {
+        fail_native_present(sc, "VK_KHR_swapchain is not enabled");
+        return false;
+    }
+
+    if (!SDL_Vulkan_CreateSurface(window, r->instance, &sc->surface)) {
+        fail_native_present(sc, SDL_GetError());
+        sc->surface = VK_NULL_HANDLE;
+        return false;
+    }
+
+    QueueFamilyIndices indices =
+        pgraph_vk_find_queue_families(r->physical_device);
+    VkBool32 supported = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(
+        r->physical_device, indices.queue_family, sc->surface, &supported);
+    if (!supported) {
+        vkDestroySurfaceKHR(r->instance, sc->surface, NULL);
+        sc->surface = VK_NULL_HANDLE;
+        fail_native_present(sc, "queue cannot present to the window");
+        return false;
+    }
+
+    sc->window = window;
+    sc->queue_family = indices.queue_family;
+    return true;
+}
+
+static bool choose_surface_format(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    // The display image already holds non-linear values, as in the GL path
+    static const VkFormat preferred_formats[] = {
+        VK_FORMAT_B8G8R8A8_UNORM,
+        VK_FORMAT_R8G8B8A8_UNORM,
+        VK_FORMAT_A2B10G10R10_UNORM_PACK32,
+    };
+
+    uint32_t num_formats = 0;
+    VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(
+        r->physical_device, sc->surface, &num_formats, NULL));
+    g_autofree VkSurfaceFormatKHR *formats =
+        g_malloc_n(num_formats, sizeof(VkSurfaceFormatKHR));
+    VK_CHECK(vkGetPhysicalDeviceSurfaceFormatsKHR(
+        r->physical_device, sc->surface, &num_formats, formats));
+
+    for (int i = 0; i < ARRAY_SIZE(preferred_formats); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(r->physical_device,
+                                            preferred_formats[i], &props);
+        if (!(props.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT)) {
+            continue;
+        }
+
+        for (int j = 0; j < num_formats; j++) {
+            if (formats[j].format == preferred_formats[i] &&
+                formats[j].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
+                sc->format = formats[j].format;
+                sc->color_space = formats[j].colorSpace;
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static VkPresentModeKHR get_requested_present_mode(void)
+{
+#ifdef __ANDROID__
+    // The compositor never tears, so immediate is mailbox at best. FIFO is
+    // relaxed so a late frame is shown at once instead of a refresh later.
+    if (!g_config.display.window.vsync ||
+        g_config.display.window.present_mode !=
+            CONFIG_DISPLAY_WINDOW_PRESENT_MODE_FIFO) {
+        return VK_PRESENT_MODE_MAILBOX_KHR;
+    }
+    return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+#else
+    if (!g_config.display.window.vsync) {
+        return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    }
+
+    switch (g_config.display.window.present_mode) {
+    case CONFIG_DISPLAY_WINDOW_PRESENT_MODE_MAILBOX:
+        return VK_PRESENT_MODE_MAILBOX_KHR;
+    case CONFIG_DISPLAY_WINDOW_PRESENT_MODE_IMMEDIATE:
+        return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    case CONFIG_DISPLAY_WINDOW_PRESENT_MODE_FIFO:
+    default:
+        return VK_PRESENT_MODE_FIFO_KHR;
+    }
+#endif
+}
+
+static VkPresentModeKHR choose_present_mode(PGRAPHVkState *r,
+                                            VkPresentModeKHR requested)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    uint32_t num_modes = 0;
+    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(
+        r->physical_device, sc->surface, &num_modes, NULL));
+    g_autofree VkPresentModeKHR *modes =
+        g_malloc_n(num_modes, sizeof(VkPresentModeKHR));
+    VK_CHECK(vkGetPhysicalDeviceSurfacePresentModesKHR(
+        r->physical_device, sc->surface, &num_modes, modes));
+
+    for (int i = 0; i < num_modes; i++) {
+        if (modes[i] == requested) {
+            return requested;
+        }
+    }
+
+#ifdef __ANDROID__
+    // Older Android releases only offer mailbox and FIFO
+    for (int i = 0; i < num_modes; i++) {
+        if (modes[i] == VK_PRESENT_MODE_MAILBOX_KHR ||
+            modes[i] == VK_PRESENT_MODE_FIFO_RELAXED_KHR) {
+            return modes[i];
+        }
+    }
+#endif
+
+    // Always supported
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+static void create_render_pass(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    // The frame is already in the image, the overlay is drawn on top
+    VkAttachmentDescription attachment = {
+        .format = sc->format,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+    };
+
+    VkAttachmentReference color_reference = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_reference,
+    };
+
+    VkRenderPassCreateInfo render_pass_create_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+    };
+    VK_CHECK(vkCreateRenderPass(r->device, &render_pass_create_info, NULL,
+                                &sc->render_pass));
+}
+
+static void create_overlay_descriptor_pool(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = OVERLAY_DESCRIPTOR_POOL_SIZE,
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+        .maxSets = OVERLAY_DESCRIPTOR_POOL_SIZE,
+    };
+    VK_CHECK(vkCreateDescriptorPool(r->device, &pool_info, NULL,
+                                    &sc->overlay_descriptor_pool));
+}
+
+static bool init_swapchain_resources(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (!choose_surface_format(r)) {
+        fail_native_present(sc, "no supported window surface format");
+        return false;
+    }
+
+    create_render_pass(r);
+    create_overlay_descriptor_pool(r);
+
+    VkCommandBufferAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = r->command_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    VK_CHECK(vkAllocateCommandBuffers(r->device, &alloc_info,
+                                      &sc->command_buffer));
+
+    VkFenceCreateInfo fence_info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+    VK_CHECK(vkCreateFence(r->device, &fence_info, NULL, &sc->fence));
+
+    VkSemaphoreCreateInfo semaphore_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+    VK_CHECK(vkCreateSemaphore(r->device, &semaphore_info, NULL,
+                               &sc->acquire_semaphore));
+
+    return true;
+}
+
+static void destroy_swapchain_images(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    for (int i = 0; i < sc->num_images; i++) {
+        vkDestroyFramebuffer(r->device, sc->framebuffers[i], NULL);
+        vkDestroyImageView(r->device, sc->image_views[i], NULL);
+        vkDestroySemaphore(r->device, sc->render_semaphores[i], NULL);
+    }
+
+    g_free(sc->images);
+    g_free(sc->image_views);
+    g_free(sc->framebuffers);
+    g_free(sc->render_semaphores);
+    sc->images = NULL;
+    sc->image_views = NULL;
+    sc->framebuffers = NULL;
+    sc->render_semaphores = NULL;
+    sc->num_images = 0;
+}
+
+static void create_swapchain_images(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    VK_CHECK(vkGetSwapchainImagesKHR(r->device, sc->swapchain,
+                                     &sc->num_images, NULL));
+    sc->images = g_malloc_n(sc->num_images, sizeof(VkImage));
+    VK_CHECK(vkGetSwapchainImagesKHR(r->device, sc->swapchain,
+                                     &sc->num_images, sc->images));
+
+    sc->image_views = g_malloc_n(sc->num_images, sizeof(VkImageView));
+    sc->framebuffers = g_malloc_n(sc->num_images, sizeof(VkFramebuffer));
+    sc->render_semaphores = g_malloc_n(sc->num_images, sizeof(VkSemaphore));
+
+    for (int i = 0; i < sc->num_images; i++) {
+        VkImageViewCreateInfo view_info = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = sc->images[i],
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = sc->format,
+            .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .subresourceRange.levelCount = 1,
+            .subresourceRange.layerCount = 1,
+        };
+        VK_CHECK(vkCreateImageView(r->device, &view_info, NULL,
+                                   &sc->image_views[i]));
+
+        VkFramebufferCreateInfo framebuffer_info = {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = sc->render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &sc->image_views[i],
+            .width = sc->extent.width,
+            .height = sc->extent.height,
+            .layers = 1,
+        };
+        VK_CHECK(vkCreateFramebuffer(r->device, &framebuffer_info, NULL,
+                                     &sc->framebuffers[i]));
+
+        VkSemaphoreCreateInfo semaphore_info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        };
+        VK_CHECK(vkCreateSemaphore(r->device, &semaphore_info, NULL,
+                                   &sc->render_semaphores[i]));
+    }
+}
+
+static bool create_swapchain(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+    const NV2APresentRequest *req = &sc->request;
+
+    VkSurfaceCapabilitiesKHR caps;
+    VK_CHECK(vkGetPhysicalDeviceSurfaceCapabilitiesKHR(
+        r->physical_device, sc->surface, &caps));
+
+    if (!(caps.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+        fail_native_present(sc, "window images cannot be blitted to");
+        return false;
+    }
+
+    VkExtent2D extent = caps.currentExtent;
+    if (extent.width == UINT32_MAX) {
+        extent.width = MIN(MAX(req->width, caps.minImageExtent.width),
+                           caps.maxImageExtent.width);
+        extent.height = MIN(MAX(req->height, caps.minImageExtent.height),
+                            caps.maxImageExtent.height);
+    }
+    if (extent.width == 0 || extent.height == 0) {
+        // Minimized
+        return false;
+    }
+
+    uint32_t min_image_count = MAX(caps.minImageCount + 1, 2);
+    if (caps.maxImageCount) {
+        min_image_count = MIN(min_image_count, caps.maxImageCount);
+    }
+
+    VkCompositeAlphaFlagBitsKHR composite_alpha =
+        VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    if (!(caps.supportedCompositeAlpha & composite_alpha)) {
+        composite_alpha = caps.supportedCompositeAlpha &
+                          -caps.supportedCompositeAlpha;
+    }
+
+    VkSurfaceTransformFlagBitsKHR pre_transform = caps.currentTransform;
+#ifdef __ANDROID__
+    // The blit isn't rotated, so leave rotating the window to the compositor
+    if (caps.supportedTransforms & VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR) {
+        pre_transform = VK_SURFACE_TRANSFORM_IDENTITY_BIT_KHR;
+    }
+#endif
+
+    VkPresentModeKHR requested_present_mode = get_requested_present_mode();
+    VkPresentModeKHR present_mode =
+        choose_present_mode(r, requested_present_mode);
+
+    // Images of the old swapchain may still be in use by the present engine
+    pgraph_vk_wait_for_queued_submits(r);
+    VK_CHECK(vkQueueWaitIdle(r->queue));
+    destroy_swapchain_images(r);
+
+    VkSwapchainKHR old_swapchain = sc->swapchain;
+    VkSwapchainCreateInfoKHR create_info = {
+        .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR,
+        .surface = sc->surface,
+        .minImageCount = min_image_count,
+        .imageFormat = sc->format,
+        .imageColorSpace = sc->color_space,
+        .imageExtent = extent,
+        .imageArrayLayers = 1,
+        .imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                      VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .imageSharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .preTransform = pre_transform,
+        .compositeAlpha = composite_alpha,
+        .presentMode = present_mode,
+        .clipped = VK_TRUE,
+        .oldSwapchain = old_swapchain,
+    };
+    VkResult result =
+        vkCreateSwapchainKHR(r->device, &create_info, NULL, &sc->swapchain);
+    if (old_swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(r->device, old_swapchain, NULL);
+    }
+    if (result != VK_SUCCESS) {
+        fprintf(stderr, "nv2a: Failed to create swapchain (%d)\n", result);
+        sc->swapchain = VK_NULL_HANDLE;
+        return false;
+    }
+
+    sc->extent = extent;
+    sc->requested_extent = (VkExtent2D){ req->width, req->height };
+    sc->present_mode = present_mode;
+    sc->requested_present_mode = requested_present_mode;
+    sc->min_image_count = min_image_count;
+    sc->needs_recreate = false;
+    create_swapchain_images(r);
+
+    return true;
+}
+
+/*
+ * Release the swapchain and surface of a window whose native surface went
+ * away, e.g. when an Android app is sent to the background. A new surface
+ * is created with the next present request.
+ */
+static void release_surface(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    pgraph_vk_wait_for_queued_submits(r);
+    VK_CHECK(vkQueueWaitIdle(r->queue));
+    destroy_swapchain_images(r);
+
+    if (sc->swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(r->device, sc->swapchain, NULL);
+        sc->swapchain = VK_NULL_HANDLE;
+    }
+    if (sc->surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(r->instance, sc->surface, NULL);
+        sc->surface = VK_NULL_HANDLE;
+    }
+    sc->window = NULL;
+}
+
+static bool is_swapchain_current(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    return sc->swapchain != VK_NULL_HANDLE && !sc->needs_recreate &&
+           sc->requested_extent.width == sc->request.width &&
+           sc->requested_extent.height == sc->request.height &&
+           sc->requested_present_mode == get_requested_present_mode();
+}
+
+static void image_barrier(VkCommandBuffer cmd, VkImage image,
+                          VkImageLayout old_layout, VkImageLayout new_layout,
+                          VkAccessFlags src_access, VkAccessFlags dst_access,
+                          VkPipelineStageFlags src_stage,
+                          VkPipelineStageFlags dst_stage)
+{
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .oldLayout = old_layout,
+        .newLayout = new_layout,
+        .srcAccessMask = src_access,
+        .dstAccessMask = dst_access,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.layerCount = 1,
+    };
+    vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1,
+                         &barrier);
+}
+
+static float get_display_aspect_ratio(int width, int height)
+{
+    switch (g_config.display.ui.aspect_ratio) {
+    case CONFIG_DISPLAY_UI_ASPECT_RATIO_NATIVE:
+        return (float)width / (float)height;
+    case CONFIG_DISPLAY_UI_ASPECT_RATIO_16X9:
+        return 16.0f / 9.0f;
+    case CONFIG_DISPLAY_UI_ASPECT_RATIO_4X3:
+        return 4.0f / 3.0f;
+    case CONFIG_DISPLAY_UI_ASPECT_RATIO_AUTO:
+    default:
+        return xemu_get_widescreen() ? 16.0f / 9.0f : 4.0f / 3.0f;
+    }
+}
+
+/*
+ * Get the blit of the display image into the window, fit the same way as
+ * the GL path. Parts which would fall outside the window are cropped.
+ */
+static VkImageBlit get_display_blit(PGRAPHVkState *r)
+{
+    PGRAPHVkDisplayState *disp = &r->display;
+    VkExtent2D extent = r->swapchain.extent;
+    float w = extent.width, h = extent.height;
+    float scale[2];
+
+    if (g_config.display.ui.fit == CONFIG_DISPLAY_UI_FIT_STRETCH) {
+        scale[0] = 1.0f;
+        scale[1] = 1.0f;
+    } else if (g_config.display.ui.fit == CONFIG_DISPLAY_UI_FIT_CENTER) {
+        float t_ratio = get_display_aspect_ratio(disp->width, disp->height);
+        scale[0] = t_ratio * disp->height / w;
+        scale[1] = disp->height / h;
+    } else {
+        float t_ratio = get_display_aspect_ratio(disp->width, disp->height);
+        float w_ratio = w / h;
+        if (w_ratio >= t_ratio) {
+            scale[0] = t_ratio / w_ratio;
+            scale[1] = 1.0f;
+        } else {
+            scale[0] = 1.0f;
+            scale[1] = w_ratio / t_ratio;
+        }
+    }
+
+    float crop[2] = { MIN(scale[0], 1.0f) / scale[0],
+                      MIN(scale[1], 1.0f) / scale[1] };
+    int dst_w = MIN(scale[0], 1.0f) * w;
+    int dst_h = MIN(scale[1], 1.0f) * h;
+    int dst_x = (extent.width - dst_w) / 2;
+    int dst_y = (extent.height - dst_h) / 2;
+    int src_w = crop[0] * disp->width;
+    int src_h = crop[1] * disp->height;
+    int src_x = (disp->width - src_w) / 2;
+    int src_y = (disp->height - src_h) / 2;
+
+    return (VkImageBlit){
+        .srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .srcSubresource.layerCount = 1,
+        .srcOffsets[0] = { src_x, src_y, 0 },
+        .srcOffsets[1] = { src_x + src_w, src_y + src_h, 1 },
+        .dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .dstSubresource.layerCount = 1,
+        // The display image is stored bottom-up, as GL expects it
+        .dstOffsets[0] = { dst_x, dst_y + dst_h, 0 },
+        .dstOffsets[1] = { dst_x + dst_w, dst_y, 1 },
+    };
+}
+
+static void blit_display_image(PGRAPHVkState *r, VkCommandBuffer cmd,
+                               VkImage dst, const VkImageBlit *region)
+{
+    PGRAPHVkDisplayState *disp = &r->display;
+
+    image_barrier(cmd, disp->image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                  VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkFilter filter =
+        g_config.display.filtering == CONFIG_DISPLAY_FILTERING_NEAREST ?
+            VK_FILTER_NEAREST :
+            VK_FILTER_LINEAR;
+    vkCmdBlitImage(cmd, disp->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, region,
+                   filter);
+
+    image_barrier(cmd, disp->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                  VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+/*
+ * With the FSR display filter, enlarging the display image is done in two
+ * passes instead of a blit. EASU resamples it into an image the size of the
+ * picture in the window, then RCAS sharpens that into the window.
+ */
+
+static const char *upscale_easu_main_glsl =
+    "layout(binding = 0) uniform sampler2D tex;\n"
+    "layout(push_constant, std430) uniform PushConstants {\n"
+    "    vec4 scale_offset;\n"
+    "    vec4 src_rect;\n"
+    "};\n"
+    "layout(location = 0) out vec4 out_Color;\n"
+    "void main()\n"
+    "{\n"
+    "    vec2 pp = gl_FragCoord.xy * scale_offset.xy + scale_offset.zw;\n"
+    "    out_Color = vec4(upscale_easu(tex, pp, ivec4(src_rect)), 1.0);\n"
+    "}\n";
+
+static const char *upscale_rcas_main_glsl =
+    "layout(binding = 0) uniform sampler2D tex;\n"
+    "layout(push_constant, std430) uniform PushConstants {\n"
+    "    vec2 offset;\n"
+    "    float sharpness;\n"
+    "};\n"
+    "layout(location = 0) out vec4 out_Color;\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 p = ivec2(gl_FragCoord.xy - offset);\n"
+    "    ivec4 rect = ivec4(ivec2(0), textureSize(tex, 0) - 1);\n"
+    "    out_Color = vec4(upscale_rcas(tex, p, rect, sharpness), 1.0);\n"
+    "}\n";
+
+static ShaderModuleInfo *create_upscale_shader_module(PGRAPHVkState *r,
+                                                      const char *main_glsl)
+{
+    g_autofree char *glsl = g_strconcat("#version 450\n",
+                                        display_upscale_glsl_src, main_glsl,
+                                        NULL);
+    return pgraph_vk_create_shader_module_from_glsl(
+        r, VK_SHADER_STAGE_FRAGMENT_BIT, glsl);
+}
+
+static void create_upscale_render_pass(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    VkAttachmentDescription attachment = {
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+        .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+        .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+    };
+
+    VkAttachmentReference color_reference = {
+        .attachment = 0,
+        .layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+    };
+
+    VkSubpassDescription subpass = {
+        .pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+        .colorAttachmentCount = 1,
+        .pColorAttachments = &color_reference,
+    };
+
+    // Written after the last frame's RCAS pass, read by this frame's
+    VkSubpassDependency dependencies[] = {
+        {
+            .srcSubpass = VK_SUBPASS_EXTERNAL,
+            .dstSubpass = 0,
+            .srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        },
+        {
+            .srcSubpass = 0,
+            .dstSubpass = VK_SUBPASS_EXTERNAL,
+            .srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+        },
+    };
+
+    VkRenderPassCreateInfo render_pass_create_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &attachment,
+        .subpassCount = 1,
+        .pSubpasses = &subpass,
+        .dependencyCount = ARRAY_SIZE(dependencies),
+        .pDependencies = dependencies,
+    };
+    VK_CHECK(vkCreateRenderPass(r->device, &render_pass_create_info, NULL,
+                                &sc->upscale.render_pass));
+}
+
+static void create_upscale_descriptors(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    VkDescriptorPoolSize pool_size = {
+        .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 2,
+    };
+
+    VkDescriptorPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+        .poolSizeCount = 1,
+        .pPoolSizes = &pool_size,
+        .maxSets = 2,
+    };
+    VK_CHECK(vkCreateDescriptorPool(r->device, &pool_info, NULL,
+                                    &sc->upscale.descriptor_pool));
+
+    VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+    };
+    VkDescriptorSetLayoutCreateInfo layout_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = 1,
+        .pBindings = &binding,
+    };
+    VK_CHECK(vkCreateDescriptorSetLayout(r->device, &layout_info, NULL,
+                                         &sc->upscale.descriptor_set_layout));
+
+    VkDescriptorSetLayout layouts[2] = { sc->upscale.descriptor_set_layout,
+                                         sc->upscale.descriptor_set_layout };
+    VkDescriptorSet sets[2];
+    VkDescriptorSetAllocateInfo alloc_info = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = sc->upscale.descriptor_pool,
+        .descriptorSetCount = ARRAY_SIZE(layouts),
+        .pSetLayouts = layouts,
+    };
+    VK_CHECK(vkAllocateDescriptorSets(r->device, &alloc_info, sets));
+    sc->upscale.easu_descriptor_set = sets[0];
+    sc->upscale.rcas_descriptor_set = sets[1];
+}
+
+static void update_upscale_descriptor(PGRAPHVkState *r, VkDescriptorSet set,
+                                      VkImageView image_view)
+{
+    VkDescriptorImageInfo image_info = {
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .imageView = image_view,
+        .sampler = r->display.sampler,
+    };
+    VkWriteDescriptorSet descriptor_write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = set,
+        .dstBinding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .descriptorCount = 1,
+        .pImageInfo = &image_info,
+    };
+    vkUpdateDescriptorSets(r->device, 1, &descriptor_write, 0, NULL);
+}
+
+static void create_upscale_pipeline(PGRAPHVkState *r, ShaderModuleInfo *frag,
+                                    VkRenderPass render_pass,
+                                    VkPipelineLayout *layout,
+                                    VkPipeline *pipeline)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    VkPipelineShaderStageCreateInfo shader_stages[] = {
+        (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_VERTEX_BIT,
+            .module = r->quad_vert_module->module,
+            .pName = "main",
+        },
+        (VkPipelineShaderStageCreateInfo){
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_FRAGMENT_BIT,
+            .module = frag->module,
+            .pName = "main",
+        },
+    };
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    };
+
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    };
+
+    VkPipelineViewportStateCreateInfo viewport_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1,
+    };
+
+    VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .lineWidth = 1.0f,
+        .cullMode = VK_CULL_MODE_BACK_BIT,
+        .frontFace = VK_FRONT_FACE_CLOCKWISE,
+    };
+
+    VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    VkPipelineColorBlendAttachmentState color_blend_attachment = {
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+                          VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+        .blendEnable = VK_FALSE,
+    };
+
+    VkPipelineColorBlendStateCreateInfo color_blending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &color_blend_attachment,
+    };
+
+    VkDynamicState dynamic_states[] = { VK_DYNAMIC_STATE_VIEWPORT,
+                                        VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamic_state = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = ARRAY_SIZE(dynamic_states),
+        .pDynamicStates = dynamic_states,
+    };
+
+    VkPushConstantRange push_constant_range = {
+        .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+        .size = frag->push_constants.total_size,
+    };
+
+    VkPipelineLayoutCreateInfo pipeline_layout_info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = 1,
+        .pSetLayouts = &sc->upscale.descriptor_set_layout,
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &push_constant_range,
+    };
+    VK_CHECK(vkCreatePipelineLayout(r->device, &pipeline_layout_info, NULL,
+                                    layout));
+
+    VkGraphicsPipelineCreateInfo pipeline_info = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .stageCount = ARRAY_SIZE(shader_stages),
+        .pStages = shader_stages,
+        .pVertexInputState = &vertex_input,
+        .pInputAssemblyState = &input_assembly,
+        .pViewportState = &viewport_state,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pColorBlendState = &color_blending,
+        .pDynamicState = &dynamic_state,
+        .layout = *layout,
+        .renderPass = render_pass,
+        .subpass = 0,
+    };
+    VK_CHECK(vkCreateGraphicsPipelines(r->device, r->vk_pipeline_cache, 1,
+                                       &pipeline_info, NULL, pipeline));
+}
+
+// Created with the first upscaled frame, as most never use the filter
+static void create_upscale_resources(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    sc->upscale.easu_frag =
+        create_upscale_shader_module(r, upscale_easu_main_glsl);
+    sc->upscale.rcas_frag =
+        create_upscale_shader_module(r, upscale_rcas_main_glsl);
+
+    create_upscale_render_pass(r);
+    create_upscale_descriptors(r);
+    create_upscale_pipeline(r, sc->upscale.easu_frag, sc->upscale.render_pass,
+                            &sc->upscale.easu_pipeline_layout,
+                            &sc->upscale.easu_pipeline);
+    create_upscale_pipeline(r, sc->upscale.rcas_frag, sc->render_pass,
+                            &sc->upscale.rcas_pipeline_layout,
+                            &sc->upscale.rcas_pipeline);
+}
+
+static void destroy_upscale_image(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (sc->upscale.image == VK_NULL_HANDLE) {
+        return;
+    }
+
+    vkDestroyFramebuffer(r->device, sc->upscale.framebuffer, NULL);
+    vkDestroyImageView(r->device, sc->upscale.image_view, NULL);
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_DISPLAY],
+                                 sc->upscale.allocation, true);
+    vmaDestroyImage(r->allocator, sc->upscale.image, sc->upscale.allocation);
+    sc->upscale.framebuffer = VK_NULL_HANDLE;
+    sc->upscale.image_view = VK_NULL_HANDLE;
+    sc->upscale.image = VK_NULL_HANDLE;
+    sc->upscale.allocation = VK_NULL_HANDLE;
+    sc->upscale.width = 0;
+    sc->upscale.height = 0;
+}
+
+static void destroy_upscale_resources(PGRAPHVkState *r)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (sc->upscale.render_pass == VK_NULL_HANDLE) {
+        return;
+    }
+
+    destroy_upscale_image(r);
+
+    vkDestroyPipeline(r->device, sc->upscale.rcas_pipeline, NULL);
+    vkDestroyPipeline(r->device, sc->upscale.easu_pipeline, NULL);
+    vkDestroyPipelineLayout(r->device, sc->upscale.rcas_pipeline_layout,
+                            NULL);
+    vkDestroyPipelineLayout(r->device, sc->upscale.easu_pipeline_layout,
+                            NULL);
+    vkDestroyDescriptorPool(r->device, sc->upscale.descriptor_pool, NULL);
+    vkDestroyDescriptorSetLayout(r->device,
+                                 sc->upscale.descriptor_set_layout, NULL);
+    vkDestroyRenderPass(r->device, sc->upscale.render_pass, NULL);
+    pgraph_vk_destroy_shader_module(r, sc->upscale.rcas_frag);
+    pgraph_vk_destroy_shader_module(r, sc->upscale.easu_frag);
+
+    memset(&sc->upscale, 0, sizeof(sc->upscale));
+}
+
+static void update_upscale_image(PGRAPHVkState *r, int width, int height)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (sc->upscale.image != VK_NULL_HANDLE &&
+        sc->upscale.width == width && sc->upscale.height == height) {
+        return;
+    }
+
+    // The last frame to use it has completed, its fence was waited on
+    destroy_upscale_image(r);
+
+    VkImageCreateInfo image_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = width,
+        .extent.height = height,
+        .extent.depth = 1,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                 VK_IMAGE_USAGE_SAMPLED_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+
+    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
+                            &alloc_create_info, &sc->upscale.image,
+                            &sc->upscale.allocation, NULL));
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_DISPLAY],
+                                 sc->upscale.allocation, false);
+
+    VkImageViewCreateInfo view_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = sc->upscale.image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.layerCount = 1,
+    };
+    VK_CHECK(vkCreateImageView(r->device, &view_info, NULL,
+                               &sc->upscale.image_view));
+
+    VkFramebufferCreateInfo framebuffer_info = {
+        .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+        .renderPass = sc->upscale.render_pass,
+        .attachmentCount = 1,
+        .pAttachments = &sc->upscale.image_view,
+        .width = width,
+        .height = height,
+        .layers = 1,
+    };
+    VK_CHECK(vkCreateFramebuffer(r->device, &framebuffer_info, NULL,
+                                 &sc->upscale.framebuffer));
+
+    update_upscale_descriptor(r, sc->upscale.rcas_descriptor_set,
+                              sc->upscale.image_view);
+    sc->upscale.width = width;
+    sc->upscale.height = height;
+}
+
+static void get_blit_rects(const VkImageBlit *region, VkRect2D *src,
+                           VkRect2D *dst)
+{
+    *src = (VkRect2D){
+        .offset = { region->srcOffsets[0].x, region->srcOffsets[0].y },
+        .extent = { region->srcOffsets[1].x - region->srcOffsets[0].x,
+                    region->srcOffsets[1].y - region->srcOffsets[0].y },
+    };
+
+    // Flipped vertically, see get_display_blit
+    *dst = (VkRect2D){
+        .offset = { region->dstOffsets[0].x, region->dstOffsets[1].y },
+        .extent = { region->dstOffsets[1].x - region->dstOffsets[0].x,
+                    region->dstOffsets[0].y - region->dstOffsets[1].y },
+    };
+}
+
+static bool should_upscale_display_image(const VkImageBlit *region)
+{
+    if (g_config.display.filtering != CONFIG_DISPLAY_FILTERING_FSR) {
+        return false;
+    }
+
+    // Nothing to reconstruct when shrinking, blit as with linear filtering
+    VkRect2D src, dst;
+    get_blit_rects(region, &src, &dst);
+    return dst.extent.width > src.extent.width ||
+           dst.extent.height > src.extent.height;
+}
+
+static void set_viewport(VkCommandBuffer cmd, VkRect2D rect)
+{
+    VkViewport viewport = {
+        .x = rect.offset.x,
+        .y = rect.offset.y,
+        .width = rect.extent.width,
+        .height = rect.extent.height,
+        .minDepth = 0.0,
+        .maxDepth = 1.0,
+    };
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &rect);
+}
+
+// Resample the display image to the picture size, outside any render pass
+static void record_upscale_easu(PGRAPHVkState *r, VkCommandBuffer cmd,
+                                const VkImageBlit *region)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+    VkRect2D src, dst;
+
+    get_blit_rects(region, &src, &dst);
+
+    if (sc->upscale.render_pass == VK_NULL_HANDLE) {
+        create_upscale_resources(r);
+    }
+    update_upscale_image(r, dst.extent.width, dst.extent.height);
+    update_upscale_descriptor(r, sc->upscale.easu_descriptor_set,
+                              r->display.image_view);
+
+    // Map pixel centres to texels, flipping the bottom-up display image
+    ShaderUniformLayout *l = &sc->upscale.easu_frag->push_constants;
+    float sx = (float)src.extent.width / dst.extent.width;
+    float sy = (float)src.extent.height / dst.extent.height;
+    uniform4f(l, uniform_index(l, "scale_offset"), sx, -sy,
+              src.offset.x - 0.5f,
+              src.offset.y + src.extent.height - 0.5f);
+    uniform4f(l, uniform_index(l, "src_rect"), src.offset.x, src.offset.y,
+              src.offset.x + src.extent.width - 1,
+              src.offset.y + src.extent.height - 1);
+
+    VkRenderPassBeginInfo render_pass_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = sc->upscale.render_pass,
+        .framebuffer = sc->upscale.framebuffer,
+        .renderArea.extent = dst.extent,
+    };
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      sc->upscale.easu_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            sc->upscale.easu_pipeline_layout, 0, 1,
+                            &sc->upscale.easu_descriptor_set, 0, NULL);
+    set_viewport(cmd, (VkRect2D){ .extent = dst.extent });
+    vkCmdPushConstants(cmd, sc->upscale.easu_pipeline_layout,
+                       VK_SHADER_STAGE_FRAGMENT_BIT, 0, l->total_size,
+                       l->allocation);
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+    vkCmdEndRenderPass(cmd);
+}
+
+// Sharpen the resampled image into the window, inside the overlay pass
+static void record_upscale_rcas(PGRAPHVkState *r, VkCommandBuffer cmd,
+                                const VkImageBlit *region)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+    VkRect2D src, dst;
+
+    get_blit_rects(region, &src, &dst);
+
+    ShaderUniformLayout *l = &sc->upscale.rcas_frag->push_constants;
+    uniform2f(l, uniform_index(l, "offset"), dst.offset.x, dst.offset.y);
+    uniform1f(l, uniform_index(l, "sharpness"), UPSCALE_SHARPNESS);
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      sc->upscale.rcas_pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            sc->upscale.rcas_pipeline_layout, 0, 1,
+                            &sc->upscale.rcas_descriptor_set, 0, NULL);
+    set_viewport(cmd, dst);
+    vkCmdPushConstants(cmd, sc->upscale.rcas_pipeline_layout,
+                       VK_SHADER_STAGE_FRAGMENT_BIT, 0, l->total_size,
+                       l->allocation);
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+}
+
+static NV2AVkPresentContext get_overlay_context(PGRAPHVkState *r,
+                                                VkCommandBuffer cmd)
+{
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    return (NV2AVkPresentContext){
+        .instance = r->instance,
+        .physical_device = r->physical_device,
+        .device = r->device,
+        .queue_family = sc->queue_family,
+        .queue = r->queue,
+        .descriptor_pool = sc->overlay_descriptor_pool,
+        .render_pass = sc->render_pass,
+        .min_image_count = sc->min_image_count,
+        .image_count = sc->num_images,
+        .command_buffer = cmd,
+    };
+}
+
+static void record_present(PGRAPHState *pg, VkCommandBuffer cmd,
+                           uint32_t image_index)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+    VkImage image = sc->images[image_index];
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    VK_CHECK(vkBeginCommandBuffer(cmd, &begin_info));
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_YELLOW, "Present");
+
+    image_barrier(cmd, image, VK_IMAGE_LAYOUT_UNDEFINED,
+                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                  VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkClearColorValue black = { 0 };
+    VkImageSubresourceRange range = {
+        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .levelCount = 1,
+        .layerCount = 1,
+    };
+    vkCmdClearColorImage(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         &black, 1, &range);
+
+    VkImageBlit region = { 0 };
+    bool upscale = false;
+    if (sc->request.show_framebuffer && r->display.image != VK_NULL_HANDLE &&
+        !nv2a_get_screen_off()) {
+        region = get_display_blit(r);
+        upscale = should_upscale_display_image(&region);
+        if (upscale) {
+            record_upscale_easu(r, cmd, &region);
+        } else {
+            image_barrier(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT);
+            blit_display_image(r, cmd, image, &region);
+        }
+    }
+
+    image_barrier(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                  VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                  VK_ACCESS_TRANSFER_WRITE_BIT,
+                  VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                  VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+
+    VkRenderPassBeginInfo render_pass_begin_info = {
+        .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+        .renderPass = sc->render_pass,
+        .framebuffer = sc->framebuffers[image_index],
+        .renderArea.extent = sc->extent,
+    };
+    vkCmdBeginRenderPass(cmd, &render_pass_begin_info,
+                         VK_SUBPASS_CONTENTS_INLINE);
+    if (upscale) {
+        record_upscale_rcas(r, cmd, &region);
+    }
+    if (sc->request.overlay) {
+        NV2AVkPresentContext ctx = get_overlay_context(r, cmd);
+        sc->request.overlay(&ctx);
+    }
+    vkCmdEndRenderPass(cmd);
+
+    pgraph_vk_end_debug_marker(r, cmd);
+    VK_CHECK(vkEndCommandBuffer(cmd));
+}
+
+static bool present_frame(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (sc->failed) {
+        return false;
+    }
+    if (sc->surface_lost) {
+        release_surface(r);
+        return false;
+    }
+    if (sc->render_pass == VK_NULL_HANDLE && !init_swapchain_resources(r)) {
+        return false;
+    }
+
+    // The command buffer and acquire semaphore are reused every frame
+    VK_CHECK(vkWaitForFences(r->device, 1, &sc->fence, VK_TRUE, UINT64_MAX));
+
+    if (!is_swapchain_current(r) && !create_swapchain(r)) {
+        return false;
+    }
+
+    if (sc->request.show_framebuffer) {
+        pgraph_vk_render_display(pg);
+    }
+
+    uint32_t image_index;
+    VkResult result =
+        vkAcquireNextImageKHR(r->device, sc->swapchain, UINT64_MAX,
+                              sc->acquire_semaphore, VK_NULL_HANDLE,
+                              &image_index);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+        sc->needs_recreate = true;
+        return false;
+    } else if (result == VK_ERROR_SURFACE_LOST_KHR) {
+        sc->surface_lost = true;
+        return false;
+    } else if (result == VK_SUBOPTIMAL_KHR) {
+        sc->needs_recreate = true;
+    } else if (result != VK_SUCCESS) {
+        fprintf(stderr, "nv2a: Failed to acquire swapchain image (%d)\n",
+                result);
+        return false;
+    }
+
+    pgraph_vk_wait_for_queued_submits(r);
+    record_present(pg, sc->command_buffer, image_index);
+
+    VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo submit_info = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &sc->acquire_semaphore,
+        .pWaitDstStageMask = &wait_stage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &sc->command_buffer,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &sc->render_semaphores[image_index],
+    };
+    VK_CHECK(vkResetFences(r->device, 1, &sc->fence));
+    VK_CHECK(vkQueueSubmit(r->queue, 1, &submit_info, sc->fence));
+    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_PRESENT);
+
+    VkPresentInfoKHR present_info = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+        .waitSemaphoreCount = 1,
+        .pWaitSemaphores = &sc->render_semaphores[image_index],
+        .swapchainCount = 1,
+        .pSwapchains = &sc->swapchain,
+        .pImageIndices = &image_index,
+    };
+    result = vkQueuePresentKHR(r->queue, &present_info);
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+        sc->needs_recreate = true;
+    } else if (result == VK_ERROR_SURFACE_LOST_KHR) {
+        sc->surface_lost = true;
+    } else if (result != VK_SUCCESS) {
+        fprintf(stderr, "nv2a: Failed to present (%d)\n", result);
+        return false;
+    }
+
+    return true;
+}
+
+static bool submit_present_request(NV2AState *d,
+                                   const NV2APresentRequest *req)
+{
+    PGRAPHVkSwapchainState *sc = &d->pgraph.vk_renderer_state->swapchain;
+
+    qemu_mutex_lock(&d->pfifo.lock);
+    qemu_event_reset(&sc->present_complete);
+    sc->request = *req;
+    qatomic_set(&sc->present_pending, true);
+    pfifo_kick(d);
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_event_wait(&sc->present_complete);
+
+    return sc->presented;
+}
+
+/*
+ * Called from the thread owning the window, which blocks until the frame
+ * has been presented.
+ */
+bool pgraph_vk_present_frame(NV2AState *d, const NV2APresentRequest *req)
+{
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    // The renderer releases the old swapchain before its surface is replaced
+    if (sc->surface_lost && sc->surface != VK_NULL_HANDLE) {
+        submit_present_request(d, req);
+    }
+    sc->surface_lost = false;
+
+    // Surfaces are created on the window thread, which some platforms need
+    if (!create_surface(r, req->window)) {
+        return false;
+    }
+
+    return submit_present_request(d, req);
+}
+
+/*
+ * Called from the thread owning the window when its native surface has been
+ * destroyed. Nothing is released until the next present request.
+ */
+void pgraph_vk_present_surface_lost(NV2AState *d)
+{
+    d->pgraph.vk_renderer_state->swapchain.surface_lost = true;
+}
+
+void pgraph_vk_process_pending_present(NV2AState *d)
+{
+    PGRAPHVkSwapchainState *sc = &d->pgraph.vk_renderer_state->swapchain;
+
+    sc->presented = present_frame(&d->pgraph);
+    qatomic_set(&sc->present_pending, false);
+    qemu_event_set(&sc->present_complete);
+}
+
+void pgraph_vk_init_swapchain(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    qemu_event_init(&r->swapchain.present_complete, false);
+}
+
+void pgraph_vk_finalize_swapchain(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    PGRAPHVkSwapchainState *sc = &r->swapchain;
+
+    if (sc->render_pass != VK_NULL_HANDLE) {
+        pgraph_vk_wait_for_queued_submits(r);
+        VK_CHECK(vkDeviceWaitIdle(r->device));
+
+        if (sc->request.overlay) {
+            NV2AVkPresentContext ctx = get_overlay_context(r, VK_NULL_HANDLE);
+            sc->request.overlay(&ctx);
+        }
+
+        destroy_swapchain_images(r);
+        if (sc->swapchain != VK_NULL_HANDLE) {
+            vkDestroySwapchainKHR(r->device, sc->swapchain, NULL);
+            sc->swapchain = VK_NULL_HANDLE;
+        }
+
+        vkDestroySemaphore(r->device, sc->acquire_semaphore, NULL);
+        vkDestroyFence(r->device, sc->fence, NULL);
+        vkFreeCommandBuffers(r->device, r->command_pool, 1,
+                             &sc->command_buffer);
+        destroy_upscale_resources(r);
+        vkDestroyDescriptorPool(r->device, sc->overlay_descriptor_pool, NULL);
+        vkDestroyRenderPass(r->device, sc->render_pass, NULL);
+        sc->render_pass = VK_NULL_HANDLE;
+    }
+
+    if (sc->surface != VK_NULL_HANDLE) {
+        vkDestroySurfaceKHR(r->instance, sc->surface, NULL);
+        sc->surface = VK_NULL_HANDLE;
+    }
+
+    qemu_event_destroy(&sc->present_complete);
+}
@@ -0,0 +1,297 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "qemu/units.h"
+#include "ui/xemu-settings.h"
+#include "xemu-version.h"
+#include "renderer.h"
+
+#include <glib/gstdio.h>
+
+/*
+ * Texture cache file layout:
+ *   uint64_t              xemu version string length (including terminator)
+ *   char[]                xemu version string
+ *   TextureDiskCacheKey   key
+ *   uint8_t[]             converted texture payload
+ *
+ * Files are named after the hash of their key. An in-memory index of the
+ * files, ordered by last use, is built at startup to keep the cache under
+ * its size limit and to avoid touching the disk on a miss.
+ */
+typedef struct TextureDiskCacheEntry {
+    QTAILQ_ENTRY(TextureDiskCacheEntry) entry;
+    uint64_t hash;
+    uint64_t size;
+} TextureDiskCacheEntry;
+
+static char *texture_disk_cache_get_directory(void)
+{
+    return g_strdup_printf("%svk_textures", xemu_settings_get_base_path());
+}
+
+static char *texture_disk_cache_get_path(uint64_t hash)
+{
+    return g_strdup_printf("%svk_textures/%016" PRIx64,
+                           xemu_settings_get_base_path(), hash);
+}
+
+static uint64_t texture_disk_cache_get_header_size(void)
+{
+    return sizeof(uint64_t) + strlen(xemu_version) + 1 +
+           sizeof(TextureDiskCacheKey);
+}
+
+static void texture_disk_cache_remove(TextureDiskCache *c,
+                                      TextureDiskCacheEntry *e, bool unlink)
+{
+    if (unlink) {
+        g_autofree char *path = texture_disk_cache_get_path(e->hash);
+        qemu_unlink(path);
+    }
+
+    c->size -= e->size;
+    QTAILQ_REMOVE(&c->lru, e, entry);
+    g_hash_table_remove(c->entries, &e->hash);
+}
+
+static void texture_disk_cache_insert(TextureDiskCache *c, uint64_t hash,
+                                      uint64_t size)
+{
+    TextureDiskCacheEntry *e = g_malloc(sizeof(*e));
+    e->hash = hash;
+    e->size = size;
+
+    g_hash_table_insert(c->entries, &e->hash, e);
+    QTAILQ_INSERT_HEAD(&c->lru, e, entry);
+    c->size += size;
+
+    while (c->size > c->max_size) {
+        TextureDiskCacheEntry *oldest = QTAILQ_LAST(&c->lru);
+        if (oldest == e) {
+            break;
+        }
+        texture_disk_cache_remove(c, oldest, true);
+    }
+}
+
+typedef struct TextureDiskCacheFile {
+    uint64_t hash;
+    uint64_t size;
+    gint64 mtime;
+} TextureDiskCacheFile;
+
+static gint compare_texture_disk_cache_files(gconstpointer a, gconstpointer b)
+{
+    const TextureDiskCacheFile *fa = a, *fb = b;
+    return fa->mtime < fb->mtime ? -1 : fa->mtime > fb->mtime ? 1 : 0;
+}
+
+static void texture_disk_cache_scan(TextureDiskCache *c, const char *dir_path)
+{
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    if (!dir) {
+        return;
+    }
+
+    g_autoptr(GArray) files =
+        g_array_new(FALSE, FALSE, sizeof(TextureDiskCacheFile));
+    const char *name;
+
+    while ((name = g_dir_read_name(dir))) {
+        char *end;
+        TextureDiskCacheFile f;
+        f.hash = g_ascii_strtoull(name, &end, 16);
+        if (*end || end - name != 16) {
+            continue;
+        }
+
+        g_autofree char *path = g_build_filename(dir_path, name, NULL);
+        GStatBuf st;
+        if (g_stat(path, &st)) {
+            continue;
+        }
+        f.size = st.st_size;
+        f.mtime = st.st_mtime;
+        g_array_append_val(files, f);
+    }
+    g_dir_close(dir);
+
+    // Insert oldest first so the most recently used end up at the head
+    g_array_sort(files, compare_texture_disk_cache_files);
+    for (int i = 0; i < files->len; i++) {
+        TextureDiskCacheFile *f = &g_array_index(files, TextureDiskCacheFile, i);
+        texture_disk_cache_insert(c, f->hash, f->size);
+    }
+}
+
+void pgraph_vk_init_texture_disk_cache(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureDiskCache *c = &r->texture_disk_cache;
+
+    c->enabled = g_config.perf.cache_textures;
+    c->entries = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL,
+                                       g_free);
+    QTAILQ_INIT(&c->lru);
+    c->size = 0;
+    c->max_size = (uint64_t)MAX(g_config.perf.texture_cache_size_mb, 0) * MiB;
+
+    c->write_pool = NULL;
+
+    if (!c->enabled) {
+        return;
+    }
+
+    // A single writer keeps file writes off the render thread without
+    // competing with it for more than one core
+    c->write_pool = g_thread_pool_new(texture_disk_cache_write, NULL, 1, FALSE,
+                                      NULL);
+
+    g_autofree char *dir_path = texture_disk_cache_get_directory();
+    qemu_mkdir(dir_path);
+    texture_disk_cache_scan(c, dir_path);
+}
+
+void pgraph_vk_finalize_texture_disk_cache(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureDiskCache *c = &r->texture_disk_cache;
+
+    if (c->write_pool) {
+        // Finish pending writes
+        g_thread_pool_free(c->write_pool, FALSE, TRUE);
+        c->write_pool = NULL;
+    }
+
+    g_hash_table_destroy(c->entries);
+    c->entries = NULL;
+    QTAILQ_INIT(&c->lru);
+    c->size = 0;
+}
+
+static uint64_t texture_disk_cache_hash_key(const TextureDiskCacheKey *key)
+{
+    return fast_hash((void *)key, sizeof(*key));
+}
+
+GMappedFile *pgraph_vk_texture_disk_cache_lookup(PGRAPHVkState *r,
+                                                 const TextureDiskCacheKey *key,
+                                                 const uint8_t **payload,
+                                                 size_t *payload_size)
+{
+    TextureDiskCache *c = &r->texture_disk_cache;
+    if (!c->enabled) {
+        return NULL;
+    }
+
+    uint64_t hash = texture_disk_cache_hash_key(key);
+    TextureDiskCacheEntry *e = g_hash_table_lookup(c->entries, &hash);
+    if (!e) {
+        return NULL;
+    }
+
+    g_autofree char *path = texture_disk_cache_get_path(hash);
+    GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+    if (!file) {
+        texture_disk_cache_remove(c, e, false);
+        return NULL;
+    }
+
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(file);
+    size_t size = g_mapped_file_get_length(file);
+    uint64_t version_len = strlen(xemu_version) + 1;
+    uint64_t header_size = texture_disk_cache_get_header_size();
+
+    if (size < header_size || memcmp(data, &version_len, sizeof(version_len)) ||
+        memcmp(data + sizeof(version_len), xemu_version, version_len) ||
+        memcmp(data + sizeof(version_len) + version_len, key, sizeof(*key))) {
+        // Stale or colliding, delete it so it won't be loaded again
+        g_mapped_file_unref(file);
+        texture_disk_cache_remove(c, e, true);
+        return NULL;
+    }
+
+    // Refresh the file time so the order survives a restart
+    g_utime(path, NULL);
+    QTAILQ_REMOVE(&c->lru, e, entry);
+    QTAILQ_INSERT_HEAD(&c->lru, e, entry);
+
+    *payload = data + header_size;
+    *payload_size = size - header_size;
+    return file;
+}
+
+typedef struct TextureDiskCacheWrite {
+    uint64_t hash;
+    GByteArray *data;
+} TextureDiskCacheWrite;
+
+static void texture_disk_cache_write(gpointer data, gpointer user_data)
+{
+    TextureDiskCacheWrite *w = data;
+    g_autofree char *path = texture_disk_cache_get_path(w->hash);
+
+    if (!g_file_set_contents(path, (const gchar *)w->data->data, w->data->len,
+                             NULL)) {
+        fprintf(stderr, "nv2a: Failed to write texture cache file to %s\n",
+                path);
+        qemu_unlink(path);
+    }
+
+    g_byte_array_unref(w->data);
+    g_free(w);
+}
+
+GByteArray *pgraph_vk_texture_disk_cache_begin_store(
+    const TextureDiskCacheKey *key)
+{
+    uint64_t version_len = strlen(xemu_version) + 1;
+    GByteArray *data = g_byte_array_new();
+
+    g_byte_array_append(data, (const guint8 *)&version_len,
+                        sizeof(version_len));
+    g_byte_array_append(data, (const guint8 *)xemu_version, version_len);
+    g_byte_array_append(data, (const guint8 *)key, sizeof(*key));
+
+    return data;
+}
+
+void pgraph_vk_texture_disk_cache_store(PGRAPHVkState *r,
+                                        const TextureDiskCacheKey *key,
+                                        GByteArray *data)
+{
+    TextureDiskCache *c = &r->texture_disk_cache;
+    uint64_t hash = texture_disk_cache_hash_key(key);
+
+    if (!c->enabled || data->len > c->max_size ||
+        g_hash_table_contains(c->entries, &hash)) {
+        g_byte_array_unref(data);
+        return;
+    }
+
+    texture_disk_cache_insert(c, hash, data->len);
+
+    TextureDiskCacheWrite *w = g_malloc(sizeof(*w));
+    w->hash = hash;
+    w->data = data;
+    g_thread_pool_push(c->write_pool, w, NULL);
+}
@@ -0,0 +1,658 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/fast-hash.h"
+#include "ui/xemu-settings.h"
+#include "renderer.h"
+
+/*
+ * Texture packs replace guest textures with images made for the host, e.g. at
+ * a higher resolution. A pack is a file in the texture_packs directory with
+ * the .xtp extension, laid out as follows, all little endian:
+ *
+ *   char[4]      magic "XTXP"
+ *   uint32_t     version
+ *   uint32_t     number of entries
+ *   uint32_t     reserved
+ *   entry[]      index
+ *   uint8_t[]    images
+ *
+ * Each entry is:
+ *
+ *   uint64_t     content hash of the guest texture, as computed by xemu
+ *   uint32_t     guest color format
+ *   uint16_t     guest width
+ *   uint16_t     guest height
+ *   uint32_t     VkFormat of the image, one of texture_pack_formats
+ *   uint16_t     image width
+ *   uint16_t     image height
+ *   uint32_t     number of mipmap levels
+ *   uint32_t     reserved
+ *   uint64_t     offset of the image in the file
+ *   uint64_t     size of the image
+ *
+ * An image holds its levels back to back, largest first, each tightly packed
+ * in the block layout of its format. Packs are memory-mapped and loaded in
+ * name order, a later pack overriding the textures of an earlier one.
+ *
+ * Images are copied out of the mapping on a worker thread, so page faults on
+ * the pack never stall the render thread, and uploaded when textures are next
+ * bound. The guest texture is sampled until then.
+ */
+
+#define TEXTURE_PACK_VERSION 1
+#define TEXTURE_PACK_HEADER_SIZE 16
+#define TEXTURE_PACK_ENTRY_SIZE 48
+
+// Loaded images waiting for upload take memory, so only so many are read ahead
+#define TEXTURE_REPLACEMENT_MAX_LOADING 32
+
+// Bounds the time a bind spends uploading replacements
+#define TEXTURE_REPLACEMENT_MAX_UPLOADS_PER_BIND 4
+
+typedef struct TexturePackFormat {
+    VkFormat format;
+    uint8_t block_width, block_height;
+    uint8_t block_size;
+} TexturePackFormat;
+
+static const TexturePackFormat texture_pack_formats[] = {
+    { VK_FORMAT_BC1_RGBA_UNORM_BLOCK, 4, 4, 8 },
+    { VK_FORMAT_BC2_UNORM_BLOCK, 4, 4, 16 },
+    { VK_FORMAT_BC3_UNORM_BLOCK, 4, 4, 16 },
+    { VK_FORMAT_BC7_UNORM_BLOCK, 4, 4, 16 },
+    { VK_FORMAT_ASTC_4x4_UNORM_BLOCK, 4, 4, 16 },
+    { VK_FORMAT_ASTC_6x6_UNORM_BLOCK, 6, 6, 16 },
+    { VK_FORMAT_ASTC_8x8_UNORM_BLOCK, 8, 8, 16 },
+};
+
+typedef struct TexturePackKey {
+    uint64_t content_hash;
+    uint32_t color_format;
+    uint16_t width, height;
+} TexturePackKey;
+
+struct TexturePackEntry {
+    TexturePackKey key;
+    const TexturePackFormat *format;
+    uint32_t width, height, levels;
+    const uint8_t *data; // Within the mapped pack
+    size_t size;
+};
+
+struct TextureReplacementLoad {
+    QSIMPLEQ_ENTRY(TextureReplacementLoad) entry;
+    const TexturePackEntry *pack_entry;
+    TextureBinding *binding; // NULL once the binding leaves the cache
+    uint64_t content_hash;
+    uint8_t *data; // Copied from the pack by the worker
+};
+
+static guint texture_pack_key_hash(gconstpointer key)
+{
+    return fast_hash((void *)key, sizeof(TexturePackKey));
+}
+
+static gboolean texture_pack_key_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, sizeof(TexturePackKey));
+}
+
+static bool is_texture_pack_format_supported(PGRAPHVkState *r,
+                                             const TexturePackFormat *f)
+{
+    const VkFormatFeatureFlags required_features =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+    bool is_astc = f->format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK &&
+                   f->format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK;
+    if (is_astc ?
+            !r->enabled_physical_device_features.textureCompressionASTC_LDR :
+            !r->enabled_physical_device_features.textureCompressionBC) {
+        return false;
+    }
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(r->physical_device, f->format, &props);
+    return (props.optimalTilingFeatures & required_features) ==
+           required_features;
+}
+
+static size_t get_texture_pack_image_size(const TexturePackFormat *f,
+                                          uint32_t width, uint32_t height,
+                                          uint32_t levels)
+{
+    size_t size = 0;
+    for (int i = 0; i < levels; i++) {
+        size += (size_t)DIV_ROUND_UP(MAX(width >> i, 1), f->block_width) *
+                DIV_ROUND_UP(MAX(height >> i, 1), f->block_height) *
+                f->block_size;
+    }
+    return size;
+}
+
+static bool parse_texture_pack_entry(PGRAPHVkState *r, const uint8_t *pack,
+                                     size_t pack_size, const uint8_t *p,
+                                     const bool *formats_supported,
+                                     TexturePackEntry *e)
+{
+    e->key = (TexturePackKey){
+        .content_hash = ldq_le_p(p),
+        .color_format = ldl_le_p(p + 8),
+        .width = lduw_le_p(p + 12),
+        .height = lduw_le_p(p + 14),
+    };
+    VkFormat format = ldl_le_p(p + 16);
+    e->width = lduw_le_p(p + 20);
+    e->height = lduw_le_p(p + 22);
+    e->levels = ldl_le_p(p + 24);
+    uint64_t offset = ldq_le_p(p + 32);
+    uint64_t size = ldq_le_p(p + 40);
+
+    e->format = NULL;
+    for (int i = 0; i < ARRAY_SIZE(texture_pack_formats); i++) {
+        if (texture_pack_formats[i].format == format && formats_supported[i]) {
+            e->format = &texture_pack_formats[i];
+        }
+    }
+
+    uint32_t max_dimension = r->device_props.limits.maxImageDimension2D;
+    if (!e->format ||
+        e->key.color_format >= ARRAY_SIZE(kelvin_color_format_vk_map) ||
+        !e->key.width || !e->key.height || !e->width || !e->height ||
+        e->width > max_dimension || e->height > max_dimension ||
+        !e->levels || e->levels > 16 ||
+        (MAX(e->width, e->height) >> (e->levels - 1)) == 0 ||
+        offset > pack_size || size > pack_size - offset ||
+        size != get_texture_pack_image_size(e->format, e->width, e->height,
+                                            e->levels)) {
+        return false;
+    }
+
+    e->data = pack + offset;
+    e->size = size;
+    return true;
+}
+
+static void add_texture_pack(PGRAPHVkState *r, const char *path,
+                             const bool *formats_supported)
+{
+    TextureReplacementState *s = &r->texture_replacement;
+    g_autoptr(GError) err = NULL;
+
+    GMappedFile *file = g_mapped_file_new(path, FALSE, &err);
+    if (!file) {
+        fprintf(stderr, "nv2a: Failed to open texture pack: %s\n",
+                err->message);
+        return;
+    }
+
+    const uint8_t *data = (const uint8_t *)g_mapped_file_get_contents(file);
+    size_t size = g_mapped_file_get_length(file);
+
+    if (size < TEXTURE_PACK_HEADER_SIZE || memcmp(data, "XTXP", 4) ||
+        ldl_le_p(data + 4) != TEXTURE_PACK_VERSION ||
+        ldl_le_p(data + 8) > (size - TEXTURE_PACK_HEADER_SIZE) /
+                                 TEXTURE_PACK_ENTRY_SIZE) {
+        fprintf(stderr, "nv2a: %s is not a supported texture pack\n", path);
+        g_mapped_file_unref(file);
+        return;
+    }
+
+    uint32_t num_entries = ldl_le_p(data + 8);
+    int num_added = 0;
+
+    for (int i = 0; i < num_entries; i++) {
+        TexturePackEntry *e = g_malloc(sizeof(*e));
+        if (!parse_texture_pack_entry(r, data, size,
+                                      data + TEXTURE_PACK_HEADER_SIZE +
+                                          i * TEXTURE_PACK_ENTRY_SIZE,
+                                      formats_supported, e)) {
+            g_free(e);
+            continue;
+        }
+        g_hash_table_replace(s->entries, &e->key, e);
+        num_added++;
+    }
+
+    fprintf(stderr, "nv2a: Loaded %d of %u textures from %s\n", num_added,
+            num_entries, path);
+
+    if (num_added) {
+        g_ptr_array_add(s->packs, file);
+    } else {
+        g_mapped_file_unref(file);
+    }
+}
+
+static gint compare_texture_pack_names(gconstpointer a, gconstpointer b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void scan_texture_packs(PGRAPHVkState *r)
+{
+    g_autofree char *dir_path =
+        g_strdup_printf("%stexture_packs", xemu_settings_get_base_path());
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    if (!dir) {
+        return;
+    }
+
+    g_autoptr(GPtrArray) names = g_ptr_array_new_with_free_func(g_free);
+    const char *name;
+    while ((name = g_dir_read_name(dir))) {
+        if (g_str_has_suffix(name, ".xtp")) {
+            g_ptr_array_add(names, g_strdup(name));
+        }
+    }
+    g_dir_close(dir);
+
+    if (!names->len) {
+        return;
+    }
+
+    bool formats_supported[ARRAY_SIZE(texture_pack_formats)];
+    for (int i = 0; i < ARRAY_SIZE(texture_pack_formats); i++) {
+        formats_supported[i] =
+            is_texture_pack_format_supported(r, &texture_pack_formats[i]);
+    }
+
+    g_ptr_array_sort(names, compare_texture_pack_names);
+    for (int i = 0; i < names->len; i++) {
+        g_autofree char *path =
+            g_build_filename(dir_path, g_ptr_array_index(names, i), NULL);
+        add_texture_pack(r, path, formats_supported);
+    }
+}
+
+static void texture_replacement_load(gpointer data, gpointer user_data)
+{
+    TextureReplacementLoad *load = data;
+    TextureReplacementState *s = user_data;
+
+    // Copying out of the mapping is what reads the pack from disk
+    load->data = g_memdup2(load->pack_entry->data, load->pack_entry->size);
+
+    qemu_mutex_lock(&s->lock);
+    QSIMPLEQ_INSERT_TAIL(&s->loaded, load, entry);
+    qemu_mutex_unlock(&s->lock);
+}
+
+void pgraph_vk_init_texture_replacement(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureReplacementState *s = &r->texture_replacement;
+
+    s->enabled = false;
+    s->packs = g_ptr_array_new_with_free_func(
+        (GDestroyNotify)g_mapped_file_unref);
+    s->entries = g_hash_table_new_full(texture_pack_key_hash,
+                                       texture_pack_key_equal, NULL, g_free);
+    s->load_pool = NULL;
+    qemu_mutex_init(&s->lock);
+    QSIMPLEQ_INIT(&s->loaded);
+    s->num_loading = 0;
+
+    if (!g_config.display.vulkan.texture_packs) {
+        return;
+    }
+
+    scan_texture_packs(r);
+    if (!g_hash_table_size(s->entries)) {
+        return;
+    }
+
+    // A single reader is enough to keep ahead of uploads without adding
+    // contention for the disk
+    s->load_pool = g_thread_pool_new(texture_replacement_load, s, 1, FALSE,
+                                     NULL);
+    s->enabled = true;
+}
+
+void pgraph_vk_finalize_texture_replacement(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureReplacementState *s = &r->texture_replacement;
+
+    if (s->load_pool) {
+        // Finish pending loads, their bindings are gone already
+        g_thread_pool_free(s->load_pool, FALSE, TRUE);
+        s->load_pool = NULL;
+    }
+
+    TextureReplacementLoad *load, *next;
+    QSIMPLEQ_FOREACH_SAFE(load, &s->loaded, entry, next) {
+        g_free(load->data);
+        g_free(load);
+    }
+    QSIMPLEQ_INIT(&s->loaded);
+    s->num_loading = 0;
+
+    g_hash_table_destroy(s->entries);
+    s->entries = NULL;
+    g_ptr_array_free(s->packs, TRUE);
+    s->packs = NULL;
+    qemu_mutex_destroy(&s->lock);
+    s->enabled = false;
+}
+
+// Replacements are plain 2D images sampled with normalized coordinates
+static bool is_texture_replaceable(const TextureKey *key)
+{
+    const TextureShape *s = &key->state;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s->color_format];
+
+    return s->dimensionality == 2 && !s->cubemap && !s->border && !f.linear &&
+           !f.depth && !key->mip_skip && !key->surface_alias &&
+           kelvin_color_format_vk_map[s->color_format].vk_format !=
+               VK_FORMAT_R32_UINT;
+}
+
+/*
+ * Start loading the replacement for the current content of a texture, if a
+ * pack has one.
+ */
+void pgraph_vk_request_texture_replacement(PGRAPHState *pg,
+                                           TextureBinding *binding)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureReplacementState *s = &r->texture_replacement;
+
+    if (!s->enabled || binding->replacement_load ||
+        pgraph_vk_is_texture_replaced(binding) ||
+        s->num_loading >= TEXTURE_REPLACEMENT_MAX_LOADING ||
+        !is_texture_replaceable(&binding->key)) {
+        return;
+    }
+
+    TexturePackKey key = {
+        .content_hash = binding->hash,
+        .color_format = binding->key.state.color_format,
+        .width = binding->key.state.width,
+        .height = binding->key.state.height,
+    };
+    const TexturePackEntry *e = g_hash_table_lookup(s->entries, &key);
+    if (!e) {
+        return;
+    }
+
+    TextureReplacementLoad *load = g_malloc0(sizeof(*load));
+    load->pack_entry = e;
+    load->binding = binding;
+    load->content_hash = binding->hash;
+    binding->replacement_load = load;
+    s->num_loading++;
+    g_thread_pool_push(s->load_pool, load, NULL);
+}
+
+static void destroy_texture_replacement(PGRAPHVkState *r,
+                                        TextureReplacement *replacement)
+{
+    pgraph_vk_bindless_remove_view(r, replacement->bindless_slot);
+    vkDestroyImageView(r->device, replacement->image_view, NULL);
+    pgraph_vk_discard_image_acquire(r, replacement->image);
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_TEXTURE],
+                                 replacement->allocation, true);
+    vmaDestroyImage(r->allocator, replacement->image, replacement->allocation);
+    g_free(replacement);
+}
+
+static TextureReplacement *
+create_texture_replacement(PGRAPHState *pg, TextureBinding *binding,
+                           const TextureReplacementLoad *load)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    const TexturePackEntry *e = load->pack_entry;
+    const TexturePackFormat *f = e->format;
+
+    VkImageCreateInfo image_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent.width = e->width,
+        .extent.height = e->height,
+        .extent.depth = 1,
+        .mipLevels = e->levels,
+        .arrayLayers = 1,
+        .format = f->format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    VmaAllocationCreateInfo alloc_create_info = {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+    };
+
+    TextureReplacement *replacement = g_malloc0(sizeof(*replacement));
+    replacement->content_hash = load->content_hash;
+    replacement->bindless_slot = -1;
+
+    // The guest texture still works, so running out of memory is not fatal
+    if (vmaCreateImage(r->allocator, &image_create_info, &alloc_create_info,
+                       &replacement->image, &replacement->allocation,
+                       NULL) != VK_SUCCESS) {
+        g_free(replacement);
+        return NULL;
+    }
+    pgraph_vk_account_allocation(r, r->image_mem_accounts[IMAGE_MEM_TEXTURE],
+                                 replacement->allocation, false);
+
+    VkImageViewCreateInfo image_view_create_info = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = replacement->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = f->format,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.baseMipLevel = 0,
+        .subresourceRange.levelCount = e->levels,
+        .subresourceRange.baseArrayLayer = 0,
+        .subresourceRange.layerCount = 1,
+    };
+    VK_CHECK(vkCreateImageView(r->device, &image_view_create_info, NULL,
+                               &replacement->image_view));
+
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_SRC, e->size);
+
+    uint8_t *mapped_memory_ptr;
+    VK_CHECK(vmaMapMemory(r->allocator,
+                          r->storage_buffers[BUFFER_STAGING_SRC].allocation,
+                          (void *)&mapped_memory_ptr));
+    memcpy(mapped_memory_ptr, load->data, e->size);
+    vmaFlushAllocation(r->allocator,
+                       r->storage_buffers[BUFFER_STAGING_SRC].allocation, 0,
+                       VK_WHOLE_SIZE);
+    vmaUnmapMemory(r->allocator,
+                   r->storage_buffers[BUFFER_STAGING_SRC].allocation);
+
+    g_autofree VkBufferImageCopy *regions =
+        g_malloc0_n(e->levels, sizeof(VkBufferImageCopy));
+    VkDeviceSize buffer_offset = 0;
+    for (int i = 0; i < e->levels; i++) {
+        uint32_t width = MAX(e->width >> i, 1);
+        uint32_t height = MAX(e->height >> i, 1);
+        regions[i] = (VkBufferImageCopy){
+            .bufferOffset = buffer_offset,
+            .bufferRowLength = 0, // Tightly packed
+            .bufferImageHeight = 0,
+            .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .imageSubresource.mipLevel = i,
+            .imageSubresource.baseArrayLayer = 0,
+            .imageSubresource.layerCount = 1,
+            .imageOffset = (VkOffset3D){ 0, 0, 0 },
+            .imageExtent = (VkExtent3D){ width, height, 1 },
+        };
+        buffer_offset += get_texture_pack_image_size(f, width, height, 1);
+    }
+    assert(buffer_offset == e->size);
+
+    // Nothing has sampled the new image yet, so it can always be filled on the
+    // transfer queue
+    bool use_transfer_queue = r->transfer_queue_enabled;
+    VkCommandBuffer cmd = use_transfer_queue ?
+                              pgraph_vk_begin_transfer_commands(pg) :
+                              pgraph_vk_begin_single_time_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_GREEN, __func__);
+
+    VkBufferMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_HOST_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = r->storage_buffers[BUFFER_STAGING_SRC].buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &host_barrier, 0, NULL);
+
+    pgraph_vk_transition_image_layout(pg, cmd, replacement->image, f->format,
+                                      VK_IMAGE_LAYOUT_UNDEFINED,
+                                      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+    vkCmdCopyBufferToImage(cmd, r->storage_buffers[BUFFER_STAGING_SRC].buffer,
+                           replacement->image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, e->levels,
+                           regions);
+
+    if (use_transfer_queue) {
+        pgraph_vk_release_image_to_graphics(
+            pg, cmd, replacement->image, VK_IMAGE_ASPECT_COLOR_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    } else {
+        pgraph_vk_transition_image_layout(
+            pg, cmd, replacement->image, f->format,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
+
+    pgraph_vk_end_debug_marker(r, cmd);
+    if (use_transfer_queue) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_TRANSFER_QUEUE);
+        pgraph_vk_end_transfer_commands(pg, cmd);
+    } else {
+        nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
+        pgraph_vk_end_single_time_commands(pg, cmd);
+    }
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_REPLACEMENT);
+
+    // Sampled with the sampler of the texture it replaces
+    if (r->bindless.enabled) {
+        replacement->bindless_slot = pgraph_vk_bindless_add_view(
+            r, replacement->image_view, binding->sampler,
+            PSH_BINDLESS_SAMPLER_2D);
+    }
+
+    return replacement;
+}
+
+static bool is_texture_bound(PGRAPHVkState *r, TextureBinding *binding)
+{
+    for (int i = 0; i < ARRAY_SIZE(r->texture_bindings); i++) {
+        if (r->texture_bindings[i] == binding) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool replace_texture(PGRAPHState *pg, TextureBinding *binding,
+                            const TextureReplacementLoad *load)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (binding->replacement) {
+        // Left over from earlier content, and possibly still being sampled
+        if (r->in_command_buffer && binding->submit_time == r->submit_count) {
+            return false;
+        }
+        pgraph_vk_wait_for_submit(r, binding->submit_time);
+        destroy_texture_replacement(r, binding->replacement);
+        binding->replacement = NULL;
+    }
+
+    binding->replacement = create_texture_replacement(pg, binding, load);
+    return binding->replacement != NULL;
+}
+
+/*
+ * Upload loaded replacements. Returns true if a bound texture was replaced,
+ * which needs its descriptors updated.
+ */
+bool pgraph_vk_process_texture_replacements(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureReplacementState *s = &r->texture_replacement;
+    bool bound_texture_replaced = false;
+
+    if (!s->enabled) {
+        return false;
+    }
+
+    for (int i = 0; i < TEXTURE_REPLACEMENT_MAX_UPLOADS_PER_BIND; i++) {
+        qemu_mutex_lock(&s->lock);
+        TextureReplacementLoad *load = QSIMPLEQ_FIRST(&s->loaded);
+        if (load) {
+            QSIMPLEQ_REMOVE_HEAD(&s->loaded, entry);
+        }
+        qemu_mutex_unlock(&s->lock);
+
+        if (!load) {
+            break;
+        }
+        s->num_loading--;
+
+        TextureBinding *binding = load->binding;
+        if (binding) {
+            binding->replacement_load = NULL;
+            // Content that changed while loading is requested again
+            if (binding->hash == load->content_hash &&
+                replace_texture(pg, binding, load)) {
+                bound_texture_replaced |= is_texture_bound(r, binding);
+            }
+        }
+
+        g_free(load->data);
+        g_free(load);
+    }
+
+    return bound_texture_replaced;
+}
+
+void pgraph_vk_release_texture_replacement(PGRAPHVkState *r,
+                                           TextureBinding *binding)
+{
+    if (binding->replacement_load) {
+        binding->replacement_load->binding = NULL;
+        binding->replacement_load = NULL;
+    }
+
+    if (binding->replacement) {
+        destroy_texture_replacement(r, binding->replacement);
+        binding->replacement = NULL;
+    }
+}
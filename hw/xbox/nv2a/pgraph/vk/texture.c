@@ -28,7 +28,10 @@
 #include "hw/xbox/nv2a/pgraph/swizzle.h"
 #include "qemu/fast-hash.h"
 #include "qemu/lru.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
 #include "renderer.h"
+#include "ui/xemu-settings.h"
 
 static void texture_cache_release_node_resources(PGRAPHVkState *r, TextureBinding *snode);
 
@@ -134,9 +137,155 @@ static size_t get_cubemap_layer_size(PGRAPHState *pg, TextureShape s)
     return ROUND_UP(length, NV2A_CUBEMAP_FACE_ALIGNMENT);
 }
 
+static bool is_native_compressed_texture(PGRAPHVkState *r,
+                                         const TextureShape *s)
+{
+    // Volume blocks are interleaved across slices and always decoded
+    return r->native_bc_textures && s->dimensionality == 2 && !s->border;
+}
+
+static VkFormat get_texture_host_vk_format(PGRAPHVkState *r,
+                                           const TextureShape *s)
+{
+    if (is_native_compressed_texture(r, s)) {
+        switch (s->color_format) {
+        case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
+            return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
+            return VK_FORMAT_BC2_UNORM_BLOCK;
+        case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
+            return VK_FORMAT_BC3_UNORM_BLOCK;
+        default:
+            break;
+        }
+    }
+
+    return kelvin_color_format_vk_map[s->color_format].vk_format;
+}
+
+typedef struct TextureDecodeBatch {
+    QemuMutex lock;
+    QemuCond cond;
+    int remaining;
+} TextureDecodeBatch;
+
+// Decode of one mip level of one layer of a swizzled or compressed texture
+typedef struct TextureLevelDecodeJob {
+    const TextureShape *s;
+    const uint8_t *data;
+    size_t data_size;
+    const uint8_t *palette_data;
+    unsigned int width, height, depth;
+    bool crop_to_shape;
+    bool compressed;
+    bool native_compressed;
+    TextureLevel *level;
+    TextureDecodeBatch *batch;
+} TextureLevelDecodeJob;
+
+static void decode_texture_level(TextureLevelDecodeJob *job)
+{
+    const TextureShape *s = job->s;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s->color_format];
+    unsigned int width = job->width, height = job->height, depth = job->depth;
+    uint8_t *converted;
+    size_t converted_size;
+
+    if (job->native_compressed) {
+        converted = g_memdup2(job->data, job->data_size);
+        converted_size = job->data_size;
+    } else if (job->compressed) {
+        enum S3TC_DECOMPRESS_FORMAT format =
+            kelvin_format_to_s3tc_format(s->color_format);
+        converted_size = width * height * depth * 4;
+        converted = s->dimensionality == 3 ?
+                        s3tc_decompress_3d(format, job->data, width, height,
+                                           depth) :
+                        s3tc_decompress_2d(format, job->data, width, height);
+        assert(converted);
+    } else {
+        unsigned int row_pitch = width * f.bytes_per_pixel;
+        unsigned int slice_pitch = row_pitch * height;
+
+        size_t unswizzled_size = slice_pitch * depth;
+        uint8_t *unswizzled = g_malloc(unswizzled_size);
+        unswizzle_box(job->data, width, height, depth, unswizzled, row_pitch,
+                      slice_pitch, f.bytes_per_pixel);
+
+        converted = pgraph_convert_texture_data(
+            *s, unswizzled, job->palette_data, width, height, depth,
+            row_pitch, slice_pitch, &converted_size);
+
+        if (converted) {
+            g_free(unswizzled);
+        } else {
+            converted = unswizzled;
+            converted_size = unswizzled_size;
+        }
+    }
+
+    *job->level = (TextureLevel){
+        .width = job->crop_to_shape ? s->width : width,
+        .height = job->crop_to_shape ? s->height : height,
+        .depth = depth,
+        .decoded_size = converted_size,
+        .decoded_data = converted,
+    };
+}
+
+static void texture_decode_worker(gpointer data, gpointer user_data)
+{
+    TextureLevelDecodeJob *job = data;
+
+    decode_texture_level(job);
+
+    qemu_mutex_lock(&job->batch->lock);
+    if (--job->batch->remaining == 0) {
+        qemu_cond_signal(&job->batch->cond);
+    }
+    qemu_mutex_unlock(&job->batch->lock);
+}
+
+// Below this much guest data, handing jobs to the pool costs more than it saves
+#define TEXTURE_DECODE_THREAD_MIN_SIZE (64 * KiB)
+
+static void run_texture_level_decode_jobs(PGRAPHVkState *r,
+                                          TextureLevelDecodeJob *jobs,
+                                          int num_jobs, size_t total_size)
+{
+    if (!r->texture_decode_pool || num_jobs < 2 ||
+        total_size < TEXTURE_DECODE_THREAD_MIN_SIZE) {
+        for (int i = 0; i < num_jobs; i++) {
+            decode_texture_level(&jobs[i]);
+        }
+        return;
+    }
+
+    TextureDecodeBatch batch;
+    qemu_mutex_init(&batch.lock);
+    qemu_cond_init(&batch.cond);
+    batch.remaining = num_jobs - 1;
+
+    // The first level is the largest, decode it here while workers take the
+    // remaining levels and faces
+    for (int i = 1; i < num_jobs; i++) {
+        jobs[i].batch = &batch;
+        g_thread_pool_push(r->texture_decode_pool, &jobs[i], NULL);
+    }
+    decode_texture_level(&jobs[0]);
+
+    qemu_mutex_lock(&batch.lock);
+    while (batch.remaining) {
+        qemu_cond_wait(&batch.cond, &batch.lock);
+    }
+    qemu_mutex_unlock(&batch.lock);
+
+    qemu_cond_destroy(&batch.cond);
+    qemu_mutex_destroy(&batch.lock);
+}
+
 // FIXME: Move to common
 // FIXME: More refactoring
-// FIXME: Possible parallelization of decoding
 // FIXME: Bounds checking
 static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
 {
@@ -227,168 +376,63 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
             s.color_format == NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5;
         block_size = is_dxt1 ? 8 : 16;
     }
+    bool native_compressed =
+        is_compressed && is_native_compressed_texture(pg->vk_renderer_state, &s);
 
-    if (s.dimensionality == 2) {
-        hwaddr layer_size = s.cubemap ? get_cubemap_layer_size(pg, s) : 0;
-        const int num_layers = s.cubemap ? 6 : 1;
-        for (int layer = 0; layer < num_layers; layer++) {
-            unsigned int width = adjusted_width, height = adjusted_height;
-            texture_data_ptr = (char *)d->vram_ptr + texture_vram_offset +
-                               layer * layer_size;
-
-            for (int level = 0; level < s.levels; level++) {
-                NV2A_VK_DPRINTF("Layer %d Level %d @ %x", layer, level, (int)((char*)texture_data_ptr - (char*)d->vram_ptr));
-
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                if (is_compressed) {
-                    // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
-                    unsigned int tex_width = width, tex_height = height;
-                    unsigned int physical_width = (width + 3) & ~3,
-                                 physical_height = (height + 3) & ~3;
-
-                    size_t converted_size = width * height * 4;
-                    uint8_t *converted = s3tc_decompress_2d(
-                        kelvin_format_to_s3tc_format(s.color_format),
-                        texture_data_ptr, width, height);
-                    assert(converted);
-
-                    if (s.cubemap && adjusted_width != s.width) {
-                        // FIXME: Consider preserving the border.
-                        // There does not seem to be a way to reference the border
-                        // texels in a cubemap, so they are discarded.
-
-                        // glPixelStorei(GL_UNPACK_SKIP_PIXELS, 4);
-                        // glPixelStorei(GL_UNPACK_SKIP_ROWS, 4);
-                        tex_width = s.width;
-                        tex_height = s.height;
-                        // if (physical_width == width) {
-                        //     glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                        // }
-
-                        // FIXME: Crop by 4 pixels on each side
-                    }
-
-                    layout->layers[layer].levels[level] = (TextureLevel){
-                        .width = tex_width,
-                        .height = tex_height,
-                        .depth = 1,
-                        .decoded_size = converted_size,
-                        .decoded_data = converted,
-                    };
-
-                    texture_data_ptr +=
-                        physical_width / 4 * physical_height / 4 * block_size;
-                } else {
-                    unsigned int pitch = width * f.bytes_per_pixel;
-                    unsigned int tex_width = width, tex_height = height;
-
-                    size_t converted_size = height * pitch;
-                    uint8_t *unswizzled = (uint8_t*)g_malloc(height * pitch);
-                    unswizzle_rect(texture_data_ptr, width, height,
-                                   unswizzled, pitch, f.bytes_per_pixel);
-
-                    uint8_t *converted = pgraph_convert_texture_data(
-                        s, unswizzled, palette_data_ptr, width, height, 1,
-                        pitch, 0, &converted_size);
-
-                    if (converted) {
-                        g_free(unswizzled);
-                    } else {
-                        converted = unswizzled;
-                    }
-
-                    if (s.cubemap && adjusted_width != s.width) {
-                        // FIXME: Consider preserving the border.
-                        // There does not seem to be a way to reference the border
-                        // texels in a cubemap, so they are discarded.
-                        // glPixelStorei(GL_UNPACK_ROW_LENGTH, adjusted_width);
-                        tex_width = s.width;
-                        tex_height = s.height;
-                        // pixel_data += 4 * f.bytes_per_pixel + 4 * pitch;
-
-                        // FIXME: Crop by 4 pixels on each side
-                    }
-
-                    layout->layers[layer].levels[level] = (TextureLevel){
-                        .width = tex_width,
-                        .height = tex_height,
-                        .depth = 1,
-                        .decoded_size = converted_size,
-                        .decoded_data = converted,
-                    };
-
-                    texture_data_ptr += width * height * f.bytes_per_pixel;
-                }
-
-                width /= 2;
-                height /= 2;
-            }
-        }
-    } else if (s.dimensionality == 3) {
-        assert(!f.linear);
+    TextureLevelDecodeJob jobs[ARRAY_SIZE(layout->layers) *
+                               ARRAY_SIZE(layout->layers[0].levels)];
+    int num_jobs = 0;
+    size_t total_size = 0;
+
+    const int num_layers = s.cubemap ? 6 : 1;
+    hwaddr layer_size = s.cubemap ? get_cubemap_layer_size(pg, s) : 0;
+    for (int layer = 0; layer < num_layers; layer++) {
         unsigned int width = adjusted_width, height = adjusted_height,
-                     depth = adjusted_depth;
+                     depth = s.dimensionality == 3 ? adjusted_depth : 1;
+        texture_data_ptr = (char *)d->vram_ptr + texture_vram_offset +
+                           layer * layer_size;
 
         for (int level = 0; level < s.levels; level++) {
+            NV2A_VK_DPRINTF("Layer %d Level %d @ %x", layer, level, (int)((char*)texture_data_ptr - (char*)d->vram_ptr));
+
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+            depth = MAX(depth, 1);
+
+            TextureLevelDecodeJob *job = &jobs[num_jobs++];
+            *job = (TextureLevelDecodeJob){
+                .s = &s,
+                .data = texture_data_ptr,
+                .palette_data = palette_data_ptr,
+                .width = width,
+                .height = height,
+                .depth = depth,
+                .compressed = is_compressed,
+                .native_compressed = native_compressed,
+                .level = &layout->layers[layer].levels[level],
+            };
+
+            if (s.cubemap && adjusted_width != s.width) {
+                // FIXME: Consider preserving the border.
+                // There does not seem to be a way to reference the border
+                // texels in a cubemap, so they are discarded.
+                // FIXME: Crop by 4 pixels on each side
+                job->crop_to_shape = true;
+            }
+
+            size_t level_size;
             if (is_compressed) {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
+                // https://docs.microsoft.com/en-us/windows/win32/direct3d10/d3d10-graphics-programming-guide-resources-block-compression#virtual-size-versus-physical-size
                 unsigned int physical_width = (width + 3) & ~3,
                              physical_height = (height + 3) & ~3;
-                depth = MAX(depth, 1);
-
-                size_t converted_size = width * height * depth * 4;
-                uint8_t *converted = s3tc_decompress_3d(
-                    kelvin_format_to_s3tc_format(s.color_format),
-                    texture_data_ptr, width, height, depth);
-                assert(converted);
-
-                layout->layers[0].levels[level] = (TextureLevel){
-                    .width = width,
-                    .height = height,
-                    .depth = depth,
-                    .decoded_size = converted_size,
-                    .decoded_data = converted,
-                };
-
-                texture_data_ptr += physical_width / 4 * physical_height / 4 * depth * block_size;
+                level_size = physical_width / 4 * physical_height / 4 * depth *
+                             block_size;
             } else {
-                width = MAX(width, 1);
-                height = MAX(height, 1);
-                depth = MAX(depth, 1);
-
-                unsigned int row_pitch = width * f.bytes_per_pixel;
-                unsigned int slice_pitch = row_pitch * height;
-
-                size_t unswizzled_size = slice_pitch * depth;
-                uint8_t *unswizzled = g_malloc(unswizzled_size);
-                unswizzle_box(texture_data_ptr, width, height, depth,
-                              unswizzled, row_pitch, slice_pitch,
-                              f.bytes_per_pixel);
-
-                size_t converted_size;
-                uint8_t *converted = pgraph_convert_texture_data(
-                    s, unswizzled, palette_data_ptr, width, height, depth,
-                    row_pitch, slice_pitch, &converted_size);
-
-                if (converted) {
-                    g_free(unswizzled);
-                } else {
-                    converted = unswizzled;
-                    converted_size = unswizzled_size;
-                }
-
-                layout->layers[0].levels[level] = (TextureLevel){
-                    .width = width,
-                    .height = height,
-                    .depth = depth,
-                    .decoded_size = converted_size,
-                    .decoded_data = converted,
-                };
-
-                texture_data_ptr += width * height * depth * f.bytes_per_pixel;
+                level_size = width * height * depth * f.bytes_per_pixel;
             }
+            job->data_size = level_size;
+            texture_data_ptr += level_size;
+            total_size += level_size;
 
             width /= 2;
             height /= 2;
@@ -396,60 +440,120 @@ static TextureLayout *get_texture_layout(PGRAPHState *pg, int texture_idx)
         }
     }
 
+    run_texture_level_decode_jobs(pg->vk_renderer_state, jobs, num_jobs,
+                                  total_size);
+
     NV2A_VK_DGROUP_END();
     return layout;
 }
 
-struct pgraph_texture_possibly_dirty_struct {
-    hwaddr addr, end;
-};
-
-static void mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node, void *opaque)
+static void texture_index_insert(PGRAPHVkState *r, TextureBinding *snode)
 {
-    struct pgraph_texture_possibly_dirty_struct *test = opaque;
+    if (snode->indexed) {
+        return;
+    }
+
+    snode->tex_itree.start = snode->key.texture_vram_offset;
+    snode->tex_itree.last = snode->key.texture_vram_offset +
+                            MAX(snode->key.texture_length, 1) - 1;
+    interval_tree_insert(&snode->tex_itree, &r->texture_tree);
+
+    if (snode->key.palette_length > 0) {
+        snode->pal_itree.start = snode->key.palette_vram_offset;
+        snode->pal_itree.last = snode->key.palette_vram_offset +
+                                snode->key.palette_length - 1;
+        interval_tree_insert(&snode->pal_itree, &r->palette_tree);
+    }
+
+    snode->indexed = true;
+}
 
-    TextureBinding *tnode = container_of(node, TextureBinding, node);
-    if (tnode->possibly_dirty) {
+static void texture_index_remove(PGRAPHVkState *r, TextureBinding *snode)
+{
+    if (!snode->indexed) {
         return;
     }
 
-    uintptr_t k_tex_addr = tnode->key.texture_vram_offset;
-    uintptr_t k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
-    bool overlapping = !(test->addr > k_tex_end || k_tex_addr > test->end);
+    interval_tree_remove(&snode->tex_itree, &r->texture_tree);
+    if (snode->key.palette_length > 0) {
+        interval_tree_remove(&snode->pal_itree, &r->palette_tree);
+    }
+
+    snode->indexed = false;
+}
 
-    if (tnode->key.palette_length > 0) {
-        uintptr_t k_pal_addr = tnode->key.palette_vram_offset;
-        uintptr_t k_pal_end = k_pal_addr + tnode->key.palette_length - 1;
-        overlapping |= !(test->addr > k_pal_end || k_pal_addr > test->end);
+static void mark_texture_range_possibly_dirty(TextureBinding *tnode,
+                                              hwaddr addr, hwaddr end)
+{
+    hwaddr k_tex_addr = tnode->key.texture_vram_offset;
+    hwaddr k_tex_end = k_tex_addr + tnode->key.texture_length - 1;
+
+    if (tnode->dirty_pages) {
+        hwaddr first_page = k_tex_addr >> TARGET_PAGE_BITS;
+        hwaddr start = MAX(addr, k_tex_addr) >> TARGET_PAGE_BITS;
+        hwaddr last = MIN(end, k_tex_end) >> TARGET_PAGE_BITS;
+        bitmap_set(tnode->dirty_pages, start - first_page, last - start + 1);
     }
 
-    tnode->possibly_dirty |= overlapping;
+    tnode->possibly_dirty = true;
 }
 
+/*
+ * Cached textures are indexed by the VRAM ranges of their texture and palette
+ * data, so only the textures overlapping the range are visited.
+ */
 void pgraph_vk_mark_textures_possibly_dirty(NV2AState *d,
     hwaddr addr, hwaddr size)
 {
+    PGRAPHVkState *r = d->pgraph.vk_renderer_state;
+
     hwaddr end = TARGET_PAGE_ALIGN(addr + size) - 1;
     addr &= TARGET_PAGE_MASK;
     assert(end <= memory_region_size(d->vram));
 
-    struct pgraph_texture_possibly_dirty_struct test = {
-        .addr = addr,
-        .end = end,
-    };
-
-    lru_visit_active(&d->pgraph.vk_renderer_state->texture_cache,
-                     mark_textures_possibly_dirty_visitor,
-                     &test);
+    IntervalTreeNode *node;
+    for (node = interval_tree_iter_first(&r->texture_tree, addr, end); node;
+         node = interval_tree_iter_next(node, addr, end)) {
+        mark_texture_range_possibly_dirty(
+            container_of(node, TextureBinding, tex_itree), addr, end);
+    }
+    for (node = interval_tree_iter_first(&r->palette_tree, addr, end); node;
+         node = interval_tree_iter_next(node, addr, end)) {
+        container_of(node, TextureBinding, pal_itree)->possibly_dirty = true;
+    }
 }
 
-static bool check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
+/*
+ * Test and clear each page spanned by the range, marking textures which
+ * overlap runs of dirty pages as possibly dirty. Returns true if any page
+ * was dirty.
+ */
+static bool check_texture_pages_dirty(NV2AState *d, hwaddr addr, hwaddr size)
 {
     hwaddr end = TARGET_PAGE_ALIGN(addr + size);
     addr &= TARGET_PAGE_MASK;
     assert(end < memory_region_size(d->vram));
-    return memory_region_test_and_clear_dirty(d->vram, addr, end - addr,
-                                              DIRTY_MEMORY_NV2A_TEX);
+
+    bool dirty = false;
+    hwaddr run_start = end;
+    for (hwaddr page = addr; page < end; page += TARGET_PAGE_SIZE) {
+        if (pgraph_vram_test_and_clear_dirty(d, page, TARGET_PAGE_SIZE,
+                                             DIRTY_MEMORY_NV2A_TEX)) {
+            if (run_start == end) {
+                run_start = page;
+            }
+            dirty = true;
+        } else if (run_start != end) {
+            pgraph_vk_mark_textures_possibly_dirty(d, run_start,
+                                                   page - run_start);
+            run_start = end;
+        }
+    }
+    if (run_start != end) {
+        pgraph_vk_mark_textures_possibly_dirty(d, run_start, end - run_start);
+    }
+
+    return dirty;
 }
 
 // Check if any of the pages spanned by the a texture are dirty.
@@ -459,22 +563,532 @@ static bool check_texture_possibly_dirty(NV2AState *d,
                                          hwaddr palette_vram_offset,
                                          unsigned int palette_length)
 {
-    bool possibly_dirty = false;
-    if (check_texture_dirty(d, texture_vram_offset, length)) {
-        possibly_dirty = true;
-        pgraph_vk_mark_textures_possibly_dirty(d, texture_vram_offset, length);
-    }
-    if (palette_length && check_texture_dirty(d, palette_vram_offset,
-                                                     palette_length)) {
-        possibly_dirty = true;
-        pgraph_vk_mark_textures_possibly_dirty(d, palette_vram_offset,
-                                            palette_length);
+    bool possibly_dirty = check_texture_pages_dirty(d, texture_vram_offset,
+                                                    length);
+    if (palette_length) {
+        possibly_dirty |= check_texture_pages_dirty(d, palette_vram_offset,
+                                                    palette_length);
     }
     return possibly_dirty;
 }
 
+static void init_texture_page_hashes(TextureBinding *snode)
+{
+    hwaddr addr = snode->key.texture_vram_offset;
+    hwaddr end = addr + snode->key.texture_length;
+    snode->num_pages = ((end - 1) >> TARGET_PAGE_BITS) -
+                       (addr >> TARGET_PAGE_BITS) + 1;
+    snode->page_hashes = g_malloc_n(snode->num_pages, sizeof(uint64_t));
+    snode->dirty_pages = bitmap_new(snode->num_pages);
+    bitmap_set(snode->dirty_pages, 0, snode->num_pages);
+    snode->changed_pages = bitmap_new(snode->num_pages);
+    bitmap_set(snode->changed_pages, 0, snode->num_pages);
+    snode->palette_hash = 0;
+}
+
+static void record_texture_hash_time(size_t length, int64_t us)
+{
+    if (length < 64 * KiB) {
+        nv2a_profile_add_counter(NV2A_PROF_TEX_HASH_US_UNDER_64K, us);
+    } else if (length < 1 * MiB) {
+        nv2a_profile_add_counter(NV2A_PROF_TEX_HASH_US_UNDER_1M, us);
+    } else {
+        nv2a_profile_add_counter(NV2A_PROF_TEX_HASH_US_OVER_1M, us);
+    }
+}
+
+// Rehash dirty pages and combine with the palette into a content hash
+static uint64_t hash_texture_content(NV2AState *d, TextureBinding *snode)
+{
+    int64_t start_time = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+    hwaddr addr = snode->key.texture_vram_offset;
+    hwaddr end = addr + snode->key.texture_length;
+    hwaddr page_addr = addr & TARGET_PAGE_MASK;
+    int num_hashed = 0;
+
+    for (int i = 0; i < snode->num_pages;
+         i++, page_addr += TARGET_PAGE_SIZE) {
+        if (!test_bit(i, snode->dirty_pages)) {
+            continue;
+        }
+        hwaddr start = MAX(page_addr, addr);
+        hwaddr stop = MIN(page_addr + TARGET_PAGE_SIZE, end);
+        uint64_t page_hash = fast_hash(d->vram_ptr + start, stop - start);
+        if (page_hash != snode->page_hashes[i]) {
+            set_bit(i, snode->changed_pages);
+        }
+        snode->page_hashes[i] = page_hash;
+        num_hashed++;
+    }
+    bitmap_clear(snode->dirty_pages, 0, snode->num_pages);
+
+    uint64_t hash = fast_hash((void *)snode->page_hashes,
+                              snode->num_pages * sizeof(uint64_t));
+    if (snode->key.palette_length) {
+        uint64_t palette_hash =
+            fast_hash(d->vram_ptr + snode->key.palette_vram_offset,
+                      snode->key.palette_length);
+        if (palette_hash != snode->palette_hash) {
+            // Every texel may be affected by a palette change
+            bitmap_set(snode->changed_pages, 0, snode->num_pages);
+            snode->palette_hash = palette_hash;
+        }
+        hash ^= palette_hash;
+    }
+
+    nv2a_profile_add_counter(NV2A_PROF_TEX_HASH_PAGES, num_hashed);
+    record_texture_hash_time(snode->key.texture_length,
+                             qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                 start_time);
+
+    return hash;
+}
+
 // FIXME: Make sure we update sampler when data matches. Should we add filtering
 // options to the textureshape?
+/*
+ * Map pages that changed since the last upload to texel rectangles of the
+ * image. Returns the number of rectangles, or -1 if a full upload is needed.
+ */
+static int get_changed_texture_rects(PGRAPHState *pg, TextureBinding *binding,
+                                     VkRect2D *rects)
+{
+    TextureShape *state = &binding->key.state;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[state->color_format];
+
+    if (binding->current_layout == VK_IMAGE_LAYOUT_UNDEFINED ||
+        !binding->changed_pages || state->levels != 1 || state->cubemap ||
+        state->dimensionality != 2 || state->border ||
+        pgraph_is_texture_format_compressed(pg, state->color_format)) {
+        return -1;
+    }
+
+    hwaddr addr = binding->key.texture_vram_offset;
+    hwaddr end = addr + binding->key.texture_length;
+    hwaddr page_addr = addr & TARGET_PAGE_MASK;
+    uint32_t num_texels = state->width * state->height;
+    size_t changed_texels = 0;
+    int num_rects = 0;
+
+    for (int i = 0; i < binding->num_pages;
+         i++, page_addr += TARGET_PAGE_SIZE) {
+        if (!test_bit(i, binding->changed_pages)) {
+            continue;
+        }
+        hwaddr start = MAX(page_addr, addr) - addr;
+        hwaddr stop = MIN(page_addr + TARGET_PAGE_SIZE, end) - addr;
+
+        unsigned int x0, y0, x1, y1;
+        if (f.linear) {
+            x0 = 0;
+            x1 = state->width;
+            y0 = start / state->pitch;
+            y1 = MIN(DIV_ROUND_UP(stop, state->pitch), state->height);
+        } else {
+            uint32_t first = start / f.bytes_per_pixel;
+            uint32_t last =
+                MIN((stop - 1) / f.bytes_per_pixel, num_texels - 1);
+            if (first > last) {
+                continue;
+            }
+            swizzle_get_range_bounds(state->width, state->height, first, last,
+                                     &x0, &y0, &x1, &y1);
+        }
+        if (y0 >= y1) {
+            continue;
+        }
+
+        // Extend the previous rectangle when it spans the same columns
+        VkRect2D *prev = num_rects ? &rects[num_rects - 1] : NULL;
+        if (prev && prev->offset.x == x0 && prev->extent.width == x1 - x0 &&
+            y0 >= prev->offset.y &&
+            y0 <= prev->offset.y + prev->extent.height) {
+            uint32_t prev_end = prev->offset.y + prev->extent.height;
+            if (y1 > prev_end) {
+                changed_texels += (x1 - x0) * (y1 - prev_end);
+                prev->extent.height = y1 - prev->offset.y;
+            }
+            continue;
+        }
+
+        rects[num_rects++] = (VkRect2D){
+            .offset = { x0, y0 },
+            .extent = { x1 - x0, y1 - y0 },
+        };
+        changed_texels += (x1 - x0) * (y1 - y0);
+    }
+
+    // Not worth splitting up the copy when most of the image changed
+    if (changed_texels * 2 > num_texels) {
+        return -1;
+    }
+
+    return num_rects;
+}
+
+static TextureDecodeKernel get_texture_decode_kernel(PGRAPHVkState *r,
+                                                     const TextureShape *s)
+{
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s->color_format];
+
+    if (f.linear || s->border) {
+        return TEXTURE_DECODE_NONE;
+    }
+
+    // Block data is uploaded as is and sampled natively
+    if (pgraph_is_texture_format_compressed(NULL, s->color_format) &&
+        is_native_compressed_texture(r, s)) {
+        return TEXTURE_DECODE_NONE;
+    }
+
+    switch (s->color_format) {
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT1_A1R5G5B5:
+        return s->dimensionality == 2 ? TEXTURE_DECODE_BC1 :
+                                        TEXTURE_DECODE_NONE;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT23_A8R8G8B8:
+        return s->dimensionality == 2 ? TEXTURE_DECODE_BC2 :
+                                        TEXTURE_DECODE_NONE;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_L_DXT45_A8R8G8B8:
+        return s->dimensionality == 2 ? TEXTURE_DECODE_BC3 :
+                                        TEXTURE_DECODE_NONE;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8:
+        return TEXTURE_DECODE_PALETTE_8;
+    case NV097_SET_TEXTURE_FORMAT_COLOR_SZ_R6G5B5:
+        // Converted to a 24-bit host format, done on the CPU
+        return TEXTURE_DECODE_NONE;
+    default:
+        break;
+    }
+
+    switch (f.bytes_per_pixel) {
+    case 1:
+        return TEXTURE_DECODE_UNSWIZZLE_8;
+    case 2:
+        return TEXTURE_DECODE_UNSWIZZLE_16;
+    case 4:
+        return TEXTURE_DECODE_UNSWIZZLE_32;
+    default:
+        return TEXTURE_DECODE_NONE;
+    }
+}
+
+/*
+ * Upload raw guest texture data and decode it on the GPU. Returns false if
+ * the texture cannot be decoded this way and the CPU path must be used.
+ */
+static bool upload_texture_image_compute(PGRAPHState *pg,
+                                         TextureBinding *binding)
+{
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    TextureShape *state = &binding->key.state;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[state->color_format];
+    VkColorFormatInfo vkf = kelvin_color_format_vk_map[state->color_format];
+
+    TextureDecodeKernel kernel = get_texture_decode_kernel(r, state);
+    if (kernel == TEXTURE_DECODE_NONE || pgraph_vk_compute_needs_finish(r)) {
+        return false;
+    }
+
+    bool is_compressed = kernel == TEXTURE_DECODE_BC1 ||
+                         kernel == TEXTURE_DECODE_BC2 ||
+                         kernel == TEXTURE_DECODE_BC3;
+    size_t block_size = kernel == TEXTURE_DECODE_BC1 ? 8 : 16;
+    const int num_layers = state->cubemap ? 6 : 1;
+    size_t layer_size = state->cubemap ? get_cubemap_layer_size(pg, *state) : 0;
+
+    int num_regions = num_layers * state->levels;
+    g_autofree TextureDecodeRegion *decode_regions =
+        g_malloc0_n(num_regions, sizeof(TextureDecodeRegion));
+    g_autofree VkBufferImageCopy *copy_regions =
+        g_malloc0_n(num_regions, sizeof(VkBufferImageCopy));
+    int num_copy_regions = 0;
+    unsigned int mip_skip = binding->key.mip_skip;
+
+    size_t in_size = binding->key.texture_length;
+    size_t out_size = 0;
+
+    for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
+        size_t in_offset = layer_idx * layer_size;
+        unsigned int width = state->width, height = state->height,
+                     depth = state->dimensionality == 3 ? state->depth : 1;
+
+        for (int level_idx = 0; level_idx < state->levels; level_idx++) {
+            width = MAX(width, 1);
+            height = MAX(height, 1);
+            depth = MAX(depth, 1);
+
+            size_t level_size;
+            if (is_compressed) {
+                level_size = DIV_ROUND_UP(width, 4) * DIV_ROUND_UP(height, 4) *
+                             block_size;
+            } else {
+                level_size = width * height * depth * f.bytes_per_pixel;
+            }
+            if (in_offset + level_size > in_size) {
+                return false;
+            }
+
+            int i = layer_idx * state->levels + level_idx;
+            decode_regions[i] = (TextureDecodeRegion){
+                .width = width,
+                .height = height,
+                .depth = depth,
+                .in_offset = in_offset,
+                .out_offset = out_size,
+            };
+            if (level_idx >= mip_skip) {
+                copy_regions[num_copy_regions++] = (VkBufferImageCopy){
+                    .bufferOffset = out_size,
+                    .bufferRowLength = 0, // Tightly packed
+                    .bufferImageHeight = 0,
+                    .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .imageSubresource.mipLevel = level_idx - mip_skip,
+                    .imageSubresource.baseArrayLayer = layer_idx,
+                    .imageSubresource.layerCount = 1,
+                    .imageOffset = (VkOffset3D){ 0, 0, 0 },
+                    .imageExtent = (VkExtent3D){ width, height, depth },
+                };
+            }
+
+            in_offset += level_size;
+            out_size += ROUND_UP(pgraph_vk_get_texture_decode_output_size(
+                                     kernel, &decode_regions[i]),
+                                 16);
+
+            width /= 2;
+            height /= 2;
+            depth /= 2;
+        }
+    }
+
+    size_t palette_offset = 0;
+    size_t palette_size = 0;
+    if (kernel == TEXTURE_DECODE_PALETTE_8) {
+        palette_offset = ROUND_UP(
+            in_size, r->device_props.limits.minStorageBufferOffsetAlignment);
+        palette_size = binding->key.palette_length;
+    }
+    size_t upload_size = palette_offset + palette_size;
+    in_size = ROUND_UP(in_size, 4);
+
+    if (MAX(upload_size, in_size) >
+            r->storage_buffers[BUFFER_STAGING_SRC].max_size ||
+        MAX(upload_size, in_size) >
+            r->storage_buffers[BUFFER_COMPUTE_DST].max_size ||
+        out_size > r->storage_buffers[BUFFER_COMPUTE_SRC].max_size) {
+        return false;
+    }
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_SRC,
+                                     MAX(upload_size, in_size));
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_DST,
+                                     MAX(upload_size, in_size));
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_SRC, out_size);
+
+    StorageBuffer *staging = &r->storage_buffers[BUFFER_STAGING_SRC];
+    StorageBuffer *decode_src = &r->storage_buffers[BUFFER_COMPUTE_DST];
+    StorageBuffer *decode_dst = &r->storage_buffers[BUFFER_COMPUTE_SRC];
+
+    uint8_t *mapped_memory_ptr;
+    VK_CHECK(vmaMapMemory(r->allocator, staging->allocation,
+                          (void *)&mapped_memory_ptr));
+    memcpy(mapped_memory_ptr, d->vram_ptr + binding->key.texture_vram_offset,
+           binding->key.texture_length);
+    if (palette_size) {
+        memcpy(mapped_memory_ptr + palette_offset,
+               d->vram_ptr + binding->key.palette_vram_offset, palette_size);
+    }
+    vmaFlushAllocation(r->allocator, staging->allocation, 0, VK_WHOLE_SIZE);
+    vmaUnmapMemory(r->allocator, staging->allocation);
+
+    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    pgraph_vk_begin_debug_marker(r, cmd, RGBA_GREEN, __func__);
+
+    VkBufferMemoryBarrier host_barrier = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_HOST_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .buffer = staging->buffer,
+        .size = VK_WHOLE_SIZE
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_HOST_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 1,
+                         &host_barrier, 0, NULL);
+
+    VkBufferCopy buffer_copy_region = {
+        .size = MAX(upload_size, in_size),
+    };
+    vkCmdCopyBuffer(cmd, staging->buffer, decode_src->buffer, 1,
+                    &buffer_copy_region);
+
+    VkBufferMemoryBarrier pre_decode_barriers[] = {
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_READ_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = decode_src->buffer,
+            .size = VK_WHOLE_SIZE,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+            .dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = decode_dst->buffer,
+            .size = VK_WHOLE_SIZE,
+        },
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL,
+                         ARRAY_SIZE(pre_decode_barriers), pre_decode_barriers,
+                         0, NULL);
+
+    bool decoded = pgraph_vk_decode_texture(
+        pg, cmd, kernel, decode_src->buffer, MAX(upload_size, in_size),
+        palette_offset, palette_size, decode_dst->buffer, out_size,
+        decode_regions, num_regions);
+
+    if (decoded) {
+        VkBufferMemoryBarrier post_decode_barriers[] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_READ_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = decode_src->buffer,
+                .size = VK_WHOLE_SIZE,
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+                .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+                .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .buffer = decode_dst->buffer,
+                .size = VK_WHOLE_SIZE,
+            },
+        };
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL,
+                             ARRAY_SIZE(post_decode_barriers),
+                             post_decode_barriers, 0, NULL);
+
+        pgraph_vk_transition_image_layout(
+            pg, cmd, binding->image, vkf.vk_format, binding->current_layout,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        binding->current_layout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+        vkCmdCopyBufferToImage(cmd, decode_dst->buffer, binding->image,
+                               binding->current_layout, num_copy_regions,
+                               copy_regions);
+
+        pgraph_vk_transition_image_layout(
+            pg, cmd, binding->image, vkf.vk_format, binding->current_layout,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+        binding->current_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_COMPUTE);
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
+    pgraph_vk_end_debug_marker(r, cmd);
+    pgraph_vk_end_single_time_commands(pg, cmd);
+
+    return decoded;
+}
+
+// Below this, converting again is about as fast as reading from disk
+#define TEXTURE_DISK_CACHE_MIN_SIZE (16 * KiB)
+
+static bool should_use_texture_disk_cache(PGRAPHVkState *r,
+                                          const TextureBinding *binding)
+{
+    const TextureShape *s = &binding->key.state;
+    BasicColorFormatInfo f = kelvin_color_format_info_map[s->color_format];
+
+    // Linear and natively sampled textures are close to a plain copy
+    return r->texture_disk_cache.enabled && !f.linear &&
+           !(pgraph_is_texture_format_compressed(NULL, s->color_format) &&
+             is_native_compressed_texture(r, s)) &&
+           binding->key.texture_length >= TEXTURE_DISK_CACHE_MIN_SIZE;
+}
+
+typedef struct TextureDiskCacheLevel {
+    uint32_t width, height, depth;
+    uint32_t reserved;
+    uint64_t size;
+} TextureDiskCacheLevel;
+
+static GByteArray *write_texture_layout(const TextureDiskCacheKey *key,
+                                        const TextureLayout *layout)
+{
+    const TextureShape *s = &key->state;
+    GByteArray *data = pgraph_vk_texture_disk_cache_begin_store(key);
+
+    for (int layer_idx = 0; layer_idx < (s->cubemap ? 6 : 1); layer_idx++) {
+        for (int level_idx = 0; level_idx < s->levels; level_idx++) {
+            const TextureLevel *level =
+                &layout->layers[layer_idx].levels[level_idx];
+            TextureDiskCacheLevel header = {
+                .width = level->width,
+                .height = level->height,
+                .depth = level->depth,
+                .size = level->decoded_size,
+            };
+            g_byte_array_append(data, (const guint8 *)&header, sizeof(header));
+            g_byte_array_append(data, level->decoded_data,
+                                level->decoded_size);
+        }
+    }
+
+    return data;
+}
+
+// Levels of the returned layout point into data
+static TextureLayout *read_texture_layout(const TextureShape *s,
+                                          const uint8_t *data, size_t size)
+{
+    TextureLayout *layout = g_malloc0(sizeof(TextureLayout));
+    size_t pos = 0;
+
+    for (int layer_idx = 0; layer_idx < (s->cubemap ? 6 : 1); layer_idx++) {
+        for (int level_idx = 0; level_idx < s->levels; level_idx++) {
+            TextureDiskCacheLevel header;
+            if (size - pos < sizeof(header)) {
+                goto error;
+            }
+            memcpy(&header, data + pos, sizeof(header));
+            pos += sizeof(header);
+            if (!header.size || header.size > size - pos) {
+                goto error;
+            }
+            layout->layers[layer_idx].levels[level_idx] = (TextureLevel){
+                .width = header.width,
+                .height = header.height,
+                .depth = header.depth,
+                .decoded_size = header.size,
+                .decoded_data = (void *)(data + pos),
+            };
+            pos += header.size;
+        }
+    }
+
+    if (pos == size) {
+        return layout;
+    }
+
+error:
+    g_free(layout);
+    return NULL;
+}
+
 static void upload_texture_image(PGRAPHState *pg, int texture_idx,
                                  TextureBinding *binding)
 {
@@ -484,22 +1098,77 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
 
     nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
-    g_autofree TextureLayout *layout = get_texture_layout(pg, texture_idx);
+    g_autofree VkRect2D *changed_rects =
+        g_malloc_n(MAX(binding->num_pages, 1), sizeof(VkRect2D));
+    int num_changed_rects =
+        get_changed_texture_rects(pg, binding, changed_rects);
+
+    if (num_changed_rects <= 0 &&
+        g_config.display.vulkan.compute_texture_decode &&
+        upload_texture_image_compute(pg, binding)) {
+        if (binding->changed_pages) {
+            bitmap_clear(binding->changed_pages, 0, binding->num_pages);
+        }
+        return;
+    }
+
+    g_autofree TextureLayout *layout = NULL;
+    GMappedFile *disk_cache_file = NULL;
     const int num_layers = state->cubemap ? 6 : 1;
 
+    if (num_changed_rects <= 0 && should_use_texture_disk_cache(r, binding)) {
+        TextureDiskCacheKey disk_cache_key;
+        memset(&disk_cache_key, 0, sizeof(disk_cache_key));
+        disk_cache_key.state = *state;
+        disk_cache_key.content_hash = binding->hash;
+        disk_cache_key.host_format = get_texture_host_vk_format(r, state);
+
+        const uint8_t *payload;
+        size_t payload_size;
+        disk_cache_file = pgraph_vk_texture_disk_cache_lookup(
+            r, &disk_cache_key, &payload, &payload_size);
+        if (disk_cache_file) {
+            layout = read_texture_layout(state, payload, payload_size);
+            if (layout) {
+                nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_DISK_CACHE);
+            } else {
+                g_mapped_file_unref(disk_cache_file);
+                disk_cache_file = NULL;
+            }
+        }
+        if (!layout) {
+            layout = get_texture_layout(pg, texture_idx);
+            pgraph_vk_texture_disk_cache_store(
+                r, &disk_cache_key,
+                write_texture_layout(&disk_cache_key, layout));
+        }
+    } else {
+        layout = get_texture_layout(pg, texture_idx);
+    }
+
+    size_t texel_size = 0;
+    if (num_changed_rects > 0) {
+        TextureLevel *level = &layout->layers[0].levels[0];
+        texel_size = level->decoded_size / (level->width * level->height);
+        if (!texel_size || 16 % texel_size ||
+            level->decoded_size != texel_size * level->width * level->height) {
+            num_changed_rects = -1;
+        }
+    }
+
     // Calculate decoded texture data size
+    const unsigned int mip_skip = binding->key.mip_skip;
     size_t texture_data_size = 0;
     for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
         TextureLayer *layer = &layout->layers[layer_idx];
-        for (int level_idx = 0; level_idx < state->levels; level_idx++) {
+        for (int level_idx = mip_skip; level_idx < state->levels; level_idx++) {
             size_t size = layer->levels[level_idx].decoded_size;
             assert(size);
             texture_data_size += size;
         }
     }
 
-    assert(texture_data_size <=
-           r->storage_buffers[BUFFER_STAGING_SRC].buffer_size);
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_SRC, texture_data_size);
 
     // Copy texture data to mapped device buffer
     uint8_t *mapped_memory_ptr;
@@ -508,38 +1177,77 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
                           r->storage_buffers[BUFFER_STAGING_SRC].allocation,
                           (void *)&mapped_memory_ptr));
 
-    int num_regions = num_layers * state->levels;
+    int num_regions = num_changed_rects > 0 ?
+                          num_changed_rects :
+                          num_layers * (state->levels - mip_skip);
     g_autofree VkBufferImageCopy *regions =
         g_malloc0_n(num_regions, sizeof(VkBufferImageCopy));
 
     VkBufferImageCopy *region = regions;
     VkDeviceSize buffer_offset = 0;
 
-    for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
-        TextureLayer *layer = &layout->layers[layer_idx];
-        NV2A_VK_DPRINTF("Layer %d", layer_idx);
-        for (int level_idx = 0; level_idx < state->levels; level_idx++) {
-            TextureLevel *level = &layer->levels[level_idx];
-            NV2A_VK_DPRINTF(" - Level %d, w=%d h=%d d=%d @ %08" HWADDR_PRIx,
-                            level_idx, level->width, level->height,
-                            level->depth, buffer_offset);
-            memcpy(mapped_memory_ptr + buffer_offset, level->decoded_data,
-                   level->decoded_size);
+    if (num_changed_rects > 0) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_PARTIAL);
+
+        // Only copy the rectangles covering changed pages
+        TextureLevel *level = &layout->layers[0].levels[0];
+        size_t row_size = level->width * texel_size;
+        for (int i = 0; i < num_changed_rects; i++) {
+            VkRect2D *rect = &changed_rects[i];
+            size_t rect_row_size = rect->extent.width * texel_size;
+            buffer_offset = QEMU_ALIGN_UP(buffer_offset, 16);
+            for (int y = 0; y < rect->extent.height; y++) {
+                memcpy(mapped_memory_ptr + buffer_offset + y * rect_row_size,
+                       (uint8_t *)level->decoded_data +
+                           (rect->offset.y + y) * row_size +
+                           rect->offset.x * texel_size,
+                       rect_row_size);
+            }
             *region = (VkBufferImageCopy){
                 .bufferOffset = buffer_offset,
                 .bufferRowLength = 0, // Tightly packed
                 .bufferImageHeight = 0,
                 .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .imageSubresource.mipLevel = level_idx,
-                .imageSubresource.baseArrayLayer = layer_idx,
+                .imageSubresource.mipLevel = 0,
+                .imageSubresource.baseArrayLayer = 0,
                 .imageSubresource.layerCount = 1,
-                .imageOffset = (VkOffset3D){ 0, 0, 0 },
-                .imageExtent =
-                    (VkExtent3D){ level->width, level->height, level->depth },
+                .imageOffset = (VkOffset3D){ rect->offset.x, rect->offset.y,
+                                             0 },
+                .imageExtent = (VkExtent3D){ rect->extent.width,
+                                             rect->extent.height, 1 },
             };
-            buffer_offset += level->decoded_size;
+            buffer_offset += rect->extent.height * rect_row_size;
             region++;
         }
+    } else {
+        for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
+            TextureLayer *layer = &layout->layers[layer_idx];
+            NV2A_VK_DPRINTF("Layer %d", layer_idx);
+            for (int level_idx = mip_skip; level_idx < state->levels;
+                 level_idx++) {
+                TextureLevel *level = &layer->levels[level_idx];
+                NV2A_VK_DPRINTF(
+                    " - Level %d, w=%d h=%d d=%d @ %08" HWADDR_PRIx,
+                    level_idx, level->width, level->height, level->depth,
+                    buffer_offset);
+                memcpy(mapped_memory_ptr + buffer_offset, level->decoded_data,
+                       level->decoded_size);
+                *region = (VkBufferImageCopy){
+                    .bufferOffset = buffer_offset,
+                    .bufferRowLength = 0, // Tightly packed
+                    .bufferImageHeight = 0,
+                    .imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                    .imageSubresource.mipLevel = level_idx - mip_skip,
+                    .imageSubresource.baseArrayLayer = layer_idx,
+                    .imageSubresource.layerCount = 1,
+                    .imageOffset = (VkOffset3D){ 0, 0, 0 },
+                    .imageExtent = (VkExtent3D){ level->width, level->height,
+                                                 level->depth },
+                };
+                buffer_offset += level->decoded_size;
+                region++;
+            }
+        }
     }
     assert(buffer_offset <= r->storage_buffers[BUFFER_STAGING_SRC].buffer_size);
 
@@ -550,8 +1258,16 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
     vmaUnmapMemory(r->allocator,
                    r->storage_buffers[BUFFER_STAGING_SRC].allocation);
 
+    // A new image has nothing for frames in flight to read, so it can be
+    // filled on the transfer queue without waiting behind them
+    bool use_transfer_queue =
+        r->transfer_queue_enabled &&
+        binding->current_layout == VK_IMAGE_LAYOUT_UNDEFINED;
+
     // FIXME: Use nondraw. Need to fill and copy tex buffer at once
-    VkCommandBuffer cmd = pgraph_vk_begin_single_time_commands(pg);
+    VkCommandBuffer cmd = use_transfer_queue ?
+                              pgraph_vk_begin_transfer_commands(pg) :
+                              pgraph_vk_begin_single_time_commands(pg);
     pgraph_vk_begin_debug_marker(r, cmd, RGBA_GREEN, __func__);
 
     VkBufferMemoryBarrier host_barrier = {
@@ -576,14 +1292,34 @@ static void upload_texture_image(PGRAPHState *pg, int texture_idx,
                            binding->image, binding->current_layout,
                            num_regions, regions);
 
-    pgraph_vk_transition_image_layout(pg, cmd, binding->image, vkf.vk_format,
-                                      binding->current_layout,
-                                      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    if (use_transfer_queue) {
+        pgraph_vk_release_image_to_graphics(
+            pg, cmd, binding->image, VK_IMAGE_ASPECT_COLOR_BIT,
+            binding->current_layout, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    } else {
+        pgraph_vk_transition_image_layout(
+            pg, cmd, binding->image, vkf.vk_format, binding->current_layout,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    }
     binding->current_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-    nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
     pgraph_vk_end_debug_marker(r, cmd);
-    pgraph_vk_end_single_time_commands(pg, cmd);
+    if (use_transfer_queue) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD_TRANSFER_QUEUE);
+        pgraph_vk_end_transfer_commands(pg, cmd);
+    } else {
+        nv2a_profile_inc_counter(NV2A_PROF_QUEUE_SUBMIT_4);
+        pgraph_vk_end_single_time_commands(pg, cmd);
+    }
+
+    if (binding->changed_pages) {
+        bitmap_clear(binding->changed_pages, 0, binding->num_pages);
+    }
+
+    if (disk_cache_file) {
+        g_mapped_file_unref(disk_cache_file);
+        return;
+    }
 
     // Release decoded texture data
     for (int layer_idx = 0; layer_idx < num_layers; layer_idx++) {
@@ -663,8 +1399,14 @@ static void copy_zeta_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surfac
             .imageExtent = (VkExtent3D){scaled_width, scaled_height, 1},
         };
     }
+    pgraph_vk_reserve_scratch_buffer(
+        pg, BUFFER_COMPUTE_DST,
+        MAX(copied_image_size, stencil_buffer_offset + stencil_buffer_size));
+    if (use_compute_to_convert_depth_stencil) {
+        pgraph_vk_reserve_scratch_buffer(pg, BUFFER_COMPUTE_SRC,
+                                         scaled_width * scaled_height * 4);
+    }
     StorageBuffer *dst_storage_buffer = &r->storage_buffers[BUFFER_COMPUTE_DST];
-    assert(dst_storage_buffer->buffer_size >= copied_image_size);
 
     pgraph_vk_transition_image_layout(
         pg, cmd, surface->image, surface->host_fmt.vk_format,
@@ -715,7 +1457,7 @@ static void copy_zeta_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surfac
         pgraph_vk_pack_depth_stencil(
             pg, surface, cmd,
             r->storage_buffers[BUFFER_COMPUTE_DST].buffer,
-            r->storage_buffers[BUFFER_COMPUTE_SRC].buffer, false);
+            r->storage_buffers[BUFFER_COMPUTE_SRC].buffer, false, false);
 
         VkBufferMemoryBarrier post_pack_src_barrier = {
             .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
@@ -806,9 +1548,79 @@ static void copy_zeta_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surfac
 }
 
 // FIXME: Should be able to skip the copy and sample the original surface image
+/*
+ * Fill the lower mip levels of a texture from level 0 with a chain of blits,
+ * the whole image is in TRANSFER_DST_OPTIMAL before and after.
+ */
+static void generate_texture_mipmaps(PGRAPHState *pg, VkCommandBuffer cmd,
+                                     TextureBinding *texture,
+                                     unsigned int width, unsigned int height)
+{
+    TextureShape *state = &texture->key.state;
+
+    VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = texture->image,
+        .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+        .subresourceRange.levelCount = 1,
+        .subresourceRange.layerCount = 1,
+    };
+
+    for (unsigned int level = 1; level < state->levels; level++) {
+        barrier.subresourceRange.baseMipLevel = level - 1;
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0,
+                             NULL, 1, &barrier);
+
+        unsigned int level_width = MAX(width / 2, 1),
+                     level_height = MAX(height / 2, 1);
+        VkImageBlit blit = {
+            .srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .srcSubresource.mipLevel = level - 1,
+            .srcSubresource.layerCount = 1,
+            .srcOffsets[1] = (VkOffset3D){ width, height, 1 },
+            .dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .dstSubresource.mipLevel = level,
+            .dstSubresource.layerCount = 1,
+            .dstOffsets[1] = (VkOffset3D){ level_width, level_height, 1 },
+        };
+        vkCmdBlitImage(cmd, texture->image,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit,
+                       VK_FILTER_LINEAR);
+
+        width = level_width;
+        height = level_height;
+    }
+
+    // Put the source levels back so the image has a single layout again
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = state->levels - 1;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL,
+                         1, &barrier);
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX_MIPMAPS);
+}
+
 static void copy_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surface,
                                     TextureBinding *texture)
 {
+    if (texture->changed_pages) {
+        // Image no longer matches guest memory, next upload must be full
+        bitmap_set(texture->changed_pages, 0, texture->num_pages);
+    }
+
     if (!surface->color) {
         copy_zeta_surface_to_texture(pg, surface, texture);
         return;
@@ -852,6 +1664,11 @@ static void copy_surface_to_texture(PGRAPHState *pg, SurfaceBinding *surface,
                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, texture->image,
                    texture->current_layout, 1, &region);
 
+    if (state->levels > 1) {
+        generate_texture_mipmaps(pg, cmd, texture, region.extent.width,
+                                 region.extent.height);
+    }
+
     pgraph_vk_transition_image_layout(
         pg, cmd, surface->image, surface->host_fmt.vk_format,
         VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
@@ -886,14 +1703,26 @@ static unsigned int vk_format_texel_size(VkFormat format)
     }
 }
 
-static bool check_surface_to_texture_compatiblity(const SurfaceBinding *surface,
+static bool check_surface_to_texture_compatiblity(PGRAPHVkState *r,
+                                                  const SurfaceBinding *surface,
                                                   const TextureShape *shape)
 {
     if ((!surface->swizzle && surface->pitch != shape->pitch) ||
         surface->width != shape->width ||
         surface->height != shape->height ||
-        shape->cubemap ||
-        shape->levels > 1) {
+        shape->cubemap) {
+        return false;
+    }
+
+    // Lower levels are generated from the surface instead of guest memory
+    const VkFormatFeatureFlags mipmap_features =
+        VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if (shape->levels > 1 &&
+        (!g_config.display.quality.surface_mipmaps || !surface->color ||
+         (r->texture_format_properties[shape->color_format]
+              .optimalTilingFeatures &
+          mipmap_features) != mipmap_features)) {
         return false;
     }
 
@@ -901,11 +1730,54 @@ static bool check_surface_to_texture_compatiblity(const SurfaceBinding *surface,
         return true;
     }
 
+    // Block compressed images can't be the destination of a surface copy
+    if (pgraph_is_texture_format_compressed(NULL, shape->color_format) &&
+        is_native_compressed_texture(r, shape)) {
+        return false;
+    }
+
     VkColorFormatInfo tex_vkf = kelvin_color_format_vk_map[shape->color_format];
     return tex_vkf.vk_format &&
            surface->host_fmt.host_bytes_per_pixel == vk_format_texel_size(tex_vkf.vk_format);
 }
 
+/*
+ * A color surface can be sampled in place when the texture uses its host
+ * format and needs no levels beyond the surface itself. Render targets are
+ * still copied, they can't be sampled and written in the same pass.
+ */
+static bool check_surface_alias_compatibility(PGRAPHVkState *r,
+                                              const SurfaceBinding *surface,
+                                              const TextureShape *shape)
+{
+    return surface->color && surface != r->color_binding &&
+           shape->dimensionality == 2 &&
+           (shape->levels == 1 ||
+            kelvin_color_format_info_map[shape->color_format].linear) &&
+           get_texture_host_vk_format(r, shape) == surface->host_fmt.vk_format;
+}
+
+/*
+ * Aliased surfaces are moved to SHADER_READ_ONLY_OPTIMAL when a render pass
+ * begins, so a pass that began without this one has to be restarted.
+ */
+static void bind_surface_alias(PGRAPHState *pg, TextureBinding *texture)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX_ALIAS);
+
+    if (!r->in_render_pass) {
+        return;
+    }
+    for (int i = 0; i < r->num_aliased_surface_images; i++) {
+        if (r->aliased_surface_images[i] == texture->image) {
+            return;
+        }
+    }
+    pgraph_vk_ensure_not_in_render_pass(pg, VK_RENDER_PASS_END_TRANSFER);
+}
+
 static void create_dummy_texture(PGRAPHState *pg)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
@@ -980,6 +1852,7 @@ static void create_dummy_texture(PGRAPHState *pg)
     uint8_t *mapped_memory_ptr;
     size_t texture_data_size =
         image_create_info.extent.width * image_create_info.extent.height;
+    pgraph_vk_reserve_scratch_buffer(pg, BUFFER_STAGING_SRC, texture_data_size);
 
     VK_CHECK(vmaMapMemory(r->allocator,
                           r->storage_buffers[BUFFER_STAGING_SRC].allocation,
@@ -1032,6 +1905,8 @@ static void create_dummy_texture(PGRAPHState *pg)
         .image_view = texture_image_view,
         .sampler = texture_sampler,
     };
+    pgraph_vk_bindless_add_texture(r, &r->dummy_texture,
+                                   PSH_BINDLESS_SAMPLER_2D);
 }
 
 static void destroy_dummy_texture(PGRAPHVkState *r)
@@ -1092,8 +1967,7 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     bool is_indexed = (state.color_format ==
             NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
     uint32_t max_anisotropy =
-        1 << (GET_MASK(pgraph_reg_r(pg, NV_PGRAPH_TEXCTL0_0 + texture_idx*4),
-                       NV_PGRAPH_TEXCTL0_0_MAX_ANISOTROPY));
+        pgraph_get_texture_max_anisotropy(pg, texture_idx);
 
     TextureKey key;
     memset(&key, 0, sizeof(key));
@@ -1114,6 +1988,8 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     key.address = address;
     key.border_color = border_color_pack32;
     key.max_anisotropy = max_anisotropy;
+    key.lod_bias = pgraph_get_texture_lod_bias(pg, texture_idx);
+    key.mip_skip = pgraph_get_texture_mip_skip(&state);
 
     bool possibly_dirty = false;
     bool possibly_dirty_checked = false;
@@ -1121,9 +1997,16 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
 
     // Check active surfaces to see if this texture was a render target
     SurfaceBinding *surface = pgraph_vk_surface_get(d, texture_vram_offset);
-    if (surface && state.levels == 1) {
+    if (surface && !key.mip_skip) {
         surface_to_texture =
-            check_surface_to_texture_compatiblity(surface, &state);
+            check_surface_to_texture_compatiblity(r, surface, &state);
+        surface->zeta_contents_needed |= surface_to_texture;
+        surface->attachment_only &= !surface_to_texture;
+        surface->frame_skip_pinned = true;
+        if (surface_to_texture && surface->transient) {
+            nv2a_profile_inc_counter(NV2A_PROF_SURF_TRANSIENT_MISS);
+            surface_to_texture = false;
+        }
 
         if (!surface_to_texture && surface->color) {
             trace_nv2a_pgraph_surface_texture_compat_failed(
@@ -1131,11 +2014,15 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
                 state.color_format);
         }
 
-        if (surface_to_texture && surface->upload_pending) {
+        if (surface_to_texture) {
             pgraph_vk_upload_surface_data(d, surface, false);
         }
     }
 
+    bool surface_alias = surface_to_texture &&
+                         check_surface_alias_compatibility(r, surface, &state);
+    key.surface_alias = surface_alias;
+
     if (!surface_to_texture) {
         // FIXME: Restructure to support rendering surfaces to cubemap faces
 
@@ -1149,15 +2036,21 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     }
 
     uint64_t key_hash = fast_hash((void*)&key, sizeof(key));
+    if (!r->texture_cache.num_free &&
+        !lru_contains_hash(&r->texture_cache, key_hash)) {
+        texture_cache_grow(r);
+    }
     LruNode *node = lru_lookup(&r->texture_cache, key_hash, &key);
     TextureBinding *snode = container_of(node, TextureBinding, node);
     bool binding_found = snode->image != VK_NULL_HANDLE;
 
     if (binding_found) {
         NV2A_VK_DPRINTF("Cache hit");
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_CACHE_HIT);
         r->texture_bindings[texture_idx] = snode;
         possibly_dirty |= snode->possibly_dirty;
     } else {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_CACHE_MISS);
         possibly_dirty = true;
     }
 
@@ -1167,29 +2060,27 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
             texture_palette_data_size);
     }
 
-    // Calculate hash of texture data, if necessary
-    void *texture_data = (char*)d->vram_ptr + texture_vram_offset;
-    void *palette_data = (char*)d->vram_ptr + texture_palette_vram_offset;
-
-    uint64_t content_hash = 0;
-    if (!surface_to_texture && possibly_dirty) {
-        content_hash = fast_hash(texture_data, texture_length);
-        if (is_indexed) {
-            content_hash ^= fast_hash(palette_data, texture_palette_data_size);
-        }
-    }
-
     if (binding_found) {
-        if (surface_to_texture) {
+        if (surface_alias) {
+            bind_surface_alias(pg, snode);
+        } else if (surface_to_texture) {
             // FIXME: Add draw time tracking
             if (surface->draw_time != snode->draw_time) {
                 copy_surface_to_texture(pg, surface, snode);
             }
         } else {
+            if (!snode->page_hashes) {
+                init_texture_page_hashes(snode);
+            }
+            uint64_t content_hash =
+                possibly_dirty ? hash_texture_content(d, snode) : 0;
             if (possibly_dirty && content_hash != snode->hash) {
+                xemu_trace_begin("texture upload", NULL);
                 upload_texture_image(pg, texture_idx, snode);
+                xemu_trace_end();
                 snode->hash = content_hash;
             }
+            pgraph_vk_request_texture_replacement(pg, snode);
         }
 
         NV2A_VK_DGROUP_END();
@@ -1199,9 +2090,14 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     NV2A_VK_DPRINTF("Cache miss");
 
     memcpy(&snode->key, &key, sizeof(key));
+    texture_index_insert(r, snode);
     snode->current_layout = VK_IMAGE_LAYOUT_UNDEFINED;
     snode->possibly_dirty = false;
-    snode->hash = content_hash;
+    snode->hash = 0;
+    if (!surface_to_texture) {
+        init_texture_page_hashes(snode);
+        snode->hash = hash_texture_content(d, snode);
+    }
 
     VkColorFormatInfo vkf = kelvin_color_format_vk_map[state.color_format];
     assert(vkf.vk_format != 0);
@@ -1213,12 +2109,13 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     VkImageCreateInfo image_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
         .imageType = dimensionality_to_vk_image_type[state.dimensionality],
-        .extent.width = state.width, // FIXME: Use adjusted size?
-        .extent.height = state.height,
+        // FIXME: Use adjusted size?
+        .extent.width = MAX(state.width >> key.mip_skip, 1),
+        .extent.height = MAX(state.height >> key.mip_skip, 1),
         .extent.depth = state.depth,
-        .mipLevels = f_basic.linear ? 1 : state.levels,
+        .mipLevels = f_basic.linear ? 1 : state.levels - key.mip_skip,
         .arrayLayers = state.cubemap ? 6 : 1,
-        .format = vkf.vk_format,
+        .format = get_texture_host_vk_format(r, &state),
         .tiling = VK_IMAGE_TILING_OPTIMAL,
         .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
         .usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
@@ -1230,15 +2127,27 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     if (surface_to_texture) {
         pgraph_apply_scaling_factor(pg, &image_create_info.extent.width,
                                         &image_create_info.extent.height);
+        if (state.levels > 1) {
+            image_create_info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
     }
 
     VmaAllocationCreateInfo alloc_create_info = {
         .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
     };
 
-    VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
-                            &alloc_create_info, &snode->image,
-                            &snode->allocation, NULL));
+    if (surface_alias) {
+        // The surface owns the image, the binding only adds a view of it
+        snode->image = surface->image;
+        snode->allocation = VK_NULL_HANDLE;
+    } else {
+        VK_CHECK(vmaCreateImage(r->allocator, &image_create_info,
+                                &alloc_create_info, &snode->image,
+                                &snode->allocation, NULL));
+        pgraph_vk_account_allocation(
+            r, r->image_mem_accounts[IMAGE_MEM_TEXTURE], snode->allocation,
+            false);
+    }
 
     VkImageViewCreateInfo image_view_create_info = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
@@ -1246,7 +2155,7 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
         .viewType = state.cubemap ?
             VK_IMAGE_VIEW_TYPE_CUBE :
             dimensionality_to_vk_image_view_type[state.dimensionality],
-        .format = vkf.vk_format,
+        .format = image_create_info.format,
         .subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
         .subresourceRange.baseMipLevel = 0,
         .subresourceRange.levelCount = image_create_info.mipLevels,
@@ -1336,8 +2245,7 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
         min_filter == NV_PGRAPH_TEXFILTER0_MIN_BOX_NEARESTLOD ||
         min_filter == NV_PGRAPH_TEXFILTER0_MIN_TENT_NEARESTLOD;
 
-    float lod_bias = pgraph_convert_lod_bias_to_float(
-        GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS));
+    float lod_bias = key.lod_bias;
     if (lod_bias > r->device_props.limits.maxSamplerLodBias) {
         lod_bias = r->device_props.limits.maxSamplerLodBias;
     } else if (lod_bias < -r->device_props.limits.maxSamplerLodBias) {
@@ -1365,8 +2273,10 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
         .compareOp = VK_COMPARE_OP_ALWAYS,
         .mipmapMode = mipmap_nearest ? VK_SAMPLER_MIPMAP_MODE_NEAREST :
                                        VK_SAMPLER_MIPMAP_MODE_LINEAR,
-        .minLod = mipmap_en ? MIN(state.min_mipmap_level, state.levels - 1) : 0.0,
-        .maxLod = mipmap_en ? MIN(state.max_mipmap_level, state.levels - 1) : 0.0,
+        .minLod = mipmap_en ? MIN(MAX(state.min_mipmap_level, key.mip_skip),
+                                  state.levels - 1) - key.mip_skip : 0.0,
+        .maxLod = mipmap_en ? MIN(MAX(state.max_mipmap_level, key.mip_skip),
+                                  state.levels - 1) - key.mip_skip : 0.0,
         .mipLodBias = lod_bias,
         .pNext = sampler_next_struct,
     };
@@ -1374,15 +2284,30 @@ static void create_texture(PGRAPHState *pg, int texture_idx)
     VK_CHECK(vkCreateSampler(r->device, &sampler_create_info, NULL,
                              &snode->sampler));
 
-    set_texture_label(pg, snode);
+    // Matches the sampler type the pixel shader declares for the stage
+    enum PshBindlessSamplerType bindless_type =
+        state.cubemap             ? PSH_BINDLESS_SAMPLER_CUBE :
+        state.dimensionality == 3 ? PSH_BINDLESS_SAMPLER_3D :
+        is_integer_type           ? PSH_BINDLESS_USAMPLER_2D :
+                                    PSH_BINDLESS_SAMPLER_2D;
+    pgraph_vk_bindless_add_texture(r, snode, bindless_type);
+
+    if (!surface_alias) {
+        set_texture_label(pg, snode);
+    }
 
     r->texture_bindings[texture_idx] = snode;
 
-    if (surface_to_texture) {
+    if (surface_alias) {
+        bind_surface_alias(pg, snode);
+    } else if (surface_to_texture) {
         copy_surface_to_texture(pg, surface, snode);
     } else {
+        xemu_trace_begin("texture upload", NULL);
         upload_texture_image(pg, texture_idx, snode);
+        xemu_trace_end();
         snode->draw_time = 0;
+        pgraph_vk_request_texture_replacement(pg, snode);
     }
 
     NV2A_VK_DGROUP_END();
@@ -1393,7 +2318,13 @@ static bool check_textures_dirty(PGRAPHState *pg)
     PGRAPHVkState *r = pg->vk_renderer_state;
 
     for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
-        if (!r->texture_bindings[i] || pg->texture_dirty[i]) {
+        TextureBinding *binding = r->texture_bindings[i];
+        if (!binding || pg->texture_dirty[i]) {
+            return true;
+        }
+        // Fall back to a copy once an aliased surface is rendered to again
+        if (binding->key.surface_alias && r->color_binding &&
+            binding->image == r->color_binding->image) {
             return true;
         }
     }
@@ -1419,7 +2350,7 @@ void pgraph_vk_bind_textures(NV2AState *d)
     // FIXME: Check for modifications on bind fastpath (CPU hook)
     // FIXME: Mark textures that are sourced from surfaces so we can track them
 
-    r->texture_bindings_changed = false;
+    r->texture_bindings_changed = pgraph_vk_process_texture_replacements(pg);
 
     if (!check_textures_dirty(pg)) {
         NV2A_VK_DPRINTF("Not dirty");
@@ -1452,19 +2383,44 @@ static void texture_cache_entry_init(Lru *lru, LruNode *node, const void *state)
     snode->allocation = VK_NULL_HANDLE;
     snode->image_view = VK_NULL_HANDLE;
     snode->sampler = VK_NULL_HANDLE;
+    snode->indexed = false;
+    snode->num_pages = 0;
+    snode->page_hashes = NULL;
+    snode->dirty_pages = NULL;
+    snode->changed_pages = NULL;
+    snode->bindless_slot = -1;
+    snode->replacement = NULL;
+    snode->replacement_load = NULL;
 }
 
 static void texture_cache_release_node_resources(PGRAPHVkState *r, TextureBinding *snode)
 {
+    pgraph_vk_bindless_remove_texture(r, snode);
+    pgraph_vk_release_texture_replacement(r, snode);
+
     vkDestroySampler(r->device, snode->sampler, NULL);
     snode->sampler = VK_NULL_HANDLE;
 
     vkDestroyImageView(r->device, snode->image_view, NULL);
     snode->image_view = VK_NULL_HANDLE;
 
-    vmaDestroyImage(r->allocator, snode->image, snode->allocation);
+    if (!snode->key.surface_alias) {
+        pgraph_vk_discard_image_acquire(r, snode->image);
+        pgraph_vk_account_allocation(
+            r, r->image_mem_accounts[IMAGE_MEM_TEXTURE], snode->allocation,
+            true);
+        vmaDestroyImage(r->allocator, snode->image, snode->allocation);
+    }
     snode->image = VK_NULL_HANDLE;
     snode->allocation = VK_NULL_HANDLE;
+
+    g_free(snode->page_hashes);
+    snode->page_hashes = NULL;
+    g_free(snode->dirty_pages);
+    snode->dirty_pages = NULL;
+    g_free(snode->changed_pages);
+    snode->changed_pages = NULL;
+    snode->num_pages = 0;
 }
 
 static bool texture_cache_entry_pre_evict(Lru *lru, LruNode *node)
@@ -1487,6 +2443,9 @@ static bool texture_cache_entry_pre_evict(Lru *lru, LruNode *node)
         return false;
     }
 
+    // Used by a frame still executing
+    pgraph_vk_wait_for_submit(r, snode->submit_time);
+
     return true;
 }
 
@@ -1494,6 +2453,7 @@ static void texture_cache_entry_post_evict(Lru *lru, LruNode *node)
 {
     PGRAPHVkState *r = container_of(lru, PGRAPHVkState, texture_cache);
     TextureBinding *snode = container_of(node, TextureBinding, node);
+    texture_index_remove(r, snode);
     texture_cache_release_node_resources(r, snode);
 }
 
@@ -1504,15 +2464,41 @@ static bool texture_cache_entry_compare(Lru *lru, LruNode *node,
     return memcmp(&snode->key, key, sizeof(TextureKey));
 }
 
+// Entries are added on demand, the memory budget decides how many stay alive
+#define TEXTURE_CACHE_CHUNK_SIZE 256
+#define TEXTURE_CACHE_MAX_CHUNKS 64
+#define TEXTURE_CACHE_LOW_MEMORY_MAX_CHUNKS 16
+
+QEMU_BUILD_BUG_ON(TEXTURE_CACHE_CHUNK_SIZE * TEXTURE_CACHE_MAX_CHUNKS + 1 >
+                  MAX_BINDLESS_TEXTURES);
+QEMU_BUILD_BUG_ON(MAX_BINDLESS_TEXTURES > 0x10000);
+
+static void texture_cache_grow(PGRAPHVkState *r)
+{
+    int max_chunks = r->low_memory ? TEXTURE_CACHE_LOW_MEMORY_MAX_CHUNKS :
+                                     TEXTURE_CACHE_MAX_CHUNKS;
+    if (r->texture_cache_chunks->len >= max_chunks) {
+        return;
+    }
+
+    TextureBinding *entries =
+        g_malloc_n(TEXTURE_CACHE_CHUNK_SIZE, sizeof(TextureBinding));
+    for (int i = 0; i < TEXTURE_CACHE_CHUNK_SIZE; i++) {
+        lru_add_free(&r->texture_cache, &entries[i].node);
+    }
+    g_ptr_array_add(r->texture_cache_chunks, entries);
+    xemu_mem_account_set(xemu_mem_account("vk", "texture cache nodes"),
+                         r->texture_cache_chunks->len *
+                             TEXTURE_CACHE_CHUNK_SIZE * sizeof(TextureBinding));
+}
+
 static void texture_cache_init(PGRAPHVkState *r)
 {
-    const size_t texture_cache_size = 1024;
     lru_init(&r->texture_cache);
-    r->texture_cache_entries = g_malloc_n(texture_cache_size, sizeof(TextureBinding));
-    assert(r->texture_cache_entries != NULL);
-    for (int i = 0; i < texture_cache_size; i++) {
-        lru_add_free(&r->texture_cache, &r->texture_cache_entries[i].node);
-    }
+    r->texture_tree = (IntervalTreeRoot){};
+    r->palette_tree = (IntervalTreeRoot){};
+    r->texture_cache_chunks = g_ptr_array_new_with_free_func(g_free);
+    texture_cache_grow(r);
     r->texture_cache.init_node = texture_cache_entry_init;
     r->texture_cache.compare_nodes = texture_cache_entry_compare;
     r->texture_cache.pre_node_evict = texture_cache_entry_pre_evict;
@@ -1522,24 +2508,166 @@ static void texture_cache_init(PGRAPHVkState *r)
 static void texture_cache_finalize(PGRAPHVkState *r)
 {
     lru_flush(&r->texture_cache);
-    g_free(r->texture_cache_entries);
-    r->texture_cache_entries = NULL;
+    lru_destroy(&r->texture_cache);
+    g_ptr_array_free(r->texture_cache_chunks, TRUE);
+    r->texture_cache_chunks = NULL;
+    xemu_mem_account_set(xemu_mem_account("vk", "texture cache nodes"), 0);
 }
 
-void pgraph_vk_trim_texture_cache(PGRAPHState *pg)
+typedef struct SurfaceAliasSearch {
+    VkImage image;
+    GPtrArray *bindings;
+} SurfaceAliasSearch;
+
+static void collect_surface_alias(Lru *lru, LruNode *node, void *opaque)
+{
+    SurfaceAliasSearch *search = opaque;
+    TextureBinding *snode = container_of(node, TextureBinding, node);
+
+    if (snode->key.surface_alias && snode->image == search->image) {
+        g_ptr_array_add(search->bindings, snode);
+    }
+}
+
+/*
+ * Drop the bindings sampling a surface image in place, before the image is
+ * destroyed or reused for another surface. Callers finish the command buffer
+ * first, so the bindings are no longer in use.
+ */
+void pgraph_vk_release_surface_texture_aliases(PGRAPHState *pg, VkImage image)
 {
     PGRAPHVkState *r = pg->vk_renderer_state;
 
-    // FIXME: Allow specifying some amount to trim by
+    assert(!r->in_command_buffer);
+
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        TextureBinding *binding = r->texture_bindings[i];
+        if (binding && binding->key.surface_alias && binding->image == image) {
+            // Recreated on the next bind
+            r->texture_bindings[i] = NULL;
+        }
+    }
+
+    SurfaceAliasSearch search = {
+        .image = image,
+        .bindings = g_ptr_array_new(),
+    };
+    lru_visit_active(&r->texture_cache, collect_surface_alias, &search);
+
+    for (int i = 0; i < search.bindings->len; i++) {
+        TextureBinding *snode = g_ptr_array_index(search.bindings, i);
+        pgraph_vk_wait_for_submit(r, snode->submit_time);
+        lru_evict_node(&r->texture_cache, &snode->node);
+    }
+
+    g_ptr_array_free(search.bindings, TRUE);
+}
+
+typedef struct TextureEvictionCandidate {
+    TextureBinding *binding;
+    uint64_t weight;
+} TextureEvictionCandidate;
+
+typedef struct TextureEvictionState {
+    PGRAPHVkState *r;
+    const VkDeviceSize *heap_excess;
+    GArray *candidates;
+} TextureEvictionState;
+
+static void collect_texture_eviction_candidate(Lru *lru, LruNode *node,
+                                               void *opaque)
+{
+    TextureEvictionState *state = opaque;
+    TextureBinding *snode = container_of(node, TextureBinding, node);
+
+    TextureEvictionCandidate candidate = {
+        .binding = snode,
+        .weight = pgraph_vk_get_eviction_weight(
+            state->r, snode->allocation,
+            state->r->submit_count - snode->submit_time, state->heap_excess),
+    };
+    if (candidate.weight) {
+        g_array_append_val(state->candidates, candidate);
+    }
+}
+
+static gint compare_eviction_candidates(gconstpointer a, gconstpointer b)
+{
+    const TextureEvictionCandidate *ca = a, *cb = b;
+    return ca->weight < cb->weight ? 1 : ca->weight > cb->weight ? -1 : 0;
+}
+
+/*
+ * Evict textures from the heaps with a non-zero entry in heap_excess, until
+ * they are back within budget. Returns true if all heaps are within budget.
+ */
+bool pgraph_vk_trim_texture_cache(PGRAPHState *pg, VkDeviceSize *heap_excess)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    TextureEvictionState state = {
+        .r = r,
+        .heap_excess = heap_excess,
+        .candidates = g_array_new(FALSE, FALSE,
+                                  sizeof(TextureEvictionCandidate)),
+    };
+    lru_visit_active(&r->texture_cache, collect_texture_eviction_candidate,
+                     &state);
+    g_array_sort(state.candidates, compare_eviction_candidates);
 
-    int num_to_evict = r->texture_cache.num_used / 4;
     int num_evicted = 0;
+    bool within_budget = false;
 
-    while (num_to_evict-- && lru_try_evict_one(&r->texture_cache)) {
+    for (int i = 0; i < state.candidates->len && !within_budget; i++) {
+        TextureBinding *snode =
+            g_array_index(state.candidates, TextureEvictionCandidate, i)
+                .binding;
+        if (!texture_cache_entry_pre_evict(&r->texture_cache, &snode->node)) {
+            continue;
+        }
+        within_budget =
+            pgraph_vk_release_heap_excess(r, snode->allocation, heap_excess);
+        lru_evict_node(&r->texture_cache, &snode->node);
         num_evicted += 1;
     }
 
+    g_array_free(state.candidates, TRUE);
+
     NV2A_VK_DPRINTF("Evicted %d textures, %d remain", num_evicted, r->texture_cache.num_used);
+
+    return within_budget;
+}
+
+static void init_native_bc_textures(PGRAPHVkState *r)
+{
+    static const VkFormat bc_formats[] = {
+        VK_FORMAT_BC1_RGBA_UNORM_BLOCK,
+        VK_FORMAT_BC2_UNORM_BLOCK,
+        VK_FORMAT_BC3_UNORM_BLOCK,
+    };
+    const VkFormatFeatureFlags required_features =
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT |
+        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT |
+        VK_FORMAT_FEATURE_TRANSFER_DST_BIT;
+
+    r->native_bc_textures =
+        g_config.display.vulkan.native_bc_textures &&
+        r->enabled_physical_device_features.textureCompressionBC == VK_TRUE;
+
+    for (int i = 0; r->native_bc_textures && i < ARRAY_SIZE(bc_formats); i++) {
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(r->physical_device, bc_formats[i],
+                                            &props);
+        if ((props.optimalTilingFeatures & required_features) !=
+            required_features) {
+            r->native_bc_textures = false;
+        }
+    }
+
+    if (!r->native_bc_textures) {
+        fprintf(stderr, "nv2a: Native BC textures unavailable, decoding "
+                        "compressed textures on upload\n");
+    }
 }
 
 void pgraph_vk_init_textures(PGRAPHState *pg)
@@ -1556,6 +2684,18 @@ void pgraph_vk_init_textures(PGRAPHState *pg)
             r->physical_device, kelvin_color_format_vk_map[i].vk_format,
             &r->texture_format_properties[i]);
     }
+
+    init_native_bc_textures(r);
+    pgraph_vk_init_texture_disk_cache(pg);
+    pgraph_vk_init_texture_replacement(pg);
+
+    // The calling thread decodes too, so leave a core for everything else
+    int num_decode_threads = MIN((int)g_get_num_processors() - 1, 4);
+    r->texture_decode_pool =
+        num_decode_threads > 0 ?
+            g_thread_pool_new(texture_decode_worker, NULL, num_decode_threads,
+                              FALSE, NULL) :
+            NULL;
 }
 
 void pgraph_vk_finalize_textures(PGRAPHState *pg)
@@ -1573,6 +2713,14 @@ void pgraph_vk_finalize_textures(PGRAPHState *pg)
 
     assert(r->texture_cache.num_used == 0);
 
+    pgraph_vk_finalize_texture_disk_cache(pg);
+    pgraph_vk_finalize_texture_replacement(pg);
+
+    if (r->texture_decode_pool) {
+        g_thread_pool_free(r->texture_decode_pool, FALSE, TRUE);
+        r->texture_decode_pool = NULL;
+    }
+
     g_free(r->texture_format_properties);
     r->texture_format_properties = NULL;
 }
@@ -0,0 +1,339 @@
+/*
+ * Geforce NV2A PGRAPH Vulkan Renderer
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "ui/xemu-settings.h"
+#include "ui/xemu-title-profile.h"
+#include "xemu-version.h"
+#include "renderer.h"
+
+/*
+ * Shader trace file layout:
+ *   char[8]          magic
+ *   uint64_t         xemu version string length (including terminator)
+ *   char[]           xemu version string
+ *   Records:
+ *     uint32_t       record kind
+ *     uint32_t       payload size in bytes
+ *     uint8_t[]      payload
+ *
+ * Shader states are recorded once and referenced by hash from pipeline
+ * records, which only carry the active vertex input descriptions.
+ */
+static const char shader_trace_magic[8] = "NV2ATRC1";
+
+enum ShaderTraceRecordKind {
+    SHADER_TRACE_RECORD_SHADER_STATE = 1,
+    SHADER_TRACE_RECORD_PIPELINE = 2,
+};
+
+typedef struct ShaderTraceRecordHeader {
+    uint32_t kind;
+    uint32_t size;
+} ShaderTraceRecordHeader;
+
+typedef struct ShaderTracePipeline {
+    uint64_t shader_state_hash;
+    RenderPassState render_pass_state;
+    uint32_t regs[9];
+    uint32_t num_binding_descriptions;
+    uint32_t num_attribute_descriptions;
+} ShaderTracePipeline;
+
+static char *get_global_shader_trace_path(void)
+{
+    return g_strdup_printf("%svk_shader_trace.bin",
+                           xemu_settings_get_base_path());
+}
+
+/*
+ * Traces are kept per title when the disc is known at boot, so prewarming
+ * only compiles what the title actually uses.
+ */
+static char *get_shader_trace_path(void)
+{
+    if (g_config.perf.shader_trace.path &&
+        *g_config.perf.shader_trace.path) {
+        return g_strdup(g_config.perf.shader_trace.path);
+    }
+
+    uint32_t title_id = xemu_title_profile_get_boot_title_id();
+    if (!title_id) {
+        return get_global_shader_trace_path();
+    }
+
+    g_autofree char *dir =
+        g_strdup_printf("%sshader_traces", xemu_settings_get_base_path());
+    qemu_mkdir(dir);
+    return g_strdup_printf("%s/%08x.bin", dir, title_id);
+}
+
+static void shader_trace_write_record(PGRAPHVkState *r, uint32_t kind,
+                                      const void *payload, size_t size,
+                                      uint64_t hash)
+{
+    if (!r->shader_trace_file ||
+        !g_hash_table_add(r->shader_trace_recorded, g_memdup2(&hash,
+                                                              sizeof(hash)))) {
+        return;
+    }
+
+    ShaderTraceRecordHeader header = {
+        .kind = kind,
+        .size = size,
+    };
+    if (fwrite(&header, sizeof(header), 1, r->shader_trace_file) != 1 ||
+        fwrite(payload, size, 1, r->shader_trace_file) != 1) {
+        fprintf(stderr, "nv2a: Failed to write shader trace, stopping\n");
+        fclose(r->shader_trace_file);
+        r->shader_trace_file = NULL;
+    }
+}
+
+void pgraph_vk_trace_shader_state(PGRAPHVkState *r, const ShaderState *state)
+{
+    if (!r->shader_trace_file) {
+        return;
+    }
+
+    uint64_t hash = fast_hash((void *)state, sizeof(*state));
+    shader_trace_write_record(r, SHADER_TRACE_RECORD_SHADER_STATE, state,
+                              sizeof(*state), hash);
+}
+
+void pgraph_vk_trace_pipeline(PGRAPHVkState *r, const PipelineKey *key)
+{
+    if (!r->shader_trace_file) {
+        return;
+    }
+
+    pgraph_vk_trace_shader_state(r, &key->shader_state);
+
+    ShaderTracePipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    pipeline.shader_state_hash =
+        fast_hash((void *)&key->shader_state, sizeof(key->shader_state));
+    pipeline.render_pass_state = key->render_pass_state;
+    memcpy(pipeline.regs, key->regs, sizeof(pipeline.regs));
+    pipeline.num_binding_descriptions = key->num_binding_descriptions;
+    pipeline.num_attribute_descriptions = key->num_attribute_descriptions;
+
+    size_t bindings_size = key->num_binding_descriptions *
+                           sizeof(key->binding_descriptions[0]);
+    size_t attributes_size = key->num_attribute_descriptions *
+                             sizeof(key->attribute_descriptions[0]);
+
+    g_autoptr(GByteArray) data = g_byte_array_new();
+    g_byte_array_append(data, (const guint8 *)&pipeline, sizeof(pipeline));
+    g_byte_array_append(data, (const guint8 *)key->binding_descriptions,
+                        bindings_size);
+    g_byte_array_append(data, (const guint8 *)key->attribute_descriptions,
+                        attributes_size);
+
+    shader_trace_write_record(r, SHADER_TRACE_RECORD_PIPELINE, data->data,
+                              data->len, fast_hash(data->data, data->len));
+}
+
+static bool shader_trace_read_pipeline_key(GHashTable *shader_states,
+                                           const uint8_t *payload, size_t size,
+                                           PipelineKey *key)
+{
+    ShaderTracePipeline pipeline;
+    if (size < sizeof(pipeline)) {
+        return false;
+    }
+    memcpy(&pipeline, payload, sizeof(pipeline));
+
+    if (pipeline.num_binding_descriptions >
+            ARRAY_SIZE(key->binding_descriptions) ||
+        pipeline.num_attribute_descriptions >
+            ARRAY_SIZE(key->attribute_descriptions)) {
+        return false;
+    }
+
+    size_t bindings_size = pipeline.num_binding_descriptions *
+                           sizeof(key->binding_descriptions[0]);
+    size_t attributes_size = pipeline.num_attribute_descriptions *
+                             sizeof(key->attribute_descriptions[0]);
+    if (size != sizeof(pipeline) + bindings_size + attributes_size) {
+        return false;
+    }
+
+    const ShaderState *state =
+        g_hash_table_lookup(shader_states, &pipeline.shader_state_hash);
+    if (!state) {
+        return false;
+    }
+
+    memset(key, 0, sizeof(*key));
+    key->render_pass_state = pipeline.render_pass_state;
+    memcpy(&key->shader_state, state, sizeof(key->shader_state));
+    memcpy(key->regs, pipeline.regs, sizeof(key->regs));
+    key->num_binding_descriptions = pipeline.num_binding_descriptions;
+    key->num_attribute_descriptions = pipeline.num_attribute_descriptions;
+    memcpy(key->binding_descriptions, payload + sizeof(pipeline),
+           bindings_size);
+    memcpy(key->attribute_descriptions,
+           payload + sizeof(pipeline) + bindings_size, attributes_size);
+
+    return true;
+}
+
+/*
+ * Walk all records of a trace, optionally compiling each shader state and
+ * pipeline. Returns false if the trace was written by another xemu build.
+ */
+static bool shader_trace_replay(PGRAPHState *pg, const uint8_t *data,
+                                size_t size, bool prewarm)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    size_t pos = 0;
+
+    uint64_t version_len;
+    if (size < sizeof(shader_trace_magic) + sizeof(version_len) ||
+        memcmp(data, shader_trace_magic, sizeof(shader_trace_magic))) {
+        return false;
+    }
+    pos += sizeof(shader_trace_magic);
+    memcpy(&version_len, data + pos, sizeof(version_len));
+    pos += sizeof(version_len);
+    if (version_len != strlen(xemu_version) + 1 ||
+        version_len > size - pos ||
+        memcmp(data + pos, xemu_version, version_len)) {
+        return false;
+    }
+    pos += version_len;
+
+    g_autoptr(GHashTable) shader_states =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
+    int num_shaders = 0, num_pipelines = 0;
+
+    while (size - pos >= sizeof(ShaderTraceRecordHeader)) {
+        ShaderTraceRecordHeader header;
+        memcpy(&header, data + pos, sizeof(header));
+        pos += sizeof(header);
+        if (header.size > size - pos) {
+            break;
+        }
+        const uint8_t *payload = data + pos;
+        pos += header.size;
+
+        uint64_t hash = fast_hash((void *)payload, header.size);
+        g_hash_table_add(r->shader_trace_recorded,
+                         g_memdup2(&hash, sizeof(hash)));
+
+        if (header.kind == SHADER_TRACE_RECORD_SHADER_STATE &&
+            header.size == sizeof(ShaderState)) {
+            ShaderState *state = g_memdup2(payload, sizeof(ShaderState));
+            g_hash_table_insert(shader_states, g_memdup2(&hash, sizeof(hash)),
+                                state);
+            if (prewarm) {
+                pgraph_vk_get_shader_binding(pg, state);
+                num_shaders++;
+            }
+        } else if (header.kind == SHADER_TRACE_RECORD_PIPELINE) {
+            PipelineKey key;
+            if (prewarm && shader_trace_read_pipeline_key(
+                               shader_states, payload, header.size, &key)) {
+                pgraph_vk_prewarm_pipeline(pg, &key);
+                num_pipelines++;
+            }
+        }
+    }
+
+    if (prewarm) {
+        fprintf(stderr,
+                "nv2a: Prewarmed %d shaders and %d pipelines from trace\n",
+                num_shaders, num_pipelines);
+    }
+
+    return true;
+}
+
+void pgraph_vk_init_shader_trace(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    bool record = g_config.perf.shader_trace.record;
+    bool prewarm = g_config.perf.shader_trace.prewarm;
+
+    r->shader_trace_file = NULL;
+    r->shader_trace_recorded =
+        g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+
+    if (!record && !prewarm) {
+        return;
+    }
+
+    g_autofree char *path = get_shader_trace_path();
+    g_autofree gchar *contents = NULL;
+    gsize contents_size = 0;
+    bool valid = false;
+
+    if (g_file_get_contents(path, &contents, &contents_size, NULL)) {
+        valid = shader_trace_replay(pg, (const uint8_t *)contents,
+                                    contents_size, prewarm);
+    } else if (prewarm && xemu_title_profile_get_boot_title_id() &&
+               !(g_config.perf.shader_trace.path &&
+                 *g_config.perf.shader_trace.path)) {
+        // Until the title has a trace of its own, warm up from the shared one
+        g_autofree char *global_path = get_global_shader_trace_path();
+        g_autofree gchar *global_contents = NULL;
+        gsize global_size = 0;
+        if (g_file_get_contents(global_path, &global_contents, &global_size,
+                                NULL)) {
+            shader_trace_replay(pg, (const uint8_t *)global_contents,
+                                global_size, true);
+        }
+    }
+
+    if (!record) {
+        return;
+    }
+
+    // Start over if the existing trace is unusable by this build
+    r->shader_trace_file = qemu_fopen(path, valid ? "ab" : "wb");
+    if (!r->shader_trace_file) {
+        fprintf(stderr, "nv2a: Failed to open shader trace %s\n", path);
+        return;
+    }
+
+    if (!valid) {
+        g_hash_table_remove_all(r->shader_trace_recorded);
+        uint64_t version_len = strlen(xemu_version) + 1;
+        fwrite(shader_trace_magic, sizeof(shader_trace_magic), 1,
+               r->shader_trace_file);
+        fwrite(&version_len, sizeof(version_len), 1, r->shader_trace_file);
+        fwrite(xemu_version, version_len, 1, r->shader_trace_file);
+    }
+}
+
+void pgraph_vk_finalize_shader_trace(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    if (r->shader_trace_file) {
+        fclose(r->shader_trace_file);
+        r->shader_trace_file = NULL;
+    }
+
+    g_hash_table_destroy(r->shader_trace_recorded);
+    r->shader_trace_recorded = NULL;
+}
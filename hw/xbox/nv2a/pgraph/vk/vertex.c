@@ -23,23 +23,153 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "qemu/fast-hash.h"
 #include "renderer.h"
 
+/*
+ * Titles often stream the same inline geometry several times per frame
+ * (HUD elements, particles). Data already streamed by the frame being
+ * recorded is looked up by content and its slice of the ring reused. Slices
+ * are only kept alive by the frame that wrote them, so the caches are
+ * emptied on submit.
+ */
+typedef struct InlineDataCacheEntry {
+    uint64_t hash;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+} InlineDataCacheEntry;
+
+static bool inline_data_matches(const uint8_t *cached, void **data,
+                                VkDeviceSize *sizes, size_t count)
+{
+    for (int i = 0; i < count; i++) {
+        if (memcmp(cached, data[i], sizes[i])) {
+            return false;
+        }
+        cached += sizes[i];
+    }
+    return true;
+}
+
+static VkDeviceSize append_to_buffer_cached(PGRAPHState *pg, int index,
+                                            GHashTable *cache, void **data,
+                                            VkDeviceSize *sizes, size_t count,
+                                            VkDeviceSize alignment)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    StorageBuffer *b = &r->storage_buffers[index];
+
+    uint64_t hash = count;
+    VkDeviceSize total_size = 0;
+    for (int i = 0; i < count; i++) {
+        hash = hash * 0x100000001b3ULL ^ fast_hash(data[i], sizes[i]);
+        total_size += sizes[i];
+    }
+
+    InlineDataCacheEntry *e = g_hash_table_lookup(cache, &hash);
+    if (e && e->size == total_size &&
+        inline_data_matches(b->mapped + e->offset, data, sizes, count)) {
+        nv2a_profile_inc_counter(NV2A_PROF_INLINE_CACHE_HIT);
+        return e->offset;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_INLINE_CACHE_MISS);
+    VkDeviceSize offset =
+        pgraph_vk_append_to_buffer(pg, index, data, sizes, count, alignment);
+
+    if (!e) {
+        e = g_malloc(sizeof(*e));
+        e->hash = hash;
+        g_hash_table_insert(cache, &e->hash, e);
+    }
+    e->offset = offset;
+    e->size = total_size;
+
+    return offset;
+}
+
 VkDeviceSize pgraph_vk_update_index_buffer(PGRAPHState *pg, void *data,
                                            VkDeviceSize size)
 {
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
     nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_2);
-    return pgraph_vk_append_to_buffer(pg, BUFFER_INDEX_STAGING, &data, &size, 1,
-                                      1);
+    // Offsets must be a multiple of the index size, 16 or 32-bit
+    return append_to_buffer_cached(pg, BUFFER_INDEX_STAGING,
+                                   r->index_data_cache, &data, &size, 1,
+                                   sizeof(uint32_t));
 }
 
 VkDeviceSize pgraph_vk_update_vertex_inline_buffer(PGRAPHState *pg, void **data,
                                                    VkDeviceSize *sizes,
                                                    size_t count)
 {
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
     nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_3);
-    return pgraph_vk_append_to_buffer(pg, BUFFER_VERTEX_INLINE_STAGING, data,
-                                      sizes, count, 1);
+    return append_to_buffer_cached(pg, BUFFER_VERTEX_INLINE_STAGING,
+                                   r->vertex_inline_data_cache, data, sizes,
+                                   count, 1);
+}
+
+static bool vertex_ram_pages_in_flight(PGRAPHVkState *r, size_t start_bit,
+                                       size_t end_bit)
+{
+    for (int i = 0; i < NUM_FRAMES_IN_FLIGHT; i++) {
+        FrameInFlight *frame = &r->frames[i];
+        if (frame->in_flight &&
+            find_next_bit(frame->uploaded_bitmap, end_bit, start_bit) <
+                end_bit) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool pgraph_vk_vertex_ram_range_is_versioned(PGRAPHVkState *r, hwaddr addr,
+                                             VkDeviceSize size)
+{
+    for (int i = 0; i < r->num_vertex_ram_versions; i++) {
+        MemorySyncRequirement *v = &r->vertex_ram_versions[i];
+        if (addr < v->addr + v->size && v->addr < addr + size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool version_vertex_ram_range(PGRAPHVkState *r, hwaddr addr,
+                                     VkDeviceSize size)
+{
+    for (int i = 0; i < r->num_vertex_ram_versions; i++) {
+        MemorySyncRequirement *v = &r->vertex_ram_versions[i];
+        if (addr >= v->addr && addr + size <= v->addr + v->size) {
+            return true;
+        }
+    }
+
+    if (r->num_vertex_ram_versions >= ARRAY_SIZE(r->vertex_ram_versions)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_VERSION);
+    r->vertex_ram_versions[r->num_vertex_ram_versions++] =
+        (MemorySyncRequirement){ .addr = addr, .size = size };
+    return true;
+}
+
+void pgraph_vk_release_vertex_ram_versions(PGRAPHState *pg)
+{
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+    PGRAPHVkState *r = pg->vk_renderer_state;
+
+    // Have the next draw reading a stale range upload it again
+    for (int i = 0; i < r->num_vertex_ram_versions; i++) {
+        pgraph_vram_set_dirty(d, r->vertex_ram_versions[i].addr,
+                              r->vertex_ram_versions[i].size,
+                              DIRTY_MEMORY_NV2A);
+    }
+    r->num_vertex_ram_versions = 0;
 }
 
 void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset,
@@ -49,15 +179,34 @@ void pgraph_vk_update_vertex_ram_buffer(PGRAPHState *pg, hwaddr offset,
 
     pgraph_vk_download_surfaces_in_range_if_dirty(pg, offset, size);
 
+    if (r->vertex_ram_imported) {
+        // Vertex fetch reads guest RAM, there is nothing to copy
+        return;
+    }
+
     size_t start_bit = offset / TARGET_PAGE_SIZE;
     size_t end_bit = TARGET_PAGE_ALIGN(offset + size) / TARGET_PAGE_SIZE;
     size_t nbits = end_bit - start_bit;
 
-    if (find_next_bit(r->uploaded_bitmap, start_bit + nbits, start_bit) <
-        end_bit) {
+    bool in_use = find_next_bit(r->uploaded_bitmap, start_bit + nbits,
+                                start_bit) < end_bit;
+    bool in_flight = vertex_ram_pages_in_flight(r, start_bit, end_bit);
+
+    // Recorded draws keep reading the old contents, new draws of this range
+    // copy it from guest RAM until the next finish
+    if ((in_use || in_flight ||
+         pgraph_vk_vertex_ram_range_is_versioned(r, offset, size)) &&
+        version_vertex_ram_range(r, offset, size)) {
+        return;
+    }
+
+    if (in_use) {
         // Vertex data changed while building the draw list. Finish drawing
         // before updating RAM buffer.
         pgraph_vk_finish(pg, VK_FINISH_REASON_VERTEX_BUFFER_DIRTY);
+    } else if (in_flight) {
+        // Still being read by a submitted frame
+        pgraph_vk_wait_for_frames_in_flight(r);
     }
 
     nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_1);
@@ -105,6 +254,61 @@ static const VkFormat s32k_to_count[] = {
     VK_FORMAT_R16G16B16A16_SSCALED,
 };
 
+/*
+ * Fallbacks for formats the device can't fetch, see vertex_format_native.
+ * Three component formats are fetched with four, reading a little past the
+ * attribute; the shader ignores the extra component.
+ */
+static const VkFormat ub_raw_to_count[] = {
+    VK_FORMAT_R8_UINT,
+    VK_FORMAT_R8G8_UINT,
+    VK_FORMAT_R8G8B8A8_UINT,
+    VK_FORMAT_R8G8B8A8_UINT,
+};
+
+static const VkFormat s16_raw_to_count[] = {
+    VK_FORMAT_R16_SINT,
+    VK_FORMAT_R16G16_SINT,
+    VK_FORMAT_R16G16B16A16_SINT,
+    VK_FORMAT_R16G16B16A16_SINT,
+};
+
+static const VkFormat *const vertex_format_tables[] = {
+    [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D] = ub_to_count,
+    [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL] = ub_to_count,
+    [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S1] = s1_to_count,
+    [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_F] = float_to_count,
+    [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_S32K] = s32k_to_count,
+};
+
+void pgraph_vk_init_vertex_formats(PGRAPHState *pg)
+{
+    PGRAPHVkState *r = pg->vk_renderer_state;
+    int num_raw = 0;
+
+    QEMU_BUILD_BUG_ON(ARRAY_SIZE(vertex_format_tables) >
+                      ARRAY_SIZE(r->vertex_format_native));
+
+    for (int type = 0; type < ARRAY_SIZE(vertex_format_tables); type++) {
+        if (!vertex_format_tables[type]) {
+            continue;
+        }
+        for (int i = 0; i < 4; i++) {
+            VkFormatProperties props;
+            vkGetPhysicalDeviceFormatProperties(
+                r->physical_device, vertex_format_tables[type][i], &props);
+            r->vertex_format_native[type][i] =
+                props.bufferFeatures & VK_FORMAT_FEATURE_VERTEX_BUFFER_BIT;
+            num_raw += !r->vertex_format_native[type][i];
+        }
+    }
+
+    if (num_raw) {
+        fprintf(stderr, "nv2a: %d vertex formats unavailable, decoding them "
+                        "in the vertex shader\n", num_raw);
+    }
+}
+
 static char const * const vertex_data_array_format_to_str[] = {
     [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_D3D] = "UB_D3D",
     [NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_UB_OGL] = "UB_OGL",
@@ -135,6 +339,9 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
     pg->compressed_attrs = 0;
     pg->uniform_attrs = 0;
     pg->swizzle_attrs = 0;
+    pg->raw_attrs = 0;
+    memset(pg->raw_attr_formats, 0, sizeof(pg->raw_attr_formats));
+    memset(pg->raw_attr_counts, 0, sizeof(pg->raw_attr_counts));
 
     r->num_active_vertex_attribute_descriptions = 0;
     r->num_active_vertex_binding_descriptions = 0;
@@ -192,6 +399,16 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
             break;
         }
 
+        bool fetch_raw =
+            !needs_conversion &&
+            !r->vertex_format_native[attr->format][attr->count - 1];
+        if (fetch_raw) {
+            assert(!d3d_swizzle);
+            assert(attr->format != NV097_SET_VERTEX_DATA_ARRAY_FORMAT_TYPE_F);
+            vk_format = attr->size == 1 ? ub_raw_to_count[attr->count - 1] :
+                                          s16_raw_to_count[attr->count - 1];
+        }
+
         nv2a_profile_inc_counter(NV2A_PROF_ATTR_BIND);
         hwaddr attrib_data_addr;
         size_t stride;
@@ -266,6 +483,11 @@ void pgraph_vk_bind_vertex_attributes(NV2AState *d, unsigned int min_element,
         if (d3d_swizzle) {
             pg->swizzle_attrs |= (1 << i);
         }
+        if (fetch_raw) {
+            pg->raw_attrs |= (1 << i);
+            pg->raw_attr_formats[i] = attr->format;
+            pg->raw_attr_counts[i] = attr->count;
+        }
 
         NV2A_VK_DGROUP_END();
     }
@@ -281,6 +503,7 @@ void pgraph_vk_bind_vertex_attributes_inline(NV2AState *d)
     pg->compressed_attrs = 0;
     pg->uniform_attrs = 0;
     pg->swizzle_attrs = 0;
+    pg->raw_attrs = 0;
 
     r->num_active_vertex_attribute_descriptions = 0;
     r->num_active_vertex_binding_descriptions = 0;
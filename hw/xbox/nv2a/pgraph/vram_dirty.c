@@ -0,0 +1,121 @@
+/*
+ * QEMU Geforce NV2A VRAM dirty tracking
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "hw/xbox/nv2a/nv2a_int.h"
+
+/*
+ * Renderers ask whether VRAM ranges were written for every texture, vertex
+ * buffer and surface they touch, often many times per draw. Asking the
+ * global dirty bitmap each time takes the RCU read lock, does atomic
+ * test-and-clear over the range and, for every range that was dirty, walks
+ * the whole softmmu TLB to re-arm write tracking.
+ *
+ * Instead the global NV2A bitmaps are folded into a private copy once per
+ * batch of work the guest hands over, and the renderers query and clear
+ * that copy with plain bit operations. Pages nobody looked at stay set in
+ * the copy until someone does. The copy is only used from the FIFO thread.
+ */
+
+static unsigned long *vram_dirty_map(PGRAPHState *pg, unsigned int client)
+{
+    assert(client == DIRTY_MEMORY_NV2A || client == DIRTY_MEMORY_NV2A_TEX);
+    return pg->vram_dirty[client - DIRTY_MEMORY_NV2A];
+}
+
+static bool vram_dirty_range(PGRAPHState *pg, hwaddr addr, hwaddr size,
+                             unsigned long *first, unsigned long *count)
+{
+    if (!size) {
+        return false;
+    }
+
+    *first = addr >> TARGET_PAGE_BITS;
+    *count = (TARGET_PAGE_ALIGN(addr + size) >> TARGET_PAGE_BITS) - *first;
+    assert(*first + *count <= pg->vram_dirty_pages);
+    return true;
+}
+
+void pgraph_vram_dirty_init(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    pg->vram_dirty_pages = memory_region_size(d->vram) >> TARGET_PAGE_BITS;
+    for (int i = 0; i < ARRAY_SIZE(pg->vram_dirty); i++) {
+        pg->vram_dirty[i] = bitmap_new(pg->vram_dirty_pages);
+    }
+}
+
+void pgraph_vram_dirty_finalize(PGRAPHState *pg)
+{
+    for (int i = 0; i < ARRAY_SIZE(pg->vram_dirty); i++) {
+        g_free(pg->vram_dirty[i]);
+        pg->vram_dirty[i] = NULL;
+    }
+}
+
+void pgraph_vram_dirty_sync(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    hwaddr size = (hwaddr)pg->vram_dirty_pages << TARGET_PAGE_BITS;
+
+    for (int i = 0; i < ARRAY_SIZE(pg->vram_dirty); i++) {
+        memory_region_accumulate_and_clear_dirty(
+            d->vram, 0, size, DIRTY_MEMORY_NV2A + i, pg->vram_dirty[i]);
+    }
+}
+
+bool pgraph_vram_get_dirty(NV2AState *d, hwaddr addr, hwaddr size,
+                           unsigned int client)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned long first, count;
+
+    if (!vram_dirty_range(pg, addr, size, &first, &count)) {
+        return false;
+    }
+
+    return find_next_bit(vram_dirty_map(pg, client), first + count, first) <
+           first + count;
+}
+
+bool pgraph_vram_test_and_clear_dirty(NV2AState *d, hwaddr addr, hwaddr size,
+                                      unsigned int client)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned long first, count;
+
+    if (!pgraph_vram_get_dirty(d, addr, size, client)) {
+        return false;
+    }
+
+    vram_dirty_range(pg, addr, size, &first, &count);
+    bitmap_clear(vram_dirty_map(pg, client), first, count);
+    return true;
+}
+
+void pgraph_vram_set_dirty(NV2AState *d, hwaddr addr, hwaddr size,
+                           unsigned int client)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned long first, count;
+
+    if (vram_dirty_range(pg, addr, size, &first, &count)) {
+        bitmap_set(vram_dirty_map(pg, client), first, count);
+    }
+}
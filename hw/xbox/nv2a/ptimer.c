@@ -67,6 +67,9 @@ void ptimer_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
 {
     NV2AState *d = opaque;
 
+    // Reads are lock-free, but writes can update the interrupt line
+    BQL_LOCK_GUARD();
+
     nv2a_reg_log_write(NV_PTIMER, addr, size, val);
 
     switch (addr) {
@@ -21,6 +21,18 @@
 
 #include "nv2a_int.h"
 
+/*
+ * USER is mapped without the BQL, so a DMA_PUT write from the vCPU only
+ * waits for the pusher when it is holding the FIFO lock.
+ */
+static void user_lock_fifo(NV2AState *d)
+{
+    if (qemu_mutex_trylock(&d->pfifo.lock)) {
+        nv2a_profile_inc_counter(NV2A_PROF_FIFO_LOCK_CONTENDED);
+        user_lock_fifo(d);
+    }
+}
+
 /* USER - PFIFO MMIO and DMA submission area */
 uint64_t user_read(void *opaque, hwaddr addr, unsigned int size)
 {
@@ -29,7 +41,7 @@ uint64_t user_read(void *opaque, hwaddr addr, unsigned int size)
     unsigned int channel_id = addr >> 16;
     assert(channel_id < NV2A_NUM_CHANNELS);
 
-    qemu_mutex_lock(&d->pfifo.lock);
+    user_lock_fifo(d);
 
     uint32_t channel_modes = d->pfifo.regs[NV_PFIFO_MODE];
 
@@ -79,7 +91,7 @@ void user_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     unsigned int channel_id = addr >> 16;
     assert(channel_id < NV2A_NUM_CHANNELS);
 
-    qemu_mutex_lock(&d->pfifo.lock);
+    user_lock_fifo(d);
 
     uint32_t channel_modes = d->pfifo.regs[NV_PFIFO_MODE];
     if (channel_modes & (1 << channel_id)) {
@@ -91,6 +103,7 @@ void user_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
         if (channel_id == cur_channel_id) {
             switch (addr & 0xFFFF) {
             case NV_USER_DMA_PUT:
+                pfifo_ramht_cache_sync(d);
                 d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT] = val;
                 break;
             case NV_USER_DMA_GET:
@@ -38,4 +38,11 @@ void xbox_smc_power_button(void);
 void xbox_smc_eject_button(void);
 void xbox_smc_update_tray_state(void);
 
+/*
+ * Call @cb once, from the vCPU with the BQL held, when the guest next reads
+ * the tray state. The kernel reads it to pick what to launch at the end of
+ * its initialization.
+ */
+void xbox_smc_notify_tray_read(void (*cb)(void *opaque), void *opaque);
+
 #endif
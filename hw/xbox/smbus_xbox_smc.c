@@ -108,6 +108,9 @@ typedef struct SMBusSMCDevice {
     uint8_t error_reg;
 } SMBusSMCDevice;
 
+static void (*tray_read_cb)(void *opaque);
+static void *tray_read_opaque;
+
 static void smc_quick_cmd(SMBusDevice *dev, uint8_t read)
 {
     DPRINTF("smc_quick_cmd: addr=0x%02x read=%d\n", dev->i2c.address, read);
@@ -177,6 +180,11 @@ static uint8_t smc_receive_byte(SMBusDevice *dev)
             smc->version_string_index++ % SMC_VERSION_LENGTH];
 
     case SMC_REG_TRAYSTATE:
+        if (tray_read_cb) {
+            void (*cb)(void *opaque) = tray_read_cb;
+            tray_read_cb = NULL;
+            cb(tray_read_opaque);
+        }
         return smc->traystate_reg;
 
     case SMC_REG_SCRATCH:
@@ -372,3 +380,9 @@ void xbox_smc_update_tray_state(void)
 
     xbox_assert_extsmi();
 }
+
+void xbox_smc_notify_tray_read(void (*cb)(void *opaque), void *opaque)
+{
+    tray_read_cb = cb;
+    tray_read_opaque = opaque;
+}
@@ -56,6 +56,7 @@
 #include "hw/xbox/mcpx/apu/apu.h"
 
 #include "hw/xbox/xbox.h"
+#include "ui/xemu-settings.h"
 #include "smbus.h"
 
 #define MAX_IDE_BUS 2
@@ -191,8 +192,7 @@ static void xbox_memory_init(PCMachineState *pcms,
      * with older qemus that used qemu_ram_alloc().
      */
     ram = g_malloc(sizeof(*ram));
-    memory_region_init_ram(ram, NULL, "xbox.ram",
-                           machine->ram_size, &error_fatal);
+    xbox_ram_init(ram, machine->ram_size);
 
     *ram_memory = ram;
     memory_region_add_subregion(system_memory, 0, ram);
@@ -316,15 +316,23 @@ void xbox_init_common(MachineState *machine,
     /* USB */
     PCIDevice *usb1 = pci_new(PCI_DEVFN(3, 0), "pci-ohci");
     qdev_prop_set_uint32(&usb1->qdev, "num-ports", 4);
+    qdev_prop_set_uint32(&usb1->qdev, "idle-coalesce-frames",
+                         MAX(g_config.perf.usb_idle_coalesce, 0));
     pci_realize_and_unref(usb1, pci_bus, &error_fatal);
 
     PCIDevice *usb0 = pci_new(PCI_DEVFN(2, 0), "pci-ohci");
     qdev_prop_set_uint32(&usb0->qdev, "num-ports", 4);
+    qdev_prop_set_uint32(&usb0->qdev, "idle-coalesce-frames",
+                         MAX(g_config.perf.usb_idle_coalesce, 0));
     pci_realize_and_unref(usb0, pci_bus, &error_fatal);
 
     /* Ethernet! */
     PCIDevice *nvnet = pci_new(PCI_DEVFN(4, 0), "nvnet");
     qemu_configure_nic_device(DEVICE(nvnet), true, "nvnet");
+    qdev_prop_set_uint32(DEVICE(nvnet), "intr-coalesce-us",
+                         MAX(g_config.net.intr_coalesce.usecs, 0));
+    qdev_prop_set_uint32(DEVICE(nvnet), "intr-coalesce-frames",
+                         MAX(g_config.net.intr_coalesce.frames, 0));
     pci_realize_and_unref(nvnet, pci_bus, &error_fatal);
 
     /* APU! */
@@ -29,6 +29,9 @@ void xbox_init_common(MachineState *machine,
                       PCIBus **pci_bus_out,
                       ISABus **isa_bus_out);
 
+/* Allocate main memory, backed by huge pages if perf.huge_pages allows */
+void xbox_ram_init(MemoryRegion *ram, uint64_t size);
+
 #define TYPE_XBOX_MACHINE MACHINE_TYPE_NAME("xbox")
 
 #define XBOX_MACHINE(obj) \
@@ -0,0 +1,198 @@
+/*
+ * Xbox main memory allocation
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/madvise.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "system/memory.h"
+#include "migration/vmstate.h"
+
+#include "hw/xbox/xbox.h"
+#include "ui/xemu-settings.h"
+
+/*
+ * Guest RAM doubles as nv2a VRAM, so besides softmmu TLB refills it is what
+ * texture hashing, vertex uploads and surface downloads stream through. Huge
+ * pages keep the host page walks for all of these out of the profile.
+ */
+
+#define XBOX_RAM_NAME "xbox.ram"
+
+static void xbox_ram_init_ptr(MemoryRegion *ram, uint64_t size, void *ptr)
+{
+    /* Preallocated blocks are not registered for migration by default */
+    memory_region_init_ram_ptr(ram, NULL, XBOX_RAM_NAME, size, ptr);
+    vmstate_register_ram_global(ram);
+}
+
+#if defined(CONFIG_LINUX)
+
+static bool xbox_ram_init_explicit(MemoryRegion *ram, uint64_t size)
+{
+    /* Private hugetlb mappings reserve their pages up front */
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr == MAP_FAILED) {
+        warn_report(XBOX_RAM_NAME ": no hugetlb pages available (%s), see "
+                    "/proc/sys/vm/nr_hugepages", strerror(errno));
+        return false;
+    }
+
+    xbox_ram_init_ptr(ram, size, ptr);
+    info_report(XBOX_RAM_NAME ": %" PRIu64 " MiB backed by hugetlb pages",
+                size >> 20);
+    return true;
+}
+
+static uint64_t xbox_ram_thp_bytes(void *ptr, uint64_t size)
+{
+    g_autofree char *smaps = NULL;
+    g_auto(GStrv) lines = NULL;
+    uintptr_t lo = (uintptr_t)ptr, hi = lo + size;
+    bool in_range = false;
+    uint64_t total = 0;
+
+    if (!g_file_get_contents("/proc/self/smaps", &smaps, NULL, NULL)) {
+        return 0;
+    }
+
+    lines = g_strsplit(smaps, "\n", -1);
+    for (int i = 0; lines[i]; i++) {
+        uintptr_t start, end;
+        unsigned long long kb;
+
+        if (sscanf(lines[i], "%" SCNxPTR "-%" SCNxPTR " ", &start, &end) == 2) {
+            in_range = start < hi && end > lo;
+        } else if (in_range &&
+                   sscanf(lines[i], "AnonHugePages: %llu kB", &kb) == 1) {
+            total += kb << 10;
+        }
+    }
+
+    return total;
+}
+
+static void xbox_ram_init_transparent(MemoryRegion *ram, uint64_t size)
+{
+    memory_region_init_ram(ram, NULL, XBOX_RAM_NAME, size, &error_fatal);
+
+    /*
+     * The block is already advised for THP. Fault it in now so the kernel
+     * can hand out whole huge pages, and so there is something to report.
+     */
+    void *ptr = memory_region_get_ram_ptr(ram);
+    if (qemu_madvise(ptr, size, QEMU_MADV_POPULATE_WRITE)) {
+        info_report(XBOX_RAM_NAME ": transparent huge pages requested");
+        return;
+    }
+
+    uint64_t huge = xbox_ram_thp_bytes(ptr, size);
+    info_report(XBOX_RAM_NAME ": %" PRIu64 " of %" PRIu64 " MiB backed by "
+                "transparent huge pages", huge >> 20, size >> 20);
+}
+
+#elif defined(_WIN32)
+
+static bool xbox_ram_init_explicit(MemoryRegion *ram, uint64_t size)
+{
+    SIZE_T large_page = GetLargePageMinimum();
+    TOKEN_PRIVILEGES tp = { .PrivilegeCount = 1 };
+    HANDLE token;
+    bool have_privilege;
+
+    if (!large_page) {
+        warn_report(XBOX_RAM_NAME ": large pages are not supported");
+        return false;
+    }
+
+    /* Large pages need SeLockMemoryPrivilege, granted by group policy */
+    if (!OpenProcessToken(GetCurrentProcess(),
+                          TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+        return false;
+    }
+    tp.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+    have_privilege =
+        LookupPrivilegeValue(NULL, SE_LOCK_MEMORY_NAME,
+                             &tp.Privileges[0].Luid) &&
+        AdjustTokenPrivileges(token, FALSE, &tp, 0, NULL, NULL) &&
+        GetLastError() == ERROR_SUCCESS;
+    CloseHandle(token);
+    if (!have_privilege) {
+        warn_report(XBOX_RAM_NAME ": large pages need the \"Lock pages in "
+                    "memory\" user right");
+        return false;
+    }
+
+    void *ptr = VirtualAlloc(NULL, ROUND_UP(size, large_page),
+                             MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+                             PAGE_READWRITE);
+    if (!ptr) {
+        warn_report(XBOX_RAM_NAME ": large page allocation failed (error %lu)",
+                    GetLastError());
+        return false;
+    }
+
+    xbox_ram_init_ptr(ram, size, ptr);
+    info_report(XBOX_RAM_NAME ": %" PRIu64 " MiB backed by large pages",
+                size >> 20);
+    return true;
+}
+
+static void xbox_ram_init_transparent(MemoryRegion *ram, uint64_t size)
+{
+    memory_region_init_ram(ram, NULL, XBOX_RAM_NAME, size, &error_fatal);
+}
+
+#else
+
+static bool xbox_ram_init_explicit(MemoryRegion *ram, uint64_t size)
+{
+    warn_report(XBOX_RAM_NAME ": explicit huge pages are not supported on "
+                "this host");
+    return false;
+}
+
+static void xbox_ram_init_transparent(MemoryRegion *ram, uint64_t size)
+{
+    memory_region_init_ram(ram, NULL, XBOX_RAM_NAME, size, &error_fatal);
+}
+
+#endif
+
+void xbox_ram_init(MemoryRegion *ram, uint64_t size)
+{
+    switch (g_config.perf.huge_pages) {
+    case CONFIG_PERF_HUGE_PAGES_EXPLICIT:
+        if (xbox_ram_init_explicit(ram, size)) {
+            return;
+        }
+        /* Fall back to whatever the kernel will give us */
+        xbox_ram_init_transparent(ram, size);
+        break;
+    case CONFIG_PERF_HUGE_PAGES_OFF:
+        memory_region_init_ram(ram, NULL, XBOX_RAM_NAME, size, &error_fatal);
+        qemu_madvise(memory_region_get_ram_ptr(ram), size,
+                     QEMU_MADV_NOHUGEPAGE);
+        break;
+    default:
+        xbox_ram_init_transparent(ram, size);
+        break;
+    }
+}
@@ -137,7 +137,17 @@ static void usb_xid_gamepad_handle_data(USBDevice *dev, USBPacket *p)
     case USB_TOKEN_IN:
         if (p->ep->nr == GAMEPAD_IN_ENDPOINT_ID) {
             update_input(s);
+            // Like HID devices, NAK until the input changes. The endpoint is
+            // woken up by the input thread then.
+            if (s->in_state_valid &&
+                !memcmp(&s->in_state, &s->in_state_reported,
+                        sizeof(s->in_state))) {
+                p->status = USB_RET_NAK;
+                break;
+            }
             usb_packet_copy(p, &s->in_state, s->in_state.bLength);
+            s->in_state_reported = s->in_state;
+            s->in_state_valid = true;
         } else {
             assert(false);
         }
@@ -190,6 +200,9 @@ static void usb_xbox_gamepad_realize(USBDevice *dev, Error **errp)
     memset(&s->out_state_capabilities, 0xFF, sizeof(s->out_state_capabilities));
     s->out_state_capabilities.length = sizeof(s->out_state_capabilities);
     s->out_state_capabilities.report_id = 0;
+
+    s->input_change.notify = usb_xid_input_changed;
+    xemu_input_add_change_notifier(&s->input_change);
 }
 
 static void usb_xbox_gamepad_s_realize(USBDevice *dev, Error **errp)
@@ -214,6 +227,9 @@ static void usb_xbox_gamepad_s_realize(USBDevice *dev, Error **errp)
     memset(&s->out_state_capabilities, 0xFF, sizeof(s->out_state_capabilities));
     s->out_state_capabilities.length = sizeof(s->out_state_capabilities);
     s->out_state_capabilities.report_id = 0;
+
+    s->input_change.notify = usb_xid_input_changed;
+    xemu_input_add_change_notifier(&s->input_change);
 }
 
 static const Property xid_properties[] = {
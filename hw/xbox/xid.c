@@ -61,7 +61,10 @@ void update_input(USBXIDGamepadState *s)
 
     ControllerState *state = xemu_input_get_bound(s->device_index);
     assert(state);
-    xemu_input_update_controller(state);
+
+    // Latest sample from the input thread
+    ControllerSample sample;
+    xemu_input_get_sample(state, &sample);
 
     const int button_map_analog[6][2] = {
         { GAMEPAD_A,     CONTROLLER_BUTTON_A     },
@@ -84,28 +87,40 @@ void update_input(USBXIDGamepadState *s)
     };
 
     for (int i = 0; i < 6; i++) {
-        int pressed = state->buttons & button_map_analog[i][1];
+        int pressed = sample.buttons & button_map_analog[i][1];
         s->in_state.bAnalogButtons[button_map_analog[i][0]] = pressed ? 0xff : 0;
     }
 
     s->in_state.wButtons = 0;
     for (int i = 0; i < 8; i++) {
-        if (state->buttons & button_map_binary[i][1]) {
+        if (sample.buttons & button_map_binary[i][1]) {
             s->in_state.wButtons |= BUTTON_MASK(button_map_binary[i][0]);
         }
     }
 
-    s->in_state.bAnalogButtons[GAMEPAD_LEFT_TRIGGER] = state->axis[CONTROLLER_AXIS_LTRIG] >> 7;
-    s->in_state.bAnalogButtons[GAMEPAD_RIGHT_TRIGGER] = state->axis[CONTROLLER_AXIS_RTRIG] >> 7;
-    s->in_state.sThumbLX = state->axis[CONTROLLER_AXIS_LSTICK_X];
-    s->in_state.sThumbLY = state->axis[CONTROLLER_AXIS_LSTICK_Y];
-    s->in_state.sThumbRX = state->axis[CONTROLLER_AXIS_RSTICK_X];
-    s->in_state.sThumbRY = state->axis[CONTROLLER_AXIS_RSTICK_Y];
+    s->in_state.bAnalogButtons[GAMEPAD_LEFT_TRIGGER] = sample.axis[CONTROLLER_AXIS_LTRIG] >> 7;
+    s->in_state.bAnalogButtons[GAMEPAD_RIGHT_TRIGGER] = sample.axis[CONTROLLER_AXIS_RTRIG] >> 7;
+    s->in_state.sThumbLX = sample.axis[CONTROLLER_AXIS_LSTICK_X];
+    s->in_state.sThumbLY = sample.axis[CONTROLLER_AXIS_LSTICK_Y];
+    s->in_state.sThumbRX = sample.axis[CONTROLLER_AXIS_RSTICK_X];
+    s->in_state.sThumbRY = sample.axis[CONTROLLER_AXIS_RSTICK_Y];
 }
 
 void usb_xid_handle_reset(USBDevice *dev)
 {
+    USBXIDGamepadState *s = (USBXIDGamepadState *)dev;
+
     DPRINTF("xid reset\n");
+    s->in_state_valid = false;
+}
+
+// New input for the NAKing interrupt endpoint, have the host poll it again
+void usb_xid_input_changed(Notifier *notifier, void *data)
+{
+    USBXIDGamepadState *s =
+        container_of(notifier, USBXIDGamepadState, input_change);
+
+    usb_wakeup(s->intr, 0);
 }
 
 void usb_xid_handle_control(USBDevice *dev, USBPacket *p,
@@ -225,4 +240,7 @@ static void usb_xid_handle_destroy(USBDevice *dev)
 
 void usb_xbox_gamepad_unrealize(USBDevice *dev)
 {
+    USBXIDGamepadState *s = (USBXIDGamepadState *)dev;
+
+    notifier_remove(&s->input_change);
 }
@@ -117,10 +117,13 @@ typedef struct USBXIDGamepadState {
     USBEndpoint *intr;
     const XIDDesc *xid_desc;
     XIDGamepadReport in_state;
+    XIDGamepadReport in_state_reported; // Last sent on the interrupt endpoint
+    bool in_state_valid;
     XIDGamepadReport in_state_capabilities;
     XIDGamepadOutputReport out_state;
     XIDGamepadOutputReport out_state_capabilities;
     uint8_t device_index;
+    Notifier input_change;
 } USBXIDGamepadState;
 
 void update_input(USBXIDGamepadState *s);
@@ -128,6 +131,7 @@ void update_output(USBXIDGamepadState *s);
 void usb_xid_handle_reset(USBDevice *dev);
 void usb_xid_handle_control(USBDevice *dev, USBPacket *p, int request,
                             int value, int index, int length, uint8_t *data);
+void usb_xid_input_changed(Notifier *notifier, void *data);
 void usb_xbox_gamepad_unrealize(USBDevice *dev);
 
 #if 0
@@ -0,0 +1,28 @@
+/*
+ * TCG translation statistics for the xemu debug UI
+ *
+ * SPDX-License-Identifier: LGPL-2.1-or-later
+ */
+
+#ifndef ACCEL_TCG_RUNTIME_STATS_H
+#define ACCEL_TCG_RUNTIME_STATS_H
+
+typedef struct TCGRuntimeStats {
+    size_t code_size;        /* bytes of the code buffer in use */
+    size_t code_capacity;    /* bytes of the code buffer available */
+    size_t nb_tbs;
+    unsigned flush_count;
+    unsigned invalidate_count;
+    uint64_t gen_count;      /* blocks translated since startup */
+    uint64_t gen_time_ns;    /* time spent in guest to host translation */
+    uint64_t idle_ns;        /* time the vCPU spent halted or parked */
+    uint64_t idle_parks;     /* times a guest idle loop was parked */
+} TCGRuntimeStats;
+
+/* Fill @stats with a snapshot of the counters. Safe from any thread. */
+void tcg_get_runtime_stats(TCGRuntimeStats *stats);
+
+/* Account @ns of vCPU idle time, @parked if spent in a guest idle loop */
+void tcg_runtime_stats_add_idle(int64_t ns, bool parked);
+
+#endif
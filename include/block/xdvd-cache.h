@@ -0,0 +1,24 @@
+/*
+ * Read cache filter for Xbox disc images
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef BLOCK_XDVD_CACHE_H
+#define BLOCK_XDVD_CACHE_H
+
+typedef struct XdvdCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t prefetched_bytes;
+    /* Time guest reads spent waiting for the image */
+    uint64_t stall_ns;
+} XdvdCacheStats;
+
+/* Cache size used by nodes opened without a cache-size option */
+void xdvd_cache_set_default_size(uint64_t size);
+
+/* Counters summed over all cache nodes since startup */
+void xdvd_cache_get_stats(XdvdCacheStats *stats);
+
+#endif
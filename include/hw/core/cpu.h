@@ -362,6 +362,10 @@ typedef struct MemAccessCallback {
     MemAccessCallbackFunc func;
     void *opaque;
     QTAILQ_ENTRY(MemAccessCallback) entry;
+    /* Pending changes, protected by mem_access_callback_queue_lock */
+    bool queued_insert;
+    bool queued_remove;
+    QSIMPLEQ_ENTRY(MemAccessCallback) queue_entry;
 } MemAccessCallback;
 #endif
 
@@ -547,6 +551,12 @@ struct CPUState {
     CPUWatchpoint *watchpoint_hit;
 
     QTAILQ_HEAD(, MemAccessCallback) mem_access_callbacks;
+    /* Per ram_addr page count of callbacks overlapping it */
+    uint32_t *mem_access_watched_pages;
+    size_t mem_access_watched_pages_len;
+    QemuMutex mem_access_callback_queue_lock;
+    QSIMPLEQ_HEAD(, MemAccessCallback) mem_access_callback_queue;
+    bool mem_access_callback_commit_scheduled;
 
     void *opaque;
 
@@ -1198,6 +1208,21 @@ MemAccessCallback *mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr,
                                               MemAccessCallbackFunc func,
                                               void *opaque);
 void mem_access_callback_remove_by_ref(CPUState *cpu, MemAccessCallback *cb);
+
+/*
+ * Batched variants of the above: changes are only queued, and take effect
+ * together with a single exclusive section once mem_access_callback_commit()
+ * is called. A queued callback must not be removed by the immediate API, and
+ * must not be referenced after its removal is queued.
+ */
+MemAccessCallback *mem_access_callback_queue_insert(CPUState *cpu,
+                                                    MemoryRegion *mr,
+                                                    hwaddr offset, hwaddr len,
+                                                    MemAccessCallbackFunc func,
+                                                    void *opaque);
+void mem_access_callback_queue_remove(CPUState *cpu, MemAccessCallback *cb);
+void mem_access_callback_commit(CPUState *cpu);
+
 int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len);
 void mem_check_access_callback_ramaddr(CPUState *cpu,
                                        hwaddr ram_addr, vaddr len, int flags);
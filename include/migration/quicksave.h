@@ -0,0 +1,28 @@
+/*
+ * Incremental quicksave
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef MIGRATION_QUICKSAVE_H
+#define MIGRATION_QUICKSAVE_H
+
+/*
+ * Save the machine to the quicksave slot kept in @dir. Only RAM pages
+ * dirtied since the previous quicksave are written; the chain of deltas is
+ * merged into a full image in the background.
+ */
+bool quicksave_save(const char *dir, Error **errp);
+
+/* Restore the quicksave kept in @dir. The VM must be stopped. */
+bool quicksave_load(const char *dir, Error **errp);
+
+bool quicksave_exists(const char *dir);
+
+/*
+ * Guest RAM was replaced behind the dirty log (e.g. by loading a regular
+ * snapshot), so the next quicksave has to write a full image.
+ */
+void quicksave_invalidate(void);
+
+#endif
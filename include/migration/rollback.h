@@ -0,0 +1,29 @@
+/*
+ * In-memory rollback of the machine state
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef MIGRATION_ROLLBACK_H
+#define MIGRATION_ROLLBACK_H
+
+/*
+ * Keep up to @slots captures. Changing the count drops the captures held,
+ * 0 disables rollback and frees its memory.
+ */
+void rollback_configure(unsigned int slots);
+
+/* Number of captures currently held */
+unsigned int rollback_count(void);
+
+/* Capture the running machine. Called with the BQL held. */
+bool rollback_capture(Error **errp);
+
+/*
+ * Return the machine to the capture taken @depth captures before the newest
+ * one and drop the newer captures. Fails if a block device was written
+ * since, as disk contents are not rolled back.
+ */
+bool rollback_restore(unsigned int depth, Error **errp);
+
+#endif
@@ -34,6 +34,76 @@ bool save_snapshot(const char *name, bool overwrite,
                    bool has_devices, strList *devices,
                    Error **errp);
 
+#ifdef XBOX
+typedef void SnapshotSaveDoneFunc(bool ok, Error *err, void *opaque);
+
+/**
+ * save_snapshot_async: Save an internal snapshot in the background.
+ * @name: name of internal snapshot, or NULL for a name based on the date
+ * @overwrite: replace existing snapshot with @name
+ * @path: file to write the VM state to, or NULL to store it in the image.
+ *        With a file, the block devices only get a disk-only snapshot that
+ *        the file refers to, see load_snapshot_file().
+ * @cb: called from the main loop once the snapshot is written, with the
+ *      error (owned by the callee) on failure
+ * @opaque: passed to @cb
+ * @errp: pointer to error object
+ * The VM is only stopped while its state is copied to memory. Returns %false
+ * with @errp set if the save could not be started, @cb is not called then.
+ */
+bool save_snapshot_async(const char *name, bool overwrite, const char *path,
+                         SnapshotSaveDoneFunc *cb, void *opaque,
+                         Error **errp);
+
+/**
+ * snapshot_save_in_progress: Check for a pending background save.
+ * Sets @errp and returns %true while save_snapshot_async() is writing.
+ */
+bool snapshot_save_in_progress(Error **errp);
+
+/**
+ * load_snapshot_file: Load a snapshot saved to a file.
+ * @path: file written by save_snapshot_async()
+ * @errp: pointer to error object
+ * Reverts the block devices to the disk-only snapshot the file refers to and
+ * loads the VM state from the file. On failure, store an error through @errp
+ * and return %false.
+ */
+bool load_snapshot_file(const char *path, Error **errp);
+
+/**
+ * snapshot_file_read_info: Read the header of a snapshot file.
+ * @path: file written by save_snapshot_async()
+ * @sn: filled with the name and dates of the snapshot, and the file size as
+ *      the VM state size
+ * @extra_data: if not NULL, set to the xemu extra data of the snapshot
+ * @errp: pointer to error object
+ * Only the start of the file is read. On failure, store an error through
+ * @errp and return %false.
+ */
+bool snapshot_file_read_info(const char *path, struct QEMUSnapshotInfo *sn,
+                             GBytes **extra_data, Error **errp);
+
+/**
+ * save_vmstate_file: Save the VM state alone to a file.
+ * @path: file to write
+ * @errp: pointer to error object
+ * Unlike a snapshot, the block devices are left alone, for states that do
+ * not depend on the disk contents. The VM must be stopped. On failure, store
+ * an error through @errp and return %false.
+ */
+bool save_vmstate_file(const char *path, Error **errp);
+
+/**
+ * load_vmstate_file: Load a VM state written by save_vmstate_file().
+ * @path: file to read
+ * @errp: pointer to error object
+ * The VM must be stopped. On failure, store an error through @errp and
+ * return %false.
+ */
+bool load_vmstate_file(const char *path, Error **errp);
+#endif
+
 /**
  * load_snapshot: Load an internal snapshot.
  * @name: name of internal snapshot
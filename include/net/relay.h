@@ -0,0 +1,30 @@
+/*
+ * QEMU multi-peer UDP relay network client
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#ifndef QEMU_NET_RELAY_H
+#define QEMU_NET_RELAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NET_RELAY_MAX_PEERS 64
+
+typedef struct NetRelayPeerStats {
+    char addr[32];
+    bool learned;      /* joined a hub rather than configured */
+    int64_t rtt_us;    /* smoothed round trip time, -1 until measured */
+    float loss;        /* fraction of datagrams lost in the last second */
+    uint64_t tx_frames;
+    uint64_t rx_frames;
+} NetRelayPeerStats;
+
+/*
+ * Copy the statistics of up to @max peers of relay netdev @name. Returns the
+ * number of peers copied, or -1 if there is no such relay.
+ */
+int net_relay_get_stats(const char *name, NetRelayPeerStats *stats, int max);
+
+#endif
@@ -25,23 +25,41 @@
 #ifndef LRU_H
 #define LRU_H
 
-#include <assert.h>
+#include <stdbool.h>
 #include <stdint.h>
-#include "qemu/queue.h"
 
-#define LRU_NUM_BINS (1<<16)
+/*
+ * Nodes are indexed by an open-addressing hash table sized to the number of
+ * nodes added to the cache, and replaced using the CLOCK algorithm: a hit
+ * only sets the node's referenced flag, and eviction sweeps the nodes giving
+ * referenced ones a second chance.
+ */
 
 typedef struct LruNode {
-	QTAILQ_ENTRY(LruNode) next_global;
-	QTAILQ_ENTRY(LruNode) next_bin;
 	uint64_t hash;
+	unsigned int index; /* Position in Lru.nodes */
+	bool in_use;
+	bool referenced;
 } LruNode;
 
+typedef struct LruSlot {
+	uint64_t hash;
+	LruNode *node; /* NULL if the slot is empty */
+} LruSlot;
+
 typedef struct Lru Lru;
 
 struct Lru {
-	QTAILQ_HEAD(, LruNode) global;
-	QTAILQ_HEAD(, LruNode) bins[LRU_NUM_BINS];
+	LruNode **nodes; /* Every node added, swept by the clock hand */
+	unsigned int num_nodes;
+	unsigned int nodes_capacity;
+	unsigned int hand;
+
+	LruNode **free_nodes; /* Stack of num_free nodes not in use */
+
+	LruSlot *slots;
+	unsigned int num_slots; /* Power of two, at least twice num_nodes */
+
 	int num_used;
 	int num_free;
 
@@ -58,185 +76,28 @@ struct Lru {
 	void (*post_node_evict)(Lru *lru, LruNode *node);
 };
 
-static inline
-void lru_init(Lru *lru)
-{
-	QTAILQ_INIT(&lru->global);
-	for (unsigned int i = 0; i < LRU_NUM_BINS; i++) {
-		QTAILQ_INIT(&lru->bins[i]);
-	}
-	lru->init_node = NULL;
-	lru->compare_nodes = NULL;
-	lru->pre_node_evict = NULL;
-	lru->post_node_evict = NULL;
-	lru->num_free = 0;
-	lru->num_used = 0;
-}
+void lru_init(Lru *lru);
 
-static inline
-void lru_add_free(Lru *lru, LruNode *node)
-{
-	node->next_bin.tqe_circ.tql_prev = NULL;
-	QTAILQ_INSERT_TAIL(&lru->global, node, next_global);
-	lru->num_free += 1;
-}
-
-static inline
-unsigned int lru_hash_to_bin(Lru *lru, uint64_t hash)
-{
-	return hash % LRU_NUM_BINS;
-}
+/* Free the index. Nodes are owned by the caller and should be flushed first. */
+void lru_destroy(Lru *lru);
 
-static inline
-unsigned int lru_get_node_bin(Lru *lru, LruNode *node)
-{
-	return lru_hash_to_bin(lru, node->hash);
-}
+void lru_add_free(Lru *lru, LruNode *node);
 
 static inline
 bool lru_is_node_in_use(Lru *lru, LruNode *node)
 {
-	return QTAILQ_IN_USE(node, next_bin);
+	return node->in_use;
 }
 
-static inline
-void lru_evict_node(Lru *lru, LruNode *node)
-{
-	if (!lru_is_node_in_use(lru, node)) {
-		return;
-	}
-
-	unsigned int bin = lru_get_node_bin(lru, node);
-	QTAILQ_REMOVE(&lru->bins[bin], node, next_bin);
-	if (lru->post_node_evict) {
-		lru->post_node_evict(lru, node);
-	}
-
-	lru->num_used -= 1;
-	lru->num_free += 1;
-}
-
-static inline
-LruNode *lru_try_evict_one(Lru *lru)
-{
-	LruNode *found;
-
-	QTAILQ_FOREACH_REVERSE(found, &lru->global, next_global) {
-		if (lru_is_node_in_use(lru, found)
-			&& (!lru->pre_node_evict || lru->pre_node_evict(lru, found))) {
-			lru_evict_node(lru, found);
-			return found;
-		}
-	}
-
-	return NULL;
-}
-
-static inline
-LruNode *lru_evict_one(Lru *lru)
-{
-	LruNode *found = lru_try_evict_one(lru);
-
-	assert(found != NULL); /* No evictable node! */
-
-	return found;
-}
-
-static inline
-LruNode *lru_get_one_free(Lru *lru)
-{
-	LruNode *found;
-
-	QTAILQ_FOREACH_REVERSE(found, &lru->global, next_global) {
-		if (!lru_is_node_in_use(lru, found)) {
-			return found;
-		}
-	}
-
-	return lru_evict_one(lru);
-}
-
-static inline
-bool lru_contains_hash(Lru *lru, uint64_t hash)
-{
-	unsigned int bin = lru_hash_to_bin(lru, hash);
-	LruNode *iter;
-
-	QTAILQ_FOREACH(iter, &lru->bins[bin], next_bin) {
-        if (iter->hash == hash) {
-            return true;
-        }
-    }
-
-	return false;
-}
-
-static inline
-LruNode *lru_lookup(Lru *lru, uint64_t hash, const void *key)
-{
-	unsigned int bin = lru_hash_to_bin(lru, hash);
-	LruNode *iter, *found = NULL;
-
-	QTAILQ_FOREACH(iter, &lru->bins[bin], next_bin) {
-        if ((iter->hash == hash) && !lru->compare_nodes(lru, iter, key)) {
-            found = iter;
-            break;
-        }
-    }
-
-	if (found) {
-		QTAILQ_REMOVE(&lru->bins[bin], found, next_bin);
-	} else {
-		found = lru_get_one_free(lru);
-		found->hash = hash;
-		if (lru->init_node) {
-			lru->init_node(lru, found, key);
-		}
-		assert(found->hash == hash);
-
-		lru->num_used += 1;
-		lru->num_free -= 1;
-	}
-
-	QTAILQ_REMOVE(&lru->global, found, next_global);
-	QTAILQ_INSERT_HEAD(&lru->global, found, next_global);
-	QTAILQ_INSERT_HEAD(&lru->bins[bin], found, next_bin);
-
-	return found;
-}
-
-static inline
-void lru_flush(Lru *lru)
-{
-	LruNode *iter, *iter_next;
-
-	for (unsigned int bin = 0; bin < LRU_NUM_BINS; bin++) {
-		QTAILQ_FOREACH_SAFE(iter, &lru->bins[bin], next_bin, iter_next) {
-			bool can_evict = true;
-			if (lru->pre_node_evict) {
-				can_evict = lru->pre_node_evict(lru, iter);
-			}
-			if (can_evict) {
-				lru_evict_node(lru, iter);
-				QTAILQ_REMOVE(&lru->global, iter, next_global);
-				QTAILQ_INSERT_TAIL(&lru->global, iter, next_global);
-			}
-		}
-	}
-}
+void lru_evict_node(Lru *lru, LruNode *node);
+LruNode *lru_try_evict_one(Lru *lru);
+LruNode *lru_evict_one(Lru *lru);
+bool lru_contains_hash(Lru *lru, uint64_t hash);
+LruNode *lru_lookup(Lru *lru, uint64_t hash, const void *key);
+void lru_flush(Lru *lru);
 
 typedef void (*LruNodeVisitorFunc)(Lru *lru, LruNode *node, void *opaque);
 
-static inline
-void lru_visit_active(Lru *lru, LruNodeVisitorFunc visitor_func, void *opaque)
-{
-	LruNode *iter, *iter_next;
-
-	for (unsigned int bin = 0; bin < LRU_NUM_BINS; bin++) {
-		QTAILQ_FOREACH_SAFE(iter, &lru->bins[bin], next_bin, iter_next) {
-			visitor_func(lru, iter, opaque);
-		}
-	}
-}
+void lru_visit_active(Lru *lru, LruNodeVisitorFunc visitor_func, void *opaque);
 
 #endif
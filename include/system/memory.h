@@ -2236,6 +2236,33 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr,
                                       DirtyBitmapSnapshot *snap,
                                       hwaddr addr, hwaddr size);
 
+#ifdef XBOX
+/**
+ * memory_region_accumulate_and_clear_dirty: OR the dirty bitmap of a range
+ *                                           into a caller-owned bitmap and
+ *                                           clear it.
+ *
+ * Like memory_region_snapshot_and_clear_dirty, but merges into a bitmap the
+ * caller keeps across calls instead of allocating a new snapshot, so pages
+ * the caller has not looked at yet stay dirty. Clean bitmap words are
+ * skipped without atomic operations and only the span that was dirty has
+ * its TLB write tracking re-armed, which keeps calling this for a mostly
+ * clean range cheap.
+ *
+ * @mr: the memory region being queried; must start on a bitmap word.
+ * @addr: the address (relative to the start of the region) being queried;
+ *        must be aligned to BITS_PER_LONG pages.
+ * @size: the size of the range being queried.
+ * @client: the user of the logging information.
+ * @dest: bitmap with one bit per page of the range.
+ *
+ * Returns true if any page in the range was dirty.
+ */
+bool memory_region_accumulate_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
+                                              hwaddr size, unsigned client,
+                                              unsigned long *dest);
+#endif
+
 /**
  * memory_region_reset_dirty: Mark a range of pages as clean, for a specified
  *                            client.
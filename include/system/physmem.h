@@ -51,4 +51,11 @@ bool physical_memory_snapshot_get_dirty(DirtyBitmapSnapshot *snap,
                                         ram_addr_t start,
                                         ram_addr_t length);
 
+#ifdef XBOX
+bool physical_memory_accumulate_and_clear_dirty(MemoryRegion *mr,
+                                                hwaddr offset, hwaddr length,
+                                                unsigned client,
+                                                unsigned long *dest);
+#endif
+
 #endif
@@ -14,6 +14,7 @@ typedef enum CONFIG_DISPLAY_RENDERER {
 typedef enum CONFIG_DISPLAY_FILTERING {
     CONFIG_DISPLAY_FILTERING_LINEAR = 0,
     CONFIG_DISPLAY_FILTERING_NEAREST,
+    CONFIG_DISPLAY_FILTERING_FSR,
     CONFIG_DISPLAY_FILTERING__COUNT,
 } CONFIG_DISPLAY_FILTERING;
 
@@ -51,6 +52,7 @@ typedef enum CONFIG_NET_BACKEND {
     CONFIG_NET_BACKEND_NAT = 0,
     CONFIG_NET_BACKEND_UDP,
     CONFIG_NET_BACKEND_PCAP,
+    CONFIG_NET_BACKEND_RELAY,
     CONFIG_NET_BACKEND__COUNT,
 } CONFIG_NET_BACKEND;
 
@@ -77,6 +79,56 @@ typedef enum CONFIG_SYS_AVPACK {
     CONFIG_SYS_AVPACK__COUNT,
 } CONFIG_SYS_AVPACK;
 
+typedef enum CONFIG_PERF_TCG_THREAD {
+    CONFIG_PERF_TCG_THREAD_AUTO = 0,
+    CONFIG_PERF_TCG_THREAD_SINGLE,
+    CONFIG_PERF_TCG_THREAD_MULTI,
+    CONFIG_PERF_TCG_THREAD__COUNT,
+} CONFIG_PERF_TCG_THREAD;
+
+typedef enum CONFIG_PERF_LOW_MEMORY {
+    CONFIG_PERF_LOW_MEMORY_AUTO = 0,
+    CONFIG_PERF_LOW_MEMORY_ON,
+    CONFIG_PERF_LOW_MEMORY_OFF,
+    CONFIG_PERF_LOW_MEMORY__COUNT,
+} CONFIG_PERF_LOW_MEMORY;
+
+typedef enum CONFIG_PERF_HUGE_PAGES {
+    CONFIG_PERF_HUGE_PAGES_TRANSPARENT = 0,
+    CONFIG_PERF_HUGE_PAGES_EXPLICIT,
+    CONFIG_PERF_HUGE_PAGES_OFF,
+    CONFIG_PERF_HUGE_PAGES__COUNT,
+} CONFIG_PERF_HUGE_PAGES;
+
+typedef enum CONFIG_PERF_TITLE_PROFILES_RENDERER {
+    CONFIG_PERF_TITLE_PROFILES_RENDERER_DEFAULT = 0,
+    CONFIG_PERF_TITLE_PROFILES_RENDERER_NULL,
+    CONFIG_PERF_TITLE_PROFILES_RENDERER_OPENGL,
+    CONFIG_PERF_TITLE_PROFILES_RENDERER_VULKAN,
+    CONFIG_PERF_TITLE_PROFILES_RENDERER__COUNT,
+} CONFIG_PERF_TITLE_PROFILES_RENDERER;
+
+typedef enum CONFIG_PERF_TITLE_PROFILES_HARD_FPU {
+    CONFIG_PERF_TITLE_PROFILES_HARD_FPU_DEFAULT = 0,
+    CONFIG_PERF_TITLE_PROFILES_HARD_FPU_ON,
+    CONFIG_PERF_TITLE_PROFILES_HARD_FPU_OFF,
+    CONFIG_PERF_TITLE_PROFILES_HARD_FPU__COUNT,
+} CONFIG_PERF_TITLE_PROFILES_HARD_FPU;
+
+typedef enum CONFIG_PERF_TITLE_PROFILES_USE_DSP {
+    CONFIG_PERF_TITLE_PROFILES_USE_DSP_DEFAULT = 0,
+    CONFIG_PERF_TITLE_PROFILES_USE_DSP_ON,
+    CONFIG_PERF_TITLE_PROFILES_USE_DSP_OFF,
+    CONFIG_PERF_TITLE_PROFILES_USE_DSP__COUNT,
+} CONFIG_PERF_TITLE_PROFILES_USE_DSP;
+
+typedef enum CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK {
+    CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK_AUTO = 0,
+    CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK_ALWAYS,
+    CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK_NEVER,
+    CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK__COUNT,
+} CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK;
+
 struct config {
     struct general {
         bool show_welcome;
@@ -140,6 +192,7 @@ struct config {
         bool auto_bind;
         bool allow_vibration;
         bool background_input_capture;
+        int runahead_frames;
         struct keyboard_controller_scancode_map {
             int a;
             int b;
@@ -263,6 +316,12 @@ struct config {
             const char *bind_addr;
             const char *remote_addr;
         } udp;
+        struct {
+            const char *bind_addr;
+            const char *peers;
+            bool hub;
+            int aggregate_us;
+        } relay;
         struct {
             struct forward_port {
                 int host;
@@ -271,6 +330,10 @@ struct config {
             } *forward_ports;
             unsigned int forward_ports_count;
         } nat;
+        struct intr_coalesce {
+            int usecs;
+            int frames;
+        } intr_coalesce;
     } net;
 
     struct sys {
@@ -287,7 +350,28 @@ struct config {
 
     struct perf {
         bool hard_fpu;
+        bool tb_cache;
+        struct tcg {
+            CONFIG_PERF_TCG_THREAD thread;
+            int tb_size_mb;
+            int max_insns;
+            bool chain;
+        } tcg;
+        bool park_idle_loops;
         bool cache_shaders;
+        int disc_cache_mb;
+        CONFIG_PERF_LOW_MEMORY low_memory;
+        CONFIG_PERF_HUGE_PAGES huge_pages;
+        struct title_profile {
+            const char *title_id;
+            CONFIG_PERF_TITLE_PROFILES_RENDERER renderer;
+            int surface_scale;
+            CONFIG_PERF_TITLE_PROFILES_HARD_FPU hard_fpu;
+            CONFIG_PERF_TITLE_PROFILES_USE_DSP use_dsp;
+            int vp_workers;
+            CONFIG_PERF_TITLE_PROFILES_SURFACE_READBACK surface_readback;
+        } *title_profiles;
+        unsigned int title_profiles_count;
     } perf;
 };
 
@@ -0,0 +1,728 @@
+/*
+ * Incremental quicksave
+ *
+ * A quicksave is a disk-only internal snapshot of the block devices, the
+ * device state (everything but RAM) and a chain of RAM page files: a full
+ * base image followed by deltas holding the pages dirtied between two
+ * quicksaves, tracked with the DIRTY_MEMORY_SNAPSHOT client. Once the chain
+ * grows past QUICKSAVE_MAX_CHAIN deltas a background thread merges it into
+ * a new base image.
+ *
+ * Files in the quicksave directory:
+ *   chain          "base=<seq> head=<seq>", replaced atomically on commit
+ *   base-<seq>.ram full RAM image as of quicksave <seq>
+ *   delta-<seq>.ram pages dirtied between quicksave <seq - 1> and <seq>
+ *   state-<seq>.bin device state of the head quicksave
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "block/block.h"
+#include "block/snapshot.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "migration/global_state.h"
+#include "migration/quicksave.h"
+#include "migration/snapshot.h"
+#include "system/memory.h"
+#include "system/ramblock.h"
+#include "system/runstate.h"
+#include "system/system.h"
+#include "migration.h"
+#include "options.h"
+#include "qemu-file.h"
+#include "ram.h"
+#include "savevm.h"
+#include "trace.h"
+
+#define QUICKSAVE_SNAPSHOT_NAME "xemu-quicksave"
+#define QUICKSAVE_MAGIC 0x7871736b /* 'xqsk' */
+#define QUICKSAVE_VERSION 1
+#define QUICKSAVE_MAX_CHAIN 8
+
+typedef struct QuicksaveState {
+    /* Protects the chain against the compaction thread */
+    QemuMutex lock;
+    char *dir;
+    uint32_t base_seq;
+    uint32_t head_seq;
+
+    /* Dirty log is relative to the head of the chain */
+    bool valid;
+    bool logging;
+
+    QemuThread compact_thread;
+    bool compacting;
+} QuicksaveState;
+
+static QuicksaveState quicksave_state;
+
+static void quicksave_init(void)
+{
+    static bool initialized;
+
+    if (!initialized) {
+        qemu_mutex_init(&quicksave_state.lock);
+        initialized = true;
+    }
+}
+
+static char *quicksave_path(const char *dir, const char *kind, uint32_t seq)
+{
+    return g_strdup_printf("%s/%s-%08" PRIu32 ".%s", dir, kind, seq,
+                           strcmp(kind, "state") ? "ram" : "bin");
+}
+
+static bool quicksave_read_chain(const char *dir, uint32_t *base,
+                                 uint32_t *head)
+{
+    g_autofree char *path = g_build_filename(dir, "chain", NULL);
+    g_autofree char *buf = NULL;
+
+    if (!g_file_get_contents(path, &buf, NULL, NULL)) {
+        return false;
+    }
+    return sscanf(buf, "base=%" SCNu32 " head=%" SCNu32, base, head) == 2 &&
+           *base <= *head;
+}
+
+static bool quicksave_write_chain(const char *dir, uint32_t base,
+                                  uint32_t head, Error **errp)
+{
+    g_autofree char *path = g_build_filename(dir, "chain", NULL);
+    g_autofree char *buf = g_strdup_printf("base=%" PRIu32 " head=%" PRIu32
+                                           "\n", base, head);
+    GError *gerr = NULL;
+
+    if (!g_file_set_contents(path, buf, -1, &gerr)) {
+        error_setg(errp, "Could not write %s: %s", path, gerr->message);
+        g_error_free(gerr);
+        return false;
+    }
+    return true;
+}
+
+/* Switch to the quicksave directory of another HDD image */
+static void quicksave_select_dir(const char *dir)
+{
+    QuicksaveState *s = &quicksave_state;
+
+    if (!g_strcmp0(s->dir, dir)) {
+        return;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    g_free(s->dir);
+    s->dir = g_strdup(dir);
+    s->valid = false;
+    if (!quicksave_read_chain(dir, &s->base_seq, &s->head_seq)) {
+        s->base_seq = s->head_seq = 0;
+    }
+    qemu_mutex_unlock(&s->lock);
+}
+
+static void quicksave_wait_compaction(void)
+{
+    QuicksaveState *s = &quicksave_state;
+
+    if (s->compacting) {
+        bql_unlock();
+        qemu_thread_join(&s->compact_thread);
+        bql_lock();
+        s->compacting = false;
+    }
+}
+
+/* Remove page files that are no longer part of the chain */
+static void quicksave_remove_stale(const char *dir, uint32_t base,
+                                   uint32_t head)
+{
+    g_autoptr(GDir) d = g_dir_open(dir, 0, NULL);
+    const char *name;
+
+    if (!d) {
+        return;
+    }
+
+    while ((name = g_dir_read_name(d))) {
+        uint32_t seq;
+        bool stale;
+
+        if (sscanf(name, "base-%" SCNu32 ".ram", &seq) == 1) {
+            stale = seq != base;
+        } else if (sscanf(name, "delta-%" SCNu32 ".ram", &seq) == 1) {
+            stale = seq <= base || seq > head;
+        } else if (sscanf(name, "state-%" SCNu32 ".bin", &seq) == 1) {
+            stale = seq != head;
+        } else {
+            continue;
+        }
+
+        if (stale) {
+            g_autofree char *path = g_build_filename(dir, name, NULL);
+            unlink(path);
+        }
+    }
+}
+
+/*
+ * Page files hold a header followed by one record per RAM block:
+ * idstr length and bytes, used length, page count and the pages, each
+ * preceded by its index within the block.
+ */
+static void quicksave_put_be32(FILE *f, uint32_t v)
+{
+    v = cpu_to_be32(v);
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static void quicksave_put_be64(FILE *f, uint64_t v)
+{
+    v = cpu_to_be64(v);
+    fwrite(&v, sizeof(v), 1, f);
+}
+
+static bool quicksave_get_be32(FILE *f, uint32_t *v)
+{
+    if (fread(v, sizeof(*v), 1, f) != 1) {
+        return false;
+    }
+    *v = be32_to_cpu(*v);
+    return true;
+}
+
+static bool quicksave_get_be64(FILE *f, uint64_t *v)
+{
+    if (fread(v, sizeof(*v), 1, f) != 1) {
+        return false;
+    }
+    *v = be64_to_cpu(*v);
+    return true;
+}
+
+static FILE *quicksave_create(const char *path, uint32_t nblocks,
+                              Error **errp)
+{
+    FILE *f = fopen(path, "wb");
+
+    if (!f) {
+        error_setg_errno(errp, errno, "Could not create %s", path);
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 * MiB);
+
+    quicksave_put_be32(f, QUICKSAVE_MAGIC);
+    quicksave_put_be32(f, QUICKSAVE_VERSION);
+    quicksave_put_be32(f, nblocks);
+    return f;
+}
+
+static void quicksave_put_block(FILE *f, const char *idstr,
+                                uint64_t used_length, uint32_t npages)
+{
+    size_t len = strlen(idstr);
+
+    fputc(len, f);
+    fwrite(idstr, len, 1, f);
+    quicksave_put_be64(f, used_length);
+    quicksave_put_be32(f, npages);
+}
+
+static bool quicksave_finish(FILE *f, const char *tmp, const char *path,
+                             Error **errp)
+{
+    bool ok = !ferror(f);
+
+    ok &= fclose(f) == 0;
+    if (!ok) {
+        error_setg(errp, "Could not write %s", path);
+        unlink(tmp);
+        return false;
+    }
+    if (rename(tmp, path) < 0) {
+        error_setg_errno(errp, errno, "Could not rename %s", tmp);
+        unlink(tmp);
+        return false;
+    }
+    return true;
+}
+
+typedef void (*QuicksavePageFn)(void *opaque, const char *idstr,
+                                uint64_t used_length, uint64_t offset,
+                                const uint8_t *page);
+
+static bool quicksave_read_pages(const char *path, QuicksavePageFn fn,
+                                 void *opaque, Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    g_autofree uint8_t *page = g_malloc(page_size);
+    uint32_t magic, version, nblocks;
+    FILE *f = fopen(path, "rb");
+
+    if (!f) {
+        error_setg_errno(errp, errno, "Could not open %s", path);
+        return false;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 * MiB);
+
+    if (!quicksave_get_be32(f, &magic) || magic != QUICKSAVE_MAGIC ||
+        !quicksave_get_be32(f, &version) || version != QUICKSAVE_VERSION ||
+        !quicksave_get_be32(f, &nblocks)) {
+        goto corrupt;
+    }
+
+    for (uint32_t i = 0; i < nblocks; i++) {
+        char idstr[256];
+        uint64_t used_length;
+        uint32_t npages;
+        int len = fgetc(f);
+
+        if (len == EOF || fread(idstr, 1, len, f) != (size_t)len ||
+            !quicksave_get_be64(f, &used_length) ||
+            !quicksave_get_be32(f, &npages)) {
+            goto corrupt;
+        }
+        idstr[len] = 0;
+
+        for (uint32_t j = 0; j < npages; j++) {
+            uint32_t index;
+            if (!quicksave_get_be32(f, &index) ||
+                (uint64_t)index * page_size + page_size > used_length ||
+                fread(page, page_size, 1, f) != 1) {
+                goto corrupt;
+            }
+            fn(opaque, idstr, used_length, (uint64_t)index * page_size, page);
+        }
+    }
+
+    fclose(f);
+    return true;
+
+corrupt:
+    error_setg(errp, "Quicksave file %s is corrupt", path);
+    fclose(f);
+    return false;
+}
+
+/*
+ * Write the RAM pages dirtied since the last quicksave, or all of them for a
+ * base image. Either way the dirty log is cleared, so the next delta is
+ * relative to this quicksave.
+ */
+static bool quicksave_write_ram(const char *path, bool full, Error **errp)
+{
+    size_t page_size = qemu_target_page_size();
+    g_autofree char *tmp = g_strconcat(path, ".tmp", NULL);
+    uint32_t nblocks = 0;
+    uint64_t written = 0;
+    RAMBlock *block;
+    FILE *f;
+
+    RCU_READ_LOCK_GUARD();
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        nblocks++;
+    }
+
+    f = quicksave_create(tmp, nblocks, errp);
+    if (!f) {
+        return false;
+    }
+
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        uint64_t used_length = qemu_ram_get_used_length(block);
+        uint32_t npages = used_length / page_size;
+        uint8_t *host = qemu_ram_get_host_addr(block);
+        DirtyBitmapSnapshot *snap = memory_region_snapshot_and_clear_dirty(
+            block->mr, 0, used_length, DIRTY_MEMORY_SNAPSHOT);
+
+        uint32_t ndirty = 0;
+        for (uint32_t i = 0; i < npages; i++) {
+            if (full || memory_region_snapshot_get_dirty(
+                            block->mr, snap, (hwaddr)i * page_size,
+                            page_size)) {
+                ndirty++;
+            }
+        }
+
+        quicksave_put_block(f, qemu_ram_get_idstr(block), used_length,
+                            ndirty);
+        for (uint32_t i = 0; i < npages; i++) {
+            if (full || memory_region_snapshot_get_dirty(
+                            block->mr, snap, (hwaddr)i * page_size,
+                            page_size)) {
+                quicksave_put_be32(f, i);
+                fwrite(host + (size_t)i * page_size, page_size, 1, f);
+            }
+        }
+        written += (uint64_t)ndirty * page_size;
+        g_free(snap);
+    }
+
+    trace_quicksave_write_ram(path, full, written);
+    return quicksave_finish(f, tmp, path, errp);
+}
+
+static void quicksave_start_logging(void)
+{
+    RAMBlock *block;
+
+    if (quicksave_state.logging) {
+        return;
+    }
+
+    /* TCG stores are always logged, this also catches DMA */
+    RCU_READ_LOCK_GUARD();
+    RAMBLOCK_FOREACH_MIGRATABLE(block) {
+        memory_region_set_log(block->mr, true, DIRTY_MEMORY_SNAPSHOT);
+    }
+    quicksave_state.logging = true;
+}
+
+static bool quicksave_save_state(const char *path, Error **errp)
+{
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    int ret;
+
+    ioc = qio_channel_file_new_path(path, O_WRONLY | O_CREAT | O_TRUNC, 0660,
+                                    errp);
+    if (!ioc) {
+        return false;
+    }
+    f = qemu_file_new_output(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    ret = qemu_save_device_state(f);
+    if (qemu_fclose(f) < 0 || ret < 0) {
+        error_setg(errp, "Could not save device state");
+        return false;
+    }
+    return true;
+}
+
+static bool quicksave_load_state(const char *path, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    QIOChannelFile *ioc;
+    QEMUFile *f;
+    int ret = -EINVAL;
+
+    ioc = qio_channel_file_new_path(path, O_RDONLY, 0, errp);
+    if (!ioc) {
+        return false;
+    }
+    f = qemu_file_new_input(QIO_CHANNEL(ioc));
+    object_unref(OBJECT(ioc));
+
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        error_setg(errp, "Quicksave device state is corrupt");
+    } else {
+        mis->from_src_file = f;
+        ret = qemu_load_device_state(f, errp);
+        mis->from_src_file = NULL;
+    }
+    qemu_fclose(f);
+
+    return ret == 0;
+}
+
+typedef struct QuicksaveImageBlock {
+    uint64_t used_length;
+    uint8_t *data;
+} QuicksaveImageBlock;
+
+static void quicksave_merge_page(void *opaque, const char *idstr,
+                                 uint64_t used_length, uint64_t offset,
+                                 const uint8_t *page)
+{
+    GHashTable *blocks = opaque;
+    QuicksaveImageBlock *b = g_hash_table_lookup(blocks, idstr);
+
+    if (!b) {
+        b = g_new0(QuicksaveImageBlock, 1);
+        b->used_length = used_length;
+        b->data = g_malloc0(used_length);
+        g_hash_table_insert(blocks, g_strdup(idstr), b);
+    }
+    if (offset + qemu_target_page_size() <= b->used_length) {
+        memcpy(b->data + offset, page, qemu_target_page_size());
+    }
+}
+
+static void quicksave_image_block_free(gpointer p)
+{
+    QuicksaveImageBlock *b = p;
+    g_free(b->data);
+    g_free(b);
+}
+
+/* Merge the deltas into a new base image, off the main loop */
+static void *quicksave_compact_thread(void *opaque)
+{
+    QuicksaveState *s = &quicksave_state;
+    size_t page_size = qemu_target_page_size();
+    g_autoptr(GHashTable) blocks = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, quicksave_image_block_free);
+    Error *err = NULL;
+    char *dir;
+    uint32_t base, head;
+
+    qemu_mutex_lock(&s->lock);
+    dir = g_strdup(s->dir);
+    base = s->base_seq;
+    head = s->head_seq;
+    qemu_mutex_unlock(&s->lock);
+
+    int64_t start = get_clock();
+
+    for (uint32_t seq = base; seq <= head; seq++) {
+        g_autofree char *path =
+            quicksave_path(dir, seq == base ? "base" : "delta", seq);
+        if (!quicksave_read_pages(path, quicksave_merge_page, blocks, &err)) {
+            goto out;
+        }
+    }
+
+    g_autofree char *path = quicksave_path(dir, "base", head);
+    g_autofree char *tmp = g_strconcat(path, ".tmp", NULL);
+    FILE *f = quicksave_create(tmp, g_hash_table_size(blocks), &err);
+    if (!f) {
+        goto out;
+    }
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, blocks);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        QuicksaveImageBlock *b = value;
+        uint32_t npages = b->used_length / page_size;
+
+        quicksave_put_block(f, key, b->used_length, npages);
+        for (uint32_t i = 0; i < npages; i++) {
+            quicksave_put_be32(f, i);
+            fwrite(b->data + (size_t)i * page_size, page_size, 1, f);
+        }
+    }
+
+    if (!quicksave_finish(f, tmp, path, &err)) {
+        goto out;
+    }
+
+    /* Saves may have extended the chain meanwhile, keep their deltas */
+    qemu_mutex_lock(&s->lock);
+    if (!g_strcmp0(s->dir, dir) && s->base_seq == base &&
+        quicksave_write_chain(dir, head, s->head_seq, &err)) {
+        s->base_seq = head;
+        quicksave_remove_stale(dir, s->base_seq, s->head_seq);
+    } else {
+        unlink(path);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+    trace_quicksave_compact(base, head, (get_clock() - start) / SCALE_MS);
+
+out:
+    if (err) {
+        warn_report_err(err);
+    }
+    g_free(dir);
+    return NULL;
+}
+
+bool quicksave_exists(const char *dir)
+{
+    uint32_t base, head;
+    return quicksave_read_chain(dir, &base, &head);
+}
+
+void quicksave_invalidate(void)
+{
+    quicksave_state.valid = false;
+}
+
+bool quicksave_save(const char *dir, Error **errp)
+{
+    QuicksaveState *s = &quicksave_state;
+    RunState saved_state = runstate_get();
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    QEMUSnapshotInfo sn = { 0 };
+    BlockDriverState *bs;
+    bool ok = false;
+
+    GLOBAL_STATE_CODE();
+    quicksave_init();
+
+    if (!migrate_can_snapshot(errp) || migration_is_blocked(errp) ||
+        snapshot_save_in_progress(errp) ||
+        !bdrv_all_can_snapshot(false, NULL, errp)) {
+        return false;
+    }
+
+    bs = bdrv_all_find_vmstate_bs(NULL, false, NULL, errp);
+    if (!bs) {
+        return false;
+    }
+
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        error_setg_errno(errp, errno, "Could not create %s", dir);
+        return false;
+    }
+
+    quicksave_select_dir(dir);
+    quicksave_start_logging();
+
+    /* A base image is needed until the dirty log follows the chain */
+    bool full = !s->valid;
+    if (full) {
+        quicksave_wait_compaction();
+    }
+    uint32_t seq = s->head_seq + 1;
+
+    int64_t start = get_clock();
+    global_state_store();
+    vm_stop(RUN_STATE_SAVE_VM);
+    bdrv_drain_all_begin();
+
+    /* The block devices are kept in a disk-only internal snapshot */
+    if (bdrv_all_delete_snapshot(QUICKSAVE_SNAPSHOT_NAME, false, NULL,
+                                 errp) < 0) {
+        goto the_end;
+    }
+    pstrcpy(sn.name, sizeof(sn.name), QUICKSAVE_SNAPSHOT_NAME);
+    sn.date_sec = g_date_time_to_unix(now);
+    sn.date_nsec = g_date_time_get_microsecond(now) * 1000;
+    sn.vm_clock_nsec = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    sn.icount = -1ULL;
+    if (bdrv_all_create_snapshot(&sn, bs, 0, false, NULL, errp) < 0) {
+        goto the_end;
+    }
+
+    /* Device state first, its pre_save hooks may still write to RAM */
+    g_autofree char *state_path = quicksave_path(dir, "state", seq);
+    if (!quicksave_save_state(state_path, errp)) {
+        goto the_end;
+    }
+
+    g_autofree char *ram_path = quicksave_path(dir, full ? "base" : "delta",
+                                               seq);
+    if (!quicksave_write_ram(ram_path, full, errp)) {
+        goto the_end;
+    }
+
+    qemu_mutex_lock(&s->lock);
+    ok = quicksave_write_chain(dir, full ? seq : s->base_seq, seq, errp);
+    if (ok) {
+        if (full) {
+            s->base_seq = seq;
+        }
+        s->head_seq = seq;
+        quicksave_remove_stale(dir, s->base_seq, s->head_seq);
+    }
+    qemu_mutex_unlock(&s->lock);
+
+the_end:
+    /* The dirty log was cleared, so a failed save breaks the chain */
+    s->valid = ok;
+
+    bdrv_drain_all_end();
+    vm_resume(saved_state);
+    trace_quicksave_save(seq, full, ok, (get_clock() - start) / SCALE_US);
+
+    if (ok && !s->compacting &&
+        s->head_seq - s->base_seq >= QUICKSAVE_MAX_CHAIN) {
+        s->compacting = true;
+        qemu_thread_create(&s->compact_thread, "quicksave-compact",
+                           quicksave_compact_thread, NULL,
+                           QEMU_THREAD_JOINABLE);
+    }
+
+    return ok;
+}
+
+static void quicksave_load_page(void *opaque, const char *idstr,
+                                uint64_t used_length, uint64_t offset,
+                                const uint8_t *page)
+{
+    RAMBlock *block = qemu_ram_block_by_name(idstr);
+
+    if (block && qemu_ram_get_used_length(block) == used_length) {
+        memcpy((uint8_t *)qemu_ram_get_host_addr(block) + offset, page,
+               qemu_target_page_size());
+    }
+}
+
+bool quicksave_load(const char *dir, Error **errp)
+{
+    QuicksaveState *s = &quicksave_state;
+    uint32_t base, head;
+    RAMBlock *block;
+    bool ok = false;
+
+    GLOBAL_STATE_CODE();
+    quicksave_init();
+
+    if (!migrate_can_snapshot(errp) || snapshot_save_in_progress(errp) ||
+        !bdrv_all_can_snapshot(false, NULL, errp)) {
+        return false;
+    }
+
+    quicksave_select_dir(dir);
+    quicksave_wait_compaction();
+
+    if (!quicksave_read_chain(dir, &base, &head) ||
+        bdrv_all_has_snapshot(QUICKSAVE_SNAPSHOT_NAME, false, NULL,
+                              NULL) != 1) {
+        error_setg(errp, "No quicksave to load");
+        return false;
+    }
+
+    int64_t start = get_clock();
+    bdrv_drain_all_begin();
+
+    if (bdrv_all_goto_snapshot(QUICKSAVE_SNAPSHOT_NAME, false, NULL,
+                               errp) < 0) {
+        goto the_end;
+    }
+
+    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+
+    /* RAM goes first, loading the CPU state flushes stale translations */
+    for (uint32_t seq = base; seq <= head; seq++) {
+        g_autofree char *path =
+            quicksave_path(dir, seq == base ? "base" : "delta", seq);
+        if (!quicksave_read_pages(path, quicksave_load_page, NULL, errp)) {
+            goto the_end;
+        }
+    }
+
+    g_autofree char *state_path = quicksave_path(dir, "state", head);
+    ok = quicksave_load_state(state_path, errp);
+
+    /*
+     * RAM was written behind every dirty log. Let the other clients see all
+     * of it, while the quicksave log starts over from the head.
+     */
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            ram_addr_t len = qemu_ram_get_used_length(block);
+            memory_region_set_dirty(block->mr, 0, len);
+            memory_region_reset_dirty(block->mr, 0, len,
+                                      DIRTY_MEMORY_SNAPSHOT);
+        }
+    }
+    s->valid = ok && s->logging;
+
+the_end:
+    bdrv_drain_all_end();
+    trace_quicksave_load(head, ok, (get_clock() - start) / SCALE_US);
+    return ok;
+}
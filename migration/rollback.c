@@ -0,0 +1,373 @@
+/*
+ * In-memory rollback of the machine state
+ *
+ * Captures are kept in a ring of slots. Device state is serialized into a
+ * buffer per slot, while RAM is kept once as a shadow copy of the newest
+ * capture: each slot only holds an undo log of the pages that changed since
+ * the capture before it, with their previous contents. The logs live in
+ * per-slot arenas that keep their memory when the slot is reused, so a
+ * steady capture rate does not allocate.
+ *
+ * Block devices are not captured, so restoring across a disk write is
+ * refused.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/rcu.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "block/accounting.h"
+#include "exec/target_page.h"
+#include "io/channel-buffer.h"
+#include "migration/rollback.h"
+#include "system/block-backend.h"
+#include "system/memory.h"
+#include "system/ramblock.h"
+#include "system/runstate.h"
+#include "migration.h"
+#include "qemu-file.h"
+#include "ram.h"
+#include "savevm.h"
+#include "trace.h"
+
+typedef struct RollbackPage {
+    uint32_t block;
+    uint32_t index;
+    /* followed by the page contents */
+} RollbackPage;
+
+typedef struct RollbackSlot {
+    uint8_t *state;
+    size_t state_len;
+    size_t state_capacity;
+    /* Undo log of RollbackPage records back to the previous capture */
+    GByteArray *pages;
+    uint64_t disk_writes;
+} RollbackSlot;
+
+typedef struct RollbackBlock {
+    RAMBlock *rb;
+    uint8_t *shadow;
+} RollbackBlock;
+
+typedef struct RollbackState {
+    RollbackSlot *slots;
+    unsigned int nslots;
+    unsigned int head;
+    unsigned int count;
+
+    RollbackBlock *blocks;
+    unsigned int nblocks;
+} RollbackState;
+
+static RollbackState rollback_state;
+
+static RollbackSlot *rollback_slot(unsigned int depth)
+{
+    RollbackState *s = &rollback_state;
+    return &s->slots[(s->head + s->nslots - depth) % s->nslots];
+}
+
+static uint64_t rollback_disk_writes(void)
+{
+    BlockBackend *blk = NULL;
+    uint64_t writes = 0;
+
+    while ((blk = blk_all_next(blk))) {
+        writes += blk_get_stats(blk)->nr_ops[BLOCK_ACCT_WRITE];
+    }
+    return writes;
+}
+
+static void rollback_set_log(bool log)
+{
+    RollbackState *s = &rollback_state;
+
+    for (unsigned int i = 0; i < s->nblocks; i++) {
+        memory_region_set_log(s->blocks[i].rb->mr, log,
+                              DIRTY_MEMORY_ROLLBACK);
+    }
+}
+
+static void rollback_free(void)
+{
+    RollbackState *s = &rollback_state;
+
+    rollback_set_log(false);
+    for (unsigned int i = 0; i < s->nblocks; i++) {
+        qemu_vfree(s->blocks[i].shadow);
+    }
+    g_clear_pointer(&s->blocks, g_free);
+    s->nblocks = 0;
+
+    for (unsigned int i = 0; i < s->nslots; i++) {
+        g_free(s->slots[i].state);
+        g_byte_array_unref(s->slots[i].pages);
+    }
+    g_clear_pointer(&s->slots, g_free);
+    s->nslots = s->head = s->count = 0;
+}
+
+void rollback_configure(unsigned int slots)
+{
+    RollbackState *s = &rollback_state;
+    RAMBlock *block;
+
+    if (slots == s->nslots) {
+        return;
+    }
+
+    rollback_free();
+    if (!slots) {
+        return;
+    }
+
+    s->nslots = slots;
+    s->slots = g_new0(RollbackSlot, slots);
+    for (unsigned int i = 0; i < slots; i++) {
+        s->slots[i].pages = g_byte_array_new();
+    }
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            s->nblocks++;
+        }
+        s->blocks = g_new0(RollbackBlock, s->nblocks);
+        unsigned int i = 0;
+        RAMBLOCK_FOREACH_MIGRATABLE(block) {
+            s->blocks[i].rb = block;
+            s->blocks[i].shadow =
+                qemu_memalign(qemu_real_host_page_size(),
+                              qemu_ram_get_used_length(block));
+            i++;
+        }
+    }
+    rollback_set_log(true);
+}
+
+unsigned int rollback_count(void)
+{
+    return rollback_state.count;
+}
+
+/*
+ * Bring the shadow copies up to date with RAM. With @log, the previous
+ * contents of each page that changed are appended to it.
+ */
+static void rollback_sync_ram(GByteArray *log)
+{
+    RollbackState *s = &rollback_state;
+    size_t page_size = qemu_target_page_size();
+
+    for (unsigned int i = 0; i < s->nblocks; i++) {
+        RollbackBlock *b = &s->blocks[i];
+        uint64_t used_length = qemu_ram_get_used_length(b->rb);
+        uint8_t *host = qemu_ram_get_host_addr(b->rb);
+        DirtyBitmapSnapshot *snap = memory_region_snapshot_and_clear_dirty(
+            b->rb->mr, 0, used_length, DIRTY_MEMORY_ROLLBACK);
+
+        if (!log) {
+            memcpy(b->shadow, host, used_length);
+            g_free(snap);
+            continue;
+        }
+
+        for (uint64_t offset = 0; offset < used_length; offset += page_size) {
+            if (!memory_region_snapshot_get_dirty(b->rb->mr, snap, offset,
+                                                  page_size)) {
+                continue;
+            }
+            RollbackPage rec = { .block = i, .index = offset / page_size };
+            g_byte_array_append(log, (const guint8 *)&rec, sizeof(rec));
+            g_byte_array_append(log, b->shadow + offset, page_size);
+            memcpy(b->shadow + offset, host + offset, page_size);
+        }
+        g_free(snap);
+    }
+}
+
+/* Put back the pages that changed since the newest capture */
+static void rollback_revert_ram(void)
+{
+    RollbackState *s = &rollback_state;
+    size_t page_size = qemu_target_page_size();
+
+    for (unsigned int i = 0; i < s->nblocks; i++) {
+        RollbackBlock *b = &s->blocks[i];
+        uint64_t used_length = qemu_ram_get_used_length(b->rb);
+        uint8_t *host = qemu_ram_get_host_addr(b->rb);
+        DirtyBitmapSnapshot *snap = memory_region_snapshot_and_clear_dirty(
+            b->rb->mr, 0, used_length, DIRTY_MEMORY_ROLLBACK);
+
+        for (uint64_t offset = 0; offset < used_length; offset += page_size) {
+            if (memory_region_snapshot_get_dirty(b->rb->mr, snap, offset,
+                                                 page_size)) {
+                memcpy(host + offset, b->shadow + offset, page_size);
+            }
+        }
+        g_free(snap);
+    }
+}
+
+static void rollback_apply_undo(GByteArray *log)
+{
+    RollbackState *s = &rollback_state;
+    size_t page_size = qemu_target_page_size();
+    size_t rec_size = sizeof(RollbackPage) + page_size;
+
+    for (size_t pos = 0; pos + rec_size <= log->len; pos += rec_size) {
+        RollbackPage rec;
+        memcpy(&rec, log->data + pos, sizeof(rec));
+        RollbackBlock *b = &s->blocks[rec.block];
+        uint64_t offset = (uint64_t)rec.index * page_size;
+        const uint8_t *data = log->data + pos + sizeof(rec);
+
+        memcpy((uint8_t *)qemu_ram_get_host_addr(b->rb) + offset, data,
+               page_size);
+        memcpy(b->shadow + offset, data, page_size);
+    }
+}
+
+static bool rollback_save_state(RollbackSlot *slot, Error **errp)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(slot->state_capacity);
+    QEMUFile *f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    bool ok;
+
+    ok = qemu_save_device_state(f) == 0 && qemu_fflush(f) == 0;
+    if (ok) {
+        /* Take the buffer before closing the file frees it */
+        g_free(slot->state);
+        slot->state = bioc->data;
+        slot->state_len = bioc->usage;
+        slot->state_capacity = bioc->capacity;
+        bioc->data = NULL;
+    } else {
+        error_setg(errp, "Could not capture device state");
+    }
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ok;
+}
+
+static bool rollback_load_state(RollbackSlot *slot, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(0);
+    QEMUFile *f;
+    int ret = -EINVAL;
+
+    bioc->data = slot->state;
+    bioc->capacity = slot->state_capacity;
+    bioc->usage = slot->state_len;
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+
+    if (qemu_get_be32(f) != QEMU_VM_FILE_MAGIC ||
+        qemu_get_be32(f) != QEMU_VM_FILE_VERSION) {
+        error_setg(errp, "Rollback device state is corrupt");
+    } else {
+        mis->from_src_file = f;
+        ret = qemu_load_device_state(f, errp);
+        mis->from_src_file = NULL;
+    }
+
+    /* The slot keeps its buffer */
+    bioc->data = NULL;
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ret == 0;
+}
+
+bool rollback_capture(Error **errp)
+{
+    RollbackState *s = &rollback_state;
+    RunState saved_state = runstate_get();
+    RollbackSlot *slot;
+    bool ok;
+
+    GLOBAL_STATE_CODE();
+
+    if (!s->nslots) {
+        error_setg(errp, "Rollback is not enabled");
+        return false;
+    }
+
+    int64_t start = get_clock();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    /*
+     * The slot after the newest one is the oldest, or unused. Its undo log
+     * leads to a capture that is being dropped, so it is reused.
+     */
+    s->head = (s->head + 1) % s->nslots;
+    slot = rollback_slot(0);
+    g_byte_array_set_size(slot->pages, 0);
+
+    ok = rollback_save_state(slot, errp);
+    if (ok) {
+        rollback_sync_ram(s->count ? slot->pages : NULL);
+        slot->disk_writes = rollback_disk_writes();
+        s->count = MIN(s->count + 1, s->nslots);
+    } else {
+        /* The RAM shadow still matches the previous capture */
+        s->head = (s->head + s->nslots - 1) % s->nslots;
+    }
+
+    vm_resume(saved_state);
+    trace_rollback_capture(s->count, slot->state_len, slot->pages->len,
+                           (get_clock() - start) / SCALE_US);
+    return ok;
+}
+
+bool rollback_restore(unsigned int depth, Error **errp)
+{
+    RollbackState *s = &rollback_state;
+    RunState saved_state = runstate_get();
+    RollbackSlot *target;
+    bool ok;
+
+    GLOBAL_STATE_CODE();
+
+    if (depth >= s->count) {
+        error_setg(errp, "Only %u rollback captures are held", s->count);
+        return false;
+    }
+
+    target = rollback_slot(depth);
+    if (target->disk_writes != rollback_disk_writes()) {
+        error_setg(errp, "Disk was written since the rollback capture");
+        return false;
+    }
+
+    int64_t start = get_clock();
+    vm_stop(RUN_STATE_RESTORE_VM);
+
+    rollback_revert_ram();
+    for (unsigned int i = 0; i < depth; i++) {
+        rollback_apply_undo(rollback_slot(i)->pages);
+    }
+    s->head = (s->head + s->nslots - depth) % s->nslots;
+    s->count -= depth;
+
+    ok = rollback_load_state(target, errp);
+
+    /* RAM was written behind the other dirty logs */
+    for (unsigned int i = 0; i < s->nblocks; i++) {
+        MemoryRegion *mr = s->blocks[i].rb->mr;
+        ram_addr_t len = qemu_ram_get_used_length(s->blocks[i].rb);
+        memory_region_set_dirty(mr, 0, len);
+        memory_region_reset_dirty(mr, 0, len, DIRTY_MEMORY_ROLLBACK);
+    }
+
+    if (!ok) {
+        /* The machine is in an unknown state, start over */
+        s->count = 0;
+    }
+
+    vm_resume(saved_state);
+    trace_rollback_restore(depth, ok, (get_clock() - start) / SCALE_US);
+    return ok;
+}
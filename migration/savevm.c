@@ -73,6 +73,10 @@
 #include "options.h"
 
 #include "ui/xemu-snapshots.h"
+#include "migration/quicksave.h"
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 
 const unsigned int postcopy_ram_discard_version;
 
@@ -3221,6 +3225,12 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         return false;
     }
 
+#ifdef XBOX
+    if (snapshot_save_in_progress(errp)) {
+        return false;
+    }
+#endif
+
     if (!replay_can_snapshot()) {
         error_setg(errp, "Record/replay does not allow making snapshot "
                    "right now. Try once more later.");
@@ -3314,6 +3324,749 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
     return ret == 0;
 }
 
+#ifdef XBOX
+/*
+ * Asynchronous snapshot save. The guest is only stopped while its state is
+ * serialized into memory, then compression runs on a worker thread while
+ * the guest keeps running. Block devices stay drained until the snapshot is
+ * created, with guest requests queued, so the disk matches the saved RAM.
+ *
+ * Compressed VM states keep the xemu extra data in front, so it can still
+ * be read without decompressing, followed by:
+ *   be32 SNAPSHOT_COMPRESSED_MAGIC, be64 raw size, be64 compressed size
+ * and a zstd frame of the regular migration stream.
+ *
+ * A snapshot saved to a file holds the same VM state after a header naming
+ * the disk-only snapshot of the block devices that goes with it:
+ *   be32 SNAPSHOT_FILE_MAGIC, be32 version, be64 date_sec, be32 date_nsec,
+ *   be64 vm_clock_nsec, be16 name length, name
+ * The file is written next to the image in one sequential pass, so the
+ * image only gets a snapshot table entry and no VM state clusters.
+ */
+#define SNAPSHOT_COMPRESSED_MAGIC 0x787a7374 /* 'xzst' */
+#define SNAPSHOT_COMPRESSED_HEADER_SIZE 20
+#define SNAPSHOT_COMPRESSION_LEVEL 3
+
+#define SNAPSHOT_FILE_MAGIC 0x78736e70 /* 'xsnp' */
+#define SNAPSHOT_FILE_VERSION 1
+#define SNAPSHOT_FILE_HEADER_SIZE 30
+
+typedef struct SnapshotSaveJob {
+    QEMUSnapshotInfo sn;
+    BlockDriverState *bs;
+    /* Closing the file frees the buffer, so it stays open until the end */
+    QEMUFile *file;
+    QIOChannelBuffer *bioc;
+    size_t prefix_len;
+    /* Extra data completed with the thumbnail, replaces the stream's own */
+    GBytes *prefix;
+    uint8_t *out;
+    size_t out_len;
+    /* State file, written as tmp_path by the worker and renamed when done */
+    char *path;
+    char *tmp_path;
+    uint64_t file_size;
+    Error *file_err;
+    QemuThread thread;
+    int64_t start;
+    SnapshotSaveDoneFunc *cb;
+    void *opaque;
+} SnapshotSaveJob;
+
+static SnapshotSaveJob *snapshot_save_job;
+
+bool snapshot_save_in_progress(Error **errp)
+{
+    if (snapshot_save_job) {
+        error_setg(errp, "A snapshot is still being saved");
+        return true;
+    }
+    return false;
+}
+
+static void snapshot_save_complete_bh(void *opaque)
+{
+    SnapshotSaveJob *job = opaque;
+    Error *err = NULL;
+    uint64_t vm_state_size = 0;
+    QEMUFile *f;
+    int ret;
+
+    qemu_thread_join(&job->thread);
+
+    if (job->path) {
+        if (job->file_err) {
+            err = g_steal_pointer(&job->file_err);
+            goto the_end;
+        }
+        vm_state_size = job->file_size;
+
+        /* The file refers to a disk-only snapshot taken at the same time */
+        if (bdrv_all_create_snapshot(&job->sn, job->bs, 0,
+                                     false, NULL, &err) < 0) {
+            bdrv_all_delete_snapshot(job->sn.name, false, NULL, NULL);
+            unlink(job->tmp_path);
+        } else if (rename(job->tmp_path, job->path) < 0) {
+            error_setg_errno(&err, errno, "Could not rename '%s' to '%s'",
+                             job->tmp_path, job->path);
+            bdrv_all_delete_snapshot(job->sn.name, false, NULL, NULL);
+            unlink(job->tmp_path);
+        }
+        goto the_end;
+    }
+
+    f = qemu_fopen_bdrv(job->bs, 1);
+    if (!f) {
+        error_setg(&err, "Could not open VM state file");
+        goto the_end;
+    }
+    if (job->prefix) {
+        qemu_put_buffer(f, g_bytes_get_data(job->prefix, NULL),
+                        g_bytes_get_size(job->prefix));
+    } else {
+        qemu_put_buffer(f, job->bioc->data, job->prefix_len);
+    }
+    if (job->out) {
+        qemu_put_buffer(f, job->out, job->out_len);
+    } else {
+        qemu_put_buffer(f, job->bioc->data + job->prefix_len,
+                        job->bioc->usage - job->prefix_len);
+    }
+    vm_state_size = qemu_file_transferred(f);
+    ret = qemu_fclose(f);
+    if (ret < 0) {
+        error_setg_errno(&err, -ret, "Error while writing VM state");
+        goto the_end;
+    }
+
+    if (bdrv_all_create_snapshot(&job->sn, job->bs, vm_state_size,
+                                 false, NULL, &err) < 0) {
+        bdrv_all_delete_snapshot(job->sn.name, false, NULL, NULL);
+    }
+
+the_end:
+    bdrv_drain_all_end();
+    trace_save_snapshot_async_complete(job->sn.name, job->bioc->usage,
+                                       vm_state_size,
+                                       (get_clock() - job->start) / SCALE_MS);
+
+    snapshot_save_job = NULL;
+    job->cb(!err, err, job->opaque);
+
+    qemu_fclose(job->file);
+    object_unref(OBJECT(job->bioc));
+    if (job->prefix) {
+        g_bytes_unref(job->prefix);
+    }
+    g_free(job->out);
+    g_free(job->path);
+    g_free(job->tmp_path);
+    g_free(job);
+}
+
+static bool snapshot_save_write_file(SnapshotSaveJob *job, Error **errp)
+{
+    size_t name_len = strlen(job->sn.name);
+    uint8_t header[SNAPSHOT_FILE_HEADER_SIZE];
+    const uint8_t *parts[4];
+    size_t sizes[4];
+    int fd;
+
+    stl_be_p(header, SNAPSHOT_FILE_MAGIC);
+    stl_be_p(header + 4, SNAPSHOT_FILE_VERSION);
+    stq_be_p(header + 8, job->sn.date_sec);
+    stl_be_p(header + 16, job->sn.date_nsec);
+    stq_be_p(header + 20, job->sn.vm_clock_nsec);
+    stw_be_p(header + 28, name_len);
+
+    parts[0] = header;
+    sizes[0] = sizeof(header);
+    parts[1] = (const uint8_t *)job->sn.name;
+    sizes[1] = name_len;
+    if (job->prefix) {
+        parts[2] = g_bytes_get_data(job->prefix, &sizes[2]);
+    } else {
+        parts[2] = job->bioc->data;
+        sizes[2] = job->prefix_len;
+    }
+    if (job->out) {
+        parts[3] = job->out;
+        sizes[3] = job->out_len;
+    } else {
+        parts[3] = job->bioc->data + job->prefix_len;
+        sizes[3] = job->bioc->usage - job->prefix_len;
+    }
+
+    fd = qemu_create(job->tmp_path, O_WRONLY | O_TRUNC | O_BINARY, 0644, errp);
+    if (fd < 0) {
+        return false;
+    }
+
+    job->file_size = 0;
+    for (int i = 0; i < ARRAY_SIZE(parts); i++) {
+        if (qemu_write_full(fd, parts[i], sizes[i]) != sizes[i]) {
+            error_setg_errno(errp, errno, "Could not write '%s'",
+                             job->tmp_path);
+            goto fail;
+        }
+        job->file_size += sizes[i];
+    }
+
+    if (qemu_fdatasync(fd) < 0) {
+        error_setg_errno(errp, errno, "Could not write '%s'", job->tmp_path);
+        goto fail;
+    }
+    qemu_close(fd);
+    return true;
+
+fail:
+    qemu_close(fd);
+    unlink(job->tmp_path);
+    return false;
+}
+
+/*
+ * Compress a migration stream, with the header in front. Returns NULL if
+ * the stream has to be written as is.
+ */
+static uint8_t *snapshot_compress(const uint8_t *data, size_t size,
+                                  size_t *out_len)
+{
+#ifdef CONFIG_ZSTD
+    size_t bound = ZSTD_compressBound(size);
+    size_t header_len = SNAPSHOT_COMPRESSED_HEADER_SIZE;
+    uint8_t *out = g_try_malloc(header_len + bound);
+    size_t n;
+
+    if (!out) {
+        return NULL;
+    }
+
+    n = ZSTD_compress(out + header_len, bound, data, size,
+                      SNAPSHOT_COMPRESSION_LEVEL);
+    if (ZSTD_isError(n)) {
+        warn_report("Snapshot compression failed: %s", ZSTD_getErrorName(n));
+        g_free(out);
+        return NULL;
+    }
+
+    stl_be_p(out, SNAPSHOT_COMPRESSED_MAGIC);
+    stq_be_p(out + 4, size);
+    stq_be_p(out + 12, n);
+    *out_len = header_len + n;
+    return out;
+#else
+    return NULL;
+#endif
+}
+
+static void *snapshot_save_compress_thread(void *opaque)
+{
+    SnapshotSaveJob *job = opaque;
+
+    job->out = snapshot_compress(job->bioc->data + job->prefix_len,
+                                 job->bioc->usage - job->prefix_len,
+                                 &job->out_len);
+
+    /* The thumbnail is encoded meanwhile on the UI side */
+    if (job->prefix_len) {
+        job->prefix = xemu_snapshots_finish_extra_data();
+    }
+
+    if (job->path) {
+        snapshot_save_write_file(job, &job->file_err);
+    }
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), snapshot_save_complete_bh,
+                            job);
+    return NULL;
+}
+
+bool save_snapshot_async(const char *name, bool overwrite, const char *path,
+                         SnapshotSaveDoneFunc *cb, void *opaque,
+                         Error **errp)
+{
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    RunState saved_state = runstate_get();
+    SnapshotSaveJob *job;
+    BlockDriverState *bs;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (!migrate_can_snapshot(errp) || migration_is_blocked(errp) ||
+        snapshot_save_in_progress(errp) ||
+        !bdrv_all_can_snapshot(false, NULL, errp)) {
+        return false;
+    }
+
+    if (name) {
+        if (overwrite) {
+            if (bdrv_all_delete_snapshot(name, false, NULL, errp) < 0) {
+                return false;
+            }
+        } else {
+            ret = bdrv_all_has_snapshot(name, false, NULL, errp);
+            if (ret < 0) {
+                return false;
+            }
+            if (ret == 1) {
+                error_setg(errp,
+                           "Snapshot '%s' already exists in one or more devices",
+                           name);
+                return false;
+            }
+        }
+    }
+
+    bs = bdrv_all_find_vmstate_bs(NULL, false, NULL, errp);
+    if (!bs) {
+        return false;
+    }
+
+    job = g_new0(SnapshotSaveJob, 1);
+    job->bs = bs;
+    if (path) {
+        job->path = g_strdup(path);
+        job->tmp_path = g_strconcat(path, ".tmp", NULL);
+    }
+    job->cb = cb;
+    job->opaque = opaque;
+    job->start = get_clock();
+
+    global_state_store();
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    bdrv_drain_all_begin();
+
+    job->sn.date_sec = g_date_time_to_unix(now);
+    job->sn.date_nsec = g_date_time_get_microsecond(now) * 1000;
+    job->sn.vm_clock_nsec = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    job->sn.icount = -1ULL;
+    if (name) {
+        pstrcpy(job->sn.name, sizeof(job->sn.name), name);
+    } else {
+        g_autofree char *autoname = g_date_time_format(now,  "vm-%Y%m%d%H%M%S");
+        pstrcpy(job->sn.name, sizeof(job->sn.name), autoname);
+    }
+
+    /* Freeze the VM state into memory, the guest resumes right after */
+    job->bioc = qio_channel_buffer_new(256 * MiB);
+    job->file = qemu_file_new_output(QIO_CHANNEL(job->bioc));
+    ret = qemu_savevm_state(job->file, errp);
+    if (ret == 0 && qemu_fflush(job->file) < 0) {
+        error_setg(errp, "Error while writing VM state");
+        ret = -EIO;
+    }
+
+    vm_resume(saved_state);
+
+    if (ret < 0) {
+        bdrv_drain_all_end();
+        qemu_fclose(job->file);
+        object_unref(OBJECT(job->bioc));
+        g_free(job->path);
+        g_free(job->tmp_path);
+        g_free(job);
+        return false;
+    }
+
+    /* The extra data stays uncompressed so it can be listed cheaply */
+    if (job->bioc->usage >= 12 &&
+        ldl_be_p(job->bioc->data) == XEMU_SNAPSHOT_DATA_MAGIC) {
+        job->prefix_len = 12 + ldl_be_p(job->bioc->data + 8);
+    }
+
+    trace_save_snapshot_async_frozen(job->sn.name, job->bioc->usage,
+                                     (get_clock() - job->start) / SCALE_MS);
+
+    snapshot_save_job = job;
+    qemu_thread_create(&job->thread, "snapshot-save",
+                       snapshot_save_compress_thread, job,
+                       QEMU_THREAD_JOINABLE);
+    return true;
+}
+
+/*
+ * Open a stream over the VM state of a snapshot. The whole state is read
+ * with a few large requests instead of one request per QEMUFile buffer,
+ * and a compressed state is decompressed straight from that copy.
+ */
+#define SNAPSHOT_LOAD_CHUNK (64 * MiB)
+
+/* The VM state starts at @start in @buffer, which is owned by the stream */
+static QEMUFile *snapshot_open_vmstate_buffer(uint8_t *buffer, size_t start,
+                                              uint64_t vm_state_size,
+                                              Error **errp)
+{
+    g_autofree uint8_t *buf = buffer;
+    QIOChannelBuffer *bioc;
+    uint64_t pos = start;
+    QEMUFile *f;
+
+    /* Skip the extra data, it is read again by qemu_loadvm_state() */
+    if (vm_state_size - start >= 12 &&
+        ldl_be_p(buf + start) == XEMU_SNAPSHOT_DATA_MAGIC) {
+        pos += 12 + (uint64_t)ldl_be_p(buf + start + 8);
+    }
+
+    if (pos + SNAPSHOT_COMPRESSED_HEADER_SIZE <= vm_state_size &&
+        ldl_be_p(buf + pos) == SNAPSHOT_COMPRESSED_MAGIC) {
+#ifdef CONFIG_ZSTD
+        uint64_t raw_size = ldq_be_p(buf + pos + 4);
+        uint64_t size = ldq_be_p(buf + pos + 12);
+        uint8_t *data = buf + pos + SNAPSHOT_COMPRESSED_HEADER_SIZE;
+        uint8_t *raw;
+        size_t n;
+
+        if (size > vm_state_size - pos - SNAPSHOT_COMPRESSED_HEADER_SIZE) {
+            error_setg(errp, "Compressed VM state is truncated");
+            return NULL;
+        }
+
+        raw = g_try_malloc(raw_size);
+        if (!raw) {
+            error_setg(errp, "Could not allocate %" PRIu64
+                       " bytes for VM state", raw_size);
+            return NULL;
+        }
+
+        n = ZSTD_decompress(raw, raw_size, data, size);
+        if (ZSTD_isError(n) || n != raw_size) {
+            error_setg(errp, "Compressed VM state is corrupt");
+            g_free(raw);
+            return NULL;
+        }
+
+        g_free(buf);
+        buf = raw;
+        start = 0;
+        vm_state_size = raw_size;
+#else
+        error_setg(errp, "Snapshot is compressed, but zstd support is missing");
+        return NULL;
+#endif
+    }
+
+    bioc = qio_channel_buffer_new(0);
+    g_free(bioc->data);
+    bioc->data = g_steal_pointer(&buf);
+    bioc->capacity = bioc->usage = vm_state_size;
+    bioc->offset = start;
+    f = qemu_file_new_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+    return f;
+}
+
+static QEMUFile *snapshot_open_vmstate(BlockDriverState *bs,
+                                       uint64_t vm_state_size, Error **errp)
+{
+    g_autofree uint8_t *buf = g_try_malloc(vm_state_size);
+    size_t pos = 0;
+
+    if (!buf) {
+        error_setg(errp, "Could not allocate %" PRIu64 " bytes for VM state",
+                   vm_state_size);
+        return NULL;
+    }
+
+    while (pos < vm_state_size) {
+        int len = MIN(vm_state_size - pos, SNAPSHOT_LOAD_CHUNK);
+        int ret = bdrv_load_vmstate(bs, buf + pos, pos, len);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Could not read VM state");
+            return NULL;
+        }
+        pos += len;
+    }
+
+    return snapshot_open_vmstate_buffer(g_steal_pointer(&buf), 0,
+                                        vm_state_size, errp);
+}
+
+/* Reset the machine and load the VM state from @f, which is closed */
+static int snapshot_load_stream(QEMUFile *f, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    int ret;
+
+    qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
+    mis->from_src_file = f;
+
+    if (!yank_register_instance(MIGRATION_YANK_INSTANCE, errp)) {
+        qemu_fclose(f);
+        mis->from_src_file = NULL;
+        return -EINVAL;
+    }
+    ret = qemu_loadvm_state(f, errp);
+    migration_incoming_state_destroy();
+    if (ret < 0) {
+        return ret;
+    }
+
+    quicksave_invalidate();
+    return 0;
+}
+
+static bool snapshot_file_parse_header(const char *path, const uint8_t *buf,
+                                       size_t size, QEMUSnapshotInfo *sn,
+                                       size_t *header_len, Error **errp)
+{
+    size_t name_len;
+
+    if (size < SNAPSHOT_FILE_HEADER_SIZE ||
+        ldl_be_p(buf) != SNAPSHOT_FILE_MAGIC) {
+        error_setg(errp, "'%s' is not a snapshot file", path);
+        return false;
+    }
+    if (ldl_be_p(buf + 4) != SNAPSHOT_FILE_VERSION) {
+        error_setg(errp, "Unsupported snapshot file version %u in '%s'",
+                   ldl_be_p(buf + 4), path);
+        return false;
+    }
+
+    name_len = lduw_be_p(buf + 28);
+    if (name_len >= sizeof(sn->name) ||
+        size < SNAPSHOT_FILE_HEADER_SIZE + name_len) {
+        error_setg(errp, "Snapshot file '%s' is truncated", path);
+        return false;
+    }
+
+    memset(sn, 0, sizeof(*sn));
+    sn->date_sec = ldq_be_p(buf + 8);
+    sn->date_nsec = ldl_be_p(buf + 16);
+    sn->vm_clock_nsec = ldq_be_p(buf + 20);
+    sn->icount = -1ULL;
+    memcpy(sn->name, buf + SNAPSHOT_FILE_HEADER_SIZE, name_len);
+    *header_len = SNAPSHOT_FILE_HEADER_SIZE + name_len;
+    return true;
+}
+
+bool snapshot_file_read_info(const char *path, QEMUSnapshotInfo *sn,
+                             GBytes **extra_data, Error **errp)
+{
+    uint8_t buf[SNAPSHOT_FILE_HEADER_SIZE + sizeof(sn->name) + 12];
+    size_t header_len, len;
+    struct stat st;
+    bool ok = false;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        error_setg_errno(errp, errno, "Could not open '%s'", path);
+        return false;
+    }
+
+    len = fread(buf, 1, sizeof(buf), f);
+    if (!snapshot_file_parse_header(path, buf, len, sn, &header_len, errp)) {
+        goto out;
+    }
+    if (fstat(fileno(f), &st) < 0) {
+        error_setg_errno(errp, errno, "Could not stat '%s'", path);
+        goto out;
+    }
+    sn->vm_state_size = st.st_size;
+
+    if (extra_data) {
+        const uint8_t *p = buf + header_len;
+        uint8_t *data;
+        uint32_t size;
+
+        if (len < header_len + 12 || ldl_be_p(p) != XEMU_SNAPSHOT_DATA_MAGIC ||
+            ldl_be_p(p + 4) != XEMU_SNAPSHOT_DATA_VERSION) {
+            *extra_data = g_bytes_new(NULL, 0);
+            ok = true;
+            goto out;
+        }
+
+        size = ldl_be_p(p + 8);
+        if (size > st.st_size - header_len - 12 ||
+            fseek(f, header_len + 12, SEEK_SET) < 0) {
+            error_setg(errp, "Snapshot file '%s' is truncated", path);
+            goto out;
+        }
+        data = g_malloc(size);
+        if (fread(data, 1, size, f) != size) {
+            error_setg(errp, "Could not read '%s'", path);
+            g_free(data);
+            goto out;
+        }
+        *extra_data = g_bytes_new_take(data, size);
+    }
+    ok = true;
+
+out:
+    fclose(f);
+    return ok;
+}
+
+bool load_snapshot_file(const char *path, Error **errp)
+{
+    g_autofree gchar *buf = NULL;
+    BlockDriverState *bs_vm_state;
+    QEMUSnapshotInfo sn, disk_sn;
+    g_autoptr(GError) gerr = NULL;
+    size_t header_len;
+    gsize size;
+    QEMUFile *f;
+    int ret;
+
+    if (!migrate_can_snapshot(errp) || snapshot_save_in_progress(errp) ||
+        !bdrv_all_can_snapshot(false, NULL, errp)) {
+        return false;
+    }
+
+    /* Read in one go, the file is laid out for sequential access */
+    if (!g_file_get_contents(path, &buf, &size, &gerr)) {
+        error_setg(errp, "Could not read '%s': %s", path, gerr->message);
+        return false;
+    }
+    if (!snapshot_file_parse_header(path, (uint8_t *)buf, size, &sn,
+                                    &header_len, errp)) {
+        return false;
+    }
+
+    ret = bdrv_all_has_snapshot(sn.name, false, NULL, errp);
+    if (ret < 0) {
+        return false;
+    }
+    if (ret == 0) {
+        error_setg(errp, "Snapshot '%s' does not exist in one or more devices",
+                   sn.name);
+        return false;
+    }
+
+    bs_vm_state = bdrv_all_find_vmstate_bs(NULL, false, NULL, errp);
+    if (!bs_vm_state) {
+        return false;
+    }
+
+    /* A snapshot saved later under the same name leaves the file stale */
+    if (bdrv_snapshot_find(bs_vm_state, &disk_sn, sn.name) < 0 ||
+        disk_sn.date_sec != sn.date_sec || disk_sn.date_nsec != sn.date_nsec) {
+        error_setg(errp, "Snapshot '%s' in the image does not match '%s'",
+                   sn.name, path);
+        return false;
+    }
+
+    bdrv_drain_all_begin();
+
+    ret = bdrv_all_goto_snapshot(sn.name, false, NULL, errp);
+    if (ret < 0) {
+        goto err_drain;
+    }
+
+    f = snapshot_open_vmstate_buffer((uint8_t *)g_steal_pointer(&buf),
+                                     header_len, size, errp);
+    if (!f) {
+        goto err_drain;
+    }
+
+    ret = snapshot_load_stream(f, errp);
+    bdrv_drain_all_end();
+    return ret == 0;
+
+err_drain:
+    bdrv_drain_all_end();
+    return false;
+}
+
+bool save_vmstate_file(const char *path, Error **errp)
+{
+    g_autofree char *tmp = g_strconcat(path, ".tmp", NULL);
+    QIOChannelBuffer *bioc;
+    size_t prefix_len = 0;
+    size_t out_len = 0;
+    uint8_t *out = NULL;
+    QEMUFile *f;
+    bool ok = false;
+    FILE *file;
+    int ret;
+
+    GLOBAL_STATE_CODE();
+
+    if (!migrate_can_snapshot(errp) || migration_is_blocked(errp) ||
+        snapshot_save_in_progress(errp)) {
+        return false;
+    }
+
+    global_state_store();
+
+    /* Requests in flight would not be part of the state */
+    bdrv_drain_all_begin();
+    bioc = qio_channel_buffer_new(256 * MiB);
+    f = qemu_file_new_output(QIO_CHANNEL(bioc));
+    ret = qemu_savevm_state(f, errp);
+    if (ret == 0 && qemu_fflush(f) < 0) {
+        error_setg(errp, "Error while writing VM state");
+        ret = -EIO;
+    }
+    bdrv_drain_all_end();
+    if (ret < 0) {
+        goto out;
+    }
+
+    if (bioc->usage >= 12 && ldl_be_p(bioc->data) == XEMU_SNAPSHOT_DATA_MAGIC) {
+        prefix_len = 12 + ldl_be_p(bioc->data + 8);
+    }
+    out = snapshot_compress(bioc->data + prefix_len, bioc->usage - prefix_len,
+                            &out_len);
+
+    file = fopen(tmp, "wb");
+    if (!file) {
+        error_setg_errno(errp, errno, "Could not create '%s'", tmp);
+        goto out;
+    }
+    fwrite(bioc->data, 1, prefix_len, file);
+    if (out) {
+        fwrite(out, 1, out_len, file);
+    } else {
+        fwrite(bioc->data + prefix_len, 1, bioc->usage - prefix_len, file);
+    }
+    if (ferror(file) | fclose(file)) {
+        error_setg(errp, "Could not write '%s'", tmp);
+        unlink(tmp);
+        goto out;
+    }
+    if (rename(tmp, path) < 0) {
+        error_setg_errno(errp, errno, "Could not rename '%s'", tmp);
+        unlink(tmp);
+        goto out;
+    }
+    ok = true;
+
+out:
+    g_free(out);
+    qemu_fclose(f);
+    object_unref(OBJECT(bioc));
+    return ok;
+}
+
+bool load_vmstate_file(const char *path, Error **errp)
+{
+    g_autoptr(GError) gerr = NULL;
+    gchar *buf;
+    gsize size;
+    QEMUFile *f;
+    int ret;
+
+    if (!migrate_can_snapshot(errp) || snapshot_save_in_progress(errp)) {
+        return false;
+    }
+
+    if (!g_file_get_contents(path, &buf, &size, &gerr)) {
+        error_setg(errp, "Could not read '%s': %s", path, gerr->message);
+        return false;
+    }
+
+    bdrv_drain_all_begin();
+    f = snapshot_open_vmstate_buffer((uint8_t *)buf, 0, size, errp);
+    ret = f ? snapshot_load_stream(f, errp) : -EINVAL;
+    bdrv_drain_all_end();
+    return ret == 0;
+}
+#endif
+
 void qmp_xen_save_devices_state(const char *filename, bool has_live, bool live,
                                 Error **errp)
 {
@@ -3406,6 +4159,12 @@ bool load_snapshot(const char *name, const char *vmstate,
         return false;
     }
 
+#ifdef XBOX
+    if (snapshot_save_in_progress(errp)) {
+        return false;
+    }
+#endif
+
     if (!bdrv_all_can_snapshot(has_devices, devices, errp)) {
         return false;
     }
@@ -3450,11 +4209,18 @@ bool load_snapshot(const char *name, const char *vmstate,
     }
 
     /* restore the VM state */
+#ifdef XBOX
+    f = snapshot_open_vmstate(bs_vm_state, sn.vm_state_size, errp);
+    if (!f) {
+        goto err_drain;
+    }
+#else
     f = qemu_fopen_bdrv(bs_vm_state, 0);
     if (!f) {
         error_setg(errp, "Could not open VM state file");
         goto err_drain;
     }
+#endif
 
     qemu_system_reset(SHUTDOWN_CAUSE_SNAPSHOT_LOAD);
     mis->from_src_file = f;
@@ -3472,6 +4238,10 @@ bool load_snapshot(const char *name, const char *vmstate,
         return false;
     }
 
+#ifdef XBOX
+    quicksave_invalidate();
+#endif
+
     return true;
 
 err_drain:
@@ -82,6 +82,9 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
 int net_init_pcap(const Netdev *netdev, const char *name,
                   NetClientState *peer, Error **errp);
 
+int net_init_relay(const Netdev *netdev, const char *name,
+                   NetClientState *peer, Error **errp);
+
 #ifdef CONFIG_VMNET
 int net_init_vmnet_host(const Netdev *netdev, const char *name,
                           NetClientState *peer, Error **errp);
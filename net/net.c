@@ -1309,6 +1309,7 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
         [NET_CLIENT_DRIVER_L2TPV3]    = net_init_l2tpv3,
 #endif
         [NET_CLIENT_DRIVER_PCAP]      = net_init_pcap,
+        [NET_CLIENT_DRIVER_RELAY]     = net_init_relay,
 #ifdef CONFIG_VMNET
         [NET_CLIENT_DRIVER_VMNET_HOST] = net_init_vmnet_host,
         [NET_CLIENT_DRIVER_VMNET_SHARED] = net_init_vmnet_shared,
@@ -27,15 +27,37 @@
 #include "qapi/error.h"
 #include "qemu/iov.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "net/pcap.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_packet.h>
+#endif
+
 #if 0
 #define LOG(fmt, ...) fprintf(stderr, "%s: " fmt "\n", __func__, ##__VA_ARGS__)
 #else
 #define LOG(...) do {} while (0)
 #endif
 
+#ifdef CONFIG_LINUX
+/*
+ * On Linux, frames are received through a TPACKET_V3 ring shared with the
+ * kernel rather than through libpcap. The kernel fills whole blocks of
+ * frames, which are passed to the peer straight from the ring and handed
+ * back together. A block is retired after RING_BLOCK_TIMEOUT_MS even if it
+ * isn't full, which bounds the added latency.
+ */
+#define RING_BLOCK_SIZE (128 * KiB)
+#define RING_BLOCK_COUNT 32
+#define RING_FRAME_SIZE 2048
+#define RING_BLOCK_TIMEOUT_MS 1
+#define RING_PROTOCOL 0x0003 /* ETH_P_ALL */
+#endif
+
 typedef struct NetPcapState {
     NetClientState nc;
     char *ifname;
@@ -46,6 +68,12 @@ typedef struct NetPcapState {
     int fd;
     bool read_poll;
 #endif
+#ifdef CONFIG_LINUX
+    uint8_t *ring; // NULL when reading through libpcap
+    unsigned int ring_block;     // Block to read next
+    unsigned int ring_block_pkt; // Frames of it already sent
+    struct tpacket3_hdr *ring_pkt;
+#endif
 } NetPcapState;
 
 static ssize_t net_pcap_receive(NetClientState *nc, const uint8_t *buf,
@@ -54,6 +82,16 @@ static ssize_t net_pcap_receive(NetClientState *nc, const uint8_t *buf,
     NetPcapState *s = DO_UPCAST(NetPcapState, nc, nc);
     LOG("qemu->pcap %zd bytes...", size);
 
+#ifdef CONFIG_LINUX
+    if (s->ring) {
+        if (send(s->fd, buf, size, MSG_DONTWAIT) < 0) {
+            LOG("send failed: %s", strerror(errno));
+            return -1;
+        }
+        return size;
+    }
+#endif
+
     if (pcap_sendpacket(s->p, buf, size)) {
         LOG("pcap_sendpacket failed!\n");
         return -1;
@@ -67,8 +105,18 @@ static void net_pcap_cleanup(NetClientState *nc)
     NetPcapState *s = DO_UPCAST(NetPcapState, nc, nc);
 #if defined(_WIN32)
     qemu_del_wait_object(s->fd, NULL, NULL);
+#else
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
 #endif
-    pcap_close(s->p);
+#ifdef CONFIG_LINUX
+    if (s->ring) {
+        munmap(s->ring, RING_BLOCK_SIZE * RING_BLOCK_COUNT);
+        close(s->fd);
+    }
+#endif
+    if (s->p) {
+        pcap_close(s->p);
+    }
     free(s->ifname);
 }
 
@@ -119,9 +167,17 @@ static void net_pcap_send(void *opaque)
 }
 
 #if !defined(_WIN32)
+static void net_pcap_ring_send(void *opaque);
+
 static void net_pcap_update_fd_handler(NetPcapState *s)
 {
-    qemu_set_fd_handler(s->fd, s->read_poll ? net_pcap_send : NULL, NULL, s);
+    IOHandler *handler = net_pcap_send;
+#ifdef CONFIG_LINUX
+    if (s->ring) {
+        handler = net_pcap_ring_send;
+    }
+#endif
+    qemu_set_fd_handler(s->fd, s->read_poll ? handler : NULL, NULL, s);
 }
 
 static void net_pcap_read_poll(NetPcapState *s, bool enable)
@@ -131,6 +187,124 @@ static void net_pcap_read_poll(NetPcapState *s, bool enable)
 }
 #endif
 
+#ifdef CONFIG_LINUX
+static void net_pcap_ring_send_completed(NetClientState *nc, ssize_t len)
+{
+    NetPcapState *s = DO_UPCAST(NetPcapState, nc, nc);
+    net_pcap_read_poll(s, true);
+}
+
+/* Returns false if the peer queued the frame and can't take more for now */
+static bool net_pcap_ring_send_frame(NetPcapState *s,
+                                     const struct tpacket3_hdr *pkt)
+{
+    const uint8_t *buf = (const uint8_t *)pkt + pkt->tp_mac;
+    size_t size = pkt->tp_snaplen;
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+
+    if (size < 14) {
+        return true;
+    }
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+            buf = min_pkt;
+            size = min_pktsz;
+        }
+    }
+
+    LOG("ring->qemu %zd bytes", size);
+    return qemu_send_packet_async(&s->nc, buf, size,
+                                  net_pcap_ring_send_completed) != 0;
+}
+
+static void net_pcap_ring_send(void *opaque)
+{
+    NetPcapState *s = opaque;
+
+    while (s->read_poll) {
+        struct tpacket_block_desc *block =
+            (void *)(s->ring + s->ring_block * RING_BLOCK_SIZE);
+        if (!(qatomic_load_acquire(&block->hdr.bh1.block_status) &
+              TP_STATUS_USER)) {
+            break;
+        }
+
+        while (s->ring_block_pkt < block->hdr.bh1.num_pkts) {
+            struct tpacket3_hdr *pkt =
+                s->ring_block_pkt ?
+                    s->ring_pkt :
+                    (void *)((uint8_t *)block +
+                             block->hdr.bh1.offset_to_first_pkt);
+            s->ring_pkt = (void *)((uint8_t *)pkt + pkt->tp_next_offset);
+            s->ring_block_pkt++;
+
+            if (!net_pcap_ring_send_frame(s, pkt)) {
+                // The frame was copied, resume after it once the peer drains
+                net_pcap_read_poll(s, false);
+                return;
+            }
+        }
+
+        qatomic_store_release(&block->hdr.bh1.block_status, TP_STATUS_KERNEL);
+        s->ring_block = (s->ring_block + 1) % RING_BLOCK_COUNT;
+        s->ring_block_pkt = 0;
+    }
+}
+
+/* Set up a receive ring on ifname, or return NULL to use libpcap instead */
+static uint8_t *net_pcap_ring_open(const char *ifname, int *fd_out)
+{
+    unsigned int ifindex = if_nametoindex(ifname);
+    if (!ifindex) {
+        return NULL;
+    }
+
+    int fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(RING_PROTOCOL));
+    if (fd < 0) {
+        return NULL;
+    }
+
+    int version = TPACKET_V3;
+    struct tpacket_req3 req = {
+        .tp_block_size = RING_BLOCK_SIZE,
+        .tp_block_nr = RING_BLOCK_COUNT,
+        .tp_frame_size = RING_FRAME_SIZE,
+        .tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_COUNT,
+        .tp_retire_blk_tov = RING_BLOCK_TIMEOUT_MS,
+    };
+    struct packet_mreq mreq = {
+        .mr_ifindex = ifindex,
+        .mr_type = PACKET_MR_PROMISC,
+    };
+    struct sockaddr_ll addr = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(RING_PROTOCOL),
+        .sll_ifindex = ifindex,
+    };
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version,
+                   sizeof(version)) ||
+        setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) ||
+        setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq,
+                   sizeof(mreq)) ||
+        bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        LOG("failed to set up ring: %s", strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    void *ring = mmap(NULL, RING_BLOCK_SIZE * RING_BLOCK_COUNT,
+                      PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+
+    *fd_out = fd;
+    return ring;
+}
+#endif
+
 int net_init_pcap(const Netdev *netdev, const char *name, NetClientState *peer,
                   Error **errp)
 {
@@ -148,6 +322,22 @@ int net_init_pcap(const Netdev *netdev, const char *name, NetClientState *peer,
     }
 #endif
 
+#ifdef CONFIG_LINUX
+    int ring_fd;
+    uint8_t *ring = net_pcap_ring_open(pcap_opts->ifname, &ring_fd);
+    if (ring) {
+        nc = qemu_new_net_client(&net_pcap_info, peer, "pcap", name);
+        s = DO_UPCAST(NetPcapState, nc, nc);
+        s->ifname = strdup(pcap_opts->ifname);
+        s->fd = ring_fd;
+        s->ring = ring;
+
+        LOG("Initialized ring with interface %s", s->ifname);
+        net_pcap_read_poll(s, true);
+        return 0;
+    }
+#endif
+
     pcap_t *p = pcap_open_live(pcap_opts->ifname, 65536, promisc, 1, err);
     if (p == NULL) {
         error_setg(errp, "failed to open interface '%s' for capture: %s",
@@ -0,0 +1,694 @@
+/*
+ * QEMU multi-peer UDP relay network client
+ *
+ * Exchanges Ethernet frames with any number of peers over one UDP socket, so
+ * a system link session between several instances does not need an external
+ * bridge. Frames for a known MAC address go to the peer it was learned from,
+ * everything else is flooded to all peers. In hub mode frames are also
+ * forwarded between peers, and unknown senders are accepted as new peers.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "net/net.h"
+#include "net/eth.h"
+#include "net/relay.h"
+#include "clients.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/bswap.h"
+#include "qemu/sockets.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "trace.h"
+
+#define RELAY_MAGIC 0x784c5259 /* "xLRY" */
+#define RELAY_VERSION 1
+
+#define RELAY_MAX_DGRAM 8192
+#define RELAY_MAX_FRAME \
+    (RELAY_MAX_DGRAM - sizeof(RelayHeader) - sizeof(uint16_t))
+#define RELAY_BATCH 32
+#define RELAY_PING_INTERVAL_MS 1000
+#define RELAY_PEER_TIMEOUT_MS 10000
+
+enum {
+    RELAY_MSG_DATA,
+    RELAY_MSG_PING,
+    RELAY_MSG_PONG,
+};
+
+/*
+ * Every datagram starts with this header. DATA is followed by @count frames,
+ * each prefixed with its big endian length. PING and PONG carry the sender's
+ * clock in @timestamp, which the PONG echoes back.
+ */
+typedef struct QEMU_PACKED RelayHeader {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint16_t count;
+    uint32_t seq;
+    uint64_t timestamp;
+} RelayHeader;
+
+typedef struct RelayPeer {
+    struct sockaddr_in addr;
+    bool learned;
+    int64_t last_rx_ms;
+
+    /* Outgoing frames waiting for the next flush */
+    uint8_t tx_buf[RELAY_MAX_DGRAM];
+    size_t tx_len;
+    uint16_t tx_count;
+    uint32_t tx_seq;
+
+    /* Sequence tracking for loss over the current ping interval */
+    bool rx_seq_valid;
+    uint32_t rx_seq_next;
+    uint32_t interval_rx;
+    uint32_t interval_lost;
+
+    NetRelayPeerStats stats;
+} RelayPeer;
+
+typedef struct NetRelayState {
+    NetClientState nc;
+    int fd;
+    bool read_poll;
+    bool hub;
+    uint32_t aggregate_us;
+
+    RelayPeer *peers[NET_RELAY_MAX_PEERS];
+    int num_peers;
+    GHashTable *macs; /* MAC address -> RelayPeer */
+
+    QEMUTimer *flush_timer;
+    QEMUTimer *ping_timer;
+
+    uint8_t rx_buf[RELAY_BATCH][RELAY_MAX_DGRAM];
+} NetRelayState;
+
+static void net_relay_flush(NetRelayState *s);
+
+static int64_t relay_clock_ms(void)
+{
+    return qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+}
+
+static void relay_header_init(RelayHeader *hdr, uint8_t type, uint32_t seq,
+                              uint64_t timestamp)
+{
+    hdr->magic = cpu_to_be32(RELAY_MAGIC);
+    hdr->version = RELAY_VERSION;
+    hdr->type = type;
+    hdr->count = 0;
+    hdr->seq = cpu_to_be32(seq);
+    hdr->timestamp = cpu_to_be64(timestamp);
+}
+
+static uint64_t relay_mac_key(const uint8_t *mac)
+{
+    uint64_t key = 0;
+    memcpy(&key, mac, ETH_ALEN);
+    return key;
+}
+
+static RelayPeer *relay_find_peer(NetRelayState *s,
+                                  const struct sockaddr_in *addr)
+{
+    for (int i = 0; i < s->num_peers; i++) {
+        RelayPeer *p = s->peers[i];
+        if (p->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            p->addr.sin_port == addr->sin_port) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static RelayPeer *relay_add_peer(NetRelayState *s,
+                                 const struct sockaddr_in *addr, bool learned)
+{
+    if (s->num_peers >= NET_RELAY_MAX_PEERS) {
+        return NULL;
+    }
+
+    RelayPeer *p = g_new0(RelayPeer, 1);
+    p->addr = *addr;
+    p->learned = learned;
+    p->last_rx_ms = relay_clock_ms();
+    p->stats.rtt_us = -1;
+    snprintf(p->stats.addr, sizeof(p->stats.addr), "%s:%d",
+             inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+    p->stats.learned = learned;
+    s->peers[s->num_peers++] = p;
+
+    trace_net_relay_peer_add(p->stats.addr, learned);
+    return p;
+}
+
+static gboolean relay_mac_is_peer(gpointer key, gpointer value,
+                                  gpointer user_data)
+{
+    return value == user_data;
+}
+
+static void relay_remove_peer(NetRelayState *s, int index)
+{
+    RelayPeer *p = s->peers[index];
+
+    trace_net_relay_peer_remove(p->stats.addr);
+    g_hash_table_foreach_remove(s->macs, relay_mac_is_peer, p);
+    s->peers[index] = s->peers[--s->num_peers];
+    g_free(p);
+}
+
+static void relay_update_info_str(NetRelayState *s)
+{
+    qemu_set_info_str(&s->nc, "relay: %d peer%s%s", s->num_peers,
+                      s->num_peers == 1 ? "" : "s", s->hub ? ", hub" : "");
+}
+
+/* Append a frame to the peer's pending datagram */
+static void relay_queue_frame(NetRelayState *s, RelayPeer *p,
+                              const uint8_t *buf, size_t size)
+{
+    if (p->tx_len + sizeof(uint16_t) + size > sizeof(p->tx_buf)) {
+        net_relay_flush(s);
+    }
+
+    if (!p->tx_len) {
+        p->tx_len = sizeof(RelayHeader);
+    }
+
+    stw_be_p(&p->tx_buf[p->tx_len], size);
+    memcpy(&p->tx_buf[p->tx_len + sizeof(uint16_t)], buf, size);
+    p->tx_len += sizeof(uint16_t) + size;
+    p->tx_count++;
+    p->stats.tx_frames++;
+}
+
+/*
+ * Queue a frame for the peer its destination was learned from, or for all
+ * peers but @from if the destination is unknown or not unicast.
+ */
+static void relay_route_frame(NetRelayState *s, RelayPeer *from,
+                              const uint8_t *buf, size_t size)
+{
+    RelayPeer *dst = NULL;
+
+    if (!(buf[0] & 1)) {
+        uint64_t key = relay_mac_key(buf);
+        dst = g_hash_table_lookup(s->macs, &key);
+    }
+
+    if (dst) {
+        if (dst != from) {
+            relay_queue_frame(s, dst, buf, size);
+        }
+        return;
+    }
+
+    for (int i = 0; i < s->num_peers; i++) {
+        if (s->peers[i] != from) {
+            relay_queue_frame(s, s->peers[i], buf, size);
+        }
+    }
+}
+
+static void relay_schedule_flush(NetRelayState *s)
+{
+    if (!s->aggregate_us) {
+        net_relay_flush(s);
+    } else if (!timer_pending(s->flush_timer)) {
+        timer_mod(s->flush_timer,
+                  qemu_clock_get_us(QEMU_CLOCK_REALTIME) + s->aggregate_us);
+    }
+}
+
+static void relay_send_batch(NetRelayState *s, struct iovec *iov,
+                             struct sockaddr_in **addrs, int count)
+{
+#ifdef CONFIG_SENDMMSG
+    struct mmsghdr msgs[RELAY_BATCH];
+
+    for (int i = 0; i < count; i++) {
+        msgs[i] = (struct mmsghdr) {
+            .msg_hdr = {
+                .msg_name = addrs[i],
+                .msg_namelen = sizeof(*addrs[i]),
+                .msg_iov = &iov[i],
+                .msg_iovlen = 1,
+            },
+        };
+    }
+
+    int sent = 0;
+    while (sent < count) {
+        int ret = RETRY_ON_EINTR(sendmmsg(s->fd, &msgs[sent], count - sent, 0));
+        if (ret <= 0) {
+            /* Datagrams are best effort, a full socket buffer drops them */
+            trace_net_relay_send_dropped(count - sent, errno);
+            break;
+        }
+        sent += ret;
+    }
+    trace_net_relay_send_batch(count);
+#else
+    for (int i = 0; i < count; i++) {
+        ssize_t ret = RETRY_ON_EINTR(
+            sendto(s->fd, iov[i].iov_base, iov[i].iov_len, 0,
+                   (struct sockaddr *)addrs[i], sizeof(*addrs[i])));
+        if (ret < 0) {
+            trace_net_relay_send_dropped(1, errno);
+        }
+    }
+#endif
+}
+
+/* Send the pending datagram of every peer, RELAY_BATCH per syscall */
+static void net_relay_flush(NetRelayState *s)
+{
+    struct iovec iov[RELAY_BATCH];
+    struct sockaddr_in *addrs[RELAY_BATCH];
+    int count = 0;
+
+    timer_del(s->flush_timer);
+
+    for (int i = 0; i < s->num_peers; i++) {
+        RelayPeer *p = s->peers[i];
+        if (!p->tx_count) {
+            continue;
+        }
+
+        RelayHeader *hdr = (RelayHeader *)p->tx_buf;
+        relay_header_init(hdr, RELAY_MSG_DATA, p->tx_seq++, 0);
+        hdr->count = cpu_to_be16(p->tx_count);
+
+        iov[count] = (struct iovec) { p->tx_buf, p->tx_len };
+        addrs[count] = &p->addr;
+        if (++count == RELAY_BATCH) {
+            relay_send_batch(s, iov, addrs, count);
+            count = 0;
+        }
+
+        /* The buffers stay untouched until the batch has gone out */
+        p->tx_len = 0;
+        p->tx_count = 0;
+    }
+
+    if (count) {
+        relay_send_batch(s, iov, addrs, count);
+    }
+}
+
+static void net_relay_flush_timer(void *opaque)
+{
+    net_relay_flush(opaque);
+}
+
+static void relay_send_control(NetRelayState *s, RelayPeer *p, uint8_t type,
+                               uint32_t seq, uint64_t timestamp)
+{
+    RelayHeader hdr;
+    ssize_t ret;
+
+    relay_header_init(&hdr, type, seq, timestamp);
+    ret = RETRY_ON_EINTR(sendto(s->fd, (void *)&hdr, sizeof(hdr), 0,
+                                (struct sockaddr *)&p->addr, sizeof(p->addr)));
+    if (ret < 0) {
+        trace_net_relay_send_dropped(1, errno);
+    }
+}
+
+/* Count sequence gaps as lost datagrams, late arrivals undo the count */
+static void relay_track_seq(RelayPeer *p, uint32_t seq)
+{
+    if (p->rx_seq_valid) {
+        int32_t delta = seq - p->rx_seq_next;
+        if (delta < 0) {
+            if (p->interval_lost) {
+                p->interval_lost--;
+            }
+            p->interval_rx++;
+            return;
+        }
+        p->interval_lost += delta;
+    }
+
+    p->rx_seq_valid = true;
+    p->rx_seq_next = seq + 1;
+    p->interval_rx++;
+}
+
+static void net_relay_ping_timer(void *opaque)
+{
+    NetRelayState *s = opaque;
+    int64_t now = relay_clock_ms();
+
+    for (int i = s->num_peers - 1; i >= 0; i--) {
+        RelayPeer *p = s->peers[i];
+
+        if (p->learned && now - p->last_rx_ms > RELAY_PEER_TIMEOUT_MS) {
+            relay_remove_peer(s, i);
+            continue;
+        }
+
+        uint32_t total = p->interval_rx + p->interval_lost;
+        if (total) {
+            p->stats.loss = (float)p->interval_lost / total;
+        } else if (now - p->last_rx_ms > RELAY_PING_INTERVAL_MS * 2) {
+            p->stats.loss = 1.0f;
+        }
+        p->interval_rx = 0;
+        p->interval_lost = 0;
+
+        relay_send_control(s, p, RELAY_MSG_PING, p->tx_seq++,
+                           qemu_clock_get_us(QEMU_CLOCK_REALTIME));
+    }
+
+    relay_update_info_str(s);
+    timer_mod(s->ping_timer, now + RELAY_PING_INTERVAL_MS);
+}
+
+static ssize_t net_relay_receive(NetClientState *nc, const uint8_t *buf,
+                                 size_t size)
+{
+    NetRelayState *s = DO_UPCAST(NetRelayState, nc, nc);
+
+    if (size < ETH_HLEN || size > RELAY_MAX_FRAME) {
+        return size;
+    }
+
+    relay_route_frame(s, NULL, buf, size);
+    relay_schedule_flush(s);
+
+    return size;
+}
+
+static void net_relay_update_fd_handler(NetRelayState *s);
+
+static void net_relay_send_completed(NetClientState *nc, ssize_t len)
+{
+    NetRelayState *s = DO_UPCAST(NetRelayState, nc, nc);
+
+    if (!s->read_poll) {
+        s->read_poll = true;
+        net_relay_update_fd_handler(s);
+    }
+}
+
+static void relay_deliver_frame(NetRelayState *s, const uint8_t *buf,
+                                size_t size)
+{
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+
+    if (net_peer_needs_padding(&s->nc) &&
+        eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
+        buf = min_pkt;
+        size = min_pktsz;
+    }
+
+    if (qemu_send_packet_async(&s->nc, buf, size,
+                               net_relay_send_completed) == 0) {
+        s->read_poll = false;
+        net_relay_update_fd_handler(s);
+    }
+}
+
+static void relay_handle_data(NetRelayState *s, RelayPeer *p,
+                              const uint8_t *buf, size_t len, int count)
+{
+    size_t offset = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (offset + sizeof(uint16_t) > len) {
+            break;
+        }
+        size_t size = lduw_be_p(&buf[offset]);
+        offset += sizeof(uint16_t);
+        if (size < ETH_HLEN || offset + size > len) {
+            break;
+        }
+
+        const uint8_t *frame = &buf[offset];
+        offset += size;
+        p->stats.rx_frames++;
+
+        /* Learn where the sender lives so replies are not flooded */
+        if (!(frame[ETH_ALEN] & 1)) {
+            uint64_t key = relay_mac_key(&frame[ETH_ALEN]);
+            if (g_hash_table_lookup(s->macs, &key) != p) {
+                g_hash_table_insert(s->macs, g_memdup2(&key, sizeof(key)), p);
+            }
+        }
+
+        if (s->hub) {
+            relay_route_frame(s, p, frame, size);
+        }
+
+        relay_deliver_frame(s, frame, size);
+    }
+}
+
+static void relay_handle_datagram(NetRelayState *s,
+                                  const struct sockaddr_in *addr,
+                                  const uint8_t *buf, size_t len)
+{
+    const RelayHeader *hdr = (const RelayHeader *)buf;
+
+    if (len < sizeof(*hdr) || be32_to_cpu(hdr->magic) != RELAY_MAGIC ||
+        hdr->version != RELAY_VERSION) {
+        return;
+    }
+
+    RelayPeer *p = relay_find_peer(s, addr);
+    if (!p) {
+        if (!s->hub) {
+            return;
+        }
+        p = relay_add_peer(s, addr, true);
+        if (!p) {
+            return;
+        }
+        relay_update_info_str(s);
+    }
+    p->last_rx_ms = relay_clock_ms();
+
+    switch (hdr->type) {
+    case RELAY_MSG_DATA:
+        relay_track_seq(p, be32_to_cpu(hdr->seq));
+        relay_handle_data(s, p, buf + sizeof(*hdr), len - sizeof(*hdr),
+                          be16_to_cpu(hdr->count));
+        break;
+    case RELAY_MSG_PING:
+        relay_track_seq(p, be32_to_cpu(hdr->seq));
+        relay_send_control(s, p, RELAY_MSG_PONG, 0,
+                           be64_to_cpu(hdr->timestamp));
+        break;
+    case RELAY_MSG_PONG: {
+        int64_t rtt = qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                      be64_to_cpu(hdr->timestamp);
+        if (rtt >= 0) {
+            p->stats.rtt_us = p->stats.rtt_us < 0 ?
+                                  rtt :
+                                  (p->stats.rtt_us * 7 + rtt) / 8;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+/* Read up to RELAY_BATCH datagrams per wakeup */
+static void net_relay_send(void *opaque)
+{
+    NetRelayState *s = opaque;
+    struct sockaddr_in addrs[RELAY_BATCH];
+    size_t lens[RELAY_BATCH];
+    int count;
+
+#ifdef CONFIG_SENDMMSG
+    struct mmsghdr msgs[RELAY_BATCH];
+    struct iovec iov[RELAY_BATCH];
+
+    for (int i = 0; i < RELAY_BATCH; i++) {
+        iov[i] = (struct iovec) { s->rx_buf[i], sizeof(s->rx_buf[i]) };
+        msgs[i] = (struct mmsghdr) {
+            .msg_hdr = {
+                .msg_name = &addrs[i],
+                .msg_namelen = sizeof(addrs[i]),
+                .msg_iov = &iov[i],
+                .msg_iovlen = 1,
+            },
+        };
+    }
+
+    count = RETRY_ON_EINTR(
+        recvmmsg(s->fd, msgs, RELAY_BATCH, MSG_DONTWAIT, NULL));
+    for (int i = 0; i < count; i++) {
+        lens[i] = msgs[i].msg_len;
+    }
+#else
+    for (count = 0; count < RELAY_BATCH; count++) {
+        socklen_t addrlen = sizeof(addrs[count]);
+        ssize_t ret = RETRY_ON_EINTR(
+            recvfrom(s->fd, (void *)s->rx_buf[count], sizeof(s->rx_buf[count]),
+                     0, (struct sockaddr *)&addrs[count], &addrlen));
+        if (ret < 0) {
+            break;
+        }
+        lens[count] = ret;
+    }
+#endif
+
+    if (count <= 0) {
+        return;
+    }
+    trace_net_relay_recv_batch(count);
+
+    for (int i = 0; i < count; i++) {
+        relay_handle_datagram(s, &addrs[i], s->rx_buf[i], lens[i]);
+    }
+
+    /* Push out anything the hub forwarded */
+    relay_schedule_flush(s);
+}
+
+static void net_relay_update_fd_handler(NetRelayState *s)
+{
+    qemu_set_fd_handler(s->fd, s->read_poll ? net_relay_send : NULL, NULL, s);
+}
+
+static void net_relay_cleanup(NetClientState *nc)
+{
+    NetRelayState *s = DO_UPCAST(NetRelayState, nc, nc);
+
+    qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    close(s->fd);
+    timer_free(s->flush_timer);
+    timer_free(s->ping_timer);
+    g_hash_table_destroy(s->macs);
+    for (int i = 0; i < s->num_peers; i++) {
+        g_free(s->peers[i]);
+    }
+    s->num_peers = 0;
+}
+
+static NetClientInfo net_relay_info = {
+    .type = NET_CLIENT_DRIVER_RELAY,
+    .size = sizeof(NetRelayState),
+    .receive = net_relay_receive,
+    .cleanup = net_relay_cleanup,
+};
+
+int net_relay_get_stats(const char *name, NetRelayPeerStats *stats, int max)
+{
+    NetClientState *nc = qemu_find_netdev(name);
+    if (!nc || nc->info->type != NET_CLIENT_DRIVER_RELAY) {
+        return -1;
+    }
+
+    NetRelayState *s = DO_UPCAST(NetRelayState, nc, nc);
+    int n = MIN(s->num_peers, max);
+    for (int i = 0; i < n; i++) {
+        stats[i] = s->peers[i]->stats;
+    }
+    return n;
+}
+
+int net_init_relay(const Netdev *netdev, const char *name,
+                   NetClientState *peer, Error **errp)
+{
+    const NetdevRelayOptions *opts = &netdev->u.relay;
+    struct sockaddr_in laddr;
+    g_auto(GStrv) peers = NULL;
+    NetClientState *nc;
+    NetRelayState *s;
+    int fd;
+
+    assert(netdev->type == NET_CLIENT_DRIVER_RELAY);
+
+    if (parse_host_port(&laddr, opts->localaddr, errp) < 0) {
+        return -1;
+    }
+
+    /* Peers are separated by spaces, commas or semicolons */
+    peers = g_strsplit_set(opts->peers ? opts->peers : "", " ,;", -1);
+    GArray *peer_addrs = g_array_new(false, false, sizeof(struct sockaddr_in));
+    for (int i = 0; peers[i]; i++) {
+        struct sockaddr_in addr;
+        if (!peers[i][0]) {
+            continue;
+        }
+        if (parse_host_port(&addr, peers[i], errp) < 0) {
+            g_array_free(peer_addrs, true);
+            return -1;
+        }
+        g_array_append_val(peer_addrs, addr);
+    }
+
+    if (peer_addrs->len > NET_RELAY_MAX_PEERS) {
+        error_setg(errp, "at most %d relay peers are supported",
+                   NET_RELAY_MAX_PEERS);
+        g_array_free(peer_addrs, true);
+        return -1;
+    }
+    if (!peer_addrs->len && !(opts->has_hub && opts->hub)) {
+        error_setg(errp, "peers= is mandatory unless hub=on");
+        g_array_free(peer_addrs, true);
+        return -1;
+    }
+
+    fd = qemu_socket(PF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "can't create datagram socket");
+        g_array_free(peer_addrs, true);
+        return -1;
+    }
+    if (socket_set_fast_reuse(fd) < 0) {
+        error_setg_errno(errp, errno, "can't set socket option SO_REUSEADDR");
+        goto fail;
+    }
+    if (bind(fd, (struct sockaddr *)&laddr, sizeof(laddr)) < 0) {
+        error_setg_errno(errp, errno, "can't bind ip=%s to socket",
+                         inet_ntoa(laddr.sin_addr));
+        goto fail;
+    }
+    if (!qemu_set_blocking(fd, false, errp)) {
+        goto fail;
+    }
+
+    nc = qemu_new_net_client(&net_relay_info, peer, "relay", name);
+    s = DO_UPCAST(NetRelayState, nc, nc);
+
+    s->fd = fd;
+    s->hub = opts->has_hub && opts->hub;
+    s->aggregate_us = opts->has_aggregate_us ? opts->aggregate_us : 0;
+    s->macs = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+    for (guint i = 0; i < peer_addrs->len; i++) {
+        relay_add_peer(s, &g_array_index(peer_addrs, struct sockaddr_in, i),
+                       false);
+    }
+    g_array_free(peer_addrs, true);
+
+    s->flush_timer =
+        timer_new_us(QEMU_CLOCK_REALTIME, net_relay_flush_timer, s);
+    s->ping_timer = timer_new_ms(QEMU_CLOCK_REALTIME, net_relay_ping_timer, s);
+    timer_mod(s->ping_timer, relay_clock_ms());
+
+    relay_update_info_str(s);
+    s->read_poll = true;
+    net_relay_update_fd_handler(s);
+
+    return 0;
+
+fail:
+    close(fd);
+    g_array_free(peer_addrs, true);
+    return -1;
+}
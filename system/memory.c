@@ -2267,7 +2267,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 #ifdef XBOX
     assert((client == DIRTY_MEMORY_VGA) \
         || (client == DIRTY_MEMORY_NV2A) \
-        || (client == DIRTY_MEMORY_NV2A_TEX));
+        || (client == DIRTY_MEMORY_NV2A_TEX) \
+        || (client == DIRTY_MEMORY_SNAPSHOT) \
+        || (client == DIRTY_MEMORY_ROLLBACK));
     if (mr->alias) {
         memory_region_set_log(mr->alias, log, client);
         return;
@@ -2449,6 +2451,22 @@ bool memory_region_snapshot_get_dirty(MemoryRegion *mr, DirtyBitmapSnapshot *sna
                 memory_region_get_ram_addr(mr) + addr, size);
 }
 
+#ifdef XBOX
+bool memory_region_accumulate_and_clear_dirty(MemoryRegion *mr, hwaddr addr,
+                                              hwaddr size, unsigned client,
+                                              unsigned long *dest)
+{
+    if (mr->alias) {
+        return memory_region_accumulate_and_clear_dirty(
+            mr->alias, addr - mr->alias_offset, size, client, dest);
+    }
+
+    assert(mr->ram_block);
+    return physical_memory_accumulate_and_clear_dirty(mr, addr, size, client,
+                                                      dest);
+}
+#endif
+
 void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
 {
     if (mr->readonly != readonly) {
@@ -856,10 +856,56 @@ static inline bool access_callback_address_matches(MemAccessCallback *cb,
     return !(addr > watch_end || cb->addr > access_end);
 }
 
+/*
+ * Callbacks are looked up on every TLB fill, so keep a count of the callbacks
+ * covering each page to answer the common unwatched case without walking the
+ * list. Only updated from safe work, with all vCPUs stopped.
+ */
+static void mem_access_watched_pages_update(CPUState *cpu,
+                                            MemAccessCallback *cb, int delta)
+{
+    hwaddr first = cb->addr >> TARGET_PAGE_BITS;
+    hwaddr last = (cb->addr + cb->len - 1) >> TARGET_PAGE_BITS;
+
+    if (last >= cpu->mem_access_watched_pages_len) {
+        assert(delta > 0);
+        size_t old_len = cpu->mem_access_watched_pages_len;
+        size_t new_len = MAX(pow2ceil(last + 1), 1024);
+        cpu->mem_access_watched_pages =
+            g_renew(uint32_t, cpu->mem_access_watched_pages, new_len);
+        memset(cpu->mem_access_watched_pages + old_len, 0,
+               (new_len - old_len) * sizeof(uint32_t));
+        cpu->mem_access_watched_pages_len = new_len;
+    }
+
+    for (hwaddr page = first; page <= last; page++) {
+        cpu->mem_access_watched_pages[page] += delta;
+    }
+}
+
+static bool mem_access_range_is_watched(CPUState *cpu, hwaddr addr, hwaddr len)
+{
+    hwaddr first = addr >> TARGET_PAGE_BITS;
+    hwaddr last = (addr + len - 1) >> TARGET_PAGE_BITS;
+
+    for (hwaddr page = first;
+         page <= last && page < cpu->mem_access_watched_pages_len; page++) {
+        if (cpu->mem_access_watched_pages[page]) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len)
 {
     int ret = 0;
 
+    if (!mem_access_range_is_watched(cpu, addr, len)) {
+        return 0;
+    }
+
     MemAccessCallback *cb;
     QTAILQ_FOREACH(cb, &cpu->mem_access_callbacks, entry) {
         if (access_callback_address_matches(cb, addr, len)) {
@@ -870,55 +916,124 @@ int mem_access_callback_address_matches(CPUState *cpu, hwaddr addr, hwaddr len)
     return ret;
 }
 
-static void do_mem_access_callback_insert(CPUState *cpu, run_on_cpu_data data)
+static void mem_access_callback_flush_tlb(MemAccessCallback *cb)
+{
+    ram_addr_t ram_addr_base = memory_region_get_ram_addr(cb->mr);
+    uintptr_t host = (uintptr_t)memory_region_get_ram_ptr(cb->mr) +
+                     (cb->addr - ram_addr_base);
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        tlb_flush_host_range(cpu, host, cb->len);
+    }
+}
 
+/*
+ * Apply every queued change with all vCPUs stopped, flushing just the TLB
+ * entries that map the affected ranges.
+ */
+static void do_mem_access_callback_commit(CPUState *cpu, run_on_cpu_data data)
 {
-    MemAccessCallback *cb = (MemAccessCallback *)data.host_ptr;
-    QTAILQ_INSERT_TAIL(&cpu->mem_access_callbacks, cb, entry);
+    MemAccessCallback *cb, *next;
+
+    /* Held throughout so the queued flags can't change under us */
+    qemu_mutex_lock(&cpu->mem_access_callback_queue_lock);
+
+    QSIMPLEQ_FOREACH_SAFE(cb, &cpu->mem_access_callback_queue, queue_entry,
+                          next) {
+        if (cb->queued_insert && cb->queued_remove) {
+            /* Created and destroyed within one batch, never visible */
+            g_free(cb);
+            continue;
+        }
+
+        mem_access_callback_flush_tlb(cb);
+
+        if (cb->queued_insert) {
+            cb->queued_insert = false;
+            QTAILQ_INSERT_TAIL(&cpu->mem_access_callbacks, cb, entry);
+            mem_access_watched_pages_update(cpu, cb, 1);
+        } else {
+            QTAILQ_REMOVE(&cpu->mem_access_callbacks, cb, entry);
+            mem_access_watched_pages_update(cpu, cb, -1);
+            g_free(cb);
+        }
+    }
+
+    QSIMPLEQ_INIT(&cpu->mem_access_callback_queue);
+    cpu->mem_access_callback_commit_scheduled = false;
+    qemu_mutex_unlock(&cpu->mem_access_callback_queue_lock);
 }
 
-MemAccessCallback *mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr,
-                                              hwaddr offset, hwaddr len,
-                                              MemAccessCallbackFunc func,
-                                              void *opaque)
+MemAccessCallback *mem_access_callback_queue_insert(CPUState *cpu,
+                                                    MemoryRegion *mr,
+                                                    hwaddr offset, hwaddr len,
+                                                    MemAccessCallbackFunc func,
+                                                    void *opaque)
 {
     assert(len > 0);
 
-    MemAccessCallback *cb = g_malloc(sizeof(*cb));
+    MemAccessCallback *cb = g_malloc0(sizeof(*cb));
     cb->mr = mr;
     cb->addr = memory_region_get_ram_addr(mr) + offset;
     cb->len = len;
     cb->func = func;
     cb->opaque = opaque;
+    cb->queued_insert = true;
 
-    async_safe_run_on_cpu(cpu, do_mem_access_callback_insert,
-                          RUN_ON_CPU_HOST_PTR(cb));
-
-    // FIXME: flush only applicable pages
-    tlb_flush_all_cpus_synced(cpu);
+    qemu_mutex_lock(&cpu->mem_access_callback_queue_lock);
+    QSIMPLEQ_INSERT_TAIL(&cpu->mem_access_callback_queue, cb, queue_entry);
+    qemu_mutex_unlock(&cpu->mem_access_callback_queue_lock);
 
     return cb;
 }
 
-static void do_mem_access_callback_remove_by_ref(CPUState *cpu,
-                                                 run_on_cpu_data data)
+void mem_access_callback_queue_remove(CPUState *cpu, MemAccessCallback *cb)
 {
-    MemAccessCallback *cb = (MemAccessCallback *)data.host_ptr;
-    QTAILQ_REMOVE(&cpu->mem_access_callbacks, cb, entry);
-    g_free(cb);
+    if (!cb) {
+        return;
+    }
+
+    qemu_mutex_lock(&cpu->mem_access_callback_queue_lock);
+    assert(!cb->queued_remove);
+    cb->queued_remove = true;
+    if (!cb->queued_insert) {
+        QSIMPLEQ_INSERT_TAIL(&cpu->mem_access_callback_queue, cb, queue_entry);
+    }
+    qemu_mutex_unlock(&cpu->mem_access_callback_queue_lock);
 }
 
-void mem_access_callback_remove_by_ref(CPUState *cpu, MemAccessCallback *cb)
+void mem_access_callback_commit(CPUState *cpu)
 {
-    if (!cb) {
-        return;
+    bool schedule;
+
+    qemu_mutex_lock(&cpu->mem_access_callback_queue_lock);
+    schedule = !QSIMPLEQ_EMPTY(&cpu->mem_access_callback_queue) &&
+               !cpu->mem_access_callback_commit_scheduled;
+    cpu->mem_access_callback_commit_scheduled |= schedule;
+    qemu_mutex_unlock(&cpu->mem_access_callback_queue_lock);
+
+    if (schedule) {
+        async_safe_run_on_cpu(cpu, do_mem_access_callback_commit,
+                              RUN_ON_CPU_NULL);
     }
+}
 
-    async_safe_run_on_cpu(cpu, do_mem_access_callback_remove_by_ref,
-                          RUN_ON_CPU_HOST_PTR(cb));
+MemAccessCallback *mem_access_callback_insert(CPUState *cpu, MemoryRegion *mr,
+                                              hwaddr offset, hwaddr len,
+                                              MemAccessCallbackFunc func,
+                                              void *opaque)
+{
+    MemAccessCallback *cb =
+        mem_access_callback_queue_insert(cpu, mr, offset, len, func, opaque);
+    mem_access_callback_commit(cpu);
+    return cb;
+}
 
-    // FIXME: flush only applicable pages
-    tlb_flush_all_cpus_synced(cpu);
+void mem_access_callback_remove_by_ref(CPUState *cpu, MemAccessCallback *cb)
+{
+    mem_access_callback_queue_remove(cpu, cb);
+    mem_access_callback_commit(cpu);
 }
 
 void mem_check_access_callback_vaddr(CPUState *cpu,
@@ -933,6 +1048,10 @@ void mem_check_access_callback_vaddr(CPUState *cpu,
 void mem_check_access_callback_ramaddr(CPUState *cpu,
                                        hwaddr ram_addr, vaddr len, int flags)
 {
+    if (!mem_access_range_is_watched(cpu, ram_addr, len)) {
+        return;
+    }
+
     MemAccessCallback *cb;
     QTAILQ_FOREACH(cb, &cpu->mem_access_callbacks, entry) {
         if (access_callback_address_matches(cb, ram_addr, len)) {
@@ -1062,11 +1181,14 @@ bool physical_memory_is_clean(ram_addr_t addr)
 {
     bool nv2a = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A);
     bool nv2a_tex = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A_TEX);
+    bool snapshot = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_SNAPSHOT);
+    bool rollback = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_ROLLBACK);
     bool vga = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_VGA);
     bool code = physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_CODE);
     bool migration =
         physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_MIGRATION);
-    return !(nv2a && nv2a_tex && vga && code && migration);
+    return !(nv2a && nv2a_tex && snapshot && rollback && vga && code &&
+             migration);
 }
 
 static bool physical_memory_all_dirty(ram_addr_t start, ram_addr_t length,
@@ -1122,6 +1244,14 @@ uint8_t physical_memory_range_includes_clean(ram_addr_t start,
         !physical_memory_all_dirty(start, length, DIRTY_MEMORY_NV2A_TEX)) {
         ret |= (1 << DIRTY_MEMORY_NV2A_TEX);
     }
+    if (mask & (1 << DIRTY_MEMORY_SNAPSHOT) &&
+        !physical_memory_all_dirty(start, length, DIRTY_MEMORY_SNAPSHOT)) {
+        ret |= (1 << DIRTY_MEMORY_SNAPSHOT);
+    }
+    if (mask & (1 << DIRTY_MEMORY_ROLLBACK) &&
+        !physical_memory_all_dirty(start, length, DIRTY_MEMORY_ROLLBACK)) {
+        ret |= (1 << DIRTY_MEMORY_ROLLBACK);
+    }
     if (mask & (1 << DIRTY_MEMORY_VGA) &&
         !physical_memory_all_dirty(start, length, DIRTY_MEMORY_VGA)) {
         ret |= (1 << DIRTY_MEMORY_VGA);
@@ -1201,6 +1331,14 @@ void physical_memory_set_dirty_range(ram_addr_t start, ram_addr_t length,
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_NV2A_TEX]->blocks[idx],
                                   offset, next - page);
             }
+            if (unlikely(mask & (1 << DIRTY_MEMORY_SNAPSHOT))) {
+                bitmap_set_atomic(blocks[DIRTY_MEMORY_SNAPSHOT]->blocks[idx],
+                                  offset, next - page);
+            }
+            if (unlikely(mask & (1 << DIRTY_MEMORY_ROLLBACK))) {
+                bitmap_set_atomic(blocks[DIRTY_MEMORY_ROLLBACK]->blocks[idx],
+                                  offset, next - page);
+            }
 
             page = next;
             idx++;
@@ -1270,6 +1408,8 @@ static void physical_memory_clear_dirty_range(ram_addr_t addr, ram_addr_t length
     physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_CODE);
     physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_NV2A);
     physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_NV2A_TEX);
+    physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_SNAPSHOT);
+    physical_memory_test_and_clear_dirty(addr, length, DIRTY_MEMORY_ROLLBACK);
 }
 
 DirtyBitmapSnapshot *physical_memory_snapshot_and_clear_dirty
@@ -1347,6 +1487,72 @@ bool physical_memory_snapshot_get_dirty(DirtyBitmapSnapshot *snap,
     return false;
 }
 
+#ifdef XBOX
+bool physical_memory_accumulate_and_clear_dirty(MemoryRegion *mr,
+                                                hwaddr offset, hwaddr length,
+                                                unsigned client,
+                                                unsigned long *dest)
+{
+    DirtyMemoryBlocks *blocks;
+    ram_addr_t start;
+    unsigned long page, end, first, last, word;
+
+    start = memory_region_get_ram_addr(mr);
+    assert(start != RAM_ADDR_INVALID);
+    start += offset;
+
+    /* RAM blocks are allocated on bitmap word boundaries */
+    page = start >> TARGET_PAGE_BITS;
+    end = TARGET_PAGE_ALIGN(start + length) >> TARGET_PAGE_BITS;
+    assert(QEMU_IS_ALIGNED(page, BITS_PER_LONG));
+
+    first = end;
+    last = page;
+    word = 0;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        blocks = qatomic_rcu_read(&ram_list.dirty_memory[client]);
+
+        for (; page < end; page += BITS_PER_LONG, word++) {
+            unsigned long idx = page / DIRTY_MEMORY_BLOCK_SIZE;
+            unsigned long ofs = page % DIRTY_MEMORY_BLOCK_SIZE;
+            unsigned long *src = &blocks->blocks[idx][BIT_WORD(ofs)];
+            unsigned long bits;
+
+            /* Mostly clean, so look before paying for the exchange */
+            if (!qatomic_read(src)) {
+                continue;
+            }
+            bits = qatomic_xchg(src, 0);
+            if (end - page < BITS_PER_LONG) {
+                /* Put back bits past the end of the range */
+                unsigned long keep = bits & ~BITMAP_LAST_WORD_MASK(end - page);
+                if (keep) {
+                    qatomic_or(src, keep);
+                }
+                bits &= ~keep;
+            }
+            if (bits) {
+                dest[word] |= bits;
+                first = MIN(first, page);
+                last = page + BITS_PER_LONG;
+            }
+        }
+    }
+
+    if (first >= end) {
+        return false;
+    }
+
+    /* Only the pages that were dirty need their notdirty slow path back */
+    last = MIN(last, end);
+    physical_memory_dirty_bits_cleared(first << TARGET_PAGE_BITS,
+                                       (last - first) << TARGET_PAGE_BITS);
+    memory_region_clear_dirty_bitmap(mr, offset, length);
+    return true;
+}
+#endif
+
 uint64_t physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                                                 ram_addr_t start,
                                                 ram_addr_t pages)
@@ -1387,6 +1593,8 @@ uint64_t physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A_TEX][idx][offset], temp);
+                    qatomic_or(&blocks[DIRTY_MEMORY_SNAPSHOT][idx][offset], temp);
+                    qatomic_or(&blocks[DIRTY_MEMORY_ROLLBACK][idx][offset], temp);
 
                     if (global_dirty_tracking) {
                         qatomic_or(
@@ -156,7 +156,12 @@
 #include "ui/xemu-notifications.h"
 #include "ui/xemu-net.h"
 #include "ui/xemu-input.h"
+#include "ui/xemu-bench.h"
+#include "ui/xemu-hdd-trim.h"
+#include "ui/xemu-headless.h"
+#include "block/xdvd-cache.h"
 #include "hw/xbox/eeprom_generation.h"
+#include "hw/xbox/nv2a/nv2a.h"
 
 #define MAX_VIRTIO_CONSOLES 1
 
@@ -185,6 +190,8 @@ static const char *incoming;
 static const char *incoming_str[MIGRATION_CHANNEL_TYPE__MAX];
 static MigrationChannel *incoming_channels[MIGRATION_CHANNEL_TYPE__MAX];
 static const char *loadvm;
+static const char *nv2a_replay_path;
+static XemuBenchOptions bench_opts;
 static const char *accelerators;
 static bool have_custom_ram_size;
 static const char *ram_memdev_id;
@@ -2535,6 +2542,12 @@ static void configure_accelerators(const char *progname)
 /* Return 1 if file fails to open */
 static int xemu_check_file(const char *path)
 {
+    // Images opened through the Android storage picker are passed as fds
+    const char *fd_str;
+    if (strstart(path, "saf-fd:", &fd_str)) {
+        return fcntl(atoi(fd_str), F_GETFD) < 0;
+    }
+
     FILE *fd = qemu_fopen(path, "rb");
     if (fd == NULL) {
         return 1;
@@ -2565,6 +2578,102 @@ static char *strdup_double_commas(const char *input) {
     return output;
 }
 
+/* Raw or qcow2, told apart by the qcow2 header magic */
+static const char *get_hdd_image_format(const char *path)
+{
+    static const uint8_t qcow2_magic[] = { 'Q', 'F', 'I', 0xfb };
+    uint8_t magic[sizeof(qcow2_magic)] = { 0 };
+
+#ifdef __ANDROID__
+    const char *fd_str;
+    if (strstart(path, "saf-fd:", &fd_str)) {
+        if (pread(atoi(fd_str), magic, sizeof(magic), 0) != sizeof(magic)) {
+            return "raw";
+        }
+        return memcmp(magic, qcow2_magic, sizeof(magic)) ? "raw" : "qcow2";
+    }
+#endif
+
+    FILE *fd = qemu_fopen(path, "rb");
+    if (fd) {
+        if (fread(magic, sizeof(magic), 1, fd) != 1) {
+            memset(magic, 0, sizeof(magic));
+        }
+        fclose(fd);
+    }
+    return memcmp(magic, qcow2_magic, sizeof(magic)) ? "raw" : "qcow2";
+}
+
+/*
+ * Drive options of the hard disk. With perf.hdd_cache_overlay the image is
+ * opened under the xhdd-volatile filter, which keeps the cache partitions in
+ * RAM. The image format has to be given then, as it is not probed below a
+ * filter. perf.hdd_trim needs discard requests to reach the image.
+ */
+static char *get_hdd_drive_opts(const char *hdd_path)
+{
+    char *escaped_hdd_path = strdup_double_commas(hdd_path);
+    GString *opts = g_string_new(NULL);
+
+    g_string_append_printf(opts, "index=0,media=disk,file=%s",
+                           escaped_hdd_path);
+    if (g_config.perf.hdd_cache_overlay != CONFIG_PERF_HDD_CACHE_OVERLAY_OFF) {
+        g_string_append_printf(
+            opts, ",driver=xhdd-volatile,file.driver=%s,cache-size=%" PRIu64
+            ",writeback=%s", get_hdd_image_format(hdd_path),
+            (uint64_t)MAX(g_config.perf.hdd_cache_overlay_mb, 0) * MiB,
+            g_config.perf.hdd_cache_overlay ==
+                    CONFIG_PERF_HDD_CACHE_OVERLAY_WRITEBACK ? "on" : "off");
+    }
+    if (g_config.perf.hdd_trim) {
+        g_string_append(opts, ",discard=unmap");
+    }
+    g_string_append(opts, ",locked=on");
+    free(escaped_hdd_path);
+
+    return g_string_free(opts, false);
+}
+
+/*
+ * Code buffer size for perf.tcg.tb_size_mb. The guest has at most 128 MiB of
+ * RAM, so QEMU's default of 1 GiB is mostly wasted on small devices; when left
+ * at 0, scale with host memory instead (128 MiB on a 4 GiB phone, 64 MiB in
+ * the low memory profile).
+ */
+static int get_tcg_tb_size_mb(void)
+{
+    int size = g_config.perf.tcg.tb_size_mb;
+
+    if (size <= 0) {
+        size_t phys_mem = qemu_get_host_physmem();
+        size = phys_mem ? phys_mem / 32 / MiB : 128;
+        size = MAX(32, MIN(size, xemu_settings_low_memory_mode() ? 64 : 512));
+    }
+
+    return size;
+}
+
+static char *get_tcg_accel_opts(void)
+{
+    GString *opts = g_string_new("tcg");
+
+    if (g_config.perf.tcg.thread == CONFIG_PERF_TCG_THREAD_SINGLE) {
+        g_string_append(opts, ",thread=single");
+    } else if (g_config.perf.tcg.thread == CONFIG_PERF_TCG_THREAD_MULTI) {
+        g_string_append(opts, ",thread=multi");
+    }
+    g_string_append_printf(opts, ",tb-size=%d", get_tcg_tb_size_mb());
+    if (g_config.perf.tcg.max_insns > 0) {
+        g_string_append_printf(opts, ",tb-max-insns=%d",
+                               MIN(g_config.perf.tcg.max_insns, 512));
+    }
+    if (!g_config.perf.tcg.chain) {
+        g_string_append(opts, ",chain=off");
+    }
+
+    return g_string_free(opts, false);
+}
+
 static void qemu_validate_options(const QDict *machine_opts)
 {
     const char *kernel_filename = qdict_get_try_str(machine_opts, "kernel");
@@ -2888,6 +2997,18 @@ void qmp_x_exit_preconfig(Error **errp)
         return;
     }
 
+#ifdef XBOX
+    if (g_config.perf.hdd_trim && !loadvm) {
+        xemu_hdd_trim();
+    }
+    if (nv2a_replay_path) {
+        nv2a_replay_start(nv2a_replay_path);
+    }
+    if (bench_opts.seconds > 0) {
+        xemu_bench_start(&bench_opts, &error_fatal);
+    }
+#endif
+
     if (loadvm) {
         RunState state = autostart ? RUN_STATE_RUNNING : runstate_get();
         load_snapshot(loadvm, NULL, false, NULL, &error_fatal);
@@ -3075,6 +3196,20 @@ void qemu_init(int argc, char **argv)
     fake_argv[fake_argc++] = strdup("-m");
     fake_argv[fake_argc++] = g_strdup_printf("%d", mem);
 
+    // Tune TCG from perf.tcg unless the command line picks an accelerator
+    bool user_accel = false;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] && (strcmp(argv[i], "-accel") == 0 ||
+                        strcmp(argv[i], "--accel") == 0)) {
+            user_accel = true;
+            break;
+        }
+    }
+    if (!user_accel) {
+        fake_argv[fake_argc++] = strdup("-accel");
+        fake_argv[fake_argc++] = get_tcg_accel_opts();
+    }
+
     const char *hdd_path = g_config.sys.files.hdd_path;
     if (strlen(hdd_path) > 0) {
         if (xemu_check_file(hdd_path)) {
@@ -3083,11 +3218,7 @@ void qemu_init(int argc, char **argv)
             g_free(msg);
         } else {
             fake_argv[fake_argc++] = strdup("-drive");
-            char *escaped_hdd_path = strdup_double_commas(hdd_path);
-            fake_argv[fake_argc++] = g_strdup_printf("index=0,media=disk,file=%s%s",
-                escaped_hdd_path,
-                strlen(escaped_hdd_path) > 0 ? ",locked=on" : "");
-            free(escaped_hdd_path);
+            fake_argv[fake_argc++] = get_hdd_drive_opts(hdd_path);
         }
     }
 
@@ -3104,16 +3235,64 @@ void qemu_init(int argc, char **argv)
         }
     }
 
+    // Replay a pushbuffer capture instead of running the guest
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] && strcmp(argv[i], "-nv2a_replay") == 0) {
+            argv[i] = NULL;
+            if (i < argc - 1 && argv[i+1]) {
+                nv2a_replay_path = argv[i+1];
+                argv[i+1] = NULL;
+                autostart = 0;
+            }
+            break;
+        }
+    }
+
+    // Benchmark mode: record for -bench_seconds, then write a report and exit
+    for (int i = 1; i < argc; i++) {
+        if (!argv[i] || i == argc - 1 || !argv[i+1]) {
+            continue;
+        }
+        if (strcmp(argv[i], "-bench_seconds") == 0 ||
+            strcmp(argv[i], "-bench_warmup") == 0) {
+            char *end;
+            double value = g_ascii_strtod(argv[i+1], &end);
+            if (*end || value < 0) {
+                error_report("%s: Invalid number of seconds '%s'", argv[i],
+                             argv[i+1]);
+                exit(1);
+            }
+            if (strcmp(argv[i], "-bench_seconds") == 0) {
+                bench_opts.seconds = value;
+            } else {
+                bench_opts.warmup = value;
+            }
+        } else if (strcmp(argv[i], "-bench_input") == 0) {
+            bench_opts.input_path = argv[i+1];
+        } else if (strcmp(argv[i], "-bench_output") == 0) {
+            bench_opts.output_path = argv[i+1];
+        } else {
+            continue;
+        }
+        argv[i] = NULL;
+        argv[i+1] = NULL;
+        i++;
+    }
+
     // Always populate DVD drive. If disc path is the empty string, drive is
-    // connected but no media present.
+    // connected but no media present. Discs are read through the disc cache
+    // filter unless it is disabled.
+    xdvd_cache_set_default_size((uint64_t)MAX(g_config.perf.disc_cache_mb, 0) * MiB);
     fake_argv[fake_argc++] = strdup("-drive");
     char *escaped_dvd_path = strdup_double_commas(dvd_path);
-    fake_argv[fake_argc++] = g_strdup_printf("index=1,media=cdrom,file=%s",
-        escaped_dvd_path);
+    fake_argv[fake_argc++] = g_strdup_printf("index=1,media=cdrom,file=%s%s",
+        escaped_dvd_path,
+        strlen(escaped_dvd_path) > 0 && g_config.perf.disc_cache_mb > 0 ?
+            ",driver=xdvd-cache" : "");
     free(escaped_dvd_path);
 
     fake_argv[fake_argc++] = strdup("-display");
-    fake_argv[fake_argc++] = strdup("xemu");
+    fake_argv[fake_argc++] = strdup(xemu_headless ? "none" : "xemu");
 
     // Create USB Daughterboard for 1.0 Xbox. This is connected to Port 1 of the Root hub.
     fake_argv[fake_argc++] = strdup("-device");
@@ -4136,6 +4315,11 @@ void qemu_init(int argc, char **argv)
         qmp_x_exit_preconfig(&error_fatal);
     }
     qemu_init_displays();
+#ifdef XBOX
+    if (xemu_headless) {
+        xemu_headless_display_ready();
+    }
+#endif
     accel_setup_post(current_machine);
     if (migrate_mode() != MIG_MODE_CPR_EXEC) {
         os_setup_post();
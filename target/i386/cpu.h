@@ -2061,6 +2061,13 @@ typedef struct CPUArchState {
     uint64_t msr_rapl_power_unit;
     uint64_t msr_pkg_energy_status;
 
+#ifdef XBOX
+    /* Last pass through a candidate idle loop, see helper_idle_loop() */
+    target_ulong idle_loop_pc;
+    target_ulong idle_loop_regs[CPU_NB_REGS];
+    uint32_t idle_loop_spins;
+#endif
+
     /* Fields up to this point are cleared by a CPU reset */
     struct {} end_reset_fields;
 
@@ -60,6 +60,10 @@ DEF_HELPER_FLAGS_2(raise_exception, TCG_CALL_NO_WG, noreturn, env, int)
 DEF_HELPER_FLAGS_1(icebp, TCG_CALL_NO_WG, noreturn, env)
 DEF_HELPER_3(boundw, void, env, tl, int)
 DEF_HELPER_3(boundl, void, env, tl, int)
+#ifdef XBOX
+DEF_HELPER_4(rep_movs_fast, void, env, tl, tl, i32)
+DEF_HELPER_3(rep_stos_fast, void, env, tl, i32)
+#endif
 
 #ifndef CONFIG_USER_ONLY
 DEF_HELPER_1(rsm, void, env)
@@ -98,10 +102,13 @@ DEF_HELPER_1(rdmsr, void, env)
 DEF_HELPER_1(wrmsr, void, env)
 DEF_HELPER_FLAGS_1(read_cr8, TCG_CALL_NO_RWG, tl, env)
 DEF_HELPER_FLAGS_3(write_crN, TCG_CALL_NO_RWG, void, env, int, tl)
+#ifdef XBOX
+DEF_HELPER_FLAGS_2(idle_loop, TCG_CALL_NO_WG, void, env, tl)
+#endif
 #endif /* !CONFIG_USER_ONLY */
 
 /* x86 FPU */
-#if defined(XBOX) && defined(__x86_64__)
+#if defined(XBOX) && (defined(__x86_64__) || defined(__aarch64__))
 #define HS_DEF_HELPER_1(name, ret, t1) \
 	DEF_HELPER_1(name ## __soft, ret, t1) \
 	DEF_HELPER_1(name ## __hard, ret, t1)
@@ -73,8 +73,8 @@
 #define floatx80_ln2_d make_floatx80(0x3ffe, 0xb17217f7d1cf79abLL)
 #define floatx80_pi_d make_floatx80(0x4000, 0xc90fdaa22168c234LL)
 
-#if defined(XBOX) && defined(__x86_64__)
-#ifdef USE_HARD_FPU
+#if defined(XBOX) && (defined(__x86_64__) || defined(__aarch64__))
+#if defined(USE_HARD_FPU) && defined(__x86_64__)
 /*
  * FIXME: rounding and exceptions
  */
@@ -175,6 +175,86 @@ floatx80 int32_to_floatx80__hard(int32_t a, float_status *status)
 #define float64_to_floatx80   float64_to_floatx80__hard
 #define floatx80_to_float64   floatx80_to_float64__hard
 #define int32_to_floatx80     int32_to_floatx80__hard
+#elif defined(USE_HARD_FPU)
+/*
+ * No host type is wider than double here, so registers keep the soft
+ * floatx80 layout and arithmetic runs natively only while the precision
+ * control is single or double, where the extra bits are not observable.
+ * Extended precision falls back to softfloat.
+ *
+ * FIXME: exceptions
+ */
+
+static inline bool host_precision(float_status *status)
+{
+    return status->floatx80_rounding_precision != floatx80_precision_x;
+}
+
+static inline double to_host(floatx80 a, float_status *status)
+{
+    union {
+        float64 f64;
+        double d;
+    } x;
+
+    x.f64 = floatx80_to_float64(a, status);
+    return x.d;
+}
+
+static inline floatx80 from_host(double d, float_status *status)
+{
+    union {
+        float64 f64;
+        double d;
+    } x;
+
+    if (status->floatx80_rounding_precision == floatx80_precision_s) {
+        d = (float)d;
+    }
+    x.d = d;
+    return float64_to_floatx80(x.f64, status);
+}
+
+static inline
+floatx80 floatx80_add__hard(floatx80 a, floatx80 b, float_status *status)
+{
+    if (!host_precision(status)) {
+        return floatx80_add(a, b, status);
+    }
+    return from_host(to_host(a, status) + to_host(b, status), status);
+}
+
+static inline
+floatx80 floatx80_sub__hard(floatx80 a, floatx80 b, float_status *status)
+{
+    if (!host_precision(status)) {
+        return floatx80_sub(a, b, status);
+    }
+    return from_host(to_host(a, status) - to_host(b, status), status);
+}
+
+static inline
+floatx80 floatx80_mul__hard(floatx80 a, floatx80 b, float_status *status)
+{
+    if (!host_precision(status)) {
+        return floatx80_mul(a, b, status);
+    }
+    return from_host(to_host(a, status) * to_host(b, status), status);
+}
+
+static inline
+floatx80 floatx80_div__hard(floatx80 a, floatx80 b, float_status *status)
+{
+    if (!host_precision(status)) {
+        return floatx80_div(a, b, status);
+    }
+    return from_host(to_host(a, status) / to_host(b, status), status);
+}
+
+#define floatx80_add          floatx80_add__hard
+#define floatx80_sub          floatx80_sub__hard
+#define floatx80_mul          floatx80_mul__hard
+#define floatx80_div          floatx80_div__hard
 #endif /* USE_HARD_FPU */
 
 #ifdef USE_HARD_FPU
@@ -264,7 +344,7 @@ floatx80 int32_to_floatx80__hard(int32_t a, float_status *status)
 #define helper_fsave          MAP_HELPER_SOFT_HARD(fsave)
 #define helper_frstor         MAP_HELPER_SOFT_HARD(frstor)
 
-#endif /* defined(XBOX) && defined(__x86_64__) */
+#endif /* defined(XBOX) && (defined(__x86_64__) || defined(__aarch64__)) */
 
 static inline void fpush(CPUX86State *env)
 {
@@ -21,7 +21,9 @@
 #include "cpu.h"
 #include "exec/helper-proto.h"
 #include "accel/tcg/cpu-ldst.h"
+#include "accel/tcg/probe.h"
 #include "qemu/int128.h"
+#include "qemu/units.h"
 #include "qemu/atomic128.h"
 #include "tcg/tcg.h"
 #include "helper-tcg.h"
@@ -54,3 +56,123 @@ void helper_boundl(CPUX86State *env, target_ulong a0, int v)
         raise_exception_ra(env, EXCP05_BOUND, GETPC());
     }
 }
+
+#ifdef XBOX
+/*
+ * Bulk paths for REP MOVS/STOS with a 32-bit address size and DF clear, the
+ * shape of every memcpy and memset in the kernel and XDK libraries. Runs of
+ * plain RAM are handled a page at a time with one host copy or fill. We stop
+ * at the first element that straddles a page or touches MMIO, watched or
+ * unmapped memory, and leave it to the generic per-element loop, which also
+ * raises any fault with the registers left pointing at it.
+ */
+#define REP_FAST_MAX_BYTES (256 * KiB)
+
+/* Number of elements that fit before the end of the page or a 32-bit wrap */
+static uint32_t rep_fast_clamp(target_ulong addr, uint32_t reg,
+                               uint32_t count, MemOp ot)
+{
+    uint64_t page_left = -(addr | TARGET_PAGE_MASK);
+    uint64_t reg_left = (1ULL << 32) - reg;
+
+    return MIN(count, MIN(page_left, reg_left) >> ot);
+}
+
+void helper_rep_movs_fast(CPUX86State *env, target_ulong src,
+                          target_ulong dst, uint32_t ot)
+{
+    int mmu_idx = cpu_mmu_index(env_cpu(env), false);
+    uint32_t budget = REP_FAST_MAX_BYTES >> ot;
+    uintptr_t ra = GETPC();
+
+    if (env->df != 1) {
+        return;
+    }
+
+    while (budget) {
+        uint32_t esi = env->regs[R_ESI];
+        uint32_t edi = env->regs[R_EDI];
+        uint32_t n = MIN((uint32_t)env->regs[R_ECX], budget);
+        void *hsrc, *hdst;
+
+        n = rep_fast_clamp(src, esi, n, ot);
+        n = rep_fast_clamp(dst, edi, n, ot);
+        if (!n) {
+            break;
+        }
+
+        size_t len = (size_t)n << ot;
+        if (probe_access_flags(env, src, len, MMU_DATA_LOAD, mmu_idx, true,
+                               &hsrc, ra) ||
+            probe_access_flags(env, dst, len, MMU_DATA_STORE, mmu_idx, true,
+                               &hdst, ra)) {
+            break;
+        }
+
+        /* A destination just ahead of the source replicates the pattern */
+        if (hdst > hsrc && hdst < hsrc + len) {
+            break;
+        }
+
+        memmove(hdst, hsrc, len);
+        env->regs[R_ESI] = (uint32_t)(esi + len);
+        env->regs[R_EDI] = (uint32_t)(edi + len);
+        env->regs[R_ECX] = (uint32_t)(env->regs[R_ECX] - n);
+        src += len;
+        dst += len;
+        budget -= n;
+    }
+}
+
+void helper_rep_stos_fast(CPUX86State *env, target_ulong dst, uint32_t ot)
+{
+    int mmu_idx = cpu_mmu_index(env_cpu(env), false);
+    uint32_t budget = REP_FAST_MAX_BYTES >> ot;
+    uint32_t val = env->regs[R_EAX];
+    uintptr_t ra = GETPC();
+
+    if (env->df != 1) {
+        return;
+    }
+
+    while (budget) {
+        uint32_t edi = env->regs[R_EDI];
+        uint32_t n = MIN((uint32_t)env->regs[R_ECX], budget);
+        void *hdst;
+
+        n = rep_fast_clamp(dst, edi, n, ot);
+        if (!n) {
+            break;
+        }
+
+        size_t len = (size_t)n << ot;
+        if (probe_access_flags(env, dst, len, MMU_DATA_STORE, mmu_idx, true,
+                               &hdst, ra)) {
+            break;
+        }
+
+        switch (ot) {
+        case MO_8:
+            memset(hdst, val, len);
+            break;
+        case MO_16:
+            for (uint32_t i = 0; i < n; i++) {
+                stw_le_p(hdst + i * 2, val);
+            }
+            break;
+        case MO_32:
+            for (uint32_t i = 0; i < n; i++) {
+                stl_le_p(hdst + i * 4, val);
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+
+        env->regs[R_EDI] = (uint32_t)(edi + len);
+        env->regs[R_ECX] = (uint32_t)(env->regs[R_ECX] - n);
+        dst += len;
+        budget -= n;
+    }
+}
+#endif
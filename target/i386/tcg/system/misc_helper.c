@@ -27,6 +27,11 @@
 #include "exec/cputlb.h"
 #include "tcg/helper-tcg.h"
 #include "hw/i386/apic.h"
+#ifdef XBOX
+#include "qemu/timer.h"
+#include "system/cpus.h"
+#include "accel/tcg/runtime-stats.h"
+#endif
 
 void helper_outb(CPUX86State *env, uint32_t port, uint32_t data)
 {
@@ -521,6 +526,52 @@ G_NORETURN void helper_hlt(CPUX86State *env)
     cpu_loop_exit(cs);
 }
 
+#ifdef XBOX
+/*
+ * Called on the back edge of a block that loops to itself without storing
+ * to memory. If the loop comes around IDLE_LOOP_SPINS times with every
+ * register unchanged, it is waiting for something outside the vCPU: the
+ * kernel idle loop, or a title polling a flag set by the vblank DPC or by
+ * the GPU. Sleep like HLT until an interrupt kicks the vCPU. Cap the sleep
+ * at IDLE_LOOP_WAIT_MS, because DMA writes and polled MMIO registers can
+ * end the loop without raising an interrupt.
+ */
+#define IDLE_LOOP_SPINS   32
+#define IDLE_LOOP_WAIT_MS 1
+
+void helper_idle_loop(CPUX86State *env, target_ulong pc)
+{
+    CPUState *cs = env_cpu(env);
+    int64_t start;
+
+    if (env->idle_loop_pc != pc ||
+        memcmp(env->idle_loop_regs, env->regs, sizeof(env->idle_loop_regs))) {
+        env->idle_loop_pc = pc;
+        memcpy(env->idle_loop_regs, env->regs, sizeof(env->idle_loop_regs));
+        env->idle_loop_spins = 0;
+        return;
+    }
+    if (++env->idle_loop_spins < IDLE_LOOP_SPINS) {
+        return;
+    }
+    env->idle_loop_spins = 0;
+
+    /* Nothing but NMI could end a loop polled with interrupts masked */
+    if (!(env->eflags & IF_MASK) || bql_locked()) {
+        return;
+    }
+
+    start = get_clock();
+    bql_lock();
+    if (!cs->interrupt_request && !cs->stop &&
+        !qatomic_read(&cs->exit_request) && cpu_work_list_empty(cs)) {
+        qemu_cond_timedwait_bql(cs->halt_cond, IDLE_LOOP_WAIT_MS);
+    }
+    bql_unlock();
+    tcg_runtime_stats_add_idle(get_clock() - start, true);
+}
+#endif
+
 void helper_monitor(CPUX86State *env, target_ulong ptr)
 {
     if ((uint32_t)env->regs[R_ECX] != 0) {
@@ -37,7 +37,15 @@
 
 static int g_use_hard_fpu;
 
-#if defined(XBOX) && defined(__x86_64__)
+#if defined(XBOX) && !defined(CONFIG_USER_ONLY)
+#include "ui/xemu-settings.h"
+static bool g_park_idle_loops;
+
+/* Guest idle loops are a handful of loads, a compare and a branch */
+#define IDLE_LOOP_MAX_INSNS 16
+#endif
+
+#if defined(XBOX) && (defined(__x86_64__) || defined(__aarch64__))
 #include "ui/xemu-settings.h"
 #define MAP_GEN_HELPER_SOFT_HARD(name) \
     (g_use_hard_fpu ? gen_helper_##name##__hard : gen_helper_##name##__soft)
@@ -121,7 +129,7 @@ static int g_use_hard_fpu;
 #define gen_helper_fldenv         MAP_GEN_HELPER_SOFT_HARD(fldenv)
 #define gen_helper_fsave          MAP_GEN_HELPER_SOFT_HARD(fsave)
 #define gen_helper_frstor         MAP_GEN_HELPER_SOFT_HARD(frstor)
-#endif /* defined(XBOX) && defined(__x86_64__) */
+#endif /* defined(XBOX) && (defined(__x86_64__) || defined(__aarch64__)) */
 
 #define HELPER_H "helper.h"
 #include "exec/helper-info.c.inc"
@@ -1448,6 +1456,35 @@ static void gen_outs(DisasContext *s, MemOp ot, TCGv dshift)
 
 #define REP_MAX 65535
 
+#ifdef XBOX
+/*
+ * With a bulk helper in front, only a few elements at a page crossing or in
+ * MMIO are left for the loop, so return to the helper sooner.
+ */
+#define REP_FAST_MAX 255
+
+static bool gen_rep_fast(DisasContext *s, MemOp ot,
+                         void (*fn)(DisasContext *s, MemOp ot, TCGv dshift))
+{
+    TCGv dst;
+
+    if (s->aflag != MO_32 || (fn != gen_movs && fn != gen_stos)) {
+        return false;
+    }
+
+    dst = tcg_temp_new();
+    gen_string_movl_A0_EDI(s);
+    tcg_gen_mov_tl(dst, s->A0);
+    if (fn == gen_movs) {
+        gen_string_movl_A0_ESI(s);
+        gen_helper_rep_movs_fast(tcg_env, s->A0, dst, tcg_constant_i32(ot));
+    } else {
+        gen_helper_rep_stos_fast(tcg_env, dst, tcg_constant_i32(ot));
+    }
+    return true;
+}
+#endif
+
 static void do_gen_rep(DisasContext *s, MemOp ot, TCGv dshift,
                        void (*fn)(DisasContext *s, MemOp ot, TCGv dshift),
                        bool is_repz_nz)
@@ -1489,6 +1526,13 @@ static void do_gen_rep(DisasContext *s, MemOp ot, TCGv dshift,
     gen_update_cc_op(s);
     tcg_set_insn_start_param(s->base.insn_start, 1, CC_OP_DYNAMIC);
 
+    target_ulong rep_max = REP_MAX;
+#ifdef XBOX
+    if (can_loop && gen_rep_fast(s, ot, fn)) {
+        rep_max = REP_FAST_MAX;
+    }
+#endif
+
     /* Any iteration at all?  */
     tcg_gen_brcondi_tl(TCG_COND_TSTEQ, cpu_regs[R_ECX], cx_mask, done);
 
@@ -1528,7 +1572,7 @@ static void do_gen_rep(DisasContext *s, MemOp ot, TCGv dshift,
 
     if (can_loop) {
         tcg_gen_subi_tl(cx_next, cx_next, 1);
-        tcg_gen_brcondi_tl(TCG_COND_TSTNE, cx_next, REP_MAX, loop);
+        tcg_gen_brcondi_tl(TCG_COND_TSTNE, cx_next, rep_max, loop);
         tcg_gen_brcondi_tl(TCG_COND_TSTEQ, cx_next, cx_mask, last);
     }
 
@@ -2797,6 +2841,35 @@ gen_eob(DisasContext *s, int mode)
     s->base.is_jmp = DISAS_NORETURN;
 }
 
+#if defined(XBOX) && !defined(CONFIG_USER_ONLY)
+/*
+ * A block that branches back to its own start without storing to memory or
+ * calling helpers can only be left once an interrupt, a device or MMIO
+ * changes what it loads. Such back edges call helper_idle_loop(), which parks
+ * the vCPU once the loop stops making progress.
+ */
+static bool is_idle_loop_candidate(DisasContext *s, target_ulong new_pc)
+{
+    TCGOp *op;
+
+    if (!g_park_idle_loops || new_pc != s->base.pc_first ||
+        s->base.num_insns > IDLE_LOOP_MAX_INSNS) {
+        return false;
+    }
+
+    QTAILQ_FOREACH(op, &tcg_ctx->ops, link) {
+        const TCGOpDef *def = &tcg_op_defs[op->opc];
+
+        if (op->opc == INDEX_op_call || op->opc == INDEX_op_qemu_st ||
+            op->opc == INDEX_op_qemu_st2 ||
+            (def->flags & (TCG_OPF_VECTOR | TCG_OPF_FP))) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
 /* Jump to eip+diff, truncating the result to OT. */
 static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
 {
@@ -2835,6 +2908,12 @@ static void gen_jmp_rel(DisasContext *s, MemOp ot, int diff, int tb_num)
         new_pc = (uint32_t)(new_eip + s->cs_base);
     }
 
+#if defined(XBOX) && !defined(CONFIG_USER_ONLY)
+    if (is_idle_loop_candidate(s, new_pc)) {
+        gen_helper_idle_loop(tcg_env, tcg_constant_tl(new_pc));
+    }
+#endif
+
     if (use_goto_tb && translator_use_goto_tb(&s->base, new_pc)) {
         /* jump to same page: we can use a direct jump */
         tcg_gen_goto_tb(tb_num);
@@ -4227,9 +4306,12 @@ void tcg_x86_init(void)
     fpstt = tcg_global_mem_new_i32(tcg_env,
                                    offsetof(CPUX86State, fpstt), "fpstt");
 
-#if defined(XBOX) && defined(__x86_64__)
+#if defined(XBOX) && (defined(__x86_64__) || defined(__aarch64__))
     g_use_hard_fpu = g_config.perf.hard_fpu;
 #endif
+#if defined(XBOX) && !defined(CONFIG_USER_ONLY)
+    g_park_idle_loops = g_config.perf.park_idle_loops;
+#endif
 }
 
 static void i386_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cpu)
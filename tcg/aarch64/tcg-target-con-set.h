@@ -15,6 +15,7 @@ C_O0_I2(rz, r)
 C_O0_I2(w, r)
 C_O0_I3(rz, rz, r)
 C_O1_I1(r, r)
+C_O1_I1(r, w)
 C_O1_I1(w, r)
 C_O1_I1(w, w)
 C_O1_I1(w, wr)
@@ -28,6 +29,7 @@ C_O1_I2(r, rZ, rA)
 C_O1_I2(r, rz, rMZ)
 C_O1_I2(r, rz, rz)
 C_O1_I2(r, rZ, rZ)
+C_O1_I2(r, w, w)
 C_O1_I2(w, 0, w)
 C_O1_I2(w, w, w)
 C_O1_I2(w, w, wN)
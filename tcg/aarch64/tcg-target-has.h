@@ -28,6 +28,8 @@
 
 #define TCG_TARGET_HAS_tst              1
 
+#define TCG_TARGET_HAS_fpu              1
+
 #define TCG_TARGET_HAS_v64              1
 #define TCG_TARGET_HAS_v128             1
 #define TCG_TARGET_HAS_v256             0
@@ -32,6 +32,7 @@
 #endif
 
 #define TCG_TARGET_HAS_fpu              (TCG_TARGET_REG_BITS == 64)
+#define TCG_TARGET_HAS_fp_ext80         TCG_TARGET_HAS_fpu
 
 #define TCG_TARGET_HAS_qemu_ldst_i128 \
     (TCG_TARGET_REG_BITS == 64 && (cpuinfo & CPUINFO_ATOMIC_VMOVDQA))
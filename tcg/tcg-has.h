@@ -54,5 +54,9 @@
 #ifndef TCG_TARGET_HAS_fpu
 #define TCG_TARGET_HAS_fpu              0
 #endif
+/* ld80f, st80f, sin and cos; otherwise they become helper calls */
+#ifndef TCG_TARGET_HAS_fp_ext80
+#define TCG_TARGET_HAS_fp_ext80         0
+#endif
 
 #endif
@@ -5,6 +5,7 @@
 #include "exec/translation-block.h"
 #include "exec/plugin-gen.h"
 #include "tcg-internal.h"
+#include "tcg-has.h"
 
 static void tcg_gen_op1_i32(TCGOpcode opc, TCGv_i32 a1)
 {
@@ -18,21 +19,49 @@ void tcg_gen_flcr(TCGv_i32 arg)
 
 void tcg_gen_st80f_f32(TCGv_f32 arg, TCGv_ptr dst)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i32 t = tcg_temp_ebb_new_i32();
+        tcg_gen_mov32f_i32(t, arg);
+        gen_helper_st80f_f32(dst, t);
+        tcg_temp_free_i32(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_st80f_f32, TCG_TYPE_F32, tcgv_f32_arg(arg), tcgv_ptr_arg(dst));
 }
 
 void tcg_gen_st80f_f64(TCGv_f64 arg, TCGv_ptr dst)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i64 t = tcg_temp_ebb_new_i64();
+        tcg_gen_mov64f_i64(t, arg);
+        gen_helper_st80f_f64(dst, t);
+        tcg_temp_free_i64(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_st80f_f64, TCG_TYPE_F64, tcgv_f64_arg(arg), tcgv_ptr_arg(dst));
 }
 
 void tcg_gen_ld80f_f32(TCGv_f32 ret, TCGv_ptr src)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i32 t = tcg_temp_ebb_new_i32();
+        gen_helper_ld80f_f32(t, src);
+        tcg_gen_mov32i_f32(ret, t);
+        tcg_temp_free_i32(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_ld80f_f32, TCG_TYPE_F32, tcgv_f32_arg(ret), tcgv_ptr_arg(src));
 }
 
 void tcg_gen_ld80f_f64(TCGv_f64 ret, TCGv_ptr src)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i64 t = tcg_temp_ebb_new_i64();
+        gen_helper_ld80f_f64(t, src);
+        tcg_gen_mov64i_f64(ret, t);
+        tcg_temp_free_i64(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_ld80f_f64, TCG_TYPE_F64, tcgv_f64_arg(ret), tcgv_ptr_arg(src));
 }
 
@@ -82,11 +111,27 @@ void tcg_gen_com_f64(TCGv_i64 ret, TCGv_f64 arg1, TCGv_f64 arg2)
 
 void tcg_gen_cos_f32(TCGv_f32 ret, TCGv_f32 arg)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i32 t = tcg_temp_ebb_new_i32();
+        tcg_gen_mov32f_i32(t, arg);
+        gen_helper_cos_f32(t, t);
+        tcg_gen_mov32i_f32(ret, t);
+        tcg_temp_free_i32(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_cos_f32, TCG_TYPE_F32, tcgv_f32_arg(ret), tcgv_f32_arg(arg));
 }
 
 void tcg_gen_cos_f64(TCGv_f64 ret, TCGv_f64 arg)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i64 t = tcg_temp_ebb_new_i64();
+        tcg_gen_mov64f_i64(t, arg);
+        gen_helper_cos_f64(t, t);
+        tcg_gen_mov64i_f64(ret, t);
+        tcg_temp_free_i64(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_cos_f64, TCG_TYPE_F64, tcgv_f64_arg(ret), tcgv_f64_arg(arg));
 }
 
@@ -196,11 +241,27 @@ void tcg_gen_mul_f64(TCGv_f64 ret, TCGv_f64 arg1, TCGv_f64 arg2)
 
 void tcg_gen_sin_f32(TCGv_f32 ret, TCGv_f32 arg)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i32 t = tcg_temp_ebb_new_i32();
+        tcg_gen_mov32f_i32(t, arg);
+        gen_helper_sin_f32(t, t);
+        tcg_gen_mov32i_f32(ret, t);
+        tcg_temp_free_i32(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_sin_f32, TCG_TYPE_F32, tcgv_f32_arg(ret), tcgv_f32_arg(arg));
 }
 
 void tcg_gen_sin_f64(TCGv_f64 ret, TCGv_f64 arg)
 {
+    if (!TCG_TARGET_HAS_fp_ext80) {
+        TCGv_i64 t = tcg_temp_ebb_new_i64();
+        tcg_gen_mov64f_i64(t, arg);
+        gen_helper_sin_f64(t, t);
+        tcg_gen_mov64i_f64(ret, t);
+        tcg_temp_free_i64(t);
+        return;
+    }
     tcg_gen_op2(INDEX_op_sin_f64, TCG_TYPE_F64, tcgv_f64_arg(ret), tcgv_f64_arg(arg));
 }
 
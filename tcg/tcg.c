@@ -2623,11 +2623,17 @@ bool tcg_op_supported(TCGOpcode op, TCGType type, unsigned flags)
     case INDEX_op_cmpsel_vec:
         return has_type && TCG_TARGET_HAS_cmpsel_vec;
 
-    case INDEX_op_flcr:
     case INDEX_op_ld80f_f32:
     case INDEX_op_ld80f_f64:
     case INDEX_op_st80f_f32:
     case INDEX_op_st80f_f64:
+    case INDEX_op_cos_f32:
+    case INDEX_op_cos_f64:
+    case INDEX_op_sin_f32:
+    case INDEX_op_sin_f64:
+        return TCG_TARGET_HAS_fpu && TCG_TARGET_HAS_fp_ext80;
+
+    case INDEX_op_flcr:
     case INDEX_op_abs_f32:
     case INDEX_op_abs_f64:
     case INDEX_op_add_f32:
@@ -2636,8 +2642,6 @@ bool tcg_op_supported(TCGOpcode op, TCGType type, unsigned flags)
     case INDEX_op_chs_f64:
     case INDEX_op_com_f32:
     case INDEX_op_com_f64:
-    case INDEX_op_cos_f32:
-    case INDEX_op_cos_f64:
     case INDEX_op_cvt32f_f64:
     case INDEX_op_cvt32f_i32:
     case INDEX_op_cvt32f_i64:
@@ -2658,8 +2662,6 @@ bool tcg_op_supported(TCGOpcode op, TCGType type, unsigned flags)
     case INDEX_op_mov_f64:
     case INDEX_op_mul_f32:
     case INDEX_op_mul_f64:
-    case INDEX_op_sin_f32:
-    case INDEX_op_sin_f64:
     case INDEX_op_sqrt_f32:
     case INDEX_op_sqrt_f64:
     case INDEX_op_sub_f32:
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+#include "qemu/osdep.h"
+#include "qemu/lru.h"
+#include "qemu/timer.h"
+
+typedef struct BenchNode {
+    LruNode node;
+    uint64_t key;
+} BenchNode;
+
+static const struct {
+    const char *name;
+    unsigned int capacity;
+    unsigned int working_set;
+} benchmarks[] = {
+    { "Hits", 4096, 2048 },
+    { "Mixed", 4096, 6144 },
+    { "Misses", 1024, 1 << 20 },
+};
+
+static const unsigned int num_lookups = 4 * 1000 * 1000;
+
+static void bench_node_init(Lru *lru, LruNode *node, const void *key)
+{
+    container_of(node, BenchNode, node)->key = *(const uint64_t *)key;
+}
+
+static bool bench_node_compare(Lru *lru, LruNode *node, const void *key)
+{
+    return container_of(node, BenchNode, node)->key != *(const uint64_t *)key;
+}
+
+static uint64_t key_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void run_benchmark(unsigned int capacity, unsigned int working_set,
+                          double *ops_per_sec, double *hit_rate)
+{
+    Lru lru;
+    BenchNode *nodes = g_new0(BenchNode, capacity);
+
+    lru_init(&lru);
+    lru.init_node = bench_node_init;
+    lru.compare_nodes = bench_node_compare;
+    for (unsigned int i = 0; i < capacity; i++) {
+        lru_add_free(&lru, &nodes[i].node);
+    }
+
+    GRand *rand = g_rand_new_with_seed(1);
+    uint64_t *keys = g_new(uint64_t, num_lookups);
+    for (unsigned int i = 0; i < num_lookups; i++) {
+        keys[i] = g_rand_int_range(rand, 0, working_set);
+    }
+
+    unsigned int hits = 0;
+    int64_t start = get_clock();
+    for (unsigned int i = 0; i < num_lookups; i++) {
+        uint64_t hash = key_hash(keys[i]);
+        hits += lru_contains_hash(&lru, hash);
+        lru_lookup(&lru, hash, &keys[i]);
+    }
+    int64_t elapsed = get_clock() - start;
+
+    *ops_per_sec = num_lookups / (elapsed * 1e-9);
+    *hit_rate = (double)hits / num_lookups;
+
+    lru_flush(&lru);
+    lru_destroy(&lru);
+    g_free(keys);
+    g_rand_free(rand);
+    g_free(nodes);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("%-10s %10s %12s %10s %8s\n", "Benchmark", "Capacity",
+           "Working set", "Mops/s", "Hits");
+    for (size_t i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        double ops_per_sec, hit_rate;
+        run_benchmark(benchmarks[i].capacity, benchmarks[i].working_set,
+                      &ops_per_sec, &hit_rate);
+        printf("%-10s %10u %12u %10.2f %7.1f%%\n", benchmarks[i].name,
+               benchmarks[i].capacity, benchmarks[i].working_set,
+               ops_per_sec * 1e-6, hit_rate * 100);
+    }
+    return 0;
+}
@@ -0,0 +1,675 @@
+/*
+ * MCPX APU benchmark.
+ *
+ * Runs synthetic voice lists through the voice processor kernels, and GP/EP
+ * microcode through the DSP interpreter, against a fake guest memory region
+ * for a fixed number of frames. Results are printed as JSON like
+ * bench-xbox-nv2a.
+ *
+ * DSP images use the same text format as tests/xbox/dsp/data, one
+ * "<P|X|Y> <addr> <value>" word per line, and are given on the command line
+ * as [gp:|ep:]path. Without any, built-in synthetic programs are run.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "hw/xbox/mcpx/apu/apu_regs.h"
+#include "hw/xbox/mcpx/apu/fpconv.h"
+#include "hw/xbox/mcpx/apu/vp/adpcm_cache.h"
+#include "hw/xbox/mcpx/apu/vp/hrtf.h"
+#include "hw/xbox/mcpx/apu/vp/mix.h"
+#include "hw/xbox/mcpx/apu/vp/resample.h"
+#include "hw/xbox/mcpx/apu/vp/svf.h"
+#include "hw/xbox/mcpx/apu/dsp/dsp.h"
+#include "hw/xbox/mcpx/apu/dsp/dsp_state.h"
+
+#define GUEST_RAM_SIZE (16 * MiB)
+#define ADPCM_BLOCK_SIZE 36 /* Per channel, 65 samples */
+#define MULTIPASS_BIN 31
+
+static const int num_frames = 1500; /* One second of audio */
+static const int worker_counts[] = { 1, 2, 4, 8 };
+
+/* The DSPs run at 160 MHz, this is their budget for one 32 sample frame */
+static const int dsp_cycles_per_frame = 160000000 / 48000 * NUM_SAMPLES_PER_FRAME;
+
+static uint8_t *guest_ram;
+static size_t guest_ram_used;
+
+static const char *filter;
+static bool first_result = true;
+
+static void print_result(const char *name, const char *fields)
+{
+    printf("%s\n    { \"name\": \"%s\", %s }", first_result ? "" : ",", name,
+           fields);
+    fflush(stdout);
+    first_result = false;
+}
+
+static hwaddr guest_alloc(size_t size)
+{
+    hwaddr addr = guest_ram_used;
+    guest_ram_used += ROUND_UP(size, 64);
+    assert(guest_ram_used <= GUEST_RAM_SIZE);
+    return addr;
+}
+
+//
+// Voice processor
+//
+
+typedef enum VoiceFormat {
+    VOICE_PCM8,
+    VOICE_PCM16,
+    VOICE_ADPCM,
+    VOICE_MULTIPASS, /* Reads the multipass bin mixed by earlier voices */
+} VoiceFormat;
+
+typedef struct BenchVoice {
+    VoiceFormat format;
+    int channels;
+    bool hrtf;
+    float rate;
+    float gain;
+    int bins[8];
+
+    hwaddr addr;
+    unsigned int num_samples;
+    unsigned int pos;
+    int adpcm_block_index;
+    int16_t adpcm_decoded[ADPCM_CACHE_MAX_SAMPLES];
+
+    VpResampler resampler;
+    sv_filter svf[2];
+    HrtfFilter hrtf_filter;
+} BenchVoice;
+
+typedef struct VoiceList {
+    BenchVoice voices[MCPX_HW_MAX_VOICES];
+    int num_voices;
+    AdpcmCache adpcm_cache;
+    float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
+} VoiceList;
+
+typedef struct BenchWorker BenchWorker;
+
+typedef struct WorkerPool {
+    VoiceList *list;
+    BenchWorker *workers;
+    int num_workers;
+    bool multipass_phase;
+    bool should_exit;
+    QemuSemaphore done;
+} WorkerPool;
+
+struct BenchWorker {
+    QemuThread thread;
+    QemuSemaphore start;
+    WorkerPool *pool;
+    int id;
+    float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
+};
+
+static void add_voices(VoiceList *list, GRand *rand, int count,
+                       VoiceFormat format, int channels, bool hrtf)
+{
+    for (int i = 0; i < count; i++) {
+        assert(list->num_voices < MCPX_HW_MAX_VOICES);
+        BenchVoice *v = &list->voices[list->num_voices++];
+
+        memset(v, 0, sizeof(*v));
+        v->format = format;
+        v->channels = channels;
+        v->hrtf = hrtf;
+        v->rate = g_rand_double_range(rand, 0.25, 2.0);
+        v->gain = 0.125f;
+        v->adpcm_block_index = -1;
+
+        for (int b = 0; b < ARRAY_SIZE(v->bins); b++) {
+            // Multipass sources feed the multipass bin, nothing else does
+            v->bins[b] = (format != VOICE_MULTIPASS && g_rand_boolean(rand)) ?
+                             MULTIPASS_BIN :
+                             g_rand_int_range(rand, 0, MULTIPASS_BIN);
+        }
+
+        switch (format) {
+        case VOICE_PCM8:
+        case VOICE_PCM16: {
+            int bytes = format == VOICE_PCM8 ? 1 : 2;
+            v->num_samples = 4096;
+            v->addr = guest_alloc(v->num_samples * channels * bytes);
+            for (size_t j = 0; j < v->num_samples * channels * bytes; j++) {
+                guest_ram[v->addr + j] = g_rand_int(rand);
+            }
+            break;
+        }
+        case VOICE_ADPCM: {
+            int num_blocks = 64;
+            size_t block_size = ADPCM_BLOCK_SIZE * channels;
+            v->num_samples = num_blocks * ADPCM_SAMPLES_PER_BLOCK;
+            v->addr = guest_alloc(num_blocks * block_size);
+            for (int blk = 0; blk < num_blocks; blk++) {
+                uint8_t *p = &guest_ram[v->addr + blk * block_size];
+                for (int ch = 0; ch < channels; ch++) {
+                    stw_le_p(p, g_rand_int(rand));
+                    p[2] = g_rand_int_range(rand, 0, 89); // Step index
+                    p[3] = 0;
+                    p += 4;
+                }
+                for (int j = 0; j < 32 * channels; j++) {
+                    *p++ = g_rand_int(rand);
+                }
+            }
+            break;
+        }
+        case VOICE_MULTIPASS:
+            v->num_samples = NUM_SAMPLES_PER_FRAME;
+            break;
+        }
+
+        vp_resampler_reset(&v->resampler);
+        for (int ch = 0; ch < 2; ch++) {
+            setup_svf(&v->svf[ch], g_rand_double_range(rand, 0.05, 0.9),
+                      g_rand_double_range(rand, 0.1, 1.0), F_LP);
+        }
+
+        hrtf_filter_init(&v->hrtf_filter);
+        if (hrtf) {
+            float hrir[2][HRTF_NUM_TAPS];
+            for (int ch = 0; ch < 2; ch++) {
+                for (int k = 0; k < HRTF_NUM_TAPS; k++) {
+                    hrir[ch][k] = int8_to_float(g_rand_int(rand));
+                }
+            }
+            hrtf_filter_set_target_params(&v->hrtf_filter, hrir,
+                                          g_rand_double_range(rand, -20, 20));
+        }
+    }
+}
+
+static float get_voice_sample(VoiceList *list, BenchVoice *v, int ch)
+{
+    switch (v->format) {
+    case VOICE_PCM8:
+        return uint8_to_float(
+            guest_ram[v->addr + v->pos * v->channels + ch]);
+    case VOICE_PCM16:
+        return int16_to_float(
+            lduw_le_p(&guest_ram[v->addr + (v->pos * v->channels + ch) * 2]));
+    case VOICE_ADPCM: {
+        int block_index = v->pos / ADPCM_SAMPLES_PER_BLOCK;
+        int block_position = v->pos % ADPCM_SAMPLES_PER_BLOCK;
+        if (v->adpcm_block_index != block_index) {
+            size_t block_size = ADPCM_BLOCK_SIZE * v->channels;
+            hwaddr addr = v->addr + block_index * block_size;
+            adpcm_cache_decode(&list->adpcm_cache, addr, &guest_ram[addr],
+                               block_size, v->channels, v->adpcm_decoded);
+            v->adpcm_block_index = block_index;
+        }
+        return int16_to_float(
+            v->adpcm_decoded[block_position * v->channels + ch]);
+    }
+    case VOICE_MULTIPASS:
+        return list->mixbins[MULTIPASS_BIN][v->pos];
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void get_voice_samples(VoiceList *list, BenchVoice *v,
+                              float samples[][2], int n)
+{
+    for (int i = 0; i < n; i++) {
+        for (int ch = 0; ch < 2; ch++) {
+            samples[i][ch] = get_voice_sample(list, v, ch % v->channels);
+        }
+        v->pos = (v->pos + 1) % v->num_samples;
+    }
+}
+
+/* Same stages as voice_process in vp.c */
+static void process_voice(VoiceList *list, BenchVoice *v,
+                          float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME])
+{
+    float samples[NUM_SAMPLES_PER_FRAME][2];
+
+    int count = 0;
+    for (;;) {
+        count += vp_resampler_read(&v->resampler, &samples[count],
+                                   NUM_SAMPLES_PER_FRAME - count, v->rate,
+                                   v->channels);
+        if (count == NUM_SAMPLES_PER_FRAME) {
+            break;
+        }
+
+        float in[VP_RESAMPLE_CHUNK][2];
+        get_voice_samples(list, v, in, VP_RESAMPLE_CHUNK);
+        vp_resampler_push(&v->resampler, (const float (*)[2])in,
+                          VP_RESAMPLE_CHUNK);
+    }
+
+    for (int ch = 0; ch < 2; ch++) {
+        for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
+            samples[i][ch] = run_svf(&v->svf[ch], samples[i][ch]);
+            samples[i][ch] = fmin(fmax(samples[i][ch], -1.0), 1.0);
+        }
+    }
+
+    if (v->hrtf) {
+        hrtf_filter_process(&v->hrtf_filter, samples, samples);
+    }
+
+    float planar[2][NUM_SAMPLES_PER_FRAME];
+    vp_mix_deinterleave(planar[0], planar[1], samples, NUM_SAMPLES_PER_FRAME);
+
+    for (int b = 0; b < ARRAY_SIZE(v->bins); b++) {
+        vp_mix_accumulate(mixbins[v->bins[b]], planar[b % v->channels],
+                          v->gain, NUM_SAMPLES_PER_FRAME);
+    }
+}
+
+/* Voices are split round-robin, so each is always run by the same worker */
+static void worker_run_phase(BenchWorker *w)
+{
+    WorkerPool *pool = w->pool;
+    VoiceList *list = pool->list;
+
+    for (int i = w->id; i < list->num_voices; i += pool->num_workers) {
+        BenchVoice *v = &list->voices[i];
+        if ((v->format == VOICE_MULTIPASS) == pool->multipass_phase) {
+            process_voice(list, v, w->mixbins);
+        }
+    }
+}
+
+static void *worker_thread(void *opaque)
+{
+    BenchWorker *w = opaque;
+
+    for (;;) {
+        qemu_sem_wait(&w->start);
+        if (w->pool->should_exit) {
+            break;
+        }
+        worker_run_phase(w);
+        qemu_sem_post(&w->pool->done);
+    }
+
+    return NULL;
+}
+
+static void worker_pool_init(WorkerPool *pool, VoiceList *list,
+                             int num_workers)
+{
+    pool->list = list;
+    pool->num_workers = num_workers;
+    pool->workers = g_new0(BenchWorker, num_workers);
+    pool->should_exit = false;
+    qemu_sem_init(&pool->done, 0);
+
+    // Worker 0 runs on the calling thread
+    for (int i = 0; i < num_workers; i++) {
+        BenchWorker *w = &pool->workers[i];
+        w->pool = pool;
+        w->id = i;
+        qemu_sem_init(&w->start, 0);
+        if (i > 0) {
+            qemu_thread_create(&w->thread, "bench.voice_worker",
+                               worker_thread, w, QEMU_THREAD_JOINABLE);
+        }
+    }
+}
+
+static void worker_pool_finalize(WorkerPool *pool)
+{
+    pool->should_exit = true;
+    for (int i = 1; i < pool->num_workers; i++) {
+        qemu_sem_post(&pool->workers[i].start);
+        qemu_thread_join(&pool->workers[i].thread);
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        qemu_sem_destroy(&pool->workers[i].start);
+    }
+    qemu_sem_destroy(&pool->done);
+    g_free(pool->workers);
+}
+
+static void worker_pool_run_phase(WorkerPool *pool, bool multipass_phase)
+{
+    pool->multipass_phase = multipass_phase;
+    for (int i = 1; i < pool->num_workers; i++) {
+        qemu_sem_post(&pool->workers[i].start);
+    }
+    worker_run_phase(&pool->workers[0]);
+    for (int i = 1; i < pool->num_workers; i++) {
+        qemu_sem_wait(&pool->done);
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        BenchWorker *w = &pool->workers[i];
+        for (int b = 0; b < NUM_MIXBINS; b++) {
+            vp_mix_accumulate(pool->list->mixbins[b], w->mixbins[b], 1.0f,
+                              NUM_SAMPLES_PER_FRAME);
+        }
+        memset(w->mixbins, 0, sizeof(w->mixbins));
+    }
+}
+
+static void run_vp_frame(WorkerPool *pool)
+{
+    memset(pool->list->mixbins, 0, sizeof(pool->list->mixbins));
+    worker_pool_run_phase(pool, false);
+    worker_pool_run_phase(pool, true);
+}
+
+static void build_pcm8(VoiceList *list, GRand *rand)
+{
+    add_voices(list, rand, 64, VOICE_PCM8, 1, false);
+}
+
+static void build_pcm16(VoiceList *list, GRand *rand)
+{
+    add_voices(list, rand, 64, VOICE_PCM16, 2, false);
+}
+
+static void build_adpcm(VoiceList *list, GRand *rand)
+{
+    add_voices(list, rand, 64, VOICE_ADPCM, 1, false);
+}
+
+static void build_hrtf(VoiceList *list, GRand *rand)
+{
+    add_voices(list, rand, MCPX_HW_MAX_3D_VOICES, VOICE_PCM16, 1, true);
+}
+
+static void build_multipass(VoiceList *list, GRand *rand)
+{
+    add_voices(list, rand, 48, VOICE_PCM16, 1, false);
+    add_voices(list, rand, 16, VOICE_MULTIPASS, 1, false);
+}
+
+/* Every voice in use, roughly the mix of a busy title */
+static void build_full(VoiceList *list, GRand *rand)
+{
+    add_voices(list, rand, MCPX_HW_MAX_3D_VOICES, VOICE_ADPCM, 1, true);
+    add_voices(list, rand, 64, VOICE_ADPCM, 2, false);
+    add_voices(list, rand, 80, VOICE_PCM16, 2, false);
+    add_voices(list, rand, 32, VOICE_PCM8, 1, false);
+    add_voices(list, rand, 16, VOICE_MULTIPASS, 1, false);
+}
+
+static const struct {
+    const char *name;
+    void (*build)(VoiceList *list, GRand *rand);
+} voice_lists[] = {
+    { "pcm8", build_pcm8 },
+    { "pcm16", build_pcm16 },
+    { "adpcm", build_adpcm },
+    { "hrtf", build_hrtf },
+    { "multipass", build_multipass },
+    { "full", build_full },
+};
+
+static void run_vp_benchmarks(void)
+{
+    for (int l = 0; l < ARRAY_SIZE(voice_lists); l++) {
+        for (int w = 0; w < ARRAY_SIZE(worker_counts); w++) {
+            g_autofree char *name =
+                g_strdup_printf("vp/%s/workers=%d", voice_lists[l].name,
+                                worker_counts[w]);
+            if (filter && !strstr(name, filter)) {
+                continue;
+            }
+
+            // Same voices and guest memory contents for every run
+            guest_ram_used = 0;
+            VoiceList *list = g_new0(VoiceList, 1);
+            adpcm_cache_init(&list->adpcm_cache);
+            GRand *rand = g_rand_new_with_seed(l + 1);
+            voice_lists[l].build(list, rand);
+            g_rand_free(rand);
+
+            WorkerPool pool;
+            worker_pool_init(&pool, list, worker_counts[w]);
+
+            int64_t start = get_clock();
+            for (int f = 0; f < num_frames; f++) {
+                run_vp_frame(&pool);
+            }
+            int64_t elapsed = get_clock() - start;
+
+            worker_pool_finalize(&pool);
+            adpcm_cache_finalize(&list->adpcm_cache);
+
+            double elapsed_ms = elapsed * 1e-6;
+            g_autofree char *fields = g_strdup_printf(
+                "\"voices\": %d, \"workers\": %d, \"frames\": %d, "
+                "\"voices_per_ms\": %.1f, \"realtime_factor\": %.2f",
+                list->num_voices, worker_counts[w], num_frames,
+                list->num_voices * num_frames / elapsed_ms,
+                (num_frames * 1000.0 / 1500) / elapsed_ms);
+            print_result(name, fields);
+
+            g_free(list);
+        }
+    }
+}
+
+//
+// DSP
+//
+
+#define OP_MOVEC_FF_M0  0x05FFA0 /* movec #$ff,m0 */
+#define OP_ADD_X0_A_PM  0x44D840 /* add x0,a x:(r0)+,x0 */
+#define OP_MAC_X0_X0_A  0x200082 /* mac x0,x0,a */
+#define OP_DO_IMM(n)    (0x060080 | ((n) << 8)) /* do #n,expr */
+#define OP_JMP(addr)    (0x0C0000 | (addr)) /* jmp addr */
+
+static void dsp_scratch_rw(void *opaque, uint8_t *ptr, uint32_t addr,
+                           size_t len, bool dir)
+{
+    // Scratch space lives at the top of the fake guest memory
+    hwaddr base = GUEST_RAM_SIZE / 2;
+    addr %= GUEST_RAM_SIZE / 2 - len;
+    if (dir) {
+        memcpy(&guest_ram[base + addr], ptr, len);
+    } else {
+        memcpy(ptr, &guest_ram[base + addr], len);
+    }
+}
+
+static void dsp_fifo_rw(void *opaque, uint8_t *ptr, unsigned int index,
+                        size_t len, bool dir)
+{
+    static hwaddr cur;
+    hwaddr base = GUEST_RAM_SIZE / 4;
+
+    if (cur + len > GUEST_RAM_SIZE / 4) {
+        cur = 0;
+    }
+    if (dir) {
+        memcpy(&guest_ram[base + cur], ptr, len);
+    } else {
+        memcpy(ptr, &guest_ram[base + cur], len);
+    }
+    cur += len;
+}
+
+static void load_image(DSPState *s, const char *path)
+{
+    g_autofree char *contents = NULL;
+    g_autoptr(GError) err = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, &err)) {
+        fprintf(stderr, "Failed to load %s: %s\n", path, err->message);
+        exit(1);
+    }
+
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    for (int i = 0; lines[i]; i++) {
+        char space;
+        unsigned int addr, value;
+
+        // Other lines, like the labels in "I" lines, are ignored
+        if (!*lines[i] || !strchr("PXY", lines[i][0])) {
+            continue;
+        }
+        if (sscanf(lines[i], "%c %x %x", &space, &addr, &value) != 3) {
+            fprintf(stderr, "%s:%d: Invalid line\n", path, i + 1);
+            exit(1);
+        }
+        dsp_write_memory(s, space, addr, value);
+    }
+}
+
+/* Tight DO loop over x memory, the shape of most mixing code */
+static void load_synthetic_loop(DSPState *s)
+{
+    static const uint32_t prog[] = {
+        OP_MOVEC_FF_M0,
+        OP_DO_IMM(0x40), 0x000004,
+        OP_ADD_X0_A_PM,
+        OP_MAC_X0_X0_A,
+        OP_JMP(1),
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(prog); i++) {
+        dsp_write_memory(s, 'P', i, prog[i]);
+    }
+}
+
+/* Long straight-line code, the shape of unrolled filters */
+static void load_synthetic_straight(DSPState *s)
+{
+    dsp_write_memory(s, 'P', 0, OP_MOVEC_FF_M0);
+    for (int i = 1; i < 0x3ff; i++) {
+        dsp_write_memory(s, 'P', i, (i & 1) ? OP_ADD_X0_A_PM : OP_MAC_X0_X0_A);
+    }
+    dsp_write_memory(s, 'P', 0x3ff, OP_JMP(1));
+}
+
+/*
+ * Run frames the way gp_ep.c does, until the program idles or has used up
+ * the cycle budget of a frame.
+ */
+static void run_dsp_benchmark(const char *name, bool is_gp,
+                              void (*load)(DSPState *s), const char *path)
+{
+    if (filter && !strstr(name, filter)) {
+        return;
+    }
+
+    DSPState *s = dsp_init(NULL, dsp_scratch_rw, dsp_fifo_rw);
+    s->is_gp = is_gp;
+    s->core.is_gp = is_gp;
+    if (path) {
+        load_image(s, path);
+    } else {
+        load(s);
+    }
+
+    GRand *rand = g_rand_new_with_seed(1);
+    float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
+    for (int b = 0; b < NUM_MIXBINS; b++) {
+        for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
+            mixbins[b][i] = g_rand_double_range(rand, -1.0, 1.0);
+        }
+    }
+    g_rand_free(rand);
+
+    uint64_t total_cycles = 0;
+    int64_t start = get_clock();
+    for (int f = 0; f < num_frames; f++) {
+        if (is_gp) {
+            vp_mix_to_int24(s->core.mixbuffer, &mixbins[0][0],
+                            NUM_MIXBINS * NUM_SAMPLES_PER_FRAME);
+        }
+        dsp_start_frame(s);
+        s->core.is_idle = false;
+        s->core.cycle_count = 0;
+        do {
+            dsp_run(s, 1000);
+        } while (!s->core.is_idle &&
+                 s->core.cycle_count < dsp_cycles_per_frame);
+        total_cycles += s->core.cycle_count;
+    }
+    int64_t elapsed = get_clock() - start;
+
+    dsp_destroy(s);
+
+    g_autofree char *fields = g_strdup_printf(
+        "\"frames\": %d, \"cycles\": %" PRIu64 ", \"mips\": %.1f, "
+        "\"realtime_factor\": %.2f",
+        num_frames, total_cycles, total_cycles / (elapsed * 1e-3),
+        (num_frames * 1e9 / 1500) / elapsed);
+    print_result(name, fields);
+}
+
+static void run_dsp_benchmarks(char **images, int num_images)
+{
+    if (!num_images) {
+        run_dsp_benchmark("dsp/gp/loop", true, load_synthetic_loop, NULL);
+        run_dsp_benchmark("dsp/gp/straight", true, load_synthetic_straight,
+                          NULL);
+        run_dsp_benchmark("dsp/ep/loop", false, load_synthetic_loop, NULL);
+        return;
+    }
+
+    for (int i = 0; i < num_images; i++) {
+        const char *path = images[i];
+        bool is_gp = true;
+        if (g_str_has_prefix(path, "gp:")) {
+            path += 3;
+        } else if (g_str_has_prefix(path, "ep:")) {
+            path += 3;
+            is_gp = false;
+        }
+
+        g_autofree char *base = g_path_get_basename(path);
+        g_autofree char *name =
+            g_strdup_printf("dsp/%s/%s", is_gp ? "gp" : "ep", base);
+        run_dsp_benchmark(name, is_gp, NULL, path);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int argi = 1;
+    if (argi + 1 < argc && !strcmp(argv[argi], "--filter")) {
+        filter = argv[argi + 1];
+        argi += 2;
+    }
+    if (argi < argc && argv[argi][0] == '-') {
+        fprintf(stderr, "Usage: %s [--filter NAME] [[gp:|ep:]IMAGE...]\n",
+                argv[0]);
+        return 1;
+    }
+
+    guest_ram = g_malloc0(GUEST_RAM_SIZE);
+
+    printf("{\n  \"suite\": \"apu\",\n  \"benchmarks\": [");
+    run_vp_benchmarks();
+    run_dsp_benchmarks(&argv[argi], argc - argi);
+    printf("\n  ]\n}\n");
+
+    g_free(guest_ram);
+
+    return 0;
+}
@@ -0,0 +1,435 @@
+/*
+ * Microbenchmarks for nv2a CPU-side kernels.
+ *
+ * Results are printed as JSON so they can be compared across releases. All
+ * inputs are generated from fixed seeds and every benchmark runs a fixed
+ * amount of work, reporting the best of several repeats.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/fast-hash.h"
+#include "qemu/lru.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "hw/xbox/nv2a/debug.h"
+#include "hw/xbox/nv2a/pgraph/prim_rewrite.h"
+#include "hw/xbox/nv2a/pgraph/s3tc.h"
+#include "hw/xbox/nv2a/pgraph/swizzle.h"
+
+/* Referenced by the profile counters in prim_rewrite.c */
+NV2AStats g_nv2a_stats;
+
+typedef void (*BenchFunc)(void *opaque);
+
+static const int num_repeats = 5;
+static const size_t bytes_per_repeat = 64 * MiB;
+
+static const char *filter;
+static bool first_result = true;
+
+static void fill_random(void *buf, size_t size, uint32_t seed)
+{
+    GRand *rand = g_rand_new_with_seed(seed);
+    uint8_t *p = buf;
+
+    for (size_t i = 0; i < size; i++) {
+        p[i] = g_rand_int(rand);
+    }
+    g_rand_free(rand);
+}
+
+static unsigned int get_iterations_for_bytes(size_t bytes_per_op)
+{
+    return MAX(1, bytes_per_repeat / bytes_per_op);
+}
+
+/*
+ * Time iterations calls of fn and print the result. bytes_per_op may be zero
+ * for benchmarks without a meaningful throughput.
+ */
+static void run_benchmark(const char *name, size_t bytes_per_op,
+                          unsigned int iterations, BenchFunc fn, void *opaque)
+{
+    if (filter && !strstr(name, filter)) {
+        return;
+    }
+
+    // Warm up caches and any lazily initialized state
+    fn(opaque);
+
+    int64_t best = INT64_MAX;
+    for (int r = 0; r < num_repeats; r++) {
+        int64_t start = get_clock();
+        for (unsigned int i = 0; i < iterations; i++) {
+            fn(opaque);
+        }
+        best = MIN(best, get_clock() - start);
+    }
+
+    double ns_per_op = (double)best / iterations;
+
+    printf("%s\n    { \"name\": \"%s\", \"iterations\": %u, "
+           "\"ns_per_op\": %.1f",
+           first_result ? "" : ",", name, iterations, ns_per_op);
+    if (bytes_per_op) {
+        printf(", \"bytes_per_op\": %zu, \"mb_per_s\": %.1f", bytes_per_op,
+               bytes_per_op * 1e3 / ns_per_op);
+    }
+    printf(" }");
+    fflush(stdout);
+
+    first_result = false;
+}
+
+//
+// swizzle_rect / unswizzle_rect
+//
+
+typedef struct SwizzleBench {
+    unsigned int width, height, bytes_per_pixel;
+    uint8_t *linear;
+    uint8_t *swizzled;
+} SwizzleBench;
+
+static void bench_swizzle(void *opaque)
+{
+    SwizzleBench *b = opaque;
+    swizzle_rect(b->linear, b->width, b->height, b->swizzled,
+                 b->width * b->bytes_per_pixel, b->bytes_per_pixel);
+}
+
+static void bench_unswizzle(void *opaque)
+{
+    SwizzleBench *b = opaque;
+    unswizzle_rect(b->swizzled, b->width, b->height, b->linear,
+                   b->width * b->bytes_per_pixel, b->bytes_per_pixel);
+}
+
+static void run_swizzle_benchmarks(void)
+{
+    static const struct {
+        unsigned int size, bytes_per_pixel;
+    } shapes[] = {
+        { 64, 4 }, { 256, 4 }, { 1024, 4 }, { 256, 2 }, { 512, 1 },
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(shapes); i++) {
+        SwizzleBench b = {
+            .width = shapes[i].size,
+            .height = shapes[i].size,
+            .bytes_per_pixel = shapes[i].bytes_per_pixel,
+        };
+        size_t size = b.width * b.height * b.bytes_per_pixel;
+        b.linear = g_malloc(size);
+        b.swizzled = g_malloc(size);
+        fill_random(b.linear, size, i + 1);
+        fill_random(b.swizzled, size, i + 1);
+
+        g_autofree char *swizzle_name = g_strdup_printf(
+            "swizzle/%ux%ux%u", b.width, b.height, b.bytes_per_pixel);
+        run_benchmark(swizzle_name, size, get_iterations_for_bytes(size),
+                      bench_swizzle, &b);
+
+        g_autofree char *unswizzle_name = g_strdup_printf(
+            "unswizzle/%ux%ux%u", b.width, b.height, b.bytes_per_pixel);
+        run_benchmark(unswizzle_name, size, get_iterations_for_bytes(size),
+                      bench_unswizzle, &b);
+
+        g_free(b.linear);
+        g_free(b.swizzled);
+    }
+}
+
+//
+// s3tc_decompress_2d
+//
+
+typedef struct S3tcBench {
+    enum S3TC_DECOMPRESS_FORMAT format;
+    unsigned int width, height;
+    uint8_t *data;
+} S3tcBench;
+
+static void bench_s3tc(void *opaque)
+{
+    S3tcBench *b = opaque;
+    g_free(s3tc_decompress_2d(b->format, b->data, b->width, b->height));
+}
+
+static void run_s3tc_benchmarks(void)
+{
+    static const struct {
+        const char *name;
+        enum S3TC_DECOMPRESS_FORMAT format;
+        unsigned int block_size;
+    } formats[] = {
+        { "dxt1", S3TC_DECOMPRESS_FORMAT_DXT1, 8 },
+        { "dxt3", S3TC_DECOMPRESS_FORMAT_DXT3, 16 },
+        { "dxt5", S3TC_DECOMPRESS_FORMAT_DXT5, 16 },
+    };
+    static const unsigned int sizes[] = { 256, 1024 };
+
+    for (int f = 0; f < ARRAY_SIZE(formats); f++) {
+        for (int s = 0; s < ARRAY_SIZE(sizes); s++) {
+            S3tcBench b = {
+                .format = formats[f].format,
+                .width = sizes[s],
+                .height = sizes[s],
+            };
+            size_t size = (b.width / 4) * (b.height / 4) * formats[f].block_size;
+            b.data = g_malloc(size);
+            fill_random(b.data, size, f + 1);
+
+            // Throughput is measured in decoded texels
+            size_t decoded_size = b.width * b.height * 4;
+            g_autofree char *name = g_strdup_printf(
+                "s3tc_decompress_2d/%s/%ux%u", formats[f].name, b.width,
+                b.height);
+            run_benchmark(name, decoded_size,
+                          get_iterations_for_bytes(decoded_size), bench_s3tc,
+                          &b);
+
+            g_free(b.data);
+        }
+    }
+}
+
+//
+// pgraph_prim_rewrite_indexed
+//
+
+// More distinct inputs than cache entries, so every call does the rewrite
+#define PRIM_BENCH_NUM_INPUTS (2 * PRIM_REWRITE_CACHE_SIZE)
+
+typedef struct PrimBench {
+    PrimRewriteBuf buf;
+    PrimAssemblyState mode;
+    uint32_t *indices[PRIM_BENCH_NUM_INPUTS];
+    unsigned int num_indices;
+    unsigned int next;
+} PrimBench;
+
+static void bench_prim_rewrite(void *opaque)
+{
+    PrimBench *b = opaque;
+    pgraph_prim_rewrite_indexed(&b->buf, b->mode, b->indices[b->next],
+                                b->num_indices);
+    b->next = (b->next + 1) % PRIM_BENCH_NUM_INPUTS;
+}
+
+static void run_prim_rewrite_benchmarks(void)
+{
+    static const struct {
+        const char *name;
+        enum ShaderPrimitiveMode mode;
+    } prims[] = {
+        { "points", PRIM_TYPE_POINTS },
+        { "lines", PRIM_TYPE_LINES },
+        { "line_loop", PRIM_TYPE_LINE_LOOP },
+        { "line_strip", PRIM_TYPE_LINE_STRIP },
+        { "triangles", PRIM_TYPE_TRIANGLES },
+        { "triangle_strip", PRIM_TYPE_TRIANGLE_STRIP },
+        { "triangle_fan", PRIM_TYPE_TRIANGLE_FAN },
+        { "quads", PRIM_TYPE_QUADS },
+        { "quad_strip", PRIM_TYPE_QUAD_STRIP },
+        { "polygon", PRIM_TYPE_POLYGON },
+    };
+    static const struct {
+        const char *name;
+        enum ShaderPolygonMode mode;
+    } polygon_modes[] = {
+        { "fill", POLY_MODE_FILL },
+        { "line", POLY_MODE_LINE },
+    };
+    // Divisible by the vertex count of every primitive type
+    const unsigned int num_indices = 12 * 1024;
+
+    for (int p = 0; p < ARRAY_SIZE(prims); p++) {
+        for (int m = 0; m < ARRAY_SIZE(polygon_modes); m++) {
+            PrimBench b = {
+                .mode = {
+                    .primitive_mode = prims[p].mode,
+                    .polygon_mode = polygon_modes[m].mode,
+                },
+                .num_indices = num_indices,
+            };
+            pgraph_prim_rewrite_init(&b.buf);
+
+            GRand *rand = g_rand_new_with_seed(p + 1);
+            for (int i = 0; i < PRIM_BENCH_NUM_INPUTS; i++) {
+                b.indices[i] = g_new(uint32_t, num_indices);
+                for (unsigned int j = 0; j < num_indices; j++) {
+                    b.indices[i][j] = g_rand_int_range(rand, 0, 0x10000);
+                }
+            }
+            g_rand_free(rand);
+
+            size_t size = num_indices * sizeof(uint32_t);
+            g_autofree char *name =
+                g_strdup_printf("prim_rewrite/%s/%s", prims[p].name,
+                                polygon_modes[m].name);
+            run_benchmark(name, size, get_iterations_for_bytes(size) / 4,
+                          bench_prim_rewrite, &b);
+
+            for (int i = 0; i < PRIM_BENCH_NUM_INPUTS; i++) {
+                g_free(b.indices[i]);
+            }
+            pgraph_prim_rewrite_finalize(&b.buf);
+        }
+    }
+}
+
+//
+// fast_hash
+//
+
+typedef struct HashBench {
+    uint8_t *data;
+    size_t size;
+    uint64_t sink;
+} HashBench;
+
+static void bench_fast_hash(void *opaque)
+{
+    HashBench *b = opaque;
+    b->sink ^= fast_hash(b->data, b->size);
+}
+
+static void run_fast_hash_benchmarks(void)
+{
+    // Typical texture level sizes, from a small 32x32 A8R8G8B8 level up
+    static const size_t sizes[] = { 4 * KiB, 64 * KiB, 1 * MiB, 4 * MiB };
+
+    for (int i = 0; i < ARRAY_SIZE(sizes); i++) {
+        HashBench b = {
+            .data = g_malloc(sizes[i]),
+            .size = sizes[i],
+        };
+        fill_random(b.data, b.size, i + 1);
+
+        g_autofree char *name = g_strdup_printf("fast_hash/%zu", b.size);
+        run_benchmark(name, b.size, get_iterations_for_bytes(b.size),
+                      bench_fast_hash, &b);
+
+        g_free(b.data);
+    }
+}
+
+//
+// lru_lookup, with and without eviction
+//
+
+typedef struct LruBenchNode {
+    LruNode node;
+    uint64_t key;
+} LruBenchNode;
+
+typedef struct LruBench {
+    Lru lru;
+    LruBenchNode *nodes;
+    uint64_t *keys;
+    unsigned int num_keys;
+    unsigned int next;
+} LruBench;
+
+static void lru_bench_node_init(Lru *lru, LruNode *node, const void *key)
+{
+    container_of(node, LruBenchNode, node)->key = *(const uint64_t *)key;
+}
+
+static bool lru_bench_node_compare(Lru *lru, LruNode *node, const void *key)
+{
+    return container_of(node, LruBenchNode, node)->key !=
+           *(const uint64_t *)key;
+}
+
+static uint64_t lru_bench_key_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static void bench_lru_lookup(void *opaque)
+{
+    LruBench *b = opaque;
+    uint64_t key = b->keys[b->next];
+    lru_lookup(&b->lru, lru_bench_key_hash(key), &key);
+    b->next = (b->next + 1) % b->num_keys;
+}
+
+static void run_lru_benchmarks(void)
+{
+    static const struct {
+        const char *name;
+        unsigned int capacity;
+        unsigned int working_set;
+    } configs[] = {
+        { "hit", 1024, 512 },
+        { "evict", 1024, 64 * 1024 },
+    };
+    const unsigned int num_keys = 64 * 1024;
+    const unsigned int num_lookups = 1000 * 1000;
+
+    for (int i = 0; i < ARRAY_SIZE(configs); i++) {
+        LruBench b = {
+            .nodes = g_new0(LruBenchNode, configs[i].capacity),
+            .keys = g_new(uint64_t, num_keys),
+            .num_keys = num_keys,
+        };
+
+        lru_init(&b.lru);
+        b.lru.init_node = lru_bench_node_init;
+        b.lru.compare_nodes = lru_bench_node_compare;
+        for (unsigned int j = 0; j < configs[i].capacity; j++) {
+            lru_add_free(&b.lru, &b.nodes[j].node);
+        }
+
+        GRand *rand = g_rand_new_with_seed(i + 1);
+        for (unsigned int j = 0; j < num_keys; j++) {
+            b.keys[j] = g_rand_int_range(rand, 0, configs[i].working_set);
+        }
+        g_rand_free(rand);
+
+        g_autofree char *name = g_strdup_printf("lru_lookup/%s",
+                                                configs[i].name);
+        run_benchmark(name, 0, num_lookups, bench_lru_lookup, &b);
+
+        lru_destroy(&b.lru);
+        g_free(b.nodes);
+        g_free(b.keys);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [filter]\n", argv[0]);
+        return 1;
+    }
+    filter = argc == 2 ? argv[1] : NULL;
+
+    printf("{\n  \"suite\": \"nv2a\",\n  \"benchmarks\": [");
+    run_swizzle_benchmarks();
+    run_s3tc_benchmarks();
+    run_prim_rewrite_benchmarks();
+    run_fast_hash_benchmarks();
+    run_lru_benchmarks();
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
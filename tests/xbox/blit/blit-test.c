@@ -0,0 +1,404 @@
+/*
+ * Crosscheck and benchmark NV09F blit kernels.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define X_METHODS \
+    X(A) \
+    X(B)
+
+typedef void (*blit_copy_handler)(const uint8_t *source, uint8_t *dest,
+                                  size_t width_bytes, size_t height,
+                                  size_t source_pitch, size_t dest_pitch);
+typedef void (*blit_blend_and_handler)(const uint8_t *source, uint8_t *dest,
+                                       size_t width_pixels, size_t height,
+                                       size_t source_pitch, size_t dest_pitch,
+                                       uint32_t beta);
+typedef void (*blit_patch_alpha_handler)(uint8_t *dest, size_t width_pixels,
+                                         size_t height, size_t dest_pitch,
+                                         uint8_t alpha);
+typedef void (*blit_scale_handler)(const uint8_t *source, uint8_t *dest,
+                                   size_t width_pixels, size_t height,
+                                   size_t source_pitch, size_t dest_pitch,
+                                   size_t bytes_per_pixel,
+                                   unsigned int factor);
+
+typedef struct Method {
+    const char *name;
+    blit_copy_handler copy;
+    blit_blend_and_handler blend_and;
+    blit_patch_alpha_handler patch_alpha;
+    blit_scale_handler expand;
+    blit_scale_handler shrink;
+} Method;
+
+#define X(m) \
+    void blit_copy_ ## m(const uint8_t *source, uint8_t *dest, \
+                         size_t width_bytes, size_t height, \
+                         size_t source_pitch, size_t dest_pitch); \
+    void blit_blend_and_ ## m(const uint8_t *source, uint8_t *dest, \
+                              size_t width_pixels, size_t height, \
+                              size_t source_pitch, size_t dest_pitch, \
+                              uint32_t beta); \
+    void blit_patch_alpha_ ## m(uint8_t *dest, size_t width_pixels, \
+                                size_t height, size_t dest_pitch, \
+                                uint8_t alpha); \
+    void blit_expand_ ## m(const uint8_t *source, uint8_t *dest, \
+                           size_t width_pixels, size_t height, \
+                           size_t source_pitch, size_t dest_pitch, \
+                           size_t bytes_per_pixel, unsigned int factor); \
+    void blit_shrink_ ## m(const uint8_t *source, uint8_t *dest, \
+                           size_t width_pixels, size_t height, \
+                           size_t source_pitch, size_t dest_pitch, \
+                           size_t bytes_per_pixel, unsigned int factor);
+X_METHODS
+#undef X
+
+const Method methods[] = {
+    #define X(m) { #m, blit_copy_ ## m, blit_blend_and_ ## m, \
+                   blit_patch_alpha_ ## m, blit_expand_ ## m, \
+                   blit_shrink_ ## m },
+    X_METHODS
+    #undef X
+};
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+int widths[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 33, 64 };
+int heights[] = { 1, 2, 3, 8 };
+int pitch_adjusts[] = { 0, 1, 4, 12 };
+uint32_t betas[] = { 0, 0x00010000, 0x00800000, 0x3fc00000, 0x40000000,
+                     0x7f7f0000, 0x7f800000 };
+int scale_bpps[] = { 1, 2, 4 };
+unsigned int scale_factors[] = { 1, 2, 3, 4, 5 };
+
+static uint8_t *random_buffer(size_t size)
+{
+    uint8_t *buf = malloc(size);
+    for (size_t i = 0; i < size; i++) {
+        buf[i] = rand();
+    }
+    return buf;
+}
+
+static void crosscheck_separate(void)
+{
+    for (int width_idx = 0; width_idx < ARRAY_SIZE(widths); width_idx++)
+    for (int height_idx = 0; height_idx < ARRAY_SIZE(heights); height_idx++)
+    for (int adj_idx = 0; adj_idx < ARRAY_SIZE(pitch_adjusts); adj_idx++)
+    for (int beta_idx = 0; beta_idx < ARRAY_SIZE(betas); beta_idx++) {
+        int width = widths[width_idx];
+        int height = heights[height_idx];
+        size_t source_pitch = width * 4 + pitch_adjusts[adj_idx];
+        size_t dest_pitch = width * 4 + pitch_adjusts[ARRAY_SIZE(pitch_adjusts) - 1 - adj_idx];
+        size_t source_size = source_pitch * height;
+        size_t dest_size = dest_pitch * height;
+
+        uint8_t *source = random_buffer(source_size);
+        uint8_t *dest = random_buffer(dest_size);
+        uint8_t *expected = malloc(dest_size);
+        uint8_t *actual = malloc(dest_size);
+
+        memcpy(expected, dest, dest_size);
+        methods[0].blend_and(source, expected, width, height, source_pitch,
+                             dest_pitch, betas[beta_idx]);
+        for (int method_idx = 1; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            memcpy(actual, dest, dest_size);
+            methods[method_idx].blend_and(source, actual, width, height,
+                                          source_pitch, dest_pitch,
+                                          betas[beta_idx]);
+            assert(!memcmp(expected, actual, dest_size));
+        }
+
+        memcpy(expected, dest, dest_size);
+        methods[0].copy(source, expected, width * 4, height, source_pitch,
+                        dest_pitch);
+        methods[0].patch_alpha(expected, width, height, dest_pitch,
+                               beta_idx & 1 ? 0xff : 0);
+        for (int method_idx = 1; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            memcpy(actual, dest, dest_size);
+            methods[method_idx].copy(source, actual, width * 4, height,
+                                     source_pitch, dest_pitch);
+            methods[method_idx].patch_alpha(actual, width, height, dest_pitch,
+                                            beta_idx & 1 ? 0xff : 0);
+            assert(!memcmp(expected, actual, dest_size));
+        }
+
+        free(actual);
+        free(expected);
+        free(dest);
+        free(source);
+    }
+}
+
+/* Source and dest within the same surface, as when a title scrolls */
+static void crosscheck_overlapping(void)
+{
+    for (int width_idx = 0; width_idx < ARRAY_SIZE(widths); width_idx++)
+    for (int offset = -9; offset <= 9; offset++) {
+        int width = widths[width_idx];
+        int height = 4;
+        size_t pitch = width * 4;
+        size_t margin = 10 * 4 + pitch;
+        size_t size = pitch * height + 2 * margin;
+        ptrdiff_t delta = offset * 4 + (offset & 1) * pitch;
+
+        uint8_t *original = random_buffer(size);
+        uint8_t *expected = malloc(size);
+        uint8_t *actual = malloc(size);
+
+        memcpy(expected, original, size);
+        methods[0].blend_and(expected + margin, expected + margin + delta,
+                             width, height, pitch, pitch, 0x40000000);
+        methods[0].copy(expected + margin, expected + margin - delta,
+                        pitch, height, pitch, pitch);
+        for (int method_idx = 1; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            memcpy(actual, original, size);
+            methods[method_idx].blend_and(actual + margin,
+                                          actual + margin + delta, width,
+                                          height, pitch, pitch, 0x40000000);
+            methods[method_idx].copy(actual + margin, actual + margin - delta,
+                                     pitch, height, pitch, pitch);
+            assert(!memcmp(expected, actual, size));
+        }
+
+        free(actual);
+        free(expected);
+        free(original);
+    }
+}
+
+/* Surface upscaling, as done around CPU uploads and downloads */
+static void crosscheck_scale(void)
+{
+    for (int width_idx = 0; width_idx < ARRAY_SIZE(widths); width_idx++)
+    for (int height_idx = 0; height_idx < ARRAY_SIZE(heights); height_idx++)
+    for (int bpp_idx = 0; bpp_idx < ARRAY_SIZE(scale_bpps); bpp_idx++)
+    for (int factor_idx = 0; factor_idx < ARRAY_SIZE(scale_factors);
+         factor_idx++) {
+        int width = widths[width_idx];
+        int height = heights[height_idx];
+        int bpp = scale_bpps[bpp_idx];
+        unsigned int factor = scale_factors[factor_idx];
+        size_t pitch = width * bpp + pitch_adjusts[height_idx];
+        size_t scaled_pitch = width * bpp * factor + pitch_adjusts[bpp_idx];
+        size_t size = pitch * height;
+        size_t scaled_size = scaled_pitch * height * factor;
+
+        size_t max_size = size > scaled_size ? size : scaled_size;
+
+        uint8_t *source = random_buffer(size);
+        uint8_t *scaled_source = random_buffer(scaled_size);
+        uint8_t *original = random_buffer(max_size);
+        uint8_t *expected = malloc(max_size);
+        uint8_t *actual = malloc(max_size);
+
+        memcpy(expected, original, scaled_size);
+        methods[0].expand(source, expected, width, height, pitch,
+                          scaled_pitch, bpp, factor);
+        for (int method_idx = 1; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            memcpy(actual, original, scaled_size);
+            methods[method_idx].expand(source, actual, width, height, pitch,
+                                       scaled_pitch, bpp, factor);
+            assert(!memcmp(expected, actual, scaled_size));
+        }
+
+        memcpy(expected, original, size);
+        methods[0].shrink(scaled_source, expected, width, height,
+                          scaled_pitch, pitch, bpp, factor);
+        for (int method_idx = 1; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            memcpy(actual, original, size);
+            methods[method_idx].shrink(scaled_source, actual, width, height,
+                                       scaled_pitch, pitch, bpp, factor);
+            assert(!memcmp(expected, actual, size));
+        }
+
+        /* Shrinking an expanded image gives back the original pixels */
+        methods[ARRAY_SIZE(methods) - 1].expand(source, expected, width,
+                                                height, pitch, scaled_pitch,
+                                                bpp, factor);
+        memcpy(actual, source, size);
+        methods[ARRAY_SIZE(methods) - 1].shrink(expected, actual, width,
+                                                height, scaled_pitch, pitch,
+                                                bpp, factor);
+        assert(!memcmp(source, actual, size));
+
+        free(actual);
+        free(expected);
+        free(original);
+        free(scaled_source);
+        free(source);
+    }
+}
+
+static void crosscheck(void)
+{
+    assert(ARRAY_SIZE(methods) > 0);
+    fprintf(stderr, "%s...", __func__);
+    crosscheck_separate();
+    crosscheck_overlapping();
+    crosscheck_scale();
+    fprintf(stderr, "ok!\n");
+}
+
+#define NUM_ITERATIONS 10
+
+static int compare_ints(const void *a, const void *b)
+{
+    return *(int*)a - *(int*)b;
+}
+
+typedef struct BenchConfig {
+    int width, height;
+} BenchConfig;
+
+static const BenchConfig bench_configs[] = {
+    { 640, 480 },
+    { 1280, 720 },
+    { 1920, 1080 },
+};
+
+typedef enum BenchOp {
+    BENCH_COPY,
+    BENCH_BLEND_AND,
+    BENCH_PATCH_ALPHA,
+    BENCH_EXPAND,
+    BENCH_SHRINK,
+} BenchOp;
+
+#define BENCH_SCALE_FACTOR 3
+
+static const char *bench_op_names[] = {
+    [BENCH_COPY] = "copy",
+    [BENCH_BLEND_AND] = "blend_and",
+    [BENCH_PATCH_ALPHA] = "patch_alpha",
+    [BENCH_EXPAND] = "expand",
+    [BENCH_SHRINK] = "shrink",
+};
+
+static void bench_method(const Method *method, BenchOp op,
+                         const BenchConfig *config, const uint8_t *source,
+                         uint8_t *dest, uint8_t *scaled, size_t pitch,
+                         size_t size_bytes)
+{
+    fprintf(stderr, "[%6s %11s] ", method->name, bench_op_names[op]);
+
+    int samples[NUM_ITERATIONS];
+    int sum = 0;
+
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (op) {
+        case BENCH_COPY:
+            method->copy(source, dest, config->width * 4, config->height,
+                         pitch, pitch);
+            break;
+        case BENCH_BLEND_AND:
+            method->blend_and(source, dest, config->width, config->height,
+                              pitch, pitch, 0x40000000);
+            break;
+        case BENCH_PATCH_ALPHA:
+            method->patch_alpha(dest, config->width, config->height, pitch,
+                                0xff);
+            break;
+        case BENCH_EXPAND:
+            method->expand(source, scaled, config->width, config->height,
+                           pitch, config->width * 4 * BENCH_SCALE_FACTOR, 4,
+                           BENCH_SCALE_FACTOR);
+            break;
+        case BENCH_SHRINK:
+            method->shrink(scaled, dest, config->width, config->height,
+                           config->width * 4 * BENCH_SCALE_FACTOR, pitch, 4,
+                           BENCH_SCALE_FACTOR);
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
+        uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
+
+        samples[iter] = (end_ns - start_ns) / 1000;
+        sum += samples[iter];
+    }
+
+    qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+
+    int min = samples[0],
+        max = samples[ARRAY_SIZE(samples) - 1],
+        avg = sum / ARRAY_SIZE(samples),
+        med = samples[ARRAY_SIZE(samples) / 2];
+    double size_gib = size_bytes / (1024.0 * 1024.0 * 1024.0);
+    fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2g GiB/s\n",
+            min, max, avg, med, size_gib / ((med ? med : 1) / 1000000.0));
+}
+
+static void bench(void)
+{
+    fprintf(stderr, "%s...\n", __func__);
+
+    for (int config_idx = 0; config_idx < ARRAY_SIZE(bench_configs);
+         config_idx++) {
+        const BenchConfig *config = &bench_configs[config_idx];
+
+        /* Pad rows the way surfaces usually are, to defeat the packed path */
+        size_t pitch = config->width * 4 + 64;
+        size_t size_bytes = pitch * config->height;
+        fprintf(stderr, "with w: %d, h: %d, size: %zu KiB, iterations: %d\n",
+                config->width, config->height, size_bytes / 1024,
+                NUM_ITERATIONS);
+
+        uint8_t *source = random_buffer(size_bytes);
+        uint8_t *dest = random_buffer(size_bytes);
+        uint8_t *scaled = random_buffer(config->width * config->height * 4 *
+                                        BENCH_SCALE_FACTOR *
+                                        BENCH_SCALE_FACTOR);
+
+        for (int method_idx = 0; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            for (BenchOp op = BENCH_COPY; op <= BENCH_SHRINK; op++) {
+                bench_method(&methods[method_idx], op, config, source, dest,
+                             scaled, pitch, size_bytes);
+            }
+        }
+
+        free(scaled);
+        free(dest);
+        free(source);
+    }
+}
+
+int main(int argc, char const *argv[])
+{
+    srand(1337);
+
+    crosscheck();
+    bench();
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * DSP interpreter benchmark.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "hw/xbox/mcpx/apu/dsp/dsp.h"
+#include "hw/xbox/mcpx/apu/dsp/dsp_state.h"
+
+#define OP_MOVEC_FF_M0  0x05FFA0 /* movec #$ff,m0 */
+#define OP_ADD_X0_A_PM  0x44D840 /* add x0,a x:(r0)+,x0 */
+#define OP_MAC_Y0_X0_A  0x2000D2 /* mac y0,x0,a */
+#define OP_ADD_X0_A     0x200040 /* add x0,a */
+#define OP_ASR_A        0x200022 /* asr a */
+#define OP_DO_IMM(n)    (0x060080 | ((n) << 8)) /* do #n,expr */
+#define OP_JMP(addr)    (0x0C0000 | (addr)) /* jmp addr */
+
+static const int cycles_per_run = 1000;
+static const int num_runs = 20000;
+
+static void scratch_rw(void *opaque, uint8_t *ptr, uint32_t addr, size_t len, bool dir)
+{
+    assert(!"Not implemented");
+}
+
+static void fifo_rw(void *opaque, uint8_t *ptr, unsigned int index, size_t len, bool dir)
+{
+    assert(!"Not implemented");
+}
+
+/* Tight DO loop, the shape of most mixing code */
+static void load_loop(DSPState *s)
+{
+    static const uint32_t prog[] = {
+        OP_MOVEC_FF_M0,
+        OP_DO_IMM(0x40), 0x000006,
+        OP_ADD_X0_A_PM,
+        OP_MAC_Y0_X0_A,
+        OP_ADD_X0_A,
+        OP_ASR_A,
+        OP_JMP(1),
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(prog); i++) {
+        dsp_write_memory(s, 'P', i, prog[i]);
+    }
+}
+
+/* Long straight-line code, the shape of unrolled filters */
+static void load_straight(DSPState *s)
+{
+    dsp_write_memory(s, 'P', 0, OP_MOVEC_FF_M0);
+    for (int i = 1; i < 0x3ff; i++) {
+        dsp_write_memory(s, 'P', i, (i & 1) ? OP_ADD_X0_A_PM : OP_MAC_Y0_X0_A);
+    }
+    dsp_write_memory(s, 'P', 0x3ff, OP_JMP(1));
+}
+
+static const struct {
+    const char *name;
+    void (*load)(DSPState *s);
+} benchmarks[] = {
+    { "Loop", load_loop },
+    { "Straight", load_straight },
+};
+
+static void run_benchmark(void (*load)(DSPState *s), double *cycles_per_sec,
+                          double *insts_per_sec)
+{
+    DSPState *s = dsp_init(NULL, scratch_rw, fifo_rw);
+    load(s);
+
+    uint32_t start_insts = s->core.cycle_count;
+    int64_t start = get_clock();
+    for (int i = 0; i < num_runs; i++) {
+        dsp_run(s, cycles_per_run);
+    }
+    int64_t elapsed = get_clock() - start;
+
+    *cycles_per_sec = (double)num_runs * cycles_per_run / (elapsed * 1e-9);
+    *insts_per_sec = (s->core.cycle_count - start_insts) / (elapsed * 1e-9);
+
+    dsp_destroy(s);
+}
+
+int main(int argc, char *argv[])
+{
+    printf("%-10s %14s %14s\n", "Benchmark", "Mcycles/s", "Minsts/s");
+    for (size_t i = 0; i < ARRAY_SIZE(benchmarks); i++) {
+        double cycles_per_sec, insts_per_sec;
+        run_benchmark(benchmarks[i].load, &cycles_per_sec, &insts_per_sec);
+        printf("%-10s %14.2f %14.2f\n", benchmarks[i].name,
+               cycles_per_sec * 1e-6, insts_per_sec * 1e-6);
+    }
+    return 0;
+}
@@ -19,6 +19,7 @@
 
 #include "qemu/osdep.h"
 #include "hw/xbox/mcpx/apu/dsp/dsp.h"
+#include "hw/xbox/mcpx/apu/dsp/dsp_state.h"
 
 static void scratch_rw(void *opaque, uint8_t *ptr, uint32_t addr, size_t len, bool dir)
 {
@@ -74,11 +75,60 @@ static void test_dsp_basic(void)
     dsp_destroy(s);
 }
 
+static void test_dsp_pram_write(void)
+{
+    g_autofree gchar *path = g_test_build_filename(G_TEST_DIST, "data", "basic", NULL);
+
+    DSPState *s = dsp_init(NULL, scratch_rw, fifo_rw);
+
+    load_prog(s, path);
+    dsp_run(s, 1000);
+    g_assert_cmphex(dsp_read_memory(s, 'X', 3), ==, 0x123456);
+
+    /* Replace move a,x:$3 with move a,y:$3 in the already executed loop */
+    dsp_write_memory(s, 'X', 3, 0);
+    dsp_write_memory(s, 'P', 0x44, 0x5E7000);
+    s->core.is_idle = false;
+    dsp_run(s, 1000);
+
+    g_assert_cmphex(dsp_read_memory(s, 'X', 3), ==, 0);
+    g_assert_cmphex(dsp_read_memory(s, 'Y', 3), ==, 0x123456);
+
+    dsp_destroy(s);
+}
+
+static void test_dsp_alu(void)
+{
+    g_autofree gchar *path = g_test_build_filename(G_TEST_DIST, "data", "alu", NULL);
+
+    DSPState *s = dsp_init(NULL, scratch_rw, fifo_rw);
+
+    load_prog(s, path);
+    dsp_run(s, 1000);
+
+    static const uint32_t expected[] = {
+        0xe00001, 0x000006, /* mpy */
+        0xe00001, 0x000000, /* rnd */
+        0xc00002, 0x000000, /* asl */
+        0x800001, 0x000000, /* sub */
+        0x800002,           /* rnd, half way from odd */
+        0x800002, 0x000000, /* rnd, half way from even */
+    };
+    for (int i = 0; i < ARRAY_SIZE(expected); i++) {
+        g_assert_cmphex(dsp_read_memory(s, 'X', i), ==, expected[i]);
+    }
+    g_assert_cmphex(s->core.registers[DSP_REG_A2], ==, 0xff);
+
+    dsp_destroy(s);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/basic", test_dsp_basic);
+    g_test_add_func("/pram_write", test_dsp_pram_write);
+    g_test_add_func("/alu", test_dsp_alu);
 
     return g_test_run();
 }
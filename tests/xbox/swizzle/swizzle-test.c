@@ -25,8 +25,8 @@
 #include <time.h>
 
 #define X_METHODS \
-    X(A)
-    // X(B)
+    X(A) \
+    X(B)
 
 typedef void (*swizzle_box_handler)(
     const uint8_t *src_buf,
@@ -147,63 +147,90 @@ static int compare_ints(const void *a, const void *b)
     return *(int*)a - *(int*)b;
 }
 
-static void bench(void)
+typedef struct BenchConfig {
+    int width, height, depth, bpp;
+} BenchConfig;
+
+static const BenchConfig bench_configs[] = {
+    { 256, 256, 256, 4 },
+    { 2048, 2048, 1, 1 },
+    { 2048, 2048, 1, 2 },
+    { 2048, 2048, 1, 4 },
+};
+
+static void bench_method(const char *name, const char *direction,
+                         swizzle_box_handler handler,
+                         const BenchConfig *config, const void *src,
+                         void *dst, size_t row_pitch, size_t slice_pitch,
+                         size_t size_bytes)
 {
-    fprintf(stderr, "%s...", __func__);
+    fprintf(stderr, "[%6s %9s] ", name, direction);
 
-    int width = 256;
-    int height = 256;
-    int depth = 256;
-    int bpp = 4;
+    int samples[NUM_ITERATIONS];
+    int sum = 0;
 
-    size_t row_pitch = width * bpp;
-    size_t slice_pitch = row_pitch * height;
-    size_t size_bytes = slice_pitch * depth;
-    size_t size_mib = size_bytes / (1024*1024);
-    fprintf(stderr, "with w: %d, h: %d, d: %d, bpp: %d, "
-                    "size: %zu MiB, iterations: %d\n",
-                    width, height, depth, bpp, size_mib, NUM_ITERATIONS);
+    for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
+        struct timespec start, end;
 
-    void *original_data = malloc(size_bytes);
-    memset(original_data, 0, size_bytes);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        handler(src, config->width, config->height, config->depth, dst,
+                row_pitch, slice_pitch, config->bpp);
+        clock_gettime(CLOCK_MONOTONIC, &end);
 
-    void *swizzled_data = malloc(size_bytes);
-    memset(swizzled_data, 0, size_bytes);
+        uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
+        uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
 
+        samples[iter] = (end_ns - start_ns) / 1000;
+        sum += samples[iter];
+    }
 
-    for (int method_idx = 0; method_idx < ARRAY_SIZE(methods); method_idx++) {
-        const Method * const method = &methods[method_idx];
-        fprintf(stderr, "[%6s] ", method->name);
+    qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
 
-        int samples[NUM_ITERATIONS];
-        int sum = 0;
+    int min = samples[0],
+        max = samples[ARRAY_SIZE(samples) - 1],
+        avg = sum / ARRAY_SIZE(samples),
+        med = samples[ARRAY_SIZE(samples) / 2];
+    double size_gib = size_bytes / (1024.0 * 1024.0 * 1024.0);
+    fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2g GiB/s\n",
+            min, max, avg, med, size_gib / ((med ? med : 1) / 1000000.0));
+}
 
-        for (int iter = 0; iter < NUM_ITERATIONS; iter++ ) {
-            struct timespec start, end;
+static void bench(void)
+{
+    fprintf(stderr, "%s...\n", __func__);
 
-            clock_gettime(CLOCK_MONOTONIC, &start);
-            method->swizzle(original_data, width, height, depth, swizzled_data, row_pitch, slice_pitch, bpp);
-            clock_gettime(CLOCK_MONOTONIC, &end);
+    for (int config_idx = 0; config_idx < ARRAY_SIZE(bench_configs);
+         config_idx++) {
+        const BenchConfig *config = &bench_configs[config_idx];
 
-            uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
-            uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
+        size_t row_pitch = config->width * config->bpp;
+        size_t slice_pitch = row_pitch * config->height;
+        size_t size_bytes = slice_pitch * config->depth;
+        fprintf(stderr, "with w: %d, h: %d, d: %d, bpp: %d, "
+                        "size: %zu MiB, iterations: %d\n",
+                        config->width, config->height, config->depth,
+                        config->bpp, size_bytes / (1024*1024), NUM_ITERATIONS);
 
-            samples[iter] = (end_ns - start_ns) / 1000;
-            sum += samples[iter];
-        }
+        void *original_data = malloc(size_bytes);
+        memset(original_data, 0, size_bytes);
 
-        qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+        void *swizzled_data = malloc(size_bytes);
+        memset(swizzled_data, 0, size_bytes);
 
-        int min = samples[0],
-            max = samples[ARRAY_SIZE(samples) - 1],
-            avg = sum / ARRAY_SIZE(samples),
-            med = samples[ARRAY_SIZE(samples) / 2];
-        fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2g GiB/s\n",
-                min, max, avg, med, (size_mib / 1024.0) / (med / 1000000.0));
-    }
+        for (int method_idx = 0; method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            const Method * const method = &methods[method_idx];
+            bench_method(method->name, "swizzle", method->swizzle, config,
+                         original_data, swizzled_data, row_pitch,
+                         slice_pitch, size_bytes);
+            bench_method(method->name, "unswizzle", method->unswizzle, config,
+                         swizzled_data, original_data, row_pitch,
+                         slice_pitch, size_bytes);
+        }
 
-    free(swizzled_data);
-    free(original_data);
+        free(swizzled_data);
+        free(original_data);
+    }
 }
 
 int main(int argc, char const *argv[])
@@ -0,0 +1,266 @@
+/*
+ * Crosscheck and benchmark VP mixing kernels.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+#include <assert.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define X_METHODS \
+    X(A) \
+    X(B)
+
+typedef struct Method {
+    const char *name;
+    void (*accumulate)(float *dst, const float *src, float gain, int n);
+    float (*dot)(const float *a, const float *b, int n);
+    void (*smooth)(float *cur, const float *tar, float alpha, int n);
+    void (*deinterleave)(float *left, float *right, const float (*in)[2],
+                         int n);
+    void (*to_int24)(uint32_t *dst, const float *src, int n);
+} Method;
+
+#define X(m) \
+    void vp_mix_accumulate_ ## m(float *dst, const float *src, float gain, \
+                                 int n); \
+    float vp_mix_dot_ ## m(const float *a, const float *b, int n); \
+    void vp_mix_smooth_ ## m(float *cur, const float *tar, float alpha, \
+                             int n); \
+    void vp_mix_deinterleave_ ## m(float *left, float *right, \
+                                   const float (*in)[2], int n); \
+    void vp_mix_to_int24_ ## m(uint32_t *dst, const float *src, int n);
+X_METHODS
+#undef X
+
+const Method methods[] = {
+    #define X(m) { #m, vp_mix_accumulate_ ## m, vp_mix_dot_ ## m, \
+                   vp_mix_smooth_ ## m, vp_mix_deinterleave_ ## m, \
+                   vp_mix_to_int24_ ## m },
+    X_METHODS
+    #undef X
+};
+
+#define ARRAY_SIZE(x) (sizeof(x)/sizeof(x[0]))
+
+#define NUM_SAMPLES_PER_FRAME 32
+#define NUM_MIXBINS 32
+#define HRTF_NUM_TAPS 31
+#define MAX_LEN 67
+
+/* Vector sums are reassociated, so only ask for agreement to a few ulps */
+static int close_enough(float a, float b)
+{
+    return fabsf(a - b) <= 1e-5f * (1.0f + fabsf(a) + fabsf(b));
+}
+
+static float rand_sample(void)
+{
+    return (float)rand() / RAND_MAX * 2.0f - 1.0f;
+}
+
+static void crosscheck(void)
+{
+    assert(ARRAY_SIZE(methods) > 0);
+    fprintf(stderr, "%s...", __func__);
+
+    /* Cover every vector width plus each possible tail length */
+    for (int n = 0; n <= MAX_LEN; n++)
+    for (int offset = 0; offset < 4; offset++) {
+        float a[MAX_LEN + 4], b[MAX_LEN + 4], in[MAX_LEN + 4][2];
+        for (int i = 0; i < MAX_LEN + 4; i++) {
+            a[i] = rand_sample();
+            b[i] = rand_sample();
+            in[i][0] = rand_sample();
+            in[i][1] = rand_sample();
+        }
+        /* Push some samples out of range to exercise saturation */
+        float wide[MAX_LEN + 4];
+        for (int i = 0; i < MAX_LEN + 4; i++) {
+            wide[i] = a[i] * 1.5f;
+        }
+        float gain = rand_sample();
+
+        float acc_A[MAX_LEN + 4], sm_A[MAX_LEN + 4];
+        float left_A[MAX_LEN + 4], right_A[MAX_LEN + 4];
+        uint32_t int24_A[MAX_LEN + 4];
+        memset(int24_A, 0, sizeof(int24_A));
+        memcpy(acc_A, a, sizeof(a));
+        memcpy(sm_A, a, sizeof(a));
+        memset(left_A, 0, sizeof(left_A));
+        memset(right_A, 0, sizeof(right_A));
+        methods[0].accumulate(acc_A + offset, b + offset, gain, n);
+        methods[0].smooth(sm_A + offset, b + offset, gain, n);
+        methods[0].deinterleave(left_A + offset, right_A + offset,
+                                in + offset, n);
+        methods[0].to_int24(int24_A + offset, wide + offset, n);
+        float dot_A = methods[0].dot(a + offset, b + offset, n);
+
+        for (int method_idx = 1;
+             method_idx < ARRAY_SIZE(methods);
+             method_idx++) {
+            const Method *m = &methods[method_idx];
+            float acc_B[MAX_LEN + 4], sm_B[MAX_LEN + 4];
+            float left_B[MAX_LEN + 4], right_B[MAX_LEN + 4];
+            uint32_t int24_B[MAX_LEN + 4];
+            memset(int24_B, 0, sizeof(int24_B));
+            memcpy(acc_B, a, sizeof(a));
+            memcpy(sm_B, a, sizeof(a));
+            memset(left_B, 0, sizeof(left_B));
+            memset(right_B, 0, sizeof(right_B));
+            m->accumulate(acc_B + offset, b + offset, gain, n);
+            m->smooth(sm_B + offset, b + offset, gain, n);
+            m->deinterleave(left_B + offset, right_B + offset, in + offset, n);
+            m->to_int24(int24_B + offset, wide + offset, n);
+            float dot_B = m->dot(a + offset, b + offset, n);
+
+            for (int i = 0; i < MAX_LEN + 4; i++) {
+                assert(close_enough(acc_A[i], acc_B[i]));
+                assert(close_enough(sm_A[i], sm_B[i]));
+            }
+            assert(!memcmp(left_A, left_B, sizeof(left_A)));
+            assert(!memcmp(right_A, right_B, sizeof(right_A)));
+            assert(!memcmp(int24_A, int24_B, sizeof(int24_A)));
+            assert(close_enough(dot_A, dot_B));
+        }
+    }
+
+    fprintf(stderr, "ok!\n");
+}
+
+#define NUM_ITERATIONS 10
+#define NUM_FRAMES 1000
+#define NUM_VOICES 256
+#define NUM_3D_VOICES 64
+#define BINS_PER_VOICE 8
+
+static int compare_ints(const void *a, const void *b)
+{
+    return *(int*)a - *(int*)b;
+}
+
+typedef struct BenchVoice {
+    float samples[NUM_SAMPLES_PER_FRAME][2];
+    float coeff[2][HRTF_NUM_TAPS], target[2][HRTF_NUM_TAPS];
+    float history[2][NUM_SAMPLES_PER_FRAME + HRTF_NUM_TAPS];
+    float gain[BINS_PER_VOICE];
+    int bin[BINS_PER_VOICE];
+} BenchVoice;
+
+/*
+ * One VP frame worth of work shaped like vp.c: every voice is split into
+ * planar channels and mixed into its bins, the 3D voices first run through
+ * a smoothed FIR per channel.
+ */
+static void run_frame(const Method *m, BenchVoice *voices,
+                      float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME])
+{
+    for (int v = 0; v < NUM_VOICES; v++) {
+        BenchVoice *voice = &voices[v];
+        float planar[2][NUM_SAMPLES_PER_FRAME];
+
+        if (v < NUM_3D_VOICES) {
+            for (int i = 0; i < NUM_SAMPLES_PER_FRAME; i++) {
+                for (int ch = 0; ch < 2; ch++) {
+                    m->smooth(voice->coeff[ch], voice->target[ch], 0.01f,
+                              HRTF_NUM_TAPS);
+                    voice->samples[i][ch] =
+                        m->dot(voice->coeff[ch], &voice->history[ch][i],
+                               HRTF_NUM_TAPS);
+                }
+            }
+        }
+
+        m->deinterleave(planar[0], planar[1],
+                        (const float (*)[2])voice->samples,
+                        NUM_SAMPLES_PER_FRAME);
+        for (int b = 0; b < BINS_PER_VOICE; b++) {
+            m->accumulate(mixbins[voice->bin[b]], planar[b % 2],
+                          voice->gain[b], NUM_SAMPLES_PER_FRAME);
+        }
+    }
+}
+
+static void bench(void)
+{
+    fprintf(stderr, "%s...\n", __func__);
+    fprintf(stderr, "with voices: %d, 3d voices: %d, bins per voice: %d, "
+                    "frames: %d, iterations: %d\n",
+                    NUM_VOICES, NUM_3D_VOICES, BINS_PER_VOICE, NUM_FRAMES,
+                    NUM_ITERATIONS);
+
+    BenchVoice *voices = malloc(sizeof(BenchVoice) * NUM_VOICES);
+    for (int v = 0; v < NUM_VOICES; v++) {
+        float *f = (float *)&voices[v];
+        for (int i = 0; i < offsetof(BenchVoice, gain) / sizeof(float); i++) {
+            f[i] = rand_sample();
+        }
+        for (int b = 0; b < BINS_PER_VOICE; b++) {
+            voices[v].gain[b] = rand_sample();
+            voices[v].bin[b] = rand() % NUM_MIXBINS;
+        }
+    }
+
+    for (int method_idx = 0; method_idx < ARRAY_SIZE(methods); method_idx++) {
+        const Method * const method = &methods[method_idx];
+        fprintf(stderr, "[%6s] ", method->name);
+
+        int samples[NUM_ITERATIONS];
+        int sum = 0;
+
+        for (int iter = 0; iter < NUM_ITERATIONS; iter++) {
+            float mixbins[NUM_MIXBINS][NUM_SAMPLES_PER_FRAME];
+            struct timespec start, end;
+
+            memset(mixbins, 0, sizeof(mixbins));
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (int frame = 0; frame < NUM_FRAMES; frame++) {
+                run_frame(method, voices, mixbins);
+            }
+            clock_gettime(CLOCK_MONOTONIC, &end);
+
+            uint64_t start_ns = (uint64_t)start.tv_sec * (uint64_t)1000000000 + start.tv_nsec;
+            uint64_t end_ns   = (uint64_t)end.tv_sec   * (uint64_t)1000000000 + end.tv_nsec;
+
+            samples[iter] = (end_ns - start_ns) / 1000;
+            sum += samples[iter];
+        }
+
+        qsort(samples, ARRAY_SIZE(samples), sizeof(samples[0]), compare_ints);
+
+        int min = samples[0],
+            max = samples[ARRAY_SIZE(samples) - 1],
+            avg = sum / ARRAY_SIZE(samples),
+            med = samples[ARRAY_SIZE(samples) / 2];
+        fprintf(stderr, "min: %6d us, max: %6d us, avg: %6d us, med: %6d us  -- %.2f us/frame\n",
+                min, max, avg, med, (double)med / NUM_FRAMES);
+    }
+
+    free(voices);
+}
+
+int main(int argc, char const *argv[])
+{
+    srand(1337);
+
+    crosscheck();
+    bench();
+
+    return 0;
+}
@@ -164,6 +164,11 @@ void qemu_console_co_wait_update(QemuConsole *con)
 
 }
 
+bool qemu_console_dump_pending(QemuConsole *con)
+{
+    return con && !qemu_co_queue_empty(&con->dump_queue);
+}
+
 static void graphic_hw_gl_unblock_timer(void *opaque)
 {
     warn_report("console: no gl-unblock within one second");
@@ -0,0 +1,158 @@
+// Spatial upscaling of the display, after AMD FidelityFX Super Resolution 1.0
+//
+// upscale_easu() resamples with a Lanczos-like kernel stretched along the
+// local edge direction, then clamps to the nearest 2x2 texels to avoid
+// ringing. upscale_rcas() then sharpens the result at output resolution,
+// limiting the sharpening so it cannot push a pixel outside its neighbours.
+//
+// Both fetch texels directly. Callers include this after #version and pass
+// the rectangle of valid texels, inclusive, which fetches are clamped to.
+
+vec3 upscale_fetch(sampler2D tex, ivec2 p, ivec4 rect)
+{
+    return texelFetch(tex, clamp(p, rect.xy, rect.zw), 0).rgb;
+}
+
+float upscale_luma(vec3 c)
+{
+    return c.b * 0.5 + (c.r * 0.5 + c.g);
+}
+
+// Accumulate edge direction and length around one of the four texels
+// nearest to the sample, a is above c, b left, d right and e below
+void easu_set(inout vec2 dir, inout float len, float w,
+              float la, float lb, float lc, float ld, float le)
+{
+    float dir_x = ld - lb;
+    float len_x = max(abs(ld - lc), abs(lc - lb));
+    len_x = len_x > 0.0 ? clamp(abs(dir_x) / len_x, 0.0, 1.0) : 0.0;
+    dir.x += dir_x * w;
+    len += len_x * len_x * w;
+
+    float dir_y = le - la;
+    float len_y = max(abs(le - lc), abs(lc - la));
+    len_y = len_y > 0.0 ? clamp(abs(dir_y) / len_y, 0.0, 1.0) : 0.0;
+    dir.y += dir_y * w;
+    len += len_y * len_y * w;
+}
+
+void easu_tap(inout vec3 acc, inout float acc_w, vec2 off, vec2 dir,
+              vec2 len, float lob, float clp, vec3 c)
+{
+    // Rotate into the edge direction and scale by the anisotropy
+    vec2 v = vec2(dot(off, dir), dot(off, vec2(-dir.y, dir.x))) * len;
+    float d2 = min(dot(v, v), clp);
+
+    // Windowed Lanczos2 approximation without sin() or rcp()
+    float wb = 2.0 / 5.0 * d2 - 1.0;
+    float wa = lob * d2 - 1.0;
+    float w = (25.0 / 16.0 * wb * wb - (25.0 / 16.0 - 1.0)) * (wa * wa);
+
+    acc += c * w;
+    acc_w += w;
+}
+
+// pp is the sample position in texels, with texel centres on integers
+vec3 upscale_easu(sampler2D tex, vec2 pp, ivec4 rect)
+{
+    vec2 fp = floor(pp);
+    ivec2 p = ivec2(fp);
+    pp -= fp;
+
+    //    b c
+    //  e f g h
+    //  i j k l
+    //    n o
+    vec3 b = upscale_fetch(tex, p + ivec2(0, -1), rect);
+    vec3 c = upscale_fetch(tex, p + ivec2(1, -1), rect);
+    vec3 e = upscale_fetch(tex, p + ivec2(-1, 0), rect);
+    vec3 f = upscale_fetch(tex, p, rect);
+    vec3 g = upscale_fetch(tex, p + ivec2(1, 0), rect);
+    vec3 h = upscale_fetch(tex, p + ivec2(2, 0), rect);
+    vec3 i = upscale_fetch(tex, p + ivec2(-1, 1), rect);
+    vec3 j = upscale_fetch(tex, p + ivec2(0, 1), rect);
+    vec3 k = upscale_fetch(tex, p + ivec2(1, 1), rect);
+    vec3 l = upscale_fetch(tex, p + ivec2(2, 1), rect);
+    vec3 n = upscale_fetch(tex, p + ivec2(0, 2), rect);
+    vec3 o = upscale_fetch(tex, p + ivec2(1, 2), rect);
+
+    float lb = upscale_luma(b), lc = upscale_luma(c);
+    float le = upscale_luma(e), lf = upscale_luma(f);
+    float lg = upscale_luma(g), lh = upscale_luma(h);
+    float li = upscale_luma(i), lj = upscale_luma(j);
+    float lk = upscale_luma(k), ll = upscale_luma(l);
+    float ln = upscale_luma(n), lo = upscale_luma(o);
+
+    // Bilinearly weighted edge analysis of f, g, j and k
+    vec2 dir = vec2(0.0);
+    float len = 0.0;
+    easu_set(dir, len, (1.0 - pp.x) * (1.0 - pp.y), lb, le, lf, lg, lj);
+    easu_set(dir, len, pp.x * (1.0 - pp.y), lc, lf, lg, lh, lk);
+    easu_set(dir, len, (1.0 - pp.x) * pp.y, lf, li, lj, lk, ln);
+    easu_set(dir, len, pp.x * pp.y, lg, lj, lk, ll, lo);
+
+    float dir_r = dot(dir, dir);
+    dir = dir_r < 1.0 / 32768.0 ? vec2(1.0, 0.0) : dir * inversesqrt(dir_r);
+
+    // Stretch the kernel along edges, narrow it across them
+    len = len * 0.5;
+    len *= len;
+    float stretch = dot(dir, dir) / max(abs(dir.x), abs(dir.y));
+    vec2 len2 = vec2(1.0 + (stretch - 1.0) * len, 1.0 - 0.5 * len);
+    float lob = 0.5 + ((1.0 / 4.0 - 0.04) - 0.5) * len;
+    float clp = 1.0 / lob;
+
+    vec3 acc = vec3(0.0);
+    float acc_w = 0.0;
+    easu_tap(acc, acc_w, vec2(0.0, -1.0) - pp, dir, len2, lob, clp, b);
+    easu_tap(acc, acc_w, vec2(1.0, -1.0) - pp, dir, len2, lob, clp, c);
+    easu_tap(acc, acc_w, vec2(-1.0, 1.0) - pp, dir, len2, lob, clp, i);
+    easu_tap(acc, acc_w, vec2(0.0, 1.0) - pp, dir, len2, lob, clp, j);
+    easu_tap(acc, acc_w, vec2(0.0, 0.0) - pp, dir, len2, lob, clp, f);
+    easu_tap(acc, acc_w, vec2(-1.0, 0.0) - pp, dir, len2, lob, clp, e);
+    easu_tap(acc, acc_w, vec2(1.0, 1.0) - pp, dir, len2, lob, clp, k);
+    easu_tap(acc, acc_w, vec2(2.0, 1.0) - pp, dir, len2, lob, clp, l);
+    easu_tap(acc, acc_w, vec2(2.0, 0.0) - pp, dir, len2, lob, clp, h);
+    easu_tap(acc, acc_w, vec2(1.0, 0.0) - pp, dir, len2, lob, clp, g);
+    easu_tap(acc, acc_w, vec2(1.0, 2.0) - pp, dir, len2, lob, clp, o);
+    easu_tap(acc, acc_w, vec2(0.0, 2.0) - pp, dir, len2, lob, clp, n);
+
+    // Deringing
+    vec3 mn = min(min(f, g), min(j, k));
+    vec3 mx = max(max(f, g), max(j, k));
+    return clamp(acc / acc_w, mn, mx);
+}
+
+// sharpness is 2^-stops, 1.0 sharpens the most
+vec3 upscale_rcas(sampler2D tex, ivec2 p, ivec4 rect, float sharpness)
+{
+    //    b
+    //  d e f
+    //    h
+    vec3 b = upscale_fetch(tex, p + ivec2(0, -1), rect);
+    vec3 d = upscale_fetch(tex, p + ivec2(-1, 0), rect);
+    vec3 e = upscale_fetch(tex, p, rect);
+    vec3 f = upscale_fetch(tex, p + ivec2(1, 0), rect);
+    vec3 h = upscale_fetch(tex, p + ivec2(0, 1), rect);
+
+    // Back off where the centre alone stands out, which is likely noise
+    float lb = upscale_luma(b), ld = upscale_luma(d), le = upscale_luma(e);
+    float lf = upscale_luma(f), lh = upscale_luma(h);
+    float range = max(max(max(lb, ld), max(le, lf)), lh) -
+                  min(min(min(lb, ld), min(le, lf)), lh);
+    float nz = 0.25 * (lb + ld + lf + lh) - le;
+    nz = range > 0.0 ? clamp(abs(nz) / range, 0.0, 1.0) : 0.0;
+    nz = -0.5 * nz + 1.0;
+
+    // Largest negative lobe which keeps the result within the ring's range
+    vec3 mn4 = min(min(b, d), min(f, h));
+    vec3 mx4 = max(max(b, d), max(f, h));
+    vec3 hit_min = mn4 / max(4.0 * mx4, 1.0 / 65536.0);
+    vec3 hit_max = (1.0 - mx4) / min(4.0 * mn4 - 4.0, -1.0 / 65536.0);
+    vec3 lobe3 = max(-hit_min, hit_max);
+    float lobe = max(-(0.25 - 1.0 / 16.0),
+                     min(max(max(lobe3.r, lobe3.g), lobe3.b), 0.0));
+    lobe *= sharpness * nz;
+
+    return (lobe * (b + d + f + h) + e) / (4.0 * lobe + 1.0);
+}
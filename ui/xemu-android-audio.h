@@ -0,0 +1,55 @@
+/*
+ * xemu Android AAudio output
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef XEMU_ANDROID_AUDIO_H
+#define XEMU_ANDROID_AUDIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fills len bytes of interleaved stereo S16 samples. Runs on the AAudio
+ * real-time thread, so it must not block.
+ */
+typedef void (*XemuAndroidAudioCallback)(void *opaque, uint8_t *stream,
+                                         int len);
+
+/*
+ * Open a low-latency 48 kHz stereo output stream, preferring exclusive
+ * (MMAP) access, and start it. Returns false if AAudio is not usable, in
+ * which case the caller should fall back to SDL. On success buffer_bytes is
+ * set to the size of the device buffer the callback has to keep filled.
+ */
+bool xemu_android_audio_open(XemuAndroidAudioCallback cb, void *opaque,
+                             int *buffer_bytes);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
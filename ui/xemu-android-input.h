@@ -0,0 +1,43 @@
+/*
+ * xemu Android on-screen controller input
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef XEMU_ANDROID_INPUT_H
+#define XEMU_ANDROID_INPUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Attach the on-screen controller as an SDL virtual gamepad. Events queued
+ * by the Java side are applied each time SDL updates joysticks. Must be
+ * called after the SDL gamecontroller subsystem is up.
+ */
+void xemu_android_input_init(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
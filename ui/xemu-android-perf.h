@@ -0,0 +1,60 @@
+/*
+ * xemu Android performance hints and thermal management
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef XEMU_ANDROID_PERF_H
+#define XEMU_ANDROID_PERF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum XemuPerfThread {
+    XEMU_PERF_THREAD_VCPU,
+    XEMU_PERF_THREAD_PFIFO,
+    XEMU_PERF_THREAD_APU,
+} XemuPerfThread;
+
+/*
+ * Called at the top of an emulation thread. The vCPU and pfifo threads join
+ * the performance hint session; core placement is left to the thread
+ * topology manager.
+ */
+void xemu_android_perf_thread_started(XemuPerfThread kind);
+
+/* Report the time the guest took to produce the last frame */
+void xemu_android_perf_report_frame(int64_t duration_ns);
+
+/*
+ * Check thermal status and trade quality for headroom as the device heats
+ * up. Called from the display loop with the BQL held.
+ */
+void xemu_android_perf_poll(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
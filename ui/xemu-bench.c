@@ -0,0 +1,405 @@
+/*
+ * xemu headless benchmark mode
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_RUNAHEAD
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "system/runstate.h"
+#include "accel/tcg/runtime-stats.h"
+#include "hw/xbox/mcpx/apu/apu_debug.h"
+#include "hw/xbox/nv2a/debug.h"
+#include "xemu-bench.h"
+#include "xemu-input.h"
+#include "xemu-title-profile.h"
+
+/*
+ * Unattended benchmark runs. After booting and an optional warmup, frame
+ * times, APU utilization, NV2A counters and TCG statistics are recorded for
+ * a fixed time, written out as JSON, and xemu exits. An input script can
+ * drive the title into the scene to be measured.
+ *
+ * Input scripts have one event per line, with the time in seconds from
+ * boot, the port (1-4), and the new state of a button (0 or 1) or an axis
+ * (-32768 to 32767, triggers from 0):
+ *
+ *     # Skip the intro and hold the stick forward
+ *     12.0  1  start     1
+ *     12.1  1  start     0
+ *     20.0  1  lstick_y  32767
+ */
+
+typedef struct BenchControl {
+    const char *name;
+    bool is_axis;
+    int index; // Button mask or axis index
+} BenchControl;
+
+static const BenchControl bench_controls[] = {
+    { "a", false, CONTROLLER_BUTTON_A },
+    { "b", false, CONTROLLER_BUTTON_B },
+    { "x", false, CONTROLLER_BUTTON_X },
+    { "y", false, CONTROLLER_BUTTON_Y },
+    { "dpad_left", false, CONTROLLER_BUTTON_DPAD_LEFT },
+    { "dpad_up", false, CONTROLLER_BUTTON_DPAD_UP },
+    { "dpad_right", false, CONTROLLER_BUTTON_DPAD_RIGHT },
+    { "dpad_down", false, CONTROLLER_BUTTON_DPAD_DOWN },
+    { "back", false, CONTROLLER_BUTTON_BACK },
+    { "start", false, CONTROLLER_BUTTON_START },
+    { "white", false, CONTROLLER_BUTTON_WHITE },
+    { "black", false, CONTROLLER_BUTTON_BLACK },
+    { "lstick", false, CONTROLLER_BUTTON_LSTICK },
+    { "rstick", false, CONTROLLER_BUTTON_RSTICK },
+    { "ltrig", true, CONTROLLER_AXIS_LTRIG },
+    { "rtrig", true, CONTROLLER_AXIS_RTRIG },
+    { "lstick_x", true, CONTROLLER_AXIS_LSTICK_X },
+    { "lstick_y", true, CONTROLLER_AXIS_LSTICK_Y },
+    { "rstick_x", true, CONTROLLER_AXIS_RSTICK_X },
+    { "rstick_y", true, CONTROLLER_AXIS_RSTICK_Y },
+};
+
+typedef struct BenchInputEvent {
+    int64_t time_us;
+    int port;
+    const BenchControl *control;
+    int value;
+} BenchInputEvent;
+
+typedef enum BenchState {
+    BENCH_IDLE,
+    BENCH_WARMUP,
+    BENCH_RECORDING,
+} BenchState;
+
+static struct {
+    BenchState state;
+    XemuBenchOptions opts;
+    int64_t start_us;
+    int64_t record_start_us;
+
+    GArray *events;
+    unsigned int next_event;
+    ControllerSample input[4];
+    bool input_used[4];
+
+    GArray *mspf;
+    unsigned int last_frame_count;
+    unsigned int dropped_frames;
+    uint64_t counters[NV2A_PROF__COUNT];
+
+    int64_t last_apu_sample_us;
+    double apu_utilization_sum;
+    float apu_utilization_max;
+    unsigned int apu_samples;
+
+    TCGRuntimeStats tcg_start;
+} g_bench;
+
+static const BenchControl *find_control(const char *name)
+{
+    for (int i = 0; i < ARRAY_SIZE(bench_controls); i++) {
+        if (!strcmp(bench_controls[i].name, name)) {
+            return &bench_controls[i];
+        }
+    }
+    return NULL;
+}
+
+static bool load_input_script(const char *path, Error **errp)
+{
+    g_autofree char *contents = NULL;
+    g_autoptr(GError) err = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, &err)) {
+        error_setg(errp, "Failed to read input script %s: %s", path,
+                   err->message);
+        return false;
+    }
+
+    g_auto(GStrv) lines = g_strsplit(contents, "\n", -1);
+    for (int i = 0; lines[i]; i++) {
+        char *line = g_strstrip(lines[i]);
+        if (!*line || *line == '#') {
+            continue;
+        }
+
+        double time;
+        int port, value;
+        char name[32];
+        const BenchControl *control;
+        if (sscanf(line, "%lf %d %31s %d", &time, &port, name, &value) != 4 ||
+            time < 0 || port < 1 || port > 4 ||
+            !(control = find_control(name))) {
+            error_setg(errp, "%s:%d: Invalid input event", path, i + 1);
+            return false;
+        }
+
+        BenchInputEvent event = {
+            .time_us = time * 1e6,
+            .port = port - 1,
+            .control = control,
+            .value = control->is_axis ? MIN(MAX(value, -32768), 32767) :
+                                        !!value,
+        };
+        if (g_bench.events->len &&
+            event.time_us < g_array_index(g_bench.events, BenchInputEvent,
+                                          g_bench.events->len - 1).time_us) {
+            error_setg(errp, "%s:%d: Input events must be in time order",
+                       path, i + 1);
+            return false;
+        }
+        g_array_append_val(g_bench.events, event);
+    }
+
+    return true;
+}
+
+bool xemu_bench_start(const XemuBenchOptions *opts, Error **errp)
+{
+    assert(g_bench.state == BENCH_IDLE);
+
+    g_bench.opts = *opts;
+    g_bench.events = g_array_new(false, false, sizeof(BenchInputEvent));
+    g_bench.mspf = g_array_new(false, false, sizeof(int));
+
+    if (opts->input_path && !load_input_script(opts->input_path, errp)) {
+        return false;
+    }
+
+    g_bench.start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    g_bench.state = BENCH_WARMUP;
+    return true;
+}
+
+static void apply_input_events(int64_t elapsed_us)
+{
+    bool changed[4] = { false };
+
+    while (g_bench.next_event < g_bench.events->len) {
+        const BenchInputEvent *event = &g_array_index(
+            g_bench.events, BenchInputEvent, g_bench.next_event);
+        if (event->time_us > elapsed_us) {
+            break;
+        }
+
+        ControllerSample *input = &g_bench.input[event->port];
+        if (event->control->is_axis) {
+            input->axis[event->control->index] = event->value;
+        } else if (event->value) {
+            input->buttons |= event->control->index;
+        } else {
+            input->buttons &= ~event->control->index;
+        }
+        changed[event->port] = true;
+        g_bench.next_event++;
+    }
+
+    int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    for (int i = 0; i < 4; i++) {
+        if (changed[i]) {
+            g_bench.input[i].timestamp_us = now;
+            g_bench.input_used[i] = true;
+            xemu_input_set_override(i, &g_bench.input[i]);
+        }
+    }
+}
+
+/* Add the frames flipped since the last call to the recording */
+static void collect_frames(void)
+{
+    unsigned int frame_count = qatomic_read(&g_nv2a_stats.frame_count);
+    unsigned int frame_ptr = qatomic_read(&g_nv2a_stats.frame_ptr);
+    unsigned int n = frame_count - g_bench.last_frame_count;
+
+    // Older frames have already been overwritten in the history
+    if (n > NV2A_PROF_NUM_FRAMES) {
+        g_bench.dropped_frames += n - NV2A_PROF_NUM_FRAMES;
+        n = NV2A_PROF_NUM_FRAMES;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+        unsigned int idx = (frame_ptr + NV2A_PROF_NUM_FRAMES - n + i) %
+                           NV2A_PROF_NUM_FRAMES;
+        typeof(g_nv2a_stats.frame_history[0]) *frame =
+            &g_nv2a_stats.frame_history[idx];
+        g_array_append_val(g_bench.mspf, frame->mspf);
+        for (int c = 0; c < NV2A_PROF__COUNT; c++) {
+            g_bench.counters[c] += frame->counters[c];
+        }
+    }
+
+    g_bench.last_frame_count = frame_count;
+}
+
+static void sample_apu(int64_t now)
+{
+    if (now - g_bench.last_apu_sample_us < 1000000) {
+        return;
+    }
+
+    // Updated by the APU once per second
+    float utilization = mcpx_apu_get_debug_info()->utilization;
+    g_bench.apu_utilization_sum += utilization;
+    g_bench.apu_utilization_max = MAX(g_bench.apu_utilization_max,
+                                      utilization);
+    g_bench.apu_samples++;
+    g_bench.last_apu_sample_us = now;
+}
+
+static int compare_int(gconstpointer a, gconstpointer b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+/* Nearest-rank percentile of the sorted frame times */
+static int get_percentile(GArray *sorted, int p)
+{
+    if (!sorted->len) {
+        return 0;
+    }
+    unsigned int rank = (sorted->len * p + 99) / 100;
+    return g_array_index(sorted, int, MAX(rank, 1) - 1);
+}
+
+static char *build_report(int64_t elapsed_us)
+{
+    GString *out = g_string_new("{\n");
+    double seconds = elapsed_us / 1e6;
+
+    g_array_sort(g_bench.mspf, compare_int);
+    double mspf_sum = 0;
+    for (unsigned int i = 0; i < g_bench.mspf->len; i++) {
+        mspf_sum += g_array_index(g_bench.mspf, int, i);
+    }
+
+    g_string_append_printf(out, "  \"title_id\": \"%08x\",\n",
+                           xemu_title_profile_get_title_id());
+    g_string_append_printf(out, "  \"seconds\": %.3f,\n", seconds);
+    g_string_append_printf(out, "  \"frames\": %u,\n", g_bench.mspf->len);
+    g_string_append_printf(out, "  \"dropped_frames\": %u,\n",
+                           g_bench.dropped_frames);
+    g_string_append_printf(out, "  \"fps\": %.2f,\n",
+                           (g_bench.mspf->len + g_bench.dropped_frames) /
+                               seconds);
+    g_string_append_printf(
+        out,
+        "  \"mspf\": { \"mean\": %.2f, \"p50\": %d, \"p95\": %d, "
+        "\"p99\": %d, \"max\": %d },\n",
+        g_bench.mspf->len ? mspf_sum / g_bench.mspf->len : 0.0,
+        get_percentile(g_bench.mspf, 50), get_percentile(g_bench.mspf, 95),
+        get_percentile(g_bench.mspf, 99),
+        get_percentile(g_bench.mspf, 100));
+
+    g_string_append_printf(
+        out, "  \"apu\": { \"utilization_mean\": %.3f, "
+        "\"utilization_max\": %.3f },\n",
+        g_bench.apu_samples ?
+            g_bench.apu_utilization_sum / g_bench.apu_samples : 0.0,
+        g_bench.apu_utilization_max);
+
+    g_string_append(out, "  \"counters\": {");
+    for (int c = 0; c < NV2A_PROF__COUNT; c++) {
+        g_string_append_printf(out, "%s\n    \"%s\": %" PRIu64, c ? "," : "",
+                               nv2a_profile_get_counter_name(c),
+                               g_bench.counters[c]);
+    }
+    g_string_append(out, "\n  },\n");
+
+    TCGRuntimeStats tcg;
+    tcg_get_runtime_stats(&tcg);
+    g_string_append_printf(
+        out,
+        "  \"tcg\": { \"code_size\": %zu, \"code_capacity\": %zu, "
+        "\"tbs\": %zu, \"flushes\": %u, \"invalidations\": %u, "
+        "\"translated\": %" PRIu64 ", \"translate_ms\": %.3f, "
+        "\"idle_ms\": %.3f, \"idle_parks\": %" PRIu64 " }\n",
+        tcg.code_size, tcg.code_capacity, tcg.nb_tbs,
+        tcg.flush_count - g_bench.tcg_start.flush_count,
+        tcg.invalidate_count - g_bench.tcg_start.invalidate_count,
+        tcg.gen_count - g_bench.tcg_start.gen_count,
+        (tcg.gen_time_ns - g_bench.tcg_start.gen_time_ns) / 1e6,
+        (tcg.idle_ns - g_bench.tcg_start.idle_ns) / 1e6,
+        tcg.idle_parks - g_bench.tcg_start.idle_parks);
+
+    g_string_append(out, "}\n");
+    return g_string_free(out, false);
+}
+
+static void finish(int64_t now)
+{
+    g_autofree char *report = build_report(now - g_bench.record_start_us);
+
+    if (g_bench.opts.output_path) {
+        g_autoptr(GError) err = NULL;
+        if (!g_file_set_contents(g_bench.opts.output_path, report, -1,
+                                 &err)) {
+            error_report("Failed to write benchmark results to %s: %s",
+                         g_bench.opts.output_path, err->message);
+        }
+    } else {
+        fputs(report, stdout);
+        fflush(stdout);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (g_bench.input_used[i]) {
+            xemu_input_set_override(i, NULL);
+        }
+    }
+    g_array_free(g_bench.events, true);
+    g_array_free(g_bench.mspf, true);
+    g_bench.state = BENCH_IDLE;
+
+    qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_UI);
+}
+
+void xemu_bench_frame(void)
+{
+    if (g_bench.state == BENCH_IDLE) {
+        return;
+    }
+
+    int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    apply_input_events(now - g_bench.start_us);
+
+    if (g_bench.state == BENCH_WARMUP) {
+        if (now - g_bench.start_us < g_bench.opts.warmup * 1e6) {
+            return;
+        }
+        g_bench.state = BENCH_RECORDING;
+        g_bench.record_start_us = now;
+        g_bench.last_apu_sample_us = now;
+        g_bench.last_frame_count = qatomic_read(&g_nv2a_stats.frame_count);
+        tcg_get_runtime_stats(&g_bench.tcg_start);
+        return;
+    }
+
+    collect_frames();
+    sample_apu(now);
+
+    if (now - g_bench.record_start_us >= g_bench.opts.seconds * 1e6) {
+        finish(now);
+    }
+}
@@ -0,0 +1,53 @@
+/*
+ * xemu headless benchmark mode
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_RUNAHEAD
+#ifndef XEMU_BENCH
+#define XEMU_BENCH
+
+#include <stdbool.h>
+#include "qapi/error.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct XemuBenchOptions {
+    double seconds;          // Length of the recording, 0 if not benchmarking
+    double warmup;           // Seconds from boot before recording starts
+    const char *input_path;  // Input script, or NULL
+    const char *output_path; // JSON report, or NULL for stdout
+} XemuBenchOptions;
+
+// Load the input script and start the clock. Called with the BQL held once
+// the machine has been created.
+bool xemu_bench_start(const XemuBenchOptions *opts, Error **errp);
+
+// Called once per presented frame, after the vblank, with the BQL held
+void xemu_bench_frame(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * xemu fast boot
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "block/block_int.h"
+#include "migration/snapshot.h"
+#include "system/block-backend.h"
+#include "system/runstate.h"
+#include "hw/xbox/smbus.h"
+#include "xemu-fast-boot.h"
+#include "xemu-notifications.h"
+#include "xemu-settings.h"
+#include "xemu-version.h"
+
+/*
+ * Fast boot caches the machine as it is when the kernel, done initializing,
+ * reads the tray state to pick what to launch. Nothing has been read from the
+ * disc at that point, so one state serves every disc: it is restored right
+ * after startup and the disc in the drive is presented as newly inserted.
+ *
+ * The state is only valid for the BIOS, EEPROM and machine settings it was
+ * captured with, which name the cache file. Block devices are not part of it
+ * and the HDD is not reverted, so saves made by titles are kept.
+ */
+#define FAST_BOOT_DIR "fast-boot"
+#define FAST_BOOT_SUFFIX ".bin"
+
+typedef enum FastBootState {
+    FAST_BOOT_START,
+    FAST_BOOT_ARMED,
+    FAST_BOOT_CAPTURE,
+    FAST_BOOT_DONE,
+} FastBootState;
+
+static FastBootState fast_boot_state = FAST_BOOT_START;
+
+static void fingerprint_add_file(GChecksum *sum, const char *path)
+{
+    g_autofree gchar *data = NULL;
+    gsize size;
+
+    g_checksum_update(sum, (const guchar *)path, strlen(path) + 1);
+    if (*path && g_file_get_contents(path, &data, &size, NULL)) {
+        g_checksum_update(sum, (const guchar *)data, size);
+    }
+}
+
+static char *fast_boot_path(void)
+{
+    g_autoptr(GChecksum) sum = g_checksum_new(G_CHECKSUM_SHA256);
+    g_autofree char *settings = g_strdup_printf(
+        "%s|%d|%d|%d|%s", xemu_version, g_config.sys.mem_limit,
+        g_config.sys.avpack, g_config.general.skip_boot_anim,
+        g_config.sys.files.hdd_path);
+    g_autofree char *file = NULL;
+
+    g_checksum_update(sum, (const guchar *)settings, strlen(settings));
+    fingerprint_add_file(sum, g_config.sys.files.bootrom_path);
+    fingerprint_add_file(sum, g_config.sys.files.flashrom_path);
+    fingerprint_add_file(sum, g_config.sys.files.eeprom_path);
+
+    file = g_strconcat(g_checksum_get_string(sum), FAST_BOOT_SUFFIX, NULL);
+    return g_build_filename(xemu_settings_get_base_path(), FAST_BOOT_DIR, file,
+                            NULL);
+}
+
+// Runs on the vCPU, the state is captured once the VM has stopped
+static void fast_boot_tray_read(void *opaque)
+{
+    if (fast_boot_state != FAST_BOOT_ARMED) {
+        return;
+    }
+    fast_boot_state = FAST_BOOT_CAPTURE;
+    qemu_system_vmstop_request_prepare();
+    qemu_system_vmstop_request(RUN_STATE_PAUSED);
+}
+
+// Drop states captured with other settings, only one is kept
+static void fast_boot_remove_others(const char *path)
+{
+    g_autofree char *dir_path = g_path_get_dirname(path);
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    const char *name;
+
+    if (!dir) {
+        return;
+    }
+    while ((name = g_dir_read_name(dir))) {
+        g_autofree char *other = g_build_filename(dir_path, name, NULL);
+        if (g_str_has_suffix(name, FAST_BOOT_SUFFIX) && strcmp(other, path)) {
+            unlink(other);
+        }
+    }
+    g_dir_close(dir);
+}
+
+static void fast_boot_capture(void)
+{
+    g_autofree char *path = fast_boot_path();
+    g_autofree char *dir = g_path_get_dirname(path);
+    Error *err = NULL;
+
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        error_setg_errno(&err, errno, "Could not create %s", dir);
+    } else if (save_vmstate_file(path, &err)) {
+        fast_boot_remove_others(path);
+    }
+    if (err) {
+        error_prepend(&err, "Fast boot: ");
+        xemu_queue_error_message(error_get_pretty(err));
+        error_free(err);
+    }
+    vm_start();
+}
+
+// Present the disc as newly inserted, the guest may have seen another one
+static void fast_boot_swap_disc(void)
+{
+    BlockBackend *blk = blk_by_name("ide0-cd1");
+
+    if (blk && blk_is_inserted(blk)) {
+        blk_dev_change_media_cb(blk, true, NULL);
+    }
+    xbox_smc_update_tray_state();
+}
+
+static bool fast_boot_restore(const char *path)
+{
+    Error *err = NULL;
+
+    vm_stop(RUN_STATE_RESTORE_VM);
+    if (load_vmstate_file(path, &err)) {
+        fast_boot_swap_disc();
+        vm_start();
+        return true;
+    }
+
+    // Boot normally and capture a new state on the way
+    error_prepend(&err, "Fast boot: ");
+    xemu_queue_error_message(error_get_pretty(err));
+    error_free(err);
+    unlink(path);
+    qemu_system_reset(SHUTDOWN_CAUSE_HOST_UI);
+    vm_start();
+    return false;
+}
+
+void xemu_fast_boot_update(void)
+{
+    switch (fast_boot_state) {
+    case FAST_BOOT_START: {
+        const char *dvd_path = g_config.sys.files.dvd_path;
+
+        fast_boot_state = FAST_BOOT_DONE;
+
+        // The state is taken on the way to a disc, and only from a cold boot
+        if (!g_config.general.fast_boot || !dvd_path || !*dvd_path ||
+            !runstate_is_running()) {
+            return;
+        }
+
+        g_autofree char *path = fast_boot_path();
+        if (g_file_test(path, G_FILE_TEST_IS_REGULAR) &&
+            fast_boot_restore(path)) {
+            return;
+        }
+
+        fast_boot_state = FAST_BOOT_ARMED;
+        xbox_smc_notify_tray_read(fast_boot_tray_read, NULL);
+        break;
+    }
+    case FAST_BOOT_CAPTURE:
+        // Wait for the stop requested from the vCPU
+        if (runstate_check(RUN_STATE_PAUSED)) {
+            fast_boot_state = FAST_BOOT_DONE;
+            fast_boot_capture();
+        }
+        break;
+    default:
+        break;
+    }
+}
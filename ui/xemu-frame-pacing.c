@@ -0,0 +1,322 @@
+/*
+ * xemu frame pacing
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "xemu-settings.h"
+#include "xemu-frame-pacing.h"
+
+#include <epoxy/gl.h>
+
+#ifdef __ANDROID__
+#include <android/choreographer.h>
+#include <android/looper.h>
+#endif
+
+/*
+ * The refresh loop presents at the emulated 60 Hz rate, and the guest's
+ * vblank is raised right after each present. In low latency mode with FIFO
+ * presentation, the start of each refresh is delayed so the present lands
+ * just before a host vblank. The framebuffer and input are then sampled as
+ * late as possible instead of up to a full host refresh early.
+ */
+
+#define EMULATED_REFRESH_INTERVAL 16666666 // ns
+
+// Headroom left before the predicted host vblank in low latency mode
+#define LOW_LATENCY_SAFETY_MARGIN 2000000 // ns
+
+XemuFramePacingStats g_frame_pacing_stats;
+
+static struct {
+    SDL_Window *window;
+    int swap_interval;
+    int64_t host_refresh_interval;
+    int64_t frame_start;
+    int64_t last_present;
+    int64_t last_input_poll;
+    int64_t prev_input_poll;
+    int64_t present_cost; // Smoothed, ns
+    bool has_gl; // False when the renderer presents without GL
+    GLsync fence;
+} g_pacing;
+
+#ifdef __ANDROID__
+/*
+ * Mailbox presents return straight away, so they don't show when the host
+ * refreshes. The choreographer reports the time of every vsync instead, on
+ * a looper thread of its own. Frame times use CLOCK_MONOTONIC, the same
+ * clock as QEMU_CLOCK_REALTIME.
+ */
+static int64_t g_last_vsync;
+
+static void post_vsync_callback(AChoreographer *choreographer);
+
+#if __ANDROID_API__ >= 29
+static void vsync_callback(int64_t frame_time_ns, void *data)
+#else
+static void vsync_callback(long frame_time_ns, void *data)
+#endif
+{
+    qatomic_set(&g_last_vsync, (int64_t)frame_time_ns);
+    post_vsync_callback(data);
+}
+
+static void post_vsync_callback(AChoreographer *choreographer)
+{
+#if __ANDROID_API__ >= 29
+    AChoreographer_postFrameCallback64(choreographer, vsync_callback,
+                                       choreographer);
+#else
+    AChoreographer_postFrameCallback(choreographer, vsync_callback,
+                                     choreographer);
+#endif
+}
+
+static void *vsync_thread(void *opaque)
+{
+    ALooper_prepare(0);
+    AChoreographer *choreographer = AChoreographer_getInstance();
+    if (!choreographer) {
+        return NULL;
+    }
+
+    post_vsync_callback(choreographer);
+    while (true) {
+        ALooper_pollOnce(-1, NULL, NULL, NULL);
+    }
+
+    return NULL;
+}
+
+static void start_vsync_thread(void)
+{
+    static bool started;
+    QemuThread thread;
+
+    if (!started) {
+        started = true;
+        qemu_thread_create(&thread, "xemu-vsync", vsync_thread, NULL,
+                           QEMU_THREAD_DETACHED);
+    }
+}
+#endif
+
+static int64_t get_time_ns(void)
+{
+    return qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
+
+static CONFIG_DISPLAY_WINDOW_PRESENT_MODE get_present_mode(void)
+{
+    if (!g_config.display.window.vsync) {
+        return CONFIG_DISPLAY_WINDOW_PRESENT_MODE_IMMEDIATE;
+    }
+
+    return g_config.display.window.present_mode;
+}
+
+static int get_swap_interval(CONFIG_DISPLAY_WINDOW_PRESENT_MODE mode)
+{
+    switch (mode) {
+    case CONFIG_DISPLAY_WINDOW_PRESENT_MODE_IMMEDIATE:
+        return 0;
+    case CONFIG_DISPLAY_WINDOW_PRESENT_MODE_MAILBOX:
+        // GL has no mailbox mode. Adaptive sync is the closest: it waits for
+        // vblank when on time, but doesn't hold back a late frame.
+        return -1;
+    case CONFIG_DISPLAY_WINDOW_PRESENT_MODE_FIFO:
+    default:
+        return 1;
+    }
+}
+
+static void update_host_refresh_rate(void)
+{
+    SDL_DisplayMode mode;
+    int display = SDL_GetWindowDisplayIndex(g_pacing.window);
+    int refresh_rate = 60;
+
+    if (display >= 0 && !SDL_GetCurrentDisplayMode(display, &mode) &&
+        mode.refresh_rate > 0) {
+        refresh_rate = mode.refresh_rate;
+    }
+
+    g_pacing.host_refresh_interval = NANOSECONDS_PER_SECOND / refresh_rate;
+    g_frame_pacing_stats.refresh_rate = refresh_rate;
+}
+
+void xemu_frame_pacing_init(SDL_Window *window)
+{
+    memset(&g_pacing, 0, sizeof(g_pacing));
+    g_pacing.window = window;
+    g_pacing.swap_interval = INT_MIN;
+    g_pacing.has_gl = SDL_GL_GetCurrentContext() != NULL;
+    update_host_refresh_rate();
+    xemu_frame_pacing_update_swap_interval();
+#ifdef __ANDROID__
+    start_vsync_thread();
+#endif
+}
+
+/*
+ * Apply the configured present mode to the current GL context. Called from
+ * the render loop so changes made in the settings take effect immediately.
+ */
+void xemu_frame_pacing_update_swap_interval(void)
+{
+    int interval = get_swap_interval(get_present_mode());
+    if (interval == g_pacing.swap_interval) {
+        return;
+    }
+
+    if (g_pacing.has_gl && SDL_GL_SetSwapInterval(interval) && interval < 0) {
+        SDL_GL_SetSwapInterval(1);
+    }
+    g_pacing.swap_interval = interval;
+    update_host_refresh_rate();
+}
+
+/*
+ * Get the time of a recent host vblank, if it is known.
+ */
+static int64_t get_last_vblank(void)
+{
+#ifdef __ANDROID__
+    int64_t vsync = qatomic_read(&g_last_vsync);
+    if (vsync) {
+        return vsync;
+    }
+#endif
+
+    // The last FIFO present returned at a host vblank
+    return g_pacing.swap_interval == 1 ? g_pacing.last_present : 0;
+}
+
+/*
+ * Get the time at which the next refresh should start.
+ */
+int64_t xemu_frame_pacing_get_deadline(void)
+{
+    int64_t deadline = g_pacing.frame_start + EMULATED_REFRESH_INTERVAL;
+    int64_t last_vblank = get_last_vblank();
+
+    if (!g_config.display.window.low_latency || !last_vblank) {
+        return deadline;
+    }
+
+    // Aim for the first vblank that leaves time to present after the
+    // emulated refresh is due
+    int64_t period = g_pacing.host_refresh_interval;
+    int64_t lead = g_pacing.present_cost + LOW_LATENCY_SAFETY_MARGIN;
+    int64_t vblanks = (deadline + lead - last_vblank + period - 1) / period;
+    int64_t vblank = last_vblank + MAX(vblanks, 1) * period;
+
+    return vblank - lead;
+}
+
+void xemu_frame_pacing_frame_started(int64_t now)
+{
+    g_pacing.frame_start = now;
+}
+
+void xemu_frame_pacing_input_polled(void)
+{
+    g_pacing.last_input_poll = get_time_ns();
+}
+
+/*
+ * Mark the end of the present's GL commands, so they can be waited on
+ * without draining everything else queued on the context.
+ */
+void xemu_frame_pacing_insert_fence(void)
+{
+    if (!g_pacing.has_gl) {
+        return;
+    }
+    if (g_pacing.fence) {
+        glDeleteSync(g_pacing.fence);
+    }
+    g_pacing.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void wait_for_fence(void)
+{
+    if (g_pacing.fence) {
+        GLenum result = glClientWaitSync(g_pacing.fence,
+                                         GL_SYNC_FLUSH_COMMANDS_BIT,
+                                         (GLuint64)5000000000);
+        if (result == GL_WAIT_FAILED) {
+            glFinish();
+        }
+        glDeleteSync(g_pacing.fence);
+        g_pacing.fence = NULL;
+    } else {
+        glFinish();
+    }
+}
+
+/*
+ * Wait until the present has finished reading the guest framebuffer, so it
+ * can be handed back to the renderer.
+ */
+void xemu_frame_pacing_wait_for_gpu(void)
+{
+    int64_t start = get_time_ns();
+
+    // Without GL the present request has already waited for the renderer
+    if (g_pacing.has_gl) {
+        wait_for_fence();
+    }
+
+    int64_t now = get_time_ns();
+    g_frame_pacing_stats.gpu_wait_ms = (now - start) / 1e6f;
+
+    // Cost of each present, smoothed so one late frame doesn't move the
+    // low latency deadline much
+    int64_t cost = now - g_pacing.frame_start;
+    if (g_pacing.frame_start && cost > 0 && cost < NANOSECONDS_PER_SECOND) {
+        g_pacing.present_cost += (cost - g_pacing.present_cost) / 8;
+    }
+    g_frame_pacing_stats.present_ms = g_pacing.present_cost / 1e6f;
+}
+
+void xemu_frame_pacing_frame_presented(void)
+{
+    int64_t now = get_time_ns();
+    g_pacing.last_present = now;
+
+    // Input is visible to the guest from the vblank following its poll, so
+    // the frame being shown now was rendered using input polled during the
+    // previous refresh. Add half a refresh for scanout of the frame.
+    if (g_pacing.prev_input_poll) {
+        int64_t latency = now - g_pacing.prev_input_poll +
+                          g_pacing.host_refresh_interval / 2;
+        g_frame_pacing_stats.input_latency_ms +=
+            (latency / 1e6f - g_frame_pacing_stats.input_latency_ms) * 0.1f;
+    }
+    g_pacing.prev_input_poll = g_pacing.last_input_poll;
+}
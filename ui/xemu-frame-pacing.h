@@ -0,0 +1,57 @@
+/*
+ * xemu frame pacing
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_FRAME_PACING
+#define XEMU_FRAME_PACING
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct XemuFramePacingStats {
+    float refresh_rate;       // Host display refresh rate, in Hz
+    float present_ms;         // Refresh start until the frame is handed off
+    float gpu_wait_ms;        // Time spent waiting for the frame to render
+    float input_latency_ms;   // Estimated input poll to photon latency
+} XemuFramePacingStats;
+
+extern XemuFramePacingStats g_frame_pacing_stats;
+
+void xemu_frame_pacing_init(SDL_Window *window);
+void xemu_frame_pacing_update_swap_interval(void);
+int64_t xemu_frame_pacing_get_deadline(void);
+void xemu_frame_pacing_frame_started(int64_t now);
+void xemu_frame_pacing_input_polled(void);
+void xemu_frame_pacing_insert_fence(void);
+void xemu_frame_pacing_wait_for_gpu(void);
+void xemu_frame_pacing_frame_presented(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
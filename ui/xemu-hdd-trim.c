@@ -0,0 +1,204 @@
+/*
+ * xemu HDD trim
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/host-utils.h"
+#include "qemu/units.h"
+#include "system/block-backend.h"
+#include "xemu-hdd-trim.h"
+
+/*
+ * Deleted saves and cache files leave their clusters allocated in the image,
+ * so it only ever grows and fragments. Before the guest runs, the FAT of each
+ * FATX partition on the disk is all there is to know about it, so the free
+ * clusters it lists are discarded: qcow2 images reuse them for new data and
+ * drop them from snapshots to come, raw images get holes.
+ */
+#define HDD_NAME "ide0-hd0"
+#define HDD_SECTOR_SIZE 512
+
+#define HDD_PARTINFO_MAGIC "****PARTINFO****"
+#define HDD_PARTINFO_ENTRIES 14
+#define HDD_PARTINFO_IN_USE 0x80000000
+
+#define FATX_SIGNATURE 0x58544146
+#define FATX_FAT_OFFSET 0x1000
+#define FATX_FAT_ALIGN 0x1000
+#define FATX_FAT16_MAX_CLUSTERS 65525
+#define FATX_MAX_SECTORS_PER_CLUSTER 1024
+
+#define FAT_READ_SIZE (256 * KiB)
+
+typedef struct HddPartition {
+    int64_t offset;
+    int64_t size;
+} HddPartition;
+
+// Retail layout: X, Y, Z, C and E, the rest of larger disks being F
+static const HddPartition hdd_retail_partitions[] = {
+    { 0x00080000LL, 0x2ee00000LL },
+    { 0x2ee80000LL, 0x2ee00000LL },
+    { 0x5dc80000LL, 0x2ee00000LL },
+    { 0x8ca80000LL, 0x1f400000LL },
+    { 0xabe80000LL, 0x1312d6000LL },
+};
+#define HDD_RETAIL_END 0x1dd156000LL
+
+// Table written to the first sector by partitioning tools for larger disks
+typedef struct QEMU_PACKED HddPartInfoEntry {
+    char name[16];
+    uint32_t flags;
+    uint32_t lba_start;
+    uint32_t lba_size;
+    uint32_t reserved;
+} HddPartInfoEntry;
+
+typedef struct QEMU_PACKED HddPartInfo {
+    char magic[16];
+    char reserved[32];
+    HddPartInfoEntry entries[HDD_PARTINFO_ENTRIES];
+} HddPartInfo;
+
+typedef struct QEMU_PACKED FatxSuperblock {
+    uint32_t signature;
+    uint32_t volume_id;
+    uint32_t sectors_per_cluster;
+    uint32_t root_cluster;
+} FatxSuperblock;
+
+static int hdd_get_partitions(BlockBackend *blk, int64_t disk_size,
+                              HddPartition *parts)
+{
+    HddPartInfo info;
+    int n = 0;
+
+    if (blk_pread(blk, 0, sizeof(info), &info, 0) >= 0 &&
+        !memcmp(info.magic, HDD_PARTINFO_MAGIC, sizeof(info.magic))) {
+        for (int i = 0; i < HDD_PARTINFO_ENTRIES; i++) {
+            const HddPartInfoEntry *e = &info.entries[i];
+            if (le32_to_cpu(e->flags) & HDD_PARTINFO_IN_USE) {
+                parts[n].offset =
+                    (int64_t)le32_to_cpu(e->lba_start) * HDD_SECTOR_SIZE;
+                parts[n].size =
+                    (int64_t)le32_to_cpu(e->lba_size) * HDD_SECTOR_SIZE;
+                n++;
+            }
+        }
+        return n;
+    }
+
+    for (; n < ARRAY_SIZE(hdd_retail_partitions); n++) {
+        parts[n] = hdd_retail_partitions[n];
+    }
+    if (disk_size > HDD_RETAIL_END) {
+        parts[n].offset = HDD_RETAIL_END;
+        parts[n].size = disk_size - HDD_RETAIL_END;
+        n++;
+    }
+    return n;
+}
+
+// Discard the free clusters of partition @p, if it holds a FATX file system
+static void hdd_trim_partition(BlockBackend *blk, int64_t disk_size,
+                               const HddPartition *p)
+{
+    int64_t end = p->offset + p->size;
+    FatxSuperblock sb;
+
+    if (p->size <= 0 || end > disk_size ||
+        blk_pread(blk, p->offset, sizeof(sb), &sb, 0) < 0 ||
+        le32_to_cpu(sb.signature) != FATX_SIGNATURE) {
+        return;
+    }
+
+    uint32_t sectors_per_cluster = le32_to_cpu(sb.sectors_per_cluster);
+    if (!is_power_of_2(sectors_per_cluster) ||
+        sectors_per_cluster > FATX_MAX_SECTORS_PER_CLUSTER) {
+        return;
+    }
+
+    // The FAT has an entry per cluster the partition could hold, 16 bit wide
+    // on smaller partitions. Entry 0 is reserved, and cluster 1 is the first
+    // of the data area that follows the FAT.
+    int64_t cluster_size = (int64_t)sectors_per_cluster * HDD_SECTOR_SIZE;
+    int64_t num_clusters = p->size / cluster_size;
+    int entry_size = num_clusters < FATX_FAT16_MAX_CLUSTERS ? 2 : 4;
+    int64_t fat = p->offset + FATX_FAT_OFFSET;
+    int64_t data = fat + ROUND_UP(num_clusters * entry_size, FATX_FAT_ALIGN);
+    if (data >= end) {
+        return;
+    }
+    int64_t last = MIN(num_clusters, (end - data) / cluster_size + 1);
+
+    g_autofree uint8_t *buf = g_malloc(FAT_READ_SIZE);
+    int64_t per_read = FAT_READ_SIZE / entry_size;
+    int64_t run = 0;
+
+    for (int64_t base = 0; base < last; base += per_read) {
+        int64_t n = MIN(per_read, last - base);
+
+        if (blk_pread(blk, fat + base * entry_size, n * entry_size, buf,
+                      0) < 0) {
+            return;
+        }
+
+        for (int64_t i = MAX(base, 1); i < base + n; i++) {
+            const uint8_t *e = buf + (i - base) * entry_size;
+            bool is_free = entry_size == 2 ? !lduw_le_p(e) : !ldl_le_p(e);
+
+            if (is_free && !run) {
+                run = i;
+            } else if (!is_free && run) {
+                blk_pdiscard(blk, data + (run - 1) * cluster_size,
+                             (i - run) * cluster_size);
+                run = 0;
+            }
+        }
+    }
+    if (run) {
+        blk_pdiscard(blk, data + (run - 1) * cluster_size,
+                     (last - run) * cluster_size);
+    }
+}
+
+void xemu_hdd_trim(void)
+{
+    BlockBackend *blk = blk_by_name(HDD_NAME);
+    HddPartition parts[HDD_PARTINFO_ENTRIES];
+
+    if (!blk || !blk_is_inserted(blk) || !blk_is_writable(blk)) {
+        return;
+    }
+
+    int64_t disk_size = blk_getlength(blk);
+    if (disk_size < 0) {
+        return;
+    }
+
+    int n = hdd_get_partitions(blk, disk_size, parts);
+    for (int i = 0; i < n; i++) {
+        hdd_trim_partition(blk, disk_size, &parts[i]);
+    }
+}
@@ -27,10 +27,16 @@
 #include "qemu/option.h"
 #include "qemu/timer.h"
 #include "qemu/config-file.h"
+#include "qemu/main-loop.h"
+#include "qemu/seqlock.h"
+#include "qemu/thread.h"
 
 #include "xemu-input.h"
 #include "xemu-notifications.h"
 #include "xemu-settings.h"
+#ifdef __ANDROID__
+#include "xemu-android-input.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -48,6 +54,41 @@
 
 #define XEMU_INPUT_MIN_INPUT_UPDATE_INTERVAL_US  2500
 #define XEMU_INPUT_MIN_RUMBLE_UPDATE_INTERVAL_US 2500
+#define XEMU_INPUT_SAMPLE_INTERVAL_NS            1000000
+
+typedef struct ControllerSampleSlot {
+    QemuSeqLock lock;
+    ControllerSample sample;
+} ControllerSampleSlot;
+
+// Held by the input thread while it samples, and by the main thread while it
+// adds or removes controllers or reallocates their mappings
+static QemuMutex input_thread_lock;
+static bool input_thread_running;
+
+// Input replacing that of the device bound to each port, see
+// xemu_input_set_override
+static struct {
+    QemuSeqLock lock;
+    bool active;
+    ControllerSample sample;
+} input_override[4];
+
+static NotifierList input_change_notifiers =
+    NOTIFIER_LIST_INITIALIZER(input_change_notifiers);
+static QEMUBH *input_change_bh;
+
+static void *xemu_input_thread(void *opaque);
+
+static void xemu_input_notify_change(void *opaque)
+{
+    notifier_list_notify(&input_change_notifiers, NULL);
+}
+
+void xemu_input_add_change_notifier(Notifier *notifier)
+{
+    notifier_list_add(&input_change_notifiers, notifier);
+}
 
 #if 0
 static void xemu_input_print_controller_state(ControllerState *state)
@@ -277,11 +318,23 @@ void xemu_input_init(void)
         SDL_SetHint(SDL_HINT_JOYSTICK_ALLOW_BACKGROUND_EVENTS, "1");
     }
 
+    // Joysticks are updated from the input thread too
+    SDL_SetHint(SDL_HINT_JOYSTICK_THREAD, "1");
+    qemu_mutex_init(&input_thread_lock);
+    input_change_bh = qemu_bh_new(xemu_input_notify_change, NULL);
+    for (int i = 0; i < ARRAY_SIZE(input_override); i++) {
+        seqlock_init(&input_override[i].lock);
+    }
+
     if (SDL_Init(SDL_INIT_GAMECONTROLLER) < 0) {
         fprintf(stderr, "Failed to initialize SDL gamecontroller subsystem: %s\n", SDL_GetError());
         exit(1);
     }
 
+#ifdef __ANDROID__
+    xemu_android_input_init();
+#endif
+
     // Create the keyboard input (always first)
     ControllerState *new_con = malloc(sizeof(ControllerState));
     memset(new_con, 0, sizeof(ControllerState));
@@ -319,6 +372,11 @@ void xemu_input_init(void)
     }
 
     QTAILQ_INSERT_TAIL(&available_controllers, new_con, entry);
+
+    QemuThread thread;
+    input_thread_running = true;
+    qemu_thread_create(&thread, "xemu-input", xemu_input_thread, NULL,
+                       QEMU_THREAD_DETACHED);
 }
 
 int xemu_input_get_controller_default_bind_port(ControllerState *state, int start)
@@ -361,7 +419,7 @@ void xemu_save_peripheral_settings(int player_index, int peripheral_index,
         peripheral_parameter == NULL ? "" : peripheral_parameter);
 }
 
-void xemu_input_process_sdl_events(const SDL_Event *event)
+static void xemu_input_handle_device_event(const SDL_Event *event)
 {
     if (event->type == SDL_CONTROLLERDEVICEADDED) {
         DPRINTF("Controller Added: %d\n", event->cdevice.which);
@@ -388,6 +446,8 @@ void xemu_input_process_sdl_events(const SDL_Event *event)
         new_con->peripheral_types[1] = PERIPHERAL_NONE;
         new_con->peripherals[0] = NULL;
         new_con->peripherals[1] = NULL;
+        new_con->sample_slot = g_new0(ControllerSampleSlot, 1);
+        seqlock_init(&new_con->sample_slot->lock);
 
         char guid_buf[35] = { 0 };
         SDL_JoystickGetGUIDString(new_con->sdl_joystick_guid, guid_buf, sizeof(guid_buf));
@@ -480,6 +540,7 @@ void xemu_input_process_sdl_events(const SDL_Event *event)
                     if (iter->peripherals[i])
                         g_free(iter->peripherals[i]);
                 }
+                g_free(iter->sample_slot);
                 free(iter);
 
                 handled = 1;
@@ -494,8 +555,82 @@ void xemu_input_process_sdl_events(const SDL_Event *event)
     }
 }
 
+void xemu_input_process_sdl_events(const SDL_Event *event)
+{
+    if (event->type != SDL_CONTROLLERDEVICEADDED &&
+        event->type != SDL_CONTROLLERDEVICEREMOVED &&
+        event->type != SDL_CONTROLLERDEVICEREMAPPED) {
+        return;
+    }
+
+    qemu_mutex_lock(&input_thread_lock);
+    xemu_input_handle_device_event(event);
+    qemu_mutex_unlock(&input_thread_lock);
+}
+
+static bool xemu_input_get_override(int port, ControllerSample *sample)
+{
+    if (port < 0 || port >= ARRAY_SIZE(input_override)) {
+        return false;
+    }
+
+    bool active;
+    unsigned int start;
+    do {
+        start = seqlock_read_begin(&input_override[port].lock);
+        active = input_override[port].active;
+        *sample = input_override[port].sample;
+    } while (seqlock_read_retry(&input_override[port].lock, start));
+
+    return active;
+}
+
+void xemu_input_set_override(int port, const ControllerSample *sample)
+{
+    assert(port >= 0 && port < ARRAY_SIZE(input_override));
+
+    seqlock_write_begin(&input_override[port].lock);
+    input_override[port].active = sample != NULL;
+    if (sample) {
+        input_override[port].sample = *sample;
+    }
+    seqlock_write_end(&input_override[port].lock);
+}
+
+void xemu_input_get_sample(ControllerState *state, ControllerSample *sample)
+{
+    ControllerSampleSlot *slot = state->sample_slot;
+
+    if (xemu_input_get_override(state->bound, sample)) {
+        return;
+    }
+
+    if (!input_thread_running || !slot) {
+        xemu_input_update_controller(state);
+        sample->timestamp_us = state->last_input_updated_ts;
+        sample->buttons = state->buttons;
+        memcpy(sample->axis, state->axis, sizeof(sample->axis));
+        return;
+    }
+
+    unsigned int start;
+    do {
+        start = seqlock_read_begin(&slot->lock);
+        *sample = slot->sample;
+    } while (seqlock_read_retry(&slot->lock, start));
+}
+
 void xemu_input_update_controller(ControllerState *state)
 {
+    if (input_thread_running && state->sample_slot) {
+        ControllerSample sample;
+        xemu_input_get_sample(state, &sample);
+        state->buttons = sample.buttons;
+        memcpy(state->axis, sample.axis, sizeof(state->axis));
+        state->last_input_updated_ts = sample.timestamp_us;
+        return;
+    }
+
     int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     if (ABS(now - state->last_input_updated_ts) <
         XEMU_INPUT_MIN_INPUT_UPDATE_INTERVAL_US) {
@@ -573,10 +708,11 @@ void xemu_input_update_sdl_kbd_controller_state(ControllerState *state)
 #undef KBD_STATE
 }
 
-void xemu_input_update_sdl_controller_state(ControllerState *state)
+static void xemu_input_read_sdl_controller(ControllerState *state,
+                                           uint16_t *buttons, int16_t *axis)
 {
-    state->buttons = 0;
-    memset(state->axis, 0, sizeof(state->axis));
+    *buttons = 0;
+    memset(axis, 0, sizeof(int16_t) * CONTROLLER_AXIS__COUNT);
     if (!state->controller_map) {
         return;
     }
@@ -587,21 +723,21 @@ void xemu_input_update_sdl_controller_state(ControllerState *state)
          (state)->controller_map->controller_mapping.btn) \
      << idx)
 
-    state->buttons |= SDL_MASK_BUTTON(state, a, 0);
-    state->buttons |= SDL_MASK_BUTTON(state, b, 1);
-    state->buttons |= SDL_MASK_BUTTON(state, x, 2);
-    state->buttons |= SDL_MASK_BUTTON(state, y, 3);
-    state->buttons |= SDL_MASK_BUTTON(state, dpad_left, 4);
-    state->buttons |= SDL_MASK_BUTTON(state, dpad_up, 5);
-    state->buttons |= SDL_MASK_BUTTON(state, dpad_right, 6);
-    state->buttons |= SDL_MASK_BUTTON(state, dpad_down, 7);
-    state->buttons |= SDL_MASK_BUTTON(state, back, 8);
-    state->buttons |= SDL_MASK_BUTTON(state, start, 9);
-    state->buttons |= SDL_MASK_BUTTON(state, lshoulder, 10);
-    state->buttons |= SDL_MASK_BUTTON(state, rshoulder, 11);
-    state->buttons |= SDL_MASK_BUTTON(state, lstick_btn, 12);
-    state->buttons |= SDL_MASK_BUTTON(state, rstick_btn, 13);
-    state->buttons |= SDL_MASK_BUTTON(state, guide, 14);
+    *buttons |= SDL_MASK_BUTTON(state, a, 0);
+    *buttons |= SDL_MASK_BUTTON(state, b, 1);
+    *buttons |= SDL_MASK_BUTTON(state, x, 2);
+    *buttons |= SDL_MASK_BUTTON(state, y, 3);
+    *buttons |= SDL_MASK_BUTTON(state, dpad_left, 4);
+    *buttons |= SDL_MASK_BUTTON(state, dpad_up, 5);
+    *buttons |= SDL_MASK_BUTTON(state, dpad_right, 6);
+    *buttons |= SDL_MASK_BUTTON(state, dpad_down, 7);
+    *buttons |= SDL_MASK_BUTTON(state, back, 8);
+    *buttons |= SDL_MASK_BUTTON(state, start, 9);
+    *buttons |= SDL_MASK_BUTTON(state, lshoulder, 10);
+    *buttons |= SDL_MASK_BUTTON(state, rshoulder, 11);
+    *buttons |= SDL_MASK_BUTTON(state, lstick_btn, 12);
+    *buttons |= SDL_MASK_BUTTON(state, rstick_btn, 13);
+    *buttons |= SDL_MASK_BUTTON(state, guide, 14);
 
 #undef SDL_MASK_BUTTON
 
@@ -610,18 +746,18 @@ void xemu_input_update_sdl_controller_state(ControllerState *state)
         (state)->sdl_gamecontroller, \
         (state)->controller_map->controller_mapping.axis)
 
-    state->axis[0] = SDL_GET_AXIS(state, axis_trigger_left);
-    state->axis[1] = SDL_GET_AXIS(state, axis_trigger_right);
-    state->axis[2] = SDL_GET_AXIS(state, axis_left_x);
-    state->axis[3] = SDL_GET_AXIS(state, axis_left_y);
-    state->axis[4] = SDL_GET_AXIS(state, axis_right_x);
-    state->axis[5] = SDL_GET_AXIS(state, axis_right_y);
+    axis[0] = SDL_GET_AXIS(state, axis_trigger_left);
+    axis[1] = SDL_GET_AXIS(state, axis_trigger_right);
+    axis[2] = SDL_GET_AXIS(state, axis_left_x);
+    axis[3] = SDL_GET_AXIS(state, axis_left_y);
+    axis[4] = SDL_GET_AXIS(state, axis_right_x);
+    axis[5] = SDL_GET_AXIS(state, axis_right_y);
 
 #undef SDL_GET_AXIS
 
 // FIXME: Check range
 #define INVERT_AXIS(controller_axis) \
-    state->axis[controller_axis] = -1 - state->axis[controller_axis]
+    axis[controller_axis] = -1 - axis[controller_axis]
 
     if (state->controller_map->controller_mapping.invert_axis_left_x) {
         INVERT_AXIS(CONTROLLER_AXIS_LSTICK_X);
@@ -640,10 +776,73 @@ void xemu_input_update_sdl_controller_state(ControllerState *state)
     }
 
 #undef INVERT_AXIS
+}
+
+void xemu_input_update_sdl_controller_state(ControllerState *state)
+{
+    xemu_input_read_sdl_controller(state, &state->buttons, state->axis);
 
     // xemu_input_print_controller_state(state);
 }
 
+/*
+ * Gamepads are read at 1 kHz on their own thread, so a guest poll sees input
+ * from within the last millisecond instead of from the last display frame.
+ * The keyboard is still read on the main thread, its state only changes when
+ * SDL events are pumped there.
+ */
+static void xemu_input_sample_controllers(void)
+{
+    ControllerState *iter;
+    bool changed = false;
+
+    SDL_LockJoysticks();
+    SDL_JoystickUpdate();
+    int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    QTAILQ_FOREACH(iter, &available_controllers, entry) {
+        ControllerSampleSlot *slot = iter->sample_slot;
+        if (!slot) {
+            continue;
+        }
+
+        ControllerSample sample = { .timestamp_us = now };
+        xemu_input_read_sdl_controller(iter, &sample.buttons, sample.axis);
+        changed |= sample.buttons != slot->sample.buttons ||
+                   memcmp(sample.axis, slot->sample.axis, sizeof(sample.axis));
+
+        seqlock_write_begin(&slot->lock);
+        slot->sample = sample;
+        seqlock_write_end(&slot->lock);
+    }
+    SDL_UnlockJoysticks();
+
+    if (changed) {
+        qemu_bh_schedule(input_change_bh);
+    }
+}
+
+static void *xemu_input_thread(void *opaque)
+{
+    int64_t next = get_clock();
+
+    while (true) {
+        qemu_mutex_lock(&input_thread_lock);
+        xemu_input_sample_controllers();
+        qemu_mutex_unlock(&input_thread_lock);
+
+        // Keep the rate, but don't try to catch up after a stall
+        next += XEMU_INPUT_SAMPLE_INTERVAL_NS;
+        int64_t now = get_clock();
+        if (next > now) {
+            g_usleep((next - now) / SCALE_US);
+        } else {
+            next = now;
+        }
+    }
+
+    return NULL;
+}
+
 void xemu_input_update_rumble(ControllerState *state)
 {
     if (state->type != INPUT_DEVICE_SDL_GAMECONTROLLER) {
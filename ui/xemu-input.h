@@ -28,6 +28,7 @@
 #include <SDL2/SDL.h>
 #include <stdbool.h>
 
+#include "qemu/notify.h"
 #include "qemu/queue.h"
 #include "xemu-settings.h"
 #include <SDL2/SDL.h>
@@ -80,6 +81,12 @@ typedef struct XmuState {
     void *dev;
 } XmuState;
 
+typedef struct ControllerSample {
+    int64_t  timestamp_us; // QEMU_CLOCK_REALTIME when the device was read
+    uint16_t buttons;
+    int16_t  axis[CONTROLLER_AXIS__COUNT];
+} ControllerSample;
+
 typedef struct ControllerState {
     QTAILQ_ENTRY(ControllerState) entry;
 
@@ -90,6 +97,10 @@ typedef struct ControllerState {
     uint16_t buttons;
     int16_t  axis[CONTROLLER_AXIS__COUNT];
 
+    // Latest state from the input thread, written at 1 kHz and read without
+    // taking a lock
+    struct ControllerSampleSlot *sample_slot;
+
     // Rendering state hacked on here for convenience but needs to be moved (FIXME)
     uint32_t animate_guide_button_end;
     uint32_t animate_trigger_end;
@@ -128,6 +139,7 @@ void xemu_input_init(void);
 void xemu_input_process_sdl_events(const SDL_Event *event); // SDL_CONTROLLERDEVICEADDED, SDL_CONTROLLERDEVICEREMOVED
 void xemu_input_update_controllers(void);
 void xemu_input_update_controller(ControllerState *state);
+void xemu_input_get_sample(ControllerState *state, ControllerSample *sample);
 void xemu_input_update_sdl_kbd_controller_state(ControllerState *state);
 void xemu_input_update_sdl_controller_state(ControllerState *state);
 void xemu_input_update_rumble(ControllerState *state);
@@ -142,6 +154,14 @@ void xemu_save_peripheral_settings(int player_index, int peripheral_index,
                                    int peripheral_type,
                                    const char *peripheral_parameter);
 
+// Replace the input of the device bound to @port, as for scripted input.
+// Pass NULL to return to the device.
+void xemu_input_set_override(int port, const ControllerSample *sample);
+
+// Notified on the main thread when the input thread sees a controller change,
+// so that devices only reporting changes can wake up their endpoint
+void xemu_input_add_change_notifier(Notifier *notifier);
+
 void xemu_input_set_test_mode(int enabled);
 int xemu_input_get_test_mode(void);
 void xemu_input_reset_input_mapping(ControllerState *state);
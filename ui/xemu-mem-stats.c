@@ -0,0 +1,164 @@
+/*
+ * xemu memory accounting
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+#include "qemu/module.h"
+#include "qapi/error.h"
+#include "qapi/type-helpers.h"
+#include "qapi/qapi-commands-machine.h"
+#include "monitor/monitor.h"
+#include "accel/tcg/runtime-stats.h"
+#include "xemu-mem-stats.h"
+
+struct XemuMemAccount {
+    char *group;
+    char *name;
+    uint64_t live;
+    uint64_t peak;
+};
+
+static struct {
+    QemuMutex lock;
+    GPtrArray *accounts;
+    XemuMemAccount *tcg_code_buffer;
+} g_mem_stats;
+
+static void __attribute__((constructor)) xemu_mem_stats_init(void)
+{
+    qemu_mutex_init(&g_mem_stats.lock);
+    g_mem_stats.accounts = g_ptr_array_new();
+}
+
+XemuMemAccount *xemu_mem_account(const char *group, const char *name)
+{
+    XemuMemAccount *account = NULL;
+
+    qemu_mutex_lock(&g_mem_stats.lock);
+    for (int i = 0; i < g_mem_stats.accounts->len; i++) {
+        XemuMemAccount *a = g_ptr_array_index(g_mem_stats.accounts, i);
+        if (!strcmp(a->group, group) && !strcmp(a->name, name)) {
+            account = a;
+            break;
+        }
+    }
+    if (!account) {
+        account = g_new0(XemuMemAccount, 1);
+        account->group = g_strdup(group);
+        account->name = g_strdup(name);
+        g_ptr_array_add(g_mem_stats.accounts, account);
+    }
+    qemu_mutex_unlock(&g_mem_stats.lock);
+
+    return account;
+}
+
+static void update_peak(XemuMemAccount *account, uint64_t live)
+{
+    uint64_t peak = qatomic_read(&account->peak);
+    while (live > peak) {
+        uint64_t prev = qatomic_cmpxchg(&account->peak, peak, live);
+        if (prev == peak) {
+            break;
+        }
+        peak = prev;
+    }
+}
+
+void xemu_mem_account_add(XemuMemAccount *account, int64_t bytes)
+{
+    uint64_t live = qatomic_add_fetch(&account->live, (uint64_t)bytes);
+    assert((int64_t)live >= 0);
+    update_peak(account, live);
+}
+
+void xemu_mem_account_set(XemuMemAccount *account, uint64_t bytes)
+{
+    qatomic_set(&account->live, bytes);
+    update_peak(account, bytes);
+}
+
+// The code buffer is managed by TCG itself, so sample it when asked
+static void update_tcg_accounts(void)
+{
+    if (!g_mem_stats.tcg_code_buffer) {
+        g_mem_stats.tcg_code_buffer = xemu_mem_account("tcg", "code buffer");
+    }
+
+    TCGRuntimeStats st;
+    tcg_get_runtime_stats(&st);
+    xemu_mem_account_set(g_mem_stats.tcg_code_buffer, st.code_size);
+}
+
+XemuMemAccountStats *xemu_mem_get_stats(size_t *count)
+{
+    update_tcg_accounts();
+
+    qemu_mutex_lock(&g_mem_stats.lock);
+    *count = g_mem_stats.accounts->len;
+    XemuMemAccountStats *stats = g_new(XemuMemAccountStats, *count);
+    for (int i = 0; i < *count; i++) {
+        XemuMemAccount *a = g_ptr_array_index(g_mem_stats.accounts, i);
+        stats[i] = (XemuMemAccountStats){
+            .group = a->group,
+            .name = a->name,
+            .live = qatomic_read(&a->live),
+            .peak = qatomic_read(&a->peak),
+        };
+    }
+    qemu_mutex_unlock(&g_mem_stats.lock);
+
+    return stats;
+}
+
+HumanReadableText *qmp_x_query_xemu_memory(Error **errp)
+{
+    g_autoptr(GString) buf = g_string_new("");
+    size_t count;
+    g_autofree XemuMemAccountStats *stats = xemu_mem_get_stats(&count);
+    uint64_t total_live = 0, total_peak = 0;
+
+    g_string_append_printf(buf, "%-6s %-28s %12s %12s\n", "group", "name",
+                           "live KiB", "peak KiB");
+    for (size_t i = 0; i < count; i++) {
+        g_string_append_printf(buf, "%-6s %-28s %12" PRIu64 " %12" PRIu64 "\n",
+                               stats[i].group, stats[i].name,
+                               stats[i].live / 1024, stats[i].peak / 1024);
+        total_live += stats[i].live;
+        total_peak += stats[i].peak;
+    }
+    // Peaks of different accounts need not coincide, so their sum is a bound
+    g_string_append_printf(buf, "%-35s %12" PRIu64 " %12" PRIu64 "\n", "total",
+                           total_live / 1024, total_peak / 1024);
+
+    return human_readable_text_from_str(buf);
+}
+
+static void xemu_mem_stats_register_hmp(void)
+{
+    monitor_register_hmp_info_hrt("xemu-memory", qmp_x_query_xemu_memory);
+}
+
+type_init(xemu_mem_stats_register_hmp);
@@ -0,0 +1,62 @@
+/*
+ * xemu memory accounting
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_MEM_STATS
+#define XEMU_MEM_STATS
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Accounts of the memory held by renderer, audio and CPU emulator
+ * allocations, named by group (e.g. "vk") and category within the group.
+ * Accounts are never freed, so callers look one up once and keep it. Updates
+ * are lock-free and may come from any thread.
+ */
+typedef struct XemuMemAccount XemuMemAccount;
+
+typedef struct XemuMemAccountStats {
+    const char *group;
+    const char *name;
+    uint64_t live;  // Bytes currently held
+    uint64_t peak;  // Highest live value since startup
+} XemuMemAccountStats;
+
+// Find the account named group/name, creating it if it doesn't exist yet
+XemuMemAccount *xemu_mem_account(const char *group, const char *name);
+
+void xemu_mem_account_add(XemuMemAccount *account, int64_t bytes);
+void xemu_mem_account_set(XemuMemAccount *account, uint64_t bytes);
+
+// Snapshot all accounts in creation order. Free the result with g_free.
+XemuMemAccountStats *xemu_mem_get_stats(size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
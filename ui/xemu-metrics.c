@@ -0,0 +1,292 @@
+/*
+ * xemu metrics exporter
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/error-report.h"
+#include "qemu/sockets.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-machine.h"
+#include "io/channel-socket.h"
+#include "io/net-listener.h"
+#include "accel/tcg/runtime-stats.h"
+#include "hw/xbox/mcpx/apu/apu_debug.h"
+#include "hw/xbox/nv2a/debug.h"
+#include "xemu-mem-stats.h"
+#include "xemu-settings.h"
+#include "xemu-metrics.h"
+
+// Requests larger than this are not from a metrics scraper
+#define MAX_REQUEST_SIZE 4096
+
+typedef struct MetricsClient {
+    QIOChannelSocket *sioc;
+    GString *request;
+} MetricsClient;
+
+static QIONetListener *metrics_listener;
+
+static double get_hit_rate(enum NV2A_PROF_COUNTERS_ENUM hit,
+                           enum NV2A_PROF_COUNTERS_ENUM miss)
+{
+    uint64_t hits = nv2a_profile_get_counter_total(hit);
+    uint64_t lookups = hits + nv2a_profile_get_counter_total(miss);
+    return lookups ? (double)hits / lookups : 0;
+}
+
+/*
+ * Everything read here is either written atomically or a plain value that is
+ * safe to read torn, so the hot paths updating it never take a lock.
+ */
+XemuStats *qmp_query_xemu_stats(Error **errp)
+{
+    XemuStats *stats = g_new0(XemuStats, 1);
+
+    unsigned int last_frame =
+        (qatomic_read(&g_nv2a_stats.frame_ptr) + NV2A_PROF_NUM_FRAMES - 1) %
+        NV2A_PROF_NUM_FRAMES;
+    stats->fps = qatomic_read(&g_nv2a_stats.increment_fps);
+    stats->mspf = g_nv2a_stats.frame_history[last_frame].mspf;
+    stats->frames = qatomic_read(&g_nv2a_stats.total_frames);
+
+    XemuStatsCounterList **counters_tail = &stats->counters;
+    for (int i = 0; i < NV2A_PROF__COUNT; i++) {
+        XemuStatsCounter *counter = g_new0(XemuStatsCounter, 1);
+        counter->name = g_strdup(nv2a_profile_get_counter_name(i));
+        counter->value = nv2a_profile_get_counter_total(i);
+        QAPI_LIST_APPEND(counters_tail, counter);
+    }
+
+    stats->shader_cache_hit_rate =
+        get_hit_rate(NV2A_PROF_SHADER_CACHE_HIT, NV2A_PROF_SHADER_CACHE_MISS);
+    stats->pipeline_cache_hit_rate = get_hit_rate(
+        NV2A_PROF_PIPELINE_CACHE_HIT, NV2A_PROF_PIPELINE_CACHE_MISS);
+    stats->texture_cache_hit_rate =
+        get_hit_rate(NV2A_PROF_TEX_CACHE_HIT, NV2A_PROF_TEX_CACHE_MISS);
+
+    const struct McpxApuDebug *apu = mcpx_apu_get_debug_info();
+    stats->apu_utilization = apu->utilization;
+    stats->vp_workers = apu->vp.num_workers;
+
+    TCGRuntimeStats tcg;
+    tcg_get_runtime_stats(&tcg);
+    stats->tb_flushes = tcg.flush_count;
+    stats->tb_invalidations = tcg.invalidate_count;
+
+    size_t count;
+    g_autofree XemuMemAccountStats *accounts = xemu_mem_get_stats(&count);
+    XemuStatsMemoryList **memory_tail = &stats->memory;
+    for (size_t i = 0; i < count; i++) {
+        XemuStatsMemory *memory = g_new0(XemuStatsMemory, 1);
+        memory->group = g_strdup(accounts[i].group);
+        memory->name = g_strdup(accounts[i].name);
+        memory->live = accounts[i].live;
+        memory->peak = accounts[i].peak;
+        QAPI_LIST_APPEND(memory_tail, memory);
+    }
+
+    return stats;
+}
+
+static void append_metric(GString *buf, const char *name, const char *type,
+                          const char *help)
+{
+    g_string_append_printf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help,
+                           name, type);
+}
+
+// Format the stats in the Prometheus text exposition format
+static GString *format_prometheus(const XemuStats *stats)
+{
+    GString *buf = g_string_new("");
+
+    append_metric(buf, "xemu_fps", "gauge", "Frames flipped per second");
+    g_string_append_printf(buf, "xemu_fps %g\n", stats->fps);
+    append_metric(buf, "xemu_frame_time_ms", "gauge",
+                  "Milliseconds taken by the last frame");
+    g_string_append_printf(buf, "xemu_frame_time_ms %" PRId64 "\n",
+                           stats->mspf);
+    append_metric(buf, "xemu_frames_total", "counter", "Frames rendered");
+    g_string_append_printf(buf, "xemu_frames_total %" PRIu64 "\n",
+                           stats->frames);
+
+    append_metric(buf, "xemu_nv2a_events_total", "counter",
+                  "Renderer profiling counters");
+    for (XemuStatsCounterList *c = stats->counters; c; c = c->next) {
+        g_string_append_printf(buf,
+                               "xemu_nv2a_events_total{counter=\"%s\"} "
+                               "%" PRIu64 "\n",
+                               c->value->name, c->value->value);
+    }
+
+    append_metric(buf, "xemu_cache_hit_ratio", "gauge",
+                  "Fraction of renderer cache lookups which hit");
+    g_string_append_printf(buf, "xemu_cache_hit_ratio{cache=\"shader\"} %g\n",
+                           stats->shader_cache_hit_rate);
+    g_string_append_printf(buf,
+                           "xemu_cache_hit_ratio{cache=\"pipeline\"} %g\n",
+                           stats->pipeline_cache_hit_rate);
+    g_string_append_printf(buf, "xemu_cache_hit_ratio{cache=\"texture\"} %g\n",
+                           stats->texture_cache_hit_rate);
+
+    append_metric(buf, "xemu_apu_utilization", "gauge",
+                  "Fraction of the audio frame time spent processing");
+    g_string_append_printf(buf, "xemu_apu_utilization %g\n",
+                           stats->apu_utilization);
+    append_metric(buf, "xemu_apu_vp_workers", "gauge",
+                  "Threads processing APU voices");
+    g_string_append_printf(buf, "xemu_apu_vp_workers %" PRId64 "\n",
+                           stats->vp_workers);
+
+    append_metric(buf, "xemu_tb_flushes_total", "counter",
+                  "Translation block cache flushes");
+    g_string_append_printf(buf, "xemu_tb_flushes_total %" PRIu64 "\n",
+                           stats->tb_flushes);
+    append_metric(buf, "xemu_tb_invalidations_total", "counter",
+                  "Translation block invalidations");
+    g_string_append_printf(buf, "xemu_tb_invalidations_total %" PRIu64 "\n",
+                           stats->tb_invalidations);
+
+    append_metric(buf, "xemu_memory_bytes", "gauge", "Accounted memory");
+    for (XemuStatsMemoryList *m = stats->memory; m; m = m->next) {
+        g_string_append_printf(buf,
+                               "xemu_memory_bytes{group=\"%s\",name=\"%s\"} "
+                               "%" PRIu64 "\n",
+                               m->value->group, m->value->name,
+                               m->value->live);
+    }
+    append_metric(buf, "xemu_memory_peak_bytes", "gauge",
+                  "Highest accounted memory since startup");
+    for (XemuStatsMemoryList *m = stats->memory; m; m = m->next) {
+        g_string_append_printf(buf,
+                               "xemu_memory_peak_bytes{group=\"%s\","
+                               "name=\"%s\"} %" PRIu64 "\n",
+                               m->value->group, m->value->name,
+                               m->value->peak);
+    }
+
+    return buf;
+}
+
+static void respond(MetricsClient *client)
+{
+    QIOChannel *ioc = QIO_CHANNEL(client->sioc);
+    const char *status = "404 Not Found";
+    g_autoptr(GString) body = NULL;
+
+    if (g_str_has_prefix(client->request->str, "GET /metrics ") ||
+        g_str_has_prefix(client->request->str, "GET /metrics?")) {
+        g_autoptr(XemuStats) stats = qmp_query_xemu_stats(NULL);
+        status = "200 OK";
+        body = format_prometheus(stats);
+    } else {
+        body = g_string_new("Not found\n");
+    }
+
+    g_autofree char *header = g_strdup_printf(
+        "HTTP/1.0 %s\r\n"
+        "Content-Type: text/plain; version=0.0.4\r\n"
+        "Content-Length: %zu\r\n"
+        "Connection: close\r\n\r\n",
+        status, body->len);
+
+    // The response fits in the socket buffer of any scraper worth serving
+    qio_channel_set_blocking(ioc, true, NULL);
+    if (qio_channel_write_all(ioc, header, strlen(header), NULL) == 0) {
+        qio_channel_write_all(ioc, body->str, body->len, NULL);
+    }
+}
+
+static gboolean client_readable(QIOChannel *ioc, GIOCondition condition,
+                                gpointer opaque)
+{
+    MetricsClient *client = opaque;
+    char buf[512];
+
+    ssize_t len = qio_channel_read(ioc, buf, sizeof(buf), NULL);
+    if (len == QIO_CHANNEL_ERR_BLOCK) {
+        return G_SOURCE_CONTINUE;
+    }
+    if (len > 0) {
+        g_string_append_len(client->request, buf, len);
+        if (!strstr(client->request->str, "\r\n\r\n") &&
+            client->request->len < MAX_REQUEST_SIZE) {
+            return G_SOURCE_CONTINUE;
+        }
+        respond(client);
+    }
+
+    qio_channel_close(ioc, NULL);
+    return G_SOURCE_REMOVE;
+}
+
+static void free_client(gpointer opaque)
+{
+    MetricsClient *client = opaque;
+    object_unref(OBJECT(client->sioc));
+    g_string_free(client->request, true);
+    g_free(client);
+}
+
+static void accept_client(QIONetListener *listener, QIOChannelSocket *sioc,
+                          gpointer opaque)
+{
+    MetricsClient *client = g_new0(MetricsClient, 1);
+    client->sioc = sioc;
+    client->request = g_string_new("");
+    object_ref(OBJECT(sioc));
+
+    qio_channel_set_name(QIO_CHANNEL(sioc), "xemu-metrics-client");
+    qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
+    qio_channel_add_watch(QIO_CHANNEL(sioc), G_IO_IN | G_IO_HUP | G_IO_ERR,
+                          client_readable, client, free_client);
+}
+
+void xemu_metrics_init(void)
+{
+    const char *addr_str = g_config.perf.metrics_addr;
+    Error *err = NULL;
+
+    if (!addr_str || !addr_str[0]) {
+        return;
+    }
+
+    SocketAddress *addr = socket_parse(addr_str, &err);
+    if (addr) {
+        metrics_listener = qio_net_listener_new();
+        qio_net_listener_set_name(metrics_listener, "xemu-metrics-listener");
+        if (qio_net_listener_open_sync(metrics_listener, addr, 1, &err) < 0) {
+            object_unref(OBJECT(metrics_listener));
+            metrics_listener = NULL;
+        }
+        qapi_free_SocketAddress(addr);
+    }
+    if (err) {
+        error_reportf_err(err, "Failed to serve metrics on %s: ", addr_str);
+        return;
+    }
+
+    qio_net_listener_set_client_func(metrics_listener, accept_client, NULL,
+                                     NULL);
+}
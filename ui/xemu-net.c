@@ -35,6 +35,7 @@
 #include "net/net.h"
 #include "net/hub.h"
 #include "net/slirp.h"
+#include "net/relay.h"
 #include <libslirp.h>
 #if defined(_WIN32)
 #include <pcap/pcap.h>
@@ -65,6 +66,15 @@ void xemu_net_enable(void)
         qdict_put_str(qdict, "type",      "socket");
         qdict_put_str(qdict, "udp",       g_config.net.udp.remote_addr);
         qdict_put_str(qdict, "localaddr", g_config.net.udp.bind_addr);
+    } else if (g_config.net.backend == CONFIG_NET_BACKEND_RELAY) {
+        qdict = qdict_new();
+        qdict_put_str(qdict, "id",        id);
+        qdict_put_str(qdict, "type",      "relay");
+        qdict_put_str(qdict, "localaddr", g_config.net.relay.bind_addr);
+        qdict_put_str(qdict, "peers",     g_config.net.relay.peers);
+        qdict_put_bool(qdict, "hub",      g_config.net.relay.hub);
+        qdict_put_int(qdict, "aggregate-us",
+                      MAX(g_config.net.relay.aggregate_us, 0));
     } else if (g_config.net.backend == CONFIG_NET_BACKEND_PCAP) {
 #if defined(_WIN32)
         if (pcap_load_library()) {
@@ -194,6 +204,11 @@ void xemu_net_disable(void)
     g_config.net.enable = false;
 }
 
+int xemu_net_get_relay_stats(NetRelayPeerStats *stats, int max)
+{
+    return net_relay_get_stats(id, stats, max);
+}
+
 int xemu_net_is_enabled(void)
 {
     NetClientState *nc;
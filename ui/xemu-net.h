@@ -22,6 +22,8 @@
 #ifndef XEMU_NETWORK_H
 #define XEMU_NETWORK_H
 
+#include "net/relay.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -30,6 +32,9 @@ void xemu_net_enable(void);
 void xemu_net_disable(void);
 int xemu_net_is_enabled(void);
 
+/* Per-peer statistics of the relay backend, -1 if it is not active */
+int xemu_net_get_relay_stats(NetRelayPeerStats *stats, int max);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,92 @@
+/*
+ * xemu input rollback
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "migration/rollback.h"
+#include "system/runstate.h"
+#include "xemu-input.h"
+#include "xemu-settings.h"
+#include "xemu-runahead.h"
+
+/*
+ * Input rollback. The machine is captured after every emulated frame. When
+ * a button changes, it is rolled back by input.runahead_frames frames and
+ * continues from there with the new input, so the press lands that many
+ * frames earlier in game time.
+ *
+ * Classic run-ahead emulates the frames ahead in a burst and only presents
+ * the last one, but here the guest runs in real time on its own threads, so
+ * the frames in between are replayed at normal speed instead.
+ */
+
+#define RUNAHEAD_MAX_FRAMES 8
+
+static uint16_t last_buttons[4];
+static bool capture_failed;
+
+static bool buttons_changed(void)
+{
+    bool changed = false;
+
+    for (int i = 0; i < 4; i++) {
+        uint16_t buttons = bound_controllers[i] ?
+                               bound_controllers[i]->buttons : 0;
+        changed |= buttons != last_buttons[i];
+        last_buttons[i] = buttons;
+    }
+    return changed;
+}
+
+void xemu_runahead_frame(void)
+{
+    int frames = MIN(MAX(g_config.input.runahead_frames, 0),
+                     RUNAHEAD_MAX_FRAMES);
+    Error *err = NULL;
+
+    // One more capture than the rollback distance, the newest is the present
+    rollback_configure(frames ? frames + 1 : 0);
+    if (!frames || !runstate_is_running()) {
+        return;
+    }
+
+    if (buttons_changed() && rollback_count() > (unsigned int)frames) {
+        // Fails when the disk was written since, the press is then kept
+        if (rollback_restore(frames, &err)) {
+            return;
+        }
+        error_free(err);
+        err = NULL;
+    }
+
+    if (!rollback_capture(&err)) {
+        if (!capture_failed) {
+            warn_report_err(err);
+            capture_failed = true;
+        } else {
+            error_free(err);
+        }
+    }
+}
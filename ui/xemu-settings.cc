@@ -18,6 +18,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include <stdlib.h>
 #include <SDL_filesystem.h>
 #include <string.h>
@@ -33,6 +34,7 @@
 
 #include "xemu-controllers.h"
 #include "xemu-settings.h"
+#include "xemu-title-profile.h"
 
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -117,6 +119,21 @@ const char *xemu_settings_get_default_eeprom_path(void)
     return eeprom_path;
 }
 
+bool xemu_settings_low_memory_mode(void)
+{
+    switch (g_config.perf.low_memory) {
+    case CONFIG_PERF_LOW_MEMORY_ON:
+        return true;
+    case CONFIG_PERF_LOW_MEMORY_OFF:
+        return false;
+    default: {
+        // A "6 GB" phone reports a little less than 6 GiB to the kernel
+        size_t phys_mem = qemu_get_host_physmem();
+        return phys_mem && phys_mem <= 6 * GiB;
+    }
+    }
+}
+
 static ssize_t get_file_size(FILE *fd)
 {
     if (fseek(fd, 0, SEEK_END)) {
@@ -250,7 +267,10 @@ void xemu_settings_save(void)
     // controller, so we can set it to true (default) now to remove it from the user config.
     g_config.input.allow_vibration = true;
 
+    // Save the global values, not those layered by the running title's profile
+    xemu_title_profile_settings_save_begin();
     config_tree.update_from_struct(&g_config);
+    xemu_title_profile_settings_save_end();
     fprintf(fd, "%s", config_tree.generate_delta_toml().c_str());
     fclose(fd);
 
@@ -288,6 +308,27 @@ void remove_net_nat_forward_ports(unsigned int index)
     cnode->store_to_struct(&g_config);
 }
 
+int add_perf_title_profile(const char *title_id)
+{
+    auto cnode = config_tree.child("perf")->child("title_profiles");
+    cnode->update_from_struct(&g_config);
+    cnode->children.push_back(*cnode->array_item_type);
+    auto &e = cnode->children.back();
+    e.child("title_id")->set_string(title_id);
+    cnode->free_allocations(&g_config);
+    cnode->store_to_struct(&g_config);
+    return cnode->children.size() - 1;
+}
+
+void remove_perf_title_profile(unsigned int index)
+{
+    auto cnode = config_tree.child("perf")->child("title_profiles");
+    cnode->update_from_struct(&g_config);
+    cnode->children.erase(cnode->children.begin()+index);
+    cnode->free_allocations(&g_config);
+    cnode->store_to_struct(&g_config);
+}
+
 bool xemu_settings_load_gamepad_mapping(const char *guid,
                                         GamepadMappings **mapping)
 {
@@ -63,6 +63,10 @@ bool xemu_settings_load(void);
 // Save config file to disk
 void xemu_settings_save(void);
 
+// Whether the low memory profile is in effect, resolving perf.low_memory=auto
+// from the amount of host RAM
+bool xemu_settings_low_memory_mode(void);
+
 static inline void xemu_settings_set_string(const char **str, const char *new_str)
 {
     assert(new_str);
@@ -73,6 +77,10 @@ static inline void xemu_settings_set_string(const char **str, const char *new_st
 void add_net_nat_forward_ports(int host, int guest, CONFIG_NET_NAT_FORWARD_PORTS_PROTOCOL protocol);
 void remove_net_nat_forward_ports(unsigned int index);
 
+// Returns the index of the new profile in g_config.perf.title_profiles
+int add_perf_title_profile(const char *title_id);
+void remove_perf_title_profile(unsigned int index);
+
 
 // Load gamepad mapping for controller with 'guid', setting the mapping pointer
 // to the config entry. Returns true if the mapping did not previously exist.
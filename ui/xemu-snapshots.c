@@ -18,6 +18,7 @@
  */
 
 #include "xemu-snapshots.h"
+#include "xemu-notifications.h"
 #include "xemu-settings.h"
 #include "xemu-xbe.h"
 
@@ -30,14 +31,23 @@
 #include "block/qdict.h"
 #include "block/block-io.h"
 #include "migration/qemu-file.h"
+#include "migration/quicksave.h"
 #include "migration/snapshot.h"
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
+#include "qemu/cutils.h"
 #include "system/runstate.h"
 
 #include "ui/console.h"
 #include "ui/input.h"
 
+/*
+ * Snapshots saved with general.snapshots.external keep their VM state in a
+ * file per snapshot in <hdd>.snapshots, next to a disk-only snapshot in the
+ * HDD image, so saving does not allocate VM state clusters in the image.
+ */
+#define XEMU_SNAPSHOT_FILE_SUFFIX ".xsnap"
+
 static QEMUSnapshotInfo *xemu_snapshots_metadata = NULL;
 static XemuSnapshotData *xemu_snapshots_extra_data = NULL;
 static int xemu_snapshots_len = 0;
@@ -50,127 +60,477 @@ const char **g_snapshot_shortcut_index_key_map[] = {
     &g_config.general.snapshots.shortcuts.f8,
 };
 
-static void xemu_snapshots_load_data(BlockDriverState *bs_ro,
-                                     QEMUSnapshotInfo *info,
-                                     XemuSnapshotData *data, Error **err)
+/*
+ * Sidecar index of the extra data saved with each snapshot, so listing does
+ * not have to read the vmstate area of the HDD image. Entries are matched to
+ * the image's snapshot table by name, date and vmstate size; snapshots that
+ * are missing from the index (e.g. saved from the monitor) are read from the
+ * image once and added.
+ */
+#define XEMU_SNAPSHOT_INDEX_MAGIC 0x78736978 // 'xsix'
+#define XEMU_SNAPSHOT_INDEX_VERSION 1
+
+typedef struct XemuSnapshotIndexEntry {
+    int64_t date_sec;
+    int64_t date_nsec;
+    uint64_t vm_state_size;
+    GBytes *data;
+} XemuSnapshotIndexEntry;
+
+static GHashTable *xemu_snapshots_index = NULL;
+static char *xemu_snapshots_index_path = NULL;
+static bool xemu_snapshots_index_dirty = false;
+static GBytes *xemu_snapshots_pending_data = NULL;
+
+/*
+ * Saves started from the UI request the thumbnail up front and add it to the
+ * extra data once it is encoded, while the snapshot is compressed.
+ */
+#define XEMU_SNAPSHOT_THUMBNAIL_TIMEOUT_MS 1000
+
+static bool xemu_snapshots_thumbnail_requested = false;
+static bool xemu_snapshots_thumbnail_pending = false;
+
+/* Decoded thumbnails, kept across list rebuilds while the data matches */
+typedef struct XemuSnapshotThumbnail {
+    GBytes *data;
+    GLuint tex;
+    bool used;
+} XemuSnapshotThumbnail;
+
+static GHashTable *xemu_snapshots_thumbnails = NULL;
+
+static char *xemu_snapshots_dir(void)
 {
-    data->disc_path = NULL;
-    data->xbe_title_name = NULL;
-    data->gl_thumbnail = 0;
+    return g_strconcat(g_config.sys.files.hdd_path, ".snapshots", NULL);
+}
 
-    int res = bdrv_snapshot_load_tmp(bs_ro, info->id_str, info->name, err);
-    if (res < 0) {
-        return;
+static char *xemu_snapshots_file_path(const char *vm_name)
+{
+    g_autofree char *dir = xemu_snapshots_dir();
+    g_autofree char *escaped = g_uri_escape_string(vm_name, NULL, true);
+    g_autofree char *file = g_strconcat(escaped, XEMU_SNAPSHOT_FILE_SUFFIX,
+                                        NULL);
+    return g_build_filename(dir, file, NULL);
+}
+
+/*
+ * Snapshot files whose disk-only snapshot is still in the image. A file is
+ * left stale when its snapshot is replaced, e.g. from the monitor.
+ */
+static GArray *xemu_snapshots_list_files(QEMUSnapshotInfo *disk_snapshots,
+                                         int disk_snapshots_len)
+{
+    GArray *found = g_array_new(false, false, sizeof(QEMUSnapshotInfo));
+    g_autofree char *dir_path = xemu_snapshots_dir();
+    GDir *dir = g_dir_open(dir_path, 0, NULL);
+    const char *file;
+
+    if (!dir) {
+        return found;
     }
 
-    uint32_t header[3];
-    int64_t offset = 0;
-    res = bdrv_load_vmstate(bs_ro, (uint8_t *)&header, offset, sizeof(header));
-    if (res != sizeof(header)) {
+    while ((file = g_dir_read_name(dir))) {
+        if (!g_str_has_suffix(file, XEMU_SNAPSHOT_FILE_SUFFIX)) {
+            continue;
+        }
+
+        g_autofree char *path = g_build_filename(dir_path, file, NULL);
+        QEMUSnapshotInfo sn;
+        if (!snapshot_file_read_info(path, &sn, NULL, NULL)) {
+            continue;
+        }
+
+        for (int i = 0; i < disk_snapshots_len; ++i) {
+            QEMUSnapshotInfo *disk = &disk_snapshots[i];
+            if (!disk->vm_state_size && !strcmp(disk->name, sn.name) &&
+                disk->date_sec == sn.date_sec &&
+                disk->date_nsec == sn.date_nsec) {
+                pstrcpy(sn.id_str, sizeof(sn.id_str), disk->id_str);
+                g_array_append_val(found, sn);
+                break;
+            }
+        }
+    }
+
+    g_dir_close(dir);
+    return found;
+}
+
+static void xemu_snapshots_index_entry_free(gpointer p)
+{
+    XemuSnapshotIndexEntry *entry = p;
+    g_bytes_unref(entry->data);
+    g_free(entry);
+}
+
+static bool xemu_snapshots_index_entry_matches(XemuSnapshotIndexEntry *entry,
+                                               QEMUSnapshotInfo *info)
+{
+    return entry->date_sec == info->date_sec &&
+           entry->date_nsec == info->date_nsec &&
+           entry->vm_state_size == info->vm_state_size;
+}
+
+static void xemu_snapshots_index_load(void)
+{
+    char *path = g_strdup_printf("%s.snapshot-index",
+                                 g_config.sys.files.hdd_path);
+
+    if (xemu_snapshots_index &&
+        !g_strcmp0(path, xemu_snapshots_index_path)) {
+        g_free(path);
         return;
     }
-    offset += res;
 
-    if (be32_to_cpu(header[0]) != XEMU_SNAPSHOT_DATA_MAGIC ||
-        be32_to_cpu(header[1]) != XEMU_SNAPSHOT_DATA_VERSION) {
+    if (xemu_snapshots_index) {
+        g_hash_table_destroy(xemu_snapshots_index);
+    }
+    g_free(xemu_snapshots_index_path);
+    xemu_snapshots_index_path = path;
+    xemu_snapshots_index_dirty = false;
+    xemu_snapshots_index = g_hash_table_new_full(
+        g_str_hash, g_str_equal, g_free, xemu_snapshots_index_entry_free);
+
+    gchar *buf;
+    gsize size;
+    if (!g_file_get_contents(path, &buf, &size, NULL)) {
         return;
     }
 
-    size_t size = be32_to_cpu(header[2]);
-    uint8_t *buf = g_malloc(size);
-    res = bdrv_load_vmstate(bs_ro, buf, offset, size);
-    if (res != size) {
-        g_free(buf);
+    const uint8_t *p = (const uint8_t *)buf;
+    const uint8_t *end = p + size;
+
+#define NEED(n) if ((size_t)(end - p) < (n)) goto done
+
+    NEED(12);
+    if (ldl_be_p(p) != XEMU_SNAPSHOT_INDEX_MAGIC ||
+        ldl_be_p(p + 4) != XEMU_SNAPSHOT_INDEX_VERSION) {
+        goto done;
+    }
+    uint32_t count = ldl_be_p(p + 8);
+    p += 12;
+
+    for (uint32_t i = 0; i < count; i++) {
+        NEED(2);
+        size_t name_len = lduw_be_p(p);
+        p += 2;
+        NEED(name_len + 24);
+        char *name = g_strndup((const char *)p, name_len);
+        p += name_len;
+
+        XemuSnapshotIndexEntry *entry = g_new0(XemuSnapshotIndexEntry, 1);
+        entry->date_sec = ldq_be_p(p);
+        entry->date_nsec = ldl_be_p(p + 8);
+        entry->vm_state_size = ldq_be_p(p + 12);
+        size_t data_size = ldl_be_p(p + 20);
+        p += 24;
+        if ((size_t)(end - p) < data_size) {
+            g_free(name);
+            g_free(entry);
+            goto done;
+        }
+        entry->data = g_bytes_new(p, data_size);
+        p += data_size;
+
+        g_hash_table_replace(xemu_snapshots_index, name, entry);
+    }
+
+#undef NEED
+
+done:
+    g_free(buf);
+}
+
+static void xemu_snapshots_index_store(void)
+{
+    if (!xemu_snapshots_index || !xemu_snapshots_index_dirty) {
         return;
     }
 
-    assert(size >= 9);
+    GByteArray *out = g_byte_array_new();
+    uint8_t hdr[24];
+
+    stl_be_p(hdr, XEMU_SNAPSHOT_INDEX_MAGIC);
+    stl_be_p(hdr + 4, XEMU_SNAPSHOT_INDEX_VERSION);
+    stl_be_p(hdr + 8, g_hash_table_size(xemu_snapshots_index));
+    g_byte_array_append(out, hdr, 12);
+
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, xemu_snapshots_index);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        const char *name = key;
+        XemuSnapshotIndexEntry *entry = value;
+        gsize data_size;
+        const uint8_t *data = g_bytes_get_data(entry->data, &data_size);
+        size_t name_len = strlen(name);
+
+        stw_be_p(hdr, name_len);
+        g_byte_array_append(out, hdr, 2);
+        g_byte_array_append(out, (const uint8_t *)name, name_len);
+        stq_be_p(hdr, entry->date_sec);
+        stl_be_p(hdr + 8, entry->date_nsec);
+        stq_be_p(hdr + 12, entry->vm_state_size);
+        stl_be_p(hdr + 20, data_size);
+        g_byte_array_append(out, hdr, 24);
+        g_byte_array_append(out, data, data_size);
+    }
 
-    offset = 0;
+    /* The index is only a cache, so failing to write it is not an error */
+    if (g_file_set_contents(xemu_snapshots_index_path, (const gchar *)out->data,
+                            out->len, NULL)) {
+        xemu_snapshots_index_dirty = false;
+    }
+    g_byte_array_free(out, true);
+}
+
+static void xemu_snapshots_index_add(QEMUSnapshotInfo *info, GBytes *data)
+{
+    XemuSnapshotIndexEntry *entry = g_new0(XemuSnapshotIndexEntry, 1);
+    entry->date_sec = info->date_sec;
+    entry->date_nsec = info->date_nsec;
+    entry->vm_state_size = info->vm_state_size;
+    entry->data = g_bytes_ref(data);
+    g_hash_table_replace(xemu_snapshots_index, g_strdup(info->name), entry);
+    xemu_snapshots_index_dirty = true;
+}
+
+/* Drop entries of snapshots that are no longer in the image */
+static void xemu_snapshots_index_prune(QEMUSnapshotInfo *info,
+                                       int snapshots_len)
+{
+    GHashTableIter iter;
+    gpointer key, value;
+
+    g_hash_table_iter_init(&iter, xemu_snapshots_index);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        bool found = false;
+        for (int i = 0; i < snapshots_len; ++i) {
+            if (!strcmp(info[i].name, key) &&
+                xemu_snapshots_index_entry_matches(value, &info[i])) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            g_hash_table_iter_remove(&iter);
+            xemu_snapshots_index_dirty = true;
+        }
+    }
+}
+
+static void xemu_snapshots_thumbnail_free(gpointer p)
+{
+    XemuSnapshotThumbnail *thumbnail = p;
+    g_bytes_unref(thumbnail->data);
+    if (thumbnail->tex) {
+        glDeleteTextures(1, &thumbnail->tex);
+    }
+    g_free(thumbnail);
+}
 
-    const size_t disc_path_size = be32_to_cpu(*(uint32_t *)&buf[offset]);
+static gboolean xemu_snapshots_thumbnail_unused(gpointer key, gpointer value,
+                                                gpointer opaque)
+{
+    XemuSnapshotThumbnail *thumbnail = value;
+    bool unused = !thumbnail->used;
+    thumbnail->used = false;
+    return unused;
+}
+
+static GLuint xemu_snapshots_get_thumbnail(const char *name, GBytes *bytes,
+                                           const uint8_t *png, size_t size)
+{
+    if (!xemu_snapshots_thumbnails) {
+        xemu_snapshots_thumbnails = g_hash_table_new_full(
+            g_str_hash, g_str_equal, g_free, xemu_snapshots_thumbnail_free);
+    }
+
+    XemuSnapshotThumbnail *thumbnail =
+        g_hash_table_lookup(xemu_snapshots_thumbnails, name);
+    if (thumbnail && g_bytes_equal(thumbnail->data, bytes)) {
+        thumbnail->used = true;
+        return thumbnail->tex;
+    }
+
+    thumbnail = g_new0(XemuSnapshotThumbnail, 1);
+    thumbnail->data = g_bytes_ref(bytes);
+    thumbnail->used = true;
+    glGenTextures(1, &thumbnail->tex);
+    if (!xemu_snapshots_load_png_to_texture(thumbnail->tex, (void *)png,
+                                            size)) {
+        glDeleteTextures(1, &thumbnail->tex);
+        thumbnail->tex = 0;
+    }
+    g_hash_table_replace(xemu_snapshots_thumbnails, g_strdup(name), thumbnail);
+    return thumbnail->tex;
+}
+
+static void xemu_snapshots_parse_data(const char *name, GBytes *bytes,
+                                      XemuSnapshotData *data)
+{
+    gsize size;
+    const uint8_t *buf = g_bytes_get_data(bytes, &size);
+    size_t offset = 0;
+
+    data->disc_path = NULL;
+    data->xbe_title_name = NULL;
+    data->gl_thumbnail = 0;
+
+    if (size < 9) {
+        return;
+    }
+
+    const size_t disc_path_size = ldl_be_p(&buf[offset]);
     offset += 4;
 
+    if (size < offset + disc_path_size + 1) {
+        return;
+    }
     if (disc_path_size) {
-        data->disc_path = (char *)g_malloc(disc_path_size + 1);
-        assert(size >= (offset + disc_path_size));
-        memcpy(data->disc_path, &buf[offset], disc_path_size);
-        data->disc_path[disc_path_size] = 0;
+        data->disc_path = g_strndup((const char *)&buf[offset], disc_path_size);
         offset += disc_path_size;
     }
 
-    assert(size >= (offset + 4));
     const size_t xbe_title_name_size = buf[offset];
     offset += 1;
 
+    if (size < offset + xbe_title_name_size + 4) {
+        return;
+    }
     if (xbe_title_name_size) {
-        data->xbe_title_name = (char *)g_malloc(xbe_title_name_size + 1);
-        assert(size >= (offset + xbe_title_name_size));
-        memcpy(data->xbe_title_name, &buf[offset], xbe_title_name_size);
-        data->xbe_title_name[xbe_title_name_size] = 0;
+        data->xbe_title_name =
+            g_strndup((const char *)&buf[offset], xbe_title_name_size);
         offset += xbe_title_name_size;
     }
 
-    const size_t thumbnail_size = be32_to_cpu(*(uint32_t *)&buf[offset]);
+    const size_t thumbnail_size = ldl_be_p(&buf[offset]);
     offset += 4;
 
-    if (thumbnail_size) {
-        GLuint thumbnail;
-        glGenTextures(1, &thumbnail);
-        assert(size >= (offset + thumbnail_size));
-        if (xemu_snapshots_load_png_to_texture(thumbnail, &buf[offset],
-                                               thumbnail_size)) {
-            data->gl_thumbnail = thumbnail;
-        } else {
-            glDeleteTextures(1, &thumbnail);
-        }
-        offset += thumbnail_size;
+    if (thumbnail_size && size >= offset + thumbnail_size) {
+        data->gl_thumbnail = xemu_snapshots_get_thumbnail(
+            name, bytes, &buf[offset], thumbnail_size);
     }
+}
 
-    g_free(buf);
+/* Read the extra data saved at the start of the snapshot's vmstate */
+static GBytes *xemu_snapshots_read_data(BlockDriverState *bs_ro,
+                                        QEMUSnapshotInfo *info, Error **err)
+{
+    int res = bdrv_snapshot_load_tmp(bs_ro, info->id_str, info->name, err);
+    if (res < 0) {
+        return NULL;
+    }
+
+    uint32_t header[3];
+    int64_t offset = 0;
+    res = bdrv_load_vmstate(bs_ro, (uint8_t *)&header, offset, sizeof(header));
+    if (res != sizeof(header)) {
+        return NULL;
+    }
+    offset += res;
+
+    if (be32_to_cpu(header[0]) != XEMU_SNAPSHOT_DATA_MAGIC ||
+        be32_to_cpu(header[1]) != XEMU_SNAPSHOT_DATA_VERSION) {
+        return g_bytes_new(NULL, 0);
+    }
+
+    size_t size = be32_to_cpu(header[2]);
+    uint8_t *buf = g_malloc(size);
+    res = bdrv_load_vmstate(bs_ro, buf, offset, size);
+    if (res != size) {
+        g_free(buf);
+        return NULL;
+    }
+
+    return g_bytes_new_take(buf, size);
 }
 
+/* Snapshots from internal_len on are snapshot files */
 static void xemu_snapshots_all_load_data(QEMUSnapshotInfo **info,
                                          XemuSnapshotData **data,
-                                         int snapshots_len, Error **err)
+                                         int snapshots_len, int internal_len,
+                                         Error **err)
 {
-    BlockDriverState *bs_ro;
-    QDict *opts = qdict_new();
+    BlockDriverState *bs_ro = NULL;
 
     assert(info && data);
 
     if (*data) {
         for (int i = 0; i < xemu_snapshots_len; ++i) {
+            g_free((*data)[i].disc_path);
             g_free((*data)[i].xbe_title_name);
-            if ((*data)[i].gl_thumbnail) {
-                glDeleteTextures(1, &((*data)[i].gl_thumbnail));
-            }
         }
         g_free(*data);
     }
 
-    *data =
-        (XemuSnapshotData *)g_malloc(sizeof(XemuSnapshotData) * snapshots_len);
-    memset(*data, 0, sizeof(XemuSnapshotData) * snapshots_len);
+    *data = g_new0(XemuSnapshotData, snapshots_len);
 
-    qdict_put_bool(opts, BDRV_OPT_READ_ONLY, true);
-    bs_ro = bdrv_open(g_config.sys.files.hdd_path, NULL, opts,
-                      BDRV_O_RO_WRITE_SHARE | BDRV_O_AUTO_RDONLY, err);
-    if (!bs_ro) {
-        return;
+    xemu_snapshots_index_load();
+    xemu_snapshots_index_prune(*info, internal_len);
+
+    for (int i = internal_len; i < snapshots_len; ++i) {
+        QEMUSnapshotInfo *snapshot = (*info) + i;
+        g_autofree char *path = xemu_snapshots_file_path(snapshot->name);
+        QEMUSnapshotInfo sn;
+        GBytes *bytes;
+
+        /* The extra data is at the start of the file, no index needed */
+        if (snapshot_file_read_info(path, &sn, &bytes, NULL)) {
+            xemu_snapshots_parse_data(snapshot->name, bytes, (*data) + i);
+            g_bytes_unref(bytes);
+        }
     }
 
-    for (int i = 0; i < snapshots_len; ++i) {
-        xemu_snapshots_load_data(bs_ro, (*info) + i, (*data) + i, err);
-        if (*err) {
-            break;
+    for (int i = 0; i < internal_len; ++i) {
+        QEMUSnapshotInfo *snapshot = (*info) + i;
+        XemuSnapshotIndexEntry *entry =
+            g_hash_table_lookup(xemu_snapshots_index, snapshot->name);
+
+        if (!entry) {
+            /* Not indexed yet, fall back to reading the vmstate once */
+            if (!bs_ro) {
+                QDict *opts = qdict_new();
+                qdict_put_bool(opts, BDRV_OPT_READ_ONLY, true);
+                bs_ro = bdrv_open(g_config.sys.files.hdd_path, NULL, opts,
+                                  BDRV_O_RO_WRITE_SHARE | BDRV_O_AUTO_RDONLY,
+                                  err);
+                if (!bs_ro) {
+                    break;
+                }
+            }
+
+            GBytes *bytes = xemu_snapshots_read_data(bs_ro, snapshot, err);
+            if (*err) {
+                break;
+            }
+            if (!bytes) {
+                continue;
+            }
+            xemu_snapshots_index_add(snapshot, bytes);
+            g_bytes_unref(bytes);
+            entry = g_hash_table_lookup(xemu_snapshots_index, snapshot->name);
         }
+
+        xemu_snapshots_parse_data(snapshot->name, entry->data, (*data) + i);
+    }
+
+    /* Drop the textures of snapshots that are gone */
+    if (xemu_snapshots_thumbnails && !(*err)) {
+        g_hash_table_foreach_remove(xemu_snapshots_thumbnails,
+                                    xemu_snapshots_thumbnail_unused, NULL);
     }
 
-    bdrv_flush(bs_ro);
-    bdrv_drain(bs_ro);
-    bdrv_unref(bs_ro);
-    assert(bs_ro->refcnt == 0);
+    if (bs_ro) {
+        bdrv_flush(bs_ro);
+        bdrv_drain(bs_ro);
+        bdrv_unref(bs_ro);
+        assert(bs_ro->refcnt == 0);
+    }
+
+    xemu_snapshots_index_store();
+
     if (!(*err))
         xemu_snapshots_dirty = false;
 }
@@ -196,9 +556,32 @@ int xemu_snapshots_list(QEMUSnapshotInfo **info, XemuSnapshotData **extra_data,
     }
 
     snapshots_len = bdrv_snapshot_list(bs, &xemu_snapshots_metadata);
+    GArray *files = xemu_snapshots_list_files(xemu_snapshots_metadata,
+                                              snapshots_len);
+
+    /*
+     * Other disk-only snapshots (e.g. the quicksave) cannot be loaded from
+     * here, the ones with a snapshot file are listed after the internal ones
+     */
+    int j = 0;
+    for (int i = 0; i < snapshots_len; ++i) {
+        if (xemu_snapshots_metadata[i].vm_state_size) {
+            xemu_snapshots_metadata[j++] = xemu_snapshots_metadata[i];
+        }
+    }
+    int internal_len = j;
+    snapshots_len = j + files->len;
+    xemu_snapshots_metadata =
+        g_renew(QEMUSnapshotInfo, xemu_snapshots_metadata, snapshots_len);
+    if (files->len) {
+        memcpy(xemu_snapshots_metadata + internal_len, files->data,
+               files->len * sizeof(QEMUSnapshotInfo));
+    }
+    g_array_free(files, true);
+
     xemu_snapshots_all_load_data(&xemu_snapshots_metadata,
                                  &xemu_snapshots_extra_data, snapshots_len,
-                                 err);
+                                 internal_len, err);
     if (*err) {
         return -1;
     }
@@ -240,21 +623,157 @@ char *xemu_get_currently_loaded_disc_path(void)
 
 void xemu_snapshots_load(const char *vm_name, Error **err)
 {
+    g_autofree char *path = xemu_snapshots_file_path(vm_name);
     bool vm_running = runstate_is_running();
+    bool ok;
+
     vm_stop(RUN_STATE_RESTORE_VM);
-    if (load_snapshot(vm_name, NULL, false, NULL, err) && vm_running) {
+    if (g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+        ok = load_snapshot_file(path, err);
+    } else {
+        ok = load_snapshot(vm_name, NULL, false, NULL, err);
+    }
+    if (ok && vm_running) {
         vm_start();
     }
 }
 
+/* Index the extra data of a snapshot that was just saved */
+static void xemu_snapshots_index_saved(const char *vm_name)
+{
+    QEMUSnapshotInfo *snapshots = NULL, *found = NULL;
+    BlockDriverState *bs;
+    int snapshots_len;
+
+    bs = bdrv_all_find_vmstate_bs(NULL, false, NULL, NULL);
+    if (!bs) {
+        return;
+    }
+
+    /* Without a name, the snapshot that was just saved is the newest one */
+    snapshots_len = bdrv_snapshot_list(bs, &snapshots);
+    for (int i = 0; i < snapshots_len; ++i) {
+        QEMUSnapshotInfo *sn = &snapshots[i];
+        if (vm_name ? !strcmp(sn->name, vm_name) :
+                      (!found || sn->date_sec > found->date_sec ||
+                       (sn->date_sec == found->date_sec &&
+                        sn->date_nsec > found->date_nsec))) {
+            found = sn;
+        }
+    }
+
+    /* Snapshot files hold their own extra data */
+    if (found && found->vm_state_size) {
+        xemu_snapshots_index_load();
+        xemu_snapshots_index_add(found, xemu_snapshots_pending_data);
+        xemu_snapshots_index_store();
+    }
+    g_free(snapshots);
+}
+
+static void xemu_snapshots_save_done(bool ok, Error *err, void *opaque)
+{
+    char *vm_name = opaque;
+
+    if (ok && xemu_snapshots_pending_data) {
+        xemu_snapshots_index_saved(vm_name);
+    }
+    g_clear_pointer(&xemu_snapshots_pending_data, g_bytes_unref);
+    xemu_snapshots_dirty = true;
+
+    if (err) {
+        xemu_queue_error_message(error_get_pretty(err));
+        error_free(err);
+    }
+    g_free(vm_name);
+}
+
 void xemu_snapshots_save(const char *vm_name, Error **err)
 {
-    save_snapshot(vm_name, true, NULL, false, NULL, err);
+    g_autofree char *path = NULL;
+    char *name;
+
+    /* The extra data of the save in flight is still in use */
+    if (snapshot_save_in_progress(err)) {
+        return;
+    }
+
+    if (vm_name) {
+        name = g_strdup(vm_name);
+    } else {
+        /* The file is named after the snapshot, so pick the name here */
+        g_autoptr(GDateTime) now = g_date_time_new_now_local();
+        name = g_date_time_format(now, "vm-%Y%m%d%H%M%S");
+    }
+
+    path = xemu_snapshots_file_path(name);
+    if (g_config.general.snapshots.external) {
+        g_autofree char *dir = xemu_snapshots_dir();
+        if (g_mkdir_with_parents(dir, 0755) < 0) {
+            error_setg_errno(err, errno, "Could not create %s", dir);
+            g_free(name);
+            return;
+        }
+    } else {
+        /* The snapshot replaced by this one may have been saved to a file */
+        unlink(path);
+        g_clear_pointer(&path, g_free);
+    }
+
+    g_clear_pointer(&xemu_snapshots_pending_data, g_bytes_unref);
+    xemu_snapshots_thumbnail_requested = xemu_snapshots_request_thumbnail();
+
+    /* Compression and the write finish in the background */
+    if (!save_snapshot_async(name, true, path, xemu_snapshots_save_done, name,
+                             err)) {
+        g_clear_pointer(&xemu_snapshots_pending_data, g_bytes_unref);
+        xemu_snapshots_thumbnail_pending = false;
+        g_free(name);
+    }
+    xemu_snapshots_thumbnail_requested = false;
+}
+
+static char *xemu_snapshots_quicksave_dir(void)
+{
+    return g_strconcat(g_config.sys.files.hdd_path, ".quicksave", NULL);
+}
+
+bool xemu_snapshots_quicksave_exists(void)
+{
+    g_autofree char *dir = xemu_snapshots_quicksave_dir();
+    return quicksave_exists(dir);
+}
+
+void xemu_snapshots_quicksave(Error **err)
+{
+    g_autofree char *dir = xemu_snapshots_quicksave_dir();
+    quicksave_save(dir, err);
+}
+
+void xemu_snapshots_quickload(Error **err)
+{
+    g_autofree char *dir = xemu_snapshots_quicksave_dir();
+    bool vm_running = runstate_is_running();
+    vm_stop(RUN_STATE_RESTORE_VM);
+    if (quicksave_load(dir, err) && vm_running) {
+        vm_start();
+    }
 }
 
 void xemu_snapshots_delete(const char *vm_name, Error **err)
 {
-    delete_snapshot(vm_name, false, NULL, err);
+    if (delete_snapshot(vm_name, false, NULL, err)) {
+        g_autofree char *path = xemu_snapshots_file_path(vm_name);
+        if (unlink(path) < 0 && errno != ENOENT) {
+            error_setg_errno(err, errno, "Could not delete %s", path);
+        }
+
+        xemu_snapshots_index_load();
+        if (g_hash_table_remove(xemu_snapshots_index, vm_name)) {
+            xemu_snapshots_index_dirty = true;
+            xemu_snapshots_index_store();
+        }
+    }
 }
 
 void xemu_snapshots_save_extra_data(QEMUFile *f)
@@ -274,33 +793,91 @@ void xemu_snapshots_save_extra_data(QEMUFile *f)
     }
 
     size_t thumbnail_size = 0;
-    void *thumbnail_buf = xemu_snapshots_create_framebuffer_thumbnail_png(&thumbnail_size);
+    void *thumbnail_buf = NULL;
+    if (xemu_snapshots_thumbnail_requested) {
+        /* Added by xemu_snapshots_finish_extra_data */
+        xemu_snapshots_thumbnail_pending = true;
+    } else {
+        thumbnail_buf =
+            xemu_snapshots_create_framebuffer_thumbnail_png(&thumbnail_size);
+    }
 
-    qemu_put_be32(f, XEMU_SNAPSHOT_DATA_MAGIC);
-    qemu_put_be32(f, XEMU_SNAPSHOT_DATA_VERSION);
-    qemu_put_be32(f, 4 + path_size + 1 + xbe_title_name_size + 4 + thumbnail_size);
+    /* Build the payload once, it is also kept for the snapshot index */
+    size_t size = 4 + path_size + 1 + xbe_title_name_size + 4 + thumbnail_size;
+    uint8_t *buf = g_malloc(size);
+    size_t offset = 0;
 
-    qemu_put_be32(f, path_size);
+    stl_be_p(&buf[offset], path_size);
+    offset += 4;
     if (path_size) {
-        qemu_put_buffer(f, (const uint8_t *)path, path_size);
+        memcpy(&buf[offset], path, path_size);
+        offset += path_size;
         g_free(path);
     }
 
-    qemu_put_byte(f, xbe_title_name_size);
+    buf[offset++] = xbe_title_name_size;
     if (xbe_title_name_size) {
-        qemu_put_buffer(f, (const uint8_t *)xbe_title_name, xbe_title_name_size);
+        memcpy(&buf[offset], xbe_title_name, xbe_title_name_size);
+        offset += xbe_title_name_size;
         g_free(xbe_title_name);
     }
 
-    qemu_put_be32(f, thumbnail_size);
+    stl_be_p(&buf[offset], thumbnail_size);
+    offset += 4;
     if (thumbnail_size) {
-        qemu_put_buffer(f, (const uint8_t *)thumbnail_buf, thumbnail_size);
+        memcpy(&buf[offset], thumbnail_buf, thumbnail_size);
+        offset += thumbnail_size;
         g_free(thumbnail_buf);
     }
+    assert(offset == size);
+
+    qemu_put_be32(f, XEMU_SNAPSHOT_DATA_MAGIC);
+    qemu_put_be32(f, XEMU_SNAPSHOT_DATA_VERSION);
+    qemu_put_be32(f, size);
+    qemu_put_buffer(f, buf, size);
+
+    g_clear_pointer(&xemu_snapshots_pending_data, g_bytes_unref);
+    xemu_snapshots_pending_data = g_bytes_new_take(buf, size);
 
     xemu_snapshots_dirty = true;
 }
 
+GBytes *xemu_snapshots_finish_extra_data(void)
+{
+    if (!xemu_snapshots_thumbnail_pending || !xemu_snapshots_pending_data) {
+        return NULL;
+    }
+    xemu_snapshots_thumbnail_pending = false;
+
+    size_t thumbnail_size = 0;
+    void *thumbnail_buf = xemu_snapshots_wait_thumbnail(
+        &thumbnail_size, XEMU_SNAPSHOT_THUMBNAIL_TIMEOUT_MS);
+    if (!thumbnail_buf) {
+        return NULL;
+    }
+
+    /* The thumbnail comes last, its size field ends the payload */
+    gsize payload_size;
+    const uint8_t *payload =
+        g_bytes_get_data(xemu_snapshots_pending_data, &payload_size);
+    size_t size = payload_size + thumbnail_size;
+    uint8_t *buf = g_malloc(size);
+    memcpy(buf, payload, payload_size);
+    stl_be_p(&buf[payload_size - 4], thumbnail_size);
+    memcpy(&buf[payload_size], thumbnail_buf, thumbnail_size);
+    g_free(thumbnail_buf);
+
+    g_bytes_unref(xemu_snapshots_pending_data);
+    xemu_snapshots_pending_data = g_bytes_new_take(buf, size);
+
+    uint8_t *record = g_malloc(12 + size);
+    stl_be_p(&record[0], XEMU_SNAPSHOT_DATA_MAGIC);
+    stl_be_p(&record[4], XEMU_SNAPSHOT_DATA_VERSION);
+    stl_be_p(&record[8], size);
+    memcpy(&record[12], buf, size);
+    return g_bytes_new_take(record, 12 + size);
+}
+
 bool xemu_snapshots_offset_extra_data(QEMUFile *f)
 {
     unsigned int v;
@@ -53,8 +53,16 @@ int xemu_snapshots_list(QEMUSnapshotInfo **info, XemuSnapshotData **extra_data,
 void xemu_snapshots_load(const char *vm_name, Error **err);
 void xemu_snapshots_save(const char *vm_name, Error **err);
 void xemu_snapshots_delete(const char *vm_name, Error **err);
+bool xemu_snapshots_quicksave_exists(void);
+void xemu_snapshots_quicksave(Error **err);
+void xemu_snapshots_quickload(Error **err);
 
 void xemu_snapshots_save_extra_data(QEMUFile *f);
+/*
+ * Extra data record completed with the thumbnail requested by the UI, or
+ * NULL to keep the one in the stream. Called from the save worker thread.
+ */
+GBytes *xemu_snapshots_finish_extra_data(void);
 bool xemu_snapshots_offset_extra_data(QEMUFile *f);
 void xemu_snapshots_mark_dirty(void);
 
@@ -62,6 +70,9 @@ void xemu_snapshots_mark_dirty(void);
 void xemu_snapshots_set_framebuffer_texture(GLuint tex, bool flip);
 bool xemu_snapshots_load_png_to_texture(GLuint tex, void *buf, size_t size);
 void *xemu_snapshots_create_framebuffer_thumbnail_png(size_t *size);
+bool xemu_snapshots_request_thumbnail(void);
+void xemu_snapshots_poll_thumbnail(void);
+void *xemu_snapshots_wait_thumbnail(size_t *size, int timeout_ms);
 
 #ifdef __cplusplus
 }
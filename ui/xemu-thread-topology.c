@@ -0,0 +1,505 @@
+/*
+ * xemu emulator thread placement
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/host-utils.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
+#include "xemu-settings.h"
+#include "xemu-thread-topology.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <pthread/qos.h>
+#endif
+
+/*
+ * Hosts are described as a list of physical cores, each a mask of its SMT
+ * siblings and a rank where higher is faster: cpu_capacity or the maximum
+ * clock on Linux, the efficiency class on Windows. Any core ranked above the
+ * slowest is a fast core, so hybrid desktops get their P-cores and phones
+ * their big and prime clusters. macOS exposes neither ranks nor affinity,
+ * so there only the QoS class is set and the scheduler does the rest.
+ *
+ * Masks are 64 bits wide. Larger hosts have cores to spare and are left to
+ * the OS scheduler.
+ */
+
+#define MAX_CPUS 64
+#define MAX_THREADS 64
+#define RESERVED_CORES 2        // One each for the vCPU and pfifo threads
+#define MIN_CORES_TO_RESERVE 4  // Below this nothing would be left over
+
+typedef struct HostCore {
+    uint64_t cpus;
+    uint64_t rank;
+} HostCore;
+
+static struct {
+    QemuMutex lock;
+    int num_cpus;
+    uint64_t allowed;  // 0 when affinity is left to the OS
+    uint64_t fast;
+    uint64_t reserved;
+    struct {
+        bool live;
+        XemuThreadInfo info;
+    } threads[MAX_THREADS];
+} g_topo;
+
+static gsize topo_initialized;
+static __thread int thread_slot = -1;
+static __thread Notifier thread_exit_notifier;
+
+static const char *const class_names[XEMU_THREAD__COUNT] = {
+    [XEMU_THREAD_REALTIME] = "Realtime",
+    [XEMU_THREAD_LATENCY] = "Latency",
+    [XEMU_THREAD_THROUGHPUT] = "Throughput",
+    [XEMU_THREAD_BACKGROUND] = "Background",
+};
+
+const char *xemu_thread_class_name(XemuThreadClass cls)
+{
+    return cls < XEMU_THREAD__COUNT ? class_names[cls] : "?";
+}
+
+#if defined(__linux__)
+
+static char *read_cpu_file(int cpu, const char *file)
+{
+    g_autofree char *path =
+        g_strdup_printf("/sys/devices/system/cpu/cpu%d/%s", cpu, file);
+    char *contents = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        return NULL;
+    }
+    return contents;
+}
+
+// Parse a kernel CPU list such as "0-3,8"
+static uint64_t parse_cpu_list(const char *s)
+{
+    uint64_t mask = 0;
+
+    while (*s) {
+        char *end;
+        unsigned long first = strtoul(s, &end, 10);
+        unsigned long last = first;
+        if (end == s) {
+            break;
+        }
+        if (*end == '-') {
+            s = end + 1;
+            last = strtoul(s, &end, 10);
+        }
+        for (unsigned long i = first; i <= last && i < MAX_CPUS; i++) {
+            mask |= BIT_ULL(i);
+        }
+        if (*end != ',') {
+            break;
+        }
+        s = end + 1;
+    }
+
+    return mask;
+}
+
+static int detect_cores(HostCore *cores)
+{
+    cpu_set_t set;
+
+    if (sched_getaffinity(0, sizeof(set), &set) ||
+        CPU_COUNT(&set) > MAX_CPUS) {
+        return 0;
+    }
+
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            g_topo.allowed |= BIT_ULL(cpu);
+        }
+    }
+    if (ctpop64(g_topo.allowed) != CPU_COUNT(&set)) {
+        g_topo.allowed = 0;
+        return 0;
+    }
+
+    int n = 0;
+    for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (!(g_topo.allowed & BIT_ULL(cpu))) {
+            continue;
+        }
+
+        g_autofree char *siblings =
+            read_cpu_file(cpu, "topology/thread_siblings_list");
+        uint64_t cpus = siblings ? parse_cpu_list(siblings) : 0;
+        cpus &= g_topo.allowed;
+        if (!cpus) {
+            cpus = BIT_ULL(cpu);
+        }
+        if (ctz64(cpus) != cpu) {
+            continue; // Counted with its first sibling
+        }
+
+        // cpu_capacity is the scheduler's own view of big and little on Arm
+        g_autofree char *capacity = read_cpu_file(cpu, "cpu_capacity");
+        g_autofree char *freq =
+            capacity ? NULL : read_cpu_file(cpu, "cpufreq/cpuinfo_max_freq");
+        const char *rank = capacity ? capacity : freq;
+
+        cores[n++] = (HostCore){
+            .cpus = cpus,
+            .rank = rank ? g_ascii_strtoull(rank, NULL, 10) : 0,
+        };
+    }
+
+    return n;
+}
+
+static const int class_nice[XEMU_THREAD__COUNT] = {
+    [XEMU_THREAD_REALTIME] = -10,
+    [XEMU_THREAD_LATENCY] = -5,
+    [XEMU_THREAD_THROUGHPUT] = 0,
+    [XEMU_THREAD_BACKGROUND] = 10,
+};
+
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_BE_LOWEST ((2 << 13) | 7)
+
+static uint64_t apply_placement(XemuThreadInfo *info, uint64_t cpus)
+{
+    if (cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < MAX_CPUS; cpu++) {
+            if (cpus & BIT_ULL(cpu)) {
+                CPU_SET(cpu, &set);
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set)) {
+            cpus = 0;
+        }
+    }
+
+    // Per-thread on Linux. Raising priority needs CAP_SYS_NICE or an
+    // RLIMIT_NICE allowance; without either the thread stays at nice 0.
+    int nice = class_nice[info->cls];
+    if (setpriority(PRIO_PROCESS, info->tid, nice) && nice < 0) {
+        setpriority(PRIO_PROCESS, info->tid, 0);
+    }
+#ifdef SYS_ioprio_set
+    if (info->cls == XEMU_THREAD_BACKGROUND) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, info->tid,
+                IOPRIO_BE_LOWEST);
+    }
+#endif
+
+    errno = 0;
+    nice = getpriority(PRIO_PROCESS, info->tid);
+    if (errno) {
+        pstrcpy(info->priority, sizeof(info->priority), "unknown");
+    } else {
+        snprintf(info->priority, sizeof(info->priority), "nice %d", nice);
+    }
+
+    return cpus;
+}
+
+#elif defined(_WIN32)
+
+static int detect_cores(HostCore *cores)
+{
+    DWORD_PTR process_mask, system_mask;
+    DWORD len = 0;
+
+    // Affinity masks only reach within a processor group
+    if (GetActiveProcessorGroupCount() > 1 ||
+        !GetProcessAffinityMask(GetCurrentProcess(), &process_mask,
+                                &system_mask)) {
+        return 0;
+    }
+
+    GetLogicalProcessorInformationEx(RelationProcessorCore, NULL, &len);
+    if (!len) {
+        return 0;
+    }
+    g_autofree uint8_t *buf = g_malloc(len);
+    if (!GetLogicalProcessorInformationEx(
+            RelationProcessorCore,
+            (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buf, &len)) {
+        return 0;
+    }
+
+    g_topo.allowed = process_mask;
+
+    int n = 0;
+    for (DWORD off = 0; off < len && n < MAX_CPUS;) {
+        PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX info =
+            (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buf + off);
+        uint64_t cpus = info->Processor.GroupMask[0].Mask & g_topo.allowed;
+        if (cpus) {
+            cores[n++] = (HostCore){
+                .cpus = cpus,
+                .rank = info->Processor.EfficiencyClass,
+            };
+        }
+        off += info->Size;
+    }
+
+    return n;
+}
+
+static const struct {
+    int priority;
+    const char *name;
+} class_priority[XEMU_THREAD__COUNT] = {
+    [XEMU_THREAD_REALTIME] = { THREAD_PRIORITY_HIGHEST, "highest" },
+    [XEMU_THREAD_LATENCY] = { THREAD_PRIORITY_ABOVE_NORMAL, "above normal" },
+    [XEMU_THREAD_THROUGHPUT] = { THREAD_PRIORITY_NORMAL, "normal" },
+    [XEMU_THREAD_BACKGROUND] = { THREAD_PRIORITY_BELOW_NORMAL,
+                                 "below normal" },
+};
+
+static uint64_t apply_placement(XemuThreadInfo *info, uint64_t cpus)
+{
+    HANDLE thread = GetCurrentThread();
+
+    if (cpus && !SetThreadAffinityMask(thread, cpus)) {
+        cpus = 0;
+    }
+
+    // Background mode also lowers the thread's I/O and memory priority
+    if (info->cls == XEMU_THREAD_BACKGROUND &&
+        SetThreadPriority(thread, THREAD_MODE_BACKGROUND_BEGIN)) {
+        pstrcpy(info->priority, sizeof(info->priority), "background");
+    } else if (SetThreadPriority(thread, class_priority[info->cls].priority)) {
+        pstrcpy(info->priority, sizeof(info->priority),
+                class_priority[info->cls].name);
+    } else {
+        pstrcpy(info->priority, sizeof(info->priority), "default");
+    }
+
+    return cpus;
+}
+
+#else
+
+static int detect_cores(HostCore *cores)
+{
+    return 0;
+}
+
+static uint64_t apply_placement(XemuThreadInfo *info, uint64_t cpus)
+{
+#ifdef __APPLE__
+    static const struct {
+        qos_class_t qos;
+        const char *name;
+    } class_qos[XEMU_THREAD__COUNT] = {
+        [XEMU_THREAD_REALTIME] = { QOS_CLASS_USER_INTERACTIVE,
+                                   "QoS interactive" },
+        [XEMU_THREAD_LATENCY] = { QOS_CLASS_USER_INTERACTIVE,
+                                  "QoS interactive" },
+        [XEMU_THREAD_THROUGHPUT] = { QOS_CLASS_USER_INITIATED,
+                                     "QoS initiated" },
+        [XEMU_THREAD_BACKGROUND] = { QOS_CLASS_UTILITY, "QoS utility" },
+    };
+
+    if (!pthread_set_qos_class_self_np(class_qos[info->cls].qos, 0)) {
+        pstrcpy(info->priority, sizeof(info->priority),
+                class_qos[info->cls].name);
+        return 0;
+    }
+#endif
+    pstrcpy(info->priority, sizeof(info->priority), "default");
+    return 0;
+}
+
+#endif
+
+static int compare_cores(const void *a, const void *b)
+{
+    const HostCore *ca = a, *cb = b;
+
+    if (ca->rank != cb->rank) {
+        return ca->rank > cb->rank ? -1 : 1;
+    }
+    return ctz64(ca->cpus) - ctz64(cb->cpus);
+}
+
+static void topology_init(void)
+{
+    HostCore cores[MAX_CPUS];
+
+    qemu_mutex_init(&g_topo.lock);
+    g_topo.num_cpus = g_get_num_processors();
+
+    int n = detect_cores(cores);
+    if (!n) {
+        return;
+    }
+
+    qsort(cores, n, sizeof(cores[0]), compare_cores);
+    for (int i = 0; i < n; i++) {
+        if (cores[i].rank > cores[n - 1].rank) {
+            g_topo.fast |= cores[i].cpus;
+        }
+    }
+    if (n >= MIN_CORES_TO_RESERVE) {
+        for (int i = 0; i < RESERVED_CORES; i++) {
+            g_topo.reserved |= cores[i].cpus;
+        }
+    }
+}
+
+static void ensure_init(void)
+{
+    if (g_once_init_enter(&topo_initialized)) {
+        topology_init();
+        g_once_init_leave(&topo_initialized, 1);
+    }
+}
+
+/*
+ * Every class gets an explicit mask, not just the pinned ones, since a
+ * thread inherits the affinity of whichever thread created it.
+ */
+static uint64_t class_cpus(XemuThreadClass cls)
+{
+    uint64_t fast = g_topo.fast ? g_topo.fast : g_topo.allowed;
+    uint64_t rest = g_topo.allowed & ~g_topo.reserved;
+
+    switch (cls) {
+    case XEMU_THREAD_LATENCY:
+        return g_topo.reserved ? g_topo.reserved : fast;
+    case XEMU_THREAD_REALTIME:
+    case XEMU_THREAD_THROUGHPUT:
+        return (fast & rest) ? (fast & rest) : rest;
+    default:
+        return rest;
+    }
+}
+
+static void format_cpus(uint64_t mask, char *buf, size_t len)
+{
+    size_t pos = 0;
+
+    buf[0] = '\0';
+    for (int i = 0; i < MAX_CPUS && pos < len; i++) {
+        if (!(mask & BIT_ULL(i))) {
+            continue;
+        }
+        int j = i;
+        while (j + 1 < MAX_CPUS && (mask & BIT_ULL(j + 1))) {
+            j++;
+        }
+        if (j > i) {
+            pos += snprintf(buf + pos, len - pos, "%s%d-%d",
+                            pos ? "," : "", i, j);
+        } else {
+            pos += snprintf(buf + pos, len - pos, "%s%d", pos ? "," : "", i);
+        }
+        i = j;
+    }
+}
+
+static void thread_exited(Notifier *notifier, void *data)
+{
+    qemu_mutex_lock(&g_topo.lock);
+    g_topo.threads[thread_slot].live = false;
+    qemu_mutex_unlock(&g_topo.lock);
+}
+
+void xemu_thread_topology_register(XemuThreadClass cls, const char *name)
+{
+    ensure_init();
+
+    XemuThreadInfo info = {
+        .name = name,
+        .cls = cls,
+        .tid = qemu_get_thread_id(),
+    };
+    uint64_t cpus = 0;
+
+    if (g_config.perf.thread_topology) {
+        cpus = apply_placement(&info, class_cpus(cls));
+    } else {
+        pstrcpy(info.priority, sizeof(info.priority), "default");
+    }
+    if (cpus) {
+        format_cpus(cpus, info.cpus, sizeof(info.cpus));
+    } else {
+        pstrcpy(info.cpus, sizeof(info.cpus), "any");
+    }
+
+    qemu_mutex_lock(&g_topo.lock);
+    if (thread_slot < 0) {
+        for (int i = 0; i < MAX_THREADS; i++) {
+            if (!g_topo.threads[i].live) {
+                thread_slot = i;
+                g_topo.threads[i].live = true;
+                thread_exit_notifier.notify = thread_exited;
+                qemu_thread_atexit_add(&thread_exit_notifier);
+                break;
+            }
+        }
+    }
+    if (thread_slot >= 0) {
+        g_topo.threads[thread_slot].info = info;
+    }
+    qemu_mutex_unlock(&g_topo.lock);
+}
+
+void xemu_thread_topology_get(XemuThreadTopology *topo)
+{
+    ensure_init();
+
+    *topo = (XemuThreadTopology){ .num_cpus = g_topo.num_cpus };
+    format_cpus(g_topo.fast, topo->fast_cpus, sizeof(topo->fast_cpus));
+    format_cpus(g_topo.reserved, topo->reserved_cpus,
+                sizeof(topo->reserved_cpus));
+}
+
+XemuThreadInfo *xemu_thread_topology_get_threads(size_t *count)
+{
+    ensure_init();
+
+    XemuThreadInfo *infos = g_new(XemuThreadInfo, MAX_THREADS);
+    size_t n = 0;
+
+    qemu_mutex_lock(&g_topo.lock);
+    for (int i = 0; i < MAX_THREADS; i++) {
+        if (g_topo.threads[i].live) {
+            infos[n++] = g_topo.threads[i].info;
+        }
+    }
+    qemu_mutex_unlock(&g_topo.lock);
+
+    *count = n;
+    return infos;
+}
@@ -0,0 +1,77 @@
+/*
+ * xemu emulator thread placement
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_THREAD_TOPOLOGY
+#define XEMU_THREAD_TOPOLOGY
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Emulator threads announce what kind of work they do when they start, and
+ * get a priority and a set of host cores to match. The vCPU and pfifo
+ * threads get the fastest cores to themselves where there are enough to go
+ * around; audio and worker threads take the remaining fast cores, and
+ * background I/O runs anywhere else at low priority.
+ */
+typedef enum XemuThreadClass {
+    XEMU_THREAD_REALTIME,   // Audio, must not miss its deadline
+    XEMU_THREAD_LATENCY,    // vCPU and render path, gates the frame
+    XEMU_THREAD_THROUGHPUT, // Worker pools fed by the render path
+    XEMU_THREAD_BACKGROUND, // Disk caches, prewarming
+    XEMU_THREAD__COUNT,
+} XemuThreadClass;
+
+typedef struct XemuThreadInfo {
+    const char *name;
+    XemuThreadClass cls;
+    int tid;
+    char cpus[48];     // Host CPUs the thread may run on
+    char priority[24]; // Platform priority or QoS, as applied
+} XemuThreadInfo;
+
+typedef struct XemuThreadTopology {
+    int num_cpus;
+    char fast_cpus[48];     // Empty on homogeneous hosts
+    char reserved_cpus[48]; // Set aside for latency threads
+} XemuThreadTopology;
+
+// Place the calling thread. The name must be a static string.
+void xemu_thread_topology_register(XemuThreadClass cls, const char *name);
+
+const char *xemu_thread_class_name(XemuThreadClass cls);
+
+void xemu_thread_topology_get(XemuThreadTopology *topo);
+
+// Snapshot the live registered threads. Free the result with g_free.
+XemuThreadInfo *xemu_thread_topology_get_threads(size_t *count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -27,6 +27,36 @@
 static GLuint display_tex = 0;
 static bool display_flip = false;
 
+/*
+ * Thumbnail requests read the scaled down framebuffer back into a pixel
+ * buffer, which is mapped once its fence has passed on a later frame. The
+ * PNG is then encoded on a worker thread, so the save only waits for the
+ * GPU copy to be queued.
+ */
+enum ThumbnailState {
+    THUMBNAIL_IDLE,
+    THUMBNAIL_READING,
+    THUMBNAIL_ENCODING,
+    THUMBNAIL_DONE,
+};
+
+typedef struct ThumbnailEncodeJob {
+    uint8_t *pixels;
+    int width, height;
+    unsigned int generation;
+} ThumbnailEncodeJob;
+
+static GLuint thumbnail_pbo = 0;
+static GLsync thumbnail_fence = 0;
+static int thumbnail_width, thumbnail_height;
+
+static GMutex thumbnail_lock;
+static GCond thumbnail_cond;
+static ThumbnailState thumbnail_state = THUMBNAIL_IDLE;
+static unsigned int thumbnail_generation = 0;
+static void *thumbnail_png = NULL;
+static size_t thumbnail_png_size = 0;
+
 void xemu_snapshots_set_framebuffer_texture(GLuint tex, bool flip)
 {
     display_tex = tex;
@@ -55,6 +85,140 @@ bool xemu_snapshots_load_png_to_texture(GLuint tex, void *buf, size_t size)
     return true;
 }
 
+static void thumbnail_set_state(ThumbnailState state)
+{
+    g_mutex_lock(&thumbnail_lock);
+    thumbnail_state = state;
+    g_cond_broadcast(&thumbnail_cond);
+    g_mutex_unlock(&thumbnail_lock);
+}
+
+static gpointer thumbnail_encode_thread(gpointer opaque)
+{
+    ThumbnailEncodeJob *job = (ThumbnailEncodeJob *)opaque;
+    std::vector<uint8_t> png;
+    bool ok = fpng::fpng_encode_image_to_memory(job->pixels, job->width,
+                                                job->height, 3, png);
+
+    g_mutex_lock(&thumbnail_lock);
+    /* A newer request replaces the result */
+    if (job->generation == thumbnail_generation) {
+        g_free(thumbnail_png);
+        thumbnail_png = NULL;
+        thumbnail_png_size = 0;
+        if (ok) {
+            thumbnail_png = g_memdup2(png.data(), png.size());
+            thumbnail_png_size = png.size();
+        }
+        thumbnail_state = THUMBNAIL_DONE;
+        g_cond_broadcast(&thumbnail_cond);
+    }
+    g_mutex_unlock(&thumbnail_lock);
+
+    g_free(job->pixels);
+    g_free(job);
+    return NULL;
+}
+
+bool xemu_snapshots_request_thumbnail(void)
+{
+    if (!SDL_GL_GetCurrentContext() || display_tex == 0) {
+        return false;
+    }
+
+    if (thumbnail_fence) {
+        glDeleteSync(thumbnail_fence);
+        thumbnail_fence = 0;
+    }
+    if (!thumbnail_pbo) {
+        glGenBuffers(1, &thumbnail_pbo);
+    }
+
+    g_mutex_lock(&thumbnail_lock);
+    thumbnail_generation++;
+    g_free(thumbnail_png);
+    thumbnail_png = NULL;
+    thumbnail_png_size = 0;
+    thumbnail_state = THUMBNAIL_READING;
+    g_mutex_unlock(&thumbnail_lock);
+
+    RenderFramebufferToPbo(display_tex, display_flip, thumbnail_pbo,
+                           2 * XEMU_SNAPSHOT_THUMBNAIL_WIDTH,
+                           2 * XEMU_SNAPSHOT_THUMBNAIL_HEIGHT,
+                           &thumbnail_width, &thumbnail_height);
+    thumbnail_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    return true;
+}
+
+void xemu_snapshots_poll_thumbnail(void)
+{
+    if (!thumbnail_fence) {
+        return;
+    }
+
+    GLenum status = glClientWaitSync(thumbnail_fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return;
+    }
+    glDeleteSync(thumbnail_fence);
+    thumbnail_fence = 0;
+
+    if (status == GL_WAIT_FAILED) {
+        thumbnail_set_state(THUMBNAIL_DONE);
+        return;
+    }
+
+    size_t size = thumbnail_width * thumbnail_height * 3;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, thumbnail_pbo);
+    void *mapped =
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if (!mapped) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        thumbnail_set_state(THUMBNAIL_DONE);
+        return;
+    }
+
+    ThumbnailEncodeJob *job = g_new(ThumbnailEncodeJob, 1);
+    job->pixels = (uint8_t *)g_memdup2(mapped, size);
+    job->width = thumbnail_width;
+    job->height = thumbnail_height;
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    g_mutex_lock(&thumbnail_lock);
+    job->generation = thumbnail_generation;
+    thumbnail_state = THUMBNAIL_ENCODING;
+    g_mutex_unlock(&thumbnail_lock);
+
+    g_thread_unref(g_thread_new("thumbnail-encode", thumbnail_encode_thread,
+                                job));
+}
+
+void *xemu_snapshots_wait_thumbnail(size_t *size, int timeout_ms)
+{
+    gint64 end_time = g_get_monotonic_time() + timeout_ms * G_TIME_SPAN_MILLISECOND;
+    void *png = NULL;
+
+    g_mutex_lock(&thumbnail_lock);
+    while (thumbnail_state == THUMBNAIL_READING ||
+           thumbnail_state == THUMBNAIL_ENCODING) {
+        if (!g_cond_wait_until(&thumbnail_cond, &thumbnail_lock, end_time)) {
+            break;
+        }
+    }
+    if (thumbnail_state == THUMBNAIL_DONE) {
+        png = thumbnail_png;
+        *size = thumbnail_png_size;
+        thumbnail_png = NULL;
+        thumbnail_png_size = 0;
+        thumbnail_state = THUMBNAIL_IDLE;
+    }
+    g_mutex_unlock(&thumbnail_lock);
+
+    return png;
+}
+
 void *xemu_snapshots_create_framebuffer_thumbnail_png(size_t *size)
 {
     /*
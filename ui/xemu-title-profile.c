@@ -0,0 +1,298 @@
+/*
+ * xemu per-title performance profiles
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/timer.h"
+#include "hw/xbox/nv2a/nv2a.h"
+#include "xemu-settings.h"
+#include "xemu-xbe.h"
+#include "xemu-title-profile.h"
+
+#define POLL_INTERVAL_MS 1000
+
+/*
+ * A profile value layered over the global setting. The global value is put
+ * back when the profile no longer applies, unless the user has changed the
+ * setting in the meantime.
+ */
+typedef struct SettingOverride {
+    bool active;
+    int base;
+    int value;
+} SettingOverride;
+
+static struct {
+    uint32_t boot_title_id;
+    uint32_t title_id;
+    int64_t last_poll;
+
+    // Only read at startup, so these stay with the boot title
+    SettingOverride renderer;
+    SettingOverride hard_fpu;
+    SettingOverride vp_workers;
+
+    // Follow the running title
+    uint32_t layered_title_id;
+    SettingOverride surface_scale;
+    SettingOverride use_dsp;
+    SettingOverride cpu_clock;
+} g_profile;
+
+static void override_set(SettingOverride *o, int base, int value)
+{
+    // Keep the original global value if a previous profile was layered
+    o->base = o->active ? o->base : base;
+    o->value = value;
+    o->active = true;
+}
+
+/* Returns the value the setting should have once the override is dropped */
+static int override_release(SettingOverride *o, int current)
+{
+    bool restore = o->active && current == o->value;
+    o->active = false;
+    return restore ? o->base : current;
+}
+
+int xemu_title_profile_find(uint32_t title_id)
+{
+    if (!title_id) {
+        return -1;
+    }
+
+    for (int i = 0; i < g_config.perf.title_profiles_count; i++) {
+        const char *id = g_config.perf.title_profiles[i].title_id;
+        if (id && g_ascii_strtoull(id, NULL, 16) == title_id) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static const struct title_profile *find_profile(uint32_t title_id)
+{
+    int i = xemu_title_profile_find(title_id);
+    return i < 0 ? NULL : &g_config.perf.title_profiles[i];
+}
+
+void xemu_title_profile_apply_boot(void)
+{
+    struct xbe_disc_info info;
+    const char *dvd_path = g_config.sys.files.dvd_path;
+
+    if (!dvd_path || !*dvd_path ||
+        !xemu_get_disc_xbe_info(dvd_path, &info)) {
+        return;
+    }
+    g_free(info.title_name);
+
+    g_profile.boot_title_id = info.title_id;
+    g_profile.layered_title_id = info.title_id;
+
+    const struct title_profile *p = find_profile(info.title_id);
+    if (!p) {
+        return;
+    }
+
+    if (p->renderer != CONFIG_PERF_TITLE_PROFILES_RENDERER_DEFAULT) {
+        override_set(&g_profile.renderer, g_config.display.renderer,
+                     p->renderer - CONFIG_PERF_TITLE_PROFILES_RENDERER_NULL +
+                         CONFIG_DISPLAY_RENDERER_NULL);
+        g_config.display.renderer = g_profile.renderer.value;
+    }
+    if (p->hard_fpu != CONFIG_PERF_TITLE_PROFILES_HARD_FPU_DEFAULT) {
+        override_set(&g_profile.hard_fpu, g_config.perf.hard_fpu,
+                     p->hard_fpu == CONFIG_PERF_TITLE_PROFILES_HARD_FPU_ON);
+        g_config.perf.hard_fpu = g_profile.hard_fpu.value;
+    }
+    if (p->vp_workers >= 0) {
+        override_set(&g_profile.vp_workers, g_config.audio.vp.num_workers,
+                     p->vp_workers);
+        g_config.audio.vp.num_workers = g_profile.vp_workers.value;
+    }
+
+    // The renderer picks the scale up from the config when it starts
+    if (p->surface_scale > 0) {
+        override_set(&g_profile.surface_scale,
+                     g_config.display.quality.surface_scale,
+                     p->surface_scale);
+        g_config.display.quality.surface_scale = g_profile.surface_scale.value;
+    }
+    if (p->use_dsp != CONFIG_PERF_TITLE_PROFILES_USE_DSP_DEFAULT) {
+        override_set(&g_profile.use_dsp, g_config.audio.use_dsp,
+                     p->use_dsp == CONFIG_PERF_TITLE_PROFILES_USE_DSP_ON);
+        g_config.audio.use_dsp = g_profile.use_dsp.value;
+    }
+    if (p->cpu_clock_percent > 0) {
+        override_set(&g_profile.cpu_clock, g_config.perf.cpu_clock_percent,
+                     p->cpu_clock_percent);
+        g_config.perf.cpu_clock_percent = g_profile.cpu_clock.value;
+    }
+
+    fprintf(stderr, "Applied title profile for %08x\n", info.title_id);
+}
+
+static void layer_runtime_settings(uint32_t title_id)
+{
+    const struct title_profile *p = find_profile(title_id);
+    int scale = nv2a_get_surface_scale_factor();
+    int new_scale;
+
+    new_scale = override_release(&g_profile.surface_scale, scale);
+    g_config.audio.use_dsp =
+        override_release(&g_profile.use_dsp, g_config.audio.use_dsp);
+    g_config.perf.cpu_clock_percent = override_release(
+        &g_profile.cpu_clock, g_config.perf.cpu_clock_percent);
+
+    if (p && p->surface_scale > 0) {
+        override_set(&g_profile.surface_scale, new_scale, p->surface_scale);
+        new_scale = p->surface_scale;
+    }
+    if (p && p->use_dsp != CONFIG_PERF_TITLE_PROFILES_USE_DSP_DEFAULT) {
+        override_set(&g_profile.use_dsp, g_config.audio.use_dsp,
+                     p->use_dsp == CONFIG_PERF_TITLE_PROFILES_USE_DSP_ON);
+        g_config.audio.use_dsp = g_profile.use_dsp.value;
+    }
+    // The TSC picks the new rate up on its next read
+    if (p && p->cpu_clock_percent > 0) {
+        override_set(&g_profile.cpu_clock, g_config.perf.cpu_clock_percent,
+                     p->cpu_clock_percent);
+        g_config.perf.cpu_clock_percent = g_profile.cpu_clock.value;
+    }
+
+    if (new_scale != scale) {
+        nv2a_set_surface_scale_factor(new_scale);
+    }
+    g_profile.layered_title_id = title_id;
+}
+
+void xemu_title_profile_update(void)
+{
+    int64_t now = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    if (now - g_profile.last_poll < POLL_INTERVAL_MS) {
+        return;
+    }
+    g_profile.last_poll = now;
+
+    struct xbe *xbe = xemu_get_xbe_info();
+    uint32_t title_id = xbe && xbe->cert ? le32_to_cpu(xbe->cert->m_titleid) : 0;
+    g_profile.title_id = title_id;
+
+    // Keep the current layering while the kernel is between titles
+    if (title_id && title_id != g_profile.layered_title_id) {
+        layer_runtime_settings(title_id);
+    }
+}
+
+uint32_t xemu_title_profile_get_boot_title_id(void)
+{
+    return g_profile.boot_title_id;
+}
+
+uint32_t xemu_title_profile_get_title_id(void)
+{
+    return g_profile.title_id;
+}
+
+void xemu_title_profile_changed(void)
+{
+    const struct title_profile *p = find_profile(g_profile.boot_title_id);
+
+    // Startup settings of a dropped override apply from the next boot on
+    if (!p || p->renderer == CONFIG_PERF_TITLE_PROFILES_RENDERER_DEFAULT) {
+        g_config.display.renderer =
+            override_release(&g_profile.renderer, g_config.display.renderer);
+    }
+    if (!p || p->hard_fpu == CONFIG_PERF_TITLE_PROFILES_HARD_FPU_DEFAULT) {
+        g_config.perf.hard_fpu =
+            override_release(&g_profile.hard_fpu, g_config.perf.hard_fpu);
+    }
+    if (!p || p->vp_workers < 0) {
+        g_config.audio.vp.num_workers = override_release(
+            &g_profile.vp_workers, g_config.audio.vp.num_workers);
+    }
+
+    if (g_profile.title_id) {
+        layer_runtime_settings(g_profile.title_id);
+    }
+}
+
+/*
+ * Swap the global values back in for the duration of a save. A setting the
+ * user changed away from the profile value is theirs now, so stop tracking
+ * it and let it be saved as is.
+ */
+static void save_begin(SettingOverride *o, int *current)
+{
+    if (!o->active) {
+        return;
+    }
+    if (*current == o->value) {
+        *current = o->base;
+    } else {
+        o->active = false;
+    }
+}
+
+static void save_end(SettingOverride *o, int *current)
+{
+    if (o->active) {
+        *current = o->value;
+    }
+}
+
+#define FOR_EACH_OVERRIDE(fn)                                           \
+    do {                                                                \
+        int v;                                                          \
+        v = g_config.display.renderer;                                  \
+        fn(&g_profile.renderer, &v);                                    \
+        g_config.display.renderer = v;                                  \
+        v = g_config.perf.hard_fpu;                                     \
+        fn(&g_profile.hard_fpu, &v);                                    \
+        g_config.perf.hard_fpu = v;                                     \
+        v = g_config.audio.vp.num_workers;                              \
+        fn(&g_profile.vp_workers, &v);                                  \
+        g_config.audio.vp.num_workers = v;                              \
+        v = g_config.display.quality.surface_scale;                     \
+        fn(&g_profile.surface_scale, &v);                               \
+        g_config.display.quality.surface_scale = v;                     \
+        v = g_config.audio.use_dsp;                                     \
+        fn(&g_profile.use_dsp, &v);                                     \
+        g_config.audio.use_dsp = v;                                     \
+        v = g_config.perf.cpu_clock_percent;                            \
+        fn(&g_profile.cpu_clock, &v);                                   \
+        g_config.perf.cpu_clock_percent = v;                            \
+    } while (0)
+
+void xemu_title_profile_settings_save_begin(void)
+{
+    FOR_EACH_OVERRIDE(save_begin);
+}
+
+void xemu_title_profile_settings_save_end(void)
+{
+    FOR_EACH_OVERRIDE(save_end);
+}
@@ -0,0 +1,60 @@
+/*
+ * xemu per-title performance profiles
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_TITLE_PROFILE
+#define XEMU_TITLE_PROFILE
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Layer the profile of the disc in the drive over g_config, before the
+// machine is created so that settings only read at startup take effect
+void xemu_title_profile_apply_boot(void);
+
+// Follow the running title and re-layer settings that can change at runtime.
+// Call periodically with the BQL held.
+void xemu_title_profile_update(void);
+
+// Title ID of the disc at boot, or of the running XBE; 0 if unknown
+uint32_t xemu_title_profile_get_boot_title_id(void);
+uint32_t xemu_title_profile_get_title_id(void);
+
+// Index into g_config.perf.title_profiles, or -1 if the title has none
+int xemu_title_profile_find(uint32_t title_id);
+
+// Re-layer settings after g_config.perf.title_profiles has been edited
+void xemu_title_profile_changed(void);
+
+// Keep layered values out of the saved config
+void xemu_title_profile_settings_save_begin(void);
+void xemu_title_profile_settings_save_end(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,224 @@
+/*
+ * xemu thread activity tracing
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "xemu-settings.h"
+#include "xemu-notifications.h"
+#include "xemu-trace.h"
+
+/*
+ * Each thread records begin/end events into its own ring, so recording
+ * takes no locks: the thread is the only producer and the exporter the only
+ * consumer. Full rings drop events instead of overwriting them. Rings are
+ * drained into a Chrome trace JSON file, which Perfetto also opens, when
+ * tracing is stopped.
+ */
+
+#define XEMU_TRACE_BUFFER_SIZE (1 << 20) // Events, power of two
+
+typedef struct XemuTraceEvent {
+    int64_t ts; // ns
+    const char *name;
+    const char *arg;
+    char phase;
+} XemuTraceEvent;
+
+typedef struct XemuTraceBuffer {
+    struct XemuTraceBuffer *next;
+    int tid;
+    const char *thread_name;
+    unsigned int head, tail;
+    unsigned int dropped;
+    unsigned int skip_depth; // Open spans whose begin was dropped
+    XemuTraceEvent events[XEMU_TRACE_BUFFER_SIZE];
+} XemuTraceBuffer;
+
+bool g_xemu_trace_active;
+
+static struct {
+    QemuMutex lock;
+    bool initialized;
+    XemuTraceBuffer *buffers;
+    int64_t start_time;
+} g_trace;
+
+static __thread XemuTraceBuffer *trace_buffer;
+static __thread const char *trace_thread_name;
+
+static void trace_init(void)
+{
+    if (!qatomic_read(&g_trace.initialized)) {
+        qemu_mutex_init(&g_trace.lock);
+        qatomic_set(&g_trace.initialized, true);
+    }
+}
+
+void xemu_trace_set_thread_name(const char *name)
+{
+    trace_thread_name = name;
+}
+
+static XemuTraceBuffer *get_trace_buffer(void)
+{
+    if (!trace_buffer) {
+        XemuTraceBuffer *buffer = g_malloc0(sizeof(XemuTraceBuffer));
+        buffer->tid = qemu_get_thread_id();
+        buffer->thread_name = trace_thread_name;
+
+        qemu_mutex_lock(&g_trace.lock);
+        buffer->next = g_trace.buffers;
+        g_trace.buffers = buffer;
+        qemu_mutex_unlock(&g_trace.lock);
+
+        trace_buffer = buffer;
+    }
+
+    return trace_buffer;
+}
+
+void xemu_trace_record(char phase, const char *name, const char *arg)
+{
+    XemuTraceBuffer *buffer = get_trace_buffer();
+    unsigned int head = buffer->head;
+    unsigned int tail = qatomic_load_acquire(&buffer->tail);
+
+    // Keep begin/end pairs matched when a begin had to be dropped
+    if (phase == 'E' && buffer->skip_depth) {
+        buffer->skip_depth--;
+        return;
+    }
+    if (head - tail >= XEMU_TRACE_BUFFER_SIZE) {
+        buffer->dropped++;
+        if (phase == 'B') {
+            buffer->skip_depth++;
+        }
+        return;
+    }
+
+    XemuTraceEvent *event = &buffer->events[head % XEMU_TRACE_BUFFER_SIZE];
+    event->ts = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    event->name = name;
+    event->arg = arg;
+    event->phase = phase;
+    qatomic_store_release(&buffer->head, head + 1);
+}
+
+void xemu_trace_start(void)
+{
+    trace_init();
+
+    if (qatomic_read(&g_xemu_trace_active)) {
+        return;
+    }
+
+    // Discard anything recorded since the last export
+    qemu_mutex_lock(&g_trace.lock);
+    for (XemuTraceBuffer *b = g_trace.buffers; b; b = b->next) {
+        qatomic_store_release(&b->tail, qatomic_load_acquire(&b->head));
+        b->dropped = 0;
+    }
+    g_trace.start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    qemu_mutex_unlock(&g_trace.lock);
+
+    qatomic_set(&g_xemu_trace_active, true);
+    xemu_queue_notification("Thread trace started");
+}
+
+static char *get_trace_path(void)
+{
+    g_autofree char *dir =
+        g_strdup_printf("%straces", xemu_settings_get_base_path());
+    qemu_mkdir(dir);
+
+    g_autoptr(GDateTime) now = g_date_time_new_now_local();
+    g_autofree char *name = g_date_time_format(now, "%Y%m%d-%H%M%S.json");
+    return g_build_filename(dir, name, NULL);
+}
+
+static void append_event(GString *out, bool *first, int tid,
+                         const XemuTraceEvent *event, int64_t start_time)
+{
+    g_string_append_printf(out, "%s\n{\"ph\":\"%c\",\"pid\":1,\"tid\":%d,"
+                           "\"ts\":%.3f", *first ? "" : ",", event->phase,
+                           tid, (event->ts - start_time) / 1000.0);
+    if (event->name) {
+        g_string_append_printf(out, ",\"name\":\"%s\"", event->name);
+    }
+    if (event->arg) {
+        g_string_append_printf(out, ",\"args\":{\"detail\":\"%s\"}",
+                               event->arg);
+    }
+    g_string_append_c(out, '}');
+    *first = false;
+}
+
+void xemu_trace_stop(void)
+{
+    if (!qatomic_read(&g_xemu_trace_active)) {
+        return;
+    }
+    qatomic_set(&g_xemu_trace_active, false);
+
+    g_autoptr(GString) out = g_string_new("{\"traceEvents\":[");
+    bool first = true;
+    unsigned int dropped = 0;
+
+    qemu_mutex_lock(&g_trace.lock);
+    for (XemuTraceBuffer *b = g_trace.buffers; b; b = b->next) {
+        g_autofree char *thread_name =
+            b->thread_name ? g_strdup(b->thread_name) :
+                             g_strdup_printf("thread %d", b->tid);
+        g_string_append_printf(out, "%s\n{\"ph\":\"M\",\"pid\":1,\"tid\":%d,"
+                               "\"name\":\"thread_name\",\"args\":"
+                               "{\"name\":\"%s\"}}", first ? "" : ",",
+                               b->tid, thread_name);
+        first = false;
+
+        unsigned int head = qatomic_load_acquire(&b->head);
+        for (unsigned int i = b->tail; i != head; i++) {
+            append_event(out, &first, b->tid,
+                         &b->events[i % XEMU_TRACE_BUFFER_SIZE],
+                         g_trace.start_time);
+        }
+        qatomic_store_release(&b->tail, head);
+        dropped += b->dropped;
+    }
+    qemu_mutex_unlock(&g_trace.lock);
+
+    g_string_append(out, "\n]}\n");
+
+    g_autofree char *path = get_trace_path();
+    g_autofree char *msg = NULL;
+    if (g_file_set_contents(path, out->str, out->len, NULL)) {
+        msg = dropped ? g_strdup_printf("Wrote trace to %s (%u events dropped)",
+                                        path, dropped) :
+                        g_strdup_printf("Wrote trace to %s", path);
+        xemu_queue_notification(msg);
+    } else {
+        msg = g_strdup_printf("Failed to write trace to %s", path);
+        xemu_queue_error_message(msg);
+    }
+}
@@ -0,0 +1,63 @@
+/*
+ * xemu thread activity tracing
+ *
+ * Copyright (c) 2026 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef XEMU_TRACE
+#define XEMU_TRACE
+
+#include <stdbool.h>
+#include "qemu/atomic.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern bool g_xemu_trace_active;
+
+void xemu_trace_set_thread_name(const char *name);
+void xemu_trace_record(char phase, const char *name, const char *arg);
+void xemu_trace_start(void);
+void xemu_trace_stop(void);
+
+/*
+ * Mark the start and end of a span of work on the calling thread. Names and
+ * arguments must be static strings; they are only formatted on export.
+ */
+static inline void xemu_trace_begin(const char *name, const char *arg)
+{
+    if (unlikely(qatomic_read(&g_xemu_trace_active))) {
+        xemu_trace_record('B', name, arg);
+    }
+}
+
+static inline void xemu_trace_end(void)
+{
+    if (unlikely(qatomic_read(&g_xemu_trace_active))) {
+        xemu_trace_record('E', NULL, NULL);
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,6 +37,7 @@
 #include "qapi/error.h"
 #include "qapi/qapi-commands-block.h"
 #include "qobject/qdict.h"
+#include "block/xdvd-cache.h"
 #include "ui/console.h"
 #include "ui/input.h"
 #include "ui/xemu-display.h"
@@ -48,6 +49,12 @@
 #include "xemu-settings.h"
 // #include "xemu-shaders.h"
 #include "xemu-snapshots.h"
+#include "xemu-frame-pacing.h"
+#include "xemu-bench.h"
+#include "xemu-headless.h"
+#include "xemu-metrics.h"
+#include "xemu-runahead.h"
+#include "xemu-title-profile.h"
 #include "xemu-version.h"
 #include "xemu-os-utils.h"
 
@@ -62,6 +69,8 @@
 
 #ifdef __ANDROID__
 #include <android/log.h>
+#include <SDL_vulkan.h>
+#include "ui/xemu-android-perf.h"
 #endif
 #ifdef _WIN32
 #include "nvapi.h"
@@ -118,11 +127,14 @@ static int guest_x, guest_y;
 static SDL_Cursor *guest_sprite;
 static Notifier mouse_mode_notifier;
 static SDL_Window *m_window;
+static SDL_Window *m_gl_window; // Window m_context was created for
 static SDL_GLContext m_context;
+static bool m_native_present;
 static SDL_threadID sdl_render_thread_id;
 // struct decal_shader *blit;
 
 static QemuSemaphore display_init_sem;
+bool xemu_headless;
 
 static void toggle_full_screen(struct sdl2_console *scon);
 
@@ -170,6 +182,9 @@ static void android_log_gl_error(const char *stage)
 {
     GLenum err;
     bool logged = false;
+    if (!m_context) {
+        return;
+    }
     while ((err = glGetError()) != GL_NO_ERROR) {
         __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
                             "GL error at %s: 0x%x", stage, err);
@@ -308,7 +323,50 @@ static void android_blit_frame(GLuint tex, bool flip)
     glBindVertexArray(0);
     android_log_gl_error("blit-draw");
 }
+
+/*
+ * Have the Vulkan renderer blit the frame into the window's swapchain, which
+ * skips the GL interop and blit entirely.
+ */
+static void android_present_native(SDL_Window *window)
+{
+    NV2APresentRequest req = {
+        .window = window,
+        .show_framebuffer = true,
+    };
+    SDL_Vulkan_GetDrawableSize(window, &req.width, &req.height);
+
+    if (!nv2a_present_frame(&req) && (g_android_frame_counter % 120) == 0) {
+        __android_log_print(ANDROID_LOG_WARN, "xemu-android",
+                            "refresh: native present failed");
+    }
+}
+#endif
+
+static bool is_native_present_requested(void)
+{
+#if defined(CONFIG_IMGUI_VULKAN) && !defined(__ANDROID__)
+    return g_config.display.renderer == CONFIG_DISPLAY_RENDERER_VULKAN &&
+           g_config.display.vulkan.native_present;
+#elif defined(CONFIG_VULKAN) && defined(__ANDROID__)
+    // The GL HUD draws to the window's EGL surface, and a window can only
+    // be connected to either EGL or a swapchain
+    return g_config.display.renderer == CONFIG_DISPLAY_RENDERER_VULKAN &&
+           g_config.display.vulkan.native_present && !g_android_use_hud;
+#else
+    return false;
 #endif
+}
+
+/*
+ * With native presentation the main window is presented to by the Vulkan
+ * renderer, so GL is made current on a hidden window instead. On Android
+ * there is no GL window at all.
+ */
+static SDL_Window *get_gl_window(SDL_Window *window)
+{
+    return window == m_window ? m_gl_window : window;
+}
 
 int xemu_is_fullscreen(void)
 {
@@ -823,6 +881,10 @@ void sdl2_poll_events(struct sdl2_console *scon)
             break;
         case SDL_APP_WILLENTERBACKGROUND:
         case SDL_APP_DIDENTERBACKGROUND:
+            // The window gets a new native surface when it comes back
+            if (m_native_present) {
+                nv2a_present_surface_lost();
+            }
             g_android_paused = true;
             __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                                 "android: app background");
@@ -929,6 +991,80 @@ static const DisplayChangeListenerOps dcl_gl_ops = {
     .dpy_gl_update           = sdl2_gl_scanout_flush,
 };
 
+static void sdl2_gl_context_init(void)
+{
+    m_context = SDL_GL_CreateContext(m_gl_window);
+
+#ifndef __ANDROID__
+    if (m_context != NULL && epoxy_gl_version() < 40) {
+        SDL_GL_MakeCurrent(NULL, NULL);
+        SDL_GL_DeleteContext(m_context);
+        m_context = NULL;
+    }
+#endif
+
+    if (m_context == NULL) {
+#ifdef __ANDROID__
+        const char *msg =
+            "Unable to create OpenGL ES context. This usually means the\r\n"
+            "graphics device on this system does not support OpenGL ES 3.0.\r\n"
+            "\r\n"
+            "xemu cannot continue and will now exit.";
+#else
+        const char *msg =
+            "Unable to create OpenGL context. This usually means the\r\n"
+            "graphics device on this system does not support OpenGL 4.0.\r\n"
+            "\r\n"
+            "xemu cannot continue and will now exit.";
+#endif
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
+            "Unable to create OpenGL context",
+            msg,
+            m_window);
+        SDL_DestroyWindow(m_window);
+        SDL_Quit();
+        exit(1);
+    }
+
+    if (SDL_GL_MakeCurrent(m_gl_window, m_context) != 0) {
+        fprintf(stderr, "Failed to make GL context current: %s\n", SDL_GetError());
+        SDL_DestroyWindow(m_window);
+        SDL_Quit();
+        exit(1);
+    }
+#ifdef __ANDROID__
+    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                        "sdl2_display_very_early_init: GL context current");
+#endif
+
+    fprintf(stderr, "GL_VENDOR: %s\n", glGetString(GL_VENDOR));
+    fprintf(stderr, "GL_RENDERER: %s\n", glGetString(GL_RENDERER));
+    fprintf(stderr, "GL_VERSION: %s\n", glGetString(GL_VERSION));
+    fprintf(stderr, "GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
+#ifdef __ANDROID__
+    {
+        const char *vendor = (const char *)glGetString(GL_VENDOR);
+        const char *renderer = (const char *)glGetString(GL_RENDERER);
+        const char *version = (const char *)glGetString(GL_VERSION);
+        const char *sl = (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION);
+        const char *exts = (const char *)glGetString(GL_EXTENSIONS);
+        g_android_gl_bgra_supported = sdl2_gl_has_extension(exts, "GL_EXT_texture_format_BGRA8888") ||
+                                      sdl2_gl_has_extension(exts, "GL_EXT_texture_format_BGRA8888_OES");
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "GL_VENDOR=%s", vendor ? vendor : "(null)");
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "GL_RENDERER=%s", renderer ? renderer : "(null)");
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "GL_VERSION=%s", version ? version : "(null)");
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "GLSL_VERSION=%s", sl ? sl : "(null)");
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "GL_EXT_texture_format_BGRA8888=%s",
+                            g_android_gl_bgra_supported ? "yes" : "no");
+    }
+#endif
+}
+
 static void sdl2_display_very_early_init(DisplayOptions *o)
 {
 #ifdef __ANDROID__
@@ -977,8 +1113,8 @@ static void sdl2_display_very_early_init(DisplayOptions *o)
     SDL_SetHint(SDL_HINT_VIDEO_MINIMIZE_ON_FOCUS_LOSS, "0");
 
     // Initialize rendering context
-    // Note: On Android, we always need GL context even for Vulkan because
-    // Vulkan uses GL external memory for display presentation
+    // Note: On Android, Vulkan frames are displayed through the GL context
+    // unless the renderer presents to the window natively
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
@@ -1039,16 +1175,12 @@ static void sdl2_display_very_early_init(DisplayOptions *o)
         window_height = min_window_height;
     }
 
-    // On Android, always use OpenGL window even for Vulkan because Vulkan
-    // needs GL context for external memory display presentation
-#ifdef __ANDROID__
-    SDL_WindowFlags window_flags = (SDL_WindowFlags)(SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
-#else
-    bool use_vulkan = (g_config.display.renderer == CONFIG_DISPLAY_RENDERER_VULKAN);
+    // With native presentation the Vulkan renderer owns the window's
+    // swapchain. The UI still renders offscreen with GL, on a hidden window.
+    m_native_present = is_native_present_requested();
     SDL_WindowFlags window_flags = (SDL_WindowFlags)(
-        (use_vulkan ? SDL_WINDOW_VULKAN : SDL_WINDOW_OPENGL) | 
+        (m_native_present ? SDL_WINDOW_VULKAN : SDL_WINDOW_OPENGL) |
         SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
-#endif
 
     // Create main window
     m_window = SDL_CreateWindow(
@@ -1069,49 +1201,30 @@ static void sdl2_display_very_early_init(DisplayOptions *o)
         SDL_SetWindowPosition(m_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
     }
 
-    m_context = SDL_GL_CreateContext(m_window);
-
-#ifndef __ANDROID__
-    if (m_context != NULL && epoxy_gl_version() < 40) {
-        SDL_GL_MakeCurrent(NULL, NULL);
-        SDL_GL_DeleteContext(m_context);
-        m_context = NULL;
-    }
-#endif
-
-    if (m_context == NULL) {
+    m_gl_window = m_window;
+    if (m_native_present) {
 #ifdef __ANDROID__
-        const char *msg =
-            "Unable to create OpenGL ES context. This usually means the\r\n"
-            "graphics device on this system does not support OpenGL ES 3.0.\r\n"
-            "\r\n"
-            "xemu cannot continue and will now exit.";
+        // Nothing is drawn with GL without the HUD, so no context is made
+        m_gl_window = NULL;
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "sdl2_display_very_early_init: native Vulkan presentation");
 #else
-        const char *msg =
-            "Unable to create OpenGL context. This usually means the\r\n"
-            "graphics device on this system does not support OpenGL 4.0.\r\n"
-            "\r\n"
-            "xemu cannot continue and will now exit.";
+        m_gl_window = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED,
+                                       SDL_WINDOWPOS_UNDEFINED, 1, 1,
+                                       SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        if (m_gl_window == NULL) {
+            fprintf(stderr, "Failed to create GL window\n");
+            SDL_DestroyWindow(m_window);
+            SDL_Quit();
+            exit(1);
+        }
 #endif
-        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,
-            "Unable to create OpenGL context",
-            msg,
-            m_window);
-        SDL_DestroyWindow(m_window);
-        SDL_Quit();
-        exit(1);
     }
 
-    if (SDL_GL_MakeCurrent(m_window, m_context) != 0) {
-        fprintf(stderr, "Failed to make GL context current: %s\n", SDL_GetError());
-        SDL_DestroyWindow(m_window);
-        SDL_Quit();
-        exit(1);
+    // Without a GL window there is no context either
+    if (m_gl_window) {
+        sdl2_gl_context_init();
     }
-#ifdef __ANDROID__
-    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                        "sdl2_display_very_early_init: GL context current");
-#endif
 
     int width, height, channels = 0;
     stbi_set_flip_vertically_on_load(0);
@@ -1128,32 +1241,6 @@ static void sdl2_display_very_early_init(DisplayOptions *o)
 
     fprintf(stderr, "CPU: %s\n", xemu_get_cpu_info());
     fprintf(stderr, "OS_Version: %s\n", xemu_get_os_info());
-    fprintf(stderr, "GL_VENDOR: %s\n", glGetString(GL_VENDOR));
-    fprintf(stderr, "GL_RENDERER: %s\n", glGetString(GL_RENDERER));
-    fprintf(stderr, "GL_VERSION: %s\n", glGetString(GL_VERSION));
-    fprintf(stderr, "GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
-#ifdef __ANDROID__
-    {
-        const char *vendor = (const char *)glGetString(GL_VENDOR);
-        const char *renderer = (const char *)glGetString(GL_RENDERER);
-        const char *version = (const char *)glGetString(GL_VERSION);
-        const char *sl = (const char *)glGetString(GL_SHADING_LANGUAGE_VERSION);
-        const char *exts = (const char *)glGetString(GL_EXTENSIONS);
-        g_android_gl_bgra_supported = sdl2_gl_has_extension(exts, "GL_EXT_texture_format_BGRA8888") ||
-                                      sdl2_gl_has_extension(exts, "GL_EXT_texture_format_BGRA8888_OES");
-        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                            "GL_VENDOR=%s", vendor ? vendor : "(null)");
-        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                            "GL_RENDERER=%s", renderer ? renderer : "(null)");
-        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                            "GL_VERSION=%s", version ? version : "(null)");
-        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                            "GLSL_VERSION=%s", sl ? sl : "(null)");
-        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                            "GL_EXT_texture_format_BGRA8888=%s",
-                            g_android_gl_bgra_supported ? "yes" : "no");
-    }
-#endif
 
     // Initialize offscreen rendering context now
 #ifdef __ANDROID__
@@ -1185,9 +1272,9 @@ static void sdl2_display_early_init(DisplayOptions *o)
     // Avoid binding the display context on the QEMU thread.
     return;
 #else
-    SDL_GL_MakeCurrent(m_window, m_context);
-    SDL_GL_SetSwapInterval(g_config.display.window.vsync ? 1 : 0);
-    xemu_hud_init(m_window, m_context);
+    SDL_GL_MakeCurrent(m_gl_window, m_context);
+    xemu_frame_pacing_init(m_window);
+    xemu_hud_init(m_window, m_context, m_native_present);
 #endif
     // blit = create_decal_shader(SHADER_TYPE_BLIT_GAMMA);
 }
@@ -1203,7 +1290,7 @@ static void sdl2_display_init(DisplayState *ds, DisplayOptions *o)
     __android_log_print(ANDROID_LOG_INFO, "xemu-android",
                         "sdl2_display_init: begin");
 #else
-    SDL_GL_MakeCurrent(m_window, m_context);
+    SDL_GL_MakeCurrent(m_gl_window, m_context);
 #endif
 
     memset(&info, 0, sizeof(info));
@@ -1306,20 +1393,18 @@ void xemu_android_display_preinit(void)
     initialized = true;
     sdl_render_thread_id = SDL_ThreadID();
     sdl2_display_very_early_init(NULL);
-    if (SDL_GL_MakeCurrent(m_window, m_context) != 0) {
-#ifdef __ANDROID__
-        __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
-                            "xemu_android_display_preinit: make current failed: %s",
-                            SDL_GetError());
-#endif
+    if (m_context) {
+        if (SDL_GL_MakeCurrent(m_gl_window, m_context) != 0) {
+            __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
+                                "xemu_android_display_preinit: make current failed: %s",
+                                SDL_GetError());
+        }
+        // Cache EGL state now while GL context is current on this thread
+        extern void glo_android_cache_current_egl_state(void);
+        glo_android_cache_current_egl_state();
+        __android_log_print(ANDROID_LOG_INFO, "xemu-android",
+                            "xemu_android_display_preinit: cached EGL state");
     }
-#ifdef __ANDROID__
-    // Cache EGL state now while GL context is current on this thread
-    extern void glo_android_cache_current_egl_state(void);
-    glo_android_cache_current_egl_state();
-    __android_log_print(ANDROID_LOG_INFO, "xemu-android",
-                        "xemu_android_display_preinit: cached EGL state");
-#endif
     nv2a_android_early_context_init();
     qemu_sem_init(&display_init_sem, 0);
 }
@@ -1347,8 +1432,8 @@ void xemu_android_display_loop(void)
     if (sdl_render_thread_id == 0) {
         sdl_render_thread_id = SDL_ThreadID();
     }
-    if (SDL_GL_GetCurrentContext() != m_context) {
-        if (SDL_GL_MakeCurrent(m_window, m_context) != 0) {
+    if (m_context && SDL_GL_GetCurrentContext() != m_context) {
+        if (SDL_GL_MakeCurrent(m_gl_window, m_context) != 0) {
 #ifdef __ANDROID__
             __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
                                 "xemu_android_display_loop: make current failed: %s",
@@ -1358,9 +1443,9 @@ void xemu_android_display_loop(void)
         }
     }
 #ifdef __ANDROID__
-    SDL_GL_SetSwapInterval(g_config.display.window.vsync ? 1 : 0);
+    xemu_frame_pacing_init(m_window);
     if (g_android_use_hud) {
-        xemu_hud_init(m_window, m_context);
+        xemu_hud_init(m_window, m_context, false);
     }
 #endif
     tcg_register_init_ctx();
@@ -1368,6 +1453,7 @@ void xemu_android_display_loop(void)
     qemu_mutex_lock_main_loop();
     bql_lock();
     xemu_input_init();
+    xemu_metrics_init();
     bql_unlock();
     qemu_mutex_unlock_main_loop();
 
@@ -1504,7 +1590,7 @@ void sdl2_gl_update(DisplayChangeListener *dcl,
         return;
     }
 #endif
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    SDL_GL_MakeCurrent(get_gl_window(scon->real_window), scon->winctx);
 }
 
 void sdl2_gl_switch(DisplayChangeListener *dcl,
@@ -1519,7 +1605,7 @@ void sdl2_gl_switch(DisplayChangeListener *dcl,
         return;
     }
 #endif
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    SDL_GL_MakeCurrent(get_gl_window(scon->real_window), scon->winctx);
     xb_surface_gl_destroy_texture(old_surface);
     if (!new_surface) {
         return;
@@ -1528,7 +1614,7 @@ void sdl2_gl_switch(DisplayChangeListener *dcl,
     if (!scon->real_window) {
         scon->real_window = m_window;
         scon->winctx = m_context;
-        SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+        SDL_GL_MakeCurrent(get_gl_window(scon->real_window), scon->winctx);
     }
 }
 
@@ -1574,8 +1660,9 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
         return;
     }
 #endif
-    if (SDL_GL_MakeCurrent(scon->real_window, scon->winctx) != 0 ||
-        SDL_GL_GetCurrentContext() == NULL) {
+    if (scon->winctx &&
+        (SDL_GL_MakeCurrent(get_gl_window(scon->real_window), scon->winctx) != 0 ||
+         SDL_GL_GetCurrentContext() == NULL)) {
 #ifdef __ANDROID__
         __android_log_print(ANDROID_LOG_ERROR, "xemu-android",
                             "sdl2_gl_refresh: make current failed: %s",
@@ -1636,7 +1723,9 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
      */
     GLuint tex = 0;
 #ifdef __ANDROID__
-    if (force_cpu_blit) {
+    if (m_native_present) {
+        // The renderer blits its own display image
+    } else if (force_cpu_blit) {
         /* Trigger a render/sync so the readback buffer gets updated. */
         (void)nv2a_get_framebuffer_surface();
         nv2a_release_framebuffer_surface();
@@ -1707,7 +1796,10 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
         }
     }
 #else
-    tex = nv2a_get_framebuffer_surface();
+    // The renderer blits its own display image when presenting natively
+    if (!m_native_present) {
+        tex = nv2a_get_framebuffer_surface();
+    }
 #endif
 #ifdef __ANDROID__
     android_log_gl_error("refresh-get-fb");
@@ -1723,7 +1815,7 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
                             (int)runstate_get());
     }
 #endif
-    if (tex == 0) {
+    if (tex == 0 && !m_native_present) {
 #ifdef __ANDROID__
         // Ensure the software VGA path updates the surface before uploading.
         qemu_mutex_lock_main_loop();
@@ -1757,19 +1849,26 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
     qemu_mutex_lock_main_loop();
     bql_lock();
     sdl2_poll_events(scon);
+    xemu_frame_pacing_input_polled();
 
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
 #ifdef __ANDROID__
-    android_blit_frame(tex, flip_required);
+    if (!m_native_present) {
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        android_blit_frame(tex, flip_required);
+    }
 #else
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
 #endif
 #ifdef __ANDROID__
     android_log_gl_error("refresh-blit");
 #else
     xemu_snapshots_set_framebuffer_texture(tex, flip_required);
+    xemu_snapshots_poll_thumbnail();
     xemu_hud_set_framebuffer_texture(tex, flip_required);
     xemu_hud_render();
+    xemu_frame_pacing_insert_fence();
 #endif
 
     // Release BQL before swapping (which may sleep if swap interval is not immediate)
@@ -1777,15 +1876,26 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
     qemu_mutex_unlock_main_loop();
 
 #ifdef __ANDROID__
-    glFlush();
+    if (m_native_present) {
+        android_present_native(scon->real_window);
+        xemu_frame_pacing_wait_for_gpu();
+    } else {
+        glFlush();
+    }
 #else
-    glFinish();
+    if (m_native_present) {
+        xemu_hud_present();
+    }
+    xemu_frame_pacing_wait_for_gpu();
 #endif
     nv2a_release_framebuffer_surface();
 #ifdef __ANDROID__
     android_log_gl_error("refresh-finish");
 #endif
-    SDL_GL_SwapWindow(scon->real_window);
+    if (!m_native_present) {
+        SDL_GL_SwapWindow(scon->real_window);
+    }
+    xemu_frame_pacing_frame_presented();
 #ifdef __ANDROID__
     android_log_gl_error("refresh-swap");
 #endif
@@ -1797,14 +1907,18 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
     if (scon->updates && scon->surface) {
         scon->updates = 0;
     }
+    xemu_runahead_frame();
+    xemu_bench_frame();
+#ifdef __ANDROID__
+    xemu_android_perf_poll();
+#endif
     bql_unlock();
     qemu_mutex_unlock_main_loop();
 
     /*
      * Throttle to make sure swaps happen at 60Hz
      */
-    static int64_t last_update = 0;
-    int64_t deadline = last_update + 16666666;
+    int64_t deadline = xemu_frame_pacing_get_deadline();
 
 #ifdef DEBUG_XEMU_C
     int64_t sleep_acc = 0;
@@ -1839,7 +1953,7 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
             }
         } else {
             DPRINTF("zzZz %g %ld\n", (double)sleep_acc/1000000.0, spin_acc);
-            last_update = now;
+            xemu_frame_pacing_frame_started(now);
             break;
         }
     }
@@ -1871,7 +1985,7 @@ QEMUGLContext sdl2_gl_create_context(DisplayChangeListener *dcl,
 
     assert(scon->opengl);
 
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    SDL_GL_MakeCurrent(get_gl_window(scon->real_window), scon->winctx);
 
     SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
     if (scon->opts->gl == DISPLAY_GL_MODE_ON ||
@@ -1918,7 +2032,7 @@ int sdl2_gl_make_context_current(DisplayChangeListener *dcl,
         return 0;
     }
 #endif
-    return SDL_GL_MakeCurrent(scon->real_window, sdlctx);
+    return SDL_GL_MakeCurrent(get_gl_window(scon->real_window), sdlctx);
 }
 
 QEMUGLContext sdl2_gl_get_current_context(DisplayChangeListener *dcl)
@@ -1993,6 +2107,42 @@ static void sleep_ns(int64_t ns)
 #endif
 }
 
+void xemu_headless_display_ready(void)
+{
+    qemu_sem_post(&display_init_sem);
+}
+
+#ifndef __ANDROID__
+// Without a window nothing else paces the guest, so raise the vblank at 60Hz
+static void G_NORETURN headless_loop(void)
+{
+    QemuConsole *con = qemu_console_lookup_by_index(0);
+    int64_t deadline = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    while (1) {
+        qemu_mutex_lock_main_loop();
+        bql_lock();
+        SDL_Event event;
+        while (SDL_PollEvent(&event)) {
+            xemu_input_process_sdl_events(&event);
+        }
+        xemu_input_update_controllers();
+        graphic_hw_update(con);
+        xemu_bench_frame();
+        bql_unlock();
+        qemu_mutex_unlock_main_loop();
+
+        deadline += NANOSECONDS_PER_SECOND / 60;
+        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (deadline > now) {
+            sleep_ns(deadline - now);
+        } else {
+            deadline = now;
+        }
+    }
+}
+#endif
+
 #ifdef _WIN32
 static const wchar_t *get_executable_name(void)
 {
@@ -2088,6 +2238,14 @@ int main(int argc, char **argv)
         }
     }
 
+    for (int i = 1; i < argc; i++) {
+        if (argv[i] && strcmp(argv[i], "-headless") == 0) {
+            argv[i] = NULL;
+            xemu_headless = true;
+            break;
+        }
+    }
+
     if (!xemu_settings_load()) {
         const char *err_msg = xemu_settings_get_error_message();
         fprintf(stderr, "%s", err_msg);
@@ -2097,7 +2255,11 @@ int main(int argc, char **argv)
         SDL_Quit();
         exit(1);
     }
-    atexit(xemu_settings_save);
+    // Headless instances may share a config file, so leave it untouched
+    if (!xemu_headless) {
+        atexit(xemu_settings_save);
+    }
+    xemu_title_profile_apply_boot();
 
 #ifdef _WIN32
     if (g_config.display.setup_nvidia_profile) {
@@ -2105,7 +2267,15 @@ int main(int argc, char **argv)
     }
 #endif
 
-    sdl2_display_very_early_init(NULL);
+    if (xemu_headless) {
+        // Audio goes nowhere, so let the APU run off the turbo clock
+        g_setenv("SDL_AUDIODRIVER", "dummy", true);
+        g_config.audio.turbo.enable = true;
+        g_config.display.vulkan.native_present = false;
+        nv2a_context_init_headless();
+    } else {
+        sdl2_display_very_early_init(NULL);
+    }
 
     qemu_sem_init(&display_init_sem, 0);
     qemu_thread_create(&thread, "qemu_main", call_qemu_main,
@@ -2115,7 +2285,7 @@ int main(int argc, char **argv)
     qemu_sem_wait(&display_init_sem);
 
     gui_grab = 0;
-    if (gui_fullscreen) {
+    if (gui_fullscreen && !xemu_headless) {
         sdl_grab_start(0);
         set_full_screen(&sdl2_console[0], gui_fullscreen);
     }
@@ -2133,9 +2303,14 @@ int main(int argc, char **argv)
     qemu_mutex_lock_main_loop();
     bql_lock();
     xemu_input_init();
+    xemu_metrics_init();
     bql_unlock();
     qemu_mutex_unlock_main_loop();
 
+    if (xemu_headless) {
+        headless_loop();
+    }
+
     while (1) {
         sdl2_gl_refresh(&sdl2_console[0].dcl);
         assert(glGetError() == GL_NO_ERROR);
@@ -2169,8 +2344,13 @@ void xemu_load_disc(const char *path, Error **errp)
     xbox_smc_eject_button();
     xemu_settings_set_string(&g_config.sys.files.dvd_path, "");
 
-    qmp_blockdev_change_medium("ide0-cd1", NULL, path, "raw", false, false,
-                               false, 0, &error);
+    xdvd_cache_set_default_size((uint64_t)MAX(g_config.perf.disc_cache_mb, 0) *
+                                MiB);
+    // Without the cache the format is probed, so compressed images open too
+    qmp_blockdev_change_medium("ide0-cd1", NULL, path,
+                               g_config.perf.disc_cache_mb > 0 ? "xdvd-cache" :
+                                                                 NULL,
+                               false, false, false, 0, &error);
     if (error) {
         error_propagate(errp, error);
     } else {
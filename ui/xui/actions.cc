@@ -37,7 +37,8 @@ void ActionEjectDisc(void)
 void ActionLoadDisc(void)
 {
     const char *iso_file_filters =
-        "Disc Image Files (*.iso, *.xiso)\0*.iso;*.xiso\0All Files\0*.*\0";
+        "Disc Image Files (*.iso, *.xiso, *.zxiso)\0*.iso;*.xiso;*.zxiso\0"
+        "All Files\0*.*\0";
     const char *new_disc_path =
         PausedFileOpen(NOC_FILE_DIALOG_OPEN, iso_file_filters,
                        g_config.sys.files.dvd_path, NULL);
@@ -112,3 +113,24 @@ void ActionLoadSnapshotChecked(const char *name)
 {
     g_snapshot_mgr.LoadSnapshotChecked(name);
 }
+
+void ActionQuicksave(bool save)
+{
+    Error *err = NULL;
+    if (save) {
+        xemu_snapshots_quicksave(&err);
+        if (!err) {
+            xemu_queue_notification("Quicksaved");
+        }
+    } else if (!xemu_snapshots_quicksave_exists()) {
+        xemu_queue_notification("No quicksave to load");
+        return;
+    } else {
+        xemu_snapshots_quickload(&err);
+    }
+
+    if (err) {
+        xemu_queue_error_message(error_get_pretty(err));
+        error_free(err);
+    }
+}
@@ -27,3 +27,4 @@ void ActionShutdown();
 void ActionScreenshot();
 void ActionActivateBoundSnapshot(int slot, bool save);
 void ActionLoadSnapshotChecked(const char *name);
+void ActionQuicksave(bool save);
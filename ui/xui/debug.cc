@@ -21,6 +21,15 @@
 #include "misc.hh"
 #include "font-manager.hh"
 #include "viewport-manager.hh"
+#include "ui/xemu-frame-pacing.h"
+#include "ui/xemu-mem-stats.h"
+#include "ui/xemu-notifications.h"
+#include "ui/xemu-thread-topology.h"
+
+extern "C" {
+#include "accel/tcg/runtime-stats.h"
+#include "block/xdvd-cache.h"
+}
 
 #define MAX_VOICES 256
 
@@ -109,7 +118,8 @@ void DebugApuWindow::Draw()
         const struct McpxApuDebugVoice *voice = &dbg->vp.v[voice_info];
         ImGui::BeginTooltip();
         bool is_paused = voice->paused;
-        ImGui::Text("Voice 0x%x/%d %s", voice_info, voice_info, is_paused ? "(Paused)" : "");
+        ImGui::Text("Voice 0x%x/%d %s", voice_info, voice_info,
+                    is_paused ? "(Paused)" : voice->culled ? "(Culled)" : "");
         ImGui::SameLine();
         ImGui::Text(voice->stereo ? "Stereo" : "Mono");
 
@@ -218,6 +228,12 @@ void DebugApuWindow::Draw()
         mcpx_apu_debug_set_ep_realtime_enabled(ep_realtime);
     }
 
+    static bool gp_hle;
+    gp_hle = dbg->gp_hle;
+    if (ImGui::Checkbox("GP HLE\n", &gp_hle)) {
+        mcpx_apu_debug_set_gp_hle_enabled(gp_hle);
+    }
+
     ImGui::Checkbox("HRTF Filtering\n", &g_config.audio.hrtf);
 
     ImGui::PushFont(g_font_mgr.m_fixed_width_font);
@@ -228,6 +244,7 @@ void DebugApuWindow::Draw()
     if (color) ImGui::PopStyleColor();
 
     ImGui::Text("Frames:      %04d", dbg->frames_processed);
+    ImGui::Text("Lock waits:  %04d", dbg->fe_lock_contended);
     ImGui::Text("VP:          %4d us", dbg->vp.total_worker_time_us);
     if (ImGui::TreeNode("VP Workers")) {
         ImGui::Text(" W: #  us");
@@ -242,6 +259,8 @@ void DebugApuWindow::Draw()
     }
     ImGui::Text("GP Cycles:   %04d", dbg->gp.cycles);
     ImGui::Text("EP Cycles:   %04d", dbg->ep.cycles);
+    ImGui::Text("GP Program:  %016" PRIx64 " %s", dbg->gp.program_hash,
+                dbg->gp.hle_program ? dbg->gp.hle_program : "(interpreted)");
 
     ImGui::PopFont();
     ImGui::Columns(1);
@@ -281,10 +300,87 @@ DebugVideoWindow::DebugVideoWindow()
     m_position_restored = false;
     m_resize_init_complete = false;
     m_prev_scale = g_viewport_mgr.m_scale;
+    m_method_costs_shown = false;
+}
+
+void DebugVideoWindow::DrawMethodCosts()
+{
+    const int max_rows = 32;
+    NV2AMethodCostEntry entries[max_rows];
+    uint64_t total_ns;
+    size_t num_entries =
+        nv2a_profile_get_method_costs(entries, max_rows, &total_ns);
+
+    if (ImGui::Button("Reset")) {
+        nv2a_profile_reset_method_costs();
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Save CSV")) {
+        g_autoptr(GDateTime) now = g_date_time_new_now_local();
+        g_autofree char *name =
+            g_date_time_format(now, "method_costs-%Y%m%d-%H%M%S.csv");
+        g_autofree char *path =
+            g_build_filename(xemu_settings_get_base_path(), name, NULL);
+        g_autofree char *msg = NULL;
+        if (nv2a_profile_save_method_costs(path)) {
+            msg = g_strdup_printf("Wrote method costs to %s", path);
+            xemu_queue_notification(msg);
+        } else {
+            msg = g_strdup_printf("Failed to write method costs to %s", path);
+            xemu_queue_error_message(msg);
+        }
+    }
+    ImGui::SameLine();
+    ImGui::Text("Total: %.3f ms", total_ns / 1e6);
+
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+                            ImGuiTableFlags_SizingFixedFit;
+    if (ImGui::BeginTable("method_costs_tbl", 6, flags)) {
+        ImGui::TableSetupColumn("Class");
+        ImGui::TableSetupColumn("Method");
+        ImGui::TableSetupColumn("Calls");
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("ns/call");
+        ImGui::TableSetupColumn("%");
+        ImGui::TableHeadersRow();
+
+        for (size_t i = 0; i < num_entries; i++) {
+            NV2AMethodCostEntry *entry = &entries[i];
+            const char *name =
+                pgraph_get_method_name(entry->graphics_class, entry->method);
+
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::Text("0x%02x", entry->graphics_class);
+            ImGui::TableSetColumnIndex(1);
+            if (name) {
+                ImGui::TextUnformatted(name);
+            } else {
+                ImGui::Text("0x%04x", entry->method);
+            }
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%" PRIu64, entry->calls);
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%.3f", entry->ns / 1e6);
+            ImGui::TableSetColumnIndex(4);
+            ImGui::Text("%.1f", (double)entry->ns / entry->calls);
+            ImGui::TableSetColumnIndex(5);
+            ImGui::Text("%.1f", total_ns ? entry->ns * 100.0 / total_ns : 0.0);
+        }
+        ImGui::EndTable();
+    }
 }
 
 void DebugVideoWindow::Draw()
 {
+    // GPU timestamps are only collected while they are being shown
+    qatomic_set(&g_nv2a_stats.gpu_timers_enabled, m_is_open);
+
+    if (!m_is_open && m_method_costs_shown) {
+        qatomic_set(&g_nv2a_stats.method_costs_enabled, false);
+        m_method_costs_shown = false;
+    }
+
     if (!m_is_open)
         return;
 
@@ -354,6 +450,69 @@ void DebugVideoWindow::Draw()
         }
         ImPlot::PopStyleColor();
 
+        ImGui::Text("Present: %.1f ms (GPU wait %.1f ms) @ %.0f Hz, "
+                    "est. input latency: %.1f ms",
+                    g_frame_pacing_stats.present_ms,
+                    g_frame_pacing_stats.gpu_wait_ms,
+                    g_frame_pacing_stats.refresh_rate,
+                    g_frame_pacing_stats.input_latency_ms);
+
+        NV2AMemoryStats ms;
+        if (nv2a_get_memory_stats(&ms)) {
+            ImGui::Text("Memory: %.1f MiB device (textures %u, %.1f MiB; "
+                        "surfaces %u, %.1f MiB; %u pipelines, %u shaders), "
+                        "%d MiB guest%s",
+                        ms.device_bytes / (1024.0 * 1024.0), ms.textures,
+                        ms.texture_bytes / (1024.0 * 1024.0), ms.surfaces,
+                        ms.surface_bytes / (1024.0 * 1024.0), ms.pipelines,
+                        ms.shader_modules, (g_config.sys.mem_limit + 1) * 64,
+                        xemu_settings_low_memory_mode() ? ", low memory" : "");
+        }
+
+        if (g_nv2a_stats.gpu_timers_enabled) {
+            char gpu_times[256];
+            int len = snprintf(gpu_times, sizeof(gpu_times), "GPU: %.2f ms",
+                               nv2a_profile_get_gpu_total_time());
+            for (int i = 0; i < NV2A_PROF_GPU__COUNT && len < (int)sizeof(gpu_times); i++) {
+                len += snprintf(gpu_times + len, sizeof(gpu_times) - len,
+                                ", %s %.2f", nv2a_profile_get_gpu_timer_name(i),
+                                nv2a_profile_get_gpu_time(i));
+            }
+            ImGui::TextUnformatted(gpu_times);
+
+            x_end = g_nv2a_stats.frame_count;
+            x_start = x_end - NV2A_PROF_NUM_FRAMES;
+
+            ImGui::SetNextWindowBgAlpha(alpha);
+            if (ImPlot::BeginPlot("##ScrollingGPU", ImVec2(-1,75*g_viewport_mgr.m_scale))) {
+                ImPlot::SetupAxes(NULL, NULL, rt_axis, ImPlotAxisFlags_AutoFit);
+                ImPlot::SetupAxisLimits(ImAxis_X1, x_start, x_end, ImPlotCond_Always);
+                ImPlot::PlotLine("Total", &g_nv2a_stats.frame_history[0].gpu_total_ms, NV2A_PROF_NUM_FRAMES, 1, x_start, 0, g_nv2a_stats.frame_ptr, sizeof(g_nv2a_stats.frame_working));
+                for (int i = 0; i < NV2A_PROF_GPU__COUNT; i++) {
+                    ImPlot::PlotLine(nv2a_profile_get_gpu_timer_name(i), &g_nv2a_stats.frame_history[0].gpu_ms[i], NV2A_PROF_NUM_FRAMES, 1, x_start, 0, g_nv2a_stats.frame_ptr, sizeof(g_nv2a_stats.frame_working));
+                }
+                ImPlot::EndPlot();
+            }
+        }
+
+        ImGui::SetNextItemOpen(
+            g_config.display.debug.video.method_costs_tree_state,
+            ImGuiCond_Once);
+        g_config.display.debug.video.method_costs_tree_state =
+            ImGui::TreeNode("Method Costs");
+
+        bool show_method_costs =
+            m_is_open && g_config.display.debug.video.method_costs_tree_state;
+        if (show_method_costs != m_method_costs_shown) {
+            qatomic_set(&g_nv2a_stats.method_costs_enabled, show_method_costs);
+            m_method_costs_shown = show_method_costs;
+        }
+
+        if (g_config.display.debug.video.method_costs_tree_state) {
+            DrawMethodCosts();
+            ImGui::TreePop();
+        }
+
         ImGui::SetNextItemOpen(g_config.display.debug.video.advanced_tree_state,
                                ImGuiCond_Once);
         g_config.display.debug.video.advanced_tree_state =
@@ -414,5 +573,181 @@ void DebugVideoWindow::Draw()
     ImGui::PopStyleColor(5);
 }
 
+DebugCpuWindow::DebugCpuWindow()
+    : m_is_open(false), m_last_sample_ms(0), m_last_gen_count(0),
+      m_last_gen_time_ns(0), m_last_idle_ns(0), m_gen_rate(0), m_gen_load(0),
+      m_idle_load(0)
+{
+}
+
+void DebugCpuWindow::Draw()
+{
+    if (!m_is_open)
+        return;
+
+    TCGRuntimeStats st;
+    tcg_get_runtime_stats(&st);
+
+    // Rates are sampled once a second so they stay readable
+    uint32_t now = SDL_GetTicks();
+    uint32_t elapsed = now - m_last_sample_ms;
+    if (elapsed >= 1000) {
+        if (m_last_sample_ms && st.gen_count >= m_last_gen_count) {
+            m_gen_rate = (st.gen_count - m_last_gen_count) * 1000.0f / elapsed;
+            m_gen_load = (st.gen_time_ns - m_last_gen_time_ns) /
+                         (elapsed * 1e4f);
+            m_idle_load = (st.idle_ns - m_last_idle_ns) / (elapsed * 1e4f);
+        }
+        m_last_sample_ms = now;
+        m_last_gen_count = st.gen_count;
+        m_last_gen_time_ns = st.gen_time_ns;
+        m_last_idle_ns = st.idle_ns;
+    }
+
+    ImGui::SetNextWindowContentSize(ImVec2(400.0f*g_viewport_mgr.m_scale, 0.0f));
+    if (!ImGui::Begin("CPU Debug", &m_is_open,
+                      ImGuiWindowFlags_NoCollapse |
+                          ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    float fill = st.code_capacity ?
+                     (float)st.code_size / st.code_capacity : 0.0f;
+    char overlay[64];
+    snprintf(overlay, sizeof(overlay), "%.1f / %.1f MiB",
+             st.code_size / (1024.0 * 1024.0),
+             st.code_capacity / (1024.0 * 1024.0));
+    ImGui::Text("Code buffer");
+    ImGui::ProgressBar(fill, ImVec2(-1, 0), overlay);
+
+    ImGui::PushFont(g_font_mgr.m_fixed_width_font);
+    ImGui::Text("Blocks:        %zu", st.nb_tbs);
+    ImGui::Text("Translated:    %" PRIu64 " (%.0f/s)", st.gen_count,
+                m_gen_rate);
+    ImGui::Text("Translate:     %.1f ms total, %.1f us avg",
+                st.gen_time_ns / 1e6,
+                st.gen_count ? st.gen_time_ns / 1e3 / st.gen_count : 0.0);
+    bool color = (m_gen_load > 10.0f);
+    if (color) ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1,0,0,1));
+    ImGui::Text("Translate load: %.2f%%", m_gen_load);
+    if (color) ImGui::PopStyleColor();
+    ImGui::Text("Idle:          %.1f%% (%" PRIu64 " loops parked)",
+                MIN(m_idle_load, 100.0f), st.idle_parks);
+    ImGui::Text("Flushes:       %u", st.flush_count);
+    ImGui::Text("Invalidations: %u", st.invalidate_count);
+    ImGui::PopFont();
+
+    XdvdCacheStats dc;
+    xdvd_cache_get_stats(&dc);
+    uint64_t reads = dc.hits + dc.misses;
+    ImGui::Text("Disc cache");
+    ImGui::PushFont(g_font_mgr.m_fixed_width_font);
+    ImGui::Text("Hit rate:      %.1f%% (%" PRIu64 " misses)",
+                reads ? dc.hits * 100.0 / reads : 0.0, dc.misses);
+    ImGui::Text("Prefetched:    %.1f MiB",
+                dc.prefetched_bytes / (1024.0 * 1024.0));
+    ImGui::Text("Stalled:       %.1f ms", dc.stall_ns / 1e6);
+    ImGui::PopFont();
+
+    XemuThreadTopology topo;
+    xemu_thread_topology_get(&topo);
+    ImGui::Text("Threads");
+    ImGui::PushFont(g_font_mgr.m_fixed_width_font);
+    ImGui::Text("Host CPUs:     %d", topo.num_cpus);
+    ImGui::Text("Fast cores:    %s",
+                topo.fast_cpus[0] ? topo.fast_cpus : "all");
+    ImGui::Text("Reserved:      %s",
+                topo.reserved_cpus[0] ? topo.reserved_cpus : "none");
+    ImGui::PopFont();
+
+    size_t count;
+    g_autofree XemuThreadInfo *threads =
+        xemu_thread_topology_get_threads(&count);
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+                            ImGuiTableFlags_SizingFixedFit;
+    if (ImGui::BeginTable("threads_tbl", 5, flags)) {
+        ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableSetupColumn("TID");
+        ImGui::TableSetupColumn("Class");
+        ImGui::TableSetupColumn("CPUs");
+        ImGui::TableSetupColumn("Priority");
+        ImGui::TableHeadersRow();
+
+        for (size_t i = 0; i < count; i++) {
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::TextUnformatted(threads[i].name);
+            ImGui::TableSetColumnIndex(1);
+            ImGui::Text("%d", threads[i].tid);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::TextUnformatted(xemu_thread_class_name(threads[i].cls));
+            ImGui::TableSetColumnIndex(3);
+            ImGui::TextUnformatted(threads[i].cpus);
+            ImGui::TableSetColumnIndex(4);
+            ImGui::TextUnformatted(threads[i].priority);
+        }
+        ImGui::EndTable();
+    }
+
+    ImGui::End();
+}
+
+DebugMemoryWindow::DebugMemoryWindow() : m_is_open(false)
+{
+}
+
+void DebugMemoryWindow::Draw()
+{
+    if (!m_is_open)
+        return;
+
+    ImGui::SetNextWindowContentSize(ImVec2(500.0f*g_viewport_mgr.m_scale, 0.0f));
+    if (!ImGui::Begin("Memory Debug", &m_is_open,
+                      ImGuiWindowFlags_NoCollapse |
+                          ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    size_t count;
+    g_autofree XemuMemAccountStats *stats = xemu_mem_get_stats(&count);
+    uint64_t total_live = 0, total_peak = 0;
+
+    ImGuiTableFlags flags = ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+                            ImGuiTableFlags_SizingFixedFit;
+    if (ImGui::BeginTable("memory_tbl", 4, flags)) {
+        ImGui::TableSetupColumn("Group");
+        ImGui::TableSetupColumn("Name", ImGuiTableColumnFlags_WidthStretch);
+        ImGui::TableSetupColumn("Live MiB");
+        ImGui::TableSetupColumn("Peak MiB");
+        ImGui::TableHeadersRow();
+
+        for (size_t i = 0; i < count; i++) {
+            ImGui::TableNextRow();
+            ImGui::TableSetColumnIndex(0);
+            ImGui::TextUnformatted(stats[i].group);
+            ImGui::TableSetColumnIndex(1);
+            ImGui::TextUnformatted(stats[i].name);
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.2f", stats[i].live / (1024.0 * 1024.0));
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%.2f", stats[i].peak / (1024.0 * 1024.0));
+            total_live += stats[i].live;
+            total_peak += stats[i].peak;
+        }
+        ImGui::EndTable();
+    }
+
+    // Peaks of different accounts need not coincide, so their sum is a bound
+    ImGui::Text("Total: %.1f MiB live, at most %.1f MiB peak",
+                total_live / (1024.0 * 1024.0),
+                total_peak / (1024.0 * 1024.0));
+
+    ImGui::End();
+}
+
 DebugApuWindow apu_window;
 DebugVideoWindow video_window;
+DebugCpuWindow cpu_window;
+DebugMemoryWindow memory_window;
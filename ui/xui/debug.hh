@@ -18,6 +18,8 @@
 //
 #pragma once
 
+#include <stdint.h>
+
 class DebugApuWindow
 {
 public:
@@ -34,10 +36,39 @@ public:
     bool m_position_restored;
     bool m_resize_init_complete;
     float m_prev_scale;
+    bool m_method_costs_shown;
 
     DebugVideoWindow();
     void Draw();
+    void DrawMethodCosts();
+};
+
+class DebugCpuWindow
+{
+public:
+    bool m_is_open;
+    uint32_t m_last_sample_ms;
+    uint64_t m_last_gen_count;
+    uint64_t m_last_gen_time_ns;
+    uint64_t m_last_idle_ns;
+    float m_gen_rate;
+    float m_gen_load;
+    float m_idle_load;
+
+    DebugCpuWindow();
+    void Draw();
+};
+
+class DebugMemoryWindow
+{
+public:
+    bool m_is_open;
+
+    DebugMemoryWindow();
+    void Draw();
 };
 
 extern DebugApuWindow apu_window;
 extern DebugVideoWindow video_window;
+extern DebugCpuWindow cpu_window;
+extern DebugMemoryWindow memory_window;
@@ -18,6 +18,9 @@
 //
 #include "font-manager.hh"
 #include "viewport-manager.hh"
+#ifdef CONFIG_IMGUI_VULKAN
+#include "vulkan-hud.hh"
+#endif
 
 #include "data/Roboto-Medium.ttf.h"
 #include "data/RobotoCondensed-Regular.ttf.h"
@@ -106,6 +109,12 @@ void FontManager::Rebuild()
         m_fixed_width_font = io.Fonts->AddFontDefault(&config);
     }
 
+#ifdef CONFIG_IMGUI_VULKAN
+    if (g_vulkan_hud) {
+        VulkanHudInvalidateFonts();
+        return;
+    }
+#endif
     ImGui_ImplOpenGL3_CreateFontsTexture();
 }
 
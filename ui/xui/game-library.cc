@@ -0,0 +1,330 @@
+//
+// xemu User Interface
+//
+// Copyright (C) 2020-2022 Matt Borgerson
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "qemu/osdep.h"
+
+#include <glib.h>
+#include <filesystem>
+#include <unordered_map>
+#include "game-library.hh"
+#include "../xemu-settings.h"
+#include "xemu-xbe.h"
+#include <nlohmann/json.hpp>
+using json = nlohmann::json;
+
+#define GAME_LIBRARY_INDEX_FILE "game-library.json"
+#define GAME_LIBRARY_INDEX_VERSION 1
+
+// Publish newly read titles in batches while a large library is indexed
+#define GAME_LIBRARY_PUBLISH_INTERVAL 16
+
+GameLibrary g_game_library;
+
+static void ReadImageMetadata(GameLibraryEntry &entry)
+{
+    struct xbe_disc_info info;
+    if (!xemu_get_disc_xbe_info(entry.path.c_str(), &info)) {
+        return;
+    }
+
+    entry.title_id = info.title_id;
+    if (info.title_name) {
+        entry.title = info.title_name;
+        g_free(info.title_name);
+    }
+    entry.icon_offset = info.icon_offset;
+    entry.icon_size = info.icon_size;
+}
+
+static bool IsDiscImage(const std::filesystem::path &path)
+{
+    return path.extension() == ".iso" || path.extension() == ".xiso" ||
+           path.extension() == ".zxiso";
+}
+
+GameLibrary::GameLibrary()
+{
+    m_exiting = false;
+    m_generation = 0;
+    m_scan_requested = false;
+    m_force_scan = false;
+    m_indexed_dir_mtime = 0;
+}
+
+GameLibrary::~GameLibrary()
+{
+    Stop();
+}
+
+std::string GameLibrary::GetIndexPath()
+{
+    g_autofree char *path = g_build_filename(xemu_settings_get_base_path(),
+                                             GAME_LIBRARY_INDEX_FILE, NULL);
+    return path;
+}
+
+void GameLibrary::LoadIndex()
+{
+    g_autofree char *contents = NULL;
+    gsize len;
+    if (!g_file_get_contents(GetIndexPath().c_str(), &contents, &len, NULL)) {
+        return;
+    }
+
+    json index = json::parse(contents, contents + len, nullptr, false);
+    if (index.is_discarded() || !index.is_object()) {
+        return;
+    }
+
+    try {
+        if (index.value("version", 0) != GAME_LIBRARY_INDEX_VERSION) {
+            return;
+        }
+
+        // An index of some other directory is of no use
+        std::string dir = index.value("dir", "");
+        if (dir != m_requested_dir) {
+            return;
+        }
+
+        std::vector<GameLibraryEntry> entries;
+        for (const auto &game : index.at("games")) {
+            GameLibraryEntry entry;
+            entry.path = game.at("path").get<std::string>();
+            entry.title = game.at("title").get<std::string>();
+            entry.title_id = game.value("title_id", 0u);
+            entry.size = game.at("size").get<int64_t>();
+            entry.mtime = game.at("mtime").get<int64_t>();
+            entry.icon_offset = game.value("icon_offset", (uint64_t)0);
+            entry.icon_size = game.value("icon_size", 0u);
+            entries.push_back(entry);
+        }
+
+        m_indexed_dir = dir;
+        m_indexed_dir_mtime = index.value("dir_mtime", (int64_t)0);
+        m_entries = entries;
+        m_generation++;
+    } catch (const json::exception &e) {
+        fprintf(stderr, "Ignoring invalid game library index: %s\n",
+                e.what());
+    }
+}
+
+void GameLibrary::SaveIndex(const std::vector<GameLibraryEntry> &entries)
+{
+    json games = json::array();
+    for (const auto &entry : entries) {
+        games.push_back({
+            { "path", entry.path },
+            { "title", entry.title },
+            { "title_id", entry.title_id },
+            { "size", entry.size },
+            { "mtime", entry.mtime },
+            { "icon_offset", entry.icon_offset },
+            { "icon_size", entry.icon_size },
+        });
+    }
+
+    json index = {
+        { "version", GAME_LIBRARY_INDEX_VERSION },
+        { "dir", m_indexed_dir },
+        { "dir_mtime", m_indexed_dir_mtime },
+        { "games", games },
+    };
+
+    // Titles may not be valid UTF-8 if they came from file names
+    std::string s = index.dump(1, ' ', false, json::error_handler_t::replace);
+    g_autoptr(GError) err = NULL;
+    if (!g_file_set_contents(GetIndexPath().c_str(), s.c_str(), s.length(),
+                             &err)) {
+        fprintf(stderr, "Failed to save game library index: %s\n",
+                err->message);
+    }
+}
+
+void GameLibrary::Publish(const std::vector<GameLibraryEntry> &entries)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_entries = entries;
+    m_generation++;
+}
+
+void GameLibrary::Scan(const std::string &dir, bool force)
+{
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path directory(dir);
+
+    // Adding, removing or renaming an image updates the directory's mtime,
+    // so an unchanged directory means there is nothing new to list. Images
+    // rewritten in place are picked up by the full scan at startup.
+    int64_t dir_mtime = 0;
+    if (!dir.empty()) {
+        auto time = fs::last_write_time(directory, ec);
+        dir_mtime = ec ? 0 : time.time_since_epoch().count();
+    }
+    if (!force && dir == m_indexed_dir && dir_mtime &&
+        dir_mtime == m_indexed_dir_mtime) {
+        return;
+    }
+
+    std::unordered_map<std::string, GameLibraryEntry> previous;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (const auto &entry : m_entries) {
+            previous.emplace(entry.path, entry);
+        }
+    }
+
+    // List the directory first, keeping what is already known about
+    // unchanged images, then read the new and modified ones.
+    std::vector<GameLibraryEntry> entries;
+    std::vector<size_t> stale;
+    if (!dir.empty() && fs::is_directory(directory, ec)) {
+        for (fs::directory_iterator it(directory, ec), end;
+             !ec && it != end && !m_exiting; it.increment(ec)) {
+            const fs::directory_entry &file = *it;
+            std::error_code file_ec;
+            if (!IsDiscImage(file.path()) || !file.is_regular_file(file_ec)) {
+                continue;
+            }
+
+            GameLibraryEntry entry = {};
+            entry.path = file.path().string();
+            entry.size = file.file_size(file_ec);
+            if (file_ec) {
+                continue;
+            }
+            auto time = file.last_write_time(file_ec);
+            if (file_ec) {
+                continue;
+            }
+            entry.mtime = time.time_since_epoch().count();
+
+            auto known = previous.find(entry.path);
+            if (known != previous.end() && known->second.size == entry.size &&
+                known->second.mtime == entry.mtime) {
+                entries.push_back(known->second);
+                continue;
+            }
+
+            entry.title = file.path().stem().string();
+            stale.push_back(entries.size());
+            entries.push_back(entry);
+        }
+    }
+    if (m_exiting) {
+        return;
+    }
+    Publish(entries);
+
+    for (size_t i = 0; i < stale.size() && !m_exiting; i++) {
+        GameLibraryEntry &entry = entries[stale[i]];
+        // zxiso images are compressed, so only their file name is known
+        if (fs::path(entry.path).extension() != ".zxiso") {
+            ReadImageMetadata(entry);
+        }
+        if ((i + 1) % GAME_LIBRARY_PUBLISH_INTERVAL == 0) {
+            Publish(entries);
+        }
+    }
+    if (m_exiting) {
+        return;
+    }
+    Publish(entries);
+
+    m_indexed_dir = dir;
+    m_indexed_dir_mtime = dir_mtime;
+    SaveIndex(entries);
+}
+
+void GameLibrary::ThreadFunc()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    while (true) {
+        m_cond.wait(lock, [this] { return m_exiting || m_scan_requested; });
+        if (m_exiting) {
+            break;
+        }
+
+        std::string dir = m_requested_dir;
+        bool force = m_force_scan;
+        m_scan_requested = false;
+        m_force_scan = false;
+
+        lock.unlock();
+        Scan(dir, force);
+        lock.lock();
+    }
+}
+
+void GameLibrary::Start()
+{
+    if (m_thread.joinable()) {
+        return;
+    }
+
+    const char *games_dir = g_config.general.games_dir;
+    m_requested_dir = games_dir ? games_dir : "";
+    LoadIndex();
+
+    // Check every image once per run, in case one was replaced in place
+    m_scan_requested = true;
+    m_force_scan = true;
+    m_thread = std::thread(&GameLibrary::ThreadFunc, this);
+}
+
+void GameLibrary::Stop()
+{
+    if (!m_thread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_exiting = true;
+    }
+    m_cond.notify_one();
+    m_thread.join();
+}
+
+void GameLibrary::Refresh()
+{
+    const char *games_dir = g_config.general.games_dir;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_requested_dir = games_dir ? games_dir : "";
+        m_scan_requested = true;
+    }
+    m_cond.notify_one();
+}
+
+bool GameLibrary::GetEntries(std::vector<GameLibraryEntry> &entries,
+                             uint64_t &generation)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (generation == m_generation) {
+        return false;
+    }
+    entries = m_entries;
+    generation = m_generation;
+    return true;
+}
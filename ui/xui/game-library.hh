@@ -0,0 +1,84 @@
+//
+// xemu User Interface
+//
+// Copyright (C) 2020-2022 Matt Borgerson
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct GameLibraryEntry {
+    std::string path;
+    std::string title;     // From the XBE certificate, else the file name
+    uint32_t title_id;     // 0 if no XBE could be read from the image
+    int64_t size;
+    int64_t mtime;
+    uint64_t icon_offset;  // Image offset of the $$XTIMAGE section, or 0
+    uint32_t icon_size;
+};
+
+// Keeps an index of the disc images in the games directory, with metadata
+// read from each image's default.xbe, up to date on a background thread.
+// The index is saved between runs, so a large library on slow storage is
+// listed straight away and only new or changed images are read again.
+class GameLibrary
+{
+protected:
+    std::mutex m_lock;
+    std::condition_variable m_cond;
+    std::thread m_thread;
+    std::atomic<bool> m_exiting;
+
+    // Protected by m_lock
+    std::vector<GameLibraryEntry> m_entries;
+    uint64_t m_generation;
+    std::string m_requested_dir;
+    bool m_scan_requested;
+    bool m_force_scan;
+
+    // Scanner thread only
+    std::string m_indexed_dir;
+    int64_t m_indexed_dir_mtime;
+
+    std::string GetIndexPath();
+    void LoadIndex();
+    void SaveIndex(const std::vector<GameLibraryEntry> &entries);
+    void Publish(const std::vector<GameLibraryEntry> &entries);
+    void Scan(const std::string &dir, bool force);
+    void ThreadFunc();
+
+public:
+    GameLibrary();
+    ~GameLibrary();
+    void Start();
+    void Stop();
+
+    // Ask for the games directory to be checked for changes
+    void Refresh();
+
+    // Copy the current entries if they changed since @generation, which is
+    // updated. Returns whether anything was copied.
+    bool GetEntries(std::vector<GameLibraryEntry> &entries,
+                    uint64_t &generation);
+};
+
+extern GameLibrary g_game_library;
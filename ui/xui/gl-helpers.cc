@@ -29,8 +29,10 @@
 #include <fpng.h>
 #include <math.h>
 #include <stdio.h>
+#include <string>
 #include <vector>
 
+#include "ui/shader/display-upscale-glsl.h"
 #include "ui/shader/xemu-logo-frag.h"
 
 Fbo *controller_fbo, *xmu_fbo, *logo_fbo;
@@ -41,6 +43,8 @@ enum class ShaderType {
     BlitGamma, // FIMXE: Move to nv2a_get_framebuffer_surface
     Mask,
     Logo,
+    UpscaleEasu,
+    UpscaleRcasGamma,
 };
 
 typedef struct DecalShader_
@@ -58,12 +62,21 @@ typedef struct DecalShader_
     GLint color_fill_loc;
     GLint time_loc;
     GLint scale_loc;
+    GLint sharpness_loc;
     GLint palette_loc[256];
 } DecalShader;
 
 static DecalShader *g_decal_shader,
                    *g_logo_shader,
-                   *g_framebuffer_shader;
+                   *g_framebuffer_shader,
+                   *g_upscale_easu_shader,
+                   *g_upscale_rcas_shader;
+
+// Intermediate for FSR upscaling, sized to the window's picture
+static Fbo *g_upscale_fbo;
+
+// RCAS sharpening of 0.2 stops, 2^-0.2
+#define UPSCALE_SHARPNESS 0.87f
 
 GLint Fbo::vp[4];
 GLint Fbo::original_fbo;
@@ -234,9 +247,7 @@ void main() {
     // }
     // )";
 
-    const char *image_gamma_frag_src = R"(
-#version 400 core
-uniform sampler2D tex;
+    const char *gamma_src = R"(
 uniform uint palette[256];
 float gamma_ch(int ch, float col)
 {
@@ -247,11 +258,41 @@ vec4 gamma(vec4 col)
 {
     return vec4(gamma_ch(0, col.r), gamma_ch(1, col.g), gamma_ch(2, col.b), col.a);
 }
+)";
+
+    const char *image_gamma_frag_src = R"(
+uniform sampler2D tex;
 in  vec2 Texcoord;
 out vec4 out_Color;
 void main() {
     out_Color.rgba = gamma(texture(tex, Texcoord));
 }
+)";
+
+    // FSR 1.0 style upscaling, the EASU pass renders to an intermediate at
+    // the size of the picture in the window, which RCAS then sharpens
+    const char *upscale_easu_frag_src = R"(
+uniform sampler2D tex;
+in  vec2 Texcoord;
+out vec4 out_Color;
+void main() {
+    ivec2 size = textureSize(tex, 0);
+    vec2 pp = Texcoord * vec2(size) - 0.5;
+    out_Color = vec4(upscale_easu(tex, pp, ivec4(0, 0, size - 1)), 1.0);
+}
+)";
+
+    const char *upscale_rcas_gamma_frag_src = R"(
+uniform sampler2D tex;
+uniform float sharpness;
+in  vec2 Texcoord;
+out vec4 out_Color;
+void main() {
+    ivec2 size = textureSize(tex, 0);
+    ivec2 p = ivec2(Texcoord * vec2(size));
+    vec3 col = upscale_rcas(tex, p, ivec4(0, 0, size - 1), sharpness);
+    out_Color = gamma(vec4(col, 1.0));
+}
 )";
 
     // Simple 2-color decal shader
@@ -276,15 +317,26 @@ void main() {
 }
 )";
 
-    const char *frag_src = NULL;
+    const std::string version_src = "#version 400 core\n";
+    std::string frag_src;
     switch (type) {
     case ShaderType::Mask: frag_src = mask_frag_src; break;
     // case ShaderType::Blit: frag_src = image_frag_src; break;
-    case ShaderType::BlitGamma: frag_src = image_gamma_frag_src; break;
+    case ShaderType::BlitGamma:
+        frag_src = version_src + gamma_src + image_gamma_frag_src;
+        break;
     case ShaderType::Logo: frag_src = xemu_logo_frag_src; break;
+    case ShaderType::UpscaleEasu:
+        frag_src = version_src + display_upscale_glsl_src +
+                   upscale_easu_frag_src;
+        break;
+    case ShaderType::UpscaleRcasGamma:
+        frag_src = version_src + gamma_src + display_upscale_glsl_src +
+                   upscale_rcas_gamma_frag_src;
+        break;
     default: assert(0);
     }
-    GLuint frag = Shader(GL_FRAGMENT_SHADER, frag_src);
+    GLuint frag = Shader(GL_FRAGMENT_SHADER, frag_src.c_str());
     assert(frag != 0);
 
     // Link vertex and fragment shaders
@@ -309,6 +361,7 @@ void main() {
     s->color_fill_loc = glGetUniformLocation(s->prog, "in_ColorFill");
     s->time_loc = glGetUniformLocation(s->prog, "iTime");
     s->scale_loc = glGetUniformLocation(s->prog, "scale");
+    s->sharpness_loc = glGetUniformLocation(s->prog, "sharpness");
     for (int i = 0; i < 256; i++) {
         char name[64];
         snprintf(name, sizeof(name), "palette[%d]", i);
@@ -457,6 +510,8 @@ void InitCustomRendering(void)
     g_icon_tex = LoadTextureFromMemory(xemu_64x64_data, xemu_64x64_size, false);
 
     g_framebuffer_shader = NewDecalShader(ShaderType::BlitGamma);
+    g_upscale_easu_shader = NewDecalShader(ShaderType::UpscaleEasu);
+    g_upscale_rcas_shader = NewDecalShader(ShaderType::UpscaleRcasGamma);
 }
 
 static void RenderMeter(DecalShader *s, float x, float y, float width,
@@ -884,13 +939,96 @@ void ScaleDimensions(int src_width, int src_height, int max_width, int max_heigh
     }
 }
 
+static void SetPaletteUniforms(DecalShader *s)
+{
+    const uint8_t *palette = nv2a_get_dac_palette();
+    for (int i = 0; i < 256; i++) {
+        uint32_t e = (palette[i * 3 + 2] << 16) | (palette[i * 3 + 1] << 8) |
+                     palette[i * 3];
+        glUniform1ui(s->palette_loc[i], e);
+    }
+}
+
+// Upscale <tex> to the size of the picture in the window, then sharpen it
+// into the window. Returns false if the picture would not be enlarged.
+static bool RenderFramebufferUpscaled(GLint tex, int width, int height,
+                                      bool flip, float scale[2])
+{
+    int tw, th;
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tw);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &th);
+
+    if (scale[0] > 1.0f || scale[1] > 1.0f) {
+        return false;
+    }
+
+    // Keep the picture on whole pixels so that RCAS maps texels 1:1
+    int w = width - 2 * (int)roundf(width * (1.0f - scale[0]) / 2.0f);
+    int h = height - 2 * (int)roundf(height * (1.0f - scale[1]) / 2.0f);
+    if (w <= 0 || h <= 0 || (w <= tw && h <= th)) {
+        return false;
+    }
+
+    if (!g_upscale_fbo || g_upscale_fbo->w != w || g_upscale_fbo->h != h) {
+        delete g_upscale_fbo;
+        g_upscale_fbo = new Fbo(w, h);
+    }
+
+    GLint original_fbo = GetCurrentFbo();
+    bool blend = glIsEnabled(GL_BLEND);
+    if (blend) glDisable(GL_BLEND);
+
+    DecalShader *s = g_upscale_easu_shader;
+    glBindFramebuffer(GL_FRAMEBUFFER, g_upscale_fbo->fbo);
+    glViewport(0, 0, w, h);
+    glUseProgram(s->prog);
+    glBindVertexArray(s->vao);
+    glUniform1i(s->flipy_loc, flip);
+    glUniform4f(s->scale_offset_loc, 1.0, 1.0, 0, 0);
+    glUniform4f(s->tex_scale_offset_loc, 1.0, 1.0, 0, 0);
+    glUniform1i(s->tex_loc, 0);
+    glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, NULL);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, original_fbo);
+    if (blend) glEnable(GL_BLEND);
+
+    s = g_upscale_rcas_shader;
+    glBindTexture(GL_TEXTURE_2D, g_upscale_fbo->Texture());
+    glViewport(0, 0, width, height);
+    glUseProgram(s->prog);
+    glBindVertexArray(s->vao);
+    glUniform1i(s->flipy_loc, 0);
+    glUniform4f(s->scale_offset_loc, (float)w / width, (float)h / height, 0,
+                0);
+    glUniform4f(s->tex_scale_offset_loc, 1.0, 1.0, 0, 0);
+    glUniform1i(s->tex_loc, 0);
+    glUniform1f(s->sharpness_loc, UPSCALE_SHARPNESS);
+    SetPaletteUniforms(s);
+
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, NULL);
+
+    return true;
+}
+
 void RenderFramebuffer(GLint tex, int width, int height, bool flip, float scale[2])
 {
+    if (g_config.display.filtering == CONFIG_DISPLAY_FILTERING_FSR &&
+        !nv2a_get_screen_off() &&
+        RenderFramebufferUpscaled(tex, width, height, flip, scale)) {
+        return;
+    }
+
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, tex);
     
     switch (g_config.display.filtering) {
     case CONFIG_DISPLAY_FILTERING_LINEAR:
+    case CONFIG_DISPLAY_FILTERING_FSR:
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     break;
@@ -909,13 +1047,7 @@ void RenderFramebuffer(GLint tex, int width, int height, bool flip, float scale[
     glUniform4f(s->scale_offset_loc, scale[0], scale[1], 0, 0);
     glUniform4f(s->tex_scale_offset_loc, 1.0, 1.0, 0, 0);
     glUniform1i(s->tex_loc, 0);
-
-    const uint8_t *palette = nv2a_get_dac_palette();
-    for (int i = 0; i < 256; i++) {
-        uint32_t e = (palette[i * 3 + 2] << 16) | (palette[i * 3 + 1] << 8) |
-                     palette[i * 3];
-        glUniform1ui(s->palette_loc[i], e);
-    }
+    SetPaletteUniforms(s);
 
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
@@ -975,7 +1107,28 @@ void RenderFramebuffer(GLint tex, int width, int height, bool flip)
     RenderFramebuffer(tex, width, height, flip, scale);
 }
 
-bool RenderFramebufferToPng(GLuint tex, bool flip, std::vector<uint8_t> &png, int max_width, int max_height)
+// Render the framebuffer scaled down to fit max_width x max_height and read
+// it back as RGB. With a buffer bound to GL_PIXEL_PACK_BUFFER, pixels is an
+// offset into it and the read does not stall.
+static void ReadFramebufferPixels(GLuint tex, bool flip, void *pixels,
+                                  int width, int height)
+{
+    Fbo fbo(width, height);
+    fbo.Target();
+    bool blend = glIsEnabled(GL_BLEND);
+    if (blend) glDisable(GL_BLEND);
+    float scale[2] = {1.0, 1.0};
+    RenderFramebuffer(tex, width, height, !flip, scale);
+    if (blend) glEnable(GL_BLEND);
+    glPixelStorei(GL_PACK_ROW_LENGTH, width);
+    glPixelStorei(GL_PACK_IMAGE_HEIGHT, height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    fbo.Restore();
+}
+
+static void GetFramebufferSize(GLuint tex, int max_width, int max_height,
+                               int *out_width, int *out_height)
 {
     int width, height;
 
@@ -988,27 +1141,33 @@ bool RenderFramebufferToPng(GLuint tex, bool flip, std::vector<uint8_t> &png, in
 
     if (!max_width) max_width = width;
     if (!max_height) max_height = height;
-    ScaleDimensions(width, height, max_width, max_height, &width, &height);
+    ScaleDimensions(width, height, max_width, max_height, out_width, out_height);
+}
+
+bool RenderFramebufferToPng(GLuint tex, bool flip, std::vector<uint8_t> &png, int max_width, int max_height)
+{
+    int width, height;
+    GetFramebufferSize(tex, max_width, max_height, &width, &height);
 
     std::vector<uint8_t> pixels;
     pixels.resize(width * height * 3);
-
-    Fbo fbo(width, height);
-    fbo.Target();
-    bool blend = glIsEnabled(GL_BLEND);
-    if (blend) glDisable(GL_BLEND);
-    float scale[2] = {1.0, 1.0};
-    RenderFramebuffer(tex, width, height, !flip, scale);
-    if (blend) glEnable(GL_BLEND);
-    glPixelStorei(GL_PACK_ROW_LENGTH, width);
-    glPixelStorei(GL_PACK_IMAGE_HEIGHT, height);
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
-    fbo.Restore();
+    ReadFramebufferPixels(tex, flip, pixels.data(), width, height);
 
     return fpng::fpng_encode_image_to_memory(pixels.data(), width, height, 3, png);
 }
 
+void RenderFramebufferToPbo(GLuint tex, bool flip, GLuint pbo, int max_width,
+                            int max_height, int *width, int *height)
+{
+    GetFramebufferSize(tex, max_width, max_height, width, height);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, *width * *height * 3, NULL,
+                 GL_STREAM_READ);
+    ReadFramebufferPixels(tex, flip, NULL, *width, *height);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
 void SaveScreenshot(GLuint tex, bool flip)
 {
     Error *err = NULL;
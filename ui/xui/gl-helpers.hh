@@ -52,5 +52,7 @@ void RenderXmu(float frame_x, float frame_y, uint32_t primary_color,
 void RenderFramebuffer(GLint tex, int width, int height, bool flip);
 void RenderFramebuffer(GLint tex, int width, int height, bool flip, float scale[2]);
 bool RenderFramebufferToPng(GLuint tex, bool flip, std::vector<uint8_t> &png, int max_width = 0, int max_height = 0);
+void RenderFramebufferToPbo(GLuint tex, bool flip, GLuint pbo, int max_width,
+                            int max_height, int *width, int *height);
 void SaveScreenshot(GLuint tex, bool flip);
 void ScaleDimensions(int src_width, int src_height, int max_width, int max_height, int *out_width, int *out_height);
@@ -11,6 +11,20 @@ InputManager::InputManager()
     m_navigating_with_controller = false;
 }
 
+// Whether controller buttons changed since the last Update, for polling the
+// controllers while the HUD is idle
+bool InputManager::ButtonsChanged()
+{
+    uint32_t buttons = 0;
+    ControllerState *iter;
+    QTAILQ_FOREACH (iter, &available_controllers, entry) {
+        if (iter->type == INPUT_DEVICE_SDL_GAMECONTROLLER) {
+            buttons |= iter->buttons;
+        }
+    }
+    return buttons != m_buttons;
+}
+
 void InputManager::Update()
 {
     ImGuiIO& io = ImGui::GetIO();
@@ -15,6 +15,7 @@ public:
 	inline bool IsNavigatingWithController() { return m_navigating_with_controller; }
 	inline bool MouseMoved() { return m_mouse_moved; }
 	inline uint32_t CombinedButtons() { return m_buttons; }
+	bool ButtonsChanged();
 };
 
 extern InputManager g_input_mgr;
@@ -34,6 +34,7 @@
 #include "../xemu-input.h"
 #include "../xemu-notifications.h"
 #include "../xemu-settings.h"
+#include "../xemu-title-profile.h"
 #include "../xemu-monitor.h"
 #include "../xemu-version.h"
 #include "../xemu-net.h"
@@ -51,6 +52,141 @@ void MainMenuTabView::Draw()
 {
 }
 
+static const int cpu_clock_percents[] = { 100, 125, 150, 175, 200 };
+#define CPU_CLOCK_ITEMS \
+    "733 MHz\0" "917 MHz\0" "1100 MHz\0" "1283 MHz\0" "1467 MHz\0"
+
+/*
+ * Choose a guest CPU clock from the steps above. With allow_default, the
+ * first item stands for a percentage of 0, i.e. the global setting.
+ */
+static bool CpuClockCombo(const char *label, int *percent, bool allow_default,
+                          const char *description)
+{
+    int offset = allow_default ? 1 : 0;
+    int index = 0;
+    if (!allow_default || *percent > 0) {
+        for (int i = 0; i < (int)std::size(cpu_clock_percents); i++) {
+            if (*percent >= cpu_clock_percents[i]) {
+                index = i + offset;
+            }
+        }
+    }
+
+    bool changed = ChevronCombo(label, &index,
+                                allow_default ? "Default\0" CPU_CLOCK_ITEMS :
+                                                CPU_CLOCK_ITEMS,
+                                description);
+    if (changed) {
+        *percent = index < offset ? 0 : cpu_clock_percents[index - offset];
+    }
+    return changed;
+}
+
+static void SaveTitleProfile(uint32_t title_id)
+{
+    int index = xemu_title_profile_find(title_id);
+    if (index < 0) {
+        char id[9];
+        snprintf(id, sizeof(id), "%08x", title_id);
+        index = add_perf_title_profile(id);
+    }
+
+    struct title_profile *p = &g_config.perf.title_profiles[index];
+    p->renderer = (CONFIG_PERF_TITLE_PROFILES_RENDERER)(
+        CONFIG_PERF_TITLE_PROFILES_RENDERER_NULL + g_config.display.renderer);
+    p->surface_scale = nv2a_get_surface_scale_factor();
+    p->hard_fpu = g_config.perf.hard_fpu ?
+                      CONFIG_PERF_TITLE_PROFILES_HARD_FPU_ON :
+                      CONFIG_PERF_TITLE_PROFILES_HARD_FPU_OFF;
+    p->use_dsp = g_config.audio.use_dsp ? CONFIG_PERF_TITLE_PROFILES_USE_DSP_ON :
+                                          CONFIG_PERF_TITLE_PROFILES_USE_DSP_OFF;
+    p->vp_workers = g_config.audio.vp.num_workers;
+    p->cpu_clock_percent = g_config.perf.cpu_clock_percent;
+}
+
+static void DrawTitleProfile()
+{
+    SectionTitle("Title Profile");
+
+    uint32_t title_id = xemu_title_profile_get_title_id();
+    if (!title_id) {
+        ImGui::TextWrapped("Start a game to save settings for it.");
+        return;
+    }
+
+    int index = xemu_title_profile_find(title_id);
+    if (index < 0) {
+        ImGui::Text("No profile for title %08X", title_id);
+        if (ImGui::Button("Save current settings for this title")) {
+            SaveTitleProfile(title_id);
+            xemu_title_profile_changed();
+        }
+        return;
+    }
+
+    ImGui::Text("Profile for title %08X", title_id);
+    struct title_profile *p = &g_config.perf.title_profiles[index];
+    bool changed = false;
+
+    changed |= ChevronCombo("Renderer", &p->renderer,
+                            "Default\0"
+                            "Null\0"
+                            "OpenGL\0"
+#ifdef CONFIG_VULKAN
+                            "Vulkan\0"
+#endif
+                            ,
+                            "Renderer used when booting this title "
+                            "(requires restart)");
+    changed |= ChevronCombo("Internal resolution scale", &p->surface_scale,
+                            "Default\0"
+                            "1x\0"
+                            "2x\0"
+                            "3x\0"
+                            "4x\0"
+                            "5x\0"
+                            "6x\0"
+                            "7x\0"
+                            "8x\0"
+                            "9x\0"
+                            "10x\0",
+                            "Surface scaling factor while this title runs");
+    changed |= ChevronCombo("Hard FPU emulation", &p->hard_fpu,
+                            "Default\0"
+                            "On\0"
+                            "Off\0",
+                            "Floating point emulation used when booting this "
+                            "title (requires restart)");
+    changed |= ChevronCombo("Real-time DSP processing", &p->use_dsp,
+                            "Default\0"
+                            "On\0"
+                            "Off\0",
+                            "Audio DSP processing while this title runs");
+    changed |= CpuClockCombo("CPU clock", &p->cpu_clock_percent, true,
+                             "Guest CPU clock while this title runs");
+    changed |= ChevronCombo("Surface readback", &p->surface_readback,
+                            "Learned\0"
+                            "Always\0"
+                            "Never\0",
+                            "Whether to read back GPU surfaces the title may "
+                            "not use (Vulkan, requires restart)");
+
+    if (ImGui::Button("Update from current settings")) {
+        SaveTitleProfile(title_id);
+        changed = true;
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Remove profile")) {
+        remove_perf_title_profile(index);
+        changed = true;
+    }
+
+    if (changed) {
+        xemu_title_profile_changed();
+    }
+}
+
 void MainMenuGeneralView::Draw()
 {
 #if defined(_WIN32)
@@ -59,18 +195,35 @@ void MainMenuGeneralView::Draw()
            "Check for updates whenever xemu is opened");
 #endif
 
-#if defined(__x86_64__)
+#if defined(__x86_64__) || defined(__aarch64__)
     SectionTitle("Performance");
     Toggle("Hard FPU emulation", &g_config.perf.hard_fpu,
            "Use hardware-accelerated floating point emulation (requires restart)");
 #endif
 
+    Toggle("Cache translated code", &g_config.perf.tb_cache,
+           "Retranslate code seen in earlier sessions while the CPU is idle "
+           "(requires restart)");
+
+    Toggle("Sleep in guest idle loops", &g_config.perf.park_idle_loops,
+           "Let the CPU thread sleep while games busy-wait for an interrupt, "
+           "saving power (requires restart)");
+
+    CpuClockCombo("CPU clock", &g_config.perf.cpu_clock_percent, false,
+                  "Clock of the emulated CPU as seen by games. Faster clocks "
+                  "help titles that are CPU-bound on a real Xbox if the host "
+                  "keeps up, but titles timed by the CPU clock run fast");
+
     Toggle("Cache shaders to disk", &g_config.perf.cache_shaders,
            "Reduce stutter in games by caching previously generated shaders");
 
+    DrawTitleProfile();
+
     SectionTitle("Miscellaneous");
     Toggle("Skip startup animation", &g_config.general.skip_boot_anim,
            "Skip the full Xbox boot animation sequence");
+    Toggle("Fast boot", &g_config.general.fast_boot,
+           "Start discs from a state cached after the kernel has initialized");
     FilePicker("Screenshot output directory", &g_config.general.screenshot_dir,
                NULL, true);
     FilePicker("Games directory", &g_config.general.games_dir, NULL, true);
@@ -570,6 +723,14 @@ void MainMenuInputView::Draw()
     Toggle("Background controller input capture",
            &g_config.input.background_input_capture,
            "Capture even if window is unfocused (requires restart)");
+    ChevronCombo("Input rollback", &g_config.input.runahead_frames,
+                 "Off\0"
+                 "1 frame\0"
+                 "2 frames\0"
+                 "3 frames\0"
+                 "4 frames\0",
+                 "Roll the game back on button presses so they land earlier "
+                 "(experimental)");
 }
 
 void MainMenuInputView::Hide()
@@ -735,6 +896,64 @@ void MainMenuInputView::PopulateTableController(ControllerState *state)
     }
 }
 
+static void DrawTextureQuality()
+{
+    static const int anisotropy_levels[] = { 0, 1, 2, 4, 8, 16 };
+    static const float lod_biases[] = { -1.0f, -0.5f, 0.0f, 0.5f, 1.0f, 2.0f };
+
+    int anisotropy = 0;
+    for (int i = 0; i < (int)G_N_ELEMENTS(anisotropy_levels); i++) {
+        if (anisotropy_levels[i] == g_config.display.quality.anisotropy) {
+            anisotropy = i;
+        }
+    }
+    if (ChevronCombo("Anisotropic filtering", &anisotropy,
+                     "Game default\0"
+                     "Off\0"
+                     "2x\0"
+                     "4x\0"
+                     "8x\0"
+                     "16x\0",
+                     "Override the anisotropic filtering level games ask "
+                     "for")) {
+        g_config.display.quality.anisotropy = anisotropy_levels[anisotropy];
+    }
+
+    int lod_bias = 2;
+    for (int i = 0; i < (int)G_N_ELEMENTS(lod_biases); i++) {
+        if (lod_biases[i] == g_config.display.quality.lod_bias) {
+            lod_bias = i;
+        }
+    }
+    if (ChevronCombo("Mipmap LOD bias", &lod_bias,
+                     "-1.0\0"
+                     "-0.5\0"
+                     "0\0"
+                     "+0.5\0"
+                     "+1.0\0"
+                     "+2.0\0",
+                     "Added to the bias games set, higher values pick "
+                     "smaller mipmaps and save bandwidth")) {
+        g_config.display.quality.lod_bias = lod_biases[lod_bias];
+    }
+
+    Toggle("Render target mipmaps", &g_config.display.quality.surface_mipmaps,
+           "Generate the mipmaps of rendered textures on the GPU instead of "
+           "reading them from guest memory");
+
+#ifdef CONFIG_VULKAN
+    int mip_skip = MIN(MAX(g_config.display.quality.texture_mip_skip, 0), 2);
+    if (ChevronCombo("Skip top mipmaps", &mip_skip,
+                     "Off\0"
+                     "1 level\0"
+                     "2 levels\0",
+                     "Never upload the largest mipmap levels of textures, "
+                     "to save memory on low-end devices (Vulkan)")) {
+        g_config.display.quality.texture_mip_skip = mip_skip;
+    }
+#endif
+}
+
 void MainMenuDisplayView::Draw()
 {
     SectionTitle("Renderer");
@@ -761,6 +980,70 @@ void MainMenuDisplayView::Draw()
                      "Increase surface scaling factor for higher quality")) {
         nv2a_set_surface_scale_factor(rendering_scale+1);
     }
+    Toggle("Parallel shader compile",
+           &g_config.display.opengl.parallel_shader_compile,
+           "Link OpenGL shaders in the background, skipping draws until "
+           "they are ready (requires restart)");
+#ifdef CONFIG_VULKAN
+    ChevronCombo("Async pipelines",
+                 &g_config.display.vulkan.async_pipeline_compile,
+                 "Off\0"
+                 "Skip draws\0"
+                 "Fallback\0",
+                 "Compile Vulkan pipelines in the background to avoid stutter");
+    Toggle("Ubershaders", &g_config.display.vulkan.ubershaders,
+           "Draw with a generic pixel shader while the specialized one "
+           "compiles in the background");
+    ChevronCombo("Geometry shaders",
+                 &g_config.display.vulkan.geometry_shaders,
+                 "Auto\0"
+                 "On\0"
+                 "Off\0",
+                 "Use geometry shaders, or read primitive vertices in the "
+                 "fragment shader instead (requires restart)");
+    Toggle("Dynamic resolution",
+           &g_config.display.quality.dynamic_scale.enabled,
+           "Lower the resolution scale when frames take too long to render");
+    Toggle("Frame skip", &g_config.display.frame_skip.enabled,
+           "Skip drawing some frames to the screen when frames take too "
+           "long, while emulating them in full");
+    Toggle("Map guest RAM for vertices",
+           &g_config.display.vulkan.host_mapped_vertex_ram,
+           "Read vertex data directly from guest memory instead of copying "
+           "it (requires restart)");
+    Toggle("Threaded submission", &g_config.display.vulkan.threaded_submit,
+           "Submit recorded Vulkan work from a separate thread "
+           "(requires restart)");
+    Toggle("Parallel recording", &g_config.display.vulkan.parallel_recording,
+           "Record render passes into secondary command buffers on worker "
+           "threads (requires restart)");
+    Toggle("Transfer queue", &g_config.display.vulkan.transfer_queue,
+           "Upload new textures on a dedicated copy queue when the device "
+           "has one (requires restart)");
+    Toggle("Tiler render passes",
+           &g_config.display.vulkan.tiler_render_passes,
+           "Turn full clears into render pass load ops, skip storing "
+           "depth that is always cleared and keep surfaces that are only "
+           "drawn to in lazily allocated memory, for tile-based GPUs "
+           "(requires restart)");
+    Toggle("Bindless textures",
+           &g_config.display.vulkan.bindless_textures,
+           "Keep every cached texture in one descriptor array and select "
+           "them per draw, instead of writing descriptors on each texture "
+           "change (requires restart)");
+    Toggle("Dynamic rendering",
+           &g_config.display.vulkan.dynamic_rendering,
+           "Begin rendering on surface views directly, without render pass "
+           "and framebuffer objects (requires restart)");
+#endif
+#ifdef CONFIG_IMGUI_VULKAN
+    Toggle("Native presentation", &g_config.display.vulkan.native_present,
+           "Present directly from the Vulkan renderer, skipping the copy to "
+           "OpenGL (requires restart)");
+#endif
+
+    SectionTitle("Textures");
+    DrawTextureQuality();
 
     SectionTitle("Window");
     bool fs = xemu_is_fullscreen();
@@ -789,6 +1072,16 @@ void MainMenuDisplayView::Draw()
     }
     Toggle("Vertical refresh sync", &g_config.display.window.vsync,
            "Sync to screen vertical refresh to reduce tearing artifacts");
+    ChevronCombo("Present mode", &g_config.display.window.present_mode,
+                 "FIFO\0"
+                 "Mailbox\0"
+                 "Immediate\0",
+                 "Select how frames are queued for display when synced");
+    Toggle("Low latency", &g_config.display.window.low_latency,
+           "Present frames as close to the screen refresh as possible");
+    Toggle("Queue frames", &g_config.display.frame_queue.enabled,
+           "Let the game run ahead of the screen by a few frames, so it is "
+           "not held up by slow presents");
 
     SectionTitle("Interface");
     Toggle("Show main menu bar", &g_config.display.ui.show_menubar,
@@ -844,6 +1137,16 @@ void MainMenuAudioView::Draw()
     SectionTitle("Quality");
     Toggle("Real-time DSP processing", &g_config.audio.use_dsp,
            "Enable improved audio accuracy (experimental)");
+    Toggle("Parallel EP processing", &g_config.audio.ep_thread,
+           "Run the encode processor DSP on its own thread (experimental)");
+    ChevronCombo("Voice resampler", &g_config.audio.vp.resampler,
+                 "Polyphase (Default)\0"
+                 "Sinc (High quality)\0",
+                 "Select the interpolation used for voice pitch");
+
+    SectionTitle("Speed");
+    Toggle("Turbo", &g_config.audio.turbo.enable,
+           "Run audio unthrottled, dropping output the device can't play");
 
 }
 
@@ -947,7 +1250,8 @@ void MainMenuNetworkView::Draw()
             "Attached to", &g_config.net.backend,
             "NAT\0"
             "UDP Tunnel\0"
-            "Bridged Adapter\0",
+            "Bridged Adapter\0"
+            "System Link Relay\0",
             "Controls what the virtual network controller interfaces with")) {
         appearing = true;
     }
@@ -962,9 +1266,16 @@ void MainMenuNetworkView::Draw()
     case CONFIG_NET_BACKEND_UDP:
         DrawUdpOptions(appearing);
         break;
+    case CONFIG_NET_BACKEND_RELAY:
+        DrawRelayOptions(appearing);
+        break;
     default: break;
     }
     if (enabled) ImGui::EndDisabled();
+
+    if (enabled && g_config.net.backend == CONFIG_NET_BACKEND_RELAY) {
+        DrawRelayStats();
+    }
 }
 
 void MainMenuNetworkView::DrawPcapOptions(bool appearing)
@@ -1130,6 +1441,89 @@ void MainMenuNetworkView::DrawUdpOptions(bool appearing)
     ImGui::PopFont();
 }
 
+void MainMenuNetworkView::DrawRelayOptions(bool appearing)
+{
+    if (appearing) {
+        strncpy(local_addr, g_config.net.relay.bind_addr,
+                sizeof(local_addr) - 1);
+        strncpy(relay_peers, g_config.net.relay.peers,
+                sizeof(relay_peers) - 1);
+    }
+
+    float size_ratio = 0.5;
+    float width = ImGui::GetColumnWidth() * size_ratio;
+    ImGui::PushFont(g_font_mgr.m_menu_font_small);
+    PrepareComboTitleDescription(
+        "Peers",
+        "Space separated addr:port list of other consoles (1.2.3.4:9368)",
+        size_ratio);
+    ImGui::SetNextItemWidth(width);
+    if (ImGui::InputText("###relay_peers", relay_peers,
+                         sizeof(relay_peers))) {
+        xemu_settings_set_string(&g_config.net.relay.peers, relay_peers);
+    }
+    PrepareComboTitleDescription(
+        "Bind Address", "Local addr:port to receive packets on (0.0.0.0:9368)",
+        size_ratio);
+    ImGui::SetNextItemWidth(width);
+    if (ImGui::InputText("###relay_local_host", local_addr,
+                         sizeof(local_addr))) {
+        xemu_settings_set_string(&g_config.net.relay.bind_addr, local_addr);
+    }
+    ImGui::PopFont();
+
+    Toggle("Act as hub", &g_config.net.relay.hub,
+           "Forward packets between peers and let other consoles join by "
+           "listing this one as their only peer");
+}
+
+void MainMenuNetworkView::DrawRelayStats()
+{
+    static ImGuiTableFlags flags =
+        ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg;
+    NetRelayPeerStats stats[NET_RELAY_MAX_PEERS];
+    int count = xemu_net_get_relay_stats(stats, NET_RELAY_MAX_PEERS);
+    if (count < 0) {
+        return;
+    }
+
+    SectionTitle("Peers");
+    float p = ImGui::GetFrameHeight() * 0.3;
+    ImGui::PushStyleVar(ImGuiStyleVar_CellPadding, ImVec2(p, p));
+    if (ImGui::BeginTable("relay_peers_tbl", 4, flags)) {
+        ImGui::TableSetupColumn("Address");
+        ImGui::TableSetupColumn("RTT");
+        ImGui::TableSetupColumn("Loss");
+        ImGui::TableSetupColumn("Frames Out / In");
+        ImGui::TableHeadersRow();
+
+        for (int row = 0; row < count; row++) {
+            ImGui::TableNextRow();
+
+            ImGui::TableSetColumnIndex(0);
+            ImGui::Text("%s%s", stats[row].addr,
+                        stats[row].learned ? " (joined)" : "");
+
+            ImGui::TableSetColumnIndex(1);
+            if (stats[row].rtt_us < 0) {
+                ImGui::TextUnformatted("-");
+            } else {
+                ImGui::Text("%.2f ms", stats[row].rtt_us / 1000.0);
+            }
+
+            ImGui::TableSetColumnIndex(2);
+            ImGui::Text("%.1f%%", stats[row].loss * 100.0f);
+
+            ImGui::TableSetColumnIndex(3);
+            ImGui::Text("%" PRIu64 " / %" PRIu64, stats[row].tx_frames,
+                        stats[row].rx_frames);
+        }
+
+        ImGui::EndTable();
+    }
+    ImGui::PopStyleVar();
+}
+
 MainMenuSnapshotsView::MainMenuSnapshotsView() : MainMenuTabView()
 {
     xemu_snapshots_mark_dirty();
@@ -1294,6 +1688,9 @@ void MainMenuSnapshotsView::Draw()
            &g_config.general.snapshots.filter_current_game,
            "Only display snapshots created while running the currently running "
            "XBE");
+    Toggle("Save to separate files", &g_config.general.snapshots.external,
+           "Keep new snapshots in files next to the HDD image instead of "
+           "inside it");
 
     if (g_config.general.snapshots.filter_current_game) {
         struct xbe *xbe = xemu_get_xbe_info();
@@ -1540,6 +1937,26 @@ void MainMenuSystemView::Draw()
         m_dirty = true;
     }
 
+    if (ChevronCombo(
+            "HDD cache partitions", &g_config.perf.hdd_cache_overlay,
+            "On disk (Default)\0In RAM\0In RAM, saved on exit\0",
+            "Keep game writes to the X, Y and Z cache partitions in memory "
+            "instead of the hard disk image")) {
+        m_dirty = true;
+    }
+
+    if (Toggle("Trim free HDD space", &g_config.perf.hdd_trim,
+               "Release the space of deleted files from the hard disk image "
+               "at startup")) {
+        m_dirty = true;
+    }
+
+    if (Toggle("Manage emulator threads", &g_config.perf.thread_topology,
+               "Keep the CPU and GPU threads on the fastest cores and run "
+               "audio ahead of background work")) {
+        m_dirty = true;
+    }
+
     SectionTitle("Files");
     if (FilePicker("MCPX Boot ROM", &g_config.sys.files.bootrom_path,
                    rom_file_filters)) {
@@ -104,6 +104,7 @@ class MainMenuNetworkView : public virtual MainMenuTabView
 protected:
     char remote_addr[64];
     char local_addr[64];
+    char relay_peers[512];
     bool should_refresh;
     std::unique_ptr<NetworkInterfaceManager> iface_mgr;
 
@@ -113,6 +114,8 @@ public:
     void DrawPcapOptions(bool appearing);
     void DrawNatOptions(bool appearing);
     void DrawUdpOptions(bool appearing);
+    void DrawRelayOptions(bool appearing);
+    void DrawRelayStats();
 };
 
 class MainMenuSnapshotsView : public virtual MainMenuTabView
@@ -34,10 +34,14 @@
 #include "actions.hh"
 #include "common.hh"
 #include "xemu-hud.h"
+#include "ui/xemu-fast-boot.h"
+#include "ui/xemu-frame-pacing.h"
+#include "ui/xemu-title-profile.h"
 #include "misc.hh"
 #include "gl-helpers.hh"
 #include "input-manager.hh"
 #include "snapshot-manager.hh"
+#include "game-library.hh"
 #include "viewport-manager.hh"
 #include "font-manager.hh"
 #include "scene.hh"
@@ -50,6 +54,9 @@
 #include "welcome.hh"
 #include "menubar.hh"
 #include "compat.hh"
+#ifdef CONFIG_IMGUI_VULKAN
+#include "vulkan-hud.hh"
+#endif
 #if defined(_WIN32)
 #include "update.hh"
 #endif
@@ -62,10 +69,17 @@ float g_main_menu_height;
 static ImGuiStyle g_base_style;
 static SDL_Window *g_sdl_window;
 static float g_last_scale;
-static int g_vsync;
 static GLuint g_tex;
 static bool g_flip_req;
 
+// The HUD goes idle once it has drawn nothing for a while, so frames where
+// every window is closed and nothing is fading or animating skip ImGui
+// entirely. Input, notifications and anything on screen wake it up again.
+// The timeout covers the menubar fade and cursor auto-hide.
+static const uint32_t kHudIdleTimeout = 7000;
+static uint32_t g_hud_last_activity;
+static bool g_hud_idle;
+
 
 static void InitializeStyle()
 {
@@ -129,10 +143,19 @@ static void InitializeStyle()
     g_base_style = s;
 }
 
-void xemu_hud_init(SDL_Window* window, void* sdl_gl_context)
+static bool UseVulkanHud()
+{
+#ifdef CONFIG_IMGUI_VULKAN
+    return g_vulkan_hud;
+#else
+    return false;
+#endif
+}
+
+void xemu_hud_init(SDL_Window* window, void* sdl_gl_context,
+                   bool native_present)
 {
     xemu_monitor_init();
-    g_vsync = g_config.display.window.vsync;
 
     InitCustomRendering();
 
@@ -144,9 +167,18 @@ void xemu_hud_init(SDL_Window* window, void* sdl_gl_context)
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
     io.IniFilename = NULL;
 
-    // Setup Platform/Renderer bindings
-    ImGui_ImplSDL2_InitForOpenGL(window, sdl_gl_context);
-    ImGui_ImplOpenGL3_Init("#version 150");
+    // Setup Platform/Renderer bindings. With native presentation, the
+    // renderer backend is set up by the Vulkan renderer when it first
+    // presents.
+#ifdef CONFIG_IMGUI_VULKAN
+    g_vulkan_hud = native_present;
+#endif
+    if (UseVulkanHud()) {
+        ImGui_ImplSDL2_InitForVulkan(window);
+    } else {
+        ImGui_ImplSDL2_InitForOpenGL(window, sdl_gl_context);
+        ImGui_ImplOpenGL3_Init("#version 150");
+    }
     g_sdl_window = window;
     ImPlot::CreateContext();
 
@@ -159,11 +191,15 @@ void xemu_hud_init(SDL_Window* window, void* sdl_gl_context)
     InitializeStyle();
     g_main_menu.SetNextViewIndex(g_config.general.last_viewed_menu_index);
     first_boot_window.is_open = g_config.general.show_welcome;
+    g_game_library.Start();
 }
 
 void xemu_hud_cleanup(void)
 {
-    ImGui_ImplOpenGL3_Shutdown();
+    g_game_library.Stop();
+    if (!UseVulkanHud()) {
+        ImGui_ImplOpenGL3_Shutdown();
+    }
     ImGui_ImplSDL2_Shutdown();
     ImGui::DestroyContext();
 }
@@ -176,6 +212,8 @@ void xemu_hud_process_sdl_events(SDL_Event *event)
     }
 
     ImGui_ImplSDL2_ProcessEvent(event);
+    g_hud_idle = false;
+    g_hud_last_activity = SDL_GetTicks();
 }
 
 void xemu_hud_should_capture_kbd_mouse(int *kbd, int *mouse)
@@ -198,6 +236,8 @@ void xemu_hud_render(void)
 
     g_viewport_mgr.Update();
     g_font_mgr.Update();
+    xemu_title_profile_update();
+    xemu_fast_boot_update();
     if (g_last_scale != g_viewport_mgr.m_scale) {
         ImGuiStyle &style = ImGui::GetStyle();
         style = g_base_style;
@@ -205,13 +245,27 @@ void xemu_hud_render(void)
         g_last_scale = g_viewport_mgr.m_scale;
     }
 
-    if (!first_boot_window.is_open) {
+    if (!first_boot_window.is_open && !UseVulkanHud()) {
         int ww, wh;
         SDL_GL_GetDrawableSize(g_sdl_window, &ww, &wh);
         RenderFramebuffer(g_tex, ww, wh, g_flip_req);
     }
 
-    ImGui_ImplOpenGL3_NewFrame();
+    if (g_hud_idle && (notification_manager.HasPending() ||
+                       g_input_mgr.ButtonsChanged())) {
+        g_hud_idle = false;
+        g_hud_last_activity = now;
+    }
+
+    // Nothing to draw, the last frame's (empty) draw data stays current
+    if (g_hud_idle) {
+        xemu_frame_pacing_update_swap_interval();
+        return;
+    }
+
+    if (!UseVulkanHud()) {
+        ImGui_ImplOpenGL3_NewFrame();
+    }
     io.ConfigFlags &= ~ImGuiConfigFlags_NavEnableGamepad;
     ImGui_ImplSDL2_NewFrame();
     io.ConfigFlags |= ImGuiConfigFlags_NavEnableGamepad;
@@ -306,12 +360,17 @@ void xemu_hud_render(void)
                 break;
             }
         }
+        if (ImGui::IsKeyPressed(ImGuiKey_F9)) {
+            ActionQuicksave(mod_key_down);
+        }
     }
 
     first_boot_window.Draw();
     monitor_window.Draw();
     apu_window.Draw();
     video_window.Draw();
+    cpu_window.Draw();
+    memory_window.Draw();
     compatibility_reporter_window.Draw();
 #if defined(_WIN32)
     update_window.Draw();
@@ -324,15 +383,37 @@ void xemu_hud_render(void)
     // if (show_demo) ImGui::ShowDemoWindow(&show_demo);
 
     ImGui::Render();
-    ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+    ImDrawData *draw_data = ImGui::GetDrawData();
+    if (!UseVulkanHud()) {
+        ImGui_ImplOpenGL3_RenderDrawData(draw_data);
+    }
 
-    if (g_vsync != g_config.display.window.vsync) {
-        g_vsync = g_config.display.window.vsync;
-        SDL_GL_SetSwapInterval(g_vsync ? 1 : 0);
+    if (draw_data->TotalVtxCount > 0 || first_boot_window.is_open ||
+        g_scene_mgr.IsDisplayingScene() || g_screenshot_pending) {
+        g_hud_last_activity = now;
+    } else if (now - g_hud_last_activity > kHudIdleTimeout) {
+        g_hud_idle = true;
     }
 
+    xemu_frame_pacing_update_swap_interval();
+
     if (g_screenshot_pending) {
-        SaveScreenshot(g_tex, g_flip_req);
+        if (UseVulkanHud()) {
+            xemu_queue_notification(
+                "Screenshots are unavailable with native presentation");
+        } else {
+            SaveScreenshot(g_tex, g_flip_req);
+        }
         g_screenshot_pending = false;
     }
 }
+
+bool xemu_hud_present(void)
+{
+#ifdef CONFIG_IMGUI_VULKAN
+    if (UseVulkanHud()) {
+        return VulkanHudPresent(g_sdl_window, !first_boot_window.is_open);
+    }
+#endif
+    return false;
+}
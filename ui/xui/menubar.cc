@@ -17,6 +17,7 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include "ui/xemu-notifications.h"
+#include "ui/xemu-trace.h"
 #include "common.hh"
 #include "main-menu.hh"
 #include "menubar.hh"
@@ -101,6 +102,17 @@ void ShowMainMenu()
                     xemu_queue_notification("Created new snapshot");
                 }
 
+                ImGui::Separator();
+
+                if (ImGui::MenuItem("Quickload", "F9", false,
+                                    xemu_snapshots_quicksave_exists())) {
+                    ActionQuicksave(false);
+                }
+
+                if (ImGui::MenuItem("Quicksave", "Shift+F9")) {
+                    ActionQuicksave(true);
+                }
+
                 for (int i = 0; i < 4; ++i) {
                     char *hotkey = g_strdup_printf("Shift+F%d", i + 5);
 
@@ -204,7 +216,11 @@ void ShowMainMenu()
             HelpMarker("Controls how the rendered content should be scaled "
                        "into the window");
             ImGui::Combo("Filter Method", &g_config.display.filtering,
-                         "Linear\0Nearest\0");
+                         "Linear\0Nearest\0FSR 1.0\0");
+            ImGui::SameLine();
+            HelpMarker("FSR 1.0 upscales the frame to the window with edge "
+                       "adaptive filtering and sharpening, a cheaper way to "
+                       "a sharp picture than a higher render resolution");
             ImGui::Combo("Aspect Ratio", &g_config.display.ui.aspect_ratio,
                          "Native\0Auto\0""4:3\0""16:9\0");
             if (ImGui::MenuItem("Fullscreen", "F11",
@@ -220,6 +236,19 @@ void ShowMainMenu()
             ImGui::MenuItem("Monitor", "~", &monitor_window.is_open);
             ImGui::MenuItem("Audio", NULL, &apu_window.m_is_open);
             ImGui::MenuItem("Video", NULL, &video_window.m_is_open);
+            ImGui::MenuItem("CPU", NULL, &cpu_window.m_is_open);
+            ImGui::MenuItem("Memory", NULL, &memory_window.m_is_open);
+            if (ImGui::MenuItem("Capture Pushbuffer (10 Frames)")) {
+                nv2a_capture_frames(10);
+            }
+            if (ImGui::MenuItem(g_xemu_trace_active ? "Stop Thread Trace" :
+                                                      "Start Thread Trace")) {
+                if (g_xemu_trace_active) {
+                    xemu_trace_stop();
+                } else {
+                    xemu_trace_start();
+                }
+            }
 #ifdef CONFIG_RENDERDOC
             if (nv2a_dbg_renderdoc_available()) {
                 ImGui::MenuItem("RenderDoc: Capture", NULL, &g_capture_renderdoc_frame);
@@ -38,6 +38,12 @@ void NotificationManager::QueueError(const char *msg)
     m_error_queue.push_back(strdup(msg));
 }
 
+bool NotificationManager::HasPending()
+{
+    return m_active || !m_notification_queue.empty() ||
+           !m_error_queue.empty();
+}
+
 void NotificationManager::Draw()
 {
     uint32_t now = SDL_GetTicks();
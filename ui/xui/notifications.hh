@@ -37,6 +37,7 @@ public:
     NotificationManager();
     void QueueNotification(const char *msg);
     void QueueError(const char *msg);
+    bool HasPending();
     void Draw();
 
 private:
@@ -19,7 +19,6 @@
 #include "ui/xemu-notifications.h"
 #include <string>
 #include <vector>
-#include <filesystem>
 #include <map>
 #include "misc.hh"
 #include "actions.hh"
@@ -28,6 +27,7 @@
 #include "scene-manager.hh"
 #include "popup-menu.hh"
 #include "input-manager.hh"
+#include "game-library.hh"
 #include "xemu-hud.h"
 #include "IconsFontAwesome6.h"
 #include "../xemu-snapshots.h"
@@ -342,12 +342,15 @@ public:
 
 class GamesPopupMenu : public virtual PopupMenu {
 protected:
+    std::vector<GameLibraryEntry> games;
+    uint64_t games_generation = 0;
     std::multimap<std::string, std::string> sorted_file_names;
 
 public:
     void Show(const ImVec2 &direction) override
     {
         PopupMenu::Show(direction);
+        g_game_library.Refresh();
         PopulateGameList();
     }
 
@@ -355,16 +358,21 @@ public:
     {
         bool pop = false;
 
+        // Pick up titles as the library indexer reads them
+        PopulateGameList();
+
         if (m_focus && !m_pop_focus) {
             ImGui::SetKeyboardFocusHere();
         }
 
         for (const auto &[label, file_path] : sorted_file_names) {
+            ImGui::PushID(file_path.c_str());
             if (PopupMenuButton(label, ICON_FA_COMPACT_DISC)) {
                 ActionLoadDiscFile(file_path.c_str());
                 nav.ClearMenuStack();
                 pop = true;
             }
+            ImGui::PopID();
         }
 
         if (sorted_file_names.size() == 0) {
@@ -381,21 +389,13 @@ public:
     }
 
     void PopulateGameList() {
-        const char *games_dir = g_config.general.games_dir;
+        if (!g_game_library.GetEntries(games, games_generation)) {
+            return;
+        }
 
         sorted_file_names.clear();
-        std::filesystem::path directory(games_dir);
-        if (std::filesystem::is_directory(directory)) {
-            for (const auto &file :
-                 std::filesystem::directory_iterator(directory)) {
-                const auto &file_path = file.path();
-                if (std::filesystem::is_regular_file(file_path) &&
-                    (file_path.extension() == ".iso" ||
-                     file_path.extension() == ".xiso")) {
-                    sorted_file_names.insert(
-                        { file_path.stem().string(), file_path.string() });
-                }
-            }
+        for (const auto &game : games) {
+            sorted_file_names.insert({ game.title, game.path });
         }
     }
 };
@@ -0,0 +1,133 @@
+//
+// xemu User Interface
+//
+// Copyright (C) 2026 Matt Borgerson
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "common.hh"
+#include "vulkan-hud.hh"
+#include "hw/xbox/nv2a/nv2a_vk_present.h"
+#include <SDL_vulkan.h>
+#include <imgui_impl_vulkan.h>
+
+bool g_vulkan_hud = false;
+
+// Backend state. Only touched on the renderer thread, while the UI thread is
+// blocked in VulkanHudPresent.
+static bool g_backend_initialized = false;
+static bool g_fonts_dirty = true;
+static VkRenderPass g_render_pass = VK_NULL_HANDLE;
+static uint32_t g_min_image_count, g_image_count;
+
+static void ShutdownBackend()
+{
+    if (g_backend_initialized) {
+        ImGui_ImplVulkan_Shutdown();
+        g_backend_initialized = false;
+    }
+    g_fonts_dirty = true;
+}
+
+static void InitBackend(const NV2AVkPresentContext *ctx)
+{
+    ImGui_ImplVulkan_InitInfo info = {};
+    info.Instance = ctx->instance;
+    info.PhysicalDevice = ctx->physical_device;
+    info.Device = ctx->device;
+    info.QueueFamily = ctx->queue_family;
+    info.Queue = ctx->queue;
+    info.DescriptorPool = ctx->descriptor_pool;
+    info.RenderPass = ctx->render_pass;
+    info.MinImageCount = ctx->min_image_count;
+    info.ImageCount = MAX(ctx->image_count, ctx->min_image_count);
+    info.MSAASamples = VK_SAMPLE_COUNT_1_BIT;
+    ImGui_ImplVulkan_Init(&info);
+
+    g_backend_initialized = true;
+    g_fonts_dirty = true;
+    g_render_pass = ctx->render_pass;
+    g_min_image_count = ctx->min_image_count;
+    g_image_count = ctx->image_count;
+}
+
+// Called by the renderer to draw the HUD on top of the presented frame
+static void RenderOverlay(const NV2AVkPresentContext *ctx)
+{
+    if (ctx->command_buffer == VK_NULL_HANDLE) {
+        // Renderer is going away
+        ShutdownBackend();
+        return;
+    }
+
+    if (g_backend_initialized &&
+        (ctx->render_pass != g_render_pass ||
+         ctx->min_image_count != g_min_image_count ||
+         ctx->image_count != g_image_count)) {
+        ShutdownBackend();
+    }
+    if (!g_backend_initialized) {
+        InitBackend(ctx);
+    }
+
+    ImGuiIO &io = ImGui::GetIO();
+    ImTextureID old_font_id = io.Fonts->TexID;
+    if (g_fonts_dirty) {
+        ImGui_ImplVulkan_DestroyFontsTexture();
+        ImGui_ImplVulkan_CreateFontsTexture();
+        g_fonts_dirty = false;
+    }
+    ImTextureID font_id = io.Fonts->TexID;
+
+    ImDrawData *draw_data = ImGui::GetDrawData();
+    if (!draw_data) {
+        return;
+    }
+
+    // Other images are GL textures, which can't be sampled here, so they are
+    // left out. Draws recorded before the font texture was recreated are
+    // pointed at the new one.
+    for (ImDrawList *list : draw_data->CmdLists) {
+        for (ImDrawCmd &cmd : list->CmdBuffer) {
+            if (cmd.UserCallback) {
+                continue;
+            }
+            if (cmd.TextureId != font_id && cmd.TextureId != old_font_id) {
+                cmd.ElemCount = 0;
+            }
+            cmd.TextureId = font_id;
+        }
+    }
+
+    ImGui_ImplVulkan_RenderDrawData(draw_data, ctx->command_buffer);
+}
+
+void VulkanHudInvalidateFonts(void)
+{
+    // The atlas must be built before the next frame starts, its texture is
+    // uploaded by the renderer
+    ImGui::GetIO().Fonts->Build();
+    g_fonts_dirty = true;
+}
+
+bool VulkanHudPresent(SDL_Window *window, bool show_framebuffer)
+{
+    NV2APresentRequest req;
+    req.window = window;
+    SDL_Vulkan_GetDrawableSize(window, &req.width, &req.height);
+    req.show_framebuffer = show_framebuffer;
+    req.overlay = RenderOverlay;
+
+    return nv2a_present_frame(&req);
+}
@@ -37,9 +37,11 @@ void xemu_eject_disc(Error **errp);
 void xemu_load_disc(const char *path, Error **errp);
 
 // Implemented in xemu_hud.cc
-void xemu_hud_init(SDL_Window *window, void *sdl_gl_context);
+void xemu_hud_init(SDL_Window *window, void *sdl_gl_context,
+                   bool native_present);
 void xemu_hud_cleanup(void);
 void xemu_hud_render(void);
+bool xemu_hud_present(void);
 void xemu_hud_process_sdl_events(SDL_Event *event);
 void xemu_hud_should_capture_kbd_mouse(int *kbd, int *mouse);
 void xemu_hud_set_framebuffer_texture(GLuint tex, bool flip);
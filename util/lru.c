@@ -0,0 +1,263 @@
+/*
+ * LRU object list
+ *
+ * Copyright (c) 2021-2024 Matt Borgerson
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/lru.h"
+
+#define LRU_MIN_SLOTS 16
+
+static inline unsigned int lru_hash_to_slot(Lru *lru, uint64_t hash)
+{
+	return (hash ^ (hash >> 32)) & (lru->num_slots - 1);
+}
+
+static void lru_index_insert(Lru *lru, LruNode *node)
+{
+	unsigned int mask = lru->num_slots - 1;
+	unsigned int i = lru_hash_to_slot(lru, node->hash);
+
+	while (lru->slots[i].node) {
+		i = (i + 1) & mask;
+	}
+	lru->slots[i].hash = node->hash;
+	lru->slots[i].node = node;
+}
+
+/* Remove with backward shift, so probe sequences never contain holes. */
+static void lru_index_remove(Lru *lru, LruNode *node)
+{
+	unsigned int mask = lru->num_slots - 1;
+	unsigned int i = lru_hash_to_slot(lru, node->hash);
+
+	while (lru->slots[i].node != node) {
+		assert(lru->slots[i].node);
+		i = (i + 1) & mask;
+	}
+
+	unsigned int j = i;
+	for (;;) {
+		lru->slots[i].node = NULL;
+		for (;;) {
+			j = (j + 1) & mask;
+			if (!lru->slots[j].node) {
+				return;
+			}
+			unsigned int home = lru_hash_to_slot(lru, lru->slots[j].hash);
+			/* Move the entry back unless its home lies cyclically in (i, j] */
+			bool stays = (i <= j) ? (i < home && home <= j)
+			                      : (i < home || home <= j);
+			if (!stays) {
+				break;
+			}
+		}
+		lru->slots[i] = lru->slots[j];
+		i = j;
+	}
+}
+
+static void lru_index_resize(Lru *lru, unsigned int num_slots)
+{
+	g_free(lru->slots);
+	lru->slots = g_new0(LruSlot, num_slots);
+	lru->num_slots = num_slots;
+
+	for (unsigned int i = 0; i < lru->num_nodes; i++) {
+		if (lru->nodes[i]->in_use) {
+			lru_index_insert(lru, lru->nodes[i]);
+		}
+	}
+}
+
+void lru_init(Lru *lru)
+{
+	lru->nodes = NULL;
+	lru->num_nodes = 0;
+	lru->nodes_capacity = 0;
+	lru->hand = 0;
+	lru->free_nodes = NULL;
+	lru->slots = g_new0(LruSlot, LRU_MIN_SLOTS);
+	lru->num_slots = LRU_MIN_SLOTS;
+	lru->init_node = NULL;
+	lru->compare_nodes = NULL;
+	lru->pre_node_evict = NULL;
+	lru->post_node_evict = NULL;
+	lru->num_free = 0;
+	lru->num_used = 0;
+}
+
+void lru_destroy(Lru *lru)
+{
+	g_free(lru->nodes);
+	g_free(lru->free_nodes);
+	g_free(lru->slots);
+	lru->nodes = NULL;
+	lru->free_nodes = NULL;
+	lru->slots = NULL;
+	lru->num_nodes = lru->nodes_capacity = lru->num_slots = 0;
+}
+
+void lru_add_free(Lru *lru, LruNode *node)
+{
+	if (lru->num_nodes == lru->nodes_capacity) {
+		lru->nodes_capacity = MAX(lru->nodes_capacity * 2, LRU_MIN_SLOTS);
+		lru->nodes = g_renew(LruNode *, lru->nodes, lru->nodes_capacity);
+		lru->free_nodes =
+			g_renew(LruNode *, lru->free_nodes, lru->nodes_capacity);
+	}
+
+	node->index = lru->num_nodes;
+	node->in_use = false;
+	node->referenced = false;
+	lru->nodes[lru->num_nodes++] = node;
+	lru->free_nodes[lru->num_free++] = node;
+
+	if (lru->num_nodes * 2 > lru->num_slots) {
+		lru_index_resize(lru, lru->num_slots * 2);
+	}
+}
+
+void lru_evict_node(Lru *lru, LruNode *node)
+{
+	if (!lru_is_node_in_use(lru, node)) {
+		return;
+	}
+
+	lru_index_remove(lru, node);
+	node->in_use = false;
+	if (lru->post_node_evict) {
+		lru->post_node_evict(lru, node);
+	}
+
+	lru->num_used -= 1;
+	lru->free_nodes[lru->num_free++] = node;
+}
+
+LruNode *lru_try_evict_one(Lru *lru)
+{
+	/* Two sweeps clear every referenced flag along the way */
+	for (unsigned int n = 0; n < 2 * lru->num_nodes; n++) {
+		LruNode *node = lru->nodes[lru->hand];
+		lru->hand = (lru->hand + 1) % lru->num_nodes;
+
+		if (!node->in_use) {
+			continue;
+		}
+		if (node->referenced) {
+			node->referenced = false;
+			continue;
+		}
+		if (lru->pre_node_evict && !lru->pre_node_evict(lru, node)) {
+			continue;
+		}
+
+		lru_evict_node(lru, node);
+		return node;
+	}
+
+	return NULL;
+}
+
+LruNode *lru_evict_one(Lru *lru)
+{
+	LruNode *found = lru_try_evict_one(lru);
+
+	assert(found != NULL); /* No evictable node! */
+
+	return found;
+}
+
+static LruNode *lru_get_one_free(Lru *lru)
+{
+	if (!lru->num_free) {
+		lru_evict_one(lru);
+	}
+
+	return lru->free_nodes[--lru->num_free];
+}
+
+bool lru_contains_hash(Lru *lru, uint64_t hash)
+{
+	unsigned int mask = lru->num_slots - 1;
+
+	for (unsigned int i = lru_hash_to_slot(lru, hash); lru->slots[i].node;
+	     i = (i + 1) & mask) {
+		if (lru->slots[i].hash == hash) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+LruNode *lru_lookup(Lru *lru, uint64_t hash, const void *key)
+{
+	unsigned int mask = lru->num_slots - 1;
+
+	for (unsigned int i = lru_hash_to_slot(lru, hash); lru->slots[i].node;
+	     i = (i + 1) & mask) {
+		LruNode *iter = lru->slots[i].node;
+		if (lru->slots[i].hash == hash && !lru->compare_nodes(lru, iter, key)) {
+			iter->referenced = true;
+			return iter;
+		}
+	}
+
+	LruNode *found = lru_get_one_free(lru);
+	found->hash = hash;
+	if (lru->init_node) {
+		lru->init_node(lru, found, key);
+	}
+	assert(found->hash == hash);
+
+	found->in_use = true;
+	found->referenced = true;
+	lru_index_insert(lru, found);
+	lru->num_used += 1;
+
+	return found;
+}
+
+void lru_flush(Lru *lru)
+{
+	for (unsigned int i = 0; i < lru->num_nodes; i++) {
+		LruNode *node = lru->nodes[i];
+		if (!node->in_use) {
+			continue;
+		}
+		if (!lru->pre_node_evict || lru->pre_node_evict(lru, node)) {
+			lru_evict_node(lru, node);
+		}
+	}
+}
+
+void lru_visit_active(Lru *lru, LruNodeVisitorFunc visitor_func, void *opaque)
+{
+	for (unsigned int i = 0; i < lru->num_nodes; i++) {
+		LruNode *node = lru->nodes[i];
+		if (node->in_use) {
+			visitor_func(lru, node, opaque);
+		}
+	}
+}
@@ -1,7 +1,8 @@
 /*
  * xemu XBE accessing
  *
- * Helper functions to get details about the currently running executable.
+ * Helper functions to get details about the currently running executable,
+ * and about the executable on a disc image.
  *
  * Copyright (C) 2020-2021 Matt Borgerson
  *
@@ -27,6 +28,8 @@
 #include "system/hw_accel.h"
 #include "cpu.h"
 #include "exec/target_page.h"
+#include "qemu/bitmap.h"
+#include "qemu/units.h"
 
 static int virt_to_phys(vaddr vaddr, hwaddr *phys_addr)
 {
@@ -135,3 +138,207 @@ struct xbe *xemu_get_xbe_info(void)
 
     return &xbe;
 }
+
+#define XDVD_SECTOR_SIZE 2048
+#define XDVD_VOLUME_SECTOR 32
+#define XDVD_MAGIC "MICROSOFT*XBOX*MEDIA"
+#define XDVD_MAGIC_LEN 20
+#define XDVD_ATTR_DIRECTORY 0x10
+#define XDVD_MAX_DIR_SIZE (16 * MiB)
+
+#define XBE_MAX_HEADERS_SIZE (64 * KiB)
+#define XBE_ICON_SECTION_NAME "$$XTIMAGE"
+
+// Game partition offsets of plain XISO and full XGD1/2/3 images
+static const uint64_t xdvd_partition_offsets[] = {
+    0, 0x18300000, 0xfd90000, 0x2080000,
+};
+
+static bool read_at(FILE *f, uint64_t offset, void *buf, size_t len)
+{
+    return fseeko(f, offset, SEEK_SET) == 0 && fread(buf, 1, len, f) == len;
+}
+
+/*
+ * Find default.xbe in the root directory of the first XDVDFS volume found.
+ * Directory tables are binary trees of entries addressed by their offset in
+ * dwords from the start of the table.
+ */
+static bool find_default_xbe(FILE *f, uint64_t image_size,
+                             uint64_t *xbe_offset, uint32_t *xbe_size)
+{
+    for (int i = 0; i < ARRAY_SIZE(xdvd_partition_offsets); i++) {
+        uint64_t partition = xdvd_partition_offsets[i];
+        uint8_t volume[XDVD_SECTOR_SIZE];
+        uint64_t volume_offset =
+            partition + XDVD_VOLUME_SECTOR * XDVD_SECTOR_SIZE;
+        if (volume_offset + XDVD_SECTOR_SIZE > image_size ||
+            !read_at(f, volume_offset, volume, sizeof(volume)) ||
+            memcmp(volume, XDVD_MAGIC, XDVD_MAGIC_LEN) ||
+            memcmp(volume + 0x7ec, XDVD_MAGIC, XDVD_MAGIC_LEN)) {
+            continue;
+        }
+
+        uint64_t root = partition +
+                        (uint64_t)ldl_le_p(volume + 20) * XDVD_SECTOR_SIZE;
+        uint32_t root_size = ldl_le_p(volume + 24);
+        if (root_size == 0 || root_size > XDVD_MAX_DIR_SIZE ||
+            root + root_size > image_size) {
+            return false;
+        }
+
+        g_autofree uint8_t *table = g_malloc(root_size);
+        if (!read_at(f, root, table, root_size)) {
+            return false;
+        }
+
+        g_autofree unsigned long *visited = bitmap_new(root_size / 4 + 1);
+        g_autoptr(GArray) pending = g_array_new(false, false, sizeof(uint32_t));
+        uint32_t offset = 0;
+        g_array_append_val(pending, offset);
+
+        while (pending->len) {
+            offset = g_array_index(pending, uint32_t, pending->len - 1);
+            g_array_set_size(pending, pending->len - 1);
+            if (offset + 14 > root_size || test_and_set_bit(offset / 4, visited)) {
+                continue;
+            }
+
+            const uint8_t *e = table + offset;
+            uint16_t left = lduw_le_p(e);
+            uint16_t right = lduw_le_p(e + 2);
+            if (left == 0xffff) {
+                // Sector padding
+                continue;
+            }
+
+            uint8_t name_len = e[13];
+            if (!(e[12] & XDVD_ATTR_DIRECTORY) &&
+                name_len == strlen("default.xbe") &&
+                offset + 14 + name_len <= root_size &&
+                !g_ascii_strncasecmp((const char *)e + 14, "default.xbe",
+                                     name_len)) {
+                *xbe_offset = partition +
+                              (uint64_t)ldl_le_p(e + 4) * XDVD_SECTOR_SIZE;
+                *xbe_size = ldl_le_p(e + 8);
+                return *xbe_offset + *xbe_size <= image_size;
+            }
+
+            if (left) {
+                uint32_t child = left * 4;
+                g_array_append_val(pending, child);
+            }
+            if (right) {
+                uint32_t child = right * 4;
+                g_array_append_val(pending, child);
+            }
+        }
+        return false;
+    }
+
+    return false;
+}
+
+static bool read_xbe_info(FILE *f, uint64_t xbe_offset, uint32_t xbe_size,
+                          struct xbe_disc_info *info)
+{
+    struct xbe_header hdr;
+    if (xbe_size < sizeof(hdr) || !read_at(f, xbe_offset, &hdr, sizeof(hdr)) ||
+        ldl_le_p(&hdr.m_magic) != 0x48454258) {
+        return false;
+    }
+
+    uint32_t base = ldl_le_p(&hdr.m_base);
+    uint32_t headers_len = ldl_le_p(&hdr.m_sizeof_headers);
+    if (headers_len < sizeof(hdr) || headers_len > XBE_MAX_HEADERS_SIZE ||
+        headers_len > xbe_size) {
+        return false;
+    }
+
+    g_autofree uint8_t *headers = g_malloc(headers_len);
+    if (!read_at(f, xbe_offset, headers, headers_len)) {
+        return false;
+    }
+
+    uint32_t cert_addr = ldl_le_p(&hdr.m_certificate_addr);
+    if (cert_addr < base || (uint64_t)cert_addr - base +
+                                    sizeof(struct xbe_certificate) >
+                                headers_len) {
+        return false;
+    }
+    const struct xbe_certificate *cert =
+        (const struct xbe_certificate *)(headers + cert_addr - base);
+
+    info->title_id = ldl_le_p(&cert->m_titleid);
+
+    gunichar2 title_name[ARRAY_SIZE(cert->m_title_name)];
+    for (int i = 0; i < ARRAY_SIZE(title_name); i++) {
+        title_name[i] = lduw_le_p(&cert->m_title_name[i]);
+    }
+    info->title_name = g_utf16_to_utf8(title_name, ARRAY_SIZE(title_name),
+                                       NULL, NULL, NULL);
+    if (info->title_name && !info->title_name[0]) {
+        g_free(info->title_name);
+        info->title_name = NULL;
+    }
+
+    // Locate the title image so it can be shown without running the title
+    uint32_t num_sections = ldl_le_p(&hdr.m_sections);
+    uint32_t sections_addr = ldl_le_p(&hdr.m_section_headers_addr);
+    const size_t section_size = sizeof(struct xbe_section_header);
+    if (sections_addr < base || (uint64_t)sections_addr - base +
+                                        (uint64_t)num_sections * section_size >
+                                    headers_len) {
+        return true;
+    }
+    for (uint32_t i = 0; i < num_sections; i++) {
+        const struct xbe_section_header *section =
+            (const struct xbe_section_header *)(headers + sections_addr -
+                                                base + i * section_size);
+        uint32_t name_addr = ldl_le_p(&section->m_section_name_addr);
+        if (name_addr < base || (uint64_t)name_addr - base +
+                                    sizeof(XBE_ICON_SECTION_NAME) >
+                                headers_len) {
+            continue;
+        }
+        if (!memcmp(headers + name_addr - base, XBE_ICON_SECTION_NAME,
+                    sizeof(XBE_ICON_SECTION_NAME))) {
+            uint32_t raw_addr = ldl_le_p(&section->m_raw_addr);
+            uint32_t raw_size = ldl_le_p(&section->m_sizeof_raw);
+            if ((uint64_t)raw_addr + raw_size <= xbe_size) {
+                info->icon_offset = xbe_offset + raw_addr;
+                info->icon_size = raw_size;
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool xemu_get_disc_xbe_info(const char *path, struct xbe_disc_info *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    if (!path || !*path) {
+        return false;
+    }
+
+    FILE *f = qemu_fopen(path, "rb");
+    if (!f) {
+        return false;
+    }
+
+    bool ok = false;
+    uint64_t xbe_offset;
+    uint32_t xbe_size;
+    if (fseeko(f, 0, SEEK_END) == 0) {
+        off_t image_size = ftello(f);
+        ok = image_size > 0 &&
+             find_default_xbe(f, image_size, &xbe_offset, &xbe_size) &&
+             read_xbe_info(f, xbe_offset, xbe_size, info);
+    }
+
+    fclose(f);
+    return ok;
+}
@@ -1,7 +1,8 @@
 /*
  * xemu XBE accessing
  *
- * Helper functions to get details about the currently running executable.
+ * Helper functions to get details about the currently running executable,
+ * and about the executable on a disc image.
  *
  * Copyright (C) 2020-2021 Matt Borgerson
  *
@@ -22,6 +23,7 @@
 #ifndef XEMU_XBE_H
 #define XEMU_XBE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 // http://www.caustik.com/cxbx/download/xbe.htm
@@ -73,6 +75,24 @@ struct xbe_header
     uint32_t m_logo_bitmap_size;              // logo bitmap size
 };
 
+struct xbe_section_header
+{
+    uint32_t m_flags;                         // section flags (XBE_SECTION_*)
+    uint32_t m_virtual_addr;                  // virtual address
+    uint32_t m_virtual_size;                  // virtual size
+    uint32_t m_raw_addr;                      // file offset to raw data
+    uint32_t m_sizeof_raw;                    // size of raw data
+    uint32_t m_section_name_addr;             // section name address
+    uint32_t m_section_reference_count;       // section reference count
+    uint32_t m_head_shared_ref_count_addr;    // head shared page reference count address
+    uint32_t m_tail_shared_ref_count_addr;    // tail shared page reference count address
+    uint8_t  m_section_digest[20];            // section digest
+};
+
+#define XBE_SECTION_WRITABLE   (1 << 0)
+#define XBE_SECTION_PRELOAD    (1 << 1)
+#define XBE_SECTION_EXECUTABLE (1 << 2)
+
 struct xbe_certificate
 {
     uint32_t m_size;                          // size of certificate
@@ -108,6 +128,17 @@ extern "C" {
 // Get current XBE info
 struct xbe *xemu_get_xbe_info(void);
 
+struct xbe_disc_info {
+    uint32_t title_id;
+    char *title_name;     // UTF-8, NULL if empty; free with g_free
+    uint64_t icon_offset; // Image offset of the $$XTIMAGE section, or 0
+    uint32_t icon_size;
+};
+
+// Read details of default.xbe from an uncompressed disc image, without
+// mounting it. Returns false if the image has no readable default.xbe.
+bool xemu_get_disc_xbe_info(const char *path, struct xbe_disc_info *info);
+
 #ifdef __cplusplus
 }
 #endif